@@ -0,0 +1,178 @@
+#!/bin/sh
+#
+# benchmarks of the core tools of imscript
+#
+# usage: (from the top directory, "make bench" runs it with bin/ in the PATH)
+#
+# 	sh bench/run.sh > results.tsv
+#
+# The inputs are synthetic and deterministic (random images of plambda, with
+# its fixed default seed), at the sizes given by BENCH_SIZES.  Each case is
+# run BENCH_REPEAT times and the fastest run is kept.  The times include the
+# start of the process and the decoding and encoding of the images, as when
+# the tools are chained in a shell pipeline.
+#
+# The output has one line per case, separated by tabs:
+#
+# 	tool  case  size  seconds  Mpx/s  MB/s
+#
+# where "size" is the side of the (square) input image, Mpx/s counts its
+# pixels, and MB/s its float samples (or the size of the file, for the
+# cases of file formats).  The tools that are not in the PATH (e.g., blur
+# without fftw) are skipped.
+#
+# environment:
+# 	BENCH_SIZES   sides of the images (default "512 2048")
+# 	BENCH_REPEAT  number of runs of each case (default 3)
+# 	BENCH_DIR     directory of the temporary files (default: mktemp -d)
+
+set -e
+
+SIZES=${BENCH_SIZES:-512 2048}
+REPEAT=${BENCH_REPEAT:-3}
+
+if [ "`date +%N`" = "N" ] || [ -z "`date +%N`" ]; then
+	echo "bench: needs a date(1) with nanoseconds (%N)" >&2
+	exit 1
+fi
+
+if [ -z "$BENCH_DIR" ]; then
+	BENCH_DIR=`mktemp -d`
+	trap 'rm -rf "$BENCH_DIR"' EXIT
+fi
+T=$BENCH_DIR
+
+have() { command -v "$1" > /dev/null 2>&1; }
+
+# run the command "$@" REPEAT times and print the fastest time, in seconds
+timeit() {
+	best=
+	i=0
+	while [ $i -lt $REPEAT ]; do
+		t0=`date +%s%N`
+		"$@" > /dev/null 2>&1 || { echo "bench: failed: $*" >&2; exit 1; }
+		t1=`date +%s%N`
+		t=`expr $t1 - $t0`
+		if [ -z "$best" ] || [ $t -lt $best ]; then best=$t; fi
+		i=`expr $i + 1`
+	done
+	echo $best
+}
+
+# report: tool case size nanoseconds pixels bytes
+report() {
+	awk -v t="$1" -v c="$2" -v s="$3" -v ns="$4" -v px="$5" -v b="$6" \
+	'BEGIN { sec = ns / 1e9; if (sec <= 0) sec = 1e-9;
+	printf "%s\t%s\t%d\t%.6f\t%.3f\t%.3f\n",
+		t, c, s, sec, px / sec / 1e6, b / sec / 1048576 }'
+}
+
+# bench tool case size pixels bytes command...
+bench() {
+	tool=$1; case=$2; size=$3; px=$4; bytes=$5
+	shift 5
+	have $tool || return 0
+	report $tool "$case" $size `timeit "$@"` $px $bytes
+}
+
+filesize() { wc -c < "$1" | tr -d ' '; }
+
+printf "# tool\tcase\tsize\tseconds\tMpx/s\tMB/s\n"
+
+for n in $SIZES; do
+	# inputs
+	X=$T/x$n.tif     # gray, float
+	C=$T/c$n.tif     # color, float
+	plambda zero:${n}x$n "randg" -o $X
+	plambda zero:${n}x$n "randu randu randu join join 255 *" -o $C
+	px=`expr $n \* $n`
+	b1=`expr $px \* 4`
+	b3=`expr $px \* 12`
+
+	# plambda
+	bench plambda "x 3 *"          $n $px $b1 plambda $X "x 3 *" -o $T/o.tif
+	bench plambda "x sin x cos *"  $n $px $b1 plambda $X "x sin x cos *" -o $T/o.tif
+	bench plambda "gradient hypot" $n $px $b1 plambda $X "x(1,0) x(-1,0) - x(0,1) x(0,-1) - hypot" -o $T/o.tif
+	bench plambda "color rgb2hsv"  $n $px $b3 plambda $C "x rgb2hsv" -o $T/o.tif
+	bench plambda "x y +"          $n $px $b1 plambda $X $X "x y +" -o $T/o.tif
+
+	# blur
+	bench blur "gaussian 2"        $n $px $b1 blur g 2 $X $T/o.tif
+	bench blur "gaussian 20"       $n $px $b1 blur g 20 $X $T/o.tif
+	bench blur "square 5"          $n $px $b1 blur s 5 $X $T/o.tif
+	bench blur "cauchy 3 (fft)"    $n $px $b1 blur c 3 $X $T/o.tif
+
+	# morsi
+	bench morsi "square erosion"   $n $px $b1 morsi square erosion $X $T/o.tif
+	bench morsi "disk5 median"     $n $px $b1 morsi disk5 median $X $T/o.tif
+	bench morsi "disk5 opening"    $n $px $b1 morsi disk5 opening $X $T/o.tif
+
+	# downsa, upsa
+	bench downsa "v 2"             $n $px $b1 downsa v 2 $X $T/o.tif
+	bench downsa "i 4"             $n $px $b1 downsa i 4 $X $T/o.tif
+	bench upsa "2 bilinear"        $n $px $b1 upsa 2 2 $X $T/o.tif
+	bench upsa "2 bicubic"         $n $px $b1 upsa 2 3 $X $T/o.tif
+
+	# homwarp
+	H="1.01 0.05 3 -0.03 0.99 2 0.00001 0.00002 1"
+	bench homwarp "bilinear"       $n $px $b3 homwarp -o 2 "$H" $n $n $C $T/o.tif
+	bench homwarp "bicubic"        $n $px $b3 homwarp -o -3 "$H" $n $n $C $T/o.tif
+
+	# file formats: writing (from float tiff) and reading
+	for f in tif png jpg pgm npy; do
+		have iion || break
+		S=$C
+		[ $f = pgm ] && S=$X
+		iion $S $T/f.$f
+		fb=`filesize $T/f.$f`
+		bench iion "write $f"  $n $px $fb iion $S $T/f.$f
+		bench imprintf "read $f" $n $px $fb imprintf "%v" $T/f.$f
+	done
+
+	# random access to a tiled tiff by fancy_image (crops of 128x128)
+	if have fancy_crop && [ $n -ge 256 ]; then
+		iion $C $T/tiled.tif,tiled=128
+		crops() {
+			k=0; s=12345
+			while [ $k -lt 32 ]; do
+				s=`expr \( $s \* 1103515245 + 12345 \) % 2147483648`
+				x=`expr $s % \( $n - 128 \)`
+				y=`expr \( $s / 4096 \) % \( $n - 128 \)`
+				fancy_crop $x $y 128 128 $T/tiled.tif $T/crop.tif
+				k=`expr $k + 1`
+			done
+		}
+		cpx=`expr 32 \* 128 \* 128`
+		report fancy_crop "32 random crops" $n `timeit crops` \
+			$cpx `expr $cpx \* 12`
+	fi
+done
+
+# ransac (lines with 30% of outliers), on BENCH_SIZES points
+for n in $SIZES; do
+	have ransac || break
+	plambda zero:2x$n ":i 0 = :j randu 0.3 < randu 1000 * :j 2 * 3 + randg 0.5 * + if if" \
+		-o $T/line.txt
+	report ransac "line, 30% outliers" $n \
+		`timeit sh -c "ransac line 1000 1 10 $T/m.txt < $T/line.txt"` \
+		$n `filesize $T/line.txt`
+done
+
+# sift matching (random descriptors, the second set is a perturbation)
+for n in $SIZES; do
+	have siftu || break
+	k=`expr $n / 2`
+	plambda zero:132x$k "randu 255 * floor" -o $T/k1.txt
+	plambda $T/k1.txt "x 2 - randu 5 * floor + 0 fmax 255 fmin" -o $T/k2.txt
+	report siftu "pair $k x $k" $k `timeit siftu pair 100 $T/k1.txt $T/k2.txt $T/p.txt` \
+		`expr $k \* $k` `expr 2 \* $k \* 132 \* 4`
+done
+
+# priority queues of abstract_heap.h (a propagation on a grid of side n)
+for n in $SIZES; do
+	have heapbench || break
+	px=`expr $n \* $n`
+	for q in binary 4ary radix; do
+		report heapbench "$q heap" $n `timeit heapbench $q $n` $px 0
+	done
+done
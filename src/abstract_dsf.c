@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdbool.h>
 
 // API
 void adsf_assert_consistency(int *t, int n)
@@ -50,6 +51,41 @@ int adsf_union(int *t, int n, int a, int b)
 	return b;
 }
 
+// API
+// find, without path compression, that can be called from several threads
+// at the same time as "adsf_union_atomic"
+int adsf_find_atomic(int *t, int n, int a)
+{
+	assert(a >= 0 && a < n);
+	int p;
+	while ((p = __atomic_load_n(t + a, __ATOMIC_RELAXED)) != a)
+		a = p;
+	return a;
+}
+
+// API
+// lock-free union, that can be called from several threads at once
+// (the larger root is always linked to the smaller one, as in "adsf_union",
+// so the representative of each class is its smallest element, whatever the
+// order of the unions)
+int adsf_union_atomic(int *t, int n, int a, int b)
+{
+	assert(a >= 0 && a < n);
+	assert(b >= 0 && b < n);
+	while (1)
+	{
+		a = adsf_find_atomic(t, n, a);
+		b = adsf_find_atomic(t, n, b);
+		if (a == b)
+			return a;
+		if (a < b) { int tmp = a; a = b; b = tmp; }
+		int e = a; // link a to b, if a is still a root
+		if (__atomic_compare_exchange_n(t + a, &e, b, false,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return b;
+	}
+}
+
 // API
 //int adsf_number_of_classes(int *t, int n)
 //{
@@ -8,7 +8,9 @@
 #ifndef assert
 #include <assert.h>
 #endif
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 // Note that HEAP_ENERGY can be a sequence of expressions, e.g., such as
 // "assert(i>=0&&i<LENGTH(h)),h[i]".  It MUST NOT be enclosed on parentheses.
@@ -76,11 +78,72 @@
 // operator to change its lvalue is NOT considered elegant).
 //
 //
+// Variants, with the same interface, selected by defining these macros
+// (they are read when the heap macros are expanded, so different functions
+// of the same file may use different variants):
+//
+// #define HEAP_ARITY 4	// d-ary heap (default 2), shallower and more cache
+// 			// friendly, for large heaps
+//
+// #define HEAP_RADIX 1	// radix heap, for monotone energies: the values
+// 			// added or changed are never smaller than the last
+// 			// top removed (e.g., front propagations, or Dijkstra).
+// 			// The energies must be non-negative (their bits in
+// 			// single precision are compared as integers, so that
+// 			// the energies that round to the same float are tied).
+// 			// Only for low-energy heaps.
+//
+// The radix heap keeps the array partitioned into 33 buckets: the bucket 0
+// has the energies equal to the last removed top, and the bucket b the
+// energies whose highest bit that differs from it is b-1.  The elements only
+// move down through the buckets (unless their energy is increased), so that
+// the amortized cost of the operations is bounded by the number of buckets.  Its state is in HEAP_RADIX_STATE(h), a pointer to a "struct
+// heap_radix" (by default a static variable, so there is only one such heap
+// at a time).  Energies smaller than the last top (e.g., due to rounding)
+// are accepted, and they are treated as equal to it.
+
+#ifndef HEAP_ARITY
+#define HEAP_ARITY 2
+#endif
+
+#ifndef HEAP_RADIX
+#define HEAP_RADIX 0
+#endif
+
+#define HEAP_RADIX_NB 33 // number of buckets of the radix heap
+
+struct heap_radix {
+	double last;             // last top removed
+	int s[HEAP_RADIX_NB+1];  // bucket b is [s[b], s[b+1]), s[33] = n
+};
+
+#ifndef HEAP_RADIX_STATE
+static struct heap_radix heap_radix_state;
+#define HEAP_RADIX_STATE(h) (&heap_radix_state)
+#endif
+
+// bucket of the energy x for the given last top (internal)
+static inline int heap_radix_bucket(double last, double x)
+{
+	float fl = last, fx = x;
+	if (!(fx > fl)) return 0;
+	uint32_t a, b;
+	memcpy(&a, &fl, sizeof a);
+	memcpy(&b, &fx, sizeof b);
+	a ^= b;
+#ifdef __GNUC__
+	return 32 - __builtin_clz(a);
+#else
+	int r = 0;
+	while (a) { a >>= 1; r += 1; }
+	return r;
+#endif
+}
 
 // these three functions are only intended for internal use
-#define HEAP_PARENT(x) (((x)-1)/2)
-#define HEAP_LEFT(x) (2*(x)+1)
-#define HEAP_RIGHT(x) (2*((x)+1))
+#define HEAP_PARENT(x) (((x)-1)/HEAP_ARITY)
+#define HEAP_LEFT(x) (HEAP_ARITY*(x)+1)
+#define HEAP_RIGHT(x) (HEAP_ARITY*(x)+2)
 
 // assert the heap condition
 #define HEAP_ASSERT(h,n) do{\
@@ -105,6 +168,17 @@
 
 // USER-VISIBLE FUNCTION: build a heap out of an arbitrary array
 #define HEAP_BUILD(h,n) do{\
+	if (HEAP_RADIX) {\
+		struct heap_radix *_R_bu = HEAP_RADIX_STATE(h);\
+		_R_bu->s[HEAP_RADIX_NB] = (n);\
+		if (!(n)) break;\
+		_R_bu->last = (HEAP_ENERGY(h,0));\
+		for (int _i_bu = 1; _i_bu < (n); _i_bu++)\
+			if ((HEAP_ENERGY(h,_i_bu)) < _R_bu->last)\
+				_R_bu->last = (HEAP_ENERGY(h,_i_bu));\
+		HEAP_RADIX_DISTRIBUTE(h, _R_bu, HEAP_RADIX_NB);\
+		break;\
+	}\
 	int _i_bu = 0;\
 	while(_i_bu < (n))\
 	{\
@@ -120,20 +194,103 @@
 		((HEAP_ENERGY(h,HEAP_LEFT(i_bo)))CMPEQ (HEAP_ENERGY(h,i_bo))&&(HEAP_ENERGY(h,HEAP_LEFT(i_bo)))CMPEQ (HEAP_ENERGY(h,HEAP_RIGHT(i_bo))))?(HEAP_LEFT(i_bo)):(\
 		((HEAP_ENERGY(h,HEAP_RIGHT(i_bo)))CMPEQ (HEAP_ENERGY(h,HEAP_LEFT(i_bo)))&&(HEAP_ENERGY(h,HEAP_RIGHT(i_bo)))CMPEQ (HEAP_ENERGY(h,i_bo)))?(HEAP_RIGHT(i_bo)):-1))))
 
+// internal function, (best of a node and its children, for HEAP_ARITY > 2)
+#define HEAP_BOD(h,n,i_bo,j_bo) do{\
+	j_bo = i_bo;\
+	for (int _c_bo = HEAP_LEFT(i_bo); _c_bo < (n) &&\
+			_c_bo <= HEAP_ARITY*(i_bo) + HEAP_ARITY; _c_bo++)\
+		if ((HEAP_ENERGY(h,_c_bo)) CMPIN (HEAP_ENERGY(h,j_bo)))\
+			j_bo = _c_bo;\
+}while(0)
+
 // internal function
 #define HEAP_FIXDOWN(h,n,i_fd) do{\
 	int _j_fd;\
 	int _i_fdl = i_fd;\
-	while((_j_fd=HEAP_BOT(h,n,_i_fdl)) != _i_fdl)\
+	while(1)\
 	{\
+		if (HEAP_ARITY == 2) _j_fd = HEAP_BOT(h,n,_i_fdl);\
+		else HEAP_BOD(h,n,_i_fdl,_j_fd);\
+		if (_j_fd == _i_fdl) break;\
 		HEAP_SWAP(h, _i_fdl, _j_fd);\
 		_i_fdl = _j_fd;\
 	}\
 }while(0)
 
+// internal functions of the radix heap:
+
+// move the element at i_mv from the bucket a_mv down to the bucket b_mv,
+// by swapping it with the first element of each bucket in between
+#define HEAP_RADIX_DOWN(h,R,i_mv,a_mv,b_mv) do{\
+	int _p_mv = i_mv;\
+	for (int _b_mv = a_mv; _b_mv > (b_mv); _b_mv--)\
+	{\
+		int _q_mv = (R)->s[_b_mv];\
+		if (_q_mv != _p_mv) HEAP_SWAP(h, _q_mv, _p_mv);\
+		_p_mv = _q_mv;\
+		(R)->s[_b_mv] += 1;\
+	}\
+}while(0)
+
+// move the element at i_mv from the bucket a_mv up to the bucket b_mv
+// (b_mv = HEAP_RADIX_NB takes it out, at the end of the array)
+#define HEAP_RADIX_UP(h,R,i_mv,a_mv,b_mv) do{\
+	int _p_mv = i_mv;\
+	for (int _b_mv = (a_mv) + 1; _b_mv <= (b_mv); _b_mv++)\
+	{\
+		int _q_mv = (R)->s[_b_mv] - 1;\
+		if (_q_mv != _p_mv) HEAP_SWAP(h, _q_mv, _p_mv);\
+		_p_mv = _q_mv;\
+		(R)->s[_b_mv] -= 1;\
+	}\
+}while(0)
+
+// distribute the elements [0, s[nb_di]) into the buckets 0..nb_di-1
+// (in-place, by cycles of swaps; they must all belong to these buckets)
+#define HEAP_RADIX_DISTRIBUTE(h,R,nb_di) do{\
+	int _c_di[HEAP_RADIX_NB+1] = {0}, _e_di = (R)->s[nb_di];\
+	for (int _i_di = 0; _i_di < _e_di; _i_di++)\
+		_c_di[heap_radix_bucket((R)->last,(HEAP_ENERGY(h,_i_di)))] += 1;\
+	(R)->s[0] = 0;\
+	for (int _b_di = 0; _b_di < (nb_di); _b_di++)\
+		(R)->s[_b_di+1] = (R)->s[_b_di] + _c_di[_b_di];\
+	for (int _b_di = 0; _b_di < (nb_di); _b_di++)\
+		_c_di[_b_di] = (R)->s[_b_di];\
+	for (int _b_di = 0; _b_di < (nb_di); _b_di++)\
+		while (_c_di[_b_di] < (R)->s[_b_di+1])\
+		{\
+			int _t_di = heap_radix_bucket((R)->last,\
+					(HEAP_ENERGY(h,_c_di[_b_di])));\
+			if (_t_di != _b_di)\
+				HEAP_SWAP(h, _c_di[_b_di], _c_di[_t_di]);\
+			_c_di[_t_di] += 1;\
+		}\
+}while(0)
+
+// if the bucket 0 is empty, refill it from the first non-empty bucket
+// (whose minimum becomes the last top)
+#define HEAP_RADIX_NORMALIZE(h,R) do{\
+	if ((R)->s[1] > 0 || (R)->s[HEAP_RADIX_NB] == 0) break;\
+	int _b_no = 1;\
+	while ((R)->s[_b_no+1] == 0) _b_no += 1;\
+	double _m_no = (HEAP_ENERGY(h,0));\
+	for (int _i_no = 1; _i_no < (R)->s[_b_no+1]; _i_no++)\
+		if ((HEAP_ENERGY(h,_i_no)) < _m_no)\
+			_m_no = (HEAP_ENERGY(h,_i_no));\
+	(R)->last = _m_no;\
+	(R)->s[_b_no] = (R)->s[_b_no+1];\
+	HEAP_RADIX_DISTRIBUTE(h,R,_b_no);\
+}while(0)
+
 // USER-VISIBLE FUNCTION:
 // (n has to be decreased manually by the user afterwards)
 #define HEAP_REMOVE_TOP(h,n) do{\
+	if (HEAP_RADIX) {\
+		struct heap_radix *_R_rt = HEAP_RADIX_STATE(h);\
+		HEAP_RADIX_UP(h, _R_rt, 0, 0, HEAP_RADIX_NB);\
+		HEAP_RADIX_NORMALIZE(h, _R_rt);\
+		break;\
+	}\
 	HEAP_SWAP(h, 0, (n) - 1);\
 	HEAP_FIXDOWN(h, (n) - 1, 0);\
 }while(0)
@@ -143,6 +300,20 @@
 // "k" is the location of the new element
 // (so the heap gets to have "k+1" elements)
 #define HEAP_ADD(h,k) do{\
+	if (HEAP_RADIX) {\
+		struct heap_radix *_R_ad = HEAP_RADIX_STATE(h);\
+		int _k_ad = k;\
+		double _e_ad = (HEAP_ENERGY(h, _k_ad));\
+		if (!_k_ad) {\
+			_R_ad->last = _e_ad;\
+			for (int _b_ad = 0; _b_ad <= HEAP_RADIX_NB; _b_ad++)\
+				_R_ad->s[_b_ad] = 0;\
+		}\
+		_R_ad->s[HEAP_RADIX_NB] = _k_ad;\
+		HEAP_RADIX_DOWN(h, _R_ad, _k_ad, HEAP_RADIX_NB,\
+				heap_radix_bucket(_R_ad->last, _e_ad));\
+		break;\
+	}\
 	HEAP_FIXUP(h, k+1, k);\
 }while(0)
 
@@ -152,8 +323,12 @@
 	HEAP_BUILD(h, _n_so);\
 	while(_n_so > 1)\
 	{\
-		HEAP_SWAP(h, 0, _n_so - 1);\
-		HEAP_FIXDOWN(h, _n_so - 1, 0);\
+		if (HEAP_RADIX)\
+			HEAP_REMOVE_TOP(h, _n_so);\
+		else {\
+			HEAP_SWAP(h, 0, _n_so - 1);\
+			HEAP_FIXDOWN(h, _n_so - 1, 0);\
+		}\
 		_n_so -= 1;\
 	}\
 }while(0)
@@ -161,6 +336,21 @@
 // USER-VISIBLE FUNCTION: update the energy of an element
 #define HEAP_CHANGE_ENERGY(h,n,i_ce,E) do{\
 	double _oE_ce = (HEAP_ENERGY(h, i_ce));\
+	if (HEAP_RADIX) {\
+		struct heap_radix *_R_ce = HEAP_RADIX_STATE(h);\
+		int _i_ce = i_ce;\
+		int _a_ce = heap_radix_bucket(_R_ce->last, _oE_ce);\
+		HEAP_ENERGY(h, _i_ce) = E;\
+		int _b_ce = heap_radix_bucket(_R_ce->last,\
+				(HEAP_ENERGY(h, _i_ce)));\
+		if (_b_ce < _a_ce)\
+			HEAP_RADIX_DOWN(h, _R_ce, _i_ce, _a_ce, _b_ce);\
+		if (_b_ce > _a_ce) {\
+			HEAP_RADIX_UP(h, _R_ce, _i_ce, _a_ce, _b_ce);\
+			HEAP_RADIX_NORMALIZE(h, _R_ce);\
+		}\
+		break;\
+	}\
 	HEAP_ENERGY(h, i_ce) = E;\
 	if (_oE_ce CMPIN E)\
 		HEAP_FIXDOWN(h, n, i_ce);\
@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 
@@ -8,26 +9,35 @@
 
 #include "fail.c"
 #include "xmalloc.c"
+#include "multicolor.c"
 #include "smapa.h"
 
 SMART_PARAMETER(AMLE_NN,4)
 
+static int amle_neighbors[][3] = { // {x, y, x*x+y*y}
+	{+1,0,1}, {0,+1,1}, {-1,0,1}, {0,-1,1}, // 4-connexity
+	{+1,+1,2}, {-1,-1,2}, // 6-connexity
+	{-1,+1,2}, {+1,-1,2}, // 8-connexity
+	{+2,+1,5}, {+1,+2,5}, {+2,-1,5}, {+1,-2,5},
+	{-2,-1,5}, {-1,-2,5}, {-2,+1,5}, {-1,+2,5}, // 16-neighbors
+	{+3,+1,10}, {+1,+3,10}, {+3,-1,10}, {+1,-3,10},
+	{-3,-1,10}, {-1,-3,10}, {-3,+1,10}, {-1,+3,10}, // 24-neighbors
+	{+3,+2,13}, {+2,+3,13}, {+3,-2,13}, {+2,-3,13},
+	{-3,-2,13}, {-2,-3,13}, {-3,+2,13}, {-2,+3,13}, // 32-neighbors
+	//{+2,0,4}, {0,+2,4}, {-2,0,4}, {0,-2,4}, (non-primitive)
+	//{+4,0,16}, {0,+4,16}, {-4,0,16}, {0,-4,16} (non-primitive)
+};
+
+static int amle_nn(void)
+{
+	int nn = AMLE_NN(), nmax = sizeof amle_neighbors / sizeof*amle_neighbors;
+	return nn < nmax ? nn : nmax;
+}
+
 static int get_nvals(float *v, float *wv2, float *x, int w, int h, int i, int j)
 {
-	int r = 0, n[][3] = { // {x, y, x*x+y*y}
-		{+1,0,1}, {0,+1,1}, {-1,0,1}, {0,-1,1}, // 4-connexity
-		{+1,+1,2}, {-1,-1,2}, // 6-connexity
-		{-1,+1,2}, {+1,-1,2}, // 8-connexity
-		{+2,+1,5}, {+1,+2,5}, {+2,-1,5}, {+1,-2,5},
-		{-2,-1,5}, {-1,-2,5}, {-2,+1,5}, {-1,+2,5}, // 16-neighbors
-		{+3,+1,10}, {+1,+3,10}, {+3,-1,10}, {+1,-3,10},
-		{-3,-1,10}, {-1,-3,10}, {-3,+1,10}, {-1,+3,10}, // 24-neighbors
-		{+3,+2,13}, {+2,+3,13}, {+3,-2,13}, {+2,-3,13},
-		{-3,-2,13}, {-2,-3,13}, {-3,+2,13}, {-2,+3,13}, // 32-neighbors
-		//{+2,0,4}, {0,+2,4}, {-2,0,4}, {0,-2,4}, (non-primitive)
-		//{+4,0,16}, {0,+4,16}, {-4,0,16}, {0,-4,16} (non-primitive)
-	};
-	int nn = AMLE_NN();
+	int r = 0, (*n)[3] = amle_neighbors;
+	int nn = amle_nn();
 	for (int p = 0; p < nn; p++)
 	{
 		int ii = i + n[p][0];
@@ -43,6 +53,27 @@ static int get_nvals(float *v, float *wv2, float *x, int w, int h, int i, int j)
 	return r;
 }
 
+// like get_nvals, for an image of pd interleaved channels
+static int get_nvals_vec(float *v, float *wv2, float *x, int w, int h, int pd,
+		int i, int j)
+{
+	int r = 0, (*n)[3] = amle_neighbors;
+	int nn = amle_nn();
+	for (int p = 0; p < nn; p++)
+	{
+		int ii = i + n[p][0];
+		int jj = j + n[p][1];
+		if (ii >= 0 && jj >= 0 && ii < w && jj < h)
+		{
+			for (int l = 0; l < pd; l++)
+				v[r*pd+l] = x[(w*jj+ii)*pd+l];
+			wv2[r] = n[p][2];
+			r += 1;
+		}
+	}
+	return r;
+}
+
 static void get_minmax(float *min, float *max, float *x, int n)
 {
 	*min = INFINITY;
@@ -64,24 +95,74 @@ static void get_minmax_idx(int *min, int *max, float *x, int n)
 	}
 }
 
-static float amle_iteration(float *x, int w, int h, int (*mask)[2], int nmask)
+// the two farthest values among the n vectors v[0..n-1] of dimension pd
+// (for pd=1, these are the minimum and the maximum)
+static void get_farthest_pair_idx(int *a, int *b, float *v, int n, int pd)
+{
+	float best = -1;
+	*a = *b = 0;
+	for (int p = 0; p < n; p++)
+	for (int q = p + 1; q < n; q++)
+	{
+		float d = 0;
+		for (int l = 0; l < pd; l++)
+			d += (v[p*pd+l] - v[q*pd+l]) * (v[p*pd+l] - v[q*pd+l]);
+		if (d > best) {
+			best = d;
+			*a = p;
+			*b = q;
+		}
+	}
+}
+
+// one in-place iteration, by colors of pixels that do not see each other
+// (returns the sum of the absolute updates of all the masked samples)
+static float amle_iteration(float *x, int w, int h, int pd,
+		int (*run)[3], int nruns)
 {
+	int nn = amle_nn(), d[nn][2];
+	for (int p = 0; p < nn; p++)
+	{
+		d[p][0] = amle_neighbors[p][0];
+		d[p][1] = amle_neighbors[p][1];
+	}
+	int k, m = multicolor_modulus(&k, d, nn);
+
 	float actus = 0;
-	for (int p = 0; p < nmask; p++)
+	for (int c = 0; c < m; c++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,64) reduction(+:actus)
+#endif
+	for (int q = 0; q < nruns; q++)
+	for (int i = multicolor_first(run[q], c, m, k); i <= run[q][2]; i += m)
 	{
-		int i = mask[p][0];
-		int j = mask[p][1];
+		int j = run[q][0];
 		int idx = j*w + i, min, max;
-		float value[0x100] = {0}, weight[0x100] = {0};
-		int nv = get_nvals(value, weight, x, w, h, i, j);
-		get_minmax_idx(&min, &max, value, nv);
-		float a = weight[max];
-		float b = weight[min];
-		float newx = (a*value[min] + b*value[max]) / (a + b);
-		actus += fabs(x[idx] - newx);
-		//if (fabs(x[idx]-newx) > actumax)
-		//	actumax = fabs(x[idx]-newx);
-		x[idx] = newx;
+		if (pd == 1) {
+			float value[0x100] = {0}, weight[0x100] = {0};
+			int nv = get_nvals(value, weight, x, w, h, i, j);
+			get_minmax_idx(&min, &max, value, nv);
+			float a = weight[max];
+			float b = weight[min];
+			float newx = (a*value[min] + b*value[max]) / (a + b);
+			actus += fabs(x[idx] - newx);
+			//if (fabs(x[idx]-newx) > actumax)
+			//	actumax = fabs(x[idx]-newx);
+			x[idx] = newx;
+		} else {
+			float value[nn*pd], weight[nn];
+			int nv = get_nvals_vec(value, weight, x, w, h, pd, i, j);
+			get_farthest_pair_idx(&min, &max, value, nv, pd);
+			float a = weight[max];
+			float b = weight[min];
+			for (int l = 0; l < pd; l++)
+			{
+				float newx = (a*value[min*pd+l] + b*value[max*pd+l])
+					/ (a + b);
+				actus += fabs(x[idx*pd+l] - newx);
+				x[idx*pd+l] = newx;
+			}
+		}
 	}
 	return actus;
 }
@@ -112,34 +193,70 @@ static void amle_init(float *tinf, float *tsup, float *x, int w, int h)
 	}
 }
 
-static float absolute_difference(float *a, float *b, int w, int h,
+// initialize the masked pixels of a vector image by the top of each channel
+static void amle_init_vec(float *t, float *x, int w, int h, int pd)
+{
+	float *tinf = xmalloc(w*h*sizeof*tinf);
+	float *tsup = xmalloc(w*h*sizeof*tsup);
+	float *xl = xmalloc(w*h*sizeof*xl);
+	for (int l = 0; l < pd; l++)
+	{
+		for (int i = 0; i < w*h; i++)
+			xl[i] = isnan(x[i*pd]) ? NAN : x[i*pd+l];
+		if (pd == 1)
+			amle_init(tinf, tsup, xl, w, h);
+		else { // (AMLE_INIT is for grayscale images only)
+			float min, max;
+			get_minmax(&min, &max, xl, w*h);
+			for (int i = 0; i < w*h; i++)
+				tsup[i] = isnan(xl[i]) ? max : xl[i];
+		}
+		for (int i = 0; i < w*h; i++)
+			t[i*pd+l] = tsup[i];
+	}
+	free(xl);
+	free(tsup);
+	free(tinf);
+}
+
+static float absolute_difference(float *a, float *b, int w, int pd,
 		int (*mask)[2], int nmask)
 {
 	float r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(max:r)
+#endif
 	for (int p = 0; p < nmask; p++)
 	{
 		int i = mask[p][0];
 		int j = mask[p][1];
 		int idx = j*w + i;
-		float t = fabs(a[idx] - b[idx]);
-		if (t > r)
-			r = t;
+		for (int l = 0; l < pd; l++)
+		{
+			float t = fabs(a[idx*pd+l] - b[idx*pd+l]);
+			if (t > r)
+				r = t;
+		}
 	}
 	return r;
 }
 
-static float mean_difference(float *a, float *b, int w, int h,
+static float mean_difference(float *a, float *b, int w, int pd,
 		int (*mask)[2], int nmask)
 {
-	float r = 0;
+	double r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:r)
+#endif
 	for (int p = 0; p < nmask; p++)
 	{
 		int i = mask[p][0];
 		int j = mask[p][1];
 		int idx = j*w + i;
-		r += fabs(a[idx] - b[idx]);
+		for (int l = 0; l < pd; l++)
+			r += fabs(a[idx*pd+l] - b[idx*pd+l]);
 	}
-	return r/nmask;
+	return r/(nmask*pd);
 }
 
 SMART_PARAMETER(AMLE_TAU,0.25)
@@ -200,50 +317,121 @@ static void amle_refine(float *a, float *b, int w, int h,
 //}
 
 SMART_PARAMETER(AMLE_NITER,100)
+SMART_PARAMETER_SILENT(AMLE_EPS,0.001)
+SMART_PARAMETER_SILENT(AMLE_SCALES,0)
 
-void amle(float *y, float *x, int w, int h)
+// zoom-out by 2x2 block averages of the known values (NAN if none)
+static void amle_zoom_out(float *y, int ws, int hs, float *x, int w, int h,
+		int pd)
 {
-	int nmask = 0;
-	for (int i = 0; i < w*h; i++)
-		if (isnan(x[i]))
-			nmask += 1;
-	int (*mask)[2] = xmalloc(w*h*2*sizeof(int)), cx = 0;
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-		if (isnan(x[j*w + i])) {
-			mask[cx][0] = i;
-			mask[cx][1] = j;
-			cx += 1;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < hs; j++)
+	for (int i = 0; i < ws; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		float m = 0;
+		int n = 0;
+		for (int dj = 0; dj < 2; dj++)
+		for (int di = 0; di < 2; di++)
+		{
+			int ii = 2*i + di, jj = 2*j + dj;
+			if (ii < w && jj < h && !isnan(x[(jj*w+ii)*pd])) {
+				m += x[(jj*w+ii)*pd+l];
+				n += 1;
+			}
 		}
+		y[(j*ws+i)*pd+l] = n ? m / n : NAN;
+	}
+}
 
-	float *tinf = xmalloc(w*h*sizeof(float));
-	float *tsup = xmalloc(w*h*sizeof(float));
-	amle_init(tinf, tsup, x, w, h);
-
-	for (int iter = 0 ; iter < AMLE_NITER(); iter++)
+// iterate the masked pixels of y until the mean update is below AMLE_EPS
+static void amle_iterate(float *y, int w, int h, int pd, int (*mask)[2],
+		int nmask)
+{
+	int niter = AMLE_NITER(), nruns, (*run)[3];
+	run = multicolor_runs(&nruns, mask, nmask);
+	float *yold = xmalloc(w*h*pd*sizeof*yold);
+	memcpy(yold, y, w*h*pd*sizeof*y);
+	int last = -1; // iteration of the last check
+	for (int iter = 0 ; iter < niter; iter++)
 	{
-		float actus_inf = amle_iteration(tinf, w, h, mask, nmask);
-		float actus_sup = amle_iteration(tsup, w, h, mask, nmask);
-		float e = absolute_difference(tinf, tsup, w, h, mask, nmask);
-		float ea = mean_difference(tinf, tsup, w, h, mask, nmask);
-
-		if (0 == iter % 10)
-			fprintf(stderr,
-				"iter %d, e = {%g %g}, eactus = {%g %g}\n",
-				iter, e, ea, actus_inf, actus_sup);
+		float actus = amle_iteration(y, w, h, pd, run, nruns);
+
+		if (0 == (iter+1) % 10 || iter == niter - 1) {
+			// residual: the mean update since the last check
+			float e = absolute_difference(y, yold, w, pd, mask, nmask);
+			float ea = mean_difference(y, yold, w, pd, mask, nmask);
+			fprintf(stderr, "%dx%d iter %d, e = {%g %g}, actus = %g\n",
+					w, h, iter, e, ea, actus);
+			if (ea < AMLE_EPS() * (iter - last))
+				break;
+			memcpy(yold, y, w*h*pd*sizeof*y);
+			last = iter;
+		}
 
 		//if (0 == iter % 33)
 		//	shuffle(mask, nmask, sizeof*mask);
+	}
+	free(yold);
+	free(run);
+}
+
+// coarse-to-fine AMLE of an image of pd interleaved channels
+// (the pixels to fill-in have a NAN in their first channel)
+static void amle_rec(float *y, float *x, int w, int h, int pd, int scale)
+{
+	int (*mask)[2] = xmalloc(w*h*2*sizeof(int)), nmask = 0;
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		if (isnan(x[(j*w + i)*pd])) {
+			mask[nmask][0] = i;
+			mask[nmask][1] = j;
+			nmask += 1;
+		}
 
-		//if (0 == iter % 10)
-		//	amle_refine(tinf, tsup, w, h, mask, nmask);
+	if (nmask == 0 || nmask == w*h) { // nothing to do (or nothing known)
+		memcpy(y, x, w*h*pd*sizeof*x);
+		free(mask);
+		return;
 	}
 
+	int ws = (w + 1) / 2, hs = (h + 1) / 2;
+	if (scale != 1 && ws*hs >= 16 && ws*hs < w*h)
+	{
+		// solve at half resolution and initialize by nearest neighbor
+		float *xs = xmalloc(ws*hs*pd*sizeof*xs);
+		float *ys = xmalloc(ws*hs*pd*sizeof*ys);
+		amle_zoom_out(xs, ws, hs, x, w, h, pd);
+		amle_rec(ys, xs, ws, hs, pd, scale - 1);
+		for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		for (int l = 0; l < pd; l++)
+			y[(j*w+i)*pd+l] = isnan(x[(j*w+i)*pd]) ?
+				ys[((j/2)*ws+i/2)*pd+l] : x[(j*w+i)*pd+l];
+		free(xs);
+		free(ys);
+	} else
+		amle_init_vec(y, x, w, h, pd);
+
+	amle_iterate(y, w, h, pd, mask, nmask);
 	free(mask);
+}
 
-	for (int i = 0; i < w*h; i++)
-		//y[i] = (tinf[i] + tsup[i])/2;
-		y[i] = tsup[i];
+// AMLE of an image of pd interleaved channels (the NANs are filled-in)
+//
+// The solution is computed coarse-to-fine on AMLE_SCALES scales (0=all of
+// them), and the iterations at each scale stop when the mean update of the
+// last 10 iterations is below AMLE_EPS (or after AMLE_NITER iterations).
+void amle_vec(float *y, float *x, int w, int h, int pd)
+{
+	amle_rec(y, x, w, h, pd, AMLE_SCALES());
+}
+
+void amle(float *y, float *x, int w, int h)
+{
+	amle_vec(y, x, w, h, 1);
 }
 
 // the input mask is coded by nans
@@ -297,7 +485,7 @@ void amle_old(float *y, float *x, int w, int h)
 
 
 static char *help_string_name     = "amle";
-static char *help_string_version  = "amle 1.0\n\nWritten by eml";
+static char *help_string_version  = "amle 1.1\n\nWritten by eml";
 static char *help_string_oneliner = "Absolutely Minimizing Lipschitz Extension";
 static char *help_string_usage    = "usage:\n\t"
 "simpois [in [mask [out]]]";
@@ -307,7 +495,11 @@ static char *help_string_long     =
 "The pixels to fill-in are specified by NAN values in the input image\n"
 "or by a separate user-provided mask.  The interpolated is defined\n"
 "as that whose maximal slope is the lowest possible, recursively in all\n"
-"subsets on the region of interest.\n"
+"subsets on the region of interest.  Color images are interpolated as\n"
+"vectors (the slopes are those of the euclidean norm).\n"
+"\n"
+"The solution is computed coarse-to-fine, each scale initialized from\n"
+"the previous one, and the iterations stop when they no longer change.\n"
 "\n"
 "Usage: amle in.npy mask.png out.npy\n"
 "   or: amle in.npy mask.png > out.npy\n"
@@ -321,12 +513,15 @@ static char *help_string_long     =
 "Environement:\n"
 " AMLE_NN\tNeigborhood size (4, 6, 8, 16, 26 or 32, default=4)\n"
 " AMLE_TAU\tTimestep for the iterations (default=0.25)\n"
-" AMLE_NITER\tNumber of iterations at each scale (default=100)\n"
-" AMLE_INIT\tInitial image for the iterations (default=zeros)\n"
+" AMLE_NITER\tMaximum number of iterations at each scale (default=100)\n"
+" AMLE_EPS\tStop when the mean update is below this (default=0.001)\n"
+" AMLE_SCALES\tNumber of scales (default=0, as many as possible)\n"
+" AMLE_INIT\tInitial image at the coarsest scale (default=maximum)\n"
 "\n"
 "Examples:\n"
 " amle in.npy > out.npy               Fill-in the holes in a DSM\n"
 " AMLE_NN=32 amle in.npy > out.npy    More precise, slower solver\n"
+" AMLE_SCALES=1 AMLE_EPS=0 amle i o   Single-scale, as in amle 1.0\n"
 "\n"
 "Report bugs to <enric.meinhardt@ens-paris-saclay.fr>."
 ;
@@ -344,24 +539,25 @@ int main_amle(int c, char *v[])
 	char *filename_mask = c > 2 ? v[2] : "";
 	char *filename_out = c > 3 ? v[3] : "-";
 
-	int w[2], h[2];
-	float *in = iio_read_image_float(filename_in, w, h);
+	int w[2], h[2], pd;
+	float *in = iio_read_image_float_vec(filename_in, w, h, &pd);
 	float *mask = NULL;
 	if (filename_mask[0]) {
 		mask = iio_read_image_float(filename_mask, w+1, h+1);
 		if (w[0] != w[1] || h[0] != h[1])
 			fail("image and mask file size mismatch");
 	}
-	float *out = xmalloc(*w**h*sizeof*out);
+	float *out = xmalloc(*w**h*pd*sizeof*out);
 
 	if (mask)
 		for (int i = 0; i < *w**h; i++)
 			if (mask[i] > 0)
-				in[i] = NAN;
+				for (int l = 0; l < pd; l++)
+					in[i*pd+l] = NAN;
 
-	amle(out, in, *w, *h);
+	amle_vec(out, in, *w, *h, pd);
 
-	iio_write_image_float(filename_out, out, *w, *h);
+	iio_write_image_float_vec(filename_out, out, *w, *h, pd);
 
 	return 0;
 }
@@ -1,75 +1,238 @@
+// autotrim: crop the masked margins of an image
+//
+// autotrim [in [out]]
+//
+// The masked pixels are those having a NaN or negative sample.  The output is
+// the bounding box of the non-masked pixels.  The box is found by scanning
+// inward from each edge: the rows from the top and from the bottom until the
+// first row with a non-masked pixel, and then the prefix and the suffix of
+// each remaining row, up to the current left and right bounds.  The rows are
+// tested by chunks, with loops that the compiler can vectorize, so the cost
+// is proportional to the area of the margins.  The windows of tiff and vrt
+// files are read separately (by bands of doubling size), so that only the
+// margins and the output are decoded.
+
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "iio.h"
+
+#define AUTOTRIM_NAN      0 // mask the pixels with a NaN sample
+#define AUTOTRIM_NEGATIVE 1 // mask the pixels with a NaN or negative sample
 
-typedef bool (pixel_mask_f)(float*,int,int,int, int,int);
+#define AUTOTRIM_CHUNK 64 // pixels tested at once
+#define AUTOTRIM_BAND  64 // first band of the windowed reads
 
-// instance of pixel_mask_f
-static
-bool pixel_has_nan_sample(float *x, int w, int h, int pd, int i, int j)
+// whether some of the n pixels x[0..n-1] is not masked
+static bool some_good_pixel(const float *x, int n, int pd, int crit)
 {
-	for (int l = 0; l < pd; l++)
-		if (isnan(x[(j*w+i)*pd+l]))
-			return true;
-	return false;
+	int g = 0;
+	if (pd == 1 && crit == AUTOTRIM_NAN)
+		for (int i = 0; i < n; i++)
+			g |= x[i] == x[i];
+	else if (pd == 1)
+		for (int i = 0; i < n; i++)
+			g |= x[i] >= 0; // (false for NaN)
+	else
+		for (int i = 0; i < n; i++)
+		{
+			int b = 1;
+			for (int l = 0; l < pd; l++)
+			{
+				float v = x[i*pd+l];
+				b &= crit == AUTOTRIM_NAN ? v == v : v >= 0;
+			}
+			g |= b;
+		}
+	return g;
 }
 
-// instance of pixel_mask_f
-static
-bool pixel_has_nonpositive_sample(float *x, int w, int h, int pd, int i, int j)
+// index of the first non-masked pixel among x[0..n-1], or n
+static int first_good_pixel(const float *x, int n, int pd, int crit)
 {
-	for (int l = 0; l < pd; l++)
+	for (int i = 0; i < n; i += AUTOTRIM_CHUNK)
+	{
+		int m = n - i < AUTOTRIM_CHUNK ? n - i : AUTOTRIM_CHUNK;
+		if (some_good_pixel(x + i*pd, m, pd, crit))
+			for (int k = 0; k < m; k++)
+				if (some_good_pixel(x + (i + k)*pd, 1, pd, crit))
+					return i + k;
+	}
+	return n;
+}
+
+// index of the last non-masked pixel among x[0..n-1], or -1
+static int last_good_pixel(const float *x, int n, int pd, int crit)
+{
+	for (int i = n; i > 0; i -= AUTOTRIM_CHUNK)
 	{
-		float g = x[(j*w+i)*pd+l];
-		if (isnan(g) || g < 0)
-			return true;
+		int m = i < AUTOTRIM_CHUNK ? i : AUTOTRIM_CHUNK;
+		if (some_good_pixel(x + (i - m)*pd, m, pd, crit))
+			for (int k = i - 1; k >= i - m; k--)
+				if (some_good_pixel(x + k*pd, 1, pd, crit))
+					return k;
 	}
-	return false;
+	return -1;
 }
 
-#define BAD_MIN(x,y) ((x)<(y)?(x):(y))
-#define BAD_MAX(x,y) ((x)>(y)?(x):(y))
+// an image in memory, or a file whose windows are read on demand
+struct autotrim_source {
+	const char *fname; // (NULL for an image in memory)
+	float *x;
+	int w, h, pd;
+};
 
-void autotrim(float *y, int *out_w, int *out_h, float *x, int w, int h, int pd,
-		pixel_mask_f *badP)
+// the window [i0,i0+n) x [j0,j0+m) of the image, with rows of stride *s
+static float *window_get(struct autotrim_source *e,
+		int i0, int j0, int n, int m, int *s)
 {
-	// find bounding box
-	int i_first = w - 1;
-	int j_first = h - 1;
-	int i_last  = 0;
-	int j_last  = 0;
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	if (!badP(x, w, h, pd, i, j))
+	if (!e->fname) {
+		*s = e->w;
+		return e->x + (j0 * (long)e->w + i0) * e->pd;
+	}
+	int w, h, pd;
+	float *x = iio_read_image_float_vec_roi(e->fname,
+			i0, j0, i0 + n, j0 + m, &w, &h, &pd);
+	if (!x || w != n || h != m || pd != e->pd) {
+		fprintf(stderr, "autotrim: could not read \"%s\"\n", e->fname);
+		exit(1);
+	}
+	*s = n;
+	return x;
+}
+
+static void window_release(struct autotrim_source *e, float *x)
+{
+	if (e->fname)
+		free(x);
+}
+
+// bounding box [b[0],b[2]] x [b[1],b[3]] of the non-masked pixels
+// (returns false when all the pixels are masked)
+static bool autotrim_box(int b[4], struct autotrim_source *e, int crit)
+{
+	int w = e->w, h = e->h, pd = e->pd, s;
+	int i_first = w, j_first = h, i_last = -1, j_last = -1;
+
+	// rows from the top
+	for (int j0 = 0, n = AUTOTRIM_BAND; j_first == h && j0 < h; j0 += n,n*=2)
 	{
-		i_first = BAD_MIN(i_first, i);
-		j_first = BAD_MIN(j_first, j);
-		i_last  = BAD_MAX(i_last , i);
-		j_last  = BAD_MAX(j_last , j);
+		int m = j0 + n < h ? n : h - j0;
+		float *x = window_get(e, 0, j0, w, m, &s);
+		for (int j = 0; j < m; j++)
+			if (some_good_pixel(x + j * (long)s * pd, w, pd, crit)) {
+				j_first = j0 + j;
+				break;
+			}
+		window_release(e, x);
 	}
+	if (j_first == h)
+		return false;
+
+	// rows from the bottom (the row j_first stops the scan)
+	for (int j1 = h, n = AUTOTRIM_BAND; j_last < 0; j1 -= n, n *= 2)
+	{
+		int j0 = j1 - n > j_first ? j1 - n : j_first;
+		float *x = window_get(e, 0, j0, w, j1 - j0, &s);
+		for (int j = j1 - j0 - 1; j >= 0; j--)
+			if (some_good_pixel(x + j * (long)s * pd, w, pd, crit)) {
+				j_last = j0 + j;
+				break;
+			}
+		window_release(e, x);
+	}
+
+	// prefixes of the remaining rows, up to the current left bound
+	int m = j_last - j_first + 1;
+	for (int i0 = 0, n = AUTOTRIM_BAND; i0 < i_first; i0 += n, n *= 2)
+	{
+		int k = i0 + n < i_first ? n : i_first - i0;
+		float *x = window_get(e, i0, j_first, k, m, &s);
+		for (int j = 0; j < m; j++)
+		{
+			int q = i_first - i0 < k ? i_first - i0 : k;
+			int i = first_good_pixel(x + j * (long)s * pd, q, pd, crit);
+			if (i < q)
+				i_first = i0 + i;
+		}
+		window_release(e, x);
+	}
+
+	// suffixes of the remaining rows, down to the current right bound
+	for (int i1 = w, n = AUTOTRIM_BAND; i1 - 1 > i_last; i1 -= n, n *= 2)
+	{
+		int i0 = i1 - n > i_last + 1 ? i1 - n : i_last + 1;
+		if (i0 < i_first) i0 = i_first;
+		float *x = window_get(e, i0, j_first, i1 - i0, m, &s);
+		for (int j = 0; j < m; j++)
+		{
+			int a = i_last + 1 - i0 > 0 ? i_last + 1 - i0 : 0;
+			float *r = x + (j * (long)s + a) * pd;
+			int i = last_good_pixel(r, i1 - i0 - a, pd, crit);
+			if (i >= 0)
+				i_last = i0 + a + i;
+		}
+		window_release(e, x);
+	}
+
+	b[0] = i_first;
+	b[1] = j_first;
+	b[2] = i_last;
+	b[3] = j_last;
+	return true;
+}
+
+// crop the masked margins of the image x into y (returns the size in *out_w,
+// *out_h, which are 0 when all the pixels are masked)
+void autotrim(float *y, int *out_w, int *out_h, float *x, int w, int h, int pd,
+		int crit)
+{
+	struct autotrim_source e = { NULL, x, w, h, pd };
+	int b[4] = {0, 0, -1, -1};
+	autotrim_box(b, &e, crit);
 
 	// do the crop
-	int ow = i_last - i_first;
-	int oh = j_last - j_first;
+	int ow = b[2] - b[0] + 1;
+	int oh = b[3] - b[1] + 1;
 	fprintf(stderr, "trim if jf il jl ow oh %d %d %d %d %d %d\n",
-			i_first, j_first, i_last, j_last, ow, oh);
+			b[0], b[1], b[2], b[3], ow, oh);
 	assert(ow <= w);
 	assert(oh <= h);
 	for (int j = 0; j < oh; j++)
 	for (int i = 0; i < ow; i++)
 	for (int l = 0; l < pd; l++)
 	{
-		int ii = i + i_first;
-		int jj = j + j_first;
-		y[(j*ow+i)*pd+l] = x[(jj*w+ii)*pd+l];
+		int ii = i + b[0];
+		int jj = j + b[1];
+		y[(j*(long)ow+i)*pd+l] = x[(jj*(long)w+ii)*pd+l];
 	}
 	*out_w = ow;
 	*out_h = oh;
 }
 
-#include <stdlib.h>
-#include "iio.h"
+// whether the windows of the image can be read without decoding it whole
+static bool windows_are_cheap(const char *fname)
+{
+	if (!strcmp(fname, "-"))
+		return false;
+	size_t n = strlen(fname);
+	if (n > 4 && !strcasecmp(fname + n - 4, ".vrt"))
+		return true;
+	FILE *f = fopen(fname, "rb");
+	if (!f)
+		return false;
+	char b[4] = {0};
+	int r = fread(b, 1, 4, f);
+	fclose(f);
+	return r == 4 && (!memcmp(b, "II*\0", 4) || !memcmp(b, "MM\0*", 4)
+			|| !memcmp(b, "II+\0", 4) || !memcmp(b, "MM\0+", 4));
+}
+
 int main(int c, char *v[])
 {
 	if (c != 2 && c != 3 && c != 4)
@@ -77,12 +240,32 @@ int main(int c, char *v[])
 	//                                         0  1   2
 	char *filename_in  = c > 1 ? v[1] : "-";
 	char *filename_out = c > 2 ? v[2] : "-";
-	pixel_mask_f *criterion_bad = pixel_has_nonpositive_sample;
+	int criterion = AUTOTRIM_NEGATIVE;
+
+	int w, h, pd;
+	if (windows_are_cheap(filename_in)
+			&& !iio_read_image_info(filename_in, &w, &h, &pd, NULL)) {
+		// read only the margins, and then the box
+		struct autotrim_source e = { filename_in, NULL, w, h, pd };
+		int b[4];
+		if (!autotrim_box(b, &e, criterion))
+			return fprintf(stderr, "autotrim: all pixels masked\n"), 1;
+		int ow = b[2] - b[0] + 1, oh = b[3] - b[1] + 1, s;
+		fprintf(stderr, "trim if jf il jl ow oh %d %d %d %d %d %d\n",
+				b[0], b[1], b[2], b[3], ow, oh);
+		float *y = window_get(&e, b[0], b[1], ow, oh, &s);
+		iio_write_image_float_vec(filename_out, y, ow, oh, pd);
+		free(y);
+		return 0;
+	}
 
-	int w, h, pd;//, ow, oh;
 	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
-	float *y = malloc(w*h*pd*sizeof*y);
-	autotrim(y, &w, &h, x, w, h, pd, criterion_bad);
+	float *y = malloc(w*(long)h*pd*sizeof*y);
+	autotrim(y, &w, &h, x, w, h, pd, criterion);
+	if (w < 1 || h < 1)
+		return fprintf(stderr, "autotrim: all pixels masked\n"), 1;
 	iio_write_image_float_vec(filename_out, y, w, h, pd);
+	free(x);
+	free(y);
 	return 0;
 }
@@ -17,71 +17,13 @@
 #include "xmalloc.c"
 #include "getpixel.c"
 
-#include "bicubic.c"
+#include "warpcore.c"
 
 #include "smapa.h"
 
 SMART_PARAMETER_SILENT(NEAREST,0)
 SMART_PARAMETER_SILENT(BILINEAR,0)
 
-static float evaluate_bilinear_cell(float a, float b, float c, float d,
-							float x, float y)
-{
-	float r = 0;
-	r += a * (1-x) * (1-y);
-	r += b * ( x ) * (1-y);
-	r += c * (1-x) * ( y );
-	r += d * ( x ) * ( y );
-	return r;
-}
-
-static float getsample(float *fx, int w, int h, int pd, int i, int j, int l)
-{
-	if (i < 0 || i >= w || j < 0 || j >= h || l < 0 || l >= pd)
-		return 0;
-	float (*x)[w][pd] = (void*)fx;
-	return x[j][i][l];
-	//return x[(i+j*w)*pd + l];
-}
-
-static float getsamplen(float *fx, int w, int h, int pd, int i, int j, int l)
-{
-	if (i < 0 || i >= w || j < 0 || j >= h || l < 0 || l >= pd)
-		return NAN;
-	float (*x)[w][pd] = (void*)fx;
-	return x[j][i][l];
-	//return x[(i+j*w)*pd + l];
-}
-
-static void bilinear_interpolation_at(float *result,
-		float *x, int w, int h, int pd,
-		float p, float q)
-{
-	int ip = p;
-	int iq = q;
-	FORL(pd) {
-		float a = getsamplen(x, w, h, pd, ip  , iq  , l);
-		float b = getsamplen(x, w, h, pd, ip+1, iq  , l);
-		float c = getsamplen(x, w, h, pd, ip  , iq+1, l);
-		float d = getsamplen(x, w, h, pd, ip+1, iq+1, l);
-		float r = evaluate_bilinear_cell(a, b, c, d, p-ip, q-iq);
-		result[l] = r;
-	}
-}
-
-static void interpolate_nearest(float *result,
-		float *x, int w, int h, int pd,
-		float p, float q)
-{
-	int ip = round(p);
-	int iq = round(q);
-	FORL(pd) {
-		float r = getsamplen(x, w, h, pd, ip  , iq  , l);
-		result[l] = r;
-	}
-}
-
-
 SMART_PARAMETER_SILENT(BACKDIV,0)
 SMART_PARAMETER_SILENT(BACKDET,0)
 SMART_PARAMETER_SILENT(BFBOUND,0)
@@ -110,23 +52,29 @@ static void compute_flow_det(float *d, float *u, int w, int h)
 
 
 
-static void env_interpolate_at(float *out,
-		float *x, int w, int h, int pd,
-		float p, float q)
+// interpolation method and extrapolation, from the environment
+static void env_interpolator(int *method, getsample_operator *ext)
 {
+	*ext = getsample_nan;
 	if (BILINEAR())
-		bilinear_interpolation_at(out, x, w, h, pd, p, q);
+		*method = WARPCORE_BILINEAR;
 	else if (NEAREST())
-		interpolate_nearest(out, x, w,h, pd, p, q);
-	else
-		bicubic_interpolation_boundary(out, x, w,h,pd, p,q, BFBOUND());
+		*method = WARPCORE_NEAREST;
+	else {
+		*method = WARPCORE_BICUBIC;
+		switch ((int)BFBOUND()) {
+		default:
+		case 0: *ext = getsample_0; break;
+		case 1: *ext = getsample_1; break;
+		case 2: *ext = getsample_2; break;
+		case -1: *ext = getsample_error; break;
+		}
+	}
 }
 
 static void invflow(float *ou, float *flo, float *pin, int w, int h, int pd, int win, int hin)
 {
 	float (*out)[w][pd] = (void*)ou;
-	float (*in)[win][pd] = (void*)pin;
-	float (*flow)[w][2] = (void*)flo;
 	float *flowdiv = NULL;
 	float *flowdet = NULL;
 
@@ -140,31 +88,30 @@ static void invflow(float *ou, float *flo, float *pin, int w, int h, int pd, int
 		compute_flow_det(flowdet, flo, w, h);
 	}
 
-	FORJ(h) FORI(w) {
-		float p[2] = {i + flow[j][i][0], j + flow[j][i][1]};
-		float result[pd];
-
-		env_interpolate_at(result, pin, win, hin, pd, p[0], p[1]);
+	int method;
+	getsample_operator ext;
+	env_interpolator(&method, &ext);
+	warpcore_flow(ou, w, h, pin, win, hin, pd, flo, true, method, ext);
 
+	if (!flowdiv && !flowdet)
+		return;
+	FORJ(h) FORI(w) {
 		float factor = 1;
 		if (flowdiv)
 			factor = exp(BACKDIV() * flowdiv[j*w+i]);
-		FORL(pd)
-			out[j][i][l] = factor * result[l];
-			//out[j][i][l] = 100*log(factor * exp(result[l]/100));
 		if (flowdet) {
 			float bd = BACKDET();
-			float det = flowdet[j*w+i];
-			if (det > bd) det = bd;
+			factor = flowdet[j*w+i];
+			if (factor > bd) factor = bd;
 			//if (det < 1/bd) det = 1/bd;
-			FORL(pd)
-				out[j][i][l] = det*result[l];
-				//out[j][i][l] = bd*log(det*(exp((result[l])/bd)));
 		}
+		FORL(pd)
+			out[j][i][l] *= factor;
+			//out[j][i][l] = 100*log(factor * exp(result[l]/100));
 	}
 
-	if (flowdiv)
-		free(flowdiv);
+	free(flowdiv);
+	free(flowdet);
 }
 
 int main_backflow(int c, char *v[])
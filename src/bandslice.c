@@ -3,6 +3,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "iio.h"
 
 int main(int c, char *v[])
@@ -15,19 +16,42 @@ int main(int c, char *v[])
 	char *filename_in    = v[2];
 	char *filename_out   = v[3];
 	int w, h, pd, ww, hh;
-	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
 	float *g = iio_read_image_float(filename_guide, &ww, &hh);
+	if (iio_read_image_info(filename_in, &w, &h, &pd, NULL))
+		exit(fprintf(stderr, "could not read \"%s\"\n", filename_in));
 	if (ww != w || hh != h)
 		exit(fprintf(stderr, "guide/input mismatch %dx%d != %dx%d\n",
 					ww, hh, w, h));
+
+	// read only the bands that appear in the guide (q[j] = position of the
+	// band j among them, or -1)
+	int *q = malloc(pd*sizeof*q), nb = 0;
+	for (int j = 0; j < pd; j++)
+		q[j] = -1;
+	for (int i = 0; i < w*h; i++)
+	{
+		int j = g[i];
+		if (j >= 0 && j < pd)
+			q[j] = 0;
+	}
+	int fnmax = strlen(filename_in) + 8 + 11*pd;
+	char *fname = malloc(fnmax), *p = fname;
+	p += snprintf(p, fnmax, "%s,bands=", filename_in);
+	for (int j = 0; j < pd; j++)
+		if (q[j] >= 0)
+		{
+			p += sprintf(p, nb ? ",%d" : "%d", j);
+			q[j] = nb++;
+		}
+	float *x = nb ? iio_read_image_float_vec(fname, &w, &h, &nb) : NULL;
 	float *y = malloc(w*h*sizeof*y);
 	for (int i = 0; i < w*h; i++)
 	{
 		int j = g[i];
-		if (j < 0 || j >= pd)
+		if (j < 0 || j >= pd || q[j] < 0)
 			y[i] = NAN;
 		else
-			y[i] = x[i*pd+j];
+			y[i] = x[i*nb+q[j]];
 	}
 	iio_write_image_float_vec(filename_out, y, w, h, 1);
 	return 0;
@@ -3,7 +3,11 @@
 #define BICUBIC_C
 
 
+#include <math.h>
+#include <stdlib.h>
+
 #include "getpixel.c"
+#include "pd_specialize.h"
 
 
 static float cubic_interpolation(float v[4], float x)
@@ -116,4 +120,112 @@ void bicubic_interpolation_boundary2(float *result,
 	}
 }
 
+// batched interpolation
+//
+// The functions below interpolate many points at once.  The weights of each
+// point are computed once for all the channels (and, on a regular grid, once
+// for each column and each row), the taps far from the boundary are read
+// directly, and the loops over the channels are specialized for 1, 2, 3 and
+// 4 channels (by PD_SPECIALIZE), so that they can be vectorized.  They give the same values as
+// "bicubic_interpolation_boundary2", up to rounding errors.
+
+// weights of the 4 taps of the cubic interpolation at offset x
+static void bicubic_weights(float c[4], float x)
+{
+	c[0] = 0.5 * x * (-1 + x * (2 - x));
+	c[1] = 1 + 0.5 * x * x * (-5 + 3 * x);
+	c[2] = 0.5 * x * (1 + x * (4 - 3 * x));
+	c[3] = 0.5 * x * x * (-1 + x);
+}
+
+// o = sum of img(ix+i, iy+j) * cx[i] * cy[j], using "p" near the boundary
+static inline void bicubic_taps(float *o, float *img, int w, int h, int pd,
+		int ix, int iy, float cx[4], float cy[4], getsample_operator p)
+{
+	for (int l = 0; l < pd; l++)
+		o[l] = 0;
+	if (ix >= 0 && iy >= 0 && ix + 3 < w && iy + 3 < h) {
+		for (int j = 0; j < 4; j++)
+		{
+			float *a = img + ((iy + j) * w + ix) * pd;
+			for (int i = 0; i < 4; i++)
+			{
+				float t = cx[i] * cy[j];
+				for (int l = 0; l < pd; l++)
+					o[l] += t * a[i*pd + l];
+			}
+		}
+	} else
+		for (int j = 0; j < 4; j++)
+		for (int i = 0; i < 4; i++)
+		for (int l = 0; l < pd; l++)
+			o[l] += cx[i] * cy[j] * p(img, w, h, pd, ix+i, iy+j, l);
+}
+
+PD_KERNEL void bicubic_points_pd(float *out, float *img,
+		int w, int h, int pd, float (*q)[2], int n, getsample_operator p)
+{
+	for (int k = 0; k < n; k++)
+	{
+		float x = q[k][0] - 1, y = q[k][1] - 1, cx[4], cy[4];
+		int ix = floor(x);
+		int iy = floor(y);
+		bicubic_weights(cx, x - ix);
+		bicubic_weights(cy, y - iy);
+		bicubic_taps(out + k*pd, img, w, h, pd, ix, iy, cx, cy, p);
+	}
+}
+
+// out[k*pd+l] = bicubic interpolation of img at the n points q[k]
+// (p is the extrapolation, e.g., getsample_1)
+static void bicubic_interpolation_points(float *out,
+		float *img, int w, int h, int pd, float (*q)[2], int n,
+		getsample_operator p)
+{
+	PD_SPECIALIZE(pd, bicubic_points_pd(out, img, w, h, pd, q, n, p));
+}
+
+PD_KERNEL void bicubic_grid_pd(float *out, int ow, int oh,
+		float *img, int w, int h, int pd,
+		int *ix, float (*cx)[4], int *iy, float (*cy)[4],
+		getsample_operator p)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < oh; j++)
+	for (int i = 0; i < ow; i++)
+		bicubic_taps(out + (j * (long)ow + i) * pd, img, w, h, pd,
+				ix[i], iy[j], cx[i], cy[j], p);
+}
+
+// out(i,j) = bicubic interpolation of img at (x0 + i*dx, y0 + j*dy)
+// (the output has size ow x oh, and p is the extrapolation)
+static void bicubic_interpolation_grid(float *out, int ow, int oh,
+		float *img, int w, int h, int pd,
+		float x0, float y0, float dx, float dy,
+		getsample_operator p)
+{
+	int *ix = malloc(ow * sizeof*ix), *iy = malloc(oh * sizeof*iy);
+	float (*cx)[4] = malloc(ow * sizeof*cx);
+	float (*cy)[4] = malloc(oh * sizeof*cy);
+	for (int i = 0; i < ow; i++)
+	{
+		float x = x0 + i * dx - 1;
+		ix[i] = floor(x);
+		bicubic_weights(cx[i], x - ix[i]);
+	}
+	for (int j = 0; j < oh; j++)
+	{
+		float y = y0 + j * dy - 1;
+		iy[j] = floor(y);
+		bicubic_weights(cy[j], y - iy[j]);
+	}
+	PD_SPECIALIZE(pd, bicubic_grid_pd(out,ow,oh,img,w,h,pd,ix,cx,iy,cy,p));
+	free(ix);
+	free(iy);
+	free(cx);
+	free(cy);
+}
+
 #endif//BICUBIC_C
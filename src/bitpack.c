@@ -0,0 +1,99 @@
+#ifndef _BITPACK_C
+#define _BITPACK_C
+
+// bulk unpacking and packing of samples of 1, 2 or 4 bits
+//
+// The packed samples start at the most significant bits of each byte (as in
+// tiff and pbm files, "msb") or at the least significant ones ("lsb", as in
+// dataconv.c).  The unpacked samples are bytes.  The single bits are
+// processed by 64-bit words (SWAR), with one multiplication for each byte:
+//
+// 	unpack  the byte is copied into the 8 lanes of a word, each lane keeps
+// 	        a different bit, and adding 0x7f moves it to the top of the lane
+// 	pack    each lane is reduced to 0 or 1, and a multiplication gathers
+// 	        the 8 lanes into the top byte
+//
+// The samples of 2 and 4 bits are done by shifts, a byte at a time.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// the lanes of a word in memory order (lane k = byte k of the array)
+static inline uint64_t bitpack_lanes(uint64_t w)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap64(w);
+#else
+	return w;
+#endif
+}
+
+// y[i] = bit i of x, for i = 0..n-1
+static void bitpack_unpack1(uint8_t *y, const uint8_t *x, long n, bool msb)
+{
+	uint64_t mask = msb ? 0x0102040810204080 : 0x8040201008040201;
+	long i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t t = (x[i/8] * 0x0101010101010101) & mask;
+		t = ((t + 0x7f7f7f7f7f7f7f7f) >> 7) & 0x0101010101010101;
+		t = bitpack_lanes(t);
+		memcpy(y + i, &t, 8);
+	}
+	for (; i < n; i++)
+		y[i] = x[i/8] >> (msb ? 7 - i%8 : i%8) & 1;
+}
+
+// bit i of y = (x[i] != 0), for i = 0..n-1 (the last byte is padded by 0)
+static void bitpack_pack1(uint8_t *y, const uint8_t *x, long n, bool msb)
+{
+	uint64_t m = msb ? 0x8040201008040201 : 0x0102040810204080;
+	long i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t t;
+		memcpy(&t, x + i, 8);
+		t = bitpack_lanes(t);
+		t = (t | ((t & 0x7f7f7f7f7f7f7f7f) + 0x7f7f7f7f7f7f7f7f)) >> 7;
+		t &= 0x0101010101010101;
+		y[i/8] = (t * m) >> 56;
+	}
+	if (i < n)
+		y[i/8] = 0;
+	for (; i < n; i++)
+		if (x[i])
+			y[i/8] |= 1 << (msb ? 7 - i%8 : i%8);
+}
+
+// unpack n samples of b bits (1, 2 or 4, msb first) into bytes
+static void bitpack_unpack(uint8_t *y, const uint8_t *x, long n, int b)
+{
+	if (b == 1) {
+		bitpack_unpack1(y, x, n, true);
+		return;
+	}
+	int k = 8 / b, m = (1 << b) - 1;
+	for (long i = 0; i < n; i++)
+		y[i] = x[i/k] >> (8 - b - b * (i % k)) & m;
+}
+
+// pack n bytes into samples of b bits (1, 2 or 4, msb first); the single
+// bits are 1 for the non-zero bytes, the others keep the lowest b bits
+static void bitpack_pack(uint8_t *y, const uint8_t *x, long n, int b)
+{
+	if (b == 1) {
+		bitpack_pack1(y, x, n, true);
+		return;
+	}
+	int k = 8 / b, m = (1 << b) - 1;
+	for (long i = 0; i < n; i += k)
+	{
+		unsigned v = 0;
+		for (int j = 0; j < k; j++)
+			v = v << b | (i + j < n ? x[i+j] & m : 0);
+		y[i/k] = v;
+	}
+}
+
+#endif//_BITPACK_C
@@ -23,6 +23,9 @@
 
 #include "fail.c"
 #include "xmalloc.c"
+#include "xarena.c"
+#include "pd_specialize.h"
+#include "threads.c"
 
 static void *fftwf_xmalloc(size_t n)
 {
@@ -39,12 +42,7 @@ static void *fftwf_xmalloc(size_t n)
 
 
 
-#ifndef USE_WISDOM
-static void evoke_wisdom(void) {}
-static void bequeath_wisdom(void) {}
-#else//USE_WISDOM
-#include "fftwisdom.c"
-#endif//USE_WISDOM
+#include "fftplans.c"
 
 
 
@@ -52,21 +50,12 @@ static void bequeath_wisdom(void) {}
 // of a real-valued image
 static void fft_2dfloat(fftwf_complex *fx, float *x, int w, int h)
 {
-	fftwf_complex *a = fftwf_xmalloc(w*h*sizeof*a);
-
-	//fprintf(stderr, "planning...\n");
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_dft_2d(h, w, a, fx,
-						FFTW_FORWARD, FFTW_ESTIMATE);
-	bequeath_wisdom();
-	//fprintf(stderr, "...planned!\n");
+	struct fftplan *p = fftplan_get(FFTPLAN_DFT_FORWARD, w, h);
+	fftwf_complex *a = p->in, *b = p->out;
 
 	FORI(w*h) a[i] = x[i]; // complex assignment!
-	fftwf_execute(p);
-
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_cleanup();
+	fftwf_execute(p->p);
+	FORI(w*h) fx[i] = b[i];
 }
 
 #include "smapa.h"
@@ -77,18 +66,11 @@ SMART_PARAMETER_SILENT(FIWARN,0)
 // The input data must be hermitic.
 static void ifft_2dfloat(float *ifx,  fftwf_complex *fx, int w, int h)
 {
-	fftwf_complex *a = fftwf_xmalloc(w*h*sizeof*a);
-	fftwf_complex *b = fftwf_xmalloc(w*h*sizeof*b);
-
-	//fprintf(stderr, "planning...\n");
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_dft_2d(h, w, a, b,
-						FFTW_BACKWARD, FFTW_ESTIMATE);
-	bequeath_wisdom();
-	//fprintf(stderr, "...planned!\n");
+	struct fftplan *p = fftplan_get(FFTPLAN_DFT_BACKWARD, w, h);
+	fftwf_complex *a = p->in, *b = p->out;
 
 	FORI(w*h) a[i] = fx[i];
-	fftwf_execute(p);
+	fftwf_execute(p->p);
 	float scale = 1.0/(w*h);
 	FORI(w*h) {
 		fftwf_complex z = b[i] * scale;
@@ -100,10 +82,26 @@ static void ifft_2dfloat(float *ifx,  fftwf_complex *fx, int w, int h)
 			//assert(cimagf(z) < 0.001);
 		}
 	}
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_free(b);
-	fftwf_cleanup();
+}
+
+// number of complex coefficients of the half spectrum of a "w x h" image
+static long rfft_size(int w, int h)
+{
+	return (w/2 + 1) * (long)h;
+}
+
+// half spectrum of a real-valued image, of size (w/2+1) x h
+static void rfft_2dfloat(fftwf_complex *fx, float *x, int w, int h)
+{
+	struct fftplan *p = fftplan_get(FFTPLAN_REAL, w, h);
+	float *a = p->in;
+	fftwf_complex *b = p->out;
+	int W = 2 * (w/2 + 1); // padded width of the real image
+
+	FORJ(h) FORI(w) a[j*W+i] = x[j*w+i];
+	fftwf_execute(p->p);
+	for (long i = 0; i < rfft_size(w, h); i++)
+		fx[i] = b[i];
 }
 
 SMART_PARAMETER_SILENT(BLUR_INVERSE,0)
@@ -149,53 +147,6 @@ static void fill_2d_gaussian_image(float *gg, int w, int h, float inv_s)
 }
 
 
-// gaussian blur of a gray 2D image
-void gblur_gray(float *y, float *x, int w, int h, float s)
-{
-	s = 1/s;
-
-	fftwf_complex *fx = fftwf_xmalloc(w*h*sizeof*fx);
-	fft_2dfloat(fx, x, w, h);
-
-	float *g = xmalloc(w*h*sizeof*g);
-	fill_2d_gaussian_image(g, w, h, s);
-
-	fftwf_complex *fg = fftwf_xmalloc(w*h*sizeof*fg);
-	fft_2dfloat(fg, g, w, h);
-
-	pointwise_complex_multiplication(fx, fx, fg, w*h);
-	ifft_2dfloat(y, fx, w, h);
-
-	fftwf_free(fx);
-	fftwf_free(fg);
-	free(g);
-}
-
-
-// gausian blur of a 2D image with pd-dimensional pixels
-// (the blurring is performed independently for each co-ordinate)
-void gblur(float *y, float *x, int w, int h, int pd, float s)
-{
-	float *c = xmalloc(w*h*sizeof*c);
-	float *gc = xmalloc(w*h*sizeof*gc);
-	FORL(pd) {
-		FORI(w*h) {
-			float tmp = x[i*pd + l];
-			if (!isfinite(tmp))
-				tmp = 0;
-			c[i] = tmp;//x[i*pd + l];
-		}
-		if (s)
-			gblur_gray(gc, c, w, h, s);
-		else FORI(w*h) gc[i] = c[i];
-		FORI(w*h)
-			y[i*pd + l] = gc[i];
-	}
-	free(c);
-	free(gc);
-}
-
-
 static float kernel_2d_square(float x, float y, float *p)
 {
 	int nx=0, ny=0;
@@ -390,36 +341,436 @@ static void substract_from_identity(float *k, int w, int h)
 	k[0] += 1;
 }
 
-static void gray_fconvolution_2d(float *y, float *x, fftwf_complex *fk,
-		int w, int h)
-{
-	fftwf_complex *fx = fftwf_xmalloc(w*h*sizeof*fx);
-	fft_2dfloat(fx, x, w, h);
+SMART_PARAMETER_SILENT(BLUR_BATCH_MB,1024)
 
-	pointwise_complex_multiplication(fx, fx, fk, w*h);
-	ifft_2dfloat(y, fx, w, h);
+// a[l*s+i] = x[i*pd+l0+l], for the m channels from l0 of a row of w pixels
+// (the non-finite samples are replaced by zeros)
+PD_KERNEL void split_row(float *a, long s, float *x, int w, int pd,
+		int l0, int m)
+{
+	FORI(w) FORL(m) {
+		float tmp = x[i*pd + l0 + l];
+		a[l*s+i] = isfinite(tmp) ? tmp : 0;
+	}
+}
 
-	fftwf_free(fx);
+// y[i*pd+l0+l] = k * a[l*s+i], the converse of split_row
+PD_KERNEL void merge_row(float *y, int w, int pd, int l0, int m,
+		float *a, long s, float k)
+{
+	FORI(w) FORL(m)
+		y[i*pd + l0 + l] = a[l*s+i] * k;
 }
 
+// convolution of a color image by a kernel given by its half spectrum
+//
+// The channels are transformed in batches, by the same plan, in-place on
+// the buffer of the cached plan.  Each batch takes at most BLUR_BATCH_MB
+// megabytes (but it has at least one channel).
 static void color_fconvolution_2d(float *y, float *x, fftwf_complex *fk,
 		int w, int h, int pd)
 {
-	float *c = xmalloc(w*h*sizeof*c);
-	float *kc = xmalloc(w*h*sizeof*kc);
-	FORL(pd) {
-		FORI(w*h) {
-			float tmp = x[i*pd + l];
-			if (!isfinite(tmp))
-				tmp = 0;
-			c[i] = tmp;//x[i*pd + l];
+	int W = 2 * (w/2 + 1);
+	long n = rfft_size(w, h);
+	double mb = n * sizeof(fftwf_complex) / 1048576.0;
+	int nb = fmax(1, fmin(pd, BLUR_BATCH_MB() / mb)); // channels per batch
+	int k = (pd + nb - 1) / nb; // number of batches
+	nb = (pd + k - 1) / k;      // balanced batches
+	float scale = 1.0/(w*h);
+
+	for (int l0 = 0; l0 < pd; l0 += nb)
+	{
+		int m = l0 + nb > pd ? pd - l0 : nb;
+		struct fftplan *p = fftplan_get_many(FFTPLAN_REAL, w, h, m);
+		float *a = p->in;
+		fftwf_complex *b = p->out;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		FORJ(h) {
+			float *aj = a + j*(long)W, *xj = x + j*(long)w*pd;
+			if (m == pd) // (all the channels at once, pd is constant)
+				PD_SPECIALIZE(m, split_row(aj, h*(long)W, xj, w, m,0,m));
+			else
+				split_row(aj, h*(long)W, xj, w, pd, l0, m);
+		}
+		fftwf_execute(p->p);
+		FORL(m)
+			pointwise_complex_multiplication(b + l*n, b + l*n, fk, n);
+		fftwf_execute(p->q);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		FORJ(h) {
+			float *aj = a + j*(long)W, *yj = y + j*(long)w*pd;
+			if (m == pd)
+				PD_SPECIALIZE(m, merge_row(yj, w, m, 0, m,
+							aj, h*(long)W, scale));
+			else
+				merge_row(yj, w, pd, l0, m, aj, h*(long)W, scale);
 		}
-		gray_fconvolution_2d(kc, c, fk, w, h);
-		FORI(w*h)
-			y[i*pd + l] = kc[i];
+	}
+}
+
+// Spatial filters for the separable kernels (gaussian and square).
+//
+// These kernels are computed directly, without FFT, by two 1D passes.  The
+// boundary is periodic, and the taps are those of the FFT kernel (with the
+// same normalization), so the results are the same as those of the FFT
+// convolution, except for the truncation of the gaussians at 5 sigma.
+//
+// BLUR_FFT=1      always use the FFT
+// BLUR_FIR_MAX=r  largest radius of the direct gaussian filters
+// BLUR_IIR=1      use recursive (Young-van Vliet) filters for the gaussians
+//                 that are too large for a direct filter (approximate)
+
+SMART_PARAMETER_SILENT(BLUR_FFT,0)
+SMART_PARAMETER_SILENT(BLUR_FIR_MAX,25)
+SMART_PARAMETER_SILENT(BLUR_IIR,0)
+
+static int blur_mod(int a, int b)
+{
+	int r = a % b;
+	return r < 0 ? r + b : r;
+}
+
+// range of displacements [*d0, *d1] of the taps of radius r on a periodic
+// domain of length n (the representatives of the FFT kernel are i or i-n)
+static void blur_taps_range(int *d0, int *d1, int r, int n)
+{
+	*d0 = -r < n/2 - n ? n/2 - n : -r;
+	*d1 =  r > n/2 - 1 ? n/2 - 1 :  r;
+}
+
+// normalized 1D gaussian taps k[d-d0], for d = d0, ..., d1
+static void blur_gaussian_taps(float *k, int d0, int d1, float sigma)
+{
+	double m = 0;
+	for (int d = d0; d <= d1; d++)
+		m += k[d-d0] = exp(-d*d/(2.0*sigma*sigma));
+	for (int d = d0; d <= d1; d++)
+		k[d-d0] /= m;
+}
+
+// y[i] = sum_d k[d-d0] x[i-d] along the rows and then along the columns
+// (the temporary image is taken from the arena "a")
+static void blur_fir_2d(float *y, float *x, int w, int h,
+		float *kx, int dx0, int dx1, float *ky, int dy0, int dy1,
+		struct xarena *a)
+{
+	struct xarena_mark m = xarena_mark(a);
+	float *t = xarena_alloc(a, w*(long)h*sizeof*t);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float e[w + dx1 - dx0]; // e[s] = x[j][s-dx1]
+		for (int s = 0; s < w + dx1 - dx0; s++)
+			e[s] = x[j*w + blur_mod(s - dx1, w)];
+		for (int i = 0; i < w; i++)
+		{
+			float a = 0;
+			for (int d = dx0; d <= dx1; d++)
+				a += kx[d-dx0] * e[i - d + dx1];
+			t[j*w+i] = a;
+		}
+	}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float *yj = y + j*(long)w;
+		for (int i = 0; i < w; i++)
+			yj[i] = 0;
+		for (int d = dy0; d <= dy1; d++)
+		{
+			float kd = ky[d-dy0];
+			float *tj = t + blur_mod(j - d, h)*(long)w;
+			for (int i = 0; i < w; i++)
+				yj[i] += kd * tj[i];
+		}
+	}
+	xarena_release(a, m);
+}
+
+// y[i] = mean of x[i-d] for d = d0, ..., d1, by running sums (in double)
+static void blur_box_line(float *y, float *x, int n, long s, int d0, int d1)
+{
+	int m = d1 - d0 + 1;
+	float e[n];
+	double a = 0;
+	for (int t = -d1; t <= -d0; t++)
+		a += x[blur_mod(t, n)*s];
+	for (int i = 0; i < n; i++)
+	{
+		e[i] = a / m;
+		a += x[blur_mod(i - d0 + 1, n)*s] - x[blur_mod(i - d1, n)*s];
+	}
+	for (int i = 0; i < n; i++)
+		y[i*s] = e[i];
+}
+
+static void blur_box_2d(float *y, float *x, int w, int h,
+		int dx0, int dx1, int dy0, int dy1)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int j = 0; j < h; j++)
+		blur_box_line(y + j*(long)w, x + j*(long)w, w, 1, dx0, dx1);
+	// the columns are processed by strips, for the sake of the cache
+	int sw = 16;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i0 = 0; i0 < w; i0 += sw)
+	{
+		int m = dy1 - dy0 + 1, n = i0 + sw > w ? w - i0 : sw;
+		double a[sw];
+		float (*e)[sw] = xmalloc(h*sizeof*e);
+		for (int i = 0; i < n; i++) a[i] = 0;
+		for (int t = -dy1; t <= -dy0; t++)
+			for (int i = 0; i < n; i++)
+				a[i] += y[blur_mod(t, h)*(long)w + i0 + i];
+		for (int j = 0; j < h; j++)
+		{
+			float *p = y + blur_mod(j - dy0 + 1, h)*(long)w + i0;
+			float *q = y + blur_mod(j - dy1, h)*(long)w + i0;
+			for (int i = 0; i < n; i++)
+			{
+				e[j][i] = a[i] / m;
+				a[i] += p[i] - q[i];
+			}
+		}
+		for (int j = 0; j < h; j++)
+			for (int i = 0; i < n; i++)
+				y[j*(long)w + i0 + i] = e[j][i];
+		free(e);
+	}
+}
+
+// coefficients of the Young-van Vliet recursive gaussian
+// (I.T. Young, L.J. van Vliet, "Recursive implementation of the Gaussian
+// filter", Signal Processing 44, 1995)
+static void blur_yvv_coefficients(double b[4], float sigma)
+{
+	double q = sigma >= 2.5 ? 0.98711*sigma - 0.96330
+		: 3.97156 - 4.14554*sqrt(1 - 0.26891*sigma);
+	double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+	b[1] = (2.44413*q + 2.85619*q*q + 1.26661*q*q*q) / b0;
+	b[2] = -(1.4281*q*q + 1.26661*q*q*q) / b0;
+	b[3] = 0.422205*q*q*q / b0;
+	b[0] = 1 - b[1] - b[2] - b[3];
+}
+
+// recursive gaussian of nv interleaved lines of length n, with stride s
+// (the periodic boundary is obtained by warming up on L wrapped samples)
+static void blur_yvv_lines(float *y, float *x, int n, long s, int nv,
+		double b[4], int L)
+{
+	int N = n + 2*L;
+	double *e = xmalloc(N*(long)nv*sizeof*e);
+	for (int t = 0; t < N; t++)
+	for (int v = 0; v < nv; v++)
+		e[t*nv+v] = x[blur_mod(t - L, n)*s + v];
+	for (int t = 0; t < N; t++)
+	for (int v = 0; v < nv; v++)
+	{
+		double *p = e + v;
+		#define E(i) p[(i < 0 ? 0 : i)*nv]
+		p[t*nv] = b[0]*p[t*nv] + b[1]*E(t-1) + b[2]*E(t-2) + b[3]*E(t-3);
+		#undef E
+	}
+	for (int t = N - 1; t >= 0; t--)
+	for (int v = 0; v < nv; v++)
+	{
+		double *p = e + v;
+		#define E(i) p[(i >= N ? N - 1 : i)*nv]
+		p[t*nv] = b[0]*p[t*nv] + b[1]*E(t+1) + b[2]*E(t+2) + b[3]*E(t+3);
+		#undef E
+	}
+	for (int i = 0; i < n; i++)
+	for (int v = 0; v < nv; v++)
+		y[i*s + v] = e[(i+L)*nv+v];
+	free(e);
+}
+
+static void blur_yvv_2d(float *y, float *x, int w, int h, float sigma)
+{
+	double b[4];
+	blur_yvv_coefficients(b, sigma);
+	int L = ceil(6*sigma);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int j = 0; j < h; j++)
+		blur_yvv_lines(y + j*(long)w, x + j*(long)w, w, 1, 1, b, L);
+	int sw = 16;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i0 = 0; i0 < w; i0 += sw)
+		blur_yvv_lines(y + i0, y + i0, h, w, i0+sw > w ? w-i0 : sw, b, L);
+}
+
+// c = the channel l of x, with zeros instead of the non-finite samples
+// (the rows are distributed with the static schedule of the filters, see
+// threads.c, so that this first touch places the planes near their threads)
+static void blur_plane_from_channel(float *c, float *x, int w, int h, int pd,
+		int l)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	FORJ(h) FORI(w) {
+		float v = x[(j*(long)w+i)*pd+l];
+		c[j*(long)w+i] = isfinite(v) ? v : 0;
+	}
+}
+
+// the channel l of y = b, or c - b when c is given
+static void blur_channel_from_plane(float *y, int w, int h, int pd, int l,
+		float *b, float *c)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	FORJ(h) FORI(w) {
+		long k = j*(long)w+i;
+		y[k*pd+l] = c ? c[k] - b[k] : b[k];
+	}
+}
+
+// gaussian blur of deviation "sigma" (or the kernel minus the identity)
+// by a spatial filter; returns false if the FFT should be used instead
+static bool blur_gaussian_spatial(float *y, float *x, int w, int h, int pd,
+		float sigma, bool substract)
+{
+	if (BLUR_FFT() > 0 || !(sigma > 0)) return false;
+	int r = ceil(5*sigma), dx0, dx1, dy0, dy1;
+	blur_taps_range(&dx0, &dx1, r, w);
+	blur_taps_range(&dy0, &dy1, r, h);
+	bool fir = dx1 - dx0 <= 2*BLUR_FIR_MAX() && dy1 - dy0 <= 2*BLUR_FIR_MAX();
+	bool iir = BLUR_IIR() > 0 && sigma >= 1 && 6*sigma <= fmin(w, h);
+	if (!fir && !iir) return false;
+
+	float kx[dx1 - dx0 + 1], ky[dy1 - dy0 + 1];
+	blur_gaussian_taps(kx, dx0, dx1, sigma);
+	blur_gaussian_taps(ky, dy0, dy1, sigma);
+	// the temporaries of all the channels, mapped once
+	struct xarena a[1];
+	xarena_init(a, 3 * (w*(long)h*sizeof(float) + XARENA_ALIGN));
+	float *c = xarena_alloc(a, w*(long)h*sizeof*c);
+	float *b = xarena_alloc(a, w*(long)h*sizeof*b);
+	FORL(pd) {
+		blur_plane_from_channel(c, x, w, h, pd, l);
+		if (fir)
+			blur_fir_2d(b, c, w, h, kx, dx0, dx1, ky, dy0, dy1, a);
+		else
+			blur_yvv_2d(b, c, w, h, sigma);
+		blur_channel_from_plane(y, w, h, pd, l, b, substract ? c : NULL);
+	}
+	xarena_free(a);
+	return true;
+}
+
+// blur by the square kernel of size "nx x ny" (as in kernel_2d_square)
+static bool blur_square_spatial(float *y, float *x, int w, int h, int pd,
+		float nx, float ny, bool substract)
+{
+	if (BLUR_FFT() > 0 || !(nx > 0 && ny > 0)) return false;
+	int dx0, dx1, dy0, dy1; // the taps are the integers with 2|d| < n
+	blur_taps_range(&dx0, &dx1, ceil(nx/2) - 1, w);
+	blur_taps_range(&dy0, &dy1, ceil(ny/2) - 1, h);
+
+	float *c = xmalloc(w*(long)h*sizeof*c);
+	float *b = xmalloc(w*(long)h*sizeof*b);
+	FORL(pd) {
+		blur_plane_from_channel(c, x, w, h, pd, l);
+		blur_box_2d(b, c, w, h, dx0, dx1, dy0, dy1);
+		blur_channel_from_plane(y, w, h, pd, l, b, substract ? c : NULL);
 	}
 	free(c);
-	free(kc);
+	free(b);
+	return true;
+}
+
+// gausian blur of a 2D image with pd-dimensional pixels
+// (the blurring is performed independently for each co-ordinate)
+void gblur(float *y, float *x, int w, int h, int pd, float s)
+{
+	if (!s) {
+		FORI(w*h*pd) y[i] = isfinite(x[i]) ? x[i] : 0;
+		return;
+	}
+	if (blur_gaussian_spatial(y, x, w, h, pd, s/M_SQRT2, false))
+		return;
+
+	float *g = xmalloc(w*h*sizeof*g);
+	fill_2d_gaussian_image(g, w, h, 1/s);
+	fftwf_complex *fg = fftwf_xmalloc(rfft_size(w, h)*sizeof*fg);
+	rfft_2dfloat(fg, g, w, h);
+	free(g);
+
+	color_fconvolution_2d(y, x, fg, w, h, pd);
+
+	fftwf_free(fg);
+}
+
+// gaussian blur of a gray 2D image
+void gblur_gray(float *y, float *x, int w, int h, float s)
+{
+	gblur(y, x, w, h, 1, s);
+}
+
+// Cache of the spectra of the kernels.
+//
+// When the environment variable BLUR_SPECTRUM_CACHE names a directory, the
+// half spectrum of each kernel is saved there, in a file named after the
+// kernel, its parameters and the size of the image, and it is loaded from
+// there by the next calls with the same kernel and size (e.g., when the
+// same filter is applied to many images of the same size).
+
+// name of the file of the spectrum of a kernel (empty if there is no cache)
+static void blur_spectrum_name(char *r, char *kernel_id, float *p,
+		int w, int h)
+{
+	char *d = getenv("BLUR_SPECTRUM_CACHE");
+	*r = 0;
+	if (!d || !*d) return;
+	int n = snprintf(r, FILENAME_MAX, "%s/blur_%c%d_%dx%d", d,
+			tolower(kernel_id[0]), isupper(kernel_id[0]) ? 1 : 0,
+			w, h);
+	for (int i = 0; i < p[0] && n < FILENAME_MAX; i++)
+		n += snprintf(r + n, FILENAME_MAX - n, "_%a", p[1+i]);
+	if (n >= FILENAME_MAX - 5) { *r = 0; return; }
+	snprintf(r + n, FILENAME_MAX - n, ".spec");
+}
+
+static bool blur_spectrum_load(fftwf_complex *fk, long n, char *fname)
+{
+	FILE *f = fopen(fname, "r");
+	if (!f) return false;
+	long r = fread(fk, sizeof*fk, n, f);
+	bool ok = r == n && fgetc(f) == EOF;
+	fclose(f);
+	return ok;
+}
+
+// (the spectrum is written to a temporary file that is then renamed, so that
+// the concurrent runs never see a partial file)
+static void blur_spectrum_save(char *fname, fftwf_complex *fk, long n)
+{
+	char t[FILENAME_MAX + 32];
+	snprintf(t, sizeof t, "%s.%d", fname, (int)getpid());
+	FILE *f = fopen(t, "w");
+	if (!f) return;
+	bool ok = n == (long)fwrite(fk, sizeof*fk, n, f);
+	ok = !fclose(f) && ok;
+	if (!ok || rename(t, fname))
+		remove(t);
 }
 
 void blur_2d(float *y, float *x, int w, int h, int pd,
@@ -458,16 +809,32 @@ void blur_2d(float *y, float *x, int w, int h, int pd,
 	default: fail("unrecognized kernel name \"%s\"", kernel_id);
 	}
 
-	float *k = xmalloc(w*h*sizeof*k);
-	fill_kernel_image(k, w, h, f, p);
-	if (isupper(kernel_id[0]))
-		substract_from_identity(k, w, h);
-	//void iio_write_image_float(char*,float*,int,int);
-	//iio_write_image_float("/tmp/blurk.tiff", k, w, h);
-
-	fftwf_complex *fk = fftwf_xmalloc(w*h*sizeof*fk);
-	fft_2dfloat(fk, k, w, h);
-	free(k);
+	// separable kernels that can be computed without FFT
+	bool sub = isupper(kernel_id[0]);
+	if (f == kernel_2d_gaussian && nparams == 1 &&
+		blur_gaussian_spatial(y, x, w, h, pd, param[0], sub))
+			return;
+	if (f == kernel_2d_square && (nparams == 1 || nparams == 2) &&
+		blur_square_spatial(y, x, w, h, pd, param[0],
+			param[nparams-1], sub))
+			return;
+
+	long n = rfft_size(w, h);
+	fftwf_complex *fk = fftwf_xmalloc(n*sizeof*fk);
+	char cache[FILENAME_MAX];
+	blur_spectrum_name(cache, kernel_id, p, w, h);
+	if (!*cache || !blur_spectrum_load(fk, n, cache)) {
+		float *k = xmalloc(w*h*sizeof*k);
+		fill_kernel_image(k, w, h, f, p);
+		if (isupper(kernel_id[0]))
+			substract_from_identity(k, w, h);
+		//void iio_write_image_float(char*,float*,int,int);
+		//iio_write_image_float("/tmp/blurk.tiff", k, w, h);
+		rfft_2dfloat(fk, k, w, h);
+		free(k);
+		if (*cache)
+			blur_spectrum_save(cache, fk, n);
+	}
 
 	color_fconvolution_2d(y, x, fk, w, h, pd);
 
@@ -475,6 +842,44 @@ void blur_2d(float *y, float *x, int w, int h, int pd,
 }
 
 
+// scale space: the blurs of x by the gaussians of increasing standard
+// deviations s[0] <= s[1] <= ... <= s[n-1], as the n*pd channels of y (the
+// pd channels of the first level, then those of the second level, etc.)
+//
+// Each level is computed from the previous one, by the gaussian of the
+// difference of the variances.  Since this gaussian is narrower, it is
+// usually computed by the spatial filters (see BLUR_FIR_MAX and BLUR_IIR).
+// When it is not, the level is computed from the image by the FFT, whose
+// cost does not depend on the scale.
+void gblur_stack(float *y, float *x, int w, int h, int pd, float *s, int n)
+{
+	long np = w * (long)h * pd;
+	float *a = xmalloc(np * sizeof*a); // previous level
+	float *b = xmalloc(np * sizeof*b); // current level
+	for (int k = 0; k < n; k++)
+	{
+		if (k && !(s[k] >= s[k-1]))
+			fail("the scales must be increasing (%g < %g)",
+					s[k], s[k-1]);
+		float d = k ? sqrt(s[k]*s[k] - s[k-1]*s[k-1]) : 0;
+		if (k && d > 0 && blur_gaussian_spatial(b, a, w, h, pd, d, false))
+			;
+		else if (k && !(d > 0))
+			memcpy(b, a, np * sizeof*b);
+		else
+			blur_2d(b, x, w, h, pd, "g", s + k, 1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+		for (long i = 0; i < w * (long)h; i++)
+			for (int l = 0; l < pd; l++)
+				y[(i*n + k)*pd + l] = b[i*pd + l];
+		float *t = a; a = b; b = t;
+	}
+	free(a);
+	free(b);
+}
+
 #ifndef OMIT_BLUR_MAIN
 #define MAIN_BLUR
 #endif
@@ -517,10 +922,16 @@ static char *help_string_long     =
 " -z        zero boundary\n"
 " -s        symmetrized boundary\n"
 " -p        periodic boundary\n"
+" -t SIDE   process huge images by tiles of the given side (zero boundary)\n"
+" -m HALO   margin of the tiles (by default, the support of the kernel)\n"
+" -l        gaussian scale space: the blurs by each of the (increasing)\n"
+"           parameters, as the channels of a single image\n"
 "\n"
 "Examples:\n"
 " blur g 1.6                              Smooth an image by a slight amount\n"
 " blur C 1 | qauto                        Linear retinex\n"
+" blur -t 2048 g 3 big.tif blurred.tif   Blur a huge tiled tiff\n"
+" blur -l g \"1 2 4 8\" in.png stack.tif   Four levels of the scale space\n"
 " plambda - \"x,l -1 *\" | blur i 0.25    Laplacian square root\n"
 " plambda - \"x,l\" | blur z 0.25 | plambda - \"0 >\"      Linear dithering\n"
 "\n"
@@ -530,6 +941,123 @@ static char *help_string_long     =
 #include "parsenumbers.c"
 #include "pickopt.c"
 #include "iio.h"
+#include "fancy_image.h"
+#include "profile.c"
+
+// radius of the (numerical) support of a kernel, or -1 if it is not compact
+static int blur_kernel_radius(char *kernel_id, float *p, int np)
+{
+	float r = -1;
+	switch(tolower(kernel_id[0])) {
+	case 'g': r = 5 * p[0]; break;
+	case 'l': r = 8 * p[0]; break;
+	case 'd': r = p[0];     break;
+	case 's': r = fmax(p[0], p[np-1]) / 2; break;
+	}
+	return r < 0 ? -1 : ceil(r);
+}
+
+// blur one tile of side "t" with a halo of "m" pixels (see below)
+static void blur_one_tile(struct fancy_image *b, struct fancy_image *a,
+		int x0, int y0, int t, int n, int m,
+		char *kernel_id, float *param, int nparams)
+{
+	int pd = a->pd;
+	float *x = xmalloc(n*(long)n*pd*sizeof*x);
+	float *y = xmalloc(n*(long)n*pd*sizeof*y);
+	fancy_image_fill_rectangle_float_vec(x, n, n, a, 0, x0 - m, y0 - m);
+	blur_2d(y, x, n, n, pd, kernel_id, param, nparams);
+	int cw = fmin(t, a->w - x0);
+	int ch = fmin(t, a->h - y0);
+#ifdef _OPENMP
+#pragma omp critical(blur_tiles)
+#endif
+	for (int j = 0; j < ch; j++)
+	for (int i = 0; i < cw; i++)
+	for (int l = 0; l < pd; l++)
+		fancy_image_setsample(b, x0 + i, y0 + j, l,
+				y[((j+m)*(long)n + i+m)*pd + l]);
+	free(x);
+	free(y);
+}
+
+// blur a huge image by tiles (overlap-save)
+//
+// Each tile of side "t" is blurred in a window of side "n" (a power of two
+// larger than t+2*m), whose halo is then discarded.  The samples outside
+// the image, and the NANs, are zero.  Only a few tiles of the input and the
+// output are in memory at each time, and they are processed in parallel.
+static void blur_by_tiles(char *fname_out, char *fname_in, int t, int m,
+		char *kernel_id, float *param, int nparams)
+{
+	t = 16 * ((t + 15) / 16);
+	int ot = 256; // side of the output tiles, which must divide t
+	while (t % ot) ot /= 2;
+	int n = 1;
+	while (n < t + 2*m) n *= 2;
+	m = (n - t) / 2; // the surplus of the FFT size is used as halo
+
+	int nthreads = 1;
+#ifdef _OPENMP
+	nthreads = omp_get_max_threads();
+#endif
+	struct fancy_image *a = fancy_image_open(fname_in, "r");
+	double mb = 2.0 * nthreads * (n + 512.0) * (n + 512.0) * a->pd * 4 / 1e6;
+	fancy_image_close(a);
+	char opts[100];
+	snprintf(opts, sizeof opts, "r,megabytes=%g", fmax(100, mb));
+	a = fancy_image_open(fname_in, opts);
+	struct fancy_image *b = fancy_image_create(fname_out,
+			"megabytes=%g,w=%d,h=%d,pd=%d,bps=32,fmt=3,tw=%d,th=%d",
+			fmax(100, mb), a->w, a->h, a->pd, ot, ot);
+
+	int ntx = (a->w + t - 1) / t;
+	int nty = (a->h + t - 1) / t;
+	// the first tile initializes the plans and the smart parameters
+	blur_one_tile(b, a, 0, 0, t, n, m, kernel_id, param, nparams);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int k = 1; k < ntx * nty; k++)
+		blur_one_tile(b, a, (k % ntx) * t, (k / ntx) * t, t, n, m,
+				kernel_id, param, nparams);
+
+	fancy_image_close(b);
+	fancy_image_close(a);
+}
+
+// The boundary conditions of the FFT blur are obtained by extending the
+// image (periodically, by symmetry or by zeros) into a larger one, whose
+// periodic blur is cropped back.  By default, the extension has twice the
+// size of the image, which is exact for all the kernels.  For the compact
+// kernels whose support fits, the extension has only the size of the image
+// plus the support of each side, rounded up to a size that FFTW transforms
+// quickly (the results are the same, but the transforms of the awkward or
+// prime sizes are much faster).  In both cases, the extension is the half
+// that follows the image on the right and the half that precedes it,
+// wrapped around on the left.
+
+// size of the extension of a side n of the image
+static int blur_extended_size(int n, char *kernel_id, float *p, int np)
+{
+	char k = tolower(kernel_id[0]);
+	int r = k == 'g' || k == 'd' || k == 's' ?
+		blur_kernel_radius(kernel_id, p, np) : -1;
+	int m = r >= 0 ? fftplan_fast_size(n + 2*r + 2) : 2*n;
+	return m < 2*n ? m : 2*n;
+}
+
+// position in the image of the position i of its extension of size nn
+// (-1 for the zeros)
+static int blur_extended_index(int i, int n, int nn, int mode)
+{
+	if (i < n) return i;
+	int e = i < n + (nn - n) / 2 ? i - n : i - nn; // offset from the edge
+	if (mode == 0) return -1;
+	if (mode == 1) return e < 0 ? n + e : e;
+	return e < 0 ? -e - 1 : n - 1 - e;
+}
+
 int main_blur(int c, char *v[])
 {
 	if (c == 2)
@@ -538,6 +1066,9 @@ int main_blur(int c, char *v[])
 	bool boundary_symmetric = pick_option(&c, &v, "s", NULL);
 	bool boundary_periodic  = pick_option(&c, &v, "p", NULL);
 	bool boundary_zero      = pick_option(&c, &v, "z", NULL);
+	int tile_side = atoi(pick_option(&c, &v, "t", "0"));
+	int tile_halo = atoi(pick_option(&c, &v, "m", "-1"));
+	bool stack = pick_option(&c, &v, "l", NULL);
 	if (c != 5 && c != 3 && c != 4) {
 		fprintf(stderr, "usage:\n\t"
 				"%s kernel \"params\" [in [out]]\n", *v);
@@ -549,46 +1080,84 @@ int main_blur(int c, char *v[])
 	char *filename_in = c > 3 ? v[3] : "-";
 	char *filename_out = c > 4 ? v[4] : "-";
 
-	int maxparam = 10;
+	int maxparam = 100;
 	float param[maxparam];
 	int nparams = parse_floats(param, maxparam, kernel_params);
 	if (nparams < 1) fail("please, give at least one parameter");
+	if (stack && (kernel_id[0] != 'g' || tile_side > 0))
+		fail("the scale space needs the kernel \"g\", without tiles");
+	int nlevels = stack ? nparams : 1;
+	float *ext_param = stack ? param + nparams - 1 : param; // (the widest)
+	int ext_nparams = stack ? 1 : nparams;
 	//fprintf(stderr, "nparams = %d\n", nparams);
 	//FORI(nparams)
 	//	fprintf(stderr, "param[%d] = %g\n", i, param[i]);
 
+	if (tile_side > 0) {
+		if (c != 5 || !strcmp(filename_in, "-") || !strcmp(filename_out, "-"))
+			fail("tiled blur needs the names of the input and output");
+		if (boundary_symmetric || boundary_periodic)
+			fail("tiled blur has always a zero boundary");
+		if (tile_halo < 0)
+			tile_halo = blur_kernel_radius(kernel_id, param, nparams);
+		if (tile_halo < 0)
+			fail("kernel \"%s\" is not compact, give a halo with -m",
+					kernel_id);
+		blur_by_tiles(filename_out, filename_in, tile_side, tile_halo,
+				kernel_id, param, nparams);
+		return EXIT_SUCCESS;
+	}
+
+	threads_pin();
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
-	float *y = xmalloc(w*h*pd*sizeof*y);
+	x = threads_spread_rows(x, h, w*(size_t)pd*sizeof*x);
+	int opd = pd * nlevels;
+	float *y = threads_alloc_rows(h, w*(size_t)opd*sizeof*y);
 
 	if (boundary_symmetric || boundary_zero || boundary_periodic) {
-		int ww = 2*w, hh = 2*h;
-		float *xx = xmalloc(ww*hh*pd*sizeof*xx);
-		float *yy = xmalloc(ww*hh*pd*sizeof*xx);
-		for (int j = 0; j < h; j++)
-		for (int i = 0; i < w; i++)
-		for (int l = 0; l < pd; l++)
+		int mode = boundary_zero ? 0 : boundary_periodic ? 1 : 2;
+		int ww = blur_extended_size(w, kernel_id, ext_param, ext_nparams);
+		int hh = blur_extended_size(h, kernel_id, ext_param, ext_nparams);
+		int ii[ww];
+		for (int i = 0; i < ww; i++)
+			ii[i] = blur_extended_index(i, w, ww, mode);
+		float *xx = threads_alloc_rows(hh, ww*(size_t)pd*sizeof*xx);
+		float *yy = threads_alloc_rows(hh, ww*(size_t)opd*sizeof*yy);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+		for (int jj = 0; jj < hh; jj++)
 		{
-			float g = x[(j*w+i)*pd+l];
-			float g0 = boundary_zero ? 0 : g;
-			int si = boundary_periodic ? w+i : 2*w - i - 1;
-			int sj = boundary_periodic ? h+j : 2*h - j - 1;
-			xx[( j*ww +  i)*pd+l] = g;
-			xx[(sj*ww +  i)*pd+l] = g0;
-			xx[( j*ww + si)*pd+l] = g0;
-			xx[(sj*ww + si)*pd+l] = g0;
+			int j = blur_extended_index(jj, h, hh, mode);
+			if (j >= 0)
+			for (int i = 0; i < ww; i++)
+			for (int l = 0; l < pd; l++)
+				xx[(jj*(long)ww+i)*pd+l] = ii[i] < 0 ? 0 :
+					x[(j*(long)w+ii[i])*pd+l];
 		}
-		blur_2d(yy, xx, ww, hh, pd, kernel_id, param, nparams);
+		PROFILE_SCOPE("blur")
+			if (stack)
+				gblur_stack(yy, xx, ww, hh, pd, param, nparams);
+			else
+				blur_2d(yy, xx, ww, hh, pd, kernel_id, param,
+						nparams);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
 		for (int j = 0; j < h; j++)
 		for (int i = 0; i < w; i++)
-		for (int l = 0; l < pd; l++)
-			y[(j*w+i)*pd+l] = yy[(j*ww+i)*pd+l];
+		for (int l = 0; l < opd; l++)
+			y[(j*w+i)*opd+l] = yy[(j*ww+i)*opd+l];
 		free(xx);
 		free(yy);
-	} else
-		blur_2d(y, x, w, h, pd, kernel_id, param, nparams);
+	} else PROFILE_SCOPE("blur")
+		if (stack)
+			gblur_stack(y, x, w, h, pd, param, nparams);
+		else
+			blur_2d(y, x, w, h, pd, kernel_id, param, nparams);
 
-	iio_write_image_float_vec(filename_out, y, w, h, pd);
+	iio_write_image_float_vec(filename_out, y, w, h, opd);
 	free(x);
 	free(y);
 	return EXIT_SUCCESS;
@@ -9,32 +9,17 @@
 
 #include "xmalloc.c"
 #include "getpixel.c"
+#include "nanreduce.c"
 
 // zoom-out by 2x2 block averages
 // NANs are discarded when possible
 static void zoom_out_by_factor_two(float *out, int ow, int oh,
 		float *in, int iw, int ih, int pd)
 {
-	getsample_operator p = getsample_1;
 	assert(abs(2*ow-iw) < 2);
 	assert(abs(2*oh-ih) < 2);
-	for (int j = 0; j < oh; j++)
-	for (int i = 0; i < ow; i++)
-	for (int l = 0; l < pd; l++)
-	{
-		float a[4], m = 0;
-		a[0] = p(in, iw, ih, pd, 2*i, 2*j, l);
-		a[1] = p(in, iw, ih, pd, 2*i+1, 2*j, l);
-		a[2] = p(in, iw, ih, pd, 2*i, 2*j+1, l);
-		a[3] = p(in, iw, ih, pd, 2*i+1, 2*j+1, l);
-		int cx = 0;
-		for (int k = 0; k < 4; k++)
-			if (isfinite(a[k])) {
-				m += a[k];
-				cx += 1;
-			}
-		out[(ow*j + i)*pd+l] = cx ? m/cx : NAN;
-	}
+	nanreduce2(out, ow, oh, in, iw, ih, pd, NANREDUCE_FMEAN,
+			NANREDUCE_EDGE_CLAMP);
 }
 
 // evaluate a bilinear cell at the given point
@@ -85,6 +70,9 @@ static void zoom_in_by_factor_two(float *out, int ow, int oh,
 {
 	assert(abs(2*iw-ow) < 2);
 	assert(abs(2*ih-oh) < 2);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < oh; j++)
 	for (int i = 0; i < ow; i++)
 		bilinear_interpolation_vec(out+pd*(ow*j+i), in, iw, ih, pd,
@@ -135,10 +123,13 @@ static void float_weisz(float *y, float *x, int d, int n)
 static void median_filter_vec(float *y, float *x, int w, int h, int pd, int rad)
 {
 	int np = (2 * rad + 1) * (2 * rad + 1);
-	float p[np * pd];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 	{
+		float p[np * pd];
 		int cx = 0;
 		for (int dy = -rad; dy <= rad; dy++)
 		for (int dx = -rad; dx <= rad; dx++)
@@ -155,13 +146,13 @@ static void median_filter_vec(float *y, float *x, int w, int h, int pd, int rad)
 	}
 }
 
-static void vector_median_filter_inline(float *x, int w, int h, int pd, int rad)
+// (tmp is a buffer of w*h*pd floats)
+static void vector_median_filter_inline(float *x, float *tmp,
+		int w, int h, int pd, int rad)
 {
 	fprintf(stderr, "mfilter %d %d\n", w, h);
-	float *tmp = xmalloc(w * h * pd * sizeof*tmp);
 	median_filter_vec(tmp, x, w, h, pd, rad);
 	memcpy(x, tmp, w * h * pd * sizeof*tmp);
-	free(tmp);
 }
 
 static float squared_euclidean_distance(float *x, float *y, int n)
@@ -175,13 +166,20 @@ static float squared_euclidean_distance(float *x, float *y, int n)
 	return r;
 }
 
+static float absolute_distance(float *x, float *y, int n)
+{
+	int r = 0;
+	for (int i = 0; i < n; i++)
+		r += fabs(x[i] - y[i]);
+	return r;
+}
+
 typedef float (*cost_function_t)(float*,float*,int,int,int,int,int,int,float*);
 
-static float eval_displacement_by_bm(float *a, float *b, int w, int h, int pd,
-		int wrad, int i, int j, float d[2])
+// the windows of a around (i,j) and of b around (i,j)+d, extended by zero
+static void get_windows(float *va, float *vb, float *a, float *b,
+		int w, int h, int pd, int wrad, int i, int j, float d[2])
 {
-	int wside = 2 * wrad + 1;
-	float va[wside*wside*pd], vb[wside*wside*pd];
 	int cx = 0;
 	for (int dy = -wrad; dy <= wrad; dy++)
 	for (int dx = -wrad; dx <= wrad; dx++)
@@ -194,9 +192,26 @@ static float eval_displacement_by_bm(float *a, float *b, int w, int h, int pd,
 		cx += 1;
 
 	}
+}
+
+static float eval_displacement_by_bm(float *a, float *b, int w, int h, int pd,
+		int wrad, int i, int j, float d[2])
+{
+	int wside = 2 * wrad + 1;
+	float va[wside*wside*pd], vb[wside*wside*pd];
+	get_windows(va, vb, a, b, w, h, pd, wrad, i, j, d);
 	return squared_euclidean_distance(va, vb, wside*wside*pd);
 }
 
+static float eval_displacement_by_sad(float *a, float *b, int w, int h, int pd,
+		int wrad, int i, int j, float d[2])
+{
+	int wside = 2 * wrad + 1;
+	float va[wside*wside*pd], vb[wside*wside*pd];
+	get_windows(va, vb, a, b, w, h, pd, wrad, i, j, d);
+	return absolute_distance(va, vb, wside*wside*pd);
+}
+
 static float eval_displacement_by_sc(float *a, float *b, int w, int h, int pd,
 		int wrad, int i, int j, float d[2])
 {
@@ -207,8 +222,8 @@ static float eval_displacement_by_sc(float *a, float *b, int w, int h, int pd,
 	//int cx = 0;
 	for (int l = 0; l < pd; l++)
 	{
-		float va = getsample_nan(a, w, h, pd, i, j, l);
-		float vb = getsample_nan(b, w, h, pd, i, j, l);
+		float va = getsample_nan(a, w, h, pd, i       , j       , l);
+		float vb = getsample_nan(b, w, h, pd, i + d[0], j + d[1], l);
 		for (int dy = -wrad; dy <= wrad; dy++)
 		for (int dx = -wrad; dx <= wrad; dx++)
 		{
@@ -242,22 +257,26 @@ static float eval_displacement_by_census(float *a, float *b,
 	return r;
 }
 
+
+// candidate steps of the local optimization (only the first ones are used)
+static const int refine_neig[17][2] = { {0,0}, //1
+	{-1,0}, {0,-1}, {0,1}, {1,0},//5
+	{-1,-1}, {-1,1}, {1,-1}, {1,1}, //9
+	{2,0},{-2,0},{0,2},{0,-2},//13
+	{3,0},{-3,0},{0,3},{0,-3},//17
+};
+#define REFINE_NNEIG 5
+
 static void refine_displacement_at(float d[2], float *a, float *b,
 		int w, int h, int pd, int wrad, int i, int j,
 	       	cost_function_t e)
 {
 	int best_index = -1;
-	int neig[17][2] = { {0,0}, //1
-		{-1,0}, {0,-1}, {0,1}, {1,0},//5
-		{-1,-1}, {-1,1}, {1,-1}, {1,1}, //9
-		{2,0},{-2,0},{0,2},{0,-2},//13
-		{3,0},{-3,0},{0,3},{0,-3},//17
-	};
 	float best_energy = INFINITY;
 
-	for (int n = 0; n < 5; n++)
+	for (int n = 0; n < REFINE_NNEIG; n++)
 	{
-		float D[2] = {d[0] + neig[n][0], d[1] + neig[n][1]};
+		float D[2] = {d[0] + refine_neig[n][0], d[1] + refine_neig[n][1]};
 		float r = e(a,b, w,h,pd, wrad, i,j, D);
 		if (r < best_energy) {
 			best_energy = r;
@@ -266,13 +285,16 @@ static void refine_displacement_at(float d[2], float *a, float *b,
 	}
 	assert(best_index >= 0);
 
-	d[0] += neig[best_index][0];
-	d[1] += neig[best_index][1];
+	d[0] += refine_neig[best_index][0];
+	d[1] += refine_neig[best_index][1];
 }
 
 static void refine_displacement(float *d, float *a, float *b,
 		int w, int h, int pd, int wrad, cost_function_t e)
 {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 	{
@@ -282,37 +304,221 @@ static void refine_displacement(float *d, float *a, float *b,
 	}
 }
 
-void bmms_rec(float *out, float *a, float *b,
-		int w, int h, int pd, int wrad, int mrad, int scale,
+// Engine for the SSD, SAD and census costs, that evaluates whole rows.
+//
+// The displacements are integers, constant on large regions, so that each
+// row is split into runs of pixels of the same displacement.  Along a run,
+// the SSD and SAD costs are box filters of the pixel costs, computed by
+// running sums of column sums: (n+2r)(2r+1) pixel costs for n pixels, instead
+// of n(2r+1)^2.  The census costs are popcounts of the xor of bit-packed
+// census signatures, computed once for each scale.  The results are the same
+// as those of the cost functions above (whose sums are also on integers).
+
+#define BMMS_SSD    1
+#define BMMS_SAD    2
+#define BMMS_CENSUS 3
+
+#define BMMS_CENSUS_MAXRAD 3 // largest census window of 64-bit signatures
+
+// the engine cost that corresponds to a cost function (or 0 if none)
+static int engine_cost(cost_function_t e, int wrad)
+{
+	if (e == eval_displacement_by_bm) return BMMS_SSD;
+	if (e == eval_displacement_by_sad) return BMMS_SAD;
+	if (e == eval_displacement_by_sc && wrad <= BMMS_CENSUS_MAXRAD)
+		return BMMS_CENSUS;
+	return 0;
+}
+
+// bit k of the signature of a sample tells whether its k-th neighbor is larger
+// (the neighbors outside the image are not, as in "eval_displacement_by_sc")
+static void census_signatures(uint64_t *c, float *x, int w, int h, int pd,
+		int wrad)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		float v = x[(j*w + i)*pd + l];
+		uint64_t s = 0;
+		int k = 0;
+		for (int dy = -wrad; dy <= wrad; dy++)
+		for (int dx = -wrad; dx <= wrad; dx++)
+			if (dx || dy) {
+				float u = getsample_nan(x, w, h, pd, i+dx, j+dy, l);
+				s |= (uint64_t)(u > v) << k++;
+			}
+		c[(j*w + i)*pd + l] = s;
+	}
+}
+
+// r[i-i0] = cost of the displacement D at the pixels (i,j), for i0 <= i <= i1
+static void engine_row_costs(int *r, int i0, int i1, int j, int D[2],
+		float *a, float *b, uint64_t *ca, uint64_t *cb,
+		int w, int h, int pd, int wrad, int cost)
+{
+	if (cost == BMMS_CENSUS) {
+		int jb = j + D[1];
+		for (int i = i0; i <= i1; i++)
+		{
+			int ib = i + D[0], q = 0;
+			bool in = ib >= 0 && ib < w && jb >= 0 && jb < h;
+			uint64_t *sa = ca + (j*w + i)*pd;
+			uint64_t *sb = in ? cb + (jb*w + ib)*pd : NULL;
+			for (int l = 0; l < pd; l++)
+				q += __builtin_popcountll(sa[l] ^ (sb ? sb[l] : 0));
+			r[i-i0] = q;
+		}
+		return;
+	}
+
+	// sums of the pixel costs along the columns i0-wrad .. i1+wrad
+	int n = i1 - i0 + 1 + 2*wrad, col[n];
+	for (int x = 0; x < n; x++)
+		col[x] = 0;
+	for (int dy = -wrad; dy <= wrad; dy++)
+	{
+		int ja = j + dy, jb = ja + D[1];
+		bool ina = ja >= 0 && ja < h, inb = jb >= 0 && jb < h;
+		for (int x = 0; x < n; x++)
+		{
+			int ia = i0 - wrad + x, ib = ia + D[0];
+			float *pa = ina && ia >= 0 && ia < w ? a + (ja*w+ia)*pd : 0;
+			float *pb = inb && ib >= 0 && ib < w ? b + (jb*w+ib)*pd : 0;
+			for (int l = 0; l < pd; l++)
+			{
+				float q = (pa ? pa[l] : 0) - (pb ? pb[l] : 0);
+				col[x] += cost == BMMS_SSD ? q * q : fabs(q);
+			}
+		}
+	}
+
+	// running sums of 2*wrad+1 columns
+	int s = 0;
+	for (int x = 0; x < 2*wrad; x++)
+		s += col[x];
+	for (int i = 0; i <= i1 - i0; i++)
+	{
+		s += col[i + 2*wrad];
+		r[i] = s;
+		s -= col[i];
+	}
+}
+
+// like "refine_displacement", using the engine
+// (ca and cb are the census signatures of a and b, for BMMS_CENSUS)
+static void refine_displacement_engine(float *d, float *a, float *b,
+		uint64_t *ca, uint64_t *cb,
+		int w, int h, int pd, int wrad, int cost)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float *dj = d + 2*j*w;
+		int r[w], best_energy[w], best_index[w];
+		for (int i0 = 0, i1; i0 < w; i0 = i1 + 1)
+		{
+			for (i1 = i0; i1 + 1 < w; i1++)
+				if (dj[2*i1+2] != dj[2*i0] || dj[2*i1+3] != dj[2*i0+1])
+					break;
+			for (int n = 0; n < REFINE_NNEIG; n++)
+			{
+				int D[2] = {dj[2*i0+0] + refine_neig[n][0],
+				            dj[2*i0+1] + refine_neig[n][1]};
+				engine_row_costs(r, i0, i1, j, D, a, b, ca, cb,
+						w, h, pd, wrad, cost);
+				for (int i = i0; i <= i1; i++)
+					if (!n || r[i-i0] < best_energy[i]) {
+						best_energy[i] = r[i-i0];
+						best_index[i] = n;
+					}
+			}
+		}
+		for (int i = 0; i < w; i++)
+		{
+			dj[2*i+0] += refine_neig[best_index[i]][0];
+			dj[2*i+1] += refine_neig[best_index[i]][1];
+		}
+	}
+}
+
+// multiscale block matching
+// (the scales are computed from the coarsest to the finest, on buffers that
+// are allocated once for all of them)
+void bmms(float *out, float *a, float *b,
+		int w, int h, int pd, int wrad, int mrad, int nscales,
 		cost_function_t e)
 {
-	fprintf(stderr, "scal(%d) %d %d\n", scale, w, h);
-	// find an initial rhough displacement
-	if (scale > 1) {
-		int ws = ceil(w/2.0);
-		int hs = ceil(h/2.0);
-		float *As = malloc(ws * hs * pd * sizeof*As);
-		float *Bs = malloc(ws * hs * pd * sizeof*Bs);
-		float *Os = malloc(ws * hs * 2  * sizeof*Os);
-		zoom_out_by_factor_two(As, ws, hs, a, w, h, pd);
-		zoom_out_by_factor_two(Bs, ws, hs, b, w, h, pd);
-		bmms_rec(Os, As, Bs, ws, hs, pd, wrad, mrad, scale - 1, e);
-		zoom_in_by_factor_two(out, w, h, Os, ws, hs, 2);
-		if (mrad > 0)
-			vector_median_filter_inline(out, w, h, 2, mrad);
-		free(As);
-		free(Bs);
-		free(Os);
-
-		for (int i = 0; i < 2*w*h; i++)
-			out[i] = round(2*out[i]);
-	} else {
-		for (int i = 0; i < 2*w*h; i++)
-			out[i] = 0;
+	// pyramids of a, b and of the displacements (the scale 0 is given)
+	int n = nscales > 1 ? nscales : 1, ws[n], hs[n], np = 0;
+	for (int s = 0; s < n; s++)
+	{
+		ws[s] = s ? ceil(ws[s-1]/2.0) : w;
+		hs[s] = s ? ceil(hs[s-1]/2.0) : h;
+		np += s ? ws[s] * hs[s] : 0;
+	}
+	float *pa = xmalloc((np * pd + 1) * sizeof*pa);
+	float *pb = xmalloc((np * pd + 1) * sizeof*pb);
+	float *pf = xmalloc((np * 2  + 1) * sizeof*pf);
+	float *A[n], *B[n], *F[n];
+	A[0] = a;
+	B[0] = b;
+	F[0] = out;
+	for (int s = 1; s < n; s++)
+	{
+		int o = s > 1 ? (A[s-1] - pa) + ws[s-1] * hs[s-1] * pd : 0;
+		A[s] = pa + o;
+		B[s] = pb + o;
+		F[s] = pf + (s > 1 ? (F[s-1] - pf) + ws[s-1] * hs[s-1] * 2 : 0);
+		zoom_out_by_factor_two(A[s], ws[s], hs[s], A[s-1], ws[s-1], hs[s-1], pd);
+		zoom_out_by_factor_two(B[s], ws[s], hs[s], B[s-1], ws[s-1], hs[s-1], pd);
+	}
+	int cost = engine_cost(e, wrad);
+	uint64_t *ca = NULL, *cb = NULL;
+	if (cost == BMMS_CENSUS) {
+		ca = xmalloc(2 * w * h * pd * sizeof*ca);
+		cb = ca + w * h * pd;
+	}
+	float *tmp = mrad > 0 ? xmalloc(w * h * 2 * sizeof*tmp) : NULL;
+
+	for (int s = n - 1; s >= 0; s--)
+	{
+		int W = ws[s], H = hs[s];
+		fprintf(stderr, "scal(%d) %d %d\n", n - s, W, H);
+		// find an initial rhough displacement
+		if (s < n - 1) {
+			zoom_in_by_factor_two(F[s], W, H, F[s+1], ws[s+1], hs[s+1], 2);
+			if (mrad > 0)
+				vector_median_filter_inline(F[s], tmp, W, H, 2, mrad);
+			for (int i = 0; i < 2*W*H; i++)
+				F[s][i] = round(2*F[s][i]);
+		} else {
+			for (int i = 0; i < 2*W*H; i++)
+				F[s][i] = 0;
+		}
+
+		// refine the rhough displacement by local optimization
+		if (cost == BMMS_CENSUS) {
+			census_signatures(ca, A[s], W, H, pd, wrad);
+			census_signatures(cb, B[s], W, H, pd, wrad);
+		}
+		if (cost)
+			refine_displacement_engine(F[s], A[s], B[s], ca, cb,
+					W, H, pd, wrad, cost);
+		else
+			refine_displacement(F[s], A[s], B[s], W, H, pd, wrad, e);
 	}
 
-	// refine the rhough displacement by local optimization
-	refine_displacement(out, a, b, w, h, pd, wrad, e);
+	free(pa);
+	free(pb);
+	free(pf);
+	free(ca);
+	free(tmp);
 }
 
 
@@ -326,8 +532,8 @@ int main_bmms(int argc, char *argv[])
 	char *cost_id = pick_option(&argc, &argv, "t", "CENSUS");
 	if (argc != 7) {
 		fprintf(stderr, "usage:\n\t"
-		"%s WINRADIUS NSCALES MFRADIUS a.png b.png out.flo\n", *argv);
-		//0 1         2       3        4     5     6
+		"%s [-t SSD|SAD|CENSUS|CENSUST] "
+		"WINRADIUS NSCALES MFRADIUS a.png b.png out.flo\n", *argv);
 		return argc;
 	}
 	int winradius = atoi(argv[1]);
@@ -344,9 +550,11 @@ int main_bmms(int argc, char *argv[])
 
 	cost_function_t e = NULL;
 	if (0 == strcmp(cost_id, "SSD"    )) e = eval_displacement_by_bm;
+	if (0 == strcmp(cost_id, "SAD"    )) e = eval_displacement_by_sad;
 	if (0 == strcmp(cost_id, "CENSUS" )) e = eval_displacement_by_sc;
 	if (0 == strcmp(cost_id, "CENSUST")) e = eval_displacement_by_census;
-	bmms_rec(f, a, b, *w, *h, *pd, winradius, mfradius, nscales, e);
+	if (!e) fail("unrecognized cost \"%s\"", cost_id);
+	bmms(f, a, b, *w, *h, *pd, winradius, mfradius, nscales, e);
 
 	iio_write_image_float_vec(filename_out, f, *w, *h, 2);
 
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <math.h>   // hypot, fmin
 #include <stdlib.h> // qsort
+#include <stdbool.h>
 #include <stdio.h>
 #include "iio.h"
 #define xmalloc malloc
@@ -19,38 +20,33 @@ static float sqr(float x)
 	return x*x;
 }
 
+// energy of the pixel (i,j) of an image of size w x h, whose rows are
+// "s" pixels apart
+static float pixel_energy(float *x, int s, int w, int h, int pd, int i, int j)
+{
+	if (i==0 || j==0 || i==w-1 || j==h-1)
+		return 1000000; // protect borders
+	float E = 0, *p = x + ((long)j*s + i)*pd;
+	for (int l = 0; l < pd; l++)
+	{
+		// TODO: do something intelligent here
+		float x00 = p[l];
+		float x10 = p[s*pd + l];
+		float x01 = p[pd + l];
+		E += fabs(x10 - x00);
+		E += fabs(x01 - x00);
+	}
+	return E;
+}
+
 static void compute_energy_field(float *e, float *x, int w, int h, int pd)
 {
-	float (*X)[w][pd] = (void*)x;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
-	{
-		float E = 0;
-		if (i==0 || j==0 || i==w-1 || j==h-1)
-			E = 1000000; // protect borders
-		else
-			for (int l = 0; l < pd; l++)
-			{
-				// TODO: do something intelligent here
-				float x00 = X[j+0][i+0][l];
-				float x10 = X[j+1][i+0][l];
-				float x01 = X[j+0][i+1][l];
-				float xm0 = X[j-1][i+0][l];
-				float x0m = X[j+0][i-1][l];
-				//E += sqr(x10 - x00);
-				//E += sqr(xm0 - x00);
-				//E += sqr(x0m - x00);
-				//E += sqr(x01 - x00);
-				//E = fmax(E, fabs(x10 - x00));
-				//E = fmax(E, fabs(xm0 - x00));
-				//E = fmax(E, fabs(x0m - x00));
-				//E = fmax(E, fabs(x01 - x00));
-				E += fabs(x10 - x00);
-				E += fabs(x01 - x00);
-			}
-		//e[j*w+i] = sqrt(E);
-		e[j*w+i] = E;
-	}
+		e[j*w+i] = pixel_energy(x, w, w, h, pd, i, j);
 }
 
 void reduce_width_columnar(float *y, int w2, float *x, int w, int h, int pd)
@@ -105,7 +101,7 @@ static void fill_order_image(
 	{
 		float p[w][2];
 		for (int i = 0; i < w; i++) p[i][0] = e[j*w+i];
-		for (int i = 0; i < w; i++) p[i][1] = i
+		for (int i = 0; i < w; i++) p[i][1] = i;
 		qsort(p, w, sizeof*p,  compare_floats);
 		for (int i = 0; i < w; i++)
 			o[j*w+i] = p[i][1];
@@ -151,69 +147,246 @@ static float getpixel_1(float *x, int w, int h, int i, int j)
 	return x[j*w+i];
 }
 
-#include "smapa.h"
-SMART_PARAMETER_SILENT(CARVE_JUMP,0)
+// seam carving
+//
+// The image is kept in a buffer of its original width, whose rows are
+// shortened by one pixel for each removed seam.  Its energy "e" and the
+// cumulative minimum energy "m" of the vertical seams are kept along.
+//
+// When a single seam is removed, only the pixels whose inputs have changed
+// are recomputed: the energies around the seam, and the cumulative energies
+// of the band that starts at the seam and widens downwards while the values
+// keep changing.  This gives exactly the same result as computing them again
+// from scratch, but each step costs about the length of the seam instead of
+// the size of the image, so that the seams can be removed interactively.
+//
+// The seams can also be removed in batches: several seams are traced at once
+// on the same cumulative energy, avoiding each other, and the energies are
+// computed again after removing all of them (faster, but less accurate).
+struct seam_carver {
+	float *x, *e, *m; // image, energy and cumulative energy
+	int s, w, h, pd;  // stride (original width), current size
+	int *seam;        // last seam found (one column per row)
+	char *used;       // pixels of the seams of a batch
+};
 
-void reduce_width_seam_carving(float *y, int w2, float *x, int w, int h, int pd)
+// m(i,j) = e(i,j) + min of the three upper neighbors (clamped at the sides)
+static float cumulative_energy(struct seam_carver *c, int i, int j)
 {
-	assert(w2 > 0);
-	assert(w2 < w);
-	float *e = xmalloc(w * h * sizeof*e); // local energy field
-	compute_energy_field(e, x, w, h, pd);
-	iio_write_image_float_vec("/tmp/energy_field.npy", e, w, h, 1);
-
-	// fill-in cumulative minimum energies
-	float *m = xmalloc(w * h * sizeof*m);
-	for (int i = 0; i < w*h; i++)
-		m[i] = e[i];
+	int s = c->s, w = c->w;
+	float e = c->e[(long)j*s + i];
+	if (j == 0)
+		return e;
+	float *u = c->m + (long)(j-1)*s;
+	float r = u[i];
+	if (i > 0)   r = fmin(r, u[i-1]);
+	if (i < w-1) r = fmin(r, u[i+1]);
+	return e + r;
+}
 
-	for (int j = 1; j < h; j++)
+static void seam_carver_recompute(struct seam_carver *c)
+{
+	int s = c->s, w = c->w, h = c->h;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
+		c->e[(long)j*s+i] = pixel_energy(c->x, s, w, h, c->pd, i, j);
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		c->m[(long)j*s+i] = cumulative_energy(c, i, j);
+}
+
+static void seam_carver_init(struct seam_carver *c,
+		float *x, int w, int h, int pd)
+{
+	c->s = c->w = w;
+	c->h = h;
+	c->pd = pd;
+	c->x = xmalloc((long)w * h * pd * sizeof*c->x);
+	c->e = xmalloc((long)w * h * sizeof*c->e);
+	c->m = xmalloc((long)w * h * sizeof*c->m);
+	c->seam = xmalloc(h * sizeof*c->seam);
+	c->used = xmalloc((long)w * h * sizeof*c->used);
+	for (long i = 0; i < (long)w * h * pd; i++)
+		c->x[i] = x[i];
+	seam_carver_recompute(c);
+}
+
+static void seam_carver_free(struct seam_carver *c)
+{
+	free(c->x);
+	free(c->e);
+	free(c->m);
+	free(c->seam);
+	free(c->used);
+}
+
+// trace the seam of least cumulative energy that ends at column i
+// (avoiding the pixels already used in this batch, if any)
+static void seam_carver_trace(struct seam_carver *c, int i, bool avoid)
+{
+	int s = c->s, w = c->w;
+	for (int j = c->h - 1; j >= 0; j--)
+	{
+		char *used = c->used + (long)j*s;
+		if (avoid && used[i]) { // blocked: jump to the nearest free pixel
+			int d = 1;
+			while ((i-d < 0 || used[i-d]) && (i+d >= w || used[i+d]))
+				d += 1;
+			i = i-d >= 0 && !used[i-d] ? i-d : i+d;
+		}
+		c->seam[j] = i;
+		if (avoid) used[i] = 1;
+		if (j == 0) break;
+		float *u = c->m + (long)(j-1)*s;
+		int k = i;
+		if (i > 0   && u[i-1] < u[k]) k = i-1;
+		if (i < w-1 && u[i+1] < u[k]) k = i+1;
+		i = k;
+	}
+}
+
+static int seam_carver_argmin_last_row(struct seam_carver *c, bool avoid)
+{
+	float *v = c->m + (long)(c->h-1)*c->s;
+	char *used = c->used + (long)(c->h-1)*c->s;
+	int r = -1;
+	for (int i = 0; i < c->w; i++)
+		if (!(avoid && used[i]) && (r < 0 || v[i] < v[r]))
+			r = i;
+	return r;
+}
+
+// remove the pixel i from the row j of a buffer of n values per pixel
+static void remove_from_row(float *x, int s, int w, int n, int i, int j)
+{
+	float *r = x + ((long)j*s + i)*n;
+	for (int k = 0; k < (w - 1 - i) * n; k++)
+		r[k] = r[k+n];
+}
+
+// remove the seam of least energy, and update e and m around it
+static void seam_carver_remove_one(struct seam_carver *c)
+{
+	int s = c->s, h = c->h, pd = c->pd;
+	seam_carver_trace(c, seam_carver_argmin_last_row(c, false), false);
+	int *q = c->seam, w = c->w;
+	for (int j = 0; j < h; j++)
+	{
+		remove_from_row(c->x, s, w, pd, q[j], j);
+		remove_from_row(c->e, s, w, 1, q[j], j);
+		remove_from_row(c->m, s, w, 1, q[j], j);
+	}
+	w = c->w = w - 1;
+
+	// the energy (i,j) depends on the pixels (i,j), (i+1,j), (i,j+1)
+	for (int j = 0; j < h; j++)
 	{
-		float m_a = getpixel_1(m, w, h, i-1, j-1);
-		float m_b = getpixel_1(m, w, h, i  , j-1);
-		float m_c = getpixel_1(m, w, h, i+1, j-1);
-		m[j*w+i] = e[j*w+i] + fmin(m_a, fmin(m_b, m_c));
+		int a = j+1 < h && q[j+1] < q[j] ? q[j+1] : q[j];
+		int b = j+1 < h && q[j+1] > q[j] ? q[j+1] : q[j];
+		for (int i = a - 1 < 0 ? 0 : a - 1; i <= b && i < w; i++)
+			c->e[(long)j*s+i] = pixel_energy(c->x, s, w, h, pd, i, j);
 	}
-	iio_write_image_float("/tmp/carvaccum.npy", m, w, h);
 
-	for (int k = 1; k <= 600; k++)
+	// the cumulative energy changes at the modified energies, below the
+	// seam (where the upper neighbors have changed), and below the
+	// cumulative energies that have changed
+	int a = w, b = -1; // interval of changes of the previous row
+	for (int j = 0; j < h; j++)
 	{
-		float *v = m + (h-1)*w; // last row
-		int minpos = 0;         // position of the min on the last row
-		for (int i = 0; i < w; i++)
-			if (v[i] >= 0 && v[i] < v[minpos])
-				minpos = i;
-		m[(h-1)*w + minpos] = -k;
-		for (int j = h-2; j >= 0; j--)
+		int p = j > 0 ? q[j-1] : q[j];
+		int lo = (q[j] < p ? q[j] : p) - 2;
+		int hi = (q[j] > p ? q[j] : p) + 1;
+		if (j+1 < h) { // (modified energies)
+			if (q[j+1] - 1 < lo) lo = q[j+1] - 1;
+			if (q[j+1] > hi) hi = q[j+1];
+		}
+		if (a <= b) {
+			if (a - 1 < lo) lo = a - 1;
+			if (b + 1 > hi) hi = b + 1;
+		}
+		if (lo < 0) lo = 0;
+		if (hi > w - 1) hi = w - 1;
+		a = w;
+		b = -1;
+		for (int i = lo; i <= hi; i++)
 		{
-			v = m + j*w;    // current row
-			int newpos = minpos;
-			if (minpos > 0   && v[minpos-1] >= 0 && v[minpos-1] < v[minpos])
-				newpos = minpos-1;
-			if (minpos < w-1 && v[minpos+1] >= 0 && v[minpos+1] < v[minpos])
-				newpos = minpos+1;
-			if (CARVE_JUMP()>0 && v[minpos] < 0)
+			float *m = c->m + (long)j*s + i, n = cumulative_energy(c, i, j);
+			if (n != *m) {
+				if (i < a) a = i;
+				b = i;
+				*m = n;
+			}
+		}
+	}
+}
+
+// remove n seams found at once, avoiding each other, and recompute e and m
+static void seam_carver_remove_batch(struct seam_carver *c, int n)
+{
+	int s = c->s, w = c->w, h = c->h, pd = c->pd;
+	if (n > w - 1) n = w - 1;
+	for (long i = 0; i < (long)s*h; i++)
+		c->used[i] = 0;
+	for (int k = 0; k < n; k++)
+		seam_carver_trace(c, seam_carver_argmin_last_row(c, true), true);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float *r = c->x + (long)j*s*pd;
+		char *used = c->used + (long)j*s;
+		int ii = 0;
+		for (int i = 0; i < w; i++)
+			if (!used[i])
 			{
-				newpos = 0;
-				for (int i = 0; i < w; i++)
-					if (v[i] >= 0 && v[i] < v[newpos])
-						newpos = i;
+				for (int l = 0; l < pd; l++)
+					r[ii*pd+l] = r[i*pd+l];
+				ii += 1;
 			}
+	}
+	c->w = w - n;
+	seam_carver_recompute(c);
+}
 
-			minpos = newpos;
-			m[j*w + minpos] = -k;
-		}
+// remove n seams, one at a time (batch=1) or by batches of "batch" seams
+static void seam_carver_remove(struct seam_carver *c, int n, int batch)
+{
+	while (n > 0 && c->w > 1)
+	{
+		int k = batch > n ? n : batch;
+		if (k <= 1)
+			seam_carver_remove_one(c);
+		else
+			seam_carver_remove_batch(c, k);
+		n -= k < 1 ? 1 : k;
 	}
-	iio_write_image_float("/tmp/seeding.npy", m, w, h);
+}
 
+void reduce_width_seam_carving(float *y, int w2, float *x, int w, int h, int pd,
+		int batch)
+{
+	assert(w2 > 0);
+	assert(w2 < w);
+	struct seam_carver c[1];
+	seam_carver_init(c, x, w, h, pd);
+	seam_carver_remove(c, w - w2, batch);
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w2 * pd; i++)
+		y[(long)j*w2*pd + i] = c->x[(long)j*w*pd + i];
+	seam_carver_free(c);
 }
 
+#include "pickopt.c"
 int main(int c, char *v[])
 {
+	int batch = atoi(pick_option(&c, &v, "b", "1"));
 	if (c < 2 || c > 4) return fprintf(stderr,
-		"usage:\n\t%s columns_to_cut [in.img [out.img]]\n", *v);
-		//          0 1               2       3
+		"usage:\n\t%s [-b batch] columns_to_cut [in.img [out.img]]\n",*v);
+		//          0            1               2       3
 	int columns_to_cut = atoi(v[1]);
 	char *filename_in  = c > 2 ? v[2] : "-";
 	char *filename_out = c > 3 ? v[3] : "-";
@@ -225,7 +398,7 @@ int main(int c, char *v[])
 	float *y = xmalloc(w2 * h * pd * sizeof*y);
 
 	//reduce_width_columnar(y, w2, x, w, h, pd);
-	reduce_width_seam_carving(y, w2, x, w, h, pd);
+	reduce_width_seam_carving(y, w2, x, w, h, pd, batch);
 
 	iio_write_image_float_vec(filename_out, y, w2, h, pd);
 	return 0;
@@ -0,0 +1,88 @@
+#ifndef _CATSTREAM_C
+#define _CATSTREAM_C
+
+// concatenation of images by bands of rows (used by lrcat and tbcat)
+//
+// The inputs are read by the streaming API of iio, and the output is written
+// by bands into an "iio_create" stream, so that the whole images are never
+// in memory (except for the output formats that iio gathers, see iio.h).
+// The sizes of the inputs are obtained from their headers, before decoding
+// them.  The images with fewer channels than the output have their last
+// channel repeated (as "getsample_1"), and the rest of the output is filled
+// with a background value.
+//
+// This file needs the functions "xmalloc" and "fail" (e.g., from xmalloc.c).
+
+#include <stdlib.h>
+#include <string.h>
+#include "iio.h"
+
+struct cat_input {
+	char *fname;
+	int w, h, pd;
+	struct iio_stream *s; // open stream (NULL if closed)
+	float *band;          // rows read from the stream
+};
+
+// get the size of an input and, for stdin, open it
+static void cat_input_info(struct cat_input *x, char *fname)
+{
+	x->fname = fname;
+	x->s = NULL;
+	x->band = NULL;
+	if (strcmp(fname, "-") &&
+			0 == iio_read_image_info(fname, &x->w, &x->h, &x->pd, NULL))
+		return;
+	x->s = iio_open(fname, &x->w, &x->h, &x->pd);
+	if (!x->s) fail("could not read image \"%s\"", fname);
+}
+
+// open the stream of an input, with space for "n" rows
+static void cat_input_open(struct cat_input *x, int n)
+{
+	if (!x->s) {
+		int w, h, pd;
+		x->s = iio_open(x->fname, &w, &h, &pd);
+		if (!x->s) fail("could not read image \"%s\"", x->fname);
+		if (w != x->w || h != x->h || pd != x->pd)
+			fail("image \"%s\" changed while reading it", x->fname);
+	}
+	x->band = xmalloc(x->w * (size_t)n * x->pd * sizeof*x->band);
+}
+
+static void cat_input_close(struct cat_input *x)
+{
+	iio_close(x->s);
+	free(x->band);
+	x->s = NULL;
+	x->band = NULL;
+}
+
+// copy n pixels of pdx samples into pixels of pdy samples
+static void cat_pixels(float *y, int pdy, float *x, int pdx, int n)
+{
+	if (pdx == pdy) {
+		memcpy(y, x, n * (size_t)pdy * sizeof*y);
+		return;
+	}
+	for (int i = 0; i < n; i++)
+	for (int l = 0; l < pdy; l++)
+		y[pdy*i + l] = x[pdx*i + (l < pdx ? l : pdx - 1)];
+}
+
+static void cat_fill(float *y, size_t n, float v)
+{
+	for (size_t i = 0; i < n; i++)
+		y[i] = v;
+}
+
+// number of rows of width w and pd channels that fit in the given megabytes
+static int cat_band_height(double megabytes, int w, int h, int pd)
+{
+	double b = megabytes * 1024 * 1024 / (w * (double)pd * sizeof(float));
+	if (b < 1) b = 1;
+	if (b > h) b = h;
+	return b;
+}
+
+#endif//_CATSTREAM_C
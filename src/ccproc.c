@@ -115,6 +115,44 @@ static bool pix_boundaryingP(float *x, int w, int h,
 	return !eq(vij, vnn);
 }
 
+// one step of the counterclockwise track of a boundary, from the edge
+// (i,j,dir) to the next one, where P(i,j,dir) tells whether an edge of a
+// pixel of the component is at its boundary (could be a table also)
+#define BFOLLOW_STEP(P) do { switch(dir) {\
+	case 0: if (P(i, j, 1))\
+			dir = 1;\
+		else if (P(i, j-1, 0))\
+			j -= 1;\
+		else if (P(i+1, j-1, 3)) {\
+			i += 1; j -= 1; dir = 3;\
+		} else fail("bullshit 0\n");\
+		break;\
+	case 1: if (P(i, j, 2))\
+			dir = 2;\
+		else if (P(i-1, j, 1))\
+			i -= 1;\
+		else if (P(i-1, j-1, 0)) {\
+			i -= 1; j -= 1; dir = 0;\
+		} else fail("bullshit 1\n");\
+		break;\
+	case 2: if (P(i, j, 3))\
+			dir = 3;\
+		else if (P(i, j+1, 2))\
+			j += 1;\
+		else if (P(i-1, j+1, 1)) {\
+			i -= 1; j += 1; dir = 1;\
+		} else fail("bullshit 2\n");\
+		break;\
+	case 3: if (P(i, j, 0))\
+			dir = 0;\
+		else if (P(i+1, j, 3))\
+			i += 1;\
+		else if (P(i+1, j+1, 2)) {\
+			i += 1; j += 1; dir = 2;\
+		} else fail("bullshit 3\n");\
+		break;\
+	} } while (0)
+
 // follow the closed boundary of a connected component containing point (i,j)
 // note: the output array must be pre-allocated
 // out_bd is a list of triplets (i,j,dir) conforming the boundary
@@ -136,50 +174,123 @@ int bfollow(int *out_bd, float *x, int w, int h,
 	int dir = dfirst;
 	i = ifirst;
 	j = jfirst;
+#define BFOLLOW_P(a,b,d) pix_boundaryingP(x, w, h, eq, a, b, d)
 	do {
-		assert(pix_boundaryingP(x, w, h, eq, i, j, dir));
+		assert(BFOLLOW_P(i, j, dir));
 		out_bd[3*out_n + 0] = i;
 		out_bd[3*out_n + 1] = j;
 		out_bd[3*out_n + 2] = dir;
 		out_n += 1;
-		switch(dir) { // counterclockwise track (could be a table also)
-		case 0: if (pix_boundaryingP(x, w, h, eq, i, j, 1))
-				dir = 1;
-			else if (pix_boundaryingP(x, w, h, eq, i, j-1, 0))
-				j -= 1;
-			else if (pix_boundaryingP(x, w, h, eq, i+1, j-1, 3)) {
-				i += 1; j -= 1; dir = 3;
-			} else fail("bullshit 0\n");
-			break;
-		case 1: if (pix_boundaryingP(x, w, h, eq, i, j, 2))
-				dir = 2;
-			else if (pix_boundaryingP(x, w, h, eq, i-1, j, 1))
-				i -= 1;
-			else if (pix_boundaryingP(x, w, h, eq, i-1, j-1, 0)) {
-				i -= 1; j -= 1; dir = 0;
-			} else fail("bullshit 1\n");
-			break;
-		case 2: if (pix_boundaryingP(x, w, h, eq, i, j, 3))
-				dir = 3;
-			else if (pix_boundaryingP(x, w, h, eq, i, j+1, 2))
-				j += 1;
-			else if (pix_boundaryingP(x, w, h, eq, i-1, j+1, 1)) {
-				i -= 1; j += 1; dir = 1;
-			} else fail("bullshit 2\n");
-			break;
-		case 3: if (pix_boundaryingP(x, w, h, eq, i, j, 0))
-				dir = 0;
-			else if (pix_boundaryingP(x, w, h, eq, i+1, j, 3))
-				i += 1;
-			else if (pix_boundaryingP(x, w, h, eq, i+1, j+1, 2)) {
-				i += 1; j += 1; dir = 2;
-			} else fail("bullshit 3\n");
-			break;
+		BFOLLOW_STEP(BFOLLOW_P);
+	} while (i != ifirst || j != jfirst || dir != dfirst);
+#undef BFOLLOW_P
+	return out_n;
+}
+
+// whether an edge (i,j,dir) of a pixel of the component c is at its boundary
+static inline bool label_boundaryingP(int *idx, int w, int h, int c,
+		int i, int j, int dir)
+{
+	int ni, nj;
+	get_neighbour(&ni, &nj, i, j, dir);
+	return !insideP(w, h, ni, nj) || idx[nj*w+ni] != c;
+}
+
+// follow the outer boundary of the component of the pixel p of an image of
+// labels, where p is the first pixel of its component in raster order
+// (the track begins at the left edge of p, which starts a side of the
+// polygon; with "corners", only the first edge of each side is kept)
+// out_bd is a list of triplets (i,j,dir), or NULL to count them only
+static int bfollow_label(int *out_bd, int *idx, int w, int h, int p,
+		bool corners)
+{
+	int c = idx[p], ifirst = p % w, jfirst = p / w, dfirst = 2;
+	int i = ifirst, j = jfirst, dir = dfirst, last = 1, out_n = 0;
+#define BFOLLOW_P(a,b,d) label_boundaryingP(idx, w, h, c, a, b, d)
+	do {
+		if (!corners || dir != last) {
+			if (out_bd) {
+				out_bd[3*out_n + 0] = i;
+				out_bd[3*out_n + 1] = j;
+				out_bd[3*out_n + 2] = dir;
+			}
+			out_n += 1;
 		}
+		last = dir;
+		BFOLLOW_STEP(BFOLLOW_P);
 	} while (i != ifirst || j != jfirst || dir != dfirst);
+#undef BFOLLOW_P
 	return out_n;
 }
 
+static void atomic_min_int(int *p, int v)
+{
+	int o = __atomic_load_n(p, __ATOMIC_RELAXED);
+	while (v < o && !__atomic_compare_exchange_n(p, &o, v, false,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void atomic_max_int(int *p, int v)
+{
+	int o = __atomic_load_n(p, __ATOMIC_RELAXED);
+	while (v > o && !__atomic_compare_exchange_n(p, &o, v, false,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+// Follow the outer boundaries of all the components of an image of labels
+// (numbered from 0 to n-1, e.g., by "cclabel" or "ccproc"), in parallel.
+// The boundaries are stored contiguously, in a single array of triplets
+// (i,j,dir) that is returned; the boundary of the ith cc has out_bdsize[i]
+// triplets, starting at the triplet out_offset[i] (out_offset has n+1
+// elements).  With "corners", only the first edge of each side of the
+// polygon is kept, so that the corners given by "bfollow_corner" are the
+// vertices of the polygon.
+int *bfollow_all(int *out_bdsize, long *out_offset, int *idx, int w, int h,
+		int n, bool corners)
+{
+	// first pixel of each component
+	int *first = xmalloc(n * sizeof*first);
+	for (int c = 0; c < n; c++)
+		first[c] = w * h;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+			if (!i || idx[j*w+i-1] != idx[j*w+i])
+				atomic_min_int(first + idx[j*w+i], j*w + i);
+
+	// count the edges, and then store them at their offsets
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,64)
+#endif
+	for (int c = 0; c < n; c++)
+		out_bdsize[c] = first[c] < w * h ?
+			bfollow_label(NULL, idx, w, h, first[c], corners) : 0;
+	out_offset[0] = 0;
+	for (int c = 0; c < n; c++)
+		out_offset[c+1] = out_offset[c] + out_bdsize[c];
+	int *bd = xmalloc((3 * out_offset[n] + 1) * sizeof*bd);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,64)
+#endif
+	for (int c = 0; c < n; c++)
+		if (out_bdsize[c])
+			bfollow_label(bd + 3*out_offset[c], idx, w, h,
+					first[c], corners);
+	free(first);
+	return bd;
+}
+
+// the corner of the pixels where the boundary edge t = (i,j,dir) starts
+static void bfollow_corner(float xy[2], int *t)
+{
+	xy[0] = t[0] + (t[2] == 0 || t[2] == 1 ? 0.5 : -0.5);
+	xy[1] = t[1] + (t[2] == 0 || t[2] == 3 ? 0.5 : -0.5);
+}
+
 // Compute the number of connected components of equivalent pixels in an image.
 // If any of the "out_*" parameters is non-null, it is filled-in.
 // The connected components are ordered by size.
@@ -391,32 +502,181 @@ int ccproc_miniold(
 	return R;
 }
 
+// number of rows of the bands that are joined in parallel
+#define CCPROC_BAND 64
+
+// rep[i] = smallest pixel of the connected component of pixel i
+//
+// The bands of rows are joined in parallel, each one on its own (their trees
+// stay inside the band), and then the seams between the bands are joined,
+// also in parallel, with the lock-free union of the dsf.
 static int compute_representatives(int *rep, float *x, int w, int h,
 		float_equivalence_relation_t eq)
 {
-	// rep[i] = i
-	adsf_begin(rep, w*h);
+	int n = w * h;
+	int nb = (h + CCPROC_BAND - 1) / CCPROC_BAND;
 
 	// join equivalent neighbors (neighbors == 4-neighbors ALWAYS)
-	for (int j = 0; j < h; j++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = 0; b < nb; b++)
+	{
+		int j0 = b * CCPROC_BAND;
+		int j1 = j0 + CCPROC_BAND < h ? j0 + CCPROC_BAND : h;
+		for (int i = j0*w; i < j1*w; i++)
+			rep[i] = i;
+		for (int j = j0; j < j1; j++)
+		for (int i = 0; i < w; i++)
+		{
+			int p0 = j*w + i;
+			int p1 = j*w + i+1;
+			int p2  = (j+1)*w + i;
+			if (i+1 < w && eq(x[p0], x[p1])) adsf_union(rep, n, p0, p1);
+			if (j+1 < j1 && eq(x[p0], x[p2])) adsf_union(rep, n, p0, p2);
+		}
+	}
+
+	// join the seams between the bands
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int b = 1; b < nb; b++)
 	for (int i = 0; i < w; i++)
 	{
-		int p0 = j*w + i;
-		int p1 = j*w + i+1;
-		int p2  = (j+1)*w + i;
-		if (i+1 < w && eq(x[p0], x[p1])) adsf_union(rep, w*h, p0, p1);
-		if (j+1 < h && eq(x[p0], x[p2])) adsf_union(rep, w*h, p0, p2);
+		int p2 = b * CCPROC_BAND * w + i;
+		int p0 = p2 - w;
+		if (eq(x[p0], x[p2])) adsf_union_atomic(rep, n, p0, p2);
 	}
 
 	// canonicalize dsf (after this, the DSF is not changed anymore)
-	for (int i = 0; i < w*h; i++)
-		rep[i] = adsf_find(rep, w*h, i);
-
-	// count connected components
+	// and count connected components
 	int r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:r)
+#endif
+	for (int i = 0; i < n; i++)
+	{
+		int t = adsf_find_atomic(rep, n, i);
+		__atomic_store_n(rep + i, t, __ATOMIC_RELAXED);
+		r += t == i;
+	}
+	return r;
+}
+
+// accumulate the statistics of the components along the row j
+// (each run of pixels of the same component is added at once)
+static void cclabel_row_stats(int *size, int (*bbox)[4], int *bdsize,
+		int *idx, int w, int h, int j)
+{
+	int *l = idx + j*w;
+	for (int i0 = 0, i1; i0 < w; i0 = i1)
+	{
+		int c = l[i0], nbd = 0;
+		for (i1 = i0; i1 < w && l[i1] == c; i1++)
+			if (bdsize)
+				nbd += (i1 > 0 && l[i1-1] != c)
+					|| (i1+1 < w && l[i1+1] != c)
+					|| (j > 0 && l[i1-w] != c)
+					|| (j+1 < h && l[i1+w] != c);
+		if (size)
+			__atomic_fetch_add(size + c, i1 - i0, __ATOMIC_RELAXED);
+		if (bdsize && nbd)
+			__atomic_fetch_add(bdsize + c, nbd, __ATOMIC_RELAXED);
+		if (bbox) {
+			atomic_min_int(bbox[c] + 0, i0);
+			atomic_min_int(bbox[c] + 1, j);
+			atomic_max_int(bbox[c] + 2, i1 - 1);
+			atomic_max_int(bbox[c] + 3, j);
+		}
+	}
+}
+
+// Label the connected components of equivalent pixels, in parallel.
+// Unlike "ccproc", the components are numbered in the order of their first
+// pixel (in raster order), and they are not sorted by size.  The outputs
+// other than out_idx are optional (NULL), and they are computed in a single
+// parallel pass over the labels.
+//
+// return value: N = the number of connected components
+// out_idx[p] = index of the region containing pixel p
+// out_size[i] = area of ith cc (0<=i<N)
+// out_bbox[i] = bounding box {xmin, ymin, xmax, ymax} of ith cc
+// out_bdsize[i] = number of pixels of ith cc that touch another cc
+//
+// (the size of the outputs is not known in advance, w*h is always enough)
+int cclabel(
+		int *out_idx,           // image with the indices of each region
+		int *out_size,          // total size of each CC
+		int (*out_bbox)[4],     // bounding box of each CC
+		int *out_bdsize,        // boundary size of each CC
+		float *x, int w, int h, // input image
+		float_equivalence_relation_t eq
+	)
+{
+	if (!eq)
+		eq = floatnan_equality;
+	int *rep = xmalloc(w * h * sizeof*rep);
+	int r = compute_representatives(rep, x, w, h, eq);
+
+	// number the roots by bands, after counting the roots of each band
+	int nb = (h + CCPROC_BAND - 1) / CCPROC_BAND;
+	int *first = xmalloc((nb + 1) * sizeof*first);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int b = 0; b < nb; b++)
+	{
+		int j0 = b * CCPROC_BAND;
+		int j1 = j0 + CCPROC_BAND < h ? j0 + CCPROC_BAND : h;
+		first[b+1] = 0;
+		for (int i = j0*w; i < j1*w; i++)
+			first[b+1] += rep[i] == i;
+	}
+	first[0] = 0;
+	for (int b = 0; b < nb; b++)
+		first[b+1] += first[b];
+	assert(first[nb] == r);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int b = 0; b < nb; b++)
+	{
+		int j0 = b * CCPROC_BAND;
+		int j1 = j0 + CCPROC_BAND < h ? j0 + CCPROC_BAND : h;
+		int c = first[b];
+		for (int i = j0*w; i < j1*w; i++)
+			if (rep[i] == i)
+				out_idx[i] = c++;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int i = 0; i < w*h; i++)
-		if (rep[i] == i)
-			r += 1;
+		if (rep[i] != i)
+			out_idx[i] = out_idx[rep[i]]; // (a root, already set)
+	free(first);
+	free(rep);
+
+	// statistics
+	for (int i = 0; i < r; i++)
+	{
+		if (out_size) out_size[i] = 0;
+		if (out_bdsize) out_bdsize[i] = 0;
+		if (out_bbox) {
+			out_bbox[i][0] = w;
+			out_bbox[i][1] = h;
+			out_bbox[i][2] = out_bbox[i][3] = -1;
+		}
+	}
+	if (out_size || out_bbox || out_bdsize) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int j = 0; j < h; j++)
+			cclabel_row_stats(out_size, out_bbox, out_bdsize,
+					out_idx, w, h, j);
+	}
 	return r;
 }
 
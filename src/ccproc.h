@@ -1,3 +1,5 @@
+#include <stdbool.h>
+
 int ccproc(
 		int *out_size,          // total size of each CC
 		int *out_bdsize,        // boundary size of each CC
@@ -14,3 +16,11 @@ int bfollow(
 		int (eq)(float,float),  // input equivalence relation
 		int i, int j            // pixel inside the CC to follow
 	);                              // return value = length of boundary
+
+int *bfollow_all(               // return value = triplets (i,j,dir)
+		int *out_bdsize,        // boundary size of each CC
+		long *out_offset,       // first triplet of each CC (n+1 values)
+		int *idx, int w, int h, // input image of labels
+		int n,                  // number of labels
+		bool corners            // keep only the first edge of each side
+	);
@@ -1,9 +1,22 @@
 // census transform of a single image
+//
+// The bits of each pixel tell which neighbors are larger than the pixel.
+// They are packed into bytes, most significant bit first.
+//
+// The packed mode stores the bits of each channel on a 64-bit word instead
+// (bit k for the k-th neighbor in raster order, in the native byte order),
+// for windows of up to 65 pixels like 9x7.  The cost mode computes the
+// Hamming distances between two census images, e.g., for stereo matching.
 
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "iio.h"
+#include "pickopt.c"
 
 
 static void pack_bits_into_bytes(unsigned char *out, int *bits, int nbits)
@@ -30,7 +43,7 @@ static void census_at(unsigned char *out, float *x, int w, int h, int pd,
 {
 	int side = 2*winradius + 1;
 	int nbits = pd * (side * side - 1);
-	int bits[nbits];
+	int bits[nbits + 8];
 	int cx = 0;
 	for (int l = 0; l < pd; l++)
 	for (int j = -winradius; j <= winradius; j++)
@@ -42,6 +55,8 @@ static void census_at(unsigned char *out, float *x, int w, int h, int pd,
 			bits[cx++] = a < b;
 	}
 	assert(cx == nbits);
+	for (int k = 0; k < 8; k++)
+		bits[nbits + k] = 0; // padding of the last byte
 
 	pack_bits_into_bytes(out, bits, nbits);
 }
@@ -49,24 +64,126 @@ static void census_at(unsigned char *out, float *x, int w, int h, int pd,
 static void color_census_transform(unsigned char *y, int opd,
 		float *x, int w, int h, int pd, int winradius)
 {
-
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 		census_at(y + opd * (w * j + i), x, w, h, pd, winradius, i, j);
 }
 
-#include "iio.h"
-#include "pickopt.c"
+// census transform of a window of size sx x sy, on 64-bit words
+// (each comparison is done for a whole row at once, so that it is vectorized)
+static void packed_census_transform(uint64_t *y, float *x,
+		int w, int h, int pd, int sx, int sy)
+{
+	assert(sx * sy <= 65);
+	int rx = sx / 2, ry = sy / 2;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		uint64_t *yj = y + (long)j * w * pd;
+		float *xj = x + (long)j * w * pd;
+		for (int i = 0; i < w * pd; i++)
+			yj[i] = 0;
+		int k = 0;
+		for (int dy = -ry; dy <= ry; dy++)
+		for (int dx = -rx; dx <= rx; dx++)
+		{
+			if (!dx && !dy) continue;
+			int jj = j + dy;
+			int i0 = dx < 0 ? -dx : 0;
+			int i1 = dx > 0 ? w - dx : w;
+			if (jj >= 0 && jj < h) // outside, the bits are zero
+			{
+				float *nj = x + ((long)jj * w + dx) * pd;
+				for (int i = i0 * pd; i < i1 * pd; i++)
+					yj[i] |= (uint64_t)(xj[i] < nj[i]) << k;
+			}
+			k += 1;
+		}
+	}
+}
+
+// number of different bits of the strings of n bytes a and b
+static int hamming_distance(uint8_t *a, uint8_t *b, int n)
+{
+	int r = 0, i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint64_t p, q;
+		memcpy(&p, a + i, 8);
+		memcpy(&q, b + i, 8);
+		r += __builtin_popcountll(p ^ q);
+	}
+	for (; i < n; i++)
+		r += __builtin_popcount(a[i] ^ b[i]);
+	return r;
+}
+
+// y[(j*w+i)*nd+k] = hamming distance between a(i,j) and b(i+dmin+k,j)
+// (NAN when outside of b)
+static void hamming_cost_volume(float *y, int dmin, int dmax,
+		uint8_t *a, uint8_t *b, int w, int h, int pd)
+{
+	int nd = dmax - dmin + 1;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	for (int k = 0; k < nd; k++)
+	{
+		int ii = i + dmin + k;
+		long o = (long)j * w;
+		y[(o + i) * nd + k] = ii < 0 || ii >= w ? NAN :
+			hamming_distance(a + (o + i) * pd, b + (o + ii) * pd, pd);
+	}
+}
+
+static int main_census_cost(char *range, int c, char *v[])
+{
+	int dmin, dmax;
+	if (2 != sscanf(range, "%d:%d", &dmin, &dmax) || dmin > dmax)
+		return fprintf(stderr, "bad disparity range \"%s\"\n", range);
+	if (c != 3 && c != 4)
+		return fprintf(stderr, "usage:\n\t"
+				"%s -c dmin:dmax a.cen b.cen [out]\n", *v);
+	char *filename_out = c > 3 ? v[3] : "-";
+
+	int w[2], h[2], pd[2];
+	uint8_t *a = iio_read_image_uint8_vec(v[1], w + 0, h + 0, pd + 0);
+	uint8_t *b = iio_read_image_uint8_vec(v[2], w + 1, h + 1, pd + 1);
+	if (w[0] != w[1] || h[0] != h[1] || pd[0] != pd[1])
+		return fprintf(stderr, "census images of different size\n");
+
+	int nd = dmax - dmin + 1;
+	float *y = malloc((long)*w * *h * nd * sizeof*y);
+	hamming_cost_volume(y, dmin, dmax, a, b, *w, *h, *pd);
+	iio_write_image_float_vec(filename_out, y, *w, *h, nd);
+	free(a);
+	free(b);
+	free(y);
+	return 0;
+}
+
 int main_censust(int c, char *v[])
 {
 	// process command line arguments
 	char *radius_opt = pick_option(&c, &v, "r", "1");
+	char *packed_opt = pick_option(&c, &v, "p", "");
+	char *cost_opt = pick_option(&c, &v, "c", "");
+	if (*cost_opt)
+		return main_census_cost(cost_opt, c, v);
 	if ((c == 2 && ((0 == strcmp("-h", v[1]))
 			|| (0 == strcmp("-?", v[1]))))
 		|| (c != 1 && c != 2 && c != 3))
 	{
-		fprintf(stderr, "usage:\n\t%s [-r radius] [in [out]]\n", *v);
-		//                          0              1   2
+		fprintf(stderr, "usage:\n\t%s [-r radius | -p WxH] [in [out]]\n"
+				"\t%s -c dmin:dmax a.cen b.cen [out]\n", *v, *v);
+		//                          0                        1   2
 		return 1;
 	}
 	char *filename_in  = c > 1 ? v[1] : "-";
@@ -77,6 +194,22 @@ int main_censust(int c, char *v[])
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
 
+	if (*packed_opt) {
+		int sx, sy;
+		if (2 != sscanf(packed_opt, "%dx%d", &sx, &sy)
+				|| sx < 1 || sy < 1 || sx % 2 == 0 || sy % 2 == 0
+				|| sx * sy > 65)
+			return fprintf(stderr, "bad packed window \"%s\" "
+					"(odd sides of at most 65 pixels)\n",
+					packed_opt);
+		uint64_t *y = malloc((long)w * h * pd * sizeof*y);
+		packed_census_transform(y, x, w, h, pd, sx, sy);
+		iio_write_image_uint8_vec(filename_out, (uint8_t*)y, w, h, 8*pd);
+		free(x);
+		free(y);
+		return 0;
+	}
+
 	// size of neighborhood in bits and in bytes
 	int side = 2 * winradius + 1;
 	int nbits = pd * (side * side - 1);
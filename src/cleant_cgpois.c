@@ -41,6 +41,11 @@ struct cgpois_state {
 	int w, h, (*mask)[3], nmask, *invmask;
 	float *boundary_data;
 	float *interior_data;
+
+	// incomplete Cholesky factorization of minus the laplacian
+	int (*ic_neig)[4];  // masked neighbors left, up, right, down (or -1)
+	double *ic_diag;    // diagonal of the factorization
+	int ic_power;       // number of applications (2 for the bilaplacian)
 };
 
 typedef float (*fancy_getpixel_operator)(double*x,void*,int,int);
@@ -120,6 +125,65 @@ static void bilaplacian_operator(double *y, double *x, int n, void *ee)
 		y[p] = evaluate_bilaplacian_at(x, p, ee);
 }
 
+// IC(0) factorization A = (D+E) D^-1 (D+E^t) of minus the laplacian on the
+// mask, where E is the strictly lower part of A (the left and up neighbors)
+static void cgpois_ic_factor(struct cgpois_state *e, int power)
+{
+	int w = e->w, h = e->h, n = e->nmask;
+	e->ic_neig = xmalloc(n * sizeof*e->ic_neig);
+	e->ic_diag = xmalloc(n * sizeof*e->ic_diag);
+	e->ic_power = power;
+	int d[4][2] = {{-1,0}, {0,-1}, {1,0}, {0,1}};
+	for (int p = 0; p < n; p++)
+	{
+		int i = e->mask[p][0], j = e->mask[p][1], a = 4;
+		for (int k = 0; k < 4; k++)
+		{
+			int ii = i + d[k][0], jj = j + d[k][1];
+			int in = ii >= 0 && jj >= 0 && ii < w && jj < h;
+			e->ic_neig[p][k] = in ? e->invmask[jj*w+ii] : -1;
+			a -= !in; // the neumann neighbor is the pixel itself
+		}
+		double t = a;
+		for (int k = 0; k < 2; k++)
+		{
+			int q = e->ic_neig[p][k];
+			if (q >= 0)
+				t -= 1 / e->ic_diag[q];
+		}
+		e->ic_diag[p] = t;
+	}
+}
+
+// z = M^-1 r, for the IC(0) factorization (applied ic_power times)
+static void ic_preconditioner(double *z, double *r, int n, void *ee)
+{
+	struct cgpois_state *e = ee;
+	int (*nb)[4] = e->ic_neig;
+	double *d = e->ic_diag;
+	for (int p = 0; p < n; p++)
+		z[p] = r[p];
+	for (int l = 0; l < e->ic_power; l++)
+	{
+		for (int p = 0; p < n; p++) // (D+E) u = z
+		{
+			double t = z[p];
+			for (int k = 0; k < 2; k++)
+				if (nb[p][k] >= 0)
+					t += z[nb[p][k]];
+			z[p] = t / d[p];
+		}
+		for (int p = n - 1; p >= 0; p--) // (D+E^t) z = D u
+		{
+			double t = 0;
+			for (int k = 2; k < 4; k++)
+				if (nb[p][k] >= 0)
+					t += z[nb[p][k]];
+			z[p] += t / d[p];
+		}
+	}
+}
+
 #include "smapa.h"
 //SMART_PARAMETER(CG_MAXIT,-1)
 SMART_PARAMETER_SILENT(CG_EPS,-1)
@@ -194,9 +258,12 @@ SMART_PARAMETER_SILENT(CG_EPS,-1)
 //	free(b);
 //}
 
+// solve A(x) = b on the NANs of "in", by CG or, if "precond" is set, by
+// CG preconditioned by the incomplete Cholesky factorization of -laplacian
+// (applied twice when A is the bilaplacian)
 void linear_extension_by_cg(float *out, void (*A)(double*,double*,int,void*),
 		float *in, float *dat, int w, int h,
-		float *init, int maxit, float eps)
+		float *init, int maxit, float eps, int precond)
 {
 	// build list of masked pixels
 	int nmask, (*mask)[3] = build_mask3(&nmask, in, w, h);
@@ -244,7 +311,15 @@ void linear_extension_by_cg(float *out, void (*A)(double*,double*,int,void*),
 	//int cg_maxit = CG_MAXIT() >= 0 ? CG_MAXIT() : nmask;
 	float cg_eps = CG_EPS() >= 0 ? CG_EPS() : eps;
 	float cg_maxit = maxit == -1 ? nmask : maxit;
-	fancy_conjugate_gradient(solution, A, b, nmask,
+	if (precond) {
+		cgpois_ic_factor(e, A == bilaplacian_operator ? 2 : 1);
+		fancy_preconditioned_conjugate_gradient(solution, A,
+				ic_preconditioner, b, nmask, e,
+				initialization, cg_maxit, cg_eps);
+		free(e->ic_neig);
+		free(e->ic_diag);
+	} else
+		fancy_conjugate_gradient(solution, A, b, nmask,
 					e, initialization, cg_maxit, cg_eps);
 
 	// copy the solution to its place
@@ -267,12 +342,26 @@ void poisson_extension_by_cg(float *out, float *in, float *dat, int w, int h,
 		float *init, int maxit, float eps)
 {
 	linear_extension_by_cg(out, minus_laplacian_operator,
-			in, dat, w, h, init, maxit, eps);
+			in, dat, w, h, init, maxit, eps, 0);
 }
 
 void biharmonic_extension_by_cg(float *out, float *in, float *dat, int w, int h,
 		float *init, int maxit, float eps)
 {
 	linear_extension_by_cg(out, bilaplacian_operator,
-			in, dat, w, h, init, maxit, eps);
+			in, dat, w, h, init, maxit, eps, 0);
+}
+
+void poisson_extension_by_pcg(float *out, float *in, float *dat, int w, int h,
+		float *init, int maxit, float eps)
+{
+	linear_extension_by_cg(out, minus_laplacian_operator,
+			in, dat, w, h, init, maxit, eps, 1);
+}
+
+void biharmonic_extension_by_pcg(float *out, float *in, float *dat,
+		int w, int h, float *init, int maxit, float eps)
+{
+	linear_extension_by_cg(out, bilaplacian_operator,
+			in, dat, w, h, init, maxit, eps, 1);
 }
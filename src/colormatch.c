@@ -26,8 +26,21 @@ static
 void apply_map(float *y, struct model_map m, float *x, int w, int h, int pd)
 {
 	assert(m.pd == pd);
+	long n = w * (long)h;
+	if (pd == 1) {
+		float a = m.a[0], b = m.b[0];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (long i = 0; i < n; i++)
+			y[i] = a * x[i] + b;
+		return;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < n; i++)
 	for (int l = 0; l < pd; l++)
-	for (int i = 0; i < w*h; i++)
 		y[i*pd+l] = m.a[l] * x[i*pd+l] + m.b[l];
 }
 
@@ -46,57 +59,119 @@ struct model_map match_models(struct model_params x, struct model_params y)
 	return m;
 }
 
-// compute avg and std of an array of numbers
-static void compute_avg_std(float avg_std[2], float *x, int n)
+// sums of the samples of two images, and of their squares, over the pixels
+// that are valid (finite in all the channels) on both images
+struct model_sums {
+	int pd;
+	long n;
+	long double s[2][MAX_DIM], ss[2][MAX_DIM];
+};
+
+static void model_sums_init(struct model_sums *t, int pd)
+{
+	t->pd = pd;
+	t->n = 0;
+	for (int k = 0; k < 2; k++)
+	for (int l = 0; l < pd; l++)
+		t->s[k][l] = t->ss[k][l] = 0;
+}
+
+// add to the sums the pixels (i,j) on the grid of step "s" (i%s = j%s = 0),
+// except those already added on the grid of step "S" (if S > 0)
+static void model_sums_add(struct model_sums *t, float *A, float *B,
+		int w, int h, int pd, int s, int S)
 {
-	long double m = 0;
-	for (int i = 0; i < n; i++)
-		m += x[i];
-	m /= n;
-
-	long double s = 0;
-	for (int i = 0; i < n; i++)
-		s += (x[i] - m) * (x[i] - m);
-	s = sqrt(s/n);
-
-	avg_std[0] = m;
-	avg_std[1] = s;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		struct model_sums r[1];
+		model_sums_init(r, pd);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int j = 0; j < h; j += s)
+		{
+			double rs[2][pd], rss[2][pd]; // sums of this row
+			long rn = 0;
+			for (int k = 0; k < 2; k++)
+			for (int l = 0; l < pd; l++)
+				rs[k][l] = rss[k][l] = 0;
+			bool old_row = S > 0 && j % S == 0;
+			for (int i = 0; i < w; i += s)
+			{
+				if (old_row && i % S == 0)
+					continue;
+				float *a = A + (j*(long)w + i)*pd;
+				float *b = B + (j*(long)w + i)*pd;
+				bool good = true;
+				for (int l = 0; l < pd; l++)
+					if (!isfinite(a[l]) || !isfinite(b[l]))
+						good = false;
+				if (!good)
+					continue;
+				for (int l = 0; l < pd; l++)
+				{
+					rs[0][l] += a[l];
+					rs[1][l] += b[l];
+					rss[0][l] += a[l] * (double)a[l];
+					rss[1][l] += b[l] * (double)b[l];
+				}
+				rn += 1;
+			}
+			r->n += rn;
+			for (int k = 0; k < 2; k++)
+			for (int l = 0; l < pd; l++)
+			{
+				r->s[k][l] += rs[k][l];
+				r->ss[k][l] += rss[k][l];
+			}
+		}
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+		{
+			t->n += r->n;
+			for (int k = 0; k < 2; k++)
+			for (int l = 0; l < pd; l++)
+			{
+				t->s[k][l] += r->s[k][l];
+				t->ss[k][l] += r->ss[k][l];
+			}
+		}
+	}
 }
 
-// computation of a model (very simple case)
-static struct model_params compute_model(
-		float *x, int w, int h, int pd,
-		char *mask)
+// computation of a model (very simple case) of the image k of the sums
+static struct model_params model_from_sums(struct model_sums *t, int k)
 {
 	struct model_params r;
-	r.pd = pd;
-	float *t = malloc(w*h*sizeof*t); // storage for valid samples
-	for (int l = 0; l < pd; l++)
+	r.pd = t->pd;
+	for (int l = 0; l < t->pd; l++)
 	{
-		int cx = 0;
-		for (int i = 0; i < w*h; i++)
-			if (mask[i])
-				t[cx++] = x[i*pd+l];
-		float avg_std[2];
-		compute_avg_std(avg_std, t, cx);
-		r.mu[l]    = avg_std[0];
-		r.sigma[l] = avg_std[1];
+		long double m = t->s[k][l] / t->n;
+		long double v = t->ss[k][l] / t->n - m * m;
+		r.mu[l]    = m;
+		r.sigma[l] = sqrt(v > 0 ? v : 0);
 	}
-	free(t);
 	return r;
 }
 
-
-// extract a valid sample, nan otherwise
-static float getsample_nan(float *x, int w, int h, int pd, int i, int j, int l)
+// whether the model p is the same as q, up to "tol" times the deviations
+static bool models_agree(struct model_params p, struct model_params q,
+		double tol)
 {
-	if (i < 0 || j < 0 || i >= w || j >= h || l < 0 || l >= pd)
-		return NAN;
-	return x[(j*w+i)*pd+l];
+	for (int l = 0; l < p.pd; l++)
+		if (!(fabs(p.mu[l] - q.mu[l]) <= tol * q.sigma[l]) ||
+			!(fabs(p.sigma[l] - q.sigma[l]) <= tol * q.sigma[l]))
+			return false;
+	return true;
 }
 
 #include "smapa.h"
 SMART_PARAMETER_SILENT(VERBOSE,0)
+SMART_PARAMETER_SILENT(COLORMATCH_TOL,0)
+SMART_PARAMETER_SILENT(COLORMATCH_STRIDE,16)
 static void dump_model_stderr(struct model_params p)
 {
 	for (int i = 0; i < p.pd; i++)
@@ -108,28 +183,42 @@ static void dump_map_stderr(struct model_map m)
 		fprintf(stderr, "m[%d] = %g %g\n", i, m.a[i], m.b[i]);
 }
 
+// The models are the mean and deviation of the pixels valid on both images.
+// By default, they are computed from all the pixels.  If COLORMATCH_TOL is
+// positive, they are first computed from a grid of pixels of step
+// COLORMATCH_STRIDE (rounded to a power of two), and the step is halved,
+// adding the new pixels, until the models change by less than COLORMATCH_TOL
+// times their deviations.
 static void colormatch(float *C, float *A, int w, int h, int pd, float *B)
 {
-	// extract validity mask (pixel must be good on both images)
-	char *mask = malloc(w*h);
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
+	double tol = COLORMATCH_TOL();
+	int s = 1;
+	if (tol > 0)
+		while (2*s <= COLORMATCH_STRIDE())
+			s *= 2;
+
+	// compute models of each image, refining the grid of samples
+	struct model_sums t[1];
+	model_sums_init(t, pd);
+	struct model_params p, q;
+	int S = 0; // step of the previous grid
+	while (1)
 	{
-		int good = 1;
-		for (int l = 0; l < pd; l++)
-		{
-			if (!isfinite(getsample_nan(A, w, h, pd, i, j, l)))
-				good = 0;
-			if (!isfinite(getsample_nan(B, w, h, pd, i, j, l)))
-				good = 0;
-		}
-		mask[j*w+i] = good;
+		model_sums_add(t, A, B, w, h, pd, s, S);
+		struct model_params pp = model_from_sums(t, 0);
+		struct model_params qq = model_from_sums(t, 1);
+		bool converged = S && models_agree(pp, p, tol)
+			&& models_agree(qq, q, tol);
+		p = pp;
+		q = qq;
+		if (VERBOSE() > 0)
+			fprintf(stderr, "step %d: %ld samples\n", s, t->n);
+		if (converged || s == 1)
+			break;
+		S = s;
+		s /= 2;
 	}
 
-	// compute models of each image
-	struct model_params p = compute_model(A, w, h, pd, mask);
-	struct model_params q = compute_model(B, w, h, pd, mask);
-
 	// compute mapping to transform one model into another
 	struct model_map m = match_models(p, q);
 
@@ -162,6 +251,8 @@ int main(int c, char *v[])
 		return fprintf(stderr, "please use same size images\n");
 	if (pd[0] != pd[1])
 		return fprintf(stderr, "differnt pd match not implemented\n");
+	if (*pd > MAX_DIM)
+		return fprintf(stderr, "too many channels (%d)\n", *pd);
 
 	float *C = malloc(w[1] * h[1] * *pd * sizeof*C);
 
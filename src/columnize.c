@@ -21,20 +21,26 @@ static bool nonzeroP(float *x, int d)
 	return false;
 }
 
+// each line is formatted into a buffer, and each row written at once
 void columnize(FILE *f, float *x, int w, int h, int pd, bool pz, bool pv)
 {
+	char *buf = malloc(w * (24 + 16 * pd) + 1);
 	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	if (numericP(x + (j*w + i)*pd, pd))
-	if (nonzeroP(x + (j*w + i)*pd, pd) || pz)
 	{
-
-		fprintf(f, "%d\t%d", i, j);
-		if (pv)
-		for (int k = 0; k < pd; k++)
-			fprintf(f, "\t%g", x[(j*w+i)*pd + k]);
-		fprintf(f, "\n");
+		char *s = buf;
+		for (int i = 0; i < w; i++)
+		if (numericP(x + (j*w + i)*pd, pd))
+		if (nonzeroP(x + (j*w + i)*pd, pd) || pz)
+		{
+			s += sprintf(s, "%d\t%d", i, j);
+			if (pv)
+			for (int k = 0; k < pd; k++)
+				s += sprintf(s, "\t%g", x[(j*w+i)*pd + k]);
+			*s++ = '\n';
+		}
+		fwrite(buf, 1, s - buf, f);
 	}
+	free(buf);
 }
 
 
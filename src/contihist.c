@@ -3,6 +3,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 static float floatbin(int nbins, float min, float max, float x)
 {
 	if (isnan(x)) return x;
@@ -78,22 +82,23 @@ struct quad {
 	int ij;
 };
 
-static int compare_floats(const void *a, const void *b)
-{
-	const float *da = (const float *) a;
-	const float *db = (const float *) b;
-	return (*da > *db) - (*da < *db);
-}
 
-
-static void sort_quad(struct quad *q)
+// compare-exchange of two values (the NaNs are kept, in some position)
+static inline void sort_two_values(float *x, int i, int j)
 {
-	qsort(q->abcd, 4, sizeof q->abcd[0], compare_floats);
+	float a = x[i], b = x[j];
+	x[i] = b < a ? b : a;
+	x[j] = b < a ? a : b;
 }
 
+// sorting network of four values (five comparisons, without calls)
 static void sort_four_values(float *x)
 {
-	qsort(x, 4, sizeof*x, compare_floats);
+	sort_two_values(x, 0, 1);
+	sort_two_values(x, 2, 3);
+	sort_two_values(x, 0, 2);
+	sort_two_values(x, 1, 3);
+	sort_two_values(x, 1, 2);
 }
 
 
@@ -145,7 +150,7 @@ void fill_continuous_histogram(long double (*bins)[2], int nbins,
 		q[ij].abcd[1] = x[ij+1];
 		q[ij].abcd[2] = x[ij+w];
 		q[ij].abcd[3] = x[ij+1+w];
-		sort_quad(q + ij);
+		sort_four_values(q[ij].abcd);
 	}
 
 	// fill events (each quad determines four events)
@@ -328,6 +333,65 @@ static void accumulate_jumps_for_one_cell(long double (*o)[2],
 	//fprintf(stderr, "\tacc %d %lf\n", i_D, + fac*2/(C + D - B - A)/(D - C));
 }
 
+// accumulate the jumps of the cells of the row j
+static void accumulate_jumps_for_one_row(long double (*o)[2],
+		int n, float m, float M, float *x, int w, int h, int j)
+{
+	for (int i = 0; i < w - 1; i++)
+	{
+		float q[4]; // here we store the 4 values of the cell at (i,j)
+		copy_cell_values(q, x, w, h, i, j);
+		sort_four_values(q);
+		accumulate_jumps_for_one_cell(o, n, m, M, q);
+	}
+}
+
+typedef void (row_accumulator_f)(long double (*)[2],
+		int, float, float, float *, int, int, int);
+
+#define CONTIHIST_BAND 64
+
+// accumulate the jumps of all the rows of cells into o[*][1]
+// (the rows are cut into bands of CONTIHIST_BAND rows, each band is
+// accumulated into its own array of bins, and these arrays are added
+// afterwards, in order, so that the sums do not depend on the number of
+// threads)
+static void accumulate_all_rows(long double (*o)[2],
+		int n, float m, float M, float *x, int w, int h,
+		row_accumulator_f *f)
+{
+	int nb = (h - 1 + CONTIHIST_BAND - 1) / CONTIHIST_BAND;
+	if (nb < 1) return;
+	int nt = 1;
+#ifdef _OPENMP
+	nt = omp_get_max_threads();
+#endif
+	if (nt > nb) nt = nb;
+	long double (*t)[2] = xmalloc(nt * (long)n * sizeof*t);
+	for (int b0 = 0; b0 < nb; b0 += nt)
+	{
+		int b1 = b0 + nt < nb ? b0 + nt : nb;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt)
+#endif
+		for (int b = b0; b < b1; b++)
+		{
+			long double (*tb)[2] = t + (b - b0) * (long)n;
+			for (int i = 0; i < n; i++)
+				tb[i][0] = tb[i][1] = 0;
+			int j0 = b * CONTIHIST_BAND;
+			int j1 = j0 + CONTIHIST_BAND < h - 1 ?
+				j0 + CONTIHIST_BAND : h - 1;
+			for (int j = j0; j < j1; j++)
+				f(tb, n, m, M, x, w, h, j);
+		}
+		for (int b = 0; b < b1 - b0; b++)
+		for (int i = 0; i < n; i++)
+			o[i][1] += t[b*(long)n+i][1];
+	}
+	free(t);
+}
+
 
 void fill_continuous_histogram_simple(
 	long double (*o)[2], // output histogram array of (value,density) pairs
@@ -347,14 +411,7 @@ void fill_continuous_histogram_simple(
 	}
 
 	// compute 2nd derivative of histogram
-	for (int j = 0; j < h - 1; j++)
-	for (int i = 0; i < w - 1; i++)
-	{
-		float q[4]; // here we store the 4 values of the cell at (i,j)
-		copy_cell_values(q, x, w, h, i, j);
-		sort_four_values(q);
-		accumulate_jumps_for_one_cell(o, n, m, M, q);
-	}
+	accumulate_all_rows(o, n, m, M, x, w, h, accumulate_jumps_for_one_row);
 
 	// integrate twice
 	integrate_values(o, n);
@@ -372,6 +429,20 @@ static void accumulate_gradient_at_edge(long double (*o)[2],
 	o[B][1] -= pow(B - A, 4);
 }
 
+// accumulate the gradients of the edges of the cells of the row j
+static void accumulate_gradient_for_one_row(long double (*o)[2],
+		int n, float m, float M, float *x, int w, int h, int j)
+{
+	for (int i = 0; i < w - 1; i++)
+	{
+		float a = x[(j+0)*w+i+0];
+		float b = x[(j+0)*w+i+1];
+		float c = x[(j+1)*w+i+0];
+		accumulate_gradient_at_edge(o, n, m, M, fmin(a,b), fmax(a,b));
+		accumulate_gradient_at_edge(o, n, m, M, fmin(a,c), fmax(a,c));
+	}
+}
+
 void fill_graph_gradient_histogram(
 	long double (*o)[2], // output histogram array of (value,density) pairs
 	int n,               // requested number of bins for the histogram
@@ -390,15 +461,8 @@ void fill_graph_gradient_histogram(
 	}
 
 	// compute 1st derivative of gradient histogram
-	for (int j = 0; j < h - 1; j++)
-	for (int i = 0; i < w - 1; i++)
-	{
-		float a = x[(j+0)*w+i+0];
-		float b = x[(j+0)*w+i+1];
-		float c = x[(j+1)*w+i+0];
-		accumulate_gradient_at_edge(o, n, m, M, fmin(a,b), fmax(a,b));
-		accumulate_gradient_at_edge(o, n, m, M, fmin(a,c), fmax(a,c));
-	}
+	accumulate_all_rows(o, n, m, M, x, w, h,
+			accumulate_gradient_for_one_row);
 
 	// integrate once
 	integrate_values(o, n);
@@ -568,7 +632,7 @@ int main_contihist(int c, char *v[])
 	float *x = iio_read_image_float(filename_in, &w, &h);
 
 	// allocate space for the histogram data
-	long double bins[3+nbins][2];
+	long double (*bins)[2] = xmalloc((3 + nbins) * sizeof*bins);
 
 	update_min_max_if_not_finite(&hmin, &hmax, x, w*h);
 
@@ -584,6 +648,7 @@ int main_contihist(int c, char *v[])
 	dump_histogram(stdout, bins, nbins);
 
 	// cleanup and exit
+	free(bins);
 	free(x);
 	return 0;
 }
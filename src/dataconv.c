@@ -97,6 +97,7 @@ uint8_t *alloc_and_transpose_3dz(uint8_t *x, int w, int h, int d);
 
 #include "xmalloc.c"
 #include "fail.c"
+#include "bitpack.c"
 
 #define SETBIT(x,i) ((x)|=(1<<(i)))
 #define GETBIT(x,i) (bool)((x)&(1<<(i)))
@@ -107,9 +108,7 @@ uint8_t *alloc_and_transform_from_RAW_to_BIT(uint8_t *x, int n, int *nout)
 {
 	*nout = 8*n;
 	uint8_t *y = xmalloc(*nout+16);
-	for (int i = 0; i < n; i++)
-		for (int j = 0; j < 8; j++)
-			y[8*i+j] = GETBIT(x[i], j);
+	bitpack_unpack1(y, x, *nout, false);
 	return y;
 }
 
@@ -120,13 +119,7 @@ uint8_t *alloc_and_transform_from_BIT_to_RAW(uint8_t *x, int n, int *nout)
 	if (*nout * 8 != n)
 		fail("can not unpack an odd number (%d) of bits", n);
 	uint8_t *y = xmalloc(*nout+1);
-	for (int i = 0; i < *nout; i++)
-	{
-		y[i] = 0;
-		for (int j = 0; j < 8; j++)
-			if (x[8*i+j])
-				SETBIT(y[i], j);
-	}
+	bitpack_pack1(y, x, n, false);
 	return y;
 }
 
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,27 +30,17 @@ static void *xmalloc(size_t size)
 }
 
 
-#ifndef USE_WISDOM
-static void evoke_wisdom(void) {}
-static void bequeath_wisdom(void) {}
-#else//USE_WISDOM
-#include "fftwisdom.c"
-#endif//USE_WISDOM
+#include "fftplans.c"
 
 
 static void dct_2dfloat(float *fx, float *x, int w, int h)
 {
 	float normalization_factor = sqrt(4*(w-1)*(h-1));
-	float *a = fftwf_malloc(w*h*sizeof*a);
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_r2r_2d(h, w, a, fx,
-			FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-	bequeath_wisdom();
+	struct fftplan *p = fftplan_get(FFTPLAN_REDFT00, w, h);
+	float *a = p->in, *b = p->out;
 	FORI(w*h) a[i] = x[i] / normalization_factor;
-	fftwf_execute(p);
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_cleanup();
+	fftwf_execute(p->p);
+	FORI(w*h) fx[i] = b[i];
 }
 
 static void dct(float *y, float *x, int w, int h, int pd)
@@ -67,6 +58,142 @@ static void dct(float *y, float *x, int w, int h, int pd)
 	free(gc);
 }
 
+// orthonormalization factor of the coefficient k of the DCT-II of size n
+// (the basis vectors of FFTW_REDFT10 have a squared norm of 2n, and 4n for
+// the first one)
+static double dct_block_scale(int k, int n)
+{
+	return sqrt(1.0 / ((k ? 2 : 4) * n));
+}
+
+// orthonormal DCT-II of each block n x n of the image (of size a multiple of
+// n), or its inverse; the blocks of a row are transformed by a single batched
+// plan, and the rows of blocks in parallel
+static void dct_blocks(float *y, float *x, int w, int h, int pd, int n,
+		bool inverse)
+{
+	int nx = w / n, ny = h / n;
+	double *s = xmalloc(n * n * sizeof*s);
+	FORJ(n) FORI(n)
+		s[j*n+i] = dct_block_scale(i, n) * dct_block_scale(j, n);
+	FORL(pd)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int by = 0; by < ny; by++)
+	{
+		struct fftplan *p = fftplan_get_many(FFTPLAN_BLOCKDCT, n, n, nx);
+		float *a = p->in;
+		for (int k = 0; k < nx; k++)
+		FORJ(n) FORI(n)
+		{
+			long o = ((by*n + j)*(long)w + k*n + i)*pd + l;
+			float v = x[o];
+			a[(k*n + j)*n + i] = inverse ? v / s[j*n+i] : v;
+		}
+		fftwf_execute(inverse ? p->q : p->p);
+		for (int k = 0; k < nx; k++)
+		FORJ(n) FORI(n)
+		{
+			long o = ((by*n + j)*(long)w + k*n + i)*pd + l;
+			float v = a[(k*n + j)*n + i];
+			y[o] = inverse ? v / (4.0*n*n) : v * s[j*n+i];
+		}
+	}
+	free(s);
+}
+
+// positions of the blocks of side b, at steps s, along a side of length n
+// (with a last block against the end of the side); returns their number
+static int dct_block_positions(int *p, int n, int b, int s)
+{
+	int k = 0;
+	for (int x = 0; x + b <= n; x += s)
+		p[k++] = x;
+	if (k && p[k-1] + b < n)
+		p[k++] = n - b;
+	return k;
+}
+
+// denoise the channel l of the row of blocks at height y0: hard thresholding
+// of their orthonormal DCT, and accumulation of the denoised blocks, each one
+// with the weight 1/(1+m), where m is the number of coefficients kept
+static void dct_denoise_row(float *num, float *den, float *x, int w, int pd,
+		int l, int y0, int *px, int nx, int b, double *s, float t)
+{
+	struct fftplan *p = fftplan_get_many(FFTPLAN_BLOCKDCT, b, b, nx);
+	float *a = p->in;
+	for (int k = 0; k < nx; k++)
+	FORJ(b) FORI(b)
+		a[(k*b + j)*b + i] = x[((y0 + j)*(long)w + px[k] + i)*pd + l];
+	fftwf_execute(p->p);
+	float *weight = xmalloc(nx * sizeof*weight);
+	for (int k = 0; k < nx; k++)
+	{
+		float *c = a + k*b*b;
+		int m = 0;
+		for (int i = 1; i < b*b; i++) // (the mean is always kept)
+			if (fabs(c[i] * s[i]) < t)
+				c[i] = 0;
+			else
+				m += 1;
+		weight[k] = 1.0 / (1 + m);
+	}
+	fftwf_execute(p->q);
+	for (int k = 0; k < nx; k++)
+	FORJ(b) FORI(b)
+	{
+		long o = (y0 + j)*(long)w + px[k] + i;
+		num[o] += weight[k] * a[(k*b + j)*b + i] / (4.0*b*b);
+		den[o] += weight[k];
+	}
+	free(weight);
+}
+
+// DCT denoising: hard thresholding at t of the blocks b x b at steps s (all
+// the overlapping blocks for s=1), and weighted aggregation.  The rows of
+// blocks are processed in parallel by groups of rows that do not overlap, in
+// a fixed order, so that the result does not depend on the number of threads.
+static void dct_denoise(float *y, float *x, int w, int h, int pd,
+		int b, int s, float t)
+{
+	int *px = xmalloc((w + 1) * sizeof*px), nx;
+	int *py = xmalloc((h + 1) * sizeof*py), ny;
+	nx = dct_block_positions(px, w, b, s);
+	ny = dct_block_positions(py, h, b, s);
+	int m = (b + s - 1) / s; // rows of blocks k and k+m do not overlap
+	int nr = py[ny-1] == (ny-1) * s ? ny : ny - 1; // rows at regular steps
+	double *sc = xmalloc(b * b * sizeof*sc);
+	FORJ(b) FORI(b)
+		sc[j*b+i] = dct_block_scale(i, b) * dct_block_scale(j, b);
+	float *num = xmalloc(w*h*sizeof*num);
+	float *den = xmalloc(w*h*sizeof*den);
+	FORL(pd)
+	{
+		FORI(w*h)
+			num[i] = den[i] = 0;
+		for (int r = 0; r < m; r++)
+		{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+			for (int k = r; k < nr; k += m)
+				dct_denoise_row(num, den, x, w, pd, l, py[k],
+						px, nx, b, sc, t);
+		}
+		if (nr < ny) // the last row, against the bottom of the image
+			dct_denoise_row(num, den, x, w, pd, l, py[nr],
+					px, nx, b, sc, t);
+		FORI(w*h)
+			y[i*pd + l] = num[i] / den[i];
+	}
+	free(num);
+	free(den);
+	free(sc);
+	free(px);
+	free(py);
+}
+
 // if it finds any strange number, sets it to zero
 static void normalize_float_array_inplace(float *x, int n)
 {
@@ -76,13 +203,42 @@ static void normalize_float_array_inplace(float *x, int n)
 
 }
 
+// extend the image by symmetry around its last row and column to the size
+// W x H (at most 2w-1 x 2h-1), the extension of the DCT-I
+static float *symmetric_pad(float *x, int w, int h, int pd, int W, int H)
+{
+	float *y = xmalloc(W*(long)H*pd*sizeof*y);
+	FORJ(H) FORI(W) FORL(pd)
+	{
+		int ii = i < w ? i : 2*(w-1) - i;
+		int jj = j < h ? j : 2*(h-1) - j;
+		y[(j*(long)W+i)*pd+l] = x[(jj*(long)w+ii)*pd+l];
+	}
+	free(x);
+	return y;
+}
+
+// dct [-P] [in [out]]                       DCT-I of the whole image
+// dct -b n [-i] [in [out]]                   DCT-II of the blocks n x n
+// dct -d sigma [-b n] [-s step] [-k f] [in [out]]    DCT denoising
+#include "pickopt.c"
 int main_dct(int c, char *v[])
 {
+	bool pad = pick_option(&c, &v, "P", NULL);
+	bool inverse = pick_option(&c, &v, "i", NULL);
+	char *sigma = pick_option(&c, &v, "d", "");
+	int block = atoi(pick_option(&c, &v, "b", *sigma ? "8" : "0"));
+	int step = atoi(pick_option(&c, &v, "s", "1"));
+	float factor = atof(pick_option(&c, &v, "k", "3"));
 	if (c != 1 && c != 2 && c != 3) {
-		fprintf(stderr, "usage:\n\t%s [in [out]]\n", *v);
-		//                          0  1   2
+		fprintf(stderr, "usage:\n\t%s [-P] [in [out]]\n"
+			"\t%s -b n [-i] [in [out]]\n"
+			"\t%s -d sigma [-b n] [-s step] [-k f] [in [out]]\n",
+			*v, *v, *v);
 		return EXIT_FAILURE;
 	}
+	if (block < 0 || (*sigma && block < 1) || step < 1)
+		fail("bad block size %d or step %d", block, step);
 	char *in = c > 1 ? v[1] : "-";
 	char *out = c > 2 ? v[2] : "-";
 
@@ -90,6 +246,39 @@ int main_dct(int c, char *v[])
 	float *x = iio_read_image_float_vec(in, &w, &h, &pd);
 	normalize_float_array_inplace(x, w*h*pd);
 
+	if (*sigma) { // denoising (the size of the image is kept)
+		if (w < block || h < block)
+			fail("image %dx%d smaller than the blocks", w, h);
+		float *y = xmalloc(w*h*pd*sizeof*y);
+		dct_denoise(y, x, w, h, pd, block, step, factor * atof(sigma));
+		iio_write_image_float_vec(out, y, w, h, pd);
+		free(x);
+		free(y);
+		return EXIT_SUCCESS;
+	}
+	if (block) { // block transform (of the image cropped to whole blocks)
+		int W = w - w % block, H = h - h % block;
+		if (!W || !H)
+			fail("image %dx%d smaller than the blocks", w, h);
+		float *y = xmalloc(W*H*pd*sizeof*y);
+		FORJ(H) FORI(W) FORL(pd) // (crop in place)
+			x[(j*W+i)*pd+l] = x[(j*w+i)*pd+l];
+		dct_blocks(y, x, W, H, pd, block, inverse);
+		iio_write_image_float_vec(out, y, W, H, pd);
+		free(x);
+		free(y);
+		return EXIT_SUCCESS;
+	}
+
+	// (the DCT-I of size n is a FFT of size 2(n-1), so n-1 is made fast)
+	if (pad && w > 1 && h > 1) {
+		int W = 1 + fftplan_fast_size(w - 1);
+		int H = 1 + fftplan_fast_size(h - 1);
+		x = symmetric_pad(x, w, h, pd, W, H);
+		w = W;
+		h = H;
+	}
+
 	float *y = xmalloc(w*h*pd*sizeof*y);
 
 	dct(y, x, w, h, pd);
@@ -3,18 +3,19 @@ src/amle.o: src/amle.c src/iio.h src/fail.c src/xmalloc.c src/smapa.h \
   src/help_stuff.c
 src/autotrim.o: src/autotrim.c src/iio.h
 src/backflow.o: src/backflow.c src/iio.h src/fail.c src/xmalloc.c \
-  src/getpixel.c src/bicubic.c src/smapa.h
+  src/getpixel.c src/bicubic.c src/smapa.h src/pd_specialize.h
 src/bandslice.o: src/bandslice.c src/iio.h
 src/bdint.o: src/bdint.c src/abstract_dsf.c src/help_stuff.c src/iio.h \
   src/pickopt.c
-src/bicubic.o: src/bicubic.c src/getpixel.c
+src/bicubic.o: src/bicubic.c src/getpixel.c src/pd_specialize.h
 src/bicubic_gray.o: src/bicubic_gray.c
 src/bilinear_interpolation.o: src/bilinear_interpolation.c
-src/blur.o: src/blur.c src/fail.c src/xmalloc.c src/smapa.h src/help_stuff.c \
-  src/parsenumbers.c src/pickopt.c src/iio.h
-src/bmms.o: src/bmms.c src/xmalloc.c src/fail.c src/getpixel.c src/iio.h \
-  src/pickopt.c
-src/carve.o: src/carve.c src/iio.h src/smapa.h
+src/blur.o: src/blur.c src/profile.c src/fail.c src/xmalloc.c src/xarena.c src/smapa.h src/help_stuff.c \
+  src/parsenumbers.c src/pickopt.c src/iio.h src/pd_specialize.h \
+  src/threads.c
+src/bmms.o: src/bmms.c src/xmalloc.c src/fail.c src/getpixel.c \
+  src/nanreduce.c src/iio.h src/pickopt.c src/pd_specialize.h
+src/carve.o: src/carve.c src/iio.h src/pickopt.c
 src/ccproc.o: src/ccproc.c src/abstract_dsf.c src/xmalloc.c src/fail.c
 src/censust.o: src/censust.c src/iio.h src/pickopt.c
 src/cleant_cgpois.o: src/cleant_cgpois.c src/minicg.c src/smapa.h
@@ -26,12 +27,12 @@ src/contihist.o: src/contihist.c src/xfopen.c src/fail.c src/xmalloc.c \
   src/iio.h src/pickopt.c src/help_stuff.c
 src/crop.o: src/crop.c src/fail.c src/xmalloc.c src/iio.h
 src/d5.o: src/d5.c
-src/dataconv.o: src/dataconv.c src/xmalloc.c src/fail.c
+src/dataconv.o: src/dataconv.c src/bitpack.c src/xmalloc.c src/fail.c
 src/dct.o: src/dct.c src/iio.h
 src/dht.o: src/dht.c src/iio.h src/xmalloc.c src/fail.c
 src/dither.o: src/dither.c src/iio.h src/pickopt.c src/help_stuff.c
-src/downsa.o: src/downsa.c src/iio.h src/fail.c src/xmalloc.c src/random.c \
-  src/help_stuff.c
+src/downsa.o: src/downsa.c src/profile.c src/iio.h src/fail.c src/xmalloc.c src/random.c \
+  src/help_stuff.c src/pd_specialize.h
 src/drawsegment.o: src/drawsegment.c
 src/drawtriangle.o: src/drawtriangle.c
 src/eucdist.o: src/eucdist.c src/iio.h src/pickopt.c
@@ -39,9 +40,11 @@ src/exterior_algebra.o: src/exterior_algebra.c
 src/extrapolators.o: src/extrapolators.c
 src/fail.o: src/fail.c
 src/fancy_crop.o: src/fancy_crop.c src/fancy_image.h
-src/fancy_downsa.o: src/fancy_downsa.c src/fancy_image.h
+src/fancy_downsa.o: src/fancy_downsa.c src/fancy_image.h src/xmalloc.c \
+  src/fail.c src/nanreduce.c src/pd_specialize.h
 src/fancy_image.o: src/fancy_image.c src/fancy_image.h src/iio.h \
-  src/xmalloc.c src/fail.c src/tiff_octaves_rw.c src/smapa.h
+  src/xmalloc.c src/fail.c src/nanreduce.c src/tiff_octaves_rw.c src/bitpack.c src/smapa.h \
+  src/pd_specialize.h
 src/fft.o: src/fft.c src/iio.h src/fail.c src/xmalloc.c src/ppsmooth.c \
   src/pickopt.c
 src/fftshift.o: src/fftshift.c src/iio.h
@@ -49,10 +52,10 @@ src/flambda.o: src/flambda.c src/smapa.h src/fail.c src/xmalloc.c \
   src/random.c src/parsenumbers.c src/colorcoordsf.c src/fancy_image.h \
   src/getpixel.c
 src/flowarrows.o: src/flowarrows.c src/iio.h src/fail.c src/xmalloc.c \
-  src/drawsegment.c src/getpixel.c src/smapa.h
+  src/drawsegment.c src/getpixel.c src/fastlic.c src/smapa.h
 src/flowinv.o: src/flowinv.c src/iio.h src/fail.c src/xmalloc.c src/bicubic.c \
-  src/getpixel.c
-src/fontu.o: src/fontu.c src/xmalloc.c src/fail.c src/xfopen.c src/dataconv.c \
+  src/getpixel.c src/pd_specialize.h
+src/fontu.o: src/fontu.c src/xmalloc.c src/fail.c src/xfopen.c src/dataconv.c src/bitpack.c \
   src/fonts/xfonts_all.c src/fonts/xfont_4x6.c src/fonts/xfont_5x7.c \
   src/fonts/xfont_5x8.c src/fonts/xfont_6x10.c src/fonts/xfont_6x12.c \
   src/fonts/xfont_6x13.c src/fonts/xfont_6x13B.c src/fonts/xfont_6x13O.c \
@@ -63,19 +66,19 @@ src/fontu.o: src/fontu.c src/xmalloc.c src/fail.c src/xfopen.c src/dataconv.c \
   src/fonts/xfont_10x20.c src/fonts/xfont_canny.c \
   src/fonts/xfont_clR6x12.c src/fonts/xfont_helvR12.c src/iio.h \
   src/pickopt.c
-src/geomedian.o: src/geomedian.c src/linalg.c src/random.c src/pickopt.c \
-  src/iio.h src/help_stuff.c
+src/geomedian.o: src/geomedian.c src/linalg.c src/xmalloc.c src/fail.c \
+  src/geomedian_core.c src/random.c src/pickopt.c src/iio.h src/help_stuff.c
 src/getbands.o: src/getbands.c src/iio.h src/pickopt.c
 src/getpixel.o: src/getpixel.c
 src/ghisto.o: src/ghisto.c src/iio.h src/xmalloc.c src/fail.c src/smapa.h \
-  src/help_stuff.c src/pickopt.c
+  src/streamstats.c src/help_stuff.c src/pickopt.c
 src/gntiply.o: src/gntiply.c src/iio.h
 src/gram_schmidt.o: src/gram_schmidt.c
 src/grid.o: src/grid.c src/fail.c
 src/heatd.o: src/heatd.c src/iio.h src/pickopt.c
 src/help_stuff.o: src/help_stuff.c
 src/homographies.o: src/homographies.c
-src/homwarp.o: src/homwarp.c src/extrapolators.c src/bilinear_interpolation.c \
+src/homwarp.o: src/homwarp.c src/profile.c src/extrapolators.c src/bilinear_interpolation.c \
   src/marching_interpolation.c src/bicubic_gray.c src/spline.c src/iio.h \
   src/xmalloc.c src/fail.c src/parsenumbers.c src/help_stuff.c \
   src/pickopt.c
@@ -85,32 +88,38 @@ src/iion.o: src/iion.c src/iio.h src/help_stuff.c src/pickopt.c
 src/iion_int.o: src/iion_int.c src/iio.h
 src/iion_pure.o: src/iion_pure.c src/iio.h
 src/iion_u16.o: src/iion_u16.c src/iio.h
-src/im.o: src/im.c src/all_mains.inc src/ftr/all_mains.inc
+src/im.o: src/im.c src/iio.h src/all_mains.inc src/ftr/all_mains.inc
 src/imflip.o: src/imflip.c src/help_stuff.c src/iio.h
 src/imhalve.o: src/imhalve.c src/iio.h
-src/imprintf.o: src/imprintf.c src/iio.h src/help_stuff.c
+src/imprintf.o: src/imprintf.c src/iio.h src/fail.c src/smapa.h \
+  src/streamstats.c src/help_stuff.c
+src/isolines.o: src/isolines.c src/iio.h src/xmalloc.c src/fail.c \
+  src/pickopt.c src/marching_lines.c src/marching_squares.c src/help_stuff.c
 src/linalg.o: src/linalg.c
+src/lk_omp.o: src/lk_omp.c src/iio.h src/xmalloc.c src/fail.c src/vvector.h \
+  src/pickopt.c
 src/lrcat.o: src/lrcat.c src/iio.h src/xmalloc.c src/fail.c src/getpixel.c \
-  src/pickopt.c src/smapa.h src/help_stuff.c
+  src/pickopt.c src/catstream.c src/smapa.h src/help_stuff.c
 src/marching_interpolation.o: src/marching_interpolation.c
 src/marching_squares.o: src/marching_squares.c
 src/mdither.o: src/mdither.c src/xfopen.c src/fail.c src/iio.h
 src/mdither2.o: src/mdither2.c src/xfopen.c src/fail.c src/iio.h
 src/mdither3.o: src/mdither3.c src/iio.h
 src/means.o: src/means.c
-src/mediator.o: src/mediator.c src/iio.h
+src/mediator.o: src/mediator.c src/iio.h src/pickopt.c
 src/minicg.o: src/minicg.c
 src/modes_detector.o: src/modes_detector.c src/smapa.h
 src/moistiv_epipolar.o: src/moistiv_epipolar.c src/fail.c
-src/morsi.o: src/morsi.c src/xmalloc.c src/fail.c src/iio.h src/help_stuff.c
+src/morsi.o: src/morsi.c src/profile.c src/xmalloc.c src/fail.c src/iio.h src/help_stuff.c
 src/nnint.o: src/nnint.c src/abstract_heap.h src/xmalloc.c src/fail.c \
   src/help_stuff.c src/iio.h src/pickopt.c
-src/nonmaxsup.o: src/nonmaxsup.c src/smapa.h src/iio.h
+src/nonmaxsup.o: src/nonmaxsup.c src/xmalloc.c src/fail.c src/smapa.h \
+  src/iio.h src/pickopt.c
 src/ntiply.o: src/ntiply.c src/iio.h
 src/numbersio.o: src/numbersio.c
 src/ok_list.o: src/ok_list.c src/fail.c src/xmalloc.c
 src/palette.o: src/palette.c src/fail.c src/xmalloc.c src/xfopen.c \
-  src/smapa.h src/iio.h src/pickopt.c src/fontu.c src/dataconv.c \
+  src/smapa.h src/iio.h src/pickopt.c src/fontu.c src/dataconv.c src/bitpack.c \
   src/fonts/xfonts_all.c src/fonts/xfont_4x6.c src/fonts/xfont_5x7.c \
   src/fonts/xfont_5x8.c src/fonts/xfont_6x10.c src/fonts/xfont_6x12.c \
   src/fonts/xfont_6x13.c src/fonts/xfont_6x13B.c src/fonts/xfont_6x13O.c \
@@ -123,20 +132,20 @@ src/palette.o: src/palette.c src/fail.c src/xmalloc.c src/xfopen.c \
 src/parsenumbers.o: src/parsenumbers.c src/xmalloc.c src/fail.c
 src/pickopt.o: src/pickopt.c
 src/pixdump.o: src/pixdump.c src/iio.h
-src/plambda.o: src/plambda.c src/smapa.h src/fail.c src/xmalloc.c \
+src/plambda.o: src/plambda.c src/profile.c src/smapa.h src/fail.c src/xmalloc.c \
   src/random.c src/parsenumbers.c src/colorcoordsf.c src/getpixel.c \
-  src/iio.h src/help_stuff.c
+  src/iio.h src/help_stuff.c src/threads.c
 src/points.o: src/points.c src/iio.h src/fail.c src/xmalloc.c src/xfopen.c \
-  src/parsenumbers.c src/drawsegment.c src/pickopt.c src/random.c \
-  src/smapa.h
+  src/parsenumbers.c src/drawsegment.c src/pickopt.c src/pointgrid.c \
+  src/random.c src/smapa.h
 src/ppsmooth.o: src/ppsmooth.c src/iio.h src/pickopt.c
 src/pview.o: src/pview.c src/iio.h src/fail.c src/xmalloc.c src/xfopen.c \
-  src/parsenumbers.c src/drawsegment.c src/pickopt.c src/smapa.h \
-  src/random.c
+  src/parsenumbers.c src/drawsegment.c src/pickopt.c src/tileraster.c \
+  src/smapa.h src/random.c
 src/pλ.o: src/pλ.c src/smapa.h src/fail.c src/xmalloc.c src/random.c \
   src/parsenumbers.c src/colorcoordsf.c src/getpixel.c src/iio.h \
   src/help_stuff.c
-src/qauto.o: src/qauto.c src/iio.h src/help_stuff.c src/pickopt.c
+src/qauto.o: src/qauto.c src/profile.c src/iio.h src/help_stuff.c src/pickopt.c
 src/qeasy.o: src/qeasy.c src/iio.h src/help_stuff.c
 src/random.o: src/random.c
 src/ransac.o: src/ransac.c src/fail.c src/xmalloc.c src/xfopen.c src/random.c \
@@ -147,9 +156,10 @@ src/ransac_cases.o: src/ransac_cases.c src/vvector.h src/homographies.c \
 src/redim.o: src/redim.c src/iio.h
 src/registration.o: src/registration.c src/iio.h
 src/rpc2.o: src/rpc2.c src/xfopen.c src/fail.c src/smapa.h
-src/rpcfit33.o: src/rpcfit33.c
+src/rpcfit33.o: src/rpcfit33.c src/xmalloc.c src/fail.c src/smapa.h
 src/rpctk.o: src/rpctk.c src/xmalloc.c src/fail.c src/xfopen.c \
-  src/parsenumbers.c src/rpcfit33.c src/rpc2.c src/smapa.h
+  src/parsenumbers.c src/pickopt.c src/rpcfit33.c src/rpc2.c src/smapa.h \
+  src/utm.c
 src/rpctk_old.o: src/rpctk_old.c
 src/seconds.o: src/seconds.c
 src/setpixel.o: src/setpixel.c src/iio.h
@@ -157,8 +167,9 @@ src/siftie.o: src/siftie.c src/fail.c src/xmalloc.c src/xfopen.c \
   src/parsenumbers.c src/smapa.h src/ok_list.c src/grid.c src/iio.h
 src/siftu.o: src/siftu.c src/siftie.c src/fail.c src/xmalloc.c src/xfopen.c \
   src/parsenumbers.c src/smapa.h src/ok_list.c src/grid.c src/iio.h
-src/simpois.o: src/simpois.c src/cleant_cgpois.c src/minicg.c src/smapa.h \
-  src/help_stuff.c src/iio.h src/pickopt.c
+src/simpois.o: src/simpois.c src/multicolor.c src/nanreduce.c \
+  src/cleant_cgpois.c src/minicg.c src/smapa.h \
+  src/help_stuff.c src/iio.h src/pickopt.c src/pd_specialize.h
 src/spline.o: src/spline.c
 src/srmatch.o: src/srmatch.c src/fail.c src/xmalloc.c src/xfopen.c \
   src/siftie.c src/parsenumbers.c src/smapa.h src/ok_list.c src/grid.c \
@@ -167,29 +178,33 @@ src/srmatch.o: src/srmatch.c src/fail.c src/xmalloc.c src/xfopen.c \
 src/strt.o: src/strt.c src/xmalloc.c src/fail.c src/iio.h src/pickopt.c
 src/synflow.o: src/synflow.c src/iio.h src/xmalloc.c src/fail.c \
   src/synflow_core.c src/getpixel.c src/marching_interpolation.c \
-  src/vvector.h src/homographies.c src/smapa.h
+  src/vvector.h src/homographies.c src/smapa.h src/warpcore.c src/bicubic.c \
+  src/pd_specialize.h
 src/synflow_core.o: src/synflow_core.c src/fail.c src/getpixel.c \
   src/marching_interpolation.c src/vvector.h src/homographies.c \
-  src/smapa.h
+  src/smapa.h src/warpcore.c src/bicubic.c \
+  src/pd_specialize.h
 src/tbcat.o: src/tbcat.c src/iio.h src/xmalloc.c src/fail.c src/getpixel.c \
-  src/pickopt.c src/smapa.h src/help_stuff.c
-src/tiff_octaves_rw.o: src/tiff_octaves_rw.c
+  src/pickopt.c src/catstream.c src/smapa.h src/help_stuff.c
+src/tiff_octaves_rw.o: src/tiff_octaves_rw.c src/bitpack.c
 src/tiffu.o: src/tiffu.c
-src/upsa.o: src/upsa.c src/iio.h src/fail.c src/marching_squares.c \
+src/upsa.o: src/upsa.c src/profile.c src/iio.h src/fail.c src/marching_squares.c \
   src/marching_interpolation.c src/bicubic.c src/getpixel.c \
-  src/pickopt.c
+  src/pickopt.c src/pd_specialize.h
 src/veco.o: src/veco.c src/iio.h src/fail.c src/xmalloc.c src/random.c \
-  src/help_stuff.c src/pickopt.c
+  src/help_stuff.c src/pickopt.c src/stackreduce.c
 src/vecoh.o: src/vecoh.c src/iio.h src/fail.c src/xmalloc.c src/random.c \
-  src/modes_detector.c src/smapa.h src/help_stuff.c src/pickopt.c
+  src/modes_detector.c src/smapa.h src/help_stuff.c src/pickopt.c \
+  src/stackreduce.c
 src/vecov.o: src/vecov.c src/iio.h src/fail.c src/xmalloc.c src/random.c \
-  src/smapa.h src/help_stuff.c src/pickopt.c
+  src/quantiles.c src/geomedian_core.c src/smapa.h src/help_stuff.c src/pickopt.c \
+  src/stackreduce.c
 src/vector.o: src/vector.c
 src/viewflow.o: src/viewflow.c src/iio.h src/smapa.h src/fail.c \
   src/drawsegment.c src/colorcoordsf.c src/marching_squares.c \
-  src/help_stuff.c
+  src/fastlic.c src/help_stuff.c
 src/warp.o: src/warp.c src/iio.h src/fail.c src/xmalloc.c src/getpixel.c \
-  src/bicubic.c src/smapa.h
+  src/bicubic.c src/smapa.h src/pd_specialize.h
 src/xfopen.o: src/xfopen.c src/fail.c
 src/xmalloc.o: src/xmalloc.c src/fail.c
 src/ftr/blur.o: src/ftr/blur.c src/ftr/fail.c src/ftr/xmalloc.c src/ftr/smapa.h \
@@ -197,7 +212,7 @@ src/ftr/blur.o: src/ftr/blur.c src/ftr/fail.c src/ftr/xmalloc.c src/ftr/smapa.h
   src/ftr/iio.h
 src/ftr/ccpu.o: src/ftr/ccpu.c src/ftr/iio.h
 src/ftr/cpu.o: src/ftr/cpu.c src/ftr/fancy_image.h src/ftr/ftr.h src/ftr/fontu.c \
-  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c \
+  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/bitpack.c \
   src/ftr/fonts/xfonts_all.c src/ftr/fonts/xfont_4x6.c \
   src/ftr/fonts/xfont_5x7.c src/ftr/fonts/xfont_5x8.c \
   src/ftr/fonts/xfont_6x10.c src/ftr/fonts/xfont_6x12.c \
@@ -213,27 +228,27 @@ src/ftr/cpu.o: src/ftr/cpu.c src/ftr/fancy_image.h src/ftr/ftr.h src/ftr/fontu.c
   src/ftr/fonts/xfont_helvR12.c src/ftr/shadowcast.c src/ftr/iio.h \
   src/ftr/sarsim.c src/ftr/random.c src/ftr/smapa.h src/ftr/blur.c \
   src/ftr/ppsmooth.c src/ftr/pickopt.c src/ftr/help_stuff.c
-src/ftr/dataconv.o: src/ftr/dataconv.c src/ftr/xmalloc.c src/ftr/fail.c
+src/ftr/dataconv.o: src/ftr/dataconv.c src/ftr/bitpack.c src/ftr/xmalloc.c src/ftr/fail.c
 src/ftr/dosdo.o: src/ftr/dosdo.c src/ftr/iio.h src/ftr/ftr.h src/ftr/fontu.c \
-  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c \
+  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/bitpack.c \
   src/ftr/fonts/xfont_9x15.c
 src/ftr/dummy.o: src/ftr/dummy.c
 src/ftr/egm96.o: src/ftr/egm96.c src/ftr/iio.h
 src/ftr/epiview.o: src/ftr/epiview.c src/ftr/iio.h src/ftr/ftr.h src/ftr/fontu.c \
-  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c \
+  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/bitpack.c \
   src/ftr/fonts/xfont_9x15.c src/ftr/parsenumbers.c
 src/ftr/fail.o: src/ftr/fail.c
 src/ftr/fancy_image.o: src/ftr/fancy_image.c src/ftr/fancy_image.h src/ftr/iio.h \
-  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/tiff_octaves_rw.c \
-  src/ftr/smapa.h
+  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/nanreduce.c \
+  src/ftr/tiff_octaves_rw.c src/ftr/bitpack.c src/ftr/smapa.h
 src/ftr/fancy_rpcflip.o: src/ftr/fancy_rpcflip.c src/ftr/rpc2.c src/ftr/xfopen.c \
   src/ftr/fail.c src/ftr/smapa.h src/ftr/ftr.h src/ftr/ccpu.h \
-  src/ftr/fancy_image.h src/ftr/srtm4o.c src/ftr/tiff_octaves_rw.c \
+  src/ftr/fancy_image.h src/ftr/srtm4o.c src/ftr/tiff_octaves_rw.c src/ftr/bitpack.c \
   src/ftr/iio.h src/ftr/xmalloc.c src/ftr/pickopt.c
 src/ftr/fill_bill.o: src/ftr/fill_bill.c src/ftr/iio.h
 src/ftr/fm.o: src/ftr/fm.c src/ftr/seconds.c src/ftr/ftr.h src/ftr/iio.h
 src/ftr/fontu.o: src/ftr/fontu.c src/ftr/xmalloc.c src/ftr/fail.c \
-  src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/fonts/xfonts_all.c \
+  src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/bitpack.c src/ftr/fonts/xfonts_all.c \
   src/ftr/fonts/xfont_4x6.c src/ftr/fonts/xfont_5x7.c \
   src/ftr/fonts/xfont_5x8.c src/ftr/fonts/xfont_6x10.c \
   src/ftr/fonts/xfont_6x12.c src/ftr/fonts/xfont_6x13.c \
@@ -251,7 +266,7 @@ src/ftr/fpan.o: src/ftr/fpan.c src/ftr/iio.h src/ftr/ftr.h src/ftr/xmalloc.c \
   src/ftr/fail.c src/ftr/smapa.h
 src/ftr/fpanflip.o: src/ftr/fpanflip.c src/ftr/iio.h src/ftr/ftr.h \
   src/ftr/xmalloc.c src/ftr/fail.c
-src/ftr/fpantiff.o: src/ftr/fpantiff.c src/ftr/tiff_octaves_rw.c src/ftr/ftr.h \
+src/ftr/fpantiff.o: src/ftr/fpantiff.c src/ftr/tiff_octaves_rw.c src/ftr/bitpack.c src/ftr/ftr.h \
   src/ftr/iio.h src/ftr/pickopt.c
 src/ftr/ftr.o: src/ftr/ftr.c src/ftr/ftr_x11.c src/ftr/ftr.h \
   src/ftr/ftr_common_inc.c
@@ -276,7 +291,7 @@ src/ftr/powerkill.o: src/ftr/powerkill.c src/ftr/iio.h src/ftr/ftr.h \
 src/ftr/ppsmooth.o: src/ftr/ppsmooth.c src/ftr/iio.h src/ftr/pickopt.c
 src/ftr/random.o: src/ftr/random.c
 src/ftr/rpc2.o: src/ftr/rpc2.c src/ftr/xfopen.c src/ftr/fail.c src/ftr/smapa.h
-src/ftr/rpcflip.o: src/ftr/rpcflip.c src/ftr/tiff_octaves_rw.c src/ftr/srtm4o.c \
+src/ftr/rpcflip.o: src/ftr/rpcflip.c src/ftr/tiff_octaves_rw.c src/ftr/bitpack.c src/ftr/srtm4o.c \
   src/ftr/rpc2.c src/ftr/xfopen.c src/ftr/fail.c src/ftr/smapa.h \
   src/ftr/ftr.h src/ftr/iio.h src/ftr/xmalloc.c src/ftr/pickopt.c
 src/ftr/s5pv.o: src/ftr/s5pv.c src/ftr/ftr.h src/ftr/iio.h src/ftr/xmalloc.c \
@@ -287,20 +302,20 @@ src/ftr/seconds.o: src/ftr/seconds.c
 src/ftr/shadowcast.o: src/ftr/shadowcast.c src/ftr/iio.h src/ftr/xmalloc.c \
   src/ftr/fail.c src/ftr/pickopt.c
 src/ftr/srt.o: src/ftr/srt.c src/ftr/ftr.h src/ftr/fontu.c src/ftr/xmalloc.c \
-  src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c \
+  src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/bitpack.c \
   src/ftr/fonts/xfont_10x20.c
-src/ftr/srtm4o.o: src/ftr/srtm4o.c src/ftr/tiff_octaves_rw.c
+src/ftr/srtm4o.o: src/ftr/srtm4o.c src/ftr/tiff_octaves_rw.c src/ftr/bitpack.c
 src/ftr/strt.o: src/ftr/strt.c src/ftr/xmalloc.c src/ftr/fail.c src/ftr/iio.h \
   src/ftr/pickopt.c
 src/ftr/tdip.o: src/ftr/tdip.c src/ftr/iio.h src/ftr/strt.c src/ftr/xmalloc.c \
   src/ftr/fail.c src/ftr/smapa.h src/ftr/random.c src/ftr/pickopt.c
-src/ftr/tiff_octaves_rw.o: src/ftr/tiff_octaves_rw.c
+src/ftr/tiff_octaves_rw.o: src/ftr/tiff_octaves_rw.c src/ftr/bitpack.c
 src/ftr/tiffu.o: src/ftr/tiffu.c
 src/ftr/tterm.o: src/ftr/tterm.c
 src/ftr/viho.o: src/ftr/viho.c src/ftr/ftr.h src/ftr/marching_interpolation.c \
   src/ftr/iio.h src/ftr/pickopt.c
 src/ftr/wifpan.o: src/ftr/wifpan.c src/ftr/iio.h src/ftr/ftr.h src/ftr/fontu.c \
-  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c \
+  src/ftr/xmalloc.c src/ftr/fail.c src/ftr/xfopen.c src/ftr/dataconv.c src/ftr/bitpack.c \
   src/ftr/fonts/xfonts_all.c src/ftr/fonts/xfont_4x6.c \
   src/ftr/fonts/xfont_5x7.c src/ftr/fonts/xfont_5x8.c \
   src/ftr/fonts/xfont_6x10.c src/ftr/fonts/xfont_6x12.c \
@@ -339,7 +354,7 @@ src/misc/bfollow.o: src/misc/bfollow.c
 src/misc/bicubic.o: src/misc/bicubic.c src/misc/getpixel.c
 src/misc/bilinear_interpolation.o: src/misc/bilinear_interpolation.c
 src/misc/blur.o: src/misc/blur.c src/misc/fail.c src/misc/xmalloc.c \
-  src/misc/smapa.h src/misc/help_stuff.c src/misc/parsenumbers.c \
+  src/misc/xarena.c src/misc/smapa.h src/misc/help_stuff.c src/misc/parsenumbers.c \
   src/misc/pickopt.c src/misc/iio.h
 src/misc/bmfm.o: src/misc/bmfm.c src/misc/xmalloc.c src/misc/fail.c \
   src/misc/getpixel.c src/misc/iio.h src/misc/parsenumbers.c
@@ -365,7 +380,7 @@ src/misc/cgpois_rec.o: src/misc/cgpois_rec.c src/misc/conjugate_gradient.c \
 src/misc/chisto.o: src/misc/chisto.c src/misc/iio.h src/misc/xmalloc.c \
   src/misc/fail.c src/misc/smapa.h
 src/misc/cldmask.o: src/misc/cldmask.c src/misc/fail.c src/misc/xmalloc.c \
-  src/misc/xfopen.c src/misc/parsenumbers.c src/misc/drawsegment.c \
+  src/misc/xfopen.c src/misc/parsenumbers.c src/misc/polyfill.c \
   src/misc/iio.h src/misc/pickopt.c
 src/misc/cline.o: src/misc/cline.c src/misc/fail.c src/misc/bicubic.c \
   src/misc/getpixel.c src/misc/bilinear_interpolation.c src/misc/iio.h \
@@ -398,7 +413,7 @@ src/misc/croparound.o: src/misc/croparound.c src/misc/getpixel.c src/misc/iio.h
 src/misc/crosses.o: src/misc/crosses.c src/misc/fail.c src/misc/xmalloc.c \
   src/misc/iio.h
 src/misc/cutrecombine.o: src/misc/cutrecombine.c src/misc/iio.h src/misc/fail.c
-src/misc/dataconv.o: src/misc/dataconv.c src/misc/xmalloc.c src/misc/fail.c
+src/misc/dataconv.o: src/misc/dataconv.c src/misc/bitpack.c src/misc/xmalloc.c src/misc/fail.c
 src/misc/deframe.o: src/misc/deframe.c src/misc/fail.c src/misc/xmalloc.c \
   src/misc/getpixel.c src/misc/homographies.c src/misc/bicubic.c \
   src/misc/iio.h
@@ -416,14 +431,21 @@ src/misc/dveco.o: src/misc/dveco.c src/misc/iio.h src/misc/fail.c \
   src/misc/xmalloc.c src/misc/random.c src/misc/pickopt.c
 src/misc/dvecov_lm.o: src/misc/dvecov_lm.c src/misc/iio.h src/misc/fail.c \
   src/misc/xmalloc.c src/misc/pickopt.c
-src/misc/elap.o: src/misc/elap.c src/misc/iio.h
-src/misc/elap2.o: src/misc/elap2.c src/misc/xmalloc.c src/misc/fail.c \
+src/misc/elap.o: src/misc/elap.c src/misc/elap_engine.c \
+  src/misc/xmalloc.c src/misc/fail.c src/misc/smapa.h src/misc/iio.h
+src/misc/elap2.o: src/misc/elap2.c src/misc/elap_engine.c \
+  src/misc/xmalloc.c src/misc/fail.c src/misc/smapa.h \
   src/misc/distance.c src/misc/abstract_heap.h src/misc/iio.h
-src/misc/elap3.o: src/misc/elap3.c src/misc/iio.h
-src/misc/elap_rec.o: src/misc/elap_rec.c src/misc/iio.h
-src/misc/elap_recsep.o: src/misc/elap_recsep.c src/misc/smapa.h src/misc/iio.h
-src/misc/elevate_matches.o: src/misc/elevate_matches.c src/misc/iio.h \
-  src/misc/xfopen.c src/misc/fail.c
+src/misc/elap3.o: src/misc/elap3.c src/misc/elap_engine.c \
+  src/misc/xmalloc.c src/misc/fail.c src/misc/smapa.h src/misc/iio.h
+src/misc/elap_rec.o: src/misc/elap_rec.c src/misc/elap_engine.c \
+  src/misc/xmalloc.c src/misc/fail.c src/misc/smapa.h src/misc/iio.h
+src/misc/elap_recsep.o: src/misc/elap_recsep.c src/misc/elap_engine.c \
+  src/misc/xmalloc.c src/misc/fail.c src/misc/smapa.h \
+  src/misc/iio.h
+src/misc/elevate_matches.o: src/misc/elevate_matches.c \
+  src/misc/fancy_image.h src/misc/xfopen.c src/misc/fail.c src/misc/xmalloc.c \
+  src/misc/pickopt.c
 src/misc/elevate_matcheshh.o: src/misc/elevate_matcheshh.c src/misc/iio.h \
   src/misc/xfopen.c src/misc/fail.c src/misc/parsenumbers.c \
   src/misc/xmalloc.c
@@ -433,8 +455,8 @@ src/misc/fabius.o: src/misc/fabius.c
 src/misc/fail.o: src/misc/fail.c
 src/misc/fancy_evals.o: src/misc/fancy_evals.c src/misc/fancy_image.h
 src/misc/fancy_image.o: src/misc/fancy_image.c src/misc/fancy_image.h \
-  src/misc/iio.h src/misc/xmalloc.c src/misc/fail.c \
-  src/misc/tiff_octaves_rw.c src/misc/smapa.h
+  src/misc/iio.h src/misc/xmalloc.c src/misc/fail.c src/misc/nanreduce.c \
+  src/misc/tiff_octaves_rw.c src/misc/bitpack.c src/misc/smapa.h
 src/misc/fancy_zoomout.o: src/misc/fancy_zoomout.c src/misc/fancy_image.h
 src/misc/faxpb.o: src/misc/faxpb.c src/misc/iio.h
 src/misc/faxpby.o: src/misc/faxpby.c src/misc/iio.h
@@ -479,12 +501,16 @@ src/misc/geomedian.o: src/misc/geomedian.c src/misc/linalg.c src/misc/random.c \
 src/misc/getopt_with_pickopt.o: src/misc/getopt_with_pickopt.c
 src/misc/getpixel.o: src/misc/getpixel.c
 src/misc/gharrows.o: src/misc/gharrows.c src/misc/iio.h src/misc/smapa.h
-src/misc/ghough.o: src/misc/ghough.c src/misc/iio.h
-src/misc/ghough2.o: src/misc/ghough2.c src/misc/pickopt.c src/misc/iio.h
+src/misc/ghough.o: src/misc/ghough.c src/misc/xmalloc.c src/misc/fail.c \
+  src/misc/hough_vote.c src/misc/iio.h src/misc/pickopt.c
+src/misc/ghough2.o: src/misc/ghough2.c src/misc/xmalloc.c src/misc/fail.c \
+  src/misc/hough_vote.c src/misc/pickopt.c src/misc/iio.h
 src/misc/graysing.o: src/misc/graysing.c src/misc/iio.h
 src/misc/grid.o: src/misc/grid.c src/misc/fail.c
 src/misc/harris.o: src/misc/harris.c src/misc/iio.h src/misc/fragments.c \
   src/misc/getpixel.c
+src/misc/heapbench.o: src/misc/heapbench.c src/misc/xmalloc.c \
+  src/misc/fail.c src/misc/abstract_heap.h
 src/misc/help_stuff.o: src/misc/help_stuff.c
 src/misc/histeq8.o: src/misc/histeq8.c src/misc/iio.h
 src/misc/histomodev.o: src/misc/histomodev.c src/misc/iio.h src/misc/pickopt.c
@@ -493,7 +519,8 @@ src/misc/homdots.o: src/misc/homdots.c src/misc/iio.h
 src/misc/homfilt.o: src/misc/homfilt.c src/misc/parsenumbers.c src/misc/xmalloc.c \
   src/misc/fail.c src/misc/vvector.h src/misc/smapa.h
 src/misc/homographies.o: src/misc/homographies.c
-src/misc/houghs.o: src/misc/houghs.c src/misc/iio.h
+src/misc/houghs.o: src/misc/houghs.c src/misc/xmalloc.c src/misc/fail.c \
+  src/misc/hough_vote.c src/misc/iio.h src/misc/pickopt.c
 src/misc/hrezoom.o: src/misc/hrezoom.c src/misc/vvector.h
 src/misc/hs.o: src/misc/hs.c src/misc/iio.h
 src/misc/hs_core.o: src/misc/hs_core.c
@@ -502,7 +529,8 @@ src/misc/hslice.o: src/misc/hslice.c src/misc/iio.h
 src/misc/huffman.o: src/misc/huffman.c src/misc/abstract_heap.h
 src/misc/hview.o: src/misc/hview.c src/misc/xmalloc.c src/misc/fail.c \
   src/misc/iio.h
-src/misc/ihough2.o: src/misc/ihough2.c src/misc/iio.h src/misc/pickopt.c
+src/misc/ihough2.o: src/misc/ihough2.c src/misc/xmalloc.c src/misc/fail.c \
+  src/misc/hough_vote.c src/misc/iio.h src/misc/pickopt.c
 src/misc/iio.o: src/misc/iio.c
 src/misc/ijmesh.o: src/misc/ijmesh.c src/misc/iio.h src/misc/pickopt.c
 src/misc/imdim.o: src/misc/imdim.c src/misc/iio.h
@@ -515,10 +543,12 @@ src/misc/iminfo.o: src/misc/iminfo.c src/misc/iio.h src/misc/statistics.c \
 src/misc/imsort.o: src/misc/imsort.c src/misc/iio.h
 src/misc/imspread.o: src/misc/imspread.c src/misc/iio.h
 src/misc/inppairs.o: src/misc/inppairs.c src/misc/iio.h
-src/misc/intimg.o: src/misc/intimg.c src/misc/iio.h
+src/misc/intimg.o: src/misc/intimg.c src/misc/iio.h src/misc/xmalloc.c \
+  src/misc/fail.c src/misc/sat.c src/misc/smapa.h src/misc/pickopt.c
 src/misc/ipol_datum.o: src/misc/ipol_datum.c
 src/misc/ipol_watermark.o: src/misc/ipol_watermark.c src/misc/iio.h
-src/misc/ising.o: src/misc/ising.c src/misc/random.c
+src/misc/ising.o: src/misc/ising.c src/misc/random.c src/misc/iio.h \
+  src/misc/pickopt.c
 src/misc/isingroot.o: src/misc/isingroot.c src/misc/random.c src/misc/iio.h \
   src/misc/pickopt.c
 src/misc/isoricci.o: src/misc/isoricci.c src/misc/iio.h
@@ -534,19 +564,19 @@ src/misc/lgblur3.o: src/misc/lgblur3.c src/misc/gblur.c src/misc/iio.h \
   src/misc/fail.c src/misc/xmalloc.c src/misc/vvector.h \
   src/misc/bicubic.c src/misc/getpixel.c src/misc/smapa.h
 src/misc/lic.o: src/misc/lic.c src/misc/fail.c src/misc/xmalloc.c \
-  src/misc/random.c src/misc/bilinear_interpolation.c src/misc/smapa.h \
-  src/misc/iio.h
+  src/misc/random.c src/misc/bilinear_interpolation.c src/misc/fastlic.c \
+  src/misc/smapa.h src/misc/iio.h src/misc/pickopt.c
 src/misc/linalg.o: src/misc/linalg.c
 src/misc/lk.o: src/misc/lk.c src/misc/iio.h src/misc/svd.c src/misc/vvector.h \
   src/misc/smapa.h
-src/misc/lk_omp.o: src/misc/lk_omp.c src/misc/iio.h src/misc/svd.c \
-  src/misc/vvector.h
 src/misc/lkgen.o: src/misc/lkgen.c
 src/misc/lowe_join.o: src/misc/lowe_join.c
 src/misc/lure.o: src/misc/lure.c src/misc/xmalloc.c src/misc/fail.c \
-  src/misc/getpixel.c src/misc/blur.c src/misc/smapa.h src/misc/iio.h
+  src/misc/sat.c src/misc/blur.c src/misc/xarena.c src/misc/smapa.h \
+  src/misc/iio.h
 src/misc/lures.o: src/misc/lures.c src/misc/xmalloc.c src/misc/fail.c \
-  src/misc/getpixel.c src/misc/blur.c src/misc/smapa.h src/misc/iio.h
+  src/misc/getpixel.c src/misc/blur.c src/misc/xarena.c src/misc/smapa.h \
+  src/misc/iio.h
 src/misc/maptp.o: src/misc/maptp.c src/misc/fail.c src/misc/xmalloc.c \
   src/misc/parsenumbers.c
 src/misc/marchi_clean.o: src/misc/marchi_clean.c
@@ -598,7 +628,7 @@ src/misc/periodize.o: src/misc/periodize.c src/misc/iio.h src/misc/xmalloc.c \
 src/misc/perms.o: src/misc/perms.c
 src/misc/pickopt.o: src/misc/pickopt.c
 src/misc/plyflatten.o: src/misc/plyflatten.c src/misc/xmalloc.c src/misc/fail.c \
-  src/misc/smapa.h src/misc/iio.h
+  src/misc/smapa.h src/misc/utm.c src/misc/iio.h src/misc/pickopt.c
 src/misc/plyroads.o: src/misc/plyroads.c src/misc/fail.c src/misc/xfopen.c \
   src/misc/parsenumbers.c src/misc/xmalloc.c
 src/misc/plyroads_mini.o: src/misc/plyroads_mini.c src/misc/parsenumbers.c \
@@ -638,9 +668,11 @@ src/misc/replicate.o: src/misc/replicate.c src/misc/iio.h src/misc/xmalloc.c \
   src/misc/fail.c
 src/misc/rgbcube.o: src/misc/rgbcube.c src/misc/iio.h
 src/misc/rgfield.o: src/misc/rgfield.c src/misc/iio.h src/misc/xmalloc.c \
-  src/misc/fail.c src/misc/smapa.h src/misc/gblur.c src/misc/vvector.h
+  src/misc/fail.c src/misc/smapa.h src/misc/randfield.c src/misc/random.c \
+  src/misc/fftplans.c
 src/misc/rgfields.o: src/misc/rgfields.c src/misc/iio.h src/misc/xmalloc.c \
-  src/misc/fail.c src/misc/smapa.h src/misc/gblur.c src/misc/vvector.h
+  src/misc/fail.c src/misc/smapa.h src/misc/randfield.c src/misc/random.c \
+  src/misc/fftplans.c
 src/misc/rgfieldst.o: src/misc/rgfieldst.c src/misc/iio.h src/misc/xmalloc.c \
   src/misc/fail.c src/misc/smapa.h src/misc/gblur.c src/misc/vvector.h
 src/misc/rip.o: src/misc/rip.c
@@ -672,12 +704,13 @@ src/misc/rpc_pmn.o: src/misc/rpc_pmn.c src/misc/rpc.c src/misc/xfopen.c \
   src/misc/iio.h
 src/misc/rpc_warpab.o: src/misc/rpc_warpab.c src/misc/getpixel.c \
   src/misc/bicubic.c src/misc/rpc.c src/misc/xfopen.c src/misc/fail.c \
-  src/misc/smapa.h src/misc/iio.h src/misc/xmalloc.c
+  src/misc/smapa.h src/misc/xmalloc.c src/misc/approxmap.c src/misc/iio.h
 src/misc/rpc_warpabt.o: src/misc/rpc_warpabt.c src/misc/getpixel.c \
   src/misc/bicubic.c src/misc/rpc.c src/misc/xfopen.c src/misc/fail.c \
   src/misc/smapa.h src/misc/tiffu.c src/misc/iio.h src/misc/xmalloc.c
 src/misc/rpcflow.o: src/misc/rpcflow.c src/misc/iio.h src/misc/xmalloc.c \
-  src/misc/fail.c src/misc/rpc.c src/misc/xfopen.c src/misc/smapa.h
+  src/misc/fail.c src/misc/rpc.c src/misc/xfopen.c src/misc/smapa.h \
+  src/misc/approxmap.c
 src/misc/rpchfilt.o: src/misc/rpchfilt.c src/misc/parsenumbers.c \
   src/misc/xmalloc.c src/misc/fail.c src/misc/rpc.c src/misc/xfopen.c \
   src/misc/smapa.h
@@ -692,7 +725,8 @@ src/misc/satproj.o: src/misc/satproj.c src/misc/fail.c src/misc/getpixel.c \
 src/misc/scheme_plap.o: src/misc/scheme_plap.c src/misc/fail.c src/misc/iio.h \
   src/misc/xmalloc.c
 src/misc/sdistance.o: src/misc/sdistance.c src/misc/abstract_heap.h \
-  src/misc/xmalloc.c src/misc/fail.c src/misc/iio.h src/misc/pickopt.c
+  src/misc/xmalloc.c src/misc/fail.c src/misc/iio.h src/misc/eucdist.c \
+  src/misc/pickopt.c
 src/misc/segfilter.o: src/misc/segfilter.c src/misc/parsenumbers.c \
   src/misc/xmalloc.c src/misc/fail.c src/misc/iio.h
 src/misc/setdim.o: src/misc/setdim.c src/misc/iio.h
@@ -734,7 +768,7 @@ src/misc/thinpa_recsep.o: src/misc/thinpa_recsep.c src/misc/smapa.h src/misc/iio
 src/misc/tiff_octaves.o: src/misc/tiff_octaves.c
 src/misc/tiff_octaves_notest.o: src/misc/tiff_octaves_notest.c
 src/misc/tiff_octaves_old.o: src/misc/tiff_octaves_old.c
-src/misc/tiff_octaves_rw.o: src/misc/tiff_octaves_rw.c
+src/misc/tiff_octaves_rw.o: src/misc/tiff_octaves_rw.c src/misc/bitpack.c
 src/misc/tiffu.o: src/misc/tiffu.c
 src/misc/tiloct.o: src/misc/tiloct.c
 src/misc/tilt_and_shear.o: src/misc/tilt_and_shear.c src/misc/bicubic.c \
@@ -765,3 +799,46 @@ src/misc/zeropad.o: src/misc/zeropad.c src/misc/xmalloc.c src/misc/fail.c \
 src/misc/zoombil.o: src/misc/zoombil.c src/misc/fail.c src/misc/xmalloc.c \
   src/misc/bilinear_interpolation.c src/misc/bicubic.c \
   src/misc/getpixel.c src/misc/smapa.h src/misc/iio.h src/misc/pickopt.c
+src/lib/imscript_blur.pic.o: src/lib/imscript_blur.c src/blur.c \
+ src/fail.c src/xmalloc.c \
+ src/xarena.c src/fftplans.c src/smapa.h \
+ src/help_stuff.c src/parsenumbers.c src/pickopt.c \
+ src/iio.h src/fancy_image.h src/profile.c \
+ src/lib/imscript.h
+src/lib/imscript_downsa.pic.o: src/lib/imscript_downsa.c src/downsa.c \
+ src/iio.h src/fail.c src/xmalloc.c \
+ src/random.c src/quantiles.c src/help_stuff.c \
+ src/profile.c src/lib/imscript.h
+src/lib/imscript_homwarp.pic.o: src/lib/imscript_homwarp.c src/homwarp.c \
+ src/extrapolators.c src/bilinear_interpolation.c \
+ src/marching_interpolation.c src/bicubic_gray.c \
+ src/spline.c src/iio.h src/xmalloc.c \
+ src/fail.c src/parsenumbers.c src/help_stuff.c \
+ src/pickopt.c src/profile.c src/lib/imscript.h
+src/lib/imscript_morsi.pic.o: src/lib/imscript_morsi.c src/morsi.c \
+ src/xmalloc.c src/fail.c src/iio.h \
+ src/help_stuff.c src/profile.c src/lib/imscript.h
+src/lib/imscript_plambda.pic.o: src/lib/imscript_plambda.c src/plambda.c \
+ src/smapa.h src/fail.c src/xmalloc.c \
+ src/random.c src/quantiles.c src/parsenumbers.c \
+ src/colorcoordsf.c src/getpixel.c src/iio.h \
+ src/profile.c src/help_stuff.c src/lib/imscript.h
+src/lib/imscript_ransac.pic.o: src/lib/imscript_ransac.c src/ransac.c \
+ src/fail.c src/xmalloc.c src/xfopen.c \
+ src/random.c src/smapa.h src/ransac_cases.c \
+ src/vvector.h src/homographies.c \
+ src/moistiv_epipolar.c src/exterior_algebra.c \
+ src/parsenumbers.c src/pickopt.c src/lib/imscript.h
+src/lib/imscript_siftu.pic.o: src/lib/imscript_siftu.c src/siftu.c \
+ src/siftie.c src/fail.c src/xmalloc.c \
+ src/xfopen.c src/parsenumbers.c src/kdforest.c \
+ src/smapa.h src/grid.c src/iio.h \
+ src/ransac.c src/random.c src/ransac_cases.c \
+ src/vvector.h src/homographies.c \
+ src/moistiv_epipolar.c src/exterior_algebra.c \
+ src/pickopt.c src/lib/imscript.h
+src/lib/imscript_upsa.pic.o: src/lib/imscript_upsa.c src/upsa.c \
+ src/iio.h src/fail.c src/marching_squares.c \
+ src/marching_interpolation.c src/bicubic.c \
+ src/getpixel.c src/pickopt.c src/profile.c \
+ src/lib/imscript.h
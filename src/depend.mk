@@ -18,17 +18,19 @@ homwarp: homwarp.c extrapolators.c bilinear_interpolation.c \
  marching_interpolation.c bicubic_gray.c spline.c iio.h xmalloc.c fail.c \
  parsenumbers.c help_stuff.c pickopt.c
 synflow: synflow.c iio.h xmalloc.c fail.c synflow_core.c getpixel.c \
- marching_interpolation.c vvector.h homographies.c smapa.h
-backflow: backflow.c iio.h fail.c xmalloc.c getpixel.c bicubic.c \
- smapa.h
-flowinv: flowinv.c iio.h fail.c xmalloc.c bicubic.c getpixel.c
-nnint: nnint.c abstract_heap.h xmalloc.c fail.c iio.h pickopt.c
+ marching_interpolation.c warpcore.c bicubic.c vvector.h homographies.c \
+ smapa.h pickopt.c
+backflow: backflow.c iio.h fail.c xmalloc.c getpixel.c warpcore.c \
+ bicubic.c smapa.h
+flowinv: flowinv.c iio.h fail.c xmalloc.c bicubic.c getpixel.c splat.c \
+ pickopt.c
+nnint: nnint.c abstract_heap.h xmalloc.c fail.c eucdist.c iio.h pickopt.c
 bdint: bdint.c abstract_dsf.c iio.h pickopt.c
-amle: amle.c iio.h fail.c xmalloc.c smapa.h
-simpois: simpois.c cleant_cgpois.c minicg.c smapa.h iio.h pickopt.c
+amle: amle.c iio.h fail.c xmalloc.c multicolor.c smapa.h
+simpois: simpois.c multicolor.c nanreduce.c cleant_cgpois.c minicg.c smapa.h iio.h pickopt.c
 ghisto: ghisto.c iio.h xmalloc.c fail.c smapa.h
 contihist: contihist.c xfopen.c fail.c xmalloc.c iio.h
-fontu: fontu.c xmalloc.c fail.c xfopen.c dataconv.c iio.h pickopt.c
+fontu: fontu.c xmalloc.c fail.c xfopen.c dataconv.c bitpack.c iio.h pickopt.c
 imprintf: imprintf.c iio.h help_stuff.c
 pview: pview.c iio.h fail.c xmalloc.c xfopen.c parsenumbers.c \
  drawsegment.c pickopt.c smapa.h random.c
@@ -37,21 +39,23 @@ viewflow: viewflow.c iio.h fail.c drawsegment.c colorcoordsf.c \
 flowarrows: flowarrows.c iio.h fail.c xmalloc.c drawsegment.c \
  getpixel.c smapa.h
 palette: palette.c fail.c xmalloc.c xfopen.c smapa.h iio.h
-ransac: ransac.c fail.c xmalloc.c xfopen.c random.c ransac_cases.c \
- vvector.h homographies.c moistiv_epipolar.c parsenumbers.c
+ransac: ransac.c fail.c xmalloc.c xfopen.c random.c smapa.h ransac_cases.c \
+ vvector.h homographies.c moistiv_epipolar.c parsenumbers.c pickopt.c
 srmatch: srmatch.c fail.c xmalloc.c xfopen.c siftie.c parsenumbers.c \
- smapa.h ok_list.c grid.c iio.h ransac.c random.c ransac_cases.c \
- vvector.h homographies.c moistiv_epipolar.c
+ kdforest.c smapa.h grid.c iio.h ransac.c random.c ransac_cases.c vvector.h \
+ homographies.c moistiv_epipolar.c
 tiffu: tiffu.c
 siftu: siftu.c siftie.c fail.c xmalloc.c xfopen.c parsenumbers.c \
- smapa.h ok_list.c grid.c iio.h
+ kdforest.c smapa.h grid.c iio.h ransac.c random.c ransac_cases.c vvector.h \
+ homographies.c moistiv_epipolar.c pickopt.c
 crop: crop.c fail.c xmalloc.c iio.h
 lrcat: lrcat.c iio.h xmalloc.c fail.c getpixel.c pickopt.c
 tbcat: tbcat.c iio.h smapa.h xmalloc.c fail.c getpixel.c pickopt.c
 fftshift: fftshift.c iio.h
 imflip: imflip.c help_stuff.c iio.h
-bmms: bmms.c xmalloc.c fail.c getpixel.c iio.h pickopt.c
-registration: registration.c iio.h
+bmms: bmms.c xmalloc.c fail.c getpixel.c nanreduce.c iio.h pickopt.c
+registration: registration.c iio.h fftplans.c fail.c smapa.h ppsmooth.c \
+ pickopt.c
 blur: blur.c fail.c xmalloc.c smapa.h help_stuff.c parsenumbers.c iio.h
 fft: fft.c iio.h fail.c xmalloc.c
 dct: dct.c iio.h
@@ -59,6 +63,8 @@ dht: dht.c iio.h xmalloc.c fail.c
 flambda: flambda.c smapa.h fail.c xmalloc.c random.c parsenumbers.c \
  colorcoordsf.c fancy_image.h getpixel.c
 fancy_crop: fancy_crop.c fancy_image.h
-fancy_downsa: fancy_downsa.c fancy_image.h
+fancy_downsa: fancy_downsa.c fancy_image.h xmalloc.c fail.c nanreduce.c
 iion: iion.c iio.h
 iion_u16: iion_u16.c iio.h
+ppsmooth: ppsmooth.c fftplans.c fail.c iio.h pickopt.c xmalloc.c cleant_cgpois.c minicg.c \
+ smapa.h
@@ -13,12 +13,7 @@
 #include "xmalloc.c"
 
 
-#ifndef USE_WISDOM
-static void evoke_wisdom(void) {}
-static void bequeath_wisdom(void) {}
-#else//USE_WISDOM
-#include "fftwisdom.c"
-#endif//USE_WISDOM
+#include "fftplans.c"
 
 
 
@@ -26,22 +21,14 @@ static void bequeath_wisdom(void) {}
 // of a real-valued image
 static void fft_2dfloat(fftwf_complex *fx, float *x, int w, int h)
 {
-	fftwf_complex *a = fftwf_malloc(w*h*sizeof*a);
-
-	//fprintf(stderr, "planning...\n");
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_dft_2d(h, w, a, fx,
-						FFTW_FORWARD, FFTW_ESTIMATE);
-	bequeath_wisdom();
-	//fprintf(stderr, "...planned!\n");
+	struct fftplan *p = fftplan_get(FFTPLAN_DFT_FORWARD, w, h);
+	fftwf_complex *a = p->in, *b = p->out;
 
 	for (int i = 0; i < w*h; i++)
 		a[i] = x[i]; // complex assignment!
-	fftwf_execute(p);
-
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_cleanup();
+	fftwf_execute(p->p);
+	for (int i = 0; i < w*h; i++)
+		fx[i] = b[i];
 }
 
 // if it finds any strange number, sets it to zero
@@ -59,7 +46,7 @@ static void dht(float *y, float *x, int w, int h)
 	fft_2dfloat(gc, x, w, h);
 	for (int i = 0; i < w*h; i++)
 		y[i] = (crealf(gc[i]) - cimagf(gc[i]))/sqrt(w*h);
-	fftwf_free(gc);
+	free(gc);
 }
 
 
@@ -116,9 +116,80 @@ void dither_a(float *x, int w, int h)
 	}
 }
 
+#ifdef _OPENMP
+#include <omp.h>
+#include <stdlib.h>
+
+// number of pixels of each step of the wavefront
+#define DITHER_BLOCK 256
+
+// Floyd-Steinberg, by a skewed wavefront of rows (same result as "dither")
+//
+// The pixel (i,j) depends on its left neighbor and on the pixels (i-1..i+1)
+// of the previous row, and it receives its errors from them in the serial
+// order as long as the previous row is 3 pixels ahead.  Thus, each row is
+// processed by blocks, after the previous row has finished the block and
+// 2 more pixels.  The progress of each row is published in "done".
+void dither_wavefront(float *x, int w, int h)
+{
+	getpixel_operator get = getpixel_127;
+	setpixel_operator set = setpixel_insideP;
+	setpixel_operator add = setpixel_tsum_insideP;
+
+	int *done = malloc(h * sizeof*done);
+	for (int j = 0; j < h; j++)
+		done[j] = 0;
+
+#pragma omp parallel for schedule(static,1)
+	for (int j = 0; j < h; j++)
+	for (int i0 = 0; i0 < w; i0 += DITHER_BLOCK)
+	{
+		int i1 = i0 + DITHER_BLOCK < w ? i0 + DITHER_BLOCK : w;
+		int need = i1 + 2 < w ? i1 + 2 : w, d = j ? 0 : w;
+		while (d < need)
+		{
+#pragma omp atomic read
+			d = done[j-1];
+		}
+#pragma omp flush
+		for (int i = i0; i < i1; i++)
+		{
+			float old = get(x, w, h, i, j);
+			float new = dither_value(old);
+			float err = old - new;
+			set(x, w, h, i, j, new);
+			add(x, w, h, i+1, j+0, 7*err/16);
+			add(x, w, h, i-1, j+1, 3*err/16);
+			add(x, w, h, i+0, j+1, 5*err/16);
+			add(x, w, h, i+1, j+1, 1*err/16);
+		}
+#pragma omp flush
+#pragma omp atomic write
+		done[j] = i1;
+	}
+	free(done);
+}
+#endif//_OPENMP
 
 void dither_sep(float *x, int w, int h, int pd, _Bool b)
 {
+#ifdef _OPENMP
+	// enough channels to keep all the threads busy: one channel each
+	if (pd > 1 && pd >= omp_get_max_threads()) {
+#pragma omp parallel for
+		for (int i = 0; i < pd; i++)
+			if (b)
+				dither_b(x + i*w*h, w, h);
+			else
+				dither(x + i*w*h, w, h);
+		return;
+	}
+	if (!b && omp_get_max_threads() > 1) {
+		for (int i = 0; i < pd; i++)
+			dither_wavefront(x + i*w*h, w, h);
+		return;
+	}
+#endif
 	for (int i = 0; i < pd; i++)
 		if (b)
 			dither_b(x + i*w*h, w, h);
@@ -143,6 +214,10 @@ static char *help_string_long     =
 "The output image is binary on the same range.  For color images,\n"
 "the algorithm is applied independently to each color channel.\n"
 "\n"
+"With OpenMP, the channels are dithered in parallel, and the rows of each\n"
+"channel are processed by a skewed wavefront (without -b).  The result\n"
+"is the same as that of the serial algorithm.\n"
+"\n"
 "Usage: dither in.png out.png\n"
 "   or: dither in.png > out.npy\n"
 "   or: cat in.png | dither > out.npy\n"
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,8 @@
 #include "fail.c"
 #include "xmalloc.c"
 #include "random.c"
+#include "quantiles.c"
+#include "pd_specialize.h"
 
 struct statistics_float {
 	float min, max, median, average, sample, variance, middle, laverage;
@@ -90,54 +93,124 @@ static void statistics_getf(struct statistics_float *s, float *fin, int n)
 	}
 }
 
-static bool innerP(int w, int h, int i, int j)
+// median of n values, as computed by statistics_getf (the array is reordered)
+static float median_spoilable(float *f, int n)
 {
-	if (i < 0) return false;
-	if (j < 0) return false;
-	if (i >= w) return false;
-	if (j >= h) return false;
-	return true;
+	if (n < 1) return NAN;
+	float m = quantile_select_spoilable(f, n, n/2-1 < 0 ? 0 : n/2-1);
+	if (0 == n % 2)
+	{
+		int mtype = STATISTIC_MEDIAN_BIAS;
+		float b = quantile_select_spoilable(f, n, n/2);
+		switch(mtype)
+		{
+			case -1: break;
+			case 0: m += b; m /=2; break;
+			case 1: m = b; break;
+			default: fail("bad STATISTIC_MEDIAN_BIAS %d", mtype);
+		}
+	}
+	return m;
 }
 
-void downsa2d(float *oy, float *ox, int w, int h, int pd, int n, int ty)
+// one output row of the rules that need a single pass over each block
+// (min, max, average, first, last, count and deviation of the non-NAN values;
+// the deviation is sqrt(sum (v-mean)^2), from the sums of v-first)
+PD_KERNEL void downsa_row_onepass(float *y, float *x, int w, int pd, int W,
+		int n, int ty)
 {
-	int W = w/n;
-	int H = h/n;
-	float (*x)[w][pd] = (void*)ox;
-	float (*y)[W][pd] = (void*)oy;
-	for (int j = 0; j < H; j++)
 	for (int i = 0; i < W; i++)
 	for (int l = 0; l < pd; l++)
 	{
 		int nv = 0;
-		float vv[n*n];
+		float g = NAN, first = NAN, last = NAN;
+		double sum = 0, d1 = 0, d2 = 0;
 		for (int jj = 0; jj < n; jj++)
 		for (int ii = 0; ii < n; ii++)
-		if (innerP(w, h, i*n+ii, j*n+jj))
 		{
-			float v = x[j*n+jj][i*n+ii][l];
+			float v = x[(jj*w + i*n + ii)*pd + l];
+			if (!isfinite(v)) continue;
+			if (!nv) first = g = v;
+			else if (ty == 'i') g = fmin(g, v);
+			else if (ty == 'a') g = fmax(g, v);
+			sum += v;
+			d1 += v - first;
+			d2 += (v - first) * (v - first);
+			last = v;
+			nv += 1;
+		}
+		switch (ty)
+		{
+		case 'v': g = nv ? sum / nv : NAN; break;
+		case 'f': g = first;               break;
+		case 'l': g = last;                break;
+		case 'n': g = nv;                  break;
+		case 's': g = nv ? sqrt(fmax(0, d2 - d1 * d1 / nv)) : NAN; break;
+		}
+		y[i*pd + l] = g;
+	}
+}
+
+static void downsa_row(float *y, float *x, int w, int pd, int W, int n, int ty)
+{
+	float vv[n*n];
+	for (int i = 0; i < W; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		int nv = 0;
+		for (int jj = 0; jj < n; jj++)
+		for (int ii = 0; ii < n; ii++)
+		{
+			float v = x[(jj*w + i*n + ii)*pd + l];
 			if (isfinite(v))
 				vv[nv++] = v;
 		}
+		// the order statistics do not need to sort the values
+		float g;
+		if (ty == 'e') {
+			y[i*pd + l] = median_spoilable(vv, nv);
+			continue;
+		}
+		if (ty == 'c') {
+			y[i*pd + l] = vv[(nv-1)/2];
+			continue;
+		}
 		struct statistics_float s;
 		statistics_getf(&s, vv, nv);
-		float g;
 		switch (ty)
 		{
-		case 'i': g = s.min;          break;
-		case 'e': g = s.median;       break;
-		case 'a': g = s.max;          break;
-		case 'v': g = s.average;      break;
 		case 'V': g = s.laverage;     break;
-		case 's': g = s.variance;     break;
 		case 'r': g = s.sample;       break;
-		case 'n': g = nv;             break;
-		case 'f': g = vv[0];          break;
-		case 'l': g = vv[nv-1];       break;
-		case 'c': g = vv[(nv-1)/2];   break;
 		default:  fail("downsa type %c not implemented", ty);
 		}
-		y[j][i][l] = g;
+		y[i*pd + l] = g;
+	}
+}
+
+void downsa2d(float *oy, float *ox, int w, int h, int pd, int n, int ty)
+{
+	int W = w/n;
+	int H = h/n;
+	bool onepass = strchr("iavflns", ty);
+	if (!onepass && !strchr("ecVr", ty))
+		fail("downsa type %c not implemented", ty);
+
+	// (the random samples are drawn in order, from a single generator)
+#ifdef _OPENMP
+#pragma omp parallel for if(ty != 'r')
+#endif
+	for (int j = 0; j < H; j++)
+	{
+		float *y = oy + (long)j*W*pd;
+		float *x = ox + (long)j*n*w*pd;
+		if (!onepass)
+			downsa_row(y, x, w, pd, W, n, ty);
+		else if (n == 2) // constant factors, for unrolled kernels
+			PD_SPECIALIZE(pd, downsa_row_onepass(y, x, w, pd, W, 2, ty));
+		else if (n == 4)
+			PD_SPECIALIZE(pd, downsa_row_onepass(y, x, w, pd, W, 4, ty));
+		else
+			downsa_row_onepass(y, x, w, pd, W, n, ty);
 	}
 }
 
@@ -168,6 +241,7 @@ static char *help_string_long     =
 "\n"
 "Report bugs to <enric.meinhardt@ens-paris-saclay.fr>.";
 #include "help_stuff.c" // functions that print the strings named above
+#include "profile.c"
 
 int main_downsa(int c, char *v[])
 {
@@ -181,12 +255,28 @@ int main_downsa(int c, char *v[])
 	char *in = c > 3 ? v[3] : "-";
 	char *out = c > 4 ? v[4] : "-";
 
-	int w, h, pd;
-	float *x = iio_read_image_float_vec(in, &w, &h, &pd);
+	// for averages of named files, let the decoder do part of the zoom-out
+	// (e.g. jpeg files), and then crop to the expected size
+	int w = 0, h = 0, pd, f = 1;
+	if (v[1][0] == 'v' && strcmp(in, "-")
+			&& !iio_read_image_info(in, &w, &h, &pd, NULL))
+		f = n;
 	int W = w/n;
 	int H = h/n;
+	float *x = iio_read_image_float_vec_scaled(in, &f, &w, &h, &pd);
+	if (f == 1) {
+		W = w/n;
+		H = h/n;
+	} else {
+		int m = n/f, cw = W*m, ch = H*m;
+		for (int j = 0; j < ch; j++)
+			memmove(x + j*cw*pd, x + j*w*pd, cw*pd*sizeof*x);
+		w = cw;
+		h = ch;
+	}
 	float *y = xmalloc(W*H*pd*sizeof*y);
-	downsa2d(y, x, w, h, pd, n, v[1][0]);
+	PROFILE_SCOPE("downsa")
+		downsa2d(y, x, w, h, pd, n/f, v[1][0]);
 	iio_write_image_float_vec(out, y, W, H, pd);
 	free(x);
 	free(y);
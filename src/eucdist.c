@@ -4,23 +4,35 @@
 // "Distance Transforms of Sampled Functions",
 // by P.F.Felzenszwalb and D.P.Huttenlocher,
 // published on "Theory of Computing" in 2012
+//
+// The pixels may be non-square (spacing sx, sy along each axis), and the
+// location of the nearest point can be returned too (feature transform).
+// Each pass is computed in parallel over the rows or the columns.
+
+#ifndef _EUCDIST_C
+#define _EUCDIST_C
 
 #include <math.h>
+#include <stdlib.h>
 
-static float obtain_slope(float *f, int q, int p)
+// intersection of the parabolas at q and p (s2 = squared pixel spacing)
+static double obtain_slope(float *f, int q, int p, double s2)
 {
 	if (!isfinite(f[q]) && !isfinite(f[p])) return 0;
-	return ((f[q] + q*q) - (f[p] + p*p)) / (2*q - 2*p);
+	return ((f[q] + s2*q*q) - (f[p] + s2*p*p)) / (2*s2*(q - p));
 }
 
 // algorithm 1 from the paper, using the same variable names
+// (if a is not NULL, it gets the location of each minimum, or -1 if none)
 static void squared_distances_1d(
 		float *d,  // output distance
+		int *a,    // output location of the minimum (optional)
 		float *f,  // input data
-		int n      // length
+		int n,     // length
+		double s2  // squared spacing
 		)
 {
-	float z[n+1];  // temporary array
+	double z[n+1]; // temporary array
 	int v[n];      // index table
 	int k = 0;     // last index
 
@@ -29,8 +41,8 @@ static void squared_distances_1d(
 	z[1] =  INFINITY;
 	for (int q = 1; q < n; q++) {
 		// TODO: simplify the following ugly loop
-		float s;
-		while ((s = obtain_slope(f, q, v[k])) < z[k])
+		double s;
+		while ((s = obtain_slope(f, q, v[k], s2)) < z[k])
 			k--;
 		k++;
 		v[k] = q;
@@ -42,29 +54,80 @@ static void squared_distances_1d(
 	for (int q = 0; q < n; q++) {
 		while (z[k+1] < q)
 			k++;
-		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+		d[q] = s2 * (q - v[k]) * (q - v[k]) + f[v[k]];
+		if (a) a[q] = isfinite(d[q]) ? v[k] : -1;
 	}
 }
 
-static void squared_distances_2d(float *f, int w, int h)
+// number of columns that are gathered together by the column pass
+#define EUCDIST_BLOCK 16
+
+// (if z is not NULL, it gets the index of the nearest point, or -1)
+static void squared_distances_2d(float *f, long *z, int w, int h,
+		double sx, double sy)
 {
-	// columns
-	for (int i = 0; i < w; i++)
+	long W = w; // (the images may have more than 2^31 pixels)
+
+	// columns (by blocks, so that the accesses are contiguous)
+	int *r = z ? malloc(W*h*sizeof*r) : NULL; // nearest row of each column
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int i0 = 0; i0 < w; i0 += EUCDIST_BLOCK)
 	{
-		float t[h], d[h];
-		for (int j = 0; j < h; j++) t[j] = f[j*w+i];
-		squared_distances_1d(d, t, h);
-		for (int j = 0; j < h; j++) f[j*w+i] = d[j];
+		int nb = w - i0 < EUCDIST_BLOCK ? w - i0 : EUCDIST_BLOCK;
+		float (*t)[h] = malloc(nb * sizeof*t);
+		float (*d)[h] = malloc(nb * sizeof*d);
+		int (*a)[h] = r ? malloc(nb * sizeof*a) : NULL;
+		for (int j = 0; j < h; j++)
+		for (int b = 0; b < nb; b++)
+			t[b][j] = f[j*W+i0+b];
+		for (int b = 0; b < nb; b++)
+			squared_distances_1d(d[b], a ? a[b] : NULL, t[b], h, sy*sy);
+		for (int j = 0; j < h; j++)
+		for (int b = 0; b < nb; b++)
+			f[j*W+i0+b] = d[b][j];
+		if (r)
+			for (int j = 0; j < h; j++)
+			for (int b = 0; b < nb; b++)
+				r[j*W+i0+b] = a[b][j];
+		free(t);
+		free(d);
+		free(a);
 	}
 
 	// rows
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
 	{
 		float t[w], d[w];
-		for (int i = 0; i < w; i++) t[i] = f[j*w+i];
-		squared_distances_1d(d, t, w);
-		for (int i = 0; i < w; i++) f[j*w+i] = d[i];
+		int a[w];
+		for (int i = 0; i < w; i++) t[i] = f[j*W+i];
+		squared_distances_1d(d, z ? a : NULL, t, w, sx*sx);
+		for (int i = 0; i < w; i++) f[j*W+i] = d[i];
+		if (z)
+			for (int i = 0; i < w; i++)
+				z[j*W+i] = a[i] < 0 ? -1 : r[j*W+a[i]] * W + a[i];
 	}
+	free(r);
+}
+
+// squared distance to the nonzero pixels, with pixels of size sx x sy
+// (if z is not NULL, it gets the index j*w+i of the nearest nonzero pixel)
+void squared_euclidean_distance_to_nonzeros_aniso(
+		float *x,   // input/output: (binary image/distance to nonzeros)
+		long *z,    // output: index of the nearest nonzero (optional)
+		int w,      // width
+		int h,      // height
+		float sx,   // horizontal pixel spacing
+		float sy    // vertical pixel spacing
+		)
+{
+	for (long i = 0; i < (long)w*h; i++)
+		x[i] = x[i] > 0 ? 0: INFINITY;
+	squared_distances_2d(x, z, w, h, sx, sy);
 }
 
 void squared_euclidean_distance_to_nonzeros(
@@ -73,42 +136,69 @@ void squared_euclidean_distance_to_nonzeros(
 		int h       // height
 		)
 {
-	for (int i = 0; i < w*h; i++)
-		x[i] = x[i] > 0 ? 0: INFINITY;
-	squared_distances_2d(x, w, h);
+	squared_euclidean_distance_to_nonzeros_aniso(x, NULL, w, h, 1, 1);
 }
 
-#include <stdlib.h>
-void signed_distance_to_mask(float *x, int w, int h)
+void signed_distance_to_mask_aniso(float *x, int w, int h, float sx, float sy)
 {
-	float *tp = malloc(w * h * sizeof*tp);
-	float *tm = malloc(w * h * sizeof*tm);
-	for (long i = 0; i < w*h; i++)
+	float *tp = malloc((long)w * h * sizeof*tp);
+	float *tm = malloc((long)w * h * sizeof*tm);
+	for (long i = 0; i < (long)w*h; i++)
 	{
 		tp[i] = x[i] > 0;
 		tm[i] = !tp[i];
 	}
-	squared_euclidean_distance_to_nonzeros(tp, w, h);
-	squared_euclidean_distance_to_nonzeros(tm, w, h);
-	for (long i = 0; i < w*h; i++)
+	squared_euclidean_distance_to_nonzeros_aniso(tp, NULL, w, h, sx, sy);
+	squared_euclidean_distance_to_nonzeros_aniso(tm, NULL, w, h, sx, sy);
+	for (long i = 0; i < (long)w*h; i++)
 		x[i] = x[i] > 0 ? sqrt(tm[i])-0.5:0.5-sqrt(tp[i]);
 	free(tp);
 	free(tm);
 }
 
+void signed_distance_to_mask(float *x, int w, int h)
+{
+	signed_distance_to_mask_aniso(x, w, h, 1, 1);
+}
+
+#ifndef OMIT_EUCDIST_MAIN
+#include <stdio.h>
 #include "iio.h"
 #include "pickopt.c"
 int main(int c, char *v[])
 {
 	_Bool s = pick_option(&c, &v, "s", NULL);
-	if (c != 3) return 3;
+	float sx = atof(pick_option(&c, &v, "x", "1"));
+	float sy = atof(pick_option(&c, &v, "y", "1"));
+	char *filename_f = pick_option(&c, &v, "f", "");
+	if (c != 3) {
+		fprintf(stderr, "usage:\n\t"
+			"%s [-s] [-x sx] [-y sy] [-f nearest.tif] in out\n", *v);
+		//        0                                  1  2
+		return 3;
+	}
 	int w, h;
 	float *x = iio_read_image_float(v[1], &w, &h);
-	if (!s)
-		squared_euclidean_distance_to_nonzeros(x, w, h);
-	else
-		signed_distance_to_mask(x, w, h);
+	if (!s) {
+		long *z = *filename_f ? malloc((long)w*h*sizeof*z) : NULL;
+		squared_euclidean_distance_to_nonzeros_aniso(x, z, w, h, sx, sy);
+		if (z) { // coordinates of the nearest nonzero pixel
+			float *p = malloc(2L*w*h*sizeof*p);
+			for (long i = 0; i < (long)w*h; i++)
+			{
+				p[2*i+0] = z[i] < 0 ? NAN : z[i] % w;
+				p[2*i+1] = z[i] < 0 ? NAN : z[i] / w;
+			}
+			iio_write_image_float_vec(filename_f, p, w, h, 2);
+			free(p);
+			free(z);
+		}
+	} else
+		signed_distance_to_mask_aniso(x, w, h, sx, sy);
 
 	iio_write_image_float(v[2], x, w, h);
 	return 0;
 }
+#endif//OMIT_EUCDIST_MAIN
+
+#endif//_EUCDIST_C
@@ -1,8 +1,60 @@
 #include "fancy_image.h"
 
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iio.h"
+
+// crop an image that would be read whole, by reading only its needed part
+// (the pixels outside the image are NAN)
+static void plain_crop(char *fname_out, char *fname_in,
+		int x0, int y0, int w, int h)
+{
+	// part of the image that has been read: window [ox,ox+cw) x [oy,oy+ch)
+	int ox = 0, oy = 0, cw = 0, ch = 0, pd = 1, iw, ih;
+	float *x = NULL;
+	if (strcmp(fname_in, "-") && !iio_read_image_info(fname_in,
+				&iw, &ih, &pd, NULL)) {
+		// clip the window before reading it (the reader takes
+		// non-positive bounds as relative to the right and bottom,
+		// and fails on empty windows)
+		int xf = x0 + w < iw ? x0 + w : iw;
+		int yf = y0 + h < ih ? y0 + h : ih;
+		ox = x0 < 0 ? 0 : x0;
+		oy = y0 < 0 ? 0 : y0;
+		if (ox < xf && oy < yf)
+			x = iio_read_image_float_vec_roi(fname_in,
+					ox, oy, xf, yf, &cw, &ch, &pd);
+	} else
+		x = iio_read_image_float_vec(fname_in, &cw, &ch, &pd);
+
+	float *y = malloc(w * h * pd * sizeof*y);
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	{
+		int ii = x0 + i - ox;
+		int jj = y0 + j - oy;
+		bool in = ii >= 0 && jj >= 0 && ii < cw && jj < ch;
+		for (int l = 0; l < pd; l++)
+			y[(j * w + i) * pd + l] = in ?
+				x[(jj * cw + ii) * pd + l] : NAN;
+	}
+	iio_write_image_float_vec(fname_out, y, w, h, pd);
+	free(x);
+	free(y);
+}
+
 static void fancy_crop(char *fname_out, char *fname_in,
 		int x0, int y0, int w, int h)
 {
+	if (!fancy_image_is_lazy(fname_in))
+		return plain_crop(fname_out, fname_in, x0, y0, w, h);
+
+	// when possible, copy the tiles without decoding them
+	if (fancy_image_crop_tiles(fname_out, fname_in, x0, y0, w, h))
+		return;
+
 	// open input image
 	struct fancy_image *a = fancy_image_open(fname_in, "r");
 
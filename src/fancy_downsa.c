@@ -1,30 +1,18 @@
+// zoom-out an image (possibly huge) by blocks of pw x ph pixels
+//
+// The input is read by bands of rows through fancy_image (the missing tiles
+// of each band are read in parallel), and the rows of each band are combined
+// in parallel.  The NaN-aware operations on blocks of 2x2 pixels use the
+// vectorized kernels of nanreduce.c.  Given a number of octaves n, the
+// reduction is repeated n times, and all the octaves are written in the same
+// pass over the input.
+
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
 #include "fancy_image.h"
-
-static double average_of_non_nans(double *x, int n)
-{
-	int cx = 0;
-	double ax = 0;
-	for (int i = 0; i < n; i++)
-	{
-		if (isnan(x[i])) continue;
-		cx += 1;
-		ax += x[i];
-	}
-	return cx ? ax / cx : NAN;
-}
-
-static double combine_4doubles(double v[4], int m)
-{
-	if (m == 'f') return v[0];
-	if (m == 'v') return (v[0]+v[1]+v[2]+v[3])/4;
-	if (m == 'V') return average_of_non_nans(v, 4);
-	if (m == 'i') return fmin(fmin(v[0],v[1]), fmin(v[2],v[3]));
-	if (m == 'a') return fmax(fmax(v[0],v[1]), fmax(v[2],v[3]));
-	return m;//NAN;
-}
+#include "xmalloc.c"
+#include "nanreduce.c"
 
 static float count_non_nans(float *v, int n)
 {
@@ -36,22 +24,28 @@ static float count_non_nans(float *v, int n)
 
 static float min_non_nans(float *v, int n)
 {
-	float r = INFINITY;
+	float r = NAN;
 	for (int i = 0; i < n; i++)
-		if (!isnan(v[i]))
-			r = fmin(r, v[i]);
+		r = fmin(r, v[i]);
 	return r;
 }
 
 static float max_non_nans(float *v, int n)
 {
-	float r = -INFINITY;
+	float r = NAN;
 	for (int i = 0; i < n; i++)
-		if (!isnan(v[i]))
-			r = fmax(r, v[i]);
+		r = fmax(r, v[i]);
 	return r;
 }
 
+static float first_non_nan(float *v, int n)
+{
+	for (int i = 0; i < n; i++)
+		if (!isnan(v[i]))
+			return v[i];
+	return NAN;
+}
+
 static float avg_non_nans(float *v, int n)
 {
 	float r = 0;
@@ -84,7 +78,7 @@ static float med_non_nans(float *v, int n)
 static float combine_floats(float *v, int n, int op)
 {
 	switch(op) {
-	case 'f': return *v;
+	case 'f': return first_non_nan(v, n);
 	case 'k': return count_non_nans(v, n);
 	case 'i': return min_non_nans(v, n);
 	case 'a': return max_non_nans(v, n);
@@ -94,7 +88,38 @@ static float combine_floats(float *v, int n, int op)
 	}
 }
 
-static void fancy_downsa(char *fname_out, char *fname_in, int nw, int nh, int m)
+// reduce the rows of a band, y (of size bw x bh) from x (of width w)
+static void downsa_band(float *y, int bw, int bh, float *x, int w, int pd,
+		int pw, int ph, int op)
+{
+	if (pw == 2 && ph == 2 && nanreduce_op_p(op)) {
+		nanreduce2(y, bw, bh, x, w, 2*bh, pd, op, NANREDUCE_EDGE_NAN);
+		return;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < bh; j++)
+	for (int i = 0; i < bw; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		int nv = 0;
+		float vv[pw*ph];
+		for (int dj = 0; dj < ph; dj++)
+		for (int di = 0; di < pw; di++)
+		{
+			int ii = i * pw + di;
+			int jj = j * ph + dj;
+			vv[nv++] = x[(jj*(long)w + ii)*pd + l];
+		}
+		y[(j*(long)bw + i)*pd + l] = combine_floats(vv, nv, op);
+	}
+}
+
+// the octave k of the output is written to the file sprintf(fname_out, k)
+// when there are several octaves
+static void fancy_downsa(char *fname_out, char *fname_in, int nw, int nh, int m,
+		int no)
 {
 	// open input image
 	struct fancy_image *a = fancy_image_open(fname_in, "r");
@@ -103,47 +128,87 @@ static void fancy_downsa(char *fname_out, char *fname_in, int nw, int nh, int m)
 	int tw = 0, th = 0, fmt = 0, bps = 0;
 	fancy_image_leak_tiff_info(&tw, &th, &fmt, &bps, a);
 
-	// create output image of the appropriate size and options
-	int bw = a->w / nw;
-	int bh = a->h / nh;
-	struct fancy_image *b = fancy_image_create(fname_out,
+	// sizes of the octaves (the octave 0 is the input)
+	int w[no+1], h[no+1], pd = a->pd;
+	w[0] = a->w;
+	h[0] = a->h;
+	for (int k = 1; k <= no; k++)
+	{
+		w[k] = w[k-1] / nw;
+		h[k] = h[k-1] / nh;
+		if (w[k] < 1 || h[k] < 1)
+			fail("fancy_downsa: octave %d of a %dx%d image is empty",
+					k, w[0], h[0]);
+	}
+
+	// create output images of the appropriate size and options
+	struct fancy_image *b[no+1];
+	for (int k = 1; k <= no; k++)
+	{
+		char fname[FILENAME_MAX];
+		if (no > 1)
+			snprintf(fname, FILENAME_MAX, fname_out, k);
+		else
+			snprintf(fname, FILENAME_MAX, "%s", fname_out);
+		b[k] = fancy_image_create(fname,
 			"w=%d,h=%d,pd=%d,bps=%d,fmt=%d,tw=%d,th=%d,"
 			"compression=%d",
-			bw, bh, a->pd, bps, fmt, tw, th,
-			(int)(fmt==1 && bw>1000 && bh>1000
+			w[k], h[k], pd, bps, fmt, tw, th,
+			(int)(fmt==1 && w[k]>1000 && h[k]>1000
 			&& tw<800 && th<800)
 			);
+	}
 
-	// fill-in the zoomed-out image
-	for (int j = 0; j < b->h; j++)
-	for (int i = 0; i < b->w; i++)
-	for (int l = 0; l < b->pd; l++)
+	// bands of r[k] rows of each octave, about a row of tiles of the input
+	long r[no+1];
+	r[no] = 1;
+	for (int k = no; k > 0; k--)
+		r[k-1] = r[k] * nh;
+	long R = ((th > 64 ? th : 64) + r[0] - 1) / r[0];
+	float *x[no+1];
+	for (int k = 0; k <= no; k++)
 	{
-		int nv = 0;
-		float vv[nw*nh];
-		for (int dj = 0; dj < nh; dj++)
-		for (int di = 0; di < nw; di++)
+		r[k] *= R;
+		x[k] = xmalloc(w[k] * r[k] * pd * sizeof*x[k]);
+	}
+
+	// fill-in the zoomed-out images, band by band
+	for (long t = 0; t * r[0] < h[0]; t++)
+	{
+		long n = h[0] - t * r[0] < r[0] ? h[0] - t * r[0] : r[0];
+		fancy_image_fill_rectangle_float_vec(x[0], w[0], n, a, 0,
+				0, t * r[0]);
+		for (int k = 1; k <= no; k++)
 		{
-			int ii = i * nw + di;
-			int jj = j * nh + dj;
-			vv[nv++] = fancy_image_getsample(a, ii, jj, l);
+			long y0 = t * r[k];
+			n = h[k] - y0 < r[k] ? h[k] - y0 : r[k];
+			if (n <= 0) break;
+			downsa_band(x[k], w[k], n, x[k-1], w[k-1], pd, nw, nh, m);
+			for (int j = 0; j < n; j++)
+			for (int i = 0; i < w[k]; i++)
+			for (int l = 0; l < pd; l++)
+				fancy_image_setsample(b[k], i, y0 + j, l,
+						x[k][(j*w[k] + i)*pd + l]);
 		}
-		float r = combine_floats(vv, nv, m);
-		fancy_image_setsample(b, i, j, l, r);
 	}
 
-	// close both images
-	fancy_image_close(b);
+	// close all the images
+	for (int k = 0; k <= no; k++)
+		free(x[k]);
+	for (int k = 1; k <= no; k++)
+		fancy_image_close(b[k]);
 	fancy_image_close(a);
 }
 
 #include <stdio.h>
 int main_fancy_downsa(int c, char *v[])
 {
-	if (c != 6) {
+	if (c != 6 && c != 7) {
 		fprintf(stderr, "usage:\n\t"
-			"%s {i|e|a|v|r|f} pw ph in.tiff out.tiff\n", *v);
-		//        0  1            2  3  4       5
+			"%s {i|e|a|v|k|f} pw ph in.tiff out.tiff [n]\n", *v);
+		//        0  1            2  3  4       5        6
+		fprintf(stderr, "\t(with n octaves, out is like "
+				"\"out_%%d.tiff\")\n");
 		return 1;
 	}
 	int op = v[1][0];
@@ -151,8 +216,12 @@ int main_fancy_downsa(int c, char *v[])
 	int ph = atoi(v[3]);
 	char *filename_in = v[4];
 	char *filename_out = v[5];
+	int no = c > 6 ? atoi(v[6]) : 1;
+	if (pw < 1 || ph < 1 || no < 1)
+		return fprintf(stderr, "bad factors %dx%d or octaves %d\n",
+				pw, ph, no);
 
-	fancy_downsa(filename_out, filename_in, pw, ph, op);
+	fancy_downsa(filename_out, filename_in, pw, ph, op, no);
 
 	return 0;
 }
@@ -10,6 +10,7 @@
 #include "fancy_image.h"
 #include "iio.h"
 #include "xmalloc.c"
+#include "nanreduce.c"
 
 // default setup (e.g. with TIFF and without GDAL)
 #define FANCY_TIFF
@@ -20,6 +21,11 @@
 #undef FANCY_TIFF
 #endif
 
+// act upon external definitions
+#ifdef FANCY_IMAGE_ENABLE_GDAL
+#define FANCY_GDAL
+#endif
+
 // act upon external definitions
 #ifdef FANCY_IMAGE_DISABLE_GDAL
 #undef FANCY_GDAL
@@ -34,7 +40,8 @@
 // Note: there are 3 backends for "fancy_image"
 // 0) the "iio" fallback, internally using (optionally) tiff, png, and jpeg
 // 1) the "TIFF" backend, uses pyramidal tiff using libtiff
-// 2) the "GDAL" backend, using whatever gdal provides (read-only, no pyramids)
+// 2) the "GDAL" backend, using whatever gdal provides (read-only, the octaves
+//    are the overviews of the dataset, when they exist)
 
 
 #ifdef FANCY_TIFF
@@ -85,6 +92,7 @@ struct FI {
 	int option_fmt; // SAMPLEFORMAT_UINT, etc.
 	int option_compressed;
 	bool option_octa;
+	char option_shm[FILENAME_MAX]; // name of the shared tile cache
 
 	// implementation details
 	float *x, *pyr_x[MAX_OCTAVES];
@@ -102,7 +110,16 @@ struct FI {
 	// gdal shit
 	GDALDatasetH gdal_img;
 	GDALRasterBandH gdal_band[MAX_GDAL_BANDS];
+	int gdal_ovr[MAX_OCTAVES]; // index of the overview of each octave
 #endif//FANCY_GDAL
+	double option_gdalcache; // megabytes of the gdal block cache
+
+	// vrt mosaics, read by tiles of the first octave on demand
+	bool vrt;
+	int vrt_ntx, vrt_n, vrt_max; // tiles per row, loaded, capacity
+	float **vrt_tile;            // pixels of each tile (or NULL)
+	long *vrt_tick, vrt_clock;   // time of the last use of each tile
+	long *vrt_loaded;            // indices of the loaded tiles
 };
 
 // Compiler trick to check that "FI" can fit inside a "fancy_image"
@@ -112,7 +129,6 @@ typedef char check_FI_size[sizeof(struct FI)<=sizeof(struct fancy_image)?1:-1];
 #include "smapa.h"
 SMART_PARAMETER_SILENT(FANCY_IMAGE_MINSIDE,2000)
 
-#ifdef FANCY_TIFF
 static bool has_suffix(const char *s, const char *e)
 {
 	int n = strlen(s);
@@ -121,7 +137,6 @@ static bool has_suffix(const char *s, const char *e)
 	//fprintf(stderr, "has_suffix(\"%s\", \"%s\") = %d\n", s, e, r);
 	return r;
 }
-#endif
 
 
 // check whether a filename corresponds to a small image or a tiled tiff
@@ -151,6 +166,16 @@ static bool filename_corresponds_to_tiffo(char *filename)
 #endif
 }
 
+#ifdef FANCY_TIFF
+// check whether a filename is a tiled tiff (of any size)
+static bool filename_is_tiled_tiff(char *filename)
+{
+	struct tiff_info ti[1];
+	disable_tiff_warnings_and_errors();
+	return get_tiff_info_filename_e(ti, filename) && ti->tiled;
+}
+#endif//FANCY_TIFF
+
 // check whether a "raw" filename does actually contain a pyramidal tiff
 static bool filename_actually_contains_tiff_pyramid(char *n)
 {
@@ -178,41 +203,21 @@ static bool filename_actually_contains_tiff_pyramid(char *n)
 // type of a "zoom-out" function
 typedef void (*zoom_out_function_t)(float*,int,int,float*,int,int,int);
 
-static float getsample_zero(float *x, int w, int h, int pd, int i, int j, int l)
-{
-	if (i < 0 || i >= w) return 0;
-	if (j < 0 || j >= h) return 0;
-	return x[pd*(j*w+i)+l];
-}
-
+// zoom-out by 2x2 block averages of the non-NaN samples
+// (the samples outside of the image are zero)
 static void zoom_out_by_factor_two(float *out, int ow, int oh,
 		float *in, int iw, int ih, int pd)
 {
 	assert(abs(2*ow-iw) < 2);
 	assert(abs(2*oh-ih) < 2);
-	for (int j = 0; j < oh; j++)
-	for (int i = 0; i < ow; i++)
-	for (int l = 0; l < pd; l++)
-	{
-		float a[4], A = 0;
-		a[0] = getsample_zero(in, iw, ih, pd, 2*i  , 2*j  , l);
-		a[1] = getsample_zero(in, iw, ih, pd, 2*i+1, 2*j  , l);
-		a[2] = getsample_zero(in, iw, ih, pd, 2*i  , 2*j+1, l);
-		a[3] = getsample_zero(in, iw, ih, pd, 2*i+1, 2*j+1, l);
-		int n = 0;
-		for (int k = 0; k < 4; k++)
-			if (!isnan(a[k]))
-			{
-				A += a[k];
-				n += 1;
-			}
-		out[pd*(ow*j + i)+l] = n ? A/n : NAN;
-	}
+	nanreduce2(out, ow, oh, in, iw, ih, pd, NANREDUCE_MEAN,
+			NANREDUCE_EDGE_ZERO);
 }
 
+// set up the sizes of the octaves of the pyramid
+// (the octaves are computed lazily, see "pyramid_octave")
 static int build_pyramid(struct FI *f, int max_octaves)
 {
-	zoom_out_function_t z = zoom_out_by_factor_two;
 	f->pyr_w[0] = f->w;
 	f->pyr_h[0] = f->h;
 	f->pyr_x[0] = f->x;
@@ -221,14 +226,11 @@ static int build_pyramid(struct FI *f, int max_octaves)
 		if (s > max_octaves) break;
 		int      lw   = f->pyr_w[s-1];
 		int      lh   = f->pyr_h[s-1];
-		float   *lx   = f->pyr_x[s-1];
 		int      sw   = ceil(lw / 2.0);
 		int      sh   = ceil(lh / 2.0);
-		float   *sx = xmalloc(f->pd * sw * sh * sizeof*sx);
-		z(sx, sw, sh, lx, lw, lh, f->pd);
 		f->pyr_w[s]   = sw;
 		f->pyr_h[s]   = sh;
-		f->pyr_x[s]   = sx;
+		f->pyr_x[s]   = NULL;
 		s += 1;
 		if (sw + sh <= 2) break;
 	}
@@ -242,6 +244,31 @@ static int build_pyramid(struct FI *f, int max_octaves)
 	return s;
 }
 
+// data of an octave of the pyramid, computed the first time it is needed
+// (several threads may ask for it at once)
+static float *pyramid_octave(struct FI *f, int s)
+{
+	float *x = __atomic_load_n(f->pyr_x + s, __ATOMIC_ACQUIRE);
+	if (x) return x;
+	assert(s > 0);
+	float *lx = pyramid_octave(f, s - 1);
+#ifdef _OPENMP
+#pragma omp critical(fancy_image_pyramid)
+#endif
+	{
+		x = f->pyr_x[s];
+		if (!x) {
+			zoom_out_function_t z = zoom_out_by_factor_two;
+			int sw = f->pyr_w[s], lw = f->pyr_w[s-1];
+			int sh = f->pyr_h[s], lh = f->pyr_h[s-1];
+			x = xmalloc(f->pd * sw * sh * sizeof*x);
+			z(x, sw, sh, lx, lw, lh, f->pd);
+			__atomic_store_n(f->pyr_x + s, x, __ATOMIC_RELEASE);
+		}
+	}
+	return x;
+}
+
 static void free_pyramid(struct FI *f)
 {
 	for (int s = 0; s < f->no; s++)
@@ -264,6 +291,8 @@ static void set_default_options(struct FI *f)
 	f->option_compressed = 0;
 	f->option_spp = 1;
 	f->option_bps = 8;
+	f->option_shm[0] = '\0';
+	f->option_gdalcache = 0;
 }
 
 static void interpret_options(struct FI *f, char *options_arg)
@@ -306,6 +335,9 @@ static void interpret_options(struct FI *f, char *options_arg)
 		if (1 == sscanf(tok, "tilewidth=%lf", &x))f->option_tw      = x;
 		if (1 == sscanf(tok, "tileheight=%lf",&x))f->option_tw      = x;
 		if (1 == sscanf(tok, "compression=%lf",&x))f->option_compressed=x;
+		if (1 == sscanf(tok, "gdalcache=%lf",&x)) f->option_gdalcache = x;
+		if (tok == strstr(tok, "shm="))
+			snprintf(f->option_shm, FILENAME_MAX, "%s", tok + 4);
 		tok = strtok(NULL, ",");
 	}
 
@@ -330,8 +362,12 @@ void create_iio_file(char *filename, int w, int h, int spp)
 void generic_create(struct FI *f, char *filename)
 {
 #ifdef FANCY_TIFF
+	char base[FILENAME_MAX];
+	snprintf(base, FILENAME_MAX, "%s", filename);
+	if (has_suffix(base, ",%d")) // the pyramid is created in a single file
+		base[strlen(base) - 3] = '\0';
 	if (filename_corresponds_to_tiffo(filename) || f->option_tw > 0)
-		create_zero_tiff_file(filename,
+		create_zero_tiff_file(base,
 				f->option_w, f->option_h,
 				f->option_tw, f->option_th,
 				f->option_spp, f->option_bps,
@@ -356,6 +392,122 @@ static bool has_prefix(const char *s, const char *p)
 // whether to automatically open tiff pyramids when possible
 SMART_PARAMETER_SILENT(FANCY_IMAGE_PCD,1)
 
+// side of the tiles of the vrt mosaics
+#define FANCY_VRT_TILE 256
+
+static bool filename_is_vrt(char *filename)
+{
+	return has_suffix(filename, ".vrt");
+}
+
+static void vrt_init(struct FI *f, char *filename)
+{
+	if (iio_read_image_info(filename, &f->w, &f->h, &f->pd, NULL))
+		fail("fancy_image: could not read vrt \"%s\"", filename);
+	snprintf(f->x_filename, FILENAME_MAX, "%s", filename);
+	f->vrt = true;
+	f->no = 1; // no octaves: the mosaic is never read whole
+	f->pyr_w[0] = f->w;
+	f->pyr_h[0] = f->h;
+	int T = FANCY_VRT_TILE;
+	f->vrt_ntx = (f->w + T - 1) / T;
+	long nt = f->vrt_ntx * (long)((f->h + T - 1) / T);
+	double tile_mb = T * T * f->pd * sizeof(float) / (1024.0 * 1024);
+	double mb = f->megabytes > 0 ? f->megabytes : 100;
+	f->vrt_max = mb / tile_mb < 1 ? 1 : mb / tile_mb;
+	if (f->vrt_max > nt) f->vrt_max = nt;
+	f->vrt_tile = xmalloc(nt * sizeof*f->vrt_tile);
+	f->vrt_tick = xmalloc(nt * sizeof*f->vrt_tick);
+	f->vrt_loaded = xmalloc(f->vrt_max * sizeof*f->vrt_loaded);
+	for (long k = 0; k < nt; k++)
+		f->vrt_tile[k] = NULL;
+	f->vrt_n = 0;
+	f->vrt_clock = 0;
+}
+
+// the tile (tx,ty) of a vrt mosaic, read if necessary (evicting the least
+// recently used one when the cache is full; call it inside the critical
+// section "fancy_image_vrt")
+static float *vrt_gettile(struct FI *f, int tx, int ty)
+{
+	long k = ty * (long)f->vrt_ntx + tx;
+	if (!f->vrt_tile[k]) {
+		if (f->vrt_n < f->vrt_max)
+			f->vrt_loaded[f->vrt_n++] = k;
+		else {
+			int e = 0;
+			for (int q = 1; q < f->vrt_n; q++)
+				if (f->vrt_tick[f->vrt_loaded[q]]
+						< f->vrt_tick[f->vrt_loaded[e]])
+					e = q;
+			free(f->vrt_tile[f->vrt_loaded[e]]);
+			f->vrt_tile[f->vrt_loaded[e]] = NULL;
+			f->vrt_loaded[e] = k;
+		}
+		int T = FANCY_VRT_TILE, w, h, pd;
+		f->vrt_tile[k] = iio_read_image_float_vec_roi(f->x_filename,
+				tx * T, ty * T, tx * T + T, ty * T + T,
+				&w, &h, &pd);
+		if (!f->vrt_tile[k] || pd != f->pd)
+			fail("fancy_image: could not read tile %d %d of \"%s\"",
+					tx, ty, f->x_filename);
+	}
+	f->vrt_tick[k] = ++f->vrt_clock;
+	return f->vrt_tile[k];
+}
+
+// sample of a vrt mosaic
+static float vrt_getsample(struct FI *f, int i, int j, int l)
+{
+	if (i < 0 || j < 0 || i >= f->w || j >= f->h)
+		return NAN;
+	int T = FANCY_VRT_TILE, tx = i / T, ty = j / T;
+	int tw = f->w - tx * T < T ? f->w - tx * T : T;
+	float r;
+#ifdef _OPENMP
+#pragma omp critical(fancy_image_vrt)
+#endif
+	{
+		float *t = vrt_gettile(f, tx, ty);
+		r = t[((j - ty * T) * tw + i - tx * T) * f->pd + l];
+	}
+	return r;
+}
+
+// rectangle [x0,xf] x [y0,yf] of a vrt mosaic, read directly (only the
+// sources that intersect it are opened), with NAN outside
+static void vrt_getrectangle(float *out, struct FI *f,
+		int x0, int y0, int xf, int yf)
+{
+	int W = xf - x0 + 1, H = yf - y0 + 1, pd = f->pd;
+	for (long k = 0; k < W * (long)H * pd; k++)
+		out[k] = NAN;
+	int a0 = x0 < 0 ? 0 : x0, b0 = y0 < 0 ? 0 : y0;
+	int a1 = xf >= f->w ? f->w : xf + 1, b1 = yf >= f->h ? f->h : yf + 1;
+	if (a1 <= a0 || b1 <= b0)
+		return;
+	int w, h, d;
+	float *x = iio_read_image_float_vec_roi(f->x_filename, a0, b0, a1, b1,
+			&w, &h, &d);
+	if (!x || d != pd)
+		fail("fancy_image: could not read \"%s\"", f->x_filename);
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	for (int l = 0; l < pd; l++)
+		out[((j + b0 - y0) * (long)W + i + a0 - x0) * pd + l]
+			= x[(j * (long)w + i) * pd + l];
+	free(x);
+}
+
+static void vrt_free(struct FI *f)
+{
+	for (int q = 0; q < f->vrt_n; q++)
+		free(f->vrt_tile[f->vrt_loaded[q]]);
+	free(f->vrt_tile);
+	free(f->vrt_tick);
+	free(f->vrt_loaded);
+}
+
 void generic_read(struct FI *f, char *filename)
 {
 	if (f->option_verbose)
@@ -366,6 +518,9 @@ void generic_read(struct FI *f, char *filename)
 		f->tiffo = true;
 		tiff_octaves_init0(f->t, filename, f->megabytes,f->max_octaves);
 		if (f->option_write) f->t->option_write = true;
+		else if (*f->option_shm)
+			tiff_octaves_attach_shm(f->t, f->option_shm,
+					f->megabytes);
 		f->w = f->t->i->w;
 		f->h = f->t->i->h;
 		f->pd = f->t->i->spp;
@@ -379,10 +534,20 @@ void generic_read(struct FI *f, char *filename)
 		char fname_pcd[FILENAME_MAX];
 		snprintf(fname_pcd, FILENAME_MAX, "%s,%%d", filename);
 		generic_read(f, fname_pcd);
+#ifdef FANCY_TIFF
+	} else if (filename_is_remote(filename) && !f->option_write &&
+			filename_is_tiled_tiff(filename)) {
+		if (f->option_verbose) fprintf(stderr, "...remote tiff!\n");
+		char fname_pcd[FILENAME_MAX];
+		snprintf(fname_pcd, FILENAME_MAX, "%s,%%d", filename);
+		generic_read(f, fname_pcd);
+#endif//FANCY_TIFF
 	} else if (!f->option_write && FORCE_GDAL()) {
 #ifdef FANCY_GDAL
 		f->gdal = true;
 		GDALAllRegister();
+		if (f->option_gdalcache > 0)
+			GDALSetCacheMax64(f->option_gdalcache * 1024 * 1024);
 		char buf[2*FILENAME_MAX];
 		snprintf(buf, 2*FILENAME_MAX, has_prefix(filename, "http://") ||
 				has_prefix(filename, "https://") ?
@@ -392,12 +557,39 @@ void generic_read(struct FI *f, char *filename)
 		f->pd = GDALGetRasterCount(f->gdal_img);
 		f->w = GDALGetRasterXSize(f->gdal_img);
 		f->h = GDALGetRasterYSize(f->gdal_img);
-		f->no = 1;
 		for (int i = 0; i < f->pd; i++)
 			f->gdal_band[i] = GDALGetRasterBand(f->gdal_img, i+1);
+
+		// octaves = overviews of half the size of the previous octave
+		f->no = 1;
+		f->pyr_w[0] = f->w;
+		f->pyr_h[0] = f->h;
+		int novr = GDALGetOverviewCount(f->gdal_band[0]);
+		while (f->no <= f->max_octaves && f->no < MAX_OCTAVES)
+		{
+			int sw = ceil(f->pyr_w[f->no - 1] / 2.0);
+			int sh = ceil(f->pyr_h[f->no - 1] / 2.0);
+			int k = 0, ow = 0, oh = 0;
+			for (; k < novr; k++)
+			{
+				GDALRasterBandH b = GDALGetOverview(f->gdal_band[0],k);
+				ow = GDALGetRasterBandXSize(b);
+				oh = GDALGetRasterBandYSize(b);
+				if (abs(ow - sw) <= 1 && abs(oh - sh) <= 1)
+					break;
+			}
+			if (k == novr) break;
+			f->gdal_ovr[f->no] = k;
+			f->pyr_w[f->no] = ow;
+			f->pyr_h[f->no] = oh;
+			f->no += 1;
+		}
 #else
 		assert(false);
 #endif
+	} else if (!f->option_write && filename_is_vrt(filename)) {
+		if (f->option_verbose) fprintf(stderr, "...vrt mosaic!\n");
+		vrt_init(f, filename);
 	} else {
 		f->x = iio_read_image_float_vec(filename, &f->w, &f->h, &f->pd);
 		f->no = build_pyramid(f, f->max_octaves);
@@ -411,7 +603,7 @@ void fancy_image_reload(struct fancy_image *fi)
 {
 	struct FI *f = (void*)fi;
 
-	if (!f->tiffo && !f->gdal)
+	if (!f->tiffo && !f->gdal && !f->vrt)
 	{
 		int tmp_w, tmp_h, tmp_pd;
 		float *tmp_x = iio_read_image_float_vec(f->x_filename,
@@ -470,7 +662,7 @@ struct fancy_image *fancy_image_open(char *filename, char *options)
 		generic_create(f, filename);
 
 	// read the image
-	f->gdal = f->tiffo = false;
+	f->gdal = f->tiffo = f->vrt = false;
 	generic_read(f, filename);
 
 	if (f->option_verbose) {
@@ -526,16 +718,45 @@ int fancy_image_height_octave(struct fancy_image *fi, int octave)
 }
 
 // API: close a fancy image
+SMART_PARAMETER_SILENT(FANCY_IMAGE_STATS,0)
+
 void fancy_image_close(struct fancy_image *fi)
 {
 	struct FI *f = (void*)fi;
 
 	if (f->tiffo) {
 #ifdef FANCY_TIFF
+		if (FANCY_IMAGE_STATS() > 0)
+		{
+			struct fancy_image_stats s[1];
+			fancy_image_get_stats(s, fi);
+			fprintf(stderr, "FANCY_IMAGE_STATS \"%s\": %ld hits, "
+					"%ld misses (%ld shared), %ld evictions, "
+					"%gMB read, %d tiles of %d\n",
+					f->t->filename[0], s->hits, s->misses,
+					s->shared_hits, s->evictions,
+					s->bytes_read / (1024.0 * 1024),
+					s->tiles, s->maxtiles);
+		}
+		char base[FILENAME_MAX];
+		snprintf(base, FILENAME_MAX, "%s", f->t->filename[0]);
 		tiff_octaves_free(f->t);
+		if (f->option_write && f->option_octa && has_suffix(base, ",0"))
+		{
+			base[strlen(base) - 2] = '\0';
+			tiff_build_levels(base);
+		}
 #else
 		assert(false);
 #endif
+	} else if (f->gdal) {
+#ifdef FANCY_GDAL
+		GDALClose(f->gdal_img);
+#else
+		assert(false);
+#endif
+	} else if (f->vrt) {
+		vrt_free(f);
 	} else {
 		if ((f->option_write && f->x_changed) || f->option_creat)
 			iio_write_image_float_vec(f->x_filename, f->x,
@@ -548,6 +769,49 @@ void fancy_image_close(struct fancy_image *fi)
 	free(f);
 }
 
+#ifdef FANCY_GDAL
+// band l of octave o (the octaves above 0 are overviews)
+static GDALRasterBandH gdal_band_oct(struct FI *f, int o, int l)
+{
+	GDALRasterBandH b = f->gdal_band[l];
+	return o ? GDALGetOverview(b, f->gdal_ovr[o]) : b;
+}
+
+// read a rectangle by windowed RasterIO, in strips of whole blocks
+// (the samples outside of the image are NAN)
+static void gdal_getrectangle(float *out, struct FI *f, int o,
+		int x0, int y0, int xf, int yf)
+{
+	int w = xf - x0 + 1, h = yf - y0 + 1, pd = f->pd;
+	for (int k = 0; k < w * h * pd; k++)
+		out[k] = NAN;
+	int a0 = x0 < 0 ? 0 : x0;
+	int b0 = y0 < 0 ? 0 : y0;
+	int a1 = xf < f->pyr_w[o] ? xf : f->pyr_w[o] - 1;
+	int b1 = yf < f->pyr_h[o] ? yf : f->pyr_h[o] - 1;
+	if (a0 > a1 || b0 > b1) return;
+	for (int l = 0; l < pd; l++)
+	{
+		GDALRasterBandH b = gdal_band_oct(f, o, l);
+		int bw, bh;
+		GDALGetBlockSize(b, &bw, &bh);
+		if (bh < 1) bh = 1;
+		for (int j = b0; j <= b1; j = (j / bh + 1) * bh)
+		{
+			int j1 = (j / bh + 1) * bh - 1;
+			if (j1 > b1) j1 = b1;
+			float *p = out + ((j - y0) * w + a0 - x0) * pd + l;
+#ifdef _OPENMP
+#pragma omp critical(fancy_image_gdal)
+#endif
+			GDALRasterIO(b, GF_Read, a0, j, a1 - a0 + 1, j1 - j + 1,
+					p, a1 - a0 + 1, j1 - j + 1, GDT_Float32,
+					pd * sizeof*out, w * pd * sizeof*out);
+		}
+	}
+}
+#endif//FANCY_GDAL
+
 #ifdef FANCY_TIFF
 // internal conversion function function (for libtiff)
 static float convert_sample_to_float(struct tiff_info *ti, void *p)
@@ -592,8 +856,9 @@ float fancy_image_getsample_oct(struct fancy_image *fi,
 
 	if (f->tiffo) {
 #ifdef FANCY_TIFF
-		uint8_t *p_pixel = tiff_octaves_getpixel(f->t, octave, i, j);
-		if (!p_pixel) return NAN;
+		uint8_t p_pixel[f->t->i->spp * (f->t->i->bps / 8)];
+		if (!tiff_octaves_getpixel_copy(p_pixel, f->t, octave, i, j))
+			return NAN;
 		uint8_t *p_sample = p_pixel + (l * f->t->i->bps) / 8;
 		return convert_sample_to_float(f->t->i, p_sample);
 #else
@@ -601,18 +866,25 @@ float fancy_image_getsample_oct(struct fancy_image *fi,
 #endif
 	} else if (f->gdal) {
 #ifdef FANCY_GDAL
-		if (octave != 0) return NAN;
-		static float *roi = NULL;
-		if (!roi) roi = CPLMalloc(1*1*sizeof*roi);
-		GDALRasterBandH img = f->gdal_band[l];
-		int r = GDALRasterIO(img, GF_Read, i,j,1, 1, roi,1,1,
+		if (i < 0 || j < 0 || i >= f->pyr_w[octave]
+				|| j >= f->pyr_h[octave])
+			return NAN;
+		float roi[1] = {NAN};
+		GDALRasterBandH img = gdal_band_oct(f, octave, l);
+		// gdal datasets can not be read by several threads at once
+#ifdef _OPENMP
+#pragma omp critical(fancy_image_gdal)
+#endif
+		GDALRasterIO(img, GF_Read, i,j,1, 1, roi,1,1,
 				GDT_Float32, 0,0);
 		return roi[0*0+0];
 #else
 		assert(false);
 #endif
+	} else if (f->vrt) {
+		return vrt_getsample(f, i, j, l);
 	} else {
-		float *x = f->pyr_x[octave];
+		float *x = pyramid_octave(f, octave);
 		int    w = f->pyr_w[octave];
 		int    h = f->pyr_h[octave];
 		if (i < 0 || j < 0 || i >= w || j >= h)
@@ -623,13 +895,46 @@ float fancy_image_getsample_oct(struct fancy_image *fi,
 	return NAN;
 }
 
+// number of threads that read the tiles of a rectangle (0 = do not prefetch)
+SMART_PARAMETER_SILENT(FANCY_IMAGE_PREFETCH,8)
+
+// API: read in advance the tiles of a rectangle
+void fancy_image_prefetch_rectangle(struct fancy_image *fi,
+		int octave, int x0, int y0, int w, int h)
+{
+	struct FI *f = (void*)fi;
+#ifdef FANCY_TIFF
+	if (f->tiffo)
+		tiff_octaves_prefetch(f->t, octave, x0, y0, w, h,
+				FANCY_IMAGE_PREFETCH());
+#else
+	(void)f; (void)octave; (void)x0; (void)y0; (void)w; (void)h;
+#endif
+}
+
 // API: load a rectangle of data
 int fancy_image_getrectangle_oct(float *out, struct fancy_image *fi,
 		int octave, int x0, int y0, int xf, int yf)
 {
 	struct FI *f = (void*)fi;
+	if (octave < 0 || octave >= f->no)
+		return false;
+	if (f->gdal) {
+#ifdef FANCY_GDAL
+		gdal_getrectangle(out, f, octave, x0, y0, xf, yf);
+		return true;
+#else
+		assert(false);
+#endif
+	}
+	if (f->vrt) {
+		vrt_getrectangle(out, f, x0, y0, xf, yf);
+		return true;
+	}
 	if (f->megabytes > 0) // if we have our own cache, we use it
 	{
+		fancy_image_prefetch_rectangle(fi, octave, x0, y0,
+				xf - x0 + 1, yf - y0 + 1);
 		for (int j = y0; j <= yf; j++)
 		for (int i = x0; i <= xf; i++)
 		for (int l = 0; l < f->pd; l++)
@@ -651,12 +956,7 @@ int fancy_image_setsample(struct fancy_image *fi, int i, int j, int l, float v)
 
 	if (f->tiffo) {
 #ifdef FANCY_TIFF
-		float p[f->pd];
-		// TODO: remove this silly loop
-		for (int k = 0; k < f->pd; k++)
-			p[k] = fancy_image_getsample(fi, i, j, k);
-		p[l] = v;
-		tiff_octaves_setpixel_float(f->t, i, j, p);
+		tiff_octaves_setsample_float(f->t, i, j, l, v);
 		return true;
 #else
 		assert(false);
@@ -668,6 +968,46 @@ int fancy_image_setsample(struct fancy_image *fi, int i, int j, int l, float v)
 	}
 }
 
+// API: write the pending changes to the file
+void fancy_image_flush(struct fancy_image *fi)
+{
+	struct FI *f = (void*)fi;
+	if (f->tiffo) {
+#ifdef FANCY_TIFF
+		tiff_octaves_flush(f->t);
+#else
+		assert(false);
+#endif
+	} else if (f->option_write && f->x_changed) {
+		iio_write_image_float_vec(f->x_filename, f->x,
+				f->w, f->h, f->pd);
+		f->x_changed = false;
+	}
+}
+
+// API: whether "fancy_image_open" would read this file lazily
+int fancy_image_is_lazy(char *filename)
+{
+	return filename_corresponds_to_tiffo(filename) || FORCE_GDAL()
+		|| (FANCY_IMAGE_PCD() &&
+			filename_actually_contains_tiff_pyramid(filename));
+}
+
+int fancy_image_crop_tiles(char *fname_out, char *fname_in,
+		int x0, int y0, int w, int h)
+{
+#ifdef FANCY_TIFF
+	char buf[FILENAME_MAX];
+	snprintf(buf, FILENAME_MAX, "%s", fname_in);
+	if (has_suffix(fname_in, ",%d")) // use the first octave of a pyramid
+		snprintf(buf, FILENAME_MAX, fname_in, 0);
+	disable_tiff_warnings_and_errors();
+	return tiff_crop_tiles(fname_out, buf, x0, y0, w, h);
+#else
+	return 0;
+#endif
+}
+
 int fancy_image_leak_tiff_info(int *tw, int *th, int *fmt, int *bps,
 		struct fancy_image *fi)
 {
@@ -684,10 +1024,50 @@ int fancy_image_leak_tiff_info(int *tw, int *th, int *fmt, int *bps,
 	return 0;
 }
 
+int fancy_image_get_stats(struct fancy_image_stats *s, struct fancy_image *fi)
+{
+	struct FI *f = (void*)fi;
+	s->hits = s->misses = s->evictions = s->bytes_read = 0;
+	s->shared_hits = 0;
+	s->tiles = s->maxtiles = 0;
+#ifdef FANCY_TIFF
+	if (f->tiffo) {
+		for (int k = 0; k < f->t->nshards; k++)
+		{
+			struct tiff_octaves_shard *t = f->t->s + k;
+			lock_shard(t);
+			s->hits       += t->hits;
+			s->misses     += t->misses;
+			s->evictions  += t->evictions;
+			s->bytes_read += t->bytes_read;
+			s->shared_hits+= t->shared_hits;
+			s->tiles      += t->curtiles;
+			s->maxtiles   += t->maxtiles;
+			unlock_shard(t);
+		}
+		return 1;
+	}
+#else
+	(void)f;
+#endif
+	return 0;
+}
+
 void fancy_image_fill_rectangle_float_vec(
 		float *out, int w, int h,
 		struct fancy_image *f, int o, int x0, int y0)
 {
+#ifdef FANCY_GDAL
+	if (((struct FI *)f)->gdal && o >= 0 && o < f->no) {
+		gdal_getrectangle(out, (void*)f, o, x0, y0, x0+w-1, y0+h-1);
+		return;
+	}
+#endif
+	if (((struct FI *)f)->vrt && o == 0) {
+		vrt_getrectangle(out, (void*)f, x0, y0, x0+w-1, y0+h-1);
+		return;
+	}
+	fancy_image_prefetch_rectangle(f, o, x0, y0, w, h);
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 	for (int l = 0; l < f->pd; l++)
@@ -701,6 +1081,7 @@ void fancy_image_fill_rectangle_float_split(
 		float *out, int w, int h,
 		struct fancy_image *f, int o, int x0, int y0)
 {
+	fancy_image_prefetch_rectangle(f, o, x0, y0, w, h);
 	for (int l = 0; l < f->pd; l++)
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
@@ -723,6 +1104,168 @@ void fancy_image_getpixel_oct(float *out, struct fancy_image *f,
 		out[l] = fancy_image_getsample_oct(f, o, i, j, l);
 }
 
+// combine the pixels p[0..3] at (i,j), (i+1,j), (i,j+1), (i+1,j+1)
+// with the weights of bilinear interpolation (the pixels with zero weight
+// are not used, and may be NULL)
+static void bilinear_pixel(float *out, float *p[4], float a, float b, int pd)
+{
+	if (!a && !b) {
+		for (int l = 0; l < pd; l++)
+			out[l] = p[0] ? p[0][l] : NAN;
+		return;
+	}
+	float w[4] = {(1-a)*(1-b), a*(1-b), (1-a)*b, a*b};
+	for (int l = 0; l < pd; l++)
+	{
+		float v = 0;
+		for (int k = 0; k < 4; k++)
+			if (w[k])
+				v += w[k] * (p[k] ? p[k][l] : NAN);
+		out[l] = v;
+	}
+}
+
+// integer position of a query, and its bilinear weights
+static void gather_position(int *i, int *j, float *a, float *b,
+		const float *xy, int interp)
+{
+	float x = xy[0], y = xy[1];
+	if (!interp) { x += 0.5; y += 0.5; }
+	*i = floor(x);
+	*j = floor(y);
+	*a = interp ? x - *i : 0;
+	*b = interp ? y - *j : 0;
+}
+
+// one query, by the slow path
+static void gather_one(float *out, struct fancy_image *f, int o,
+		const float *xy, int interp)
+{
+	int i, j, pd = f->pd;
+	float a, b, q[4][pd], *p[4] = {q[0], q[1], q[2], q[3]};
+	gather_position(&i, &j, &a, &b, xy, interp);
+	for (int k = 0; k < 4; k++)
+		if (k == 0 || interp)
+			fancy_image_getpixel_oct(q[k], f, o, i + k%2, j + k/2);
+	bilinear_pixel(out, p, a, b, pd);
+}
+
+// queries on an image that is in memory
+static void gather_array(float *out, float *x, int w, int h, int pd,
+		int n, const float (*xy)[2], int interp)
+{
+	for (int k = 0; k < n; k++)
+	{
+		int i, j;
+		float a, b, *p[4];
+		gather_position(&i, &j, &a, &b, xy[k], interp);
+		for (int r = 0; r < 4; r++)
+		{
+			int ii = i + r%2, jj = j + r/2;
+			bool in = ii >= 0 && jj >= 0 && ii < w && jj < h;
+			p[r] = in ? x + (jj * w + ii) * pd : NULL;
+		}
+		bilinear_pixel(out + k * pd, p, a, b, pd);
+	}
+}
+
+#ifdef FANCY_TIFF
+// queries on a tiled tiff, grouped by tiles
+// (queries whose neighbourhood is not inside a single tile are done by the
+// slow path)
+static void gather_tiffo(float *out, struct FI *f, int o,
+		int n, const float (*xy)[2], int interp)
+{
+	struct tiff_octaves *t = f->t;
+	if (!t->loaded[o])
+		load_one_octave_file(t, o);
+	struct tiff_info *ti = t->i + o;
+	int pd = f->pd, nt = ti->ntiles, ss = ti->bps / 8;
+	int *key = xmalloc(n * sizeof*key);
+	int *start = xmalloc((nt + 2) * sizeof*start);
+	int *order = xmalloc(n * sizeof*order);
+
+	// bucket the queries by tile (key -1 = slow path)
+	for (int k = 0; k <= nt + 1; k++)
+		start[k] = 0;
+	for (int k = 0; k < n; k++)
+	{
+		int i, j;
+		float a, b;
+		gather_position(&i, &j, &a, &b, xy[k], interp);
+		int i1 = i + (interp>0), j1 = j + (interp>0);
+		key[k] = -1;
+		if (i >= 0 && j >= 0 && i1 < ti->w && j1 < ti->h
+				&& i / ti->tw == i1 / ti->tw
+				&& j / ti->th == j1 / ti->th)
+			key[k] = my_computetile(ti, i, j);
+		start[key[k] + 2] += 1;
+	}
+	for (int k = 1; k <= nt + 1; k++)
+		start[k] += start[k-1];
+	for (int k = 0; k < n; k++)
+		order[start[key[k] + 1]++] = k;
+
+	// queries of each tile, holding the tile
+	for (int tidx = 0; tidx < nt; tidx++)
+	{
+		int k0 = start[tidx], k1 = start[tidx + 1];
+		if (k0 == k1) continue;
+		struct tiff_octaves_shard *s = tile_shard(t, o, tidx);
+		lock_shard(s);
+		char *tile = tiff_octaves_gettile_locked(t, s, o, tidx);
+		for (int m = k0; m < k1; m++)
+		{
+			int k = order[m], i, j;
+			float a, b, q[4][pd], *p[4] = {q[0], q[1], q[2], q[3]};
+			gather_position(&i, &j, &a, &b, xy[k], interp);
+			for (int r = 0; r < 4; r++)
+			{
+				if (r && !interp) break;
+				char *x = tile + tiff_octaves_pixel_position(ti,
+						i + r%2, j + r/2);
+				for (int l = 0; l < pd; l++)
+					q[r][l] = convert_sample_to_float(ti,
+							x + l * ss);
+			}
+			bilinear_pixel(out + k * pd, p, a, b, pd);
+		}
+		unlock_shard(s);
+	}
+	for (int m = 0; m < start[0]; m++)
+		gather_one(out + order[m] * pd, (void*)f, o, xy[order[m]],
+				interp);
+
+	free(order);
+	free(start);
+	free(key);
+}
+#endif//FANCY_TIFF
+
+// API: sample an image at many points
+void fancy_image_gather(struct fancy_image *fi, int octave,
+		int n, const float (*xy)[2], float *out, int interp)
+{
+	struct FI *f = (void*)fi;
+	if (octave < 0 || octave >= f->no) {
+		for (int k = 0; k < n * f->pd; k++)
+			out[k] = NAN;
+		return;
+	}
+	if (f->tiffo) {
+#ifdef FANCY_TIFF
+		gather_tiffo(out, f, octave, n, xy, interp);
+#else
+		assert(false);
+#endif
+	} else if (f->gdal || f->vrt) {
+		for (int k = 0; k < n; k++)
+			gather_one(out + k * f->pd, fi, octave, xy[k], interp);
+	} else
+		gather_array(out, pyramid_octave(f, octave), f->pyr_w[octave],
+				f->pyr_h[octave], f->pd, n, xy, interp);
+}
+
 #ifdef MAIN_FI
 #include <stdio.h>
 int main_example(int c, char *v[])
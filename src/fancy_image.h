@@ -26,6 +26,16 @@ struct fancy_image {
 // BASIC API //
 ///////////////
 
+// Thread safety: when compiled with OpenMP, the functions that read samples
+// ("fancy_image_getsample", "fancy_image_getsample_oct",
+// "fancy_image_getpixel", "fancy_image_getpixel_oct",
+// "fancy_image_getrectangle_oct", "fancy_image_prefetch_rectangle" and
+// "fancy_image_get_stats") can be called concurrently from many threads on
+// the same image.  The tile cache is split into shards with their own locks,
+// and a tile is never evicted while another thread reads it.  All the other
+// functions, and in particular "fancy_image_setsample", must not run
+// concurrently with any other call on the same image.
+
 // open an image with the desired amount of cache
 // (the cache size is honored only for tiled tiffs)
 //
@@ -35,9 +45,31 @@ struct fancy_image {
 // Options for reading and writing an existing file
 // 	"rw"
 //
+// Remote files
+// 	"https://host/file.tif", "s3://bucket/file.tif"
+// (tiled tiffs are read by range requests, fetching only the tiles that are
+// accessed; their sub-images of half size are the octaves)
+//
+// Option for the size of the block cache of GDAL, in megabytes
+// 	"r,gdalcache=500"
+// (when the GDAL backend is enabled, its octaves are the overviews of the
+// dataset whose size is half of the previous octave)
+//
+// Option for sharing the decoded tiles between processes
+// 	"r,shm=/name,megabytes=8000"
+// (the shared memory object "/name" holds the tiles of all the processes
+// that open images with the same option; it is created with the size
+// given by "megabytes", and it persists until it is removed)
+//
 // Options for creating a new file
 // 	"c,width=*,height=*,pd=*,type=*[,tw=*,th=*]"
 //
+// Option for writing the octaves of a tiled tiff into the same file
+// 	"rw,o" or "c,o,..." (with a filename like "file.tif,%d")
+// (upon closing, the octaves are rebuilt from the first one and stored as
+// reduced-resolution sub-images; a single-file pyramid like this, or one
+// with internal overviews created by GDAL, is read as "file.tif,%d")
+//
 // Note: if megabytes=0 then the cache is disabled and the
 // data can only be accessed by get_rectangle.
 struct fancy_image *fancy_image_open(char *filename, char *options);
@@ -59,8 +91,13 @@ float fancy_image_getsample_oct(struct fancy_image *f, int octave, int i,int j,
 // set a sample of the given image
 // return a boolean wether it failed or not
 // the file will be actually written when calling "fancy_image_close"
+// (or "fancy_image_flush"; tiles evicted from the cache are written earlier)
 int fancy_image_setsample(struct fancy_image *f, int i, int j, int l, float v);
 
+// write all the pending changes of the image to its file
+// (the changed tiles are written in order, through a single file handle)
+void fancy_image_flush(struct fancy_image *f);
+
 
 // obtain a sample of the image at the given point
 // (if the point is outside the image domain, return NAN)
@@ -71,6 +108,16 @@ float fancy_image_getsample(struct fancy_image *f, int i,int j, int l);
 int fancy_image_getrectangle_oct(float *out, struct fancy_image *f,
 		int octave, int x0, int y0, int xf, int yf);
 
+// read in advance all the missing tiles of a rectangle of size w x h
+// (the tiles are read by several threads at once, so that the latencies of
+// the reads overlap; the number of threads is given by the environment
+// variable FANCY_IMAGE_PREFETCH, default 8, and 0 disables it)
+//
+// "fancy_image_getrectangle_oct" and "fancy_image_fill_rectangle_*" call
+// this function before reading the samples.
+void fancy_image_prefetch_rectangle(struct fancy_image *f,
+		int octave, int x0, int y0, int w, int h);
+
 
 
 
@@ -98,6 +145,13 @@ void fancy_image_getpixel(float *out, struct fancy_image *f, int i,int j);
 void fancy_image_getpixel_oct(float *out, struct fancy_image *f, int octave,
 		int i,int j);
 
+// sample an image at the n points xy[k], writing "f->pd" numbers per point
+// (interp=0 for nearest neighbor, interp=1 for bilinear interpolation;
+// the results are those of combining "fancy_image_getsample_oct", but the
+// queries are grouped by tiles, so that each tile is looked up only once)
+void fancy_image_gather(struct fancy_image *f, int octave,
+		int n, const float (*xy)[2], float *out, int interp);
+
 // getpixel with automatic scale selectoin, and trilinear interpolation
 // and automatic choice of the octave
 void fancy_image_trilinear(float *out, struct fancy_image *f,
@@ -105,6 +159,15 @@ void fancy_image_trilinear(float *out, struct fancy_image *f,
 
 
 
+// whether the file is opened lazily (by tiles) instead of read whole
+int fancy_image_is_lazy(char *filename);
+
+// crop a tiled tiff by copying its tiles, without decoding them, when the
+// rectangle starts at the corner of a tile and the codec allows it
+// (returns 0, doing nothing, otherwise)
+int fancy_image_crop_tiles(char *fname_out, char *fname_in,
+		int x0, int y0, int w, int h);
+
 // leaky abstraction
 int fancy_image_leak_tiff_info(int *tw, int *th, int *fmt, int *bps,
 		struct fancy_image *f);
@@ -115,6 +178,20 @@ void *fancy_image_leak_gdal_info(struct fancy_image *f);
 // semi-leaky abstraction
 int fancy_image_transfer_leaks(struct fancy_image *y, struct fancy_image *x);
 
+// statistics of the tile cache (only for tiled tiffs, zero otherwise)
+// return whether the image has a tile cache
+// (they are printed upon "fancy_image_close" if FANCY_IMAGE_STATS=1)
+struct fancy_image_stats {
+	long hits;       // tile accesses served from the cache
+	long misses;     // tile accesses that read the file
+	long evictions;  // tiles freed to make room for others
+	long bytes_read; // total size of the tiles read
+	long shared_hits;// misses found in the shared cache (option "shm=")
+	int tiles;       // tiles currently in memory
+	int maxtiles;    // tiles allowed in memory (0 = unlimited)
+};
+int fancy_image_get_stats(struct fancy_image_stats *s, struct fancy_image *f);
+
 
 
 
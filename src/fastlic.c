@@ -0,0 +1,190 @@
+#ifndef _FASTLIC_C
+#define _FASTLIC_C
+
+// fast line integral convolution of a vector field (Stalling and Hege)
+//
+// The texture is white noise averaged along the streamlines of the field.
+// A streamline is traced once from a seed pixel, forward and backward with
+// steps of FASTLIC_STEP pixels (midpoint rule on the normalized field), and
+// the averages of 2L+1 consecutive samples are computed by a running box
+// sum, for the m samples around the seed on each side.  Each average is
+// deposited on the pixel of its sample, and the output is the mean of the
+// deposits of each pixel.  The seeds are taken in raster order, skipping
+// the pixels that have already been reached by some streamline.
+//
+// The image is split into bands of rows, processed in parallel.  The
+// streamlines of the seeds of a band only deposit on the pixels of that
+// band, so that the result does not depend on the number of threads.  The
+// noise is a hash of the position and a seed.
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define FASTLIC_STEP 0.5  // distance between samples, in pixels
+#define FASTLIC_BAND 32   // number of rows of the bands
+
+// uniform noise in [0,1) at the pixel p
+static inline float fastlic_noise(uint64_t seed, long p)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15 * (p + 1);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	z ^= z >> 31;
+	return (z >> 40) * (1.0f / (1 << 24));
+}
+
+// normalized field at (x,y), by bilinear interpolation (false if it is zero,
+// not finite, or the point is outside)
+static bool fastlic_direction(float d[2], float *f, int w, int h,
+		float x, float y)
+{
+	if (!(x >= 0 && y >= 0 && x <= w - 1 && y <= h - 1))
+		return false;
+	int i = x, j = y;
+	if (i > w - 2) i = w > 1 ? w - 2 : 0;
+	if (j > h - 2) j = h > 1 ? h - 2 : 0;
+	float a = x - i, b = y - j;
+	int di = w > 1, dj = h > 1;
+	float *p00 = f + 2 * (j * (long)w + i), *p10 = p00 + 2 * di;
+	float *p01 = p00 + 2 * dj * (long)w, *p11 = p01 + 2 * di;
+	for (int l = 0; l < 2; l++)
+		d[l] = (1 - b) * ((1 - a) * p00[l] + a * p10[l])
+			+ b * ((1 - a) * p01[l] + a * p11[l]);
+	float n = hypot(d[0], d[1]);
+	if (!(n > 0 && isfinite(n)))
+		return false;
+	d[0] /= n;
+	d[1] /= n;
+	return true;
+}
+
+// trace n steps from (x,y) in the direction s (+1 or -1), storing the
+// positions in p[0..] (returns the number of steps that stay inside)
+static int fastlic_trace(float (*p)[2], float *f, int w, int h,
+		float x, float y, int s, int n)
+{
+	float t = s * FASTLIC_STEP;
+	for (int k = 0; k < n; k++)
+	{
+		float d[2], e[2];
+		if (!fastlic_direction(d, f, w, h, x, y)) return k;
+		if (!fastlic_direction(e, f, w, h, x + t*d[0]/2, y + t*d[1]/2))
+			return k;
+		x += t * e[0];
+		y += t * e[1];
+		if (!(x > -0.5 && y > -0.5 && x < w - 0.5 && y < h - 0.5))
+			return k;
+		p[k][0] = x;
+		p[k][1] = y;
+	}
+	return n;
+}
+
+// texture of the field f (of size w x h, two channels) into y, averaging
+// 2L+1 samples along the streamlines and reusing each one for 2m+1 pixels
+static void fast_line_integral_convolution(float *y, float *f, int w, int h,
+		int L, int m, uint64_t seed)
+{
+	if (L < 0) L = 0;
+	if (m < 0) m = 0;
+	int K = L + m; // samples on each side of the seed
+	float *cnt = xmalloc(w * (long)h * sizeof*cnt);
+	for (long p = 0; p < w * (long)h; p++)
+		y[p] = cnt[p] = 0;
+	int nb = (h + FASTLIC_BAND - 1) / FASTLIC_BAND;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = 0; b < nb; b++)
+	{
+		int j0 = b * FASTLIC_BAND;
+		int j1 = j0 + FASTLIC_BAND < h ? j0 + FASTLIC_BAND : h;
+		float (*c)[2] = xmalloc((2 * K + 1) * sizeof*c); // the curve
+		long *q = xmalloc((2 * K + 1) * sizeof*q);       // its pixels
+		float *v = xmalloc((2 * K + 1) * sizeof*v);      // its noise
+		for (int j = j0; j < j1; j++)
+		for (int i = 0; i < w; i++)
+		{
+			if (cnt[j * (long)w + i]) continue;
+
+			// the samples are c[a..e), and the seed is c[K]
+			c[K][0] = i;
+			c[K][1] = j;
+			int nf = fastlic_trace(c + K + 1, f, w, h, i, j, 1, K);
+			float (*bw)[2] = c; // backward samples, in reverse order
+			int nk = fastlic_trace(bw, f, w, h, i, j, -1, K);
+			for (int k = 0; k < nk / 2; k++)
+				for (int l = 0; l < 2; l++)
+				{
+					float t = bw[k][l];
+					bw[k][l] = bw[nk-1-k][l];
+					bw[nk-1-k][l] = t;
+				}
+			int a = K - nk, e = K + 1 + nf;
+			if (a > 0)
+				for (int k = nk - 1; k >= 0; k--)
+					for (int l = 0; l < 2; l++)
+						c[a+k][l] = c[k][l];
+			for (int k = a; k < e; k++)
+			{
+				int ii = lrintf(c[k][0]), jj = lrintf(c[k][1]);
+				q[k] = jj * (long)w + ii;
+				v[k] = fastlic_noise(seed, q[k]);
+			}
+
+			// running box sum around the samples K-m..K+m
+			int k0 = K - m < a ? a : K - m;
+			int k1 = K + m + 1 > e ? e : K + m + 1;
+			int lo = k0 - L < a ? a : k0 - L;
+			int hi = k0 + L + 1 > e ? e : k0 + L + 1;
+			double s = 0;
+			for (int k = lo; k < hi; k++)
+				s += v[k];
+			for (int k = k0; k < k1; k++)
+			{
+				long p = q[k];
+				if (p >= j0 * (long)w && p < j1 * (long)w) {
+					y[p] += s / (hi - lo);
+					cnt[p] += 1;
+				}
+				if (k + L + 1 < e) s += v[hi++];
+				if (k - L >= a) s -= v[lo++];
+			}
+		}
+		free(v);
+		free(q);
+		free(c);
+	}
+	for (long p = 0; p < w * (long)h; p++)
+		y[p] = cnt[p] ? y[p] / cnt[p] : NAN;
+	free(cnt);
+}
+
+// affine contrast stretch of x[0..n-1], from its mean and deviation to
+// 1/2 and the deviation d
+static void fastlic_stretch(float *x, long n, float d)
+{
+	double m = 0, q = 0;
+	long nm = 0;
+	for (long i = 0; i < n; i++)
+		if (isfinite(x[i]))
+		{
+			m += x[i];
+			q += x[i] * x[i];
+			nm += 1;
+		}
+	if (!nm) return;
+	m /= nm;
+	double s = sqrt(fmax(q / nm - m * m, 0));
+	for (long i = 0; i < n; i++)
+	{
+		float t = s > 0 ? 0.5 + d * (x[i] - m) / s : 0.5;
+		x[i] = isfinite(t) ? fmin(fmax(t, 0), 1) : 0.5;
+	}
+}
+
+#endif//_FASTLIC_C
@@ -25,81 +25,42 @@
 
 
 
-#ifndef USE_WISDOM
-static void evoke_wisdom(void) {}
-static void bequeath_wisdom(void) {}
-#else//USE_WISDOM
-#include "fftwisdom.c"
-#endif//USE_WISDOM
+#include "fftplans.c"
 
 
 
 // wrapper around FFTW3 that computes the complex-valued Fourier transform
-// of a real-valued image
+// of a real-valued image (the half spectrum given by the r2c transform is
+// completed by hermitian symmetry)
 static void fft_2dfloat(fftwf_complex *fx, float *x, int w, int h)
 {
-	fftwf_complex *a = fftwf_malloc(w*(long)h*sizeof*a);
-
-	//fprintf(stderr, "planning...\n");
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_dft_2d(h, w, a, fx,
-						FFTW_FORWARD, FFTW_ESTIMATE);
-	bequeath_wisdom();
-	//fprintf(stderr, "...planned!\n");
-
-	FORI(w*h) a[i] = x[i]; // complex assignment!
-	fftwf_execute(p);
-
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_cleanup();
+	struct fftplan *p = fftplan_get(FFTPLAN_REAL, w, h);
+	float *a = p->in;
+	fftwf_complex *b = p->out;
+	int W = w/2 + 1;
+
+	FORJ(h) FORI(w) a[j*2*W+i] = x[j*w+i];
+	fftwf_execute(p->p);
+	FORJ(h) FORI(w)
+		fx[j*w+i] = i < W ? b[j*W+i] : conjf(b[((h-j)%h)*W+w-i]);
 }
 
-//static void fft_2dfloatr2c(fftwf_complex *fx, float *x, int w, int h)
-//{
-//	//fftwf_complex *a = fftwf_malloc(w*h*sizeof*a);
-//
-//	//fprintf(stderr, "planning...\n");
-//	evoke_wisdom();
-//	fftwf_plan p = fftwf_plan_dft_r2c_2d(h, w, x, fx, FFTW_ESTIMATE);
-//	bequeath_wisdom();
-//	//fprintf(stderr, "...planned!\n");
-//
-//	//FORI(w*h) a[i] = x[i]; // complex assignment!
-//	fftwf_execute(p);
-//
-//	fftwf_destroy_plan(p);
-//	//fftwf_free(a);
-//	fftwf_cleanup();
-//}
-
 // Wrapper around FFTW3 that computes the real-valued inverse Fourier transform
 // of a complex-valued frequantial image.
 // The input data must be hermitic.
 static void ifft_2dfloat(float *ifx,  fftwf_complex *fx, int w, int h)
 {
-	fftwf_complex *a = fftwf_malloc(w*(long)h*sizeof*a);
-	fftwf_complex *b = fftwf_malloc(w*(long)h*sizeof*b);
-
-	//fprintf(stderr, "planning...\n");
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_dft_2d(h, w, a, b,
-						FFTW_BACKWARD, FFTW_ESTIMATE);
-	bequeath_wisdom();
-	//fprintf(stderr, "...planned!\n");
+	struct fftplan *p = fftplan_get(FFTPLAN_DFT_BACKWARD, w, h);
+	fftwf_complex *a = p->in, *b = p->out;
 
 	FORI(w*h) a[i] = fx[i];
-	fftwf_execute(p);
+	fftwf_execute(p->p);
 	float scale = 1.0/(w*h);
 	FORI(w*h) {
 		fftwf_complex z = b[i] * scale;
 		ifx[i] = crealf(z);
 		//assert(cimagf(z) < 0.001);
 	}
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_free(b);
-	fftwf_cleanup();
 }
 
 // Wrapper around FFTW3 that computes the complex-valued inverse Fourier
@@ -108,27 +69,16 @@ static void ifft_2dfloat(float *ifx,  fftwf_complex *fx, int w, int h)
 static void ifft_2dfloat_c2c(fftwf_complex *ifx,  fftwf_complex *fx,
 		int w, int h)
 {
-	fftwf_complex *a = fftwf_malloc(w*(long)h*sizeof*a);
-	fftwf_complex *b = fftwf_malloc(w*(long)h*sizeof*b);
-
-	//fprintf(stderr, "planning...\n");
-	evoke_wisdom();
-	fftwf_plan p = fftwf_plan_dft_2d(h, w, a, b,
-						FFTW_BACKWARD, FFTW_ESTIMATE);
-	bequeath_wisdom();
-	//fprintf(stderr, "...planned!\n");
+	struct fftplan *p = fftplan_get(FFTPLAN_DFT_BACKWARD, w, h);
+	fftwf_complex *a = p->in, *b = p->out;
 
 	FORI(w*h) a[i] = fx[i];
-	fftwf_execute(p);
+	fftwf_execute(p->p);
 	float scale = 1.0/(w*h);
 	FORI(w*h) {
 		fftwf_complex z = b[i] * scale;
 		ifx[i] = z;
 	}
-	fftwf_destroy_plan(p);
-	fftwf_free(a);
-	fftwf_free(b);
-	fftwf_cleanup();
 }
 
 // if it finds any strange number, sets it to zero
@@ -245,13 +195,26 @@ static void fft_inverse_complex(float *y, float *x, int w, int h, int pd)
 	free(gc);
 }
 
+// extend the image by zeros to the size W x H
+static float *zero_pad(float *x, int w, int h, int pd, int W, int H)
+{
+	float *y = xmalloc(W*(long)H*pd*sizeof*y);
+	for (long i = 0; i < W*(long)H*pd; i++)
+		y[i] = 0;
+	FORJ(h) FORI(w) FORL(pd)
+		y[(j*(long)W+i)*pd+l] = x[(j*(long)w+i)*pd+l];
+	free(x);
+	return y;
+}
+
 #include "pickopt.c"
 int main_fft(int c, char *v[])
 {
 	int localization = atoi(pick_option(&c, &v, "l", "0"));
 	bool complex_ifft = pick_option(&c, &v, "c", NULL);
+	bool pad = pick_option(&c, &v, "P", NULL);
 	if (c != 1 && c != 2 && c != 3 && c != 4) {
-		fprintf(stderr, "usage:\n\t%s {1|-1} [in [out]]\n", *v);
+		fprintf(stderr, "usage:\n\t%s [-P] {1|-1} [in [out]]\n", *v);
 		//                          0  1      2   3
 		return EXIT_FAILURE;
 	}
@@ -273,6 +236,14 @@ int main_fft(int c, char *v[])
 	if (direction < 0 && complex_ifft)
 		pdout = pd;
 
+	// (the spectrum of the image padded to a fast size has the padded size)
+	if (pad && direction > 0 && !localization) {
+		int W = fftplan_fast_size(w), H = fftplan_fast_size(h);
+		x = zero_pad(x, w, h, pd, W, H);
+		w = W;
+		h = H;
+	}
+
 	float *y = xmalloc(w*(long)h*pdout*sizeof*y);
 
 	if (localization) {
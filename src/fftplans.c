@@ -0,0 +1,253 @@
+#ifndef _FFTPLANS_C
+#define _FFTPLANS_C
+
+// cache of FFTW plans, shared by the programs that call FFTW
+//
+// Each plan is created once for each size and kind of transform, together
+// with its own input and output buffers, and it is reused by all the
+// subsequent calls (e.g., for all the channels of an image).  The user only
+// needs to fill the input buffer, call "fftwf_execute" and read the output.
+//
+// The real plans (FFTPLAN_REAL) are in-place: "in" is a real image of
+// width 2*(w/2+1) (the last columns are padding), "p" computes its half
+// spectrum of size (w/2+1) x h on the same buffer, and "q" goes back.
+// They can transform a batch of "n" images at once, stored one after the
+// other in the buffer (see "fftplan_get_many").  The block plans
+// (FFTPLAN_BLOCKDCT) are also in-place and batched: "p" computes the DCT-II
+// of each of the "n" blocks of size w x h of the buffer "in", and "q" the
+// un-normalized DCT-III (so that q(p(x)) = 4*w*h*x).  The function
+// "fftplan_fast_size" gives the sizes to pad the images to, when the
+// boundary condition of the caller allows it.
+//
+// Environment variables:
+//
+// 	IMSCRIPT_FFTW_PLAN    0=estimate (default), 1=measure, 2=patient
+// 	IMSCRIPT_FFTW_WISDOM  file to import wisdom from, and to save it at exit
+// 	IMSCRIPT_FFTW_THREADS number of threads of each transform (0=all)
+//
+// The threads are only available when compiled with -DFFTW_WITH_THREADS and
+// linked to -lfftw3f_threads.  Under OpenMP, each thread has its own cache
+// (and buffers), and the planners are called one at a time, so that the
+// transforms can be computed from several threads at once.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fftw3.h>
+
+#include "fail.c"
+#include "smapa.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+SMART_PARAMETER_SILENT(IMSCRIPT_FFTW_PLAN,0)
+SMART_PARAMETER_SILENT(IMSCRIPT_FFTW_THREADS,1)
+
+#define FFTPLAN_DFT_FORWARD  0  // complex to complex
+#define FFTPLAN_DFT_BACKWARD 1  // complex to complex, un-normalized
+#define FFTPLAN_REDFT00      2  // real to real, DCT-I on both axes
+#define FFTPLAN_REAL         3  // r2c (p) and un-normalized c2r (q), in-place
+#define FFTPLAN_RODFT00      4  // real to real, DST-I on both axes
+#define FFTPLAN_BLOCKDCT     5  // DCT-II (p) and DCT-III (q) of blocks, in-place
+
+#define FFTPLAN_CACHE 16
+
+struct fftplan {
+	int kind, w, h, n;
+	fftwf_plan p, q;
+	void *in, *out;
+};
+
+#ifdef _OPENMP
+#define FFTPLAN_LOCAL _Thread_local
+#else
+#define FFTPLAN_LOCAL
+#endif
+
+static FFTPLAN_LOCAL struct fftplan fftplan_cache[FFTPLAN_CACHE];
+static FFTPLAN_LOCAL int fftplan_ncache;   // number of valid entries
+static FFTPLAN_LOCAL int fftplan_nextslot; // entry to recycle when full
+static bool fftplan_new_wisdom;
+
+static void fftplan_drop(struct fftplan *t)
+{
+	fftwf_destroy_plan(t->p);
+	if (t->q) fftwf_destroy_plan(t->q);
+	if (t->out != t->in) fftwf_free(t->out);
+	fftwf_free(t->in);
+	t->p = t->q = NULL;
+}
+
+static void fftplan_atexit(void)
+{
+	char *f = getenv("IMSCRIPT_FFTW_WISDOM");
+	if (f && *f && fftplan_new_wisdom)
+		if (!fftwf_export_wisdom_to_filename(f))
+			fprintf(stderr, "WARNING: could not save wisdom \"%s\"\n",
+					f);
+	for (int i = 0; i < fftplan_ncache; i++) // only those of this thread
+		fftplan_drop(fftplan_cache + i);
+	fftplan_ncache = 0;
+#ifdef FFTW_WITH_THREADS
+	fftwf_cleanup_threads();
+#else
+	fftwf_cleanup();
+#endif
+}
+
+// the first call of all: threads, wisdom and cleanup at exit
+static void fftplan_init(void)
+{
+	static bool initialized = false;
+	if (initialized) return;
+	initialized = true;
+
+#ifdef FFTW_WITH_THREADS
+	if (!fftwf_init_threads())
+		fail("could not initialize the FFTW threads");
+	int n = IMSCRIPT_FFTW_THREADS();
+#ifdef _OPENMP
+	if (n < 1) n = omp_get_max_threads();
+#endif
+	fftwf_plan_with_nthreads(n < 1 ? 1 : n);
+#endif//FFTW_WITH_THREADS
+
+	char *f = getenv("IMSCRIPT_FFTW_WISDOM");
+	if (f && *f)
+		fftwf_import_wisdom_from_filename(f); // missing file is fine
+	atexit(fftplan_atexit);
+}
+
+static unsigned fftplan_flags(void)
+{
+	int l = IMSCRIPT_FFTW_PLAN();
+	if (l == 1) return FFTW_MEASURE;
+	if (l >= 2) return FFTW_PATIENT;
+	return FFTW_ESTIMATE;
+}
+
+// create the plan and the buffers of the entry "t" (not thread-safe)
+static void fftplan_create(struct fftplan *t)
+{
+	int kind = t->kind, w = t->w, h = t->h, n = t->n;
+	fftplan_init();
+	if (t->p) // a recycled entry
+		fftplan_drop(t);
+
+	// the non-estimate planners overwrite the buffers, this is fine
+	unsigned flags = fftplan_flags();
+	t->q = NULL;
+	if (kind == FFTPLAN_REAL) {
+		int W = w/2 + 1, s[2] = {h, w}, rs[2] = {h, 2*W}, cs[2] = {h, W};
+		size_t z = W * (size_t)h * n * sizeof(fftwf_complex);
+		t->in = t->out = fftwf_malloc(z);
+		if (!t->in)
+			fail("could not fftwf_malloc %zu bytes", z);
+		t->p = fftwf_plan_many_dft_r2c(2, s, n, t->in, rs, 1, 2*W*h,
+				t->out, cs, 1, W*h, flags);
+		t->q = fftwf_plan_many_dft_c2r(2, s, n, t->out, cs, 1, W*h,
+				t->in, rs, 1, 2*W*h, flags);
+		if (!t->p || !t->q)
+			fail("could not create a FFTW plan of size %dx%d", w, h);
+		if (flags != FFTW_ESTIMATE)
+			fftplan_new_wisdom = true;
+		return;
+	}
+	if (kind == FFTPLAN_BLOCKDCT) {
+		int s[2] = {h, w};
+		fftwf_r2r_kind f[2] = {FFTW_REDFT10, FFTW_REDFT10};
+		fftwf_r2r_kind b[2] = {FFTW_REDFT01, FFTW_REDFT01};
+		size_t z = w * (size_t)h * n * sizeof(float);
+		t->in = t->out = fftwf_malloc(z);
+		if (!t->in)
+			fail("could not fftwf_malloc %zu bytes", z);
+		t->p = fftwf_plan_many_r2r(2, s, n, t->in, NULL, 1, w*h,
+				t->out, NULL, 1, w*h, f, flags);
+		t->q = fftwf_plan_many_r2r(2, s, n, t->out, NULL, 1, w*h,
+				t->in, NULL, 1, w*h, b, flags);
+		if (!t->p || !t->q)
+			fail("could not create a FFTW plan of %d blocks %dx%d",
+					n, w, h);
+		if (flags != FFTW_ESTIMATE)
+			fftplan_new_wisdom = true;
+		return;
+	}
+
+	size_t m = w * (size_t)h;
+	int r2r = kind == FFTPLAN_REDFT00 || kind == FFTPLAN_RODFT00;
+	size_t s = r2r ? sizeof(float) : sizeof(fftwf_complex);
+	t->in = fftwf_malloc(m * s);
+	t->out = fftwf_malloc(m * s);
+	if (!t->in || !t->out)
+		fail("could not fftwf_malloc %zu bytes", 2 * m * s);
+
+	if (kind == FFTPLAN_REDFT00)
+		t->p = fftwf_plan_r2r_2d(h, w, t->in, t->out,
+				FFTW_REDFT00, FFTW_REDFT00, flags);
+	else if (kind == FFTPLAN_RODFT00)
+		t->p = fftwf_plan_r2r_2d(h, w, t->in, t->out,
+				FFTW_RODFT00, FFTW_RODFT00, flags);
+	else
+		t->p = fftwf_plan_dft_2d(h, w, t->in, t->out,
+				kind == FFTPLAN_DFT_FORWARD ?
+				FFTW_FORWARD : FFTW_BACKWARD, flags);
+	if (!t->p)
+		fail("could not create a FFTW plan of size %dx%d", w, h);
+	if (flags != FFTW_ESTIMATE)
+		fftplan_new_wisdom = true;
+}
+
+// get (or create) the plan of the given kind for "n" images of size "w x h"
+// (only the real and the block plans support batches, n > 1)
+static struct fftplan *fftplan_get_many(int kind, int w, int h, int n)
+{
+	if (n > 1 && kind != FFTPLAN_REAL && kind != FFTPLAN_BLOCKDCT)
+		fail("only the real and the block plans can be batched");
+	for (int i = 0; i < fftplan_ncache; i++)
+	{
+		struct fftplan *t = fftplan_cache + i;
+		if (t->kind == kind && t->w == w && t->h == h && t->n == n)
+			return t;
+	}
+
+	struct fftplan *t;
+	if (fftplan_ncache < FFTPLAN_CACHE)
+		t = fftplan_cache + fftplan_ncache++;
+	else {
+		t = fftplan_cache + fftplan_nextslot;
+		fftplan_nextslot = (fftplan_nextslot + 1) % FFTPLAN_CACHE;
+	}
+	t->kind = kind;
+	t->w = w;
+	t->h = h;
+	t->n = n;
+#ifdef _OPENMP
+#pragma omp critical(fftplans)
+#endif
+	fftplan_create(t);
+	return t;
+}
+
+// get (or create) the plan of the given kind for images of size "w x h"
+static struct fftplan *fftplan_get(int kind, int w, int h)
+{
+	return fftplan_get_many(kind, w, h, 1);
+}
+
+// smallest size m >= n whose only prime factors are 2, 3, 5 and 7 (FFTW is
+// much slower on the sizes that have large prime factors)
+static int fftplan_fast_size(int n)
+{
+	for (int m = n > 1 ? n : 1; ; m++)
+	{
+		int k = m;
+		for (int p = 2; p <= 7; p++)
+			while (k % p == 0)
+				k /= p;
+		if (k == 1)
+			return m;
+	}
+}
+
+#endif//_FFTPLANS_C
@@ -1,42 +1,27 @@
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "iio.h"
 
 
 #define xmalloc malloc
-#define FOR(i,n) for(int i=0;i<(n);i++)
 
 
-static int good_modulus(int n, int p)
+// shift of the rows of x by half their size (y = x(i+w/2, j+h/2)), done by
+// two copies per row
+static void fftshift(float *y, float *x, int w, int h, int pd)
 {
-	assert(p);
-	if (p < 0) return good_modulus(n, -p);
-
-	int r;
-	if (n >= 0)
-		r = n % p;
-	else
+	size_t a = w/2 * pd, b = (w - w/2) * pd, n = a + b;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
 	{
-		r = p - (-n) % p;
-		if (r == p)
-			r = 0;
+		float *yj = y + j * n;
+		float *xj = x + ((j + h/2) % h) * n;
+		memcpy(yj, xj + a, b * sizeof*y);
+		memcpy(yj + b, xj, a * sizeof*y);
 	}
-	assert(r >= 0);
-	assert(r < p);
-	return r;
-}
-
-typedef float (*extension_operator_float)(float*,int,int,int,int,int,int);
-
-static float extend_float_image_periodic(float *xx, int w, int h, int pd,
-		int i, int j, int l)
-{
-	float (*x)[w][pd] = (void*)xx;
-	i = good_modulus(i, w);
-	j = good_modulus(j, h);
-	l = good_modulus(l, pd);
-	return x[j][i][l];
 }
 
 int main_fftshift(int c, char *v[])
@@ -51,14 +36,11 @@ int main_fftshift(int c, char *v[])
 
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(in, &w, &h, &pd);
-	float (*y)[w][pd] = xmalloc(w*h*pd*sizeof(float));
-
-	extension_operator_float p = extend_float_image_periodic;
+	float *y = xmalloc(w*h*pd*sizeof(float));
 
-	FOR(j,h) FOR(i,w) FOR(l,pd)
-		y[j][i][l] = p(x, w,h,pd, i+w/2, j+h/2, l);
+	fftshift(y, x, w, h, pd);
 
-	iio_write_image_float_vec(out, y[0][0], w, h, pd);
+	iio_write_image_float_vec(out, y, w, h, pd);
 	free(x);
 	free(y);
 	return EXIT_SUCCESS;
@@ -229,6 +229,10 @@
 #include <string.h>
 #include <math.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 #ifndef __STDC_NO_COMPLEX__
 #include <complex.h>
@@ -239,6 +243,7 @@
 #include "fail.c"
 #include "xmalloc.c"
 #include "random.c"
+#include "quantiles.c"
 #include "parsenumbers.c"
 #include "colorcoordsf.c"
 
@@ -251,6 +256,7 @@
 #define PLAMBDA_MAX_VARLEN 0x100
 #define PLAMBDA_MAX_PIXELDIM 0x100
 #define PLAMBDA_MAX_MAGIC 42
+#define PLAMBDA_MAX_QUANTILES 64
 
 
 #ifndef FORI
@@ -958,6 +964,12 @@ struct image_stats {
 	float component_med[PLAMBDA_MAX_PIXELDIM];
 	float component_sum[PLAMBDA_MAX_PIXELDIM];
 	float *sorted_samples, *sorted_components[PLAMBDA_MAX_PIXELDIM];
+
+	// order statistics computed so far (see image_stats_quantile)
+	int nq;
+	int q_component[PLAMBDA_MAX_QUANTILES]; // -1 for all the samples
+	long q_rank[PLAMBDA_MAX_QUANTILES];
+	float q_value[PLAMBDA_MAX_QUANTILES];
 };
 
 struct linear_statistics {
@@ -1101,6 +1113,36 @@ static void compute_ordered_component_stats(struct image_stats *s,
 	}
 }
 
+// the k-th smallest sample of component c (or of all the samples, if c < 0)
+//
+// Each requested rank is selected once and cached; the images are sorted
+// only when a program asks for too many different ranks.
+static float image_stats_quantile(struct image_stats *s,
+		float *x, int w, int h, int pd, int c, long k)
+{
+	FORI(s->nq)
+		if (s->q_component[i] == c && s->q_rank[i] == k)
+			return s->q_value[i];
+	if (s->nq == PLAMBDA_MAX_QUANTILES) {
+		if (c < 0) {
+			compute_ordered_sample_stats(s, x, w, h, pd);
+			return s->sorted_samples[k];
+		}
+		compute_ordered_component_stats(s, x, w, h, pd);
+		return s->sorted_components[c][k];
+	}
+	float r;
+	long n = w * (long)h * (c < 0 ? pd : 1);
+	quantiles_of_array(&r, c < 0 ? x : x + c, n, c < 0 ? 1 : pd, &k, 1);
+	if (w*h > 1) {
+		s->q_component[s->nq] = c;
+		s->q_rank[s->nq] = k;
+		s->q_value[s->nq] = r;
+		s->nq += 1;
+	}
+	return r;
+}
+
 //static void compute_ordered_vector_stats(struct image_stats *s,
 //		float *x, int w, int h, int pd)
 //{
@@ -1139,6 +1181,7 @@ static int eval_magicvar(float *out, int magic, int img_index, int comp, int qq,
 			t[i].init_vordered = false;
 			t[i].init_csimple = false;
 			t[i].init_cordered = false;
+			t[i].nq = 0;
 		}
 		initt = true;
 	}
@@ -1191,60 +1234,62 @@ static int eval_magicvar(float *out, int magic, int img_index, int comp, int qq,
 		return pd;
 	} else if (magic == 'm' || magic == 'q') {
 		if (comp < 0) { // use all samples
-			compute_ordered_sample_stats(ti, x, w, h, pd);
 			if (magic == 'm') {
-				*out = ti->scalar_med;
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						-1, w*(long)h*pd/2);
 				return 1;
 			}
 			if (magic == 'q') {
 				int qpos = round(qq*w*h*pd/100.0);
 				qpos = bound(0, qpos, w*h*pd-1);
-				*out = ti->sorted_samples[qpos];
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						-1, qpos);
 				return 1;
 			}
 		} else {
-			compute_ordered_component_stats(ti, x, w, h, pd);
 			if (magic == 'm') {
-				*out = ti->component_med[comp];
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						comp, w*(long)h/2);
 				return 1;
 			}
 			if (magic == 'q') {
 				int qpos = round(qq*w*h/100.0);
 				qpos = bound(0, qpos, w*h-1);
-				*out = ti->sorted_components[comp][qpos];
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						comp, qpos);
 				return 1;
 			}
 		}
 	} else if (magic == 'O') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = round(qq*w*h/100.0);
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else if (magic == 'W') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = round(qq*(w*h/1000000.0));
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else if (magic == '0') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = qq;//round(qq*w*h/1000000.0);
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else if (magic == '9') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = w*h-1-qq;//round(qq*w*h/1000000.0);
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else
@@ -2069,11 +2114,34 @@ static float getsample_cfg(float *x, int w, int h, int pd, int i, int j, int l)
 
 typedef float (*getsample_operator_fancy)(struct fancy_image *,int,int,int);
 
+// a rectangle of samples of an image, loaded in memory
+struct flambda_window {
+	struct fancy_image *f;
+	float *x;          // samples of the rectangle, interleaved
+	int x0, y0, w, h;  // position and size of the rectangle
+};
+
+// windows available to the current thread (see run_program_by_tiles)
+static _Thread_local struct flambda_window *global_windows;
+static _Thread_local int global_nwindows;
+
 SMART_PARAMETER_SILENT(FLAMBDA_GETPIXEL,-1)
 static float getsample_cfg_fancy(struct fancy_image *x, int i, int j, int l)
 {
-	// TODO : fancy boundary conditions
+	for (int k = 0; k < global_nwindows; k++)
+	{
+		struct flambda_window *w = global_windows + k;
+		if (w->f != x) continue;
+		int a = i - w->x0;
+		int b = j - w->y0;
+		if (a >= 0 && b >= 0 && a < w->w && b < w->h
+				&& l >= 0 && l < x->pd)
+			return w->x[(b * w->w + a) * x->pd + l];
+	}
+
 	return fancy_image_getsample(x, i, j, l);
+
+	// TODO : fancy boundary conditions
 	//getsample_operator p = get_sample_operator(getsample_1);
 	//int option = PLAMBDA_GETPIXEL();
 	//switch (option) {
@@ -2446,6 +2514,15 @@ static int run_program_vectorially_at_fancy(float *out,
 
 // evaluation (higher level) {{{1
 
+// the output samples are rounded and clamped to [0,flambda_qmax], when it is
+// not zero (option -q)
+static int flambda_qmax;
+
+static float flambda_quantize(float v)
+{
+	if (!flambda_qmax) return v;
+	return v > 0 ? v < flambda_qmax ? floorf(v + 0.5f) : flambda_qmax : 0;
+}
 
 static void run_program_vectorially_fancy(struct fancy_image *out,
 		struct plambda_program *p,
@@ -2470,7 +2547,8 @@ static void run_program_vectorially_fancy(struct fancy_image *out,
 
 		for (int l = 0; l < r; l++)
 		{
-			int R = fancy_image_setsample(out, i, j, l, result[l]);
+			int R = fancy_image_setsample(out, i, j, l,
+					flambda_quantize(result[l]));
 			if (!R)
 				fail("cannot set sample (%d,%d)[%d] to %g!\n",
 					i, j, l, result[l]);
@@ -2479,6 +2557,149 @@ static void run_program_vectorially_fancy(struct fancy_image *out,
 	}
 }
 
+// largest distance to a neighbor accessed by the program
+static int flambda_program_halo(struct plambda_program *p)
+{
+	int r = 0;
+	FORI(p->n) {
+		struct plambda_token *t = p->t + i;
+		if (t->type != PLAMBDA_SCALAR && t->type != PLAMBDA_VECTOR
+				&& t->type != PLAMBDA_IMAGEOP)
+			continue;
+		int d = fmax(abs(t->displacement[0]), abs(t->displacement[1]));
+		if (t->type == PLAMBDA_IMAGEOP)
+			d += 1; // all the imageops are 3x3
+		if (d > r) r = d;
+	}
+	return r;
+}
+
+// whether the program calls the random number generator
+static bool flambda_program_is_random(struct plambda_program *p)
+{
+	FORI(p->n) {
+		struct plambda_token *t = p->t + i;
+		struct predefined_function *f =
+			global_table_of_predefined_functions + t->index;
+		if (t->type == PLAMBDA_OPERATOR && (f->nargs == -1
+				|| f->f == (void(*)(void))random_stable))
+			return true;
+	}
+	return false;
+}
+
+static void flambda_window_load(struct flambda_window *w)
+{
+	int x1 = w->x0 + w->w - 1;
+	int y1 = w->y0 + w->h - 1;
+	if (fancy_image_getrectangle_oct(w->x, w->f, 0, w->x0, w->y0, x1, y1))
+		return;
+	float *o = w->x;
+	for (int j = w->y0; j <= y1; j++)
+	for (int i = w->x0; i <= x1; i++)
+	for (int l = 0; l < w->f->pd; l++)
+		*o++ = fancy_image_getsample(w->f, i, j, l);
+}
+
+SMART_PARAMETER_SILENT(FLAMBDA_TILE,256)
+
+// evaluate the program by tiles of size tw x th, aligned with the tiling
+// of the output image
+//
+// The tiles are processed in batches: the input rectangles of each tile
+// (with a halo for the neighbors) are read sequentially, the tiles are
+// evaluated in parallel from these rectangles, and then written one after
+// the other.
+static void run_program_by_tiles(struct fancy_image *out,
+		struct plambda_program *p,
+		struct fancy_image *val[], int n, int tw, int th)
+{
+	int w = val[0]->w, h = val[0]->h, pd = out->pd;
+	int halo = flambda_program_halo(p);
+	int ntx = (w + tw - 1) / tw;
+	int nty = (h + th - 1) / th;
+
+	int nb = 1; // number of tiles per batch
+#ifdef _OPENMP
+	nb = 4 * omp_get_max_threads();
+#endif
+	if (nb > ntx * nty) nb = ntx * nty;
+
+	int ww = tw + 2 * halo, wh = th + 2 * halo;
+	struct flambda_window (*win)[n] = xmalloc(nb * sizeof*win);
+	float *res[nb];
+	FORI(nb) {
+		res[i] = xmalloc(tw * th * pd * sizeof(float));
+		FORJ(n) {
+			win[i][j].f = val[j];
+			win[i][j].x = xmalloc(ww * wh * val[j]->pd*sizeof(float));
+		}
+	}
+
+	for (int t0 = 0; t0 < ntx * nty; t0 += nb)
+	{
+		int m = nb < ntx * nty - t0 ? nb : ntx * nty - t0;
+		if (h > 3000)
+			fprintf(stderr, "tile %d/%d (%g%%)\n",
+					t0, ntx * nty, t0 * 100.0 / (ntx * nty));
+
+		FORI(m) FORJ(n) {
+			struct flambda_window *x = win[i] + j;
+			x->x0 = ((t0 + i) % ntx) * tw - halo;
+			x->y0 = ((t0 + i) / ntx) * th - halo;
+			x->w = ww;
+			x->h = wh;
+			flambda_window_load(x);
+		}
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int b = 0; b < m; b++)
+		{
+			int x0 = ((t0 + b) % ntx) * tw;
+			int y0 = ((t0 + b) / ntx) * th;
+			int cw = w - x0 < tw ? w - x0 : tw;
+			int ch = h - y0 < th ? h - y0 : th;
+			global_windows = win[b];
+			global_nwindows = n;
+			for (int j = 0; j < ch; j++)
+			for (int i = 0; i < cw; i++)
+			{
+				float *r = res[b] + (j * cw + i) * pd;
+				if (pd != run_program_vectorially_at_fancy(r,
+							p, val, x0 + i, y0 + j))
+					fail("r != out->pd");
+			}
+			global_nwindows = 0;
+		}
+
+		FORI(m)
+		{
+			int x0 = ((t0 + i) % ntx) * tw;
+			int y0 = ((t0 + i) / ntx) * th;
+			int cw = w - x0 < tw ? w - x0 : tw;
+			int ch = h - y0 < th ? h - y0 : th;
+			for (int j = 0; j < ch; j++)
+			for (int k = 0; k < cw; k++)
+			for (int l = 0; l < pd; l++)
+			{
+				float v = flambda_quantize(
+						res[i][(j * cw + k) * pd + l]);
+				if (!fancy_image_setsample(out, x0+k, y0+j, l, v))
+					fail("cannot set sample (%d,%d)[%d] "
+						"to %g!\n", x0+k, y0+j, l, v);
+			}
+		}
+	}
+
+	FORI(nb) {
+		free(res[i]);
+		FORJ(n) free(win[i][j].x);
+	}
+	free(win);
+}
+
 // mains {{{1
 
 static void add_hidden_variables(char *out, int maxplen, int newvars, char *in)
@@ -2532,6 +2753,10 @@ static int main_images(int c, char **v)
 	char *filename_out = pick_option(&c, &v, "o", "-");
 	if (0 == strcmp(filename_out, "-"))
 		fail("flambda requires -o option\n");
+	char *quant = pick_option(&c, &v, "q", "");
+	if (0 == strcmp(quant, "u8")) flambda_qmax = 255;
+	else if (0 == strcmp(quant, "u16")) flambda_qmax = 65535;
+	else if (*quant) fail("unrecognized output type \"%s\"", quant);
 
 	struct plambda_program p[1];
 
@@ -2563,6 +2788,10 @@ static int main_images(int c, char **v)
 	int pdreal = eval_dim(p, x);
 	int tw = 0, th = 0, fmt = 0, bps = 0;
 	fancy_image_leak_tiff_info(&tw, &th, &fmt, &bps, x[0]);
+	if (flambda_qmax) {
+		fmt = 1; // SAMPLEFORMAT_UINT
+		bps = flambda_qmax == 255 ? 8 : 16;
+	}
 	char outopt[2*FILENAME_MAX];
 	snprintf(outopt, 2*FILENAME_MAX,
 		"creat,w=%d,h=%d,spp=%d,tw=%d,th=%d,fmt=%d,bps=%d,verbose=0",
@@ -2570,7 +2799,19 @@ static int main_images(int c, char **v)
 	struct fancy_image *out = fancy_image_open(filename_out, outopt);
 
 	// core
-	run_program_vectorially_fancy(out, p, x);
+	// the tiles pay off when they follow the tiling of the input, or when
+	// there are several threads; the random programs are evaluated in
+	// raster order, as before
+	bool tiles = tw > 0 && th > 0;
+#ifdef _OPENMP
+	tiles = tiles || omp_get_max_threads() > 1;
+#endif
+	if (tw <= 0 || th <= 0)
+		tw = th = FLAMBDA_TILE();
+	if (tiles && n > 0 && !flambda_program_is_random(p))
+		run_program_by_tiles(out, p, x, n, tw, th);
+	else
+		run_program_vectorially_fancy(out, p, x);
 
 	fancy_image_close(out);
 	FORI(n) fancy_image_close(x[i]);
@@ -2604,6 +2845,8 @@ static int print_help(char *v, int verbosity)
 "Usage: %s a.tiff b.tiff c.tiff ... \"EXPRESSION\" -o output.tiff\n"
 "\n"
 "Options:\n"
+" -q type\tstore the output with samples of type u8 or u16 (rounded\n"
+" \t\tand clamped to [0,255] or [0,65535])\n"
 " -h\t\tdisplay short help message\n"
 " --help\t\tdisplay longer help message\n"
 //" --version\tdisplay version\n"
@@ -8,6 +8,10 @@
 #include "xmalloc.c"
 #include "drawsegment.c"
 #include "getpixel.c"
+#include "fastlic.c"
+#define OMIT_MAIN_FONTU
+#include "fontu.c"
+#include "fonts/xfont_5x7.c"
 
 struct float_image {
 	int w, h;
@@ -20,35 +24,79 @@ static void draw_black_pixel(int i, int j, void *data)
 	setsample_0(x->x, x->w, x->h, 1, i, j, 0, 0);
 }
 
-static void draw_black_pixel_aa(int i, int j, float a, void *data)
+static void put_black_ball(float *v, int w, int h, float p, float q)
 {
-	struct float_image *x = data;
-	float v = getsample_0(x->x, x->w, x->h, 1, i, j, 0);
-	v = v * (1 - a);
-	setsample_0(x->x, x->w, x->h, 1, i, j, 0, v);
+	for (int i = -1; i <= 1; i++)
+	for (int j = -1; j <= 1; j++)
+		setsample_0(v, w, h, 1, p+i, q+j, 0, 0);
+}
+
+// a batch of segments, drawn in parallel by bands of rows
+//
+// Each band of rows is drawn by one thread, which traverses all the segments
+// that cross the band, in order, and only draws their pixels inside the band.
+// The pixels are thus darkened in the same order as by drawing the segments
+// one after another, and the result does not depend on the number of threads.
+struct segment_batch {
+	int n, nmax;
+	float (*s)[4];
+};
+
+#define FLOWARR_BAND 32 // rows of a band
+
+struct float_image_band {
+	int w, j0, j1; // rows j0 to j1-1
+	float *x;
+};
+
+static void draw_black_pixel_aa_band(int i, int j, float a, void *data)
+{
+	struct float_image_band *x = data;
+	if (i < 0 || i >= x->w || j < x->j0 || j >= x->j1)
+		return;
+	float *v = x->x + j * x->w + i;
+	*v = *v * (1 - a);
 }
 
-static void put_black_line(float *v, int w, int h,
+static void put_black_line_batch(struct segment_batch *b,
 		float p, float q, float r, float s)
 {
-	struct float_image x = {.w = w, .h = h, .x = v};
-	//traverse_segment(p, q, r, s, draw_black_pixel, &x);
-	traverse_segment_aa2(p, q, r, s, draw_black_pixel_aa, &x);
+	assert(b->n < b->nmax);
+	float *t = b->s[b->n++];
+	t[0] = p; t[1] = q; t[2] = r; t[3] = s;
 }
 
-static void put_black_ball(float *v, int w, int h, float p, float q)
+static void draw_segment_batch(float *v, int w, int h, struct segment_batch *b)
 {
-	for (int i = -1; i <= 1; i++)
-	for (int j = -1; j <= 1; j++)
-		setsample_0(v, w, h, 1, p+i, q+j, 0, 0);
+	int nb = (h + FLOWARR_BAND - 1) / FLOWARR_BAND;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int k = 0; k < nb; k++)
+	{
+		struct float_image_band x = {.w = w, .x = v,
+			.j0 = k * FLOWARR_BAND, .j1 = (k + 1) * FLOWARR_BAND};
+		if (x.j1 > h) x.j1 = h;
+		for (int l = 0; l < b->n; l++)
+		{
+			float *t = b->s[l];
+			// (the traversal touches at most one row beyond the ends)
+			if (fmax(t[1], t[3]) < x.j0 - 2 || fmin(t[1], t[3]) > x.j1 + 1)
+				continue;
+			traverse_segment_aa2(t[0], t[1], t[2], t[3],
+					draw_black_pixel_aa_band, &x);
+		}
+	}
 }
 
 #include "smapa.h"
 SMART_PARAMETER_SILENT(FLOWARR_MAXLEN,100)
 SMART_PARAMETER_SILENT(FLOWARR_MINDOT,1)
 SMART_PARAMETER_SILENT(FLOWARR_DODRAW,3)
+SMART_PARAMETER_SILENT(FLOWARR_LIC,0)
+SMART_PARAMETER_SILENT(FLOWARR_LABEL,0) // opacity of the labels of the cells
 
-static void putarrow(float *x, int w, int h, float p, float q, float u, float v)
+static void putarrow(struct segment_batch *x, float p, float q, float u, float v)
 {
 	float n = hypot(u, v);
 	if (n < FLOWARR_MINDOT())
@@ -58,13 +106,13 @@ static void putarrow(float *x, int w, int h, float p, float q, float u, float v)
 		u *= FLOWARR_MAXLEN()/n;
 		v *= FLOWARR_MAXLEN()/n;
 	}
-	put_black_line(x, w, h, p-u/2, q-v/2, p+u/2, q+v/2);
+	put_black_line_batch(x, p-u/2, q-v/2, p+u/2, q+v/2);
 	if (n > FLOWARR_DODRAW()) {
 		float a[2] = {p+u/2, q+v/2};
 		float b[2] = {p-v/7, q+u/7};
 		float c[2] = {p+v/7, q-u/7};
-		put_black_line(x, w, h, a[0], a[1], b[0], b[1]);
-		put_black_line(x, w, h, a[0], a[1], c[0], c[1]);
+		put_black_line_batch(x, a[0], a[1], b[0], b[1]);
+		put_black_line_batch(x, a[0], a[1], c[0], c[1]);
 	}
 }
 
@@ -73,10 +121,15 @@ static void putarrow(float *x, int w, int h, float p, float q, float u, float v)
 // ff: input flow image
 // s: arrow scaling
 // g: grid spacing
-void flowarrows(float *vv, float *ff, int w, int h, float s, int g)
+// l: batch of labels (optional), where the norm of the mean flow of each cell
+//    is written at its top-left corner
+static void flowarrows_labelled(float *vv, float *ff, int w, int h, float s,
+		int g, struct font_batch *l)
 {
 	float (*f)[w][2] = (void*)ff;
 	int gw = w/g, gh = h/g;
+	struct segment_batch b[1] = {{ .nmax = 3 * gw * gh }};
+	b->s = xmalloc((b->nmax ? b->nmax : 1) * sizeof*b->s);
 	for (int j = 0; j < gh; j++)
 	for (int i = 0; i < gw; i++) {
 		float m[2] = {0, 0}, nm = 0;
@@ -92,8 +145,35 @@ void flowarrows(float *vv, float *ff, int w, int h, float s, int g)
 			}
 		}
 		if (nm > 0)
-			putarrow(vv, w, h, g*i+g/2, g*j+g/2, m[0]/nm, m[1]/nm);
+			putarrow(b, g*i+g/2, g*j+g/2, m[0]/nm, m[1]/nm);
+		if (nm > 0 && l) {
+			char t[32];
+			float black = 0;
+			snprintf(t, sizeof t, "%.1f", s * hypot(m[0], m[1]) / nm);
+			font_batch_string(l, g*i+1, g*j+1, t, &black, NULL,
+					FLOWARR_LABEL());
+		}
 	}
+	draw_segment_batch(vv, w, h, b);
+	if (l)
+		font_batch_draw_float(l, vv, w, h);
+	free(b->s);
+}
+
+void flowarrows(float *vv, float *ff, int w, int h, float s, int g)
+{
+	if (FLOWARR_LABEL() > 0) {
+		struct bitmap_font f[1] = {reformat_font(*xfont_5x7, UNPACKED)};
+		struct font_atlas a[1];
+		struct font_batch l[1];
+		font_atlas_init(a, f);
+		font_batch_init(l, a, 1, 0);
+		flowarrows_labelled(vv, ff, w, h, s, g, l);
+		font_batch_free(l);
+		font_atlas_free(a);
+		free(f->data);
+	} else
+		flowarrows_labelled(vv, ff, w, h, s, g, NULL);
 }
 
 #ifndef OMIT_MAIN
@@ -115,6 +195,13 @@ int main_flowarrows(int c, char *v[])
 	float *y = xmalloc(w*h*sizeof*y);
 	for (int i = 0; i < w*h; i++)
 		y[i] = 255;
+	if (FLOWARR_LIC() > 0) { // light LIC texture as a background
+		int L = lrint(FLOWARR_LIC() / (2 * FASTLIC_STEP));
+		fast_line_integral_convolution(y, x, w, h, L, 4 * L, 0);
+		fastlic_stretch(y, w*h, 0.25);
+		for (int i = 0; i < w*h; i++)
+			y[i] = 128 + 127 * y[i];
+	}
 	flowarrows(y, x, w, h, scale, gridsize);
 	for (int i = 0; i   < w*h; i++)
 		y[i] = (unsigned char)y[i];
@@ -10,57 +10,60 @@
 #include "fail.c"
 #include "xmalloc.c"
 #include "bicubic.c"
+#include "splat.c"
 
-static bool checkbounds(int a, int x, int b)
+// splat -u at the points x+u(x), and keep -u(x) where nothing falls
+// (with ztol >= 0, the points of largest displacement occlude the others)
+static void flowinv_init(float *v, float *u, int w, int h,
+		int kernel, float sigma, float ztol)
 {
-	return a <= x && x < b;
-}
-
-static void flowinv_init(float *v, float *u, int w, int h)
-{
-	float (*U)[w][2] = (void*)u;
-	float (*V)[w][2] = (void*)v;
-
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	for (int l = 0; l < 2; l++)
-		V[j][i][l] = -U[j][i][l];
-
+	float (*p)[2] = xmalloc(w * h * sizeof*p);
+	float *z = ztol >= 0 ? xmalloc(w * h * sizeof*z) : NULL;
+	float *s = xmalloc(w * h * sizeof*s);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 	{
-		float px = i + U[j][i][0];
-		float py = j + U[j][i][1];
-		int ipx = px;
-		int ipy = py;
-		if (checkbounds(0, ipx, w) && checkbounds(0, ipy, h))
-			for (int l = 0; l < 2; l++)
-				V[ipy][ipx][l] = -U[j][i][l];
-		if (checkbounds(0, ipx+1, w) && checkbounds(0, ipy, h))
-			for (int l = 0; l < 2; l++)
-				V[ipy][ipx+1][l] = -U[j][i][l];
-		if (checkbounds(0, ipx, w) && checkbounds(0, ipy+1, h))
-			for (int l = 0; l < 2; l++)
-				V[ipy+1][ipx][l] = -U[j][i][l];
-		if (checkbounds(0, ipx+1, w) && checkbounds(0, ipy+1, h))
-			for (int l = 0; l < 2; l++)
-				V[ipy+1][ipx+1][l] = -U[j][i][l];
+		int k = j * w + i;
+		p[k][0] = i + u[2*k+0];
+		p[k][1] = j + u[2*k+1];
+		if (z) z[k] = -hypot(u[2*k+0], u[2*k+1]);
+		v[2*k+0] = v[2*k+1] = s[k] = 0;
 	}
+	splat_points(v, s, w, h, 2, p, u, z, w * h, kernel, sigma, ztol);
+	for (int k = 0; k < w * h; k++)
+	for (int l = 0; l < 2; l++)
+		v[2*k+l] = s[k] > 0 ? -v[2*k+l] / s[k] : -u[2*k+l];
+	free(p);
+	free(z);
+	free(s);
 }
 
 static void flowinv_iter(float *v, float *u, int w, int h)
 {
 	float (*V)[w][2] = (void*)v;
 
+	// (each pixel only depends on itself, so the update can be in-place)
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
 	{
-		float p[2];
-		float qx = i + V[j][i][0];
-		float qy = j + V[j][i][1];
-		bicubic_interpolation(p, u, w, h, 2, qx, qy);
-		V[j][i][0] = -p[0];
-		V[j][i][1] = -p[1];
+		float q[w][2], p[w][2];
+		for (int i = 0; i < w; i++)
+		{
+			q[i][0] = i + V[j][i][0];
+			q[i][1] = j + V[j][i][1];
+		}
+		bicubic_interpolation_points(p[0], u, w, h, 2, q, w,
+				getsample_1);
+		for (int i = 0; i < w; i++)
+		{
+			V[j][i][0] = -p[i][0];
+			V[j][i][1] = -p[i][1];
+		}
 	}
 }
 
@@ -108,12 +111,13 @@ static void flowinv_printeval(float *v, float *u, int w, int h)
 	fprintf(stderr, "e %g\t%g\n", r1, r2);
 }
 
-static void flowinv(float *v, float *u, int w, int h, int niter, int epsil)
+static void flowinv(float *v, float *u, int w, int h, int niter, int epsil,
+		int kernel, float sigma, float ztol)
 {
 	for (int i = 0; i < w*h*2; i++)
 		v[i] = -u[i];
 	if (epsil > 0)
-		flowinv_init(v, u, w, h);
+		flowinv_init(v, u, w, h, kernel, sigma, ztol);
 
 	//flowinv_printeval(v, u, w, h);
 	for (int i = 0; i < niter; i++)
@@ -123,13 +127,18 @@ static void flowinv(float *v, float *u, int w, int h, int niter, int epsil)
 	}
 }
 
+#include "pickopt.c"
 int main_flowinv(int c, char *v[])
 {
+	float sigma = atof(pick_option(&c, &v, "g", "0"));
+	float ztol = atof(pick_option(&c, &v, "z", "-1"));
 	if (c != 3 && c != 4 && c != 5) {
-		fprintf(stderr, "usage:\n\t%s niter epsil [in [out]]\n", *v);
-		//                          0 1     2      3   4
+		fprintf(stderr, "usage:\n\t"
+			"%s [-g sigma] [-z ztol] niter epsil [in [out]]\n", *v);
+		//       0                       1     2      3   4
 		return EXIT_FAILURE;
 	}
+	int kernel = sigma > 0 ? SPLAT_GAUSSIAN : SPLAT_BILINEAR;
 	int niter = atoi(v[1]);
 	float epsil = atof(v[2]);
 	char *infile = c > 3 ? v[3] : "-";
@@ -139,7 +148,7 @@ int main_flowinv(int c, char *v[])
 	float *x = iio_read_image_float_vec(infile, &w, &h, &pd);
 	if (pd != 2) fail("2D vector field expected");
 	float *y = xmalloc(2*w*h*sizeof*y);
-	flowinv(y, x, w, h, niter, epsil);
+	flowinv(y, x, w, h, niter, epsil, kernel, sigma, ztol);
 	iio_write_image_float_vec(outfile, y, w, h, 2);
 	free(x);
 	free(y);
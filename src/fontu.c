@@ -687,6 +687,277 @@ static void put_string_in_rgb_image(uint8_t *x, int w, int h,
 	}
 }
 
+// glyph atlas
+//
+// The glyphs of an unpacked font are stored as the lists of the horizontal
+// runs of their foreground pixels, so that a glyph is drawn by filling a few
+// spans of pixels instead of testing each bit of its cell.  The atlas is
+// built once per font, and it is not modified afterwards, so that it can be
+// shared by several threads.
+struct font_run { short j, i0, i1; }; // the pixels i0 to i1-1 of the row j
+
+struct font_atlas {
+	int w, h, n;           // size and number of the glyphs
+	int *start;            // runs of glyph c: run[start[c]] to run[start[c+1]-1]
+	struct font_run *run;  // (sorted by row, and by column within each row)
+};
+
+static void font_atlas_init(struct font_atlas *a, struct bitmap_font *f)
+{
+	assert(f->packing == UNPACKED);
+	a->w = f->width;
+	a->h = f->height;
+	a->n = f->number_of_glyphs;
+	a->start = xmalloc((a->n + 1) * sizeof*a->start);
+	a->run = NULL;
+	for (int pass = 0; pass < 2; pass++) // count the runs, then fill them
+	{
+		int k = 0;
+		for (int c = 0; c < a->n; c++)
+		{
+			a->start[c] = k;
+			for (int j = 0; j < a->h; j++)
+			{
+				unsigned char *r = f->data + (c*a->h + j)*a->w;
+				for (int i = 0; i < a->w; i++)
+				if (r[i] && (!i || !r[i-1]))
+				{
+					int i1 = i + 1;
+					while (i1 < a->w && r[i1])
+						i1 += 1;
+					if (pass)
+						a->run[k] = (struct font_run){j, i, i1};
+					k += 1;
+				}
+			}
+		}
+		a->start[a->n] = k;
+		if (!pass)
+			a->run = xmalloc((k ? k : 1) * sizeof*a->run);
+	}
+}
+
+static void font_atlas_free(struct font_atlas *a)
+{
+	free(a->start);
+	free(a->run);
+}
+
+// batch of strings, drawn in parallel by bands of rows
+//
+// The strings are recorded, in order, into a batch, which cuts them into
+// glyphs (with the same layout as "put_string_in_float_image").  Then, the
+// glyphs are binned by the bands of rows that they cross, and each band is
+// drawn by one thread, which draws its glyphs in the order of the batch and
+// clipped to the band.  The result is thus the same as drawing the strings
+// one after another, and it does not depend on the number of threads.
+//
+// The glyphs are blended over the image with the opacity "alpha" of their
+// string: the foreground pixels with the color fg, and the other pixels of
+// the cell with the color bg (when there is one).  With alpha=1 the colors
+// are copied, as by "put_string_in_float_image".  Over images of bytes, the
+// colors are given as floats and the results are rounded and saturated.
+#define FONT_BAND 32 // rows of a band
+
+struct font_glyph { int x, y, c, k; }; // glyph c at (x,y), of the string k
+
+struct font_batch {
+	struct font_atlas *a;
+	int pd, kerning;
+
+	int n, nmax;   // strings
+	float *color;  // colors fg and bg of the string k, at color+2*pd*k
+	float *alpha;  // opacity of the string k
+	bool *bg;      // whether the string k has a background
+
+	int ng, ngmax; // glyphs
+	struct font_glyph *g;
+};
+
+static void font_batch_init(struct font_batch *b, struct font_atlas *a,
+		int pd, int kerning)
+{
+	b->a = a;
+	b->pd = pd;
+	b->kerning = kerning;
+	b->n = b->ng = 0;
+	b->nmax = b->ngmax = 64;
+	b->color = xmalloc(b->nmax * 2 * pd * sizeof*b->color);
+	b->alpha = xmalloc(b->nmax * sizeof*b->alpha);
+	b->bg = xmalloc(b->nmax * sizeof*b->bg);
+	b->g = xmalloc(b->ngmax * sizeof*b->g);
+}
+
+static void font_batch_free(struct font_batch *b)
+{
+	free(b->color);
+	free(b->alpha);
+	free(b->bg);
+	free(b->g);
+}
+
+// add the string s with its top-left corner at (posx,posy), of colors fg and
+// bg (a transparent background when bg is NULL) and of opacity alpha
+static void font_batch_string(struct font_batch *b, int posx, int posy,
+		char *sstring, float *fg, float *bg, float alpha)
+{
+	if (!(alpha > 0))
+		return;
+	if (b->n == b->nmax) {
+		b->nmax *= 2;
+		b->color = xrealloc(b->color, b->nmax*2*b->pd*sizeof*b->color);
+		b->alpha = xrealloc(b->alpha, b->nmax * sizeof*b->alpha);
+		b->bg = xrealloc(b->bg, b->nmax * sizeof*b->bg);
+	}
+	int k = b->n++;
+	float *c = b->color + 2 * b->pd * k;
+	for (int l = 0; l < b->pd; l++)
+	{
+		c[l] = fg[l];
+		c[b->pd + l] = bg ? bg[l] : 0;
+	}
+	b->alpha[k] = alpha < 1 ? alpha : 1;
+	b->bg[k] = bg;
+
+	struct font_atlas *a = b->a;
+	unsigned char *string = (unsigned char *)sstring;
+	int posx0 = posx;
+	while (1)
+	{
+		int c = *string++;
+		if (!c) { break;
+		} else if (c == '\n') { posy += a->h; posx = posx0;
+		} else if (c == '\t') { posx += 8 * (a->w + b->kerning);
+		} else if (c == '\b') { posx -= 1 * (a->w + b->kerning);
+		} else if (c > 0 && c < a->n)
+		{
+			if (b->ng == b->ngmax) {
+				b->ngmax *= 2;
+				b->g = xrealloc(b->g, b->ngmax * sizeof*b->g);
+			}
+			b->g[b->ng++] = (struct font_glyph){posx, posy, c, k};
+			posx += a->w + b->kerning;
+		}
+	}
+}
+
+// blend the color c over the pixels i0 to i1-1 of the row j
+static void font_batch_span(struct font_batch *b, float *xf, uint8_t *xb,
+		int w, int j, int i0, int i1, float *c, float alpha)
+{
+	int pd = b->pd;
+	if (i0 < 0) i0 = 0;
+	if (i1 > w) i1 = w;
+	for (int i = i0; i < i1; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		long o = (j * (long)w + i) * pd + l;
+		if (xf)
+			xf[o] = alpha < 1 ? xf[o] + alpha * (c[l] - xf[o]) : c[l];
+		else {
+			float v = alpha < 1 ? xb[o] + alpha * (c[l] - xb[o]) : c[l];
+			xb[o] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)(v + 0.5);
+		}
+	}
+}
+
+// the bands crossed by the visible part of the glyph g
+static bool font_batch_bands(struct font_batch *b, int w, int h,
+		struct font_glyph *g, int *t0, int *t1)
+{
+	int y0 = g->y > 0 ? g->y : 0;
+	int y1 = g->y + b->a->h < h ? g->y + b->a->h : h;
+	if (y0 >= y1 || g->x >= w || g->x + b->a->w <= 0)
+		return false;
+	*t0 = y0 / FONT_BAND;
+	*t1 = (y1 - 1) / FONT_BAND;
+	return true;
+}
+
+// draw the glyph g inside the rows j0 to j1-1
+static void font_batch_glyph(struct font_batch *b, float *xf, uint8_t *xb,
+		int w, int j0, int j1, struct font_glyph *g)
+{
+	struct font_atlas *a = b->a;
+	struct font_run *r = a->run + a->start[g->c];
+	struct font_run *re = a->run + a->start[g->c + 1];
+	float *fg = b->color + 2 * b->pd * g->k, *bg = fg + b->pd;
+	float alpha = b->alpha[g->k];
+	bool has_bg = b->bg[g->k];
+	int ja = g->y > j0 ? g->y : j0;
+	int jb = g->y + a->h < j1 ? g->y + a->h : j1;
+	for (int jj = ja; jj < jb; jj++)
+	{
+		int j = jj - g->y, i = 0;
+		while (r < re && r->j < j)
+			r++;
+		for (; r < re && r->j == j; r++)
+		{
+			if (has_bg)
+				font_batch_span(b, xf, xb, w, jj,
+						g->x + i, g->x + r->i0, bg, alpha);
+			font_batch_span(b, xf, xb, w, jj,
+					g->x + r->i0, g->x + r->i1, fg, alpha);
+			i = r->i1;
+		}
+		if (has_bg)
+			font_batch_span(b, xf, xb, w, jj,
+					g->x + i, g->x + a->w, bg, alpha);
+	}
+}
+
+static void font_batch_draw_any(struct font_batch *b, float *xf, uint8_t *xb,
+		int w, int h)
+{
+	// indices of the glyphs, sorted by band (in order within each band)
+	int nb = (h + FONT_BAND - 1) / FONT_BAND, t0, t1, ni = 0;
+	int *start = xmalloc((nb + 1) * sizeof*start);
+	for (int t = 0; t <= nb; t++)
+		start[t] = 0;
+	for (int k = 0; k < b->ng; k++)
+		if (font_batch_bands(b, w, h, b->g + k, &t0, &t1))
+			for (int t = t0; t <= t1; t++)
+				start[t + 1] += 1, ni += 1;
+	for (int t = 0; t < nb; t++)
+		start[t + 1] += start[t];
+	int *idx = xmalloc((ni ? ni : 1) * sizeof*idx);
+	for (int k = 0; k < b->ng; k++)
+		if (font_batch_bands(b, w, h, b->g + k, &t0, &t1))
+			for (int t = t0; t <= t1; t++)
+				idx[start[t]++] = k;
+	for (int t = nb; t > 0; t--)
+		start[t] = start[t - 1];
+	start[0] = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int t = 0; t < nb; t++)
+	{
+		int j0 = t * FONT_BAND;
+		int j1 = j0 + FONT_BAND < h ? j0 + FONT_BAND : h;
+		for (int k = start[t]; k < start[t + 1]; k++)
+			font_batch_glyph(b, xf, xb, w, j0, j1, b->g + idx[k]);
+	}
+
+	free(idx);
+	free(start);
+	b->n = b->ng = 0;
+}
+
+// draw the batch over an image of w*h pixels of b->pd floats, and empty it
+static void font_batch_draw_float(struct font_batch *b, float *x, int w, int h)
+{
+	font_batch_draw_any(b, x, NULL, w, h);
+}
+
+// draw the batch over an image of w*h pixels of b->pd bytes, and empty it
+static void font_batch_draw_uint8(struct font_batch *b, uint8_t *x,
+		int w, int h)
+{
+	font_batch_draw_any(b, NULL, x, w, h);
+}
+
 #ifndef OMIT_MAIN_FONTU
 #define MAIN_FONTU
 #endif//OMIT_MAIN_FONTU
@@ -817,9 +1088,14 @@ static int main_puts(int c, char **v)
 	if (pd == (int)strlen(bgcolorname))
 		for (int i = 0; i < pd; i++)
 			bg[i] = (unsigned char)((255*(bgcolorname[i]-'0'))/8);
-	put_string_in_float_image(x, w,h,pd, px,py,
-			fg, *bgcolorname=='t'?0:bg,
-			kerning, f, text);
+	struct font_atlas a[1];
+	struct font_batch b[1];
+	font_atlas_init(a, f);
+	font_batch_init(b, a, pd, kerning);
+	font_batch_string(b, px, py, text, fg, *bgcolorname=='t'?0:bg, 1);
+	font_batch_draw_float(b, x, w, h);
+	font_batch_free(b);
+	font_atlas_free(a);
 
 	iio_write_image_float_vec(filename_out, x, w, h, pd);
 
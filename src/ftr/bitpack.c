@@ -0,0 +1 @@
+../bitpack.c
\ No newline at end of file
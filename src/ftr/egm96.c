@@ -6,7 +6,10 @@
 #include <math.h>
 #include "iio.h"
 
-// location of data file
+// the geoid is given as a grid of 0.25 degrees, that is interpolated
+// (the grid is loaded on the first call, that can be made from any thread)
+
+// location of data file (unless the environment variable EGM96 is set)
 #define EGM96_025_TIF "/home/coco/.srtm4/egm96_025.tiff"
 
 
@@ -67,32 +70,63 @@ static float bilinear_interpolation_at(float *x, int w, int h, float p, float q)
 	return r;
 }
 
+static void egm96_load(int w, int h)
+{
+	char *filename = getenv("EGM96");
+	if (!filename) filename = EGM96_025_TIF;
+	int ww, hh;
+	float *tmp = iio_read_image_float(filename, &ww, &hh);
+	if (!tmp || ww != 1+w || hh != 1+h)
+		fprintf(stderr, "WARNING: could not read EGM96 data\n");
+	else if (tmp) {
+		// remove repeated last column
+		float *x = global_egm96_025_data;
+		for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+			x[j*w + i] = tmp[j*(w + 1) + i];
+		free(tmp);
+	}
+}
+
 // evaluate the egm96 geoid at the requested site, expressed in degrees
 double egm96(double longitude, double latitude)
 {
-	static bool firstcall = true;
+	static bool loaded = false;
 	int w = 1440;
 	int h = 720;
-	if (firstcall) {
-		int ww, hh;
-		float *tmp = iio_read_image_float(EGM96_025_TIF, &ww, &hh);
-		if (!tmp || ww != 1+w || hh != 1+h)
-			fprintf(stderr, "WARNING: could not read EGM96 data\n");
-		else if (tmp) {
-			// remove repeated last column
-			float *x = global_egm96_025_data;
-			for (int j = 0; j < h; j++)
-			for (int i = 0; i < w; i++)
-				x[j*w + i] = tmp[j*(w + 1) + i];
-			free(tmp);
+	bool l;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+	l = loaded;
+	if (!l) {
+#ifdef _OPENMP
+#pragma omp critical(egm96)
+#endif
+		if (!loaded) {
+			egm96_load(w, h);
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+			loaded = true;
 		}
-		firstcall = false;
 	}
 	float fi = 4 * longitude;
 	float fj = 4 * (90 - latitude);
 	return bilinear_interpolation_at(global_egm96_025_data, w, h, fi, fj);
 }
 
+// evaluate the geoid at the n sites (lon[k], lat[k]), in parallel
+void egm96_many(double *out, double *lon, double *lat, int n)
+{
+	egm96(0, 0); // load it now
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int k = 0; k < n; k++)
+		out[k] = egm96(lon[k], lat[k]);
+}
+
 #ifdef MAIN_EGM96
 int main(int c, char *v[])
 {
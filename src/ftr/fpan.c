@@ -307,6 +307,10 @@ static void pan_exposer(struct FTR *f, int b, int m, int x, int y)
 {
 	struct pan_state *e = f->userdata;
 
+	// (the pyramid is in memory, so the rows can be painted in parallel)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
 	for (int j = 0; j < f->h; j++)
 	for (int i = 0; i < f->w; i++)
 	{
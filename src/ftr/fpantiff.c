@@ -5,6 +5,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "tiff_octaves_rw.c"
 
 #ifndef FTR_BACKEND
@@ -13,6 +17,7 @@
 #include "ftr.h"
 
 #define WHEEL_FACTOR 1.4
+#define FPANTIFF_COARSE 2 // octaves of the first, quick, paint of a new view
 
 
 // data structure for the image viewer
@@ -36,6 +41,11 @@ struct pan_state {
 	bool do_preview;
 	int preview_position_x;
 	int preview_position_y;
+
+	// 4. progressive repaints
+	int coarse;          // octaves above the nominal one (while refining)
+	bool ring;           // whether to read the tiles around the view
+	double pan_x, pan_y; // last displacement of the view, in window pixels
 };
 
 // change of coordinates: from window "int" pixels to image "double" point
@@ -94,8 +104,25 @@ static float slog(float x)
 	return NAN;
 }
 
-// evaluate the value a position (p,q) in image coordinates
-static void pixel(float *out, struct pan_state *e, double p, double q)
+// octave that is k steps coarser than the nominal one, if the files have it
+static int coarser_octave(struct pan_state *e, int k)
+{
+	int o = e->octave < 0 ? 0 : e->octave;
+	int r = o + (k > 0 ? k : 0);
+	while (r > o && !tiff_octaves_has_octave(e->t, r))
+		r -= 1;
+	return r;
+}
+
+// size of the pixels of octave o, in pixels of the image
+static double octave_factor(struct pan_state *e, int o)
+{
+	if (o == e->octave) return 1/e->zoom_factor;
+	return 1 << o;
+}
+
+// evaluate the value a position (p,q) in image coordinates, at octave o
+static void pixel(float *out, struct pan_state *e, int o, double p, double q)
 {
 	if (p < 0 || q < 0 || p > e->t->i->w-1 || q > e->t->i->h-1) {
 		int ip = p-256;
@@ -119,10 +146,13 @@ static void pixel(float *out, struct pan_state *e, double p, double q)
 	int spp = e->t->i->spp;
 	int ss = bps / 8;
 
-	double factor = 1.0/e->zoom_factor;
-	int o = e->octave;
-	if (o < 0) { o = 0; factor = 1; }
-	char *pix = tiff_octaves_getpixel(e->t, o, p/factor, q/factor);
+	double factor = octave_factor(e, o);
+	double buf[20]; // (a copy, so that it can be called from many threads)
+	char *pix = (char*)buf;
+	if (!tiff_octaves_getpixel_copy(pix, e->t, o, p/factor, q/factor)) {
+		out[0] = out[1] = out[2] = 0;
+		return;
+	}
 
 	out[0] = from_sample_to_double(pix, fmt, bps);
 	if (spp >= 3) {
@@ -147,6 +177,70 @@ static void pixel(float *out, struct pan_state *e, double p, double q)
 			out[i] = slog(out[i]);
 }
 
+// read the tiles of octave o that are under the window, enlarged by (mx,my)
+// window pixels on each side, and by (dx,dy) more on the side they point to
+static void prefetch_view(struct FTR *f, int o, int mx, int my,
+		double dx, double dy)
+{
+	struct pan_state *e = f->userdata;
+	double p[2], q[2], fac = octave_factor(e, o);
+	window_to_image(p, e, -mx + fmin(dx, 0), -my + fmin(dy, 0));
+	window_to_image(q, e, f->w + mx + fmax(dx, 0), f->h + my + fmax(dy, 0));
+	int x0 = floor(p[0] / fac), y0 = floor(p[1] / fac);
+	int x1 = ceil(q[0] / fac), y1 = ceil(q[1] / fac);
+	int n = 1;
+#ifdef _OPENMP
+	n = omp_get_max_threads();
+#endif
+	tiff_octaves_prefetch(e->t, o, x0, y0, x1 - x0 + 1, y1 - y0 + 1, n);
+}
+
+// CALLBACK: pan_idle
+//
+// After a change of the view, it is first painted a few octaves coarser than
+// needed, which requires only a few tiles.  Then, when there are no pending
+// events, this handler reads the tiles of the next finer octave and asks for
+// a new paint, until the nominal octave is reached.  Finally, it reads the
+// tiles around the view, and more of them in the direction of the last
+// displacement, so that the next movements find them in the cache.
+static void pan_idle(struct FTR *f, int k, int m, int x, int y)
+{
+	(void)k; (void)m; (void)x; (void)y;
+	struct pan_state *e = f->userdata;
+	if (e->do_preview) { // nothing to refine
+		ftr_set_handler(f, "idle", NULL);
+		return;
+	}
+	if (e->coarse > 0) {
+		int oc = coarser_octave(e, e->coarse);
+		while (e->coarse > 0 && coarser_octave(e, e->coarse) == oc)
+			e->coarse -= 1;
+		int on = coarser_octave(e, e->coarse);
+		if (on != oc) {
+			prefetch_view(f, on, 0, 0, 0, 0);
+			f->changed = 1;
+			return;
+		}
+	}
+	if (e->ring) {
+		double dx = e->pan_x > 0 ? f->w : e->pan_x < 0 ? -f->w : 0;
+		double dy = e->pan_y > 0 ? f->h : e->pan_y < 0 ? -f->h : 0;
+		prefetch_view(f, coarser_octave(e, 0), f->w/2, f->h/2, dx, dy);
+		e->ring = false;
+	}
+	ftr_set_handler(f, "idle", NULL);
+}
+
+// the view has moved: paint it coarse now, and refine it later
+static void request_progressive_repaint(struct FTR *f)
+{
+	struct pan_state *e = f->userdata;
+	e->coarse = FPANTIFF_COARSE;
+	e->ring = true;
+	ftr_set_handler(f, "idle", pan_idle);
+	f->changed = 1;
+}
+
 static void action_print_value_under_cursor(struct FTR *f, int x, int y)
 {
 	if (x<f->w && x>=0 && y<f->h && y>=0) {
@@ -154,7 +248,7 @@ static void action_print_value_under_cursor(struct FTR *f, int x, int y)
 		double p[2];
 		window_to_image(p, e, x, y);
 		float v[3];
-		pixel(v, e, p[0], p[1]);
+		pixel(v, e, coarser_octave(e, 0), p[0], p[1]);
 		fprintf(stderr, "%g %g, value %g\n",p[0],p[1],v[0]);
 		//float c[3];
 		//interpolate_at(c, e->frgb, e->w, e->h, p[0], p[1]);
@@ -167,8 +261,10 @@ static void action_offset_viewport(struct FTR *f, int dx, int dy)
 	struct pan_state *e = f->userdata;
 	e->offset_x -= dx/e->zoom_factor;
 	e->offset_y -= dy/e->zoom_factor;
+	e->pan_x = -dx;
+	e->pan_y = -dy;
 
-	f->changed = 1;
+	request_progressive_repaint(f);
 }
 
 static void action_reset_zoom_and_position(struct FTR *f)
@@ -189,8 +285,9 @@ static void action_reset_zoom_and_position(struct FTR *f)
 		e->zoom_factor = e->t->i->w / (double)e->pw;
 		fprintf(stderr, "preview zoom factor %g\n", e->zoom_factor);
 	}
+	e->pan_x = e->pan_y = 0;
 
-	f->changed = 1;
+	request_progressive_repaint(f);
 }
 
 static void action_exit_preview(struct FTR *f, int x, int y)
@@ -202,7 +299,8 @@ static void action_exit_preview(struct FTR *f, int x, int y)
 	e->offset_x = x*e->zoom_factor - e->pw/2;
 	e->offset_y = y*e->zoom_factor - e->ph/2;
 	e->zoom_factor = 1;
-	f->changed = 1;
+	e->pan_x = e->pan_y = 0;
+	request_progressive_repaint(f);
 }
 
 static void action_contrast_change(struct FTR *f, float afac, float bshift)
@@ -242,7 +340,7 @@ static void action_center_contrast_at_point(struct FTR *f, int x, int y)
 	double p[2];
 	window_to_image(p, e, x, y);
 	float c[3];
-	pixel(c, e, p[0], p[1]);
+	pixel(c, e, coarser_octave(e, 0), p[0], p[1]);
 	float C = (c[0] + c[1] + c[2])/3;
 
 	e->b = 127.5 - e->a * C;
@@ -257,7 +355,7 @@ static void action_base_contrast_at_point(struct FTR *f, int x, int y)
 	double p[2];
 	window_to_image(p, e, x, y);
 	float c[3];
-	pixel(c, e, p[0], p[1]);
+	pixel(c, e, coarser_octave(e, 0), p[0], p[1]);
 	float C = (c[0] + c[1] + c[2])/3;
 
 	e->b =  255 - e->a * C;
@@ -289,8 +387,9 @@ static void action_change_zoom_to_factor(struct FTR *f, int x, int y, double F)
 	e->offset_x = c[0] - x/e->zoom_factor;
 	e->offset_y = c[1] - y/e->zoom_factor;
 	fprintf(stderr, "\t zoom changed to %g {%g %g}\n", e->zoom_factor, e->offset_x, e->offset_y);
+	e->pan_x = e->pan_y = 0;
 
-	f->changed = 1;
+	request_progressive_repaint(f);
 }
 
 //static void action_change_zoom_by_factor(struct FTR *f, int x, int y, double F)
@@ -428,7 +527,14 @@ static void pan_exposer(struct FTR *f, int b, int m, int x, int y)
 
 	if (e->do_preview) {dump_preview(f); return;}
 
+	// read the needed tiles at once, then paint the rows in parallel
+	int o = coarser_octave(e, e->coarse);
+	prefetch_view(f, o, 0, 0, 0, 0);
+
 	// for every pixel in the window
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
 	for (int j = 0; j < f->h; j++)
 	for (int i = 0; i < f->w; i++)
 	{
@@ -438,7 +544,7 @@ static void pan_exposer(struct FTR *f, int b, int m, int x, int y)
 
 		// evaluate the color value of the image at this position
 		float c[3];
-		pixel(c, e, p[0], p[1]);
+		pixel(c, e, o, p[0], p[1]);
 
 		// transform the value into RGB using the contrast change (a,b)
 		unsigned char *dest = f->rgb + 3 * (j * f->w + i);
@@ -605,6 +711,9 @@ int main_fpantiff(int c, char *v[])
 	e->do_preview = false;
 	e->a = 1;
 	e->b = 0;
+	e->coarse = 0;
+	e->ring = false;
+	e->pan_x = e->pan_y = 0;
 	if (*filename_preview) add_preview(e, filename_preview);
 
 	// open window
@@ -11,7 +11,7 @@ struct FTR {
 	void *userdata; // ignored by the library
 
 	// hidden implementation details
-	char pad[200];
+	char pad[256];
 };
 
 // type of a handler function
@@ -24,6 +24,10 @@ void ftr_fork_window_with_image_uint8_rgb(unsigned char *i, int w, int h);
 void ftr_change_title(struct FTR *f, char *title);
 void ftr_close(struct FTR *f);
 
+// tell that only the rectangle (x,y,w,h) of rgb has changed (the next
+// update only sends the union of the marked rectangles, if the backend can)
+void ftr_mark_dirty(struct FTR *f, int x, int y, int w, int h);
+
 // blocking calls
 void ftr_wait_for_mouse_click(struct FTR *f, int *x, int *y);
 void ftr_wait_for_mouse_click3(struct FTR *f, int *x, int *y, int *b);
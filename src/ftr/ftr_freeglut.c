@@ -50,6 +50,13 @@ void ftr_change_title(struct FTR *ff, char *s)
 {
 }
 
+// this backend always sends the whole image
+void ftr_mark_dirty(struct FTR *f, int x, int y, int w, int h)
+{
+	(void)x; (void)y; (void)w; (void)h;
+	f->changed = 1;
+}
+
 // glut-specific part {{{1
 
 // global variable
@@ -32,6 +32,9 @@ struct _FTR {
 	int max_w, max_h;
 	int stop_loop;
 
+	// quantized image sent on the previous dump, to send only the changes
+	uint8_t *prev;
+	int prev_w, prev_h;
 };
 
 // Check that _FTR can fit inside a FTR
@@ -113,100 +116,129 @@ static int sidx(uint8_t *rgb) // sixel index identifier
 	//return 32*(rgb[0]/32) + 4*(rgb[1]/32) + rgb[2]/64;
 }
 
-static void dump_sixels_to_bytestream_rgb3(
+// one row of sixels b[0..w-1] (values 0..63), run-length encoded
+static void bs_sixel_row(struct bytestream *out, uint8_t *b, int w)
+{
+	while (w > 0 && !b[w-1]) w -= 1; // the empty sixels at the end
+	for (int i = 0; i < w;)
+	{
+		int r = 1;
+		while (i + r < w && b[i+r] == b[i])
+			r += 1;
+		if (r < 3)
+			for (int l = 0; l < r; l++)
+				bs_putchar(out, 63 + b[i]);
+		else
+			bs_printf(out, "!%d%c", r, 63 + b[i]);
+		i += r;
+	}
+}
+
+// image of palette indices q (values < nc) as sixels
+//
+// The bitmasks of all the colors of a band are filled in a single pass over
+// its pixels, and only the colors that appear are defined and sent.  If p is
+// not NULL, it is the previous frame (of the same size) and the bands that
+// did not change are skipped: the image has a transparent background, so
+// that the terminal keeps the old pixels there.
+static void dump_sixels_to_bytestream_idx(
 		struct bytestream *out,
-		uint8_t *x, int w, int h)
+		uint8_t *q, uint8_t *p, int w, int h,
+		char (*pal)[24], int nc)
 {
-	bs_puts(out, "\033Pq\n");
-	for (int i = 0; i < 0x100; i++)
-		bs_printf(out, "#%d;2;%d;%d;%d", i,
-				(int)(14.2857*(i/32)),
-				(int)(14.2857*((i/4)%8)),
-				(int)(33.3333*(i%4)));
-	for (int j = 0; j < h/6; j++)
+	int nb = (h + 5) / 6;
+	bool used[0x100] = {0}, *skip = malloc(nb * sizeof*skip);
+	for (int j = 0; j < nb; j++)
+	{
+		int nl = h - 6*j < 6 ? h - 6*j : 6;
+		uint8_t *a = q + 6*j*w;
+		skip[j] = p && !memcmp(a, p + 6*j*w, nl*w);
+		if (!skip[j])
+			for (int i = 0; i < nl*w; i++)
+				used[a[i]] = true;
+	}
+	bs_puts(out, p ? "\033P0;1q\n" : "\033Pq\n");
+	for (int k = 0; k < nc; k++)
+		if (used[k])
+			bs_puts(out, pal[k]);
+	uint8_t *b = malloc(nc * w);
+	memset(b, 0, nc * w);
+	for (int j = 0; j < nb; j++)
 	{
+		int nl = h - 6*j < 6 ? h - 6*j : 6;
+		uint8_t *a = q + 6*j*w;
+		if (skip[j])
+		{
+			bs_puts(out, "-\n");
+			continue;
+		}
 		int m[0x100] = {0}, c = 0;
-		for (int i = 0; i < 6*w; i++)
+		for (int l = 0; l < nl; l++)
+		for (int i = 0; i < w; i++)
 		{
-			int k = sidx(x+3*(6*j*w+i));
-			if (!m[k]) c += 1;
-			m[k] += 1;
+			int k = a[l*w+i];
+			c += !m[k];
+			m[k] = 1;
+			b[k*w+i] |= 1 << l;
 		}
-		for (int k = 0; k < 0x100; k++)
+		for (int k = 0; k < nc; k++)
 		if (m[k])
 		{
-			int b[w], r[w], R[w], n = 0;
-			c -= 1;
-			for (int i = 0; i < w; i++)
-			{
-				int s = 0;
-				for (int l = 5; l >= 0; l--)
-					s = 2*s + (k==sidx(x+3*((6*j+l)*w+i)));
-				b[i] = s + 63;
-			}
-			for (int i = 0; i < w; i++)
-				R[i] = 1;
-			r[0] = *b;
-			for (int i = 1; i < w; i++)
-				if (b[i] == r[n])
-					R[n] += 1;
-				else
-					r[++n] = b[i];
 			bs_printf(out, "#%d", k);
-			for (int i = 0; i <= n; i++)
-				if (R[n] < 3)
-					for (int l = 0; l < R[i]; l++)
-						bs_putchar(out, r[i]);
-				else
-					bs_printf(out, "!%d%c", R[i], r[i]);
-			bs_puts(out, c ? "$\n" : "-\n");
+			bs_sixel_row(out, b + k*w, w);
+			memset(b + k*w, 0, w);
+			bs_puts(out, --c ? "$\n" : "-\n");
 		}
 	}
+	free(b);
+	free(skip);
 	bs_puts(out, "\033\\");
 }
 
+static void dump_sixels_to_bytestream_rgb3(
+		struct bytestream *out,
+		uint8_t *x, int w, int h)
+{
+	static char pal[0x100][24]; // color definitions, printed only once
+	if (!*pal[0])
+		for (int i = 0; i < 0x100; i++)
+			snprintf(pal[i], 24, "#%d;2;%d;%d;%d", i,
+					(int)(14.2857*(i/32)),
+					(int)(14.2857*((i/4)%8)),
+					(int)(33.3333*(i%4)));
+	uint8_t *q = malloc(w*h);
+	for (int i = 0; i < w*h; i++)
+		q[i] = sidx(x + 3*i);
+	dump_sixels_to_bytestream_idx(out, q, NULL, w, h, pal, 0x100);
+	free(q);
+}
+
+// gray palette of 0x100/Q levels
+static char (*sixel_palette_gray(int Q))[24]
+{
+	static char pal[0x100][24];
+	static int q = 0;
+	if (q != Q)
+		for (int i = 0; i < 0x100/Q; i++)
+			snprintf(pal[i], 24, "#%d;2;%d;%d;%d",
+				i, (int)(Q*.39*i), (int)(Q*.39*i), (int)(Q*.39*i));
+	q = Q;
+	return pal;
+}
+
+#define SIXEL_GRAY_Q (1<<4) // quantization over [0..255]
+
 static void dump_sixels_to_bytestream_gray2(
 		struct bytestream *out,
 		uint8_t *x, int w, int h)
 {
-	int Q = (1<<4); // quantization over [0..255]
-	bs_printf(out, "\033Pq\n");
-	for (int i = 0; i < 0x100/Q; i++)
-		bs_printf(out, "#%d;2;%d;%d;%d",
-			i, (int)(Q*.39*i), (int)(Q*.39*i), (int)(Q*.39*i));
-	for (int j = 0; j < h/6; j++) {
-		int m[0x100] = {0}, c = 0;
-		for (int i = 0; i < 6*w; i++) {
-			int k = x[6*j*w+i]/Q;
-			if (!m[k]) c += 1;
-			m[k] += 1;
-		}
-		for (int k = 0; k < 0x100/Q; k++)
-		if (m[k]) {
-			int b[w], r[w], R[w], idx = 0;
-			c -= 1;
-			for (int i = 0; i < w; i++) {
-				b[i] = 0;
-				for (int l = 5; l >= 0; l--)
-					b[i] = 2*b[i] + (k == x[(6*j+l)*w+i]/Q);
-				b[i] += 63;
-			}
-			for (int i = 0; i < w; i++) R[i] = 1;
-			r[0] = *b;
-			for (int i = 1; i < w; i++)
-				if (b[i] == r[idx]) R[idx] += 1;
-				else r[++idx] = b[i];
-			bs_printf(out, "#%d", k);
-			for (int i = 0; i <= idx; i++)
-				if (R[idx] < 3)
-					for (int l = 0; l < R[i]; l++)
-						bs_printf(out, "%c", r[i]);
-				else
-					bs_printf(out, "!%d%c", R[i], r[i]);
-			bs_printf(out, c ? "$\n" : "-\n");
-		}
-	}
-	bs_printf(out, "\033\\");
+	int Q = SIXEL_GRAY_Q;
+	uint8_t *q = malloc(w*h);
+	for (int i = 0; i < w*h; i++)
+		q[i] = x[i]/Q;
+	dump_sixels_to_bytestream_idx(out, q, NULL, w, h,
+			sixel_palette_gray(Q), 0x100/Q);
+	free(q);
 }
 
 //static void dump_sixels_to_stdout_rgb3(uint8_t *x, int w, int h)
@@ -367,23 +399,34 @@ static void dump_sixels_to_stdout_uint8(uint8_t *x, int w, int h, int pd)
 
 
 
-static void idump_six(uint8_t *x, int w, int h)
+static void ftr_term_dump(struct _FTR *f)
 {
-	// dump an image at the top of the screen using ANSI sequences
-	// NOTE: 0x1b == 033 == 27 == ESC
+	printf("dump %d %d:\n", f->w, f->h);
+	int Q = SIXEL_GRAY_Q, n = f->w * f->h;
+	uint8_t *q = malloc(n);
+	for (int i = 0; i < n; i++)
+		q[i] = (f->rgb[i*3+1]/2+f->rgb[i*3+0]/2)/Q;
+
+	// the bands that did not change are left as they are on the screen
+	uint8_t *p = f->prev;
+	if (p && (f->prev_w != f->w || f->prev_h != f->h))
+		p = NULL;
 
+	// dump the image at the top of the screen
+	// NOTE: 0x1b == 033 == 27 == ESC
+	struct bytestream s[1];
+	bytestream_init(s);
+	dump_sixels_to_bytestream_idx(s, q, p, f->w, f->h,
+			sixel_palette_gray(Q), 0x100/Q);
 	printf("\x1b[1;1H");
-	dump_sixels_to_stdout_uint8(x, w, h, 1);
-}
+	fwrite(s->t, 1, s->n, stdout);
+	fflush(stdout);
+	bytestream_free(s);
 
-static void ftr_term_dump(struct _FTR *f)
-{
-	printf("dump %d %d:\n", f->w, f->h);
-	uint8_t x[f->w*f->h];
-	for (int i = 0; i < f->w*f->h; i++)
-		x[i] = f->rgb[i*3+1]/2+f->rgb[i*3+0]/2;
-	//idump_six(f->rgb, f->w, f->h);
-	idump_six(x, f->w, f->h);
+	free(f->prev);
+	f->prev = q;
+	f->prev_w = f->w;
+	f->prev_h = f->h;
 }
 
 static void disable_canonical_and_echo_modes(void)
@@ -408,6 +451,13 @@ void ftr_change_title(struct FTR *ff, char *s)
 {
 }
 
+// this backend always sends the whole image
+void ftr_mark_dirty(struct FTR *f, int x, int y, int w, int h)
+{
+	(void)x; (void)y; (void)w; (void)h;
+	f->changed = 1;
+}
+
 //#include "smapa.h"
 //SMART_PARAMETER(COLUMNS,80)
 //SMART_PARAMETER(LINES,25)
@@ -445,6 +495,7 @@ struct FTR ftr_new_window_with_image_uint8_rgb(unsigned char *x, int w, int h)
 	f->handle_idle = NULL;
 	f->handle_idle_toggled = NULL;
 	f->stop_loop = 0;
+	f->prev = NULL;
 
 	disable_canonical_and_echo_modes();
 	ftr_term_dump(f);
@@ -464,6 +515,7 @@ void ftr_close(struct FTR *ff)
 
 	struct _FTR *f = (void*)ff;
 	if (f->rgb) free(f->rgb);
+	free(f->prev);
 }
 
 // ftr_loop_run {{{2
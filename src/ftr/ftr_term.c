@@ -85,6 +85,13 @@ void ftr_change_title(struct FTR *ff, char *s)
 {
 }
 
+// this backend always sends the whole image
+void ftr_mark_dirty(struct FTR *f, int x, int y, int w, int h)
+{
+	(void)x; (void)y; (void)w; (void)h;
+	f->changed = 1;
+}
+
 //#include "smapa.h"
 //SMART_PARAMETER(COLUMNS,80)
 //SMART_PARAMETER(LINES,25)
@@ -6,6 +6,11 @@
 #include <signal.h>
 #include <X11/Xlib.h>
 //#include <X11/Xutil.h> // only for XDestroyImage, that can be easily removed
+#ifdef FTR_WITH_XSHM
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
 #include <unistd.h> // only for "fork"
 
 #include <assert.h>
@@ -41,6 +46,11 @@ struct _FTR {
 	GC gc;
 	XImage *ximage;
 	int imgupdate;
+#ifdef FTR_WITH_XSHM
+	XShmSegmentInfo shminfo; // (the ximage is in shared memory if shm==2)
+#endif
+	int shm; // 0=not available, 1=available, 2=ximage is shared
+	int dirty[4]; // rectangle of rgb changed since the last update, if any
 
 	int wheel_ax;
 
@@ -102,6 +112,136 @@ static int getenv_int(char *s, int d)
 	return t ? atoi(t) : d;
 }
 
+static int do_bound(int a, int b, int x);
+
+#ifdef FTR_WITH_XSHM
+// whether the server can attach the shared memory segments of this client
+// (it can not if it is on another machine, and XShmAttach fails later)
+static int shm_attach_failed;
+static int shm_error_handler(Display *d, XErrorEvent *e)
+{
+	(void)d; (void)e;
+	shm_attach_failed = 1;
+	return 0;
+}
+#endif
+
+static void destroy_ximage(struct _FTR *f)
+{
+	if (!f->ximage) return;
+#ifdef FTR_WITH_XSHM
+	if (f->shm == 2) {
+		XShmDetach(f->display, &f->shminfo);
+		XSync(f->display, False);
+		shmdt(f->shminfo.shmaddr);
+		f->ximage->data = NULL;
+		f->shm = 1;
+	}
+#endif
+	f->ximage->f.destroy_image(f->ximage);
+	f->ximage = NULL;
+}
+
+// create an image of the size of the window, in shared memory if possible
+static void create_ximage(struct _FTR *f)
+{
+	destroy_ximage(f);
+#ifdef FTR_WITH_XSHM
+	if (f->shm) {
+		int s = DefaultScreen(f->display);
+		XImage *x = XShmCreateImage(f->display, f->visual,
+				DefaultDepth(f->display, s), ZPixmap, NULL,
+				&f->shminfo, f->W, f->H);
+		f->shminfo.shmid = -1;
+		if (x && x->bits_per_pixel == 32)
+			f->shminfo.shmid = shmget(IPC_PRIVATE,
+					x->bytes_per_line * x->height,
+					IPC_CREAT | 0600);
+		if (f->shminfo.shmid >= 0) {
+			x->data = f->shminfo.shmaddr = shmat(f->shminfo.shmid,0,0);
+			f->shminfo.readOnly = False;
+			shm_attach_failed = 0;
+			XErrorHandler h = XSetErrorHandler(shm_error_handler);
+			if (x->data != (void*)-1)
+				XShmAttach(f->display, &f->shminfo);
+			XSync(f->display, False);
+			XSetErrorHandler(h);
+			// the segment is removed when both sides detach it
+			shmctl(f->shminfo.shmid, IPC_RMID, NULL);
+			if (x->data != (void*)-1 && !shm_attach_failed) {
+				f->ximage = x;
+				f->shm = 2;
+				return;
+			}
+			if (x->data != (void*)-1)
+				shmdt(f->shminfo.shmaddr);
+		}
+		if (x) {
+			x->data = NULL;
+			x->f.destroy_image(x);
+		}
+		fprintf(stderr, "FTR: MIT-SHM not available, using XPutImage\n");
+		f->shm = 0; // do not try again
+	}
+#endif
+	f->ximage = XGetImage(f->display, f->window,
+			0, 0, f->W, f->H, AllPlanes, ZPixmap);
+}
+
+// copy the rectangle [x0,x1)x[y0,y1) of the rgb buffer into the image
+static void fill_ximage(struct _FTR *f, int x0, int y0, int x1, int y1)
+{
+	int s = f->s, b = f->ximage->bytes_per_line;
+	for (int j = y0; j < y1; j++)
+	for (int i = x0; i < x1; i++)
+	{
+		unsigned char *c = f->rgb + 3 * (j * f->w + i);
+		for (int q = 0; q < s; q++)
+		for (int p = 0; p < s; p++)
+		{
+			// drain bramage
+			char *d = f->ximage->data + (s*j + q) * b + 4 * (s*i + p);
+			d[0] = c[2];
+			d[1] = c[1];
+			d[2] = c[0];
+			d[3] = 0;
+		}
+	}
+}
+
+// send the rectangle [x0,x1)x[y0,y1) of the image to the window
+static void put_ximage(struct _FTR *f, int x0, int y0, int x1, int y1)
+{
+	int s = f->s;
+#ifdef FTR_WITH_XSHM
+	if (f->shm == 2) {
+		XShmPutImage(f->display, f->window, f->gc, f->ximage,
+				s*x0, s*y0, s*x0, s*y0, s*(x1-x0), s*(y1-y0), False);
+		XSync(f->display, False); // the image can be modified again
+	} else
+#endif
+		XPutImage(f->display, f->window, f->gc, f->ximage,
+				s*x0, s*y0, s*x0, s*y0, s*(x1-x0), s*(y1-y0));
+}
+
+void ftr_mark_dirty(struct FTR *ff, int x, int y, int w, int h)
+{
+	struct _FTR *f = (void*)ff;
+	int x0 = do_bound(0, f->w, x), x1 = do_bound(0, f->w, x + w);
+	int y0 = do_bound(0, f->h, y), y1 = do_bound(0, f->h, y + h);
+	if (x0 >= x1 || y0 >= y1) return;
+	int *d = f->dirty;
+	if (d[0] >= d[2]) { // empty
+		d[0] = x0; d[1] = y0; d[2] = x1; d[3] = y1;
+	} else {
+		if (x0 < d[0]) d[0] = x0;
+		if (y0 < d[1]) d[1] = y0;
+		if (x1 > d[2]) d[2] = x1;
+		if (y1 > d[3]) d[3] = y1;
+	}
+	f->changed = 1;
+}
+
 struct FTR ftr_new_window_with_image_uint8_rgb(unsigned char *x, int w, int h)
 {
 	struct _FTR f[1];
@@ -137,6 +277,12 @@ struct FTR ftr_new_window_with_image_uint8_rgb(unsigned char *x, int w, int h)
 	XStoreName(f->display, f->window, "ftr");
 	f->ximage = NULL;
 	f->imgupdate = 1;
+#ifdef FTR_WITH_XSHM
+	f->shm = XShmQueryExtension(f->display) && !getenv_int("FTR_NOSHM", 0);
+#else
+	f->shm = 0;
+#endif
+	f->dirty[0] = f->dirty[2] = 0;
 	f->wheel_ax = 0;
 	int mask = 0
 		| ExposureMask
@@ -192,7 +338,7 @@ void ftr_change_title(struct FTR *ff, char *s)
 void ftr_close(struct FTR *ff)
 {
 	struct _FTR *f = (void*)ff;
-	if (f->ximage) f->ximage->f.destroy_image(f->ximage);
+	destroy_ximage(f);
 	if (f->rgb) free(f->rgb);
 	XCloseDisplay(f->display);
 }
@@ -257,50 +403,27 @@ static void process_next_event(struct FTR *ff)
 	//fprintf(stderr,"ev(%p,%p) %d\t\"%s\"\n",(void*)f->display,(void*)f->window,event.type,event_names[event.type]);
 
 	if (event.type == Expose || f->changed) {
+		// the exposures from the server need the whole window
+		int whole = event.type == Expose && !event.xexpose.send_event;
+
 		if (f->handle_expose)
 			f->handle_expose(ff, 0, 0, 0, 0);
 		f->changed = 0;
 
 		if (!f->ximage || f->imgupdate) {
-			if (f->ximage) f->ximage->f.destroy_image(f->ximage);
-			//f->ximage = XShmGetImage(f->display, f->window,
-			//		0, 0, f->w, f->h, AllPlanes, ZPixmap);
-			f->ximage = XGetImage(f->display, f->window,
-				0, 0, f->W, f->H, AllPlanes, ZPixmap);
+			create_ximage(f);
 			f->imgupdate = 0;
-		}
-		if (f->s == 1)
-		for (int i = 0; i < f->w*f->h; i++) {
-			// drain bramage
-			f->ximage->data[4*i+0] = f->rgb[3*i+2];
-			f->ximage->data[4*i+1] = f->rgb[3*i+1];
-			f->ximage->data[4*i+2] = f->rgb[3*i+0];
-			f->ximage->data[4*i+3] = 0;
+			whole = 1;
 		}
 
-		// OK, boys, this is where the actual fucking happens
-		if (f->s > 1) {
-			int s = f->s;
-			for (int j = 0; j < f->h; j++)
-			for (int i = 0; i < f->w; i++)
-			{
-				int ij = i + j*f->w;
-				int IJ = s*i + s*j*f->W;
-				for (int q = 0; q < s; q++)
-				for (int p = 0; p < s; p++)
-				{
-					int Ip = IJ + p + q*f->W;
-					f->ximage->data[4*Ip+0]= f->rgb[3*ij+2];
-					f->ximage->data[4*Ip+1]= f->rgb[3*ij+1];
-					f->ximage->data[4*Ip+2]= f->rgb[3*ij+0];
-					f->ximage->data[4*Ip+3]= 0;
-				}
-			}
-		}
-		//XShmPutImage(f->display, f->window, f->gc, f->ximage,
-		//		0, 0, 0, 0, f->w, f->h, 0);
-		XPutImage(f->display, f->window, f->gc, f->ximage,
-				0, 0, 0, 0, f->W, f->H);
+		// update only the marked rectangle, if any
+		int *d = f->dirty, r[4] = {0, 0, f->w, f->h};
+		if (!whole && d[0] < d[2])
+			for (int k = 0; k < 4; k++)
+				r[k] = do_bound(0, k % 2 ? f->h : f->w, d[k]);
+		d[0] = d[2] = 0;
+		fill_ximage(f, r[0], r[1], r[2], r[3]);
+		put_ximage(f, r[0], r[1], r[2], r[3]);
 		if (f->handle_expose2)
 			f->handle_expose2(ff, 0, 0, 0, 0);
 
@@ -428,6 +551,9 @@ int ftr_loop_run(struct FTR *ff)
 			process_next_event(ff);
 		else if (f->handle_idle) {
 			f->handle_idle(ff, 0, 0, 0, 0);
+			// the handler asked for a redraw (e.g., of a dirty
+			// rectangle), an Expose would send the whole window
+			if (f->changed) continue;
 			XEvent ev;
 			ev.type = Expose;
 			//XLockDisplay(f->display);
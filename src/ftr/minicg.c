@@ -0,0 +1 @@
+../minicg.c
\ No newline at end of file
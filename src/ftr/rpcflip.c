@@ -44,6 +44,7 @@ double egm96(double,double);
 #define EARTH_RADIUS 6378000.0
 #define WHEEL_FACTOR 2.0
 #define BAD_MIN(a,b) ((a)<(b)?(a):(b))
+#define RPCFLIP_COARSE 2 // octaves of the first, quick, repaint of a view
 
 
 // pan_view and pan_state {{{1
@@ -72,6 +73,7 @@ struct pan_view {
 	uint8_t *display;
 	int dw, dh;
 	int repaint;
+	int coarse; // octaves above the nominal one (while refining the view)
 };
 
 #define MAX_VIEWS 60
@@ -191,6 +193,7 @@ static void init_view(struct pan_view *v,
 	v->display = NULL;
 	v->fdisplay = NULL;
 	v->repaint = 1;
+	v->coarse = 0;
 }
 
 static void init_view_no_preview(struct pan_view *v,
@@ -236,6 +239,7 @@ static void init_view_no_preview(struct pan_view *v,
 	v->display = NULL;
 	v->fdisplay = NULL;
 	v->repaint = 1;
+	v->coarse = 0;
 }
 
 static void init_view_sizes(struct pan_view *v)
@@ -801,7 +805,8 @@ void pixel_from_preview(float *r, struct pan_view *v, double p, double q, int i)
 static int tiffo_getpixel_float_raw(float *r, struct tiff_octaves *t,
 		int o, int i, int j)
 {
-	void *p = tiff_octaves_getpixel(t, o, i, j);
+	double p[20]; // (a copy of the pixel, so that it can run in parallel)
+	tiff_octaves_getpixel_copy(p, t, o, i, j);
 	convert_pixel_to_float(r, t->i, p);
 	return t->i->spp;
 }
@@ -962,6 +967,36 @@ void pixel(float *out, struct pan_view *v, double p, double q, int o, int i)
 	}
 }
 
+// octave that is k steps coarser than o, if the files have it
+// (only for the ms-octaves and gray cases, where the octaves are a pyramid)
+static int coarser_octave(struct pan_view *v, int o, int k)
+{
+	if (k <= 0 || !(v->gray_only || msoctaves_instead_of_preview))
+		return o;
+	struct tiff_octaves *t = v->gray_only ? v->tg : v->tc;
+	int s = v->gray_only ? 0 : 2; // index of the first octave of t
+	int r = (o < s - 1 ? s - 1 : o) + k;
+	while (r > o && !tiff_octaves_has_octave(t, r - s))
+		r -= 1;
+	return r;
+}
+
+// load the octave files used by "pixel" at octave o, return whether they
+// are all there (then the pixels can be evaluated in parallel)
+static bool load_octaves_of_pixel(struct pan_view *v, int o)
+{
+	if (v->gray_only)
+		return tiff_octaves_has_octave(v->tg, o);
+	if (!msoctaves_instead_of_preview)
+		return o == 0 ? true : o == 1 ? tiff_octaves_has_octave(v->tc, 0)
+			: tiff_octaves_has_octave(v->tg, 0)
+			&& tiff_octaves_has_octave(v->tc, 0);
+	if (o <= 1)
+		return tiff_octaves_has_octave(v->tg, 0)
+			&& tiff_octaves_has_octave(v->tc, 0);
+	return tiff_octaves_has_octave(v->tc, o - 2);
+}
+
 // contrast changes {{{1
 
 
@@ -1076,6 +1111,16 @@ static void update_local_projection(struct pan_state *e,
 			raster_to_image_raw : raster_to_image_exh);
 }
 
+typedef void (*window_to_image_t)(double[2], struct pan_state*, double, double);
+
+// the function that gives the image position of each window pixel
+static window_to_image_t window_to_image_function(struct pan_state *e)
+{
+	if (!e->image_space && e->force_exact)
+		return window_to_image_ex;
+	return window_to_image_apm;
+}
+
 
 // dump the image acording to the state of the viewport
 static void pan_repaint(struct pan_state *e, int w, int h)
@@ -1106,15 +1151,17 @@ static void pan_repaint(struct pan_state *e, int w, int h)
 	}
 	update_local_projection(e, w/2, h/2, e->base_h);
 
-	static void (*win_to_img)(double p[2],struct pan_state*,double,double);
-	win_to_img = window_to_image_apm;
-	if (e->image_space)      win_to_img = window_to_image_apm;
-	else if (e->force_exact) win_to_img = window_to_image_ex;
+	window_to_image_t win_to_img = window_to_image_function(e);
 
-	int o = obtain_octave(e);
+	int o = coarser_octave(v, obtain_octave(e), v->coarse);
 	int interp = e->interpolation_order;
 
-//#pragma omp parallel for
+	// the rows are computed in parallel, except in diff mode (that changes
+	// the current view) or when some of the octave files are missing
+	bool parallel = !e->diff_mode && load_octaves_of_pixel(v, o);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if(parallel)
+#endif
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 	{
@@ -1191,6 +1238,8 @@ static void overlay_vertdir(struct FTR *f, int i, int j)
 	}
 }
 
+static void pan_idle(struct FTR*, int, int, int, int);
+
 static void pan_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 {
 	(void)unused_x; (void)unused_y;
@@ -1199,6 +1248,8 @@ static void pan_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 	struct pan_view *v = obtain_view(e);
 
 	pan_repaint(e, f->w, f->h);
+	if (v->coarse > 0) // refine it later
+		ftr_set_handler(f, "idle", pan_idle);
 
 	// copy the requested view into the display
 	assert(f->w == v->dw);
@@ -1210,11 +1261,92 @@ static void pan_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 		overlay_vertdir(f, e->vdx, e->vdy);
 }
 
+// read the tiles needed by "pixel" at octave o, on a box of image positions
+// (b = x0, y0, x1, y1), in parallel
+static void prefetch_octave_box(struct tiff_octaves *t, int o, double b[4],
+		double dx, double dy, int fac)
+{
+	if (!tiff_octaves_has_octave(t, o))
+		return;
+	int x0 = floor((b[0] + dx) / fac) - 2;
+	int y0 = floor((b[1] + dy) / fac) - 2;
+	int x1 = ceil((b[2] + dx) / fac) + 2;
+	int y1 = ceil((b[3] + dy) / fac) + 2;
+	int n = 1;
+#ifdef _OPENMP
+	n = omp_get_max_threads();
+#endif
+	tiff_octaves_prefetch(t, o, x0, y0, x1 - x0 + 1, y1 - y0 + 1, n);
+}
+
+// read the tiles that are needed to paint the current view at octave o
+static void prefetch_view(struct pan_state *e, int o, int w, int h)
+{
+	struct pan_view *v = obtain_view(e);
+	window_to_image_t win_to_img = window_to_image_function(e);
+	double b[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+	for (int k = 0; k < 4; k++)
+	{
+		double p[2];
+		win_to_img(p, e, (k % 2) * w, (k / 2) * h);
+		b[0] = fmin(b[0], p[0]);
+		b[1] = fmin(b[1], p[1]);
+		b[2] = fmax(b[2], p[0]);
+		b[3] = fmax(b[3], p[1]);
+	}
+	if (!isfinite(b[0] + b[1] + b[2] + b[3]))
+		return;
+	b[0] = fmax(b[0], 0);
+	b[1] = fmax(b[1], 0);
+	b[2] = fmin(b[2], v->w - 1);
+	b[3] = fmin(b[3], v->h - 1);
+	if (v->gray_only)
+		prefetch_octave_box(v->tg, o, b, 0, 0, 1 << o);
+	else if (o >= 2 && msoctaves_instead_of_preview)
+		prefetch_octave_box(v->tc, o - 2, b, v->rgbiox, v->rgbioy,
+				1 << o);
+	else if (o > 0 || msoctaves_instead_of_preview) {
+		if (o != 1 || msoctaves_instead_of_preview)
+			prefetch_octave_box(v->tg, 0, b, 0, 0, 1);
+		prefetch_octave_box(v->tc, 0, b, v->rgbiox, v->rgbioy, 4);
+	}
+}
+
+// CALLBACK: pan_idle
+//
+// After a change of the view, it is first painted a few octaves coarser than
+// needed, which requires only a few tiles.  Then, when there are no pending
+// events, this handler reads the tiles of the next finer octave and asks for
+// a new repaint, until the nominal octave is reached.
+static void pan_idle(struct FTR *f, int k, int m, int x, int y)
+{
+	(void)k; (void)m; (void)x; (void)y;
+	struct pan_state *e = f->userdata;
+	struct pan_view *v = obtain_view(e);
+	if (v->coarse <= 0) {
+		ftr_set_handler(f, "idle", NULL);
+		return;
+	}
+	int o = obtain_octave(e);
+	int oc = coarser_octave(v, o, v->coarse);
+	while (v->coarse > 0 && coarser_octave(v, o, v->coarse) == oc)
+		v->coarse -= 1;
+	int on = coarser_octave(v, o, v->coarse);
+	if (on != oc) {
+		prefetch_view(e, on, f->w, f->h);
+		v->repaint = 1;
+		f->changed = 1;
+	}
+}
+
 static void request_repaints(struct FTR *f)
 {
 	struct pan_state *e = f->userdata;
 	for (int i = 0; i < e->nviews; i++)
+	{
 		e->view[i].repaint = 1;
+		e->view[i].coarse = RPCFLIP_COARSE;
+	}
 	f->changed = 1;
 }
 
@@ -1503,6 +1635,8 @@ static void action_dump_collection(struct FTR *f)
 	for (int i = 0; i < e->nviews; i++)
 	{
 		action_select_view(f, i, f->w/2, f->h/2);
+		obtain_view(e)->repaint |= obtain_view(e)->coarse > 0;
+		obtain_view(e)->coarse = 0;
 		pan_repaint(e, f->w, f->h);
 		int pid = getpid();
 		char fname[FILENAME_MAX];
@@ -1,4 +1,11 @@
 // SRTM4 files are of size 6000x6000 pixels and cover an area of 5x5 degrees
+//
+// The tiles are opened on their first use, and they are kept open.  When a
+// file has uncompressed 16-bit samples (as the original SRTM4 tiffs), it is
+// mapped in memory and its samples are read directly from the mapping: only
+// the pages that are used are read, and the system can drop them when it
+// needs memory.  Otherwise, it is read through a tile cache of at most
+// SRTM4_TILE_MEGABYTES per file.  The queries can be done from many threads.
 
 #include <assert.h>
 #include <stdbool.h>
@@ -9,6 +16,9 @@
 #include <tiffio.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -18,7 +28,7 @@
 //#endif//TIFFU_C_INCLUDED
 #include "tiff_octaves_rw.c"
 
-#define SRTM4_TILE_MEGABYTES 2
+#define SRTM4_TILE_MEGABYTES 100
 
 
 #define NO_DATA 0
@@ -137,55 +147,162 @@ static char *get_tile_filename(int tlon, int tlat, bool check_octaves)
 	return fname;
 }
 
-static struct tiff_octaves *global_table_of_tiles[360][180] = {{0}};
+// an open SRTM4 file (if "map" is not NULL, its first octave is mapped)
+struct srtm4_tile {
+	struct tiff_octaves t[1];
+
+	char *map;     // contents of the file
+	size_t size;   // size of the mapping
+	uint64_t *off; // position of each strip (or tile) of the file
+	int bw, bh;    // size of the strips (or tiles)
+	int ba;        // number of strips (or tiles) across
+	bool swap;     // whether the samples are byte-swapped
+};
+
+// map the file of the first octave, if its samples can be read directly
+static void map_tile_file(struct srtm4_tile *t)
+{
+	struct tiff_info *ti = t->t->i;
+	t->map = NULL;
+	if (ti->compressed || ti->broken || ti->bps != 16 || ti->spp != 1)
+		return;
+	TIFF *tif = TIFFOpen(t->t->filename[0], "r");
+	if (!tif) return;
+	int rps = ti->h;
+	if (!ti->tiled)
+		TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rps);
+	t->bw = ti->tiled ? ti->tw : ti->w;
+	t->bh = ti->tiled ? ti->th : (rps < ti->h ? rps : ti->h);
+	t->ba = ti->tiled ? ti->ta : 1;
+	int n = ti->tiled ? ti->ntiles : (int)TIFFNumberOfStrips(tif);
+	t->off = xmalloc(n * sizeof*t->off);
+	for (int i = 0; i < n; i++)
+		t->off[i] = TIFFGetStrileOffset(tif, i);
+	t->swap = TIFFIsByteSwapped(tif);
+	TIFFClose(tif);
+
+	// check that all the blocks are inside the file
+	int fd = open(t->t->filename[0], O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0) close(fd);
+		free(t->off);
+		return;
+	}
+	bool ok = n == t->ba * how_many(ti->h, t->bh);
+	for (int i = 0; ok && i < n; i++)
+	{
+		int rows = ti->tiled ? t->bh : ti->h - i * t->bh;
+		if (rows > t->bh) rows = t->bh;
+		ok = t->off[i] > 0 && t->off[i] + 2 * (size_t)t->bw * rows
+			<= (uint64_t)st.st_size;
+	}
+	void *m = ok ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+		: MAP_FAILED;
+	close(fd);
+	if (m == MAP_FAILED) {
+		free(t->off);
+		return;
+	}
+	t->map = m;
+	t->size = st.st_size;
+}
+
+// sample (i,j) of the first octave of a tile
+static double tile_sample(struct srtm4_tile *t, int i, int j)
+{
+	int16_t v;
+	if (t->map) {
+		int b = (j / t->bh) * t->ba + i / t->bw;
+		size_t p = (j % t->bh) * (size_t)t->bw + i % t->bw;
+		memcpy(&v, t->map + t->off[b] + 2 * p, 2);
+		if (t->swap)
+			v = (uint16_t)v >> 8 | (uint16_t)v << 8;
+	} else if (!tiff_octaves_getpixel_copy(&v, t->t, 0, i, j))
+		return NO_DATA;
+	return v;
+}
+
+// the tiles that are missing are marked with this address
+static struct srtm4_tile srtm4_missing_tile[1];
+
+static struct srtm4_tile *global_table_of_tiles[360][180] = {{0}};
 static int global_table_of_count[360][180] = {{0}};
 
-static struct tiff_octaves *produce_tile(int tlon, int tlat)
+static struct srtm4_tile *open_tile(int tlon, int tlat)
 {
-	struct tiff_octaves *t = global_table_of_tiles[tlon][tlat];
-	if (!t) {
-		char *fname = get_tile_filename(tlon, tlat, true);
-		char fname0[FILENAME_MAX];
-		snprintf(fname0, FILENAME_MAX, fname, 0);
-		fprintf(stderr, "trying file \"%s\"\n", fname0);
-		if (!file_exists(fname0)) {
-			fname = get_tile_filename(tlon, tlat, false);
-			fprintf(stderr, "trying now file \"%s\"\n", fname);
-			if (!file_exists(fname)
-				&& global_table_of_count[tlon][tlat] < 2)
-			{
-				global_table_of_count[tlon][tlat] += 1;
-				download_tile_file(tlon, tlat);
-			}
-		}
-		if (!file_exists(fname) && !file_exists(fname0))
+	char *fname = get_tile_filename(tlon, tlat, true);
+	char fname0[FILENAME_MAX];
+	snprintf(fname0, FILENAME_MAX, fname, 0);
+	fprintf(stderr, "trying file \"%s\"\n", fname0);
+	if (!file_exists(fname0)) {
+		fname = get_tile_filename(tlon, tlat, false);
+		fprintf(stderr, "trying now file \"%s\"\n", fname);
+		while (!file_exists(fname)
+			&& global_table_of_count[tlon][tlat] < 2)
 		{
-			//fprintf(stderr, "WARNING: srtm4 tile \"%d %d\" "
-			//		"not available\n", tlon, tlat);
-			return NULL;
+			global_table_of_count[tlon][tlat] += 1;
+			download_tile_file(tlon, tlat);
 		}
-		t = malloc(sizeof*t);
-		tiff_octaves_init(t, fname, 0);
-		if ((t->i->w != 6000) || (t->i->h != 6000))
-			exit(fprintf(stderr, "produce_tile: srtm4 file not "
-					"6000x6000\n"));
-		global_table_of_tiles[tlon][tlat] = t;
 	}
+	if (!file_exists(fname) && !file_exists(fname0))
+	{
+		//fprintf(stderr, "WARNING: srtm4 tile \"%d %d\" "
+		//		"not available\n", tlon, tlat);
+		return srtm4_missing_tile;
+	}
+	struct srtm4_tile *t = xmalloc(sizeof*t);
+	tiff_octaves_init(t->t, fname, SRTM4_TILE_MEGABYTES);
+	if ((t->t->i->w != 6000) || (t->t->i->h != 6000))
+		exit(fprintf(stderr, "produce_tile: srtm4 file not "
+				"6000x6000\n"));
+	if (t->t->i->fmt != SAMPLEFORMAT_INT || t->t->i->bps != 16
+			|| t->t->i->spp != 1)
+		exit(fprintf(stderr, "produce_tile: srtm4 file not int16\n"));
+	map_tile_file(t);
 	return t;
 }
 
-static double getpixelo_double(struct tiff_octaves *t, double x, double y, int o)
+// the tile of the given indices, or NULL if it is not available
+// (the tiles are opened only once, even when called from many threads)
+static struct srtm4_tile *produce_tile(int tlon, int tlat)
+{
+	struct srtm4_tile *t;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+	t = global_table_of_tiles[tlon][tlat];
+	if (!t) {
+#ifdef _OPENMP
+#pragma omp critical(srtm4_tiles)
+#endif
+		{
+			t = global_table_of_tiles[tlon][tlat];
+			if (!t) {
+				t = open_tile(tlon, tlat);
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+				global_table_of_tiles[tlon][tlat] = t;
+			}
+		}
+	}
+	return t == srtm4_missing_tile ? NULL : t;
+}
+
+static double getpixelo_double(struct srtm4_tile *t, double x, double y, int o)
 {
-	if (o > t->noctaves)
-		o = t->noctaves - 1;
+	if (o >= t->t->noctaves)
+		o = t->t->noctaves - 1;
 	float ofac = 1 << o;
 	int i = x / ofac;
 	int j = y / ofac;
-	assert(t->i->fmt == SAMPLEFORMAT_INT);
-	assert(t->i->bps == 16);
-	assert(t->i->spp == 1);
-	int16_t *pixel = tiff_octaves_getpixel(t, o, i, j);
-	return (double)*pixel;
+	if (o == 0)
+		return tile_sample(t, i, j);
+	int16_t pixel;
+	if (!tiff_octaves_getpixel_copy(&pixel, t->t, o, i, j))
+		return NO_DATA;
+	return pixel;
 }
 
 double srtm4o(double lon, double lat, int octave)
@@ -198,7 +315,7 @@ double srtm4o(double lon, double lat, int octave)
 	if (octave < 0)
 		fprintf(stderr, "lonlat: %g %g  => xlonxlat: %g %g\n", lon, lat, xlon, xlat);
 
-	struct tiff_octaves *t = produce_tile(tlon, tlat);
+	struct srtm4_tile *t = produce_tile(tlon, tlat);
 	if (t == NULL)
 		return NO_DATA;
 	else {
@@ -207,18 +324,71 @@ double srtm4o(double lon, double lat, int octave)
 	}
 }
 
+// height at the sample (i,j) of the whole grid of SRTM4 samples
+// (of size 432000x144000, starting at longitude -180 and latitude 60)
+static double srtm4_global_sample(long i, long j)
+{
+	long W = 72 * 6000, H = 24 * 6000;
+	i = (i % W + W) % W;
+	j = j < 0 ? 0 : j >= H ? H - 1 : j;
+	struct srtm4_tile *t = produce_tile(1 + i / 6000, 1 + j / 6000);
+	if (!t) return NO_DATA;
+	double r = tile_sample(t, i % 6000, j % 6000);
+	return r > 0 ? r : 0;
+}
+
+// height at the given point, by bilinear interpolation of the SRTM4 samples
+// (the samples are at the centers of the pixels of the tiles)
+double srtm4o_bilinear(double lon, double lat)
+{
+	if (lat >= 60 || lat <= -60)
+		return NO_DATA;
+	double x = 1200 * (lon + 180) - 0.5;
+	double y = 1200 * (60 - lat) - 0.5;
+	long i = floor(x), j = floor(y);
+	double u = x - i, v = y - j;
+	double a = srtm4_global_sample(i  , j  );
+	double b = srtm4_global_sample(i+1, j  );
+	double c = srtm4_global_sample(i  , j+1);
+	double d = srtm4_global_sample(i+1, j+1);
+	return (1-v) * ((1-u) * a + u * b) + v * ((1-u) * c + u * d);
+}
+
+// heights at the n points (lon[k], lat[k]), in parallel
+// (bilinear or nearest, at the first octave)
+void srtm4o_many(double *out, double *lon, double *lat, int n, bool bilinear)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1024)
+#endif
+	for (int k = 0; k < n; k++)
+		out[k] = bilinear ? srtm4o_bilinear(lon[k], lat[k])
+			: srtm4o(lon[k], lat[k], 0);
+}
+
 void srtm4_free_tiles(void)
 {
 	for (int j = 0; j < 360; j++)
 	for (int i = 0; i < 180; i++)
 	if (global_table_of_tiles[j][i])
 	{
-		tiff_octaves_free(global_table_of_tiles[j][i]);
-			free(global_table_of_tiles[j][i]);
+		struct srtm4_tile *t = global_table_of_tiles[j][i];
+		global_table_of_tiles[j][i] = NULL;
+		if (t == srtm4_missing_tile)
+			continue;
+		if (t->map) {
+			munmap(t->map, t->size);
+			free(t->off);
+		}
+		tiff_octaves_free(t->t);
+			free(t);
 	}
 }
 
 #ifdef MAIN_SRTM4
+// heights with respect to the ellipsoid: srtm4 + egm96
+double egm96(double, double);
+void egm96_many(double *, double *, double *, int);
 int main(int c, char *v[])
 {
 	if (c != 1 && c != 3) {
@@ -228,17 +398,31 @@ int main(int c, char *v[])
     if (c == 3) {
 	    double lon = atof(v[1]);
 	    double lat = atof(v[2]);
-	    double r = srtm4_wrt_ellipsoid(lon, lat);
+	    double r = srtm4o_bilinear(lon, lat) + egm96(lon, lat);
 	    printf("%g\n", r);
 	    return 0;
     }
-    else {
-        double lon, lat, r;
-        while(2 == scanf("%lf %lf\n", &lon, &lat)) {
-            r = srtm4_nn_wrt_ellipsoid(lon, lat);
-            printf("%g\n", r);
+    else { // batches of points, nearest neighbor
+        int n = 0, nmax = 0x10000;
+        double *lon = xmalloc(nmax * sizeof*lon);
+        double *lat = xmalloc(nmax * sizeof*lat);
+        double *r = xmalloc(nmax * sizeof*r);
+        double *g = xmalloc(nmax * sizeof*g);
+        while (1) {
+            bool eof = 2 != scanf("%lf %lf\n", lon + n, lat + n);
+            n += !eof;
+            if (n == nmax || (eof && n)) {
+                srtm4o_many(r, lon, lat, n, false);
+                egm96_many(g, lon, lat, n);
+                for (int i = 0; i < n; i++)
+                    printf("%g\n", r[i] + g[i]);
+                n = 0;
+            }
+            if (eof) break;
         }
+        free(lon); free(lat); free(r); free(g);
     }
+    return 0;
 }
 #endif//MAIN_SRTM4
 
@@ -0,0 +1 @@
+../misc/sweepline.c
\ No newline at end of file
@@ -24,7 +24,8 @@
 #include <linux/videodev2.h> // v4l2_*, V4L2_*, VIDIOC_*
 
 
-#define THE_NUMBER_OF_THE_BUFFERS_SHALL_BE_FOUR 1
+// (one of them is held by the program, the driver fills the others)
+#define THE_NUMBER_OF_THE_BUFFERS_SHALL_BE_FOUR 4
 
 #include "cam.h"
 
@@ -70,6 +71,7 @@ struct camera *camera_open(
 	c->buffers = NULL;
 	c->head.length = 0;
 	c->head.start = NULL;
+	c->current = -1;
 	return c;
 }
 
@@ -124,7 +126,7 @@ void camera_init(struct camera *c)
 	c->buffer_count = req.count;
 	c->buffers = calloc(req.count, sizeof (struct camera_buffer));
 
-	// mmap each buffer, and malloc the head one (externally visible)
+	// mmap each buffer (the head will point into them)
 	size_t buf_max = 0;
 	for (size_t i = 0; i < c->buffer_count; i++) {
 		struct v4l2_buffer buf;
@@ -143,7 +145,18 @@ void camera_init(struct camera *c)
 		if (c->buffers[i].start == MAP_FAILED) quit("mmap");
 	}
 	fprintf(stderr, "\tBUF MAX = %ld\n", buf_max);
-	c->head.start = malloc(4*buf_max);
+}
+
+// give back a buffer to the driver
+static void camera_requeue(struct camera *c, int index)
+{
+	struct v4l2_buffer buf;
+	memset(&buf, 0, sizeof buf);
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+	if (xioctl(c->fd, VIDIOC_QBUF, &buf) == -1)
+		quit("VIDIOC_QBUF");
 }
 
 // API
@@ -151,15 +164,9 @@ void camera_init(struct camera *c)
 void camera_start(struct camera *c)
 {
 	// assign each buffer to a query
-	for (size_t i = 0; i < c->buffer_count; i++) {
-		struct v4l2_buffer buf;
-		memset(&buf, 0, sizeof buf);
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
-		if (xioctl(c->fd, VIDIOC_QBUF, &buf) == -1)
-			quit("VIDIOC_QBUF");
-	}
+	for (size_t i = 0; i < c->buffer_count; i++)
+		camera_requeue(c, i);
+	c->current = -1;
 
 	// start streaming unto the buffers
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -174,6 +181,9 @@ void camera_stop(struct camera *c)
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	if (xioctl(c->fd, VIDIOC_STREAMOFF, &type) == -1)
 		quit("VIDIOC_STREAMOFF");
+	c->current = -1; // (all the buffers are back to the driver)
+	c->head.start = NULL;
+	c->head.length = 0;
 }
 
 // API
@@ -186,7 +196,7 @@ void camera_finish(struct camera *c)
 	free(c->buffers);
 	c->buffer_count = 0;
 	c->buffers = NULL;
-	free(c->head.start);
+	c->current = -1;
 	c->head.length = 0;
 	c->head.start = NULL;
 }
@@ -201,20 +211,31 @@ void camera_close(struct camera *c)
 }
 
 // API
-// copy one frame from the buffer ring to the head, at any time
+// hold the newest frame of the buffer ring at the head, and give back the
+// older ones to the driver (returns false if no frame was ready)
 int camera_capture(struct camera *c)
 {
-	struct v4l2_buffer buf;
-	memset(&buf, 0, sizeof buf);
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buf.memory = V4L2_MEMORY_MMAP;
-	if (xioctl(c->fd, VIDIOC_DQBUF, &buf) == -1)
-		return false;
-	//fprintf(stderr, "CAPTURE bytesused = %d\n", buf.bytesused);
-	memcpy(c->head.start, c->buffers[buf.index].start, buf.bytesused);
-	c->head.length = buf.bytesused;
-	if (xioctl(c->fd, VIDIOC_QBUF, &buf) == -1)
+	int index = -1;
+	size_t length = 0;
+	while (1) {
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof buf);
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(c->fd, VIDIOC_DQBUF, &buf) == -1)
+			break; // EAGAIN: no more filled buffers
+		//fprintf(stderr, "CAPTURE bytesused = %d\n", buf.bytesused);
+		if (index >= 0) camera_requeue(c, index); // a stale frame
+		index = buf.index;
+		length = buf.bytesused;
+	}
+	if (index < 0)
 		return false;
+	if (c->current >= 0)
+		camera_requeue(c, c->current);
+	c->current = index;
+	c->head.start = c->buffers[index].start;
+	c->head.length = length;
 	return true;
 }
 
@@ -222,6 +243,8 @@ int camera_capture(struct camera *c)
 // wait at most "timeout" and capture the next frame
 int camera_frame(struct camera *c, struct timeval timeout)
 {
+	if (camera_capture(c)) // a frame was already waiting
+		return true;
 	fd_set fds;
 	FD_ZERO(&fds);
 	FD_SET(c->fd, &fds);
@@ -238,29 +261,35 @@ static int bclamp(int v)
 	return v;
 }
 
+// convert the pixels [i0,i0+n) of a yuyv line
+static void yuyv_line_to_rgb(uint8_t *out, const uint8_t *in, int i0, int n)
+{
+	for (int k = 0; k < n; k++)
+	{
+		int i = i0 + k, p = 2 * (i & ~1); // (the pair of pixels)
+		int y = in[2*i] << 8;
+		int u = in[p + 1] - 128;
+		int v = in[p + 3] - 128;
+		out[3*k + 0] = bclamp((y + 359*v) >> 8);
+		out[3*k + 1] = bclamp((y + 88*u - 183*v) >> 8);
+		out[3*k + 2] = bclamp((y + 454*u) >> 8);
+	}
+}
+
 void fill_rgb888_from_yuyv422(
 		uint8_t *out_rgb, // rgb  888
 		uint8_t *in_yuyv, // yuyv 422
 		int w, int h,     // width, height
-		int s             // output line stride (including first line)
+		int s             // output line stride, in pixels (0 = w)
 	    )
 {
-	for (size_t j = 0; j < h; j += 1)
-	for (size_t i = 0; i < w; i += 2)
-	{
-		size_t ij  = j * w + i;
-		size_t ijs = j * w + i + s;
-		int y0 = in_yuyv[2*ij + 0] << 8;
-		int u  = in_yuyv[2*ij + 1] - 128;
-		int y1 = in_yuyv[2*ij + 2] << 8;
-		int v  = in_yuyv[2*ij + 3] - 128;
-		out_rgb[3*ijs + 0 + 0] = bclamp((y0 + 359*v) >> 8);
-		out_rgb[3*ijs + 0 + 3] = bclamp((y1 + 359*v) >> 8);
-		out_rgb[3*ijs + 1 + 0] = bclamp((y0 + 88*u - 183*v) >> 8);
-		out_rgb[3*ijs + 1 + 3] = bclamp((y1 + 88*u - 183*v) >> 8);
-		out_rgb[3*ijs + 2 + 0] = bclamp((y0 + 454*u) >> 8);
-		out_rgb[3*ijs + 2 + 3] = bclamp((y1 + 454*u) >> 8);
-	}
+	if (!s) s = w;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+		yuyv_line_to_rgb(out_rgb + 3 * s * (size_t)j,
+				in_yuyv + 2 * w * (size_t)j, 0, w);
 }
 
 uint8_t *yuyv2rgb(uint8_t *yuyv, int w, int h)
@@ -292,16 +321,58 @@ void camera_end(struct camera *c)
 
 void camera_grab_rgb(struct camera *c)
 {
-	if (0)
+	camera_grab(c);
+	camera_fill_rgb(c, c->rgb, 0);
+}
+
+// API
+int camera_grab(struct camera *c)
+{
+	struct timeval t;
+	t.tv_sec = 1;
+	t.tv_usec = 0;
+	return camera_frame(c, t);
+}
+
+// API
+void camera_fill_rgb(struct camera *c, uint8_t *out, int stride)
+{
+	if (c->head.start)
+		fill_rgb888_from_yuyv422(out, c->head.start, c->w, c->h, stride);
+}
+
+// API
+void camera_fill_float(struct camera *c, float *out,
+		int x0, int y0, int w, int h, int planar)
+{
+	// the part of the rectangle inside the frame
+	int a = x0 < 0 ? -x0 : 0, b = x0 + w > c->w ? c->w - x0 : w;
+	if (!c->head.start || a >= b) b = a;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
 	{
-		camera_capture(c);
-	} else {
-		struct timeval t;
-		t.tv_sec = 1;
-		t.tv_usec = 0;
-		camera_frame(c, t);
+		uint8_t t[3 * w + 1];
+		int in = a < b && y0 + j >= 0 && y0 + j < c->h;
+		if (in)
+			yuyv_line_to_rgb(t + 3 * a,
+					c->head.start + 2 * c->w * (size_t)(y0 + j),
+					x0 + a, b - a);
+		for (int i = 0; i < w; i++)
+		{
+			int inside = in && i >= a && i < b;
+			float r = inside ? t[3*i+0] : 0;
+			float g = inside ? t[3*i+1] : 0;
+			float v = inside ? t[3*i+2] : 0;
+			if (planar) {
+				out[(0*h + j)*w + i] = r;
+				out[(1*h + j)*w + i] = g;
+				out[(2*h + j)*w + i] = v;
+			} else
+				out[j*w + i] = (r + g + v) / 3;
+		}
 	}
-	fill_rgb888_from_yuyv422(c->rgb, c->head.start, c->w, c->h, 0);
 }
 
 //#ifndef WEBCAM_HIDE_MAIN
@@ -16,7 +16,8 @@ struct camera {
 		uint8_t *start;
 		size_t length;
 	} *buffers;
-	struct camera_buffer head;
+	struct camera_buffer head; // the current frame (inside the ring)
+	int current; // index of the buffer held by the head (-1 if none)
 };
 
 // high-level API: just the public struct and the following three functions:
@@ -24,6 +25,19 @@ struct camera *camera_begin(const char *device, int w, int h);
 void camera_end(struct camera *c);
 void camera_grab_rgb(struct camera *c); // fill-in the c->rgb field
 
+// zero-copy API: hold the newest frame, and convert it directly into the
+// buffers of the caller (the frame stays valid until the next grab)
+int camera_grab(struct camera *c); // wait at most 1s for a frame
+
+// rgb of the current frame, into rows of "stride" pixels (0 = c->w)
+void camera_fill_rgb(struct camera *c, uint8_t *out, int stride);
+
+// the rectangle [x0,x0+w)x[y0,y0+h) of the current frame, in float, as the
+// average of the three channels (planar=0) or as three planes (planar=1)
+// (the pixels outside the frame are 0)
+void camera_fill_float(struct camera *c, float *out,
+		int x0, int y0, int w, int h, int planar);
+
 
 // API for setting-up the camera parameters
 void camera_autofocus_toggle(struct camera *c);
@@ -52,11 +66,12 @@ void camera_finish(struct camera *c);
 // close device and free struct memory
 void camera_close(struct camera *c);
 
-// copy one frame from the buffer ring to the head, at any time
+// hold the newest frame of the buffer ring at the head, and give back the
+// older ones to the driver (returns false if no frame was ready)
 int camera_capture(struct camera *c);
 
 // wait at most "timeout" and capture the next frame
 int camera_frame(struct camera *c, struct timeval timeout);
 
 uint8_t *yuyv2rgb(uint8_t *yuyv, int width, int height);
-void fillrgb(uint8_t *rgb, uint8_t *yuyv, int width, int height);
+void fill_rgb888_from_yuyv422(uint8_t *rgb, uint8_t *yuyv, int w, int h, int s);
@@ -14,6 +14,8 @@ struct kam_state {
 
 	int diff_mode;
 	int simplest_color_balance;
+
+	int bg_w, bg_h; // size of the window when the background was painted
 };
 
 static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
@@ -26,12 +28,18 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 	(void)unused_x; (void)unused_y;
 	struct kam_state *e = f->userdata;
 
-	// workspace: dark blue background
-	for (int i = 0; i < 3 * f->w * f->h; i++)
-		f->rgb[i] = 100 * (2 == i%3);
+	// workspace: dark blue background (only when the window changes)
+	if (e->bg_w != f->w || e->bg_h != f->h) {
+		for (int i = 0; i < 3 * f->w * f->h; i++)
+			f->rgb[i] = 100 * (2 == i%3);
+		e->bg_w = f->w;
+		e->bg_h = f->h;
+		f->changed = 1;
+	}
 
 	struct camera *c = e->c;
-	camera_grab_rgb(c);
+	if (!camera_grab(c))
+		return;
 
 	// leave a symmetric margin
 	int ox = (f->w - c->w) / 2;
@@ -41,13 +49,10 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 
 	if (!e->diff_mode)
 	{
-		for (int j = 0; j < c->h; j++)
-			memcpy(
-					f->rgb+ 3*(f->w*(j+oy)+ox),
-					c->rgb+ 3*(c->w*j),
-					3*c->w
-			      );
+		// convert the frame directly into the window
+		camera_fill_rgb(c, f->rgb + 3*(f->w*oy+ox), f->w);
 	} else {
+		camera_fill_rgb(c, c->rgb, 0);
 		for (int j = 0; j < c->h; j++)
 		for (int i = 0; i < c->w; i++)
 		for (int k = 0; k < 3   ; k++)
@@ -61,7 +66,7 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 		}
 		memcpy(e->prev, c->rgb, 3 * c->w * c->h);
 	}
-
+	ftr_mark_dirty(f, ox, oy, c->w, c->h);
 }
 
 static void action_take_jpeg_screenshot(struct kam_state *e)
@@ -69,6 +74,7 @@ static void action_take_jpeg_screenshot(struct kam_state *e)
 	static int c = 0;
 	char n[FILENAME_MAX];
 	snprintf(n, FILENAME_MAX, "webcam_%d.jpg", c);
+	camera_fill_rgb(e->c, e->c->rgb, 0);
 	iio_write_image_uint8_vec(n, e->c->rgb, e->c->w, e->c->h, 3);
 	fprintf(stderr, "wrote sreenshot on file \"%s\"\n", n);
 	c += 1;
@@ -101,6 +107,7 @@ int main()
 
 	e->prev = malloc(2*3 * w * h);
 	e->diff_mode = 0;
+	e->bg_w = e->bg_h = 0;
 
 	// window stuff
 	struct FTR f = ftr_new_window(w + 100, h + 100);
@@ -0,0 +1 @@
+../cleant_cgpois.c
\ No newline at end of file
@@ -26,6 +26,8 @@ struct kam_state {
 
 	int corr_mode;
 	int corr_w;
+
+	int bg_w, bg_h; // size of the window when the background was painted
 };
 
 static void filterview_autocorr(float *y, float *x, int w, int h)
@@ -134,12 +136,18 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 	(void)unused_x; (void)unused_y;
 	struct kam_state *e = f->userdata;
 
-	// workspace: dark blue background
-	for (int i = 0; i < 3 * f->w * f->h; i++)
-		f->rgb[i] = 100 * (2 == i%3);
+	// workspace: dark blue background (only when the window changes)
+	if (e->bg_w != f->w || e->bg_h != f->h) {
+		for (int i = 0; i < 3 * f->w * f->h; i++)
+			f->rgb[i] = 100 * (2 == i%3);
+		e->bg_w = f->w;
+		e->bg_h = f->h;
+		f->changed = 1;
+	}
 
 	struct camera *c = e->c;
-	camera_grab_rgb(c);
+	if (!camera_grab(c))
+		return;
 
 	// leave a symmetric margin
 	int ox = (f->w - c->w) / 2;
@@ -147,16 +155,12 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 	assert(ox >= 0);
 	assert(oy >= 0);
 
-	for (int j = 0; j < c->h; j++)
-	for (int i = 0; i < c->w; i++)
-	for (int k = 0; k < 3; k++)
-	{
-		float v = c->rgb [3*(j*c->w+i)+k];
-		if (v > 255) v = 255;
-		if (v < 0) v = 0;
-		f->rgb[3*(f->w*(j+oy)+i+ox)+k] = v;
-	}
+	// convert the frame directly into the window
+	camera_fill_rgb(c, f->rgb + 3*(f->w*oy+ox), f->w);
+	ftr_mark_dirty(f, ox, oy, c->w, c->h);
 
+	// the filters read the central square from the frame, converting it
+	// to float in the same pass
 
 	if (e->corr_mode == 0) // none
 		;
@@ -165,15 +169,7 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 		float *aimg = xmalloc(e->corr_w * e->corr_w * sizeof*aimg);
 		int i0 = f->w/2 - e->corr_w/2 - ox;
 		int j0 = f->h/2 - e->corr_w/2 - oy;
-		for (int j = 0; j < e->corr_w; j++)
-		for (int i = 0; i < e->corr_w; i++)
-		{
-			float r = f->rgb[3*(f->w*(j+j0+oy)+i+i0+ox)+0];
-			float g = f->rgb[3*(f->w*(j+j0+oy)+i+i0+ox)+1];
-			float b = f->rgb[3*(f->w*(j+j0+oy)+i+i0+ox)+2];
-			float v = (r+g+b)/3;
-			aimg[j*e->corr_w + i] = v;
-		}
+		camera_fill_float(c, aimg, i0, j0, e->corr_w, e->corr_w, 0);
 		autocorrelation_inplace(e, aimg, e->corr_w);
 		for (int j = 0; j < e->corr_w; j++)
 		for (int i = 0; i < e->corr_w; i++)
@@ -188,13 +184,7 @@ static void kam_exposer(struct FTR *f, int b, int m, int unused_x, int unused_y)
 		float *aimg = xmalloc(3*n*n*sizeof*aimg);
 		int i0 = f->w/2 - n/2 - ox;
 		int j0 = f->h/2 - n/2 - oy;
-		for (int j = 0; j < n; j++)
-		for (int i = 0; i < n; i++)
-		for (int k = 0; k < 3; k++)
-		{
-			float v = f->rgb[3*(f->w*(j+j0+oy)+i+i0+ox)+k];
-			aimg[k*n*n + j*n + i] = v;
-		}
+		camera_fill_float(c, aimg, i0, j0, n, n, 1);
 		for (int k = 0; k < 3; k++)
 			autocorrelation_inplace(e, aimg + k*n*n, n);
 		for (int j = 0; j < n; j++)
@@ -235,6 +225,7 @@ static void action_take_jpeg_screenshot(struct kam_state *e)
 	static int c = 0;
 	char n[FILENAME_MAX];
 	snprintf(n, FILENAME_MAX, "webcam_%d.jpg", c);
+	camera_fill_rgb(e->c, e->c->rgb, 0);
 	iio_write_image_uint8_vec(n, e->c->rgb, e->c->w, e->c->h, 3);
 	fprintf(stderr, "wrote sreenshot on file \"%s\"\n", n);
 	c += 1;
@@ -271,6 +262,7 @@ int main()
 
 	e->corr_mode = 1;
 	e->corr_w = 256;
+	e->bg_w = e->bg_h = 0;
 
 	// window stuff
 	struct FTR f = ftr_new_window(w + 100, h + 100);
@@ -0,0 +1 @@
+../pd_specialize.h
\ No newline at end of file
@@ -0,0 +1 @@
+../xarena.c
\ No newline at end of file
@@ -5,23 +5,10 @@
 #include <math.h>
 
 #include "linalg.c" // cholesky, solve_spd
+#include "xmalloc.c"
+#include "geomedian_core.c" // reentrant weiszfeld-vardi-zhang
 
 
-static double *global_log; // nine columns
-static int global_i; // iteration counter for the log
-static int global_maxit;
-static double *global_solution;
-static double global_optimal_energy;
-#define LOG_i 0
-#define LOG_xi 1
-#define LOG_yi 2
-#define LOG_fi 3
-#define LOG_gxi 4
-#define LOG_gyi 5
-#define LOG_gni 6
-#define LOG_di 7
-#define LOG_ei 8
-
 static void linear_average(double *o, int d, int n, double a[n][d])
 {
 	for (int k = 0; k < d; k++)
@@ -163,35 +150,6 @@ static void get_random_subset(int *s, int n, int k)
 			s[--k] = i;
 }
 
-// XXX warning! non-reentrant
-static void reservoir_sampling_non_reentrant(int *s, int n, int k)
-{
-	// "Algorithm L", Kim-Hung Li, 1994
-	// O(k + k*log(n/k))
-	static int *r = NULL;
-	static int rn = 0;
-	if (n != rn) {
-		if (r) free(r);
-		if (n) r = malloc(n * sizeof*r);
-		rn = n;
-	}
-
-	for (int i = 0; i < k; i++)
-		r[i] = s[i];
-
-	double W = exp(log(random_uniform())/k);
-
-	int i = k;
-	while (i < n)
-	{
-		i = i + floor(log(random_uniform())/log(1-W));
-		if (i < n) {
-			r[randombounds(0,k-1)] = s[i];
-			W = W*exp(log(random_uniform())/k);
-		}
-	}
-}
-
 static int compare_doubles(const void *aa, const void *bb)
 {
 	const double *a = (const double *)aa;
@@ -745,7 +703,8 @@ struct descent_options {
 		ZERO,             // initialize at x_0=0
 		GIVEN,            // user-provided x_0
 		AVERAGE,          // x_0 = avg(a_1, ... a_n)
-		GORNER_KANZOW     // argmin(f(a_i)) - λ_k grad(f)  (very slow!)
+		GORNER_KANZOW,    // argmin(f(a_i)) - λ_k grad(f)  (very slow!)
+		CORE              // the result of "geomedian_core.c"
 	} initialization;
 
 	// -d
@@ -791,6 +750,7 @@ static void print_descent_options(FILE *f, struct descent_options *o)
 		[GIVEN] = "GIVEN",
 		[AVERAGE] = "AVERAGE",
 		[GORNER_KANZOW] = "GORNER_KANZOW",
+		[CORE] = "CORE",
 	};
 	char const*const s_d[] = {
 		[GRADIENT] = "GRADIENT",
@@ -839,6 +799,13 @@ static void find_initial_point(
 	case GORNER_KANZOW:
 		exit(fprintf(stderr, "Gorner Kanzow init not implemented\n"));
 		break;
+	case CORE: {
+		struct geomedian_workspace w[1];
+		geomedian_workspace_init(w, d, n, NULL);
+		geomedian(x, *a, d, n, w);
+		geomedian_workspace_free(w);
+		break;
+		}
 	default:
 		exit(fprintf(stderr, "bad init (%d)\n", o->initialization));
 		break;
@@ -913,6 +880,7 @@ static void grab_options(struct descent_options *o, int *c, char ***v)
 	if (!strcmp(opt_i, "zero"))    o->initialization = ZERO;
 	if (!strcmp(opt_i, "average")) o->initialization = AVERAGE;
 	if (!strcmp(opt_i, "gk"))      o->initialization = GORNER_KANZOW;
+	if (!strcmp(opt_i, "core"))    o->initialization = CORE;
 	//if (!strcmp(opt_i, "given"))   o->initialization = GIVEN;
 	if (!strcmp(opt_d, "gradient")) o->descent_direction = GRADIENT;
 	if (!strcmp(opt_d, "newton"))   o->descent_direction = NEWTON;
@@ -1115,7 +1083,7 @@ static char *help_string_long     =
 "\n"
 "Options:\n"
 " -n n\t\ttotal number of descent iterations\n"
-" -i {zero,average,gk}\t\tselect initial point\n"
+" -i {zero,average,gk,core}\t\tselect initial point\n"
 " -d {gradient,newton,dhessian}\t\tdescent direction\n"
 "\n"
 "Report bugs to <enric.meinhardt@ens-paris-saclay.fr>."
@@ -1145,17 +1113,6 @@ int main_descent(int c, char *v[])
 	void *aa = iio_read_image_double("-", &d, &n);
 	double (*a)[d] = aa; // point cloud
 
-	//// debugging stuff
-	//if (*out_log)
-	//{
-	//	global_i = 0;
-	//	global_maxit = NUMIT();
-	//	global_log = malloc(9 * global_maxit * sizeof*global_log);
-	//	global_solution = malloc(d * sizeof*global_solution);
-	//	for (int i = 0; i < d; i++)
-	//		global_solution[i] = NAN;
-	//}
-
 	double x[d]; // current position
 	find_initial_point(d, n, a, x, o);
 
@@ -1187,31 +1144,11 @@ int main_descent(int c, char *v[])
 		E = objective_function(d, n, a, x);
 		if (d == 2)
 			fprintf(stderr, "P\t%lf\t%lf\t%lf\n", x[0], x[1], E);
-
-		//if (*out_log && d > 1)
-		//{
-		//	global_i = i;
-		//	global_log[9*global_i + LOG_i  ] = global_i;
-		//	global_log[9*global_i + LOG_xi ] = x[0];
-		//	global_log[9*global_i + LOG_yi ] = x[1];
-		//	global_log[9*global_i + LOG_fi ] = E;
-		//	global_log[9*global_i + LOG_gxi] = g[0];
-		//	global_log[9*global_i + LOG_gxi] = g[1];
-		//	global_log[9*global_i + LOG_gni] = hypot(g[0],g[1]);
-		//	global_log[9*global_i + LOG_ei ] = NAN;;
-		//	global_log[9*global_i + LOG_di ] = NAN;;
-		//}
-
 	}
 
-	//if (*out_log)
-	//{
-	//	FILE *f = fopen(out_log, "w");
-	//	for (int i = 0; i < global_i; i++)
-	//	for (int j = 0; j < 9; j++)
-	//		fprintf(f, "%lf%c", global_log[9*i+j], j==8?'\n':' ');
-	//	fclose(f);
-	//}
+	// print the solution
+	for (int k = 0; k < d; k++)
+		printf("%.17g%c", x[k], k == d - 1 ? '\n' : ' ');
 
 	return 0;
 }
@@ -0,0 +1,247 @@
+#ifndef _GEOMEDIAN_CORE_C
+#define _GEOMEDIAN_CORE_C
+
+// geometric median of a cloud of points (reentrant)
+//
+// The geometric median is the point that minimizes the sum of the euclidean
+// distances to the points of the cloud.  It is found by the Weiszfeld
+// iterations, with the modification of Vardi and Zhang (so that they do not
+// stall when the iterate falls on one of the points), from a good initial
+// point: the componentwise median and, for large clouds, the "crude
+// approximation" of Cohen, Lee, Miller, Pachocki and Sidford (the point of a
+// random subset whose 65% quantile of distances to another random subset is
+// the smallest), whichever has less energy.  The cases n <= 2 and d = 1 are
+// solved exactly.
+//
+// All the state is in a workspace, whose memory is allocated or given by the
+// caller (e.g., on the stack, for the small clouds of each pixel), so that
+// many medians can be computed in parallel.
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c) when the
+// memory of the workspace is not given.
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// clouds larger than this are also initialized by the crude approximation
+#ifndef GEOMEDIAN_CRUDE_N
+#define GEOMEDIAN_CRUDE_N 256
+#endif
+
+// size of the random subsets of the crude approximation
+#define GEOMEDIAN_CRUDE_K 16
+
+// number of doubles of memory of a workspace for n points of dimension d
+#define GEOMEDIAN_WORKSPACE_SIZE(d,n) \
+	((n) + 3*(d) + GEOMEDIAN_CRUDE_K * GEOMEDIAN_CRUDE_K)
+
+struct geomedian_workspace {
+	int d, n;       // maximum dimension and number of points
+	double *t;      // scratch memory
+	double *mem;    // allocated memory (NULL if given by the caller)
+	uint64_t seed;  // state of the random subsets
+
+	// parameters, that can be changed after the initialization
+	double tol;     // stop when the step is smaller (relative to the scale)
+	int maxit;      // maximum number of iterations
+
+	// results of the last median
+	int niter;      // number of iterations
+	double energy;  // sum of the distances
+};
+
+// "mem" is either NULL or an array of GEOMEDIAN_WORKSPACE_SIZE(d,n) doubles
+static void geomedian_workspace_init(struct geomedian_workspace *w,
+		int d, int n, double *mem)
+{
+	w->d = d;
+	w->n = n;
+	w->mem = mem ? NULL :
+		xmalloc(GEOMEDIAN_WORKSPACE_SIZE(d,n) * sizeof*w->mem);
+	w->t = mem ? mem : w->mem;
+	w->seed = 0;
+	w->tol = 1e-7;
+	w->maxit = 200;
+	w->niter = 0;
+	w->energy = NAN;
+}
+
+static void geomedian_workspace_free(struct geomedian_workspace *w)
+{
+	free(w->mem);
+	w->mem = w->t = NULL;
+}
+
+// random integer in [0, n) (linear congruential generator of Knuth)
+static int geomedian_random(struct geomedian_workspace *w, int n)
+{
+	w->seed = 6364136223846793005 * w->seed + 1442695040888963407;
+	return (w->seed >> 33) % n;
+}
+
+static double geomedian_dist(double *p, double *q, int d)
+{
+	double r = 0;
+	for (int k = 0; k < d; k++)
+		r += (p[k] - q[k]) * (p[k] - q[k]);
+	return sqrt(r);
+}
+
+// sum of the distances from y to the points x[i][]
+static double geomedian_energy(double *x, int d, int n, double *y)
+{
+	double r = 0;
+	for (int i = 0; i < n; i++)
+		r += geomedian_dist(x + i*d, y, d);
+	return r;
+}
+
+// the k-th smallest value of t[0..n-1] (the array is reordered)
+static double geomedian_select(double *t, int n, int k)
+{
+	int a = 0, b = n - 1;
+	while (a < b)
+	{
+		double p = t[(a + b) / 2];
+		int i = a, j = b;
+		while (i <= j)
+		{
+			while (t[i] < p) i += 1;
+			while (t[j] > p) j -= 1;
+			if (i <= j) {
+				double s = t[i]; t[i] = t[j]; t[j] = s;
+				i += 1;
+				j -= 1;
+			}
+		}
+		if (k <= j) b = j;
+		else if (k >= i) a = i;
+		else break;
+	}
+	return t[k];
+}
+
+// y = crude approximation of the median (a point of a random subset)
+static void geomedian_crude(double *y, double *x, int d, int n,
+		struct geomedian_workspace *w)
+{
+	int K = GEOMEDIAN_CRUDE_K, S1[K], S2[K];
+	for (int i = 0; i < K; i++)
+	{
+		S1[i] = geomedian_random(w, n);
+		S2[i] = geomedian_random(w, n);
+	}
+	double *a = w->t + w->n + 3 * w->d; // K*K distances
+	int p = lrint(0.65 * (K - 1)), best = 0;
+	double best_q = INFINITY;
+	for (int i = 0; i < K; i++)
+	{
+		for (int j = 0; j < K; j++)
+			a[j] = geomedian_dist(x + S2[i]*d, x + S1[j]*d, d);
+		double q = geomedian_select(a, K, p);
+		if (q < best_q) {
+			best_q = q;
+			best = S2[i];
+		}
+	}
+	for (int k = 0; k < d; k++)
+		y[k] = x[best*d + k];
+}
+
+// y[] = geometric median of the points x[i][], for i in [0, n)
+// (returns the number of iterations, also stored in the workspace)
+static int geomedian(double *y, double *x, int d, int n,
+		struct geomedian_workspace *w)
+{
+	assert(d <= w->d && n <= w->n);
+	w->niter = 0;
+	if (n < 1) {
+		for (int k = 0; k < d; k++)
+			y[k] = NAN;
+		w->energy = NAN;
+		return 0;
+	}
+
+	// exact cases (the midpoints of the segments of minima)
+	if (n <= 2 || d == 1) {
+		for (int k = 0; k < d; k++)
+			if (n <= 2)
+				y[k] = (x[k] + x[(n-1)*d + k]) / 2;
+			else {
+				for (int i = 0; i < n; i++)
+					w->t[i] = x[i];
+				double m0 = geomedian_select(w->t, n, (n-1)/2);
+				double m1 = geomedian_select(w->t, n, n/2);
+				y[k] = (m0 + m1) / 2;
+			}
+		w->energy = geomedian_energy(x, d, n, y);
+		return 0;
+	}
+
+	// initial point
+	double *c = w->t + w->n, *a = c + w->d, *r = a + w->d;
+	for (int k = 0; k < d; k++)
+	{
+		for (int i = 0; i < n; i++)
+			w->t[i] = x[i*d + k];
+		y[k] = geomedian_select(w->t, n, n / 2);
+	}
+	double E = geomedian_energy(x, d, n, y);
+	if (n > GEOMEDIAN_CRUDE_N) {
+		geomedian_crude(c, x, d, n, w);
+		double Ec = geomedian_energy(x, d, n, c);
+		if (Ec < E) {
+			for (int k = 0; k < d; k++)
+				y[k] = c[k];
+			E = Ec;
+		}
+	}
+	double scale = E / n; // average distance to the median
+
+	// Weiszfeld iterations, modified by Vardi and Zhang
+	while (w->niter < w->maxit)
+	{
+		double b = 0; // sum of the weights
+		int eta = 0;  // number of points at y
+		for (int k = 0; k < d; k++)
+			a[k] = r[k] = 0;
+		for (int i = 0; i < n; i++)
+		{
+			double *xi = x + i*d;
+			double di = geomedian_dist(xi, y, d);
+			if (!di) {
+				eta += 1;
+				continue;
+			}
+			for (int k = 0; k < d; k++)
+			{
+				a[k] += xi[k] / di;
+				r[k] += (xi[k] - y[k]) / di;
+			}
+			b += 1 / di;
+		}
+		if (!b) break; // all the points are at y
+		double rn = 0;
+		for (int k = 0; k < d; k++)
+			rn += r[k] * r[k];
+		rn = sqrt(rn);
+		if (eta && rn <= eta) break; // y is a point and the median
+		double g = eta ? eta / rn : 0;
+		double step = 0;
+		for (int k = 0; k < d; k++)
+		{
+			double yk = (1 - g) * a[k] / b + g * y[k];
+			step += (yk - y[k]) * (yk - y[k]);
+			y[k] = yk;
+		}
+		w->niter += 1;
+		if (!(sqrt(step) > w->tol * scale))
+			break;
+	}
+	w->energy = geomedian_energy(x, d, n, y);
+	return w->niter;
+}
+
+#endif//_GEOMEDIAN_CORE_C
@@ -17,13 +17,16 @@ int main(int c, char *v[])
 	int w, h, pd;
 	if (!t && !T) {
 		fprintf(stderr, "getbands standard...\n");
-		float *x = iio_read_image_float_split(filename_in, &w, &h, &pd);
+		// with -n, only the band k is read from the file
+		char fname[FILENAME_MAX];
+		snprintf(fname, FILENAME_MAX, k >= 0 ? "%s,bands=%d" : "%s",
+				filename_in, k);
+		float *x = iio_read_image_float_split(fname, &w, &h, &pd);
 		fprintf(stderr, "getbands standard w=%d h=%d pd=%d\n",w,h,pd);
 		for (int i = 0; i < pd; i++)
 		{
-			if (k>=0 && k!=i) continue;
 			char n[FILENAME_MAX];
-			snprintf(n, FILENAME_MAX, filepat_out, i);
+			snprintf(n, FILENAME_MAX, filepat_out, k >= 0 ? k : i);
 			iio_write_image_float(n, x + w*h*i, w, h);
 		}
 	} else if (!T) {
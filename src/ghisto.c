@@ -5,8 +5,13 @@
 #include <math.h>
 #include "iio.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "xmalloc.c"
 #include "smapa.h"
+#include "streamstats.c"
 
 SMART_PARAMETER_SILENT(HISMOOTH,0)
 SMART_PARAMETER_SILENT(SHOWSTATS,0)
@@ -104,11 +109,92 @@ static void dump_histogram(long double (*h)[2], int n)
 	free(a);
 }
 
+SMART_PARAMETER_SILENT(GHISTO_BAND_MB,64)
+
+// histogram of nbins fixed bins between lo and hi (or the extrema of the
+// samples, if lo >= hi), computed from the bands of rows of the image
+// (the image is read twice when the extrema are needed)
+static int fill_histogram_stream(long double (*o)[2], int nbins,
+		double lo, double hi, char *filename)
+{
+	int w, h, pd;
+	struct iio_stream *s = iio_open(filename, &w, &h, &pd);
+	if (!s) fail("ghisto: could not open image \"%s\"", filename);
+	int band = streamstats_band_height(GHISTO_BAND_MB(), w, h, pd);
+	float *x = xmalloc(w * (size_t)band * pd * sizeof*x);
+
+	int nt = 1;
+#ifdef _OPENMP
+	nt = omp_get_max_threads();
+#endif
+	if (lo >= hi) {
+		struct streamstats_moments m[1], t[nt];
+		streamstats_moments_init(m);
+		for (int j = 0; j < h; j += band)
+		{
+			int r = j + band < h ? band : h - j;
+			iio_read_rows(s, x, j, r);
+			long rn = r * (long)w * pd, cn = (rn + nt - 1) / nt;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+			for (int k = 0; k < nt; k++)
+			{
+				long a = k * cn, b = a + cn < rn ? a + cn : rn;
+				streamstats_moments_init(t + k);
+				if (a < b)
+					streamstats_moments_add(t + k, x + a, b - a);
+			}
+			for (int k = 0; k < nt; k++)
+				streamstats_moments_merge(m, t + k);
+		}
+		lo = m->min;
+		hi = m->max;
+	}
+
+	struct streamstats_histogram H[1], t[nt];
+	streamstats_histogram_init(H, nbins, lo, hi);
+	for (int k = 0; k < nt; k++)
+		streamstats_histogram_init(t + k, nbins, lo, hi);
+	for (int j = 0; j < h; j += band)
+	{
+		int r = j + band < h ? band : h - j;
+		iio_read_rows(s, x, j, r);
+		long rn = r * (long)w * pd, cn = (rn + nt - 1) / nt;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int k = 0; k < nt; k++)
+		{
+			long a = k * cn, b = a + cn < rn ? a + cn : rn;
+			if (a < b)
+				streamstats_histogram_add(t + k, x + a, b - a);
+		}
+	}
+	for (int k = 0; k < nt; k++)
+	{
+		streamstats_histogram_merge(H, t + k);
+		streamstats_histogram_free(t + k);
+	}
+
+	for (int i = 0; i < nbins; i++)
+	{
+		o[i][0] = streamstats_histogram_center(H, i);
+		o[i][1] = H->count[i];
+	}
+	streamstats_histogram_free(H);
+	free(x);
+	iio_close(s);
+	if (HISMOOTH() > 0)
+		smooth_histogram_rw(o, nbins, HISMOOTH());
+	return nbins;
+}
+
 static char *help_string_name     = "ghisto";
 static char *help_string_version  = "ghisto 1.0\n\nWritten by eml";
 static char *help_string_oneliner = "compute the histogram of an image, in gnuplot format";
 static char *help_string_usage    = "usage:\n\t"
-"ghisto [-p] [img.png] > histo.g";
+"ghisto [-p] [-b nbins [-r min,max]] [img.png] > histo.g";
 static char *help_string_long     =
 "Ghisto computes the histogram of an image.\n"
 "\n"
@@ -116,12 +202,16 @@ static char *help_string_long     =
 "Notice that no quantization is made by this program, if the input image\n"
 "is floating point, it is likely that all pixel values will be different\n"
 "and the histogram will look flat.\n"
+"With -b, the values are counted into a fixed number of bins instead, and\n"
+"the image is read by bands of rows, so that it is never loaded whole.\n"
 "\n"
 "Usage: ghisto img.png > histo.g\n"
 "   or: cat img.png | ghisto > histo.g\n"
 "\n"
 "Options:\n"
 " -p\t\twrite a png-producing gnuplot program\n"
+" -b N\t\tcount the samples into N equal bins\n"
+" -r a,b\t\trange of the bins (default: from min to max sample)\n"
 " -h\t\tdisplay short help message\n"
 " --help\t\tdisplay longer help message\n"
 "\n"
@@ -142,13 +232,27 @@ int main_ghisto(int c, char *v[])
 	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
 
 	bool term_png = pick_option(&c, &v, "p", NULL);
+	int nbins = atoi(pick_option(&c, &v, "b", "0"));
+	char *range = pick_option(&c, &v, "r", "");
 	if (c != 2 && c != 1) {
-		fprintf(stderr, "usage:\n\t%s [in]\n", *v);
-		//                         0   1
+		fprintf(stderr, "usage:\n\t%s [-b nbins [-r a,b]] [in]\n", *v);
+		//                                           0   1
 		return EXIT_FAILURE;
 	}
 	char *filename_in = c > 1 ? v[1] : "-";
 
+	if (nbins > 0) {
+		double lo = 0, hi = 0;
+		if (*range && 2 != sscanf(range, "%lf,%lf", &lo, &hi))
+			fail("ghisto: bad range \"%s\"", range);
+		if (term_png) printf("set term pngcairo\n");
+		long double (*his)[2] = xmalloc(nbins * sizeof*his);
+		int nh = fill_histogram_stream(his, nbins, lo, hi, filename_in);
+		dump_histogram(his, nh);
+		free(his);
+		return EXIT_SUCCESS;
+	}
+
 	int w, h;
 	float *x = iio_read_image_float(filename_in, &w, &h);
 
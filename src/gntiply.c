@@ -7,10 +7,21 @@
 
 void ntiply_naive(float *y, float *x, int w, int h, int p, int f)
 {
-	for (int j = 0; j < f*h; j++)
-	for (int i = 0; i < f*w; i++)
-	for (int l = 0; l < p  ; l++)
-		y[p*(f*w*j+i)+l] = x[p*(w*(j/f)+i/f)+l];
+	// each row is built once, then copied f-1 times
+	size_t n = (size_t)f * w * p; // samples of an output row
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float *yj = y + f * j * n, *xj = x + p * (size_t)w * j;
+		for (int i = 0; i < w; i++)
+		for (int k = 0; k < f; k++)
+		for (int l = 0; l < p; l++)
+			yj[p*(f*i+k)+l] = xj[p*i+l];
+		for (int k = 1; k < f; k++)
+			memcpy(yj + k * n, yj, n * sizeof*yj);
+	}
 }
 
 // getpixel with nearest-neighbour extrapolation
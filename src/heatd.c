@@ -66,9 +66,33 @@ void linear_diffusion_step(
 		float t          // timestep
 		)
 {
+	// the step is explicit, so that the rows are independent; away from
+	// the boundary the scheme is applied by direct indexing
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-		y[j*w+i] = x[j*w+i] + t * laplacian(x, A, w, h, i, j);
+	{
+		float *yj = y + j*w, *xj = x + j*w;
+		if (j == 0 || j == h-1 || w < 3) {
+			for (int i = 0; i < w; i++)
+				yj[i] = xj[i] + t * laplacian(x, A, w, h, i, j);
+			continue;
+		}
+		yj[0] = xj[0] + t * laplacian(x, A, w, h, 0, j);
+		yj[w-1] = xj[w-1] + t * laplacian(x, A, w, h, w-1, j);
+		float *u = xj - w, *d = xj + w, *Aj = A ? A + 3*j*w : A;
+		for (int i = 1; i < w-1; i++)
+		{
+			float a = Aj ? Aj[3*i+0] : 1;
+			float b = Aj ? Aj[3*i+1] : 0;
+			float c = Aj ? Aj[3*i+2] : 1;
+			float r = b/2 * u[i-1] + c * u[i] - b/2 * u[i+1]
+				+ a * xj[i-1] + (-2*a-2*c) * xj[i] + a * xj[i+1]
+				- b/2 * d[i-1] + c * d[i] + b/2 * d[i+1];
+			yj[i] = xj[i] + t * (r/4);
+		}
+	}
 }
 
 void linear_diffusion(
@@ -47,50 +47,282 @@ float nearest_neighbor_interpolator(float *x, int w, int h, float p, float q)
 	return x[w*iq+ip];
 }
 
-int homwarp(float *X, int W, int H, double M[9], float *x,
-		int w, int h, int o)
+// Warping engine.
+//
+// The output image is processed by square tiles, in parallel.  The input
+// samples read by a tile are thus close to each other, and they stay in the
+// cache.  Along each row of a tile, the numerator and the denominator of the
+// homography are updated by additions (they are computed directly at the
+// start of each row of each tile, so that the rounding errors do not pile
+// up).  Each interpolator gets its own tile function, where it is inlined.
+
+#define HOMWARP_TILE 64
+
+typedef void (*homwarp_tile_t)(float*,int,int,double*,float*,int,int,
+		int,int,int);
+
+// warp the tile of the output X that starts at (i0,j0)
+static inline void homwarp_tile(float *X, int W, int H, double M[9],
+		float *x, int w, int h, int i0, int j0, gray_interpolator_t u)
 {
-	gray_interpolator_t u = bicubic_interpolation_gray;
-	if (o == 0) u = nearest_neighbor_interpolator;
-	if (o == 1) u = marching_interpolation_at;
-	if (o == 2) u = bilinear_interpolation_at;
-	if (o ==-2) u = quilez3_interpolation_at;
-	if (o ==-4) u = quilez5_interpolation_at;
+	int i1 = i0 + HOMWARP_TILE < W ? i0 + HOMWARP_TILE : W;
+	int j1 = j0 + HOMWARP_TILE < H ? j0 + HOMWARP_TILE : H;
+	for (int j = j0; j < j1; j++)
+	{
+		double P = M[0]*i0 + M[1]*j + M[2];
+		double Q = M[3]*i0 + M[4]*j + M[5];
+		double R = M[6]*i0 + M[7]*j + M[8];
+		for (int i = i0; i < i1; i++)
+		{
+			X[j*W+i] = u(x, w, h, P / R, Q / R);
+			P += M[0];
+			Q += M[3];
+			R += M[6];
+		}
+	}
+}
+
+#define HOMWARP_TILE_FOR(u) static void homwarp_tile_ ## u(float *X, int W, \
+		int H, double M[9], float *x, int w, int h, int i0, int j0, \
+		int o) { (void)o; homwarp_tile(X, W, H, M, x, w, h, i0, j0, u); }
+HOMWARP_TILE_FOR(nearest_neighbor_interpolator)
+HOMWARP_TILE_FOR(marching_interpolation_at)
+HOMWARP_TILE_FOR(bilinear_interpolation_at)
+HOMWARP_TILE_FOR(quilez3_interpolation_at)
+HOMWARP_TILE_FOR(quilez5_interpolation_at)
+HOMWARP_TILE_FOR(bicubic_interpolation_gray)
 
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
+// warp a tile using the splines of order o (of a pre-filtered image x)
+static void homwarp_tile_spline(float *X, int W, int H, double M[9],
+		float *x, int w, int h, int i0, int j0, int o)
+{
+	int i1 = i0 + HOMWARP_TILE < W ? i0 + HOMWARP_TILE : W;
+	int j1 = j0 + HOMWARP_TILE < H ? j0 + HOMWARP_TILE : H;
+	float q[HOMWARP_TILE][2];
+	for (int j = j0; j < j1; j++)
 	{
-		double p[2] = {i, j};
-		apply_homography(p, M, p);
-		X[j*W+i] = u(x, w, h, p[0], p[1]);
+		double P = M[0]*i0 + M[1]*j + M[2];
+		double Q = M[3]*i0 + M[4]*j + M[5];
+		double R = M[6]*i0 + M[7]*j + M[8];
+		for (int i = i0; i < i1; i++)
+		{
+			// (the 0.5 solves a mis-alignement convention)
+			q[i-i0][0] = P / R + 0.5;
+			q[i-i0][1] = Q / R + 0.5;
+			P += M[0];
+			Q += M[3];
+			R += M[6];
+		}
+		evaluate_spline_at_points(X + (j*W + i0), x, w, h, 1, o,
+				q, i1 - i0);
 	}
+}
 
-	return 0;
+// run the tile function f on all the tiles of the output, in parallel
+static void homwarp_engine(float *X, int W, int H, double M[9], float *x,
+		int w, int h, int o, homwarp_tile_t f)
+{
+	int nx = (W + HOMWARP_TILE - 1) / HOMWARP_TILE;
+	int ny = (H + HOMWARP_TILE - 1) / HOMWARP_TILE;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int t = 0; t < nx * ny; t++)
+		f(X, W, H, M, x, w, h, HOMWARP_TILE*(t%nx), HOMWARP_TILE*(t/nx), o);
 }
 
-int shomwarp(float *X, int W, int H, double M[9], float *x,
+int homwarp(float *X, int W, int H, double M[9], float *x,
 		int w, int h, int o)
+{
+	homwarp_tile_t f = homwarp_tile_bicubic_interpolation_gray;
+	if (o == 0) f = homwarp_tile_nearest_neighbor_interpolator;
+	if (o == 1) f = homwarp_tile_marching_interpolation_at;
+	if (o == 2) f = homwarp_tile_bilinear_interpolation_at;
+	if (o ==-2) f = homwarp_tile_quilez3_interpolation_at;
+	if (o ==-4) f = homwarp_tile_quilez5_interpolation_at;
+	homwarp_engine(X, W, H, M, x, w, h, o, f);
+	return 0;
+}
+
+// like "shomwarp", but the spline coefficients of x are kept in the cache t
+// (so that warping the same image again does not filter it again)
+int shomwarp_cached(float *X, int W, int H, double M[9],
+		struct spline_cache *t, float *x, int w, int h, int o)
 {
 	// if low order-interpolation, evaluate right away
-	if (o == 0 || o == 1 || o == 2 || o == -2 || o == -3)
+	if (o == 0 || o == 1 || o == 2 || o == -2 || o == -3 || o == -4)
 		return homwarp(X, W, H, M, x, w, h, o);
 
-	// otherwise, pre-filtering is required
-	bool r = prepare_spline(x, w, h, 1, o);
-	if (!r) return 2;
+	// otherwise, pre-filtering is required (on a copy, x is kept)
+	float *c = spline_cache_get(t, x, w, h, 1, o);
+	if (!c) return 2;
 
 	// warp the points
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
+	homwarp_engine(X, W, H, M, c, w, h, o, homwarp_tile_spline);
+	return 0;
+}
+
+int shomwarp(float *X, int W, int H, double M[9], float *x,
+		int w, int h, int o)
+{
+	struct spline_cache t = SPLINE_CACHE_INIT;
+	int r = shomwarp_cached(X, W, H, M, &t, x, w, h, o);
+	spline_cache_free(&t);
+	return r;
+}
+
+// Device engine.
+//
+// With a compiler that supports the offloading of OpenMP (e.g., gcc built
+// with nvptx or amdgcn targets, using -foffload as in the Makefile), the
+// low-order warps run on the accelerator; otherwise, or when there is no
+// device, the same loops run on the host.  The output is processed by bands
+// of rows, and only the band and the rows of the input that it reads are
+// sent to the device, so that the images larger than its memory can be
+// warped.  Each thread of the device computes a row of a tile exactly like
+// "homwarp_tile", so that the results are those of the CPU engine (up to the
+// contraction of the arithmetic into fused multiply-adds by the device).
+// The environment variable HOMWARP_GPU_MEGABYTES bounds the size of the
+// bands (default 512).  The other orders are computed by the CPU engine.
+
+#include "smapa.h"
+SMART_PARAMETER_SILENT(HOMWARP_GPU_MEGABYTES,512)
+
+#ifdef _OPENMP
+#pragma omp declare target
+#endif
+static float homwarp_dev_clamp(float *x, int w, int h, int i, int j)
+{
+	if (i < 0) i = 0;
+	if (j < 0) j = 0;
+	if (i >= w) i = w - 1;
+	if (j >= h) j = h - 1;
+	return x[i+j*(long)w];
+}
+
+static float homwarp_dev_zero(float *x, int w, int h, int i, int j)
+{
+	if (i < 0 || i >= w || j < 0 || j >= h)
+		return 0;
+	return x[i+j*(long)w];
+}
+
+static float homwarp_dev_cubic(float v[4], float x)
+{
+	return v[1] + 0.5 * x*(v[2] - v[0]
+			+ x*(2.0*v[0] - 5.0*v[1] + 4.0*v[2] - v[3]
+			+ x*(3.0*(v[1] - v[2]) + v[3] - v[0])));
+}
+
+// the sample at (p,q) of an image of w*h pixels whose rows are stored from
+// the row j0 on, for the interpolator of order o (the same computation as
+// the functions used by "homwarp")
+static float homwarp_dev_sample(float *x, int w, int h, int j0,
+		float p, float q, int o)
+{
+	x -= j0 * (long)w;
+	if (o == 0) {
+		int ip = round(p);
+		int iq = round(q);
+		return homwarp_dev_clamp(x, w, h, ip, iq);
+	}
+	if (o == 2) {
+		int ip = p;
+		int iq = q;
+		float a = homwarp_dev_clamp(x, w, h, ip  , iq  );
+		float b = homwarp_dev_clamp(x, w, h, ip+1, iq  );
+		float c = homwarp_dev_clamp(x, w, h, ip  , iq+1);
+		float d = homwarp_dev_clamp(x, w, h, ip+1, iq+1);
+		float u = p - ip, v = q - iq, r = 0;
+		r += a * (1-u) * (1-v);
+		r += b * ( u ) * (1-v);
+		r += c * (1-u) * ( v );
+		r += d * ( u ) * ( v );
+		return r;
+	}
+	p -= 1;
+	q -= 1;
+	int ip = floor(p);
+	int iq = floor(q);
+	float c[4][4], v[4];
+	for (int j = 0; j < 4; j++)
+	for (int i = 0; i < 4; i++)
+		c[i][j] = homwarp_dev_zero(x, w, h, ip + i, iq + j);
+	for (int i = 0; i < 4; i++)
+		v[i] = homwarp_dev_cubic(c[i], q - iq);
+	return homwarp_dev_cubic(v, p - ip);
+}
+#ifdef _OPENMP
+#pragma omp end declare target
+#endif
+
+// rows of the input read by the output rows [j0,j1) (all of them, when the
+// rows cross the line at infinity of the homography)
+static void homwarp_dev_rows(int *a, int *b, int W, double M[9], int h,
+		int j0, int j1)
+{
+	*a = 0;
+	*b = h;
+	double y0 = INFINITY, y1 = -INFINITY;
+	int s = 0;
+	for (int k = 0; k < 4; k++)
 	{
-		double p[2] = {i, j};
-		apply_homography(p, M, p);
-		p[0] += 0.5; // solve a mis-alignement convention
-		p[1] += 0.5;
-		float *out = X + (j*W + i);
-		evaluate_spline_at(out, x, w, h, 1, o, p[0], p[1]);
+		double p[2] = {k % 2 ? W - 1 : 0, k / 2 ? j1 - 1 : j0}, q[2];
+		double R = M[6]*p[0] + M[7]*p[1] + M[8];
+		s += R > 0 ? 1 : R < 0 ? -1 : 0;
+		apply_homography(q, M, p);
+		y0 = fmin(y0, q[1]);
+		y1 = fmax(y1, q[1]);
 	}
+	if (abs(s) != 4 || !(y1 - y0 < h))
+		return;
+	// (margin for the support of the interpolators and for the rounding)
+	*a = fmax(0, fmin(h - 1, floor(y0) - 3));
+	*b = fmax(1, fmin(h, floor(y1) + 5));
+}
 
+// like "homwarp", on the device, for the orders 0, 2 and -3
+static int homwarp_gpu(float *X, int W, int H, double M[9], float *x,
+		int w, int h, int o)
+{
+	if (o != 0 && o != 2 && o != -3)
+		return shomwarp(X, W, H, M, x, w, h, o);
+	long budget = HOMWARP_GPU_MEGABYTES() * (1 << 20) / sizeof(float);
+	int band = budget / 2 / (W ? W : 1);
+	if (band < HOMWARP_TILE) band = HOMWARP_TILE;
+	band -= band % HOMWARP_TILE;
+	int nx = (W + HOMWARP_TILE - 1) / HOMWARP_TILE;
+	for (int j0 = 0; j0 < H; j0 += band)
+	{
+		int j1 = j0 + band < H ? j0 + band : H, ya, yb;
+		homwarp_dev_rows(&ya, &yb, W, M, h, j0, j1);
+		float *Y = X + j0 * (long)W, *y = x + ya * (long)w;
+		long N = (j1 - j0) * (long)W, n = (yb - ya) * (long)w;
+		double m[9];
+		for (int k = 0; k < 9; k++)
+			m[k] = M[k];
+#ifdef _OPENMP
+#pragma omp target teams distribute parallel for collapse(2) \
+		map(from:Y[0:N]) map(to:y[0:n],m[0:9])
+#endif
+		for (int j = j0; j < j1; j++)
+		for (int t = 0; t < nx; t++)
+		{
+			int i0 = t * HOMWARP_TILE;
+			int i1 = i0 + HOMWARP_TILE < W ? i0 + HOMWARP_TILE : W;
+			double P = m[0]*i0 + m[1]*j + m[2];
+			double Q = m[3]*i0 + m[4]*j + m[5];
+			double R = m[6]*i0 + m[7]*j + m[8];
+			for (int i = i0; i < i1; i++)
+			{
+				Y[(j-j0)*(long)W+i] = homwarp_dev_sample(y, w, h,
+						ya, P / R, Q / R, o);
+				P += m[0];
+				Q += m[3];
+				R += m[6];
+			}
+		}
+	}
 	return 0;
 }
 
@@ -99,7 +331,7 @@ static char *help_string_name     = "homwarp";
 static char *help_string_version  = "homwarp 1.0\n\nWritten by eml";
 static char *help_string_oneliner = "warp an image by an homography";
 static char *help_string_usage    = "usage:\n\t"
-"homwarp [-i] [-o ORDER] HOMOGRAPHY [W H [in [out]]]";
+"homwarp [-i] [-o ORDER] [-gpu] HOMOGRAPHY [W H [in [out]]]";
 static char *help_string_long     =
 "Homwarp resamples an image according to an homography.\n"
 "\n"
@@ -122,6 +354,7 @@ static char *help_string_long     =
 "Options:\n"
 " -i        use the inverse homography\n"
 " -o ORDER  choose a different interpolation method (default = -3)\n"
+" -gpu      run the orders 0, 2 and -3 on the accelerator, if available\n"
 " -h        display short help message\n"
 " --help    display longer help message\n"
 "\n"
@@ -154,17 +387,20 @@ static char *help_string_long     =
 #include "parsenumbers.c"
 #include "help_stuff.c"
 #include "pickopt.c"
+#include "profile.c"
 int main_homwarp(int c, char *v[])
 {
 	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
 	bool do_invert = pick_option(&c, &v, "i", NULL);
 	int order = atoi(pick_option(&c, &v, "o", "-3"));
+	bool use_gpu = pick_option(&c, &v, "gpu", NULL);
 	if (c != 2 && c != 4 && c != 5 && c != 6)
 		return fprintf(stderr, "usage:\n\t"
-		"%s [-i] [-o {0|1|2|-3|3|5|7}] hom [w h [in [out]]]\n"
+		"%s [-i] [-o {0|1|2|-3|3|5|7}] [-gpu] hom [w h [in [out]]]\n"
 		//0                            1   2 3  4   5
 		"\t-i\tinvert input homography\n"
 		"\t-o\tchose interpolation order (default -3 = bicubic)\n"
+		"\t-gpu\twarp on the accelerator\n"
 		, *v);
 	double H_direct[9], H_inv[9];
 	read_n_doubles_from_string(H_direct, v[1], 9);
@@ -182,8 +418,10 @@ int main_homwarp(int c, char *v[])
 	float *y = xmalloc(ow * oh * pd * sizeof*y);
 
 	int r = 0;
+	PROFILE_SCOPE("homwarp")
 	for (int i = 0; i < pd; i++)
-		r += shomwarp(y + i*ow*oh, ow, oh, H, x + i*w*h, w, h, order);
+		r += (use_gpu ? homwarp_gpu : shomwarp)(y + i*ow*oh, ow, oh, H,
+				x + i*w*h, w, h, order);
 
 	iio_write_image_float_split(filename_out, y, ow, oh, pd);
 	return r;
@@ -42,6 +42,8 @@
 //#define I_CAN_HAS_LIBHEIF
 //#define I_CAN_HAS_LIBHDF5
 //#define I_CAN_HAS_LIBEXR
+//#define I_CAN_HAS_ZLIB
+//#define I_CAN_HAS_LIBZSTD
 
 #define I_CAN_HAS_WGET
 #define I_CAN_HAS_WHATEVER
@@ -110,6 +112,14 @@
 #undef I_CAN_HAS_LIBHEIF
 #endif
 
+#ifdef IIO_DISABLE_ZLIB
+#undef I_CAN_HAS_ZLIB
+#endif
+
+#ifdef IIO_DISABLE_LIBZSTD
+#undef I_CAN_HAS_LIBZSTD
+#endif
+
 #ifdef IIO_DISABLE_IMGLIBS
 #undef I_CAN_HAS_LIBPNG
 #undef I_CAN_HAS_LIBJPEG
@@ -191,6 +201,8 @@
 #define IIO_FORMAT_RAT 37
 #define IIO_FORMAT_WEBP 38
 #define IIO_FORMAT_HEIF 39
+#define IIO_FORMAT_SHM 40
+#define IIO_FORMAT_ZNPY 41
 #define IIO_FORMAT_UNRECOGNIZED (-1)
 
 //
@@ -245,6 +257,19 @@
 #  define I_CAN_HAS_MKSTEMP 1
 #endif
 
+#if defined(I_CAN_POSIX) && !defined(__MINGW32__)
+#  define I_CAN_HAS_MMAP 1
+#endif
+
+#if defined(I_CAN_HAS_MMAP) && _POSIX_C_SOURCE >= 200112L
+#  define I_CAN_HAS_SHM 1
+#endif
+
+#if defined(I_CAN_POSIX) && !defined(__MINGW32__)
+#  define I_CAN_HAS_PTHREAD 1
+#  include <pthread.h>
+#endif
+
 
 
 
@@ -311,6 +336,23 @@ static char *xgetenv(const char *s)
 #endif// I_CAN_GETENV
 }
 
+#ifdef _OPENMP
+#  include <omp.h>
+#endif//_OPENMP
+
+// number of threads used for decoding (IIO_THREADS, 0 = all the cores)
+static int iio_threads(void)
+{
+	char *t = xgetenv("IIO_THREADS");
+	int n = t ? atoi(t) : 1;
+#ifdef _OPENMP
+	if (n <= 0) n = omp_get_max_threads();
+#else//_OPENMP
+	n = 1;
+#endif//_OPENMP
+	return n;
+}
+
 static void fail(const char *fmt, ...) __attribute__((noreturn,format(printf,1,2)));
 static void fail(const char *fmt, ...)
 
@@ -676,7 +718,7 @@ static const char *iio_strfmt(int format)
 	M(PCX); M(GIF); M(XPM); M(RAFA); M(FLO); M(LUM); M(JUV);
 	M(PCM); M(ASC); M(RAW); M(RWA); M(PDS); M(CSV); M(VRT); M(RAT);
 	M(FFD); M(DLM); M(NPY); M(VIC); M(CCS); M(FIT); M(HDF5);
-	M(TXT); M(WEBP); M(HEIF);
+	M(TXT); M(WEBP); M(HEIF); M(SHM); M(ZNPY);
 	M(UNRECOGNIZED);
 	default: fail("caca de la grossa (%d)", format);
 	}
@@ -754,66 +796,145 @@ static void iio_image_init2d(struct iio_image *x,
 	x->rem = NULL;
 }
 
-static void inplace_swap_pixels(struct iio_image *x, int i, int j, int a, int b)
+// Flips, transposes and rotations (the 8 elements of the group D8).  Each
+// of them is a copy y(i,j) = x(a,b), where the offset of (a,b) is an affine
+// function o + i*si + j*sj of (i,j).  The copy is split recursively until
+// the blocks fit in the cache (so that the transposes do not miss the cache
+// at every pixel), and the kernels are written for the common pixel sizes.
+
+#define IIO_D8_BLOCK 0x1000 // bytes of the blocks copied directly
+#define IIO_D8_BAND 64      // rows of output given to each thread
+
+typedef struct { uint32_t v[3]; } iio_pixel12;
+typedef struct { uint64_t v[2]; } iio_pixel16;
+
+#define T(t) \
+static void d8_copy_ ## t(t *restrict y, const t *restrict x, int W, \
+		long o, long si, long sj, int i0, int i1, int j0, int j1) \
+{ \
+	int ni = i1 - i0, nj = j1 - j0; \
+	if (ni * (long)nj * sizeof(t) > IIO_D8_BLOCK && ni + nj > 2) { \
+		if (ni >= nj) { \
+			d8_copy_ ## t(y, x, W, o, si, sj, i0, i0+ni/2, j0, j1); \
+			d8_copy_ ## t(y, x, W, o, si, sj, i0+ni/2, i1, j0, j1); \
+		} else { \
+			d8_copy_ ## t(y, x, W, o, si, sj, i0, i1, j0, j0+nj/2); \
+			d8_copy_ ## t(y, x, W, o, si, sj, i0, i1, j0+nj/2, j1); \
+		} \
+		return; \
+	} \
+	for (int j = j0; j < j1; j++) \
+	for (int i = i0; i < i1; i++) \
+		y[j*(long)W + i] = x[o + i*si + j*sj]; \
+}
+T(uint8_t)
+T(uint16_t)
+T(uint32_t)
+T(uint64_t)
+T(iio_pixel12)
+T(iio_pixel16)
+#undef T
+
+// generic pixel size (by rows of blocks, without recursion)
+static void d8_copy_bytes(char *y, const char *x, int W, int ps,
+		long o, long si, long sj, int j0, int j1)
+{
+	int b = 1 + IIO_D8_BLOCK / ps / (j1 - j0);
+	for (int i0 = 0; i0 < W; i0 += b)
+	for (int j = j0; j < j1; j++)
+	for (int i = i0; i < i0 + b && i < W; i++)
+		memcpy(y + ps * (j*(long)W + i), x + ps * (o + i*si + j*sj), ps);
+}
+
+// the transformation "op" as flips of each axis (fh, fv) and a transposition
+static bool d8_parse(bool *fh, bool *fv, bool *t, const char *op)
+{
+	static const char *names[][2] = {
+		{"identity", "xy"}, {"leftright", "Xy"}, {"topdown", "xY"},
+		{"r180", "XY"}, {"transpose", "yx"}, {"r90", "Yx"},
+		{"r270", "yX"}, {"posetrans", "YX"} };
+	for (unsigned k = 0; k < sizeof names / sizeof*names; k++)
+		if (0 == strcmp(op, names[k][0]))
+			op = names[k][1];
+	if (2 != strlen(op)) return false;
+	int a = toupper(op[0]), b = toupper(op[1]);
+	if (!((a == 'X' && b == 'Y') || (a == 'Y' && b == 'X'))) return false;
+	*fh = isupper(op[0]);
+	*fv = isupper(op[1]);
+	*t = a > b;
+	return true;
+}
+
+int iio_flip(void *y, int *W, int *H, void *x, int w, int h, int ps,
+		const char *op)
 {
-	if (x->dimension != 2)
-		fail("can only flip 2-dimensional images");
-	int w = x->sizes[0];
-	//int h = x->sizes[1]; // unused
-	int pixsize = x->pixel_dimension * iio_image_sample_size(x);
-	uint8_t *p = (i + j * w) * pixsize + (uint8_t*)x->data;
-	uint8_t *q = (a + b * w) * pixsize + (uint8_t*)x->data;
-	for (int k = 0; k < pixsize; k++)
+	bool fh, fv, t;
+	if (!d8_parse(&fh, &fv, &t, op)) return -1;
+
+	// the flips are applied first, then the transposition
+	long o = (fh ? w - 1 : 0) + (fv ? (h - 1) * (long)w : 0);
+	long sx = fh ? -1 : 1, sy = fv ? -(long)w : w;
+	*W = t ? h : w;
+	*H = t ? w : h;
+	long si = t ? sy : sx;
+	long sj = t ? sx : sy;
+
+	int nw = *W, nh = *H;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads()) schedule(dynamic)
+#endif
+	for (int j0 = 0; j0 < nh; j0 += IIO_D8_BAND)
 	{
-		uint8_t tmp = p[k];
-		p[k] = q[k];
-		q[k] = tmp;
+		int j1 = j0 + IIO_D8_BAND < nh ? j0 + IIO_D8_BAND : nh;
+		switch (ps) {
+#define T(t) d8_copy_ ## t(y, x, nw, o, si, sj, 0, nw, j0, j1); break;
+		case 1: T(uint8_t)
+		case 2: T(uint16_t)
+		case 4: T(uint32_t)
+		case 8: T(uint64_t)
+		case 12: T(iio_pixel12)
+		case 16: T(iio_pixel16)
+#undef T
+		default: d8_copy_bytes(y, x, nw, ps, o, si, sj, j0, j1);
+		}
 	}
+	return 0;
 }
 
-static void inplace_flip_horizontal(struct iio_image *x)
+// apply the transformation "op" to an image (its data is replaced)
+static void inplace_flip(struct iio_image *x, const char *op)
 {
+	if (x->dimension != 2)
+		fail("can only flip 2-dimensional images");
 	int w = x->sizes[0];
 	int h = x->sizes[1];
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w/2; i++)
-		inplace_swap_pixels(x, i, j, w - i - 1, j);
+	int ps = x->pixel_dimension * iio_image_sample_size(x);
+	void *y = xmalloc(w * (size_t)h * ps);
+	if (iio_flip(y, x->sizes + 0, x->sizes + 1, x->data, w, h, ps, op))
+		fail("unknown flip \"%s\"", op);
+	xfree(x->data);
+	x->data = y;
+}
+
+static void inplace_flip_horizontal(struct iio_image *x)
+{
+	inplace_flip(x, "leftright");
 }
 
 static void inplace_flip_vertical(struct iio_image *x)
 {
-	int w = x->sizes[0];
-	int h = x->sizes[1];
-	for (int j = 0; j < h/2; j++)
-	for (int i = 0; i < w; i++)
-		inplace_swap_pixels(x, i, j, i, h - j - 1);
+	inplace_flip(x, "topdown");
 }
 
 static void inplace_transpose(struct iio_image *x)
 {
-	int w = x->sizes[0];
-	int h = x->sizes[1];
-	if (w != h)
-	{
-		void rectangular_not_inplace_transpose(struct iio_image*);
-		rectangular_not_inplace_transpose(x);
-	} else {
-		for (int i = 0; i < w; i++)
-		for (int j = 0; j < i; j++)
-			inplace_swap_pixels(x, i, j, j, i);
-	}
+	inplace_flip(x, "transpose");
 }
 
 static void inplace_reorient(struct iio_image *x, int orientation)
 {
-	int orx = orientation & 0xff;
-	int ory = (orientation & 0xff00)/0x100;
-	if (isupper(orx))
-		inplace_flip_horizontal(x);
-	if (isupper(ory))
-		inplace_flip_vertical(x);
-	if (toupper(orx) > toupper(ory))
-		inplace_transpose(x);
+	char op[3] = { orientation & 0xff, (orientation & 0xff00)/0x100, 0 };
+	inplace_flip(x, op);
 }
 
 static int insideP(int w, int h, int i, int j)
@@ -862,29 +983,120 @@ static void inplace_trim(struct iio_image *x,
 	xfree(old_data);
 }
 
-void rectangular_not_inplace_transpose(struct iio_image *x)
+// region of interest requested by "iio_read_image_float_vec_roi" on the file
+// "fname" (the readers that can decode only a part of it set "done")
+#  if __STDC_VERSION__ >= 201112L
+_Thread_local
+#  endif
+static struct iio_roi { const char *fname; bool done; int x0, y0, xf, yf; }
+global_roi;
+
+// clip the region of interest to an image of size w x h
+// (non-positive values of "xf" and "yf" are relative to the right and bottom)
+static void global_roi_rectangle(int *x0, int *y0, int *rw, int *rh,
+		int w, int h)
 {
-	assert(2 == x->dimension);
-	int ps = x->pixel_dimension * iio_image_sample_size(x); // pixel_size
-	int w = x->sizes[0];
-	int h = x->sizes[1];
-	int nw = h;
-	int nh = w;
-	char *old_data = x->data;
-	char *new_data = xmalloc(nw * nh * ps);
-	for (int i = 0; i < nw*nh*ps; i++)
-		((char*)new_data)[i] = 1;
-	for (int j = 0; j < nh; j++)
-	for (int i = 0; i < nw; i++)
-		memcpy(
-			new_data + ps * (j*nw + i),
-			old_data + ps * (i*w  + j),
-			ps
-		);
-	x->sizes[0] = nw;
-	x->sizes[1] = nh;
-	x->data = new_data;
-	xfree(old_data);
+	int xf = global_roi.xf > 0 ? global_roi.xf : w + global_roi.xf;
+	int yf = global_roi.yf > 0 ? global_roi.yf : h + global_roi.yf;
+	*x0 = global_roi.x0 < 0 ? 0 : global_roi.x0 > w ? w : global_roi.x0;
+	*y0 = global_roi.y0 < 0 ? 0 : global_roi.y0 > h ? h : global_roi.y0;
+	if (xf > w) xf = w;
+	if (yf > h) yf = h;
+	*rw = xf - *x0;
+	*rh = yf - *y0;
+	if (*rw <= 0 || *rh <= 0)
+		fail("empty region of interest %d %d %d %d in a %dx%d image",
+				global_roi.x0, global_roi.y0,
+				global_roi.xf, global_roi.yf, w, h);
+}
+
+// bands requested by a filename suffix like "img.tif,bands=3,5,9" on the file
+// "fname" (the readers that can skip the other bands set "done"); the output
+// channel k is the band b[k] of the file, counted from 0
+#  if __STDC_VERSION__ >= 201112L
+_Thread_local
+#  endif
+static struct iio_bands { const char *fname; bool done; int n, *b; }
+global_bands;
+
+// position of the band selection in a filename like "img.tif,bands=3,5,9"
+// (it is the last suffix; the bands are numbers from 0, or ranges like "10-20")
+static char *bands_options_suffix(const char *filename)
+{
+	char *p = strstr(filename, ",bands=");
+	while (p && strstr(p + 1, ",bands="))
+		p = strstr(p + 1, ",bands=");
+	if (!p || !p[7] || p[7 + strspn(p + 7, "0123456789,-")])
+		return NULL;
+	return p;
+}
+
+// parse the list of bands "3,5,9" or "10-20" into b (if not NULL), and
+// return their number
+static int parse_bands(int *b, const char *s)
+{
+	int n = 0;
+	while (*s)
+	{
+		int a, z, k = 0;
+		if (2 == sscanf(s, "%d-%d%n", &a, &z, &k) && k);
+		else if (1 == sscanf(s, "%d%n", &a, &k) && k) z = a;
+		else fail("bad band list \"%s\"", s);
+		if (a > z) fail("bad band range %d-%d", a, z);
+		for (int l = a; l <= z; l++, n++)
+			if (b) b[n] = l;
+		s += k;
+		if (*s == ',') s += 1;
+	}
+	return n;
+}
+
+// whether the selected bands are to be read by the reader of the file with
+// pd bands (they must exist in the file)
+static bool global_bands_apply(const char *fname, int pd)
+{
+	if (!fname || !global_bands.fname || global_bands.done
+			|| strcmp(fname, global_bands.fname))
+		return false;
+	for (int k = 0; k < global_bands.n; k++)
+		if (global_bands.b[k] >= pd)
+			return false;
+	return true;
+}
+
+// keep only the selected bands of an image that was read whole
+static void inplace_select_bands(struct iio_image *x, int *b, int n)
+{
+	int pd = x->pixel_dimension;
+	size_t ss = iio_image_sample_size(x);
+	size_t np = iio_image_number_of_samples(x) / pd;
+	for (int k = 0; k < n; k++)
+		if (b[k] >= pd)
+			fail("band %d does not exist (the image has %d)",
+					b[k], pd);
+	char *y = xmalloc(np * n * ss), *d = x->data;
+	for (size_t i = 0; i < np; i++)
+		for (int k = 0; k < n; k++)
+			memcpy(y + (i*n + k)*ss, d + (i*pd + b[k])*ss, ss);
+	xfree(x->data);
+	x->data = y;
+	x->pixel_dimension = n;
+}
+
+// zoom-out factor requested by "iio_read_image_float_vec_scaled" on the file
+// "fname" (the readers that can decode at a reduced size set "done" to the
+// factor that they applied)
+#  if __STDC_VERSION__ >= 201112L
+_Thread_local
+#  endif
+static struct { const char *fname; int n, done; } global_scale;
+
+// whether the image being read was requested at a reduced size
+static bool global_scale_applies(void)
+{
+	const char *f = global_variable_containing_the_name_of_the_last_opened_file;
+	return global_scale.fname && !global_scale.done
+		&& 0 == strcmp(f ? f : "-", global_scale.fname);
 }
 
 void general_copy3d_with_transposition(
@@ -951,6 +1163,217 @@ static void inplace_3dreorient(struct iio_image *x, char *s)
 }
 
 
+// profiling                                                                {{{1
+
+// If the environment variable IMSCRIPT_PROFILE is set, the reading
+// (decoding), conversion and writing (encoding) of each image are timed,
+// and so are the scopes declared by the programs (see "iio_profile_add").
+// At exit, a summary is printed into stderr, as a single line of JSON:
+//
+// {"tool":"blur","wall":0.52,"cpu":0.91,"maxrss_mb":80.1,
+//  "io":[{"op":"read","file":"x.png","format":"PNG","w":512,"h":512,"pd":3,
+//         "type":"UINT8","bytes":786432,"seconds":0.011,"convert":0.002},
+//        ...],
+//  "scopes":[{"name":"blur","n":1,"seconds":0.31}, ...]}
+//
+// where "wall" is the time since the first call to iio, and the operations
+// of "io" are "read", "map" (mapped files) and "write".
+
+#include <time.h>
+#ifdef I_CAN_POSIX
+#  include <sys/resource.h>
+#endif
+
+#define IIO_PROFILE_MAX_IO 1000
+#define IIO_PROFILE_MAX_SCOPES 100
+
+struct iio_profile_io {
+	const char *op;
+	char *file;
+	char format[16];
+	int w, h, pd, type;
+	double bytes, seconds, convert;
+};
+
+struct iio_profile_scope {
+	char *name;
+	long n;
+	double seconds;
+};
+
+static struct iio_profile {
+	int on; // 0, 1, or -1 if not yet known
+	double t0;
+	int nio, nscopes;
+	struct iio_profile_io io[IIO_PROFILE_MAX_IO];
+	struct iio_profile_scope scope[IIO_PROFILE_MAX_SCOPES];
+} global_profile = { .on = -1 };
+
+#ifdef I_CAN_HAS_PTHREAD
+static pthread_mutex_t global_profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define IIO_PROFILE_LOCK() pthread_mutex_lock(&global_profile_mutex)
+#  define IIO_PROFILE_UNLOCK() pthread_mutex_unlock(&global_profile_mutex)
+#else
+#  define IIO_PROFILE_LOCK()
+#  define IIO_PROFILE_UNLOCK()
+#endif
+
+// state of the calling thread: nesting of the timed operations, format of
+// the image being read, and record of the last image read (for conversions)
+#if __STDC_VERSION__ >= 201112L
+_Thread_local
+#endif
+static struct { int depth; const char *format; int last; }
+	global_profile_thread = { 0, NULL, -1 };
+
+// API
+double iio_profile_now(void)
+{
+#if _POSIX_C_SOURCE >= 199309L
+	struct timespec t[1];
+	clock_gettime(CLOCK_MONOTONIC, t);
+	return t->tv_sec + 1e-9 * t->tv_nsec;
+#else
+	return clock() / (double)CLOCKS_PER_SEC;
+#endif
+}
+
+static void json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; s && *s; s++)
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	fputc('"', f);
+}
+
+static void iio_profile_report(void)
+{
+	struct iio_profile *p = &global_profile;
+	char tool[100] = "";
+#ifdef I_CAN_LINUX
+	FILE *c = fopen("/proc/self/comm", "r");
+	if (c) {
+		if (!fgets(tool, sizeof tool, c)) *tool = '\0';
+		tool[strcspn(tool, "\n")] = '\0';
+		fclose(c);
+	}
+#endif
+	double cpu = clock() / (double)CLOCKS_PER_SEC, rss = 0;
+#ifdef I_CAN_POSIX
+	struct rusage u[1];
+	if (!getrusage(RUSAGE_SELF, u))
+		rss = u->ru_maxrss / 1024.0;
+#endif
+	IIO_PROFILE_LOCK();
+	FILE *f = stderr;
+	fprintf(f, "{\"tool\":");
+	json_string(f, tool);
+	fprintf(f, ",\"wall\":%g,\"cpu\":%g,\"maxrss_mb\":%g,\"io\":[",
+			iio_profile_now() - p->t0, cpu, rss);
+	for (int i = 0; i < p->nio; i++)
+	{
+		struct iio_profile_io *o = p->io + i;
+		fprintf(f, "%s{\"op\":\"%s\",\"file\":", i ? "," : "", o->op);
+		json_string(f, o->file);
+		fprintf(f, ",\"format\":");
+		json_string(f, o->format);
+		fprintf(f, ",\"w\":%d,\"h\":%d,\"pd\":%d,\"type\":\"%s\","
+				"\"bytes\":%.0f,\"seconds\":%g,\"convert\":%g}",
+				o->w, o->h, o->pd, iio_strtyp(o->type),
+				o->bytes, o->seconds, o->convert);
+	}
+	fprintf(f, "],\"scopes\":[");
+	for (int i = 0; i < p->nscopes; i++)
+	{
+		fprintf(f, "%s{\"name\":", i ? "," : "");
+		json_string(f, p->scope[i].name);
+		fprintf(f, ",\"n\":%ld,\"seconds\":%g}",
+				p->scope[i].n, p->scope[i].seconds);
+	}
+	fprintf(f, "]}\n");
+	IIO_PROFILE_UNLOCK();
+}
+
+// API
+int iio_profile_enabled(void)
+{
+	if (global_profile.on < 0) {
+		IIO_PROFILE_LOCK();
+		if (global_profile.on < 0) {
+			global_profile.t0 = iio_profile_now();
+			global_profile.on = !!xgetenv("IMSCRIPT_PROFILE");
+			if (global_profile.on)
+				atexit(iio_profile_report);
+		}
+		IIO_PROFILE_UNLOCK();
+	}
+	return global_profile.on;
+}
+
+// API
+void iio_profile_add(const char *name, double seconds)
+{
+	if (!iio_profile_enabled()) return;
+	struct iio_profile *p = &global_profile;
+	IIO_PROFILE_LOCK();
+	int i = 0;
+	while (i < p->nscopes && strcmp(p->scope[i].name, name))
+		i += 1;
+	if (i == p->nscopes && i < IIO_PROFILE_MAX_SCOPES) {
+		p->scope[i].name = strdup(name);
+		p->scope[i].n = 0;
+		p->scope[i].seconds = 0;
+		p->nscopes += 1;
+	}
+	if (i < p->nscopes) {
+		p->scope[i].n += 1;
+		p->scope[i].seconds += seconds;
+	}
+	IIO_PROFILE_UNLOCK();
+}
+
+// record an operation on the file "fname", return its index (or -1)
+static int iio_profile_io_add(const char *op, const char *fname,
+		const char *format, struct iio_image *x, double seconds)
+{
+	struct iio_profile *p = &global_profile;
+	int r = -1;
+	IIO_PROFILE_LOCK();
+	if (p->nio < IIO_PROFILE_MAX_IO) {
+		r = p->nio++;
+		struct iio_profile_io *o = p->io + r;
+		o->op = op;
+		o->file = strdup(fname);
+		snprintf(o->format, sizeof o->format, "%s",
+				format ? format : "");
+		o->w = x->sizes[0];
+		o->h = x->dimension > 1 ? x->sizes[1] : 1;
+		o->pd = x->pixel_dimension;
+		o->type = x->type;
+		o->bytes = iio_image_data_size(x);
+		o->seconds = seconds;
+		o->convert = 0;
+	}
+	IIO_PROFILE_UNLOCK();
+	return r;
+}
+
+// add the time of a conversion to the last image read by this thread
+static void iio_profile_convert(double seconds)
+{
+	int i = global_profile_thread.last;
+	if (i < 0) return;
+	IIO_PROFILE_LOCK();
+	global_profile.io[i].convert += seconds;
+	IIO_PROFILE_UNLOCK();
+}
+
+
 // data conversion                                                          {{{1
 
 // macros to crop a numeric value
@@ -1118,6 +1541,37 @@ static void convert_datum(void *dest, void *src, int dest_fmt, int src_fmt)
 	default: fail("bad conversion from %d to %d", src_fmt, dest_fmt);
 	}
 }
+
+// convert n samples of the most common pairs of types in tight loops, which
+// are vectorized by the compiler (the results are identical to those of
+// "convert_datum"), return false for the other pairs
+static bool convert_bulk(void *dest, void *src, int n,
+		int dest_fmt, int src_fmt)
+{
+#define B(a,b,ta,tb,e) case CC(a,b): {\
+		ta *restrict y = dest; tb *restrict x = src;\
+		for (int i = 0; i < n; i++) y[i] = e; } return true
+	switch(CC(dest_fmt,src_fmt)) {
+	B(F4,U8, float,    uint8_t, x[i]);
+	B(F4,U6, float,   uint16_t, x[i]);
+	B(F4,I6, float,    int16_t, x[i]);
+	B(F4,F8, float,     double, x[i]);
+	B(F8,U8, double,   uint8_t, x[i]);
+	B(F8,U6, double,  uint16_t, x[i]);
+	B(F8,I6, double,   int16_t, x[i]);
+	B(F8,F4, double,     float, x[i]);
+	B(U8,F4, uint8_t,    float, T8(0.5+x[i]));
+	B(U6,F4, uint16_t,   float, T6(0.5+x[i]));
+	B(I6,F4, int16_t,    float, x[i]);
+	B(U8,F8, uint8_t,   double, T8(0.5+x[i]));
+	B(U6,F8, uint16_t,  double, T6(0.5+x[i]));
+	B(I6,F8, int16_t,   double, x[i]);
+	B(U6,U8, uint16_t, uint8_t, x[i]);
+	B(U8,U6, uint8_t, uint16_t, T8(x[i]));
+	default: return false;
+	}
+#undef B
+}
 #undef CC
 #undef I8
 #undef U8
@@ -1129,6 +1583,22 @@ static void convert_datum(void *dest, void *src, int dest_fmt, int src_fmt)
 #undef F8
 #undef F6
 
+// convert n samples into a pre-allocated array
+static void convert_samples_into(void *dest, void *src, int n,
+		int dest_fmt, int src_fmt)
+{
+	if (convert_bulk(dest, src, n, dest_fmt, src_fmt))
+		return;
+	size_t src_width = iio_type_size(src_fmt);
+	size_t dest_width = iio_type_size(dest_fmt);
+	for (int i = 0; i < n; i++)
+	{
+		void *to   = i * dest_width + (char *)dest;
+		void *from = i * src_width  + (char *)src;
+		convert_datum(to, from, dest_fmt, src_fmt);
+	}
+}
+
 static void *convert_data(void *src, int n, int dest_fmt, int src_fmt)
 {
 	if (src_fmt == IIO_TYPE_FLOAT)
@@ -1139,55 +1609,48 @@ static void *convert_data(void *src, int n, int dest_fmt, int src_fmt)
 	IIO_DEBUG("src width = %zu\n", src_width);
 	IIO_DEBUG("dest width = %zu\n", dest_width);
 	char *r = xmalloc(n * dest_width);
-	// NOTE: the switch inside "convert_datum" should be optimized
-	// outside of this loop
-	for (int i = 0; i < n; i++)
-	{
-		void *to   = i * dest_width + r;
-		void *from = i * src_width  + (char *)src;
-		convert_datum(to, from, dest_fmt, src_fmt);
-	}
+	convert_samples_into(r, src, n, dest_fmt, src_fmt);
 	xfree(src);
 	return r;
 }
 
-static void unpack_nibbles_to_bytes(uint8_t out[2], uint8_t in)
-{
-	out[1] = (in & 0x0f);    //0b00001111
-	out[0] = (in & 0xf0)>>4; //0b11110000
-}
-
-static void unpack_couples_to_bytes(uint8_t out[4], uint8_t in)
-{
-	out[3] = (in & 0x03);    //0b00000011
-	out[2] = (in & 0x0c)>>2; //0b00001100
-	out[1] = (in & 0x30)>>4; //0b00110000
-	out[0] = (in & 0xc0)>>6; //0b11000000
-}
-
-static void unpack_bits_to_bytes(uint8_t out[8], uint8_t in)
-{
-	out[7] = (in & 1) ? 1 : 0;
-	out[6] = (in & 2) ? 1 : 0;
-	out[5] = (in & 4) ? 1 : 0;
-	out[4] = (in & 8) ? 1 : 0;
-	out[3] = (in & 16) ? 1 : 0;
-	out[2] = (in & 32) ? 1 : 0;
-	out[1] = (in & 64) ? 1 : 0;
-	out[0] = (in & 128) ? 1 : 0;
-}
-
+// expand n packed samples of 1, 2 or 4 bits (starting at the most
+// significant bits of each byte) into one byte per sample.  Each byte of
+// single bits is spread into a 64-bit word by a multiplication: the byte is
+// copied into the 8 lanes, each lane keeps a different bit, and adding 0x7f
+// moves it to the top of the lane.
 static void unpack_to_bytes_here(uint8_t *dest, uint8_t *src, int n, int bits)
 {
-	//fprintf(stderr, "unpacking %d bytes %d-fold\n", n, bits);
 	assert(bits==1 || bits==2 || bits==4);
-	//size_t unpack_factor = 8 / bits;
-	switch(bits) {
-	case 1: FORI(n)    unpack_bits_to_bytes(dest + 8*i, src[i]); break;
-	case 2: FORI(n) unpack_couples_to_bytes(dest + 4*i, src[i]); break;
-	case 4: FORI(n) unpack_nibbles_to_bytes(dest + 2*i, src[i]); break;
-	default: fail("very strange error");
-	}
+	int i = 0, k = 8 / bits;
+	if (bits == 1)
+		for (; i + 8 <= n; i += 8)
+		{
+			uint64_t t = (src[i/8] * 0x0101010101010101) &
+				0x0102040810204080;
+			t = ((t + 0x7f7f7f7f7f7f7f7f) >> 7) & 0x0101010101010101;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			t = __builtin_bswap64(t);
+#endif
+			memcpy(dest + i, &t, 8);
+		}
+	if (bits == 2)
+		for (; i + 4 <= n; i += 4)
+		{
+			unsigned v = src[i/4];
+			dest[i+0] = v >> 6;
+			dest[i+1] = v >> 4 & 3;
+			dest[i+2] = v >> 2 & 3;
+			dest[i+3] = v & 3;
+		}
+	if (bits == 4)
+		for (; i + 2 <= n; i += 2)
+		{
+			dest[i+0] = src[i/2] >> 4;
+			dest[i+1] = src[i/2] & 15;
+		}
+	for (; i < n; i++) // the last samples of a partial byte
+		dest[i] = src[i/k] >> (8 - bits - bits * (i % k)) & ((1<<bits)-1);
 }
 
 static void iio_convert_samples(struct iio_image *x, int desired_type)
@@ -1196,9 +1659,12 @@ static void iio_convert_samples(struct iio_image *x, int desired_type)
 	desired_type = normalize_type(desired_type);
 	if (source_type == desired_type) return;
 	IIO_DEBUG("converting from %s to %s\n", iio_strtyp(x->type), iio_strtyp(desired_type));
+	double t = iio_profile_enabled() ? iio_profile_now() : 0;
 	int n = iio_image_number_of_samples(x);
 	x->data = convert_data(x->data, n, desired_type, source_type);
 	x->type = desired_type;
+	if (iio_profile_enabled())
+		iio_profile_convert(iio_profile_now() - t);
 }
 
 static void iio_hacky_colorize(struct iio_image *x, int pd)
@@ -1300,6 +1766,7 @@ static void iio_hacky_uncolorizea(struct iio_image *x)
 // (of which "bufn" bytes are already read into "buf")
 //
 // Output: a malloc'd block with the whole file content
+// (followed by a terminating zero, which is not counted in the size)
 //
 // Implementation: re-invent the wheel
 static void *load_rest_of_file(long *on, FILE *f, void *buf, size_t bufn)
@@ -1309,18 +1776,18 @@ static void *load_rest_of_file(long *on, FILE *f, void *buf, size_t bufn)
 	if (!t) fail("out of mem (%zu) while loading file", ntop);
 	memcpy(t, buf, bufn);
 	while (1) {
-		if (n >= ntop) {
+		if (n + 1 >= ntop) {
 			ntop = 1000 + 2*(ntop + 1);
 			t = xrealloc(t, ntop);
 			if (!t) fail("out of mem (%zu) loading file", ntop);
 
 		}
-		int r = fgetc(f);
-		if (r == EOF)
+		size_t r = fread(t + n, 1, ntop - n - 1, f);
+		if (!r)
 			break;
-		t[n] = r;//iw810
-		n += 1;
+		n += r;
 	}
+	t[n] = '\0';
 	*on = n;
 	return t;
 }
@@ -1332,6 +1799,9 @@ static void *load_rest_of_file(long *on, FILE *f, void *buf, size_t bufn)
 // Implementation: re-invent the wheel
 static char *put_data_into_temporary_file(void *filedata, size_t filesize)
 {
+#  if __STDC_VERSION__ >= 201112L
+	_Thread_local
+#  endif
 	static char filename[FILENAME_MAX];
 	fill_temporary_filename(filename);
 	FILE *f = xfopen(filename, "w");
@@ -1384,6 +1854,75 @@ static FILE *iio_fmemopen(void *data, size_t size)
 }
 
 
+// Memory-mapped files
+//
+// The pixels of some uncompressed files (raw, npy, pfm, rim) are stored
+// exactly as they are required in memory.  In that case, the image data can
+// be a pointer into a private mapping of the file, and no copy is needed.
+// The mappings are private and writable: the callers can modify their images
+// in place without disturbing the files.  The table of active mappings is
+// used by "iio_free" to tell apart mapped pointers from malloc'd ones.
+#ifdef I_CAN_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IIO_MAX_MAPPINGS 0x400
+static struct iio_mapping {
+	void *base;  // start of the mapping
+	size_t size; // size of the mapping
+	void *data;  // pointer given to the user (inside the mapping)
+} global_table_of_mappings[IIO_MAX_MAPPINGS];
+
+// map a whole regular file, return NULL if not possible
+static void *iio_map_file(size_t *out_size, const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st[1];
+	if (fstat(fd, st) || !S_ISREG(st->st_mode) || st->st_size <= 0)
+		return close(fd), NULL;
+	void *p = mmap(NULL, st->st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return NULL;
+	IIO_DEBUG("mapped file \"%s\" (%zu bytes) at %p\n",
+			filename, (size_t)st->st_size, p);
+	*out_size = st->st_size;
+	return p;
+}
+
+static bool iio_register_mapping(void *base, size_t size, void *data)
+{
+	FORI(IIO_MAX_MAPPINGS)
+		if (!global_table_of_mappings[i].data)
+		{
+			global_table_of_mappings[i].base = base;
+			global_table_of_mappings[i].size = size;
+			global_table_of_mappings[i].data = data;
+			return true;
+		}
+	return false;
+}
+
+// if "p" was obtained from a mapping, unmap it and return true
+static bool iio_unmap_if_mapped(void *p)
+{
+	FORI(IIO_MAX_MAPPINGS)
+		if (p && p == global_table_of_mappings[i].data)
+		{
+			struct iio_mapping *m = global_table_of_mappings + i;
+			IIO_DEBUG("unmapping %p (%zu bytes)\n", m->base, m->size);
+			munmap(m->base, m->size);
+			m->data = m->base = NULL;
+			m->size = 0;
+			return true;
+		}
+	return false;
+}
+#endif//I_CAN_HAS_MMAP
+
+
 // beautiful hack follows
 static void *matrix_build(int w, int h, size_t n)
 {
@@ -1404,77 +1943,180 @@ static void *wrap_2dmatrix_around_data(void *x, int w, int h, size_t s)
 }
 
 
-// todo make this function more general, or a front-end to a general
-// "data trasposition" routine
+// Conversion between interleaved ("clear") pixels, x[pd*i + l], and
+// planar ("broken") pixels, x[n*l + i], of n pixels with pd samples of sz
+// bytes.  The loops are written for each common sample size, with constant
+// pd=2,3,4 so that the compiler can vectorize them, and the generic case
+// is blocked so that the pd planes are visited in cache-sized chunks.
+
+#define IIO_TRANSPOSE_BLOCK 0x400
+
+#define T(t) \
+static void deinterleave_ ## t(t *restrict b, const t *restrict c, \
+		size_t n, int pd) \
+{ \
+	switch (pd) { \
+	case 1: memcpy(b, c, n * sizeof*b); return; \
+	case 2: for (size_t i = 0; i < n; i++) { \
+			b[i] = c[2*i]; b[n+i] = c[2*i+1]; } return; \
+	case 3: for (size_t i = 0; i < n; i++) { \
+			b[i] = c[3*i]; b[n+i] = c[3*i+1]; \
+			b[2*n+i] = c[3*i+2]; } return; \
+	case 4: for (size_t i = 0; i < n; i++) { \
+			b[i] = c[4*i]; b[n+i] = c[4*i+1]; \
+			b[2*n+i] = c[4*i+2]; b[3*n+i] = c[4*i+3]; } return; \
+	} \
+	for (size_t i0 = 0; i0 < n; i0 += IIO_TRANSPOSE_BLOCK) { \
+		size_t i1 = i0 + IIO_TRANSPOSE_BLOCK < n ? \
+			i0 + IIO_TRANSPOSE_BLOCK : n; \
+		for (int l = 0; l < pd; l++) \
+		for (size_t i = i0; i < i1; i++) \
+			b[n*l + i] = c[pd*i + l]; \
+	} \
+} \
+static void interleave_ ## t(t *restrict c, const t *restrict b, \
+		size_t n, int pd) \
+{ \
+	switch (pd) { \
+	case 1: memcpy(c, b, n * sizeof*c); return; \
+	case 2: for (size_t i = 0; i < n; i++) { \
+			c[2*i] = b[i]; c[2*i+1] = b[n+i]; } return; \
+	case 3: for (size_t i = 0; i < n; i++) { \
+			c[3*i] = b[i]; c[3*i+1] = b[n+i]; \
+			c[3*i+2] = b[2*n+i]; } return; \
+	case 4: for (size_t i = 0; i < n; i++) { \
+			c[4*i] = b[i]; c[4*i+1] = b[n+i]; \
+			c[4*i+2] = b[2*n+i]; c[4*i+3] = b[3*n+i]; } return; \
+	} \
+	for (size_t i0 = 0; i0 < n; i0 += IIO_TRANSPOSE_BLOCK) { \
+		size_t i1 = i0 + IIO_TRANSPOSE_BLOCK < n ? \
+			i0 + IIO_TRANSPOSE_BLOCK : n; \
+		for (int l = 0; l < pd; l++) \
+		for (size_t i = i0; i < i1; i++) \
+			c[pd*i + l] = b[n*l + i]; \
+	} \
+}
+T(uint8_t) T(uint16_t) T(uint32_t) T(uint64_t)
+#undef T
+
+static void deinterleave_samples(void *broken, const void *clear,
+		size_t n, int pd, int sz)
+{
+	switch (sz) {
+	case 1: deinterleave_uint8_t(broken, clear, n, pd); return;
+	case 2: deinterleave_uint16_t(broken, clear, n, pd); return;
+	case 4: deinterleave_uint32_t(broken, clear, n, pd); return;
+	case 8: deinterleave_uint64_t(broken, clear, n, pd); return;
+	}
+	char *b = broken;
+	const char *c = clear;
+	for (size_t i = 0; i < n; i++)
+	for (int l = 0; l < pd; l++)
+		memcpy(b + sz*(n*l + i), c + sz*(pd*i + l), sz);
+}
+
+static void interleave_samples(void *clear, const void *broken,
+		size_t n, int pd, int sz)
+{
+	switch (sz) {
+	case 1: interleave_uint8_t(clear, broken, n, pd); return;
+	case 2: interleave_uint16_t(clear, broken, n, pd); return;
+	case 4: interleave_uint32_t(clear, broken, n, pd); return;
+	case 8: interleave_uint64_t(clear, broken, n, pd); return;
+	}
+	char *c = clear;
+	const char *b = broken;
+	for (size_t i = 0; i < n; i++)
+	for (int l = 0; l < pd; l++)
+		memcpy(c + sz*(pd*i + l), b + sz*(n*l + i), sz);
+}
+
+// transpose in place a matrix of r rows and c columns, by following the
+// cycles of the permutation (needs only one bit of memory per sample)
+static void transpose_samples_inplace(void *x, size_t r, size_t c, int sz)
+{
+	size_t N = r * c;
+	if (r < 2 || c < 2) return;
+	char *t = x, tmp[2][sz];
+	uint8_t *seen = xmalloc((N + 7) / 8);
+	memset(seen, 0, (N + 7) / 8);
+	for (size_t s = 1; s < N - 1; s++)
+	{
+		if (seen[s/8] & (1 << s%8)) continue;
+		memcpy(tmp[0], t + s*sz, sz);
+		size_t k = s;
+		int a = 0;
+		do {
+			k = (k * r) % (N - 1); // destination of sample k
+			memcpy(tmp[!a], t + k*sz, sz);
+			memcpy(t + k*sz, tmp[a], sz);
+			seen[k/8] |= 1 << k%8;
+			a = !a;
+		} while (k != s);
+	}
+	xfree(seen);
+}
+
+// images larger than that are converted in place, without a second buffer
+#define IIO_INPLACE_TRANSPOSE_BYTES (1 << 28)
+
+static void deinterleave_samples_inplace(void *x, size_t n, int pd, int sz)
+{
+	if (n * pd * sz > IIO_INPLACE_TRANSPOSE_BYTES)
+		return transpose_samples_inplace(x, n, pd, sz);
+	void *t = xmalloc(n * pd * sz);
+	memcpy(t, x, n * pd * sz);
+	deinterleave_samples(x, t, n, pd, sz);
+	xfree(t);
+}
+
+static void interleave_samples_inplace(void *x, size_t n, int pd, int sz)
+{
+	if (n * pd * sz > IIO_INPLACE_TRANSPOSE_BYTES)
+		return transpose_samples_inplace(x, pd, n, sz);
+	void *t = xmalloc(n * pd * sz);
+	memcpy(t, x, n * pd * sz);
+	interleave_samples(x, t, n, pd, sz);
+	xfree(t);
+}
+
 static void break_pixels_float(float *broken, float *clear, int n, int pd)
 {
-	FORI(n) FORL(pd)
-		broken[n*l + i] = clear[pd*i + l];
+	deinterleave_samples(broken, clear, n, pd, sizeof*clear);
 }
 
 static void
 recover_broken_pixels_float(float *clear, float *broken, int n, int pd)
 {
-	FORL(pd) FORI(n)
-		clear[pd*i + l] = broken[n*l + i];
+	interleave_samples(clear, broken, n, pd, sizeof*clear);
 }
 
-
-//static void break_pixels_uint8(uint8_t *broken, uint8_t *clear, int n, int pd)
-//{
-//	FORI(n) FORL(pd)
-//		broken[n*l + i] = clear[pd*i + l];
-//}
-
 static void break_pixels_double(double *broken, double *clear, int n, int pd)
 {
-	FORI(n) FORL(pd)
-		broken[n*l + i] = clear[pd*i + l];
+	deinterleave_samples(broken, clear, n, pd, sizeof*clear);
 }
 
 static void
 recover_broken_pixels_uint8(uint8_t *clear, uint8_t *broken, int n, int pd)
 {
-	FORL(pd) FORI(n)
-		clear[pd*i + l] = broken[n*l + i];
+	interleave_samples(clear, broken, n, pd, sizeof*clear);
 }
 
 static void
 recover_broken_pixels_int(int *clear, int *broken, int n, int pd)
 {
-	FORL(pd) FORI(n)
-		clear[pd*i + l] = broken[n*l + i];
-}
-
-//static void break_pixels_int(int *broken, int *clear, int n, int pd)
-//{
-//	FORI(n) FORL(pd)
-//		broken[n*l + i] = clear[pd*i + l];
-//}
-
-
-static
-void repair_broken_pixels(void *clear, void *broken, int n, int pd, int sz)
-{
-	char *c = clear;
-	char *b = broken;
-	FORL(pd) FORI(n)
-		memcpy(c + sz*(pd*i+l), b + sz*(n*l + i), sz);
+	interleave_samples(clear, broken, n, pd, sizeof*clear);
 }
 
 static void repair_broken_pixels_inplace(void *x, int n, int pd, int sz)
 {
-	char *t = malloc(n * pd * sz);
-	memcpy(t, x, n * pd * sz);
-	repair_broken_pixels(x, t, n, pd, sz);
-	free(t);
+	interleave_samples_inplace(x, n, pd, sz);
 }
 
 static void
 recover_broken_pixels_double(double *clear, double *broken, int n, int pd)
 {
-	FORL(pd) FORI(n)
-		clear[pd*i + l] = broken[n*l + i];
+	interleave_samples(clear, broken, n, pd, sizeof*clear);
 }
 
 // individual format readers                                                {{{1
@@ -1549,6 +2191,30 @@ static int read_beheaded_png(struct iio_image *x,
 	return 0;
 }
 
+// fill-in the size and type of a png image, without decoding its pixels
+static int png_read_image_info(struct iio_image *x, FILE *f)
+{
+	png_structp pp = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+	if (!pp) fail("png_create_read_struct fail");
+	png_infop pi = png_create_info_struct(pp);
+	if (!pi) fail("png_create_info_struct fail");
+	if (setjmp(png_jmpbuf(pp))) fail("png error");
+	png_init_io(pp, f);
+	png_read_info(pp, pi);
+	png_set_packing(pp);
+	png_set_expand(pp);
+	png_read_update_info(pp, pi);
+	int w = png_get_image_width(pp, pi);
+	int h = png_get_image_height(pp, pi);
+	int channels = png_get_channels(pp, pi);
+	int depth = png_get_bit_depth(pp, pi);
+	png_destroy_read_struct(&pp, &pi, NULL);
+	IIO_DEBUG("png info %dx%d,%d depth %d\n", w, h, channels, depth);
+	iio_image_init2d(x, w, h, channels,
+			depth == 16 ? IIO_TYPE_UINT16 : IIO_TYPE_CHAR);
+	return 0;
+}
+
 #endif//I_CAN_HAS_LIBPNG
 
 // JPEG reader                                                              {{{2
@@ -1578,9 +2244,23 @@ static int read_whole_jpeg(struct iio_image *x, FILE *f)
 
 	// obtain image info
 	jpeg_read_header(cinfo, 1);
+
+	// decode at a reduced size by DCT scaling, if requested
+	int scale = 1;
+	if (global_scale_applies())
+		for (int f = 8; f > 1; f /= 2)
+			if (global_scale.n % f == 0) { scale = f; break; }
+	if (scale > 1) {
+		cinfo->scale_num = 1;
+		cinfo->scale_denom = scale;
+		global_scale.done = scale;
+		IIO_DEBUG("jpeg scaled decode 1/%d\n", scale);
+	}
+	jpeg_calc_output_dimensions(cinfo);
+
 	int size[2], depth;
-	size[0] = cinfo->image_width;
-	size[1] = cinfo->image_height;
+	size[0] = cinfo->output_width;
+	size[1] = cinfo->output_height;
 	depth = cinfo->num_components;
 	IIO_DEBUG("jpeg header width = %d\n", size[0]);
 	IIO_DEBUG("jpeg header height = %d\n", size[1]);
@@ -1611,11 +2291,27 @@ static int read_whole_jpeg(struct iio_image *x, FILE *f)
 	return 0;
 }
 
-static int read_beheaded_jpeg(struct iio_image *x,
-		FILE *fin, char *header, int nheader)
+// fill-in the size and type of a jpeg image, without decoding its pixels
+static int jpeg_read_image_info(struct iio_image *x, FILE *f)
 {
-	long filesize;
-	// TODO (optimization): if "f" is rewindable, rewind it!
+	struct jpeg_decompress_struct cinfo[1];
+	struct jpeg_error_mgr jerr[1];
+	cinfo->err = jpeg_std_error(jerr);
+	jerr[0].error_exit = on_jpeg_error;
+	jpeg_create_decompress(cinfo);
+	jpeg_stdio_src(cinfo, f);
+	jpeg_read_header(cinfo, 1);
+	iio_image_init2d(x, cinfo->image_width, cinfo->image_height,
+			cinfo->num_components, IIO_TYPE_CHAR);
+	jpeg_destroy_decompress(cinfo);
+	return 0;
+}
+
+static int read_beheaded_jpeg(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
+{
+	long filesize;
+	// TODO (optimization): if "f" is rewindable, rewind it!
 	void *filedata = load_rest_of_file(&filesize, fin, header, nheader);
 	FILE *f = iio_fmemopen(filedata, filesize);
 
@@ -1633,6 +2329,73 @@ static int read_beheaded_jpeg(struct iio_image *x,
 #ifdef I_CAN_HAS_LIBTIFF
 #  include <tiffio.h>
 
+// in-memory files for libtiff (see TIFFClientOpen)
+struct tiff_memfile { char *data; toff_t size, cap, pos; };
+
+static tmsize_t tiff_memfile_read(thandle_t h, void *buf, tmsize_t n)
+{
+	struct tiff_memfile *m = h;
+	if (m->pos >= m->size) return 0;
+	if ((toff_t)n > m->size - m->pos) n = m->size - m->pos;
+	memcpy(buf, m->data + m->pos, n);
+	m->pos += n;
+	return n;
+}
+
+static tmsize_t tiff_memfile_write(thandle_t h, void *buf, tmsize_t n)
+{
+	struct tiff_memfile *m = h;
+	if (m->pos + n > m->cap) {
+		toff_t cap = 2 * m->cap > m->pos + n ? 2 * m->cap : m->pos + n;
+		if (cap < 0x1000) cap = 0x1000;
+		m->data = xrealloc(m->data, cap);
+		memset(m->data + m->cap, 0, cap - m->cap);
+		m->cap = cap;
+	}
+	memcpy(m->data + m->pos, buf, n);
+	m->pos += n;
+	if (m->pos > m->size) m->size = m->pos;
+	return n;
+}
+
+static toff_t tiff_memfile_seek(thandle_t h, toff_t off, int whence)
+{
+	struct tiff_memfile *m = h;
+	switch (whence) {
+	case SEEK_SET: m->pos = off; break;
+	case SEEK_CUR: m->pos += off; break;
+	case SEEK_END: m->pos = m->size + off; break;
+	}
+	return m->pos;
+}
+
+static int tiff_memfile_close(thandle_t h) { (void)h; return 0; }
+
+static toff_t tiff_memfile_size(thandle_t h)
+{
+	return ((struct tiff_memfile *)h)->size;
+}
+
+static int tiff_memfile_map(thandle_t h, void **base, toff_t *size)
+{
+	(void)h; (void)base; (void)size;
+	return 0;
+}
+
+static void tiff_memfile_unmap(thandle_t h, void *base, toff_t size)
+{
+	(void)h; (void)base; (void)size;
+}
+
+static TIFF *tiff_memfile_open(struct tiff_memfile *m, const char *mode)
+{
+	return TIFFClientOpen("iio_memfile", mode, (thandle_t)m,
+			tiff_memfile_read, tiff_memfile_write,
+			tiff_memfile_seek, tiff_memfile_close,
+			tiff_memfile_size, tiff_memfile_map,
+			tiff_memfile_unmap);
+}
+
 static TIFF *tiffopen_fancy(const char *filename, char *mode)
 {
 	char *comma = strrchr(filename, ',');
@@ -1658,7 +2421,43 @@ static TIFF *tiffopen_fancy(const char *filename, char *mode)
 	return tif;
 }
 
-static int read_whole_tiff(struct iio_image *x, const char *filename)
+// iio type of the samples of a (non-complex) tiff image
+static int tiff_sample_type(uint16_t fmt, uint16_t bps)
+{
+	if (fmt == SAMPLEFORMAT_UINT) {
+		if (1 == bps) return IIO_TYPE_UINT1;
+		else if (2 == bps) return IIO_TYPE_UINT2;
+		else if (4 == bps) return IIO_TYPE_UINT4;
+		else if (8 == bps) return IIO_TYPE_UINT8;
+		else if (16 == bps) return IIO_TYPE_UINT16;
+		else if (32 == bps) return IIO_TYPE_UINT32;
+		else fail("unrecognized UINT type of size %d bits", bps);
+	} else if (fmt == SAMPLEFORMAT_INT) {
+		if (8 == bps) return IIO_TYPE_INT8;
+		else if (16 == bps) return IIO_TYPE_INT16;
+		else if (32 == bps) return IIO_TYPE_INT32;
+		else fail("unrecognized INT type of size %d bits", bps);
+	} else if (fmt == SAMPLEFORMAT_IEEEFP) {
+		IIO_DEBUG("floating tiff!\n");
+		if (32 == bps) return IIO_TYPE_FLOAT;
+		else if (64 == bps) return IIO_TYPE_DOUBLE;
+		else fail("unrecognized FLOAT type of size %d bits", bps);
+	} else fail("unrecognized tiff sample format %d (see tiff.h)", fmt);
+}
+
+// open a tiff file for reading, either named or already in memory
+static TIFF *tiffopen_reader(const char *filename, struct tiff_memfile *mem)
+{
+	if (mem) {
+		mem->pos = 0;
+		return tiff_memfile_open(mem, "rm");
+	}
+	return tiffopen_fancy(filename, "rm");
+}
+
+// if "mem" is not NULL, it contains the whole file and "filename" is a label
+static int read_tiff_image(struct iio_image *x, const char *filename,
+		struct tiff_memfile *mem)
 {
 	IIO_DEBUG("read whole tiff  \"%s\"\n", filename);
 	// tries to read data in the correct format (via scanlines)
@@ -1666,7 +2465,7 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 	TIFFSetWarningHandler(NULL);//suppress warnings
 
 	//fprintf(stderr, "TIFFOpen \"%s\"\n", filename);
-	TIFF *tif = tiffopen_fancy(filename, "rm");
+	TIFF *tif = tiffopen_reader(filename, mem);
 	if (!tif) fail("could not open TIFF file \"%s\"", filename);
 	uint32_t w, h;
 	uint16_t spp, bps, fmt;
@@ -1678,6 +2477,12 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 	IIO_DEBUG("tiff get field length %d (r=%d)\n", (int)h, r);
 	if (r != 2) fail("can not read tiff of unknown size");
 
+	// region of interest (the whole image by default)
+	int rx = 0, ry = 0, rw = w, rh = h;
+	bool roi = global_roi.fname && !global_roi.done
+				&& 0 == strcmp(filename, global_roi.fname);
+	if (roi) global_roi_rectangle(&rx, &ry, &rw, &rh, w, h);
+
 	r = TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
 	if(!r) spp=1;
 	if(r)IIO_DEBUG("tiff get field spp %d (r=%d)\n", spp, r);
@@ -1711,25 +2516,7 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 	if (fmt == SAMPLEFORMAT_COMPLEXIEEEFP) fmt = SAMPLEFORMAT_IEEEFP;
 
 	// set appropriate size and type flags
-	if (fmt == SAMPLEFORMAT_UINT) {
-		if (1 == bps) fmt_iio = IIO_TYPE_UINT1;
-		else if (2 == bps) fmt_iio = IIO_TYPE_UINT2;
-		else if (4 == bps) fmt_iio = IIO_TYPE_UINT4;
-		else if (8 == bps) fmt_iio = IIO_TYPE_UINT8;
-		else if (16 == bps) fmt_iio = IIO_TYPE_UINT16;
-		else if (32 == bps) fmt_iio = IIO_TYPE_UINT32;
-		else fail("unrecognized UINT type of size %d bits", bps);
-	} else if (fmt == SAMPLEFORMAT_INT) {
-		if (8 == bps) fmt_iio = IIO_TYPE_INT8;
-		else if (16 == bps) fmt_iio = IIO_TYPE_INT16;
-		else if (32 == bps) fmt_iio = IIO_TYPE_INT32;
-		else fail("unrecognized INT type of size %d bits", bps);
-	} else if (fmt == SAMPLEFORMAT_IEEEFP) {
-		IIO_DEBUG("floating tiff!\n");
-		if (32 == bps) fmt_iio = IIO_TYPE_FLOAT;
-		else if (64 == bps) fmt_iio = IIO_TYPE_DOUBLE;
-		else fail("unrecognized FLOAT type of size %d bits", bps);
-	} else fail("unrecognized tiff sample format %d (see tiff.h)", fmt);
+	fmt_iio = tiff_sample_type(fmt, bps);
 
 	if (bps >= 8 && bps != 8*iio_type_size(fmt_iio)) {
 		IIO_DEBUG("bps = %d\n", bps);
@@ -1744,6 +2531,14 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 	if (r != 1) planarity = PLANARCONFIG_CONTIG;
 	bool broken = planarity == PLANARCONFIG_SEPARATE;
 	complicated = complicated && broken; // complicated = complex and broken
+	if (complicated) {
+		roi = false; // will be cropped after reading
+		rx = ry = 0; rw = w; rh = h;
+	}
+
+	// the planes of the selected bands are read alone
+	bool bands = broken && !complicated && global_bands_apply(filename, spp);
+	int ospp = bands ? global_bands.n : spp; // samples of the output pixels
 
 	uint16_t compression;
 	r = TIFFGetField(tif, TIFFTAG_COMPRESSION, &compression);
@@ -1751,6 +2546,14 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 	IIO_DEBUG("TIFF Tag Compression = %d\n", compression);
 	IIO_DEBUG("w = %d\n", (int)w);
 
+	// planar strips are read plane by plane when selecting bands, or when
+	// they can not be read by rows (compressed or bit-packed)
+	int allbands[spp], *band = bands ? global_bands.b : allbands;
+	for (int l = 0; l < spp; l++)
+		allbands[l] = l;
+	bool planes = bands
+		|| (broken && !complicated && (bps < 8 || compression != 1));
+
 	uint32_t rows_per_strip;
 	r = TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
 	IIO_DEBUG("r = %d\n", (int)r);
@@ -1761,7 +2564,8 @@ static int read_whole_tiff(struct iio_image *x, const char *filename)
 
 
 	// acquire memory block
-	uint32_t scanline_size = (w * (int)spp * (int)bps)/8;
+	uint32_t scanline_size = broken ? spp * ((w * (int)bps + 7)/8)
+		: (w * (int)spp * (int)bps + 7)/8;
 	int rbps = (bps/8) ? (bps/8) : 1;
 	uint32_t uscanline_size = w * (int)spp * (int)rbps;
 	IIO_DEBUG("w = %d\n", (int)w);
@@ -1801,8 +2605,11 @@ go_on:
 	else
 		assert((int)scanline_size == spp*sls);
 	assert((int)scanline_size >= sls);
-	uint8_t *data = xmalloc(w * h * spp * rbps * (complicated?2:1));
+	uint8_t *data = xmalloc(rw * rh * ospp * rbps * (complicated?2:1));
 	uint8_t *buf = xmalloc(scanline_size);
+	int strip_rows = rows_per_strip ? (int)rows_per_strip : (int)h;
+	int rowsize = rw * ospp * rbps; // bytes of each output row
+	IIO_DEBUG("tiff window %d %d %d %d\n", rx, ry, rw, rh);
 
 	// use a particular reader for tiled tiff
 	if (TIFFIsTiled(tif)) {
@@ -1814,27 +2621,63 @@ go_on:
 		IIO_DEBUG("tilelength = %u\n", tilelength);
 		IIO_DEBUG("tisize = %d (%u)\n", tisize, tilewidth*tilelength);
 
-		if (bps < 8)
-			fail("only byte-oriented tiles are supported (%d)",bps);
-		int Bps = bps/8;
+		if (bps < 8 && broken)
+			fail("only contiguous bit-packed tiles are supported");
+		int Bps = rbps;
 
 		IIO_DEBUG("bps = %u\n", bps);
 		IIO_DEBUG("Bps = %d\n", Bps);
 
+		uint32_t tx0 = rx - rx % tilewidth;
+		uint32_t ty0 = ry - ry % tilelength;
+		int ntx = (rx + rw - tx0 + tilewidth - 1) / tilewidth;
+		int nty = (ry + rh - ty0 + tilelength - 1) / tilelength;
+
+		// tiles are decoded in parallel, each thread with its own handle
+		int nthreads = iio_threads();
+		if (nthreads > ntx * nty) nthreads = ntx * nty;
+		IIO_DEBUG("decoding %dx%d tiles with %d threads\n",
+				ntx, nty, nthreads);
+#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+		{
+		TIFF *t = tif;
+#ifdef _OPENMP
+		struct tiff_memfile tmem[1];
+		if (mem) *tmem = *mem; // same data, private position
+		if (omp_get_thread_num() > 0)
+			t = tiffopen_reader(filename, mem ? tmem : NULL);
+		if (!t) fail("could not reopen TIFF file \"%s\"", filename);
+#endif//_OPENMP
 		uint8_t *tbuf = xmalloc(tisize*Bps*spp);
-		for (uint32_t tx = 0; tx < w; tx += tilewidth)
-		for (uint32_t ty = 0; ty < h; ty += tilelength)
+		uint8_t *pbuf = NULL; // packed tile, unpacked row by row
+		if (bps < 8) {
+			xfree(tbuf);
+			tbuf = xmalloc(tilewidth * tilelength * spp);
+			pbuf = xmalloc(tisize);
+		}
+#pragma omp for schedule(dynamic)
+		for (int k = 0; k < ntx * nty; k++)
 		{
+			uint32_t tx = tx0 + (k % ntx) * tilewidth;
+			uint32_t ty = ty0 + (k / ntx) * tilelength;
 			IIO_DEBUG("tile at %u %u\n", tx, ty);
 			if (!broken) {
-				if (-1 == TIFFReadTile(tif, tbuf, tx, ty, 0, 0))
-					memset(tbuf, -1, TIFFTileSize(tif));
+				uint8_t *b = pbuf ? pbuf : tbuf;
+				if (-1 == TIFFReadTile(t, b, tx, ty, 0, 0))
+					memset(b, -1, TIFFTileSize(t));
+			}
+			if (pbuf) {
+				int prow = (tilewidth * spp * bps + 7) / 8;
+				for (uint32_t j = 0; j < tilelength; j++)
+					unpack_to_bytes_here(tbuf + j*tilewidth*spp,
+							pbuf + j*prow,
+							tilewidth*spp, bps);
 			}
-			for (uint16_t l = 0; l < spp; l++)
+			for (int k = 0; k < ospp; k++)
 			{
-			int L = l, Spp = spp;
+			int l = bands ? band[k] : k, L = l, Spp = spp;
 			if (broken) {
-				TIFFReadTile(tif, tbuf, tx, ty, 0, l);
+				TIFFReadTile(t, tbuf, tx, ty, 0, l);
 				L = 0;
 				Spp = 1;
 			}
@@ -1842,12 +2685,12 @@ go_on:
 			for (uint32_t i = 0; i < tilewidth; i++)
 			for (int b = 0; b < Bps; b++)
 			{
-				uint32_t ii = i + tx;
-				uint32_t jj = j + ty;
-				if (ii < w && jj < h)
+				int ii = i + tx - rx;
+				int jj = j + ty - ry;
+				if (insideP(rw, rh, ii, jj))
 				{
 				int idx_i = ((j*tilewidth + i)*Spp + L)*Bps + b;
-				int idx_o = ((jj*w + ii)*spp + l)*Bps + b;
+				int idx_o = ((jj*rw + ii)*ospp + k)*Bps + b;
 				uint8_t s = tbuf[idx_i];
 				((uint8_t*)data)[idx_o] = s;
 				}
@@ -1855,29 +2698,55 @@ go_on:
 			}
 		}
 		xfree(tbuf);
+		if (pbuf) xfree(pbuf);
+		if (t != tif) TIFFClose(t);
+		}
+		if (bps < 8) fmt_iio = IIO_TYPE_UINT8;
 	} else {
 
 		// dump scanline data
-		if (broken && bps < 8) fail("cannot unpack broken scanlines");
-		if (!broken) FORI(h) {
+		// (compressed strips are decoded from their first row)
+
+		uint8_t *ubuf = xmalloc(spp * (uscanline_size + scanline_size));
+		int coff = rx * spp * rbps; // offset of the window inside a row
+		if (planes) for (int k = 0; k < ospp; k++)
+		for (int i = ry - ry % strip_rows; i < ry + rh; i++)
+		{
+			// each plane is decoded from the first row of its strip
+			r = TIFFReadScanline(tif, buf, i, band[k]);
+			if (r < 0) fail("error read tiff row %d/%d;%d",
+					i, (int)h, band[k]);
+			if (i < ry) continue;
+			uint8_t *src = buf + rx * rbps;
+			if (bps < 8) {
+				unpack_to_bytes_here(ubuf, buf, w, bps);
+				src = ubuf + rx;
+				fmt_iio = IIO_TYPE_UINT8;
+			}
+			uint8_t *dst = data + (i-ry)*rowsize + k*rbps;
+			for (int ii = 0; ii < rw; ii++)
+				memcpy(dst + ii*ospp*rbps, src + ii*rbps, rbps);
+		}
+		else if (!broken) for (int i = ry - ry % strip_rows; i < ry + rh; i++) {
 			r = TIFFReadScanline(tif, buf, i, 0);
 			IIO_DEBUG("TIFFReadScanline r = %d\n", r);
 			if (r < 0) fail("error read tiff row %d/%d", i, (int)h);
+			if (i < ry) continue;
 
 			if (bps < 8) {
 				//fprintf(stderr,"unpacking %dth scanline\n",i);
-				unpack_to_bytes_here(data + i*uscanline_size,
-						buf, scanline_size, bps);
+				unpack_to_bytes_here(ubuf, buf, w * spp, bps);
+				memcpy(data + (i-ry)*rowsize, ubuf + coff, rowsize);
 				fmt_iio = IIO_TYPE_UINT8;
 			} else {
-				memcpy(data + i*sls, buf, sls);
+				memcpy(data + (i-ry)*rowsize, buf + coff, rowsize);
 			}
 		}
 		else {
 			int f = complicated ? 2 : 1; // bizarre case, squeeze!
-			if (compression==1) FORI(h)
+			if (compression==1) for (int i = ry; i < ry + rh; i++)
 			{
-				unsigned char *dest = data + i*spp*sls/f;
+				unsigned char *dest = roi ? ubuf : data + i*spp*sls/f;
 				FORJ(spp/f)
 				{
 					r = TIFFReadScanline(tif, buf, i, j);
@@ -1891,11 +2760,15 @@ go_on:
 				if (!complicated)
 					repair_broken_pixels_inplace(dest,
 							w, spp, bps/8);
+				if (roi)
+					memcpy(data + (i-ry)*rowsize,
+							dest + coff, rowsize);
 			} else { // compression > 1
 				unsigned char *dest = data;
 				fail("shit not implemented yet");
 			}
 		}
+		xfree(ubuf);
 	}
 
 	TIFFClose(tif);
@@ -1903,15 +2776,64 @@ go_on:
 	xfree(buf);
 
 	// fill struct fields
-	iio_image_init2d(x, w, h, spp, fmt_iio);
+	iio_image_init2d(x, rw, rh, ospp, fmt_iio);
 	x->data = data;
+	if (roi) global_roi.done = true;
+	if (bands) global_bands.done = true;
 	return 0;
 }
 
-// Note: TIFF library only reads from a named file.  The only way to use the
-// library if you have your image in a stream, is to write the data to a
-// temporary file, and read it from there.  This can be optimized in the future
-// by recovering the original filename through hacks, in case it was not a pipe.
+static int read_whole_tiff(struct iio_image *x, const char *filename)
+{
+	return read_tiff_image(x, filename, NULL);
+}
+
+// fill-in the size and type of a tiff image as given by "read_whole_tiff",
+// without decoding its pixels
+static int tiff_read_image_info(struct iio_image *x, const char *filename)
+{
+	TIFFSetWarningHandler(NULL);//suppress warnings
+	TIFF *tif = tiffopen_fancy(filename, "rm");
+	if (!tif) return 1;
+	uint32_t w, h;
+	uint16_t spp, bps, fmt, planarity;
+	int r = TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w)
+		+ TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+	if (!TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &spp)) spp = 1;
+	if (!TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &bps)) bps = 1;
+	if (!TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &fmt))
+		fmt = SAMPLEFORMAT_UINT;
+	if (!TIFFGetField(tif, TIFFTAG_PLANARCONFIG, &planarity))
+		planarity = PLANARCONFIG_CONTIG;
+	int sls = TIFFScanlineSize(tif);
+	TIFFClose(tif);
+	if (r != 2) return 2;
+
+	if (fmt == SAMPLEFORMAT_COMPLEXINT || fmt == SAMPLEFORMAT_COMPLEXIEEEFP)
+	{
+		spp *= 2;
+		bps /= 2;
+	}
+	if (fmt == SAMPLEFORMAT_COMPLEXINT   ) fmt = SAMPLEFORMAT_INT;
+	if (fmt == SAMPLEFORMAT_COMPLEXIEEEFP) fmt = SAMPLEFORMAT_IEEEFP;
+	int type = bps < 8 ? IIO_TYPE_UINT8 : tiff_sample_type(fmt, bps);
+
+	// inconsistent scanlines are read as RGBA
+	int scanline_size = planarity == PLANARCONFIG_SEPARATE
+		? spp * ((w * (int)bps + 7)/8) : (w * (int)spp * (int)bps + 7)/8;
+	if (xgetenv("IIO_OVERRIDE_SLS"))
+		scanline_size = sls;
+	if (scanline_size != sls && !(planarity == PLANARCONFIG_SEPARATE
+				&& sls * spp == scanline_size))
+	{
+		spp = 4;
+		type = IIO_TYPE_UINT8;
+	}
+	iio_image_init2d(x, w, h, spp, type);
+	return 0;
+}
+
+// Note: streams are decoded from memory through TIFFClientOpen
 static int read_beheaded_tiff(struct iio_image *x,
 		FILE *fin, char *header, int nheader)
 {
@@ -1924,13 +2846,13 @@ static int read_beheaded_tiff(struct iio_image *x,
 
 	long filesize;
 	void *filedata = load_rest_of_file(&filesize, fin, header, nheader);
-	char *filename = put_data_into_temporary_file(filedata, filesize);
-	xfree(filedata);
+	struct tiff_memfile m[1] = {{
+		.data = filedata, .size = filesize, .cap = filesize, .pos = 0 }};
 
-	int r = read_whole_tiff(x, filename);
+	int r = read_tiff_image(x, "-", m);
 	if (r) fail("read whole tiff returned %d", r);
 
-	delete_temporary_file(filename);
+	xfree(filedata);
 
 	return 0;
 }
@@ -1951,7 +2873,76 @@ static int read_beheaded_tiff(struct iio_image *x,
 // libraries should be shot.  In front of their families.
 //
 
-static int read_whole_hdf5(struct iio_image *x, const char *filename_raw)
+// the comma that separates the file name from the dataset name (commas that
+// appear inside the brackets of a hyperslab selector do not count)
+static char *hdf5_dataset_comma(const char *filename)
+{
+	char *r = NULL;
+	int depth = 0;
+	for (const char *p = filename; *p; p++)
+		if (*p == '[') depth += 1;
+		else if (*p == ']') depth -= 1;
+		else if (*p == ',' && !depth) r = (char *)p;
+	return r;
+}
+
+// Parse a hyperslab selector "[s0,s1,...]" of a dataset of dimensions "dim".
+// Each entry is either an index "i", which selects one position and removes
+// that dimension, or a range "a:b" or "a:b:step", which may omit any of its
+// bounds (as in python).  Negative values count from the end.  Missing
+// entries select the whole dimension.  Returns the number of dimensions that
+// remain, and their sizes in "odim".
+static int hdf5_parse_hyperslab(hsize_t *start, hsize_t *stride,
+		hsize_t *count, hsize_t *odim, const char *sel,
+		const hsize_t *dim, int ndim)
+{
+	int ondim = 0;
+	const char *p = sel ? sel + 1 : "]";
+	for (int i = 0; i < ndim; i++)
+	{
+		long d = dim[i], a = 0, b = d, st = 1;
+		bool single = false;
+		if (*p && *p != ']') {
+			char *q;
+			long v = strtol(p, &q, 10);
+			bool has_a = q != p;
+			if (has_a) a = v < 0 ? v + d : v;
+			p = q;
+			if (*p == ':') {
+				v = strtol(++p, &q, 10);
+				if (q != p) b = v < 0 ? v + d : v;
+				p = q;
+				if (*p == ':') {
+					st = strtol(++p, &q, 10);
+					p = q;
+				}
+			} else if (has_a) {
+				single = true;
+				b = a + 1;
+			}
+			if (*p == ',') p++;
+			else if (*p != ']')
+				fail("bad hdf5 hyperslab \"%s\"", sel);
+		}
+		if (a < 0 || b > d || a >= b || st < 1)
+			fail("hdf5 hyperslab \"%s\" out of range on dim %d "
+					"(%ld:%ld:%ld of %ld)", sel, i, a, b, st, d);
+		start[i] = a;
+		stride[i] = st;
+		count[i] = (b - a + st - 1) / st;
+		if (!single)
+			odim[ondim++] = count[i];
+	}
+	if (*p != ']' || (sel && p[1]))
+		fail("bad hdf5 hyperslab \"%s\" for %d dimensions", sel, ndim);
+	if (!ondim)
+		odim[ondim++] = 1;
+	return ondim;
+}
+
+// if "image" is not NULL, it contains the whole file (of "nimage" bytes)
+static int read_hdf5_image(struct iio_image *x, const char *filename_raw,
+		void *image, size_t nimage)
 {
 	// The structure of a HDF5 file is the following:
 	// - each file contains several datasets
@@ -1978,19 +2969,26 @@ static int read_whole_hdf5(struct iio_image *x, const char *filename_raw)
 	// if dataset is given by comma-suffix, take it
 	char filename[FILENAME_MAX];
 	snprintf(filename, FILENAME_MAX, "%s", filename_raw);
-	char *comma = strrchr(filename, ',');
+	char *comma = hdf5_dataset_comma(filename);
 	if (comma) {
 		*comma = '\0';
-		dataset_id = 1 + comma;
+		if (comma[1] != '[')
+			dataset_id = 1 + comma;
 	}
 
-	// otherwise, try a default dataset
-	if (!dataset_id)
-		dataset_id = "/dset";
+	// an optional hyperslab selector goes after the dataset name
+	char *sel = comma ? strchr(comma + 1, '[') : NULL;
+	char hyperslab[FILENAME_MAX] = {0};
+	if (sel) {
+		snprintf(hyperslab, FILENAME_MAX, "%s", sel);
+		*sel = '\0';
+		sel = hyperslab;
+	}
 
 
 	IIO_DEBUG("read whole hdf5 filename=\"%s\"\n", filename);
 	IIO_DEBUG("read whole hdf5 dataset=\"%s\"\n", dataset_id);
+	IIO_DEBUG("read whole hdf5 hyperslab=\"%s\"\n", sel ? sel : "");
 
 	// open the file, the dataset, and extract basic info
 	hid_t       f;  // file
@@ -2000,8 +2998,15 @@ static int read_whole_hdf5(struct iio_image *x, const char *filename_raw)
 	H5T_class_t c;  // data class (yes, you are in a world of pain now)
 	herr_t      e;  // error status code
 
-	// open file
-	f = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+	// open file (from memory, by the "core" driver, if possible)
+	hid_t fapl = H5P_DEFAULT;
+	if (image) {
+		fapl = H5Pcreate(H5P_FILE_ACCESS);
+		H5Pset_fapl_core(fapl, 1 << 20, 0);
+		H5Pset_file_image(fapl, image, nimage);
+	}
+	f = H5Fopen(filename, H5F_ACC_RDONLY, fapl);
+	if (image) H5Pclose(fapl);
 	IIO_DEBUG("h5 f = %d\n", (int)f);
 
 	// open dataset
@@ -2034,23 +3039,35 @@ static int read_whole_hdf5(struct iio_image *x, const char *filename_raw)
 	int ndim = H5Sget_simple_extent_ndims(s);
 
 	// sizes along each dimension
-	hsize_t dim[ndim];
-	size_t n = 1;
-	e = H5Sget_simple_extent_dims(s, dim, NULL);
+	hsize_t fdim[ndim];
+	e = H5Sget_simple_extent_dims(s, fdim, NULL);
 	IIO_DEBUG("h5 ndim = %d\n", ndim);
 	for (int i = 0; i < ndim; i++)
-	{
-		n *= dim[i];
-		IIO_DEBUG("\tdim[%d] = %d\n", i, (int)dim[i]);
-	}
-	IIO_DEBUG("h5 n = %d\n", (int)n);
+		IIO_DEBUG("\tdim[%d] = %d\n", i, (int)fdim[i]);
 
 	// extract hyperslab from within dataset
-	//e = H5Sselect_hyperslab();
+	// (only the chunks that intersect it are read from the file)
+	hsize_t start[ndim], stride[ndim], count[ndim], dim[ndim];
+	int fndim = ndim;
+	ndim = hdf5_parse_hyperslab(start, stride, count, dim, sel, fdim, ndim);
+	size_t n = 1;
+	for (int i = 0; i < fndim; i++)
+		n *= count[i];
+	IIO_DEBUG("h5 n = %d (%d dimensions selected)\n", (int)n, ndim);
 
 	void *buf = xmalloc(n * Bps);
-	e = H5Dread(d, t, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf);
+	if (sel) {
+		hid_t m = H5Screate_simple(fndim, count, NULL);
+		e = H5Sselect_hyperslab(s, H5S_SELECT_SET, start, stride,
+				count, NULL);
+		if (e < 0) fail("could not select hdf5 hyperslab \"%s\"", sel);
+		e = H5Dread(d, t, m, s, H5P_DEFAULT, buf);
+		H5Sclose(m);
+	} else
+		e = H5Dread(d, t, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf);
 	IIO_DEBUG("h5 e(read) = %d\n", (int)e);
+	if (e < 0) fail("could not read hdf5 dataset \"%s\"", dataset_id);
+	H5Sclose(s);
 
 
 	// close dataset and file, whatever that means
@@ -2078,7 +3095,8 @@ static int read_whole_hdf5(struct iio_image *x, const char *filename_raw)
 	// identify IIO sizes (with some squeezing if necessary)
 	// philosophy: data is not reordered here
 	int w=1, h=1, pd=1, brk=0;
-	if (ndim==2) {w=dim[1]; h=dim[0]; }
+	if (ndim==1) {w=dim[0]; }
+	else if (ndim==2) {w=dim[1]; h=dim[0]; }
 	else if (ndim==3 && dim[0]==1) { w=dim[2]; h=dim[1]; }
 	else if (ndim==3 && dim[2]==1) { w=dim[1]; h=dim[0]; }
 	else if (ndim==4 && dim[0]==1) { w=dim[2]; h=dim[1]; pd=dim[3]; brk=1; }
@@ -2098,6 +3116,11 @@ static int read_whole_hdf5(struct iio_image *x, const char *filename_raw)
 	return 0;
 }
 
+static int read_whole_hdf5(struct iio_image *x, const char *filename)
+{
+	return read_hdf5_image(x, filename, NULL, 0);
+}
+
 static int read_beheaded_hdf5(struct iio_image *x,
 		FILE *fin, char *header, int nheader)
 {
@@ -2110,13 +3133,11 @@ static int read_beheaded_hdf5(struct iio_image *x,
 
 	long filesize;
 	void *filedata = load_rest_of_file(&filesize, fin, header, nheader);
-	char *filename = put_data_into_temporary_file(filedata, filesize);
-	xfree(filedata);
 
-	int r = read_whole_hdf5(x, filename);
+	int r = read_hdf5_image(x, "-", filedata, filesize);
 	if (r) fail("read whole hdf5 returned %d", r);
 
-	delete_temporary_file(filename);
+	xfree(filedata);
 
 	return 0;
 }
@@ -2167,15 +3188,30 @@ static int read_beheaded_webp(struct iio_image *x,
 	void *filedata = load_rest_of_file(&filesize, f, header, nheader);
 	if (!filedata) return 1;
 
-	int w, h;
-	int rv = WebPGetInfo(filedata, filesize, &w, &h);
-	if (!rv) return 2;
-
+	// the advanced API, to let the decoder use a thread for filtering
+	WebPDecoderConfig c[1];
+	if (!WebPInitDecoderConfig(c)
+			|| VP8_STATUS_OK != WebPGetFeatures(filedata, filesize,
+				&c->input)) {
+		xfree(filedata);
+		return 2;
+	}
+	int w = c->input.width;
+	int h = c->input.height;
 	uint8_t *data = xmalloc(4 * w * h);
-	uint8_t *r = WebPDecodeRGBAInto(filedata, filesize, data, 4*w*h, 4*w);
-	if (!r) return 3;
-
-	xfree(filedata); // XXX: leak upon load failure
+	c->options.use_threads = iio_threads() > 1;
+	c->output.colorspace = MODE_RGBA;
+	c->output.is_external_memory = 1;
+	c->output.u.RGBA.rgba = data;
+	c->output.u.RGBA.stride = 4 * w;
+	c->output.u.RGBA.size = 4 * w * h;
+	int r = WebPDecode(filedata, filesize, c);
+	WebPFreeDecBuffer(&c->output);
+	xfree(filedata);
+	if (VP8_STATUS_OK != r) {
+		xfree(data);
+		return 3;
+	}
 
 	iio_image_init2d(x, w, h, 4, IIO_TYPE_UINT8);
 	x->data = data;
@@ -2195,6 +3231,10 @@ static int read_beheaded_heif(struct iio_image *x,
 
 	struct heif_context *ctx = heif_context_alloc();
 	heif_context_read_from_memory_without_copy(ctx, filedata, filesize, 0);
+#if defined(LIBHEIF_NUMERIC_VERSION) && LIBHEIF_NUMERIC_VERSION >= 0x010d0000
+	// the tiles of a grid image are decoded in parallel
+	heif_context_set_max_decoding_threads(ctx, iio_threads());
+#endif
 
 	struct heif_image_handle* handle;
 	heif_context_get_primary_image_handle(ctx, &handle);
@@ -2456,9 +3496,10 @@ static void byteswap4(void *data, int n)
 	}
 }
 
-static int read_beheaded_rim_fimage(struct iio_image *x, FILE *f, bool swp)
+// parse the fimage header and skip the comments
+// (fills-in the image struct, except for the data)
+static void rim_fimage_read_header(struct iio_image *x, FILE *f, bool swp)
 {
-	IIO_DEBUG("rim reader fimage swp = %d", swp);
 	uint16_t lencomm = rim_getshort(f, swp);
 	uint16_t dx = rim_getshort(f, swp);
 	uint16_t dy = rim_getshort(f, swp);
@@ -2467,6 +3508,15 @@ static int read_beheaded_rim_fimage(struct iio_image *x, FILE *f, bool swp)
 		int c = pick_char_for_sure(f); // skip further shit (comments)
 		(void)c;
 	}
+	iio_image_init2d(x, dx, dy, 1, IIO_TYPE_FLOAT);
+}
+
+static int read_beheaded_rim_fimage(struct iio_image *x, FILE *f, bool swp)
+{
+	IIO_DEBUG("rim reader fimage swp = %d", swp);
+	rim_fimage_read_header(x, f, swp);
+	int dx = x->sizes[0];
+	int dy = x->sizes[1];
 	// now, read dx*dy floats
 	float *data = xmalloc(dx * dy * sizeof*data);
 	size_t r = fread(data, sizeof*data, dx*dy, f);
@@ -2589,21 +3639,32 @@ static void switch_8endianness(void *tt, int n)
 }
 
 // PFM reader                                                               {{{2
+
+// parse the pfm header that follows the magic bytes
+// (fills-in the image struct, except for the data)
+static int pfm_read_header(struct iio_image *x, FILE *f, char *header,
+		float *scale)
+{
+	int w, h, pd = isupper(header[1]) ? 3 : 1;
+	if (!isspace(pick_char_for_sure(f))) return -1;
+	if (3 != fscanf(f, "%d %d\n%g", &w, &h, scale)) return -2;
+	if (!isspace(pick_char_for_sure(f))) return -3;
+	iio_image_init2d(x, w, h, pd, IIO_TYPE_FLOAT);
+	return 0;
+}
+
 static int read_beheaded_pfm(struct iio_image *x,
 		FILE *f, char *header, int nheader)
 {
 	assert(4 == sizeof(float));
 	assert(nheader == 2); (void)nheader;
 	assert('f' == tolower(header[1]));
-	int w, h, pd = isupper(header[1]) ? 3 : 1;
 	float scale;
-	if (!isspace(pick_char_for_sure(f))) return -1;
-	if (3 != fscanf(f, "%d %d\n%g", &w, &h, &scale)) return -2;
-	if (!isspace(pick_char_for_sure(f))) return -3;
-	float *data = xmalloc(w*h*4*pd);
-	if (1 != fread(data, w*h*4*pd, 1, f)) return (xfree(data),-4);
-
-	iio_image_init2d(x, w, h, 2, IIO_TYPE_FLOAT);
+	int r = pfm_read_header(x, f, header, &scale);
+	if (r) return r;
+	size_t n = iio_image_data_size(x);
+	float *data = xmalloc(n);
+	if (1 != fread(data, n, 1, f)) return (xfree(data),-4);
 	x->data = data;
 	return 0;
 }
@@ -2706,51 +3767,164 @@ static int read_beheaded_bmp(struct iio_image *x,
 // EXR reader                                                               {{{2
 
 #ifdef I_CAN_HAS_LIBEXR
-#include <OpenEXR/ImfCRgbaFile.h>
-// EXTERNALIZED TO :  read_exr_float.cpp
+#include <openexr.h>
+
+// The file is read by the chunk API of OpenEXR (OpenEXRCore): the chunks
+// (blocks of scanlines, or the tiles of the first level) are decoded in
+// parallel by IIO_THREADS threads, each one directly into the final image.
+// The environment variable IIO_EXR_CHANNELS selects the channels and their
+// order (e.g. "R,G,B" or "diffuse.R,depth.Z"); the other channels are not
+// unpacked.  By default, the channels R,G,B (and A) when the file has them,
+// or all the channels in the order of the file.
+
+// index of the channel named n in the list, or -1
+static int exr_channel_index(const exr_attr_chlist_t *l, const char *n)
+{
+	for (int k = 0; k < l->num_channels; k++)
+		if (!strcmp(l->entries[k].name.str, n))
+			return k;
+	return -1;
+}
+
+// the channels of the file that are read (returns their number)
+static int exr_select_channels(int *c, const exr_attr_chlist_t *l)
+{
+	int n = 0;
+	char *e = xgetenv("IIO_EXR_CHANNELS");
+	if (e) {
+		char buf[strlen(e) + 1];
+		strcpy(buf, e);
+		for (char *t = strtok(buf, ","); t; t = strtok(NULL, ","))
+		{
+			int k = exr_channel_index(l, t);
+			if (k < 0) fail("exr file has no channel \"%s\"", t);
+			if (n < IIO_MAX_DIMENSION) c[n++] = k;
+		}
+	} else if (exr_channel_index(l, "R") >= 0
+			&& exr_channel_index(l, "G") >= 0
+			&& exr_channel_index(l, "B") >= 0) {
+		const char *rgba[4] = {"R", "G", "B", "A"};
+		for (int i = 0; i < 4; i++)
+			if (exr_channel_index(l, rgba[i]) >= 0)
+				c[n++] = exr_channel_index(l, rgba[i]);
+	} else
+		for (int k = 0; k < l->num_channels && k < IIO_MAX_DIMENSION; k++)
+			c[n++] = k;
+	for (int i = 0; i < n; i++)
+		if (l->entries[c[i]].x_sampling != 1
+				|| l->entries[c[i]].y_sampling != 1)
+			fail("exr subsampled channel \"%s\" not supported",
+					l->entries[c[i]].name.str);
+	return n;
+}
 
-static int read_whole_exr(struct iio_image *x, const char *filename)
+// decode one chunk into the image y of size w x pd (whose origin is the
+// corner of the data window), the chunk starts at (x0,y0) of the image
+static bool exr_decode_chunk(float *y, int w, int pd, exr_context_t e,
+		exr_chunk_info_t *ci, int x0, int y0,
+		const exr_attr_chlist_t *l, int *c)
 {
-	struct ImfInputFile *f = ImfOpenInputFile(filename);
-	if (!f) fail("could not read exr from %s", filename);
-	int r;
-
-	const char *nom = ImfInputFileName(f);
-	IIO_DEBUG("ImfInputFileName returned %s\n", nom);
-
-	r = ImfInputChannels(f);
-	IIO_DEBUG("ImfInputChannels returned %d\n", r);
-
-	const struct ImfHeader *header = ImfInputHeader(f);
-	int xmin, ymin, xmax, ymax;
-	ImfHeaderDataWindow(header, &xmin, &ymin, &xmax, &ymax);
-	IIO_DEBUG("xmin ymin xmax ymax = %d %d %d %d\n", xmin,ymin,xmax,ymax);
-
-	int width = xmax - xmin + 1;
-	int height = ymax - ymin + 1;
-	struct ImfRgba *data = xmalloc(width*height*sizeof*data);
-
-	r = ImfInputSetFrameBuffer(f, data, 1, width);
-	IIO_DEBUG("ImfInputSetFrameBuffer returned %d\n", r);
-
-	r = ImfInputReadPixels(f, ymin, ymax);
-	IIO_DEBUG("ImfInputReadPixels returned %d\n", r);
+	exr_decode_pipeline_t d = EXR_DECODE_PIPELINE_INITIALIZER;
+	if (EXR_ERR_SUCCESS != exr_decoding_initialize(e, 0, ci, &d))
+		return false;
+	for (int k = 0; k < d.channel_count; k++)
+	{
+		exr_coding_channel_info_t *o = d.channels + k;
+		o->decode_to_ptr = NULL; // the channels not selected are skipped
+		for (int q = 0; q < pd; q++)
+			if (!strcmp(o->channel_name, l->entries[c[q]].name.str))
+			{
+				o->decode_to_ptr = (uint8_t *)(y + q
+						+ (y0 * (long)w + x0) * pd);
+				o->user_pixel_stride = pd * sizeof(float);
+				o->user_line_stride = w * pd * sizeof(float);
+				o->user_data_type = EXR_PIXEL_FLOAT;
+				o->user_bytes_per_element = sizeof(float);
+			}
+	}
+	bool r = EXR_ERR_SUCCESS == exr_decoding_choose_default_routines(e,
+			0, &d) && EXR_ERR_SUCCESS == exr_decoding_run(e, 0, &d);
+	exr_decoding_destroy(e, &d);
+	return r;
+}
 
-	r = ImfCloseInputFile(f);
-	IIO_DEBUG("ImfCloseInputFile returned %d\n", r);
+static int read_whole_exr(struct iio_image *x, const char *filename)
+{
+	exr_context_t e;
+	exr_context_initializer_t ci = EXR_DEFAULT_CONTEXT_INITIALIZER;
+	if (EXR_ERR_SUCCESS != exr_start_read(&e, filename, &ci))
+		fail("could not read exr from %s", filename);
+
+	exr_attr_box2i_t dw;
+	const exr_attr_chlist_t *l;
+	exr_storage_t st;
+	if (EXR_ERR_SUCCESS != exr_get_data_window(e, 0, &dw)
+			|| EXR_ERR_SUCCESS != exr_get_channels(e, 0, &l)
+			|| EXR_ERR_SUCCESS != exr_get_storage(e, 0, &st))
+		fail("bad exr header in %s", filename);
+	int w = dw.max.x - dw.min.x + 1;
+	int h = dw.max.y - dw.min.y + 1;
+	IIO_DEBUG("exr data window = %d %d %d %d\n",
+			dw.min.x, dw.min.y, dw.max.x, dw.max.y);
+
+	int c[IIO_MAX_DIMENSION];
+	int pd = exr_select_channels(c, l);
+	if (pd < 1) fail("exr file %s has no channels", filename);
+	float *y = xmalloc(w * (long)h * pd * sizeof*y);
+	for (long i = 0; i < w * (long)h * pd; i++)
+		y[i] = 0;
+
+	// the chunks of the first level, with their positions
+	int nc, cw = w, ch = 1;
+	if (st == EXR_STORAGE_TILED) {
+		uint32_t tw, th;
+		int32_t ntx, nty;
+		exr_tile_level_mode_t lm;
+		exr_tile_round_mode_t rm;
+		if (EXR_ERR_SUCCESS != exr_get_tile_descriptor(e, 0, &tw, &th,
+					&lm, &rm)
+				|| EXR_ERR_SUCCESS != exr_get_tile_counts(e, 0, 0, 0,
+					&ntx, &nty))
+			fail("bad exr tiles in %s", filename);
+		cw = tw;
+		ch = th;
+		nc = ntx * nty;
+	} else if (st == EXR_STORAGE_SCANLINE) {
+		int32_t lpc;
+		if (EXR_ERR_SUCCESS != exr_get_scanlines_per_chunk(e, 0, &lpc))
+			fail("bad exr scanlines in %s", filename);
+		ch = lpc;
+		nc = (h + ch - 1) / ch;
+	} else
+		fail("deep exr files are not supported (%s)", filename);
+	int ntx = (w + cw - 1) / cw;
+	IIO_DEBUG("exr %d chunks of %dx%d, %d channels\n", nc, cw, ch, pd);
 
-	float *finaldata = xmalloc(4*width*height*sizeof*data);
-	FORI(width*height) {
-		finaldata[4*i+0] = ImfHalfToFloat(data[i].r);
-		finaldata[4*i+1] = ImfHalfToFloat(data[i].g);
-		finaldata[4*i+2] = ImfHalfToFloat(data[i].b);
-		finaldata[4*i+3] = ImfHalfToFloat(data[i].a);
+	int bad = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads()) schedule(dynamic)
+#endif
+	for (int k = 0; k < nc; k++)
+	{
+		int tx = k % ntx, ty = k / ntx;
+		exr_chunk_info_t info;
+		exr_result_t r = st == EXR_STORAGE_TILED ?
+			exr_read_tile_chunk_info(e, 0, tx, ty, 0, 0, &info) :
+			exr_read_scanline_chunk_info(e, 0, dw.min.y + k*ch, &info);
+		if (EXR_ERR_SUCCESS != r || !exr_decode_chunk(y, w, pd, e,
+					&info, tx * cw, ty * ch, l, c))
+		{
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+			bad = 1;
+		}
 	}
-	xfree(data);
+	exr_finish(&e);
+	if (bad) fail("could not decode exr file %s", filename);
 
-	// fill struct fields
-	iio_image_init2d(x, w, h, 4, IIO_TYPE_FLOAT);
-	x->data = finaldata;
+	iio_image_init2d(x, w, h, pd, IIO_TYPE_FLOAT);
+	x->data = y;
 	return 0;
 }
 
@@ -2785,6 +3959,97 @@ static int read_beheaded_exr(struct iio_image *x,
 
 
 
+// text parsing                                                             {{{2
+
+// Parse a number as "strtod" does, in the C locale.  Plain decimal numbers
+// of up to 15 significant digits and small exponents are exactly representable
+// as a double times (or divided by) a power of ten, so that a single rounded
+// operation gives the correctly rounded result.  Other numbers (long
+// mantissae, large exponents, hexadecimal, inf, nan) are left to "strtod".
+static double text_strtod(const char *s, char **e)
+{
+	static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+		1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+		1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *p = s;
+	while (*p == ' ' || (*p >= '\t' && *p <= '\r')) p++;
+	bool neg = *p == '-';
+	if (*p == '-' || *p == '+') p++;
+	uint64_t m = 0;
+	int nd = 0, nz = 0, ex = 0;
+	for (; *p >= '0' && *p <= '9'; p++, nz++)
+		if (m || *p > '0') { m = 10*m + *p - '0'; nd++; }
+	if (*p == '.')
+		for (p++; *p >= '0' && *p <= '9'; p++, nz++, ex--)
+			if (m || *p > '0') { m = 10*m + *p - '0'; nd++; }
+	if (!nz || nd > 15) goto slow;
+	if ((*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool eneg = *q == '-';
+		if (*q == '-' || *q == '+') q++;
+		if (*q >= '0' && *q <= '9') {
+			int v = 0;
+			for (; *q >= '0' && *q <= '9'; q++)
+				if (v < 10000) v = 10*v + *q - '0';
+			ex += eneg ? -v : v;
+			p = q;
+		}
+	}
+	if ((*p|32) >= 'a' && (*p|32) <= 'z') goto slow;
+	if (ex < -22 || ex > 22) { if (m) goto slow; ex = 0; }
+	double r = ex < 0 ? m / p10[-ex] : m * p10[ex];
+	if (e) *e = (char *)p;
+	return neg ? -r : r;
+slow:
+	return strtod(s, e);
+}
+
+// Parse the numbers of "s" (of length "n", zero-terminated), separated by
+// any run of the characters of "delim", as if tokenized by "strtok" and
+// converted by "atof".  At most "nout" numbers are stored into "out", the
+// rest of the array is filled by zeros.  Big buffers are split in pieces
+// that are parsed in parallel.  Returns the number of tokens.
+static long parse_text_numbers(float *out, long nout, const char *s, long n,
+		const char *delim)
+{
+	bool isdelim[0x100] = {[0] = true};
+	for (const char *d = delim; *d; d++)
+		isdelim[(unsigned char)*d] = true;
+	n = strnlen(s, n); // like strtok, stop at the first zero byte
+#define TOKEN_STARTS(i) (!isdelim[(uint8_t)s[i]] && (!i||isdelim[(uint8_t)s[i-1]]))
+
+	int nchunks = 1 + n / 0x100000;
+	long count[nchunks + 1];
+	count[0] = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads())
+#endif
+	for (int c = 0; c < nchunks; c++)
+	{
+		long k = 0;
+		for (long i = c*n/nchunks; i < (c+1)*n/nchunks; i++)
+			k += TOKEN_STARTS(i);
+		count[c+1] = k;
+	}
+	for (int c = 0; c < nchunks; c++)
+		count[c+1] += count[c];
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads())
+#endif
+	for (int c = 0; c < nchunks; c++)
+	{
+		long k = count[c];
+		for (long i = c*n/nchunks; i < (c+1)*n/nchunks && k < nout; i++)
+			if (TOKEN_STARTS(i))
+				out[k++] = text_strtod(s + i, NULL);
+	}
+#undef TOKEN_STARTS
+	for (long k = count[nchunks]; k < nout; k++)
+		out[k] = 0;
+	return count[nchunks];
+}
+
 // ASC reader                                                               {{{2
 static int read_beheaded_asc(struct iio_image *x,
 		FILE *f, char *header, int nheader)
@@ -2806,13 +4071,8 @@ static int read_beheaded_asc(struct iio_image *x,
 	IIO_DEBUG("asc %d,%d,%d,%d\n", n[0], n[1], n[2], n[3]);
 
 	// read data
-	float *numbers = xdata;
-	char *delim = " \n", *tok = strtok(filedata + n[4], delim);
-	while (tok && numbers < (float*)(xdata)+nsamples)
-	{
-		*numbers++ = atof(tok);
-		tok = strtok(NULL, delim);
-	}
+	parse_text_numbers(xdata, nsamples, filedata + n[4],
+			filesize - n[4], " \n");
 	free(filedata);
 
 	x->data = xmalloc(nsamples * sizeof*xdata);
@@ -3007,12 +4267,7 @@ static int read_beheaded_csv(struct iio_image *x,
 	float *numbers = x->data;
 
 	// read data
-	char *delim = ",\n", *tok = strtok(filedata, delim);
-	while (tok && numbers < (float*)(x->data)+w*h)
-	{
-		*numbers++ = atof(tok);
-		tok = strtok(NULL, delim);
-	}
+	parse_text_numbers(numbers, w*h, filedata, filesize, ",\n");
 
 	// cleanup and exit
 	free(filedata);
@@ -3049,12 +4304,7 @@ static int read_beheaded_txt(struct iio_image *x,
 	float *numbers = x->data;
 
 	// read data
-	char *delim = " \n", *tok = strtok(filedata, delim);
-	while (tok && numbers < (float*)(x->data)+w*h)
-	{
-		*numbers++ = atof(tok);
-		tok = strtok(NULL, delim);
-	}
+	parse_text_numbers(numbers, w*h, filedata, filesize, " \n");
 
 	// cleanup and exit
 	free(filedata);
@@ -3103,25 +4353,47 @@ static int xml_get_tag_content(char *out, char *line, char *tag)
 }
 
 
-float *iio_read_image_float(const char *fname, int *w, int *h); // forward
-static int read_beheaded_vrt(struct iio_image *x,
-		FILE *fin, char *header, int nheader)
+// The mosaic is only an index of its sources (their names and rectangles),
+// that are read on demand: a region of interest only reads the parts of the
+// sources that intersect it (in parallel, with IIO_THREADS), and a stream
+// keeps a bounded number of them open (see IIO_STREAM_VRT).  The sources are
+// pasted in the order of the file, so that the later ones are on top.  The
+// pixels not covered by any source are zero.
+
+struct vrt_source {
+	char *fname;         // full name of the file
+	int x, y, w, h;      // destination rectangle, "DstRect"
+	int sw, sh;          // size of the file (0 until its header is read)
+};
+
+struct vrt_mosaic {
+	int w, h, n;
+	struct vrt_source *s;
+};
+
+static int read_image(struct iio_image *x, const char *fname);
+static int read_image_info(struct iio_image *x, const char *fname);
+static int read_image_roi(struct iio_image *x, const char *fname,
+		int x0, int y0, int xf, int yf);
+
+// parse the vrt file "vname" (from the rest of its first line)
+static int vrt_parse(struct vrt_mosaic *v, FILE *fin, const char *vname)
 {
-	(void)header; (void)nheader;
 	int n = FILENAME_MAX + 0x200, cx = 0, w = 0, h = 0;
-	char fname[n], dirvrt[n], fullfname[n], line[n], *sl = fgets(line, n, fin);
+	char fname[n], dirvrt[n], line[n], *sl = fgets(line, n, fin);
 	if (!sl) return 1;
 	cx += xml_get_numeric_attr(&w, line, "Dataset", "rasterXSize");
 	cx += xml_get_numeric_attr(&h, line, "Dataset", "rasterYSize");
 	if (!w || !h) return 2;
 	if (cx != 2) return 3;
-	iio_image_init2d(x, w, h, 1, IIO_TYPE_FLOAT);
-	x->data = xmalloc(w * h * sizeof(float));
-	float (*xx)[w] = x->data;
-	int pos[4] = {0,0,0,0}, pos_cx = 0, has_fname = 0;
+	v->w = w;
+	v->h = h;
+	v->n = 0;
+	v->s = NULL;
+	int pos[4] = {0,0,0,0}, pos_cx = 0, has_fname = 0, nmax = 0;
 
 	// obtain the path where the vrt file is located
-	strncpy(dirvrt, global_variable_containing_the_name_of_the_last_opened_file, n-1);
+	snprintf(dirvrt, n, "%s", vname ? vname : ".");
 	char* dirvrt2 = dirname(dirvrt);
 
 	while (1) {
@@ -3135,48 +4407,169 @@ static int read_beheaded_vrt(struct iio_image *x,
 		if (pos_cx == 4 && has_fname == 1)
 		{
 			pos_cx = has_fname = 0;
-			int wt, ht;
-			snprintf(fullfname,FILENAME_MAX,"%s/%s",dirvrt2,fname);
-			float *xt = iio_read_image_float(fullfname, &wt, &ht);
-			if (!xt) return 4;
-			for (int j = 0; j < pos[3]; j++)
-			for (int i = 0; i < pos[2]; i++)
-			{
-				int ii = i + pos[0];
-				int jj = j + pos[1];
-				if (insideP(w,h, ii,jj) && insideP(wt,ht, i,j))
-					xx[jj][ii] = xt[j*wt+i];
+			if (v->n == nmax) {
+				nmax = nmax ? 2 * nmax : 64;
+				v->s = xrealloc(v->s, nmax * sizeof*v->s);
 			}
-			xfree(xt);
+			struct vrt_source *t = v->s + v->n++;
+			int l = strlen(dirvrt2) + strlen(fname) + 2;
+			t->fname = xmalloc(l);
+			snprintf(t->fname, l, "%s/%s", dirvrt2, fname);
+			t->x = pos[0];
+			t->y = pos[1];
+			t->w = pos[2];
+			t->h = pos[3];
+			t->sw = t->sh = 0;
 		}
 	}
 	return 0;
 }
 
-// FARBFELD reader                                                          {{{2
-static int read_beheaded_ffd(struct iio_image *x,
-		FILE *fin, char *header, int nheader)
+static void vrt_free(struct vrt_mosaic *v)
 {
-	(void)header; (void)nheader;
-	for (int i = 0; i < 4; i++)
-		pick_char_for_sure(fin);
-	int s[8];
-	for (int i = 0; i < 8; i++)
-		s[i] = pick_char_for_sure(fin);
-	uint32_t w = s[3] + 0x100 * s[2] + 0x10000 * s[1] + 0x1000000 * s[0];
-	uint32_t h = s[7] + 0x100 * s[6] + 0x10000 * s[5] + 0x1000000 * s[4];
+	for (int k = 0; k < v->n; k++)
+		xfree(v->s[k].fname);
+	if (v->s) xfree(v->s);
+	v->s = NULL;
+	v->n = 0;
+}
 
-	iio_image_init2d(x, w, h, 4, IIO_TYPE_UINT16);
-	x->data = xmalloc(w * h * 4 * sizeof(uint16_t));
-	uint32_t r = fread(x->data, 2, w*h*4, fin);
-	if (r != w*h*4) return 1;
-	switch_2endianness(x->data, r);
-	return 0;
+// intersection of the window [x0,x0+w) x [y0,y0+h) with the pixels of the
+// mosaic that come from the source t, whose size must be known
+// (returns false if it is empty)
+static bool vrt_clip(int r[4], struct vrt_source *t,
+		int x0, int y0, int w, int h)
+{
+	r[0] = t->x > x0 ? t->x : x0;
+	r[1] = t->y > y0 ? t->y : y0;
+	r[2] = t->x + (t->w < t->sw ? t->w : t->sw);
+	r[3] = t->y + (t->h < t->sh ? t->h : t->sh);
+	if (r[2] > x0 + w) r[2] = x0 + w;
+	if (r[3] > y0 + h) r[3] = y0 + h;
+	return r[0] < r[2] && r[1] < r[3];
 }
 
-// RAT reader                                                               {{{2
-static int read_beheaded_rat(struct iio_image *x,
-		FILE *fin, char *header, int nheader)
+// whether the destination rectangle of t intersects a window
+static bool vrt_overlaps(struct vrt_source *t, int x0, int y0, int w, int h)
+{
+	return t->x < x0 + w && t->y < y0 + h
+		&& t->x + t->w > x0 && t->y + t->h > y0;
+}
+
+// gray level of the samples of a source (as in "iio_read_image_float")
+static int vrt_scalarize(struct iio_image *x)
+{
+	if (x->pixel_dimension == 3) iio_hacky_uncolorize(x);
+	if (x->pixel_dimension == 4) iio_hacky_uncolorizea(x);
+	if (x->pixel_dimension != 1) return 1;
+	iio_convert_samples(x, IIO_TYPE_FLOAT);
+	return 0;
+}
+
+// read the window [x0,x0+w) x [y0,y0+h) of the mosaic into "out"
+static int vrt_read_window(struct vrt_mosaic *v, float *out,
+		int x0, int y0, int w, int h)
+{
+	for (long p = 0; p < w * (long)h; p++)
+		out[p] = 0;
+	int *k = xmalloc((v->n + 1) * sizeof*k), nk = 0;
+	for (int i = 0; i < v->n; i++)
+		if (vrt_overlaps(v->s + i, x0, y0, w, h))
+			k[nk++] = i;
+	struct iio_image *b = xmalloc((nk + 1) * sizeof*b);
+	int (*r)[4] = xmalloc((nk + 1) * sizeof*r), err = 0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads()) schedule(dynamic)
+#endif
+	for (int q = 0; q < nk; q++)
+	{
+		struct vrt_source *t = v->s + k[q];
+		b[q].data = NULL;
+		if (!t->sw) {
+			struct iio_image i[1];
+			if (read_image_info(i, t->fname)) {
+				err = 1;
+				continue;
+			}
+			t->sw = i->sizes[0];
+			t->sh = i->sizes[1];
+		}
+		if (!vrt_clip(r[q], t, x0, y0, w, h))
+			continue;
+		if (read_image_roi(b + q, t->fname, r[q][0] - t->x,
+					r[q][1] - t->y, r[q][2] - t->x,
+					r[q][3] - t->y) || vrt_scalarize(b + q))
+			err = 1;
+	}
+	for (int q = 0; q < nk; q++)
+	{
+		float *bq = b[q].data;
+		if (!bq) continue;
+		int bw = r[q][2] - r[q][0];
+		for (int j = r[q][1]; j < r[q][3]; j++)
+			memcpy(out + (j - y0) * (long)w + r[q][0] - x0,
+				bq + (j - r[q][1]) * (long)bw, bw * sizeof*out);
+		xfree(bq);
+	}
+	xfree(r);
+	xfree(b);
+	xfree(k);
+	return err;
+}
+
+static int read_beheaded_vrt(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
+{
+	(void)header; (void)nheader;
+	const char *vname =
+		global_variable_containing_the_name_of_the_last_opened_file;
+	struct vrt_mosaic v[1];
+	int r = vrt_parse(v, fin, vname);
+	if (r) return r;
+
+	// for a region of interest, read only its sources
+	int rx = 0, ry = 0, rw = v->w, rh = v->h;
+	bool roi = vname && global_roi.fname && !global_roi.done
+		&& 0 == strcmp(vname, global_roi.fname);
+	if (roi) global_roi_rectangle(&rx, &ry, &rw, &rh, v->w, v->h);
+	struct iio_roi roi_state = global_roi;
+
+	iio_image_init2d(x, rw, rh, 1, IIO_TYPE_FLOAT);
+	x->data = xmalloc(rw * (long)rh * sizeof(float));
+	r = vrt_read_window(v, x->data, rx, ry, rw, rh);
+	vrt_free(v);
+
+	// the sources were read with the same global state
+	global_roi = roi_state;
+	global_variable_containing_the_name_of_the_last_opened_file = vname;
+	if (roi) global_roi.done = true;
+	return r ? 4 : 0;
+}
+
+// FARBFELD reader                                                          {{{2
+static int read_beheaded_ffd(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
+{
+	(void)header; (void)nheader;
+	for (int i = 0; i < 4; i++)
+		pick_char_for_sure(fin);
+	int s[8];
+	for (int i = 0; i < 8; i++)
+		s[i] = pick_char_for_sure(fin);
+	uint32_t w = s[3] + 0x100 * s[2] + 0x10000 * s[1] + 0x1000000 * s[0];
+	uint32_t h = s[7] + 0x100 * s[6] + 0x10000 * s[5] + 0x1000000 * s[4];
+
+	iio_image_init2d(x, w, h, 4, IIO_TYPE_UINT16);
+	x->data = xmalloc(w * h * 4 * sizeof(uint16_t));
+	uint32_t r = fread(x->data, 2, w*h*4, fin);
+	if (r != w*h*4) return 1;
+	switch_2endianness(x->data, r);
+	return 0;
+}
+
+// RAT reader                                                               {{{2
+static int read_beheaded_rat(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
 {
 	(void)header; (void)nheader;
 	assert(nheader == 4);
@@ -3206,11 +4599,12 @@ static int read_beheaded_rat(struct iio_image *x,
 }
 
 // NUMPY reader                                                             {{{2
-static int read_beheaded_npy(struct iio_image *x,
-		FILE *fin, char *header, int nheader)
+
+// parse the npy header that follows the magic bytes
+// (fills-in the image struct, except for the data)
+static int npy_read_header(struct iio_image *x, FILE *fin,
+		bool *fortran, bool *bigendian)
 {
-	(void)header;
-	assert(nheader == 4);
 	int s[6]; // remaining part of the fixed-size header
 	for (int i = 0; i < 6; i++)
 		s[i] = pick_char_for_sure(fin);
@@ -3237,7 +4631,8 @@ static int read_beheaded_npy(struct iio_image *x,
 		pd = 1;
 	}
 
-	if (order[0] == 'T') // fortran_order == True
+	*fortran = order[0] == 'T';
+	if (*fortran) // fortran_order == True
 	{
 		int t = h;
 		h = w;
@@ -3252,6 +4647,7 @@ static int read_beheaded_npy(struct iio_image *x,
 
 	// parse type string
 	char *desc = descr; // pointer to the bare description
+	*bigendian = *descr == '>';
 	if (*descr=='<' || *descr=='>' || *descr=='=' || *descr=='|')
 		desc += 1;
 	if (false) ;
@@ -3276,17 +4672,268 @@ static int read_beheaded_npy(struct iio_image *x,
 
 	// fill image struct
 	iio_image_init2d(x, w, h, pd, x->type);
+	return 0;
+}
+
+// read the selected bands of the npy data that follows the header; in fortran
+// order each band is a contiguous plane, and the others are skipped, while in
+// C order the pixels are read by rows and only the selected samples kept
+static int npy_read_bands(struct iio_image *x, FILE *fin, bool fortran)
+{
+	int w = x->sizes[0], h = x->sizes[1], pd = x->pixel_dimension;
+	int n = global_bands.n, *b = global_bands.b;
+	size_t ss = iio_type_size(x->type), np = w * (size_t)h;
+	char *y = xmalloc(np * n * ss);
+	if (fortran) {
+		char *p = xmalloc(np * n * ss); // the selected planes
+		long pos = 0; // current plane, counted in samples
+		for (int k = 0; k < n; k++)
+		{
+			long skip = (b[k] * np - pos) * ss;
+			if (skip && fseek(fin, skip, SEEK_CUR))
+			{
+				if (skip < 0) fail("cannot go back in npy file");
+				while (skip-- > 0)
+					pick_char_for_sure(fin);
+			}
+			if (np != fread(p + k*np*ss, ss, np, fin))
+				fail("npy file smaller than expected");
+			pos = (b[k] + 1) * np;
+		}
+		interleave_samples(y, p, np, n, ss);
+		xfree(p);
+	} else {
+		char *r = xmalloc(w * pd * ss); // a row of the file
+		for (int j = 0; j < h; j++)
+		{
+			if ((size_t)w * pd != fread(r, ss, w * pd, fin))
+				fail("npy file smaller than expected");
+			char *o = y + j * (size_t)w * n * ss;
+			for (int i = 0; i < w; i++)
+			for (int k = 0; k < n; k++)
+				memcpy(o + (i*n + k)*ss, r + (i*pd + b[k])*ss, ss);
+		}
+		xfree(r);
+	}
+	x->data = y;
+	x->pixel_dimension = n;
+	if (fortran) inplace_transpose(x);
+	global_bands.done = true;
+	return 0;
+}
+
+static int read_beheaded_npy(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
+{
+	(void)header;
+	assert(nheader == 4);
+	bool fortran, bigendian;
+	int r = npy_read_header(x, fin, &fortran, &bigendian);
+	if (r) return r;
+
+	int w = x->sizes[0];
+	int h = x->sizes[1];
+	int pd = x->pixel_dimension;
 	size_t bps = iio_type_size(x->type);
 	IIO_DEBUG("bps = %d\n", (int)bps);
+	const char *fname =
+		global_variable_containing_the_name_of_the_last_opened_file;
+	if (global_bands_apply(fname ? fname : "-", pd))
+		return npy_read_bands(x, fin, fortran);
 	x->data = xmalloc(((bps * w) * h) * pd);
 	IIO_DEBUG("data = %p\n", (void*)x->data);
-	uint64_t r = fread(x->data, bps, w*h*pd, fin);
-	if (r != (uint64_t)w*h*pd)
+	uint64_t n = fread(x->data, bps, w*h*pd, fin);
+	if (n != (uint64_t)w*h*pd)
 		fprintf(stderr,"IIO WARNING: npy file smaller than expected\n");
-	if (order[0] == 'T') inplace_transpose(x);
+	if (fortran && pd > 1) // the bands are planes
+		repair_broken_pixels_inplace(x->data, w*h, pd, bps);
+	if (fortran) inplace_transpose(x);
+	return 0;
+}
+
+// ZNPY reader                                                              {{{2
+// (see "ZNPY writer" below)
+#ifdef I_CAN_HAS_ZLIB
+#include <zlib.h>
+#endif
+#ifdef I_CAN_HAS_LIBZSTD
+#include <zstd.h>
+#endif
+
+#define ZNPY_CODEC_DEFLATE 1
+#define ZNPY_CODEC_ZSTD 2
+#define ZNPY_FLAG_SHUFFLE 1
+
+struct znpy_header {
+	int codec;         // ZNPY_CODEC_*
+	int flags;         // ZNPY_FLAG_*
+	uint64_t chunk;    // uncompressed size of each chunk, in bytes
+	int nchunks;       // number of chunks
+	uint64_t *offset;  // position of each chunk, and of the end (malloc'd)
+};
+
+static uint64_t znpy_get(uint8_t *b, int n)
+{
+	uint64_t r = 0;
+	for (int i = n - 1; i >= 0; i--)
+		r = 0x100 * r + b[i];
+	return r;
+}
+
+// read the header of a znpy file, whose first 4 bytes are already read
+static int znpy_read_header(struct iio_image *x, struct znpy_header *z,
+		FILE *f)
+{
+	uint8_t b[16];
+	if (12 != fread(b + 4, 1, 12, f) || b[4] != 'Y' || b[5] != 1)
+		return 1;
+	z->codec = b[6];
+	z->flags = b[7];
+	z->chunk = znpy_get(b + 8, 4);
+	z->nchunks = znpy_get(b + 12, 4);
+	if (4 != fread(b, 1, 4, f) || b[0] != 0x93 || b[1] != 'N')
+		return 2;
+	bool fortran, swapped;
+	if (npy_read_header(x, f, &fortran, &swapped) || fortran || swapped)
+		return 3;
+	size_t n = iio_image_data_size(x);
+	if (!z->chunk || z->nchunks != (int)((n + z->chunk - 1) / z->chunk))
+		return 4;
+	z->offset = xmalloc((z->nchunks + 1) * sizeof*z->offset);
+	FORI(z->nchunks + 1) {
+		if (8 != fread(b, 1, 8, f))
+			return xfree(z->offset), 5;
+		z->offset[i] = znpy_get(b, 8);
+	}
+	IIO_DEBUG("znpy codec=%d flags=%d chunk=%zu nchunks=%d\n",
+			z->codec, z->flags, (size_t)z->chunk, z->nchunks);
+	return 0;
+}
+
+static void znpy_decode_chunk(void *out, size_t n, void *in, size_t nin,
+		struct znpy_header *z, int ss)
+{
+	(void)in; (void)nin;
+	bool shuffle = z->flags & ZNPY_FLAG_SHUFFLE;
+	void *t = shuffle ? xmalloc(n) : out;
+	size_t r = 0;
+	switch (z->codec) {
+#ifdef I_CAN_HAS_ZLIB
+	case ZNPY_CODEC_DEFLATE: {
+		uLongf m = n;
+		if (Z_OK == uncompress(t, &m, in, nin)) r = m;
+		break;
+	}
+#endif//I_CAN_HAS_ZLIB
+#ifdef I_CAN_HAS_LIBZSTD
+	case ZNPY_CODEC_ZSTD: {
+		size_t m = ZSTD_decompress(t, n, in, nin);
+		if (!ZSTD_isError(m)) r = m;
+		break;
+	}
+#endif//I_CAN_HAS_LIBZSTD
+	default: fail("znpy codec %d not available", z->codec);
+	}
+	if (r != n) fail("corrupt znpy chunk (%zu of %zu bytes)", r, n);
+	if (shuffle) {
+		interleave_samples(out, t, n / ss, ss, 1);
+		xfree(t);
+	}
+}
+
+static int read_beheaded_znpy(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
+{
+	(void)header;
+	assert(nheader == 4);
+	struct znpy_header z[1];
+	int r = znpy_read_header(x, z, fin);
+	if (r) return r;
+	int w = x->sizes[0], h = x->sizes[1], ss = iio_image_sample_size(x);
+	size_t n = iio_image_data_size(x);
+	size_t rowbytes = (size_t)w * x->pixel_dimension * ss;
+
+	// for a region of interest, decode only the chunks of its row band
+	int rx = 0, ry = 0, rw = w, rh = h, c0 = 0, c1 = z->nchunks, rpc = 0;
+	const char *fname =
+		global_variable_containing_the_name_of_the_last_opened_file;
+	bool roi = fname && global_roi.fname && !global_roi.done
+		&& 0 == strcmp(fname, global_roi.fname)
+		&& z->chunk % rowbytes == 0;
+	if (roi) global_roi_rectangle(&rx, &ry, &rw, &rh, w, h);
+	if (roi && rw > 0 && rh > 0) {
+		rpc = z->chunk / rowbytes;
+		c0 = ry / rpc;
+		c1 = (ry + rh + rpc - 1) / rpc;
+	} else roi = false;
+
+	// the compressed chunks are contiguous, after the header
+	uint64_t *o = z->offset;
+	long skip = o[c0] - o[0];
+	if (skip && fseek(fin, skip, SEEK_CUR))
+		while (skip-- > 0)
+			pick_char_for_sure(fin);
+	size_t nin = o[c1] - o[c0];
+	char *in = xmalloc(nin);
+	if (nin != fread(in, 1, nin, fin))
+		fail("znpy file smaller than expected");
+	size_t base = c0 * z->chunk;
+	size_t nout = (c1 * z->chunk < n ? c1 * z->chunk : n) - base;
+	char *out = xmalloc(nout);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads())
+#endif
+	for (int c = c0; c < c1; c++)
+	{
+		size_t a = c * z->chunk - base;
+		size_t m = a + z->chunk < nout ? z->chunk : nout - a;
+		znpy_decode_chunk(out + a, m, in + o[c] - o[c0],
+				o[c+1] - o[c], z, ss);
+	}
+	xfree(in);
+	xfree(z->offset);
+	x->data = out;
+
+	if (roi) {
+		int y0 = c0 * rpc, ny = nout / rowbytes;
+		x->sizes[1] = ny;
+		inplace_trim(x, rx, y0 + ny - ry - rh, w - rx - rw, ry - y0);
+		global_roi.done = true;
+	}
 	return 0;
 }
 
+// SHM reader                                                               {{{2
+// (see "SHM writer" below)
+static int read_image_f(struct iio_image*, FILE *);
+static int read_beheaded_shm(struct iio_image *x,
+		FILE *fin, char *header, int nheader)
+{
+	(void)header; (void)nheader;
+#ifdef I_CAN_HAS_SHM
+	char name[100];
+	size_t n;
+	if (2 != fscanf(fin, " %99s %zu", name, &n) || *name != '/')
+		return 1;
+	pick_char_for_sure(fin); // final newline
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) fail("could not open shared memory object \"%s\"", name);
+	shm_unlink(name);
+	void *p = mmap(NULL, n, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) fail("could not map shared memory \"%s\"", name);
+	IIO_DEBUG("reading %zu bytes from shared memory \"%s\"\n", n, name);
+	FILE *f = iio_fmemopen(p, n);
+	int r = read_image_f(x, f);
+	fclose(f);
+	munmap(p, n);
+	return r;
+#else//I_CAN_HAS_SHM
+	(void)x; (void)fin;
+	fail("shared memory images are not supported");
+#endif//I_CAN_HAS_SHM
+}
+
 // VICAR reader                                                             {{{2
 static int read_beheaded_vic(struct iio_image *x,
 		FILE *fin, char *header, int nheader)
@@ -3615,7 +5262,6 @@ static int parse_raw_binary_image_explicit(struct iio_image *x,
 		int header_bytes, int sample_type,
 		bool broken_pixels, bool endianness)
 {
-	(void)broken_pixels;
 	size_t nsamples = w*h*pd;
 	size_t ss = iio_type_size(sample_type);
 	if (ndata < header_bytes + nsamples*ss) {
@@ -3633,6 +5279,36 @@ static int parse_raw_binary_image_explicit(struct iio_image *x,
 		if (ss >= 4)
 			switch_4endianness(x->data, nsamples);
 	}
+	if (broken_pixels && pd > 1)
+		repair_broken_pixels_inplace(x->data, w*h, pd, ss);
+	return 0;
+}
+
+// explicit raw reader of the selected bands (the other ones are not touched,
+// which avoids reading them when the data is mapped)
+static int parse_raw_binary_bands(struct iio_image *x, char *data,
+		int w, int h, int pd, int header_bytes, int sample_type,
+		bool broken_pixels, bool endianness)
+{
+	int n = global_bands.n, *b = global_bands.b;
+	size_t ss = iio_type_size(sample_type), np = w * (size_t)h;
+	int sizes[2] = {w, h};
+	iio_image_build_independent(x, 2, sizes, sample_type, n);
+	char *y = x->data, *d = data + header_bytes;
+	for (int k = 0; k < n; k++)
+		if (broken_pixels)
+			for (size_t i = 0; i < np; i++)
+				memcpy(y + (i*n + k)*ss, d + (b[k]*np + i)*ss, ss);
+		else
+			for (size_t i = 0; i < np; i++)
+				memcpy(y + (i*n + k)*ss, d + (i*pd + b[k])*ss, ss);
+	if (endianness) {
+		if (ss == 2)
+			switch_2endianness(x->data, np * n);
+		if (ss >= 4)
+			switch_4endianness(x->data, np * n);
+	}
+	global_bands.done = true;
 	return 0;
 }
 
@@ -3661,7 +5337,12 @@ static int raw_gfp(void *dat, int siz, char *tok, int endianness)
 	}
 }
 
-static int read_raw_named_image(struct iio_image *x, const char *filespec)
+// read a raw image given by its full specification (see above)
+// if "map_type" is non-zero, map the file and point into it, or fail with
+// a non-zero return value if the data is not stored with that type
+// (a negative "map_type" accepts any type)
+static int raw_named_image(struct iio_image *x, const char *filespec,
+		int map_type)
 {
 	// filespec => description + filename
 	char *colon = raw_prefix(filespec);
@@ -3671,9 +5352,22 @@ static int read_raw_named_image(struct iio_image *x, const char *filespec)
 	memcpy(description, filespec+4, desclen);
 	description[desclen] = '\0';
 
-	// read data from file
+	// read data from file (only the touched parts, when selecting bands)
+	bool bands = !map_type && global_bands.fname && !global_bands.done
+		&& 0 == strcmp(filespec, global_bands.fname);
 	long file_size;
 	void *file_contents = NULL;
+#ifdef I_CAN_HAS_MMAP
+	size_t map_size = 0;
+	if (map_type || bands)
+		file_contents = iio_map_file(&map_size, filename);
+	if (map_type && !file_contents) return 1;
+	if (file_contents)
+		file_size = map_size;
+	else
+#else
+	if (map_type) return 1;
+#endif//I_CAN_HAS_MMAP
 	{
 		FILE *f = xfopen(filename, "r");
 		file_contents = load_rest_of_file(&file_size, f, NULL, 0);
@@ -3753,16 +5447,49 @@ static int read_raw_named_image(struct iio_image *x, const char *filespec)
 	if (used_data_size > file_size)
 		fail("raw file is not large enough");
 
-	int r = parse_raw_binary_image_explicit(x,
-			file_contents, file_size,
-			width, height, pixel_dimension,
-			offset, sample_type, brokenness, endianness);
+#ifdef I_CAN_HAS_MMAP
+	if (map_type)
+	{
+		bool good = !endianness && !orientation && !brokenness
+			&& (map_type < 0 || normalize_type(sample_type)
+					== normalize_type(map_type))
+			&& 0 == offset % ss
+			&& iio_register_mapping(file_contents, map_size,
+					offset + (char*)file_contents);
+		if (!good) return munmap(file_contents, map_size), 2;
+		int sizes[2] = {width, height};
+		iio_wrap_image_struct_around_data(x, 2, sizes, pd,
+				sample_type, offset + (char*)file_contents);
+		return 0;
+	}
+#endif//I_CAN_HAS_MMAP
+
+	int r;
+	if (bands && global_bands_apply(filespec, pd))
+		r = parse_raw_binary_bands(x, file_contents,
+				width, height, pixel_dimension,
+				offset, sample_type, brokenness, endianness);
+	else
+		r = parse_raw_binary_image_explicit(x,
+				file_contents, file_size,
+				width, height, pixel_dimension,
+				offset, sample_type, brokenness, endianness);
 	if (orientation)
 		inplace_reorient(x, orientation);
+#ifdef I_CAN_HAS_MMAP
+	if (map_size)
+		munmap(file_contents, map_size);
+	else
+#endif//I_CAN_HAS_MMAP
 	xfree(file_contents);
 	return r;
 }
 
+static int read_raw_named_image(struct iio_image *x, const char *filespec)
+{
+	return raw_named_image(x, filespec, 0);
+}
+
 // read a RAW image specified by the IIO_RAW environment
 // caveat: the image *must* be a named file, not a pipe
 // (this is for simplicity of the implementation, this restriction can be
@@ -3803,14 +5530,9 @@ static char *trans_prefix(const char *f)
 static void trans_flip(struct iio_image *x, char *s)
 {
 	IIO_DEBUG("TRANS flip \"%s\"\n", s);
-	if (0 == strcmp(s, "leftright")) inplace_flip_horizontal(x);
-	if (0 == strcmp(s, "topdown"))   inplace_flip_vertical(x);
-	if (0 == strcmp(s, "transpose")) inplace_transpose(x);
-	if (0 == strcmp(s, "r270"))      inplace_reorient(x, 'y' + 'X' * 0x100);
-	if (0 == strcmp(s, "r90"))       inplace_reorient(x, 'Y' + 'x' * 0x100);
-	if (0 == strcmp(s, "r180"))      inplace_reorient(x, 'X' + 'Y' * 0x100);
-	if (0 == strcmp(s, "posetrans")) inplace_reorient(x, 'Y' + 'X' * 0x100);
-	if (2 == strlen(s)) inplace_reorient(x, s[0] + s[1]*0x100);
+	bool fh, fv, t;
+	if (d8_parse(&fh, &fv, &t, s))
+		inplace_flip(x, s);
 	if (3 == strlen(s) && (3*'y')==tolower(*s)+tolower(s[1])+tolower(s[2]))
 		inplace_3dreorient(x, s);
 }
@@ -3930,6 +5652,236 @@ int try_reading_file_with_libraw_4channels(const char *fname, struct iio_image *
 
 #ifdef I_CAN_HAS_LIBPNG
 
+// options for writing png files, given by the environment variable
+// IIO_PNG_OPTIONS or by a filename suffix like "out.png,level=1,filter=up"
+//
+// 	level=N      zlib compression level (0 to 9)
+// 	filter=F     none, sub, up, avg, paeth, or adaptive (the default)
+// 	threads=N    compress bands of rows in parallel into a single zlib
+// 	             stream (each band is primed with the last 32K of the
+// 	             previous one, as in pigz); "parallel" uses IIO_THREADS
+//
+// Without threads the file is written by libpng.
+struct png_write_options {
+	int level;   // zlib compression level, or -1 for the default
+	int filter;  // PNG_FILTER_VALUE_*, or -1 for adaptive
+	int threads; // number of threads that compress the bands
+};
+
+static void png_parse_write_options(struct png_write_options *o,
+		const char *options)
+{
+	char buf[strlen(options) + 1];
+	strcpy(buf, options);
+	for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+	{
+		char *eq = strchr(tok, '=');
+		int v = eq ? atoi(eq + 1) : 0;
+		if (eq) *eq = '\0';
+		if (!strcmp(tok, "level"))
+			o->level = v < 0 ? 0 : v > 9 ? 9 : v;
+		else if (!strcmp(tok, "threads"))
+			o->threads = v;
+		else if (!strcmp(tok, "parallel"))
+			o->threads = iio_threads();
+		else if (!strcmp(tok, "filter") && eq) {
+			char *f = eq + 1;
+			if      (!strcmp(f, "none"))  o->filter = PNG_FILTER_VALUE_NONE;
+			else if (!strcmp(f, "sub"))   o->filter = PNG_FILTER_VALUE_SUB;
+			else if (!strcmp(f, "up"))    o->filter = PNG_FILTER_VALUE_UP;
+			else if (!strcmp(f, "avg"))   o->filter = PNG_FILTER_VALUE_AVG;
+			else if (!strcmp(f, "paeth")) o->filter = PNG_FILTER_VALUE_PAETH;
+			else if (!strcmp(f, "adaptive")) o->filter = -1;
+			else fail("unrecognized png filter \"%s\"", f);
+		}
+		else fail("unrecognized png option \"%s\"", tok);
+	}
+}
+
+// position of the options in a filename like "out.png,level=1"
+static char *png_options_suffix(const char *filename)
+{
+	for (const char *p = strchr(filename, ','); p; p = strchr(p + 1, ','))
+	{
+		int n = p - filename;
+		if (n > 4 && !strncasecmp(p - 4, ".png", 4))
+			return (char *)p;
+	}
+	return NULL;
+}
+
+#ifdef I_CAN_HAS_ZLIB
+static int png_paeth(int a, int b, int c)
+{
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// filter the row r (with the previous row q, or NULL) into y[0..n-1],
+// bpp is the number of bytes of a pixel
+static void png_filter_row(uint8_t *y, uint8_t *r, uint8_t *q,
+		int n, int bpp, int type)
+{
+	for (int i = 0; i < n; i++)
+	{
+		int a = i >= bpp ? r[i-bpp] : 0;
+		int b = q ? q[i] : 0;
+		int c = q && i >= bpp ? q[i-bpp] : 0;
+		int p = 0;
+		switch (type) {
+		case PNG_FILTER_VALUE_SUB:   p = a; break;
+		case PNG_FILTER_VALUE_UP:    p = b; break;
+		case PNG_FILTER_VALUE_AVG:   p = (a + b) / 2; break;
+		case PNG_FILTER_VALUE_PAETH: p = png_paeth(a, b, c); break;
+		}
+		y[i] = r[i] - p;
+	}
+}
+
+// filtered row: the filter type byte and the n filtered bytes, choosing the
+// type by the heuristic of libpng (least sum of absolute differences) when
+// the filter is adaptive
+static void png_filter_line(uint8_t *y, uint8_t *r, uint8_t *q,
+		int n, int bpp, int filter, uint8_t *tmp)
+{
+	if (filter >= 0) {
+		y[0] = filter;
+		png_filter_row(y + 1, r, q, n, bpp, filter);
+		return;
+	}
+	long best = -1;
+	for (int t = PNG_FILTER_VALUE_NONE; t <= PNG_FILTER_VALUE_PAETH; t++)
+	{
+		png_filter_row(tmp, r, q, n, bpp, t);
+		long m = 0;
+		for (int i = 0; i < n; i++)
+			m += abs((int8_t)tmp[i]);
+		if (best < 0 || m < best) {
+			best = m;
+			y[0] = t;
+			memcpy(y + 1, tmp, n);
+		}
+	}
+}
+
+static void png_write_chunk_crc(FILE *f, const char *type,
+		const void *data, size_t n)
+{
+	uint8_t h[8] = {n >> 24, n >> 16, n >> 8, n, type[0], type[1],
+		type[2], type[3]};
+	uLong c = crc32(crc32(0, NULL, 0), h + 4, 4);
+	if (n) c = crc32(c, data, n);
+	uint8_t t[4] = {c >> 24, c >> 16, c >> 8, c};
+	fwrite(h, 1, 8, f);
+	if (n) fwrite(data, 1, n, f);
+	fwrite(t, 1, 4, f);
+}
+
+// write a png file whose IDAT stream is compressed by bands in parallel
+static void png_write_parallel(FILE *f, struct iio_image *x, int bit_depth,
+		int color_type, struct png_write_options *o)
+{
+	int w = x->sizes[0], h = x->sizes[1], pd = x->pixel_dimension;
+	int ss = bit_depth / 8, bpp = pd * ss, n = w * bpp;
+	long N = n + 1L;
+
+	// filtered rows (the 16-bit samples are big-endian)
+	uint8_t *fy = xmalloc(h * N);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(o->threads)
+#endif
+	{
+		uint8_t *r = xmalloc(2 * n + n), *q = r + n, *tmp = q + n;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+		for (int j = 0; j < h; j++)
+		{
+			for (int k = 0; k <= (j > 0); k++)
+			{
+				uint8_t *d = k ? q : r, *s = (uint8_t *)x->data
+					+ (j - k) * (long)n;
+				for (int i = 0; i < n; i++)
+					d[i] = ss == 2 ? s[i ^ 1] : s[i];
+			}
+			png_filter_line(fy + j * N, r, j ? q : NULL, n, bpp,
+					o->filter, tmp);
+		}
+		free(r);
+	}
+
+	// bands of about 128K, raw deflate streams that end on a byte
+	long band = 1 + (1 << 17) / N;
+	int nb = (h + band - 1) / band;
+	uint8_t **z = xmalloc(nb * sizeof*z);
+	uLong *zn = xmalloc(nb * sizeof*zn), *ad = xmalloc(nb * sizeof*ad);
+	int level = o->level < 0 ? Z_DEFAULT_COMPRESSION : o->level;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(o->threads) schedule(dynamic)
+#endif
+	for (int b = 0; b < nb; b++)
+	{
+		long a0 = b * band * N, a1 = (b + 1 == nb ? h : (b+1)*band) * N;
+		z_stream s[1] = {{0}};
+		if (Z_OK != deflateInit2(s, level, Z_DEFLATED, -15, 8,
+					Z_DEFAULT_STRATEGY))
+			fail("png: deflateInit2 failed");
+		if (b) { // prime with the end of the previous band
+			long d = a0 < 32768 ? a0 : 32768;
+			deflateSetDictionary(s, fy + a0 - d, d);
+		}
+		uLong cap = deflateBound(s, a1 - a0) + 64;
+		z[b] = xmalloc(cap);
+		s->next_in = fy + a0;
+		s->avail_in = a1 - a0;
+		s->next_out = z[b];
+		s->avail_out = cap;
+		int r = deflate(s, b + 1 == nb ? Z_FINISH : Z_SYNC_FLUSH);
+		if (r != (b + 1 == nb ? Z_STREAM_END : Z_OK) || s->avail_in)
+			fail("png: deflate failed (%d)", r);
+		zn[b] = cap - s->avail_out;
+		deflateEnd(s);
+		ad[b] = adler32(adler32(0, NULL, 0), fy + a0, a1 - a0);
+	}
+
+	// the zlib stream: header, the bands, and the combined checksum
+	uLong c = ad[0];
+	for (int b = 1; b < nb; b++)
+	{
+		long a1 = (b + 1 == nb ? h : (b+1)*band) * N;
+		c = adler32_combine(c, ad[b], a1 - b * band * N);
+	}
+	int l = level < 0 ? 6 : level;
+	uint8_t zh[2] = {0x78, l < 2 ? 0x01 : l < 6 ? 0x5e : l == 6 ? 0x9c : 0xda};
+	uint8_t zt[4] = {c >> 24, c >> 16, c >> 8, c};
+
+	uint8_t ihdr[13] = {w >> 24, w >> 16, w >> 8, w, h >> 24, h >> 16,
+		h >> 8, h, bit_depth, color_type, 0, 0, 0};
+	fwrite("\x89PNG\r\n\x1a\n", 1, 8, f);
+	png_write_chunk_crc(f, "IHDR", ihdr, 13);
+	if (x->rem) {
+		size_t m = strlen(x->rem);
+		char *t = xmalloc(m + 8);
+		memcpy(t, "Comment", 8);
+		memcpy(t + 8, x->rem, m);
+		png_write_chunk_crc(f, "tEXt", t, m + 8);
+		free(t);
+	}
+	png_write_chunk_crc(f, "IDAT", zh, 2);
+	for (int b = 0; b < nb; b++)
+		png_write_chunk_crc(f, "IDAT", z[b], zn[b]);
+	png_write_chunk_crc(f, "IDAT", zt, 4);
+	png_write_chunk_crc(f, "IEND", NULL, 0);
+
+	for (int b = 0; b < nb; b++)
+		free(z[b]);
+	free(ad);
+	free(zn);
+	free(z);
+	free(fy);
+}
+#endif//I_CAN_HAS_ZLIB
+
 static void iio_write_image_as_png(const char *filename, struct iio_image *x)
 {
 	IIO_DEBUG("png writer filename = \"%s\"\n", filename);
@@ -3937,6 +5889,20 @@ static void iio_write_image_as_png(const char *filename, struct iio_image *x)
 			x->sizes[0],x->sizes[1],x->pixel_dimension);
 	IIO_DEBUG("png writer rem = \"%s\"\n", x->rem);
 
+	// gather the options from the environment and from the filename
+	struct png_write_options o[1] = {{
+		.level = -1, .filter = -1, .threads = 0 }};
+	char *env = xgetenv("IIO_PNG_OPTIONS");
+	if (env) png_parse_write_options(o, env);
+	char *suffix = png_options_suffix(filename);
+	char fname[strlen(filename) + 1];
+	strcpy(fname, filename);
+	if (suffix) {
+		png_parse_write_options(o, suffix + 1);
+		fname[suffix - filename] = '\0';
+	}
+	filename = fname;
+
 	png_structp pp = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0,0,0);
 	if (!pp) fail("png_create_write_struct fail");
 	png_infop pi = png_create_info_struct(pp);
@@ -3977,7 +5943,19 @@ static void iio_write_image_as_png(const char *filename, struct iio_image *x)
 	}
 
 	FILE *f = xfopen(filename, "w");
+#ifdef I_CAN_HAS_ZLIB
+	if (o->threads > 1) {
+		png_destroy_write_struct(&pp, &pi);
+		png_write_parallel(f, x, bit_depth, color_type, o);
+		xfclose(f);
+		return;
+	}
+#endif
 	png_init_io(pp, f);
+	if (o->level >= 0)
+		png_set_compression_level(pp, o->level);
+	if (o->filter >= 0)
+		png_set_filter(pp, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE << o->filter);
 
 	int ss = bit_depth/8;
 	int pd = x->pixel_dimension;
@@ -4001,19 +5979,82 @@ static void iio_write_image_as_png(const char *filename, struct iio_image *x)
 
 #ifdef I_CAN_HAS_LIBTIFF
 
-static void iio_write_image_as_tiff(const char *filename, struct iio_image *x)
+// options for writing tiff files, given by the environment variable
+// IIO_TIFF_OPTIONS or by a filename suffix like "out.tif,tiled=512,zstd"
+struct tiff_write_options {
+	int tile;        // side of the tiles, or 0 for strips
+	int compression; // COMPRESSION_*, or -1 for the default
+	int predictor;   // PREDICTOR_*, or 0 for none
+	int level;       // compression level, or 0 for the codec default
+	int threads;     // number of threads that compress the tiles
+};
+
+static void tiff_parse_write_options(struct tiff_write_options *o,
+		const char *options)
 {
-	if (x->dimension != 2)
-		fail("only 2d images can be saved as TIFFs");
-	TIFF *tif = TIFFOpen(filename, "w8");
-	if (!tif) fail("could not open TIFF file \"%s\"", filename);
+	char buf[strlen(options) + 1];
+	strcpy(buf, options);
+	for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+	{
+		char *eq = strchr(tok, '=');
+		int v = eq ? atoi(eq + 1) : 0;
+		if (eq) *eq = '\0';
+		if (!strcmp(tok, "tiled") || !strcmp(tok, "tile"))
+			o->tile = eq ? v : 256;
+		else if (!strcmp(tok, "none") || !strcmp(tok, "plain"))
+			o->compression = COMPRESSION_NONE;
+		else if (!strcmp(tok, "lzw"))
+			o->compression = COMPRESSION_LZW;
+		else if (!strcmp(tok, "deflate") || !strcmp(tok, "zip"))
+			o->compression = COMPRESSION_ADOBE_DEFLATE;
+		else if (!strcmp(tok, "packbits"))
+			o->compression = COMPRESSION_PACKBITS;
+#ifdef COMPRESSION_ZSTD
+		else if (!strcmp(tok, "zstd"))
+			o->compression = COMPRESSION_ZSTD;
+#endif
+#ifdef COMPRESSION_LERC
+		else if (!strcmp(tok, "lerc"))
+			o->compression = COMPRESSION_LERC;
+#endif
+#ifdef COMPRESSION_LZMA
+		else if (!strcmp(tok, "lzma"))
+			o->compression = COMPRESSION_LZMA;
+#endif
+		else if (!strcmp(tok, "predictor"))
+			o->predictor = eq ? v : PREDICTOR_HORIZONTAL;
+		else if (!strcmp(tok, "level"))
+			o->level = v;
+		else if (!strcmp(tok, "threads"))
+			o->threads = v;
+		else fail("unrecognized tiff option \"%s\"", tok);
+	}
+	if (o->tile % 16) // required by the tiff specification
+		o->tile += 16 - o->tile % 16;
+}
+
+// position of the options in a filename like "out.tif,tiled=512,zstd"
+static char *tiff_options_suffix(const char *filename)
+{
+	for (const char *p = strchr(filename, ','); p; p = strchr(p + 1, ','))
+	{
+		int n = p - filename;
+		if ((n > 4 && !strncasecmp(p - 4, ".tif", 4))
+				|| (n > 5 && !strncasecmp(p - 5, ".tiff", 5)))
+			return (char *)p;
+	}
+	return NULL;
+}
 
+// set the tags of a tiff file of size w x h for the samples of image x
+static void tiff_set_fields(TIFF *tif, struct iio_image *x, int w, int h,
+		struct tiff_write_options *o)
+{
 	int ss = iio_image_sample_size(x);
-	int sls = x->sizes[0]*x->pixel_dimension*ss;
 	int tsf;
 
-	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, x->sizes[0]);
-	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, x->sizes[1]);
+	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, w);
+	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, h);
 	TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 	TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, x->pixel_dimension);
 	TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, ss * 8);
@@ -4036,11 +6077,25 @@ static void iio_write_image_as_tiff(const char *filename, struct iio_image *x)
 		TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
 	}
 
-	// disable TIFF compression when saving large images
-	if (x->sizes[0] * x->sizes[1] < 2000*2000 && !xgetenv("IIOTIFF_PLAIN"))
-		TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
-	else
-		TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+	// by default, disable TIFF compression when saving large images
+	int compression = o->compression;
+	if (compression < 0)
+		compression = x->sizes[0] * x->sizes[1] < 2000*2000
+			&& !xgetenv("IIOTIFF_PLAIN") ?
+			COMPRESSION_LZW : COMPRESSION_NONE;
+	TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+	if (o->predictor > 0)
+		TIFFSetField(tif, TIFFTAG_PREDICTOR, o->predictor);
+	if (o->level > 0 && compression == COMPRESSION_ADOBE_DEFLATE)
+		TIFFSetField(tif, TIFFTAG_ZIPQUALITY, o->level);
+#ifdef COMPRESSION_ZSTD
+	if (o->level > 0 && compression == COMPRESSION_ZSTD)
+		TIFFSetField(tif, TIFFTAG_ZSTD_LEVEL, o->level);
+#endif
+#ifdef COMPRESSION_LZMA
+	if (o->level > 0 && compression == COMPRESSION_LZMA)
+		TIFFSetField(tif, TIFFTAG_LZMAPRESET, o->level);
+#endif
 
 	switch(x->type) {
 	case IIO_TYPE_DOUBLE:
@@ -4057,38 +6112,154 @@ static void iio_write_image_as_tiff(const char *filename, struct iio_image *x)
 	}
 	TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, tsf);
 
-	// define TIFFTAG_ROWSPERSTRIP to satisfy some readers (e.g. gdal)
-	uint32_t rows_per_strip = x->sizes[1];
-	rows_per_strip = TIFFDefaultStripSize(tif, rows_per_strip);
-	TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
-
-	FORI(x->sizes[1]) {
-		void *line = i*sls + (char *)x->data;
-		int r = TIFFWriteScanline(tif, line, i, 0);
-		if (r < 0) fail("error writing %dth TIFF scanline", i);
+	if (o->tile) {
+		TIFFSetField(tif, TIFFTAG_TILEWIDTH, o->tile);
+		TIFFSetField(tif, TIFFTAG_TILELENGTH, o->tile);
+	} else {
+		// define TIFFTAG_ROWSPERSTRIP to satisfy some readers (e.g. gdal)
+		uint32_t rows_per_strip = TIFFDefaultStripSize(tif, h);
+		TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
 	}
+}
 
-	if (x->rem) // optional comment
-		TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, x->rem);
-
-	TIFFClose(tif);
+// copy the tile at (tx,ty) of image x, padded with zeros, into buf
+static void tiff_extract_tile(uint8_t *buf, struct iio_image *x,
+		int tx, int ty, int t)
+{
+	int w = x->sizes[0];
+	int h = x->sizes[1];
+	int ps = x->pixel_dimension * iio_image_sample_size(x);
+	int n = tx + t > w ? w - tx : t;
+	memset(buf, 0, t * t * ps);
+	for (int j = 0; j < t && ty + j < h; j++)
+		memcpy(buf + j*t*ps, (char*)x->data + ((ty+j)*w + tx)*ps, n*ps);
+}
+
+// compress one tile by writing it into a temporary in-memory tiff
+// and return its encoded bytes
+static void *tiff_encode_tile(tmsize_t *n, uint8_t *buf, struct iio_image *x,
+		struct tiff_write_options *o)
+{
+	struct tiff_memfile m[1] = {{0}};
+	TIFF *t = tiff_memfile_open(m, "w");
+	if (!t) fail("could not create in-memory TIFF");
+	tiff_set_fields(t, x, o->tile, o->tile, o);
+	if (-1 == TIFFWriteEncodedTile(t, 0, buf, TIFFTileSize(t)))
+		fail("error encoding TIFF tile");
+	toff_t offset = TIFFGetStrileOffset(t, 0);
+	*n = TIFFGetStrileByteCount(t, 0);
+	void *r = xmalloc(*n);
+	memcpy(r, m->data + offset, *n);
+	TIFFClose(t);
+	xfree(m->data);
+	return r;
 }
 
-static void iio_write_image_as_tiff_smarter(const char *filename,
-		struct iio_image *x)
+// write the tiles of image x, compressing batches of them in parallel
+// (the tiles are numbered from kbase, for images written by bands of tiles)
+static void tiff_write_tiles(TIFF *tif, struct iio_image *x,
+		struct tiff_write_options *o, int kbase)
 {
-	char *tiffname = strstr(filename, "TIFF:");
-	if (tiffname == filename) {
-		iio_write_image_as_tiff_smarter(filename+5, x);
+	int t = o->tile;
+	int ntx = (x->sizes[0] + t - 1) / t;
+	int nty = (x->sizes[1] + t - 1) / t;
+	int ntiles = ntx * nty;
+	tmsize_t tsize = TIFFTileSize(tif);
+	int nthreads = o->threads > ntiles ? ntiles : o->threads;
+	IIO_DEBUG("writing %dx%d tiles with %d threads\n", ntx, nty, nthreads);
+
+	if (nthreads <= 1) {
+		uint8_t *buf = xmalloc(tsize);
+		for (int k = 0; k < ntiles; k++)
+		{
+			tiff_extract_tile(buf, x, (k % ntx) * t, (k / ntx) * t, t);
+			if (-1 == TIFFWriteEncodedTile(tif, kbase+k, buf, tsize))
+				fail("error writing %dth TIFF tile", kbase+k);
+		}
+		xfree(buf);
 		return;
 	}
-	if (0 == strcmp(filename, "-")) {
-		char tfn[FILENAME_MAX];
-		fill_temporary_filename(tfn);
-		iio_write_image_as_tiff(tfn, x);
-		FILE *f = xfopen(tfn, "r");
-		int c;
-		while ((c = fgetc(f)) != EOF)
+
+	int batch = 4 * nthreads;
+	void *chunk[batch];
+	tmsize_t nchunk[batch];
+	for (int k0 = 0; k0 < ntiles; k0 += batch)
+	{
+		int nk = ntiles - k0 < batch ? ntiles - k0 : batch;
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+		for (int i = 0; i < nk; i++)
+		{
+			int k = k0 + i;
+			uint8_t *buf = xmalloc(tsize);
+			tiff_extract_tile(buf, x, (k % ntx) * t, (k / ntx) * t, t);
+			chunk[i] = tiff_encode_tile(nchunk + i, buf, x, o);
+			xfree(buf);
+		}
+		for (int i = 0; i < nk; i++)
+		{
+			int k = kbase + k0 + i;
+			if (-1 == TIFFWriteRawTile(tif, k, chunk[i], nchunk[i]))
+				fail("error writing %dth TIFF tile", k);
+			xfree(chunk[i]);
+		}
+	}
+}
+
+static void iio_write_image_as_tiff(const char *filename, struct iio_image *x)
+{
+	if (x->dimension != 2)
+		fail("only 2d images can be saved as TIFFs");
+
+	// gather the options from the environment and from the filename
+	struct tiff_write_options o[1] = {{
+		.tile = 0, .compression = -1, .predictor = 0, .level = 0,
+		.threads = iio_threads() }};
+	char *env = xgetenv("IIO_TIFF_OPTIONS");
+	if (env) tiff_parse_write_options(o, env);
+	char *suffix = tiff_options_suffix(filename);
+	char fname[strlen(filename) + 1];
+	strcpy(fname, filename);
+	if (suffix) {
+		tiff_parse_write_options(o, suffix + 1);
+		fname[suffix - filename] = '\0';
+	}
+
+	TIFF *tif = TIFFOpen(fname, "w8");
+	if (!tif) fail("could not open TIFF file \"%s\"", fname);
+	tiff_set_fields(tif, x, x->sizes[0], x->sizes[1], o);
+
+	if (o->tile)
+		tiff_write_tiles(tif, x, o, 0);
+	else {
+		int sls = x->sizes[0]*x->pixel_dimension*iio_image_sample_size(x);
+		FORI(x->sizes[1]) {
+			void *line = i*sls + (char *)x->data;
+			int r = TIFFWriteScanline(tif, line, i, 0);
+			if (r < 0) fail("error writing %dth TIFF scanline", i);
+		}
+	}
+
+	if (x->rem) // optional comment
+		TIFFSetField(tif, TIFFTAG_IMAGEDESCRIPTION, x->rem);
+
+	TIFFClose(tif);
+}
+
+static void iio_write_image_as_tiff_smarter(const char *filename,
+		struct iio_image *x)
+{
+	char *tiffname = strstr(filename, "TIFF:");
+	if (tiffname == filename) {
+		iio_write_image_as_tiff_smarter(filename+5, x);
+		return;
+	}
+	if (0 == strcmp(filename, "-")) {
+		char tfn[FILENAME_MAX];
+		fill_temporary_filename(tfn);
+		iio_write_image_as_tiff(tfn, x);
+		FILE *f = xfopen(tfn, "r");
+		int c;
+		while ((c = fgetc(f)) != EOF)
 			fputc(c, stdout);
 		fclose(f);
 		delete_temporary_file(tfn);
@@ -4177,6 +6348,73 @@ static void iio_write_image_as_ppm(const char *filename, struct iio_image *x)
 	xfclose(f);
 }
 
+// text writer                                                              {{{2
+
+// print the integer "v" into "s", return the number of characters
+static int text_itoa(char *s, long v)
+{
+	char t[24];
+	int n = 0, k = 0;
+	unsigned long u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+	do t[n++] = '0' + u % 10; while (u /= 10);
+	if (v < 0) s[k++] = '-';
+	while (n) s[k++] = t[--n];
+	return k;
+}
+
+// print "v" as "%.9g" does (integers are printed directly)
+static int text_gtoa(char *s, double v)
+{
+	if (v > -1e9 && v < 1e9 && v == (long)v && (v || 1/v > 0))
+		return text_itoa(s, v);
+	return sprintf(s, "%.9g", v);
+}
+
+// Write "n" samples of type "typ" as text, "w" numbers per line separated by
+// the character "sep".  The numbers are formatted in parallel into blocks of
+// memory, which are then written in order by a single "fwrite" each.
+static void write_text_numbers(FILE *f, void *t, int typ, long n, int w,
+		char sep)
+{
+	enum { BLOCK = 0x1000, ROUND = 0x40, WIDTH = 32 };
+	char *buf = xmalloc((size_t)ROUND * BLOCK * WIDTH);
+	long len[ROUND];
+	for (long r = 0; r < n; r += (long)ROUND * BLOCK)
+	{
+		int nb = (n - r + BLOCK - 1) / BLOCK;
+		if (nb > ROUND) nb = ROUND;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads())
+#endif
+		for (int b = 0; b < nb; b++)
+		{
+			char *o = buf + (size_t)b * BLOCK * WIDTH;
+			long k = 0;
+			for (long i = r + b*BLOCK; i < r + (b+1)*BLOCK && i < n; i++)
+			{
+				char *q = o + k;
+				switch (typ) {
+				case IIO_TYPE_FLOAT:
+					k += text_gtoa(q, ((float*)t)[i]);
+					break;
+				case IIO_TYPE_DOUBLE:
+					k += text_gtoa(q, ((double*)t)[i]);
+					break;
+				case IIO_TYPE_UINT8:
+					k += text_itoa(q, ((uint8_t*)t)[i]);
+					break;
+				default: fail("bad text type %d", typ);
+				}
+				o[k++] = (i+1) % w ? sep : '\n';
+			}
+			len[b] = k;
+		}
+		for (int b = 0; b < nb; b++)
+			fwrite(buf + (size_t)b * BLOCK * WIDTH, 1, len[b], f);
+	}
+	xfree(buf);
+}
+
 // ASC writer                                                               {{{2
 static void iio_write_image_as_asc(const char *filename, struct iio_image *x)
 {
@@ -4191,8 +6429,7 @@ static void iio_write_image_as_asc(const char *filename, struct iio_image *x)
 		fprintf(f, "%d %d 1 %d\n", w, h, pd);
 		float *t = xmalloc(w*h*pd*sizeof*t);
 		break_pixels_float(t, x->data, w*h, pd);
-		for (int i = 0; i < w*h*pd; i++)
-			fprintf(f, "%.9g\n", t[i]);
+		write_text_numbers(f, t, IIO_TYPE_FLOAT, w*h*pd, 1, '\n');
 		xfree(t);
 		xfclose(f);
 	} else if (x->type == IIO_TYPE_DOUBLE) {
@@ -4205,8 +6442,7 @@ static void iio_write_image_as_asc(const char *filename, struct iio_image *x)
 		fprintf(f, "%d %d 1 %d\n", w, h, pd);
 		double *t = xmalloc(w*h*pd*sizeof*t);
 		break_pixels_double(t, x->data, w*h, pd);
-		for (int i = 0; i < w*h*pd; i++)
-			fprintf(f, "%.9g\n", t[i]);
+		write_text_numbers(f, t, IIO_TYPE_DOUBLE, w*h*pd, 1, '\n');
 		xfree(t);
 		xfclose(f);
 	}
@@ -4219,21 +6455,9 @@ static void iio_write_image_as_csv(const char *filename, struct iio_image *x)
 	int w = x->sizes[0];
 	int h = x->sizes[1];
 	assert(x->pixel_dimension == 1);
-	if (x->type == IIO_TYPE_FLOAT) {
-		float *t = x->data;
-		for (int i = 0; i < w*h; i++)
-			fprintf(f, "%.9g%c", t[i], (i+1)%w?',':'\n');
-	}
-	if (x->type == IIO_TYPE_DOUBLE) {
-		double *t = x->data;
-		for (int i = 0; i < w*h; i++)
-			fprintf(f, "%.9g%c", t[i], (i+1)%w?',':'\n');
-	}
-	if (x->type == IIO_TYPE_UINT8) {
-		uint8_t *t = x->data;
-		for (int i = 0; i < w*h; i++)
-			fprintf(f, "%d%c", t[i], (i+1)%w?',':'\n');
-	}
+	if (x->type == IIO_TYPE_FLOAT || x->type == IIO_TYPE_DOUBLE
+			|| x->type == IIO_TYPE_UINT8)
+		write_text_numbers(f, x->data, x->type, w*h, w, ',');
 	xfclose(f);
 }
 
@@ -4249,21 +6473,9 @@ static void iio_write_image_as_txt(const char *filename, struct iio_image *x)
 		else if (h == 1) w = x->pixel_dimension;
 		else assert(false);
 	}
-	if (x->type == IIO_TYPE_FLOAT) {
-		float *t = x->data;
-		for (int i = 0; i < w*h; i++)
-			fprintf(f, "%.9g%c", t[i], (i+1)%w?' ':'\n');
-	}
-	if (x->type == IIO_TYPE_DOUBLE) {
-		double *t = x->data;
-		for (int i = 0; i < w*h; i++)
-			fprintf(f, "%.9g%c", t[i], (i+1)%w?' ':'\n');
-	}
-	if (x->type == IIO_TYPE_UINT8) {
-		uint8_t *t = x->data;
-		for (int i = 0; i < w*h; i++)
-			fprintf(f, "%d%c", t[i], (i+1)%w?' ':'\n');
-	}
+	if (x->type == IIO_TYPE_FLOAT || x->type == IIO_TYPE_DOUBLE
+			|| x->type == IIO_TYPE_UINT8)
+		write_text_numbers(f, x->data, x->type, w*h, w, ' ');
 	xfclose(f);
 }
 
@@ -4298,7 +6510,8 @@ static void iio_write_image_as_raw(const char *filename, struct iio_image *x)
 }
 
 // NPY writer                                                               {{{2
-static void iio_write_image_as_npy(const char *filename, struct iio_image *x)
+// fill-in the npy header of image "x" and return its size
+static int npy_write_header(char buf[1000], struct iio_image *x)
 {
 	char *descr = 0; // string to identify the number type (by numpy)
 	switch (normalize_type(x->type)) {
@@ -4315,7 +6528,8 @@ static void iio_write_image_as_npy(const char *filename, struct iio_image *x)
 		case IIO_TYPE_DOUBLE : descr = "<f8"; break;
 		default: fail("unrecognized internal type %d\n", x->type);
 	}
-	char buf[1000] = {-109, 'N', 'U', 'M', 'P', 'Y', 1, 0, 0}; // magic
+	char magic[] = {-109, 'N', 'U', 'M', 'P', 'Y', 1, 0, 0, 0};
+	memcpy(buf, magic, 10);
 	int n = 10;               // size of magic before header string
 	n += snprintf(buf+n, 1000-n, "{'descr': '%s', 'fortran_order': "
 			"False, 'shape': (", descr);
@@ -4328,6 +6542,13 @@ static void iio_write_image_as_npy(const char *filename, struct iio_image *x)
 	for (int i = n; i < m-1; i++)
 		buf[i] = ' ';     // pad with spaces
 	buf[m-1] = '\n';          // must end in EOL.  Note: not 0-finished!
+	return m;
+}
+
+static void iio_write_image_as_npy(const char *filename, struct iio_image *x)
+{
+	char buf[1000];
+	int m = npy_write_header(buf, x);
 
 	FILE *f = xfopen(filename, "w");
 	fwrite(buf, 1, m, f);                               // write the header
@@ -4336,6 +6557,246 @@ static void iio_write_image_as_npy(const char *filename, struct iio_image *x)
 	xfclose(f);
 }
 
+// ZNPY writer                                                              {{{2
+
+// Chunk-compressed npy files.  The samples of the image are split into
+// chunks of whole rows, which are compressed independently.  Thus they can
+// be decoded in parallel, or only some of them when a band of rows is read.
+// The layout of the file is:
+//
+// 	0	"\x93ZNPY", version (1), codec, flags	8 bytes
+// 	8	uncompressed size of each chunk		uint32
+// 	12	number of chunks			uint32
+// 	16	header of the equivalent npy file
+// 	...	offsets of the chunks, and of the end	uint64 x (nchunks+1)
+// 	...	compressed chunks
+//
+// The numbers are little-endian and the offsets count from the start of the
+// file.  With the flag "shuffle", the bytes of the samples of each chunk are
+// stored in separate planes, which makes floating-point data much more
+// compressible.
+//
+// These files are written when a name like "out.npy,zstd,shuffle" is
+// given, or when IIO_NPY_OPTIONS is set for a ".npy" or ".raw" file.
+struct znpy_write_options {
+	int codec;   // ZNPY_CODEC_*, 0 for none, or -1 for the default
+	int level;   // compression level, or 0 for the codec default
+	int rows;    // rows per chunk, or 0 for chunks of about 1MiB
+	bool shuffle;
+	int threads; // number of threads that compress the chunks
+};
+
+static void znpy_parse_write_options(struct znpy_write_options *o,
+		const char *options)
+{
+	char buf[strlen(options) + 1];
+	strcpy(buf, options);
+	for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ","))
+	{
+		char *eq = strchr(tok, '=');
+		int v = eq ? atoi(eq + 1) : 0;
+		if (eq) *eq = '\0';
+		if (!strcmp(tok, "none") || !strcmp(tok, "plain"))
+			o->codec = 0;
+		else if (!strcmp(tok, "deflate") || !strcmp(tok, "zip")
+				|| !strcmp(tok, "zlib"))
+			o->codec = ZNPY_CODEC_DEFLATE;
+		else if (!strcmp(tok, "zstd"))
+			o->codec = ZNPY_CODEC_ZSTD;
+		else if (!strcmp(tok, "shuffle"))
+			o->shuffle = true;
+		else if (!strcmp(tok, "rows"))
+			o->rows = v;
+		else if (!strcmp(tok, "level"))
+			o->level = v;
+		else if (!strcmp(tok, "threads"))
+			o->threads = v;
+		else fail("unrecognized npy option \"%s\"", tok);
+	}
+}
+
+// position of the options in a filename like "out.npy,zstd,rows=64"
+static char *npy_options_suffix(const char *filename)
+{
+	for (const char *p = strchr(filename, ','); p; p = strchr(p + 1, ','))
+	{
+		int n = p - filename;
+		if (n > 4 && (!strncasecmp(p - 4, ".npy", 4)
+					|| !strncasecmp(p - 4, ".raw", 4)))
+			return (char *)p;
+	}
+	return NULL;
+}
+
+static void znpy_put(uint8_t *b, uint64_t v, int n)
+{
+	for (int i = 0; i < n; i++, v /= 0x100)
+		b[i] = v % 0x100;
+}
+
+// compress "n" bytes, return a malloc'd buffer and its size in "*out_n"
+static void *znpy_encode_chunk(size_t *out_n, void *in, size_t n,
+		struct znpy_write_options *o, int ss)
+{
+	(void)out_n;
+	void *t = in;
+	if (o->shuffle) {
+		t = xmalloc(n);
+		deinterleave_samples(t, in, n / ss, ss, 1);
+	}
+	void *r = NULL;
+	switch (o->codec) {
+#ifdef I_CAN_HAS_ZLIB
+	case ZNPY_CODEC_DEFLATE: {
+		uLongf m = compressBound(n);
+		r = xmalloc(m);
+		int lev = o->level > 0 ? o->level : Z_DEFAULT_COMPRESSION;
+		if (Z_OK != compress2(r, &m, t, n, lev))
+			fail("deflate error on a chunk of %zu bytes", n);
+		*out_n = m;
+		break;
+	}
+#endif//I_CAN_HAS_ZLIB
+#ifdef I_CAN_HAS_LIBZSTD
+	case ZNPY_CODEC_ZSTD: {
+		size_t m = ZSTD_compressBound(n);
+		r = xmalloc(m);
+		m = ZSTD_compress(r, m, t, n, o->level > 0 ? o->level : 3);
+		if (ZSTD_isError(m))
+			fail("zstd error \"%s\"", ZSTD_getErrorName(m));
+		*out_n = m;
+		break;
+	}
+#endif//I_CAN_HAS_LIBZSTD
+	default: fail("npy compression %d not available", o->codec);
+	}
+	if (t != in) xfree(t);
+	return r;
+}
+
+static void iio_write_image_as_znpy(const char *filename, struct iio_image *x,
+		struct znpy_write_options *o)
+{
+	int h = x->sizes[1], ss = iio_image_sample_size(x);
+	size_t n = iio_image_data_size(x), rowbytes = n / h;
+	int rows = o->rows > 0 ? o->rows : 1 + (int)((0x100000-1) / rowbytes);
+	if (rows > h) rows = h;
+	size_t chunk = rows * rowbytes;
+	if (chunk > UINT32_MAX) fail("npy chunks of %zu bytes too big", chunk);
+	int nc = (h + rows - 1) / rows;
+
+	// compress the chunks in parallel
+	void **cbuf = xmalloc(nc * sizeof*cbuf);
+	size_t *clen = xmalloc(nc * sizeof*clen);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(o->threads > 0 ? o->threads : 1)
+#endif
+	for (int c = 0; c < nc; c++)
+	{
+		size_t a = c * chunk, m = a + chunk < n ? chunk : n - a;
+		cbuf[c] = znpy_encode_chunk(clen + c, (char*)x->data + a, m,
+				o, ss);
+	}
+
+	// headers and index
+	char npyh[1000];
+	int m = npy_write_header(npyh, x);
+	uint8_t head[16] = {0x93, 'Z', 'N', 'P', 'Y', 1, o->codec,
+		o->shuffle ? ZNPY_FLAG_SHUFFLE : 0};
+	znpy_put(head + 8, chunk, 4);
+	znpy_put(head + 12, nc, 4);
+	uint8_t *index = xmalloc(8 * (nc + 1));
+	uint64_t pos = 16 + m + 8 * (nc + 1);
+	for (int c = 0; c <= nc; c++) {
+		znpy_put(index + 8*c, pos, 8);
+		if (c < nc) pos += clen[c];
+	}
+	IIO_DEBUG("znpy: %d chunks of %d rows, %zu => %zu bytes\n",
+			nc, rows, n, (size_t)pos);
+
+	FILE *f = xfopen(filename, "w");
+	fwrite(head, 1, 16, f);
+	fwrite(npyh, 1, m, f);
+	fwrite(index, 8, nc + 1, f);
+	for (int c = 0; c < nc; c++) {
+		fwrite(cbuf[c], 1, clen[c], f);
+		xfree(cbuf[c]);
+	}
+	xfclose(f);
+	xfree(index);
+	xfree(clen);
+	xfree(cbuf);
+}
+
+static bool string_suffix(const char *s, const char *suf);
+static void iio_write_image_as_npy_smarter(const char *filename,
+		struct iio_image *x)
+{
+	// gather the options from the environment and from the filename
+	struct znpy_write_options o[1] = {{ .codec = -1, .level = 0,
+		.rows = 0, .shuffle = false, .threads = iio_threads() }};
+	char *env = xgetenv("IIO_NPY_OPTIONS");
+	if (env) znpy_parse_write_options(o, env);
+	char *suffix = npy_options_suffix(filename);
+	char fname[strlen(filename) + 1];
+	strcpy(fname, filename);
+	if (suffix) {
+		znpy_parse_write_options(o, suffix + 1);
+		fname[suffix - filename] = '\0';
+	}
+	if (o->codec < 0) {
+#ifdef I_CAN_HAS_ZLIB
+		o->codec = ZNPY_CODEC_DEFLATE;
+#elif defined(I_CAN_HAS_LIBZSTD)
+		o->codec = ZNPY_CODEC_ZSTD;
+#else
+		o->codec = 0;
+#endif
+	}
+	if (!o->codec && string_suffix(fname, ".raw"))
+		iio_write_image_as_raw(fname, x);
+	else if (!o->codec)
+		iio_write_image_as_npy(fname, x);
+	else
+		iio_write_image_as_znpy(fname, x, o);
+}
+
+// SHM writer                                                               {{{2
+
+// Shared-memory handoff for pipelines of imscript tools.  The image is stored
+// as a npy file inside a POSIX shared memory object, and only the line
+// "%SHM name size" is written into the pipe.  The reader unlinks the object.
+// This is enabled by IIO_SHM=1, and only when the standard output is a pipe.
+#ifdef I_CAN_HAS_SHM
+static bool stdout_is_a_pipe(void)
+{
+	struct stat st[1];
+	return !fstat(1, st) && S_ISFIFO(st->st_mode);
+}
+
+static void iio_write_image_as_shm(struct iio_image *x)
+{
+	static int counter = 0;
+	char name[100], header[1000];
+	snprintf(name, sizeof name, "/iio-%d-%d", (int)getpid(), counter++);
+	int m = npy_write_header(header, x);
+	size_t n = iio_image_data_size(x);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) fail("could not create shared memory object \"%s\"", name);
+	if (ftruncate(fd, m + n))
+		fail("could not resize shared memory object \"%s\"", name);
+	char *p = mmap(NULL, m + n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) fail("could not map shared memory \"%s\"", name);
+	memcpy(p, header, m);
+	memcpy(p + m, x->data, n);
+	munmap(p, m + n);
+	IIO_DEBUG("wrote %zu bytes into shared memory \"%s\"\n", m + n, name);
+	printf("%%SHM %s %zu\n", name, m + n);
+	fflush(stdout);
+}
+#endif//I_CAN_HAS_SHM
+
 // RIM writer                                                               {{{2
 
 static void rim_putshort(FILE *f, uint16_t n)
@@ -4443,100 +6904,118 @@ static int sidx(uint8_t *rgb) // sixel index identifier
 	//return 32*(rgb[0]/32) + 4*(rgb[1]/32) + rgb[2]/64;
 }
 
-static void dump_sixels_to_bytestream_rgb3(
+// one row of sixels b[0..w-1] (values 0..63), run-length encoded
+static void bs_sixel_row(struct bytestream *out, uint8_t *b, int w)
+{
+	while (w > 0 && !b[w-1]) w -= 1; // the empty sixels at the end
+	for (int i = 0; i < w;)
+	{
+		int r = 1;
+		while (i + r < w && b[i+r] == b[i])
+			r += 1;
+		if (r < 3)
+			for (int l = 0; l < r; l++)
+				bs_putchar(out, 63 + b[i]);
+		else
+			bs_printf(out, "!%d%c", r, 63 + b[i]);
+		i += r;
+	}
+}
+
+// image of palette indices q (values < nc) as sixels
+//
+// The bitmasks of all the colors of a band are filled in a single pass over
+// its pixels, and only the colors that appear are defined and sent.  If p is
+// not NULL, it is the previous frame (of the same size) and the bands that
+// did not change are skipped: the image has a transparent background, so
+// that the terminal keeps the old pixels there.
+static void dump_sixels_to_bytestream_idx(
 		struct bytestream *out,
-		uint8_t *x, int w, int h)
+		uint8_t *q, uint8_t *p, int w, int h,
+		char (*pal)[24], int nc)
 {
-	bs_puts(out, "\033Pq\n");
-	for (int i = 0; i < 0x100; i++)
-		bs_printf(out, "#%d;2;%d;%d;%d", i,
-				(int)(14.2857*(i/32)),
-				(int)(14.2857*((i/4)%8)),
-				(int)(33.3333*(i%4)));
-	for (int j = 0; j < h/6; j++)
+	int nb = (h + 5) / 6;
+	bool used[0x100] = {0}, *skip = xmalloc(nb * sizeof*skip);
+	for (int j = 0; j < nb; j++)
 	{
+		int nl = h - 6*j < 6 ? h - 6*j : 6;
+		uint8_t *a = q + 6*j*w;
+		skip[j] = p && !memcmp(a, p + 6*j*w, nl*w);
+		if (!skip[j])
+			for (int i = 0; i < nl*w; i++)
+				used[a[i]] = true;
+	}
+	bs_puts(out, p ? "\033P0;1q\n" : "\033Pq\n");
+	for (int k = 0; k < nc; k++)
+		if (used[k])
+			bs_puts(out, pal[k]);
+	uint8_t *b = xmalloc(nc * w);
+	memset(b, 0, nc * w);
+	for (int j = 0; j < nb; j++)
+	{
+		int nl = h - 6*j < 6 ? h - 6*j : 6;
+		uint8_t *a = q + 6*j*w;
+		if (skip[j])
+		{
+			bs_puts(out, "-\n");
+			continue;
+		}
 		int m[0x100] = {0}, c = 0;
-		for (int i = 0; i < 6*w; i++)
+		for (int l = 0; l < nl; l++)
+		for (int i = 0; i < w; i++)
 		{
-			int k = sidx(x+3*(6*j*w+i));
-			if (!m[k]) c += 1;
-			m[k] += 1;
+			int k = a[l*w+i];
+			c += !m[k];
+			m[k] = 1;
+			b[k*w+i] |= 1 << l;
 		}
-		for (int k = 0; k < 0x100; k++)
+		for (int k = 0; k < nc; k++)
 		if (m[k])
 		{
-			int b[w], r[w], R[w], n = 0;
-			c -= 1;
-			for (int i = 0; i < w; i++)
-			{
-				int s = 0;
-				for (int l = 5; l >= 0; l--)
-					s = 2*s + (k==sidx(x+3*((6*j+l)*w+i)));
-				b[i] = s + 63;
-			}
-			for (int i = 0; i < w; i++)
-				R[i] = 1;
-			r[0] = *b;
-			for (int i = 1; i < w; i++)
-				if (b[i] == r[n])
-					R[n] += 1;
-				else
-					r[++n] = b[i];
 			bs_printf(out, "#%d", k);
-			for (int i = 0; i <= n; i++)
-				if (R[n] < 3)
-					for (int l = 0; l < R[i]; l++)
-						bs_putchar(out, r[i]);
-				else
-					bs_printf(out, "!%d%c", R[i], r[i]);
-			bs_puts(out, c ? "$\n" : "-\n");
+			bs_sixel_row(out, b + k*w, w);
+			memset(b + k*w, 0, w);
+			bs_puts(out, --c ? "$\n" : "-\n");
 		}
 	}
+	xfree(b);
+	xfree(skip);
 	bs_puts(out, "\033\\");
 }
 
+static void dump_sixels_to_bytestream_rgb3(
+		struct bytestream *out,
+		uint8_t *x, int w, int h)
+{
+	static char pal[0x100][24]; // color definitions, printed only once
+	if (!*pal[0])
+		for (int i = 0; i < 0x100; i++)
+			snprintf(pal[i], 24, "#%d;2;%d;%d;%d", i,
+					(int)(14.2857*(i/32)),
+					(int)(14.2857*((i/4)%8)),
+					(int)(33.3333*(i%4)));
+	uint8_t *q = xmalloc(w*h);
+	for (int i = 0; i < w*h; i++)
+		q[i] = sidx(x + 3*i);
+	dump_sixels_to_bytestream_idx(out, q, NULL, w, h, pal, 0x100);
+	xfree(q);
+}
+
 static void dump_sixels_to_bytestream_gray2(
 		struct bytestream *out,
 		uint8_t *x, int w, int h)
 {
 	int Q = (1<<2); // quantization over [0..255]
-	bs_printf(out, "\033Pq\n");
-	for (int i = 0; i < 0x100/Q; i++)
-		bs_printf(out, "#%d;2;%d;%d;%d",
-			i, (int)(Q*.39*i), (int)(Q*.39*i), (int)(Q*.39*i));
-	for (int j = 0; j < h/6; j++) {
-		int m[0x100] = {0}, c = 0;
-		for (int i = 0; i < 6*w; i++) {
-			int k = x[6*j*w+i]/Q;
-			if (!m[k]) c += 1;
-			m[k] += 1;
-		}
-		for (int k = 0; k < 0x100/Q; k++)
-		if (m[k]) {
-			int b[w], r[w], R[w], idx = 0;
-			c -= 1;
-			for (int i = 0; i < w; i++) {
-				b[i] = 0;
-				for (int l = 5; l >= 0; l--)
-					b[i] = 2*b[i] + (k == x[(6*j+l)*w+i]/Q);
-				b[i] += 63;
-			}
-			for (int i = 0; i < w; i++) R[i] = 1;
-			r[0] = *b;
-			for (int i = 1; i < w; i++)
-				if (b[i] == r[idx]) R[idx] += 1;
-				else r[++idx] = b[i];
-			bs_printf(out, "#%d", k);
-			for (int i = 0; i <= idx; i++)
-				if (R[idx] < 3)
-					for (int l = 0; l < R[i]; l++)
-						bs_printf(out, "%c", r[i]);
-				else
-					bs_printf(out, "!%d%c", R[i], r[i]);
-			bs_printf(out, c ? "$\n" : "-\n");
-		}
-	}
-	bs_printf(out, "\033\\");
+	static char pal[0x100][24];
+	if (!*pal[0])
+		for (int i = 0; i < 0x100/Q; i++)
+			snprintf(pal[i], 24, "#%d;2;%d;%d;%d",
+				i, (int)(Q*.39*i), (int)(Q*.39*i), (int)(Q*.39*i));
+	uint8_t *q = xmalloc(w*h);
+	for (int i = 0; i < w*h; i++)
+		q[i] = x[i]/Q;
+	dump_sixels_to_bytestream_idx(out, q, NULL, w, h, pal, 0x100/Q);
+	xfree(q);
 }
 
 //static void dump_sixels_to_stdout_rgb3(uint8_t *x, int w, int h)
@@ -4854,6 +7333,12 @@ static int guess_format(FILE *f, char *buf, int *nbuf, int bufmax)
 	if (b[0]==4 && b[1]==0 && b[2]==0 && b[3]==0)
 		return IIO_FORMAT_RAT; // Random Access Texture (just for radar)
 
+	if (b[0]=='%' && b[1]=='S' && b[2]=='H' && b[3]=='M')
+		return IIO_FORMAT_SHM; // shared memory handoff (see SHM writer)
+
+	if (b[0]==0x93 && b[1]=='Z' && b[2]=='N' && b[3]=='P')
+		return IIO_FORMAT_ZNPY; // chunk-compressed npy (see ZNPY writer)
+
 #ifdef I_CAN_HAS_LIBHDF5
 	if (b[0]==0x89 && b[1]=='H' && b[2]=='D' && b[3]=='F')
 		return IIO_FORMAT_HDF5;
@@ -5055,7 +7540,7 @@ static bool comma_named_hdf5(const char *filename)
 {
 	IIO_DEBUG("hdf5 try \"%s\"\n", filename);
 
-	char *comma = strrchr(filename, ',');
+	char *comma = hdf5_dataset_comma(filename);
 	if (!comma) return false;
 
 	//int lnumber = strlen(comma + 1);
@@ -5093,6 +7578,8 @@ static
 int read_beheaded_image(struct iio_image *x, FILE *f, char *h, int hn, int fmt)
 {
 	IIO_DEBUG("rbi fmt = %d\n", fmt);
+	if (!global_profile_thread.format)
+		global_profile_thread.format = iio_strfmt(fmt);
 	// these functions can be defined in separate, independent files
 	// TODO: turn this function into an array of pointers to functions,
 	// indexed by a format enum
@@ -5114,6 +7601,8 @@ int read_beheaded_image(struct iio_image *x, FILE *f, char *h, int hn, int fmt)
 	case IIO_FORMAT_FFD:   return read_beheaded_ffd (x, f, h, hn);
 	case IIO_FORMAT_DLM:   return read_beheaded_dlm (x, f, h, hn);
 	case IIO_FORMAT_NPY:   return read_beheaded_npy (x, f, h, hn);
+	case IIO_FORMAT_SHM:   return read_beheaded_shm (x, f, h, hn);
+	case IIO_FORMAT_ZNPY:  return read_beheaded_znpy(x, f, h, hn);
 	case IIO_FORMAT_RAT:   return read_beheaded_rat (x, f, h, hn);
 	case IIO_FORMAT_VIC:   return read_beheaded_vic (x, f, h, hn);
 	case IIO_FORMAT_FIT:   return read_beheaded_fit (x, f, h, hn);
@@ -5193,12 +7682,174 @@ static int read_image_f(struct iio_image *x, FILE *f)
 	return read_beheaded_image(x, f, buf, nbuf, format);
 }
 
+// memory images                                                            {{{2
+
+// Images named "MEM:name" are kept in memory, to pass them between the
+// stages of a pipeline that run inside the same process (see "im pipe").
+// Writing such a name stores a copy of the image, and reading it takes the
+// image out of the store (the oldest one, if it was written several times).
+// When the image is not there yet, the reader waits until another thread
+// writes it.  Each thread can also redirect its standard input and output
+// to memory images, see "iio_set_std_names".
+
+struct iio_mem_image {
+	char *name;
+	struct iio_image x;
+	struct iio_mem_image *next;
+};
+
+static struct iio_mem_image *global_mem_images = NULL;
+#ifdef I_CAN_HAS_PTHREAD
+static pthread_mutex_t global_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t global_mem_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+#if __STDC_VERSION__ >= 201112L
+_Thread_local
+#endif
+static const char *global_std_names[2]; // replacements of "-" (in, out)
+
+// API
+void iio_set_std_names(const char *in, const char *out)
+{
+	global_std_names[0] = in;
+	global_std_names[1] = out;
+}
+
+// the name that really corresponds to "fname" in this thread
+static const char *std_alias(const char *fname, int output)
+{
+	if (0 == strcmp(fname, "-") && global_std_names[output])
+		return global_std_names[output];
+	return fname;
+}
+
+static const char *mem_prefix(const char *f)
+{
+	return f == strstr(f, "MEM:") ? f + 4 : NULL;
+}
+
+static void mem_put(const char *name, struct iio_image *x)
+{
+	struct iio_mem_image *m = xmalloc(sizeof*m);
+	m->name = xmalloc(1 + strlen(name));
+	strcpy(m->name, name);
+	m->x = *x;
+	m->x.rem = NULL;
+	size_t n = iio_image_data_size(x);
+	m->x.data = xmalloc(n);
+	memcpy(m->x.data, x->data, n);
+	m->next = NULL;
+	IIO_DEBUG("storing %zu bytes into memory image \"%s\"\n", n, name);
+#ifdef I_CAN_HAS_PTHREAD
+	pthread_mutex_lock(&global_mem_mutex);
+#endif
+	struct iio_mem_image **t = &global_mem_images;
+	while (*t)
+		t = &(*t)->next;
+	*t = m;
+#ifdef I_CAN_HAS_PTHREAD
+	pthread_cond_broadcast(&global_mem_cond);
+	pthread_mutex_unlock(&global_mem_mutex);
+#endif
+}
+
+static void mem_take(struct iio_image *x, const char *name)
+{
+	struct iio_mem_image *m = NULL;
+#ifdef I_CAN_HAS_PTHREAD
+	pthread_mutex_lock(&global_mem_mutex);
+#endif
+	while (!m)
+	{
+		for (struct iio_mem_image **t = &global_mem_images; *t;
+				t = &(*t)->next)
+			if (0 == strcmp((*t)->name, name)) {
+				m = *t;
+				*t = m->next;
+				break;
+			}
+		if (m) break;
+#ifdef I_CAN_HAS_PTHREAD
+		pthread_cond_wait(&global_mem_cond, &global_mem_mutex);
+#else
+		fail("memory image \"%s\" does not exist", name);
+#endif
+	}
+#ifdef I_CAN_HAS_PTHREAD
+	pthread_mutex_unlock(&global_mem_mutex);
+#endif
+	IIO_DEBUG("taking memory image \"%s\"\n", name);
+	*x = m->x;
+	xfree(m->name);
+	xfree(m);
+}
+
+static int read_image_unprofiled(struct iio_image *x, const char *fname);
+
+// read the bands selected by the suffix "bs" of the filename
+static int read_image_bands(struct iio_image *x, const char *fname,
+		const char *bs)
+{
+	int n = parse_bands(NULL, bs + 7);
+	int *b = xmalloc(n * sizeof*b);
+	parse_bands(b, bs + 7);
+	char name[bs - fname + 1];
+	memcpy(name, fname, bs - fname);
+	name[bs - fname] = '\0';
+
+	// the region of interest, if any, is on the file without the suffix
+	const char *roi_fname = global_roi.fname;
+	if (roi_fname && 0 == strcmp(roi_fname, fname))
+		global_roi.fname = name;
+	global_bands.fname = name;
+	global_bands.done = false;
+	global_bands.n = n;
+	global_bands.b = b;
+	int r = read_image(x, name);
+	global_bands.fname = NULL;
+	if (global_roi.fname == name)
+		global_roi.fname = roi_fname;
+	if (!r && !global_bands.done)
+		inplace_select_bands(x, b, n);
+	xfree(b);
+	return r;
+}
+
+// read_image, timed when profiling (only the outermost call)
 static int read_image(struct iio_image *x, const char *fname)
+{
+	if (!iio_profile_enabled() || global_profile_thread.depth)
+		return read_image_unprofiled(x, fname);
+	global_profile_thread.depth += 1;
+	global_profile_thread.format = mem_prefix(std_alias(fname, 0)) ?
+		"MEM" : NULL;
+	double t = iio_profile_now();
+	int r = read_image_unprofiled(x, fname);
+	t = iio_profile_now() - t;
+	global_profile_thread.depth -= 1;
+	if (!r)
+		global_profile_thread.last = iio_profile_io_add("read", fname,
+				global_profile_thread.format, x, t);
+	return r;
+}
+
+static int read_image_unprofiled(struct iio_image *x, const char *fname)
 {
 	int r; // the return-value of this function, zero if it succeeded
 
+	fname = std_alias(fname, 0);
 	IIO_DEBUG("read image \"%s\"\n", fname);
 
+	char *bands = bands_options_suffix(fname);
+	if (bands && !global_bands.fname)
+		return read_image_bands(x, fname, bands);
+
+	if (mem_prefix(fname)) {
+		mem_take(x, mem_prefix(fname));
+		return 0;
+	}
+
 #ifndef IIO_ABORT_ON_ERROR
 	if (setjmp(global_jump_buffer)) {
 		IIO_DEBUG("SOME ERROR HAPPENED AND WAS HANDLED\n");
@@ -5316,6 +7967,249 @@ static int read_image(struct iio_image *x, const char *fname)
 	return r;
 }
 
+// Try to read an image by mapping its file into memory.
+// This only works for named files of uncompressed formats whose samples are
+// stored natively with the required type (or any type, if "type" is negative).
+// Otherwise, it returns non-zero and the caller must use "read_image" instead.
+static int map_image_unprofiled(struct iio_image *x, const char *fname,
+		int type);
+
+// map_image, timed when profiling
+static int map_image(struct iio_image *x, const char *fname, int type)
+{
+	if (!iio_profile_enabled() || global_profile_thread.depth)
+		return map_image_unprofiled(x, fname, type);
+	global_profile_thread.depth += 1;
+	double t = iio_profile_now();
+	int r = map_image_unprofiled(x, fname, type);
+	t = iio_profile_now() - t;
+	global_profile_thread.depth -= 1;
+	if (!r)
+		global_profile_thread.last = iio_profile_io_add("map", fname,
+				NULL, x, t);
+	return r;
+}
+
+static int map_image_unprofiled(struct iio_image *x, const char *fname,
+		int type)
+{
+#ifdef I_CAN_HAS_MMAP
+	if (raw_prefix(fname))
+		return raw_named_image(x, fname, type);
+	if (!seekable_filenameP(fname) || xgetenv("IIO_RAW")
+			|| xgetenv("IIO_TXT") || xgetenv("IIO_TRANS"))
+		return 1;
+
+	FILE *f = fopen(fname, "rb");
+	if (!f) return 2;
+	int bufmax = 0x100, nbuf, r = 3;
+	char buf[0x100] = {0};
+	int format = guess_format(f, buf, &nbuf, bufmax);
+	bool fortran = false, swapped = false;
+	float scale = -1;
+	if (format == IIO_FORMAT_NPY)
+		r = npy_read_header(x, f, &fortran, &swapped);
+	if (format == IIO_FORMAT_PFM)
+		r = pfm_read_header(x, f, buf, &scale);
+	if (format == IIO_FORMAT_RIM && buf[0] == 'I' && buf[1] == 'R')
+		r = (rim_fimage_read_header(x, f, false), 0);
+	long offset = ftell(f);
+	fclose(f);
+	if (r || fortran || swapped || scale > 0 || offset <= 0) return 4;
+	if (type > 0 && normalize_type(x->type) != normalize_type(type))
+		return 5;
+	if (offset % iio_image_sample_size(x)) return 6;
+
+	size_t size, need = offset + iio_image_data_size(x);
+	char *p = iio_map_file(&size, fname);
+	if (!p) return 7;
+	if (size < need || !iio_register_mapping(p, size, p + offset))
+		return munmap(p, size), 8;
+	x->data = p + offset;
+	IIO_DEBUG("mapped image \"%s\" %s %dx%d,%d\n", fname, iio_strfmt(format),
+			x->sizes[0], x->sizes[1], x->pixel_dimension);
+	return 0;
+#else//I_CAN_HAS_MMAP
+	(void)x; (void)fname; (void)type;
+	return 1;
+#endif//I_CAN_HAS_MMAP
+}
+
+// Decoded-image cache
+//
+// When IIO_CACHE_DIR is set, the images decoded from named files are stored
+// in that directory as npy files, with the sample type requested by the
+// caller.  The name of each cached file is a hash of the device, inode, size
+// and modification time of the original file, so that the cache entries
+// become stale when the file changes.  Later reads of the same file load the
+// npy file instead of running the decoder (and map it directly, when
+// IIO_MMAP=1).  Old entries are never removed by iio.
+#ifdef I_CAN_HAS_MMAP
+static bool cache_filename(char *out, int n, const char *fname, int type)
+{
+	char *dir = xgetenv("IIO_CACHE_DIR");
+	if (!dir || !*dir || raw_prefix(fname) || trans_prefix(fname)
+			|| xgetenv("IIO_TRANS") || xgetenv("IIO_RAW")
+			|| xgetenv("IIO_TXT") || !seekable_filenameP(fname))
+		return false;
+	struct stat st[1];
+	if (stat(fname, st) || !S_ISREG(st->st_mode))
+		return false;
+	uint64_t k[5] = { st->st_dev, st->st_ino, st->st_size, st->st_mtime,
+#if _POSIX_C_SOURCE >= 200809L
+		st->st_mtim.tv_nsec
+#endif
+	};
+	uint64_t h = 0xcbf29ce484222325; // FNV-1a
+	FORI(sizeof k)
+		h = (h ^ ((uint8_t*)k)[i]) * 0x100000001b3;
+	return n > snprintf(out, n, "%s/iio-%016llx-%s.npy", dir,
+			(unsigned long long)h,
+			type > 0 ? iio_strtyp(normalize_type(type)) : "ANY");
+}
+
+static void cache_store(struct iio_image *x, const char *cname)
+{
+	char tmp[FILENAME_MAX + 30], header[1000];
+	snprintf(tmp, sizeof tmp, "%s.%d", cname, (int)getpid());
+	FILE *f = fopen(tmp, "wb");
+	if (!f) {
+		IIO_DEBUG("could not create cache file \"%s\"\n", tmp);
+		return;
+	}
+	int m = npy_write_header(header, x);
+	size_t n = iio_image_data_size(x);
+	bool ok = m == (int)fwrite(header, 1, m, f)
+		&& n == fwrite(x->data, 1, n, f);
+	ok = !fclose(f) && ok && !rename(tmp, cname);
+	if (!ok) remove(tmp);
+	IIO_DEBUG("cache store \"%s\": %s\n", cname, ok ? "ok" : "failed");
+}
+#endif//I_CAN_HAS_MMAP
+
+// read the image, mapping it if possible and requested by the environment
+static int read_image_maybe_mapped(struct iio_image *x, const char *fname,
+		int type)
+{
+	char *m = xgetenv("IIO_MMAP");
+	bool mmap_ok = m && atoi(m);
+	if (mmap_ok && 0 == map_image(x, fname, type))
+		return 0;
+#ifdef I_CAN_HAS_MMAP
+	char cname[FILENAME_MAX];
+	if (cache_filename(cname, sizeof cname, fname, type)) {
+		if (0 == access(cname, R_OK)) {
+			IIO_DEBUG("cache hit \"%s\" => \"%s\"\n", fname, cname);
+			if (mmap_ok && 0 == map_image(x, cname, type))
+				return 0;
+			return read_image(x, cname);
+		}
+		int r = read_image(x, fname);
+		if (r) return r;
+		if (type > 0) iio_convert_samples(x, type);
+		cache_store(x, cname);
+		return r;
+	}
+#endif//I_CAN_HAS_MMAP
+	return read_image(x, fname);
+}
+
+// Fill-in the size and sample type of an image (with NULL data) by parsing
+// only the header of the file, when its format allows it.  Otherwise, the
+// whole image is read and its data discarded.
+static int read_image_info(struct iio_image *x, const char *fname)
+{
+	if (trans_prefix(fname) || xgetenv("IIO_TRANS") || xgetenv("IIO_RAW")
+			|| xgetenv("IIO_TXT"))
+		goto whole;
+#ifdef I_CAN_HAS_MMAP
+	if (raw_prefix(fname) && 0 == raw_named_image(x, fname, -1)) {
+		iio_unmap_if_mapped(x->data);
+		x->data = NULL;
+		return 0;
+	}
+#endif//I_CAN_HAS_MMAP
+#ifdef I_CAN_HAS_LIBTIFF
+	if (comma_named_tiff(fname) && 0 == tiff_read_image_info(x, fname))
+		return x->data = NULL, 0;
+#endif//I_CAN_HAS_LIBTIFF
+	if (raw_prefix(fname) || !seekable_filenameP(fname))
+		goto whole;
+
+	FILE *f = fopen(fname, "rb");
+	if (!f) goto whole;
+	int bufmax = 0x100, nbuf, r = 1;
+	char buf[0x100] = {0};
+	int format = guess_format(f, buf, &nbuf, bufmax);
+	bool fortran, swapped;
+	float scale;
+	switch (format) {
+	case IIO_FORMAT_NPY:
+		r = npy_read_header(x, f, &fortran, &swapped);
+		if (!r && fortran) { // the data will be transposed
+			int t = x->sizes[0];
+			x->sizes[0] = x->sizes[1];
+			x->sizes[1] = t;
+		}
+		break;
+	case IIO_FORMAT_ZNPY: {
+		struct znpy_header z[1];
+		r = znpy_read_header(x, z, f);
+		if (!r) xfree(z->offset);
+		break;
+	}
+	case IIO_FORMAT_PFM:
+		r = pfm_read_header(x, f, buf, &scale);
+		break;
+	case IIO_FORMAT_RIM:
+		if (buf[0] == 'I' && buf[1] == 'R')
+			r = (rim_fimage_read_header(x, f, false), 0);
+		break;
+	case IIO_FORMAT_VRT: {
+		char line[FILENAME_MAX + 0x200];
+		int w = 0, h = 0;
+		rewind(f);
+		if (fgets(line, sizeof line, f)
+			&& xml_get_numeric_attr(&w, line, "Dataset", "rasterXSize")
+			&& xml_get_numeric_attr(&h, line, "Dataset", "rasterYSize")
+			&& w > 0 && h > 0)
+			r = (iio_image_init2d(x, w, h, 1, IIO_TYPE_FLOAT), 0);
+		break;
+	}
+#ifdef I_CAN_HAS_LIBPNG
+	case IIO_FORMAT_PNG:
+		rewind(f);
+		r = png_read_image_info(x, f);
+		break;
+#endif//I_CAN_HAS_LIBPNG
+#ifdef I_CAN_HAS_LIBJPEG
+	case IIO_FORMAT_JPEG:
+		rewind(f);
+		r = jpeg_read_image_info(x, f);
+		break;
+#endif//I_CAN_HAS_LIBJPEG
+#ifdef I_CAN_HAS_LIBTIFF
+	case IIO_FORMAT_TIFF:
+		r = tiff_read_image_info(x, fname);
+		break;
+#endif//I_CAN_HAS_LIBTIFF
+	}
+	fclose(f);
+	if (!r) {
+		IIO_DEBUG("image info \"%s\" %s %dx%d,%d %s\n", fname,
+				iio_strfmt(format), x->sizes[0], x->sizes[1],
+				x->pixel_dimension, iio_strtyp(x->type));
+		x->data = NULL;
+		return 0;
+	}
+
+whole:
+	r = read_image(x, fname);
+	if (!r) xfree(x->data);
+	x->data = NULL;
+	return r;
+}
+
 
 static void iio_write_image_default(const char *filename, struct iio_image *x);
 
@@ -5356,7 +8250,7 @@ static void *rfail(const char *fmt, ...)
 float *iio_read_image_float_vec(const char *fname, int *w, int *h, int *pd)
 {
 	struct iio_image x[1];
-	int r = read_image(x, fname);
+	int r = read_image_maybe_mapped(x, fname, IIO_TYPE_FLOAT);
 	if (r) return rfail("could not read image");
 	if (x->dimension != 2) {
 		x->dimension = 2;
@@ -5368,15 +8262,89 @@ float *iio_read_image_float_vec(const char *fname, int *w, int *h, int *pd)
 	return x->data;
 }
 
+// read the window [x0,xf) x [y0,yf) of an image
+static int read_image_roi(struct iio_image *x, const char *fname,
+		int x0, int y0, int xf, int yf)
+{
+	bool trans = trans_prefix(fname) || xgetenv("IIO_TRANS");
+	global_roi.fname = trans ? NULL : fname;
+	global_roi.done = false;
+	global_roi.x0 = x0;
+	global_roi.y0 = y0;
+	global_roi.xf = xf;
+	global_roi.yf = yf;
+	int r = read_image(x, fname);
+	global_roi.fname = NULL;
+	if (r) return r;
+	if (x->dimension != 2) {
+		x->dimension = 2;
+	}
+	if (!global_roi.done) {
+		// the reader decoded the whole image, crop it now
+		int sw = x->sizes[0], sh = x->sizes[1], rx, ry, rw, rh;
+		global_roi_rectangle(&rx, &ry, &rw, &rh, sw, sh);
+		inplace_trim(x, rx, sh - ry - rh, sw - rx - rw, ry);
+	}
+	return 0;
+}
+
+// API 2D (region of interest)
+float *iio_read_image_float_vec_roi(const char *fname,
+		int x0, int y0, int xf, int yf, int *w, int *h, int *pd)
+{
+	struct iio_image x[1];
+	if (read_image_roi(x, fname, x0, y0, xf, yf))
+		return rfail("could not read image");
+	*w = x->sizes[0];
+	*h = x->sizes[1];
+	*pd = x->pixel_dimension;
+	iio_convert_samples(x, IIO_TYPE_FLOAT);
+	return x->data;
+}
+
+// API 2D (zoomed-out)
+float *iio_read_image_float_vec_scaled(const char *fname, int *n,
+		int *w, int *h, int *pd)
+{
+	struct iio_image x[1];
+	global_scale.fname = fname;
+	global_scale.n = *n;
+	global_scale.done = 0;
+	int r = read_image(x, fname);
+	global_scale.fname = NULL;
+	if (r) return rfail("could not read image");
+	if (x->dimension != 2) {
+		x->dimension = 2;
+	}
+	*n = global_scale.done ? global_scale.done : 1;
+	*w = x->sizes[0];
+	*h = x->sizes[1];
+	*pd = x->pixel_dimension;
+	iio_convert_samples(x, IIO_TYPE_FLOAT);
+	return x->data;
+}
+
+// API 2D (header only)
+int iio_read_image_info(const char *fname, int *w, int *h, int *pd,
+		const char **type)
+{
+	struct iio_image x[1];
+	int r = read_image_info(x, fname);
+	if (r) return r;
+	*w = x->sizes[0];
+	*h = x->sizes[1];
+	*pd = x->pixel_dimension;
+	if (type) *type = iio_strtyp(x->type);
+	return 0;
+}
+
 // API 2D
 float *iio_read_image_float_split(const char *fname, int *w, int *h, int *pd)
 {
 	float *r = iio_read_image_float_vec(fname, w, h, pd);
 	if (!r) return rfail("could not read image");
-	float *rbroken = xmalloc(*w**h**pd*sizeof*rbroken);
-	break_pixels_float(rbroken, r, *w**h, *pd);
-	xfree(r);
-	return rbroken;
+	deinterleave_samples_inplace(r, (size_t)*w**h, *pd, sizeof*r);
+	return r;
 }
 
 // API 2D
@@ -5402,7 +8370,7 @@ float *iio_read_image_float_rgb(const char *fname, int *w, int *h)
 double *iio_read_image_double_vec(const char *fname, int *w, int *h, int *pd)
 {
 	struct iio_image x[1];
-	int r = read_image(x, fname);
+	int r = read_image_maybe_mapped(x, fname, IIO_TYPE_DOUBLE);
 	if (r) return rfail("could not read image");
 	if (x->dimension != 2) {
 		x->dimension = 2;
@@ -5418,7 +8386,7 @@ double *iio_read_image_double_vec(const char *fname, int *w, int *h, int *pd)
 uint8_t *iio_read_image_uint8_vec(const char *fname, int *w, int *h, int *pd)
 {
 	struct iio_image x[1];
-	int r = read_image(x, fname);
+	int r = read_image_maybe_mapped(x, fname, IIO_TYPE_UINT8);
 	if (r) return rfail("could not read image");
 	if (x->dimension != 2) {
 		x->dimension = 2;
@@ -5434,7 +8402,7 @@ uint8_t *iio_read_image_uint8_vec(const char *fname, int *w, int *h, int *pd)
 uint16_t *iio_read_image_uint16_vec(const char *fname, int *w, int *h, int *pd)
 {
 	struct iio_image x[1];
-	int r = read_image(x, fname);
+	int r = read_image_maybe_mapped(x, fname, IIO_TYPE_UINT16);
 	if (r) return rfail("could not read image");
 	if (x->dimension != 2) {
 		x->dimension = 2;
@@ -5451,10 +8419,8 @@ double *iio_read_image_double_split(const char *fname, int *w, int *h, int *pd)
 {
 	double *r = iio_read_image_double_vec(fname, w, h, pd);
 	if (!r) return rfail("could not read image");
-	double *rbroken = xmalloc(*w**h**pd*sizeof*rbroken);
-	break_pixels_double(rbroken, r, *w**h, *pd);
-	xfree(r);
-	return rbroken;
+	deinterleave_samples_inplace(r, (size_t)*w**h, *pd, sizeof*r);
+	return r;
 }
 
 // API 2D
@@ -5612,10 +8578,10 @@ void *iio_read_nd_image_as_desired(char *fname,
 		bool desired_ieeefp_samples, bool desired_signed_samples)
 {
 	struct iio_image x[1];
-	int r = read_image(x, fname);
-	if (r) return rfail("so much fail");
 	int desired_type = iio_type_id(desired_sample_size,
 				desired_ieeefp_samples, desired_signed_samples);
+	int r = read_image_maybe_mapped(x, fname, desired_type);
+	if (r) return rfail("so much fail");
 	iio_convert_samples(x, desired_type);
 	*dimension = x->dimension;
 	FORI(x->dimension) sizes[i] = x->sizes[i];
@@ -5623,6 +8589,40 @@ void *iio_read_nd_image_as_desired(char *fname,
 	return x->data;
 }
 
+// API 2D (mapped)
+static void *iio_map_image_vec(const char *fname, int *w, int *h, int *pd,
+		int type)
+{
+	struct iio_image x[1];
+	int r = map_image(x, fname, type) && read_image(x, fname);
+	if (r) return rfail("could not read image");
+	*w = x->sizes[0];
+	*h = x->sizes[1];
+	*pd = x->pixel_dimension;
+	iio_convert_samples(x, type);
+	return x->data;
+}
+
+float *iio_map_image_float_vec(const char *fname, int *w, int *h, int *pd)
+{
+	return iio_map_image_vec(fname, w, h, pd, IIO_TYPE_FLOAT);
+}
+
+double *iio_map_image_double_vec(const char *fname, int *w, int *h, int *pd)
+{
+	return iio_map_image_vec(fname, w, h, pd, IIO_TYPE_DOUBLE);
+}
+
+uint8_t *iio_map_image_uint8_vec(const char *fname, int *w, int *h, int *pd)
+{
+	return iio_map_image_vec(fname, w, h, pd, IIO_TYPE_UINT8);
+}
+
+uint16_t *iio_map_image_uint16_vec(const char *fname, int *w, int *h, int *pd)
+{
+	return iio_map_image_vec(fname, w, h, pd, IIO_TYPE_UINT16);
+}
+
 // API 2D
 float *iio_read_image_float(const char *fname, int *w, int *h)
 {
@@ -5708,6 +8708,591 @@ uint8_t *iio_read_image_uint8(const char *fname, int *w, int *h)
 }
 
 
+// API (streaming)                                                          {{{1
+
+// A stream gives access to bands of rows of an image without reading the
+// whole image into memory.  PNG and JPEG are decoded sequentially (and
+// restarted when the caller goes back), TIFF is read by scanlines or by rows
+// of tiles, VRT mosaics by bands from the streams of their sources,
+// uncompressed files are mapped and anything else is read whole.
+#define IIO_STREAM_MEMORY 1
+#define IIO_STREAM_PNG    2
+#define IIO_STREAM_JPEG   3
+#define IIO_STREAM_TIFF   4
+#define IIO_STREAM_VRT    5
+
+struct iio_stream {
+	int w, h, pd, type;  // the samples are stored with this type
+	int kind;            // one of the IIO_STREAM_* above
+	char *fname;
+	void *row;           // decoded row (png, jpeg and stripped tiff)
+	double seconds;      // time spent decoding (when profiling)
+
+	// memory streams
+	void *data;
+
+	// sequential streams (png, jpeg and stripped tiff)
+	FILE *f;
+	int next_row;        // index of the next row to be decoded
+#ifdef I_CAN_HAS_LIBPNG
+	png_structp pp;
+	png_infop pi;
+#endif//I_CAN_HAS_LIBPNG
+#ifdef I_CAN_HAS_LIBJPEG
+	struct jpeg_decompress_struct cinfo[1];
+	struct jpeg_error_mgr jerr[1];
+#endif//I_CAN_HAS_LIBJPEG
+
+	// tiff streams
+#ifdef I_CAN_HAS_LIBTIFF
+	TIFF *tif;
+	bool tiled, broken;
+	int packed;          // bits of the packed samples (1, 2, 4), or 0
+	uint32_t tw, th;     // size of the tiles (th = rows per strip)
+	int band;            // index of the row of tiles stored in "tband"
+	uint8_t *tband;      // decoded row of tiles
+	uint8_t *tbuf;       // one tile, or one scanline of a separate plane
+#endif//I_CAN_HAS_LIBTIFF
+
+	// vrt streams
+	struct vrt_mosaic *vrt;
+	float *vband;        // decoded band of rows of the mosaic
+	int vy0, vny;        // its first row and number of rows
+	struct stream_vrt_open *vopen; // cache of open sources
+	int nvopen;
+	long vtick;          // counter of the uses of the cache
+};
+
+static size_t stream_row_size(struct iio_stream *s)
+{
+	return s->w * s->pd * iio_type_size(s->type);
+}
+
+#ifdef I_CAN_HAS_LIBPNG
+// (re)start the decoding of a png stream, return non-zero if not possible
+static int stream_png_start(struct iio_stream *s)
+{
+	if (s->pp) png_destroy_read_struct(&s->pp, &s->pi, NULL);
+	rewind(s->f);
+	s->pp = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+	if (!s->pp) fail("png_create_read_struct fail");
+	s->pi = png_create_info_struct(s->pp);
+	if (!s->pi) fail("png_create_info_struct fail");
+	if (setjmp(png_jmpbuf(s->pp))) fail("png error");
+	png_init_io(s->pp, s->f);
+	png_read_info(s->pp, s->pi);
+	if (png_get_interlace_type(s->pp, s->pi) != PNG_INTERLACE_NONE)
+		return 1; // interlaced images can not be read by rows
+	png_set_packing(s->pp);
+	png_set_expand(s->pp);
+	png_set_swap(s->pp); // like "read_beheaded_png", assume little endian
+	png_read_update_info(s->pp, s->pi);
+	s->w = png_get_image_width(s->pp, s->pi);
+	s->h = png_get_image_height(s->pp, s->pi);
+	s->pd = png_get_channels(s->pp, s->pi);
+	int depth = png_get_bit_depth(s->pp, s->pi);
+	s->type = depth == 16 ? IIO_TYPE_UINT16 : IIO_TYPE_UINT8;
+	if (stream_row_size(s) != png_get_rowbytes(s->pp, s->pi))
+		fail("png row size mismatch");
+	s->next_row = 0;
+	return 0;
+}
+#endif//I_CAN_HAS_LIBPNG
+
+#ifdef I_CAN_HAS_LIBJPEG
+// (re)start the decoding of a jpeg stream
+static void stream_jpeg_start(struct iio_stream *s)
+{
+	if (s->cinfo->err) jpeg_destroy_decompress(s->cinfo);
+	rewind(s->f);
+	s->cinfo->err = jpeg_std_error(s->jerr);
+	s->jerr->error_exit = on_jpeg_error;
+	jpeg_create_decompress(s->cinfo);
+	jpeg_stdio_src(s->cinfo, s->f);
+	jpeg_read_header(s->cinfo, 1);
+	jpeg_start_decompress(s->cinfo);
+	s->w = s->cinfo->output_width;
+	s->h = s->cinfo->output_height;
+	s->pd = s->cinfo->output_components;
+	s->type = IIO_TYPE_UINT8;
+	s->next_row = 0;
+}
+#endif//I_CAN_HAS_LIBJPEG
+
+#ifdef I_CAN_HAS_LIBTIFF
+// open a tiff stream, return non-zero if it can not be read by rows
+static int stream_tiff_start(struct iio_stream *s)
+{
+	TIFFSetWarningHandler(NULL);//suppress warnings
+	s->tif = tiffopen_fancy(s->fname, "rm");
+	if (!s->tif) return 1;
+	uint32_t w, h;
+	uint16_t spp, bps, fmt, planarity;
+	if (!TIFFGetField(s->tif, TIFFTAG_IMAGEWIDTH, &w)) return 2;
+	if (!TIFFGetField(s->tif, TIFFTAG_IMAGELENGTH, &h)) return 3;
+	if (!TIFFGetField(s->tif, TIFFTAG_SAMPLESPERPIXEL, &spp)) spp = 1;
+	if (!TIFFGetField(s->tif, TIFFTAG_BITSPERSAMPLE, &bps)) bps = 1;
+	if (!TIFFGetField(s->tif, TIFFTAG_SAMPLEFORMAT, &fmt))
+		fmt = SAMPLEFORMAT_UINT;
+	if (!TIFFGetField(s->tif, TIFFTAG_PLANARCONFIG, &planarity))
+		planarity = PLANARCONFIG_CONTIG;
+	if ((bps < 8 && bps != 1 && bps != 2 && bps != 4)
+			|| (fmt != SAMPLEFORMAT_UINT && fmt != SAMPLEFORMAT_INT
+				&& fmt != SAMPLEFORMAT_IEEEFP))
+		return 4; // complex or weird samples
+	s->w = w;
+	s->h = h;
+	s->pd = spp;
+	s->packed = bps < 8 ? bps : 0;
+	s->type = s->packed ? IIO_TYPE_UINT8 : tiff_sample_type(fmt, bps);
+	s->broken = planarity == PLANARCONFIG_SEPARATE;
+	s->tiled = TIFFIsTiled(s->tif);
+	int ss = iio_type_size(s->type);
+	if (!s->packed && bps != 8 * ss) return 5;
+	if (s->packed && (s->tiled || s->broken))
+		return 9; // only contiguous bit-packed strips are unpacked by rows
+	if (s->tiled) {
+		TIFFGetField(s->tif, TIFFTAG_TILEWIDTH, &s->tw);
+		TIFFGetField(s->tif, TIFFTAG_TILELENGTH, &s->th);
+		if (TIFFTileSize(s->tif) != (tmsize_t)s->tw*s->th
+				*(s->broken ? 1 : spp) * ss)
+			return 6;
+		s->tbuf = xmalloc(TIFFTileSize(s->tif));
+		s->tband = xmalloc(stream_row_size(s) * s->th);
+		s->band = -1;
+	} else {
+		uint16_t compression;
+		if (!TIFFGetField(s->tif, TIFFTAG_COMPRESSION, &compression))
+			compression = 1;
+		if (s->broken && compression != 1)
+			return 8; // separate planes can not be decoded by rows
+		if (!TIFFGetField(s->tif, TIFFTAG_ROWSPERSTRIP, &s->th))
+			s->th = h;
+		int sls = TIFFScanlineSize(s->tif);
+		int bits = s->packed ? s->packed : 8 * ss;
+		if (sls != (int)((w * (s->broken ? 1 : spp) * bits + 7) / 8))
+			return 7;
+		s->tbuf = xmalloc(sls);
+	}
+	return 0;
+}
+
+// decode the row "y" of a tiff stream, return a pointer to it
+static void *stream_tiff_row(struct iio_stream *s, int y)
+{
+	int w = s->w, spp = s->pd, ss = iio_type_size(s->type);
+	uint8_t *row = s->row;
+	if (!s->tiled) {
+		// compressed strips are decoded sequentially from their start
+		if (y < s->next_row) {
+			TIFFClose(s->tif);
+			s->tif = tiffopen_fancy(s->fname, "rm");
+			if (!s->tif) fail("could not reopen TIFF \"%s\"", s->fname);
+			s->next_row = 0;
+		}
+		if (s->next_row < y - y % (int)s->th)
+			s->next_row = y - y % (int)s->th;
+		for (; s->next_row < y; s->next_row++)
+			if (TIFFReadScanline(s->tif, row, s->next_row, 0) < 0)
+				fail("error read tiff row %d/%d", s->next_row, s->h);
+		s->next_row = y + 1;
+		if (s->packed) {
+			if (TIFFReadScanline(s->tif, s->tbuf, y, 0) < 0)
+				fail("error read tiff row %d/%d", y, s->h);
+			unpack_to_bytes_here(row, s->tbuf, w * spp, s->packed);
+		} else if (!s->broken) {
+			if (TIFFReadScanline(s->tif, row, y, 0) < 0)
+				fail("error read tiff row %d/%d", y, s->h);
+		} else for (int l = 0; l < spp; l++) {
+			if (TIFFReadScanline(s->tif, s->tbuf, y, l) < 0)
+				fail("error read tiff row %d/%d;%d", y, s->h, l);
+			for (int i = 0; i < w; i++)
+				memcpy(row + (i*spp + l)*ss, s->tbuf + i*ss, ss);
+		}
+		return row;
+	}
+
+	// decode the whole row of tiles that contains the requested row
+	int band = y / s->th;
+	int Spp = s->broken ? 1 : spp;
+	if (band != s->band)
+	for (uint32_t tx = 0; tx < (uint32_t)w; tx += s->tw)
+	for (int l = 0; l < spp / Spp; l++)
+	{
+		uint32_t ty = band * s->th;
+		if (-1 == TIFFReadTile(s->tif, s->tbuf, tx, ty, 0, l))
+			memset(s->tbuf, -1, TIFFTileSize(s->tif));
+		for (uint32_t j = 0; j < s->th && ty + j < (uint32_t)s->h; j++)
+		for (uint32_t i = 0; i < s->tw && tx + i < (uint32_t)w; i++)
+		for (int k = 0; k < Spp; k++)
+		{
+			int idx_i = ((j*s->tw + i)*Spp + k)*ss;
+			int idx_o = ((j*w + tx + i)*spp + l + k)*ss;
+			memcpy(s->tband + idx_o, s->tbuf + idx_i, ss);
+		}
+	}
+	s->band = band;
+	return s->tband + (y - band * s->th) * stream_row_size(s);
+}
+#endif//I_CAN_HAS_LIBTIFF
+
+// VRT streams are decoded by bands of IIO_VRT_BAND rows, each one from the
+// streams of the sources that it crosses (read in parallel).  At most
+// IIO_VRT_MAXOPEN sources (default 64) are kept open, and the least recently
+// used one is closed to open another.
+#define IIO_VRT_BAND 64
+
+struct iio_stream *iio_open(const char *fname, int *w, int *h, int *pd);
+int iio_read_rows(struct iio_stream *s, float *out, int y0, int nrows);
+void iio_close(struct iio_stream *s);
+
+struct stream_vrt_open {
+	int k;                // index of the source
+	long tick;            // time of its last use
+	struct iio_stream *s;
+};
+
+static int stream_vrt_maxopen(void)
+{
+	char *t = xgetenv("IIO_VRT_MAXOPEN");
+	int n = t ? atoi(t) : 64;
+	return n > 0 ? n : 1;
+}
+
+static int stream_vrt_start(struct iio_stream *s)
+{
+	rewind(s->f);
+	s->vrt = xmalloc(sizeof*s->vrt);
+	if (vrt_parse(s->vrt, s->f, s->fname)) {
+		xfree(s->vrt);
+		s->vrt = NULL;
+		return 1;
+	}
+	fclose(s->f);
+	s->f = NULL;
+	s->w = s->vrt->w;
+	s->h = s->vrt->h;
+	s->pd = 1;
+	s->type = IIO_TYPE_FLOAT;
+	s->vband = xmalloc(IIO_VRT_BAND * (size_t)s->w * sizeof*s->vband);
+	s->vy0 = s->vny = 0;
+	s->vopen = xmalloc(stream_vrt_maxopen() * sizeof*s->vopen);
+	s->nvopen = 0;
+	s->vtick = 0;
+	return 0;
+}
+
+// the open stream of the source k
+static struct iio_stream *stream_vrt_source(struct iio_stream *s, int k)
+{
+	struct stream_vrt_open *o = s->vopen;
+	int i = 0;
+	while (i < s->nvopen && o[i].k != k)
+		i += 1;
+	if (i == s->nvopen) {
+		if (s->nvopen < stream_vrt_maxopen())
+			s->nvopen += 1;
+		else {
+			i = 0;
+			for (int j = 1; j < s->nvopen; j++)
+				if (o[j].tick < o[i].tick)
+					i = j;
+			IIO_DEBUG("vrt closes \"%s\"\n", s->vrt->s[o[i].k].fname);
+			iio_close(o[i].s);
+		}
+		struct vrt_source *t = s->vrt->s + k;
+		int pd;
+		o[i].k = k;
+		o[i].s = iio_open(t->fname, &t->sw, &t->sh, &pd);
+		if (!o[i].s || pd == 2 || pd > 4)
+			fail("could not read VRT source \"%s\"", t->fname);
+	}
+	o[i].tick = ++s->vtick;
+	return o[i].s;
+}
+
+// decode the band of rows of a vrt stream that starts at the row y0
+static void stream_vrt_band(struct iio_stream *s, int y0)
+{
+	struct vrt_mosaic *v = s->vrt;
+	int w = s->w, n = y0 + IIO_VRT_BAND < s->h ? IIO_VRT_BAND : s->h - y0;
+	float *out = s->vband;
+	for (long p = 0; p < n * (long)w; p++)
+		out[p] = 0;
+	int m = stream_vrt_maxopen();
+	int *k = xmalloc(m * sizeof*k), (*c)[4] = xmalloc(m * sizeof*c);
+	float **b = xmalloc(m * sizeof*b);
+	struct iio_stream **z = xmalloc(m * sizeof*z);
+	for (int i = 0; i < v->n; )
+	{
+		// a batch of at most m sources that cross the band
+		int nk = 0;
+		for (; i < v->n && nk < m; i++)
+			if (vrt_overlaps(v->s + i, 0, y0, w, n))
+				k[nk++] = i;
+		for (int q = 0; q < nk; q++)
+			z[q] = stream_vrt_source(s, k[q]);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(iio_threads()) schedule(dynamic)
+#endif
+		for (int q = 0; q < nk; q++)
+		{
+			struct vrt_source *t = v->s + k[q];
+			b[q] = NULL;
+			if (!vrt_clip(c[q], t, 0, y0, w, n))
+				continue;
+			int nr = c[q][3] - c[q][1], bw = c[q][2] - c[q][0];
+			int sw = z[q]->w, pd = z[q]->pd;
+			float *r = xmalloc(nr * (size_t)sw * pd * sizeof*r);
+			iio_read_rows(z[q], r, c[q][1] - t->y, nr);
+			b[q] = xmalloc(nr * (size_t)bw * sizeof*b[q]);
+			for (int j = 0; j < nr; j++)
+			for (int l = 0; l < bw; l++)
+			{
+				float *p = r + (j*(size_t)sw + l + c[q][0] - t->x)*pd;
+				b[q][j*bw+l] = pd == 1 ? *p :
+					.299*p[0] + .587*p[1] + .114*p[2];
+			}
+			xfree(r);
+		}
+		for (int q = 0; q < nk; q++)
+		{
+			if (!b[q]) continue;
+			int bw = c[q][2] - c[q][0];
+			for (int j = c[q][1]; j < c[q][3]; j++)
+				memcpy(out + (j - y0) * (long)w + c[q][0],
+					b[q] + (j - c[q][1]) * (long)bw,
+					bw * sizeof*out);
+			xfree(b[q]);
+		}
+	}
+	xfree(z);
+	xfree(b);
+	xfree(c);
+	xfree(k);
+	s->vy0 = y0;
+	s->vny = n;
+}
+
+// return a pointer to the row "y" of the stream, in the native sample type
+static void *stream_row(struct iio_stream *s, int y)
+{
+	switch (s->kind) {
+	case IIO_STREAM_MEMORY:
+		return y * stream_row_size(s) + (char *)s->data;
+	case IIO_STREAM_VRT:
+		if (y < s->vy0 || y >= s->vy0 + s->vny)
+			stream_vrt_band(s, y - y % IIO_VRT_BAND);
+		return s->vband + (y - s->vy0) * (size_t)s->w;
+#ifdef I_CAN_HAS_LIBTIFF
+	case IIO_STREAM_TIFF:
+		return stream_tiff_row(s, y);
+#endif//I_CAN_HAS_LIBTIFF
+	}
+
+	// sequential decoders
+	if (y < s->next_row) {
+		IIO_DEBUG("stream \"%s\" restart at row %d\n", s->fname, y);
+#ifdef I_CAN_HAS_LIBPNG
+		if (s->kind == IIO_STREAM_PNG) stream_png_start(s);
+#endif//I_CAN_HAS_LIBPNG
+#ifdef I_CAN_HAS_LIBJPEG
+		if (s->kind == IIO_STREAM_JPEG) stream_jpeg_start(s);
+#endif//I_CAN_HAS_LIBJPEG
+	}
+	while (s->next_row <= y) {
+#ifdef I_CAN_HAS_LIBPNG
+		if (s->kind == IIO_STREAM_PNG) {
+			if (setjmp(png_jmpbuf(s->pp))) fail("png error");
+			png_read_row(s->pp, s->row, NULL);
+		}
+#endif//I_CAN_HAS_LIBPNG
+#ifdef I_CAN_HAS_LIBJPEG
+		if (s->kind == IIO_STREAM_JPEG) {
+			JSAMPROW scanline[1] = { s->row };
+			if (1 != jpeg_read_scanlines(s->cinfo, scanline, 1))
+				fail("failed to read jpeg scanline %d",
+						s->next_row);
+		}
+#endif//I_CAN_HAS_LIBJPEG
+		s->next_row += 1;
+	}
+	return s->row;
+}
+
+// try to open a stream that decodes the file incrementally
+static int stream_open_incremental(struct iio_stream *s)
+{
+#ifdef I_CAN_HAS_LIBTIFF
+	if (comma_named_tiff(s->fname)) {
+		s->kind = IIO_STREAM_TIFF;
+		return stream_tiff_start(s);
+	}
+#endif//I_CAN_HAS_LIBTIFF
+	if (!seekable_filenameP(s->fname) || raw_prefix(s->fname)
+			|| trans_prefix(s->fname) || xgetenv("IIO_TRANS"))
+		return 1;
+	FILE *f = fopen(s->fname, "rb");
+	if (!f) return 2;
+	int bufmax = 0x100, nbuf;
+	char buf[0x100] = {0};
+	int format = guess_format(f, buf, &nbuf, bufmax);
+	s->f = f;
+	switch (format) {
+	case IIO_FORMAT_VRT:
+		s->kind = IIO_STREAM_VRT;
+		return stream_vrt_start(s);
+#ifdef I_CAN_HAS_LIBPNG
+	case IIO_FORMAT_PNG:
+		s->kind = IIO_STREAM_PNG;
+		return stream_png_start(s);
+#endif//I_CAN_HAS_LIBPNG
+#ifdef I_CAN_HAS_LIBJPEG
+	case IIO_FORMAT_JPEG:
+		s->kind = IIO_STREAM_JPEG;
+		stream_jpeg_start(s);
+		return 0;
+#endif//I_CAN_HAS_LIBJPEG
+#ifdef I_CAN_HAS_LIBTIFF
+	case IIO_FORMAT_TIFF:
+		fclose(f);
+		s->f = NULL;
+		s->kind = IIO_STREAM_TIFF;
+		return stream_tiff_start(s);
+#endif//I_CAN_HAS_LIBTIFF
+	}
+	return 3;
+}
+
+// release the decoder parts of a stream (but not its name)
+static void stream_release(struct iio_stream *s)
+{
+#ifdef I_CAN_HAS_LIBPNG
+	if (s->pp) png_destroy_read_struct(&s->pp, &s->pi, NULL);
+#endif//I_CAN_HAS_LIBPNG
+#ifdef I_CAN_HAS_LIBJPEG
+	if (s->cinfo->err) jpeg_destroy_decompress(s->cinfo);
+	s->cinfo->err = NULL;
+#endif//I_CAN_HAS_LIBJPEG
+#ifdef I_CAN_HAS_LIBTIFF
+	if (s->tif) TIFFClose(s->tif);
+	s->tif = NULL;
+	if (s->tbuf) xfree(s->tbuf);
+	if (s->tband) xfree(s->tband);
+	s->tbuf = s->tband = NULL;
+#endif//I_CAN_HAS_LIBTIFF
+	if (s->vopen) {
+		for (int i = 0; i < s->nvopen; i++)
+			iio_close(s->vopen[i].s);
+		xfree(s->vopen);
+	}
+	s->vopen = NULL;
+	s->nvopen = 0;
+	if (s->vrt) {
+		vrt_free(s->vrt);
+		xfree(s->vrt);
+	}
+	s->vrt = NULL;
+	if (s->vband) xfree(s->vband);
+	s->vband = NULL;
+	if (s->f) fclose(s->f);
+	s->f = NULL;
+	if (s->row) xfree(s->row);
+	s->row = NULL;
+	if (s->data) {
+#ifdef I_CAN_HAS_MMAP
+		if (!iio_unmap_if_mapped(s->data))
+#endif//I_CAN_HAS_MMAP
+			xfree(s->data);
+	}
+	s->data = NULL;
+}
+
+// record the time spent by an incremental stream (when profiling)
+static void stream_profile(const char *op, const char *fname, int kind,
+		int w, int h, int pd, int type, double seconds)
+{
+	if (!iio_profile_enabled()) return;
+	struct iio_image x[1] = {{ .dimension = 2, .sizes = {w, h},
+		.pixel_dimension = pd, .type = type }};
+	const char *format = kind == IIO_STREAM_PNG ? "PNG" :
+		kind == IIO_STREAM_JPEG ? "JPEG" :
+		kind == IIO_STREAM_VRT ? "VRT" : "TIFF";
+	iio_profile_io_add(op, fname, format, x, seconds);
+}
+
+struct iio_stream *iio_open(const char *fname, int *w, int *h, int *pd)
+{
+	double t = iio_profile_enabled() ? iio_profile_now() : 0;
+	struct iio_stream *s = xmalloc(sizeof*s);
+	memset(s, 0, sizeof*s);
+	s->fname = xmalloc(1 + strlen(fname));
+	strcpy(s->fname, fname);
+
+	if (stream_open_incremental(s)) {
+		stream_release(s);
+		struct iio_image x[1];
+		int r = map_image(x, fname, -1) && read_image(x, fname);
+		if (r) {
+			xfree(s->fname);
+			xfree(s);
+			return rfail("could not open image stream");
+		}
+		s->kind = IIO_STREAM_MEMORY;
+		s->w = x->sizes[0];
+		s->h = x->dimension > 1 ? x->sizes[1] : 1;
+		s->pd = x->pixel_dimension;
+		s->type = x->type;
+		s->data = x->data;
+	} else {
+		s->row = xmalloc(stream_row_size(s));
+		if (iio_profile_enabled())
+			s->seconds = iio_profile_now() - t;
+	}
+	IIO_DEBUG("stream \"%s\" kind %d %dx%d,%d %s\n", fname, s->kind,
+			s->w, s->h, s->pd, iio_strtyp(s->type));
+
+	*w = s->w;
+	*h = s->h;
+	*pd = s->pd;
+	return s;
+}
+
+int iio_read_rows(struct iio_stream *s, float *out, int y0, int nrows)
+{
+	if (y0 < 0 || y0 >= s->h) return 0;
+	if (nrows > s->h - y0) nrows = s->h - y0;
+	bool timed = s->kind != IIO_STREAM_MEMORY && iio_profile_enabled();
+	double t = timed ? iio_profile_now() : 0;
+	int n = s->w * s->pd;
+	for (int j = 0; j < nrows; j++)
+	{
+		char *row = stream_row(s, y0 + j);
+		float *o = out + j * n;
+		if (normalize_type(s->type) == IIO_TYPE_FLOAT)
+			memcpy(o, row, n * sizeof*o);
+		else
+			convert_samples_into(o, row, n, IIO_TYPE_FLOAT,
+					normalize_type(s->type));
+	}
+	if (timed)
+		s->seconds += iio_profile_now() - t;
+	return nrows;
+}
+
+void iio_close(struct iio_stream *s)
+{
+	if (!s) return;
+	if (s->kind != IIO_STREAM_MEMORY)
+		stream_profile("stream", s->fname, s->kind, s->w, s->h, s->pd,
+				s->type, s->seconds);
+	stream_release(s);
+	xfree(s->fname);
+	xfree(s);
+}
+
+
+
 // API (output)                                                             {{{1
 
 //static bool this_float_is_actually_a_byte(float x)
@@ -5761,9 +9346,36 @@ static char *rem_prefix(const char *f)
 // Note:
 // This function was written without being designed.  See file "saving.txt" for
 // an attempt at designing it.
+static void iio_write_image_unprofiled(const char *filename,
+		struct iio_image *x);
+
+// iio_write_image_unprofiled, timed when profiling (only the outermost call)
 static void iio_write_image_default(const char *filename, struct iio_image *x)
 {
+	if (!iio_profile_enabled() || global_profile_thread.depth) {
+		iio_write_image_unprofiled(filename, x);
+		return;
+	}
+	global_profile_thread.depth += 1;
+	global_profile_thread.last = -1;
+	const char *name = std_alias(filename, 1), *dot = strrchr(name, '.');
+	const char *format = mem_prefix(name) ? "MEM" : dot ? dot + 1 : name;
+	double t = iio_profile_now();
+	iio_write_image_unprofiled(filename, x);
+	t = iio_profile_now() - t;
+	global_profile_thread.depth -= 1;
+	iio_profile_io_add("write", filename, format, x, t);
+}
+
+static void iio_write_image_unprofiled(const char *filename,
+		struct iio_image *x)
+{
+	filename = std_alias(filename, 1);
 	IIO_DEBUG("going to write into filename \"%s\"\n", filename);
+	if (mem_prefix(filename)) {
+		mem_put(mem_prefix(filename), x);
+		return;
+	}
 	int typ = normalize_type(x->type);
 	char rem_text[FILENAME_MAX]; //XXX: fails for recursive calls below
 	if (x->dimension != 2) fail("de moment només escrivim 2D");
@@ -5779,6 +9391,14 @@ static void iio_write_image_default(const char *filename, struct iio_image *x)
 					iio_strtyp(x->type));
 		return;
 	}
+#ifdef I_CAN_HAS_SHM
+	char *shm = xgetenv("IIO_SHM");
+	if (!strcmp(filename, "-") && shm && atoi(shm) && stdout_is_a_pipe())
+	{
+		iio_write_image_as_shm(x);
+		return;
+	}
+#endif//I_CAN_HAS_SHM
 	x->rem = xgetenv("IIO_REM");
 	if (rem_prefix(filename)) {
 		char *colon = rem_prefix(filename);
@@ -5837,6 +9457,13 @@ static void iio_write_image_default(const char *filename, struct iio_image *x)
 		iio_write_image_as_txt(filename, x);
 		return;
 	}
+	if (npy_options_suffix(filename) || (xgetenv("IIO_NPY_OPTIONS") &&
+		(string_suffix(filename, ".npy") || string_suffix(filename, ".raw"))))
+	{
+		IIO_DEBUG("npy options detected\n");
+		iio_write_image_as_npy_smarter(filename, x);
+		return;
+	}
 	if (string_suffix(filename, ".raw")) {
 		iio_write_image_as_raw(filename, x);
 		return;
@@ -5900,6 +9527,11 @@ static void iio_write_image_default(const char *filename, struct iio_image *x)
 		}
 	}
 #ifdef I_CAN_HAS_LIBTIFF
+	if (tiff_options_suffix(filename)) {
+		IIO_DEBUG("tiff options detected\n");
+		iio_write_image_as_tiff_smarter(filename, x);
+		return;
+	}
 	if (true) {
 		if (false
 				|| string_suffix(filename, ".tiff")
@@ -5965,6 +9597,7 @@ static void iio_write_image_default(const char *filename, struct iio_image *x)
 		if (false
 				|| string_suffix(filename, ".png")
 				|| string_suffix(filename, ".PNG")
+				|| png_options_suffix(filename)
 			//	|| (typ==IIO_TYPE_UINT8&&x->pixel_dimension==4)
 			//	|| (typ==IIO_TYPE_UINT8&&x->pixel_dimension==2)
 			//	|| (typ==IIO_TYPE_UINT8&&x->pixel_dimension==1)
@@ -6191,9 +9824,166 @@ void iio_write_image_uint16_vec(char *filename, uint16_t *data,
 
 void iio_free(char *p)
 {
+#ifdef I_CAN_HAS_MMAP
+	if (iio_unmap_if_mapped(p))
+		return;
+#endif//I_CAN_HAS_MMAP
 	xfree(p);
 }
 
+
+
+// API (streaming output)                                                   {{{1
+
+// An output stream receives an image by bands of rows.  TIFF files are
+// written by rows of tiles as soon as they are complete, so that only one row
+// of tiles is kept in memory.  Other images are gathered and written whole
+// when the stream is closed.
+struct iio_ostream {
+	int w, h, pd;
+	int next_row;        // index of the next row to be written
+	char *fname;
+	float *data;         // whole image (non-tiff files)
+	double seconds;      // time spent encoding (when profiling)
+#ifdef I_CAN_HAS_LIBTIFF
+	TIFF *tif;
+	struct tiff_write_options o[1];
+	float *tband;        // current row of tiles
+#endif//I_CAN_HAS_LIBTIFF
+};
+
+#ifdef I_CAN_HAS_LIBTIFF
+static bool ostream_tiff_start(struct iio_ostream *s)
+{
+	char *f = s->fname;
+	if (!tiff_options_suffix(f) && strstr(f, "TIFF:") != f
+			&& !string_suffix(f, ".tif") && !string_suffix(f, ".tiff")
+			&& !string_suffix(f, ".TIF") && !string_suffix(f, ".TIFF"))
+		return false;
+	if (strstr(f, "TIFF:") == f) f += 5;
+
+	*s->o = (struct tiff_write_options){
+		.tile = 0, .compression = -1, .predictor = 0, .level = 0,
+		.threads = iio_threads() };
+	char *env = xgetenv("IIO_TIFF_OPTIONS");
+	if (env) tiff_parse_write_options(s->o, env);
+	char *suffix = tiff_options_suffix(f);
+	char fname[strlen(f) + 1];
+	strcpy(fname, f);
+	if (suffix) {
+		tiff_parse_write_options(s->o, suffix + 1);
+		fname[suffix - f] = '\0';
+	}
+	if (!s->o->tile) s->o->tile = 256;
+
+	s->tif = TIFFOpen(fname, "w8");
+	if (!s->tif) fail("could not open TIFF file \"%s\"", fname);
+	struct iio_image x[1];
+	iio_image_init2d(x, s->w, s->h, s->pd, IIO_TYPE_FLOAT);
+	tiff_set_fields(s->tif, x, s->w, s->h, s->o);
+
+	// the bands of tiles must be encoded like the whole image
+	uint16_t compression;
+	TIFFGetField(s->tif, TIFFTAG_COMPRESSION, &compression);
+	s->o->compression = compression;
+
+	s->tband = xmalloc(s->w * (size_t)s->o->tile * s->pd * sizeof(float));
+	return true;
+}
+
+// write the first "n" rows of the current row of tiles
+static void ostream_tiff_band(struct iio_ostream *s, int n)
+{
+	int t = s->o->tile;
+	struct iio_image x[1];
+	iio_image_init2d(x, s->w, n, s->pd, IIO_TYPE_FLOAT);
+	x->data = s->tband;
+	int ntx = (s->w + t - 1) / t;
+	tiff_write_tiles(s->tif, x, s->o, ntx * ((s->next_row - 1) / t));
+}
+#endif//I_CAN_HAS_LIBTIFF
+
+struct iio_ostream *iio_create(const char *fname, int w, int h, int pd)
+{
+	struct iio_ostream *s = xmalloc(sizeof*s);
+	memset(s, 0, sizeof*s);
+	s->w = w;
+	s->h = h;
+	s->pd = pd;
+	s->fname = xmalloc(1 + strlen(fname));
+	strcpy(s->fname, fname);
+#ifdef I_CAN_HAS_LIBTIFF
+	if (ostream_tiff_start(s)) {
+		IIO_DEBUG("ostream \"%s\" %dx%d,%d tiles of %d\n", fname,
+				w, h, pd, s->o->tile);
+		return s;
+	}
+#endif//I_CAN_HAS_LIBTIFF
+	s->data = xmalloc(w * (size_t)h * pd * sizeof*s->data);
+	return s;
+}
+
+int iio_write_rows(struct iio_ostream *s, float *in, int nrows)
+{
+	if (nrows > s->h - s->next_row) nrows = s->h - s->next_row;
+	size_t n = s->w * (size_t)s->pd;
+#ifdef I_CAN_HAS_LIBTIFF
+	if (s->tif) {
+		double t0 = iio_profile_enabled() ? iio_profile_now() : 0;
+		int t = s->o->tile;
+		for (int j = 0; j < nrows; j++)
+		{
+			int y = s->next_row++;
+			memcpy(s->tband + (y % t) * n, in + j * n,
+					n * sizeof*in);
+			if (y % t == t - 1 || y == s->h - 1)
+				ostream_tiff_band(s, y % t + 1);
+		}
+		if (iio_profile_enabled())
+			s->seconds += iio_profile_now() - t0;
+		return nrows;
+	}
+#endif//I_CAN_HAS_LIBTIFF
+	memcpy(s->data + s->next_row * n, in, nrows * n * sizeof*in);
+	s->next_row += nrows;
+	return nrows;
+}
+
+void iio_finish(struct iio_ostream *s)
+{
+	if (!s) return;
+	size_t n = s->w * (size_t)s->pd;
+#ifdef I_CAN_HAS_LIBTIFF
+	if (s->tif) {
+		if (s->next_row < s->h) { // fill the missing rows with zeros
+			float *zero = xmalloc(n * sizeof*zero);
+			for (size_t i = 0; i < n; i++) zero[i] = 0;
+			while (s->next_row < s->h)
+				iio_write_rows(s, zero, 1);
+			xfree(zero);
+		}
+		double t = iio_profile_enabled() ? iio_profile_now() : 0;
+		TIFFClose(s->tif);
+		xfree(s->tband);
+		if (iio_profile_enabled())
+			stream_profile("stream-write", s->fname, IIO_STREAM_TIFF,
+					s->w, s->h, s->pd, IIO_TYPE_FLOAT,
+					s->seconds + iio_profile_now() - t);
+	} else
+#endif//I_CAN_HAS_LIBTIFF
+	{
+		if (s->next_row < s->h)
+			memset(s->data + s->next_row * n, 0,
+				(s->h - s->next_row) * n * sizeof*s->data);
+		iio_write_image_float_vec(s->fname, s->data, s->w, s->h, s->pd);
+		xfree(s->data);
+	}
+	xfree(s->fname);
+	xfree(s);
+}
+
+
+
 // API (deprecated)                                                         {{{1
 #ifdef IIO_USE_INCONSISTENT_NAMES
 // code below generated by an ugly sed script
@@ -42,6 +42,38 @@ float *iio_read_image_float_rgb(const char *fname, int *w, int *h);
 float *iio_read_image_float_split(const char *fname, int *w, int *h, int *pd);
 // x[w*h*l + i + j*w]
 
+float *iio_read_image_float_vec_roi(const char *fname,
+		int x0, int y0, int xf, int yf, int *w, int *h, int *pd);
+// read the window [x0,xf) x [y0,yf) of the image, clipped to its domain
+// (non-positive xf, yf count from the right and bottom; tiff files only
+// decode the tiles or strips that intersect the window, and vrt mosaics only
+// open the sources that intersect it, reading them in parallel)
+// x[(i + j*w)*pd + l], where w and h are the size of the window
+
+float *iio_read_image_float_vec_scaled(const char *fname, int *n,
+		int *w, int *h, int *pd);
+// read the image zoomed-out by a factor that divides *n, if its format allows
+// to decode it at a reduced size (jpeg files, by factors of 2, 4 or 8), and
+// set *n to the factor that was applied (1 for the other formats)
+// x[(i + j*w)*pd + l]
+
+int iio_read_image_info(const char *fname, int *w, int *h, int *pd,
+		const char **type);
+// get the size and sample type (e.g. "UINT8", "FLOAT") of an image, parsing
+// only the header of png, tiff, jpeg, npy, pfm, rim, vrt and raw files
+// (other files are decoded whole); returns 0 on success
+
+//
+// band selection
+//
+// In all the reading functions, a filename suffix like "img.tif,bands=3,5,9"
+// or "img.tif,bands=10-20" keeps only these bands of the image, in the given
+// order.  The bands are counted from 0 (the first band is "bands=0").  The planes of the other bands are skipped in planar tiff files,
+// fortran-ordered npy files and planar raw files ("RAW[...,b1]:"), while npy
+// and raw files with interleaved pixels keep only the selected samples while
+// reading.  Other images are read whole and the bands extracted afterwards.
+//
+
 //
 // convenience float API for 2D images (also returns a freeable pointer)
 //
@@ -137,6 +169,102 @@ void *iio_read_nd_image_as_desired(char *fname,
 
 
 
+//
+// memory-mapped API (returns a pointer that must be released by "iio_free")
+//
+// For uncompressed files (raw, npy, pfm, rim) whose samples are stored
+// natively with the requested type, the returned pointer points inside a
+// private mapping of the file, and no data is copied.  The mapping is
+// writable, and modifications are not written back to the file.  Other files
+// are read normally.
+//
+// If the environment variable IIO_MMAP=1 is set, the "_vec" functions above
+// and "iio_read_nd_image_as_desired" behave in the same way.  In that case,
+// all the returned pointers must also be released by "iio_free".
+//
+// If the environment variable IIO_CACHE_DIR is set, the images decoded by
+// these functions are kept in that directory as npy files, and later reads
+// of the same (unmodified) files are served from there without decoding.
+//
+float *iio_map_image_float_vec(const char *fname, int *w, int *h, int *pd);
+double *iio_map_image_double_vec(const char *fname, int *w, int *h, int *pd);
+#ifdef UINT8_MAX
+uint8_t *iio_map_image_uint8_vec(const char *fname, int *w, int *h, int *pd);
+#endif//UINT8_MAX
+#ifdef UINT16_MAX
+uint16_t *iio_map_image_uint16_vec(const char *fname, int *w, int *h, int *pd);
+#endif//UINT16_MAX
+
+
+
+
+//
+// streaming API (reads bands of rows without loading the whole image)
+//
+// PNG, JPEG and TIFF files are decoded incrementally, and uncompressed files
+// are mapped.  VRT mosaics are read by bands of rows, opening each source
+// when the band first needs it and keeping at most IIO_VRT_MAXOPEN (64) of
+// them open.  Other images are read whole when the stream is opened.
+// The rows y0..y0+nrows-1 are stored into "out" as in "_float_vec", and the
+// number of rows actually read is returned.  Reading the rows in increasing
+// order is fastest; going back restarts the decoding of PNG and JPEG files.
+//
+struct iio_stream;
+struct iio_stream *iio_open(const char *fname, int *w, int *h, int *pd);
+int iio_read_rows(struct iio_stream *s, float *out, int y0, int nrows);
+void iio_close(struct iio_stream *s);
+
+//
+// streaming output API (writes bands of rows without the whole image)
+//
+// The rows are given in increasing order, starting at the first row.  TIFF
+// files are written as tiled TIFF (tiles of 256x256 by default, see
+// IIO_TIFF_OPTIONS) while the rows are received.  Other images are gathered
+// in memory and written by "iio_finish".  The missing rows are set to zero.
+//
+struct iio_ostream;
+struct iio_ostream *iio_create(const char *fname, int w, int h, int pd);
+int iio_write_rows(struct iio_ostream *s, float *in, int nrows);
+void iio_finish(struct iio_ostream *s);
+
+//
+// memory images (to pass images between threads of the same process)
+//
+// The images named "MEM:name" are stored in memory when written, and taken
+// out when read; a reader waits until the image is written.  The function
+// "iio_set_std_names" makes "-" stand for the given names (in the calling
+// thread only), e.g., iio_set_std_names("MEM:a", "MEM:b").  NULL is "-".
+//
+void iio_set_std_names(const char *in, const char *out);
+
+//
+// profiling (enabled by the environment variable IMSCRIPT_PROFILE)
+//
+// The images read and written are timed, and "iio_profile_add" accumulates
+// the time of a named scope of the program.  At exit, a summary of all the
+// times is printed into stderr as a single line of JSON.  (See "profile.c"
+// for a convenient macro around "iio_profile_add".)
+//
+int iio_profile_enabled(void);
+double iio_profile_now(void);
+void iio_profile_add(const char *name, double seconds);
+
+//
+// flips, transposes and rotations by multiples of 90 degrees (group D8)
+//
+// The image x of w*h pixels of "ps" bytes each is copied into y, transformed
+// by "op": "identity", "leftright", "topdown", "transpose", "posetrans",
+// "r90", "r180", "r270", or a pair of letters as in the option "flip" of
+// the TRANS[] prefix (e.g., "Xy" flips left-right, "yx" transposes).  The
+// new size is stored into *W and *H.  The result is -1 if "op" is unknown.
+// The copy is done by blocks, with IIO_THREADS threads.
+//
+int iio_flip(void *y, int *W, int *H, void *x, int w, int h, int ps,
+		const char *op);
+
+
+
+
 #ifdef UINT8_MAX
 
 // basic byte API (returns a freeable pointer)
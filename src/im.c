@@ -1,10 +1,172 @@
+#include <stdio.h>
 #include <string.h>
-int main(int c, char *v[])
+#include <pthread.h>
+#include "iio.h"
+
+typedef int (*main_t)(int, char **);
+
+// the main function of the tool called "name", or NULL
+static main_t main_of(char *name)
 {
 #define MAIN(x) int main_ ## x(int, char**);\
-	if (c>1 && !strcmp(v[1], #x)) return main_ ## x(c-1, v+1)
+	if (!strcmp(name, #x)) return main_ ## x
 #include "all_mains.inc"
 #include "ftr/all_mains.inc"
 //#include "misc/all_mains.inc"
-	return 1;
+	return NULL;
+}
+
+// pipelines of tools inside this process
+//
+// 	im pipe 'blur g 2 | plambda "x 3 *" | qauto'
+// 	im pipe blur g 2 '|' plambda 'x 3 *' '|' qauto
+//
+// The stages are run on their own threads, and the images are passed
+// between them through memory (the standard output of each stage and the
+// standard input of the next are the same "MEM:" image of iio), so there is
+// no encoding or decoding.  A stage starts while the previous ones are still
+// running, and waits for their images when it reads them.  The state of the
+// tools is global, so when a tool appears twice its second stage waits for
+// the first one to finish.
+
+#define PIPE_MAX_STAGES 100
+#define PIPE_MAX_ARGS 1000
+#define PIPE_STACK_SIZE (64*1024*1024)
+
+struct pipe_stage {
+	main_t f;
+	int argc;
+	char **argv;
+	char in[40], out[40];
+	pthread_t thread;
+	int started, joined, r;
+};
+
+static void *pipe_stage_run(void *e)
+{
+	struct pipe_stage *s = e;
+	iio_set_std_names(*s->in ? s->in : NULL, *s->out ? s->out : NULL);
+	s->r = s->f(s->argc, s->argv);
+	return NULL;
+}
+
+// split the string s into words, like a shell, and "|" into separate words
+// (the words are written into s itself, the returned pointers point into s)
+static int pipe_split(char **w, int n, char *s)
+{
+	int k = 0;
+	char *o = s;
+	while (*s)
+	{
+		while (*s == ' ' || *s == '\t' || *s == '\n') s++;
+		if (!*s) break;
+		if (k >= n) return -1;
+		if (*s == '|') {
+			w[k++] = "|";
+			s++;
+			continue;
+		}
+		w[k++] = o;
+		while (*s && *s != ' ' && *s != '\t' && *s != '\n' && *s != '|')
+			if (*s == '\'' || *s == '"') {
+				char q = *s++;
+				while (*s && *s != q) *o++ = *s++;
+				if (*s) s++;
+			} else
+				*o++ = *s++;
+		char t = *s; // what ends the word (the "\0" may overwrite it)
+		*o++ = '\0';
+		if (!t) break;
+		s++;
+		if (t == '|') {
+			if (k >= n) return -1;
+			w[k++] = "|";
+		}
+	}
+	return k;
+}
+
+static int main_pipe(int c, char *v[])
+{
+	// words of the pipeline (a single argument is split like a shell)
+	char *w[PIPE_MAX_ARGS + 1];
+	int n = c - 1;
+	if (c == 2)
+		n = pipe_split(w, PIPE_MAX_ARGS, v[1]);
+	else if (n <= PIPE_MAX_ARGS)
+		memcpy(w, v + 1, n * sizeof*w);
+	else
+		n = -1;
+	if (n < 0) {
+		fprintf(stderr, "pipe: too many words\n");
+		return 1;
+	}
+
+	// stages
+	struct pipe_stage s[PIPE_MAX_STAGES];
+	int ns = 0;
+	for (int i = 0; i <= n; i++)
+	{
+		int j = i;
+		while (j < n && strcmp(w[j], "|")) j++;
+		if (j == i || ns == PIPE_MAX_STAGES) {
+			fprintf(stderr, "pipe: bad pipeline\n");
+			return 1;
+		}
+		struct pipe_stage *t = s + ns;
+		t->f = main_of(w[i]);
+		if (!t->f) {
+			fprintf(stderr, "pipe: unknown tool \"%s\"\n", w[i]);
+			return 1;
+		}
+		t->argc = j - i;
+		t->argv = w + i;
+		t->started = t->joined = t->r = 0;
+		ns += 1;
+		i = j;
+	}
+	for (int i = 0; i < ns; i++)
+	{
+		s[i].argv[s[i].argc] = NULL; // overwrites the "|"
+		*s[i].in = *s[i].out = '\0';
+		if (i > 0)
+			snprintf(s[i].in, sizeof s[i].in, "MEM:pipe-%d", i);
+		if (i < ns - 1)
+			snprintf(s[i].out, sizeof s[i].out, "MEM:pipe-%d", i+1);
+	}
+
+	// run them
+	pthread_attr_t a;
+	pthread_attr_init(&a);
+	pthread_attr_setstacksize(&a, PIPE_STACK_SIZE);
+	int r = 0;
+	for (int i = 0; i < ns; i++)
+	{
+		for (int j = 0; j < i; j++)
+			if (s[j].f == s[i].f && s[j].started && !s[j].joined) {
+				pthread_join(s[j].thread, NULL);
+				s[j].joined = 1;
+			}
+		if (pthread_create(&s[i].thread, &a, pipe_stage_run, s + i)) {
+			fprintf(stderr, "pipe: could not create a thread\n");
+			return 1;
+		}
+		s[i].started = 1;
+	}
+	for (int i = 0; i < ns; i++)
+	{
+		if (!s[i].joined)
+			pthread_join(s[i].thread, NULL);
+		if (s[i].r) r = s[i].r;
+	}
+	pthread_attr_destroy(&a);
+	return r;
+}
+
+int main(int c, char *v[])
+{
+	if (c > 2 && !strcmp(v[1], "pipe"))
+		return main_pipe(c - 1, v + 1);
+	main_t f = c > 1 ? main_of(v[1]) : NULL;
+	return f ? f(c - 1, v + 1) : 1;
 }
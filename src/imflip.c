@@ -1,93 +1,48 @@
-// all the flipping functions below have the same signature
-
-static void flip_leftright(
-		float *X,    // output image data
-		int *WH,     // output image (width,height) in (WH[0],WH[1])
-		float *x,    // input image data
-		int w,       // input image width
-		int h        // input image height
-		)
-{
-	int W = WH[0] = w;
-	int H = WH[1] = h;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[j*w + w - 1 - i];
-}
-
-static void flip_topdown(float *X, int *WH, float *x, int w, int h)
-{
-	int W = WH[0] = w;
-	int H = WH[1] = h;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[(h-1-j)*w + i];
-}
-
-static void flip_transpose(float *X, int *WH, float *x, int w, int h)
+// the flips are those of the group D8, done by "iio_flip" (see iio.h)
+
+#include <string.h>
+
+// names of the operations, and their names for "iio_flip"
+static const char *flip_names[][2] = {
+	{"1",         "identity"},
+	{"identity",  "identity"},
+	{"x",         "leftright"},
+	{"y",         "topdown"},
+	{"r",         "r90"},
+	{"rr",        "r180"},
+	{"rrr",       "r270"},
+	{"t",         "transpose"},
+	{"z",         "posetrans"},
+	{"leftright", "leftright"},
+	{"rightleft", "leftright"},
+	{"lr",        "leftright"},
+	{"rl",        "leftright"},
+	{"topdown",   "topdown"},
+	{"topbottom", "topdown"},
+	{"bottomup",  "topdown"},
+	{"updown",    "topdown"},
+	{"ud",        "topdown"},
+	{"td",        "topdown"},
+	{"tb",        "topdown"},
+	{"bu",        "topdown"},
+	{"transpose", "transpose"},
+	{"trans",     "transpose"},
+	{"posetrans", "posetrans"},
+	{"r90",       "r90"},
+	{"r-90",      "r270"},
+	{"rm90",      "r270"},
+	{"r270",      "r270"},
+	{"r180",      "r180"},
+};
+
+static const char *flip_name(const char *op)
 {
-	int W = WH[0] = h;
-	int H = WH[1] = w;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[i*w+j];
+	for (unsigned i = 0; i < sizeof flip_names / sizeof*flip_names; i++)
+		if (!strcmp(op, flip_names[i][0]))
+			return flip_names[i][1];
+	return NULL;
 }
 
-static void flip_r90(float *X, int *WH, float *x, int w, int h)
-{
-	int W = WH[0] = h;
-	int H = WH[1] = w;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[i*w+(w-1-j)];
-}
-
-static void flip_r270(float *X, int *WH, float *x, int w, int h)
-{
-	int W = WH[0] = h;
-	int H = WH[1] = w;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[(h-1-i)*w+j];
-}
-
-static void flip_r180(float *X, int *WH, float *x, int w, int h)
-{
-	int W = WH[0] = w;
-	int H = WH[1] = h;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[(h-1-j)*w+(w-1-i)];
-}
-
-static void flip_posetrans(float *X, int *WH, float *x, int w, int h)
-{
-	int W = WH[0] = h;
-	int H = WH[1] = w;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[(h-1-i)*w+(w-1-j)];
-}
-
-static void flip_identity(float *X, int *WH, float *x, int w, int h)
-{
-	int W = WH[0] = w;
-	int H = WH[1] = h;
-
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
-		X[j*W+i] = x[j*w + i];
-}
-
-// note: all 8 elements of the D8 are covered now
-
 
 static char *help_string_name     = "imflip";
 static char *help_string_version  = "imflip 1.0\n\nWritten by eml";
@@ -138,49 +93,24 @@ int main_imflip(int c, char *v[])
 	char *filename_in = c > 2 ? v[2] : "-";
 	char *filename_out = c > 3 ? v[3] : "-";
 
+	const char *name = flip_name(op);
+	if (!name) {
+		fprintf(stderr, "imflip: unknown operation \"%s\"\n", op);
+		return 1;
+	}
+
 	// read input image and alloc space for output image
 	int w, h, pd, wh[2] = {0, 0};
-	float *x = iio_read_image_float_split(filename_in, &w, &h, &pd);
+	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
 	float *y = malloc(w*h*pd*sizeof*y);
 
-	// flip each channel as requested
-	for (int l = 0; l < pd; l++)
-	{
-		float *X = x + l*w*h;
-		float *Y = y + l*w*h;
-		if (!strcmp(op, "1"))         flip_identity(Y, wh, X, w, h);
-		if (!strcmp(op, "identity"))  flip_identity(Y, wh, X, w, h);
-		if (!strcmp(op, "x"))         flip_leftright(Y, wh, X, w, h);
-		if (!strcmp(op, "y"))         flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "r"))         flip_r90      (Y, wh, X, w, h);
-		if (!strcmp(op, "rr"))        flip_r180     (Y, wh, X, w, h);
-		if (!strcmp(op, "rrr"))       flip_r270     (Y, wh, X, w, h);
-		if (!strcmp(op, "t"))         flip_transpose(Y, wh, X, w, h);
-		if (!strcmp(op, "z"))         flip_posetrans(Y, wh, X, w, h);
-		if (!strcmp(op, "leftright")) flip_leftright(Y, wh, X, w, h);
-		if (!strcmp(op, "rightleft")) flip_leftright(Y, wh, X, w, h);
-		if (!strcmp(op, "lr"))        flip_leftright(Y, wh, X, w, h);
-		if (!strcmp(op, "rl"))        flip_leftright(Y, wh, X, w, h);
-		if (!strcmp(op, "topdown"))   flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "topbottom")) flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "bottomup"))  flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "updown"))    flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "ud"))        flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "td"))        flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "tb"))        flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "bu"))        flip_topdown  (Y, wh, X, w, h);
-		if (!strcmp(op, "transpose")) flip_transpose(Y, wh, X, w, h);
-		if (!strcmp(op, "trans"))     flip_transpose(Y, wh, X, w, h);
-		if (!strcmp(op, "posetrans")) flip_posetrans(Y, wh, X, w, h);
-		if (!strcmp(op, "r90"))       flip_r90      (Y, wh, X, w, h);
-		if (!strcmp(op, "r-90"))      flip_r270     (Y, wh, X, w, h);
-		if (!strcmp(op, "rm90"))      flip_r270     (Y, wh, X, w, h);
-		if (!strcmp(op, "r270"))      flip_r270     (Y, wh, X, w, h);
-		if (!strcmp(op, "r180"))      flip_r180     (Y, wh, X, w, h);
-	}
+	// flip all the channels at once
+	iio_flip(y, wh, wh+1, x, w, h, pd*sizeof*x, name);
 
 	// save and exit
-	iio_write_image_float_split(filename_out, y, wh[0], wh[1], pd);
+	iio_write_image_float_vec(filename_out, y, wh[0], wh[1], pd);
+	free(x);
+	free(y);
 	return 0;
 }
 
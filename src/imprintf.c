@@ -54,6 +54,13 @@
 #include "iio.h"
 
 #define xmalloc malloc
+#include "fail.c"
+#include "smapa.h"
+#include "streamstats.c"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifdef IIO_MAX_DIMENSION
 # define MAX_PIXELDIM IIO_MAX_DIMENSION
@@ -91,6 +98,7 @@ struct printable_data {
 	struct conversion_specifier_and_its_data *t;
 
 	float *sorted_samples; int nsorted_samples;
+	struct streamstats_sketch *sketch; // instead of sorted_samples
 	float *sorted_vectors; // by comparing their norm
 	float *sorted_colors;  // by comparing their samples
 	float *squared_samples;
@@ -364,7 +372,7 @@ static void compute_stuff_sorts(struct printable_data *p,
 	p->sorted_samples = xmalloc(ns * sizeof*p->sorted_samples);
 	for (int i = 0; i < ns; i++)
 		if (!isnan(x[i])) {
-			p->sorted_samples[i] = x[i];
+			p->sorted_samples[ns0] = x[i];
 			ns0 += 1;
 		}
 	p->nsorted_samples = ns0;
@@ -439,6 +447,171 @@ static void compute_printable_data(struct printable_data *p,
 	if (REQ_SQUARES & p->compuflag) compute_stuff_squares(p, x, w, h, pd);
 }
 
+// streaming computation {{{1
+//
+// When the format needs neither the positions of the samples nor the
+// numbers of different values, the image is not loaded: its bands of rows
+// are read (see "iio_open") and summarized by the accumulators of
+// streamstats.c.  The percentiles and the median are then given by a
+// sketch, which is exact while the image has fewer than IMPRINTF_SKETCH
+// samples.  The rows of each band are summarized in parallel, and merged in
+// order.
+
+SMART_PARAMETER_SILENT(IMPRINTF_SKETCH,1048576)
+SMART_PARAMETER_SILENT(IMPRINTF_BAND_MB,64)
+
+// the conversions that need the whole image
+static bool format_needs_image(struct printable_data *p)
+{
+	char *whole = "pPkKMQ";
+	for (int i = 0; p->t[i].name; i++)
+		if (p->t[i].selected && strchr(whole, *p->t[i].shortname))
+			return true;
+	return false;
+}
+
+// extreme pixels (by their norm), and sums of pixels
+struct imprintf_pixels {
+	long n;
+	float min, max;
+	float vmin[MAX_PIXELDIM], vmax[MAX_PIXELDIM];
+	long double sum[MAX_PIXELDIM], sumnorm;
+};
+
+static void imprintf_pixels_init(struct imprintf_pixels *a, int pd)
+{
+	a->n = 0;
+	a->min = INFINITY;
+	a->max = -INFINITY;
+	a->sumnorm = 0;
+	for (int l = 0; l < pd; l++)
+	{
+		a->vmin[l] = a->vmax[l] = NAN;
+		a->sum[l] = 0;
+	}
+}
+
+static void imprintf_pixels_add(struct imprintf_pixels *a, float *x,
+		int n, int pd)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float *v = x + i*pd;
+		float xnorm = vnormf(v, pd);
+		if (isnan(xnorm)) continue;
+		if (xnorm < a->min) { a->min = xnorm; memcpy(a->vmin,v,pd*4); }
+		if (xnorm > a->max) { a->max = xnorm; memcpy(a->vmax,v,pd*4); }
+		for (int l = 0; l < pd; l++)
+			a->sum[l] += v[l];
+		a->sumnorm += xnorm;
+		a->n += 1;
+	}
+}
+
+// a += b (where b comes after a, so that the first extreme pixel is kept)
+static void imprintf_pixels_merge(struct imprintf_pixels *a,
+		struct imprintf_pixels *b, int pd)
+{
+	if (b->min < a->min) { a->min = b->min; memcpy(a->vmin,b->vmin,pd*4); }
+	if (b->max > a->max) { a->max = b->max; memcpy(a->vmax,b->vmax,pd*4); }
+	for (int l = 0; l < pd; l++)
+		a->sum[l] += b->sum[l];
+	a->sumnorm += b->sumnorm;
+	a->n += b->n;
+}
+
+static void compute_printable_data_stream(struct printable_data *p,
+		struct iio_stream *s, int w, int h, int pd)
+{
+	p->x = NULL; p->w = w; p->h = h; p->pd = pd;
+	p->compuflag = 0;
+	for (int i = 0; p->t[i].name; i++)
+		if (p->t[i].selected)
+			p->compuflag |= p->t[i].required_precomputation;
+	compute_stuff_nothing(p, NULL, w, h, pd);
+
+	struct streamstats_moments m[1];
+	struct imprintf_pixels a[1];
+	streamstats_moments_init(m);
+	imprintf_pixels_init(a, pd);
+	if (REQ_SORTS & p->compuflag) {
+		p->sketch = xmalloc(sizeof*p->sketch);
+		streamstats_sketch_init(p->sketch, IMPRINTF_SKETCH());
+	}
+
+	int band = streamstats_band_height(IMPRINTF_BAND_MB(), w, h, pd);
+	float *x = xmalloc(w * (size_t)band * pd * sizeof*x);
+	struct streamstats_moments *mr = xmalloc(band * sizeof*mr);
+	struct imprintf_pixels *ar = xmalloc(band * sizeof*ar);
+	float fsum = 0, ks = 0, kc = 0;
+	for (int j = 0; j < h; j += band)
+	{
+		int r = j + band < h ? band : h - j;
+		if (r != iio_read_rows(s, x, j, r))
+			fail("imprintf: could not read rows %d..%d", j, j+r-1);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int i = 0; i < r; i++)
+		{
+			float *xi = x + i * (size_t)w * pd;
+			streamstats_moments_init(mr + i);
+			streamstats_moments_add(mr + i, xi, w * (long)pd);
+			imprintf_pixels_init(ar + i, pd);
+			imprintf_pixels_add(ar + i, xi, w, pd);
+		}
+		for (int i = 0; i < r; i++)
+		{
+			streamstats_moments_merge(m, mr + i);
+			imprintf_pixels_merge(a, ar + i, pd);
+		}
+		if (p->sketch)
+			streamstats_sketch_add(p->sketch, x, r * (long)w * pd);
+
+		// the float sums of "%s" and "%+" are sequential
+		for (long i = 0; i < r * (long)w * pd; i++)
+			if (!isnan(x[i])) {
+				fsum += x[i];
+				if (isfinite(x[i])) {
+					float y = x[i] - kc;
+					float t = ks + y;
+					kc = (t - ks) - y;
+					ks = t;
+				}
+			}
+	}
+	free(x);
+	free(mr);
+	free(ar);
+
+	setnumber(p, "minsample", m->min);
+	setnumber(p, "maxsample", m->max);
+	setnumber(p, "avgsample", m->sum / m->n);
+	setnumber(p, "avgnzsample", m->sum / (m->n - m->nzero));
+	setnumber(p, "sumsamples", fsum);
+	setnumber(p, "kahsamples", ks);
+	setnumber(p, "nnan", m->nnan);
+	setnumber(p, "ninf", m->ninf);
+	setnumber(p, "rms", sqrtl(m->sum2 / m->n));
+
+	long double mipi[pd], mapi[pd], avgpixel[pd];
+	for (int l = 0; l < pd; l++)
+	{
+		mipi[l] = a->vmin[l];
+		mapi[l] = a->vmax[l];
+		avgpixel[l] = a->sum[l] / a->n;
+	}
+	setnumbers(p, "sumpixels", a->sum, pd);
+	setnumbers(p, "minpixel", mipi, pd);
+	setnumbers(p, "maxpixel", mapi, pd);
+	setnumbers(p, "avgpixel", avgpixel, pd);
+	setnumber(p, "error", a->sumnorm / a->n);
+
+	if (p->sketch)
+		setnumber(p, "medsample",
+			streamstats_sketch_rank(p->sketch, p->sketch->count/2));
+}
+
 static void print_scalar(FILE *f, struct printable_data *p, double x)
 {
 	fprintf(f, p->numberformat, x);
@@ -498,15 +671,17 @@ static void print_parametric_datum(FILE *f, struct printable_data *p, int idx,
 		int q = ((int)argv[0])%101;
 		assert(q >= 0);
 		assert(q <= 100);
-		int ns0 = p->nsorted_samples;
+		long ns0 = p->sketch ? p->sketch->count : p->nsorted_samples;
 		if (!ns0) {
 			print_scalar(f, p, NAN);
 		} else {
 			float factor = ns0 - 1;
-			int pq = (factor * q)/100;
+			long pq = (factor * q)/100;
 			assert(pq >= 0);
 			assert(pq < ns0);
-			print_scalar(f, p, p->sorted_samples[pq]);
+			print_scalar(f, p, p->sketch ?
+					streamstats_sketch_rank(p->sketch, pq)
+					: p->sorted_samples[pq]);
 		}
 	} else if (0 == strcmp("Percentile", p->t[idx].name)) {
 		exit(fprintf(stderr, "ERROR: Percentile not implemented\n"));
@@ -681,7 +856,9 @@ static char *preprocess_arrobas(char *fmt)
 	}
 }
 
-static void imprintf_2d(FILE *f, char *fmt, float *x, int w, int h, int pd)
+// (the samples are given either in x, or by the stream s, or not at all)
+static void imprintf_2d(FILE *f, char *fmt, float *x, struct iio_stream *s,
+		int w, int h, int pd)
 {
 	struct printable_data p[1] = {{
 		.t = (struct conversion_specifier_and_its_data []){
@@ -720,6 +897,7 @@ static void imprintf_2d(FILE *f, char *fmt, float *x, int w, int h, int pd)
 //			{"l2norm",     "2", REQ_SQUARES, 1, {0}, 0, {0}, false},
 			{NULL, NULL, 0, 0, {0}, 0, {0}, false} },
 		.sorted_samples = NULL,
+		.sketch = NULL,
 		.sorted_vectors = NULL,
 		.sorted_colors = NULL,
 		.squared_samples = NULL,
@@ -732,8 +910,23 @@ static void imprintf_2d(FILE *f, char *fmt, float *x, int w, int h, int pd)
 	}};
 
 	config_printable_data(p, preprocess_arrobas(fmt));
-	compute_printable_data(p, x, w, h, pd);
+	bool whole = s && format_needs_image(p);
+	if (whole) {
+		x = xmalloc(w * (size_t)h * pd * sizeof*x);
+		if (h != iio_read_rows(s, x, 0, h))
+			fail("imprintf: could not read the image");
+	}
+	if (s && !whole)
+		compute_printable_data_stream(p, s, w, h, pd);
+	else
+		compute_printable_data(p, x, w, h, pd);
 	print_printable_data(f, p);
+	if (whole)
+		free(x);
+	if (p->sketch) {
+		streamstats_sketch_free(p->sketch);
+		free(p->sketch);
+	}
 }
 
 
@@ -784,6 +977,12 @@ static char *help_string_long     =
 " @5         \"%wx%h[%k] %c[%K]\\n\"\n"
 " @9         \"(everything)\\n\"\n"
 "\n"
+"Large images:\n"
+" Unless the format uses %p %P %k %K %M or %Q, the image is read by bands\n"
+" of rows and never loaded whole.  The median and the percentiles are then\n"
+" exact up to IMPRINTF_SKETCH samples (default 1048576), and approximate\n"
+" after.  IMPRINTF_BAND_MB is the memory of a band (default 64).\n"
+"\n"
 "Examples:\n"
 " imprintf \"%w %h\\n\" a.png                    print the image dimensions\n"
 " imprintf \"width=%w heigth=%h\\n\" a.png       use a fancier format string\n"
@@ -793,6 +992,16 @@ static char *help_string_long     =
 ;
 #include "help_stuff.c" // functions that print the strings named above
 
+// whether the format string needs the values of the samples
+static bool format_needs_samples(char *fmt)
+{
+	char *size_only = "whdcnND"; // conversions of "compute_stuff_nothing"
+	for (char *s = preprocess_arrobas(fmt); *s; s++)
+		if (*s == '%' && (!s[1] || !strchr(size_only, *++s)))
+			return true;
+	return false;
+}
+
 int main_imprintf(int c, char *v[])
 {
 	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
@@ -805,8 +1014,17 @@ int main_imprintf(int c, char *v[])
 	char *format = v[1];
 	char *finame = c > 2 ? v[2] : "-";
 	int w, h, pd;
-	float *x = iio_read_image_float_vec(finame, &w, &h, &pd);
-	imprintf_2d(stdout, format, x, w, h, pd);
+	if (!format_needs_samples(format)
+			&& !iio_read_image_info(finame, &w, &h, &pd, NULL))
+	{
+		imprintf_2d(stdout, format, NULL, NULL, w, h, pd);
+		return EXIT_SUCCESS;
+	}
+	struct iio_stream *s = iio_open(finame, &w, &h, &pd);
+	if (!s)
+		fail("imprintf: could not open image \"%s\"", finame);
+	imprintf_2d(stdout, format, NULL, s, w, h, pd);
+	iio_close(s);
 	return EXIT_SUCCESS;
 }
 
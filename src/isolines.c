@@ -0,0 +1,185 @@
+// isolines: level lines of an image, as polylines (GeoJSON or text)
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "iio.h"
+
+#include "xmalloc.c"
+#include "pickopt.c"
+#include "marching_lines.c"
+
+// parse a list of levels "a,b,c" or a range "from:step:to"
+static float *parse_levels(int *n, char *s)
+{
+	float a, d, b;
+	if (3 == sscanf(s, "%g:%g:%g", &a, &d, &b)) {
+		if (!(d > 0) || !(b >= a))
+			fail("isolines: bad range of levels \"%s\"", s);
+		*n = 1 + floor((b - a) / d + 1e-4);
+		float *l = xmalloc(*n * sizeof*l);
+		for (int i = 0; i < *n; i++)
+			l[i] = a + i * d;
+		return l;
+	}
+	*n = 1;
+	for (char *p = s; *p; p++)
+		*n += *p == ',';
+	float *l = xmalloc(*n * sizeof*l);
+	for (int i = 0; i < *n; i++)
+	{
+		char *e;
+		l[i] = strtof(s, &e);
+		if (e == s || (*e && *e != ','))
+			fail("isolines: bad list of levels \"%s\"", s);
+		s = e + 1;
+	}
+	return l;
+}
+
+struct isolines_output {
+	FILE *f;
+	bool text;
+	bool geo;     // whether to map the coordinates by g
+	double g[6];  // x = g0 + i*g1 + j*g2, y = g3 + i*g4 + j*g5
+};
+
+static void isolines_emit(void *ee, float level, float *xy, long n,
+		bool closed)
+{
+	(void)closed; // the closed lines already repeat their first point
+	struct isolines_output *e = ee;
+	double *g = e->g;
+	if (e->text)
+		fprintf(e->f, "%.8g", level);
+	else
+		fprintf(e->f, "{\"type\":\"Feature\",\"properties\":{"
+				"\"level\":%.8g},\"geometry\":{\"type\":"
+				"\"LineString\",\"coordinates\":[", level);
+	for (long i = 0; i < n; i++)
+	{
+		double x = xy[2*i+0], y = xy[2*i+1];
+		if (e->geo) {
+			double p = x, q = y;
+			x = g[0] + p * g[1] + q * g[2];
+			y = g[3] + p * g[4] + q * g[5];
+		}
+		if (e->text)
+			fprintf(e->f, " %.9g %.9g", x, y);
+		else
+			fprintf(e->f, "%s[%.9g,%.9g]", i ? "," : "", x, y);
+	}
+	fputs(e->text ? "\n" : "]}}\n", e->f);
+}
+
+static char *help_string_name     = "isolines";
+static char *help_string_version  = "isolines 1.0\n\nWritten by eml";
+static char *help_string_oneliner = "level lines of an image, as polylines";
+static char *help_string_usage    = "usage:\n\t"
+"isolines [-t tile] [-g geotransform] [-f text] levels [in [out]]";
+static char *help_string_long     =
+"Isolines computes the level lines of an image, as polylines.\n"
+"\n"
+"The image is read by bands of rows, and each band is cut into tiles.  The\n"
+"segments of marching squares of each tile are chained in parallel, for all\n"
+"the levels at once, and the polylines are joined across the seams of the\n"
+"tiles.  Each polyline is written as soon as it is complete, so that the\n"
+"memory does not hold all of them.  The closed polylines repeat their first\n"
+"point.  The cells with a NAN vertex have no lines.  Only the first channel\n"
+"of the image is used.\n"
+"\n"
+"The output has one GeoJSON feature per line (a LineString with the\n"
+"property \"level\"), or, with \"-f text\", lines of the form\n"
+"\"level x1 y1 x2 y2 ...\".  The coordinates are those of the pixels (the\n"
+"point (i,j) is the pixel i of the row j), or their image by an affine map.\n"
+"\n"
+"Usage: isolines levels in.tif > out.geojson\n"
+"\n"
+"Levels:\n"
+" t\t\ta single level\n"
+" a,b,c\t\ta list of levels\n"
+" a:d:b\t\tthe levels a, a+d, a+2d, ..., up to b\n"
+"\n"
+"Options:\n"
+" -t N\t\tsize of the tiles and height of the bands (default 256)\n"
+" -g \"a b c d e f\"\tcoordinates x=a+i*b+j*c, y=d+i*e+j*f (as GDAL)\n"
+" -f text\toutput in text lines instead of GeoJSON\n"
+" -h\t\tdisplay short help message\n"
+" --help\t\tdisplay longer help message\n"
+"\n"
+"Examples:\n"
+" isolines 0:10:2000 dem.tif -o contours.geojson  contours every 10 meters\n"
+" isolines -f text 127.5 lena.png                 a single level line\n"
+"\n"
+"Report bugs to <enric.meinhardt@ens-paris-saclay.fr>."
+;
+#include "help_stuff.c" // functions that print the strings named above
+int main_isolines(int c, char *v[])
+{
+	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
+
+	char *filename_out = pick_option(&c, &v, "o", "-");
+	int tile = atoi(pick_option(&c, &v, "t", "256"));
+	char *geo = pick_option(&c, &v, "g", "");
+	char *format = pick_option(&c, &v, "f", "geojson");
+	if (c < 2 || c > 4) {
+		fprintf(stderr, "%s\n", help_string_usage);
+		return 1;
+	}
+	char *filename_in = c > 2 ? v[2] : "-";
+	if (c > 3) filename_out = v[3];
+	if (tile < 1) fail("isolines: bad tile size %d", tile);
+
+	struct isolines_output e[1];
+	e->text = !strcmp(format, "text");
+	if (!e->text && strcmp(format, "geojson"))
+		fail("isolines: unknown format \"%s\"", format);
+	e->geo = *geo;
+	if (e->geo && 6 != sscanf(geo, "%lf %lf %lf %lf %lf %lf", e->g + 0,
+				e->g + 1, e->g + 2, e->g + 3, e->g + 4, e->g + 5))
+		fail("isolines: the geotransform needs 6 numbers");
+	e->f = strcmp(filename_out, "-") ? fopen(filename_out, "w") : stdout;
+	if (!e->f) fail("isolines: could not open \"%s\"", filename_out);
+
+	int nl;
+	float *l = parse_levels(&nl, v[1]);
+
+	int w, h, pd;
+	struct iio_stream *s = iio_open(filename_in, &w, &h, &pd);
+	if (!s) fail("isolines: could not open image \"%s\"", filename_in);
+	struct marching_lines m[1];
+	marching_lines_init(m, w, h, l, nl, tile, isolines_emit, e);
+
+	// bands of tile+1 rows, the first one repeats the last of the previous
+	float *b = xmalloc(w * (size_t)(tile + 1) * pd * sizeof*b);
+	float *x = pd == 1 ? b : xmalloc(w * (size_t)(tile + 1) * sizeof*x);
+	for (int j0 = 0; j0 < h - 1; j0 += tile)
+	{
+		int r0 = j0 ? 1 : 0; // rows already in the band
+		if (j0)
+			memmove(x, x + tile * (size_t)w, w * sizeof*x);
+		int n = tile + 1 - r0 < h - j0 - r0 ? tile + 1 - r0 : h - j0 - r0;
+		float *t = pd == 1 ? x + r0 * (size_t)w : b;
+		if (n != iio_read_rows(s, t, j0 + r0, n))
+			fail("isolines: could not read the rows of \"%s\"",
+					filename_in);
+		if (pd > 1)
+			for (size_t i = 0; i < n * (size_t)w; i++)
+				x[r0 * (size_t)w + i] = b[i * pd];
+		marching_lines_band(m, x, j0, r0 + n - 1);
+	}
+	marching_lines_end(m);
+	iio_close(s);
+
+	if (e->f != stdout) fclose(e->f);
+	if (x != b) free(x);
+	free(b);
+	free(l);
+	return 0;
+}
+
+#ifndef HIDE_ALL_MAINS
+int main(int c, char **v) { return main_isolines(c, v); }
+#endif
@@ -0,0 +1,327 @@
+#ifndef _KDFOREST_C
+#define _KDFOREST_C
+
+// randomized kd-forest, for approximate nearest neighbors of float vectors
+//
+// Several kd-trees are built over the same points, each one splitting at
+// the mean of a dimension chosen at random among those of largest variance
+// (Silpa-Anan and Hartley, "Optimised KD-trees for fast image descriptor
+// matching", CVPR 2008).  The search descends all the trees at once, and
+// then keeps visiting the closest unexplored branches of any tree until
+// "checks" points have been compared.  Thus "checks" sets the tradeoff
+// between speed and recall (with checks >= n the search is exact).
+//
+// The forest only stores the indices of the points, not the points, so that
+// it can be saved to a small file next to the original data, and loaded
+// again for the same data.  The file is in the native byte order.
+//
+// This file needs a function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fail.c"
+
+#define KDFOREST_LEAF 8      // maximum number of points on a leaf
+#define KDFOREST_RANDIM 5    // number of dimensions to choose the split from
+#define KDFOREST_SAMPLE 128  // points used to choose each split
+
+// node of a tree: a split along "dim", or a leaf (dim < 0)
+struct kdforest_node {
+	int dim;
+	float val;
+	int a, b; // children (or interval of the permutation, for a leaf)
+};
+
+struct kdforest {
+	int d, n, ntrees;
+	int *nnodes;                  // number of nodes of each tree
+	struct kdforest_node **node;  // nodes of each tree (the root first)
+	int **perm;                   // points of each tree, leaf by leaf
+
+	// the points, not owned by the forest: x[i*stride+k], k < d
+	float *x;
+	int stride;
+};
+
+static uint32_t kdforest_rand(uint64_t *s)
+{
+	*s = *s * 6364136223846793005 + 1442695040888963407;
+	return *s >> 32;
+}
+
+static float *kdforest_point(struct kdforest *f, int i)
+{
+	return f->x + i * (size_t)f->stride;
+}
+
+// build the subtree of the points p[0..m-1], which start at "o" in the
+// permutation, and return its node
+static int kdforest_build_rec(struct kdforest *f, int t, int *p, int m, int o,
+		uint64_t *seed)
+{
+	int d = f->d, r = f->nnodes[t]++;
+	struct kdforest_node *node = f->node[t] + r;
+	if (m <= KDFOREST_LEAF) {
+		node->dim = -1;
+		node->a = o;
+		node->b = o + m;
+		return r;
+	}
+
+	// mean and variance of each dimension, on a sample of the points
+	int ns = m < KDFOREST_SAMPLE ? m : KDFOREST_SAMPLE;
+	double mu[d], var[d];
+	for (int k = 0; k < d; k++)
+		mu[k] = var[k] = 0;
+	for (int j = 0; j < ns; j++)
+	{
+		float *y = kdforest_point(f, p[j * (size_t)m / ns]);
+		for (int k = 0; k < d; k++)
+		{
+			mu[k] += y[k];
+			var[k] += y[k] * (double)y[k];
+		}
+	}
+	for (int k = 0; k < d; k++)
+	{
+		mu[k] /= ns;
+		var[k] = var[k] / ns - mu[k] * mu[k];
+	}
+
+	// random dimension among the KDFOREST_RANDIM of largest variance
+	int top[KDFOREST_RANDIM], ntop = 0;
+	for (int k = 0; k < d; k++)
+	{
+		int j;
+		if (ntop < KDFOREST_RANDIM)
+			j = ntop++;
+		else if (var[k] > var[top[KDFOREST_RANDIM-1]])
+			j = KDFOREST_RANDIM - 1;
+		else
+			continue;
+		while (j > 0 && var[top[j-1]] < var[k]) {
+			top[j] = top[j-1];
+			j -= 1;
+		}
+		top[j] = k;
+	}
+
+	// split at the mean (or at the mean of the largest variance, or leaf)
+	int dim, np;
+	for (int a = 0; a < 2; a++)
+	{
+		dim = a ? top[0] : top[kdforest_rand(seed) % ntop];
+		float v = mu[dim];
+		np = 0;
+		for (int j = 0; j < m; j++)
+			if (kdforest_point(f, p[j])[dim] < v) {
+				int tmp = p[j];
+				p[j] = p[np];
+				p[np++] = tmp;
+			}
+		node->dim = dim;
+		node->val = v;
+		if (np > 0 && np < m)
+			break;
+		node->dim = -1;
+	}
+	if (node->dim < 0) { // all the points are equal (along these axes)
+		node->a = o;
+		node->b = o + m;
+		return r;
+	}
+	int left = kdforest_build_rec(f, t, p, np, o, seed);
+	int right = kdforest_build_rec(f, t, p + np, m - np, o + np, seed);
+	node->a = left;
+	node->b = right;
+	return r;
+}
+
+// build a forest of "ntrees" trees over the n points x[i*stride+(0..d-1)]
+static void kdforest_build(struct kdforest *f, float *x, int n, int d,
+		int stride, int ntrees, uint64_t seed)
+{
+	f->d = d;
+	f->n = n;
+	f->ntrees = ntrees;
+	f->x = x;
+	f->stride = stride;
+	f->nnodes = xmalloc(ntrees * sizeof*f->nnodes);
+	f->node = xmalloc(ntrees * sizeof*f->node);
+	f->perm = xmalloc(ntrees * sizeof*f->perm);
+	for (int t = 0; t < ntrees; t++)
+	{
+		f->nnodes[t] = 0;
+		f->node[t] = xmalloc((2 * n + 1) * sizeof*f->node[t]);
+		f->perm[t] = xmalloc((n + 1) * sizeof*f->perm[t]);
+		for (int i = 0; i < n; i++)
+			f->perm[t][i] = i;
+		uint64_t s = seed + 0x9e3779b97f4a7c15 * (t + 1);
+		kdforest_build_rec(f, t, f->perm[t], n, 0, &s);
+	}
+}
+
+static void kdforest_free(struct kdforest *f)
+{
+	for (int t = 0; t < f->ntrees; t++)
+	{
+		free(f->node[t]);
+		free(f->perm[t]);
+	}
+	free(f->nnodes);
+	free(f->node);
+	free(f->perm);
+}
+
+static void kdforest_save(struct kdforest *f, char *filename)
+{
+	FILE *o = fopen(filename, "wb");
+	if (!o) fail("could not open file \"%s\" for writing", filename);
+	int h[4] = {0x3146444b, f->d, f->n, f->ntrees}; // "KDF1"
+	int ok = 4 == fwrite(h, sizeof*h, 4, o);
+	for (int t = 0; ok && t < f->ntrees; t++)
+	{
+		int m = f->nnodes[t];
+		ok = 1 == fwrite(&m, sizeof m, 1, o)
+			&& m == (int)fwrite(f->node[t], sizeof*f->node[t], m, o)
+			&& f->n == (int)fwrite(f->perm[t], sizeof(int), f->n, o);
+	}
+	if (!ok || fclose(o))
+		fail("could not write the kd-forest \"%s\"", filename);
+}
+
+// load a forest saved by "kdforest_save", over the given points
+static void kdforest_load(struct kdforest *f, char *filename,
+		float *x, int n, int d, int stride)
+{
+	FILE *i = fopen(filename, "rb");
+	if (!i) fail("could not open file \"%s\" for reading", filename);
+	int h[4];
+	if (4 != fread(h, sizeof*h, 4, i) || h[0] != 0x3146444b)
+		fail("file \"%s\" is not a kd-forest", filename);
+	if (h[1] != d || h[2] != n)
+		fail("kd-forest \"%s\" is for %d points of dimension %d "
+				"(not %d of %d)", filename, h[2], h[1], n, d);
+	f->d = d;
+	f->n = n;
+	f->ntrees = h[3];
+	f->x = x;
+	f->stride = stride;
+	f->nnodes = xmalloc(f->ntrees * sizeof*f->nnodes);
+	f->node = xmalloc(f->ntrees * sizeof*f->node);
+	f->perm = xmalloc(f->ntrees * sizeof*f->perm);
+	for (int t = 0; t < f->ntrees; t++)
+	{
+		int m;
+		if (1 != fread(&m, sizeof m, 1, i) || m < 1 || m > 2 * n + 1)
+			fail("corrupt kd-forest \"%s\"", filename);
+		f->nnodes[t] = m;
+		f->node[t] = xmalloc(m * sizeof*f->node[t]);
+		f->perm[t] = xmalloc((n + 1) * sizeof*f->perm[t]);
+		if (m != (int)fread(f->node[t], sizeof*f->node[t], m, i) ||
+				n != (int)fread(f->perm[t], sizeof(int), n, i))
+			fail("corrupt kd-forest \"%s\"", filename);
+	}
+	fclose(i);
+}
+
+// branch waiting to be explored, with a lower bound of its distance
+struct kdforest_branch { float e; int t, r; };
+
+static void kdforest_push(struct kdforest_branch *h, int *n, int cap,
+		float e, int t, int r)
+{
+	if (*n >= cap) return; // drop it (the search is approximate anyway)
+	int i = (*n)++;
+	while (i > 0 && h[(i-1)/2].e > e) {
+		h[i] = h[(i-1)/2];
+		i = (i-1)/2;
+	}
+	h[i] = (struct kdforest_branch){e, t, r};
+}
+
+static struct kdforest_branch kdforest_pop(struct kdforest_branch *h, int *n)
+{
+	struct kdforest_branch top = h[0], last = h[--*n];
+	int i = 0;
+	while (2*i + 1 < *n) {
+		int c = 2*i + 1;
+		if (c + 1 < *n && h[c+1].e < h[c].e)
+			c += 1;
+		if (h[c].e >= last.e)
+			break;
+		h[i] = h[c];
+		i = c;
+	}
+	if (*n > 0)
+		h[i] = last;
+	return top;
+}
+
+// compare q to the points of a leaf, and update the k nearest ones
+static int kdforest_leaf(int *oi, float *od2, int k, struct kdforest *f,
+		float *q, int t, struct kdforest_node *node)
+{
+	for (int j = node->a; j < node->b; j++)
+	{
+		int i = f->perm[t][j];
+		int seen = 0;
+		for (int l = 0; l < k; l++)
+			seen |= oi[l] == i;
+		if (seen)
+			continue;
+		float *y = kdforest_point(f, i), e = 0;
+		for (int l = 0; l < f->d; l++)
+			e += (q[l] - y[l]) * (q[l] - y[l]);
+		if (e >= od2[k-1])
+			continue;
+		int l = k - 1;
+		while (l > 0 && od2[l-1] > e) {
+			od2[l] = od2[l-1];
+			oi[l] = oi[l-1];
+			l -= 1;
+		}
+		od2[l] = e;
+		oi[l] = i;
+	}
+	return node->b - node->a;
+}
+
+// approximate k nearest neighbors of q, after comparing about "checks" points
+// (oi[0..k-1] get their indices, or -1, and od2 their squared distances)
+static void kdforest_knn(int *oi, float *od2, int k, struct kdforest *f,
+		float *q, int checks)
+{
+	for (int l = 0; l < k; l++)
+	{
+		oi[l] = -1;
+		od2[l] = INFINITY;
+	}
+	int cap = 4 * (f->ntrees + checks) + 64, nh = 0, count = 0;
+	struct kdforest_branch *h = xmalloc(cap * sizeof*h);
+	for (int t = 0; t < f->ntrees; t++)
+		kdforest_push(h, &nh, cap, 0, t, 0);
+	while (nh > 0 && (count < checks || oi[k-1] < 0))
+	{
+		struct kdforest_branch c = kdforest_pop(h, &nh);
+		if (c.e >= od2[k-1])
+			continue;
+		struct kdforest_node *node = f->node[c.t] + c.r;
+		while (node->dim >= 0)
+		{
+			float s = q[node->dim] - node->val;
+			int near = s < 0 ? node->a : node->b;
+			int far = s < 0 ? node->b : node->a;
+			kdforest_push(h, &nh, cap, s * s, c.t, far);
+			node = f->node[c.t] + near;
+		}
+		count += kdforest_leaf(oi, od2, k, f, q, c.t, node);
+	}
+	free(h);
+}
+
+#endif//_KDFOREST_C
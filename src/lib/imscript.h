@@ -0,0 +1,59 @@
+#ifndef _IMSCRIPT_H
+#define _IMSCRIPT_H
+
+// core kernels of imscript, as a shared library (bin/libimscript.so)
+//
+// The images are arrays of floats of size w*h*pd, with the samples of each
+// pixel contiguous (as in iio, and as a C-ordered numpy array of shape
+// (h,w,pd)).  The outputs are allocated by the caller, so that the kernels
+// work directly on the memory of the caller, without copies.
+//
+// The functions return 0 on success, or a positive number when the
+// arguments are not valid (e.g., an unknown name).  Other errors (e.g., out
+// of memory) still end the process, as in the command line tools.
+//
+// These functions are the ones used by the python module "imscript"
+// (src/python/imscript/imscript.py).
+
+// blur.c: blur by a kernel of the given name and parameters ("gaussian 2"
+// is kernel "g", p = {2}, np = 1), see "blur -h"
+int imscript_blur(float *y, float *x, int w, int h, int pd,
+		char *kernel, float *p, int np);
+
+// morsi.c: morphological operation by a structuring element ("cross",
+// "square", "disk5", etc.); for "all", y has 13*pd samples per pixel
+int imscript_morsi(float *y, float *x, int w, int h, int pd,
+		char *element, char *operation);
+
+// downsa.c: zoom-out by a factor n, y has size (w/n)*(h/n)*pd
+int imscript_downsa(float *y, float *x, int w, int h, int pd, int n, int type);
+
+// upsa.c: zoom-in by a factor n, y has size (n*w-n)*(n*h-n)*pd
+int imscript_upsa(float *y, float *x, int w, int h, int pd, int n, int type,
+		float dx, float dy);
+
+// homwarp.c: y(p) = x(H p), of size W*H*pd, interpolation of order o
+int imscript_homwarp(float *y, int W, int H, double M[9],
+		float *x, int w, int h, int pd, int o);
+
+// plambda.c: compiled expressions of n variables
+void *imscript_plambda_compile(char *expression, int n);
+int imscript_plambda_dim(void *p, float **x, int *w, int *h, int *pd);
+int imscript_plambda_run(void *p, float *y, int pdy,
+		float **x, int *w, int *h, int *pd, int nthreads);
+void imscript_plambda_free(void *p);
+
+// ransac.c: fit a model ("line", "aff", "affn", "hom", "aff3d", "fm",
+// "fma") to n data points; returns the number of inliers (-1 if the model
+// is unknown), and fills the model and the mask of inliers
+int imscript_ransac(float *model, char *mask, char *model_id,
+		float *data, int n, float *quality,
+		int ntrials, float maxerr, int minliers);
+int imscript_ransac_dims(char *model_id, int *datadim, int *modeldim);
+
+// siftu.c: two nearest neighbors in b of each descriptor of a (the
+// descriptors of length 128 are at x[i*s+(0..127)])
+int imscript_sift_nearest_two(int *idx, double *d, double *d2,
+		float *a, long sa, int na, float *b, long sb, int nb);
+
+#endif//_IMSCRIPT_H
@@ -0,0 +1,16 @@
+// blur.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../blur.c"
+#include "imscript.h"
+
+int imscript_blur(float *y, float *x, int w, int h, int pd,
+		char *kernel, float *p, int np)
+{
+	if (!kernel || !*kernel || !strchr("glckqudsparyzto", tolower(*kernel)))
+		return 1;
+	if (np < 1)
+		return 2;
+	blur_2d(y, x, w, h, pd, kernel, p, np);
+	return 0;
+}
@@ -0,0 +1,15 @@
+// downsa.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../downsa.c"
+#include "imscript.h"
+
+int imscript_downsa(float *y, float *x, int w, int h, int pd, int n, int type)
+{
+	if (!type || !strchr("iavflnecVsr", type))
+		return 1;
+	if (n < 1)
+		return 2;
+	downsa2d(y, x, w, h, pd, n, type);
+	return 0;
+}
@@ -0,0 +1,28 @@
+// homwarp.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../homwarp.c"
+#include "imscript.h"
+
+// the warps work on planes, so the channels of pd > 1 are split first
+int imscript_homwarp(float *y, int W, int H, double M[9],
+		float *x, int w, int h, int pd, int o)
+{
+	if (pd == 1)
+		return shomwarp(y, W, H, M, x, w, h, o);
+	long n = w * (long)h, N = W * (long)H;
+	float *xs = xmalloc(n * pd * sizeof*xs);
+	float *ys = xmalloc(N * pd * sizeof*ys);
+	for (int l = 0; l < pd; l++)
+	for (long i = 0; i < n; i++)
+		xs[l*n+i] = x[i*pd+l];
+	int r = 0;
+	for (int l = 0; l < pd && !r; l++)
+		r = shomwarp(ys + l*N, W, H, M, xs + l*n, w, h, o);
+	for (int l = 0; l < pd; l++)
+	for (long i = 0; i < N; i++)
+		y[i*pd+l] = ys[l*N+i];
+	free(xs);
+	free(ys);
+	return r;
+}
@@ -0,0 +1,99 @@
+// morsi.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../morsi.c"
+#include "imscript.h"
+
+// the structuring element of the given name (NULL if not valid)
+static int *morsi_element(char *s, bool *allocated)
+{
+	static int cross[] = {5,0,  0,0, -1,0, 0,0, 1,0, 0,-1, 0,1 };
+	static int square[] = {9,0, 0,0, -1,-1,-1,0,-1,1, 0,-1,0,0,0,1,
+		1,-1,1,0,1,1};
+	*allocated = false;
+	if (0 == strcmp(s, "cross" )) return cross;
+	if (0 == strcmp(s, "square")) return square;
+	int *e = NULL;
+	if (4 == strspn(s, "disk")) e = build_disk(atof(s + 4));
+	if (4 == strspn(s, "dysk")) e = build_dysk(atof(s + 4));
+	if (4 == strspn(s, "hrec")) e = build_hrec(atof(s + 4));
+	if (4 == strspn(s, "vrec")) e = build_vrec(atof(s + 4));
+	if (4 == strspn(s, "drec")) e = build_drec(atof(s + 4));
+	if (4 == strspn(s, "Drec")) e = build_Drec(atof(s + 4));
+	*allocated = e;
+	return e;
+}
+
+typedef void (*morsi_operation_t)(float*,float*,int,int,int*);
+
+static morsi_operation_t morsi_operation(char *s)
+{
+	if (0 == strcmp(s, "erosion"    )) return morsi_erosion;
+	if (0 == strcmp(s, "dilation"   )) return morsi_dilation;
+	if (0 == strcmp(s, "median"     )) return morsi_median;
+	if (0 == strcmp(s, "rank"       )) return morsi_rank;
+	if (0 == strcmp(s, "opening"    )) return morsi_opening;
+	if (0 == strcmp(s, "closing"    )) return morsi_closing;
+	if (0 == strcmp(s, "gradient"   )) return morsi_gradient;
+	if (0 == strcmp(s, "igradient"  )) return morsi_igradient;
+	if (0 == strcmp(s, "egradient"  )) return morsi_egradient;
+	if (0 == strcmp(s, "laplacian"  )) return morsi_laplacian;
+	if (0 == strcmp(s, "enhance"    )) return morsi_enhance;
+	if (0 == strcmp(s, "blur"       )) return morsi_blur;
+	if (0 == strcmp(s, "oscillation")) return morsi_oscillation;
+	if (0 == strcmp(s, "tophat"     )) return morsi_tophat;
+	if (0 == strcmp(s, "bothat"     )) return morsi_bothat;
+	if (0 == strcmp(s, "iblur"      )) return morsi_iblur;
+	if (0 == strcmp(s, "eblur"      )) return morsi_eblur;
+	if (0 == strcmp(s, "cblur"      )) return morsi_cblur;
+	return NULL;
+}
+
+// the operators work on planes, so the channels of pd > 1 are split first
+int imscript_morsi(float *y, float *x, int w, int h, int pd,
+		char *element, char *operation)
+{
+	bool all = 0 == strcmp(operation, "all");
+	morsi_operation_t f = morsi_operation(operation);
+	if (!f && !all)
+		return 2;
+	bool allocated;
+	int *e = morsi_element(element, &allocated);
+	if (!e)
+		return 1;
+
+	int pdo = all ? 13*pd : pd;
+	long n = w * (long)h;
+	float *xs = x, *ys = y;
+	if (pd > 1) {
+		xs = xmalloc(n * pd * sizeof*xs);
+		for (int l = 0; l < pd; l++)
+		for (long i = 0; i < n; i++)
+			xs[l*n+i] = x[i*pd+l];
+	}
+	if (pdo > 1)
+		ys = xmalloc(n * pdo * sizeof*ys);
+
+	for (int k = 0; k < pd; k++)
+		if (all) {
+			float *o[13];
+			for (int q = 0; q < 13; q++)
+				o[q] = ys + (13*k + q)*n;
+			morsi_all(o[0], o[1], o[2], o[3], o[4], o[5], o[6],
+					o[7], o[8], o[9], o[10], o[11], o[12],
+					xs + k*n, w, h, e);
+		} else
+			f(ys + k*n, xs + k*n, w, h, e);
+
+	if (pdo > 1) {
+		for (int l = 0; l < pdo; l++)
+		for (long i = 0; i < n; i++)
+			y[i*pdo+l] = ys[l*n+i];
+		free(ys);
+	}
+	if (pd > 1)
+		free(xs);
+	if (allocated)
+		free(e);
+	return 0;
+}
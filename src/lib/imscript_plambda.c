@@ -0,0 +1,52 @@
+// plambda.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../plambda.c"
+#include "imscript.h"
+
+// compile an expression of n variables (NULL if the number does not match)
+// (as in the command line, when the expression has no variables the n
+// images are pushed to the stack)
+void *imscript_plambda_compile(char *expression, int n)
+{
+	struct plambda_program *p = xmalloc(sizeof*p);
+	plambda_compile_program(p, expression);
+	if (n > 0 && p->var->n == 0) {
+		int maxplen = n*10 + strlen(expression) + 100;
+		char newprogram[maxplen];
+		add_hidden_variables(newprogram, maxplen, n, expression);
+		collection_of_varnames_end(p->var);
+		plambda_compile_program(p, newprogram);
+	}
+	if (n != p->var->n && !(n == 1 && p->var->n == 0)) {
+		imscript_plambda_free(p);
+		return NULL;
+	}
+	xsrand(100+SRAND());
+	return p;
+}
+
+// number of samples per pixel of the result
+int imscript_plambda_dim(void *p, float **x, int *w, int *h, int *pd)
+{
+	(void)w; (void)h;
+	return eval_dim(p, x, pd);
+}
+
+// evaluate at all the pixels (the images have the size of the first one)
+int imscript_plambda_run(void *p, float *y, int pdy,
+		float **x, int *w, int *h, int *pd, int nthreads)
+{
+	if (pdy != eval_dim(p, x, pd))
+		return 1;
+	nthreads = plambda_threads(nthreads);
+	run_program_vectorially(y, pdy, p, x, w, h, pd, nthreads, true, false);
+	return 0;
+}
+
+void imscript_plambda_free(void *p)
+{
+	struct plambda_program *q = p;
+	collection_of_varnames_end(q->var);
+	free(q);
+}
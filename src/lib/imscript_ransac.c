@@ -0,0 +1,69 @@
+// ransac.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../ransac.c"
+#include "imscript.h"
+
+// the models of "ransac", as in its main function
+struct ransac_case {
+	int datadim, modeldim, nfit;
+	ransac_error_evaluation_function *mev;
+	ransac_model_generating_function *mgen;
+	ransac_model_accepting_function *macc;
+};
+
+static bool ransac_case(struct ransac_case *r, char *id)
+{
+	if (0 == strcmp(id, "line")) {
+		*r = (struct ransac_case){2, 3, 2,
+			distance_of_point_to_straight_line,
+			straight_line_through_two_points, NULL};
+	} else if (0 == strcmp(id, "aff") || 0 == strcmp(id, "affn")) {
+		*r = (struct ransac_case){4, 6, 3,
+			affine_match_error, affine_map_from_three_pairs,
+			id[3] ? affine_map_is_reasonable : NULL};
+	} else if (0 == strcmp(id, "hom")) {
+		*r = (struct ransac_case){4, 9, 4,
+			homographic_match_error, homography_from_four, NULL};
+	} else if (0 == strcmp(id, "aff3d")) {
+		*r = (struct ransac_case){6, 12, 4,
+			affine3d_match_error, affine3d_map_from_four_pairs,
+			NULL};
+	} else if (0 == strcmp(id, "fm")) {
+		*r = (struct ransac_case){4, 9, 7,
+			epipolar_error, seven_point_algorithm, NULL};
+	} else if (0 == strcmp(id, "fma")) {
+		*r = (struct ransac_case){4, 9, 4,
+			epipolar_error, affine_fundamental_matrix, NULL};
+	} else
+		return false;
+	return true;
+}
+
+int imscript_ransac_dims(char *model_id, int *datadim, int *modeldim)
+{
+	struct ransac_case r;
+	if (!ransac_case(&r, model_id))
+		return 1;
+	*datadim = r.datadim;
+	*modeldim = r.modeldim;
+	return 0;
+}
+
+// (the quality of each point, for PROSAC, may be NULL)
+int imscript_ransac(float *model, char *mask, char *model_id,
+		float *data, int n, float *quality,
+		int ntrials, float maxerr, int minliers)
+{
+	struct ransac_case r;
+	if (!ransac_case(&r, model_id))
+		return -1;
+	bool *m = xmalloc(n * sizeof*m + 1);
+	int k = ransac_guided(m, model, data, r.datadim, n, r.modeldim,
+			r.mev, r.mgen, r.nfit, ntrials, minliers, maxerr,
+			r.macc, NULL, quality);
+	for (int i = 0; i < n; i++)
+		mask[i] = m[i];
+	free(m);
+	return k;
+}
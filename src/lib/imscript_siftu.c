@@ -0,0 +1,23 @@
+// siftu.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../siftu.c"
+#include "imscript.h"
+
+// (the distances are euclidean, as with the defaults of "siftu")
+int imscript_sift_nearest_two(int *idx, double *d, double *d2,
+		float *a, long sa, int na, float *b, long sb, int nb)
+{
+	if (sa < SIFT_LENGTH || sb < SIFT_LENGTH)
+		return 1;
+	if (!nb) {
+		for (int i = 0; i < na; i++)
+		{
+			idx[i] = -1;
+			d[i] = d2[i] = INFINITY;
+		}
+		return 0;
+	}
+	sift_nearest_two_l2(idx, d, d2, a, sa, na, b, sb, nb);
+	return 0;
+}
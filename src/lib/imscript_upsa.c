@@ -0,0 +1,16 @@
+// upsa.c, for the shared library (see imscript.h)
+
+#define HIDE_ALL_MAINS
+#include "../upsa.c"
+#include "imscript.h"
+
+int imscript_upsa(float *y, float *x, int w, int h, int pd, int n, int type,
+		float dx, float dy)
+{
+	if (type < -3 || type > 4 || type == -1)
+		return 1;
+	if (n < 1)
+		return 2;
+	zoom_into(y, x, w, h, pd, n, type, dx, dy);
+	return 0;
+}
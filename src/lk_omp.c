@@ -0,0 +1,696 @@
+// Lucas-Kanade optical flow, coarse-to-fine
+//
+// The flow between two images is estimated at each scale of a pyramid of
+// 2x2 averages, starting from the coarsest one.  At each scale, the second
+// image is warped by the current flow, and the flow is updated by a least
+// squares solution of the linearized optical flow constraint, either on a
+// window around each pixel or globally (constant, affine or polynomial).
+//
+// The window sums are computed by separable convolutions of the products
+// of derivatives, and all the per-pixel steps run in parallel.  When a
+// sequence of images is given, the pyramid of each image is built only
+// once, and each flow is initialized from the previous one.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "iio.h"
+#include "xmalloc.c"
+
+#define LK_MAX_SCALES 20
+#define LK_MIN_SIZE 8 // smallest side of the coarsest scale
+
+static float sqr(float x)
+{
+	return x * x;
+}
+
+typedef float (*extension_operator_float)(float*, int, int, int, int);
+
+static float extend_float_image_constant(float *x, int w, int h, int i, int j)
+{
+	if (i < 0) i = 0;
+	if (j < 0) j = 0;
+	if (i >= w) i = w - 1;
+	if (j >= h) j = h - 1;
+	return x[j*w+i];
+}
+
+// derivatives by a 2x2 stencil, at the centers of the cells
+// (the last row and column are extended by a constant)
+static void compute_input_derivatives(float *Ex, float *Ey, float *Et,
+		float *a, float *b, int w, int h)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		int jj = j + 1 < h ? j + 1 : j;
+		float *a0 = a + j*w, *a1 = a + jj*w;
+		float *b0 = b + j*w, *b1 = b + jj*w;
+		float *ex = Ex + j*w, *ey = Ey + j*w, *et = Et + j*w;
+		for (int i = 0; i < w; i++)
+		{
+			int ii = i + 1 < w ? i + 1 : i;
+			ey[i] = (1.0/4) * ( a1[i] - a0[i] + a1[ii] - a0[ii]
+					+ b1[i] - b0[i] + b1[ii] - b0[ii]);
+			ex[i] = (1.0/4) * ( a0[ii] - a0[i] + a1[ii] - a1[i]
+					+ b0[ii] - b0[i] + b1[ii] - b1[i]);
+			et[i] = (1.0/4) * ( b0[i] - a0[i] + b0[ii] - a0[ii]
+					+ b1[i] - a1[i] + b1[ii] - a1[ii]);
+		}
+	}
+}
+
+// normalized weights of a window of side kside (a box if sigma < 0)
+// (the 2D weights exp(-(r/sigma)^2) are the products of these)
+static void fill_window_values(float *wv, int kside, float sigma)
+{
+	int kradius = (kside - 1)/2;
+	float m = 0;
+	for (int i = 0; i < kside; i++)
+	{
+		wv[i] = sigma < 0 ? 1 : exp(-sqr((i - kradius)/sigma));
+		m += wv[i];
+	}
+	for (int i = 0; i < kside; i++)
+		wv[i] /= m;
+}
+
+#include "vvector.h"
+
+static float solve_sdp_2x2(float x[2], float A[3], float b[2])
+{
+	float m[2][2] = {{A[0], A[1]}, {A[1], A[2]}};
+	float n[2][2], det;
+	INVERT_2X2(n, det, m);
+	x[0] = n[0][0] * b[0] + n[0][1] * b[1];
+	x[1] = n[1][0] * b[0] + n[1][1] * b[1];
+	if(!det) {x[0]=x[1]=0;}
+	//fprintf(stderr, "A=(%g %g %g), b=(%g %g), x=(%g %g)\n",
+	//		A[0], A[1], A[2], b[0], b[1], x[0], x[1]);
+	//float e[2];
+	//e[0] = A[0]*x[0] + A[1]*x[1] - b[0];
+	//e[1] = A[1]*x[0] + A[2]*x[1] - b[1];
+	//fprintf(stderr, "e=(%g %g)\n", e[0], e[1]);
+	return det;
+}
+
+
+/*  solvps.c    CCMATH mathematics library source code.
+ *
+ *  Copyright (C)  2000   Daniel A. Atkinson    All rights reserved.
+ *  This code may be redistributed under the terms of the GNU library
+ *  public license (LGPL). ( See the lgpl.license file for details.)
+ * ------------------------------------------------------------------------
+ */
+int solvps(double *a,double *b,int n)
+{ double *p,*q,*r,*s,t;
+  int j,k;
+  for(j=0,p=a; j<n ;++j,p+=n+1){
+    for(q=a+j*n; q<p ;++q) *p-= *q* *q;
+    if(*p<=0.) return -1;
+    *p=sqrt(*p);
+    for(k=j+1,q=p+n; k<n ;++k,q+=n){
+      for(r=a+j*n,s=a+k*n,t=0.; r<p ;) t+= *r++ * *s++;
+      *q-=t; *q/= *p;
+     }
+   }
+  for(j=0,p=a; j<n ;++j,p+=n+1){
+    for(k=0,q=a+j*n; k<j ;) b[j]-=b[k++]* *q++;
+    b[j]/= *p;
+   }
+  for(j=n-1,p=a+n*n-1; j>=0 ;--j,p-=n+1){
+    for(k=j+1,q=p+n; k<n ;q+=n) b[j]-=b[k++]* *q;
+    b[j]/= *p;
+   }
+  return 0;
+}
+
+
+// (on a singular system, the solution is set to zero)
+static double solve_sdp_6x6(double x[6], double A[6][6], double b[6])
+{
+	int r = solvps(A[0], b, 6);
+	for (int i = 0; i < 6; i++)
+		x[i] = r < 0 ? 0 : b[i];
+	return r;
+}
+
+static double solve_sdp_nxn(double *x, double *A, double *b, int n)
+{
+	for (int j = 0; j < n; j++)
+		for (int i = 0; i < n; i++)
+			assert(A[n*i+j] == A[n*j + i]);
+
+	int r = solvps(A, b, n);
+	for (int i = 0; i < n; i++)
+		x[i] = r < 0 ? 0 : b[i];
+	return r;
+}
+
+#define STLEN 5 // gx*gx, gx*gy, gy*gy, -gx*gt, -gy*gt
+
+// weighted window sums of the products of derivatives, on each pixel
+// (structure tensor on the first 3 channels, right hand side on the last 2)
+static void compute_structure_tensor_field(float *st,
+		float *wv, int kside,
+		float *gx, float *gy, float *gt, int w, int h)
+{
+	int kradius = (kside - 1)/2;
+	float *t = xmalloc(w * h * STLEN * sizeof*t);
+
+	// horizontal sums (the products are extended by a constant)
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float (*p)[STLEN] = xmalloc((w + 2*kradius) * sizeof*p);
+		for (int i = -kradius; i < w + kradius; i++)
+		{
+			int o = j*w + (i < 0 ? 0 : i >= w ? w - 1 : i);
+			float *q = p[i + kradius];
+			q[0] = gx[o] * gx[o];
+			q[1] = gx[o] * gy[o];
+			q[2] = gy[o] * gy[o];
+			q[3] = -gx[o] * gt[o];
+			q[4] = -gy[o] * gt[o];
+		}
+		for (int i = 0; i < w; i++)
+		{
+			float s[STLEN] = {0};
+			for (int k = 0; k < kside; k++)
+			for (int l = 0; l < STLEN; l++)
+				s[l] += wv[k] * p[i + k][l];
+			for (int l = 0; l < STLEN; l++)
+				t[(j*w + i)*STLEN + l] = s[l];
+		}
+		free(p);
+	}
+
+	// vertical sums
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float *s = st + j*w*STLEN;
+		for (int i = 0; i < w * STLEN; i++)
+			s[i] = 0;
+		for (int k = 0; k < kside; k++)
+		{
+			int jj = j + k - kradius;
+			jj = jj < 0 ? 0 : jj >= h ? h - 1 : jj;
+			float *r = t + jj*w*STLEN;
+			for (int i = 0; i < w * STLEN; i++)
+				s[i] += wv[k] * r[i];
+		}
+	}
+	free(t);
+}
+
+static void solve_pointwise(float *u, float *v, float *st, int w, int h)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif//_OPENMP
+	for (int i = 0; i < w*h; i++)
+	{
+		float f[2], *s = st + i*STLEN;
+		solve_sdp_2x2(f, s, s + 3);
+		u[i] = f[0];
+		v[i] = f[1];
+	}
+}
+
+static void global_constant_approximation(float *u, float *v,
+		float *gx, float *gy, float *gt, int w, int h)
+{
+	extension_operator_float p = extend_float_image_constant;
+
+	float atwa[STLEN], rhs[2];
+	atwa[0] = atwa[1] = atwa[2] = rhs[0] = rhs[1] = 0;
+
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			atwa[0] += 1 * sqr(p(gx, w, h, i, j));
+			atwa[1] += 1 * p(gx,w,h, i, j) * p(gy,w,h, i, j);
+			atwa[2] += 1 * sqr(p(gy, w, h, i, j));
+			rhs[0] -= 1 * p(gx,w,h, i, j) * p(gt,w,h, i, j);
+			rhs[1] -= 1 * p(gy,w,h, i, j) * p(gt,w,h, i, j);
+		}
+
+	float f[2];
+	solve_sdp_2x2(f, atwa, rhs);
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			u[j*w + i] = f[0];
+			v[j*w + i] = f[1];
+		}
+}
+
+static void global_affine_approximation(float *u, float *v,
+		float *gx, float *gy, float *gt, int w, int h)
+{
+	extension_operator_float p = extend_float_image_constant;
+
+	double ast[6][6], rhs[6] = {0,0,0,0,0,0};
+	for (int j = 0; j < 6; j++)
+	for (int i = 0; i < 6; i++)
+		ast[j][i] = 0;
+
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			double x = i;
+			double y = j;
+			double Ex = p(gx, w, h, i, j);
+			double Ey = p(gy, w, h, i, j);
+			double Et = p(gt, w, h, i, j);
+			ast[0][0] += Ex * Ex * x * x;
+			ast[0][1] += Ex * Ex * x * y;
+			ast[0][2] += Ex * Ex * x;
+			ast[0][3] += Ex * Ey * x * x;
+			ast[0][4] += Ex * Ey * x * y;
+			ast[0][5] += Ex * Ey * x;
+			ast[1][0] += Ex * Ex * x * y;
+			ast[1][1] += Ex * Ex * y * y;
+			ast[1][2] += Ex * Ex * y;
+			ast[1][3] += Ex * Ey * x * y;
+			ast[1][4] += Ex * Ey * y * y;
+			ast[1][5] += Ex * Ey * y;
+			ast[2][0] += Ex * Ex * x;
+			ast[2][1] += Ex * Ex * y;
+			ast[2][2] += Ex * Ex;
+			ast[2][3] += Ex * Ey * x;
+			ast[2][4] += Ex * Ey * y;
+			ast[2][5] += Ex * Ey;
+			ast[3][0] += Ex * Ey * x * x;
+			ast[3][1] += Ex * Ey * x * y;
+			ast[3][2] += Ex * Ey * x;
+			ast[3][3] += Ey * Ey * x * x;
+			ast[3][4] += Ey * Ey * x * y;
+			ast[3][5] += Ey * Ey * x;
+			ast[4][0] += Ex * Ey * x * y;
+			ast[4][1] += Ex * Ey * y * y;
+			ast[4][2] += Ex * Ey * y;
+			ast[4][3] += Ey * Ey * x * y;
+			ast[4][4] += Ey * Ey * y * y;
+			ast[4][5] += Ey * Ey * y;
+			ast[5][0] += Ex * Ey * x;
+			ast[5][1] += Ex * Ey * y;
+			ast[5][2] += Ex * Ey;
+			ast[5][3] += Ey * Ey * x;
+			ast[5][4] += Ey * Ey * y;
+			ast[5][5] += Ey * Ey;
+			rhs[0] -= Et * Ex * x;
+			rhs[1] -= Et * Ex * y;
+			rhs[2] -= Et * Ex;
+			rhs[3] -= Et * Ey * x;
+			rhs[4] -= Et * Ey * y;
+			rhs[5] -= Et * Ey;
+		}
+
+	//for (int j = 0; j < 6; j++)
+	//for (int i = 0; i < 6; i++)
+	//	ast[j][i] /= sqrt(w*h);
+	//for (int i = 0; i < 6; i++)
+	//	rhs[i] /= sqrt(w*h);
+
+	double f[6];
+	solve_sdp_6x6(f, ast, rhs);
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			double x = i;
+			double y = j;
+			u[j*w + i] = f[0]*x + f[1]*y + f[2];
+			v[j*w + i] = f[3]*x + f[4]*y + f[5];
+		}
+}
+
+
+static double ipow(double base, int exponent)
+{
+	double result = 1;
+	while (exponent)
+	{
+		if (exponent & 1)
+			result *= base;
+		exponent >>= 1;
+		base *= base;
+	}
+	return result;
+}
+
+static double monomium(double x, double y, int exponent[2])
+{
+	return ipow(x,exponent[0]) * ipow(y,exponent[1]);
+}
+
+static double polynomium(double x, double y,
+		double *f, int (*polindex)[2], int nc)
+{
+	double r = 0;
+	for (int i = 0; i < nc; i++)
+		r += f[i] * monomium(x, y, polindex[i]);
+	return r;
+}
+
+static void global_polynomial_approximation(float *u, float *v,
+		float *gx, float *gy, float *gt, int w, int h, int deg)
+{
+	int nc = (deg + 2) * (deg + 1) / 2; // number of coefficients
+	double pst[2*nc][2*nc], rhs[2*nc];
+	int polindex[nc][2], idx = 0;
+	for (int j = 0; j <= deg; j++)
+	for (int i = 0; i <= j; i++)
+	{
+		polindex[idx][0] = j-i;
+		polindex[idx][1] = i;
+		idx += 1;
+	}
+	assert(idx == nc);
+
+	//for (int i = 0; i < nc; i++)
+	//	fprintf(stderr, "polindex[%d] = {%d, %d};\n",
+	//			i, polindex[i][0], polindex[i][1]);
+
+	for (int j = 0; j < 2*nc; j++)
+	for (int i = 0; i < 2*nc; i++)
+		pst[j][i] = 0;
+	for (int i = 0; i < 2*nc; i++)
+		rhs[i] = 0;
+
+	double nfac = sqrt(w*h);//100;
+
+	int passepartoutw = 2;//0.004 * w;
+	int passepartouth = 2;//0.004 * h;
+
+	for (int jj = passepartouth; jj < h - passepartouth; jj++)
+		for (int ii = passepartoutw; ii < w - passepartoutw; ii++)
+		{
+			extension_operator_float p= extend_float_image_constant;
+			double x = ii/nfac;
+			double y = jj/nfac;
+			double Ex = p(gx, w, h, ii, jj);
+			double Ey = p(gy, w, h, ii, jj);
+			double Et = p(gt, w, h, ii, jj);
+
+			for (int j = 0; j < nc; j++)
+			for (int i = 0; i < nc; i++)
+			{
+				int m[2] = {
+					polindex[i][0] + polindex[j][0],
+					polindex[i][1] + polindex[j][1]
+				};
+				pst[j][i] += Ex * Ex * monomium(x, y, m);
+				pst[j+nc][i] += Ex * Ey * monomium(x, y, m);
+				pst[j][i+nc] += Ex * Ey * monomium(x, y, m);
+				pst[j+nc][i+nc] += Ey * Ey * monomium(x, y, m);
+			}
+			for (int i = 0; i < nc; i++)
+			{
+				int m[2] = { polindex[i][0], polindex[i][1] };
+				rhs[i] -= Et * Ex * monomium(x, y, m);
+				rhs[i+nc] -= Et * Ey * monomium(x, y, m);
+			}
+		}
+
+	double f[2*nc];
+	solve_sdp_nxn(f, pst[0], rhs, 2*nc);
+	for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			double x = i/nfac;
+			double y = j/nfac;
+			u[j*w + i] = polynomium(x, y, f, polindex, nc);;
+			v[j*w + i] = polynomium(x, y, f+nc, polindex, nc);;
+		}
+}
+
+
+// one step: the flow (u,v) from a to b, by least squares
+static void least_squares_ofc(float *u, float *v,
+		float *a, float *b, int w, int h,
+		int kside, float sigma)
+{
+	float *gx = xmalloc(w * h * sizeof(float));
+	float *gy = xmalloc(w * h * sizeof(float));
+	float *gt = xmalloc(w * h * sizeof(float));
+	compute_input_derivatives(gx, gy, gt, a, b, w, h);
+	if (kside == -1)
+		global_constant_approximation(u, v, gx, gy, gt, w, h);
+	else if (kside == -2)
+		global_affine_approximation(u, v, gx, gy, gt, w, h);
+	else if (kside == -3) {
+		int deg = sigma;
+		global_polynomial_approximation(u, v, gx, gy, gt, w, h, deg);
+	}
+	else {
+		if (kside % 2 != 1) exit(fprintf(stderr,
+			"I need an ODD window size (got %d)\n", kside));
+		if (kside > 70) exit(fprintf(stderr,
+			"window size %d too large\n", kside));
+		float wv[kside]; fill_window_values(wv, kside, sigma);
+		float *st = xmalloc(w * h * STLEN * sizeof(float));
+		compute_structure_tensor_field(st, wv, kside, gx, gy, gt, w, h);
+		solve_pointwise(u, v, st, w, h);
+		free(st);
+	}
+	free(gx);
+	free(gy);
+	free(gt);
+}
+
+// zoom-out by 2x2 block averages, times a factor
+// (the last row and column are extended by a constant)
+static void zoom_out_by_factor_two(float *y, int ow, int oh,
+		float *x, int w, int h, float factor)
+{
+	extension_operator_float p = extend_float_image_constant;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < oh; j++)
+	for (int i = 0; i < ow; i++)
+		y[j*ow+i] = factor * (1.0/4) * (
+				p(x,w,h, 2*i, 2*j) + p(x,w,h, 2*i+1, 2*j)
+				+ p(x,w,h, 2*i, 2*j+1) + p(x,w,h, 2*i+1, 2*j+1));
+}
+
+// bilinear interpolation of x at (p,q)
+static float bilinear_sample(float *x, int w, int h, float p, float q)
+{
+	extension_operator_float e = extend_float_image_constant;
+	int ip = floor(p);
+	int iq = floor(q);
+	float a = p - ip, b = q - iq;
+	if (!a && !b)
+		return e(x, w, h, ip, iq);
+	return (1-a) * (1-b) * e(x, w, h, ip  , iq  )
+		+ ( a ) * (1-b) * e(x, w, h, ip+1, iq  )
+		+ (1-a) * ( b ) * e(x, w, h, ip  , iq+1)
+		+ ( a ) * ( b ) * e(x, w, h, ip+1, iq+1);
+}
+
+// y(i,j) = x(i + u(i,j), j + v(i,j))
+static void warp_bilinear(float *y, float *x, float *u, float *v, int w, int h)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		y[j*w+i] = bilinear_sample(x, w, h,
+				i + u[j*w+i], j + v[j*w+i]);
+}
+
+// zoom-in a component of a flow, from size pw x ph to w x h
+// (the values are multiplied by the factor of the zoom along that component)
+static void zoom_in_flow(float *y, int w, int h, float *x, int pw, int ph,
+		float factor)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		y[j*w+i] = factor * bilinear_sample(x, pw, ph,
+				(i + 0.5) * pw / w - 0.5, (j + 0.5) * ph / h - 0.5);
+}
+
+// pyramid of 2x2 averages of an image (the finest scale first)
+struct lk_pyramid {
+	int n, w[LK_MAX_SCALES], h[LK_MAX_SCALES];
+	float *x[LK_MAX_SCALES];
+};
+
+// build the pyramid of x, which becomes owned by the pyramid
+static void lk_pyramid_build(struct lk_pyramid *p, float *x, int w, int h,
+		int nscales)
+{
+	p->n = 1;
+	p->w[0] = w;
+	p->h[0] = h;
+	p->x[0] = x;
+	while (p->n < nscales && p->n < LK_MAX_SCALES)
+	{
+		int pw = p->w[p->n - 1], qw = (pw + 1)/2;
+		int ph = p->h[p->n - 1], qh = (ph + 1)/2;
+		if (qw < LK_MIN_SIZE || qh < LK_MIN_SIZE)
+			break;
+		p->x[p->n] = xmalloc(qw * qh * sizeof(float));
+		zoom_out_by_factor_two(p->x[p->n], qw, qh,
+				p->x[p->n - 1], pw, ph, 1);
+		p->w[p->n] = qw;
+		p->h[p->n] = qh;
+		p->n += 1;
+	}
+}
+
+static void lk_pyramid_free(struct lk_pyramid *p)
+{
+	for (int s = 0; s < p->n; s++)
+		free(p->x[s]);
+	p->n = 0;
+}
+
+// coarse-to-fine flow (u,v) from a to b, with niter warps at each scale
+// (if init, the given (u,v) is used as the initial flow, otherwise zero)
+static void lk_multiscale(float *u, float *v,
+		struct lk_pyramid *a, struct lk_pyramid *b, bool init,
+		int niter, int kside, float sigma)
+{
+	int n = a->n < b->n ? a->n : b->n;
+	float *us[LK_MAX_SCALES], *vs[LK_MAX_SCALES];
+	us[0] = u;
+	vs[0] = v;
+	for (int s = 1; s < n; s++)
+	{
+		int w = a->w[s], h = a->h[s], pw = a->w[s-1], ph = a->h[s-1];
+		us[s] = xmalloc(w * h * sizeof(float));
+		vs[s] = xmalloc(w * h * sizeof(float));
+		if (init) {
+			zoom_out_by_factor_two(us[s], w, h, us[s-1], pw, ph, 0.5);
+			zoom_out_by_factor_two(vs[s], w, h, vs[s-1], pw, ph, 0.5);
+		}
+	}
+	if (!init)
+		for (int i = 0; i < a->w[n-1] * a->h[n-1]; i++)
+			us[n-1][i] = vs[n-1][i] = 0;
+
+	for (int s = n - 1; s >= 0; s--)
+	{
+		int w = a->w[s], h = a->h[s];
+		if (s < n - 1) {
+			int pw = a->w[s+1], ph = a->h[s+1];
+			zoom_in_flow(us[s], w, h, us[s+1], pw, ph, w/(float)pw);
+			zoom_in_flow(vs[s], w, h, vs[s+1], pw, ph, h/(float)ph);
+		}
+		float *bw = xmalloc(w * h * sizeof(float));
+		float *du = xmalloc(w * h * sizeof(float));
+		float *dv = xmalloc(w * h * sizeof(float));
+		for (int k = 0; k < niter; k++)
+		{
+			warp_bilinear(bw, b->x[s], us[s], vs[s], w, h);
+			least_squares_ofc(du, dv, a->x[s], bw, w, h,
+					kside, sigma);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+			for (int i = 0; i < w * h; i++)
+			{
+				us[s][i] += du[i];
+				vs[s][i] += dv[i];
+			}
+		}
+		free(bw);
+		free(du);
+		free(dv);
+	}
+
+	for (int s = 1; s < n; s++)
+	{
+		free(us[s]);
+		free(vs[s]);
+	}
+}
+
+#include "pickopt.c"
+int main(int argc, char *argv[])
+{
+	int nscales = atoi(pick_option(&argc, &argv, "s", "1"));
+	int niter = atoi(pick_option(&argc, &argv, "i", "1"));
+	char *filename_init = pick_option(&argc, &argv, "w", "");
+	bool cold = pick_option(&argc, &argv, "c", NULL);
+	if (argc < 6)
+		exit(fprintf(stderr, "usage:\n\t"
+			"%s [-s nscales] [-i niter] [-w init] kside sigma a b f\n\t"
+			"%s [-s nscales] [-i niter] [-w init] [-c] "
+			"kside sigma f0 f1 ... fn flow%%d.tiff\n",
+			*argv, *argv));
+	int kside = atoi(argv[1]);
+	float sigma = atof(argv[2]);
+	int nimages = argc - 4;
+	char *filename_f = argv[argc - 1];
+	if (nimages > 2 && !strchr(filename_f, '%'))
+		exit(fprintf(stderr, "output \"%s\" must be a pattern like "
+					"\"flow%%d.tiff\"\n", filename_f));
+
+	int w, h, ww, hh, pd;
+	float *a = iio_read_image_float(argv[3], &w, &h);
+	struct lk_pyramid pa, pb;
+	lk_pyramid_build(&pa, a, w, h, nscales);
+
+	// initial flow
+	float *u = xmalloc(w * h * sizeof(float));
+	float *v = xmalloc(w * h * sizeof(float));
+	float *f = xmalloc(w * h * 2 * sizeof(float));
+	bool init = false;
+	if (*filename_init) {
+		float *g = iio_read_image_float_vec(filename_init, &ww, &hh, &pd);
+		if (w != ww || h != hh || pd != 2)
+			exit(fprintf(stderr, "initial flow size mismatch\n"));
+		for (int i = 0; i < w*h; i++) {
+			u[i] = g[2*i];
+			v[i] = g[2*i+1];
+		}
+		free(g);
+		init = true;
+	}
+
+	// flow between each pair of consecutive images
+	for (int k = 1; k < nimages; k++)
+	{
+		float *b = iio_read_image_float(argv[3+k], &ww, &hh);
+		if (w != ww || h != hh)
+			exit(fprintf(stderr, "input images size mismatch\n"));
+		lk_pyramid_build(&pb, b, w, h, nscales);
+		lk_multiscale(u, v, &pa, &pb, init, niter, kside, sigma);
+		for (int i = 0; i < w*h; i++) {
+			f[2*i] = u[i];
+			f[2*i+1] = v[i];
+		}
+		char buf[FILENAME_MAX];
+		if (nimages > 2)
+			snprintf(buf, FILENAME_MAX, filename_f, k - 1);
+		iio_write_image_float_vec(nimages > 2 ? buf : filename_f,
+				f, w, h, 2);
+		lk_pyramid_free(&pa);
+		pa = pb;
+		init = !cold;
+	}
+	lk_pyramid_free(&pa);
+	free(u);
+	free(v);
+	free(f);
+	return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
@@ -5,11 +6,14 @@
 #include "xmalloc.c"
 #include "getpixel.c"
 #include "pickopt.c"
+#include "catstream.c"
 
 #define BAD_MAX(a,b) (a)<(b)?(b):(a);
 
 #include "smapa.h"
 SMART_PARAMETER_SILENT(BACKGROUND,0)
+SMART_PARAMETER_SILENT(CAT_BAND_MB,64)
+SMART_PARAMETER_SILENT(LRCAT_STREAMS,256)
 
 int main_lrcat_two(int c, char *v[])
 {
@@ -72,6 +76,8 @@ static char *help_string_long     =
 "\n"
 "Environment:\n"
 " BACKGROUND\tvalue to fill the background when images have different height\n"
+" CAT_BAND_MB\tmemory of the bands of rows that are copied (default 64)\n"
+" LRCAT_STREAMS\tmaximum number of inputs read at the same time (default 256)\n"
 "\n"
 "Examples:\n"
 " lrcat lena.png lena.png -o twolenas.png            duplicate an image\n"
@@ -91,33 +97,68 @@ int main_lrcat(int c, char *v[])
 		filename[i] = v[i+1];
 	filename[n] = filename_out;
 
-	int w[n+1], h[n+1], pd[n+1];
-	float *x[n+1];
-	w[n] = h[n] = pd[n] = 0;
+	if (n < 1) {
+		fprintf(stderr, "%s", help_string_usage);
+		return 1;
+	}
+
+	// sizes of the inputs and of the output
+	struct cat_input *x = xmalloc(n * sizeof*x);
+	int *ok = xmalloc(n * sizeof*ok); // offset of each image in the output
+	int w = 0, h = 0, pd = 0;
 	for (int k = 0; k < n; k++)
 	{
-		x[k] = iio_read_image_float_vec(filename[k], w+k, h+k, pd+k);
-		w[n] += w[k];
-		h[n] = BAD_MAX(h[n], h[k]);
-		pd[n] = BAD_MAX(pd[n], pd[k]);
+		cat_input_info(x + k, filename[k]);
+		ok[k] = w;
+		w += x[k].w;
+		h = BAD_MAX(h, x[k].h);
+		pd = BAD_MAX(pd, x[k].pd);
 	}
-	x[n] = xmalloc(w[n] * h[n] * pd[n] * sizeof(x[0][0]));
-	for (int i = 0; i < w[n] * h[n] * pd[n]; i++)
-		x[n][i] = BACKGROUND();
 
-	int ok = 0;
-	for (int k = 0; k < n; k++)
+	// all the inputs are read at the same time, by bands of rows, unless
+	// there are too many of them to keep open (then they are read whole,
+	// one after the other, into a single band)
+	bool all_open = n <= LRCAT_STREAMS();
+	int band = all_open ? cat_band_height(CAT_BAND_MB(), w, h, pd) : h;
+	float *y = xmalloc(w * (size_t)band * pd * sizeof*y);
+	float bg = BACKGROUND();
+	struct iio_ostream *o = iio_create(filename[n], w, h, pd);
+	if (all_open)
+		for (int k = 0; k < n; k++)
+			cat_input_open(x + k, band);
+	for (int j0 = 0; j0 < h; j0 += band)
 	{
-		for (int j = 0; j < h[k]; j++)
-		for (int i = 0; i < w[k]; i++)
-		for (int l = 0; l < pd[2]; l++) {
-			float s = getsample_1(x[k], w[k], h[k], pd[k], i, j, l);
-			setsample_0(x[n], w[n], h[n], pd[n], i+ok, j, l, s);
+		int nb = band < h - j0 ? band : h - j0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if(all_open)
+#endif
+		for (int k = 0; k < n; k++)
+		{
+			if (!all_open) cat_input_open(x + k, x[k].h);
+			int r = 0;
+			if (j0 < x[k].h)
+				r = iio_read_rows(x[k].s, x[k].band, j0, nb);
+			for (int j = 0; j < nb; j++)
+			{
+				float *yj = y + (j * (size_t)w + ok[k]) * pd;
+				if (j < r)
+					cat_pixels(yj, pd, x[k].band +
+						j * (size_t)x[k].w * x[k].pd,
+						x[k].pd, x[k].w);
+				else
+					cat_fill(yj, x[k].w * (size_t)pd, bg);
+			}
+			if (!all_open) cat_input_close(x + k);
 		}
-		ok += w[k];
+		iio_write_rows(o, y, nb);
 	}
-
-	iio_write_image_float_vec(filename[n], x[n], w[n], h[n], pd[n]);
+	if (all_open)
+		for (int k = 0; k < n; k++)
+			cat_input_close(x + k);
+	iio_finish(o);
+	free(y);
+	free(ok);
+	free(x);
 	return 0;
 }
 
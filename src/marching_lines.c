@@ -0,0 +1,467 @@
+#ifndef _MARCHING_LINES_C
+#define _MARCHING_LINES_C
+
+// level lines of an image as polylines, by tiles and by bands of rows
+//
+// The image is given by bands of rows (each band repeats the last row of the
+// previous one), and the bands are cut into tiles of cells.  For each tile
+// and level the segments of marching squares are chained into polylines, in
+// parallel, and the polylines that end on the seams are joined afterwards.
+// The polylines are given to a callback as soon as they are complete, so
+// that only those that cross the bottom of the current band are kept.
+//
+// The ends of the segments are identified by the edges of the grid where
+// they lie (the crossing point of an edge is computed from the values of its
+// two vertices only, so that it is the same on both sides of the edge).  The
+// cells that have a NAN vertex are skipped.  The polylines are not oriented;
+// the closed ones repeat their first point at the end.
+//
+// 	struct marching_lines m[1];
+// 	marching_lines_init(m, w, h, levels, nlevels, 256, emit, e);
+// 	for (each band of rows j0..j0+n)
+// 		marching_lines_band(m, rows, j0, n);
+// 	marching_lines_end(m);
+//
+// This file needs the functions "xmalloc", "xrealloc" and "fail" (e.g., from
+// xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "marching_squares.c"
+
+// a polyline, whose points can be added at both ends
+struct mline {
+	float *p;       // points (x,y), from p[2*a] to p[2*b-1]
+	long a, b, cap;
+	long k[2];      // keys of the two ends (-1 if closed)
+	int level;      // index of the level
+	bool dead;      // whether it has been joined into another one
+};
+
+typedef void (*marching_lines_emit_t)(void *e, float level,
+		float *xy, long n, bool closed);
+
+struct marching_lines {
+	int w, h;       // image
+	int nl;         // number of levels
+	float *l;       // levels
+	int tw;         // tile width (in cells, the height is that of the band)
+	marching_lines_emit_t emit;
+	void *e;
+
+	// open polylines that end on the bottom of the last band
+	struct mline *pending;
+	int npending, cappending;
+};
+
+static void mline_init(struct mline *m, int level)
+{
+	m->cap = 16;
+	m->p = xmalloc(2 * m->cap * sizeof*m->p);
+	m->a = m->b = m->cap / 2;
+	m->k[0] = m->k[1] = -1;
+	m->level = level;
+	m->dead = false;
+}
+
+// make room for n points before and after the current ones
+static void mline_reserve(struct mline *m, long before, long after)
+{
+	if (m->a >= before && m->cap - m->b >= after)
+		return;
+	long n = m->b - m->a;
+	long cap = 2 * (m->cap + before + after);
+	float *p = xmalloc(2 * cap * sizeof*p);
+	long a = (cap - n) / 2;
+	memcpy(p + 2*a, m->p + 2*m->a, 2 * n * sizeof*p);
+	free(m->p);
+	m->p = p;
+	m->a = a;
+	m->b = a + n;
+	m->cap = cap;
+}
+
+static void mline_push_back(struct mline *m, float x, float y)
+{
+	mline_reserve(m, 0, 1);
+	m->p[2*m->b+0] = x;
+	m->p[2*m->b+1] = y;
+	m->b += 1;
+}
+
+static long mline_length(struct mline *m)
+{
+	return m->b - m->a;
+}
+
+// join d into c, at their common end (the common point is not repeated)
+static void mline_join(struct mline *c, struct mline *d, long key)
+{
+	if (mline_length(d) > mline_length(c)) { // copy the shortest one
+		struct mline t = *c;
+		*c = *d;
+		*d = t;
+	}
+	int ce = c->k[1] == key, de = d->k[1] == key;
+	long n = mline_length(d) - 1;
+	float *q = d->p + 2*d->a;
+	if (ce) {
+		mline_reserve(c, 0, n);
+		float *o = c->p + 2*c->b;
+		for (long i = 0; i < n; i++)
+		{
+			long s = de ? n - 1 - i : i + 1; // skip the common point
+			o[2*i+0] = q[2*s+0];
+			o[2*i+1] = q[2*s+1];
+		}
+		c->b += n;
+	} else {
+		mline_reserve(c, n, 0);
+		float *o = c->p + 2*(c->a - n);
+		for (long i = 0; i < n; i++)
+		{
+			long s = de ? i : n - i;
+			o[2*i+0] = q[2*s+0];
+			o[2*i+1] = q[2*s+1];
+		}
+		c->a -= n;
+	}
+	c->k[ce] = d->k[!de];
+	free(d->p);
+	d->p = NULL;
+	d->dead = true;
+}
+
+static void mline_emit(struct marching_lines *m, struct mline *c)
+{
+	bool closed = c->k[0] < 0;
+	m->emit(m->e, m->l[c->level], c->p + 2*c->a, mline_length(c), closed);
+	free(c->p);
+	c->p = NULL;
+	c->dead = true;
+}
+
+static void marching_lines_init(struct marching_lines *m, int w, int h,
+		float *levels, int nlevels, int tw,
+		marching_lines_emit_t emit, void *e)
+{
+	m->w = w;
+	m->h = h;
+	m->nl = nlevels;
+	m->l = xmalloc(nlevels * sizeof*m->l);
+	memcpy(m->l, levels, nlevels * sizeof*m->l);
+	m->tw = tw < 1 ? 1 : tw;
+	m->emit = emit;
+	m->e = e;
+	m->pending = NULL;
+	m->npending = m->cappending = 0;
+}
+
+// tiles {{{1
+
+// scratch space of a thread for the tiles of size tw x th
+struct mtile {
+	int tw, th, ne;   // tile size, number of local edges
+	int *ec;          // number of segment ends on each edge
+	int *es;          // the segment ends on each edge (2 per edge)
+	int ns;           // number of segments
+	int *se;          // local edges of the segment ends
+	long *sk;         // keys of the segment ends
+	float *sp;        // points of the segment ends
+	bool *used;
+};
+
+static void mtile_init(struct mtile *t, int tw, int th)
+{
+	t->tw = tw;
+	t->th = th;
+	t->ne = tw * (th + 1) + (tw + 1) * th;
+	int ms = 2 * tw * th; // maximum number of segments
+	t->ec = xmalloc(t->ne * sizeof*t->ec);
+	t->es = xmalloc(2 * t->ne * sizeof*t->es);
+	t->se = xmalloc(2 * ms * sizeof*t->se);
+	t->sk = xmalloc(2 * ms * sizeof*t->sk);
+	t->sp = xmalloc(4 * ms * sizeof*t->sp);
+	t->used = xmalloc(ms * sizeof*t->used);
+	for (int i = 0; i < t->ne; i++)
+		t->ec[i] = 0;
+}
+
+static void mtile_free(struct mtile *t)
+{
+	free(t->ec);
+	free(t->es);
+	free(t->se);
+	free(t->sk);
+	free(t->sp);
+	free(t->used);
+}
+
+// add the end e of the segment s, at the edge of the vertices (a,b) of the
+// cell (i,j) of the tile at (i0,j0)
+static void mtile_add_end(struct mtile *t, struct marching_lines *m,
+		float *x, int j0r, int i0, int j0, int i, int j,
+		int s, int e, int a, int b, float level)
+{
+	static const int V[4][2] = { {0,0}, {1,0}, {0,1}, {1,1} };
+	if (a > b) { int c = a; a = b; b = c; }
+	int gi = i0 + i + V[a][0], gj = j0 + j + V[a][1]; // first vertex
+	bool vertical = b - a == 2;
+	float va = x[(gj - j0r) * m->w + gi];
+	float vb = x[(gj + vertical - j0r) * m->w + gi + !vertical];
+	float f = (level - va) / (vb - va);
+	int li = gi - i0, lj = gj - j0;
+	int le = vertical ? t->tw * (t->th + 1) + lj * (t->tw + 1) + li
+	                  : lj * t->tw + li;
+	int q = 2 * s + e;
+	t->se[q] = le;
+	t->sk[q] = (2 * ((long)gj * m->w + gi) + vertical) * m->nl;
+	t->sp[2*q+0] = vertical ? gi : gi + f;
+	t->sp[2*q+1] = vertical ? gj + f : gj;
+	t->es[2*le + t->ec[le]++] = q;
+}
+
+// polylines of level l in the tile of cells [i0,i1)x[j0,j1), given the rows
+// of the image from j0r
+static void mtile_lines(struct mline **o, int *no, int *co,
+		struct mtile *t, struct marching_lines *m, float *x, int j0r,
+		int i0, int i1, int j0, int j1, int l)
+{
+	float level = m->l[l];
+
+	// segments
+	t->ns = 0;
+	for (int j = 0; j < j1 - j0; j++)
+	for (int i = 0; i < i1 - i0; i++)
+	{
+		float *r = x + (j0 + j - j0r) * m->w + i0 + i;
+		float v[4] = { r[0], r[1], r[m->w], r[m->w+1] };
+		if (isnan(v[0]) || isnan(v[1]) || isnan(v[2]) || isnan(v[3]))
+			continue;
+		int c = 0;
+		for (int k = 0; k < 4; k++)
+			if (v[k] >= level)
+				c += 1 << k;
+		for (int k = 0; k < marching_squares_table[c].ns; k++)
+		{
+			int s = t->ns++;
+			for (int e = 0; e < 2; e++)
+				mtile_add_end(t, m, x, j0r, i0, j0, i, j, s, e,
+					marching_squares_table[c].s[k][e][0],
+					marching_squares_table[c].s[k][e][1],
+					level);
+			t->used[s] = false;
+		}
+	}
+
+	// chain them (first the open chains, then the closed ones)
+	for (int pass = 0; pass < 2; pass++)
+	for (int s = 0; s < t->ns; s++)
+	for (int e = 0; e < 2; e++)
+	{
+		if (t->used[s] || (!pass && t->ec[t->se[2*s+e]] != 1))
+			continue;
+		if (*no == *co) {
+			*co = 2 * *co + 16;
+			*o = xrealloc(*o, *co * sizeof**o);
+		}
+		struct mline *c = *o + (*no)++;
+		mline_init(c, l);
+		int q = 2 * s + e; // entry end of the current segment
+		c->k[0] = pass ? -1 : t->sk[q] + l;
+		mline_push_back(c, t->sp[2*q+0], t->sp[2*q+1]);
+		while (1)
+		{
+			t->used[q/2] = true;
+			int z = q ^ 1; // exit end
+			mline_push_back(c, t->sp[2*z+0], t->sp[2*z+1]);
+			int le = t->se[z];
+			if (t->ec[le] == 1) { // end of an open chain
+				c->k[1] = t->sk[z] + l;
+				break;
+			}
+			q = t->es[2*le] == z ? t->es[2*le+1] : t->es[2*le];
+			if (t->used[q/2]) // back to the start of a closed one
+				break;
+		}
+		if (pass) c->k[1] = -1;
+	}
+
+	// reset the edges
+	for (int q = 0; q < 2 * t->ns; q++)
+		t->ec[t->se[q]] = 0;
+}
+
+// joins {{{1
+
+// hash table of the open ends of the polylines
+struct mends {
+	long cap;
+	long *k;        // keys (-1 empty)
+	int *c;         // polyline (-1 removed)
+};
+
+static void mends_init(struct mends *h, long n)
+{
+	h->cap = 16;
+	while (h->cap < 4 * n) h->cap *= 2;
+	h->k = xmalloc(h->cap * sizeof*h->k);
+	h->c = xmalloc(h->cap * sizeof*h->c);
+	for (long i = 0; i < h->cap; i++)
+		h->k[i] = -1;
+}
+
+static void mends_free(struct mends *h)
+{
+	free(h->k);
+	free(h->c);
+}
+
+static long mends_slot(struct mends *h, long key)
+{
+	unsigned long z = key * 0x9e3779b97f4a7c15ul;
+	long i = (z >> 20) & (h->cap - 1);
+	while (h->k[i] >= 0 && h->k[i] != key)
+		i = (i + 1) & (h->cap - 1);
+	return i;
+}
+
+static void mends_put(struct mends *h, long key, int c)
+{
+	long i = mends_slot(h, key);
+	h->k[i] = key;
+	h->c[i] = c;
+}
+
+// polyline with an end at the given key, or -1 (the entry is removed)
+static int mends_take(struct mends *h, long key)
+{
+	long i = mends_slot(h, key);
+	if (h->k[i] < 0) return -1;
+	int c = h->c[i];
+	h->c[i] = -1;
+	return c;
+}
+
+// whether the key is on the horizontal edges of the row j
+static bool mkey_on_row(struct marching_lines *m, long key, int j)
+{
+	long e = key / m->nl;
+	return !(e % 2) && e / 2 / m->w == j;
+}
+
+// join the polylines of a band (after the pending ones, in the same array),
+// emit the complete ones, and keep those that end on the row jb
+static void marching_lines_join(struct marching_lines *m,
+		struct mline *c, int n, int jb)
+{
+	struct mends h[1];
+	mends_init(h, 2 * (long)n);
+	for (int i = 0; i < n; i++)
+	{
+		if (c[i].k[0] < 0) continue; // closed in its tile
+		for (int e = 0; e < 2 && c[i].k[0] != c[i].k[1]; e++)
+		{
+			int d = mends_take(h, c[i].k[e]);
+			if (d < 0) continue;
+			long other = c[d].k[c[d].k[0] == c[i].k[e]];
+			mends_take(h, other);
+			mline_join(c + i, c + d, c[i].k[e]);
+			e = -1; // the ends have changed, look again
+		}
+		if (c[i].k[0] == c[i].k[1]) { // closed by the joins (the last
+			c[i].k[0] = c[i].k[1] = -1; // point is already the first)
+			continue;
+		}
+		mends_put(h, c[i].k[0], i);
+		mends_put(h, c[i].k[1], i);
+	}
+	mends_free(h);
+
+	// emit the complete polylines, keep the pending ones
+	m->npending = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (c[i].dead) continue;
+		if (c[i].k[0] >= 0 && (mkey_on_row(m, c[i].k[0], jb)
+					|| mkey_on_row(m, c[i].k[1], jb)))
+			c[m->npending++] = c[i];
+		else
+			mline_emit(m, c + i);
+	}
+}
+
+// bands {{{1
+
+// process the cells of the rows j0..j0+n-1, given the rows of the image
+// x[0..n] (that is, j0..j0+n, or less at the end of the image)
+static void marching_lines_band(struct marching_lines *m, float *x,
+		int j0, int n)
+{
+	if (j0 + n > m->h - 1) n = m->h - 1 - j0;
+	if (n <= 0) return;
+	int nt = (m->w - 1 + m->tw - 1) / m->tw; // tiles of this band
+	struct mline **to = xmalloc((nt + 1) * sizeof*to);
+	int *tn = xmalloc((nt + 1) * sizeof*tn);
+	for (int t = 0; t < nt; t++)
+	{
+		to[t] = NULL;
+		tn[t] = 0;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		struct mtile t[1];
+		mtile_init(t, m->tw, n);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int k = 0; k < nt; k++)
+		{
+			int i0 = k * m->tw;
+			int i1 = i0 + m->tw < m->w - 1 ? i0 + m->tw : m->w - 1;
+			int co = 0;
+			for (int l = 0; l < m->nl; l++)
+				mtile_lines(to + k, tn + k, &co, t, m, x, j0,
+						i0, i1, j0, j0 + n, l);
+		}
+		mtile_free(t);
+	}
+
+	// pending polylines first, then those of the tiles in order
+	int total = m->npending;
+	for (int t = 0; t < nt; t++)
+		total += tn[t];
+	if (total > m->cappending) {
+		m->cappending = total;
+		m->pending = xrealloc(m->pending, total * sizeof*m->pending);
+	}
+	int c = m->npending;
+	for (int t = 0; t < nt; t++)
+	{
+		memcpy(m->pending + c, to[t], tn[t] * sizeof*m->pending);
+		c += tn[t];
+		free(to[t]);
+	}
+	free(to);
+	free(tn);
+	marching_lines_join(m, m->pending, total, j0 + n < m->h - 1 ? j0 + n : -1);
+}
+
+// emit the remaining polylines
+static void marching_lines_end(struct marching_lines *m)
+{
+	for (int i = 0; i < m->npending; i++)
+		mline_emit(m, m->pending + i);
+	free(m->pending);
+	free(m->l);
+	m->pending = NULL;
+	m->npending = m->cappending = 0;
+}
+
+#endif//_MARCHING_LINES_C
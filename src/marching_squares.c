@@ -1,6 +1,6 @@
 #include <assert.h>
 
-#ifndef xmalloc
+#if !defined(xmalloc) && !defined(_XMALLOC_C)
 #include <stdlib.h>
 #define xmalloc malloc
 #endif//xmalloc
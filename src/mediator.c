@@ -2,7 +2,20 @@
 //
 // Image filtering adaptation by Gabriele Facciolo, 2017
 //
+// The NaN-aware mediator keeps the NaNs of the window as infinite values,
+// half of them -INFINITY and half +INFINITY, so that the heaps keep a total
+// order.  The median of the finite items is then the median of the window or
+// one of its two neighbors in the heaps.  When the oldest item leaves, the
+// two counts may differ by two, and then one of the infinities is flipped.
+//
+// The image is filtered by one mediator per row and channel, the rows are
+// processed in parallel.  Besides the exact dxd window, the filter can be
+// applied to 1xd or dx1 windows, or separably (the median of the rows and
+// then of the columns, an approximation of the 2D median that costs
+// O(log d) per pixel instead of O(d log d)).
+//
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <math.h>
 
@@ -86,6 +99,17 @@ int maxSortUp(struct Mediator* m, int i)
 /*--- Public Interface ---*/
 
 
+//empties the Mediator, to start a new stream
+void MediatorReset(struct Mediator* m)
+{
+   int nItems = m->N;
+   m->ct = m->idx = 0;
+   while (nItems--)  //set up initial heap fill pattern: median,max,min,max,...
+   {  m->pos[nItems]= ((nItems+1)/2) * ((nItems&1)?-1:1);
+      m->heap[m->pos[nItems]]=nItems;
+   }
+}
+
 //creates new Mediator: to calculate `nItems` running median.
 //mallocs single block of memory, caller must free.
 struct Mediator* MediatorNew(int nItems)
@@ -96,11 +120,7 @@ struct Mediator* MediatorNew(int nItems)
    m->pos = (int*) (m->data+nItems);
    m->heap = m->pos+nItems + (nItems/2); //points to middle of storage.
    m->N=nItems;
-   m->ct = m->idx = 0;
-   while (nItems--)  //set up initial heap fill pattern: median,max,min,max,...
-   {  m->pos[nItems]= ((nItems+1)/2) * ((nItems&1)?-1:1);
-      m->heap[m->pos[nItems]]=nItems;
-   }
+   MediatorReset(m);
    return m;
 }
 
@@ -128,6 +148,27 @@ void MediatorInsert(struct Mediator* m, Item v)
    }
 }
 
+//Replaces the item at position q of the queue (among the ct inserted items),
+//maintains median in O(lg nItems)
+void MediatorReplace(struct Mediator* m, int q, Item v)
+{
+   int p = m->pos[q];
+   Item old = m->data[q];
+   m->data[q]=v;
+   if (p>0)         //item is in minHeap
+   {  if (ItemLess(old,v)) { minSortDown(m,p*2);  }
+      else if (minSortUp(m,p)) { maxSortDown(m,-1); }
+   }
+   else if (p<0)   //item is in maxheap
+   {  if (ItemLess(v,old)) { maxSortDown(m,p*2); }
+      else if (maxSortUp(m,p)) { minSortDown(m, 1); }
+   }
+   else            //item is at median
+   {  if (maxCt(m)) { maxSortDown(m,-1); }
+      if (minCt(m)) { minSortDown(m, 1); }
+   }
+}
+
 //returns median item (or average of 2 when item count is even)
 Item MediatorMedian(struct Mediator* m)
 {
@@ -176,25 +217,189 @@ Item MediatorMedian(struct Mediator* m)
 
 
 
-// the type of a "getpixel" function
-typedef float (*getpixel_operator)(float*,int,int,int,int);
+/*--- NaN-aware Mediator ---*/
+
+struct NanMediator
+{
+   struct Mediator* m;
+   signed char* side; //for each item of the queue: 0, or 1 (-inf), 2 (+inf)
+   int* list[2];      //queue positions of the -inf and +inf items
+   int* at;           //index of each such position in its list
+   int  n[2];         //number of -inf and +inf items
+};
+
+struct NanMediator* NanMediatorNew(int nItems)
+{
+   struct NanMediator* e = malloc(sizeof*e);
+   e->m = MediatorNew(nItems);
+   e->side = malloc(nItems*sizeof*e->side);
+   e->list[0] = malloc(3*nItems*sizeof(int));
+   e->list[1] = e->list[0] + nItems;
+   e->at = e->list[1] + nItems;
+   for (int i = 0; i < nItems; i++) e->side[i] = 0;
+   e->n[0] = e->n[1] = 0;
+   return e;
+}
 
-// extrapolate by nearest value (useful for Neumann boundary conditions)
-static float getpixel_1(float *I, int w, int h, int i, int j)
+void NanMediatorFree(struct NanMediator* e)
 {
-	if (i < 0) i = 0;
-	if (j < 0) j = 0;
-	if (i >= w) i = w-1;
-	if (j >= h) j = h-1;
-	return I[i+j*w];
+   free(e->list[0]);
+   free(e->side);
+   free(e->m);
+   free(e);
 }
 
+void NanMediatorReset(struct NanMediator* e)
+{
+   MediatorReset(e->m);
+   for (int i = 0; i < e->m->N; i++) e->side[i] = 0;
+   e->n[0] = e->n[1] = 0;
+}
+
+static void nanListAdd(struct NanMediator* e, int s, int q)
+{
+   e->side[q] = s + 1;
+   e->at[q] = e->n[s];
+   e->list[s][e->n[s]++] = q;
+}
+
+static void nanListRemove(struct NanMediator* e, int q)
+{
+   int s = e->side[q] - 1, last = e->list[s][--e->n[s]];
+   e->list[s][e->at[q]] = last;
+   e->at[last] = e->at[q];
+   e->side[q] = 0;
+}
+
+//Inserts item (the NaNs are kept as infinities, balanced between both sides)
+void NanMediatorInsert(struct NanMediator* e, Item v)
+{
+   int q = e->m->idx;
+   if (e->side[q]) nanListRemove(e, q);
+   if (isnan(v))
+   {  int s = e->n[0] <= e->n[1] ? 0 : 1;
+      nanListAdd(e, s, q);
+      v = s ? INFINITY : -INFINITY;
+   }
+   MediatorInsert(e->m, v);
+   int s = e->n[0] > e->n[1] + 1 ? 0 : e->n[1] > e->n[0] + 1 ? 1 : -1;
+   if (s >= 0)     //flip an infinity of the larger side
+   {  int p = e->list[s][e->n[s]-1];
+      nanListRemove(e, p);
+      nanListAdd(e, !s, p);
+      MediatorReplace(e->m, p, s ? -INFINITY : INFINITY);
+   }
+}
+
+//returns median of the non-NaN items (NaN if there are none)
+Item NanMediatorMedian(struct NanMediator* e)
+{
+   struct Mediator* m = e->m;
+   int v = m->ct - e->n[0] - e->n[1], d = e->n[1] - e->n[0];
+   if (v < 1) return NAN;
+   if (!d) return MediatorMedian(m);
+   Item a = m->data[m->heap[0]], b = m->data[m->heap[d>0 ? -1 : 1]];
+   if (v&1) return d>0 ? b : a;
+   return ItemMean(a, b);
+}
+
+
+/*--- Image filters ---*/
+
+// y[i*s] = median of the samples x[k*s] for k in [i-r, i+r] (the indices are
+// clamped to [0,n-1], the NaNs are ignored), for i in [0,n-1]
+// (y can be x; e is a NaN-aware mediator of 2r+1 items)
+static void median_filter_line(float *y, float *x, int n, long s, int r,
+		struct NanMediator *e)
+{
+	NanMediatorReset(e);
+	for (int i = -r; i < n + r; i++)
+	{
+		int k = i < 0 ? 0 : i < n ? i : n - 1;
+		NanMediatorInsert(e, x[k*s]);
+		if (i - r >= 0)
+			y[(i-r)*s] = NanMediatorMedian(e);
+	}
+}
+
+// median of radius r along the rows (dx = 1, dy = w) or along the columns
+// (dx = w, dy = 1) of the image x of size w x h, with pd planes
+static void median_filter_lines(float *y, float *x, int w, int h, int pd,
+		int r, int along_columns)
+{
+	int n = along_columns ? h : w, nl = along_columns ? w : h;
+	long s = along_columns ? w : 1, t = along_columns ? 1 : w;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		struct NanMediator *e = NanMediatorNew(2*r + 1);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int q = 0; q < pd * nl; q++)
+		{
+			long o = (q / nl) * (long)w * h + (q % nl) * t;
+			median_filter_line(y + o, x + o, n, s, r, e);
+		}
+		NanMediatorFree(e);
+	}
+}
+
+// median in the square windows of side 2r+1 (the samples outside the image
+// are given by the nearest ones, the NaNs are ignored)
+static void median_filter_square(float *y, float *x, int w, int h, int pd,
+		int r)
+{
+	int d = 2*r + 1;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		struct NanMediator *e = NanMediatorNew(d*d);
+		float *row[d];
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int q = 0; q < pd * h; q++)
+		{
+			int c = q / h, j = q % h;
+			float *xc = x + c * (long)w * h;
+			for (int k = -r; k <= r; k++)
+			{
+				int jj = j + k < 0 ? 0 : j + k < h ? j + k : h - 1;
+				row[k+r] = xc + jj * (long)w;
+			}
+			NanMediatorReset(e);
+			float *yj = y + c * (long)w * h + j * (long)w;
+			for (int i = -r; i < w + r; i++)
+			{
+				int ii = i < 0 ? 0 : i < w ? i : w - 1;
+				for (int k = 0; k < d; k++)
+					NanMediatorInsert(e, row[k][ii]);
+				if (i - r >= 0)
+					yj[i-r] = NanMediatorMedian(e);
+			}
+		}
+		NanMediatorFree(e);
+	}
+}
+
+#include "pickopt.c"
+
 int main(int argc, char* argv[])
 {
+   bool separable = pick_option(&argc, &argv, "s", NULL);
+   bool horizontal = pick_option(&argc, &argv, "x", NULL);
+   bool vertical = pick_option(&argc, &argv, "y", NULL);
    if (argc<2) {
       fprintf(stderr, "fast median filtering using dxd windows:\n");
-      fprintf(stderr, "usage: %s d [in [out]]\n", argv[0]);
-      //                      0  1  2   3
+      fprintf(stderr, "usage: %s [-s|-x|-y] d [in [out]]\n", argv[0]);
+      //                      0            1  2   3
+      fprintf(stderr, "\t-s\tseparable approximation (rows, then columns)\n");
+      fprintf(stderr, "\t-x\thorizontal windows of size 1xd\n");
+      fprintf(stderr, "\t-y\tvertical windows of size dx1\n");
+      fprintf(stderr, "(the NaNs are ignored)\n");
       return 0;
    }
    char *filename_in  = argc > 2 ? argv[2] : "-";
@@ -212,24 +417,15 @@ int main(int argc, char* argv[])
    float *in = iio_read_image_float_split(filename_in, &w, &h, &pd);
    float *out = malloc(sizeof*out*w*h*pd);
 
-   struct Mediator* m = MediatorNew(size*size);
-
-   getpixel_operator p = getpixel_1;
-   for (int c=0;c<pd;c++) {
-      for(int j=0;j<h;j++) {
-         for(int i=-hsize;i<w+hsize;i++) {
-            for(int k=-hsize;k<=hsize;k++) {
-               MediatorInsert(m, p(in + c*w*h, w, h, i, (j+k)) );
-            }
-            if((i-hsize)>=0 && (i-hsize)<w) {
-               out[c*w*h +(j)*w +(i-hsize)]=MediatorMedian(m);
-            }
-         }
-      }
-   }
+   if (horizontal && vertical) separable = true;
+   if (horizontal || separable)
+      median_filter_lines(out, in, w, h, pd, hsize, 0);
+   if (vertical || separable)
+      median_filter_lines(out, separable ? out : in, w, h, pd, hsize, 1);
+   if (!horizontal && !vertical && !separable)
+      median_filter_square(out, in, w, h, pd, hsize);
 
    iio_write_image_float_split(filename_out, out, w, h, pd);
-   free(m);
    free(out);
    free(in);
 }
@@ -55,6 +55,52 @@ void fancy_conjugate_gradient(double *x,
 	free(Ap);
 }
 
+// preconditioned conjugate gradient method
+// (M applies the inverse of the preconditioner, both maps must be SPD)
+int fancy_preconditioned_conjugate_gradient(double *x,
+		linear_map_t A, linear_map_t M, double *b, int n, void *e,
+		double *x0, int max_iter, double min_residual)
+{
+	double *r  = malloc(n * sizeof(double));
+	double *z  = malloc(n * sizeof(double));
+	double *p  = malloc(n * sizeof(double));
+	double *Ap = malloc(n * sizeof(double));
+
+	A(Ap, x0, n, e);
+
+	FOR(i,n) x[i] = x0[i];
+	FOR(i,n) r[i] = b[i] - Ap[i];
+	M(z, r, n, e);
+	FOR(i,n) p[i] = z[i];
+
+	double rz = scalar_product(r, z, n);
+	double r0 = sqrt(scalar_product(r, r, n)), rn = r0;
+	int iter = 0;
+	while (iter < max_iter && rn >= min_residual) {
+		A(Ap, p, n, e);
+		double   alpha  = rz / scalar_product(Ap, p, n);
+		FOR(i,n) x[i]   = x[i] + alpha * p[i];
+		FOR(i,n) r[i]   = r[i] - alpha * Ap[i];
+		rn = sqrt(scalar_product(r, r, n));
+		iter += 1;
+		if (rn < min_residual)
+			break;
+		M(z, r, n, e);
+		double   rz_new = scalar_product(r, z, n);
+		double   beta   = rz_new / rz;
+		FOR(i,n) p[i]   = z[i] + beta * p[i];
+		rz = rz_new;
+	}
+	fprintf(stderr, "pcg: n=%d, %d iterations, residual %g -> %g\n",
+			n, iter, r0, rn);
+
+	free(r);
+	free(z);
+	free(p);
+	free(Ap);
+	return iter;
+}
+
 #undef FOR
 
 // conjugate gradient method with default parameters
@@ -0,0 +1,136 @@
+#ifndef _APPROXMAP_C
+#define _APPROXMAP_C
+
+// piecewise bilinear approximation of smooth maps of the plane
+//
+// A map f(i,j) = (x,y) given by an expensive function (e.g., the composition
+// of rpc projections) is tabulated on the grid of pixels of an output image.
+// The grid is cut into square tiles, and on each tile f is replaced by the
+// bilinear interpolation of its values at the four corners (which is exact
+// for affine maps).  The error is checked at the center and at the midpoints
+// of the sides, and a tile where it is above the tolerance is split in four,
+// recursively, until the tiles become so small that f is simply evaluated at
+// all their pixels.  The top-level tiles are processed in parallel.  For the
+// typical maps of orthorectification, about one evaluation of f for each
+// several hundreds of pixels is enough.
+
+#include <math.h>
+
+#ifndef APPROXMAP_TILE
+#define APPROXMAP_TILE 64 // side of the top-level tiles (a power of two)
+#endif
+
+// the type of an approximated map, out = f(e, i, j)
+typedef void approxmap_f(double out[2], void *e, double i, double j);
+
+// bilinear interpolation of the corners c[0..3] (11, 21, 12, 22) at (s,t)
+static void approxmap_bilinear(double r[2], double c[4][2], double s, double t)
+{
+	for (int k = 0; k < 2; k++)
+		r[k] = (1-s)*(1-t)*c[0][k] + s*(1-t)*c[1][k]
+			+ (1-s)*t*c[2][k] + s*t*c[3][k];
+}
+
+// fill the pixels [i0,i0+n) x [j0,j0+n) (clipped to w x h) of the map y,
+// given the values c of f at the corners (i0,j0), (i0+n,j0), (i0,j0+n) and
+// (i0+n,j0+n), where n is a power of two; returns the number of evaluations
+static long approxmap_tile(float *y, int w, int h, approxmap_f *f, void *e,
+		double tol, int i0, int j0, int n, double c[4][2])
+{
+	long r = 0;
+	if (n <= 2) {
+		for (int j = j0; j < j0 + n && j < h; j++)
+		for (int i = i0; i < i0 + n && i < w; i++)
+		{
+			double v[2];
+			f(v, e, i, j);
+			y[2*(j*(long)w+i)+0] = v[0];
+			y[2*(j*(long)w+i)+1] = v[1];
+			r += 1;
+		}
+		return r;
+	}
+
+	// values at the midpoints: a 3x3 grid with the corners
+	int m = n / 2, ok = 1;
+	double g[3][3][2];
+	for (int k = 0; k < 2; k++)
+	{
+		g[0][0][k] = c[0][k]; g[0][2][k] = c[1][k];
+		g[2][0][k] = c[2][k]; g[2][2][k] = c[3][k];
+	}
+	for (int q = 0; q < 3; q++)
+	for (int p = 0; p < 3; p++)
+		if (p == 1 || q == 1) {
+			f(g[q][p], e, i0 + p*m, j0 + q*m);
+			r += 1;
+			double b[2];
+			approxmap_bilinear(b, c, p/2.0, q/2.0);
+			double *v = g[q][p];
+			if (!(hypot(b[0] - v[0], b[1] - v[1]) <= tol))
+				ok = 0;
+		}
+
+	if (ok) {
+		for (int j = j0; j < j0 + n && j < h; j++)
+		for (int i = i0; i < i0 + n && i < w; i++)
+		{
+			double v[2];
+			approxmap_bilinear(v, c, (i - i0)/(double)n,
+					(j - j0)/(double)n);
+			y[2*(j*(long)w+i)+0] = v[0];
+			y[2*(j*(long)w+i)+1] = v[1];
+		}
+		return r;
+	}
+
+	// split in four (the corners of the quadrants are in the 3x3 grid)
+	for (int q = 0; q < 2; q++)
+	for (int p = 0; p < 2; p++)
+	{
+		int a = i0 + p*m, b = j0 + q*m;
+		if (a >= w || b >= h) continue;
+		double d[4][2];
+		for (int k = 0; k < 2; k++)
+		{
+			d[0][k] = g[q  ][p  ][k]; d[1][k] = g[q  ][p+1][k];
+			d[2][k] = g[q+1][p  ][k]; d[3][k] = g[q+1][p+1][k];
+		}
+		r += approxmap_tile(y, w, h, f, e, tol, a, b, m, d);
+	}
+	return r;
+}
+
+// y[2*(j*w+i)+k] = component k of f(i,j), up to the tolerance tol (for
+// tol <= 0, f is evaluated exactly at each pixel); returns the number of
+// evaluations of f
+static long approxmap_fill(float *y, int w, int h, approxmap_f *f, void *e,
+		double tol)
+{
+	int T = tol > 0 ? APPROXMAP_TILE : 1;
+	int nx = (w + T - 1) / T, ny = (h + T - 1) / T;
+	long r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:r)
+#endif
+	for (int t = 0; t < nx * ny; t++)
+	{
+		int i0 = (t % nx) * T, j0 = (t / nx) * T;
+		double c[4][2];
+		if (T == 1) {
+			f(c[0], e, i0, j0);
+			y[2*(j0*(long)w+i0)+0] = c[0][0];
+			y[2*(j0*(long)w+i0)+1] = c[0][1];
+			r += 1;
+			continue;
+		}
+		f(c[0], e, i0    , j0    );
+		f(c[1], e, i0 + T, j0    );
+		f(c[2], e, i0    , j0 + T);
+		f(c[3], e, i0 + T, j0 + T);
+		r += 4 + approxmap_tile(y, w, h, f, e, tol, i0, j0, T, c);
+	}
+	return r;
+}
+
+#endif//_APPROXMAP_C
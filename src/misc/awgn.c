@@ -21,9 +21,13 @@ int main(int c, char *v[])
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(in, &w, &h, &pd);
 
-	xsrand(SRAND());
-	for (int i = 0; i < w*h*pd; i++)
-		x[i] += s * random_normal();
+	// (the noise of each sample depends only on the seed and its position)
+	uint64_t seed = SRAND();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < (long)w*h*pd; i++)
+		x[i] += s * random_philox_normal(seed, 0, i);
 	iio_write_image_float_vec(out, x, w, h, pd);
 
 	return EXIT_SUCCESS;
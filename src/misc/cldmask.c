@@ -23,6 +23,11 @@ int read_cloud_mask_from_gml_file(struct cloud_mask *m, char *filename);
 
 void clouds_mask_fill(int *out_img, int w, int h, struct cloud_mask *in_mask);
 
+// rule is one of the POLYFILL_* of polyfill.c, aa the number of sub-scanlines
+// for antialiasing (the output is the coverage), or 0
+void clouds_mask_raster(float *out_img, int w, int h, struct cloud_mask *in_mask,
+		int rule, int aa);
+
 
 
 
@@ -41,7 +46,7 @@ void clouds_mask_fill(int *out_img, int w, int h, struct cloud_mask *in_mask);
 #include "xmalloc.c"
 #include "xfopen.c"
 #include "parsenumbers.c"
-#include "drawsegment.c"
+#include "polyfill.c"
 
 // read stream until character "stop" is found
 // if EOF is reached, return NULL
@@ -177,126 +182,6 @@ int read_cloud_mask_from_txt_file(struct cloud_mask *m, char *filename)
 	return 0;
 }
 
-static void putpixel_0(int *img, int w, int h, float x, float y, int v)
-{
-	int i = round(x);
-	int j = round(y);
-	if (i >= 0 && j >= 0 && i < w && j < h)
-		img[j*w+i] = v;
-}
-
-struct plot_data { int *x; int w, h; int c; };
-static void plot_pixel(int i, int j, void *e)
-{
-	struct plot_data *d = e;
-	putpixel_0(d->x, d->w, d->h, i, j, d->c);
-}
-
-static void plot_segment_gray(int *img, int w, int h,
-		float a[2], float b[2], int c)
-{
-	int p[2] = {round(a[0]), round(a[1])};
-	int q[2] = {round(b[0]), round(b[1])};
-	fprintf(stderr, "%d %d %d %d\n", p[0], p[1], q[0], p[1]);
-	struct plot_data d = { img, w, h, c };
-	traverse_segment(p[0], p[1], q[0], q[1], plot_pixel, &d);
-}
-
-// dsf = "disjoint set forest"
-static int dsf_find(int *t, int a)
-{
-	if (a != t[a])
-		t[a] = dsf_find(t, t[a]);
-	return t[a];
-}
-
-static int dsf_make_link(int *t, int a, int b)
-{
-	if (a < b) { // arbitrary choice
-		t[b] = a;
-		return a;
-	} else {
-		t[a] = b;
-		return b;
-	}
-}
-
-static int dsf_join(int *t, int a, int b)
-{
-	a = dsf_find(t, a);
-	b = dsf_find(t, b);
-	if (a != b)
-		b = dsf_make_link(t, a, b);
-	return b;
-}
-
-// connected components of positive pixels of the image rep
-static void positive_connected_component_filter(int *rep, int w, int h)
-{
-	for (int i = 0; i < w*h; i++)
-		if (rep[i] >= 0)
-			rep[i] = i;
-	for (int j = 0; j < h - 1; j++)
-	for (int i = 0; i < w - 1; i++)
-	{
-		int p0 = j*w + i;
-		int p1 = j*w + i+1;
-		int p2  = (j+1)*w + i;
-		if (rep[p0] >= 0 && rep[p1] >= 0)
-			dsf_join(rep, p0, p1);
-		if (rep[p0] >= 0 && rep[p2] >= 0)
-			dsf_join(rep, p0, p2);
-
-	}
-	for (int i = 0; i < w*h; i++)
-		if (rep[i] >= 0)
-			rep[i] = dsf_find(rep, i);
-}
-
-// signed area of triangle ABC
-static double triangle_area(double A[2], double B[2], double C[2])
-{
-	double X[2] = {B[0] - A[0], B[1] - A[1]};
-	double Y[2] = {C[0] - A[0], C[1] - A[1]};
-	return X[0]*Y[1] - X[1]*Y[0];
-}
-
-// test wether point X is inside triangle ABC
-static int winding_triangle(double A[2], double B[2], double C[2], double X[2])
-{
-	double v1 = triangle_area(A, B, X);
-	double v2 = triangle_area(B, C, X);
-	double v3 = triangle_area(C, A, X);
-	int r = 0;
-	if (v1 >= 0 && v2 >= 0 && v3 >= 0) r = 1;
-	if (v1 < 0 && v2 < 0 && v3 < 0) r = -1;
-	return r;
-}
-
-// winding number of point (x,y) with respect to a single polygon
-static int winding_number_polygon(struct cloud_polygon *p, int x, int y)
-{
-	int r = 0;
-	for (int i = 1; i < p->n - 2; i++)
-	{
-		double *A = p->v;
-		double *B = p->v + 2*(i);
-		double *C = p->v + 2*(i+1);
-		double X[2] = {x, y};
-		r += abs(winding_triangle(A, B, C, X));
-	}
-	return r;
-}
-
-// winding number of point (x,w) with respect to all polygons of the mask
-static int winding_number_clouds(struct cloud_mask *m, int x, int y)
-{
-	int r = 0;
-	for (int i = 0; i < m->n; i++)
-		r += winding_number_polygon(m->t + i, x, y);
-	return r;
-}
-
 // rescale a cloud of points to fit in the given rectangle
 static void cloud_mask_rescale(struct cloud_mask *m, int w, int h)
 {
@@ -336,65 +221,32 @@ static void cloud_mask_homography(struct cloud_mask *m, double *H)
 			apply_homography(2*j+m->t[i].v, H, 2*j+m->t[i].v);
 }
 
-void clouds_mask_fill(int *img, int w, int h, struct cloud_mask *m)
+void clouds_mask_raster(float *y, int w, int h, struct cloud_mask *m,
+		int rule, int aa)
 {
-	// initialize the image to 0
-	for (int i = 0; i < w*h; i++)
-		img[i] = 0;
-
-	// plot the pixels at the cloud edges with the value -1
+	double **p = xmalloc(m->n * sizeof*p);
+	int *n = xmalloc(m->n * sizeof*n);
 	for (int i = 0; i < m->n; i++)
 	{
-		struct cloud_polygon *p = m->t + i;
-		for (int j = 0; j < p->n - 1; j++)
-		{
-			float a[2] = {p->v[2*j+0], p->v[2*j+1]};
-			float b[2] = {p->v[2*j+2], p->v[2*j+3]};
-			plot_segment_gray(img, w, h, a, b, -1);
-			putpixel_0(img, w, h, a[0], a[1], -2);
-			putpixel_0(img, w, h, b[0], b[1], -2);
-		}
-	}
-
-	// identify the connected components of positive values
-	positive_connected_component_filter(img, w, h);
-
-
-	// identify the connected components that are background
-	int maxcomp = 100 + 2*m->n; // heuristic
-	int background_ids[maxcomp], n_background_ids = 0;
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		int idx = j*w + i;
-		if (img[idx] == idx)
-		{
-			int r = winding_number_clouds(m, i, j);
-			if (!r) {
-				background_ids[n_background_ids] = idx;
-				n_background_ids += 1;
-				if (n_background_ids >= maxcomp)
-					fail("bad heuristic of background"
-						       " components %d %d",
-						       n_background_ids, maxcomp
-						       );
-			}
-		}
+		p[i] = m->t[i].v;
+		n[i] = m->t[i].n;
 	}
+	struct polyfill t[1];
+	polyfill_init(t, w, h, p, n, m->n, rule, aa);
+	polyfill_raster(y, t);
+	polyfill_free(t);
+	free(n);
+	free(p);
+}
 
-	// paint the background pixels in black, the clouds in white
-	for (int i = 0; i < w*h; i++)
-	{
-		bool bP = false;
-		for (int j = 0; j < n_background_ids; j++)
-			if (img[i] == background_ids[j])
-				bP = true;
-		//int j = 0;
-		//while (j < n_background_ids)
-		//	if (img[i] == background_ids[j++])
-		//		break;
-		img[i] = bP ? 0 : 255;
-	}
+// the union of the clouds, in white
+void clouds_mask_fill(int *img, int w, int h, struct cloud_mask *m)
+{
+	float *y = xmalloc(w * (long)h * sizeof*y);
+	clouds_mask_raster(y, w, h, m, POLYFILL_UNION, 0);
+	for (long i = 0; i < w * (long)h; i++)
+		img[i] = 255 * y[i];
+	free(y);
 }
 
 
@@ -414,11 +266,19 @@ int main(int c, char *v[])
 	char *Hstring = pick_option(&c, &v, "h", "");
 	bool option_t = pick_option(&c, &v, "t", NULL);
 	bool option_c = pick_option(&c, &v, "c", NULL);
+	char *rule_name = pick_option(&c, &v, "r", "union");
+	int aa = atoi(pick_option(&c, &v, "a", "0"));
 	if (c != 5 && c!= 4 && c != 3) {
 		return fprintf(stderr, "usage:\n\t%s"
-		"width height [-h \"h1 ... h9\"] [clouds.gml [out.png]]\n", *v);
+		"width height [-h \"h1 ... h9\"] [-r union|nonzero|evenodd] "
+		"[-a subrows] [clouds.gml [out.png]]\n", *v);
 		//   1 2                          3           4
 	}
+	int rule = POLYFILL_UNION;
+	if (0 == strcmp(rule_name, "nonzero")) rule = POLYFILL_NONZERO;
+	else if (0 == strcmp(rule_name, "evenodd")) rule = POLYFILL_EVENODD;
+	else if (0 != strcmp(rule_name, "union"))
+		fail("unrecognized fill rule \"%s\"", rule_name);
 	int out_width = atoi(v[1]);
 	int out_height = atoi(v[2]);
 	char *filename_clg = c > 3 ? v[3] : "-";
@@ -462,7 +322,11 @@ int main(int c, char *v[])
 
 
 	// draw mask over output image
-	clouds_mask_fill(x, w, h, m);
+	float *y = xmalloc(w*h*sizeof*y);
+	clouds_mask_raster(y, w, h, m, rule, aa);
+	for (int i = 0; i < w*h; i++)
+		x[i] = lrint(255 * y[i]);
+	free(y);
 
 	// save output image
 	iio_write_image_int(filename_out, x, w, h);
@@ -12,7 +12,7 @@ bandhisto.o: bandhisto.c iio.h
 basify.o: basify.c
 bayerdots.o: bayerdots.c iio.h
 bayerparts.o: bayerparts.c iio.h
-blur.o: blur.c fail.c xmalloc.c smapa.h iio.h parsenumbers.c
+blur.o: blur.c fail.c xmalloc.c xarena.c smapa.h iio.h parsenumbers.c
 bmfm.o: bmfm.c xmalloc.c fail.c getpixel.c
 bmfm_fancier.o: bmfm_fancier.c xmalloc.c fail.c getpixel.c
 bmfm_fancierw.o: bmfm_fancierw.c xmalloc.c fail.c getpixel.c
@@ -31,7 +31,7 @@ cgpois_rec.o: cgpois_rec.c conjugate_gradient.c xmalloc.c fail.c smapa.h \
 chan.o: chan.c iio.h
 chisto.o: chisto.c iio.h xmalloc.c fail.c smapa.h
 cldmask.o: cldmask.c fail.c xmalloc.c xfopen.c parsenumbers.c \
- drawsegment.c iio.h pickopt.c
+ polyfill.c iio.h pickopt.c
 cline.o: cline.c fail.c bicubic.c getpixel.c bilinear_interpolation.c \
  iio.h smapa.h
 closeup.o: closeup.c iio.h marching_squares.c marching_interpolation.c \
@@ -59,19 +59,21 @@ drawroads.o: drawroads.c drawsegment.c iio.h fail.c parsenumbers.c \
  xmalloc.c pickopt.c
 dveco.o: dveco.c iio.h fail.c xmalloc.c random.c pickopt.c
 dvecov_lm.o: dvecov_lm.c iio.h fail.c xmalloc.c pickopt.c
-elap.o: elap.c iio.h
-elap2.o: elap2.c iio.h
-elap3.o: elap3.c iio.h
-elap_rec.o: elap_rec.c iio.h
-elap_recsep.o: elap_recsep.c smapa.h iio.h
-elevate_matches.o: elevate_matches.c iio.h xfopen.c fail.c
+elap.o: elap.c elap_engine.c xmalloc.c fail.c smapa.h iio.h
+elap2.o: elap2.c elap_engine.c xmalloc.c fail.c smapa.h distance.c abstract_heap.h \
+ iio.h
+elap3.o: elap3.c elap_engine.c xmalloc.c fail.c smapa.h iio.h
+elap_rec.o: elap_rec.c elap_engine.c xmalloc.c fail.c smapa.h iio.h
+elap_recsep.o: elap_recsep.c elap_engine.c xmalloc.c fail.c smapa.h iio.h
+elevate_matches.o: elevate_matches.c fancy_image.h xfopen.c fail.c \
+ xmalloc.c pickopt.c
 elevate_matcheshh.o: elevate_matcheshh.c iio.h xfopen.c fail.c \
  parsenumbers.c xmalloc.c
 fabius.o: fabius.c
 fancy_evals.o: fancy_evals.c fancy_image.c fancy_image.h iio.h xmalloc.c \
- fail.c tiff_octaves_rw.c
+ fail.c tiff_octaves_rw.c bitpack.c
 fancy_image.o: fancy_image.c fancy_image.h iio.h xmalloc.c fail.c \
- tiff_octaves_rw.c
+ nanreduce.c tiff_octaves_rw.c bitpack.c
 fancy_zoomout.o: fancy_zoomout.c fancy_image.h
 faxpb.o: faxpb.c iio.h
 faxpby.o: faxpby.c iio.h
@@ -89,7 +91,7 @@ flowjac.o: flowjac.c iio.h fragments.c getpixel.c
 flownop.o: flownop.c iio.h fragments.c getpixel.c
 fmsrA.o: fmsrA.c svd.c
 fnorm.o: fnorm.c iio.h
-fontu2.o: fontu2.c xmalloc.c fail.c xfopen.c dataconv.c iio.h pickopt.c
+fontu2.o: fontu2.c xmalloc.c fail.c xfopen.c dataconv.c bitpack.c iio.h pickopt.c
 fpgraph.o: fpgraph.c iio.h pickopt.c
 frakes_monaco_smith.o: frakes_monaco_smith.c fail.c xmalloc.c iio.h
 frustumize.o: frustumize.c iio.h parsenumbers.c xmalloc.c fail.c \
@@ -99,22 +101,23 @@ gblur_core.o: gblur_core.c iio.h
 gblurs.o: gblurs.c iio.h
 genk.o: genk.c fail.c xmalloc.c random.c smapa.h iio.h
 gharrows.o: gharrows.c iio.h smapa.h
-ghough.o: ghough.c iio.h
-ghough2.o: ghough2.c pickopt.c iio.h
+ghough.o: ghough.c xmalloc.c fail.c hough_vote.c iio.h pickopt.c
+ghough2.o: ghough2.c xmalloc.c fail.c hough_vote.c pickopt.c iio.h
 graysing.o: graysing.c iio.h
-harris.o: harris.c iio.h fragments.c getpixel.c
-histeq8.o: histeq8.c iio.h
+harris.o: harris.c iio.h xmalloc.c fail.c getpixel.c pickopt.c strt.c
+heapbench.o: heapbench.c xmalloc.c fail.c abstract_heap.h
+histeq8.o: histeq8.c xmalloc.c fail.c iio.h pickopt.c
 histomodev.o: histomodev.c iio.h pickopt.c
 homdots.o: homdots.c iio.h
 homfilt.o: homfilt.c parsenumbers.c xmalloc.c fail.c vvector.h smapa.h
-houghs.o: houghs.c iio.h
+houghs.o: houghs.c xmalloc.c fail.c hough_vote.c iio.h pickopt.c
 hrezoom.o: hrezoom.c vvector.h
 hs.o: hs.c iio.h
 hs_init.o: hs_init.c iio.h
 hs_omp.o: hs_omp.c iio.h
 huffman.o: huffman.c abstract_heap.h
 hview.o: hview.c xmalloc.c fail.c iio.h
-ihough2.o: ihough2.c iio.h pickopt.c
+ihough2.o: ihough2.c xmalloc.c fail.c hough_vote.c iio.h pickopt.c
 ijmesh.o: ijmesh.c iio.h
 imdim.o: imdim.c iio.h
 imgdist.o: imgdist.c iio.h
@@ -123,8 +126,9 @@ imgstats.o: imgstats.c iio.h
 iminfo.o: iminfo.c iio.h statistics.c fail.c xmalloc.c
 imspread.o: imspread.c iio.h
 inppairs.o: inppairs.c iio.h
-intimg.o: intimg.c iio.h
+intimg.o: intimg.c iio.h xmalloc.c fail.c sat.c smapa.h pickopt.c
 ipol_watermark.o: ipol_watermark.c iio.h
+ising.o: ising.c random.c iio.h pickopt.c
 isingroot.o: isingroot.c random.c iio.h pickopt.c
 isoricci.o: isoricci.c iio.h
 lapbediag.o: lapbediag.c smapa.h iio.h
@@ -134,13 +138,13 @@ lgblur.o: lgblur.c iio.h fail.c xmalloc.c
 lgblur2.o: lgblur2.c gblur.c iio.h fail.c xmalloc.c vvector.h
 lgblur3.o: lgblur3.c gblur.c iio.h fail.c xmalloc.c vvector.h bicubic.c \
  getpixel.c smapa.h
-lic.o: lic.c fail.c xmalloc.c random.c bilinear_interpolation.c smapa.h \
- iio.h
+lic.o: lic.c fail.c xmalloc.c random.c bilinear_interpolation.c fastlic.c \
+ smapa.h iio.h pickopt.c
 lk.o: lk.c iio.h svd.c vvector.h smapa.h
 lk_omp.o: lk_omp.c iio.h svd.c vvector.h
 lka.o: lka.c iio.h svd.c vvector.h
-lure.o: lure.c xmalloc.c fail.c getpixel.c blur.c smapa.h iio.h
-lures.o: lures.c xmalloc.c fail.c getpixel.c blur.c smapa.h iio.h
+lure.o: lure.c xmalloc.c fail.c sat.c blur.c xarena.c smapa.h iio.h
+lures.o: lures.c xmalloc.c fail.c getpixel.c blur.c xarena.c smapa.h iio.h
 maptp.o: maptp.c fail.c xmalloc.c parsenumbers.c
 marching_squares.o: marching_squares.c
 metatiler.o: metatiler.c iio.h
@@ -165,7 +169,8 @@ percomp.o: percomp.c fft.c iio.h fail.c xmalloc.c
 periodize.o: periodize.c iio.h xmalloc.c fail.c
 perms.o: perms.c
 pickopt.o: pickopt.c
-plyflatten.o: plyflatten.c xmalloc.c fail.c smapa.h iio.h
+plyflatten.o: plyflatten.c xmalloc.c fail.c splat.c smapa.h utm.c iio.h \
+ pickopt.c
 plyroads.o: plyroads.c fail.c xfopen.c parsenumbers.c xmalloc.c
 plyroads_mini.o: plyroads_mini.c parsenumbers.c xmalloc.c fail.c
 pmba.o: pmba.c xfopen.c fail.c parsenumbers.c xmalloc.c pickopt.c
@@ -183,10 +188,13 @@ radphar.o: radphar.c iio.h xmalloc.c fail.c
 rancloud.o: rancloud.c iio.h fragments.c
 ranrecs.o: ranrecs.c iio.h fragments.c
 really_simplest_inpainting.o: really_simplest_inpainting.c iio.h
-remove_small_cc.o: remove_small_cc.c abstract_dsf.c iio.h pickopt.c
+remove_small_cc.o: remove_small_cc.c ccproc.c abstract_dsf.c xmalloc.c fail.c \
+ iio.h pickopt.c
 replicate.o: replicate.c iio.h xmalloc.c fail.c
-rgfield.o: rgfield.c iio.h xmalloc.c fail.c smapa.h
-rgfields.o: rgfields.c iio.h xmalloc.c fail.c smapa.h
+rgfield.o: rgfield.c iio.h xmalloc.c fail.c smapa.h randfield.c random.c \
+ fftplans.c
+rgfields.o: rgfields.c iio.h xmalloc.c fail.c smapa.h randfield.c random.c \
+ fftplans.c
 rgfieldst.o: rgfieldst.c iio.h xmalloc.c fail.c smapa.h
 rpc.o: rpc.c xfopen.c fail.c smapa.h
 rpc_angpair.o: rpc_angpair.c rpc.c xfopen.c fail.c smapa.h xmalloc.c \
@@ -208,10 +216,11 @@ rpc_pm.o: rpc_pm.c iio.h getpixel.c bicubic.c rpc.c xfopen.c fail.c \
 rpc_pmn.o: rpc_pmn.c rpc.c xfopen.c fail.c smapa.h tiffu.c xmalloc.c \
  iio.h
 rpc_warpab.o: rpc_warpab.c getpixel.c bicubic.c rpc.c xfopen.c fail.c \
- smapa.h iio.h xmalloc.c
+ smapa.h xmalloc.c approxmap.c iio.h
 rpc_warpabt.o: rpc_warpabt.c getpixel.c bicubic.c rpc.c xfopen.c fail.c \
  smapa.h tiffu.c iio.h xmalloc.c
-rpcflow.o: rpcflow.c iio.h xmalloc.c fail.c rpc.c xfopen.c smapa.h
+rpcflow.o: rpcflow.c iio.h xmalloc.c fail.c rpc.c xfopen.c smapa.h \
+ approxmap.c
 rpchfilt.o: rpchfilt.c parsenumbers.c xmalloc.c fail.c rpc.c xfopen.c \
  smapa.h
 rpcparcheck.o: rpcparcheck.c xmalloc.c fail.c parsenumbers.c rpc.c \
@@ -222,7 +231,7 @@ satproj.o: satproj.c fail.c getpixel.c iio.h xmalloc.c parsenumbers.c \
 scheme_plap.o: scheme_plap.c fail.c iio.h xmalloc.c
 setdim.o: setdim.c iio.h
 sfblur.o: sfblur.c xmalloc.c fail.c iio.h
-shadowcast.o: shadowcast.c iio.h pickopt.c
+shadowcast.o: shadowcast.c iio.h xmalloc.c sweepline.c pickopt.c
 sheartilter.o: sheartilter.c
 shuntingyard.o: shuntingyard.c fail.c xmalloc.c
 simplest_inpainting.o: simplest_inpainting.c iio.h
@@ -245,7 +254,8 @@ tiffu.o: tiffu.c
 tiloct.o: tiloct.c
 tilt_and_shear.o: tilt_and_shear.c bicubic.c getpixel.c fail.c xmalloc.c \
  iio.h
-tiny_lure.o: tiny_lure.c getpixel.c blur.c fail.c xmalloc.c smapa.h iio.h
+tiny_lure.o: tiny_lure.c getpixel.c blur.c xarena.c fail.c xmalloc.c smapa.h \
+ iio.h
 tregistration.o: tregistration.c iio.h
 tvint.o: tvint.c smapa.h iio.h pickopt.c
 unalpha.o: unalpha.c iio.h
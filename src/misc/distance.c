@@ -53,6 +53,8 @@ struct dist_state {
 	e->hpos[e->hvox[j]] = j;\
 }while(0)
 
+// the distances of the front only grow
+#define HEAP_RADIX 1
 #include "abstract_heap.h"
 
 
@@ -1,111 +1,21 @@
+// elap2: fill the holes of an image by the Laplace equation, visiting the
+// holes in a chosen order
+//
+// elap2 TSTEP NITER in.png mask.png out.png {lex|peel|center|rand}
+//
+// The masked pixels (positive mask) are filled by NITER sequential
+// Gauss-Seidel iterations of time step TSTEP, starting from zero, that visit
+// the holes in raster order ("lex"), by increasing or decreasing distance to
+// the known pixels ("peel", "center"), or in random order (see elap_engine.c
+// for the parallel solver of the other tools).
+
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-
-// the type of a "getpixel" function
-typedef float (*getpixel_operator)(float*,int,int,int,int);
-
-// extrapolate by 0
-inline static float getpixel_0(float *x, int w, int h, int i, int j)
-{
-	if (i < 0 || i >= w || j < 0 || j >= h)
-		return 0;
-	return x[i+j*w];
-}
-
-// extrapolate by nearest value (useful for Neumann boundary conditions)
-inline static float getpixel_1(float *x, int w, int h, int i, int j)
-{
-	if (i < 0) i = 0;
-	if (j < 0) j = 0;
-	if (i >= w) i = w-1;
-	if (j >= h) j = h-1;
-	return x[i+j*w];
-}
-
-
-
-// evaluate the laplacian of image x at point i, j
-inline static float laplacian(float *x, int w, int h, int i, int j)
-{
-	getpixel_operator p = getpixel_1;
-
-	float r = -4 * p(x, w, h, i  , j  )
-		     + p(x, w, h, i+1, j  )
-		     + p(x, w, h, i  , j+1)
-		     + p(x, w, h, i-1, j  )
-		     + p(x, w, h, i  , j-1);
-
-	return r;
-}
-
-inline static float laplacian8(float *x, int w, int h, int i, int j)
-{
-	getpixel_operator p = getpixel_1;
-
-	float r = -8 * p(x, w, h, i  , j  )
-		     + p(x, w, h, i+1, j  )
-		     + p(x, w, h, i  , j+1)
-		     + p(x, w, h, i-1, j  )
-		     + p(x, w, h, i  , j-1)
-		     + p(x, w, h, i+1, j+1)
-		     + p(x, w, h, i-1, j+1)
-		     + p(x, w, h, i-1, j-1)
-		     + p(x, w, h, i+1, j-1);
-
-	return r;
-}
-
-
-// returns the largest change performed all over the image
-static float perform_one_iteration(float *x, int w, int h,
-		int (*mask)[2], int nmask, float tstep)
-{
-	float maxupdate = 0;
-	for (int p = 0; p < nmask; p++)
-	{
-		int i = mask[p][0];
-		int j = mask[p][1];
-		int idx = j*w + i;
-
-		float new = x[idx] + tstep * laplacian(x, w, h, i, j);
-
-		float update = fabs(x[idx] - new);
-		if (update > maxupdate)
-			maxupdate = update;
-
-		x[idx] = new;
-	}
-	return maxupdate;
-}
-
-
-#include "xmalloc.c"
-
-// build a mask of the NAN positions on image "x"
-// the output "mask[i][2]" contains the two coordinates of the ith masked pixel
-static int (*build_mask(int *out_nmask, float *x, int w, int h))[2]
-{
-	int nmask = 0;
-	for (int i = 0; i < w*h; i++)
-		if (isnan(x[i]))
-			nmask += 1;
-	int (*mask)[2] = xmalloc(w*h*2*sizeof(int)), cx = 0;
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-		if (isnan(x[j*w + i])) {
-			mask[cx][0] = i;
-			mask[cx][1] = j;
-			cx += 1;
-		}
-	assert(cx == nmask);
-
-	*out_nmask = nmask;
-	return mask;
-}
+#include "elap_engine.c"
 
 static int randombounds(int a, int b)
 {
@@ -218,20 +128,26 @@ void explicit_poisson_extension_with_ordering_choice(
 		)
 {
 	// build list of masked pixels
-	int nmask, (*mask)[2] = build_mask(&nmask, x, w, h);
+	int nmask, (*mask)[2] = elap_hole_list(&nmask, x, w, h);
 	reorder_mask(mask, nmask, x, w, h, ordering_option);
 
 	// initialize the solution to zero at the masked pixels
 	for (int i = 0; i < w*h; i++)
-		y[i] = isfinite(x[i]) ? x[i] : 0;
+		y[i] = isnan(x[i]) ? 0 : x[i];
 
 	// do the requested iterations
+	struct elap_params p[1];
+	elap_default_params(p);
+	elap_params_from_environment(p);
 	for (int i = 0; i < niter; i++)
 	{
-		float u = perform_one_iteration(y, w, h, mask, nmask, timestep);
+		float u = elap_iteration_list(y, w, h, mask, nmask, timestep,
+				p->boundary);
 
 		if (0 == i % 10)
 			fprintf(stderr, "iter = %d, maxupdate = %g\n", i, u);
+		if (u < p->tol)
+			break;
 	}
 
 	free(mask);
@@ -0,0 +1,539 @@
+#ifndef _ELAP_ENGINE_C
+#define _ELAP_ENGINE_C
+
+// extension of images by the Laplace equation (the core of the elap tools)
+//
+// The holes of an image g (its NAN samples) are filled by the solution u of
+// L(u) = f on the holes, with u = g elsewhere, where L is the 5-point
+// laplacian and f is an optional data term (zero for a harmonic extension).
+// Outside of the image domain, u is extended by its nearest value (Neumann
+// boundary conditions) or by zero (Dirichlet).  The solver has three stages:
+//
+// 	1. multiscale initialization: the image is reduced by 2x2 averages of
+// 	   its known samples, the problem is solved at the coarse scale, and
+// 	   the coarse solution is zoomed in (by nearest neighbor or bilinear
+// 	   interpolation) as the initialization of the holes at the fine scale
+// 	2. relaxation at each scale, until the largest update of an iteration
+// 	   is below a tolerance, or for a given number of iterations
+// 	3. multigrid cycles at the finest scale, until the RMS residual has
+// 	   decreased by a given factor (this is the correction scheme, as in
+// 	   simpois: the error solves the same equation with the residual as
+// 	   data, and it is approximated on the coarse grid of even pixels)
+//
+// The relaxation is a Gauss-Seidel scheme with a time step (0.25 is plain
+// Gauss-Seidel, and larger steps up to 0.5 are over-relaxations).  The holes
+// are visited in red-black order, so that the pixels of each color are
+// updated in parallel, by rows, and the laplacian of the pixels that are
+// not on the border of the image is computed by direct indexing.  The
+// channels of a color image are solved in parallel.
+//
+// The environment variables ELAP_BOUNDARY (0=Neumann, 1=Dirichlet),
+// ELAP_TOL, ELAP_MGCYCLES and ELAP_MGTOL change the corresponding parameters
+// of all the tools (see elap_params_from_environment).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xmalloc.c"
+#include "smapa.h"
+
+#define ELAP_NEUMANN   0 // extension by the nearest value
+#define ELAP_DIRICHLET 1 // extension by zero
+
+#define ELAP_MG_SMOOTH 2  // Gauss-Seidel iterations before and after
+#define ELAP_MG_COARSE 50 // Gauss-Seidel iterations at the coarsest level
+
+struct elap_params {
+	float tstep;    // time step of the relaxation (0.25 = Gauss-Seidel)
+	int niter;      // maximum number of iterations at each scale
+	float tol;      // the iterations stop when the largest update is below
+	int scales;     // number of scales (1 = no multiscale initialization)
+	bool bilinear;  // zoom-in the coarse solutions by bilinear interpolation
+	bool prefilter; // average the 4 neighbors before each zoom-out
+	int boundary;   // ELAP_NEUMANN or ELAP_DIRICHLET
+	int ncycles;    // maximum number of multigrid cycles (0 = none)
+	float mgtol;    // relative decrease of the residual by the cycles
+	bool verbose;   // print the largest update every 10 iterations
+};
+
+static void elap_default_params(struct elap_params *p)
+{
+	p->tstep = 0.25;
+	p->niter = 100;
+	p->tol = 0;
+	p->scales = 1;
+	p->bilinear = false;
+	p->prefilter = false;
+	p->boundary = ELAP_NEUMANN;
+	p->ncycles = 0;
+	p->mgtol = 1e-3;
+	p->verbose = false;
+}
+
+SMART_PARAMETER_SILENT(ELAP_BOUNDARY,-1)
+SMART_PARAMETER_SILENT(ELAP_TOL,-1)
+SMART_PARAMETER_SILENT(ELAP_MGCYCLES,-1)
+SMART_PARAMETER_SILENT(ELAP_MGTOL,-1)
+
+// override the parameters that are given in the environment
+static void elap_params_from_environment(struct elap_params *p)
+{
+	if (ELAP_BOUNDARY() >= 0) p->boundary = ELAP_BOUNDARY();
+	if (ELAP_TOL()      >= 0) p->tol      = ELAP_TOL();
+	if (ELAP_MGCYCLES() >= 0) p->ncycles  = ELAP_MGCYCLES();
+	if (ELAP_MGTOL()    >= 0) p->mgtol    = ELAP_MGTOL();
+}
+
+// value of the pixel (i,j), extended outside the image by the boundary
+static float elap_getpixel(float *x, int w, int h, int i, int j, int bc)
+{
+	if (i < 0 || j < 0 || i >= w || j >= h) {
+		if (bc == ELAP_DIRICHLET)
+			return 0;
+		if (i < 0) i = 0;
+		if (j < 0) j = 0;
+		if (i >= w) i = w - 1;
+		if (j >= h) j = h - 1;
+	}
+	return x[j*(long)w+i];
+}
+
+// laplacian of x at the pixel (i,j)
+static inline float elap_laplacian(float *x, int w, int h, int i, int j,
+		int bc)
+{
+	long ij = j*(long)w + i;
+	if (i > 0 && j > 0 && i < w - 1 && j < h - 1) // direct indexing
+		return x[ij-1] + x[ij+1] + x[ij-w] + x[ij+w] - 4 * x[ij];
+	return -4 * x[ij]
+		+ elap_getpixel(x, w, h, i+1, j  , bc)
+		+ elap_getpixel(x, w, h, i  , j+1, bc)
+		+ elap_getpixel(x, w, h, i-1, j  , bc)
+		+ elap_getpixel(x, w, h, i  , j-1, bc);
+}
+
+// the holes of an image: a mask, and the first and last holes of each row
+// (an empty row has first > last)
+struct elap_holes {
+	unsigned char *m;
+	int *first, *last;
+	long n;
+};
+
+static void elap_holes_of_mask(struct elap_holes *o, int w, int h)
+{
+	o->first = xmalloc(h * sizeof*o->first);
+	o->last = xmalloc(h * sizeof*o->last);
+	o->n = 0;
+	for (int j = 0; j < h; j++)
+	{
+		o->first[j] = w;
+		o->last[j] = -1;
+		for (int i = 0; i < w; i++)
+			if (o->m[j*(long)w+i]) {
+				if (o->first[j] == w)
+					o->first[j] = i;
+				o->last[j] = i;
+				o->n += 1;
+			}
+	}
+}
+
+// holes of the image x (its NAN samples)
+static void elap_holes(struct elap_holes *o, float *x, int w, int h)
+{
+	o->m = xmalloc(w * (long)h);
+	for (long i = 0; i < w * (long)h; i++)
+		o->m[i] = isnan(x[i]);
+	elap_holes_of_mask(o, w, h);
+}
+
+static void elap_holes_free(struct elap_holes *o)
+{
+	free(o->m);
+	free(o->first);
+	free(o->last);
+}
+
+// list of the coordinates of the holes of the image x, in raster order
+static int (*elap_hole_list(int *out_n, float *x, int w, int h))[2]
+{
+	int n = 0;
+	for (long i = 0; i < w * (long)h; i++)
+		n += isnan(x[i]);
+	int (*t)[2] = xmalloc((n ? n : 1) * sizeof*t), k = 0;
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		if (isnan(x[j*(long)w+i])) {
+			t[k][0] = i;
+			t[k][1] = j;
+			k += 1;
+		}
+	*out_n = n;
+	return t;
+}
+
+// relax the holes of color c of the row j (the pixels with i+j = c mod 2),
+// returns the largest update
+static float elap_relax_row(float *u, float *f, struct elap_holes *m,
+		int w, int h, int j, int c, float tstep, int bc)
+{
+	float r = 0;
+	unsigned char *mj = m->m + j*(long)w;
+	int i = m->first[j];
+	i += (i + j + c) % 2;
+	for (; i <= m->last[j]; i += 2)
+		if (mj[i]) {
+			float l = elap_laplacian(u, w, h, i, j, bc);
+			float d = tstep * (l - (f ? f[j*(long)w+i] : 0));
+			u[j*(long)w+i] += d;
+			r = fmaxf(r, fabsf(d));
+		}
+	return r;
+}
+
+// one red-black iteration on the holes m, returns the largest update
+static float elap_iteration(float *u, float *f, struct elap_holes *m,
+		int w, int h, float tstep, int bc)
+{
+	float r = 0;
+	for (int c = 0; c < 2; c++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,16) reduction(max:r)
+#endif
+	for (int j = 0; j < h; j++)
+		r = fmaxf(r, elap_relax_row(u, f, m, w, h, j, c, tstep, bc));
+	return r;
+}
+
+// one iteration on the holes t[0..n-1], in this order (the order affects the
+// result of the Gauss-Seidel iterations, so this is sequential)
+static float elap_iteration_list(float *u, int w, int h,
+		int (*t)[2], int n, float tstep, int bc)
+{
+	float r = 0;
+	for (int k = 0; k < n; k++)
+	{
+		int i = t[k][0], j = t[k][1];
+		float d = tstep * elap_laplacian(u, w, h, i, j, bc);
+		u[j*(long)w+i] += d;
+		r = fmaxf(r, fabsf(d));
+	}
+	return r;
+}
+
+// s = f - L(u) on the holes, zero elsewhere (returns the RMS of s)
+static double elap_residual(float *s, float *u, float *f,
+		struct elap_holes *m, int w, int h, int bc)
+{
+	double a = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:a)
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	{
+		long ij = j*(long)w + i;
+		s[ij] = 0;
+		if (m->m[ij]) {
+			s[ij] = (f ? f[ij] : 0) - elap_laplacian(u, w, h, i, j, bc);
+			a += s[ij] * (double)s[ij];
+		}
+	}
+	return m->n ? sqrt(a / m->n) : 0;
+}
+
+// solve by relaxation, from the initialization of the holes "init"
+static void elap_relax_with_init(float *u, float *g, float *f, int w, int h,
+		float *init, struct elap_params *p)
+{
+	struct elap_holes m[1];
+	elap_holes(m, g, w, h);
+	for (long i = 0; i < w * (long)h; i++)
+		u[i] = m->m[i] ? init[i] : g[i];
+	for (int i = 0; i < p->niter && m->n; i++)
+	{
+		float d = elap_iteration(u, f, m, w, h, p->tstep, p->boundary);
+		if (p->verbose && 0 == i % 10)
+			fprintf(stderr, "size = %dx%d, iter = %d, maxupdate = %g\n",
+					w, h, i, d);
+		if (d < p->tol)
+			break;
+	}
+	elap_holes_free(m);
+}
+
+// zoom-out by 2x2 block averages of the non-NAN samples (the blocks of the
+// last column and row of an odd image repeat its last samples)
+static void elap_zoom_out(float *y, int ws, int hs, float *x, int w, int h,
+		bool prefilter)
+{
+	float *t = NULL;
+	if (prefilter) { // average of the finite 4-neighbors
+		t = xmalloc(w * (long)h * sizeof*t);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			float a[4] = {
+				elap_getpixel(x, w, h, i+1, j  , ELAP_NEUMANN),
+				elap_getpixel(x, w, h, i-1, j  , ELAP_NEUMANN),
+				elap_getpixel(x, w, h, i  , j+1, ELAP_NEUMANN),
+				elap_getpixel(x, w, h, i  , j-1, ELAP_NEUMANN)
+			}, s = 0;
+			int n = 0;
+			for (int k = 0; k < 4; k++)
+				if (isfinite(a[k])) {
+					s += a[k];
+					n += 1;
+				}
+			t[j*(long)w+i] = n ? s / n : NAN;
+		}
+		x = t;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < hs; j++)
+	for (int i = 0; i < ws; i++)
+	{
+		float a[4] = {
+			elap_getpixel(x, w, h, 2*i  , 2*j  , ELAP_NEUMANN),
+			elap_getpixel(x, w, h, 2*i+1, 2*j  , ELAP_NEUMANN),
+			elap_getpixel(x, w, h, 2*i  , 2*j+1, ELAP_NEUMANN),
+			elap_getpixel(x, w, h, 2*i+1, 2*j+1, ELAP_NEUMANN)
+		}, s = 0;
+		int n = 0;
+		for (int k = 0; k < 4; k++)
+			if (isfinite(a[k])) {
+				s += a[k];
+				n += 1;
+			}
+		y[j*(long)ws+i] = n ? s / n : NAN;
+	}
+	free(t);
+}
+
+// zoom-in of a coarse solution, whose pixel (i,j) covers the fine pixels
+// (2i,2j) to (2i+1,2j+1)
+static void elap_zoom_in(float *y, int w, int h, float *x, int ws, int hs,
+		bool bilinear)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	{
+		float p = (i - 0.5) / 2, q = (j - 0.5) / 2;
+		if (!bilinear) {
+			y[j*(long)w+i] = elap_getpixel(x, ws, hs,
+					round(p), round(q), ELAP_NEUMANN);
+			continue;
+		}
+		int ip = floor(p), iq = floor(q);
+		float a = elap_getpixel(x, ws, hs, ip  , iq  , ELAP_NEUMANN);
+		float b = elap_getpixel(x, ws, hs, ip+1, iq  , ELAP_NEUMANN);
+		float c = elap_getpixel(x, ws, hs, ip  , iq+1, ELAP_NEUMANN);
+		float d = elap_getpixel(x, ws, hs, ip+1, iq+1, ELAP_NEUMANN);
+		p -= ip;
+		q -= iq;
+		y[j*(long)w+i] = a*(1-p)*(1-q) + b*p*(1-q) + c*(1-p)*q + d*p*q;
+	}
+}
+
+// solve at the given number of scales, each initialized by the coarser one
+static void elap_recursive_solve(float *u, float *g, float *f, int w, int h,
+		int scale, struct elap_params *p)
+{
+	long n = w * (long)h;
+	float *init = xmalloc(n * sizeof*init);
+	if (scale > 1 && (w > 1 || h > 1))
+	{
+		int ws = ceil(w/2.0);
+		int hs = ceil(h/2.0);
+		float *gs = xmalloc(ws * hs * sizeof*gs);
+		float *us = xmalloc(ws * hs * sizeof*us);
+		float *fs = f ? xmalloc(ws * hs * sizeof*fs) : NULL;
+		elap_zoom_out(gs, ws, hs, g, w, h, p->prefilter);
+		if (f) {
+			elap_zoom_out(fs, ws, hs, f, w, h, false);
+			for (int i = 0; i < ws * hs; i++)
+				fs[i] *= 4; // the coarse pixels are twice as large
+		}
+		elap_recursive_solve(us, gs, fs, ws, hs, scale - 1, p);
+		elap_zoom_in(init, w, h, us, ws, hs, p->bilinear);
+		free(gs);
+		free(us);
+		free(fs);
+	} else
+		for (long i = 0; i < n; i++)
+			init[i] = 0;
+	elap_relax_with_init(u, g, f, w, h, init, p);
+	free(init);
+}
+
+// restriction of the residual s by full weighting, where the coarse pixel
+// (i,j) is the fine pixel (2i,2j); the coarse holes are the even holes
+static void elap_restrict(float *sc, unsigned char *mc, int ws, int hs,
+		float *s, unsigned char *m, int w, int h)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < hs; j++)
+	for (int i = 0; i < ws; i++)
+	{
+		float a = 0, b = 0;
+		for (int dj = -1; dj <= 1; dj++)
+		for (int di = -1; di <= 1; di++)
+		{
+			int ii = 2*i + di, jj = 2*j + dj;
+			if (ii < 0 || jj < 0 || ii >= w || jj >= h) continue;
+			float k = (2 - abs(di)) * (2 - abs(dj));
+			a += k * s[jj*(long)w+ii];
+			b += k;
+		}
+		mc[j*(long)ws+i] = m[2*j*(long)w+2*i];
+		sc[j*(long)ws+i] = mc[j*(long)ws+i] ? 4 * a / b : 0;
+	}
+}
+
+// bilinear interpolation of the coarse correction ec on the holes m (the
+// coarse pixel (i,j) is the fine pixel (2i,2j)), zero elsewhere
+static void elap_prolong(float *e, unsigned char *m, int w, int h,
+		float *ec, int ws, int hs)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	{
+		int a = i / 2, b = j / 2, p = i % 2, q = j % 2;
+		float v = ec[b*(long)ws+a];
+		if (p) v = (v + elap_getpixel(ec, ws, hs, a+1, b, ELAP_NEUMANN))/2;
+		if (q) {
+			float t = elap_getpixel(ec, ws, hs, a, b+1, ELAP_NEUMANN);
+			if (p) t = (t + elap_getpixel(ec, ws, hs, a+1, b+1,
+							ELAP_NEUMANN)) / 2;
+			v = (v + t) / 2;
+		}
+		e[j*(long)w+i] = m[j*(long)w+i] ? v : 0;
+	}
+}
+
+// one multigrid cycle for L(e) = s on the holes m, e = 0 elsewhere
+static void elap_multigrid_cycle(float *e, float *s, struct elap_holes *m,
+		int w, int h, int bc)
+{
+	long n = w * (long)h;
+	int ws = ceil(w/2.0);
+	int hs = ceil(h/2.0);
+	if (!m->n)
+		return;
+	if (m->n < 16 || ws * hs == n) { // coarsest level
+		for (int i = 0; i < ELAP_MG_COARSE; i++)
+			elap_iteration(e, s, m, w, h, 0.25, bc);
+		return;
+	}
+	for (int i = 0; i < ELAP_MG_SMOOTH; i++)
+		elap_iteration(e, s, m, w, h, 0.25, bc);
+
+	float *r = xmalloc(n * sizeof*r);
+	float *c = xmalloc(n * sizeof*c);
+	float *sc = xmalloc(ws * hs * sizeof*sc);
+	float *ec = xmalloc(ws * hs * sizeof*ec);
+	struct elap_holes mc[1];
+	mc->m = xmalloc(ws * hs);
+	elap_residual(r, e, s, m, w, h, bc);
+	elap_restrict(sc, mc->m, ws, hs, r, m->m, w, h);
+	elap_holes_of_mask(mc, ws, hs);
+	for (int i = 0; i < ws * hs; i++)
+		ec[i] = 0;
+	elap_multigrid_cycle(ec, sc, mc, ws, hs, bc);
+	elap_prolong(c, m->m, w, h, ec, ws, hs);
+
+	// step that minimizes the energy of the new error
+	double rc = 0, lc = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:rc,lc)
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		if (m->m[j*(long)w+i]) {
+			double l = elap_laplacian(c, w, h, i, j, bc);
+			rc += r[j*(long)w+i] * (double)c[j*(long)w+i];
+			lc += l * c[j*(long)w+i];
+		}
+	float a = lc ? rc / lc : 0;
+	for (long i = 0; i < n; i++)
+		e[i] += a * c[i];
+	free(r);
+	free(c);
+	free(sc);
+	free(ec);
+	elap_holes_free(mc);
+
+	for (int i = 0; i < ELAP_MG_SMOOTH; i++)
+		elap_iteration(e, s, m, w, h, 0.25, bc);
+}
+
+// refine the solution u by multigrid cycles
+static void elap_multigrid(float *u, float *g, float *f, int w, int h,
+		struct elap_params *p)
+{
+	long n = w * (long)h;
+	struct elap_holes m[1];
+	elap_holes(m, g, w, h);
+	float *s = xmalloc(n * sizeof*s);
+	float *e = xmalloc(n * sizeof*e);
+	double r0 = elap_residual(s, u, f, m, w, h, p->boundary), r = r0;
+	for (int c = 0; c < p->ncycles && r > p->mgtol * r0; c++)
+	{
+		for (long i = 0; i < n; i++)
+			e[i] = 0;
+		elap_multigrid_cycle(e, s, m, w, h, p->boundary);
+		for (long i = 0; i < n; i++)
+			u[i] += e[i];
+		r = elap_residual(s, u, f, m, w, h, p->boundary);
+		if (p->verbose)
+			fprintf(stderr, "size = %dx%d, cycle = %d, residual = %g\n",
+					w, h, c, r);
+	}
+	free(e);
+	free(s);
+	elap_holes_free(m);
+}
+
+// fill the holes of g into u, with the data term f (or NULL), starting from
+// the initialization "init" (or NULL, for the multiscale initialization)
+static void elap_extension(float *u, float *g, float *f, int w, int h,
+		float *init, struct elap_params *p)
+{
+	if (init)
+		elap_relax_with_init(u, g, f, w, h, init, p);
+	else
+		elap_recursive_solve(u, g, f, w, h, p->scales, p);
+	if (p->ncycles > 0)
+		elap_multigrid(u, g, f, w, h, p);
+}
+
+// fill the holes of each channel of an image, in parallel
+static void elap_extension_separable(float *u, float *g, float *f,
+		int w, int h, int pd, float *init, struct elap_params *p)
+{
+	long n = w * (long)h;
+#ifdef _OPENMP
+#pragma omp parallel for if(pd > 1)
+#endif
+	for (int l = 0; l < pd; l++)
+		elap_extension(u + n*l, g + n*l, f ? f + n*l : NULL, w, h,
+				init ? init + n*l : NULL, p);
+}
+
+#endif//_ELAP_ENGINE_C
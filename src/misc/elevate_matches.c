@@ -1,30 +1,193 @@
+// elevate_matches: add the heights of two images to a list of matches
+//
+// elevate_matches [-b] [-i] hA.tiff hB.tiff [pairs2d [pairs3d]]
+//
+// Each input match "xa ya xb yb" is written as "xa ya ha xb yb hb", where ha
+// and hb are the values of the images hA and hB at the two points.  The
+// matches outside of the images, or on non-finite heights, are dropped.  The
+// heights are the nearest samples, or their bilinear interpolation (option
+// -i).  With option -b, the input matches are binary records of 4 native
+// floats.
+//
+// The matches are processed by batches.  The heights are opened as fancy
+// images, so that tiled tiffs are read by tiles, on demand, and the lookups
+// of each batch are grouped by tiles (fancy_image_gather).  The parsing of
+// the lines, the lookups on the two images and the formatting of the output
+// lines run in parallel.
+
 #include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "iio.h"
+#include <string.h>
 
+#include "fancy_image.h"
 #include "xfopen.c"
+#include "xmalloc.c"
+#include "pickopt.c"
+
+#define ELEVATE_BATCH 0x10000 // matches per batch
+#define ELEVATE_BLOCK 0x400000 // initial size of the text buffer
+#define ELEVATE_LINE 160 // room for an output line
+
+// a source of matches, in text or binary
+struct match_reader {
+	FILE *f;
+	bool binary;
+	bool eof;
+	char *buf;      // text that has been read but not yet parsed
+	long cap, len, pos;
+	long *line;     // starts of the lines of the current batch
+};
 
-static int getlinen(char *l, int n, FILE *f)
+// a batch of matches, and their heights
+struct elevate_batch {
+	int n;
+	double (*m)[4];        // input matches
+	float (*pa)[2], (*pb)[2]; // query points on each image
+	float *ha, *hb;        // heights (pd values per match)
+	char *text;            // output lines, ELEVATE_LINE bytes apart
+	int *len;              // their lengths (0 = dropped, -1 = too long)
+};
+
+// read more text, keeping the unparsed part
+static void refill(struct match_reader *r)
 {
-	int c, i = 0;
-	while (i < n-1 && (c = fgetc(f)) != EOF && c != '\n')
-		l[i++] = c;
-	l[i] = '\0';
-	return i;
+	memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+	r->len -= r->pos;
+	r->pos = 0;
+	if (r->len == r->cap) {
+		r->cap *= 2;
+		r->buf = xrealloc(r->buf, r->cap + 1);
+	}
+	long n = fread(r->buf + r->len, 1, r->cap - r->len, r->f);
+	r->len += n;
+	if (r->len < r->cap)
+		r->eof = true;
 }
 
-static int insideP(int w, int h, int x, int y)
+// read up to nmax matches in text (the lines that are not 4 numbers are
+// returned as NAN matches), returns the number of lines
+static int read_text_batch(double (*m)[4], int nmax, struct match_reader *r)
 {
-	return x >= 0 && y >= 0 && x < w && y < h;
+	int n = 0;
+	while (n < nmax)
+	{
+		char *s = r->buf + r->pos;
+		char *e = memchr(s, '\n', r->len - r->pos);
+		if (!e && !r->eof) {
+			if (n > 0) break; // parse these lines first
+			refill(r);
+			continue;
+		}
+		if (!e && r->pos == r->len) break;
+		if (!e) e = r->buf + r->len; // last line, without newline
+		*e = '\0';
+		r->line[n++] = r->pos;
+		r->pos = e - r->buf + (e < r->buf + r->len);
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int k = 0; k < n; k++)
+		if (4 != sscanf(r->buf + r->line[k], "%lf %lf %lf %lf",
+					m[k], m[k] + 1, m[k] + 2, m[k] + 3))
+			m[k][0] = m[k][1] = m[k][2] = m[k][3] = NAN;
+	return n;
+}
+
+// read up to nmax binary matches, returns their number
+static int read_binary_batch(double (*m)[4], int nmax, struct match_reader *r)
+{
+	float (*t)[4] = (void*)r->buf; // (the buffer has room for nmax)
+	int n = fread(t, sizeof*t, nmax, r->f);
+	for (int k = 0; k < n; k++)
+	for (int l = 0; l < 4; l++)
+		m[k][l] = t[k][l];
+	return n;
+}
+
+// query point of a coordinate pair (the points outside any reasonable image,
+// and the NANs, are sent to (-2,-2), where the image is not defined)
+static void query_point(float q[2], double x, double y, bool interp)
+{
+	if (!interp) { // the nearest sample, as given by lrint
+		x = rint(x);
+		y = rint(y);
+	}
+	bool ok = fabs(x) < 1e9 && fabs(y) < 1e9;
+	q[0] = ok ? x : -2;
+	q[1] = ok ? y : -2;
+}
+
+// compute the heights of the batch, and its output lines
+static void elevate_batch(struct elevate_batch *b,
+		struct fancy_image *a, struct fancy_image *c, bool interp)
+{
+	int n = b->n;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int k = 0; k < n; k++)
+	{
+		query_point(b->pa[k], b->m[k][0], b->m[k][1], interp);
+		query_point(b->pb[k], b->m[k][2], b->m[k][3], interp);
+	}
+
+	// the two images are independent, so they are looked up at once
+#ifdef _OPENMP
+#pragma omp parallel sections
+#endif
+	{
+#ifdef _OPENMP
+#pragma omp section
+#endif
+		fancy_image_gather(a, 0, n, (void*)b->pa, b->ha, interp);
+#ifdef _OPENMP
+#pragma omp section
+#endif
+		fancy_image_gather(c, 0, n, (void*)b->pb, b->hb, interp);
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int k = 0; k < n; k++)
+	{
+		double *m = b->m[k];
+		double va = b->ha[k * a->pd], vb = b->hb[k * c->pd];
+		b->len[k] = 0;
+		if (!isfinite(va) || !isfinite(vb)) continue;
+		int r = snprintf(b->text + k * (long)ELEVATE_LINE, ELEVATE_LINE,
+				"%lf %lf %lf %lf %lf %lf\n",
+				m[0], m[1], va, m[2], m[3], vb);
+		b->len[k] = r < ELEVATE_LINE ? r : -1;
+	}
+}
+
+static void write_batch(FILE *f, struct elevate_batch *b,
+		struct fancy_image *a, struct fancy_image *c)
+{
+	for (int k = 0; k < b->n; k++)
+		if (b->len[k] > 0)
+			fwrite(b->text + k * (long)ELEVATE_LINE, 1, b->len[k], f);
+		else if (b->len[k] < 0) {
+			double *m = b->m[k];
+			fprintf(f, "%lf %lf %lf %lf %lf %lf\n",
+					m[0], m[1], b->ha[k * a->pd],
+					m[2], m[3], b->hb[k * c->pd]);
+		}
 }
 
 int main(int c, char *v[])
 {
-	if (c != 3) {
+	bool binary = pick_option(&c, &v, "b", NULL);
+	bool interp = pick_option(&c, &v, "i", NULL);
+	if (c < 3 || c > 5) {
 		fprintf(stderr, "usage:\n\t"
-				"%s hA.tiff hB.tiff [pairs2d [pairs3d]]\n", *v);
-		//                0 1       2        3        4
+				"%s [-b] [-i] hA.tiff hB.tiff [pairs2d [pairs3d]]\n", *v);
+		//                          0 1       2        3        4
 		return 1;
 	}
 	char *filename_a = v[1];
@@ -32,35 +195,44 @@ int main(int c, char *v[])
 	char *filename_in  = c > 3 ? v[3] : "-";
 	char *filename_out = c > 4 ? v[4] : "-";
 
-	int wa, ha, wb, hb;
-	float *a = iio_read_image_float(filename_a, &wa, &ha);
-	float *b = iio_read_image_float(filename_b, &wb, &hb);
+	struct fancy_image *a = fancy_image_open(filename_a, "r");
+	struct fancy_image *b = fancy_image_open(filename_b, "r");
 	FILE *fi = xfopen(filename_in, "r");
 	FILE *fo = xfopen(filename_out, "w");
 
-	int n, lmax = 10000;
-	char line[lmax];
-	while ((n = getlinen(line, lmax, fi)))
+	struct match_reader r[1] = {{ .f = fi, .binary = binary }};
+	r->cap = binary ? ELEVATE_BATCH * 4 * sizeof(float) : ELEVATE_BLOCK;
+	r->buf = xmalloc(r->cap + 1);
+	r->line = xmalloc(ELEVATE_BATCH * sizeof*r->line);
+
+	struct elevate_batch e[1];
+	int N = ELEVATE_BATCH;
+	e->m = xmalloc(N * sizeof*e->m);
+	e->pa = xmalloc(N * sizeof*e->pa);
+	e->pb = xmalloc(N * sizeof*e->pb);
+	e->ha = xmalloc(N * a->pd * sizeof*e->ha);
+	e->hb = xmalloc(N * b->pd * sizeof*e->hb);
+	e->text = xmalloc(N * (long)ELEVATE_LINE);
+	e->len = xmalloc(N * sizeof*e->len);
+
+	while ((e->n = binary ? read_binary_batch(e->m, N, r)
+				: read_text_batch(e->m, N, r)))
 	{
-		double m[4];
-		int r = sscanf(line, "%lf %lf %lf %lf", m, m + 1, m + 2, m + 3);
-		if (r != 4) continue;
-		int ia = lrint(m[0]);
-		int ja = lrint(m[1]);
-		int ib = lrint(m[2]);
-		int jb = lrint(m[3]);
-		if (!insideP(wa, ha, ia, ja)) continue;
-		if (!insideP(wb, hb, ib, jb)) continue;
-		double va = a[wa * ja + ia];
-		double vb = b[wb * jb + ib];
-		if (!isfinite(va)) continue;
-		if (!isfinite(vb)) continue;
-		fprintf(fo, "%lf %lf %lf %lf %lf %lf\n",
-				m[0], m[1], va, m[2], m[3], vb);
+		elevate_batch(e, a, b, interp);
+		write_batch(fo, e, a, b);
 	}
 
-	free(a);
-	free(b);
+	free(e->len);
+	free(e->text);
+	free(e->hb);
+	free(e->ha);
+	free(e->pb);
+	free(e->pa);
+	free(e->m);
+	free(r->line);
+	free(r->buf);
+	fancy_image_close(a);
+	fancy_image_close(b);
 	xfclose(fo);
 	xfclose(fi);
 	return 0;
@@ -0,0 +1 @@
+../eucdist.c
\ No newline at end of file
@@ -0,0 +1 @@
+../fastlic.c
\ No newline at end of file
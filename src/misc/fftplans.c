@@ -0,0 +1 @@
+../fftplans.c
\ No newline at end of file
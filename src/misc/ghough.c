@@ -1,36 +1,19 @@
 #include <assert.h>
 #include <math.h>
 
-#ifndef M_PI
-#define M_PI 3.1416
-#endif
+#include "xmalloc.c"
+#include "hough_vote.c"
 
-void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h)
+// the lines are relative to the corner of the image, and only the gradients
+// of norm at least "t" vote
+void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h,
+		float t)
 {
-	// fill counts to zero
-	for (int i = 0; i < n_theta * n_rho; i++)
-		transform[i] = 0;
-
-	// for each gradient vector,
-	// increase the corresponding Hough count by its norm
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		float *g = grad + 2 * (j*w + i);
-		float ng = hypot(g[0], g[1]);
-		float theta = M_PI + atan2(g[1], g[0]);
-		float alpha = M_PI + atan2(j, i);
-		float rho = hypot(w,h) + hypot(i, j) * cos(alpha - theta);
-		float max_rho = 2*hypot(w, h);
-		float max_theta = 2*M_PI;
-		int i_rho   = n_rho   * rho   / max_rho;
-		int i_theta = n_theta * theta / max_theta;
-		assert(0 <= i_rho);
-		assert(0 <= i_theta);
-		assert(i_rho < n_rho);
-		assert(i_theta < n_theta);
-		transform[i_rho*n_theta + i_theta] += ng;
-	}
+	long n;
+	struct hough_voter *v = hough_compact(&n, NULL, grad, w, h, 0, 0, t);
+	struct hough_lines P = {n_theta, n_rho, -hypot(w,h), 2*hypot(w,h), 0};
+	hough_vote_gradients(transform, &P, v, n);
+	free(v);
 }
 
 
@@ -40,12 +23,14 @@ void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h)
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
+#include "pickopt.c"
 int main(int c, char *v[])
 {
 	// process input arguments
+	float t = atof(pick_option(&c, &v, "t", "0"));
 	if (c != 3) {
 		fprintf(stderr, "usage:\n\t"
-				"%s nrho ntheta <gradient >hough\n", *v);
+				"%s [-t thresh] nrho ntheta <gradient >hough\n", *v);
 		//               0  1    2
 		return 1;
 	}
@@ -59,7 +44,7 @@ int main(int c, char *v[])
 
 	// compute transform
 	float *transform = malloc(nrho * ntheta * sizeof*transform);
-	ghough(transform, nrho, ntheta, gradient, w, h);
+	ghough(transform, nrho, ntheta, gradient, w, h, t);
 
 	// save output image
 	iio_write_image_float_vec("-", transform, nrho, ntheta, 1);
@@ -7,63 +7,21 @@
 #define M_PI 3.14159265358979323846
 #endif
 
-static int insideP(int w, int h, int i, int j)
-{
-	return i >= 0 && j >= 0 && i < w && j < h;
-}
-
-static void candidate(int ab[2], int w, int h, int i, int j,
-		int n_theta, int n_rho, float gx, float gy, int folding)
-{
-	float x = i - w/2;
-	float y = j - h/2;
-	float theta = M_PI + atan2(gy, gx);
-	float alpha = M_PI + atan2(y, x);
-	float rho = hypot(x, y) * cos(alpha - theta);
-	float ti_theta = n_theta * theta / (2 * M_PI);
-	if (folding && ti_theta > n_theta/2)
-	{
-		ti_theta -= n_theta/2.0;
-		rho *= -1;
-	}
-	if (folding)
-		ti_theta *= 2;
-	int i_rho   = n_rho   * (0.5 + rho   / hypot(w, h) );
-	ab[0] = ti_theta;
-	ab[1] = i_rho;
-	//ab[1] = n_rho * (0.5 + rho / hypot(w, h));
-	//float ti_theta = n_theta * theta / (2 * M_PI);
-	//if (global_fold && ti_theta > n_theta/2)
-	//{
-	//	ti_theta -= n_theta/2.0;
-	//	rho *= -1;
-	//}
-	//int i_rho   = n_rho   * (0.5 + rho   / hypot(w, h) );
-	//if (insideP(n_theta, n_rho, (int)ti_theta, i_rho))
-	//	transform[i_rho*n_theta + (int)ti_theta] += ng;
-}
+#include "xmalloc.c"
+#include "hough_vote.c"
 
+// each gradient votes for the line orthogonal to it, centered at the image
+// (only the gradients of norm at least "t" vote)
 void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h,
-		int folding)
+		int folding, float t)
 {
-	// fill counts to zero
-	for (int i = 0; i < n_theta * n_rho; i++)
-		transform[i] = 0;
-
-	// for each gradient vector,
-	// increase the corresponding Hough count by its norm
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		float *g = grad + 2 * (j*w + i);
-		float ng = hypot(g[0], g[1]);
-		int ab[2];
-		candidate(ab, w, h, i, j, n_theta, n_rho, g[0], g[1], folding);
-		int i_theta = ab[0];
-		int i_rho   = ab[1];
-		if (insideP(n_theta, n_rho, i_theta, i_rho))
-			transform[i_rho*n_theta + i_theta] += ng;
-	}
+	long n;
+	struct hough_voter *v = hough_compact(&n, NULL, grad, w, h,
+			w/2, h/2, t);
+	struct hough_lines P = {n_theta, n_rho, -hypot(w,h)/2, hypot(w,h),
+		folding};
+	hough_vote_gradients(transform, &P, v, n);
+	free(v);
 }
 
 
@@ -80,11 +38,13 @@ int main(int c, char *v[])
 	bool folding    = pick_option(&c, &v, "f", NULL);
 	char *fname_in  = pick_option(&c, &v, "i", "-");
 	char *fname_out = pick_option(&c, &v, "o", "-");
+	float t         = atof(pick_option(&c, &v, "t", "0"));
 
 	// process input arguments
 	if (c != 3) {
 		fprintf(stderr, "usage:\n\t"
-				"%s nrho ntheta <gradient >hough\n", *v);
+				"%s [-f] [-t thresh] nrho ntheta <gradient >hough\n",
+				*v);
 		//               0  1    2
 		return 1;
 	}
@@ -98,7 +58,7 @@ int main(int c, char *v[])
 
 	// compute transform
 	float *transform = malloc(nrho * ntheta * sizeof*transform);
-	ghough(transform, nrho, ntheta, gradient, w, h, folding);
+	ghough(transform, nrho, ntheta, gradient, w, h, folding, t);
 
 	// save output image
 	iio_write_image_float_vec(fname_out, transform, nrho, ntheta, 1);
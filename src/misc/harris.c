@@ -4,8 +4,11 @@
 #include <math.h>
 #include "iio.h"
 
-#include "fragments.c"
+#include "xmalloc.c"
 #include "getpixel.c"
+#include "pickopt.c"
+#define OMIT_MAIN_STRT
+#include "strt.c"
 
 
 #define FORI(n) for(int i=0;i<(n);i++)
@@ -40,10 +43,16 @@ static void harris(float *yy, float *xx, int w, int h, int pd, float kappa)
 	}
 }
 
+// with "-s sigma", the response det(T) - kappa*trace(T)^2 of the structure
+// tensor T on a gaussian window of that sigma (or a box, if sigma < 0), of
+// side "-k kside" (by default, about 4*sigma)
 int main(int c, char *v[])
 {
+	char *sigma_opt = pick_option(&c, &v, "s", "");
+	int kside = atoi(pick_option(&c, &v, "k", "0"));
 	if (c != 4 && c != 3 && c != 2) {
-		fprintf(stderr, "usage:\n\t%s kappa [in [out]]\n", *v);
+		fprintf(stderr, "usage:\n\t%s [-s sigma [-k kside]] kappa "
+				"[in [out]]\n", *v);
 		//                          0 1  2   3
 		return EXIT_FAILURE;
 	}
@@ -54,7 +63,13 @@ int main(int c, char *v[])
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(in, &w, &h, &pd);
 	float *y = xmalloc(w*h*sizeof*y);
-	harris(y, x, w, h, pd, kappa);
+	if (*sigma_opt) {
+		double sigma = atof(sigma_opt);
+		if (kside < 1)
+			kside = 1 + 2 * ceil(2 * fabs(sigma));
+		harris_response_fused(y, kappa, x, w, h, pd, kside, sigma);
+	} else
+		harris(y, x, w, h, pd, kappa);
 	iio_write_image_float(out, y, w, h);
 	free(x);
 	free(y);
@@ -0,0 +1,154 @@
+// benchmark of the variants of abstract_heap.h
+//
+// heapbench variant [side [seed]]
+//
+// Computes the geodesic distances to the center of a grid of side x side
+// pixels with random positive costs (Dijkstra's algorithm, 4-neighbors), with
+// the same access pattern as the fast marching of distance and sdistance:
+// adding trial pixels, removing the top, and decreasing the energy of
+// elements inside the heap.  The variant is "binary" (the default heap),
+// "4ary" (HEAP_ARITY 4) or "radix" (HEAP_RADIX 1).  Prints the time of the
+// propagation and a checksum of the distances, that must be the same for all
+// the variants.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "xmalloc.c"
+
+struct heapbench {
+	float *x;  // distances (INFINITY for the far pixels)
+	int *hpos; // locations on the heap (-1 outside)
+	int *hvox; // pixels of the heap
+	int nt;    // number of elements of the heap
+};
+
+#define HEAP_ENERGY(e,i) e->x[e->hvox[i]]
+#define HEAP_SWAP(e,i,j) do{\
+	int t_ = e->hvox[i];\
+	e->hvox[i] = e->hvox[j];\
+	e->hvox[j] = t_;\
+	e->hpos[e->hvox[i]] = i;\
+	e->hpos[e->hvox[j]] = j;\
+}while(0)
+
+#include "abstract_heap.h"
+
+// cost of a pixel, in [1,2)
+static double heapbench_cost(uint64_t seed, long p)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15 * (p + 1);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	z ^= z >> 31;
+	return 1 + (z >> 11) * 0x1.0p-53;
+}
+
+// the propagation, instantiated once for each variant of the heap
+#define HEAPBENCH_DIJKSTRA(name) \
+static void name(struct heapbench *e, double *c, int n)\
+{\
+	int dx[4] = {1, 0, -1, 0}, dy[4] = {0, 1, 0, -1};\
+	for (long p = 0; p < n * (long)n; p++)\
+	{\
+		e->x[p] = INFINITY;\
+		e->hpos[p] = -1;\
+	}\
+	long s = (n/2) * (long)n + n/2;\
+	e->x[s] = 0;\
+	e->hvox[0] = s;\
+	e->hpos[s] = 0;\
+	e->nt = 1;\
+	HEAP_ADD(e, 0);\
+	while (e->nt > 0)\
+	{\
+		int r = e->hvox[0];\
+		HEAP_REMOVE_TOP(e, e->nt);\
+		e->nt -= 1;\
+		e->hpos[r] = -1;\
+		int i = r % n, j = r / n;\
+		for (int k = 0; k < 4; k++)\
+		{\
+			int ii = i + dx[k], jj = j + dy[k];\
+			if (ii < 0 || jj < 0 || ii >= n || jj >= n) continue;\
+			int q = jj * n + ii;\
+			float v = e->x[r] + c[q];\
+			if (!(v < e->x[q])) continue;\
+			if (e->hpos[q] >= 0)\
+				HEAP_CHANGE_ENERGY(e, e->nt, e->hpos[q], v);\
+			else {\
+				e->x[q] = v;\
+				e->hvox[e->nt] = q;\
+				e->hpos[q] = e->nt;\
+				e->nt += 1;\
+				HEAP_ADD(e, e->nt - 1);\
+			}\
+		}\
+	}\
+}
+
+HEAPBENCH_DIJKSTRA(dijkstra_binary)
+
+#undef HEAP_ARITY
+#define HEAP_ARITY 4
+HEAPBENCH_DIJKSTRA(dijkstra_4ary)
+
+#undef HEAP_ARITY
+#define HEAP_ARITY 2
+#undef HEAP_RADIX
+#define HEAP_RADIX 1
+HEAPBENCH_DIJKSTRA(dijkstra_radix)
+
+static double seconds(void)
+{
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + 1e-6 * t.tv_usec;
+}
+
+int main(int c, char *v[])
+{
+	if (c < 2 || c > 4) {
+		fprintf(stderr, "usage:\n\t%s {binary|4ary|radix} [side [seed]]\n",
+				*v);
+		return 1;
+	}
+	char *variant = v[1];
+	int n = c > 2 ? atoi(v[2]) : 1024;
+	uint64_t seed = c > 3 ? atoll(v[3]) : 0;
+	if (n < 1) fail("heapbench: bad side %d", n);
+
+	void (*f)(struct heapbench *, double *, int) = NULL;
+	if (!strcmp(variant, "binary")) f = dijkstra_binary;
+	if (!strcmp(variant, "4ary"))   f = dijkstra_4ary;
+	if (!strcmp(variant, "radix"))  f = dijkstra_radix;
+	if (!f) fail("heapbench: unknown variant \"%s\"", variant);
+
+	long N = n * (long)n;
+	double *cost = xmalloc(N * sizeof*cost);
+	for (long p = 0; p < N; p++)
+		cost[p] = heapbench_cost(seed, p);
+	struct heapbench e[1];
+	e->x = xmalloc(N * sizeof*e->x);
+	e->hpos = xmalloc(N * sizeof*e->hpos);
+	e->hvox = xmalloc(N * sizeof*e->hvox);
+
+	double t0 = seconds();
+	f(e, cost, n);
+	double t1 = seconds();
+
+	double sum = 0;
+	for (long p = 0; p < N; p++)
+		sum += e->x[p];
+	printf("%s\t%d\t%.6f\t%.17g\n", variant, n, t1 - t0, sum);
+
+	free(e->hvox);
+	free(e->hpos);
+	free(e->x);
+	free(cost);
+	return 0;
+}
@@ -1,3 +1,25 @@
+// histogram equalization (global or by tiles) and histogram transport
+//
+// The values are counted in bins: the integers themselves (when all the
+// values are integers of a range of at most 65536, e.g., 8 and 16 bit
+// images), or bins of equal width between the minimum and the maximum.
+// The equalized value is the proportion of the samples that are not larger,
+// interpolated linearly inside the bins of the second kind.  With a
+// reference image, the equalized values are transported to the values of
+// the reference with the same rank.
+//
+// With tiles, each tile has its own histogram (clipped as in CLAHE, if
+// requested), and the maps of the four nearest tiles are blended bilinearly.
+// The NANs are not counted, and they are kept in the output.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xmalloc.c"
+
 #include <math.h>
 #include <stdio.h>
 
@@ -28,42 +50,261 @@ static double transport_distance(double *a, double *b, int n)
 	return r;
 }
 
-static void accumulate_histogram(long double h[256])
+// binning of the values: the bin of v is floor((v - lo) / d), in [0, n)
+struct histeq_bins {
+	double lo, d;
+	int n;
+	bool integer; // bins of single integers (no interpolation inside)
+};
+
+// the bins are the integers (if nbins <= 0 and the values are integers in a
+// range of at most "nmax"), or nbins (or nmax) bins of equal width
+static void histeq_bins_init(struct histeq_bins *b, float *x, long n,
+		int nbins, int nmax)
 {
-	for (int i = 1; i < 256; i++)
-		h[i] += h[i-1];
+	float min = INFINITY, max = -INFINITY;
+	bool integer = true;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(min:min) reduction(max:max) reduction(&&:integer)
+#endif
+	for (long i = 0; i < n; i++)
+		if (isfinite(x[i])) {
+			if (x[i] < min) min = x[i];
+			if (x[i] > max) max = x[i];
+			integer = integer && x[i] == floor(x[i]);
+		}
+	if (!(min <= max))
+		min = max = 0;
+	b->integer = nbins <= 0 && integer && max - min < nmax;
+	if (b->integer) {
+		b->lo = min - 0.5;
+		b->d = 1;
+		b->n = max - min + 1;
+	} else {
+		b->n = nbins > 0 ? nbins : nmax;
+		b->lo = min;
+		b->d = max > min ? (max - (double)min) / b->n : 1;
+	}
 }
 
-static void fill_histogram(long double h[256], float *x, int n)
+// bin of the value v, and position inside it (in [0,1])
+static int histeq_bin(double *f, struct histeq_bins *b, float v)
 {
-	for (int i = 0; i < 256; i++)
-		h[i] = 0;
-	for (int i = 0; i < n; i++)
+	double p = (v - b->lo) / b->d;
+	int k = p;
+	if (p < 0) k = 0;
+	if (k >= b->n) k = b->n - 1;
+	*f = fmin(fmax(p - k, 0), 1);
+	return k;
+}
+
+// add the samples of the rectangle [i0,i1)x[j0,j1) of x (of width w) to h
+static void histeq_count(double *h, struct histeq_bins *b,
+		float *x, int w, int i0, int i1, int j0, int j1)
+{
+	for (int j = j0; j < j1; j++)
+	for (int i = i0; i < i1; i++)
 	{
-		int idx = round(x[i]);
-		if (idx < 0) idx = 0;
-		if (idx > 255) idx = 255;
-		h[idx] += 1;
+		float v = x[j*(long)w + i];
+		double f;
+		if (!isnan(v))
+			h[histeq_bin(&f, b, v)] += 1;
 	}
 }
 
+// histogram of the whole image, by partial histograms of each thread
+static void histeq_histogram(double *h, struct histeq_bins *b,
+		float *x, int w, int hh)
+{
+	for (int k = 0; k < b->n; k++)
+		h[k] = 0;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		double *t = xmalloc(b->n * sizeof*t);
+		for (int k = 0; k < b->n; k++)
+			t[k] = 0;
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int j = 0; j < hh; j++)
+			histeq_count(t, b, x, w, 0, w, j, j + 1);
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+		for (int k = 0; k < b->n; k++)
+			h[k] += t[k];
+		free(t);
+	}
+}
 
-static void equalize_inplace(float *x, long double h[256], int n)
+// clip the histogram at "clip" times its average count, and redistribute
+// the excess uniformly (as in CLAHE)
+static void histeq_clip(double *h, int n, double clip)
 {
-	for (int i = 0; i < n; i++)
+	double s = 0, e = 0;
+	for (int k = 0; k < n; k++)
+		s += h[k];
+	double l = clip * s / n;
+	for (int k = 0; k < n; k++)
+		if (h[k] > l) {
+			e += h[k] - l;
+			h[k] = l;
+		}
+	for (int k = 0; k < n; k++)
+		h[k] += e / n;
+}
+
+// m[k] = proportion of the samples in the bins before k (for k in [0,n])
+static void histeq_map(float *m, double *h, int n)
+{
+	long double a = 0, s = 0;
+	for (int k = 0; k < n; k++)
+		s += h[k];
+	m[0] = 0;
+	for (int k = 0; k < n; k++)
+	{
+		a += h[k];
+		m[k+1] = s > 0 ? a / s : (k + 1.0) / n;
+	}
+}
+
+// equalized value of v, from the map m
+static float histeq_apply(float *m, struct histeq_bins *b, float v)
+{
+	double f;
+	int k = histeq_bin(&f, b, v);
+	if (b->integer)
+		return m[k+1];
+	return m[k] + f * (m[k+1] - m[k]);
+}
+
+// value of the reference with the proportion t of samples not larger
+static float histeq_inverse(float *m, struct histeq_bins *b, float t)
+{
+	int lo = 0, hi = b->n - 1; // first bin k such that t <= m[k+1]
+	while (lo < hi)
 	{
-		int idx = round(x[i]);
-		if (idx < 0) idx = 0;
-		if (idx > 255) idx = 255;
-		x[i] = h[idx]/n;
+		int k = (lo + hi) / 2;
+		if (t <= m[k+1]) hi = k; else lo = k + 1;
 	}
+	if (b->integer)
+		return b->lo + 0.5 + lo;
+	double q = m[lo+1] > m[lo] ? (t - m[lo]) / (m[lo+1] - m[lo]) : 0.5;
+	return b->lo + b->d * (lo + fmin(fmax(q, 0), 1));
+}
+
+// equalization of x by a single histogram, with a table of the values of
+// the bins, if they are integers
+static void histeq_global(float *x, int w, int h, int nbins,
+		float *m_ref, struct histeq_bins *b_ref)
+{
+	long n = w * (long)h;
+	struct histeq_bins b[1];
+	histeq_bins_init(b, x, n, nbins, 0x10000);
+	double *H = xmalloc(b->n * sizeof*H);
+	float *m = xmalloc((b->n + 1) * sizeof*m);
+	histeq_histogram(H, b, x, w, h);
+	histeq_map(m, H, b->n);
+	float *lut = NULL;
+	if (b->integer) {
+		lut = xmalloc(b->n * sizeof*lut);
+		for (int k = 0; k < b->n; k++)
+			lut[k] = m_ref ? histeq_inverse(m_ref, b_ref, m[k+1])
+				: m[k+1];
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < n; i++)
+		if (!isnan(x[i])) {
+			double f;
+			if (lut)
+				x[i] = lut[histeq_bin(&f, b, x[i])];
+			else {
+				x[i] = histeq_apply(m, b, x[i]);
+				if (m_ref)
+					x[i] = histeq_inverse(m_ref, b_ref, x[i]);
+			}
+		}
+	free(lut);
+	free(m);
+	free(H);
+}
+
+// equalization of x by tiles of side t, with bilinear blending of the maps
+static void histeq_tiles(float *x, int w, int h, int nbins, int t,
+		double clip, float *m_ref, struct histeq_bins *b_ref)
+{
+	struct histeq_bins b[1];
+	histeq_bins_init(b, x, w * (long)h, nbins, 1024);
+	int nx = (w + t - 1) / t;
+	int ny = (h + t - 1) / t;
+	int N = b->n + 1;
+	float *m = xmalloc(nx * ny * (long)N * sizeof*m);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int q = 0; q < nx * ny; q++)
+	{
+		int i0 = (q % nx) * t, j0 = (q / nx) * t;
+		int i1 = i0 + t < w ? i0 + t : w;
+		int j1 = j0 + t < h ? j0 + t : h;
+		double *H = xmalloc(b->n * sizeof*H);
+		for (int k = 0; k < b->n; k++)
+			H[k] = 0;
+		histeq_count(H, b, x, w, i0, i1, j0, j1);
+		if (clip > 0)
+			histeq_clip(H, b->n, clip);
+		histeq_map(m + q * (long)N, H, b->n);
+		free(H);
+	}
+
+	// each pixel is between the centers of four tiles
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		double v = (j + 0.5) / t - 0.5;
+		int ja = floor(v), jb = ja + 1;
+		double fj = v - ja;
+		if (ja < 0) ja = 0;
+		if (jb > ny - 1) jb = ny - 1;
+		for (int i = 0; i < w; i++)
+		{
+			float *xij = x + j*(long)w + i;
+			if (isnan(*xij)) continue;
+			double u = (i + 0.5) / t - 0.5;
+			int ia = floor(u), ib = ia + 1;
+			double fi = u - ia;
+			if (ia < 0) ia = 0;
+			if (ib > nx - 1) ib = nx - 1;
+			float a = histeq_apply(m + (ja*nx + ia) * (long)N, b, *xij);
+			float c = histeq_apply(m + (ja*nx + ib) * (long)N, b, *xij);
+			float d = histeq_apply(m + (jb*nx + ia) * (long)N, b, *xij);
+			float e = histeq_apply(m + (jb*nx + ib) * (long)N, b, *xij);
+			float r = (1-fj) * ((1-fi) * a + fi * c)
+			          +  fj  * ((1-fi) * d + fi * e);
+			*xij = m_ref ? histeq_inverse(m_ref, b_ref, r) : r;
+		}
+	}
+	free(m);
 }
 
 #include "iio.h"
+#include "pickopt.c"
 int main(int c, char *v[])
 {
+	int nbins = atoi(pick_option(&c, &v, "b", "0"));
+	int tile = atoi(pick_option(&c, &v, "t", "0"));
+	double clip = atof(pick_option(&c, &v, "l", "0"));
+	char *filename_ref = pick_option(&c, &v, "r", "");
 	if (c != 2 && c != 1 && c != 3) {
-		fprintf(stderr, "usage:\n\t%s [in [out]]\n", *v);
+		fprintf(stderr, "usage:\n\t%s [-b bins] [-t tile [-l clip]] "
+				"[-r ref] [in [out]]\n", *v);
 		//                         0   1   2
 		return 1;
 	}
@@ -73,12 +314,29 @@ int main(int c, char *v[])
 	int w, h;
 	float *x = iio_read_image_float(filename_in, &w, &h);
 
-	long double H[256];
-	fill_histogram(H, x, w*h);
-	accumulate_histogram(H);
-	equalize_inplace(x, H, w*h);
+	// map of the reference, for the transport
+	float *m_ref = NULL;
+	struct histeq_bins b_ref[1];
+	if (*filename_ref) {
+		int wr, hr;
+		float *r = iio_read_image_float(filename_ref, &wr, &hr);
+		histeq_bins_init(b_ref, r, wr * (long)hr, nbins, 0x10000);
+		double *H = xmalloc(b_ref->n * sizeof*H);
+		m_ref = xmalloc((b_ref->n + 1) * sizeof*m_ref);
+		histeq_histogram(H, b_ref, r, wr, hr);
+		histeq_map(m_ref, H, b_ref->n);
+		free(H);
+		free(r);
+	}
+
+	if (tile > 0)
+		histeq_tiles(x, w, h, nbins, tile, clip, m_ref, b_ref);
+	else
+		histeq_global(x, w, h, nbins, m_ref, b_ref);
 
 	iio_write_image_float(filename_out, x, w, h);
 
+	free(m_ref);
+	free(x);
 	return 0;
 }
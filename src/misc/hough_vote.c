@@ -0,0 +1,294 @@
+#ifndef _HOUGH_VOTE_C
+#define _HOUGH_VOTE_C
+
+// voting engine for the Hough transforms of straight lines
+//
+// The line (theta, rho) is the set of points such that
+// x*cos(theta) + y*sin(theta) + rho = 0, for positions (x, y) relative to an
+// origin.  The accumulator has ntheta columns, that sample theta in [0, 2pi)
+// (or [0, pi) when folded), and nrho rows, that sample rho in
+// [rho0, rho0 + drho).  The cell (i_theta, i_rho) is a[i_rho*ntheta+i_theta].
+//
+// A gradient votes for the line through its pixel that is orthogonal to it,
+// with the weight of its norm.  An intensity votes for all the lines through
+// its pixel (a sinusoid of the accumulator), with the weight of its value.
+//
+// The pixels whose weight is above a threshold are first compacted into a
+// list of voters.  The list is split among the threads, that vote into their
+// own accumulators, and these are added at the end in a fixed order (so that
+// the result does not depend on the scheduling).  The sinusoids are
+// drawn with tables of sines and cosines, and optionally coarse-to-fine:
+// first into an accumulator coarser by some factor, and then only around the
+// coarse cells that are above a fraction of its maximum.
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// a compacted pixel
+struct hough_voter {
+	float x, y;    // position, relative to the origin
+	float m;       // weight
+	float gx, gy;  // gradient (for the gradient votes)
+};
+
+// sampling of the lines by the accumulator
+struct hough_lines {
+	int ntheta, nrho;   // size of the accumulator
+	double rho0, drho;  // interval of rho sampled by the rows
+	bool fold;          // whether theta is sampled in [0, pi)
+};
+
+// list of the voters: pixels (i,j) of weight m >= t, at (i-x0, j-y0)
+// the weight is the norm of the gradient g if it is given, or the value of m
+// (the list is in raster order, the pixels of zero or NAN weight are dropped)
+static struct hough_voter *hough_compact(long *out_n, float *m, float *g,
+		int w, int h, float x0, float y0, float t)
+{
+	long *o = xmalloc((h + 1) * sizeof*o);
+	o[0] = 0;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		long k = 0;
+		for (int i = 0; i < w; i++)
+		{
+			long p = j * (long)w + i;
+			float a = g ? hypot(g[2*p+0], g[2*p+1]) : m[p];
+			k += a >= t && a;
+		}
+		o[j+1] = k;
+	}
+	for (int j = 0; j < h; j++)
+		o[j+1] += o[j];
+	*out_n = o[h];
+	struct hough_voter *v = xmalloc((o[h] + 1) * sizeof*v);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		long k = o[j];
+		for (int i = 0; i < w; i++)
+		{
+			long p = j * (long)w + i;
+			float a = g ? hypot(g[2*p+0], g[2*p+1]) : m[p];
+			if (!(a >= t && a))
+				continue;
+			v[k].x = i - x0;
+			v[k].y = j - y0;
+			v[k].m = a;
+			v[k].gx = g ? g[2*p+0] : 0;
+			v[k].gy = g ? g[2*p+1] : 0;
+			k += 1;
+		}
+	}
+	free(o);
+	return v;
+}
+
+static int hough_nthreads(void)
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+// row of the accumulator of a value of rho (outside when not in [0,nrho))
+static inline int hough_row(struct hough_lines *P, double rho)
+{
+	return P->nrho * (rho - P->rho0) / P->drho;
+}
+
+// partial accumulators: the first thread votes into "a", the others into
+// zeroed arrays of p (that has space for nt-1 accumulators)
+static float *hough_partial(float *a, float *p, long N, int k)
+{
+	float *t = k ? p + (k - 1) * N : a;
+	for (long c = 0; c < N; c++)
+		t[c] = 0;
+	return t;
+}
+
+// add the partial accumulators to the first one
+static void hough_reduce(float *a, float *p, long N, int nt)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long c = 0; c < N; c++)
+		for (int k = 1; k < nt; k++)
+			a[c] += p[(k - 1) * N + c];
+}
+
+// accumulate the votes of the gradients (the transform of ghough)
+static void hough_vote_gradients(float *a, struct hough_lines *P,
+		struct hough_voter *v, long n)
+{
+	long N = P->ntheta * (long)P->nrho;
+	int nt = hough_nthreads();
+	if (nt > n) nt = n > 0 ? n : 1;
+	float *p = nt > 1 ? xmalloc((nt - 1) * N * sizeof*p) : NULL;
+	long cn = (n + nt - 1) / nt;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int k = 0; k < nt; k++)
+	{
+		float *t = hough_partial(a, p, N, k);
+		long e = (k + 1) * cn < n ? (k + 1) * cn : n;
+		for (long l = k * cn; l < e; l++)
+		{
+			struct hough_voter *q = v + l;
+			double rho = (q->x * q->gx + q->y * q->gy) / q->m;
+			float theta = M_PI + atan2(q->gy, q->gx);
+			float ti = P->ntheta * theta / (2 * M_PI);
+			if (P->fold) {
+				if (ti > P->ntheta/2) {
+					ti -= P->ntheta/2.0;
+					rho = -rho;
+				}
+				ti *= 2;
+			}
+			int i = ti;
+			int j = hough_row(P, rho);
+			if (i >= 0 && j >= 0 && i < P->ntheta && j < P->nrho)
+				t[j * P->ntheta + i] += q->m;
+		}
+	}
+	hough_reduce(a, p, N, nt);
+	free(p);
+}
+
+// accumulate the sinusoids of the voters, on the columns col[0..ncol-1]; if
+// C is given, only on the cells inside the coarse cells of C marked in
+// "mask" (the cell (i,j) is inside the coarse cell (i*C->ntheta/ntheta,
+// j*C->nrho/nrho))
+static void hough_sinusoids_core(float *a, struct hough_lines *P,
+		struct hough_voter *v, long n, int *col, int ncol,
+		struct hough_lines *C, uint8_t *mask)
+{
+	long N = P->ntheta * (long)P->nrho;
+	float *cs = xmalloc(2 * ncol * sizeof*cs), *sn = cs + ncol;
+	double period = P->fold ? M_PI : 2 * M_PI;
+	for (int l = 0; l < ncol; l++)
+	{
+		cs[l] = cos(period * col[l] / P->ntheta);
+		sn[l] = sin(period * col[l] / P->ntheta);
+	}
+	int nt = hough_nthreads();
+	if (nt > n) nt = n > 0 ? n : 1;
+	float *p = nt > 1 ? xmalloc((nt - 1) * N * sizeof*p) : NULL;
+	long cn = (n + nt - 1) / nt;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int k = 0; k < nt; k++)
+	{
+		float *t = hough_partial(a, p, N, k);
+		long e = (k + 1) * cn < n ? (k + 1) * cn : n;
+		for (long q = k * cn; q < e; q++)
+		for (int l = 0; l < ncol; l++)
+		{
+			double rho = -(v[q].x * cs[l] + v[q].y * sn[l]);
+			int j = hough_row(P, rho);
+			if (j < 0 || j >= P->nrho)
+				continue;
+			if (C) {
+				int ic = col[l] * (long)C->ntheta / P->ntheta;
+				int jc = j * (long)C->nrho / P->nrho;
+				if (!mask[jc * C->ntheta + ic])
+					continue;
+			}
+			t[j * P->ntheta + col[l]] += v[q].m;
+		}
+	}
+	hough_reduce(a, p, N, nt);
+	free(p);
+	free(cs);
+}
+
+// accumulate the sinusoids of the voters (the transform of ihough)
+static void hough_vote_sinusoids(float *a, struct hough_lines *P,
+		struct hough_voter *v, long n)
+{
+	int *col = xmalloc(P->ntheta * sizeof*col);
+	for (int i = 0; i < P->ntheta; i++)
+		col[i] = i;
+	hough_sinusoids_core(a, P, v, n, col, P->ntheta, NULL, NULL);
+	free(col);
+}
+
+// accumulate the sinusoids coarse-to-fine: the accumulator is computed f
+// times coarser, and then only inside the neighbors of the coarse cells
+// above q times its maximum (the other cells are zero)
+static void hough_vote_sinusoids_refined(float *a, struct hough_lines *P,
+		struct hough_voter *v, long n, int f, float q)
+{
+	if (f <= 1) {
+		hough_vote_sinusoids(a, P, v, n);
+		return;
+	}
+	struct hough_lines C[1] = {*P};
+	C->ntheta = (P->ntheta + f - 1) / f;
+	C->nrho = (P->nrho + f - 1) / f;
+	long NC = C->ntheta * (long)C->nrho;
+	float *b = xmalloc(NC * sizeof*b);
+	hough_vote_sinusoids(b, C, v, n);
+
+	// mark the neighbors of the strong coarse cells
+	float top = 0;
+	for (long c = 0; c < NC; c++)
+		if (b[c] > top)
+			top = b[c];
+	uint8_t *mask = xmalloc(NC);
+	for (long c = 0; c < NC; c++)
+		mask[c] = 0;
+	for (int j = 0; j < C->nrho; j++)
+	for (int i = 0; i < C->ntheta; i++)
+		if (top > 0 && b[j * C->ntheta + i] >= q * top)
+			for (int dj = -1; dj <= 1; dj++)
+			for (int di = -1; di <= 1; di++)
+			{
+				int ii = i + di, jj = j + dj;
+				if (ii >= 0 && jj >= 0 && ii < C->ntheta
+						&& jj < C->nrho)
+					mask[jj * C->ntheta + ii] = 1;
+			}
+
+	// fine columns that have some marked coarse cell
+	bool *active = xmalloc(C->ntheta * sizeof*active);
+	for (int i = 0; i < C->ntheta; i++)
+	{
+		active[i] = false;
+		for (int j = 0; j < C->nrho; j++)
+			active[i] = active[i] || mask[j * C->ntheta + i];
+	}
+	int *col = xmalloc(P->ntheta * sizeof*col), ncol = 0;
+	for (int i = 0; i < P->ntheta; i++)
+		if (active[i * (long)C->ntheta / P->ntheta])
+			col[ncol++] = i;
+
+	hough_sinusoids_core(a, P, v, n, col, ncol, C, mask);
+	free(col);
+	free(active);
+	free(mask);
+	free(b);
+}
+
+#endif//_HOUGH_VOTE_C
@@ -2,38 +2,20 @@
 #include <stdio.h>
 #include <math.h>
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
+#include "xmalloc.c"
+#include "hough_vote.c"
 
-static int insideP(int w, int h, int i, int j)
+// the lines are centered at the image, and only the gradients of norm at
+// least "t" vote
+void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h,
+		float t)
 {
-	return i >= 0 && j >= 0 && i < w && j < h;
-}
-
-void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h)
-{
-	// fill counts to zero
-	for (int i = 0; i < n_theta * n_rho; i++)
-		transform[i] = 0;
-
-	// for each gradient vector,
-	// increase the corresponding Hough count by its norm
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		float *g = grad + 2 * (j*w + i);
-		float x = i - w/2;
-		float y = j - h/2;
-		float ng = hypot(g[0], g[1]);
-		float theta = M_PI + atan2(g[1], g[0]);
-		float alpha = M_PI + atan2(y, x);
-		float rho = hypot(x, y) * cos(alpha - theta);
-		int i_rho   = n_rho   * (0.5 + rho   / hypot(w, h) );
-		int i_theta = n_theta * theta / (2 * M_PI);
-		if (insideP(n_theta, n_rho, i_theta, i_rho))
-			transform[i_rho*n_theta + i_theta] += ng;
-	}
+	long n;
+	struct hough_voter *v = hough_compact(&n, NULL, grad, w, h,
+			w/2, h/2, t);
+	struct hough_lines P = {n_theta, n_rho, -hypot(w,h)/2, hypot(w,h), 0};
+	hough_vote_gradients(transform, &P, v, n);
+	free(v);
 }
 
 
@@ -43,12 +25,14 @@ void ghough(float *transform, int n_theta, int n_rho, float *grad, int w, int h)
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
+#include "pickopt.c"
 int main(int c, char *v[])
 {
 	// process input arguments
+	float t = atof(pick_option(&c, &v, "t", "0"));
 	if (c != 3) {
 		fprintf(stderr, "usage:\n\t"
-				"%s [options] image transform\n", *v);
+				"%s [-t thresh] nrho ntheta <gradient >hough\n", *v);
 		//               0            1      2
 		return 1;
 	}
@@ -62,7 +46,7 @@ int main(int c, char *v[])
 
 	// compute transform
 	float *transform = malloc(nrho * ntheta * sizeof*transform);
-	ghough(transform, nrho, ntheta, gradient, w, h);
+	ghough(transform, nrho, ntheta, gradient, w, h, t);
 
 	// save output image
 	iio_write_image_float_vec("-", transform, nrho, ntheta, 1);
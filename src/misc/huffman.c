@@ -3,16 +3,34 @@
 // 1. API
 //
 // @out: output array of encoded bytes, to be filled-in
-// @in: input array of code words
+// @in: input array of code words (values in [0, nw), with nw <= 256)
 // @n: length of input array
 // return value: number of output bytes
-//int huffman_encode(uint8_t *out, int *in, int n);
+//int huffman_encode(uint8_t *out, uint8_t *in, int n, int nw);
 //
+// @out: output array of code words, to be filled-in
+// @in: input array of encoded bytes
+// @n: length of input array
+// return value: number of output code words (or -1 on a bad stream)
+//int huffman_decode(uint8_t *out, uint8_t *in, int n);
 //
-//int huffman_decode(int *out, uint8_t *in, int n);
-
-// precondition "out" must contain enough pre-allocated space
-// at worse, 260+n
+// precondition: "out" must contain enough pre-allocated space
+// (at worst HUFFMAN_MAX_BYTES(n,nw) for the encoder, and the length of the
+// message, stored in its first four bytes, for the decoder)
+//
+// The code is canonical, so that only the lengths of the code words are
+// stored.  The stream is
+//
+// 	4 bytes   n, the number of code words of the message (little endian)
+// 	4 bytes   nw, the number of different code words (little endian)
+// 	nw bytes  the length of the code of each word (0 if it is not used)
+// 	...       the codes of the message, most significant bit first
+//
+// The decoder looks up the first HUFFMAN_TABLE_BITS bits of the stream in a
+// table, which gives the complete code of the most frequent words, and the
+// longer codes are found by canonical ranges.  The bits are read and written
+// through a 64-bit buffer, and the lower-level functions below decode blocks
+// of words from a stream, for the callers that keep their own framing.
 
 
 // 2. IMPLEMENTATION
@@ -20,326 +38,377 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <math.h>
 
+// bits of the lookup table of the decoder (from 8 to 12)
+#ifndef HUFFMAN_TABLE_BITS
+#define HUFFMAN_TABLE_BITS 11
+#endif
 
-struct tree_node { int mother, left, right; };
-struct heap_node { int word, freq; };
-struct code_word { int word, length, *bits; };
+// maximum length of a code word
+#define HUFFMAN_MAX_LENGTH 24
 
+// size of a worst-case encoded message
+#define HUFFMAN_MAX_BYTES(n,nw) (8 + (nw) + 3*(n) + 8)
 
 
-static void fill_code_word(struct code_word *w, struct tree_node *t, int l)
-{
-	w->word = l;
-	int len = 0, i = l, cx = 1;
-	while (t[i].mother != i) {
-		len += 1;
-		i = t[i].mother;
-	}
-	w->length = len;
-	w->bits = malloc((w->length+1) * sizeof*w->bits);
-	i = l;
-	while (t[i].mother != i) {
-		int m = t[i].mother;
-		//int bit = (i == t[m].left) ? 1 : 0;
-		//int bitpos = w->length - cx++;
-		//fprintf(stderr, "word %d, bit %d = %d\n", l, bitpos, bit);
-		//w->bits[bitpos] = bit;
-		w->bits[w->length-cx++] = (i == t[m].left) ? 1 : 0;
-		i = m;
-	}
-}
+// 2.1. code lengths
 
-//static void print_code_of_this_leaf(struct tree_node *t, int n, int l)
-//{
-//	assert(l >= 0);
-//	assert(l < n);
-//	int len = 0, i = l;
-//	while (t[i].mother != i)
-//	{
-//		len += 1;
-//		i = t[i].mother;
-//	}
-//	//fprintf(stderr, "len(%d) = %d\n", l, len+1);
-//	int code[len], cx = 0;
-//	i = l;
-//	while (t[i].mother != i)
-//	{
-//		int m = t[i].mother;
-//		code[len-++cx] = (i == t[m].left) ? 1 : 0;
-//		i = m;
-//	}
-//	//fprintf(stderr, "cx = %d\n", cx);
-//	fprintf(stderr, "code(%d) = 1", l);
-//	for (int j = 0; j < len; j++)
-//		fprintf(stderr, " %d", code[j]);
-//	fprintf(stderr, "\n");
-//
-//}
+struct heap_node { int word, freq; };
+
+#define HEAP_ENERGY(h,i) h[i].freq
+#define HEAP_SWAP(h,i,j) do{struct heap_node t_=h[i];h[i]=h[j];h[j]=t_;}while(0)
+#include "abstract_heap.h"
 
-static void find_code_from_tree(struct code_word *c, struct tree_node *t, int n)
+// lengths of the huffman code for the frequencies f[0..nw-1] (zero for the
+// words that do not appear), returns the maximum length
+static int huffman_lengths_unbounded(int *len, int *f, int nw)
 {
-	assert(1 == n%2);
-	int nw = (n + 1)/2;
+	struct heap_node q[nw + 1];
+	int mother[2*nw + 1], depth[2*nw + 1];
+	int m = 0;
 	for (int i = 0; i < nw; i++)
 	{
-		assert(t[i].left < 0 || t[i].left == i);
-		fill_code_word(c + i, t, i);
+		len[i] = 0;
+		if (f[i])
+			q[m++] = (struct heap_node){i, f[i]};
 	}
-	for (int i = 0; i < nw; i++)
+	if (m < 2) {
+		if (m) len[q[0].word] = 1;
+		return m;
+	}
+
+	// join the two least frequent nodes, until there is only one
+	HEAP_BUILD(q, m);
+	int next = nw; // index of the next internal node
+	while (m > 1)
 	{
-		struct code_word *w = c + i;
-		fprintf(stderr, "codeword %d:", w->word);
-		for (int j = 0; j < w->length; j++)
-			fprintf(stderr, " %d", w->bits[j]);
-		fprintf(stderr, "\n");
+		HEAP_REMOVE_TOP(q, m);
+		struct heap_node a = q[--m];
+		HEAP_REMOVE_TOP(q, m);
+		struct heap_node b = q[--m];
+		mother[a.word] = mother[b.word] = next;
+		q[m] = (struct heap_node){next++, a.freq + b.freq};
+		HEAP_ADD(q, m);
+		m += 1;
 	}
-}
 
-static void find_tree_from_code(struct tree_node *t, struct code_word *c, int n)
-{
+	// the internal nodes are created after their children
+	int root = next - 1, r = 0;
+	depth[root] = 0;
+	for (int i = root - 1; i >= nw; i--)
+		depth[i] = depth[mother[i]] + 1;
+	for (int i = 0; i < nw; i++)
+		if (f[i]) {
+			len[i] = depth[mother[i]] + 1;
+			if (len[i] > r) r = len[i];
+		}
+	return r;
 }
 
-#define HEAP_ENERGY(h,i) h[i].freq
-#define HEAP_SWAP(h,i,j) do{struct heap_node t_=h[i];h[i]=h[j];h[j]=t_;}while(0)
-#include "abstract_heap.h"
-
-static void heap_swap(struct heap_node *h, int i, int j)
+// lengths of the huffman code, flattening the frequencies until the longest
+// code fits into HUFFMAN_MAX_LENGTH bits
+static int huffman_lengths(int *len, int *freq, int nw)
 {
-	struct heap_node t = h[i];
-	h[i] = h[j];
-	h[j] = t;
+	int f[nw];
+	memcpy(f, freq, nw * sizeof*f);
+	while (1)
+	{
+		int r = huffman_lengths_unbounded(len, f, nw);
+		if (r <= HUFFMAN_MAX_LENGTH)
+			return r;
+		for (int i = 0; i < nw; i++)
+			f[i] = f[i] ? (f[i] + 1) / 2 : 0;
+	}
 }
 
-static void heap_fixup(struct heap_node *h, int n, int i)
+// canonical code words of the given lengths: the words are sorted by length
+// (and by value, for the same length), and consecutive codes are assigned
+static void huffman_canonical_codes(uint32_t *code, int *len, int nw)
 {
-	while (h[i].freq < h[HEAP_PARENT(i)].freq)
+	uint32_t c = 0;
+	for (int l = 1; l <= HUFFMAN_MAX_LENGTH; l++)
 	{
-		heap_swap(h, i, HEAP_PARENT(i));
-		i = HEAP_PARENT(i);
+		for (int i = 0; i < nw; i++)
+			if (len[i] == l)
+				code[i] = c++;
+		c <<= 1;
 	}
 }
 
-static void heap_build(struct heap_node *h, int n)
+
+// 2.2. bit streams
+
+struct huffman_bitwriter {
+	uint8_t *p;    // next output byte
+	uint64_t buf;  // pending bits, in the high part
+	int nbits;     // number of pending bits
+};
+
+static void huffman_bitwriter_init(struct huffman_bitwriter *w, uint8_t *p)
 {
-	int i = 0;
-	while (i < n)
-		heap_fixup(h, n, i++);
+	w->p = p;
+	w->buf = 0;
+	w->nbits = 0;
 }
 
-static int heap_best_of_three(struct heap_node *h, int n, int i)
+// write the "len" lower bits of "code" (with len <= 32)
+static void huffman_put(struct huffman_bitwriter *w, uint32_t code, int len)
 {
-	int ir = HEAP_RIGHT(i);
-	int il = HEAP_LEFT(i);
-	int ei = h[i].freq;
-	int eir = h[ir].freq;
-	int eil = h[il].freq;
-	return (il >= n ) ? i :(
-		(ir == n ) ? ( ei < eil ? i : il) :(
-		(ei  <= eil && ei  <=  eir ) ? i  :(
-		(eil <= ei  && eil <=  eir ) ? il :(
-		(eir <= eil && eir <=  ei  ) ? ir :-1))));
+	if (w->nbits + len > 64)
+		while (w->nbits >= 8)
+		{
+			*w->p++ = w->buf >> 56;
+			w->buf <<= 8;
+			w->nbits -= 8;
+		}
+	w->buf |= (uint64_t)code << (64 - w->nbits - len);
+	w->nbits += len;
 }
 
-static void heap_fixdown(struct heap_node *h, int n, int i)
+// write the pending bits, padded with zeros; returns the end of the output
+static uint8_t *huffman_bitwriter_flush(struct huffman_bitwriter *w)
 {
-	int j;
-	while ((j = heap_best_of_three(h,n,i)) != i)
+	while (w->nbits > 0)
 	{
-		heap_swap(h, i, j);
-		i = j;
+		*w->p++ = w->buf >> 56;
+		w->buf <<= 8;
+		w->nbits -= 8;
 	}
+	w->nbits = 0;
+	return w->p;
 }
 
-static void heap_remove_top(struct heap_node *h, int n)
-{
-	heap_swap(h, 0, n-1);
-	heap_fixdown(h, n-1, 0);
-}
+struct huffman_bitreader {
+	uint8_t *p, *end; // next input byte, end of the input
+	uint64_t buf;     // next bits, in the high part
+	int nbits;        // number of valid bits in buf
+	int overrun;      // number of zero bytes read past the end
+};
 
-static void heap_add(struct heap_node *h, int k)
+static void huffman_bitreader_init(struct huffman_bitreader *r,
+		uint8_t *p, long n)
 {
-	heap_fixup(h, k+1, k);
+	r->p = p;
+	r->end = p + n;
+	r->buf = 0;
+	r->nbits = 0;
+	r->overrun = 0;
 }
 
-
-static
-void compute_huffman_tree(struct tree_node *htree, uint8_t *in, int n, int nw)
+// ensure that there are at least 57 bits in the buffer
+static void huffman_refill(struct huffman_bitreader *r)
 {
-#define NW nw
-#define NT (NW*2-1)
-	struct heap_node queue[NW]; // the priority queue
-
-	// 0. initialize the tree
-	for (int i = 0; i < NT; i++)
-		htree[i].mother = htree[i].left = htree[i].right = i;
-
-	// 1. compute histogram
-	for (int i = 0; i < NW; i++) {
-		queue[i].word = i;
-		queue[i].freq = 0;
+	if (r->nbits <= 56 && r->end - r->p >= 8) { // whole bytes at once
+		int k = (63 - r->nbits) / 8;
+		for (int i = 0; i < k; i++)
+			r->buf |= (uint64_t)r->p[i] << (56 - r->nbits - 8*i);
+		r->p += k;
+		r->nbits += 8 * k;
 	}
-	for (int i = 0; i < n; i++) {
-		assert(in[i] < NW);
-		queue[in[i]].freq += 1;
-	}
-
-	HEAP_BUILD(queue, NW);
-
-	for (int i = 0; i < NW - 1; i++)
+	while (r->nbits <= 56)
 	{
-		struct heap_node *qa = queue + NW - i - 1;
-		HEAP_REMOVE_TOP(queue, 1 + qa - queue);
-		//fprintf(stderr,"got top w=%d, freq=%d\n", qa->word, qa->freq);
-		struct tree_node *ta = htree + qa->word;
-
-		struct heap_node *qb = queue + NW - i - 2;
-		HEAP_REMOVE_TOP(queue, 1 + qb - queue);
-		//fprintf(stderr,"got top w=%d, freq=%d\n", qb->word, qb->freq);
-		struct tree_node *tb = htree + qb->word;
-
-		struct tree_node *tc = htree + NW + i;
-		tc->left = qa->word;
-		tc->right = qb->word;
-		ta->mother = tb->mother = NW + i;
-
-		qb->word = NW + i;
-		qb->freq += qa->freq;
-		//fprintf(stderr,"created w=%d, freq=%d\n", qb->word, qb->freq);
-		HEAP_ADD(queue, qb - queue);
-
-		//fprintf(stderr, "\n");
+		uint64_t b = r->p < r->end ? *r->p++ : (r->overrun++, 0);
+		r->buf |= b << (56 - r->nbits);
+		r->nbits += 8;
 	}
-
-	//htree[NT-1].mother = NT-1;
-
-	//for (int i = 0; i < NT; i++)
-	//{
-	//	struct tree_node *x = htree + i;
-	//	fprintf(stderr, "htree[%d] = {m=%d l=%d r=%d}\n",
-	//		i, x->mother, x->left, x->right);
-	//}
-	//fprintf(stderr, "\n");
-}
-
-#define SETBIT(x,i) ((x)|=(1<<(i)))
-#define GETBIT(x,i) (bool)((x)&(1<<(i)))
-
-static void add_bit_to_stream(uint8_t *x, int n, bool value)
-{
-	assert(value == 0 || value == 1);
-	int pos = n/8;
-	int res = n%8;
-	if (res == 1)
-		x[pos] = 0;
-	if (value)
-		SETBIT(x[pos],res);
 }
 
 
+// 2.3. decoding tables
 
-static bool get_bit_from_stream(uint8_t *x, int n)
-{
-	int pos = n/8;
-	int res = n%8;
-	return GETBIT(x[pos], res);
-}
+struct huffman_decoder {
+	int nw;
+	int maxlen;
+	uint16_t table[1 << HUFFMAN_TABLE_BITS]; // word << 5 | length (0=long)
+	uint32_t first[HUFFMAN_MAX_LENGTH + 1];  // first canonical code
+	int count[HUFFMAN_MAX_LENGTH + 1];       // number of codes
+	int index[HUFFMAN_MAX_LENGTH + 1];       // position in "sorted"
+	uint8_t sorted[256];                     // words sorted by code
+};
 
-static
-int encode_message(uint8_t *y, struct code_word *c, int nw, uint8_t *x, int n)
+// returns false if the lengths are not those of a prefix code
+static bool huffman_decoder_init(struct huffman_decoder *d, int *len, int nw)
 {
-	assert(nw < 256);
-	fprintf(stderr, "original message of %d bytes\n", n);
-
-	// TODO: canonicalize code words
-	// 1. encode the codebook (each int goes to 4 bytes)
-	uint32_t *yy = (void*)y;
-	y[0] = n;//original message length
-	// 1.1. number of words
-	yy[1] = nw;
-	// 1.2. the lengths of each word
+	if (nw < 1 || nw > 256)
+		return false;
+	d->nw = nw;
+	d->maxlen = 0;
+	for (int l = 0; l <= HUFFMAN_MAX_LENGTH; l++)
+		d->count[l] = 0;
 	for (int i = 0; i < nw; i++)
 	{
-		assert(c[i].word == i);
-		yy[2+i] = c[i].length;
+		if (len[i] < 0 || len[i] > HUFFMAN_MAX_LENGTH)
+			return false;
+		d->count[len[i]] += 1;
+		if (len[i] > d->maxlen) d->maxlen = len[i];
 	}
-	int r = 4*nw + 8, nbits = 0;
-	y += 4*(nw + 2);
-	// 1.3. the words themselves
-	for (int i = 0; i < nw; i++)
-		for (int j = 0; j < c[i].length; j++)
-			add_bit_to_stream(y, nbits++, c[i].bits[j]);
-	fprintf(stderr, "header of %d bytes\n", r);
+	d->count[0] = 0;
 
-	// 2. encode the message
-	for (int i = 0; i < n; i++)
-		for (int j = 0; j < c[x[i]].length; j++)
-			add_bit_to_stream(y, nbits++, c[x[i]].bits[j]);
+	// canonical ranges (check that the code space is not overfull)
+	uint32_t c = 0;
+	int k = 0;
+	for (int l = 1; l <= HUFFMAN_MAX_LENGTH; l++)
+	{
+		d->first[l] = c;
+		d->index[l] = k;
+		if (c + d->count[l] > (1u << l))
+			return false;
+		for (int i = 0; i < nw; i++)
+			if (len[i] == l)
+				d->sorted[k++] = i;
+		c = (c + d->count[l]) << 1;
+	}
 
-	int nbytes = nbits/8 + (bool)(nbits%8);
-	r += nbytes;
-	fprintf(stderr, "message of %d bytes\n", nbytes);
-	fprintf(stderr, "for a total of %d bytes (%g%%)\n", r, 100.0*r/n);
-	return r;
+	// table of the codes that are not longer than its bits
+	int B = HUFFMAN_TABLE_BITS;
+	for (int t = 0; t < 1 << B; t++)
+		d->table[t] = 0;
+	for (int l = 1; l <= B && l <= d->maxlen; l++)
+	for (int j = 0; j < d->count[l]; j++)
+	{
+		int w = d->sorted[d->index[l] + j];
+		uint32_t t0 = (d->first[l] + j) << (B - l);
+		for (uint32_t t = t0; t < t0 + (1u << (B - l)); t++)
+			d->table[t] = w << 5 | l;
+	}
+	return true;
 }
 
-int huffman_decode(uint8_t *y, uint8_t *x, int n)
+// decode one word of a code longer than the table
+static int huffman_decode_long(struct huffman_decoder *d,
+		struct huffman_bitreader *r)
 {
-	uint32_t *xx = (void*)x;
-	int nout = xx[0], nw = xx[1], nbits = 0, wordpos = 0, wordidx = 0;
-	struct code_word code[nw];
-	for (int i = 0; i < nw; i++) {
-		code[i].word = i;
-		code[i].length = xx[1+i];
-		nbits += code[i].length;
-	}
-	x += 4*(nw + 2);
-	for (int i = 0; i < nbits; i++) {
-		code[wordidx].bits[wordpos++] = get_bit_from_stream(x, i);
-		if (wordpos == code[wordidx].length) {
-			wordpos = 0;
-			wordidx += 1;
+	uint32_t v = r->buf >> 32;
+	for (int l = HUFFMAN_TABLE_BITS + 1; l <= d->maxlen; l++)
+	{
+		uint32_t c = v >> (32 - l);
+		if (c - d->first[l] < (uint32_t)d->count[l]) {
+			r->buf <<= l;
+			r->nbits -= l;
+			return d->sorted[d->index[l] + c - d->first[l]];
 		}
 	}
-	for (int i = 0; i < nout; i++)
+	return -1;
+}
+
+// decode n words from the stream, returns the number of decoded words
+// (smaller than n if the stream is bad or too short)
+static int huffman_decode_block(struct huffman_decoder *d,
+		struct huffman_bitreader *r, uint8_t *out, int n)
+{
+	int B = HUFFMAN_TABLE_BITS;
+	int i = 0;
+	while (i < n)
 	{
-		// we need the tree for decoding!
+		// with at least 57 bits, two words of the table fit
+		huffman_refill(r);
+		for (int k = 0; k < 2 && i < n; k++)
+		{
+			uint16_t e = d->table[r->buf >> (64 - B)];
+			int l = e & 31;
+			if (l) {
+				r->buf <<= l;
+				r->nbits -= l;
+				out[i++] = e >> 5;
+			} else {
+				int w = huffman_decode_long(d, r);
+				if (w < 0) return i;
+				out[i++] = w;
+				break;
+			}
+		}
+		if (r->overrun > 8) // past the end of the stream
+			return i - 1;
 	}
+	return i;
+}
 
-	fprintf(stderr, "decoding not yet implemented");
-	abort();
 
+// 2.4. messages
 
+static uint32_t get_le32(uint8_t *x)
+{
+	return x[0] | x[1] << 8 | x[2] << 16 | (uint32_t)x[3] << 24;
+}
+
+static void put_le32(uint8_t *x, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		x[i] = v >> (8*i);
 }
 
 int huffman_encode(uint8_t *out, uint8_t *in, int n, int nw)
 {
-	struct tree_node htree[NT];
-	compute_huffman_tree(htree, in, n, nw);
+	assert(nw > 0 && nw <= 256);
+	int freq[nw], len[nw];
+	uint32_t code[nw];
+	for (int i = 0; i < nw; i++)
+		freq[i] = 0;
+	for (int i = 0; i < n; i++)
+	{
+		assert(in[i] < nw);
+		freq[in[i]] += 1;
+	}
+	huffman_lengths(len, freq, nw);
+	huffman_canonical_codes(code, len, nw);
 
-	struct code_word code[NW];
-	find_code_from_tree(code, htree, NT);
+	put_le32(out, n);
+	put_le32(out + 4, nw);
+	for (int i = 0; i < nw; i++)
+		out[8 + i] = len[i];
+	struct huffman_bitwriter w[1];
+	huffman_bitwriter_init(w, out + 8 + nw);
+	for (int i = 0; i < n; i++)
+		huffman_put(w, code[in[i]], len[in[i]]);
+	return huffman_bitwriter_flush(w) - out;
+}
 
-	return encode_message(out, code, NW, in, n);
+int huffman_decode(uint8_t *out, uint8_t *in, int n)
+{
+	if (n < 8) return -1;
+	int nout = get_le32(in);
+	int nw = get_le32(in + 4);
+	if (nout < 0 || nw < 1 || nw > 256 || n < 8 + nw) return -1;
+	int len[nw];
+	for (int i = 0; i < nw; i++)
+		len[i] = in[8 + i];
+	struct huffman_decoder d[1];
+	if (!huffman_decoder_init(d, len, nw)) return -1;
+	struct huffman_bitreader r[1];
+	huffman_bitreader_init(r, in + 8 + nw, n - 8 - nw);
+	return nout == huffman_decode_block(d, r, out, nout) ? nout : -1;
 }
 
 
+// 3. TEST
+//
+// encode a random message of n words out of m, and decode it back
+
+#include <time.h>
 int main(int c, char **v)
 {
-	if (c != 3) return -1;
+	if (c != 3)
+		return fprintf(stderr, "usage:\n\t%s n m\n", *v);
 	int n = atoi(v[1]);
 	int m = atoi(v[2]);
-	uint8_t t[n], tt[2*n+1000];
+	if (n < 0 || m < 1 || m > 256)
+		return fprintf(stderr, "bad n=%d or m=%d\n", n, m);
+	uint8_t *t = malloc(n + 1);
+	uint8_t *u = malloc(n + 1);
+	uint8_t *tt = malloc(HUFFMAN_MAX_BYTES(n, m));
 	for (int i = 0; i < n; i++)
 		t[i] = pow(1.0*(rand()%m)/m,4)*m;
-	return huffman_encode(tt, t, n, m);
-	//uint8_t t[40] = {
-	//	0, 1, 3,  3, 3, 3,  3, 3, 3,  0,
-	//	2, 2, 2,  2, 2, 3,  3, 3, 3,  0,
-	//	4, 4, 5,  5, 5, 6,  7, 7, 7,  7,
-	//	7, 7, 7,  7, 7, 7,  6, 6, 6,  6,
-	//};
-	//uint8_t tt[100];
-	//return huffman_encode(tt, t, 40, 8);
+	int r = huffman_encode(tt, t, n, m);
+	clock_t t0 = clock();
+	int k = huffman_decode(u, tt, r);
+	double s = (clock() - t0) / (double)CLOCKS_PER_SEC;
+	bool ok = k == n && !memcmp(t, u, n);
+	fprintf(stderr, "%d bytes encoded into %d (%g%%), decoded in %gs: %s\n",
+			n, r, 100.0*r/(n ? n : 1), s, ok ? "OK" : "FAIL");
+	free(t);
+	free(u);
+	free(tt);
+	return !ok;
 }
@@ -46,35 +46,22 @@ static void voterline(double abc[3], int w, int h, int ntheta, int nrho,
 	//	abc[0], abc[1], abc[2]);
 }
 
-// reading paradigm
+#include "xmalloc.c"
+#include "hough_vote.c"
+
+// reading paradigm (the sinusoids of "candidate", by the voting engine)
+// if coarse > 1, the votes are refined coarse-to-fine around the cells above
+// the fraction "fraction" of the maximum of the coarse accumulator
 void ihough(float *transform, int ntheta, int nrho, float *imag, int w, int h,
-		float minmag, bool folding)
+		float minmag, bool folding, int coarse, float fraction)
 {
-	// fill counts to zero
-	for (int i = 0; i < ntheta * nrho; i++)
-		transform[i] = 0;
-
-	// for each bubble
-	// accumulate the corresponding Hough curve by its magnitude
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		float magnitude = imag[j*w+i];
-
-		if (magnitude < minmag)
-			continue;
-
-		for (int i_theta = 0; i_theta < ntheta; i_theta++)
-		{
-			int i_rho = candidate(w, h, ntheta, nrho, i, j, i_theta,
-					folding);
-			if (insideP(ntheta, nrho, i_theta, i_rho))
-			{
-				int it = i_rho * ntheta + i_theta;
-				transform[it] += magnitude;
-			}
-		}
-	}
+	long n;
+	struct hough_voter *v = hough_compact(&n, imag, NULL, w, h,
+			w/2, h/2, minmag);
+	struct hough_lines P = {ntheta, nrho, -hypot(w,h)/2, hypot(w,h),
+		folding};
+	hough_vote_sinusoids_refined(transform, &P, v, n, coarse, fraction);
+	free(v);
 }
 
 // compute the vector product of two vectors
@@ -363,11 +350,14 @@ int main(int c, char *v[])
 	char *f_right         =      pick_option(&c, &v, "r", "/dev/null");
 	char *f_in            =      pick_option(&c, &v, "i", "-");
 	char *f_out           =      pick_option(&c, &v, "o", "-");
+	int coarse            = atoi(pick_option(&c, &v, "c", "1"));
+	float fraction        = atof(pick_option(&c, &v, "p", "0.5"));
 
 	// process input arguments
 	if (c != 4) {
 		fprintf(stderr, "usage:\n\t"
-				"%s ntheta nrho mtres <intensity >hough\n", *v);
+				"%s [-c coarse [-p fraction]] "
+				"ntheta nrho mtres <intensity >hough\n", *v);
 		//               0  1    2      3
 		return 1;
 	}
@@ -390,7 +380,8 @@ int main(int c, char *v[])
 	if (!omit_computation)
 	{
 		if (!writing_paradigm)
-			ihough(transform, ntheta, nrho, bubbles, w, h, mtres, fold);
+			ihough(transform, ntheta, nrho, bubbles, w, h, mtres, fold,
+					coarse, fraction);
 		else
 			ihoughw(transform, ntheta, nrho, bubbles, w, h, mtres, fold);
 	}
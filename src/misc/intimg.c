@@ -1,23 +1,76 @@
-static void compute_intimg_inplace(double *x, int w, int h)
-{
-	for (int j = 0; j < h; j++)
-	for (int i = 1; i < w; i++)
-		x[j*w+i] += x[j*w + i - 1];
-	for (int i = 0; i < w; i++)
-	for (int j = 1; j < h; j++)
-		x[j*w+i] += x[(j-1)*w + i];
-}
+// integral images, and local statistics on boxes
+//
+// intimg [in [out]]                     integral image (inclusive sums)
+// intimg -r rad [-s stat] [in [out]]    statistic on the box of side 2*rad+1
+//
+// The statistics are "sum", "mean", "var" and "std".  The box is clipped to
+// the image, and the non-finite values are ignored.  All the sums come from
+// summed-area tables, so that the cost does not depend on the radius.
+//
+// INTIMG_COMPENSATED=1  use double-double tables (for very large images)
 
 #include <stdlib.h>
+#include <string.h>
 #include "iio.h"
+
+#include "xmalloc.c"
+#include "sat.c"
+#include "smapa.h"
+SMART_PARAMETER_SILENT(INTIMG_COMPENSATED,0)
+
+#include "pickopt.c"
 int main(int c, char *v[])
 {
+	int rad = atoi(pick_option(&c, &v, "r", "-1"));
+	char *stat = pick_option(&c, &v, "s", "mean");
+	if (c > 3) {
+		fprintf(stderr, "usage:\n\t%s [-r rad [-s stat]] [in [out]]\n",
+				*v);
+		return 1;
+	}
 	char *filename_in  = c > 1 ? v[1] : "-";
 	char *filename_out = c > 2 ? v[2] : "-";
+	int s = 0; // 0=sum 1=mean 2=var 3=std
+	if (false) ;
+	else if (!strcmp(stat, "sum" )) s = 0;
+	else if (!strcmp(stat, "mean")) s = 1;
+	else if (!strcmp(stat, "var" )) s = 2;
+	else if (!strcmp(stat, "std" )) s = 3;
+	else fail("intimg: unknown statistic \"%s\"", stat);
+
 	int w, h, pd;
-	double *x = iio_read_image_double_split(filename_in, &w, &h, &pd);
+	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
+	double *y = xmalloc(w * (long)h * pd * sizeof*y);
+	int flags = SAT_COUNTS | (s > 1 ? SAT_SQUARES : 0)
+		| (INTIMG_COMPENSATED() > 0 ? SAT_COMPENSATED : 0);
 	for (int l = 0; l < pd; l++)
-		compute_intimg_inplace(x + l*w*h, w, h);
-	iio_write_image_double_split(filename_out, x, w, h, pd);
+	{
+		struct sat t[1];
+		sat_init(t, x, w, h, pd, l, flags);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			double *o = y + (j*(long)w + i)*pd + l;
+			if (rad < 0) {
+				*o = sat_sum(t, 0, 0, i + 1, j + 1);
+				continue;
+			}
+			int i0 = i - rad, j0 = j - rad;
+			int i1 = i + rad + 1, j1 = j + rad + 1;
+			switch (s) {
+			case 0: *o = sat_sum(t, i0, j0, i1, j1);            break;
+			case 1: *o = sat_mean(t, i0, j0, i1, j1);           break;
+			case 2: *o = sat_variance(t, i0, j0, i1, j1);       break;
+			case 3: *o = sqrt(sat_variance(t, i0, j0, i1, j1)); break;
+			}
+		}
+		sat_free(t);
+	}
+	iio_write_image_double_vec(filename_out, y, w, h, pd);
+	free(x);
+	free(y);
 	return 0;
 }
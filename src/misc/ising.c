@@ -1,6 +1,11 @@
 // simplest ising model (with metropolis sampling)
+//
+// ising_metropolis     updates random sites, one after the other
+// ising_checkerboard   updates all the sites by parallel checkerboard sweeps
 
 #include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "random.c"
 
 static float local_field(float *s, float *J, float *H, int w, int h,
@@ -51,3 +56,192 @@ void ising_metropolis(float *s, float *J, float *H, int w, int h,
 		s[j*w+i] = U < P1bn ? 1 : -1;
 	}
 }
+
+
+// Checkerboard sampling.
+//
+// The sites of one color of the checkerboard only neighbor sites of the
+// other color, so that all of them are updated at once, in parallel, by the
+// same rule as above.  The spins of each color are packed into bits (one
+// plane of rows of 64-bit words per color), so that a sweep only writes on
+// the plane of its color while it reads the other one.  The uniform numbers
+// are a hash of a counter (the seed, the sweep and the site), so that the
+// result does not depend on the number of threads nor on their scheduling.
+// When the coupling is constant and there is no exterior field, the field
+// takes only the values J*(-4,-2,...,4), and the probabilities are
+// precomputed as thresholds for the 32-bit hashes.
+
+// 64-bit hash (the finalizer of splitmix64)
+static inline uint64_t ising_hash(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return x ^ (x >> 31);
+}
+
+// spins of a color: bit k of row j is the site (2k + (j+c)%2, j)
+struct ising_plane {
+	int nw;       // words per row
+	uint64_t *b;  // h rows of nw words
+};
+
+static inline int ising_bit(struct ising_plane *p, int i, int j)
+{
+	int k = i >> 1;
+	return (p->b[j*(long)p->nw + (k >> 6)] >> (k & 63)) & 1;
+}
+
+// sum of the spins of the neighbors of (i,j), in the plane of the other color
+static inline int ising_neighbors(struct ising_plane *p, int w, int h,
+		int i, int j)
+{
+	int r = 0;
+	if (i > 0)   r += 2 * ising_bit(p, i-1, j) - 1;
+	if (j > 0)   r += 2 * ising_bit(p, i, j-1) - 1;
+	if (i < w-1) r += 2 * ising_bit(p, i+1, j) - 1;
+	if (j < h-1) r += 2 * ising_bit(p, i, j+1) - 1;
+	return r;
+}
+
+// update the sites of color c, by the hashes of "key"
+static void ising_half_sweep(struct ising_plane p[2], int c,
+		float *J, float *H, int w, int h, double beta,
+		uint32_t *table, uint64_t key)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		uint64_t *row = p[c].b + j*(long)p[c].nw;
+		for (int q = 0; q < p[c].nw; q++)
+			row[q] = 0;
+		for (int i = (j + c) % 2; i < w; i += 2)
+		{
+			int n = ising_neighbors(p + 1 - c, w, h, i, j);
+			uint32_t u = ising_hash(key + j*(uint64_t)w + i) >> 32;
+			bool up;
+			if (table)
+				up = u < table[n + 4];
+			else {
+				long x = j*(long)w + i;
+				double bn = (H ? H[x] : 0) + n * (J ? J[x] : 1);
+				double P1bn = 1 / (1 + exp(-2 * beta * bn));
+				up = u < P1bn * 4294967296.0;
+			}
+			int k = i >> 1;
+			row[k >> 6] |= (uint64_t)up << (k & 63);
+		}
+	}
+}
+
+// s: image of signs (initialized, updated by this function)
+// J: coupling image (optional, 1 if not given)
+// H: exterior field (optional)
+// temperature: strictly positive
+// nsweeps: number of updates of each site
+// seed: of the hashes (the same seed gives the same result)
+void ising_checkerboard(float *s, float *J, float *H, int w, int h,
+		float temperature, int nsweeps, uint64_t seed)
+{
+	assert(temperature > 0);
+	double beta = 1 / temperature;
+
+	// pack the signs
+	struct ising_plane p[2];
+	for (int c = 0; c < 2; c++)
+	{
+		p[c].nw = ((w + 1) / 2 + 63) / 64;
+		p[c].b = malloc(h * (long)p[c].nw * sizeof*p[c].b);
+		for (long q = 0; q < h * (long)p[c].nw; q++)
+			p[c].b[q] = 0;
+	}
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		if (s[j*w+i] > 0)
+		{
+			struct ising_plane *pc = p + (i + j) % 2;
+			int k = i >> 1;
+			pc->b[j*(long)pc->nw + (k >> 6)] |= (uint64_t)1 << (k & 63);
+		}
+
+	// acceptance thresholds, when the field has only 9 possible values
+	bool constant = !H;
+	for (int i = 1; constant && J && i < w*h; i++)
+		constant = J[i] == J[0];
+	uint32_t table[9];
+	for (int n = -4; n <= 4; n++)
+	{
+		double bn = n * (J ? J[0] : 1);
+		double t = 4294967296.0 / (1 + exp(-2 * beta * bn));
+		table[n + 4] = t < 4294967295.0 ? t : 4294967295.0;
+	}
+
+	for (int k = 0; k < nsweeps; k++)
+	for (int c = 0; c < 2; c++)
+	{
+		uint64_t key = ising_hash(seed ^ ising_hash(2*k + c));
+		ising_half_sweep(p, c, J, H, w, h, beta,
+				constant ? table : NULL, key);
+	}
+
+	// unpack the signs
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		s[j*w+i] = 2 * ising_bit(p + (i + j) % 2, i, j) - 1;
+	free(p[0].b);
+	free(p[1].b);
+}
+
+#define MAIN_ISING
+
+#ifdef MAIN_ISING
+#include <stdio.h>
+#include "iio.h"
+#include "pickopt.c"
+int main(int c, char *v[])
+{
+	bool sequential = pick_option(&c, &v, "m", NULL);
+	char *filename_H = pick_option(&c, &v, "e", "");
+	float coupling = atof(pick_option(&c, &v, "j", "1"));
+	uint64_t seed = atoll(pick_option(&c, &v, "s", "0"));
+	if (c < 3 || c > 5)
+		return fprintf(stderr, "usage:\n\t%s [-m] [-e field] [-j J] "
+				"[-s seed] temp nsweeps [in [out]]\n", *v);
+	//                                 0           1    2       3   4
+	float temperature = atof(v[1]);
+	int nsweeps = atoi(v[2]);
+	char *filename_in  = c > 3 ? v[3] : "-";
+	char *filename_out = c > 4 ? v[4] : "-";
+
+	int w, h, pd;
+	float *s = iio_read_image_float_vec(filename_in, &w, &h, &pd);
+	float *x = malloc(w * h * sizeof*x);
+	for (int i = 0; i < w*h; i++)
+		x[i] = s[i*pd] > 0 ? 1 : -1;
+	float *J = malloc(w * h * sizeof*J);
+	for (int i = 0; i < w*h; i++)
+		J[i] = coupling;
+	float *H = NULL;
+	if (*filename_H) {
+		int ww, hh;
+		H = iio_read_image_float(filename_H, &ww, &hh);
+		if (ww != w || hh != h)
+			return fprintf(stderr, "ERROR: bad field size\n");
+	}
+
+	if (sequential) {
+		lcg_knuth_srand(seed);
+		ising_metropolis(x, J, H, w, h, temperature, nsweeps*(float)w*h);
+	} else
+		ising_checkerboard(x, J, H, w, h, temperature, nsweeps, seed);
+
+	iio_write_image_float(filename_out, x, w, h);
+	free(s);
+	free(x);
+	free(J);
+	free(H);
+	return 0;
+}
+#endif//MAIN_ISING
@@ -10,6 +10,7 @@
 #include "xmalloc.c"
 #include "random.c"
 #include "bilinear_interpolation.c"
+#include "fastlic.c"
 
 #define FORI(n) for(int i=0;i<(n);i++)
 #define FORJ(n) for(int j=0;j<(n);j++)
@@ -52,10 +53,17 @@ void line_integral_convolution(float *view, float *flow, int w, int h)
 
 #ifndef OMIT_MAIN
 #include "iio.h"
+#include "pickopt.c"
 int main(int c, char *v[])
 {
+	// -l length: fast LIC along streamlines of this length (in pixels)
+	// -r reuse: number of pixels of each streamline that reuse its samples
+	float len = atof(pick_option(&c, &v, "l", "0"));
+	float reuse = atof(pick_option(&c, &v, "r", "-1"));
+	int seed = atoi(pick_option(&c, &v, "s", "0"));
 	if (c != 3 && c != 2 && c != 1) {
-		fprintf(stderr, "usage:\n\t%s [flow [view]]\n", *v);
+		fprintf(stderr, "usage:\n\t%s [-l len [-r reuse] [-s seed]] "
+				"[flow [view]]\n", *v);
 				//          0  1     2
 		return EXIT_FAILURE;
 	}
@@ -67,7 +75,13 @@ int main(int c, char *v[])
 	if (pd != 2) fail("input is not a vector field");
 
 	float *view = xmalloc(w * h * sizeof*view);
-	line_integral_convolution(view, flow, w, h);
+	if (len > 0) {
+		if (reuse < 0) reuse = 4 * len;
+		int L = lrint(len / (2 * FASTLIC_STEP));
+		int m = lrint(reuse / (2 * FASTLIC_STEP));
+		fast_line_integral_convolution(view, flow, w, h, L, m, seed);
+	} else
+		line_integral_convolution(view, flow, w, h);
 	iio_write_image_float_vec(outfile, view, w, h, 1);
 
 	free(view);
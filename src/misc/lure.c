@@ -13,55 +13,41 @@ static int compare_struct_floatint(const void *aa, const void *bb)
 	return (a->f - b->f) - (a->f < b->f);
 }
 
-// vector length of a patch of given witdth
-static int winpatch_length(int pd, float W)
-{
-	int wi = W;
-	int wis = 2*wi+1;
-	int r = pd*wis*wis;
-	static bool firsttime = true;
-	if (firsttime) {
-		firsttime = false;
-		fprintf(stderr, "winpatch_length(%d, %g) = %d\n", pd, W, r);
-	}
-	return r;
-}
+#include "sat.c"
 
-#include "getpixel.c"
-
-// fill a patch at a given location
-static void getpatch(float *p, float *x, int w, int h, int pd,
-                                         int i, int j, float W)
+// d[k][p] = distance between the patches of size "W" of x and y[k] around the
+// pixel p (the euclidean norm of their difference, the images are extended by
+// zero), by a summed-area table of the squared differences of each frame
+static void wpatch_distances(float **d, float *x, float **y, int n,
+		int w, int h, int pd, float W)
 {
 	int rad = W;
-	int cx = 0;
-	for (int di = -rad; di <= rad; di++)
-	for (int dj = -rad; dj <= rad; dj++)
-	for (int l = 0; l < pd; l++)
-		p[cx++] = getsample_0(x, w, h, pd, i+di, j+dj, l);
-		//p[cx++] = x[(w*j+i)*pd+l];
-	assert(cx == winpatch_length(pd, W));
-}
-
-// distance between two patches
-static float patchdistance(float *p, float *q, int n)
-{
-	// TODO (maybe) : use a fancier distance?
-	float r = 0;
-	for (int i = 0; i < n; i++)
-		r = hypot(r, p[i] - q[i]);
-	return r;
-}
-
-// compute the distance between two patches of size "W"
-static float wpatch_distance(float *x, float *y, int w, int h, int pd,
-                                                 int i, int j, float W)
-{
-	int nW = winpatch_length(pd, W);
-	float px[nW], py[nW];
-	getpatch(px, x, w, h, pd, i, j, W);
-	getpatch(py, y, w, h, pd, i, j, W);
-	return patchdistance(px, py, nW);
+	float *e = xmalloc(w * h * sizeof*e);
+	for (int k = 0; k < n; k++)
+	{
+		for (int i = 0; i < w*h; i++)
+		{
+			e[i] = 0;
+			for (int l = 0; l < pd; l++)
+			{
+				float q = x[i*pd+l] - y[k][i*pd+l];
+				e[i] += q * q;
+			}
+		}
+		struct sat t[1];
+		sat_init(t, e, w, h, 1, 0, 0);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+		{
+			double s = sat_sum(t, i-rad, j-rad, i+rad+1, j+rad+1);
+			d[k][j*w+i] = sqrt(s > 0 ? s : 0);
+		}
+		sat_free(t);
+	}
+	free(e);
 }
 
 #define OMIT_BLUR_MAIN
@@ -98,6 +84,12 @@ void silly_lucky_region(float **y, float **x, int n, int w, int h, int pd,
 	//	for (int j = 0; j < w*h*pd; j++)
 	//		bx[i][j] = x[i][j];  // TODO: do the blur
 
+	// (the patch distances of all the pixels are computed beforehand)
+	float *dx[n];
+	for (int i = 0; i < n; i++)
+		dx[i] = xmalloc(w * h * sizeof*dx[0]);
+	wpatch_distances(dx, mx, bx, n, w, h, pd, W);
+
 	// 3. for each pixel location
 	fprintf(stderr, "processing lines...\n");
 	for (int j = 0; j < h; j++) {
@@ -111,7 +103,7 @@ void silly_lucky_region(float **y, float **x, int n, int w, int h, int pd,
 		for (int k = 0; k < n; k++)
 		{
 			v[k].i = k;
-			v[k].f = wpatch_distance(mx, bx[k], w, h, pd, i, j, W);
+			v[k].f = dx[k][j*w+i];
 		}
 
 	//      3.2. sort the vector of distances, with their frame indices
@@ -129,6 +121,8 @@ void silly_lucky_region(float **y, float **x, int n, int w, int h, int pd,
 	free(mx);
 	for (int i = 0; i < n; i++)
 		free(bx[i]);
+	for (int i = 0; i < n; i++)
+		free(dx[i]);
 }
 
 #include "iio.h"
@@ -0,0 +1 @@
+../nanreduce.c
\ No newline at end of file
@@ -13,6 +13,8 @@ struct ok_list {
 	int *p;		// gives the region that contains each point
 	int *plist;	// linked lists of points (by regions)
 	int *buf;	// buffer to return lists of points
+	int *ro;	// contiguous layout (or NULL): the points of region r
+	int *ri;	// are ri[ro[r]], ..., ri[ro[r+1]-1]
 
 	// optional geometrical data useful when the regions are
 	// the rectangles of a grid:
@@ -30,6 +32,8 @@ void ok_remove_point(struct ok_list *, int p); // the point p will never be retu
 int ok_which_region(struct ok_list *, int p); // returns the index of the region
 int ok_which_points(struct ok_list *, int r); // returns the number of points
 					      // (and fills buf)
+void ok_build(struct ok_list *, int *region, int np); // add all the points
+int *ok_region_points(struct ok_list *, int r, int *n); // contiguous points
 
 //#ifdef USE_IMAGE_STRUCTURES
 //#include "image3d.h"
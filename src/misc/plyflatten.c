@@ -1,28 +1,59 @@
 // take a series of ply files and produce a digital elevation map
+//
+// The vertices of the binary ply files are read in place from a mapping of
+// the file, at the stride given by the header (the properties "x", "y" and
+// "z" may be float or double, and there may be other properties).  Files
+// whose header is not understood are read as consecutive records of
+// PLY_RECORD_LENGTH bytes that start with the three floats x, y, z.
+//
+// The points are processed by chunks: their pixels are computed in
+// parallel, then they are bucketed by horizontal bands of the output, and
+// the bands are reduced in parallel (each band by a single thread, so that
+// there are no atomic operations and the result does not depend on the
+// number of threads).  The memory is thus bounded by the size of the output
+// and of a chunk, not by the number of points.
+//
+// The heights that fall on each pixel are reduced by their mean, minimum,
+// maximum, median or just counted.  The median keeps at most
+// PLYFLATTEN_MEDIAN_BUFFER heights per pixel: when the buffer is full, the
+// smallest and the largest heights are dropped (this is exact up to that
+// many points, and an approximation beyond).
+//
+// With the option "-u zone", the coordinates x, y of the points are a
+// longitude and a latitude (in degrees), that are converted to UTM (in
+// meters) by chunks, before being re-scaled to the pixels.
 
 
+#include <fcntl.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "xmalloc.c"
 #include "smapa.h"
+#define OMIT_MAIN_UTM
+#include "utm.c"
 SMART_PARAMETER(PLY_RECORD_LENGTH, 27)
+SMART_PARAMETER(PLYFLATTEN_MEDIAN_BUFFER, 16)
+SMART_PARAMETER(PLYFLATTEN_CHUNK, 1048576)
 
+#define PLYFLATTEN_BAND 16 // height of the bands of the output
 
-// fast forward "f" until "lin" is found
-static void eat_until_this_line(FILE *f, char *lin)
-{
-	char buf[FILENAME_MAX] = {0};
-	while (fgets(buf, FILENAME_MAX, f))
-		if (0 == strcmp(buf, lin))
-			return;
-}
+#define REDUCE_MEAN   0
+#define REDUCE_MIN    1
+#define REDUCE_MAX    2
+#define REDUCE_MEDIAN 3
+#define REDUCE_COUNT  4
 
-// re-scale a float between 0 and w
-static int rescale_float_to_int(float x, float min, float max, int w)
+
+// re-scale a coordinate between 0 and w
+static int rescale_float_to_int(double x, double min, double max, int w)
 {
 	int r = w * (x - min)/(max - min);
 	if (r < 0) r = 0;
@@ -30,86 +61,345 @@ static int rescale_float_to_int(float x, float min, float max, int w)
 	return r;
 }
 
-struct images {
-	float *min;
-	float *max;
-	float *cnt;
-	float *avg;
-	int w, h;
+// size of a scalar property of a ply file, or 0 if unknown
+static int ply_type_size(char *t)
+{
+	char *s1[] = {"char", "uchar", "int8", "uint8", NULL};
+	char *s2[] = {"short", "ushort", "int16", "uint16", NULL};
+	char *s4[] = {"int", "uint", "float", "int32", "uint32", "float32", NULL};
+	char *s8[] = {"double", "float64", NULL};
+	char **s[] = {s1, s2, s4, s8};
+	for (int k = 0; k < 4; k++)
+	for (char **p = s[k]; *p; p++)
+		if (0 == strcmp(*p, t))
+			return 1 << k;
+	return 0;
+}
+
+// layout of the vertices of a ply file
+struct ply_layout {
+	long offset;  // position of the first vertex
+	long n;       // number of vertices
+	int stride;   // bytes per vertex
+	int o[3];     // position of x, y, z within each vertex
+	int t[3];     // type of x, y, z (4 = float, 8 = double)
+};
+
+// read the header of a ply file, and fill the layout of its vertices
+// (returns false if the header is not that of a little-endian ply file whose
+// first element are the vertices, with scalar properties and float x, y, z)
+static bool parse_ply_header(struct ply_layout *l, FILE *f)
+{
+	char buf[FILENAME_MAX] = {0};
+	bool binary = false, vertex = false, good = false;
+	int nelem = 0;
+	for (int k = 0; k < 3; k++)
+		l->o[k] = l->t[k] = -1;
+	l->n = l->stride = 0;
+	if (!fgets(buf, FILENAME_MAX, f) || strcmp(buf, "ply\n"))
+		return false;
+	while (fgets(buf, FILENAME_MAX, f))
+	{
+		char a[FILENAME_MAX], b[FILENAME_MAX], c[FILENAME_MAX];
+		int m = sscanf(buf, "%s %s %s", a, b, c);
+		if (0 == strcmp(buf, "end_header\n")) {
+			l->offset = ftell(f);
+			return binary && good && l->stride > 0 &&
+				l->t[0] > 0 && l->t[1] > 0 && l->t[2] > 0;
+		}
+		if (m == 3 && 0 == strcmp(a, "format"))
+			binary = 0 == strcmp(b, "binary_little_endian");
+		if (m == 3 && 0 == strcmp(a, "element")) {
+			vertex = !nelem++ && 0 == strcmp(b, "vertex");
+			if (vertex) {
+				l->n = atol(c);
+				good = true;
+			}
+		}
+		if (m == 3 && 0 == strcmp(a, "property") && vertex) {
+			int s = ply_type_size(b);
+			if (!s) // (a list, or an unknown type)
+				vertex = good = false;
+			for (int k = 0; k < 3; k++)
+				if (c[0] == "xyz"[k] && !c[1]) {
+					l->o[k] = l->stride;
+					l->t[k] = 0 == strcmp(b, "float")
+						|| 0 == strcmp(b, "float32") ? 4 :
+						  0 == strcmp(b, "double")
+						|| 0 == strcmp(b, "float64") ? 8 : 0;
+				}
+			l->stride += s;
+		}
+	}
+	return false;
+}
+
+// the fallback layout: fixed-length records, starting with float x, y, z
+static bool parse_raw_header(struct ply_layout *l, FILE *f)
+{
+	char buf[FILENAME_MAX] = {0};
+	rewind(f);
+	while (fgets(buf, FILENAME_MAX, f))
+		if (0 == strcmp(buf, "end_header\n"))
+			break;
+	l->offset = ftell(f);
+	l->n = -1;
+	l->stride = PLY_RECORD_LENGTH();
+	for (int k = 0; k < 3; k++)
+	{
+		l->o[k] = 4 * k;
+		l->t[k] = 4;
+	}
+	return l->stride >= 12;
+}
+
+static double ply_scalar(char *p, int t)
+{
+	if (t == 4) { float x; memcpy(&x, p, 4); return x; }
+	double x; memcpy(&x, p, 8); return x;
+}
+
+// output image, and the state of the reduction at each pixel
+struct raster {
+	int w, h, reducer;
+	int m, s;    // size of each median buffer, and stride of the buffers
+	float *a;    // sum, minimum or maximum (or the buffers, for the median)
+	int *n;      // number of heights of each pixel (or in each buffer)
 };
 
-// update the output images with a new height
-static void add_height_to_images(struct images *x, int i, int j, float v)
+static void raster_init(struct raster *r, int w, int h, int reducer)
 {
-	int k = x->w * j + i;
-	x->min[k] = fmin(x->min[k], v);
-	x->max[k] = fmax(x->max[k], v);
-	x->avg[k] = (v + x->cnt[k] * x->avg[k]) / (1 + x->cnt[k]);
-	x->cnt[k] += 1;
+	r->w = w;
+	r->h = h;
+	r->reducer = reducer;
+	r->m = PLYFLATTEN_MEDIAN_BUFFER();
+	if (r->m < 2) r->m = 2;
+	r->s = reducer == REDUCE_MEDIAN ? r->m + 1 : 1;
+	r->a = xmalloc((size_t)w * h * r->s * sizeof*r->a);
+	r->n = xmalloc((size_t)w * h * sizeof*r->n);
+	for (long i = 0; i < (long)w * h; i++)
+	{
+		r->a[i * r->s] = 0;
+		r->n[i] = 0;
+	}
 }
 
-// open a ply file, and accumulata its points to the image
-static void add_ply_points_to_images(struct images *x,
-		float xmin, float xmax, float ymin, float ymax,
-		char *fname)
+// add the height z to the pixel i
+static void raster_add(struct raster *r, long i, float z)
+{
+	float *a = r->a + i * r->s;
+	int *n = r->n + i;
+	if (isnan(z))
+		return;
+	switch (r->reducer) {
+	case REDUCE_MEAN: *a += z; break;
+	case REDUCE_MIN: *a = *n ? fmin(*a, z) : z; break;
+	case REDUCE_MAX: *a = *n ? fmax(*a, z) : z; break;
+	case REDUCE_MEDIAN:
+		if (*n == r->m) { // drop the extremes of a full buffer
+			int imin = 0, imax = 0;
+			a[*n] = z;
+			for (int k = 1; k <= *n; k++)
+			{
+				if (a[k] < a[imin]) imin = k;
+				if (a[k] >= a[imax]) imax = k;
+			}
+			int hi = imin > imax ? imin : imax;
+			int lo = imin > imax ? imax : imin;
+			a[hi] = a[*n];
+			a[lo] = a[*n - 1];
+			*n -= 1;
+			return;
+		}
+		a[*n] = z;
+		break;
+	}
+	*n += 1;
+}
+
+static int compare_floats(const void *a, const void *b)
+{
+	const float *x = a, *y = b;
+	return (*x > *y) - (*x < *y);
+}
+
+// produce the output image y (NAN where there are no points)
+static void raster_finish(float *y, struct raster *r)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < (long)r->w * r->h; i++)
+	{
+		float *a = r->a + i * r->s;
+		int n = r->n[i];
+		if (r->reducer == REDUCE_COUNT)
+			y[i] = n;
+		else if (!n)
+			y[i] = NAN;
+		else if (r->reducer == REDUCE_MEAN)
+			y[i] = *a / n;
+		else if (r->reducer == REDUCE_MEDIAN) {
+			qsort(a, n, sizeof*a, compare_floats);
+			y[i] = n % 2 ? a[n/2] : (a[n/2-1] + a[n/2]) / 2;
+		} else
+			y[i] = *a;
+	}
+}
+
+static void raster_free(struct raster *r)
+{
+	free(r->a);
+	free(r->n);
+}
+
+// reduce n heights z[k] on the pixels p[k] (in their original order)
+static void raster_add_points(struct raster *r, int *p, float *z, int n,
+		int *idx, int *band)
+{
+	int nb = (r->h + PLYFLATTEN_BAND - 1) / PLYFLATTEN_BAND;
+	int start[nb + 1];
+	for (int b = 0; b <= nb; b++)
+		start[b] = 0;
+	for (int k = 0; k < n; k++)
+	{
+		band[k] = p[k] / r->w / PLYFLATTEN_BAND;
+		start[band[k] + 1] += 1;
+	}
+	for (int b = 0; b < nb; b++)
+		start[b+1] += start[b];
+	for (int k = 0; k < n; k++)
+		idx[start[band[k]]++] = k;
+	for (int b = nb; b > 0; b--)
+		start[b] = start[b-1];
+	start[0] = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = 0; b < nb; b++)
+		for (int c = start[b]; c < start[b+1]; c++)
+			raster_add(r, p[idx[c]], z[idx[c]]);
+}
+
+// open a ply file, and add its points to the raster
+// (if zone is not NULL, the points are converted to UTM of this zone)
+static void add_ply_points(struct raster *r,
+		double xmin, double xmax, double ymin, double ymax,
+		char *fname, int *zone)
 {
 	FILE *f = fopen(fname, "r");
 	if (!f) {
 		fprintf(stderr, "WARNING: can not open file \"%s\"\n", fname);
 		return;
 	}
+	struct ply_layout l[1];
+	if (!parse_ply_header(l, f) && !parse_raw_header(l, f)) {
+		fprintf(stderr, "WARNING: bad ply file \"%s\"\n", fname);
+		fclose(f);
+		return;
+	}
 
-	eat_until_this_line(f, "end_header\n");
+	// map the vertices
+	struct stat st;
+	if (fstat(fileno(f), &st) || st.st_size <= l->offset) {
+		fclose(f);
+		return;
+	}
+	long avail = (st.st_size - l->offset) / l->stride;
+	if (l->n < 0 || l->n > avail) {
+		if (l->n > avail)
+			fprintf(stderr, "WARNING: truncated ply file \"%s\"\n",
+					fname);
+		l->n = avail;
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	fclose(f);
+	if (map == MAP_FAILED || !l->n) {
+		if (map != MAP_FAILED) munmap(map, st.st_size);
+		return;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
 
-	size_t n = PLY_RECORD_LENGTH();
-	char cbuf[n];
-	float *fbuf = (void*)cbuf;
-	while (n == fread(cbuf, 1, n, f))
+	// process the vertices by chunks
+	int chunk = PLYFLATTEN_CHUNK();
+	if (chunk < 1) chunk = 1;
+	if (chunk > l->n) chunk = l->n;
+	int *p = xmalloc(chunk * sizeof*p);
+	float *z = xmalloc(chunk * sizeof*z);
+	int *idx = xmalloc(chunk * sizeof*idx);
+	int *band = xmalloc(chunk * sizeof*band);
+	double *x = xmalloc(2 * (size_t)chunk * sizeof*x), *y = x + chunk;
+	for (long k0 = 0; k0 < l->n; k0 += chunk)
 	{
-		int i = rescale_float_to_int(fbuf[0], xmin, xmax, x->w);
-		int j = rescale_float_to_int(fbuf[1], ymin, ymax, x->h);
-		//fprintf(stderr, "\t%8.8lf %8.8lf %8.8lf %d %d\n",
-		//		fbuf[0], fbuf[1], fbuf[2], i, j);
-		add_height_to_images(x, i, j, fbuf[2]);
+		int n = l->n - k0 < chunk ? l->n - k0 : chunk;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int k = 0; k < n; k++)
+		{
+			char *v = map + l->offset + (k0 + k) * l->stride;
+			x[k] = ply_scalar(v + l->o[0], l->t[0]);
+			y[k] = ply_scalar(v + l->o[1], l->t[1]);
+			z[k] = ply_scalar(v + l->o[2], l->t[2]);
+		}
+		if (zone)
+			utm_from_lonlat_many(x, y, x, y, n, *zone);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int k = 0; k < n; k++)
+		{
+			int i = rescale_float_to_int(x[k], xmin, xmax, r->w);
+			int j = rescale_float_to_int(y[k], ymin, ymax, r->h);
+			p[k] = j * r->w + i;
+		}
+		raster_add_points(r, p, z, n, idx, band);
 	}
-
-	fclose(f);
+	free(p);
+	free(z);
+	free(idx);
+	free(band);
+	free(x);
+	munmap(map, st.st_size);
 }
 
 
 #include "iio.h"
+#include "pickopt.c"
 int main(int c, char *v[])
 {
 	// process input arguments
+	char *reducer_name = pick_option(&c, &v, "r", "mean");
+	char *utm_zone = pick_option(&c, &v, "u", "");
 	if (c != 8) {
 		fprintf(stderr, "usage:\n\t"
-				"ls files|%s x0 xf y0 yf w h out.tiff\n", *v);
-		//                         0 1  2  3  4  5 6 7
+			"ls files|%s [-r mean|min|max|median|count] [-u zone] "
+			"x0 xf y0 yf w h out.tiff\n", *v);
+		//         0 1  2  3  4  5 6 7
 		return 1;
 	}
-	float xmin = atof(v[1]);
-	float xmax = atof(v[2]);
-	float ymin = atof(v[3]);
-	float ymax = atof(v[4]);
+	double xmin = atof(v[1]);
+	double xmax = atof(v[2]);
+	double ymin = atof(v[3]);
+	double ymax = atof(v[4]);
 	int w = atoi(v[5]);
 	int h = atoi(v[6]);
 	char *filename_out = v[7];
+	char *names[] = {"mean", "min", "max", "median", "count"};
+	int reducer = -1;
+	for (int k = 0; k < 5; k++)
+		if (0 == strcmp(reducer_name, names[k]))
+			reducer = k;
+	if (reducer < 0)
+		fail("unrecognized reducer \"%s\"", reducer_name);
+	if (w < 1 || h < 1)
+		fail("bad output size %d x %d", w, h);
+	int zone = atoi(utm_zone);
 
-	// allocate and initialize output images
-	struct images x;
-	x.w = w;
-	x.h = h;
-	x.min = xmalloc(w*h*sizeof(float));
-	x.max = xmalloc(w*h*sizeof(float));
-	x.cnt = xmalloc(w*h*sizeof(float));
-	x.avg = xmalloc(w*h*sizeof(float));
-	for (int i = 0; i < w*h; i++)
-	{
-		x.min[i] = INFINITY;
-		x.max[i] = -INFINITY;
-		x.cnt[i] = 0;
-		x.avg[i] = 0;
-	}
+	// allocate and initialize the accumulators
+	struct raster r[1];
+	raster_init(r, w, h, reducer);
 
 	// process each filename from stdin
 	char fname[FILENAME_MAX];
@@ -117,25 +407,17 @@ int main(int c, char *v[])
 	{
 		strtok(fname, "\n");
 		printf("FILENAME: \"%s\"\n", fname);
-		add_ply_points_to_images(&x, xmin, xmax, ymin, ymax, fname);
+		add_ply_points(r, xmin, xmax, ymin, ymax, fname,
+				*utm_zone ? &zone : NULL);
 	}
 
-	// set unknown values to NAN
-	for (int i = 0; i < w*h; i++)
-		if (!x.cnt[i])
-			x.avg[i] = NAN;
-
-	// save output image
-	iio_write_image_float(filename_out, x.avg, w, h);
-	//iio_write_image_float("/tmp/flattened_min.tiff", x.min, w, h);
-	//iio_write_image_float("/tmp/flattened_max.tiff", x.max, w, h);
-	//iio_write_image_float("/tmp/flattened_cnt.tiff", x.cnt, w, h);
-	//iio_write_image_float("/tmp/flattened_avg.tiff", x.avg, w, h);
+	// reduce the heights of each pixel, and save the output image
+	float *out = xmalloc((size_t)w * h * sizeof*out);
+	raster_finish(out, r);
+	iio_write_image_float(filename_out, out, w, h);
 
 	// cleanup and exit
-	free(x.min);
-	free(x.max);
-	free(x.cnt);
-	free(x.avg);
+	raster_free(r);
+	free(out);
 	return 0;
 }
@@ -1,7 +1,13 @@
 // compute the reprojection error
 // paired with "minimize.c", this is a poor man's bundle adjustment
+//
+// with option -a, refine the cameras by an actual bundle adjustment (see
+// below), and print them instead of the error
 
 #include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 // compute the vector product of two vectors
 static void vector_product(double axb[3], double a[3], double b[3])
@@ -80,52 +86,72 @@ static void matrix_product(double ab[9], double a[9], double b[9])
 	}
 }
 
-// find the straight line determined by a pixel on the given camera
-static void from_pixel_to_line(double l[6], double P[12], double ij[2])
+// the parts of a projection matrix that are needed to back-project pixels
+struct pmba_camera {
+	double iR[9];      // inverse of the left 3x3 block
+	double center[3];  // camera center
+};
+
+static void decompose_cameras(struct pmba_camera *q, int n, double *P)
 {
-	// 1. decompose projection matrix P into rotation and translation parts
-	//
-	// 0 1 2 3
-	// 4 5 6 7
-	// 8 9 10 11
-	double R[9] = {P[0], P[1], P[2], P[4], P[5], P[6], P[8], P[9], P[10]};
-	double d[3] = {-P[3], -P[7], -P[11]};
+	for (int i = 0; i < n; i++)
+	{
+		// 1. decompose projection matrix P into rotation and translation
+		//
+		// 0 1 2 3
+		// 4 5 6 7
+		// 8 9 10 11
+		double *Pi = P + 12*i;
+		double R[9] = {Pi[0], Pi[1], Pi[2], Pi[4], Pi[5], Pi[6],
+			Pi[8], Pi[9], Pi[10]};
+		double d[3] = {-Pi[3], -Pi[7], -Pi[11]};
 
-	// 2. set-up output location
+		// 2. compute camera center
+		matrix_inversion(q[i].iR, R);
+		matrix_times_vector(q[i].center, q[i].iR, d);
+	}
+}
+
+// find the straight line determined by a pixel on the given camera
+static void from_pixel_to_line(double l[6], struct pmba_camera *q, double ij[2])
+{
+	// set-up output location
 	double *center = l;
 	double *direction = l + 3;
 
-	// 3. compute camera center
-	double iR[9];
-	matrix_inversion(iR, R);
-	matrix_times_vector(center, iR, d);
-
-	// 4. compute line of sight of this pixel
+	// compute line of sight of this pixel
 	double ij1[3] = {ij[0], ij[1], 1};
-	matrix_times_vector(direction, iR, ij1);
+	for (int k = 0; k < 3; k++)
+		center[k] = q->center[k];
+	matrix_times_vector(direction, q->iR, ij1);
 
 	//fprintf(stderr, "FPTL(%g %g) = %g %g %g  %g %g %g\n",
 	//		ij[0], ij[1], l[0], l[1], l[2], l[3], l[4], l[5]);
 }
 
+// (the cameras are decomposed once, and the correspondences are done in
+// parallel)
 static double compute_reprojection_error(int n, double *P, int nc, double *c)
 {
+	struct pmba_camera q[n];
+	decompose_cameras(q, n, P);
 	long double r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:r)
+#endif
 	for (int k = 0; k < nc; k++) // for each correspondence
 	for (int j = 0; j < n; j++)
 	for (int i = 0; i < j; i++)  // for each camera pair (i<j)
 	{
-		double *ck = c + 2*n*k; // numbers of the k-th correspondence
+		double *ck = c + 2*n*(long)k; // numbers of the k-th correspondence
 		double *ki = ck + 2*i;  // i-th point of the k-th correspondence
 		double *kj = ck + 2*j;  // j-th point of the k-th correspondence
-		double *Pi = P + 12*i;  // i-th projection matrix
-		double *Pj = P + 12*j;  // j-th projection matrix
 		if (!isfinite(ki[0] + ki[1] + kj[0] + kj[1]))
 			continue;
 		//fprintf(stderr, "ki=(%g %g) kj=(%g %g)\n", ki[0], ki[1], kj[0], kj[1]);
-		double lin_ki[9], lin_kj[9];
-		from_pixel_to_line(lin_ki, Pi, ki);
-		from_pixel_to_line(lin_kj, Pj, kj);
+		double lin_ki[6], lin_kj[6];
+		from_pixel_to_line(lin_ki, q + i, ki);
+		from_pixel_to_line(lin_kj, q + j, kj);
 		double e = distance_between_two_straight_lines(lin_ki, lin_kj);
 		//fprintf(stderr, "e[%d][%d,%d] = %g\n", k, i, j, e);
 		if (isfinite(e))
@@ -135,8 +161,435 @@ static double compute_reprojection_error(int n, double *P, int nc, double *c)
 }
 
 
-#include <stdio.h>
-#include <stdbool.h>
+// BUNDLE ADJUSTMENT (option -a)
+//
+// The cameras and the 3D points are refined by Levenberg-Marquardt on the
+// reprojection errors, with analytic derivatives.  The unknowns are the 12
+// entries of each camera except the first one (which is kept fixed, to
+// remove most of the projective ambiguity; the rest is taken by the
+// damping), and the 3 coordinates of each point, initialized by the
+// triangulation of the correspondences.  The points are eliminated from the
+// normal equations (Schur complement), so that each step solves a dense
+// system of size 12(n-1) by Cholesky.  The residuals, the blocks of the
+// normal equations and the reduced system are computed in parallel, by
+// points or by cameras (each thread filling its own rows), from the lists of
+// observations of each point and of each camera.  The Jacobians are not
+// stored, but recomputed from the observations when needed.
+
+#include "xmalloc.c"
+
+struct pmba_problem {
+	int n, np, no;  // number of cameras, points and observations
+	double *P;      // cameras (n x 12)
+	double *X;      // points (np x 3)
+	int *ocam;      // camera of each observation
+	int *opnt;      // point of each observation
+	double *oxy;    // observed pixel (no x 2)
+	int *pstart;    // observations of the point p: pstart[p].. pstart[p+1]-1
+	int *cstart;    // observations of the camera a: cobs[cstart[a]..]
+	int *cobs;
+};
+
+// residual of an observation, and its derivatives with respect to the 12
+// entries of the camera and the 3 coordinates of the point
+// (returns false when the point is on the focal plane of the camera)
+static bool pmba_observation(double r[2], double Jc[2][12], double Jx[2][3],
+		double P[12], double X[3], double xy[2])
+{
+	double Xh[4] = {X[0], X[1], X[2], 1};
+	double u = 0, v = 0, w = 0;
+	for (int k = 0; k < 4; k++)
+	{
+		u += P[k] * Xh[k];
+		v += P[4+k] * Xh[k];
+		w += P[8+k] * Xh[k];
+	}
+	if (!isnormal(w))
+		return false;
+	double x = u / w, y = v / w;
+	r[0] = x - xy[0];
+	r[1] = y - xy[1];
+	if (Jc)
+		for (int k = 0; k < 4; k++)
+		{
+			Jc[0][k] = Xh[k] / w;
+			Jc[0][4+k] = 0;
+			Jc[0][8+k] = -x * Xh[k] / w;
+			Jc[1][k] = 0;
+			Jc[1][4+k] = Xh[k] / w;
+			Jc[1][8+k] = -y * Xh[k] / w;
+		}
+	if (Jx)
+		for (int k = 0; k < 3; k++)
+		{
+			Jx[0][k] = (P[k] - x * P[8+k]) / w;
+			Jx[1][k] = (P[4+k] - y * P[8+k]) / w;
+		}
+	return true;
+}
+
+// W = Jc' * Jx  (the 12x3 block of an observation in the normal equations)
+static bool pmba_wblock(double W[12][3], struct pmba_problem *e,
+		double *P, double *X, int o)
+{
+	double r[2], Jc[2][12], Jx[2][3];
+	int a = e->ocam[o], p = e->opnt[o];
+	if (!pmba_observation(r, Jc, Jx, P + 12*a, X + 3*p, e->oxy + 2*o))
+		return false;
+	for (int i = 0; i < 12; i++)
+	for (int k = 0; k < 3; k++)
+		W[i][k] = Jc[0][i] * Jx[0][k] + Jc[1][i] * Jx[1][k];
+	return true;
+}
+
+// sum of the squared reprojection errors
+static double pmba_cost(struct pmba_problem *e, double *P, double *X)
+{
+	long double s = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:s)
+#endif
+	for (int o = 0; o < e->no; o++)
+	{
+		double r[2];
+		int a = e->ocam[o], p = e->opnt[o];
+		if (pmba_observation(r, NULL, NULL, P+12*a, X+3*p, e->oxy+2*o))
+			s += r[0] * r[0] + r[1] * r[1];
+	}
+	return s;
+}
+
+// blocks of the undamped normal equations: U (12x12) and gc for each camera,
+// V (3x3) and gp for each point
+static void pmba_normal_blocks(double *U, double *gc, double *V, double *gp,
+		struct pmba_problem *e)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int a = 0; a < e->n; a++)
+	{
+		double *Ua = U + 144*a, *ga = gc + 12*a;
+		for (int i = 0; i < 144; i++) Ua[i] = 0;
+		for (int i = 0; i <  12; i++) ga[i] = 0;
+		for (int t = e->cstart[a]; t < e->cstart[a+1]; t++)
+		{
+			int o = e->cobs[t], p = e->opnt[o];
+			double r[2], J[2][12];
+			if (!pmba_observation(r, J, NULL, e->P + 12*a,
+						e->X + 3*p, e->oxy + 2*o))
+				continue;
+			for (int i = 0; i < 12; i++)
+			{
+				ga[i] += J[0][i] * r[0] + J[1][i] * r[1];
+				for (int j = 0; j < 12; j++)
+					Ua[12*i+j] += J[0][i]*J[0][j] + J[1][i]*J[1][j];
+			}
+		}
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < e->np; p++)
+	{
+		double *Vp = V + 9*p, *g = gp + 3*p;
+		for (int i = 0; i < 9; i++) Vp[i] = 0;
+		for (int i = 0; i < 3; i++) g[i] = 0;
+		for (int o = e->pstart[p]; o < e->pstart[p+1]; o++)
+		{
+			double r[2], J[2][3];
+			int a = e->ocam[o];
+			if (!pmba_observation(r, NULL, J, e->P + 12*a,
+						e->X + 3*p, e->oxy + 2*o))
+				continue;
+			for (int i = 0; i < 3; i++)
+			{
+				g[i] += J[0][i] * r[0] + J[1][i] * r[1];
+				for (int j = 0; j < 3; j++)
+					Vp[3*i+j] += J[0][i]*J[0][j] + J[1][i]*J[1][j];
+			}
+		}
+	}
+}
+
+// Cholesky factorization A = L * L' of a symmetric positive definite m x m
+// matrix, in place (only the lower triangle is used and written)
+static bool cholesky_inplace(double *A, int m)
+{
+	for (int j = 0; j < m; j++)
+	{
+		double s = A[j*(long)m+j];
+		for (int k = 0; k < j; k++)
+			s -= A[j*(long)m+k] * A[j*(long)m+k];
+		if (!(s > 0))
+			return false;
+		double d = A[j*(long)m+j] = sqrt(s);
+#ifdef _OPENMP
+#pragma omp parallel for if(m - j > 64)
+#endif
+		for (int i = j + 1; i < m; i++)
+		{
+			double *Ai = A + i*(long)m, *Aj = A + j*(long)m;
+			double t = Ai[j];
+			for (int k = 0; k < j; k++)
+				t -= Ai[k] * Aj[k];
+			Ai[j] = t / d;
+		}
+	}
+	return true;
+}
+
+// solve L * L' * x = b, in place
+static void cholesky_solve(double *b, double *L, int m)
+{
+	for (int i = 0; i < m; i++)
+	{
+		for (int k = 0; k < i; k++)
+			b[i] -= L[i*(long)m+k] * b[k];
+		b[i] /= L[i*(long)m+i];
+	}
+	for (int i = m - 1; i >= 0; i--)
+	{
+		for (int k = i + 1; k < m; k++)
+			b[i] -= L[k*(long)m+i] * b[k];
+		b[i] /= L[i*(long)m+i];
+	}
+}
+
+// one damped step (dc for the cameras, dp for the points), from the blocks of
+// the normal equations; S (m x m), b (m) and Vi (np x 9) are workspace
+static bool pmba_step(double *dc, double *dp, struct pmba_problem *e,
+		double *U, double *gc, double *V, double *gp,
+		double *S, double *b, double *Vi, double lambda)
+{
+	int n = e->n, m = 12 * (n - 1);
+
+	// inverses of the damped blocks of the points
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < e->np; p++)
+	{
+		double D[9];
+		for (int i = 0; i < 9; i++)
+			D[i] = V[9*p+i] * (i % 4 ? 1 : 1 + lambda);
+		if (!isnormal(matrix_inversion(Vi + 9*p, D)))
+			for (int i = 0; i < 9; i++)
+				Vi[9*p+i] = 0; // (the point is not moved)
+	}
+
+	// reduced system S * dc = b, by rows of cameras
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int a = 1; a < n; a++)
+	{
+		int A = 12 * (a - 1);
+		for (int i = 0; i < 12; i++)
+		{
+			for (int j = 0; j < m; j++)
+				S[(A+i)*(long)m+j] = 0;
+			for (int j = 0; j < 12; j++)
+				S[(A+i)*(long)m+A+j] = U[144*a+12*i+j]
+					* (i == j ? 1 + lambda : 1);
+			if (!(S[(A+i)*(long)m+A+i] > 0)) // unobserved
+				S[(A+i)*(long)m+A+i] = 1;
+			b[A+i] = -gc[12*a+i];
+		}
+		for (int t = e->cstart[a]; t < e->cstart[a+1]; t++)
+		{
+			int o = e->cobs[t], p = e->opnt[o];
+			double W[12][3], Y[12][3];
+			if (!pmba_wblock(W, e, e->P, e->X, o))
+				continue;
+			for (int i = 0; i < 12; i++)
+			for (int k = 0; k < 3; k++)
+				Y[i][k] = W[i][0] * Vi[9*p+k] + W[i][1] * Vi[9*p+3+k]
+					+ W[i][2] * Vi[9*p+6+k];
+			for (int i = 0; i < 12; i++)
+				b[A+i] += Y[i][0] * gp[3*p] + Y[i][1] * gp[3*p+1]
+					+ Y[i][2] * gp[3*p+2];
+			for (int q = e->pstart[p]; q < e->pstart[p+1]; q++)
+			{
+				int B = 12 * (e->ocam[q] - 1);
+				double Z[12][3];
+				if (B < 0 || !pmba_wblock(Z, e, e->P, e->X, q))
+					continue;
+				for (int i = 0; i < 12; i++)
+				for (int j = 0; j < 12; j++)
+					S[(A+i)*(long)m+B+j] -= Y[i][0] * Z[j][0]
+						+ Y[i][1] * Z[j][1] + Y[i][2] * Z[j][2];
+			}
+		}
+	}
+	if (!cholesky_inplace(S, m))
+		return false;
+	cholesky_solve(b, S, m);
+	for (int i = 0; i < 12; i++)
+		dc[i] = 0;
+	for (int i = 0; i < m; i++)
+		dc[12+i] = b[i];
+
+	// back-substitution of the points
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int p = 0; p < e->np; p++)
+	{
+		double g[3] = {-gp[3*p], -gp[3*p+1], -gp[3*p+2]};
+		for (int o = e->pstart[p]; o < e->pstart[p+1]; o++)
+		{
+			double W[12][3], *d = dc + 12 * e->ocam[o];
+			if (e->ocam[o] && pmba_wblock(W, e, e->P, e->X, o))
+				for (int i = 0; i < 12; i++)
+				for (int k = 0; k < 3; k++)
+					g[k] -= W[i][k] * d[i];
+		}
+		matrix_times_vector(dp + 3*p, Vi + 9*p, g);
+	}
+	return true;
+}
+
+// refine the cameras and the points of the problem, returns the final cost
+static double pmba_adjust(struct pmba_problem *e, int niter)
+{
+	int n = e->n, np = e->np, m = 12 * (n - 1);
+	double *U  = xmalloc(144 * n * sizeof*U);
+	double *gc = xmalloc(12 * n * sizeof*gc);
+	double *V  = xmalloc(9 * (long)np * sizeof*V);
+	double *Vi = xmalloc(9 * (long)np * sizeof*Vi);
+	double *gp = xmalloc(3 * (long)np * sizeof*gp);
+	double *S  = xmalloc(m * (long)m * sizeof*S);
+	double *b  = xmalloc(m * sizeof*b);
+	double *dc = xmalloc(12 * n * sizeof*dc);
+	double *dp = xmalloc(3 * (long)np * sizeof*dp);
+	double *P1 = xmalloc(12 * n * sizeof*P1);
+	double *X1 = xmalloc(3 * (long)np * sizeof*X1);
+
+	double lambda = 1e-3, cost = pmba_cost(e, e->P, e->X);
+	fprintf(stderr, "pmba: %d cameras, %d points, %d observations, "
+			"rms error %g\n", n, np, e->no, sqrt(cost / e->no));
+	for (int it = 0; it < niter; it++)
+	{
+		pmba_normal_blocks(U, gc, V, gp, e);
+		double new_cost = INFINITY;
+		for (int t = 0; t < 20 && !(new_cost < cost); t++)
+		{
+			if (t) lambda *= 10;
+			if (!pmba_step(dc, dp, e, U, gc, V, gp, S, b, Vi, lambda))
+				continue;
+			for (int i = 0; i < 12 * n; i++)
+				P1[i] = e->P[i] + dc[i];
+			for (long i = 0; i < 3 * (long)np; i++)
+				X1[i] = e->X[i] + dp[i];
+			new_cost = pmba_cost(e, P1, X1);
+		}
+		if (!(new_cost < cost))
+			break;
+		memcpy(e->P, P1, 12 * n * sizeof*P1);
+		memcpy(e->X, X1, 3 * (long)np * sizeof*X1);
+		double decrease = (cost - new_cost) / cost;
+		cost = new_cost;
+		lambda /= 10;
+		fprintf(stderr, "pmba: iteration %d, rms error %g (lambda=%g)\n",
+				it, sqrt(cost / e->no), lambda);
+		if (decrease < 1e-12)
+			break;
+	}
+
+	free(X1); free(P1); free(dp); free(dc); free(b); free(S);
+	free(gp); free(Vi); free(V); free(gc); free(U);
+	return cost;
+}
+
+// point that is the closest to the given straight lines (least squares)
+static bool triangulate_lines(double X[3], double (*l)[6], int nl)
+{
+	double A[9] = {0}, b[3] = {0}, iA[9];
+	for (int k = 0; k < nl; k++)
+	{
+		double *c = l[k], *u = l[k] + 3, nu = vector_norm(u);
+		double M[9]; // projection onto the orthogonal of the line
+		for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			M[3*i+j] = (i == j) - u[i] * u[j] / (nu * nu);
+		double Mc[3];
+		matrix_times_vector(Mc, M, c);
+		for (int i = 0; i < 9; i++) A[i] += M[i];
+		for (int i = 0; i < 3; i++) b[i] += Mc[i];
+	}
+	if (!isnormal(matrix_inversion(iA, A)))
+		return false;
+	matrix_times_vector(X, iA, b);
+	return isfinite(X[0] + X[1] + X[2]);
+}
+
+// build the problem from the correspondences (the points seen by less than
+// two cameras, or that can not be triangulated, are discarded)
+static void pmba_setup(struct pmba_problem *e, int n, double *P,
+		int nc, double *c)
+{
+	struct pmba_camera q[n];
+	decompose_cameras(q, n, P);
+	e->n = n;
+	e->P = P;
+	e->X = xmalloc(3 * (long)nc * sizeof*e->X);
+	e->ocam = xmalloc(n * (long)nc * sizeof*e->ocam);
+	e->opnt = xmalloc(n * (long)nc * sizeof*e->opnt);
+	e->oxy = xmalloc(2 * n * (long)nc * sizeof*e->oxy);
+	e->pstart = xmalloc((nc + 1) * sizeof*e->pstart);
+	e->np = e->no = 0;
+	for (int k = 0; k < nc; k++)
+	{
+		double *ck = c + 2*n*(long)k, l[n][6];
+		int nl = 0;
+		for (int i = 0; i < n; i++)
+			if (isfinite(ck[2*i] + ck[2*i+1]))
+				from_pixel_to_line(l[nl++], q + i, ck + 2*i);
+		if (nl < 2 || !triangulate_lines(e->X + 3*e->np, l, nl))
+			continue;
+		e->pstart[e->np] = e->no;
+		for (int i = 0; i < n; i++)
+			if (isfinite(ck[2*i] + ck[2*i+1]))
+			{
+				e->ocam[e->no] = i;
+				e->opnt[e->no] = e->np;
+				e->oxy[2*e->no+0] = ck[2*i+0];
+				e->oxy[2*e->no+1] = ck[2*i+1];
+				e->no += 1;
+			}
+		e->np += 1;
+	}
+	e->pstart[e->np] = e->no;
+
+	// lists of observations of each camera
+	e->cstart = xmalloc((n + 1) * sizeof*e->cstart);
+	e->cobs = xmalloc((e->no + 1) * sizeof*e->cobs);
+	for (int a = 0; a <= n; a++)
+		e->cstart[a] = 0;
+	for (int o = 0; o < e->no; o++)
+		e->cstart[e->ocam[o] + 1] += 1;
+	for (int a = 0; a < n; a++)
+		e->cstart[a + 1] += e->cstart[a];
+	int fill[n];
+	for (int a = 0; a < n; a++)
+		fill[a] = e->cstart[a];
+	for (int o = 0; o < e->no; o++)
+		e->cobs[fill[e->ocam[o]]++] = o;
+}
+
+static void pmba_free(struct pmba_problem *e)
+{
+	free(e->cobs);
+	free(e->cstart);
+	free(e->pstart);
+	free(e->oxy);
+	free(e->opnt);
+	free(e->ocam);
+	free(e->X);
+}
+
+
 #include "xfopen.c"
 #include "parsenumbers.c"
 #include "pickopt.c"
@@ -146,11 +599,13 @@ int main(int c, char *v[])
 	// check and process input arguments
 	bool do_normalize = pick_option(&c, &v, "n", 0);
 	bool do_root = pick_option(&c, &v, "r", 0);
+	bool do_adjust = pick_option(&c, &v, "a", 0);
+	int niter = atoi(pick_option(&c, &v, "i", "50"));
 	double units = atof(pick_option(&c, &v, "u", "1"));
 	if (c < 26) {
 falla:
-		fprintf(stderr, "usage:\n\t%s 2ncols.txt P1 ... P12n\n", *v);
-		//                          0 1          2      c-1
+		fprintf(stderr, "usage:\n\t%s [-a [-i niter]] 2ncols.txt P1 ... P12n\n", *v);
+		//                          0                 1          2      c-1
 		return c;
 	}
 	int n = (c - 2)/12;
@@ -176,6 +631,20 @@ falla:
 	//fprintf(stderr, "n_matches = %d\n", ncorr);
 	xfclose(f);
 
+	// refine the cameras, and print them
+	if (do_adjust) {
+		struct pmba_problem e[1];
+		pmba_setup(e, n, P[0], ncorr, corr);
+		if (e->np < 1)
+			return fprintf(stderr, "no points seen by two cameras\n");
+		pmba_adjust(e, niter);
+		for (int i = 0; i < 12 * n; i++)
+			printf("%.17g%c", e->P[i], i < 12*n - 1 ? ' ' : '\n');
+		pmba_free(e);
+		free(corr);
+		return 0;
+	}
+
 	// compute and print reprojection error
 	double err = compute_reprojection_error(n, P[0], ncorr, corr);
 	if (do_normalize) err /= ncorr;
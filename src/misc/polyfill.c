@@ -0,0 +1,269 @@
+#ifndef _POLYFILL_C
+#define _POLYFILL_C
+
+// scanline rasterization of sets of polygons
+//
+// The polygons are given by their vertices (they are closed implicitly, the
+// last vertex joins the first one).  The pixel (i,j) is at the point (i,j).
+// All the edges are put in an edge table, bucketed by bands of rows of the
+// image.  Each band is rasterized independently (in parallel) by the
+// classical scanline algorithm: an active edge table is kept sorted by the
+// abscissa of the crossings with the current row, and the runs of pixels
+// between consecutive crossings are inside or outside according to the
+// winding number and the fill rule.  The total cost is about one pass on the
+// image plus the number of crossings.
+//
+// Fill rules:
+//
+// 	POLYFILL_EVENODD  inside if crossed an odd number of times
+// 	POLYFILL_NONZERO  inside if the winding number is not zero
+// 	POLYFILL_UNION    inside any polygon (each one is re-oriented so that
+// 	                  the winding numbers inside are positive)
+//
+// With antialiasing, each row is sampled by several sub-scanlines, and the
+// coverage of each pixel (its footprint is [i-1/2,i+1/2]) is accumulated
+// exactly along the sub-scanlines.
+//
+// The bands can be rasterized one at a time, for tiled outputs.
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define POLYFILL_EVENODD 0
+#define POLYFILL_NONZERO 1
+#define POLYFILL_UNION   2
+
+#ifndef POLYFILL_BAND
+#define POLYFILL_BAND 64 // number of rows of the bands
+#endif
+
+struct polyfill_edge {
+	double y0, y1;  // vertical extent, y0 < y1
+	double x0, dx;  // abscissa at y0, and its increment for each unit of y
+	int dir;        // +1 or -1, orientation (for the winding numbers)
+};
+
+// edge table, with the edges of each band
+struct polyfill {
+	int w, h, nb;            // size of the image, number of bands
+	int rule, aa;            // fill rule, sub-scanlines (0 = no antialias)
+	struct polyfill_edge *e; // all the non-horizontal edges
+	int *be, *bo;            // edges of the band b: be[bo[b]..bo[b+1]-1]
+};
+
+// signed area of a polygon of n vertices p[2*k+0], p[2*k+1]
+static double polyfill_area(double *p, int n)
+{
+	double a = 0;
+	for (int k = 0; k < n; k++)
+	{
+		int l = (k + 1) % n;
+		a += p[2*k+0] * p[2*l+1] - p[2*l+0] * p[2*k+1];
+	}
+	return a / 2;
+}
+
+// sampling ordinate of the sub-scanline s of the row j
+static double polyfill_row(struct polyfill *t, int j, int s)
+{
+	return t->aa ? j - 0.5 + (s + 0.5) / t->aa : j;
+}
+
+// band of an ordinate (clamped to the bands of the image)
+static int polyfill_band(struct polyfill *t, double y)
+{
+	double b = floor((y + 0.5) / POLYFILL_BAND);
+	return b < 0 ? 0 : b >= t->nb ? t->nb - 1 : b;
+}
+
+// build the edge table of np polygons, the polygon k has n[k] vertices p[k]
+// (aa is the number of sub-scanlines of each row, or 0)
+static void polyfill_init(struct polyfill *t, int w, int h,
+		double **p, int *n, int np, int rule, int aa)
+{
+	t->w = w;
+	t->h = h;
+	t->nb = (h + POLYFILL_BAND - 1) / POLYFILL_BAND;
+	t->rule = rule;
+	t->aa = aa > 0 ? aa : 0;
+	long ne = 0;
+	for (int k = 0; k < np; k++)
+		ne += n[k];
+	t->e = xmalloc((ne + 1) * sizeof*t->e);
+	ne = 0;
+	for (int k = 0; k < np; k++)
+	{
+		int o = 1; // so that the left edges of the union go down
+		if (rule == POLYFILL_UNION && polyfill_area(p[k], n[k]) > 0)
+			o = -1;
+		for (int i = 0; i < n[k]; i++)
+		{
+			double *a = p[k] + 2*i, *b = p[k] + 2*((i + 1) % n[k]);
+			if (!(a[1] != b[1]) || !isfinite(a[0] + a[1] + b[0] + b[1]))
+				continue; // horizontal or degenerate
+			struct polyfill_edge *e = t->e + ne++;
+			e->dir = a[1] < b[1] ? o : -o;
+			if (a[1] > b[1]) { double *c = a; a = b; b = c; }
+			e->y0 = a[1];
+			e->y1 = b[1];
+			e->x0 = a[0];
+			e->dx = (b[0] - a[0]) / (b[1] - a[1]);
+		}
+	}
+
+	// bucket the edges by the bands that they cross
+	t->bo = xmalloc((t->nb + 1) * sizeof*t->bo);
+	for (int b = 0; b <= t->nb; b++)
+		t->bo[b] = 0;
+	for (long i = 0; i < ne; i++)
+		for (int b = polyfill_band(t, t->e[i].y0);
+				b <= polyfill_band(t, t->e[i].y1); b++)
+			t->bo[b+1] += 1;
+	for (int b = 0; b < t->nb; b++)
+		t->bo[b+1] += t->bo[b];
+	t->be = xmalloc((t->bo[t->nb] + 1) * sizeof*t->be);
+	int *c = xmalloc((t->nb + 1) * sizeof*c);
+	for (int b = 0; b < t->nb; b++)
+		c[b] = t->bo[b];
+	for (long i = 0; i < ne; i++)
+		for (int b = polyfill_band(t, t->e[i].y0);
+				b <= polyfill_band(t, t->e[i].y1); b++)
+			t->be[c[b]++] = i;
+	free(c);
+}
+
+static void polyfill_free(struct polyfill *t)
+{
+	free(t->e);
+	free(t->be);
+	free(t->bo);
+}
+
+static struct polyfill_edge *polyfill_sort_edges;
+#ifdef _OPENMP
+#pragma omp threadprivate(polyfill_sort_edges)
+#endif
+static int polyfill_compare_y0(const void *a, const void *b)
+{
+	double y = polyfill_sort_edges[*(int*)a].y0;
+	double z = polyfill_sort_edges[*(int*)b].y0;
+	return (y > z) - (y < z);
+}
+
+static bool polyfill_inside(struct polyfill *t, int wn)
+{
+	if (t->rule == POLYFILL_EVENODD) return wn & 1;
+	if (t->rule == POLYFILL_UNION) return wn > 0;
+	return wn != 0;
+}
+
+// add the coverage of the run [a,b) (weighted by q) to the row r
+static void polyfill_cover(float *r, int w, double a, double b, float q)
+{
+	if (a < -0.5) a = -0.5;
+	if (b > w - 0.5) b = w - 0.5;
+	if (!(a < b)) return;
+	int i = lrint(floor(a + 0.5)), k = lrint(floor(b + 0.5));
+	if (k > w - 1) k = w - 1;
+	if (i == k) {
+		r[i] += q * (b - a);
+		return;
+	}
+	r[i] += q * (i + 0.5 - a);
+	for (int l = i + 1; l < k; l++)
+		r[l] += q;
+	r[k] += q * (b - (k - 0.5));
+}
+
+// rasterize the band b into the rows y[0..], of width w: with antialiasing,
+// y is the coverage in [0,1], otherwise it is 1 inside and 0 outside
+static void polyfill_band_raster(float *y, struct polyfill *t, int b)
+{
+	int j0 = b * POLYFILL_BAND;
+	int j1 = j0 + POLYFILL_BAND < t->h ? j0 + POLYFILL_BAND : t->h;
+	int w = t->w;
+	for (long p = 0; p < (j1 - j0) * (long)w; p++)
+		y[p] = 0;
+
+	// edges of the band, sorted by their first ordinate
+	int n = t->bo[b+1] - t->bo[b];
+	int *s = xmalloc((2 * n + 1) * sizeof*s), *a = s + n, na = 0, ns = 0;
+	double *x = xmalloc((n + 1) * sizeof*x);
+	for (int i = 0; i < n; i++)
+		s[i] = t->be[t->bo[b] + i];
+	polyfill_sort_edges = t->e;
+	qsort(s, n, sizeof*s, polyfill_compare_y0);
+
+	int S = t->aa ? t->aa : 1;
+	for (int j = j0; j < j1; j++)
+	for (int q = 0; q < S; q++)
+	{
+		double r = polyfill_row(t, j, q);
+
+		// update the active edges: those with y0 <= r < y1
+		while (ns < n && t->e[s[ns]].y0 <= r)
+			a[na++] = s[ns++];
+		int m = 0;
+		for (int i = 0; i < na; i++)
+			if (t->e[a[i]].y1 > r)
+				a[m++] = a[i];
+		na = m;
+
+		// crossings, kept sorted (they are nearly sorted from the last
+		// row, so the insertion sort is about linear)
+		for (int i = 0; i < na; i++)
+		{
+			struct polyfill_edge *e = t->e + a[i];
+			x[i] = e->x0 + (r - e->y0) * e->dx;
+		}
+		for (int i = 1; i < na; i++)
+		{
+			double xi = x[i];
+			int ai = a[i], k = i;
+			for (; k > 0 && x[k-1] > xi; k--)
+			{
+				x[k] = x[k-1];
+				a[k] = a[k-1];
+			}
+			x[k] = xi;
+			a[k] = ai;
+		}
+
+		// runs between the crossings
+		float *yj = y + (j - j0) * (long)w;
+		int wn = 0;
+		for (int i = 0; i + 1 < na; i++)
+		{
+			wn += t->e[a[i]].dir;
+			if (!polyfill_inside(t, wn) || !(x[i] < x[i+1]))
+				continue;
+			double xa = x[i], xb = x[i+1];
+			if (t->aa)
+				polyfill_cover(yj, w, xa, xb, 1.0 / S);
+			else {
+				int ia = ceil(xa), ib = ceil(xb);
+				if (ia < 0) ia = 0;
+				if (ib > w) ib = w;
+				for (int l = ia; l < ib; l++)
+					yj[l] = 1;
+			}
+		}
+	}
+	free(x);
+	free(s);
+}
+
+// rasterize all the image
+static void polyfill_raster(float *y, struct polyfill *t)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = 0; b < t->nb; b++)
+		polyfill_band_raster(y + b * POLYFILL_BAND * (long)t->w, t, b);
+}
+
+#endif//_POLYFILL_C
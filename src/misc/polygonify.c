@@ -8,6 +8,7 @@
 SMART_PARAMETER(POLYGONIFY_a,50)
 SMART_PARAMETER(POLYGONIFY_A,30000)
 SMART_PARAMETER(POLYGONIFY_F,2)
+SMART_PARAMETER_SILENT(POLYGONIFY_C,0) // print only the corners
 
 
 static double transport_distance(double *a, double *b, int n)
@@ -72,11 +73,16 @@ int main(int c, char *v[])
 	int *out_all    = xmalloc(w*h*sizeof*out_size);
 	int *out_first  = xmalloc(w*h*sizeof*out_size);
 	int *out_idx    = xmalloc(w*h*sizeof*out_size);
-	int *bd_tmp     = xmalloc(3*4*w*h*sizeof*bd_tmp);
 
 	int r = ccproc(out_size, out_bdsize, out_all, out_first, out_idx,
 			y, w, h, floatnan_equality);
 
+	// boundaries of all the regions, traced in parallel
+	bool corners = POLYGONIFY_C() > 0;
+	int *bd_size = xmalloc(r*sizeof*bd_size);
+	long *bd_offset = xmalloc((r+1)*sizeof*bd_offset);
+	int *bd = bfollow_all(bd_size, bd_offset, out_idx, w, h, r, corners);
+
 	for (int i = 0; i < r; i++)
 	{
 		// reject region if it is too small or too big
@@ -114,23 +120,19 @@ int main(int c, char *v[])
 		if (POLYGONIFY_F() * d1 < d2)
 		{
 			fprintf(stderr, "\taccepted!\n");
-			// index of one interior pixel
-			int ridx = out_all[out_first[i]+0];
-			int rx = ridx % w;
-			int ry = ridx / w;
-			int bd_n = bfollow(bd_tmp, y, w, h, floatnan_equality,
-					rx, ry);
-			for (int k = 0; k < bd_n; k++)
+			int *bd_i = bd + 3*bd_offset[i];
+			for (int k = 0; k < bd_size[i]; k++)
 			{
-				float px = bd_tmp[3*k+0];
-				float py = bd_tmp[3*k+1];
-				switch(bd_tmp[3*k+2]) {
-				case 0: px += 0.5; break;
-				case 1: py -= 0.5; break;
-				case 2: px -= 0.5; break;
-				case 3: py += 0.5; break;
+				float p[2] = {bd_i[3*k+0], bd_i[3*k+1]};
+				if (corners)
+					bfollow_corner(p, bd_i + 3*k);
+				else switch(bd_i[3*k+2]) {
+				case 0: p[0] += 0.5; break;
+				case 1: p[1] -= 0.5; break;
+				case 2: p[0] -= 0.5; break;
+				case 3: p[1] += 0.5; break;
 				}
-				printf("%g %g ", px, py);
+				printf("%g %g ", p[0], p[1]);
 			}
 			printf("%g\n", d2/d1);
 		}
@@ -0,0 +1,125 @@
+#ifndef _RANDFIELD_C
+#define _RANDFIELD_C
+
+// spectral synthesis of gaussian random fields
+//
+// A field is white gaussian noise of deviation sigma convolved by a gaussian
+// kernel of deviation eta (periodic on the domain).  It is synthesized in the
+// frequency domain: the noise is drawn in parallel by the counter-based
+// generator of random.c directly into the buffer of a cached real FFT plan,
+// all the channels are transformed at once, the half spectra are multiplied
+// by the transfer function of the kernel, exp(-2 pi^2 eta^2 |xi|^2), and
+// transformed back.  The field only depends on the seed and the size.
+//
+// The sequences of fields are also correlated in time, by a periodic
+// gaussian of deviation tau along the frames (computed directly, since there
+// are usually few frames).
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c).
+
+#include <complex.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "random.c"
+#include "fftplans.c"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// f = field of size w x h with pd channels (interleaved), from the noise
+// of the given seed and stream
+static void random_field_stream(float *f, int w, int h, int pd,
+		float sigma, float eta, uint64_t seed, uint32_t stream)
+{
+	int W = 2 * (w/2 + 1);
+	struct fftplan *p = fftplan_get_many(FFTPLAN_REAL, w, h, pd);
+	float *a = p->in;
+	fftwf_complex *b = p->out;
+	random_zig_init();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int q = 0; q < pd * h; q++)
+	for (int i = 0; i < w; i++)
+	{
+		uint64_t k = q * (uint64_t)w + i;
+		struct random_words s = {seed, k, stream, 0, {0}, 4};
+		a[q*(long)W+i] = random_zig_normal(&s);
+	}
+	if (eta > 0) {
+		fftwf_execute(p->p);
+		int n = w/2 + 1;
+		double c = -2 * M_PI * M_PI * eta * eta, z = 1.0 / (w * h);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (int q = 0; q < pd * h; q++)
+		{
+			int j = q % h;
+			double y = (j < h - h/2 ? j : j - h) / (double)h;
+			for (int i = 0; i < n; i++)
+			{
+				double x = i / (double)w;
+				float g = z * exp(c * (x*x + y*y));
+				b[q*(long)n+i] *= g;
+			}
+		}
+		fftwf_execute(p->q);
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	for (int l = 0; l < pd; l++)
+		f[(j*(long)w+i)*pd+l] = sigma * a[(l*(long)h+j)*W+i];
+}
+
+static void random_field(float *f, int w, int h, int pd,
+		float sigma, float eta, uint64_t seed)
+{
+	random_field_stream(f, w, h, pd, sigma, eta, seed, 0);
+}
+
+// f = d frames of size w x h with pd channels, correlated in time by a
+// periodic gaussian of deviation tau (frame k is drawn from the stream k)
+static void random_fields(float *f, int w, int h, int d, int pd,
+		float sigma, float eta, float tau, uint64_t seed)
+{
+	long n = w * (long)h * pd;
+	for (int k = 0; k < d; k++)
+		random_field_stream(f + k*n, w, h, pd, sigma, eta, seed, k);
+	if (!(tau > 0) || d < 2)
+		return;
+
+	// normalized temporal taps t[k-k0], for the d offsets k of [k0,k1]
+	int k0 = -(d/2), k1 = d - 1 + k0;
+	float *t = xmalloc(d * sizeof*t);
+	double m = 0;
+	for (int k = k0; k <= k1; k++)
+		m += t[k-k0] = exp(-k*k / (2.0 * tau * tau));
+	for (int k = k0; k <= k1; k++)
+		t[k-k0] /= m;
+
+	float *g = xmalloc(d * n * sizeof*g);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long p = 0; p < n; p++)
+		for (int k = 0; k < d; k++)
+		{
+			double s = 0;
+			for (int o = k0; o <= k1; o++)
+				s += t[o-k0] * f[((k - o + d) % d)*n + p];
+			g[k*n+p] = s;
+		}
+	for (long p = 0; p < d * n; p++)
+		f[p] = g[p];
+	free(g);
+	free(t);
+}
+
+#endif//_RANDFIELD_C
@@ -2,35 +2,26 @@
 #include <stdlib.h>
 #include <math.h>
 
-#include "abstract_dsf.c"
+#include "ccproc.c"
 
-// connected components of positive pixels of the image rep
-static void connected_component_filter(int *rep, int w, int h, float *in, float intensity_threshold)
+// neighboring non-nan pixels whose difference is below the threshold
+static float global_intensity_threshold;
+static int close_numbers(float a, float b)
 {
-   adsf_begin(rep, w*h);
+   return fabs(a - b) < global_intensity_threshold;
+}
+
+// connected components of non-nan pixels of the image rep (-1 at the nans)
+// and their areas
+static void connected_component_filter(int *rep, int *area, int w, int h, float *in, float intensity_threshold)
+{
+   global_intensity_threshold = intensity_threshold;
+   cclabel(rep, area, NULL, NULL, in, w, h, close_numbers);
 
-   // remove from dsf pixels with NANs in input
+   // remove from the components the pixels with NANs in input
    for (int i = 0; i < w*h; i++)
       if (isnan(in[i]))
-	      rep[i] = -1;
-
-   for (int j = 0; j < h - 1; j++)
-      for (int i = 0; i < w - 1; i++)
-      {
-         int p0 = j*w + i;
-         int p1 = j*w + i+1;
-         int p2  = (j+1)*w + i;
-         if (rep[p0] >= 0 && rep[p1] >= 0 && 
-             fabs(in[p0] - in[p1]) < intensity_threshold)
-            adsf_union(rep, w*h, p0, p1); 
-         if (rep[p0] >= 0 && rep[p2] >= 0 && 
-             fabs(in[p0] - in[p2]) < intensity_threshold)
-            adsf_union(rep, w*h, p0, p2);
-
-      }
-   for (int i = 0; i < w*h; i++)
-      if (rep[i] >= 0)
-         rep[i] = adsf_find(rep, w*h, i);
+         rep[i] = -1;
 }
 
 
@@ -42,17 +33,10 @@ int remove_small_cc(int w, int h, float *in, float *out, int minarea, float inte
 	for (int i = 0; i < w*h; i++)
 		out[i] = in[i];
 
-	// identify the connected components of non nan values
+	// identify the connected components of non nan values, and their area
 	int *rep = malloc(w * h * sizeof*rep);
-	connected_component_filter(rep, w, h, in, intensity_threshold);
-
-	// measure the area of connected components
 	int *area = malloc(w * h * sizeof*area);
-	for (int i = 0; i < w*h; i++)
-		area[i] = 0;
-	for (int i = 0; i < w*h; i++)
-		if (rep[i] >= 0)
-			area[rep[i]] += 1;
+	connected_component_filter(rep, area, w, h, in, intensity_threshold);
 
 	// set to NAN the pixels whose connected component is too small
 	for (int i = 0; i < w*h; i++)
@@ -67,6 +51,7 @@ int remove_small_cc(int w, int h, float *in, float *out, int minarea, float inte
 
 	// cleanup and exit
 	free(rep);
+	free(area);
 	return remaining_cc;
 }
 
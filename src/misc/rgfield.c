@@ -15,40 +15,12 @@
 #include "smapa.h"
 SMART_PARAMETER_SILENT(RSEED,0)
 
-static double random_uniform(void)
-{
-	static bool firstrun = true;
-	if (firstrun) {
-		firstrun = false;
-		srand(RSEED());
-	}
-	return rand()/(RAND_MAX+1.0);
-}
-
-#ifndef M_PI
-#define M_PI		3.14159265358979323846	/* pi */
-#endif
-
-static double random_normal(void)
-{
-	double x1 = random_uniform();
-	double x2 = random_uniform();
-	double y1 = sqrt(-2*log(x1)) * cos(2*M_PI*x2);
-	//double y2 = sqrt(-2*log(x1)) * sin(2*M_PI*x2);
-	return y1;
-}
-
-#define OMIT_GBLUR_MAIN
-#include "gblur.c"
+#include "randfield.c"
 
+// the field is synthesized in the frequency domain (see randfield.c)
 void fill_random_field(float *f, int w, int h, float sigma, float eta)
 {
-	for (int i = 0; i < w * h * 2; i++)
-		f[i] = sigma*random_normal();
-
-	//void gblur(float *y, float *x, int w, int h, int pd, float s);
-	gblur(f, f, w, h, 2, eta);
-
+	random_field(f, w, h, 2, sigma, eta, RSEED());
 }
 
 
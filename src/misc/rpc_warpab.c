@@ -10,6 +10,11 @@
 #include "bicubic.c"
 #define DONT_USE_TEST_MAIN
 #include "rpc.c"
+#include "xmalloc.c"
+#include "approxmap.c"
+
+// tolerance of the approximation of the projections (in pixels, 0 = exact)
+SMART_PARAMETER_SILENT(RPC_WARPAB_TOL,0.01)
 
 
 #ifndef M_PI
@@ -18,6 +23,33 @@
 
 #define EARTH_RADIUS 6378000.0
 
+// projection of the output grid (at a constant height) into an image
+struct rpc_warpab_map {
+	struct rpc *r;
+	double lon0, lat0, lon_step, lat_step, h;
+};
+
+// instance of approxmap_f: position on the image of the output pixel (i,j)
+static void rpc_warpab_position(double out[2], void *ee, double i, double j)
+{
+	struct rpc_warpab_map *e = ee;
+	double lon = e->lon0 + i * e->lon_step;
+	double lat = e->lat0 + j * e->lat_step;
+	eval_rpci(out, e->r, lon, lat, e->h);
+}
+
+// out(i,j) = bicubic interpolation of x at the positions p(i,j)
+static void rpc_warpab_render(float *out, int w, int h, int pd,
+		float *x, int wx, int hx, float *p)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+		bicubic_interpolation_points(out + j*(long)w*pd, x, wx, hx, pd,
+				(float(*)[2])(p + 2*j*(long)w), w, getsample_1);
+}
+
 
 void rpc_warpab(float *outa, float *outb, int w, int h, int pd,
 		float *a, int wa, int ha, struct rpc *rpca,
@@ -70,18 +102,19 @@ void rpc_warpab(float *outa, float *outb, int w, int h, int pd,
 	}
 
 
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		double lon = c[0] + i * lon_step;
-		double lat = c[1] + j * lat_step;
-		double paij[3]; eval_rpci(paij, rpca, lon, lat, axyh[2]);
-		double pbij[3]; eval_rpci(pbij, rpcb, lon, lat, axyh[2]);
-		float *oaij = outa + (j*w + i) * pd;
-		float *obij = outb + (j*w + i) * pd;
-		bicubic_interpolation(oaij, a, wa, ha, pd, paij[0], paij[1]);
-		bicubic_interpolation(obij, b, wb, hb, pd, pbij[0], pbij[1]);
-	}
+	// positions of the output pixels on each image (the projections are
+	// approximated by tiles, see approxmap.c), and interpolation there
+	double tol = RPC_WARPAB_TOL();
+	struct rpc_warpab_map ma = {rpca, c[0],c[1], lon_step,lat_step, axyh[2]};
+	struct rpc_warpab_map mb = {rpcb, c[0],c[1], lon_step,lat_step, axyh[2]};
+	float *p = xmalloc(2 * w * (long)h * sizeof*p);
+	long n = approxmap_fill(p, w, h, rpc_warpab_position, &ma, tol);
+	rpc_warpab_render(outa, w, h, pd, a, wa, ha, p);
+	n += approxmap_fill(p, w, h, rpc_warpab_position, &mb, tol);
+	rpc_warpab_render(outb, w, h, pd, b, wb, hb, p);
+	fprintf(stderr, "%ld rpc evaluations for 2x%d pixels (tol = %g)\n",
+			n, w*h, tol);
+	free(p);
 }
 
 
@@ -90,7 +123,6 @@ void rpc_warpab(float *outa, float *outb, int w, int h, int pd,
 #ifdef MAIN_MNEHS
 #include <stdio.h>
 #include "iio.h"
-#include "xmalloc.c"
 
 int main_rpc_warpab(int c, char *v[])
 {
@@ -6,6 +6,27 @@
 
 #define DONT_USE_TEST_MAIN
 #include "rpc.c"
+#include "approxmap.c"
+
+// tolerance of the approximation of the correspondence (in pixels, 0 = exact)
+SMART_PARAMETER_SILENT(RPCFLOW_TOL,0.01)
+
+struct rpcflow_map {
+	struct rpc *a, *b;
+	int offset_a[2], offset_b[2];
+	double h;
+};
+
+// instance of approxmap_f: flow at the pixel (i,j) of the crop of a
+static void rpcflow_flow(double out[2], void *ee, double i, double j)
+{
+	struct rpcflow_map *e = ee;
+	double x[2] = {e->offset_a[0] + i, e->offset_a[1] + j}, r[2];
+	eval_rpc_pair(r, e->a, e->b, x[0], x[1], e->h);
+	double ox[2] = {r[0] - e->offset_b[0], r[1] - e->offset_b[1]};
+	out[0] = ox[0] + e->offset_a[0] - x[0];
+	out[1] = ox[1] + e->offset_a[1] - x[1];
+}
 
 int main(int c, char *v[])
 {
@@ -30,20 +51,9 @@ int main(int c, char *v[])
 	int w = size_a[0];
 	int h = size_a[1];
 	float (*f)[w][2] = xmalloc(w * h * 2 * sizeof(float));
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-	{
-		double x[2] = {offset_a[0] + i, offset_a[1] + j}, r[2];
-		eval_rpc_pair(r, rpca, rpcb, x[0], x[1], hbase);
-		double ox[2] = {r[0] - offset_b[0], r[1] - offset_b[1]};
-		f[j][i][0] = ox[0] + offset_a[0] - x[0];
-		f[j][i][1] = ox[1] + offset_a[1] - x[1];
-		//fprintf(stderr, "i=(%d %d) x=(%g %g) ox=(%g %g) f=(%g %g)\n",
-		//		i, j,
-		//		x[0], x[1],
-		//		ox[0], ox[1],
-		//		f[j][i][0], f[j][i][1]);
-	}
+	struct rpcflow_map e = {rpca, rpcb, {offset_a[0], offset_a[1]},
+		{offset_b[0], offset_b[1]}, hbase};
+	approxmap_fill(f[0][0], w, h, rpcflow_flow, &e, RPCFLOW_TOL());
 
 	iio_write_image_float_vec(filename_flow, f[0][0], w, h, 2);
 
@@ -4,38 +4,26 @@
 #include <string.h> // memcpy
 
 #include "random.c"
+#include "xmalloc.c"
+#include "sweepline.c"
 
-static void cast_horizontal_shadows(float *xx, int w, int h, float alpha)
+static void cast_horizontal_shadows(float *x, int w, int h, float alpha)
 {
-	// pointer fo easy access ( x[j][i] == xx[j*w+i] )
-	float (*x)[w] = (void*)xx;
-
 	// compute slope of the rays
 	float slope = tan(alpha * M_PI / 180);
 	//fprintf(stderr, "casting shadows with slope %g\n", slope);
 
+	// process each row independently (rightwards if alpha <= 0)
+	char *m = xmalloc(w*h*sizeof*m);
+	for (int i = 0; i < w*h; i++) m[i] = 1;
 	if (alpha <= 0)
-		// process each row independently
-		for (int j = 0; j < h; j++)
-		{
-			int l = 0;
-			for (int i = 0; i < w; i++)
-				if (x[j][i] < slope * (i - l) + x[j][l])
-					x[j][i] = NAN;
-				else
-					l = i;
-		}
+		sweep_shadows(m, x, w, h, 1, 0, -slope);
 	else
-		for (int j = 0; j < h; j++)
-		{
-			float slop = tan((180-alpha)*M_PI/180);
-			int l = w-1;
-			for (int i = w-1; i >= 0; i--)
-				if (x[j][i] < slop * (l - i) + x[j][l])
-					x[j][i] = NAN;
-				else
-					l = i;
-		}
+		sweep_shadows(m, x, w, h, -1, 0, -tan((180-alpha)*M_PI/180));
+	for (int i = 0; i < w*h; i++)
+		if (!m[i])
+			x[i] = NAN;
+	free(m);
 }
 
 static float random_speckle(void)
@@ -170,7 +158,6 @@ static void radar_sim_horizontal(
 #ifdef MAIN_SARSIM
 #include <stdio.h>
 #include <stdlib.h>
-#include "xmalloc.c"
 #include "iio.h"      // library for image input/output
 int main(int c, char *v[])
 {
@@ -0,0 +1 @@
+../sat.c
\ No newline at end of file
@@ -2,9 +2,13 @@ void fill_distance_fast(float *dist, int w, int h, float *points, int npoints);
 void fill_distance_slow(float *dist, int w, int h, float *points, int npoints);
 //void build_signed_distance(float *dist, float *mask, int w, int h);
 void build_signed_distance_t(float *dist, float *mask, int w, int h, float t);
+void build_signed_distance_fmm(float *dist, float *mask, int w, int h, float t);
+void build_signed_distance_speed(float *dist, float *mask, float *speed,
+		int w, int h, float t);
 
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <math.h>
 
@@ -55,6 +59,8 @@ struct dist_state {
 	e->hpos[e->hvox[j]] = j;\
 }while(0)
 
+// the distances of the front only grow
+#define HEAP_RADIX 1
 #include "abstract_heap.h"
 
 
@@ -323,7 +329,9 @@ void fill_distance_fast_truncated(
 
 
 #include "iio.h"
-void build_signed_distance_t(float *d, float *m, int w, int h, float T)
+// signed distance by fast marching: positive outside the mask (the nonzero
+// pixels), negative inside, and infinite beyond T (if it is not NAN)
+void build_signed_distance_fmm(float *d, float *m, int w, int h, float T)
 {
 	//iio_write_image_float("/tmp/mmmm.tiff", m, w, h);
 	float *t = xmalloc(    w * h * sizeof*t);  // temporary image
@@ -358,6 +366,154 @@ void build_signed_distance_t(float *d, float *m, int w, int h, float T)
 
 
 
+// the distances above T become infinite (if T is not NAN)
+static void truncate_signed_distance(float *d, long n, float T)
+{
+	if (!isnan(T))
+		for (long i = 0; i < n; i++)
+			if (fabs(d[i]) >= T)
+				d[i] = copysign(INFINITY, d[i]);
+}
+
+// exact signed distance (by the separable transform of eucdist.c, on the
+// mask and on its complement, in parallel)
+#define OMIT_EUCDIST_MAIN
+#include "eucdist.c"
+void build_signed_distance_t(float *d, float *m, int w, int h, float T)
+{
+	long n = w * (long)h;
+	float *t = xmalloc(n * sizeof*t);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < n; i++)
+	{
+		d[i] = m[i] != 0;
+		t[i] = m[i] == 0;
+	}
+	squared_euclidean_distance_to_nonzeros(d, w, h);
+	squared_euclidean_distance_to_nonzeros(t, w, h);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < n; i++)
+		d[i] = m[i] != 0 ? -sqrt(t[i]) : sqrt(d[i]);
+	truncate_signed_distance(d, n, T);
+	free(t);
+}
+
+// Distances for a non-constant speed: solution of the eikonal equation
+// |grad d| = 1/speed, with d=0 on the sources, by the fast iterative method
+// on tiles.  The tiles of one color of a checkerboard are updated in
+// parallel (they do not touch each other) by Gauss-Seidel sweeps of the
+// upwind (Godunov) scheme, until they converge.  The tiles that changed, and
+// their neighbors, are updated at the next round, until no tile changes.
+// The pixels of null or NAN speed are never crossed.
+
+#define FIM_TILE 32
+
+// upwind update of the pixel (i,j) (returns its new value)
+static float fim_update(float *u, float *f, int w, int h, int i, int j)
+{
+	long p = j * (long)w + i;
+	if (!(f[p] > 0)) return u[p];
+	double a = fmin(i > 0 ? u[p-1] : INFINITY, i < w-1 ? u[p+1] : INFINITY);
+	double b = fmin(j > 0 ? u[p-w] : INFINITY, j < h-1 ? u[p+w] : INFINITY);
+	double c = 1 / f[p], r;
+	if (fabs(a - b) >= c || !isfinite(a) || !isfinite(b))
+		r = fmin(a, b) + c;
+	else
+		r = (a + b + sqrt(2*c*c - (a - b)*(a - b))) / 2;
+	return r < u[p] ? r : u[p];
+}
+
+// sweeps on the tile (ti,tj) until it converges (returns whether it changed)
+static bool fim_tile(float *u, float *f, int w, int h, int ti, int tj)
+{
+	int i0 = ti * FIM_TILE, i1 = i0 + FIM_TILE < w ? i0 + FIM_TILE : w;
+	int j0 = tj * FIM_TILE, j1 = j0 + FIM_TILE < h ? j0 + FIM_TILE : h;
+	bool changed = false, again = true;
+	while (again)
+	{
+		again = false;
+		for (int s = 0; s < 4; s++) // the four sweep orders
+		for (int jj = j0; jj < j1; jj++)
+		for (int ii = i0; ii < i1; ii++)
+		{
+			int i = s & 1 ? i1 - 1 - (ii - i0) : ii;
+			int j = s & 2 ? j1 - 1 - (jj - j0) : jj;
+			long p = j * (long)w + i;
+			float r = fim_update(u, f, w, h, i, j);
+			if (r < u[p]) {
+				// (ignore the changes that are within rounding)
+				if (r < u[p] - 1e-6 * (1 + r))
+					again = true;
+				u[p] = r;
+				changed = true;
+			}
+		}
+	}
+	return changed;
+}
+
+// u = arrival times from the pixels where src is nonzero, with the speed f
+static void fim_distance(float *u, float *src, float *f, int w, int h)
+{
+	for (long p = 0; p < w * (long)h; p++)
+		u[p] = src[p] ? 0 : INFINITY;
+	int tw = (w + FIM_TILE - 1) / FIM_TILE, th = (h + FIM_TILE - 1) / FIM_TILE;
+	char *a = xmalloc(2 * tw * th), *c = a + tw * th; // active, changed
+	for (int t = 0; t < tw * th; t++)
+		a[t] = 1;
+	for (bool any = true; any; )
+	{
+		any = false;
+		for (int t = 0; t < tw * th; t++)
+			c[t] = 0;
+		for (int color = 0; color < 2; color++)
+		{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+			for (int t = 0; t < tw * th; t++)
+			{
+				int ti = t % tw, tj = t / tw;
+				if ((ti + tj) % 2 == color && a[t])
+					c[t] = fim_tile(u, f, w, h, ti, tj);
+			}
+		}
+		for (int t = 0; t < tw * th; t++)
+		{
+			int ti = t % tw, tj = t / tw;
+			a[t] = c[t] || (ti > 0 && c[t-1]) || (ti < tw-1 && c[t+1])
+				|| (tj > 0 && c[t-tw]) || (tj < th-1 && c[t+tw]);
+			any = any || a[t];
+		}
+	}
+	free(a);
+}
+
+// signed distance with the speed f (parallel, by tiles)
+void build_signed_distance_speed(float *d, float *m, float *f,
+		int w, int h, float T)
+{
+	long n = w * (long)h;
+	float *t = xmalloc(n * sizeof*t);
+	float *s = xmalloc(n * sizeof*s);
+	for (long i = 0; i < n; i++)
+		s[i] = m[i] != 0;
+	fim_distance(d, s, f, w, h);
+	for (long i = 0; i < n; i++)
+		s[i] = m[i] == 0;
+	fim_distance(t, s, f, w, h);
+	for (long i = 0; i < n; i++)
+		d[i] = m[i] != 0 ? -t[i] : d[i];
+	truncate_signed_distance(d, n, T);
+	free(s);
+	free(t);
+}
+
+
 #ifndef OMIT_DISTANCE_MAIN
 #define USE_DISTANCE_MAIN
 #endif
@@ -370,10 +526,15 @@ void build_signed_distance_t(float *d, float *m, int w, int h, float T)
 #include "pickopt.c"
 int main_sdistance(int c, char *v[])
 {
+	// -t T: truncation distance
+	// -s speed.tif: distance for this speed (fast iterative method)
+	// -m: fast marching (the old method, approximate)
 	float t = atof(pick_option(&c, &v, "t", "NAN"));
+	char *filename_s = pick_option(&c, &v, "s", "");
+	bool fmm = pick_option(&c, &v, "m", NULL);
 	if (c > 3)
-		return fprintf(stderr,
-				"usage:\n\t%s [mask [signed_distance]]\n", *v);
+		return fprintf(stderr, "usage:\n\t%s [-t T] [-s speed | -m] "
+				"[mask [signed_distance]]\n", *v);
 		//                          0  1     2
 
 	char *filename_in  = c > 1 ? v[1] : "-";
@@ -382,7 +543,17 @@ int main_sdistance(int c, char *v[])
 	int w, h;
 	float *m = iio_read_image_float(filename_in, &w, &h);
 	float *d = malloc(w*h*sizeof*d);
-	build_signed_distance_t(d, m, w, h, t);
+	if (*filename_s) {
+		int ws, hs;
+		float *f = iio_read_image_float(filename_s, &ws, &hs);
+		if (ws != w || hs != h)
+			return fprintf(stderr, "speed size mismatch\n");
+		build_signed_distance_speed(d, m, f, w, h, t);
+		free(f);
+	} else if (fmm)
+		build_signed_distance_fmm(d, m, w, h, t);
+	else
+		build_signed_distance_t(d, m, w, h, t);
 	iio_write_image_float(filename_out, d, w, h);
 	return 0;
 }
@@ -0,0 +1 @@
+../splat.c
\ No newline at end of file
@@ -34,6 +34,19 @@ static int ok_grid_add_point(struct ok_grid *o, int p, float x[2])
 	return r;
 }
 
+// add the points 0..np-1 at once, x[2*p+0], x[2*p+1] is the point p
+static void ok_grid_build(struct ok_grid *o, int np, float *x)
+{
+	int *r = xmalloc((np + 1) * sizeof*r);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i = 0; i < np; i++)
+		r[i] = grid_locate(o->g, x + 2*i);
+	ok_build(o->l, r, np);
+	free(r);
+}
+
 static int ok_neighboring_points(struct ok_grid *o, float x[2])
 {
 	int r[4], nr = grid_locate_overlapping(r, o->g, x);
@@ -42,7 +55,13 @@ static int ok_neighboring_points(struct ok_grid *o, float x[2])
 	int cx = 0;
 	for (int i = 0; i < nr; i++)
 	{
-		int nri = ok_which_points(o->l, r[i]);
+		int nri, *q = ok_region_points(o->l, r[i], &nri);
+		if (q) {
+			for (int j = 0; j < nri; j++)
+				o->buf[cx++] = q[j];
+			continue;
+		}
+		nri = ok_which_points(o->l, r[i]);
 		for (int j = 0; j < nri; j++)
 			o->buf[cx++] = o->l->buf[j];
 	}
@@ -97,11 +116,11 @@ static void print_star_tracks(float *a, float *b, int w, int h,
 	float dxy[2] = {p_dist, p_dist};
 	int n[2] = {1 + (w-1)/p_dist, 1 + (h-1)/p_dist};
 	struct ok_grid gb[1]; ok_grid_init(gb, npb, x0, dxy, n);
-	for (int i = 0; i < npb; i++)
-	{
-		float pos[2] = {pb[2*i+0], pb[2*i+1]};
-		ok_grid_add_point(gb, i, pos);
-	}
+	float *fpb = xmalloc((2 * npb + 1) * sizeof*fpb);
+	for (int i = 0; i < 2 * npb; i++)
+		fpb[i] = pb[i];
+	ok_grid_build(gb, npb, fpb);
+	free(fpb);
 
 	// for each position in the first list, traverse the list of neighbors
 	for (int i = 0; i < npa; i++)
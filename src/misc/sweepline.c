@@ -0,0 +1,180 @@
+#ifndef _SWEEPLINE_C
+#define _SWEEPLINE_C
+
+// parallel sweeps of an image domain by discrete lines of a given direction
+//
+// The domain is decomposed into disjoint Bresenham lines of direction (p,q),
+// that advance one pixel at a time along the major axis of the direction.
+// All the lines are translates of the same offsets, so that they are
+// independent: they are processed in blocks of adjacent lines, in parallel,
+// and the lines of a block advance in lockstep (so that consecutive
+// accesses stay near in memory, for all the directions).
+//
+// The shadows are cast by a running horizon on each line: a point is in the
+// shadow when the last visible point before it on the line is higher than
+// it by more than "a" times their distance.
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// number of adjacent lines processed together
+#ifndef SWEEP_BLOCK
+#define SWEEP_BLOCK 256
+#endif
+
+// the lines are those of a canonical direction (P,Q), with |P| <= Q, on a
+// domain of W columns and H rows, and the image domain is a transposition
+// and/or a vertical flip of it
+struct sweep {
+	int w, h;      // image domain
+	int W, H;      // canonical domain
+	float P, Q;    // canonical direction
+	bool swap;     // whether the canonical rows are the image columns
+	bool flip;     // whether the canonical rows are traversed backwards
+	int *t;        // offset of each canonical row (of size H)
+	int i0, n;     // abscissa of the first line, number of lines
+};
+
+// returns false if the direction is null
+static bool sweep_init(struct sweep *s, int w, int h, float p, float q)
+{
+	s->w = w;
+	s->h = h;
+	s->W = w;
+	s->H = h;
+	s->swap = s->flip = false;
+	s->t = NULL;
+	s->n = 0;
+	if (!p && !q)
+		return false;
+
+	if (fabs(p) <= q) { // canonical case
+		s->P = p; s->Q = q;
+	} else if (fabs(p) <= -q) { // swap the sign of q
+		s->P = p; s->Q = -q;
+		s->flip = true;
+	} else if (fabs(q) < p) { // swap q and p
+		s->P = q; s->Q = p;
+		s->swap = true;
+	} else if (fabs(q) < -p) { // swap q and -p
+		s->P = q; s->Q = -p;
+		s->swap = s->flip = true;
+	} else
+		return false;
+	if (s->swap) {
+		s->W = h;
+		s->H = w;
+	}
+
+	// offsets of the lines
+	s->t = xmalloc(s->H * sizeof*s->t);
+	for (int j = 0; j < s->H; j++)
+		s->t[j] = lrint(j * s->P / s->Q);
+
+	// range of abscissae of the lines that cross the domain
+	int i_min = 0;
+	int i_max = s->W;
+	if (s->P < 0) i_max += -s->t[s->H-1];
+	if (s->P > 0) i_min -= s->t[s->H-1];
+	s->i0 = i_min;
+	s->n = i_max - i_min;
+	return true;
+}
+
+static void sweep_free(struct sweep *s)
+{
+	free(s->t);
+	s->t = NULL;
+}
+
+// index of the point of the line of abscissa i on the canonical row j (whose
+// column is u = i + t[j]), and its exact (non-discretized) image coordinates
+static int sweep_point(float xy[2], struct sweep *s, int i, int j, int u)
+{
+	float e = i + j * s->P / s->Q;
+	int y = s->flip ? s->H - 1 - j : j;
+	if (s->swap) {
+		xy[0] = y;
+		xy[1] = e;
+		return u * s->w + y;
+	}
+	xy[0] = e;
+	xy[1] = y;
+	return y * s->w + u;
+}
+
+static float sweep_getpix1(float *x, int w, int h, int i, int j)
+{
+	if (i < 0) i = 0;
+	if (j < 0) j = 0;
+	if (i >= w) i = w-1;
+	if (j >= h) j = h-1;
+	return x[i+j*w];
+}
+
+// bilinear interpolation (the pixel itself at integer coordinates, so that
+// the nans of the neighbors are not spread)
+static float sweep_bilinear(float *x, int w, int h, float p, float q)
+{
+	int ip = p;
+	int iq = q;
+	float fp = p - ip;
+	float fq = q - iq;
+	float a = sweep_getpix1(x, w, h, ip, iq);
+	if (!fp && !fq) return a;
+	float b = sweep_getpix1(x, w, h, ip+1, iq  );
+	float c = sweep_getpix1(x, w, h, ip  , iq+1);
+	float d = sweep_getpix1(x, w, h, ip+1, iq+1);
+	float r = 0;
+	r += a * (1-fp) * (1-fq);
+	r += b * ( fp ) * (1-fq);
+	r += c * (1-fp) * ( fq );
+	r += d * ( fp ) * ( fq );
+	return r;
+}
+
+// set m[i] = 0 at the points in the shadow of the heights x, for rays of
+// direction (p,q) and slope a
+static void sweep_shadows(char *m, float *x, int w, int h,
+		float p, float q, float a)
+{
+	struct sweep s[1];
+	if (!sweep_init(s, w, h, p, q))
+		return;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int k = 0; k < s->n; k += SWEEP_BLOCK)
+	{
+		int nb = s->n - k < SWEEP_BLOCK ? s->n - k : SWEEP_BLOCK;
+		float Z[SWEEP_BLOCK], X[SWEEP_BLOCK], Y[SWEEP_BLOCK];
+		bool on[SWEEP_BLOCK]; // whether the line has entered the domain
+		for (int b = 0; b < nb; b++)
+			on[b] = false;
+		for (int j = 0; j < s->H; j++)
+		for (int b = 0; b < nb; b++)
+		{
+			int i = s->i0 + k + b;
+			int u = i + s->t[j];
+			if (u < 0 || u >= s->W) continue;
+			float xy[2];
+			int idx = sweep_point(xy, s, i, j, u);
+			float z = sweep_bilinear(x, w, h, xy[0], xy[1]);
+			if (on[b] && Z[b] - z > a * hypot(xy[0]-X[b], xy[1]-Y[b]))
+				m[idx] = 0; // occluded point
+			else { // new horizon
+				on[b] = true;
+				Z[b] = z;
+				X[b] = xy[0];
+				Y[b] = xy[1];
+			}
+		}
+	}
+	sweep_free(s);
+}
+
+#endif//_SWEEPLINE_C
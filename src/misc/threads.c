@@ -0,0 +1 @@
+../threads.c
\ No newline at end of file
@@ -31,267 +31,179 @@ static float getpixel_1(float *I, int w, int h, int i, int j)
 	return I[i+j*w];
 }
 
-// extrapolate by nearest value (useful for Neumann boundary conditions)
-static float getsample_1(float *x, int w, int h, int pd, int i, int j, int l)
-{
-	if (i < 0) i = 0;
-	if (j < 0) j = 0;
-	if (i >= w) i = w-1;
-	if (j >= h) j = h-1;
-	if (l < 0) l = 0;
-	if (l < pd) l = pd - 1;
-	return x[(i+j*w)*pd+l];
-}
-
-
-// evaluate the laplacian of image I at point i, j
-static float laplacian(float *I, int w, int h, int i, int j)
-{
-	getpixel_operator p = getpixel_1;
-
-	float r = -4 * p(I, w, h, i  , j  )
-		     + p(I, w, h, i+1, j  )
-		     + p(I, w, h, i  , j+1)
-		     + p(I, w, h, i-1, j  )
-		     + p(I, w, h, i  , j-1);
-
-	return r;
-}
-
-static float bilaplacian(float *x, int w, int h, int i, int j)
-{
-	float r = -4 * laplacian(x, w, h, i  , j  )
-		     + laplacian(x, w, h, i+1, j  )
-		     + laplacian(x, w, h, i  , j+1)
-		     + laplacian(x, w, h, i-1, j  )
-		     + laplacian(x, w, h, i  , j-1);
-
-	return r;
-}
-
-// evaluate the laplacian of image I at point i, j
-// (alternative function, compatible with neumann boundaries)
-static float laplacian_neum(float *I, int w, int h, int i, int j)
-{
-	getpixel_operator p = getpixel_1;
-
-	float x = p(I, w, h, i  , j  );
-	float a = p(I, w, h, i+1, j  );
-	float b = p(I, w, h, i  , j+1);
-	float c = p(I, w, h, i-1, j  );
-	float d = p(I, w, h, i  , j-1);
-
-	float r = 0;
-
-	if (isfinite(a)) r += a -x;
-	if (isfinite(b)) r += b -x;
-	if (isfinite(c)) r += c -x;
-	if (isfinite(d)) r += d -x;
-
-	return r;
-}
+// TV inpainting by the primal-dual algorithm of Chambolle and Pock
+//
+// 	min_u TV(u)   with u = g at the known pixels (where g is not NAN)
+//
+// The discrete TV is the sum of the norms of the forward differences, with
+// Neumann boundary conditions.  The dual field p = (px,py) lives on the unit
+// ball at each pixel, and each iteration is
+//
+// 	u' = u + tau * div(p),        and then u' = g at the known pixels
+// 	p' = proj(p + sigma * grad(2u' - u))
+//
+// where 2u'-u is the over-relaxation step of the method.  The steps are
+// adapted to balance the primal and dual residuals (Goldstein, Li and Yuan),
+// keeping tau*sigma = 1/8, and the iterations stop when both residuals are
+// below the tolerance.  The duality gap is not a usable stopping criterion
+// here: with a hard constraint it is infinite until div(p) vanishes on the
+// holes, and that is precisely the primal residual.
+//
+// The components of p are stored as separate planes, px is zero on the last
+// column and py on the last row, so that the gradient and the divergence of
+// a row are plain loops without boundary branches.  The rows of each step
+// are computed in parallel.
 
-// evaluate the divergence of a vector field F at point i, j
-static float divergence(float *F, int w, int h, int i, int j)
-{
-	float x  = getsample_1(F, w, h, 2, i  , j  , 0);
-	float y  = getsample_1(F, w, h, 2, i  , j  , 1);
-	float xb = getsample_1(F, w, h, 2, i-1, j  , 0);
-	float yb = getsample_1(F, w, h, 2, i  , j-1, 1);
-	return x - xb + y - yb;
-}
+#define TVINT_ALPHA 0.5  // initial variation of the adaptive steps
+#define TVINT_ETA   0.95 // decay of the variation
+#define TVINT_DELTA 1.5  // tolerated imbalance of the residuals
 
-static void gradient(float *out_g, float *I, int w, int h, int i, int j)
+// d = div(p) on the row j
+static void tv_div_row(float *d, float *px, float *py, int w, int j)
 {
-	float I00   = getpixel_1(I, w, h, i  , j  );
-	float I10 = getpixel_1(I, w, h, i+1, j  );
-	float I01 = getpixel_1(I, w, h, i  , j+1);
-	out_g[0] = I10 - I00;
-	out_g[1] = I01 - I00;
+	float *x = px + j*(long)w;
+	float *y = py + j*(long)w;
+	float *yb = y - w;
+	d[0] = x[0];
+	for (int i = 1; i < w; i++)
+		d[i] = x[i] - x[i-1];
+	if (j == 0)
+		for (int i = 0; i < w; i++)
+			d[i] += y[i];
+	else
+		for (int i = 0; i < w; i++)
+			d[i] += y[i] - yb[i];
 }
 
-//// perform one gauss-seidel iteration in-place on the data I
-//static void gauss_seidel_iteration(float *I, int w, int h,
-//		int (*omega)[2], int n_omega, float tstep)
-//{
-//	getpixel_operator op = laplacian_neum;
-//	if (tstep < 0)
-//		op = bilaplacian;
-//
-////#pragma omp parallel for
-//	for (int p = 0; p < n_omega; p++)
-//	{
-//		int i = omega[p][0];
-//		int j = omega[p][1];
-//		int ij = j*w + i;
-//
-//		float l = op(I, w, h, i, j);
-//		I[ij] = I[ij] + tstep * l;
-//	}
-//}
-
-// build a mask of the NAN positions on image "x"
-// the output "mask[i][2]" contains the two coordinates of the ith masked pixel
-static int (*build_mask(int *out_nmask, float *x, int w, int h))[2]
+// primal step: v = u, u = u + tau * div(p), and then u = g at the known pixels
+// (returns the squared norm of div(p) on the holes, the primal residual)
+static double tv_primal_step(float *u, float *v, float *g,
+		float *px, float *py, int w, int h, float tau)
 {
-	int nmask = 0;
-	for (int i = 0; i < w*h; i++)
-		if (isnan(x[i]))
-			nmask += 1;
-	int (*mask)[2] = xmalloc(w*h*2*sizeof(int)), cx = 0;
+	double r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:r)
+#endif
 	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-		if (isnan(x[j*w + i])) {
-			mask[cx][0] = i;
-			mask[cx][1] = j;
-			cx += 1;
-		}
-	assert(cx == nmask);
-
-	*out_nmask = nmask;
-	return mask;
-}
-
-// perform one gauss-seidel iteration in-place on the data I
-static void gauss_seidel_iteration(float *I, float *f, int w, int h,
-		int (*omega)[2], int n_omega, float tstep)
-{
-	getpixel_operator op = laplacian_neum;
-	if (tstep < 0)
-		op = bilaplacian;
-
-//#pragma omp parallel for
-	for (int p = 0; p < n_omega; p++)
 	{
-		int i = omega[p][0];
-		int j = omega[p][1];
-		int ij = j*w + i;
-
-		float l = op(I, w, h, i, j);
-		float d = f ? f[ij] : 0;
-		I[ij] = I[ij] + tstep * (l - d);
+		float d[w];
+		tv_div_row(d, px, py, w, j);
+		float *uj = u + j*(long)w, *vj = v + j*(long)w, *gj = g + j*(long)w;
+		for (int i = 0; i < w; i++)
+		{
+			int k = isnan(gj[i]);
+			vj[i] = uj[i];
+			uj[i] = k ? uj[i] + tau * d[i] : gj[i];
+			r += k ? d[i] * d[i] : 0;
+		}
 	}
+	return r;
 }
 
-// iterative poisson solver with initialization
-static void poisson_extension_with_init(
-		float *u,        // output image
-		float *f,        // interior Poisson data
-		float *g,        // input image with boundary data (NAN = holes)
-		int w,           // image width
-		int h,           // image height
-		float timestep,  // time step for the numerical scheme
-		int niter,       // number of iterations to run
-		float *initialization
-		)
-{
-	// build the list of pixels inside the region of interest
-	int n_omega, (*omega)[2] = build_mask(&n_omega, g, w, h);
-
-	// initialize the solution to the given data outside the ROI
-	for (int i = 0; i < w*h; i++)
-		if (isnan(g[i]))
-			u[i] = initialization ? initialization[i] : 0;
-		else
-			u[i] = g[i];
-
-	// perform the requested iterations
-	for (int i = 0; i < niter; i++)
-		gauss_seidel_iteration(u, f, w, h, omega, n_omega, timestep);
-
-	// cleanup
-	free(omega);
-}
-
-
-//// iterative minTV solver with initialization
-//static void poisson_extension_with_init(
-//		float *u,        // output image
-//		float *g,        // input image with boundary data (NAN = holes)
-//		int w,           // image width
-//		int h,           // image height
-//		float timestep,  // time step for the numerical scheme
-//		int niter,       // number of iterations to run
-//		float *initialization
-//		)
-//{
-//	// build the list of pixels inside the region of interest
-//	int n_omega, (*omega)[2] = build_mask(&n_omega, g, w, h);
-//
-//	// initialize the solution to the given data
-//	for (int i = 0; i < w*h; i++)
-//		if (isnan(g[i]))
-//			u[i] = initialization[i]; // inside the ROI
-//		else
-//			u[i] = g[i];              // outside the ROI
-//
-//	// perform the requested iterations
-//	for (int i = 0; i < niter; i++)
-//		gauss_seidel_iteration(u, w, h, omega, n_omega, timestep);
-//
-//	// cleanup
-//	free(omega);
-//}
-
-static void fill_p_from_initialization(float *p,
-		float *g, float *init, int w, int h)
+// dual step: p = proj(p + sigma * grad(2u - v))
+// (returns the squared norm of the dual residual (p-p')/sigma - grad(v-u))
+static double tv_dual_step(float *px, float *py, float *u, float *v,
+		int w, int h, float sigma)
 {
-	float *v = xmalloc(w * h * sizeof*v);
-	poisson_extension_with_init(v, init, g, w, h, 0.44, 100, NULL);
+	double r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:r)
+#endif
 	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-		gradient(p + 2 * (j*w+i), v, w, h, i, j);
-	free(v);
+	{
+		float gx[w], gy[w], ox[w], oy[w];
+		float *uj = u + j*(long)w, *vj = v + j*(long)w;
+		float *un = j < h - 1 ? uj + w : uj;
+		float *vn = j < h - 1 ? vj + w : vj;
+		for (int i = 0; i < w - 1; i++)
+		{
+			gx[i] = uj[i+1] - uj[i];
+			ox[i] = vj[i+1] - vj[i];
+		}
+		gx[w-1] = ox[w-1] = 0;
+		for (int i = 0; i < w; i++)
+		{
+			gy[i] = un[i] - uj[i];
+			oy[i] = vn[i] - vj[i];
+		}
+		float *x = px + j*(long)w, *y = py + j*(long)w;
+		for (int i = 0; i < w; i++)
+		{
+			float bx = 2 * gx[i] - ox[i];
+			float by = 2 * gy[i] - oy[i];
+			float qx = x[i] + sigma * bx;
+			float qy = y[i] + sigma * by;
+			float n = fmaxf(1, sqrtf(qx * qx + qy * qy));
+			qx /= n;
+			qy /= n;
+			float rx = (x[i] - qx) / sigma - (ox[i] - gx[i]);
+			float ry = (y[i] - qy) / sigma - (oy[i] - gy[i]);
+			r += rx * rx + ry * ry;
+			x[i] = qx;
+			y[i] = qy;
+		}
+	}
+	return r;
 }
 
-
 // iterative minTV solver with initialization
 static void tv_extension_with_init(
 		float *u,        // output image
 		float *g,        // input image with boundary data (NAN = holes)
 		int w,           // image width
 		int h,           // image height
-		float tau,       // tau
-		int niter,       // number of iterations to run
+		float tau,       // initial primal step
+		int niter,       // maximum number of iterations
+		float tol,       // tolerance on the residuals
 		float *initialization
 		)
 {
-	// allocate space for the dual field and divergence field
-	float *p = xmalloc(2 * w * h * sizeof*p);
-	float *d = xmalloc(1 * w * h * sizeof*d);
-
-	// initialize the dual field to zero everywhere (TODO: solve Poisson)
-	fill_p_from_initialization(p, g, initialization, w, h);
-	//for (int i = 0; i < 2*w*h; i++) p[i] = 0;
-
-	// perform the requested iterations in the dual space
-	for (int n = 0; n < niter; n++)
+	long n = w * (long)h, n_omega = 0;
+	for (long i = 0; i < n; i++)
 	{
-		// fill the divergence field
-		for (int j = 0; j < h; j++)
-		for (int i = 0; i < w; i++)
-			d[j*w+i] = divergence(p, w, h, i, j);
-
-		// Chambolle projection
-		for (int j = 0; j < h; j++)
-		for (int i = 0; i < w; i++)
-		{
-			float G[2];
-			gradient(G, d, w, h, i, j);
-			float f = 1 + tau * hypot(g[0], g[1]);
-			p[(j*w+i)*2 + 0] = ( p[(j*w+i)*2 + 0] + tau * G[0] ) / f;
-			p[(j*w+i)*2 + 1] = ( p[(j*w+i)*2 + 1] + tau * G[1] ) / f;
+		n_omega += isnan(g[i]);
+		u[i] = isnan(g[i]) ? initialization[i] : g[i];
+	}
+	if (!n_omega || n_omega == n)
+		return;
+
+	// dual field, and the previous iterate
+	float *px = xmalloc(n * sizeof*px);
+	float *py = xmalloc(n * sizeof*py);
+	float *v  = xmalloc(n * sizeof*v);
+	for (long i = 0; i < n; i++)
+		px[i] = py[i] = 0;
+
+	float sigma = 1 / (8 * tau), alpha = TVINT_ALPHA;
+	double rd = INFINITY;
+	int it;
+	for (it = 0; it < niter; it++)
+	{
+		double rp = tv_primal_step(u, v, g, px, py, w, h, tau);
+		rp = sqrt(rp / n_omega);
+		if (it > 0) {
+			if (rp < tol && rd < tol)
+				break;
+			if (rp > TVINT_DELTA * rd) {
+				tau /= 1 - alpha;
+				sigma *= 1 - alpha;
+				alpha *= TVINT_ETA;
+			} else if (rd > TVINT_DELTA * rp) {
+				tau *= 1 - alpha;
+				sigma /= 1 - alpha;
+				alpha *= TVINT_ETA;
+			}
 		}
+		rd = tv_dual_step(px, py, u, v, w, h, sigma);
+		rd = sqrt(rd / n);
 	}
-
-	// recover the solution as the divergence of p
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
-		u[j*w+i] = divergence(p, w, h, i, j);
+	fprintf(stderr, "TVINT %dx%d %d iterations (tau,sigma)=(%g %g)\n",
+			w, h, it, tau, sigma);
 
 	// cleanup
-	free(d);
-	free(p);
+	free(v);
+	free(py);
+	free(px);
 }
 
 // zoom-out by 2x2 block averages
@@ -369,7 +281,7 @@ static void zoom_in_by_factor_two(float *out, int ow, int oh,
 SMART_PARAMETER(PONLIT,0)
 
 void tvint_rec(float *u, float *g, int w, int h,
-		float tstep, int niter, int scale)
+		float tstep, int niter, float tol, int scale)
 {
 	fprintf(stderr, "PREC %dx%d (niter,scale)=(%d %d)\n",
 			w, h, niter, scale);
@@ -381,7 +293,7 @@ void tvint_rec(float *u, float *g, int w, int h,
 		float *gs = xmalloc(ws * hs * sizeof*gs);
 		float *us = xmalloc(ws * hs * sizeof*us);
 		zoom_out_by_factor_two(gs, ws, hs, g, w, h);
-		tvint_rec(us, gs, ws, hs, tstep, niter, scale-1);
+		tvint_rec(us, gs, ws, hs, tstep, niter, tol, scale-1);
 		zoom_in_by_factor_two(init, w, h, us, ws, hs);
 		free(gs);
 		free(us);
@@ -392,19 +304,19 @@ void tvint_rec(float *u, float *g, int w, int h,
 	if (PONLIT() && PONLIT() != w)
 		niter = 0;
 
-	tv_extension_with_init(u, g, w, h, tstep, niter, init);
+	tv_extension_with_init(u, g, w, h, tstep, niter, tol, init);
 	free(init);
 }
 
 // extension by TV minimization interpolation
 void tv_interpolator_separable(float *out, float *in,
-		int w, int h, int pd, int nscal, int niter, float tstep)
+		int w, int h, int pd, int nscal, int niter, float tstep, float tol)
 {
 	for (int l = 0; l < pd; l++)
 	{
 		float *outl = out + w*h*l;
 		float *inl  = in  + w*h*l;
-		tvint_rec(outl, inl, w, h, tstep, niter, nscal);
+		tvint_rec(outl, inl, w, h, tstep, niter, tol, nscal);
 	}
 }
 
@@ -417,7 +329,8 @@ int main(int argc, char *argv[])
 {
 	// extract named arguments
 	float tstep = atof(pick_option(&argc, &argv, "t", "0.25"));
-	float niter = atof(pick_option(&argc, &argv, "n", "10"));
+	float niter = atof(pick_option(&argc, &argv, "n", "1000"));
+	float tol   = atof(pick_option(&argc, &argv, "e", "0.001"));
 	float nscal = atof(pick_option(&argc, &argv, "s", "99"));
 //	float cgrad = atof(pick_option(&argc, &argv, "c", "0"));
 	char *filename_i = pick_option(&argc, &argv, "i", "-"); // stdin
@@ -428,15 +341,16 @@ int main(int argc, char *argv[])
 	// if any arguments are left, print a help message and quit
 	if (argc > 1) {
 		fprintf(stderr, "Usage:\n\t%s [options]\n", *argv);
-		fprintf(stderr, "\nComputes approximate solutions of Poisson"
-			" or Laplace equations for images\n");
+		fprintf(stderr, "\nFills the holes of an image by minimizing"
+			" its total variation\n");
 		fprintf(stderr, "\nOptions with their default values:\n"
 			"\t-i stdin   Input image with boundary data\n"
 //			"\t-f (zeros) Optional image with Poisson data term\n"
 			"\t-m (zeros) Optional image with region of interest\n"
 			"\t-o stdout  Output image\n"
-//			"\t-t 0.25    Time step for Gauss-Seidel iterations\n"
-//			"\t-n 10      Number of Gauss-Seidel iterations\n"
+			"\t-t 0.25    Initial primal step of the TV iterations\n"
+			"\t-n 1000    Maximum number of TV iterations per scale\n"
+			"\t-e 0.001   Tolerance on the residuals of the TV iterations\n"
 			"\t-s 99      Number of Multi-Scale octaves\n"
 //			"\t-c 0       Number of Conjugate Gradient iterations\n"
 		);
@@ -470,7 +384,7 @@ int main(int argc, char *argv[])
 				img_i[i] = NAN;
 
 	// run the algorithm
-	tv_interpolator_separable(out, img_i, w, h, pd, nscal, niter, tstep);
+	tv_interpolator_separable(out, img_i, w, h, pd, nscal, niter, tstep, tol);
 
 	// save the output image
 	iio_write_image_float_split(filename_o, out, w, h, pd);
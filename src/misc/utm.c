@@ -0,0 +1 @@
+../utm.c
\ No newline at end of file
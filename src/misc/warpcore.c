@@ -0,0 +1 @@
+../warpcore.c
\ No newline at end of file
@@ -44,49 +44,8 @@
 
 /*-------------------- GENERAL PURPOSE ROUTINES --------------------*/
 
-/* routines for vectors and matrices */
-
-static
-float *vector(int nl, int nh)
-{
-  float *v;
-
-  v=(float *)malloc((unsigned) (nh-nl+1)*sizeof(float));
-  if (!v) fail("allocation failure in vector()");
-  return v-nl;
-}
-
-static
-float **matrix(int nrl, int nrh, int ncl, int nch)
-{
-  int i;
-  float **m;
-
-  m=(float **) malloc((unsigned) (nrh-nrl+1)*sizeof(float*));
-  if (!m) fail("allocation failure 1 in matrix()");
-  m -= nrl;
-  for(i=nrl;i<=nrh;i++) {
-    m[i]=(float *) malloc((unsigned) (nch-ncl+1)*sizeof(float));
-    if (!m[i]) fail("allocation failure 2 in matrix()");
-    m[i] -= ncl;
-  }
-  return m;
-}
-
-static
-void free_vector(float *v, int nl, int nh)
-{
-  free(v + nl);
-}
-
-static
-void free_matrix(float **m, int nrl, int nrh, int ncl, int nch)
-{
-  int i;
-
-  for(i=nrh;i>=nrl;i--) free(m[i] + ncl - 1);
-  free(m + nrl);
-}
+/* vectors and matrices are indexed from 1, as in the original code, and they
+   live on the stack (the 7-point solver runs once per ransac trial) */
 
 /* Singular Value Decomposition routine */
 
@@ -95,9 +54,7 @@ void free_matrix(float **m, int nrl, int nrh, int ncl, int nch)
 //#define PYTHAG(a,b) ((at=fabs(a)) > (bt=fabs(b)) ?
 //(ct=bt/at,at*sqrt(1.0+ct*ct)) : (bt ? (ct=at/bt,bt*sqrt(1.0+ct*ct)): 0.0))
 
-static float maxarg1,maxarg2;
-#define MAX(a,b) (maxarg1=(a),maxarg2=(b),(maxarg1) > (maxarg2) ?\
-	(maxarg1) : (maxarg2))
+#define MAX(a,b) fmax(a,b) // (no static temporaries, for the threads)
 #define SIGN(a,b) ((b) >= 0.0 ? fabs(a) : -fabs(a))
 
 static
@@ -106,10 +63,9 @@ void svdcmp(float **a, int m, int n, float *w, float **v)
   int flag,i,its,j,jj,k,l,nm;
   float c,f,h,s,x,y,z;
   float anorm=0.0,g=0.0,scale=0.0;
-  float *rv1;
+  float rv1_[n+1], *rv1 = rv1_;
 
   if (m<n) fail("SVDCMP: You must augment A with extra zero rows");
-  rv1=vector(1,n);
   for (i=1;i<=n;i++) {
     l=i+1;
     rv1[i]=scale*g;
@@ -287,7 +243,6 @@ void svdcmp(float **a, int m, int n, float *w, float **v)
       w[k]=x;
     }
   }
-  free_vector(rv1,1,n);
 }
 
 #undef SIGN
@@ -446,13 +401,11 @@ int moistiv_epipolar(float *m1, float *m2, int *k, float *z,
 {
   int i,j,i2,i3,imin1,imin2;
   float wmin1,wmin2;
-  float **c  = matrix(1,9,1,9);
-  float *w  = vector(1,9);
-  float **v  = matrix(1,9,1,9);
-  //float c[9][9];
-  //float w[9];
-  //float v[9][9];
+  float c_[10][10], *c[10];
+  float v_[10][10], *v[10];
+  float w[10];
   float a[4];
+  for (i=1;i<=9;i++) { c[i] = c_[i]; v[i] = v_[i]; }
 
   /* build 9xn matrix from point matches */
   for (i=0;i<7;i++) {
@@ -524,11 +477,6 @@ int moistiv_epipolar(float *m1, float *m2, int *k, float *z,
     a[3] -= F2[i][1]*F2[i2][2]*F2[i3][3];
   }
 
-
-  free_matrix(c,1,9,1,9);
-  free_matrix(v,1,9,1,9);
-  free_vector(w,1,9);
-
   return(FindCubicRoots(a,z));
 }
 
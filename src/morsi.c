@@ -53,31 +53,112 @@ static float getpixel_1(float *x, int w, int h, int i, int j)
 // (E[6], E[7]) = second pixel
 // ...
 
-void morsi_erosion(float *y, float *x, int w, int h, int *e)
+// Fast erosion and dilation.
+//
+// The structuring element is decomposed into horizontal segments (or
+// vertical ones, if there are fewer), and the minimum over each segment is
+// computed by the van Herk/Gil-Werman algorithm, at a constant cost per
+// pixel.  The results are exactly those of the direct method: the NANs and
+// the samples outside the image are ignored.
+
+static int compare_int_pairs(const void *aa, const void *bb)
 {
-	getpixel_operator p = getpixel_nan;
+	const int *a = (const int *)aa;
+	const int *b = (const int *)bb;
+	if (a[0] != b[0]) return (a[0] > b[0]) - (a[0] < b[0]);
+	return (a[1] > b[1]) - (a[1] < b[1]);
+}
 
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
+// segments s[k] = {dy, a, b} of the structuring element, such that the
+// offsets (dx, dy) with a <= dx <= b are in the element (if "transposed",
+// the roles of dx and dy are exchanged); returns the number of segments
+static int morsi_segments(int (*s)[3], int *e, int transposed)
+{
+	int n = e[0], p[n][2], ns = 0;
+	for (int k = 0; k < n; k++)
 	{
-		float a = INFINITY;
-		for (int k = 0; k < e[0]; k++)
-			a = fmin(a, p(x,w,h, i-e[2]+e[2*k+4], j-e[3]+e[2*k+5]));
-		y[j*w+i] = a;
+		int dx = e[2*k+4] - e[2], dy = e[2*k+5] - e[3];
+		p[k][0] = transposed ? dx : dy;
+		p[k][1] = transposed ? dy : dx;
 	}
+	qsort(p, n, sizeof*p, compare_int_pairs);
+	for (int k = 0; k < n; k++)
+		if (ns && s[ns-1][0] == p[k][0] && s[ns-1][2] + 1 >= p[k][1])
+			s[ns-1][2] = fmax(s[ns-1][2], p[k][1]); // repeated pixels
+		else {
+			s[ns][0] = p[k][0];
+			s[ns][1] = s[ns][2] = p[k][1];
+			ns += 1;
+		}
+	return ns;
 }
 
-void morsi_dilation(float *y, float *x, int w, int h, int *e)
+static inline float morsi_min(float a, float b)
 {
-	getpixel_operator p = getpixel_nan;
+	return b < a ? b : a; // (no NANs here, so that it is vectorized)
+}
 
-	for (int j = 0; j < h; j++)
+// y[i] = min(y[i], p[o+i], ..., p[o+i+L-1]) for i in [0, w), where the
+// blocks of size L start at p[0] (g is a scratch of size 2*W)
+static void morsi_vhgw(float *y, float *p, float *g, int W, int L, int o,
+		int w)
+{
+	float *q = g + W;
+	// minima from the start and to the end of blocks of size L
+	for (int t = 0; t < W; t++)
+		g[t] = t % L ? morsi_min(g[t-1], p[t]) : p[t];
+	for (int t = W - 1; t >= 0; t--)
+		q[t] = t % L == L-1 || t == W-1 ? p[t] : morsi_min(q[t+1], p[t]);
+	float *qa = q + o, *ga = g + o + L - 1;
 	for (int i = 0; i < w; i++)
+		y[i] = morsi_min(y[i], morsi_min(qa[i], ga[i]));
+}
+
+// erosion (ymin) and dilation (ymax) by the horizontal segments s[0..n-1]
+// (any of the outputs can be NULL, both are computed in the same pass)
+static void morsi_minmax_by_segments(float *ymin, float *ymax,
+		float *x, int w, int h, int (*s)[3], int n)
+{
+	int amin = s[0][1], bmax = s[0][2];
+	for (int k = 0; k < n; k++)
 	{
-		float a = -INFINITY;
-		for (int k = 0; k < e[0]; k++)
-			a = fmax(a, p(x,w,h, i-e[2]+e[2*k+4], j-e[3]+e[2*k+5]));
-		y[j*w+i] = a;
+		amin = fmin(amin, s[k][1]);
+		bmax = fmax(bmax, s[k][2]);
+	}
+	int W = w + bmax - amin; // padded row: p[t] is the sample t+amin
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		// the maxima are computed as minima of the negated samples
+		float *p = xmalloc(4*W*sizeof*p), *P = p + W, *g = P + W;
+		float *yj = ymin ? ymin + j*(long)w : NULL;
+		float *zj = ymax ? ymax + j*(long)w : NULL;
+		for (int i = 0; i < w; i++)
+		{
+			if (yj) yj[i] = INFINITY;
+			if (zj) zj[i] = INFINITY;
+		}
+		for (int k = 0; k < n; k++)
+		{
+			int r = j + s[k][0], a = s[k][1], L = s[k][2] - a + 1;
+			if (r < 0 || r >= h) continue;
+			for (int t = 0; t < W; t++)
+			{
+				int i = t + amin;
+				float v = i < 0 || i >= w ? NAN : x[r*(long)w+i];
+				p[t] = isnan(v) ? INFINITY :  v;
+				P[t] = isnan(v) ? INFINITY : -v;
+			}
+			if (yj) morsi_vhgw(yj, p, g, W, L, a - amin, w);
+			if (zj) morsi_vhgw(zj, P, g, W, L, a - amin, w);
+		}
+		if (zj)
+			for (int i = 0; i < w; i++)
+				zj[i] = -zj[i];
+		free(p);
 	}
 }
 
@@ -88,54 +169,368 @@ static int compare_floats(const void *aa, const void *bb)
 	return (*a > *b) - (*a < *b);
 }
 
-static float median(float *a, int n)
+// counts of integers in [0, n), with queries of order statistics
+//
+// When n is small (e.g., the values of quantized data) this is a two-level
+// histogram, as in Perreault-Hebert, with constant-time updates.  Otherwise
+// it is a Fenwick tree, where all the operations are logarithmic.
+struct morsi_counts {
+	int n;   // number of bins
+	int *t;  // fine histogram, or fenwick tree
+	int *c;  // coarse histogram of 256 bins each (NULL for the tree)
+};
+
+static void morsi_counts_init(struct morsi_counts *m, int n)
 {
-	if (n < 1) return NAN;
-	if (n == 1) return *a;
-	if (n == 2) return (a[0] + a[1])/2;
-	qsort(a, n, sizeof*a, compare_floats);
-	if (0 == n%2)
-		return (a[n/2]+a[1+n/2])/2;
-	else
-		return a[n/2];
+	m->n = n;
+	m->t = xmalloc((n + 1) * sizeof*m->t);
+	for (int i = 0; i <= n; i++)
+		m->t[i] = 0;
+	m->c = NULL;
+	if (n <= 0x10000) {
+		int nc = n / 256 + 1;
+		m->c = xmalloc(nc * sizeof*m->c);
+		for (int i = 0; i < nc; i++)
+			m->c[i] = 0;
+	}
 }
 
-void morsi_median(float *y, float *x, int w, int h, int *e)
+static void morsi_counts_free(struct morsi_counts *m)
 {
-	getpixel_operator p = getpixel_nan;
+	free(m->t);
+	free(m->c);
+}
 
-	for (int j = 0; j < h; j++)
-	for (int i = 0; i < w; i++)
+static void morsi_counts_add(struct morsi_counts *m, int v, int d)
+{
+	if (m->c) {
+		m->t[v] += d;
+		m->c[v >> 8] += d;
+	} else
+		for (int i = v + 1; i <= m->n; i += i & -i)
+			m->t[i] += d;
+}
+
+// number of stored integers smaller than v
+static int morsi_counts_below(struct morsi_counts *m, int v)
+{
+	int r = 0;
+	if (m->c) {
+		for (int i = 0; i < v >> 8; i++)
+			r += m->c[i];
+		for (int i = v & ~255; i < v; i++)
+			r += m->t[i];
+	} else
+		for (int i = v; i > 0; i -= i & -i)
+			r += m->t[i];
+	return r;
+}
+
+// k-th smallest stored integer (k starts at 0)
+static int morsi_counts_kth(struct morsi_counts *m, int k)
+{
+	int v = 0;
+	if (m->c) {
+		while (k >= m->c[v >> 8])
+			k -= m->c[v >> 8], v += 256;
+		while (k >= m->t[v])
+			k -= m->t[v++];
+		return v;
+	}
+	int b = 1;
+	while (2*b <= m->n) b *= 2;
+	for (; b; b /= 2)
+		if (v + b <= m->n && m->t[v + b] <= k)
+			k -= m->t[v += b];
+	return v;
+}
+
+// median (op='m') or rank (op='r') filter by the segments s[0..n-1]
+//
+// The window slides along each row, adding the right ends of the segments
+// and removing the left ones.  The samples are replaced by their ranks
+// among the different finite values of the image, so that the results are
+// exactly those of the direct method.
+static void morsi_rankfilter_by_segments(float *y, float *x, int w, int h,
+		int (*s)[3], int n, int op)
+{
+	// sorted list of the different finite values
+	long N = w * (long)h, nu = 0;
+	float *u = xmalloc(N * sizeof*u);
+	for (long i = 0; i < N; i++)
+		if (isfinite(x[i]))
+			u[nu++] = x[i];
+	qsort(u, nu, sizeof*u, compare_floats);
+	long nd = 0;
+	for (long i = 0; i < nu; i++)
+		if (!nd || u[i] != u[nd-1])
+			u[nd++] = u[i];
+
+	// rank of each sample (-1 for non-finite samples)
+	int *r = xmalloc(N * sizeof*r);
+	for (long i = 0; i < N; i++)
+	{
+		r[i] = -1;
+		if (!isfinite(x[i])) continue;
+		long a = 0, b = nd - 1;
+		while (a < b) {
+			long c = (a + b) / 2;
+			if (u[c] < x[i]) a = c + 1; else b = c;
+		}
+		r[i] = a;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
 	{
-		float a[e[0]];
-		int cx = 0;
-		for (int k = 0; k < e[0]; k++)
+		struct morsi_counts m[1];
+		morsi_counts_init(m, nd);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+		for (int j = 0; j < h; j++)
 		{
-			float v = p(x,w,h, i-e[2]+e[2*k+4], j-e[3]+e[2*k+5]);
-			if (isfinite(v))
-				a[cx++] = v;
+			int cx = 0; // number of samples in the window
+#define MORSI_UPDATE(i,dx,dy,d) do { \
+	int ii = (i) + (dx), jj = j + (dy); \
+	if (ii >= 0 && ii < w && jj >= 0 && jj < h && r[jj*(long)w+ii] >= 0) {\
+		morsi_counts_add(m, r[jj*(long)w+ii], d); cx += d; } } while (0)
+			for (int k = 0; k < n; k++)
+			for (int dx = s[k][1]; dx <= s[k][2]; dx++)
+				MORSI_UPDATE(0, dx, s[k][0], 1);
+			for (int i = 0; i < w; i++)
+			{
+				if (i > 0)
+				for (int k = 0; k < n; k++)
+				{
+					MORSI_UPDATE(i - 1, s[k][1], s[k][0], -1);
+					MORSI_UPDATE(i, s[k][2], s[k][0], 1);
+				}
+				float v = x[j*(long)w+i];
+				if (op == 'r') {
+					long a = 0, b = nd; // first value not below v
+					while (a < b) {
+						long c = (a + b) / 2;
+						if (u[c] < v) a = c + 1; else b = c;
+					}
+					v = isnan(v) ? 0 : morsi_counts_below(m, a);
+				} else if (!cx) // same ranks as the function "median"
+					v = NAN;
+				else if (cx % 2)
+					v = u[morsi_counts_kth(m, cx/2)];
+				else {
+					int q = cx == 2 ? 0 : cx/2;
+					v = (u[morsi_counts_kth(m, q)]
+						+ u[morsi_counts_kth(m, q+1)]) / 2;
+				}
+				y[j*(long)w+i] = v;
+			}
+			for (int k = 0; k < n; k++)
+			for (int dx = s[k][1]; dx <= s[k][2]; dx++)
+				MORSI_UPDATE(w - 1, dx, s[k][0], -1);
+#undef MORSI_UPDATE
 		}
-		y[j*w+i] = median(a, cx);
+		morsi_counts_free(m);
 	}
+	free(u);
+	free(r);
 }
 
-void morsi_rank(float *y, float *x, int w, int h, int *e)
+// the operator "op" by segments (for op='b', y is the erosion and z is the
+// dilation, otherwise z is not used)
+static void morsi_by_segments(float *y, float *z, float *x, int w, int h,
+		int (*s)[3], int n, int op)
 {
-	getpixel_operator p = getpixel_nan;
+	if (op == 'i') morsi_minmax_by_segments(y, NULL, x, w, h, s, n);
+	else if (op == 'a') morsi_minmax_by_segments(NULL, y, x, w, h, s, n);
+	else if (op == 'b') morsi_minmax_by_segments(y, z, x, w, h, s, n);
+	else morsi_rankfilter_by_segments(y, x, w, h, s, n, op);
+}
 
+static void morsi_transpose(float *y, float *x, int w, int h)
+{
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
+		y[i*(long)h+j] = x[j*(long)w+i];
+}
+
+// try to compute the erosion (op='i'), the dilation (op='a'), both of them
+// (op='b', on y and z), the median (op='m') or the rank (op='r') by segments
+// (returns 0 when it would not be faster than the direct method)
+static int morsi_fast(float *y, float *z, float *x, int w, int h, int *e,
+		int op)
+{
+	if (e[0] < 1) return 0;
+	int (*s)[3] = xmalloc(e[0]*sizeof*s);
+	int (*st)[3] = xmalloc(e[0]*sizeof*st);
+	int ns = morsi_segments(s, e, 0);
+	int nst = morsi_segments(st, e, 1);
+	int r = 1;
+	if (4 * fmin(ns, nst) >= e[0])
+		r = 0;
+	else if (ns <= nst)
+		morsi_by_segments(y, z, x, w, h, s, ns, op);
+	else {
+		long n = w*(long)h;
+		float *xt = xmalloc((op == 'b' ? 3 : 2)*n*sizeof*xt);
+		float *yt = xt + n, *zt = op == 'b' ? yt + n : NULL;
+		morsi_transpose(xt, x, w, h);
+		morsi_by_segments(yt, zt, xt, h, w, st, nst, op);
+		morsi_transpose(y, yt, h, w);
+		if (zt)
+			morsi_transpose(z, zt, h, w);
+		free(xt);
+	}
+	free(s);
+	free(st);
+	return r;
+}
+
+// Direct method, by tiles.
+//
+// The tiles are processed in parallel.  On the pixels where the whole
+// element falls inside the image, the samples are read directly at
+// precomputed offsets, and only the remaining pixels near the boundary go
+// through "getpixel_nan".
+
+#define MORSI_TILE 64
+
+// k-th smallest of the n values a[], which are reordered so that the
+// values before a[k] are not larger and those after it are not smaller
+// (selection algorithm of Wirth, in linear expected time)
+static float morsi_select(float *a, int n, int k)
+{
+	int l = 0, m = n - 1;
+	while (l < m)
 	{
-		int cx = 0;
-		float u = p(x,w,h, i, j);
-		for (int k = 0; k < e[0]; k++)
+		float x = a[k];
+		int i = l, j = m;
+		do {
+			while (a[i] < x) i++;
+			while (x < a[j]) j--;
+			if (i <= j) {
+				float t = a[i]; a[i] = a[j]; a[j] = t;
+				i++; j--;
+			}
+		} while (i <= j);
+		if (j < k) l = i;
+		if (k < i) m = j;
+	}
+	return a[k];
+}
+
+static float median(float *a, int n)
+{
+	if (n < 1) return NAN;
+	if (n == 1) return *a;
+	if (n == 2) return (a[0] + a[1])/2;
+	float v = morsi_select(a, n, n/2);
+	if (0 == n%2) { // the next value, as a[1+n/2] of the sorted array
+		float u = a[1+n/2];
+		for (int i = 2+n/2; i < n; i++)
+			u = morsi_min(u, a[i]);
+		return (v + u)/2;
+	}
+	return v;
+}
+
+// the operator "op" (see "morsi_fast") by the direct method
+static void morsi_direct(float *y, float *z, float *x, int w, int h, int *e,
+		int op)
+{
+	int n = e[0], mx0 = 0, mx1 = 0, my0 = 0, my1 = 0;
+	int *d = xmalloc(2*n*sizeof*d);
+	long *off = xmalloc(n*sizeof*off);
+	for (int k = 0; k < n; k++)
+	{
+		int dx = d[2*k+0] = e[2*k+4] - e[2];
+		int dy = d[2*k+1] = e[2*k+5] - e[3];
+		off[k] = dy*(long)w + dx;
+		mx0 = fmax(mx0, -dx); mx1 = fmax(mx1, dx);
+		my0 = fmax(my0, -dy); my1 = fmax(my1, dy);
+	}
+	int ntx = (w + MORSI_TILE - 1) / MORSI_TILE;
+	int nty = (h + MORSI_TILE - 1) / MORSI_TILE;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int t = 0; t < ntx * nty; t++)
+	{
+		float a[n];
+		int i0 = (t % ntx) * MORSI_TILE, i1 = fmin(w, i0 + MORSI_TILE);
+		int j0 = (t / ntx) * MORSI_TILE, j1 = fmin(h, j0 + MORSI_TILE);
+		for (int j = j0; j < j1; j++)
+		for (int i = i0; i < i1; i++)
 		{
-			float v = p(x,w,h, i-e[2]+e[2*k+4], j-e[3]+e[2*k+5]);
-			if (isfinite(v))
-				cx += v < u;
+			// gather the samples under the element
+			long c = j*(long)w + i;
+			if (i >= mx0 && i < w - mx1 && j >= my0 && j < h - my1)
+				for (int k = 0; k < n; k++)
+					a[k] = x[c + off[k]];
+			else
+				for (int k = 0; k < n; k++)
+					a[k] = getpixel_nan(x, w, h,
+							i + d[2*k], j + d[2*k+1]);
+
+			if (op == 'i' || op == 'a' || op == 'b') {
+				float lo = INFINITY, hi = -INFINITY;
+				for (int k = 0; k < n; k++)
+				{
+					lo = fmin(lo, a[k]);
+					hi = fmax(hi, a[k]);
+				}
+				y[c] = op == 'a' ? hi : lo;
+				if (op == 'b') z[c] = hi;
+			} else if (op == 'm') {
+				int cx = 0;
+				for (int k = 0; k < n; k++)
+					if (isfinite(a[k]))
+						a[cx++] = a[k];
+				y[c] = median(a, cx);
+			} else {
+				int cx = 0;
+				for (int k = 0; k < n; k++)
+					if (isfinite(a[k]))
+						cx += a[k] < x[c];
+				y[c] = cx;
+			}
 		}
-		y[j*w+i] = cx;
 	}
+	free(d);
+	free(off);
+}
+
+void morsi_erosion(float *y, float *x, int w, int h, int *e)
+{
+	if (!morsi_fast(y, NULL, x, w, h, e, 'i'))
+		morsi_direct(y, NULL, x, w, h, e, 'i');
+}
+
+void morsi_dilation(float *y, float *x, int w, int h, int *e)
+{
+	if (!morsi_fast(y, NULL, x, w, h, e, 'a'))
+		morsi_direct(y, NULL, x, w, h, e, 'a');
+}
+
+// erosion and dilation at the same time
+void morsi_minmax(float *ymin, float *ymax, float *x, int w, int h, int *e)
+{
+	if (!morsi_fast(ymin, ymax, x, w, h, e, 'b'))
+		morsi_direct(ymin, ymax, x, w, h, e, 'b');
+}
+
+void morsi_median(float *y, float *x, int w, int h, int *e)
+{
+	if (!morsi_fast(y, NULL, x, w, h, e, 'm'))
+		morsi_direct(y, NULL, x, w, h, e, 'm');
+}
+
+void morsi_rank(float *y, float *x, int w, int h, int *e)
+{
+	if (!morsi_fast(y, NULL, x, w, h, e, 'r'))
+		morsi_direct(y, NULL, x, w, h, e, 'r');
 }
 
 void morsi_opening(float *y, float *x, int w, int h, int *e)
@@ -275,38 +670,83 @@ void morsi_cblur(float *y, float *x, int w, int h, int *e)
 }
 
 
+// the outputs of "morsi_all" on the rows [j0, j1) of the image
+//
+// The operators are computed on the band of rows [j0-halo, j1+halo), so
+// that a halo of twice the vertical extent of the element gives the same
+// values as on the whole image.  The outputs are o[0..12], in the order of
+// the arguments of "morsi_all" (the NULL ones are not computed).
+static void morsi_all_rows(float *o[13], float *x, int w, int h, int *e,
+		int j0, int j1, int halo)
+{
+	int a = fmax(0, j0 - halo), b = fmin(h, j1 + halo), hb = b - a;
+	long n = w*(long)hb, c = w*(long)(j0 - a), m = w*(long)(j1 - j0);
+	float *xb = x + a*(long)w;
+
+	// cached intermediate results (erosion, dilation, opening, closing)
+	float *min = xmalloc(n*sizeof*min);
+	float *max = xmalloc(n*sizeof*max);
+	float *med = o[2] ? xmalloc(n*sizeof*med) : NULL;
+	float *ope = o[3] || o[10] || o[11] ? xmalloc(n*sizeof*ope) : NULL;
+	float *clo = o[4] || o[10] || o[12] ? xmalloc(n*sizeof*clo) : NULL;
+	morsi_minmax(min, max, xb, w, hb, e);
+	if (med) morsi_median(med, xb, w, hb, e);
+	if (ope) morsi_dilation(ope, min, w, hb, e);
+	if (clo) morsi_erosion(clo, max, w, hb, e);
+
+	// derived operators, on the rows of this band only
+	float *X = xb + c;
+	for (long i = 0; i < m; i++)
+	{
+		long k = j0*(long)w + i, t = c + i;
+		float lap = (max[t] + min[t] - 2*X[i])/2;
+		if (o[0])  o[0][k]  = min[t];
+		if (o[1])  o[1][k]  = max[t];
+		if (o[2])  o[2][k]  = med[t];
+		if (o[3])  o[3][k]  = ope[t];
+		if (o[4])  o[4][k]  = clo[t];
+		if (o[5])  o[5][k]  = max[t] - min[t];
+		if (o[6])  o[6][k]  =   X[i] - min[t];
+		if (o[7])  o[7][k]  = max[t] -   X[i];
+		if (o[8])  o[8][k]  = lap;
+		if (o[9])  o[9][k]  =   X[i] - lap;
+		if (o[10]) o[10][k] = clo[t] - ope[t];
+		if (o[11]) o[11][k] =   X[i] - ope[t];
+		if (o[12]) o[12][k] = clo[t] -   X[i];
+	}
+	free(min); free(max); free(med); free(ope); free(clo);
+}
+
+// all the operators at once (the NULL outputs are not computed)
+//
+// The erosion and the dilation are computed in a single pass, and they are
+// reused by all the derived operators.  The image is cut in horizontal
+// bands, that are processed in parallel.
 void morsi_all(
-	float *o_ero, float *o_dil, float *o_ope, float *o_clo,
+	float *o_ero, float *o_dil, float *o_med, float *o_ope, float *o_clo,
 	float *o_grad, float *o_igrad, float *o_egrad,
 	float *o_lap, float *o_enh, float *o_str,
 	float *o_top, float *o_bot, float *x, int w, int h, int *e)
 {
-	int n = w*h, s = n*sizeof(float), own_ope=0, own_clo=0, own_lap=0, i;
-	float *min = xmalloc(s);
-	float *max = xmalloc(s);
-	if ((o_top || o_str) && !o_ope) { o_ope = xmalloc(s); own_ope = 1; }
-	if ((o_bot || o_str) && !o_clo) { o_clo = xmalloc(s); own_clo = 1; }
-	if (o_enh && ! o_lap)           { o_lap = xmalloc(s); own_lap = 1; }
-
-	morsi_erosion (min, x, w, h, e);
-	morsi_dilation(max, x, w, h, e);
-	if (o_ero)   for(i=0;i<n;i++) o_ero[i] = min[i];
-	if (o_dil)   for(i=0;i<n;i++) o_dil[i] = max[i];
-	if (o_ope)   morsi_dilation(  o_ope,     min, w, h, e);
-	if (o_clo)   morsi_erosion (  o_clo,     max, w, h, e);
-	if (o_grad)  for(i=0;i<n;i++) o_grad[i]  = max[i] - min[i];
-	if (o_igrad) for(i=0;i<n;i++) o_igrad[i] =   x[i] - min[i];
-	if (o_egrad) for(i=0;i<n;i++) o_egrad[i] = max[i] -   x[i];
-	if (o_top)   for(i=0;i<n;i++) o_top[i]   =     x[i] - o_ope[i];
-	if (o_bot)   for(i=0;i<n;i++) o_bot[i]   = o_clo[i] -   x[i];
-	if (o_str)   for(i=0;i<n;i++) o_str[i]   = o_clo[i] - o_ope[i];
-	if (o_lap)   for(i=0;i<n;i++) o_lap[i]   = (max[i] + min[i] - 2*x[i])/2;
-	if (o_enh)   for(i=0;i<n;i++) o_enh[i]   =     x[i] - o_lap[i];
-
-	free(min); free(max);
-	if (own_ope) free(o_ope);
-	if (own_clo) free(o_clo);
-	if (own_lap) free(o_lap);
+	float *o[13] = {o_ero, o_dil, o_med, o_ope, o_clo, o_grad, o_igrad,
+		o_egrad, o_lap, o_enh, o_str, o_top, o_bot};
+
+	// the openings and closings see twice the vertical extent of e
+	int halo = 0;
+	for (int k = 0; k < e[0]; k++)
+		halo = fmax(halo, 2 * abs(e[2*k+5] - e[3]));
+
+	int bh = fmax(64, 4 * halo); // height of the bands
+	int nb = (h + bh - 1) / bh;
+	if (nb < 2) {
+		morsi_all_rows(o, x, w, h, e, 0, h, halo);
+		return;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = 0; b < nb; b++)
+		morsi_all_rows(o, x, w, h, e, b*bh, fmin(h, (b+1)*bh), halo);
 }
 
 
@@ -466,6 +906,9 @@ static char *help_string_long     =
 " iblur        average of image and its erosion (blur towards dark)\n"
 " eblur        average of image and its dilation (blur towards light)\n"
 " cblur        average of iblur and eblur (detail-preserving smoothing)\n"
+" all          13 outputs per channel: erosion dilation median opening\n"
+"              closing gradient igradient egradient laplacian enhance\n"
+"              oscillation tophat bothat\n"
 "\n"
 "Examples:\n"
 " morsi cross erosion i.png o.png    Erode by a \"cross\" structuring element\n"
@@ -474,6 +917,7 @@ static char *help_string_long     =
 "Report bugs to <enric.meinhardt@ens-paris-saclay.fr>."
 ;
 #include "help_stuff.c" // functions that print the strings named above
+#include "profile.c"
 
 int main_morsi(int c, char **v)
 {
@@ -525,7 +969,8 @@ int main_morsi(int c, char **v)
 	if (0 == strcmp(v[2], "iblur"      )) operation = morsi_iblur;
 	if (0 == strcmp(v[2], "eblur"      )) operation = morsi_eblur;
 	if (0 == strcmp(v[2], "cblur"      )) operation = morsi_cblur;
-	if (!operation) {
+	int all = 0 == strcmp(v[2], "all");
+	if (!operation && !all) {
 		fprintf(stderr, "operations = erosion, dilation, opening...\n");
 		return 1;
 	}
@@ -533,17 +978,29 @@ int main_morsi(int c, char **v)
 	// prepare input and output images
 	int w, h, pd;
 	float *x = iio_read_image_float_split(filename_in, &w, &h, &pd);
-	float *y = malloc(w*h*pd*sizeof*y);
+	int pdo = all ? 13*pd : pd;
+	float *y = malloc(w*h*pdo*sizeof*y);
 
 	// compute
-	if (pd == 1)
+	PROFILE_SCOPE("morsi")
+	if (all)
+		for (int k = 0; k < pd; k++)
+		{
+			float *o[13];
+			for (int q = 0; q < 13; q++)
+				o[q] = y + (13*k + q)*w*h;
+			morsi_all(o[0], o[1], o[2], o[3], o[4], o[5], o[6],
+					o[7], o[8], o[9], o[10], o[11], o[12],
+					x + k*w*h, w, h, structuring_element);
+		}
+	else if (pd == 1)
 		operation(y, x, w, h, structuring_element);
 	else
 		for (int k = 0; k < pd; k++)
 			operation(y+k*w*h, x+k*w*h, w, h, structuring_element);
 
 	// save result
-	iio_write_image_float_split(filename_out, y, w, h, pd);
+	iio_write_image_float_split(filename_out, y, w, h, pdo);
 
 	// cleanup
 	free(x);
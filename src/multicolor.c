@@ -0,0 +1,72 @@
+#ifndef _MULTICOLOR_C
+#define _MULTICOLOR_C
+
+// Multi-color ordering of the pixels of a mask, for parallel relaxations.
+//
+// The pixel (i,j) gets the color (i + k*j) mod m, where m and k are chosen
+// so that no offset of the stencil joins two pixels of the same color (for
+// the 5-point stencil, this is the red-black ordering).  Thus, all the
+// pixels of a color can be updated in-place at the same time, and they form
+// arithmetic progressions of step m along each run of consecutive pixels
+// of the mask, that can be vectorized.
+//
+// This file needs a function "xmalloc" (e.g., from xmalloc.c).
+
+// smallest number of colors m (and its factor k) for the offsets d[0..n-1]
+static int multicolor_modulus(int *out_k, int (*d)[2], int n)
+{
+	for (int m = 2; ; m++)
+	for (int k = 0; k < m; k++)
+	{
+		int ok = 1;
+		for (int p = 0; ok && p < n; p++)
+			if (((d[p][0] + k * d[p][1]) % m + m) % m == 0)
+				ok = 0;
+		if (ok) {
+			*out_k = k;
+			return m;
+		}
+	}
+}
+
+// number of colors of the stencil of all the offsets with |dx|+|dy| <= r
+static int multicolor_modulus_diamond(int *out_k, int r)
+{
+	int (*d)[2] = xmalloc((2*r+1) * (2*r+1) * sizeof*d), n = 0;
+	for (int dy = -r; dy <= r; dy++)
+	for (int dx = -r; dx <= r; dx++)
+		if ((dx || dy) && abs(dx) + abs(dy) <= r) {
+			d[n][0] = dx;
+			d[n][1] = dy;
+			n += 1;
+		}
+	int m = multicolor_modulus(out_k, d, n);
+	free(d);
+	return m;
+}
+
+// runs of consecutive pixels of a mask given in raster order
+// (r[q] = {j, i0, i1} is the run of the pixels i0 <= i <= i1 of row j)
+static int (*multicolor_runs(int *out_nruns, int (*mask)[2], int n))[3]
+{
+	int (*r)[3] = xmalloc((n + 1) * sizeof*r), nr = 0;
+	for (int p = 0; p < n; p++)
+		if (nr && r[nr-1][0] == mask[p][1] && r[nr-1][2]+1 == mask[p][0])
+			r[nr-1][2] += 1;
+		else {
+			r[nr][0] = mask[p][1];
+			r[nr][1] = r[nr][2] = mask[p][0];
+			nr += 1;
+		}
+	*out_nruns = nr;
+	return r;
+}
+
+// first pixel of the color c in the run r: i0 <= i, and i = c - k*j mod m
+static int multicolor_first(int *r, int c, int m, int k)
+{
+	int i = ((c - k * r[0] - r[1]) % m + m) % m;
+	return r[1] + i;
+}
+
+#endif//_MULTICOLOR_C
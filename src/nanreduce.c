@@ -0,0 +1,186 @@
+#ifndef _NANREDUCE_C
+#define _NANREDUCE_C
+
+// NaN-aware reductions of images by blocks of 2x2 pixels (for pyramids)
+//
+// Each output sample combines the four samples of its block, ignoring the
+// NaNs.  The operations are:
+//
+// 	NANREDUCE_MEAN   average of the non-NaN samples
+// 	NANREDUCE_FMEAN  average of the finite samples
+// 	NANREDUCE_MIN    minimum of the non-NaN samples
+// 	NANREDUCE_MAX    maximum of the non-NaN samples
+// 	NANREDUCE_COUNT  number of non-NaN samples
+// 	NANREDUCE_FIRST  first non-NaN sample, in raster order
+//
+// The result is NaN when all the samples are discarded (except for the
+// count).  The combinations are written without branches, and the rows are
+// processed by separate loops for each operation, so that the compiler can
+// vectorize them.  The rows of the output are computed in parallel.
+//
+// When the input has an odd size, the blocks of the last column or row are
+// incomplete, and their missing samples are given by the "edge" policy:
+//
+// 	NANREDUCE_EDGE_NAN    ignored (they are NaN)
+// 	NANREDUCE_EDGE_ZERO   zero
+// 	NANREDUCE_EDGE_CLAMP  the nearest sample of the image
+
+#include <math.h>
+
+#include "pd_specialize.h"
+
+#define NANREDUCE_MEAN  'v'
+#define NANREDUCE_FMEAN 'V'
+#define NANREDUCE_MIN   'i'
+#define NANREDUCE_MAX   'a'
+#define NANREDUCE_COUNT 'k'
+#define NANREDUCE_FIRST 'f'
+
+#define NANREDUCE_EDGE_NAN   0
+#define NANREDUCE_EDGE_ZERO  1
+#define NANREDUCE_EDGE_CLAMP 2
+
+// combinations of four samples
+static inline float nanreduce_mean(float a, float b, float c, float d)
+{
+	float s = (a == a ? a : 0) + (b == b ? b : 0)
+		+ (c == c ? c : 0) + (d == d ? d : 0);
+	float n = (a == a) + (b == b) + (c == c) + (d == d);
+	return s / (n > 0 ? n : NAN); // (the division is not conditional)
+}
+
+static inline float nanreduce_fmean(float a, float b, float c, float d)
+{
+	int ka = fabsf(a) < INFINITY, kb = fabsf(b) < INFINITY;
+	int kc = fabsf(c) < INFINITY, kd = fabsf(d) < INFINITY;
+	float s = (ka ? a : 0) + (kb ? b : 0) + (kc ? c : 0) + (kd ? d : 0);
+	float n = ka + kb + kc + kd;
+	return s / (n > 0 ? n : NAN); // (the division is not conditional)
+}
+
+static inline float nanreduce_min2(float a, float b)
+{
+	return b < a || a != a ? b : a;
+}
+
+static inline float nanreduce_max2(float a, float b)
+{
+	return b > a || a != a ? b : a;
+}
+
+static inline float nanreduce_min(float a, float b, float c, float d)
+{
+	return nanreduce_min2(nanreduce_min2(a, b), nanreduce_min2(c, d));
+}
+
+static inline float nanreduce_max(float a, float b, float c, float d)
+{
+	return nanreduce_max2(nanreduce_max2(a, b), nanreduce_max2(c, d));
+}
+
+static inline float nanreduce_count(float a, float b, float c, float d)
+{
+	return (a == a) + (b == b) + (c == c) + (d == d);
+}
+
+static inline float nanreduce_first(float a, float b, float c, float d)
+{
+	return a == a ? a : b == b ? b : c == c ? c : d;
+}
+
+static float nanreduce4(float a, float b, float c, float d, int op)
+{
+	switch (op) {
+	case NANREDUCE_MEAN:  return nanreduce_mean(a, b, c, d);
+	case NANREDUCE_FMEAN: return nanreduce_fmean(a, b, c, d);
+	case NANREDUCE_MIN:   return nanreduce_min(a, b, c, d);
+	case NANREDUCE_MAX:   return nanreduce_max(a, b, c, d);
+	case NANREDUCE_COUNT: return nanreduce_count(a, b, c, d);
+	case NANREDUCE_FIRST: return nanreduce_first(a, b, c, d);
+	default: return NAN;
+	}
+}
+
+// whether the operation is one of the above
+static int nanreduce_op_p(int op)
+{
+	return op == NANREDUCE_MEAN || op == NANREDUCE_FMEAN
+		|| op == NANREDUCE_MIN || op == NANREDUCE_MAX
+		|| op == NANREDUCE_COUNT || op == NANREDUCE_FIRST;
+}
+
+// y[i] = the reduction of the pixels 2i and 2i+1 of the rows a and b, for
+// the n complete blocks of a row with pd samples per pixel
+#define NANREDUCE_ROW(f) do {\
+	for (int i = 0; i < n; i++)\
+	for (int l = 0; l < pd; l++)\
+	{\
+		long k = 2L*i*pd + l;\
+		y[i*pd+l] = f(a[k], a[k+pd], b[k], b[k+pd]);\
+	}\
+} while(0)
+
+PD_KERNEL void nanreduce_row_pd(float *y, const float *a, const float *b,
+		int n, int pd, int op)
+{
+	switch (op) {
+	case NANREDUCE_MEAN:  NANREDUCE_ROW(nanreduce_mean);  break;
+	case NANREDUCE_FMEAN: NANREDUCE_ROW(nanreduce_fmean); break;
+	case NANREDUCE_MIN:   NANREDUCE_ROW(nanreduce_min);   break;
+	case NANREDUCE_MAX:   NANREDUCE_ROW(nanreduce_max);   break;
+	case NANREDUCE_COUNT: NANREDUCE_ROW(nanreduce_count); break;
+	case NANREDUCE_FIRST: NANREDUCE_ROW(nanreduce_first); break;
+	default:
+		for (int i = 0; i < n * pd; i++)
+			y[i] = NAN;
+	}
+}
+
+// (the rows of 1 to 4 channels are reduced by specialized loops)
+static void nanreduce_row(float *y, const float *a, const float *b,
+		int n, int pd, int op)
+{
+	PD_SPECIALIZE(pd, nanreduce_row_pd(y, a, b, n, pd, op));
+}
+
+// sample of the image, with the given policy outside of it
+static float nanreduce_sample(const float *x, int w, int h, int pd,
+		int i, int j, int l, int edge)
+{
+	if (i >= w || j >= h) {
+		if (edge == NANREDUCE_EDGE_ZERO) return 0;
+		if (edge != NANREDUCE_EDGE_CLAMP) return NAN;
+		if (i >= w) i = w - 1;
+		if (j >= h) j = h - 1;
+	}
+	return x[(j*(long)w + i)*pd + l];
+}
+
+// reduce the image x of size w x h by 2x2 blocks into y of size ow x oh
+// (ow and oh are the ceilings or the floors of w/2 and h/2)
+static void nanreduce2(float *y, int ow, int oh,
+		const float *x, int w, int h, int pd, int op, int edge)
+{
+	int n = ow < w / 2 ? ow : w / 2; // complete blocks of a row
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < oh; j++)
+	{
+		float *yj = y + j*(long)ow*pd;
+		const float *a = x + 2*j*(long)w*pd;
+		if (2*j + 1 < h)
+			nanreduce_row(yj, a, a + w*(long)pd, n, pd, op);
+		int i0 = 2*j + 1 < h ? n : 0; // the others are incomplete
+		for (int i = i0; i < ow; i++)
+		for (int l = 0; l < pd; l++)
+			yj[i*pd+l] = nanreduce4(
+				nanreduce_sample(x, w, h, pd, 2*i  , 2*j  , l, edge),
+				nanreduce_sample(x, w, h, pd, 2*i+1, 2*j  , l, edge),
+				nanreduce_sample(x, w, h, pd, 2*i  , 2*j+1, l, edge),
+				nanreduce_sample(x, w, h, pd, 2*i+1, 2*j+1, l, edge),
+				op);
+	}
+}
+
+#endif//_NANREDUCE_C
@@ -1,6 +1,7 @@
 // nearest neighbor interpolation
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <math.h>
 
@@ -54,6 +55,9 @@ struct dist_state {
 
 // utility function that always returns a valid pointer to memory
 #include "xmalloc.c"
+
+#define OMIT_EUCDIST_MAIN
+#include "eucdist.c"
 //static void *xmalloc(size_t n)
 //{
 //	void *new = malloc(n);
@@ -248,10 +252,60 @@ void nnint(float *x, int w, int h)
 	free_things(e);
 }
 
+// index of the nearest known pixel of each pixel (-1 if there are none)
+// (this is the feature transform of the linear-time distance transform)
+static void nearest_known_pixel(long *z, float *x, int w, int h)
+{
+	float *d = xmalloc(w*h*sizeof*d);
+	for (int i = 0; i < w*h; i++)
+		d[i] = !isnan(x[i]);
+	squared_euclidean_distance_to_nonzeros_aniso(d, z, w, h, 1, 1);
+	free(d);
+}
+
+// fill-in the NANs of x by nearest neighbor, in linear time
+void nnint_edt(float *x, int w, int h)
+{
+	long *z = xmalloc(w*h*sizeof*z);
+	nearest_known_pixel(z, x, w, h);
+	for (int i = 0; i < w*h; i++) // (in-place, since z[z[i]] = z[i])
+		x[i] = z[i] >= 0 ? x[z[i]] : -1;
+	free(z);
+}
+
+// whether nnint_split uses the front propagation of "nnint"
+static bool global_nnint_propagation = false;
+
 void nnint_split(float *x, int w, int h, int pd)
 {
+	if (global_nnint_propagation) {
+		for (int l = 0; l < pd; l++)
+			nnint(x + w*h*l, w, h);
+		return;
+	}
+
+	// when all the channels have the same holes, fill them at once
+	bool same_holes = true;
+	for (int l = 1; l < pd && same_holes; l++)
+	for (int i = 0; i < w*h; i++)
+		if (isnan(x[i]) != isnan(x[w*h*l+i])) {
+			same_holes = false;
+			break;
+		}
+	if (!same_holes) {
+		for (int l = 0; l < pd; l++)
+			nnint_edt(x + w*h*l, w, h);
+		return;
+	}
+	long *z = xmalloc(w*h*sizeof*z);
+	nearest_known_pixel(z, x, w, h);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int l = 0; l < pd; l++)
-		nnint(x + w*h*l, w, h);
+	for (int i = 0; i < w*h; i++)
+		x[w*h*l+i] = z[i] >= 0 ? x[w*h*l+z[i]] : -1;
+	free(z);
 }
 
 
@@ -265,7 +319,7 @@ static char *help_string_name     = "nnint";
 static char *help_string_version  = "nnint 1.0\n\nWritten by eml";
 static char *help_string_oneliner = "nearest neighbor interpolation";
 static char *help_string_usage    = "usage:\n\t"
-"nnint [-m mask.png] [in.npy [out.npy]]";
+"nnint [-m mask.png] [-p] [in.npy [out.npy]]";
 static char *help_string_long     =
 "Nnint fills-in the missing pixels of an image by nearest-neighbor.\n"
 "\n"
@@ -273,12 +327,16 @@ static char *help_string_long     =
 "a binary mask image can be given.)  For a color image, each pixel\n"
 "dimension is treated independently.\n"
 "\n"
+"The nearest pixels are found by a linear-time distance transform.\n"
+"The option -p uses the older, slower, front propagation instead.\n"
+"\n"
 "Usage: nnint in.npy out.npy\n"
 "   or: nnint in.npy > out.npy\n"
 "   or: cat in.npy | nnint > out.npy\n"
 "\n"
 "Options:\n"
 " -m mask.png\tuse a separate binary mask instead of inline NANs\n"
+" -p\t\tfind the nearest pixels by front propagation\n"
 " -h\t\tdisplay short help message\n"
 " --help\t\tdisplay longer help message\n"
 "\n"
@@ -299,6 +357,7 @@ int main_nnint(int c, char *v[])
 
 	char *filename_mask = pick_option(&c, &v, "m", "");
 	_Bool help_argument = pick_option(&c, &v, "h", 0);
+	global_nnint_propagation = pick_option(&c, &v, "p", 0);
 	if (help_argument || (c != 1 && c != 2 && c != 3)) {
 		fprintf(stderr, "usage:\n\t%s [in.tiff [out.tiff]]\n", *v);
 		//                          0  1        2
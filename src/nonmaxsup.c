@@ -1,7 +1,9 @@
 // non-maximum suppression
 
 #include <math.h>
+#include <stdlib.h>
 
+#include "xmalloc.c"
 #include "smapa.h"
 SMART_PARAMETER(GRADFAC,1)
 
@@ -40,14 +42,215 @@ void non_maximum_suppression(
 	}
 }
 
+// window non-maximum suppression
+//
+// A pixel is a local maximum when it is equal to the maximum of the square
+// window of side 2r+1 around it (so that a plateau gives several maxima),
+// and larger than a threshold.  The maximum of the window is separable, and
+// it is computed by a horizontal and a vertical running maximum (van
+// Herk/Gil-Werman), at a constant cost per pixel.  The image is processed
+// by bands of rows, in parallel, and the vertical pass operates on whole
+// rows, so that it is vectorized.  The NANs and the outside of the image
+// are ignored.
+
+#ifndef NMS_BAND
+#define NMS_BAND 64
+#endif
+
+struct nms_point { float v; int i, j; };
+
+// decreasing score, then increasing position
+static int compare_nms_points(const void *aa, const void *bb)
+{
+	const struct nms_point *a = aa;
+	const struct nms_point *b = bb;
+	if (a->v != b->v) return (a->v < b->v) - (a->v > b->v);
+	if (a->j != b->j) return (a->j > b->j) - (a->j < b->j);
+	return (a->i > b->i) - (a->i < b->i);
+}
+
+static inline float nms_max(float a, float b)
+{
+	return b > a ? b : a; // (no NANs here, so that it is vectorized)
+}
+
+// y[i] = max(x[i-r], ..., x[i+r]) for i in [0, w)
+// (p is a scratch of size 3*(w+2*r))
+static void nms_hmax(float *y, float *x, int w, int r, float *p)
+{
+	int L = 2*r + 1, W = w + 2*r;
+	float *g = p + W, *q = g + W;
+	for (int t = 0; t < W; t++)
+	{
+		float v = t < r || t >= w + r ? NAN : x[t-r];
+		p[t] = isnan(v) ? -INFINITY : v;
+	}
+	for (int t = 0; t < W; t++)
+		g[t] = t % L ? nms_max(g[t-1], p[t]) : p[t];
+	for (int t = W - 1; t >= 0; t--)
+		q[t] = t % L == L-1 || t == W-1 ? p[t] : nms_max(q[t+1], p[t]);
+	for (int i = 0; i < w; i++)
+		y[i] = nms_max(q[i], g[i+L-1]);
+}
+
+// the rows y[j] = max(x[j], ..., x[j+2r]) for j in [0, n), where x has
+// n+2r rows of width w (g and q are scratch rows of the same size as x)
+static void nms_vmax(float *y, float *x, float *g, float *q,
+		int w, int n, int r)
+{
+	int L = 2*r + 1, N = n + 2*r;
+	for (int t = 0; t < N; t++)
+	{
+		float *gt = g + t*(long)w, *xt = x + t*(long)w;
+		if (t % L)
+			for (int i = 0; i < w; i++)
+				gt[i] = nms_max(gt[i-w], xt[i]);
+		else
+			for (int i = 0; i < w; i++)
+				gt[i] = xt[i];
+	}
+	for (int t = N - 1; t >= 0; t--)
+	{
+		float *qt = q + t*(long)w, *xt = x + t*(long)w;
+		if (t % L == L-1 || t == N-1)
+			for (int i = 0; i < w; i++)
+				qt[i] = xt[i];
+		else
+			for (int i = 0; i < w; i++)
+				qt[i] = nms_max(qt[i+w], xt[i]);
+	}
+	for (int j = 0; j < n; j++)
+	{
+		float *yj = y + j*(long)w;
+		float *qj = q + j*(long)w, *gj = g + (j+L-1)*(long)w;
+		for (int i = 0; i < w; i++)
+			yj[i] = nms_max(qj[i], gj[i]);
+	}
+}
+
+// the local maxima of x on windows of side 2r+1 that are larger than t
+//
+// If "o" is given, it is filled with a copy of x with the non-maxima set to
+// 0.  If "k" is not 0, the function returns the list of the k largest
+// maxima (all of them if k < 0), sorted by decreasing value, and their
+// number in "*np" (otherwise, it returns NULL).
+static struct nms_point *window_non_maximum_suppression(float *o, int *np,
+		float *x, int w, int h, int r, float t, int k)
+{
+	if (r < 0) r = 0;
+	struct nms_point *P = NULL;
+	int n = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int j0 = 0; j0 < h; j0 += NMS_BAND)
+	{
+		int nb = h - j0 < NMS_BAND ? h - j0 : NMS_BAND, N = nb + 2*r;
+		float *H = xmalloc((3*N*(long)w + 3*(w + 2*r)) * sizeof*H);
+		float *G = H + N*(long)w, *Q = G + N*(long)w, *p = Q + N*(long)w;
+
+		// horizontal maxima of the rows of the band and of its halo
+		for (int m = 0; m < N; m++)
+			if (j0 + m - r < 0 || j0 + m - r >= h)
+				for (int i = 0; i < w; i++)
+					H[m*(long)w+i] = -INFINITY;
+			else
+				nms_hmax(H + m*(long)w, x + (j0+m-r)*(long)w, w, r, p);
+
+		// vertical maxima (over the first rows of H, that are not read
+		// after the running maxima G and Q)
+		float *M = H;
+		nms_vmax(M, H, G, Q, w, nb, r);
+
+		// local maxima of the band
+		int nl = 0, capacity = 0;
+		struct nms_point *l = NULL;
+		for (int j = 0; j < nb; j++)
+		for (int i = 0; i < w; i++)
+		{
+			long idx = (j0 + j)*(long)w + i;
+			float v = x[idx];
+			int is_max = v == M[j*(long)w+i] && v > t;
+			if (o) o[idx] = is_max ? v : 0;
+			if (!k || !is_max) continue;
+			if (nl == capacity) {
+				capacity = 2*capacity + 64;
+				l = xrealloc(l, capacity * sizeof*l);
+			}
+			l[nl++] = (struct nms_point){v, i, j0 + j};
+			if (k > 0 && nl == 2*k + 64) { // keep the k largest
+				qsort(l, nl, sizeof*l, compare_nms_points);
+				nl = k;
+			}
+		}
+		if (k > 0 && nl > k) {
+			qsort(l, nl, sizeof*l, compare_nms_points);
+			nl = k;
+		}
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+		if (nl) {
+			P = xrealloc(P, (n + nl) * sizeof*P);
+			for (int q = 0; q < nl; q++)
+				P[n+q] = l[q];
+			n += nl;
+		}
+		free(l);
+		free(H);
+	}
+
+	if (k)
+		qsort(P, n, sizeof*P, compare_nms_points);
+	if (k > 0 && n > k)
+		n = k;
+	if (np) *np = n;
+	return P;
+}
+
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
+#include "pickopt.c"
 int main(int c, char *v[])
 {
+	// window mode, "-r radius [-t threshold] [-k number] scal [out]"
+	int radius = atoi(pick_option(&c, &v, "r", "-1"));
+	float threshold = atof(pick_option(&c, &v, "t", "-inf"));
+	int k = atoi(pick_option(&c, &v, "k", "0"));
+	if (radius >= 0 && (c == 2 || c == 3)) {
+		char *filename_in  = v[1];
+		char *filename_out = c > 2 ? v[2] : "-";
+		int w, h, pd;
+		float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
+		if (pd != 1)
+			fail("nonmaxsup: the image has %d channels", pd);
+		float *z = k ? NULL : xmalloc(w * (long)h * sizeof*z);
+		int n;
+		struct nms_point *p = window_non_maximum_suppression(z, &n,
+				x, w, h, radius, threshold, k);
+		if (k) { // list of points "i j value"
+			FILE *f = strcmp(filename_out, "-") ?
+				fopen(filename_out, "w") : stdout;
+			if (!f) fail("nonmaxsup: could not open \"%s\"",
+					filename_out);
+			for (int i = 0; i < n; i++)
+				fprintf(f, "%d %d %.9g\n", p[i].i, p[i].j, p[i].v);
+			if (f != stdout) fclose(f);
+		} else
+			iio_write_image_float_vec(filename_out, z, w, h, 1);
+		free(p);
+		free(x);
+		free(z);
+		return 0;
+	}
+
 	// process input arguments
 	if (c != 4)
-		return fprintf(stderr, "usage:\n\t%s scal vect outscal\n", *v);
+		return fprintf(stderr, "usage:\n\t%s scal vect outscal\n"
+			"\t%s -r radius [-t threshold] [-k number] scal [out]\n",
+			*v, *v);
 		//                                 0 1    2    3
 	char *filename_scal = v[1];
 	char *filename_vect = v[2];
@@ -1,7 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "iio.h"
 
+// replicate each pixel of h rows n times in both directions: the rows are
+// built once, then copied n-1 times
+static void ntiply_rows(float *y, float *x, int w, int h, int pd, int n)
+{
+	size_t m = (size_t)n * w * pd; // samples of an output row
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	{
+		float *yj = y + n * j * m, *xj = x + pd * (size_t)w * j;
+		for (int i = 0; i < w; i++)
+		for (int k = 0; k < n; k++)
+		for (int l = 0; l < pd; l++)
+			yj[pd*(n*i+k)+l] = xj[pd*i+l];
+		for (int k = 1; k < n; k++)
+			memcpy(yj + k * m, yj, m * sizeof*yj);
+	}
+}
+
 int main_ntiply(int c, char *v[])
 {
 	if (c != 2 && c != 4 && c != 3) {
@@ -12,15 +33,32 @@ int main_ntiply(int c, char *v[])
 	int n = atof(v[1]);
 	char *in = c > 2 ? v[2] : "-";
 	char *out = c > 3 ? v[3] : "-";
+	if (n < 1) {
+		fprintf(stderr, "ntiply: bad factor \"%s\"\n", v[1]);
+		return EXIT_FAILURE;
+	}
 
+	// the image is read and written by bands of (about 16MB of) output rows
 	int w, h, pd;
-	float *x = iio_read_image_float_vec(in, &w, &h, &pd);
-	float *y = malloc(n*n*w*h*pd*sizeof*y);
-	for (int j = 0; j < n*h; j++)
-	for (int i = 0; i < n*w; i++)
-	for (int l = 0; l < pd; l++)
-		y[pd*(n*w*j+i)+l] = x[pd*(w*(j/n)+i/n)+l];
-	iio_write_image_float_vec(out, y, n*w, n*h, pd);
+	struct iio_stream *s = iio_open(in, &w, &h, &pd);
+	if (!s) {
+		fprintf(stderr, "ntiply: cannot read image \"%s\"\n", in);
+		return EXIT_FAILURE;
+	}
+	int band = (1 << 22) / ((double)n * n * w * pd);
+	if (band < 1) band = 1;
+	if (band > h) band = h;
+	float *x = malloc(w * (size_t)band * pd * sizeof*x);
+	float *y = malloc(n * (size_t)n * w * band * pd * sizeof*y);
+	struct iio_ostream *o = iio_create(out, n*w, n*h, pd);
+	for (int j = 0; j < h; j += band)
+	{
+		int r = iio_read_rows(s, x, j, band);
+		ntiply_rows(y, x, w, r, pd, n);
+		iio_write_rows(o, y, n * r);
+	}
+	iio_close(s);
+	iio_finish(o);
 	free(x);
 	free(y);
 	return EXIT_SUCCESS;
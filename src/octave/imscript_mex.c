@@ -0,0 +1,425 @@
+// imscript.mex: the core kernels of imscript, called directly on the
+// matrices of octave (or matlab)
+//
+//	y = imscript("blur", x, "gaussian", 2);
+//	z = imscript("morsi", y, "disk3", "median");
+//	w = imscript("plambda", "x y - fabs", y, z);
+//
+// The functions are those of the python module (see
+// src/python/imscript/imscript.py), with the same arguments:
+//
+//	y = imscript("blur", x, kernel, p1, p2, ...)
+//	y = imscript("morsi", x, element, operation)
+//	y = imscript("downsa", x, n [, type])            type="v", "e", ...
+//	y = imscript("upsa", x, n [, type [, dx, dy]])   type=2, 0, 3, ...
+//	y = imscript("homwarp", x, H [, [h w] [, order]])
+//	y = imscript("plambda", expression, x1, x2, ...)
+//	p = imscript("compile", expression, n)   (of n images)
+//	y = imscript("run", p, x1, ..., xn)
+//	    imscript("free", p)
+//	x = imscript("iio_read", filename)
+//	    imscript("iio_write", filename, x)
+//
+// The images are arrays of size h x w x pd, of any real numeric class (as
+// those of "imread"), and the results are arrays of class single.  Octave
+// stores the arrays by columns, and the channels one after another, while
+// the kernels need the samples of each pixel contiguous, by rows (see
+// src/lib/imscript.h).  Thus each input is converted once into a buffer of
+// floats, the kernel runs directly on the buffers, and the result is
+// converted back once.  The conversions are done in parallel, by rows.
+//
+// The kernels are those of the shared library "libimscript.so", which must
+// be found at run time (e.g., in LD_LIBRARY_PATH).  Build it with "make
+// octave" (for octave, by mkoctfile), or from matlab with
+//
+//	mex -Isrc/lib -Isrc src/octave/imscript_mex.c -Lbin -limscript
+//
+// Invalid arguments raise errors of octave, but other errors of the kernels
+// (e.g., out of memory) end the process, as in the command line tools.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mex.h"
+
+#include "imscript.h"
+#include "iio.h"
+
+// internal: the sample k of the numeric array of data d and class c
+static inline float mex_sample(const void *d, mxClassID c, long k)
+{
+	switch (c) {
+	case mxDOUBLE_CLASS:  return ((const double   *)d)[k];
+	case mxSINGLE_CLASS:  return ((const float    *)d)[k];
+	case mxINT8_CLASS:    return ((const int8_t   *)d)[k];
+	case mxUINT8_CLASS:   return ((const uint8_t  *)d)[k];
+	case mxINT16_CLASS:   return ((const int16_t  *)d)[k];
+	case mxUINT16_CLASS:  return ((const uint16_t *)d)[k];
+	case mxINT32_CLASS:   return ((const int32_t  *)d)[k];
+	case mxUINT32_CLASS:  return ((const uint32_t *)d)[k];
+	case mxINT64_CLASS:   return ((const int64_t  *)d)[k];
+	case mxUINT64_CLASS:  return ((const uint64_t *)d)[k];
+	case mxLOGICAL_CLASS: return ((const mxLogical*)d)[k];
+	default: return 0;
+	}
+}
+
+// internal: buffer of floats for an image (freed by octave at the end of
+// the call)
+static float *mex_buffer(int w, int h, int pd)
+{
+	size_t n = w * (size_t)h * pd;
+	return mxMalloc((n ? n : 1) * sizeof(float));
+}
+
+// internal: an image, with the samples of each pixel contiguous
+struct mex_image {
+	int w, h, pd;
+	bool flat; // whether the array was two-dimensional
+	float *x;  // (allocated by mxMalloc)
+};
+
+// internal: convert the array a into an image
+static void mex_image(struct mex_image *i, const mxArray *a, char *what)
+{
+	mwSize n = mxGetNumberOfDimensions(a);
+	const mwSize *s = mxGetDimensions(a);
+	mxClassID c = mxGetClassID(a);
+	if ((!mxIsNumeric(a) && !mxIsLogical(a)) || mxIsComplex(a)
+			|| mxIsSparse(a) || n > 3)
+		mexErrMsgIdAndTxt("imscript:args", "imscript: %s must be a real"
+				" array of size h x w x pd", what);
+	int w = i->w = s[1], h = i->h = s[0], pd = i->pd = n > 2 ? s[2] : 1;
+	i->flat = n < 3;
+	float *x = i->x = mex_buffer(w, h, pd);
+	const void *d = mxGetData(a);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int k = 0; k < w; k++)
+	for (int l = 0; l < pd; l++)
+		x[(j*(long)w + k)*pd + l] = mex_sample(d, c,
+				j + h*(k + (long)w*l));
+}
+
+// internal: new array of class single of size h x w x pd (h x w when pd=1
+// and flat), with the samples of the image y
+static mxArray *mex_array(float *y, int w, int h, int pd, bool flat)
+{
+	mwSize s[3] = {h, w, pd};
+	mxArray *a = mxCreateNumericArray(pd == 1 && flat ? 2 : 3, s,
+			mxSINGLE_CLASS, mxREAL);
+	float *o = mxGetData(a);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int k = 0; k < w; k++)
+	for (int l = 0; l < pd; l++)
+		o[j + h*(k + (long)w*l)] = y[(j*(long)w + k)*pd + l];
+	return a;
+}
+
+// internal: the string of the argument a (freed by octave at the end of the
+// call)
+static char *mex_string(const mxArray *a, char *what)
+{
+	char *s = mxIsChar(a) ? mxArrayToString(a) : NULL;
+	if (!s)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: %s must be a string", what);
+	return s;
+}
+
+static double mex_scalar(const mxArray *a, char *what)
+{
+	if ((!mxIsNumeric(a) && !mxIsLogical(a))
+			|| mxGetNumberOfElements(a) < 1)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: %s must be a number", what);
+	return mxGetScalar(a);
+}
+
+static void mex_check(int r, char *name)
+{
+	if (r)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: bad arguments for %s (%d)", name, r);
+}
+
+static void mex_nargs(int nrhs, int lo, int hi, char *usage)
+{
+	if (nrhs < lo || nrhs > hi)
+		mexErrMsgIdAndTxt("imscript:args", "usage: %s", usage);
+}
+
+// API
+
+static void mex_blur(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 2, 100,
+			"y = imscript(\"blur\", x, kernel, p1, ...)");
+	struct mex_image x;
+	mex_image(&x, prhs[0], "x");
+	char *kernel = mex_string(prhs[1], "the kernel");
+	int np = nrhs > 2 ? nrhs - 2 : 1;
+	float p[100] = {1};
+	for (int i = 0; i < nrhs - 2; i++)
+		p[i] = mex_scalar(prhs[2+i], "a parameter");
+	float *y = mex_buffer(x.w, x.h, x.pd);
+	mex_check(imscript_blur(y, x.x, x.w, x.h, x.pd, kernel, p, np),
+			"blur");
+	plhs[0] = mex_array(y, x.w, x.h, x.pd, x.flat);
+}
+
+static void mex_morsi(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 3, 3,
+			"y = imscript(\"morsi\", x, element, operation)");
+	struct mex_image x;
+	mex_image(&x, prhs[0], "x");
+	char *element = mex_string(prhs[1], "the element");
+	char *operation = mex_string(prhs[2], "the operation");
+	int pd = strcmp(operation, "all") ? x.pd : 13 * x.pd;
+	float *y = mex_buffer(x.w, x.h, pd);
+	mex_check(imscript_morsi(y, x.x, x.w, x.h, x.pd, element, operation),
+			"morsi");
+	plhs[0] = mex_array(y, x.w, x.h, pd, x.flat);
+}
+
+static void mex_downsa(int nlhs, mxArray **plhs, int nrhs,
+		const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 2, 3, "y = imscript(\"downsa\", x, n [, type])");
+	struct mex_image x;
+	mex_image(&x, prhs[0], "x");
+	int n = mex_scalar(prhs[1], "n");
+	char *type = nrhs > 2 ? mex_string(prhs[2], "the type") : "v";
+	if (n < 1)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: bad factor %d", n);
+	int w = x.w / n, h = x.h / n;
+	float *y = mex_buffer(w, h, x.pd);
+	mex_check(imscript_downsa(y, x.x, x.w, x.h, x.pd, n, *type),
+			"downsa");
+	plhs[0] = mex_array(y, w, h, x.pd, x.flat);
+}
+
+static void mex_upsa(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 2, 5,
+			"y = imscript(\"upsa\", x, n [, type [, dx, dy]])");
+	struct mex_image x;
+	mex_image(&x, prhs[0], "x");
+	int n = mex_scalar(prhs[1], "n");
+	int type = nrhs > 2 ? mex_scalar(prhs[2], "the type") : 2;
+	float dx = nrhs > 3 ? mex_scalar(prhs[3], "dx") : 0;
+	float dy = nrhs > 4 ? mex_scalar(prhs[4], "dy") : 0;
+	if (n < 1)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: bad factor %d", n);
+	int w = n * x.w - n, h = n * x.h - n;
+	float *y = mex_buffer(w, h, x.pd);
+	mex_check(imscript_upsa(y, x.x, x.w, x.h, x.pd, n, type, dx, dy),
+			"upsa");
+	plhs[0] = mex_array(y, w, h, x.pd, x.flat);
+}
+
+static void mex_homwarp(int nlhs, mxArray **plhs, int nrhs,
+		const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 2, 4,
+			"y = imscript(\"homwarp\", x, H [, [h w] [, order]])");
+	struct mex_image x, H;
+	mex_image(&x, prhs[0], "x");
+	mex_image(&H, prhs[1], "H");
+	if (H.w * H.h * H.pd != 9)
+		mexErrMsgIdAndTxt("imscript:args", "imscript: H must be 3x3");
+	double M[9]; // (by rows)
+	for (int i = 0; i < 9; i++)
+		M[i] = H.x[i];
+	int w = x.w, h = x.h;
+	if (nrhs > 2 && mxGetNumberOfElements(prhs[2]) > 0) {
+		struct mex_image s;
+		mex_image(&s, prhs[2], "the size");
+		if (s.w * s.h * s.pd != 2)
+			mexErrMsgIdAndTxt("imscript:args",
+					"imscript: the size must be [h w]");
+		h = s.x[0];
+		w = s.x[1];
+	}
+	int order = nrhs > 3 ? mex_scalar(prhs[3], "the order") : -3;
+	if (w < 1 || h < 1)
+		mexErrMsgIdAndTxt("imscript:args", "imscript: bad size %dx%d",
+				w, h);
+	float *y = mex_buffer(w, h, x.pd);
+	mex_check(imscript_homwarp(y, w, h, M, x.x, x.w, x.h, x.pd, order),
+			"homwarp");
+	plhs[0] = mex_array(y, w, h, x.pd, x.flat);
+}
+
+// compiled plambda expressions, given to octave as uint64 handles
+#define MEX_PROGRAM_MAGIC 0x706c616d // "plam"
+struct mex_program {
+	int magic, n;
+	void *p;
+};
+
+static struct mex_program *mex_program(const mxArray *a)
+{
+	struct mex_program *p = NULL;
+	if (mxGetClassID(a) == mxUINT64_CLASS && mxGetNumberOfElements(a) == 1)
+		p = (void *)(uintptr_t)*(uint64_t *)mxGetData(a);
+	if (!p || p->magic != MEX_PROGRAM_MAGIC)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: not a compiled expression");
+	return p;
+}
+
+static void mex_compile(int nlhs, mxArray **plhs, int nrhs,
+		const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 1, 2, "p = imscript(\"compile\", expression [, n])");
+	char *e = mex_string(prhs[0], "the expression");
+	int n = nrhs > 1 ? mex_scalar(prhs[1], "n") : 1;
+	if (n < 1)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: a program needs an image");
+	void *q = imscript_plambda_compile(e, n);
+	if (!q)
+		mexErrMsgIdAndTxt("imscript:args", "imscript: the expression "
+				"\"%s\" does not have %d variables", e, n);
+	struct mex_program *p = malloc(sizeof*p); // (until "free")
+	if (!p)
+		mexErrMsgIdAndTxt("imscript:memory", "imscript: out of memory");
+	p->magic = MEX_PROGRAM_MAGIC;
+	p->n = n;
+	p->p = q;
+	plhs[0] = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+	*(uint64_t *)mxGetData(plhs[0]) = (uintptr_t)p;
+}
+
+static void mex_free(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs)
+{
+	(void)nlhs; (void)plhs;
+	mex_nargs(nrhs, 1, 1, "imscript(\"free\", p)");
+	struct mex_program *p = mex_program(prhs[0]);
+	imscript_plambda_free(p->p);
+	p->magic = 0;
+	free(p);
+}
+
+static void mex_run_program(mxArray **plhs, struct mex_program *p,
+		int n, const mxArray **prhs)
+{
+	if (n != p->n)
+		mexErrMsgIdAndTxt("imscript:args",
+				"imscript: %d images expected", p->n);
+	struct mex_image *x = mxMalloc(n * sizeof*x);
+	float **v = mxMalloc(n * sizeof*v);
+	int *w = mxMalloc(n * sizeof*w);
+	int *h = mxMalloc(n * sizeof*h);
+	int *pd = mxMalloc(n * sizeof*pd);
+	for (int i = 0; i < n; i++)
+	{
+		mex_image(x + i, prhs[i], "each image");
+		if (x[i].w != x[0].w || x[i].h != x[0].h)
+			mexErrMsgIdAndTxt("imscript:args",
+					"imscript: images of different sizes");
+		v[i] = x[i].x;
+		w[i] = x[i].w;
+		h[i] = x[i].h;
+		pd[i] = x[i].pd;
+	}
+	int opd = imscript_plambda_dim(p->p, v, w, h, pd);
+	float *y = mex_buffer(w[0], h[0], opd);
+	mex_check(imscript_plambda_run(p->p, y, opd, v, w, h, pd, 0),
+			"plambda");
+	plhs[0] = mex_array(y, w[0], h[0], opd, x[0].flat);
+}
+
+static void mex_run(int nlhs, mxArray **plhs, int nrhs, const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 2, 1000, "y = imscript(\"run\", p, x1, ..., xn)");
+	mex_run_program(plhs, mex_program(prhs[0]), nrhs - 1, prhs + 1);
+}
+
+static void mex_plambda(int nlhs, mxArray **plhs, int nrhs,
+		const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 2, 1000, "y = imscript(\"plambda\", expr, x1, ...)");
+	char *e = mex_string(prhs[0], "the expression");
+	struct mex_program p = {MEX_PROGRAM_MAGIC, nrhs - 1, NULL};
+	p.p = imscript_plambda_compile(e, p.n);
+	if (!p.p)
+		mexErrMsgIdAndTxt("imscript:args", "imscript: the expression "
+				"\"%s\" does not have %d variables", e, p.n);
+	mex_run_program(plhs, &p, p.n, prhs + 1);
+	imscript_plambda_free(p.p);
+}
+
+static void mex_iio_read(int nlhs, mxArray **plhs, int nrhs,
+		const mxArray **prhs)
+{
+	(void)nlhs;
+	mex_nargs(nrhs, 1, 1, "x = imscript(\"iio_read\", filename)");
+	char *f = mex_string(prhs[0], "the filename");
+	int w, h, pd;
+	float *x = iio_read_image_float_vec(f, &w, &h, &pd);
+	if (!x)
+		mexErrMsgIdAndTxt("imscript:iio",
+				"imscript: could not read image \"%s\"", f);
+	plhs[0] = mex_array(x, w, h, pd, true);
+	free(x);
+}
+
+static void mex_iio_write(int nlhs, mxArray **plhs, int nrhs,
+		const mxArray **prhs)
+{
+	(void)nlhs; (void)plhs;
+	mex_nargs(nrhs, 2, 2, "imscript(\"iio_write\", filename, x)");
+	char *f = mex_string(prhs[0], "the filename");
+	struct mex_image x;
+	mex_image(&x, prhs[1], "x");
+	iio_write_image_float_vec(f, x.x, x.w, x.h, x.pd);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	static struct {
+		char *name;
+		void (*f)(int, mxArray **, int, const mxArray **);
+	} t[] = {
+		{"blur", mex_blur},       {"morsi", mex_morsi},
+		{"downsa", mex_downsa},   {"upsa", mex_upsa},
+		{"homwarp", mex_homwarp}, {"plambda", mex_plambda},
+		{"compile", mex_compile}, {"run", mex_run},
+		{"free", mex_free},       {"iio_read", mex_iio_read},
+		{"iio_write", mex_iio_write},
+	};
+	if (nrhs < 1 || !mxIsChar(prhs[0]))
+		mexErrMsgIdAndTxt("imscript:args", "usage: "
+			"imscript(function, arguments...), with function "
+			"blur|morsi|downsa|upsa|homwarp|plambda|compile|"
+			"run|free|iio_read|iio_write");
+	char *name = mxArrayToString(prhs[0]);
+	for (unsigned i = 0; i < sizeof t / sizeof*t; i++)
+		if (name && !strcmp(name, t[i].name)) {
+			mxFree(name);
+			t[i].f(nlhs, plhs, nrhs - 1, prhs + 1);
+			return;
+		}
+	mexErrMsgIdAndTxt("imscript:args", "imscript: unknown function \"%s\"",
+			name ? name : "");
+}
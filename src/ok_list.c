@@ -3,9 +3,19 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /* data structure and operations to maintain a finite set of points belonging
  * to a finite set of disjoint squares (or cubes).  Points and regions are
- * identified only by their inidices. */
+ * identified only by their inidices.
+ *
+ * The points can also be added all at once (ok_build), by a counting sort
+ * that stores the points of each region contiguously ("ro" and "ri", as in a
+ * compressed sparse row matrix), so that the queries scan contiguous memory.
+ * The linked lists are kept consistent, so that the points can still be added
+ * or removed afterwards (adding a point drops the contiguous layout). */
 
 
 struct ok_list {
@@ -15,6 +25,8 @@ struct ok_list {
 	int *p;		// gives the region that contains each point
 	int *plist;	// linked lists of points (by regions)
 	int *buf;	// buffer to return lists of points
+	int *ro;	// contiguous layout (or NULL): the points of region r
+	int *ri;	// are ri[ro[r]], ..., ri[ro[r+1]-1]
 
 	// optional geometrical data useful when the regions are
 	// the rectangles of a grid:
@@ -107,6 +119,7 @@ void ok_init(struct ok_list *l, int nr, int np)
 	l->p =     xmalloc(np * sizeof(*l->p));
 	l->plist = xmalloc(np * sizeof(*l->p));
 	l->buf =   xmalloc(np * sizeof(*l->p));
+	l->ro = l->ri = NULL;
 	FORI(l->number_of_regions)
 		l->r[i] = INULL;
 	FORI(l->number_of_points)
@@ -124,6 +137,9 @@ void ok_free(struct ok_list *l)
 	xfree(l->p);
 	xfree(l->plist);
 	xfree(l->buf);
+	if (l->ro) xfree(l->ro);
+	if (l->ri) xfree(l->ri);
+	l->ro = l->ri = NULL;
 	l->number_of_regions = l->number_of_points = 0;
 }
 
@@ -137,7 +153,13 @@ int ok_which_points(struct ok_list *l, int r)
 		fail("ok_which_points (r=%d, num_of_regions=%d)", r, l->number_of_regions);
 	assert(r < l->number_of_regions);
 	int cx = 0, p = l->r[r];
-	if (p != INULL)
+	if (l->ro)
+	{
+		for (int k = l->ro[r]; k < l->ro[r+1]; k++)
+			if (l->p[l->ri[k]] != REMOVED)
+				l->buf[cx++] = l->ri[k];
+	}
+	else if (p != INULL)
 	{
 		if (l->p[p] != REMOVED)
 			l->buf[cx++] = p;
@@ -231,6 +253,13 @@ void ok_add_point(struct ok_list *l, int r, int p)
 
 	DEBUG("{{{}}} ADDing point %d to region %d\n", p, r);
 
+	if (l->ro)
+	{
+		xfree(l->ro);
+		xfree(l->ri);
+		l->ro = l->ri = NULL;
+	}
+
 	if (l->r[r] == INULL)
 	{
 		l->r[r] = p;
@@ -247,6 +276,95 @@ void ok_add_point(struct ok_list *l, int r, int p)
 #endif
 }
 
+// points of the region r in the contiguous layout (including the removed
+// ones, which have l->p[i] == REMOVED), or NULL if there is no such layout
+static
+int *ok_region_points(struct ok_list *l, int r, int *n)
+{
+	assert(r >= 0);
+	assert(r < l->number_of_regions);
+	if (!l->ro) return *n = 0, NULL;
+	*n = l->ro[r+1] - l->ro[r];
+	return l->ri + l->ro[r];
+}
+
+// add the points 0..np-1 to the regions region[0..np-1] at once (negative
+// regions are skipped), on an empty ok_list; the points of each region are
+// listed in the same order as if they were added one by one
+static
+void ok_build(struct ok_list *l, int *region, int np)
+{
+	int nr = l->number_of_regions;
+	assert(np <= l->number_of_points);
+	FORI(np)
+		if (region[i] >= nr || l->p[i] != INULL)
+			fail("ok_build: bad region %d for point %d", region[i], i);
+
+	// counting sort, by chunks of points (the latest chunks go first)
+	int nt = 1;
+#ifdef _OPENMP
+	nt = omp_get_max_threads();
+#endif
+	if (nt > 1 && np < 4096 * nt) nt = 1 + np / 4096;
+	if (nt > 1 && (long)nt * nr > 8L * np) nt = 1;
+	int cn = (np + nt - 1) / nt;
+	int *c = xmalloc((nt * (long)nr + 1) * sizeof*c);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt)
+#endif
+	for (int t = 0; t < nt; t++)
+	{
+		int *ct = c + t * (long)nr;
+		for (int r = 0; r < nr; r++)
+			ct[r] = 0;
+		int e = (t + 1) * cn < np ? (t + 1) * cn : np;
+		for (int i = t * cn; i < e; i++)
+			if (region[i] >= 0)
+				ct[region[i]] += 1;
+	}
+	l->ro = xmalloc((nr + 1) * sizeof*l->ro);
+	int s = 0;
+	for (int r = 0; r < nr; r++)
+	{
+		l->ro[r] = s;
+		for (int t = nt - 1; t >= 0; t--)
+		{
+			int k = c[t * (long)nr + r];
+			c[t * (long)nr + r] = s;
+			s += k;
+		}
+	}
+	l->ro[nr] = s;
+	l->ri = xmalloc((s + 1) * sizeof*l->ri);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nt)
+#endif
+	for (int t = 0; t < nt; t++)
+	{
+		int *ct = c + t * (long)nr;
+		int e = (t + 1) * cn < np ? (t + 1) * cn : np;
+		for (int i = e - 1; i >= t * cn; i--)
+			if (region[i] >= 0)
+			{
+				l->ri[ct[region[i]]++] = i;
+				l->p[i] = region[i];
+			}
+	}
+	xfree(c);
+
+	// the linked lists, in the same order
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int r = 0; r < nr; r++)
+	{
+		int a = l->ro[r], b = l->ro[r+1];
+		l->r[r] = a < b ? l->ri[a] : INULL;
+		for (int k = a; k < b; k++)
+			l->plist[l->ri[k]] = k + 1 < b ? l->ri[k+1] : l->ri[k];
+	}
+}
+
 //#ifdef USE_IMAGE_STRUCTURES
 
 // input: fill x0, dx and nx
@@ -29,6 +29,11 @@
 // The first step is an affine function followed by a rounding, and the second
 // step is the evaluation of a look-up table.  The proposed implementation is
 // kept simple and the size of the look-up table is fixed.
+//
+// Two more entries of the table hold the colors of NAN (black) and of the
+// infinities (white), so that the images are colorized without branches: a
+// first loop computes the indices of a run of samples (this loop is
+// vectorized by the compiler), and a second loop copies the colors.
 
 
 
@@ -37,8 +42,11 @@
 #include "xmalloc.c"
 #include "xfopen.c"
 
+#define PALETTE_NAN (PALSAMPLES)
+#define PALETTE_INF (PALSAMPLES+1)
+
 struct palette {
-	uint8_t t[3*PALSAMPLES];
+	uint8_t t[3*(PALSAMPLES+2)];
 	float m, M;
 };
 
@@ -254,6 +262,11 @@ static void fill_palette(struct palette *p, char *s, float m, float M)
 		fill_palette_with_nodes(p, nodes, nnodes);
 	}
 	else fail("unrecognized palette \"%s\"", s);
+	for (int j = 0; j < 3; j++)
+	{
+		p->t[3*PALETTE_NAN+j] = 0;
+		p->t[3*PALETTE_INF+j] = 255;
+	}
 }
 
 static void get_palette_color(uint8_t *rgb, struct palette *p, float x)
@@ -274,8 +287,43 @@ static void get_palette_color(uint8_t *rgb, struct palette *p, float x)
 	rgb[2] = p->t[3*ix+2];
 }
 
+// indices in the palette of n samples (same as "get_palette_color")
+static void get_palette_indices(int *ix, struct palette *p, float *x, int n)
+{
+	float m = p->m, d = p->M - p->m;
+	for (int i = 0; i < n; i++)
+	{
+		// twice the position, to round it by integers: (floor(2t)+1)/2
+		float t = 2*((PALSAMPLES-1)*(x[i] - m)/d);
+		t = t > 0 ? t : 0;                           // also for NAN
+		t = t < 2*(PALSAMPLES-1) ? t : 2*(PALSAMPLES-1);
+		int k = ((int)t + 1) >> 1;
+		k = fabsf(x[i]) == INFINITY ? PALETTE_INF : k;
+		ix[i] = x[i] != x[i] ? PALETTE_NAN : k;
+	}
+}
+
+// colors of n samples
+static void get_palette_colors(uint8_t *y, struct palette *p, float *x, int n)
+{
+	int ix[PALSAMPLES];
+	for (int i = 0; i < n; i += PALSAMPLES)
+	{
+		int r = n - i < PALSAMPLES ? n - i : PALSAMPLES;
+		get_palette_indices(ix, p, x + i, r);
+		uint8_t *t = p->t, *yi = y + 3*i;
+		for (int k = 0; k < r; k++)
+		{
+			yi[3*k+0] = t[3*ix[k]+0];
+			yi[3*k+1] = t[3*ix[k]+1];
+			yi[3*k+2] = t[3*ix[k]+2];
+		}
+	}
+}
+
 #include "smapa.h"
 SMART_PARAMETER_SILENT(PALMAXEPS,0)
+SMART_PARAMETER_SILENT(PALETTE_BAND_MB,64)
 
 static void get_min_max(float *min, float *max, float *x, int n)
 {
@@ -379,6 +427,25 @@ void parse_from_to(float *out_from, float *out_to, float *x, int n,
 	}
 }
 
+// whether "parse_from_to" needs the samples of the image
+static bool from_to_need_image(char *from_id, char *to_id)
+{
+	char *mp, *Mp;
+	float m = strtof(from_id, &mp);
+	float M = strtof(to_id,   &Mp);
+	return *mp == '%' || *Mp == '%' || !isfinite(m) || !isfinite(M);
+}
+
+static void apply_palette_struct(uint8_t *y, float *x, int n, struct palette *p)
+{
+	int b = 0x10000; // samples per task
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i = 0; i < n; i += b)
+		get_palette_colors(y + 3*(size_t)i, p, x + i, n - i < b ? n - i : b);
+}
+
 void apply_palette(uint8_t *y, float *x, int n, char *s, float m, float M)
 {
 	struct palette p[1];
@@ -386,8 +453,7 @@ void apply_palette(uint8_t *y, float *x, int n, char *s, float m, float M)
 
 	//fprint_palette(stderr, p);
 
-	for (int i = 0; i < n; i++)
-		get_palette_color(y + 3*i, p, x[i]);
+	apply_palette_struct(y, x, n, p);
 }
 
 
@@ -638,14 +704,41 @@ int main_palette(int c, char *v[])
 	char *filename_in = c > 4 ? v[4] : "-";
 	char *filename_out = c > 5 ? v[5] : "-";
 
-	int w, h;
-	float *x = iio_read_image_float(filename_in, &w, &h);
-	uint8_t *y = xmalloc(3*w*h);
-
+	// known range and gray image in a file: colorize it by bands of rows
+	int w, h, pd = 0;
+	float *x;
+	uint8_t *y;
 	float from, to;
-	parse_from_to(&from, &to, x, w*h, from_id, to_id);
-	//fprintf(stderr, "from=%g to=%g\n", from, to);
-	apply_palette(y, x, w*h, palette_id, from, to);
+	struct iio_stream *s = NULL;
+	if (strcmp(filename_in, "-") && !from_to_need_image(from_id, to_id))
+	{
+		s = iio_open(filename_in, &w, &h, &pd);
+		if (s && pd != 1) // color images are converted to gray by iio
+			iio_close(s);
+	}
+	if (pd == 1)
+	{
+		parse_from_to(&from, &to, NULL, 0, from_id, to_id);
+		struct palette p[1];
+		fill_palette(p, palette_id, from, to);
+		int band = PALETTE_BAND_MB() * 1024 * 1024 / (4.0 * w);
+		if (band < 1) band = 1;
+		if (band > h) band = h;
+		x = xmalloc(w * (size_t)band * sizeof*x);
+		y = xmalloc(3 * (size_t)w * h);
+		for (int j = 0; j < h; j += band)
+		{
+			int n = iio_read_rows(s, x, j, band);
+			apply_palette_struct(y + 3*(size_t)w*j, x, w * n, p);
+		}
+		iio_close(s);
+	} else {
+		x = iio_read_image_float(filename_in, &w, &h);
+		y = xmalloc(3 * (size_t)w * h);
+		parse_from_to(&from, &to, x, w*h, from_id, to_id);
+		//fprintf(stderr, "from=%g to=%g\n", from, to);
+		apply_palette(y, x, w*h, palette_id, from, to);
+	}
 
 	if (*filename_legend) {
 		int lw, lh;
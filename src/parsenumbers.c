@@ -1,27 +1,101 @@
 #ifndef _PARSENUMBERS_C
 #define _PARSENUMBERS_C
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "xmalloc.c"
 
+// utility function: parse a number like "strtod" (or "strtof", if "single")
+// in the C locale.  Plain decimal numbers with few significant digits are
+// converted exactly by a single operation with a power of ten, the other
+// numbers are left to the C library.  (Same method as the text readers of
+// iio.c.)
+inline static
+double parse_number_fast(const char *s, char **e, bool single)
+{
+	static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+		1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+		1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *p = s;
+	while (*p == ' ' || (*p >= '\t' && *p <= '\r')) p++;
+	bool neg = *p == '-';
+	if (*p == '-' || *p == '+') p++;
+	uint64_t m = 0;
+	int nd = 0, nz = 0, ex = 0;
+	for (; *p >= '0' && *p <= '9'; p++, nz++)
+		if (m || *p > '0') { m = 10*m + *p - '0'; nd++; }
+	if (*p == '.')
+		for (p++; *p >= '0' && *p <= '9'; p++, nz++, ex--)
+			if (m || *p > '0') { m = 10*m + *p - '0'; nd++; }
+	int maxd = single ? 7 : 15, maxe = single ? 10 : 22;
+	if (!nz || nd > maxd) goto slow;
+	if ((*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool eneg = *q == '-';
+		if (*q == '-' || *q == '+') q++;
+		if (*q >= '0' && *q <= '9') {
+			int v = 0;
+			for (; *q >= '0' && *q <= '9'; q++)
+				if (v < 10000) v = 10*v + *q - '0';
+			ex += eneg ? -v : v;
+			p = q;
+		}
+	}
+	if ((*p|32) >= 'a' && (*p|32) <= 'z') goto slow;
+	if (ex < -maxe || ex > maxe) { if (m) goto slow; ex = 0; }
+	double r;
+	if (single) {
+		float fm = m, fp = p10[ex < 0 ? -ex : ex];
+		r = ex < 0 ? fm / fp : fm * fp;
+	} else
+		r = ex < 0 ? m / p10[-ex] : m * p10[ex];
+	if (e) *e = (char *)p;
+	return neg ? -r : r;
+slow:
+	return single ? strtof(s, e) : strtod(s, e);
+}
+
+// utility function: read the rest of a file into a zero-terminated string
+inline static char *read_ascii_text(FILE *f)
+{
+	size_t n = 0, nt = 0x1000;
+	char *t = xmalloc(nt);
+	while (1) {
+		if (n + 1 >= nt)
+			t = xrealloc(t, nt *= 2);
+		size_t r = fread(t + n, 1, nt - n - 1, f);
+		if (!r)
+			break;
+		n += r;
+	}
+	t[n] = '\0';
+	return t;
+}
+
 // utility function: parse floats from a text file
 // returns a pointer to a malloc'ed array of the parsed floats
 // fills *no with the number of floats
 inline static float *read_ascii_floats(FILE *f, int *no)
 {
-	int r, n = 0, nt = 0;
+	int n = 0, nt = 0;
 	float *t = NULL;
+	char *s = read_ascii_text(f), *p = s, *q;
 	while(1) {
 		if (n >= nt)
 		{
 			nt = 2 * (nt + 1);
 			t = xrealloc(t, nt * sizeof * t);
 		}
-		r = fscanf(f, "%f", t+n);
-		if (r != 1)
+		t[n] = parse_number_fast(p, &q, true);
+		if (q == p)
 			break;
+		p = q;
 		n += 1;
 	}
+	free(s);
 	*no = n;
 	return t;
 }
@@ -31,19 +105,22 @@ inline static float *read_ascii_floats(FILE *f, int *no)
 // fills *no with the number of doubles
 inline static double *read_ascii_doubles(FILE *f, int *no)
 {
-	int r, n = 0, nt = 0;
+	int n = 0, nt = 0;
 	double *t = NULL;
+	char *s = read_ascii_text(f), *p = s, *q;
 	while(1) {
 		if (n >= nt)
 		{
 			nt = 2 * (nt + 1);
 			t = xrealloc(t, nt * sizeof * t);
 		}
-		r = fscanf(f, "%lf", t+n);
-		if (r != 1)
+		t[n] = parse_number_fast(p, &q, false);
+		if (q == p)
 			break;
+		p = q;
 		n += 1;
 	}
+	free(s);
 	*no = n;
 	return t;
 }
@@ -83,10 +160,13 @@ static double *read_ascii_doubles_fn(const char *fname, int *no)
 inline
 static int parse_doubles(double *t, int nmax, const char *s)
 {
-	int i = 0, w;
-	while (i < nmax && 1 == sscanf(s, "%lg %n", t + i, &w)) {
-		i += 1;
-		s += w;
+	int i = 0;
+	char *q;
+	while (i < nmax) {
+		double v = parse_number_fast(s, &q, false);
+		if (q == s) break;
+		t[i++] = v;
+		s = q;
 	}
 	return i;
 }
@@ -94,10 +174,13 @@ static int parse_doubles(double *t, int nmax, const char *s)
 inline
 static int parse_floats(float *t, int nmax, const char *s)
 {
-	int i = 0, w;
-	while (i < nmax && 1 == sscanf(s, "%g %n", t + i, &w)) {
-		i += 1;
-		s += w;
+	int i = 0;
+	char *q;
+	while (i < nmax) {
+		float v = parse_number_fast(s, &q, true);
+		if (q == s) break;
+		t[i++] = v;
+		s = q;
 	}
 	return i;
 }
@@ -0,0 +1,48 @@
+#ifndef _PD_SPECIALIZE_H
+#define _PD_SPECIALIZE_H
+
+// instances of the per-pixel kernels for small numbers of channels
+//
+// The loops over the pd samples of each pixel ("for (l = 0; l < pd; l++)")
+// are short and have a runtime bound, so that the compiler can neither
+// unroll them nor vectorize across the pixels.  The macro
+//
+// 	PD_SPECIALIZE(pd, statement);
+//
+// runs the statement with pd replaced by the constant 1, 2, 3 or 4, when it
+// has one of these values, and with its runtime value otherwise.  The
+// statement is typically a call to an inline kernel that processes a whole
+// row (or a whole image), so that each constant gives an instance of the
+// kernel where the channel loops are unrolled:
+//
+// 	PD_KERNEL void scale_row(float *y, float *x, int n, int pd, float a)
+// 	{
+// 		for (int i = 0; i < n; i++)
+// 		for (int l = 0; l < pd; l++)
+// 			y[i*pd+l] = a * x[i*pd+l];
+// 	}
+// 	...
+// 	PD_SPECIALIZE(pd, scale_row(y, x, w, pd, 2.0));
+//
+// Notice that "pd" must be the name of a variable (it is redeclared as a
+// constant in each case), and that the statement is expanded five times,
+// so it should be a single call to a kernel, outside of the pixel loops.
+// The attribute PD_KERNEL forces the inlining of the kernel into each case
+// (otherwise, the compilers do not always inline large functions that are
+// called several times).
+
+#ifdef __GNUC__
+#define PD_KERNEL static inline __attribute__((always_inline))
+#else
+#define PD_KERNEL static inline
+#endif
+
+#define PD_SPECIALIZE(pd,s) do{switch(pd){\
+	case 1: { const int pd = 1; s; } break;\
+	case 2: { const int pd = 2; s; } break;\
+	case 3: { const int pd = 3; s; } break;\
+	case 4: { const int pd = 4; s; } break;\
+	default: s;\
+	}}while(0)
+
+#endif//_PD_SPECIALIZE_H
@@ -243,6 +243,10 @@
 #include <math.h>
 //#include <tgmath.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 #ifndef __STDC_NO_COMPLEX__
 #include <complex.h>
@@ -252,7 +256,9 @@
 
 #include "fail.c"
 #include "xmalloc.c"
+#include "threads.c"
 #include "random.c"
+#include "quantiles.c"
 #include "parsenumbers.c"
 #include "colorcoordsf.c"
 
@@ -268,6 +274,7 @@
 #define PLAMBDA_MAX_VARLEN 0x100
 #define PLAMBDA_MAX_PIXELDIM 600
 #define PLAMBDA_MAX_MAGIC 42
+#define PLAMBDA_MAX_QUANTILES 64
 
 
 #ifndef FORI
@@ -956,9 +963,10 @@ static struct predefined_function {
 	char *name;
 	int nargs;
 	float value;
+	void (*ff)(void); // single-precision variant, bound by "-f32"
 } global_table_of_predefined_functions[] = {
-#define REGISTER_FUNCTION(x,n) {(void(*)(void))x, #x, n, 0}
-#define REGISTER_FUNCTIONN(x,xn,n) {(void(*)(void))x, xn, n, 0}
+#define REGISTER_FUNCTION(x,n) {(void(*)(void))x, #x, n, 0, 0}
+#define REGISTER_FUNCTIONN(x,xn,n) {(void(*)(void))x, xn, n, 0, 0}
 //#define REGISTER_FUNCTIONC(x,n) {(void(*)(void))x, "complex#x, n, 0}
 	REGISTER_FUNCTION(acos,1),
 	REGISTER_FUNCTION(acosh,1),
@@ -1129,9 +1137,9 @@ static struct predefined_function {
 	REGISTER_FUNCTIONN(rgb2xyz,"rgb2xyz",-6),
 #undef REGISTER_FUNCTION
 #undef REGISTER_FUNCTIONN
-	{NULL, "pi", 0, M_PI},
+	{NULL, "pi", 0, M_PI, 0},
 #ifdef M_E
-#define REGISTER_CONSTANT(x) {NULL, #x, 0, x}
+#define REGISTER_CONSTANT(x) {NULL, #x, 0, x, 0}
 	REGISTER_CONSTANT(M_E),
 	REGISTER_CONSTANT(M_LOG2E),
 	REGISTER_CONSTANT(M_LOG10E),
@@ -1150,8 +1158,53 @@ static struct predefined_function {
 };
 
 
+// single-precision variants of the functions of math.h
+static struct { void (*f)(void), (*ff)(void); } global_float_variants[] = {
+#define FLOAT_VARIANT(x) {(void(*)(void))x, (void(*)(void))x ## f}
+	FLOAT_VARIANT(acos), FLOAT_VARIANT(acosh), FLOAT_VARIANT(asin),
+	FLOAT_VARIANT(asinh), FLOAT_VARIANT(atan), FLOAT_VARIANT(atanh),
+	FLOAT_VARIANT(cbrt), FLOAT_VARIANT(ceil), FLOAT_VARIANT(cos),
+	FLOAT_VARIANT(cosh), FLOAT_VARIANT(erf), FLOAT_VARIANT(erfc),
+	FLOAT_VARIANT(exp), FLOAT_VARIANT(exp2), FLOAT_VARIANT(expm1),
+	FLOAT_VARIANT(fabs), FLOAT_VARIANT(floor), FLOAT_VARIANT(lgamma),
+	FLOAT_VARIANT(log), FLOAT_VARIANT(log10), FLOAT_VARIANT(log1p),
+	FLOAT_VARIANT(log2), FLOAT_VARIANT(logb), FLOAT_VARIANT(nearbyint),
+	FLOAT_VARIANT(rint), FLOAT_VARIANT(round), FLOAT_VARIANT(sin),
+	FLOAT_VARIANT(sinh), FLOAT_VARIANT(sqrt), FLOAT_VARIANT(tan),
+	FLOAT_VARIANT(tanh), FLOAT_VARIANT(tgamma), FLOAT_VARIANT(trunc),
+	FLOAT_VARIANT(atan2), FLOAT_VARIANT(copysign), FLOAT_VARIANT(fdim),
+	FLOAT_VARIANT(fmax), FLOAT_VARIANT(fmin), FLOAT_VARIANT(fmod),
+	FLOAT_VARIANT(hypot), FLOAT_VARIANT(nextafter), FLOAT_VARIANT(pow),
+	FLOAT_VARIANT(remainder),
+#undef FLOAT_VARIANT
+};
+
+// whether the arithmetic is done in single precision
+static bool global_float_math = false;
+
+// bind the predefined functions to their single-precision variants
+// (the default is double precision, as in the original outputs)
+static void bind_float_functions(void)
+{
+	int n = sizeof global_table_of_predefined_functions
+		/ sizeof*global_table_of_predefined_functions;
+	int nv = sizeof global_float_variants / sizeof*global_float_variants;
+	FORI(n) FORJ(nv)
+	{
+		struct predefined_function *f
+			= global_table_of_predefined_functions + i;
+		if (f->f == global_float_variants[j].f && f->nargs > 0)
+			f->ff = global_float_variants[j].ff;
+	}
+	global_float_math = true;
+}
+
 static float apply_function(struct predefined_function *f, float *v)
 {
+	if (f->ff && f->nargs == 1)
+		return ((float(*)(float))(f->ff))(v[0]);
+	if (f->ff && f->nargs == 2)
+		return ((float(*)(float,float))f->ff)(v[1], v[0]);
 	switch(f->nargs) {
 	case 0: return f->value;
 	case 1: return ((double(*)(double))(f->f))(v[0]);
@@ -1262,6 +1315,12 @@ struct image_stats {
 	float component_std[PLAMBDA_MAX_PIXELDIM];
 	float *sorted_samples, *sorted_components[PLAMBDA_MAX_PIXELDIM];
 
+	// order statistics computed so far (see image_stats_quantile)
+	int nq;
+	int q_component[PLAMBDA_MAX_QUANTILES]; // -1 for all the samples
+	long q_rank[PLAMBDA_MAX_QUANTILES];
+	float q_value[PLAMBDA_MAX_QUANTILES];
+
 	// original image data, for debugging purposes
 	int w, h, pd;
 	float *x;
@@ -1457,6 +1516,36 @@ static void compute_ordered_component_stats(struct image_stats *s,
 	}
 }
 
+// the k-th smallest sample of component c (or of all the samples, if c < 0)
+//
+// Each requested rank is selected once and cached; the images are sorted
+// only when a program asks for too many different ranks.
+static float image_stats_quantile(struct image_stats *s,
+		float *x, int w, int h, int pd, int c, long k)
+{
+	FORI(s->nq)
+		if (s->q_component[i] == c && s->q_rank[i] == k)
+			return s->q_value[i];
+	if (s->nq == PLAMBDA_MAX_QUANTILES) {
+		if (c < 0) {
+			compute_ordered_sample_stats(s, x, w, h, pd);
+			return s->sorted_samples[k];
+		}
+		compute_ordered_component_stats(s, x, w, h, pd);
+		return s->sorted_components[c][k];
+	}
+	float r;
+	long n = w * (long)h * (c < 0 ? pd : 1);
+	quantiles_of_array(&r, c < 0 ? x : x + c, n, c < 0 ? 1 : pd, &k, 1);
+	if (w*h > 1) {
+		s->q_component[s->nq] = c;
+		s->q_rank[s->nq] = k;
+		s->q_value[s->nq] = r;
+		s->nq += 1;
+	}
+	return r;
+}
+
 //static void compute_ordered_vector_stats(struct image_stats *s,
 //		float *x, int w, int h, int pd)
 //{
@@ -1478,16 +1567,30 @@ static int bound(int a, int x, int b)
 }
 
 
+// XXX WARNING : global variables here (leading to non-re-entrant code)
+static struct image_stats *global_magic_stats = NULL;
+
+// forget the cached data of the magic variables (when the images change)
+static void reset_magic_stats(void)
+{
+	struct image_stats *t = global_magic_stats;
+	if (!t) return;
+	for (int i = 0; i < PLAMBDA_MAX_MAGIC; i++) {
+		free(t[i].sorted_samples);
+		free(t[i].sorted_components[0]);
+	}
+	free(t);
+	global_magic_stats = NULL;
+}
+
 // the value of magic variables depends on some globally cached data
 static int eval_magicvar(float *out, int magic, int img_index, int comp, int qq,
 		float *x, int w, int h, int pd) // only needed on the first run
 {
-	// XXX WARNING : global variables here (leading to non-re-entrant code)
-	static bool initt = false;
-	static struct image_stats *t = 0;
 	//static struct image_stats t[PLAMBDA_MAX_MAGIC];
-	if (!initt) {
-		t = xmalloc(PLAMBDA_MAX_MAGIC * sizeof*t);
+	struct image_stats *t = global_magic_stats;
+	if (!t) {
+		t = global_magic_stats = xmalloc(PLAMBDA_MAX_MAGIC * sizeof*t);
 		for (int i = 0; i < PLAMBDA_MAX_MAGIC; i++) {
 			t[i].init_simple = false;
 			t[i].init_ordered = false;
@@ -1495,9 +1598,11 @@ static int eval_magicvar(float *out, int magic, int img_index, int comp, int qq,
 			t[i].init_vordered = false;
 			t[i].init_csimple = false;
 			t[i].init_cordered = false;
+			t[i].nq = 0;
+			t[i].sorted_samples = NULL;
+			t[i].sorted_components[0] = NULL;
 			t[i].w=w;t[i].h=h;t[i].pd=pd;t[i].x=x; // for debug only
 		}
-		initt = true;
 	}
 	//fprintf(stderr, "magic=%c index=%d comp=%d\n",magic,img_index,comp);
 
@@ -1551,60 +1656,62 @@ static int eval_magicvar(float *out, int magic, int img_index, int comp, int qq,
 		return pd;
 	} else if (magic == 'm' || magic == 'q') {
 		if (comp < 0) { // use all samples
-			compute_ordered_sample_stats(ti, x, w, h, pd);
 			if (magic == 'm') {
-				*out = ti->scalar_med;
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						-1, w*(long)h*pd/2);
 				return 1;
 			}
 			if (magic == 'q') {
 				int qpos = round(qq*(w*(h*pd/100.0)));
 				qpos = bound(0, qpos, w*h*pd-1);
-				*out = ti->sorted_samples[qpos];
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						-1, qpos);
 				return 1;
 			}
 		} else {
-			compute_ordered_component_stats(ti, x, w, h, pd);
 			if (magic == 'm') {
-				*out = ti->component_med[comp];
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						comp, w*(long)h/2);
 				return 1;
 			}
 			if (magic == 'q') {
 				int qpos = round(qq*(w*(h/100.0)));
 				qpos = bound(0, qpos, w*h-1);
-				*out = ti->sorted_components[comp][qpos];
+				*out = image_stats_quantile(ti, x, w, h, pd,
+						comp, qpos);
 				return 1;
 			}
 		}
 	} else if (magic == 'O') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = round(qq*(w*(h/100.0)));
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else if (magic == 'W') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = round(qq*(w*h/1000000.0));
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else if (magic == '0') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = qq;//round(qq*w*h/1000000.0);
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else if (magic == '9') {
-		compute_ordered_component_stats(ti, x, w, h, pd);
 		FORI(pd) {
 			int qposi = w*h-1-qq;//round(qq*w*h/1000000.0);
 			qposi = bound(0, qposi, w*h-1);
-			out[i] = ti->sorted_components[i][qposi];
+			out[i] = image_stats_quantile(ti, x, w, h, pd,
+					i, qposi);
 		}
 		return pd;
 	} else
@@ -2459,7 +2566,7 @@ static void vstack_process_op(struct value_vstack *s, int opid)
 #include "getpixel.c"
 
 SMART_PARAMETER_SILENT(PLAMBDA_GETPIXEL,-1)
-static float getsample_cfg(float *x, int w, int h, int pd, int i, int j, int l)
+static getsample_operator getsample_operator_cfg(void)
 {
 	getsample_operator p = get_sample_operator(getsample_1);
 	int option = PLAMBDA_GETPIXEL();
@@ -2472,9 +2579,23 @@ static float getsample_cfg(float *x, int w, int h, int pd, int i, int j, int l)
 	case 4: p = getsample_nan; break;
 	default: fail("unrecognized PLAMBDA_GETPIXEL value %d", option);
 	}
+	return p;
+}
+
+static float getsample_cfg(float *x, int w, int h, int pd, int i, int j, int l)
+{
+	getsample_operator p = getsample_operator_cfg();
 	return p(x, w, h, pd, i, j, l);
 }
 
+// a sample known to be inside the image
+static float getsample_inside(float *x, int w, int h, int pd,
+		int i, int j, int l)
+{
+	(void)h;
+	return x[(i + j*w)*pd + l];
+}
+
 #define H 0.5
 #define Q 0.25
 #define O 0.125
@@ -2558,22 +2679,20 @@ static float *get_stencil_3x3(int operator, int scheme)
 	}
 }
 
-static float apply_3x3_stencil(float *img, int w, int h, int pd,
+static float apply_3x3_stencil(getsample_operator P, float *img, int w, int h, int pd,
 		int ai, int aj, int channel, float *s)
 {
 	assert(s);
-	getsample_operator P = getsample_cfg;
 	float r = 0;
 	for (int i = 0; i < 9; i++)
 		r += s[i] * P(img, w, h, pd, ai-1+i%3, aj-1+i/3, channel);
 	return r;
 }
 
-static float apply_3x3_mstencil(float *img, int w, int h, int pd,
+static float apply_3x3_mstencil(getsample_operator P, float *img, int w, int h, int pd,
 		int ai, int aj, int channel, float *s, int op)
 {
 	assert(s);
-	getsample_operator P = getsample_cfg;
 	int nv = 0; // number of elements inside the structuring element
 	float v[9]; // pixel values
 	for (int i = 0; i < 9; i++)
@@ -2609,15 +2728,15 @@ static float apply_3x3_mstencil(float *img, int w, int h, int pd,
 //	return apply_3x3_stencil(img, w, h, pd, ai, aj, al, s);
 //}
 
-static float imageop_scalar(float *img, int w, int h, int pd,
+static float imageop_scalar(getsample_operator P, float *img, int w, int h, int pd,
 		int ai, int aj, int al, struct plambda_token *t)
 {
 	float *s = get_stencil_3x3(t->imageop_operator, t->imageop_scheme);
 	if (s) {
 		if (t->imageop_operator < IMAGEOP_M_ERO)
-			return apply_3x3_stencil(img, w, h, pd, ai, aj, al, s);
+			return apply_3x3_stencil(P, img, w, h, pd, ai, aj, al, s);
 		else
-			return apply_3x3_mstencil(img, w, h, pd, ai, aj, al, s,
+			return apply_3x3_mstencil(P, img, w, h, pd, ai, aj, al, s,
 					t->imageop_operator);
 	} else {
 		switch(t->imageop_operator) {
@@ -2625,8 +2744,8 @@ static float imageop_scalar(float *img, int w, int h, int pd,
 			{
 			float *sx=get_stencil_3x3(IMAGEOP_X,t->imageop_scheme);
 			float *sy=get_stencil_3x3(IMAGEOP_Y,t->imageop_scheme);
-			float gx = apply_3x3_stencil(img, w,h,pd, ai,aj,al, sx);
-			float gy = apply_3x3_stencil(img, w,h,pd, ai,aj,al, sy);
+			float gx = apply_3x3_stencil(P, img, w,h,pd, ai,aj,al, sx);
+			float gy = apply_3x3_stencil(P, img, w,h,pd, ai,aj,al, sy);
 			return hypot(gx, gy);
 			}
 		default: fail("unrecognized imageop operator %d\n", t->imageop_operator);
@@ -2639,7 +2758,7 @@ SMART_PARAMETER_SILENT(SHADOWX,1)
 SMART_PARAMETER_SILENT(SHADOWY,1)
 SMART_PARAMETER_SILENT(SHADOWZ,1)
 
-static int imageop_vector(float *out, float *img, int w, int h, int pd,
+static int imageop_vector(getsample_operator P, float *out, float *img, int w, int h, int pd,
 		int ai, int aj, struct plambda_token *t)
 {
 	float *sx = get_stencil_3x3(IMAGEOP_X, t->imageop_scheme);
@@ -2651,8 +2770,8 @@ static int imageop_vector(float *out, float *img, int w, int h, int pd,
 		//out[1] = apply_3x3_stencil(img, w,h,pd, ai,aj,0, sy);
 		//return 2;
 		for (int l = 0; l < pd; l++) {
-			out[2*l+0] = apply_3x3_stencil(img,w,h,pd,ai,aj,l, sx);
-			out[2*l+1] = apply_3x3_stencil(img,w,h,pd,ai,aj,l, sy);
+			out[2*l+0] = apply_3x3_stencil(P, img,w,h,pd,ai,aj,l, sx);
+			out[2*l+1] = apply_3x3_stencil(P, img,w,h,pd,ai,aj,l, sy);
 		}
 		return 2*pd;
 	case IMAGEOP_DIV:
@@ -2663,8 +2782,8 @@ static int imageop_vector(float *out, float *img, int w, int h, int pd,
 		//return 1;
 		if (pd%2)fail("can not compute divergence of a %d-vector",pd);
 		for (int l = 0; l < pd/2; l++) {
-			float ax=apply_3x3_stencil(img,w,h,pd,ai,aj,2*l+0,sx);
-			float by=apply_3x3_stencil(img,w,h,pd,ai,aj,2*l+1,sy);
+			float ax=apply_3x3_stencil(P, img,w,h,pd,ai,aj,2*l+0,sx);
+			float by=apply_3x3_stencil(P, img,w,h,pd,ai,aj,2*l+1,sy);
 			out[l] = ax + by;
 		}
 		return pd/2;
@@ -2676,8 +2795,8 @@ static int imageop_vector(float *out, float *img, int w, int h, int pd,
 		//return 1;
 		if (pd%2)fail("can not compute divergence of a %d-vector",pd);
 		for (int l = 0; l < pd/2; l++) {
-			float ax=apply_3x3_stencil(img,w,h,pd,ai,aj,2*l+0,sx);
-			float by=apply_3x3_stencil(img,w,h,pd,ai,aj,2*l+1,sy);
+			float ax=apply_3x3_stencil(P, img,w,h,pd,ai,aj,2*l+0,sx);
+			float by=apply_3x3_stencil(P, img,w,h,pd,ai,aj,2*l+1,sy);
 			out[l] = ax + by;
 		}
 		return pd/2;
@@ -2686,16 +2805,16 @@ static int imageop_vector(float *out, float *img, int w, int h, int pd,
 		float *sxy = get_stencil_3x3(IMAGEOP_XY, t->imageop_scheme);
 		float *syy = get_stencil_3x3(IMAGEOP_YY, t->imageop_scheme);
 		for (int l = 0; l < pd; l++) {
-			out[3*l+0] = apply_3x3_stencil(img,w,h,pd,ai,aj,l, sxx);
-			out[3*l+1] = apply_3x3_stencil(img,w,h,pd,ai,aj,l, sxy);
-			out[3*l+2] = apply_3x3_stencil(img,w,h,pd,ai,aj,l, syy);
+			out[3*l+0] = apply_3x3_stencil(P, img,w,h,pd,ai,aj,l, sxx);
+			out[3*l+1] = apply_3x3_stencil(P, img,w,h,pd,ai,aj,l, sxy);
+			out[3*l+2] = apply_3x3_stencil(P, img,w,h,pd,ai,aj,l, syy);
 		}
 		return 3*pd;
 		}
 	case IMAGEOP_SHADOW: {
 		if (pd != 1) fail("can not yet compute shadow of a vector");
-		float vdx[3]={1,0,apply_3x3_stencil(img, w,h,pd, ai,aj,0, sx)};
-		float vdy[3]={0,1,apply_3x3_stencil(img, w,h,pd, ai,aj,0, sy)};
+		float vdx[3]={1,0,apply_3x3_stencil(P, img, w,h,pd, ai,aj,0, sx)};
+		float vdy[3]={0,1,apply_3x3_stencil(P, img, w,h,pd, ai,aj,0, sy)};
 		//float sun[3] = {-1, -1, 1}, nor[3];
 		float sun[3] = {-SHADOWX(), -SHADOWY(), SHADOWZ()}, nor[3];
 		vector_product(nor, vdx, vdy, 3, 3);
@@ -2703,8 +2822,8 @@ static int imageop_vector(float *out, float *img, int w, int h, int pd,
 		}
 	case IMAGEOP_SHADOWL: {
 		if (pd != 1) fail("can not yet compute shadow of a vector");
-		float vdx[3]={1,0,apply_3x3_stencil(img, w,h,pd, ai,aj,0, sx)};
-		float vdy[3]={0,1,apply_3x3_stencil(img, w,h,pd, ai,aj,0, sy)};
+		float vdx[3]={1,0,apply_3x3_stencil(P, img, w,h,pd, ai,aj,0, sx)};
+		float vdy[3]={0,1,apply_3x3_stencil(P, img, w,h,pd, ai,aj,0, sy)};
 		//float sun[3] = {-1, -1, 1}, nor[3];
 		float sun[3] = {-SHADOWX(), -SHADOWY(), SHADOWZ()};
 		float sur[3] = {1, vdx[2], vdy[2]};
@@ -2720,7 +2839,7 @@ static int imageop_vector(float *out, float *img, int w, int h, int pd,
 
 
 // compute the requested imageop at the given point
-static int imageop(float *out, float *img, int w, int h, int pd,
+static int imageop(getsample_operator P, float *out, float *img, int w, int h, int pd,
 				int ai, int aj, struct plambda_token *t)
 {
 	int retval = 1;
@@ -2728,13 +2847,13 @@ static int imageop(float *out, float *img, int w, int h, int pd,
 	int pj = aj + t->displacement[1];
 	int channel = t->component;
 	if (t->imageop_operator > 1000 && t->imageop_operator < 2000)
-		return imageop_vector(out, img, w, h, pd, pi, pj, t);
+		return imageop_vector(P, out, img, w, h, pd, pi, pj, t);
 	if (channel < 0) { // means the whole of it
 		retval = pd;
 		FORL(pd)
-			out[l] = imageop_scalar(img, w, h, pd, pi, pj, l, t);
+			out[l] = imageop_scalar(P, img, w, h, pd, pi, pj, l, t);
 	} else
-		*out = imageop_scalar(img, w, h, pd, pi, pj, channel, t);
+		*out = imageop_scalar(P, img, w, h, pd, pi, pj, channel, t);
 	return retval;
 }
 
@@ -2814,7 +2933,8 @@ static int run_program_vectorially_at(float *out, struct plambda_program *p,
 			int pdv = pd[t->index];
 			int imw = w ? w[t->index] : 1;
 			int imh = h ? h[t->index] : 1;
-			int rdim = imageop(lout, img, imw, imh, pdv, ai, aj, t);
+			int rdim = imageop(getsample_operator_cfg(), lout,
+					img, imw, imh, pdv, ai, aj, t);
 			vstack_push_vector(s, lout, rdim);
 			break;
 				      }
@@ -2833,10 +2953,6 @@ static int run_program_vectorially_at(float *out, struct plambda_program *p,
 				     }
 			break;
 		case PLAMBDA_MAGIC: {
-#ifdef _OPENMP
-			fail("magic variables are not available in "
-					"parallel plambda");
-#endif//_OPENMP
 			int imw = w ? w[t->index] : 1;
 			int imh = h ? h[t->index] : 1;
 			int pdv = pd[t->index];
@@ -2855,6 +2971,1089 @@ static int run_program_vectorially_at(float *out, struct plambda_program *p,
 }
 
 
+// compiled evaluation {{{2
+
+// Plambda programs have no branches, thus once the dimensions of the input
+// images are known, the position and size of each value on the stack are
+// the same for all pixels.  The program is then translated into a flat list
+// of instructions that read and write at fixed offsets of a scratch array.
+// Each instruction writes to a new place of the scratch array, so that the
+// stack operations (and the registers) become renamings of offsets and
+// produce no code at all.  The constants are filled-in only once.
+//
+// The instructions are applied to spans of PLAMBDA_SPAN consecutive pixels
+// of a row.  Each offset of the scratch array holds one component for all
+// the pixels of the span, so that the arithmetic becomes loops over lanes
+// that the compiler can vectorize.
+
+#define PLAMBDA_SPAN 64
+
+#define PLAMBDA_OP_CONSTANT 0     // r = value
+#define PLAMBDA_OP_COLONVAR 1     // r = position-dependent variable
+#define PLAMBDA_OP_SAMPLES 2      // r[l] = img(i+dx, j+dy, c+l)
+#define PLAMBDA_OP_IMAGEOP 3      // r = imageop(img, i, j)
+#define PLAMBDA_OP_COPY 4         // r[l] = a[l]
+#define PLAMBDA_OP_INTERLEAVE 5
+#define PLAMBDA_OP_DEINTERLEAVE 6
+#define PLAMBDA_OP_ADD 7          // r[l] = a[l] + b[l]  (or broadcast)
+#define PLAMBDA_OP_SUB 8
+#define PLAMBDA_OP_MUL 9
+#define PLAMBDA_OP_DIV 10
+#define PLAMBDA_OP_FUNCTION 11    // r[l] = f(a[l], b[l], ...)
+#define PLAMBDA_OP_RANDOM 12      // r = f()
+#define PLAMBDA_OP_VFUNCTION2 13  // see treat_strange_case2
+#define PLAMBDA_OP_VFUNCTION3 14  // see treat_strange_case3
+#define PLAMBDA_OP_BIVECTOR 15    // see treat_bivector_function
+#define PLAMBDA_OP_UNIVECTOR 16   // see treat_univector_function
+#define PLAMBDA_OP_RANDOMF 17     // r[l] = f(a[l], b[l]), with random draws
+#define PLAMBDA_OP_G 18           // inlined logic_g, etc
+#define PLAMBDA_OP_L 19
+#define PLAMBDA_OP_E 20
+#define PLAMBDA_OP_GE 21
+#define PLAMBDA_OP_LE 22
+#define PLAMBDA_OP_NE 23
+#define PLAMBDA_OP_AND 24
+#define PLAMBDA_OP_OR 25
+#define PLAMBDA_OP_IF 26
+#define PLAMBDA_OP_SQRT 27
+#define PLAMBDA_OP_FABS 28
+#define PLAMBDA_OP_STENCIL 29     // r[l] = linear 3x3 stencil st[l%nst] of
+                                  //        img(i+dx, j+dy, c+l/nst)
+
+struct plambda_instruction {
+	int op;
+	int n;          // dimension of the result
+	int r;          // offset of the result
+	int nargs;
+	int a[5];       // offsets of the arguments
+	int s[5];       // strides of the arguments (0 for broadcast scalars)
+	int d[5];       // dimensions of the arguments
+	float value;    // if op==constant, value
+	int index;      // image index, or letter of the colonvar
+	int dx, dy, c;  // displacement and first component
+	int draw0;      // random draws done before this one, within a pixel
+	int nst;        // number of stencils, if op==stencil
+	float *st[3];   // and the stencils
+	struct plambda_token *t;
+	struct predefined_function *f;
+};
+
+struct plambda_machine {
+	int n, nk;      // number of instructions, number of constants
+	int nalloc;
+	struct plambda_instruction *c;
+	int nx;         // size of the scratch array
+	int out, outn;  // offset and dimension of the result
+	int draws;      // calls to the random generator per pixel
+	uint64_t jump[2]; // the generator skips "draws" steps as s=j0*s+j1
+	getsample_operator P;
+	bool f32;       // single-precision arithmetic
+
+	// only during compilation
+	bool optimize;  // fold constants and eliminate common subexpressions
+	int nkalloc;
+	bool *known;    // whether each offset holds a known constant
+	float *kv;      // and its value
+};
+
+// a value of the stack, as seen during compilation
+struct plambda_slot {
+	int o, n;       // offset and dimension
+};
+
+static const char *plambda_op_name[] = {
+	"constant", "colonvar", "samples", "imageop", "copy", "interleave",
+	"deinterleave", "add", "sub", "mul", "div", "function", "random",
+	"vfunction2", "vfunction3", "bivector", "univector", "randomf",
+	"g", "l", "e", "ge", "le", "ne", "and", "or", "if", "sqrt", "fabs",
+	"stencil"
+};
+
+// number of calls to the random generator done by each random function
+static int random_draws(struct predefined_function *f)
+{
+	void (*g)(void) = f->f;
+	if (g == (void(*)(void))random_uniform) return 1;
+	if (g == (void(*)(void))random_raw) return 1;
+	if (g == (void(*)(void))random_normal) return 2;
+	if (g == (void(*)(void))random_cauchy) return 2;
+	if (g == (void(*)(void))random_laplace) return 2;
+	if (g == (void(*)(void))random_exponential) return 2;
+	if (g == (void(*)(void))random_pareto) return 2;
+	if (g == (void(*)(void))random_stable) return 3;
+	return -1;
+}
+
+// append an empty instruction
+static struct plambda_instruction *plambda_machine_append(
+		struct plambda_machine *m)
+{
+	if (m->n == m->nalloc) {
+		m->nalloc = m->nalloc ? 2 * m->nalloc : 64;
+		m->c = xrealloc(m->c, m->nalloc * sizeof*m->c);
+	}
+	struct plambda_instruction *c = m->c + m->n++;
+	memset(c, 0, sizeof*c);
+	return c;
+}
+
+// append an instruction, with a new place for its result
+static struct plambda_instruction *plambda_machine_emit(
+		struct plambda_machine *m, int op, int n)
+{
+	struct plambda_instruction *c = plambda_machine_append(m);
+	c->op = op;
+	c->n = n;
+	c->r = m->nx;
+	m->nx += n;
+	if (m->nx > m->nkalloc) {
+		int na = 2 * m->nx + 64;
+		m->known = xrealloc(m->known, na * sizeof*m->known);
+		m->kv = xrealloc(m->kv, na * sizeof*m->kv);
+		for (int i = m->nkalloc; i < na; i++)
+			m->known[i] = false;
+		m->nkalloc = na;
+	}
+	return c;
+}
+
+static bool plambda_slot_push(struct plambda_slot *s, int *n, int o, int d)
+{
+	if (*n + 1 >= PLAMBDA_MAX_TOKENS || d > PLAMBDA_MAX_PIXELDIM)
+		return false;
+	s[*n] = (struct plambda_slot){o, d};
+	*n += 1;
+	return true;
+}
+
+// whether the value at offset o is a known constant
+static bool plambda_machine_known(struct plambda_machine *m, int o, float *v)
+{
+	if (o < 0 || o >= m->nx || !m->known[o]) return false;
+	if (v) *v = m->kv[o];
+	return true;
+}
+
+static bool plambda_machine_constant(struct plambda_machine *m,
+		struct plambda_slot *s, int *n, float v)
+{
+	if (m->optimize)
+		for (int i = 0; i < m->n; i++)
+			if (m->c[i].op == PLAMBDA_OP_CONSTANT
+				&& !memcmp(&v, &m->c[i].value, sizeof v))
+				return plambda_slot_push(s, n, m->c[i].r, 1);
+	struct plambda_instruction *c =
+		plambda_machine_emit(m, PLAMBDA_OP_CONSTANT, 1);
+	c->value = v;
+	m->known[c->r] = true;
+	m->kv[c->r] = v;
+	return plambda_slot_push(s, n, c->r, 1);
+}
+
+// offsets of the arguments of an instruction
+// argument q is the range a[q] ... a[q]+len[q]-1 of the scratch array
+// returns the number of arguments
+static int plambda_instruction_args(struct plambda_instruction *c, int *len)
+{
+	switch(c->op) {
+	case PLAMBDA_OP_CONSTANT:
+	case PLAMBDA_OP_COLONVAR:
+	case PLAMBDA_OP_SAMPLES:
+	case PLAMBDA_OP_IMAGEOP:
+	case PLAMBDA_OP_STENCIL:
+	case PLAMBDA_OP_RANDOM:
+		return 0;
+	case PLAMBDA_OP_COPY:
+	case PLAMBDA_OP_INTERLEAVE:
+	case PLAMBDA_OP_DEINTERLEAVE:
+		len[0] = c->n;
+		return 1;
+	case PLAMBDA_OP_VFUNCTION2:
+	case PLAMBDA_OP_UNIVECTOR:
+		len[0] = c->d[0];
+		return 1;
+	case PLAMBDA_OP_VFUNCTION3:
+	case PLAMBDA_OP_BIVECTOR:
+		len[0] = c->d[0];
+		len[1] = c->d[1];
+		return 2;
+	default: // scalar functions, broadcast or not
+		FORI(c->nargs)
+			len[i] = c->s[i] ? c->n : 1;
+		return c->nargs;
+	}
+}
+
+static void plambda_vector_function(float *r, float *a, float *b,
+		struct plambda_instruction *c);
+
+// if all the arguments of the last instruction are known, evaluate it now
+// and replace it by constants
+static bool plambda_machine_fold(struct plambda_machine *m)
+{
+	struct plambda_instruction *c = m->c + m->n - 1;
+	if (c->op == PLAMBDA_OP_RANDOM || c->op == PLAMBDA_OP_RANDOMF)
+		return false;
+	int len[5], na = plambda_instruction_args(c, len);
+	if (!na) return false;
+	float a[5][PLAMBDA_MAX_PIXELDIM], t[PLAMBDA_MAX_PIXELDIM];
+	FORI(na) FORL(len[i])
+		if (!plambda_machine_known(m, c->a[i] + l, a[i] + l))
+			return false;
+	int n = c->n, r = c->r;
+	switch(c->op) {
+	case PLAMBDA_OP_COPY:
+		FORL(n) t[l] = a[0][l];
+		break;
+	case PLAMBDA_OP_INTERLEAVE:
+		FORI(n/2) {
+			t[2*i] = a[0][i];
+			t[2*i+1] = a[0][i+n/2];
+		}
+		break;
+	case PLAMBDA_OP_DEINTERLEAVE:
+		FORI(n/2) {
+			t[i] = a[0][2*i];
+			t[i+n/2] = a[0][2*i+1];
+		}
+		break;
+	case PLAMBDA_OP_VFUNCTION2:
+	case PLAMBDA_OP_VFUNCTION3:
+	case PLAMBDA_OP_BIVECTOR:
+	case PLAMBDA_OP_UNIVECTOR:
+		plambda_vector_function(t, a[0], a[1], c);
+		break;
+	default: { // same evaluation as in vstack_apply_function
+		struct predefined_function *f = c->f;
+		FORL(n) {
+			float v[5];
+			FORI(na)
+				v[na-1-i] = a[i][c->s[i] ? l : 0];
+			t[l] = apply_function(f, v);
+		}
+		 }
+	}
+	m->n -= 1;
+	FORL(n) {
+		c = plambda_machine_append(m);
+		c->op = PLAMBDA_OP_CONSTANT;
+		c->n = 1;
+		c->r = r + l;
+		c->value = t[l];
+		m->known[r + l] = true;
+		m->kv[r + l] = t[l];
+	}
+	return true;
+}
+
+static bool plambda_same_instruction(struct plambda_instruction *a,
+		struct plambda_instruction *b)
+{
+	if (a->op != b->op || a->n != b->n || a->nargs != b->nargs
+			|| a->f != b->f || a->index != b->index
+			|| a->dx != b->dx || a->dy != b->dy || a->c != b->c)
+		return false;
+	FORI(5)
+		if (a->a[i] != b->a[i] || a->s[i] != b->s[i]
+				|| a->d[i] != b->d[i])
+			return false;
+	if (a->t != b->t) {
+		struct plambda_token *x = a->t, *y = b->t;
+		if (!x || !y
+			|| x->imageop_operator != y->imageop_operator
+			|| x->imageop_scheme != y->imageop_scheme
+			|| x->component != y->component
+			|| x->displacement[0] != y->displacement[0]
+			|| x->displacement[1] != y->displacement[1])
+			return false;
+	}
+	return true;
+}
+
+// find a previous instruction that computes the same values as the last one
+// returns the offset of the result, or -1
+static int plambda_machine_lookup(struct plambda_machine *m)
+{
+	struct plambda_instruction *c = m->c + m->n - 1;
+	if (c->op == PLAMBDA_OP_CONSTANT || c->op == PLAMBDA_OP_RANDOM
+			|| c->op == PLAMBDA_OP_RANDOMF)
+		return -1;
+	for (int i = 0; i < m->n - 1; i++) {
+		struct plambda_instruction *b = m->c + i;
+		// a sample of a neighbor fetched before as part of a vector
+		if (c->op == PLAMBDA_OP_SAMPLES && b->op == c->op
+				&& b->index == c->index
+				&& b->dx == c->dx && b->dy == c->dy
+				&& b->c <= c->c && c->c + c->n <= b->c + b->n)
+			return b->r + c->c - b->c;
+		if (plambda_same_instruction(b, c))
+			return b->r;
+	}
+	return -1;
+}
+
+// optimize the last emitted instruction, and return the offset of its result
+// (an instruction that must stay at its place is only folded)
+static int plambda_machine_finish(struct plambda_machine *m, bool movable)
+{
+	struct plambda_instruction *c = m->c + m->n - 1;
+	int r = c->r;
+	if (!m->optimize || plambda_machine_fold(m) || !movable)
+		return r;
+	int o = plambda_machine_lookup(m);
+	if (o < 0)
+		return r;
+	m->nx -= c->n;
+	m->n -= 1;
+	return o;
+}
+
+// emit the last instruction and push its result
+static bool plambda_machine_push(struct plambda_machine *m,
+		struct plambda_slot *s, int *n)
+{
+	int d = m->c[m->n-1].n;
+	return plambda_slot_push(s, n, plambda_machine_finish(m, true), d);
+}
+
+// concatenate k values, copying them only when they are not contiguous
+static bool plambda_machine_merge(struct plambda_machine *m,
+		struct plambda_slot *s, int *n, struct plambda_slot *x, int k)
+{
+	int o = m->nx, d = 0;
+	bool contiguous = true;
+	for (int i = 0; i < k; i++) {
+		if (i > 0 && x[i-1].o + x[i-1].n != x[i].o)
+			contiguous = false;
+		d += x[i].n;
+	}
+	if (contiguous)
+		o = x[0].o;
+	else for (int i = 0; i < k; i++)
+		if (x[i].n) {
+			struct plambda_instruction *c = plambda_machine_emit(
+					m, PLAMBDA_OP_COPY, x[i].n);
+			c->a[0] = x[i].o;
+			plambda_machine_finish(m, false);
+		}
+	return plambda_slot_push(s, n, o, d);
+}
+
+// specialized instruction for some functions of the table
+static int plambda_inlined_op(struct predefined_function *f)
+{
+	void (*g)(void) = f->f;
+	if (g == (void(*)(void))sum_two_doubles)       return PLAMBDA_OP_ADD;
+	if (g == (void(*)(void))substract_two_doubles) return PLAMBDA_OP_SUB;
+	if (g == (void(*)(void))multiply_two_doubles)  return PLAMBDA_OP_MUL;
+	if (g == (void(*)(void))divide_two_doubles)    return PLAMBDA_OP_DIV;
+	if (g == (void(*)(void))logic_g)   return PLAMBDA_OP_G;
+	if (g == (void(*)(void))logic_l)   return PLAMBDA_OP_L;
+	if (g == (void(*)(void))logic_e)   return PLAMBDA_OP_E;
+	if (g == (void(*)(void))logic_ge)  return PLAMBDA_OP_GE;
+	if (g == (void(*)(void))logic_le)  return PLAMBDA_OP_LE;
+	if (g == (void(*)(void))logic_ne)  return PLAMBDA_OP_NE;
+	if (g == (void(*)(void))logic_and) return PLAMBDA_OP_AND;
+	if (g == (void(*)(void))logic_or)  return PLAMBDA_OP_OR;
+	if (g == (void(*)(void))logic_if)  return PLAMBDA_OP_IF;
+	if (g == (void(*)(void))sqrt)      return PLAMBDA_OP_SQRT;
+	if (g == (void(*)(void))fabs)      return PLAMBDA_OP_FABS;
+	if (g == (void(*)(void))random_stable) return PLAMBDA_OP_RANDOMF;
+	return PLAMBDA_OP_FUNCTION;
+}
+
+static bool plambda_machine_compile_function(struct plambda_machine *m,
+		struct plambda_slot *s, int *n, struct predefined_function *f)
+{
+	struct plambda_instruction *c;
+	float za[PLAMBDA_MAX_PIXELDIM] = {0}, zb[PLAMBDA_MAX_PIXELDIM] = {0};
+	float zr[PLAMBDA_MAX_PIXELDIM];
+	struct plambda_slot a, b;
+	switch (f->nargs) {
+	case -1:
+		if (random_draws(f) < 0) return false;
+		c = plambda_machine_emit(m, PLAMBDA_OP_RANDOM, 1);
+		c->f = f;
+		c->draw0 = m->draws;
+		m->draws += random_draws(f);
+		return plambda_machine_push(m, s, n);
+	case -2:
+		if (*n < 1 || s[*n-1].n != 2) return false;
+		a = s[--*n];
+		c = plambda_machine_emit(m, PLAMBDA_OP_VFUNCTION2, 2);
+		c->f = f;
+		c->a[0] = a.o; c->d[0] = 2;
+		return plambda_machine_push(m, s, n);
+	case -3: {
+		if (*n < 2) return false;
+		a = s[--*n];
+		b = s[--*n];
+		if (ODDP(a.n) || ODDP(b.n)) return false;
+		int ca = a.n / 2, cb = b.n / 2, d = 0;
+		if (ca == cb) d = a.n;
+		else if (ca == 1) d = b.n;
+		else if (cb == 1) d = a.n;
+		if (!d) return false;
+		c = plambda_machine_emit(m, PLAMBDA_OP_VFUNCTION3, d);
+		c->f = f;
+		c->a[0] = a.o; c->d[0] = a.n;
+		c->a[1] = b.o; c->d[1] = b.n;
+		return plambda_machine_push(m, s, n);
+		}
+	case -5: {
+		// these functions are pure and their output dimension depends
+		// only on the input dimensions, which were already checked by
+		// eval_dim
+		if (*n < 2) return false;
+		b = s[--*n];
+		a = s[--*n];
+		int d = ((int(*)(float*,float*,float*,int,int))(f->f))
+			(zr, za, zb, a.n, b.n);
+		c = plambda_machine_emit(m, PLAMBDA_OP_BIVECTOR, d);
+		c->f = f;
+		c->a[0] = a.o; c->d[0] = a.n;
+		c->a[1] = b.o; c->d[1] = b.n;
+		return plambda_machine_push(m, s, n);
+		}
+	case -6: {
+		if (*n < 1) return false;
+		a = s[--*n];
+		int d = ((int(*)(float*,float*,int))(f->f))(zr, za, a.n);
+		c = plambda_machine_emit(m, PLAMBDA_OP_UNIVECTOR, d);
+		c->f = f;
+		c->a[0] = a.o; c->d[0] = a.n;
+		return plambda_machine_push(m, s, n);
+		}
+	case 0:
+		return plambda_machine_constant(m, s, n, f->value);
+	case 1: case 2: case 3: case 4: case 5: {
+		if (*n < f->nargs) return false;
+		struct plambda_slot *x = s + *n - f->nargs;
+		*n -= f->nargs;
+		int d = 1;
+		FORI(f->nargs)
+			if (x[i].n == 0 || (x[i].n > 1 && d > 1 && x[i].n != d))
+				return false;
+			else if (x[i].n > 1)
+				d = x[i].n;
+		int op = plambda_inlined_op(f);
+		c = plambda_machine_emit(m, op, d);
+		c->f = f;
+		c->nargs = f->nargs;
+		if (op == PLAMBDA_OP_RANDOMF) {
+			c->draw0 = m->draws;
+			m->draws += d * random_draws(f);
+		}
+		FORI(f->nargs) {
+			c->a[i] = x[i].o;
+			c->d[i] = x[i].n;
+			c->s[i] = x[i].n > 1;
+		}
+		return plambda_machine_push(m, s, n);
+		}
+	default: return false;
+	}
+}
+
+static bool plambda_machine_compile_stackop(struct plambda_machine *m,
+		struct plambda_slot *s, int *n, int opid)
+{
+	struct plambda_slot x[PLAMBDA_MAX_TOKENS];
+	switch(opid) {
+	case PLAMBDA_STACKOP_DEL:
+		if (*n < 1) return false;
+		*n -= 1;
+		return true;
+	case PLAMBDA_STACKOP_DUP:
+		if (*n < 1) return false;
+		return plambda_slot_push(s, n, s[*n-1].o, s[*n-1].n);
+	case PLAMBDA_STACKOP_VSPLIT:
+		if (*n < 1) return false;
+		x[0] = s[--*n];
+		FORI(x[0].n)
+			if (!plambda_slot_push(s, n, x[0].o + i, 1))
+				return false;
+		return true;
+	case PLAMBDA_STACKOP_NSTACK:
+		return plambda_machine_constant(m, s, n, *n);
+	case PLAMBDA_STACKOP_VMERGE:
+	case PLAMBDA_STACKOP_VMERGE3: {
+		int k = opid == PLAMBDA_STACKOP_VMERGE ? 2 : 3, d = 0;
+		if (*n < k) return false;
+		*n -= k;
+		FORI(k) d += (x[i] = s[*n + i]).n;
+		if (d >= PLAMBDA_MAX_PIXELDIM) return false;
+		return plambda_machine_merge(m, s, n, x, k);
+		}
+	case PLAMBDA_STACKOP_ROT:
+		if (*n < 2) return false;
+		x[0] = s[*n-1];
+		s[*n-1] = s[*n-2];
+		s[*n-2] = x[0];
+		return true;
+	case PLAMBDA_STACKOP_ROT3:
+		if (*n < 3) return false;
+		x[0] = s[*n-1];
+		s[*n-1] = s[*n-3];
+		s[*n-3] = x[0];
+		return true;
+	case PLAMBDA_STACKOP_ROX3:
+		if (*n < 3) return false;
+		x[0] = s[*n-1];
+		x[1] = s[*n-2];
+		x[2] = s[*n-3];
+		s[*n-3] = x[1];
+		s[*n-2] = x[0];
+		s[*n-1] = x[2];
+		return true;
+	case PLAMBDA_STACKOP_NMERGE: {
+		float v;
+		if (*n < 1 || s[*n-1].n != 1
+				|| !plambda_machine_known(m, s[*n-1].o, &v))
+			return false;
+		*n -= 1;
+		if (v < 1 || round(v) != v || v >= PLAMBDA_MAX_PIXELDIM)
+			return false;
+		int k = v, d = 0;
+		if (*n < k) return false;
+		*n -= k;
+		FORI(k) d += (x[i] = s[*n + i]).n;
+		if (d >= PLAMBDA_MAX_PIXELDIM) return false;
+		return plambda_machine_merge(m, s, n, x, k);
+		}
+	case PLAMBDA_STACKOP_INTERLEAVE:
+	case PLAMBDA_STACKOP_DEINTERLEAVE: {
+		if (*n < 1 || ODDP(s[*n-1].n)) return false;
+		x[0] = s[--*n];
+		struct plambda_instruction *c = plambda_machine_emit(m,
+				opid == PLAMBDA_STACKOP_INTERLEAVE ?
+				PLAMBDA_OP_INTERLEAVE : PLAMBDA_OP_DEINTERLEAVE,
+				x[0].n);
+		c->a[0] = x[0].o;
+		return plambda_machine_push(m, s, n);
+		}
+	case PLAMBDA_STACKOP_HALVE:
+		if (*n < 1 || ODDP(s[*n-1].n)) return false;
+		x[0] = s[--*n];
+		return plambda_slot_push(s, n, x[0].o, x[0].n/2)
+			&& plambda_slot_push(s, n, x[0].o + x[0].n/2, x[0].n/2);
+	case PLAMBDA_STACKOP_NSPLIT: {
+		float v;
+		if (*n < 2 || s[*n-1].n != 1
+				|| !plambda_machine_known(m, s[*n-1].o, &v))
+			return false;
+		*n -= 1;
+		if (v < 1 || round(v) != v) return false;
+		int k = v;
+		x[0] = s[--*n];
+		if (0 != x[0].n % k) return false;
+		int d = x[0].n / k;
+		FORI(k)
+			if (!plambda_slot_push(s, n, x[0].o + i*d, d))
+				return false;
+		return true;
+		}
+	default: return false;
+	}
+}
+
+// remove the instructions whose result is not used
+static void plambda_machine_remove_dead_code(struct plambda_machine *m)
+{
+	bool *live = xmalloc((m->nx + 1) * sizeof*live);
+	FORI(m->nx) live[i] = false;
+	FORI(m->outn) live[m->out + i] = true;
+	int k = m->n;
+	for (int i = m->n - 1; i >= 0; i--) {
+		struct plambda_instruction *c = m->c + i;
+		bool used = false;
+		FORL(c->n) used = used || live[c->r + l];
+		if (!used) continue;
+		int len[5], na = plambda_instruction_args(c, len);
+		FORJ(na) FORL(len[j]) live[c->a[j] + l] = true;
+		m->c[--k] = *c;
+	}
+	memmove(m->c, m->c + k, (m->n - k) * sizeof*m->c);
+	m->n -= k;
+	free(live);
+}
+
+// print the instructions of a compiled program
+static void print_compiled_machine(struct plambda_machine *m)
+{
+	fprintf(stderr, "MACHINE OF %d INSTRUCTIONS (%d CONSTANTS), "
+			"%d SCRATCH FLOATS, %d RANDOM DRAWS:\n",
+			m->n, m->nk, m->nx, m->draws);
+	FORI(m->n) {
+		struct plambda_instruction *c = m->c + i;
+		fprintf(stderr, "INSTRUCTION[%d]: [%d", i, c->r);
+		if (c->n != 1) fprintf(stderr, ":%d", c->r + c->n);
+		fprintf(stderr, "] = %s", plambda_op_name[c->op]);
+		if (c->op == PLAMBDA_OP_CONSTANT)
+			fprintf(stderr, " %g", c->value);
+		if (c->op == PLAMBDA_OP_COLONVAR)
+			fprintf(stderr, " \":%c\"", c->index);
+		if (c->op == PLAMBDA_OP_SAMPLES || c->op == PLAMBDA_OP_IMAGEOP
+				|| c->op == PLAMBDA_OP_STENCIL)
+			fprintf(stderr, " image %d, displacement (%d,%d), "
+				"component %d", c->index, c->dx, c->dy, c->c);
+		if (c->f)
+			fprintf(stderr, " \"%s\"", c->f->name);
+		int len[5], na = plambda_instruction_args(c, len);
+		FORJ(na) {
+			fprintf(stderr, " [%d", c->a[j]);
+			if (len[j] != 1) fprintf(stderr, ":%d", c->a[j]+len[j]);
+			fprintf(stderr, "]");
+		}
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "RESULT: [%d:%d]\n", m->out, m->out + m->outn);
+}
+
+// whether an imageop is made of linear 3x3 stencils, that are evaluated
+// directly on the interior pixels
+// returns the number of stencils per channel, and the first channel in *c
+static int plambda_imageop_stencils(float **st, struct plambda_token *t,
+		int pd, int *c)
+{
+	int op = t->imageop_operator, sc = t->imageop_scheme;
+	if (op == IMAGEOP_GRAD) {
+		st[0] = get_stencil_3x3(IMAGEOP_X, sc);
+		st[1] = get_stencil_3x3(IMAGEOP_Y, sc);
+		*c = 0;
+		return 2;
+	}
+	if (op == IMAGEOP_HESS) {
+		st[0] = get_stencil_3x3(IMAGEOP_XX, sc);
+		st[1] = get_stencil_3x3(IMAGEOP_XY, sc);
+		st[2] = get_stencil_3x3(IMAGEOP_YY, sc);
+		*c = 0;
+		return 3;
+	}
+	if (op > 1000 || t->component >= pd)
+		return 0;
+	st[0] = get_stencil_3x3(op, sc);
+	*c = t->component < 0 ? 0 : t->component;
+	return st[0] ? 1 : 0;
+}
+
+// translate the program into a list of instructions
+// returns false if the program can not be compiled; then the generic
+// interpreter is used (and it will report the errors, if any)
+static bool plambda_machine_compile(struct plambda_machine *m,
+		struct plambda_program *p, float **val, int *w, int *h, int *pd,
+		bool optimize)
+{
+	struct plambda_slot s[PLAMBDA_MAX_TOKENS], reg[10];
+	bool regset[10] = {0};
+	int n = 0;
+	m->n = m->nk = m->nalloc = m->nx = m->draws = 0;
+	m->c = NULL;
+	m->P = getsample_operator_cfg();
+	m->f32 = global_float_math;
+	m->optimize = optimize;
+	m->nkalloc = 0;
+	m->known = NULL;
+	m->kv = NULL;
+	bool ok = true;
+	for (int i = 0; ok && i < p->n; i++) {
+		struct plambda_token *t = p->t + i;
+		struct plambda_instruction *c;
+		switch(t->type) {
+		case PLAMBDA_STACKOP:
+			ok = plambda_machine_compile_stackop(m, s, &n, t->index);
+			break;
+		case PLAMBDA_CONSTANT:
+			ok = plambda_machine_constant(m, s, &n, t->value);
+			break;
+		case PLAMBDA_COLONVAR: {
+			if (m->optimize && strchr("whnWH", t->colonvar)) {
+				ok = plambda_machine_constant(m, s, &n,
+					eval_colonvar(*w, *h, 0, 0, t->colonvar));
+				break;
+			}
+			int d = strchr("XY", t->colonvar) ? 2 : 1;
+			c = plambda_machine_emit(m, PLAMBDA_OP_COLONVAR, d);
+			c->index = t->colonvar;
+			ok = plambda_machine_push(m, s, &n);
+			break;
+				       }
+		case PLAMBDA_SCALAR:
+		case PLAMBDA_VECTOR: {
+			int pdv = pd[t->index], d = 1, cmp = t->component;
+			if (t->type == PLAMBDA_VECTOR) {
+				if (t->component == -1) {
+					d = pdv;
+					cmp = 0;
+				} else if (t->component == -2 && 0==pdv%2) {
+					d = pdv/2;
+					cmp = 0;
+				} else if (t->component == -3 && 0==pdv%2) {
+					d = pdv/2;
+					cmp = pdv/2;
+				} else break; // nothing is pushed
+			}
+			c = plambda_machine_emit(m, PLAMBDA_OP_SAMPLES, d);
+			c->index = t->index;
+			c->dx = t->displacement[0];
+			c->dy = t->displacement[1];
+			c->c = cmp;
+			ok = plambda_machine_push(m, s, &n);
+			break;
+				     }
+		case PLAMBDA_IMAGEOP: {
+			// the dimension of an imageop does not depend on the
+			// position, thus we evaluate it at the first pixel
+			float lout[PLAMBDA_MAX_PIXELDIM];
+			int q = t->index, cmp = t->component;
+			int d = imageop(m->P, lout, val[q], w[q], h[q], pd[q],
+					0, 0, t);
+			float *st[3] = {0};
+			int nst = plambda_imageop_stencils(st, t, pd[q], &cmp);
+			c = plambda_machine_emit(m, nst ? PLAMBDA_OP_STENCIL
+					: PLAMBDA_OP_IMAGEOP, d);
+			c->index = q;
+			c->dx = t->displacement[0];
+			c->dy = t->displacement[1];
+			c->c = cmp;
+			c->nst = nst;
+			FORI(nst) c->st[i] = st[i];
+			c->t = t;
+			ok = plambda_machine_push(m, s, &n);
+			break;
+				      }
+		case PLAMBDA_OPERATOR:
+			ok = plambda_machine_compile_function(m, s, &n,
+				global_table_of_predefined_functions+t->index);
+			break;
+		case PLAMBDA_VARDEF: {
+			int q = abs(t->index);
+			if (t->index > 0) {
+				if (n < 1) { ok = false; break; }
+				reg[q] = s[--n];
+				regset[q] = true;
+			}
+			if (t->index < 0) {
+				if (!regset[q]) { ok = false; break; }
+				ok = plambda_slot_push(s, &n, reg[q].o, reg[q].n);
+			}
+				     }
+			break;
+		default: // magic variables need the generic interpreter
+			ok = false;
+		}
+	}
+	free(m->known);
+	free(m->kv);
+	if (!ok || n < 1) return false;
+	m->out = s[n-1].o;
+	m->outn = s[n-1].n;
+	if (m->optimize)
+		plambda_machine_remove_dead_code(m);
+
+	// put the constants first, they are evaluated only once
+	struct plambda_instruction *c = xmalloc((m->n + 1) * sizeof*c);
+	FORI(m->n) if (m->c[i].op == PLAMBDA_OP_CONSTANT) c[m->nk++] = m->c[i];
+	int k = m->nk;
+	FORI(m->n) if (m->c[i].op != PLAMBDA_OP_CONSTANT) c[k++] = m->c[i];
+	free(m->c);
+	m->c = c;
+
+	// affine map of the random generator to go from a pixel to the next
+	m->jump[1] = lcg_knuth_skip(0, m->draws);
+	m->jump[0] = lcg_knuth_skip(1, m->draws) - m->jump[1];
+	return true;
+}
+
+// apply a vector function to one pixel
+static void plambda_vector_function(float *r, float *a, float *b,
+		struct plambda_instruction *c)
+{
+	void (*f)(void) = c->f->f;
+	int nr = c->n;
+	switch(c->op) {
+	case PLAMBDA_OP_VFUNCTION2:
+		((void(*)(float*,float*))f)(r, a);
+		break;
+	case PLAMBDA_OP_VFUNCTION3: {
+		void (*ff)(float*,float*,float*) =
+			(void(*)(float*,float*,float*))f;
+		int ca = c->d[0] / 2;
+		int cb = c->d[1] / 2;
+		if (ca == cb)
+			for (int i = 0; i < ca; i++)
+				ff(r+2*i, a+2*i, b+2*i);
+		else if (ca == 1)
+			for (int i = 0; i < cb; i++)
+				ff(r+2*i, a, b+2*i);
+		else
+			for (int i = 0; i < ca; i++)
+				ff(r+2*i, a+2*i, b);
+		break;
+				    }
+	case PLAMBDA_OP_BIVECTOR:
+		nr = ((int(*)(float*,float*,float*,int,int))f)
+			(r, a, b, c->d[0], c->d[1]);
+		break;
+	case PLAMBDA_OP_UNIVECTOR:
+		nr = ((int(*)(float*,float*,int))f)(r, a, c->d[0]);
+		break;
+	}
+	if (nr != c->n)
+		fail("function \"%s\" changed its dimension", c->f->name);
+}
+
+static void plambda_machine_init(float *x, struct plambda_machine *m)
+{
+	FORI(m->nk) FORL(PLAMBDA_SPAN)
+		x[m->c[i].r * PLAMBDA_SPAN + l] = m->c[i].value;
+}
+
+// evaluate the compiled program at the n pixels (i0,j),...,(i0+n-1,j)
+// the l-th component of the result at pixel i0+p is left at x[l*SPAN+p]
+//
+// seed: state of the random generator at the start of pixel (i0,j)
+static void plambda_machine_run_span(float *x, struct plambda_machine *m,
+		float **val, int *w, int *h, int *pd, int i0, int j, int n,
+		uint64_t seed)
+{
+	for (int k = m->nk; k < m->n; k++) {
+		struct plambda_instruction *c = m->c + k;
+		float *r = x + c->r * PLAMBDA_SPAN;
+#define R(l) (r + (l) * PLAMBDA_SPAN)
+#define A(q) (x + (c->a[q] + l * c->s[q]) * PLAMBDA_SPAN)
+#define LANES1(e) FORL(c->n) { float *restrict y = R(l), *a = A(0);\
+	for (int p = 0; p < n; p++) y[p] = (e); }
+#define LANES2(e) FORL(c->n) { float *restrict y = R(l), *a = A(0), *b = A(1);\
+	for (int p = 0; p < n; p++) y[p] = (e); }
+		switch(c->op) {
+		case PLAMBDA_OP_COLONVAR:
+			if ('X' == c->index) for (int p = 0; p < n; p++) {
+				R(0)[p] = i0 + p;
+				R(1)[p] = j;
+			} else if ('Y' == c->index) for (int p = 0; p < n; p++) {
+				R(0)[p] = (2.0/(*w-1))*(i0+p) - 1;
+				R(1)[p] = (2.0/(*h-1))*j - 1;
+			} else for (int p = 0; p < n; p++)
+				r[p] = eval_colonvar(*w, *h, i0+p, j, c->index);
+			break;
+		case PLAMBDA_OP_SAMPLES: {
+			int q = c->index, iw = w[q], ih = h[q], ipd = pd[q];
+			int ii = i0 + c->dx;
+			int jj = j + c->dy;
+			// pixels pa..pb-1 of the span are inside the image
+			int pa = 0, pb = 0;
+			if (jj >= 0 && jj < ih && c->c >= 0 && c->c + c->n <= ipd) {
+				pa = bound(0, -ii, n);
+				pb = bound(pa, iw - ii, n);
+			}
+			FORL(c->n) {
+				float *y = R(l);
+				float *v = val[q] + c->c + l;
+				int o = (ii + jj*iw) * ipd;
+				for (int p = 0; p < pa; p++)
+					y[p] = m->P(val[q], iw, ih, ipd,
+							ii + p, jj, c->c + l);
+				for (int p = pa; p < pb; p++)
+					y[p] = v[o + p*ipd];
+				for (int p = pb; p < n; p++)
+					y[p] = m->P(val[q], iw, ih, ipd,
+							ii + p, jj, c->c + l);
+			}
+			break;
+					 }
+		case PLAMBDA_OP_STENCIL: {
+			int q = c->index, iw = w[q], ih = h[q], ipd = pd[q];
+			int ii = i0 + c->dx;
+			int jj = j + c->dy;
+			// the 3x3 neighborhoods of pixels pa..pb-1 are inside
+			int pa = 0, pb = 0;
+			if (jj >= 1 && jj + 1 < ih) {
+				pa = bound(0, 1 - ii, n);
+				pb = bound(pa, iw - 1 - ii, n);
+			}
+			int off[9];
+			FORI(9) off[i] = (i%3 - 1 + (i/3 - 1)*iw) * ipd;
+			FORL(c->n) {
+				float *y = R(l), *s = c->st[l % c->nst];
+				int cl = c->c + l / c->nst;
+				float *v = val[q] + cl;
+				int o = (ii + jj*iw) * ipd;
+				for (int p = 0; p < pa; p++)
+					y[p] = apply_3x3_stencil(m->P, val[q],
+						iw, ih, ipd, ii + p, jj, cl, s);
+				for (int p = pa; p < pb; p++) {
+					float *vp = v + (o + p*ipd), a = 0;
+					FORI(9) a += s[i] * vp[off[i]];
+					y[p] = a;
+				}
+				for (int p = pb; p < n; p++)
+					y[p] = apply_3x3_stencil(m->P, val[q],
+						iw, ih, ipd, ii + p, jj, cl, s);
+			}
+			break;
+					 }
+		case PLAMBDA_OP_IMAGEOP: {
+			int q = c->index, iw = w[q], ih = h[q];
+			int ii = i0 + c->dx;
+			int jj = j + c->dy;
+			int pa = 0, pb = 0;
+			if (jj >= 1 && jj + 1 < ih && c->t->component < pd[q]) {
+				pa = bound(0, 1 - ii, n);
+				pb = bound(pa, iw - 1 - ii, n);
+			}
+			float t[PLAMBDA_MAX_PIXELDIM];
+			for (int p = 0; p < n; p++) {
+				bool in = p >= pa && p < pb;
+				imageop(in ? getsample_inside : m->P, t, val[q],
+						iw, ih, pd[q], i0 + p, j, c->t);
+				FORL(c->n) R(l)[p] = t[l];
+			}
+			break;
+					 }
+		case PLAMBDA_OP_COPY:
+			memcpy(r, x + c->a[0] * PLAMBDA_SPAN,
+					c->n * PLAMBDA_SPAN * sizeof*r);
+			break;
+		case PLAMBDA_OP_INTERLEAVE:
+		case PLAMBDA_OP_DEINTERLEAVE: {
+			int hn = c->n / 2;
+			bool inter = c->op == PLAMBDA_OP_INTERLEAVE;
+			FORI(c->n) {
+				int o = inter ? (i%2 ? i/2 + hn : i/2)
+				              : (i < hn ? 2*i : 2*(i-hn) + 1);
+				memcpy(R(i), x + (c->a[0] + o) * PLAMBDA_SPAN,
+						n * sizeof*r);
+			}
+			break;
+					      }
+		// the arithmetic is done in double precision, as in
+		// apply_function, so that the results are identical
+		case PLAMBDA_OP_ADD: if (m->f32) { LANES2(a[p] + b[p]); break; }
+				     LANES2((double)a[p] + b[p]); break;
+		case PLAMBDA_OP_SUB: if (m->f32) { LANES2(a[p] - b[p]); break; }
+				     LANES2((double)a[p] - b[p]); break;
+		case PLAMBDA_OP_MUL: if (m->f32) { LANES2(a[p] * b[p]); break; }
+				     LANES2((double)a[p] * b[p]); break;
+		case PLAMBDA_OP_DIV: if (m->f32) { LANES2(a[p] / b[p]); break; }
+				     LANES2((double)a[p] / b[p]); break;
+		case PLAMBDA_OP_G:   LANES2((double)a[p] >  b[p]); break;
+		case PLAMBDA_OP_L:   LANES2((double)a[p] <  b[p]); break;
+		case PLAMBDA_OP_E:   LANES2((double)a[p] == b[p]); break;
+		case PLAMBDA_OP_GE:  LANES2((double)a[p] >= b[p]); break;
+		case PLAMBDA_OP_LE:  LANES2((double)a[p] <= b[p]); break;
+		case PLAMBDA_OP_NE:  LANES2((double)a[p] != b[p]); break;
+		case PLAMBDA_OP_AND: LANES2(a[p] && b[p]); break;
+		case PLAMBDA_OP_OR:  LANES2(a[p] || b[p]); break;
+		case PLAMBDA_OP_SQRT: if (m->f32) { LANES1(sqrtf(a[p])); break; }
+				      LANES1(sqrt(a[p])); break;
+		case PLAMBDA_OP_FABS: LANES1(fabs(a[p])); break;
+		case PLAMBDA_OP_IF: FORL(c->n) {
+			float *restrict y = R(l), *a = A(0), *b = A(1), *e = A(2);
+			for (int p = 0; p < n; p++)
+				y[p] = a[p] ? b[p] : e[p];
+			}
+			break;
+		case PLAMBDA_OP_FUNCTION: {
+			void (*f)(void) = c->f->f;
+			if (c->f->ff && c->nargs == 1) {
+				LANES1(((float(*)(float))c->f->ff)(a[p]));
+				break;
+			}
+			if (c->f->ff && c->nargs == 2) {
+				LANES2(((float(*)(float,float))c->f->ff)
+						(a[p], b[p]));
+				break;
+			}
+			switch(c->nargs) {
+			case 1: LANES1(((double(*)(double))f)(a[p])); break;
+			case 2: LANES2(((double(*)(double,double))f)
+						(a[p], b[p]));
+				break;
+			case 3: FORL(c->n) {
+				float *y = R(l), *a = A(0), *b = A(1), *e = A(2);
+				for (int p = 0; p < n; p++)
+					y[p] = ((double(*)(double,double,
+						double))f)(a[p], b[p], e[p]);
+				}
+				break;
+			case 4: FORL(c->n) {
+				float *y = R(l), *a = A(0), *b = A(1), *e = A(2);
+				float *g = A(3);
+				for (int p = 0; p < n; p++)
+					y[p] = ((double(*)(double,double,
+						double,double))f)
+						(a[p], b[p], e[p], g[p]);
+				}
+				break;
+			case 5: FORL(c->n) {
+				float *y = R(l), *a = A(0), *b = A(1), *e = A(2);
+				float *g = A(3), *o = A(4);
+				for (int p = 0; p < n; p++)
+					y[p] = ((double(*)(double,double,
+						double,double,double))f)
+						(a[p], b[p], e[p], g[p], o[p]);
+				}
+				break;
+			}
+			break;
+					  }
+		// each draw starts from the state of the generator that the
+		// pixel-by-pixel evaluation would have
+		case PLAMBDA_OP_RANDOM: {
+			double (*f)(void) = (double(*)(void))c->f->f;
+			uint64_t s = lcg_knuth_skip(seed, c->draw0);
+			for (int p = 0; p < n; p++) {
+				lcg_knuth_srand(s);
+				r[p] = f();
+				s = m->jump[0] * s + m->jump[1];
+			}
+			break;
+					}
+		case PLAMBDA_OP_RANDOMF: {
+			double (*f)(double,double) =
+				(double(*)(double,double))c->f->f;
+			int dr = random_draws(c->f);
+			FORL(c->n) {
+				float *y = R(l), *a = A(0), *b = A(1);
+				uint64_t s = lcg_knuth_skip(seed, c->draw0 + l*dr);
+				for (int p = 0; p < n; p++) {
+					lcg_knuth_srand(s);
+					y[p] = f(a[p], b[p]);
+					s = m->jump[0] * s + m->jump[1];
+				}
+			}
+			break;
+					 }
+		// the vector functions receive copies of their arguments,
+		// because some of them use the input as temporary storage
+		case PLAMBDA_OP_VFUNCTION2:
+		case PLAMBDA_OP_VFUNCTION3:
+		case PLAMBDA_OP_BIVECTOR:
+		case PLAMBDA_OP_UNIVECTOR:
+			for (int p = 0; p < n; p++) {
+				float a[PLAMBDA_MAX_PIXELDIM];
+				float b[PLAMBDA_MAX_PIXELDIM];
+				float t[PLAMBDA_MAX_PIXELDIM];
+				FORL(c->d[0])
+					a[l] = x[(c->a[0]+l)*PLAMBDA_SPAN + p];
+				FORL(c->d[1])
+					b[l] = x[(c->a[1]+l)*PLAMBDA_SPAN + p];
+				plambda_vector_function(t, a, b, c);
+				FORL(c->n) R(l)[p] = t[l];
+			}
+			break;
+		default:
+			fail("impossible condition (instruction %d)", c->op);
+		}
+#undef LANES2
+#undef LANES1
+#undef A
+#undef R
+	}
+}
+
+
 // evaluation (higher level) {{{1
 
 static int eval_dim(struct plambda_program *p, float **val, int *pd)
@@ -2863,11 +4062,139 @@ static int eval_dim(struct plambda_program *p, float **val, int *pd)
 	return r;
 }
 
-// returns the dimension of the output
-static int run_program_vectorially(float *out, int pdmax,
+SMART_PARAMETER_SILENT(PLAMBDA_THREADS,0)
+
+// number of threads (n <= 0 means the environment, or else all the cores)
+static int plambda_threads(int n)
+{
+	if (n <= 0) n = PLAMBDA_THREADS();
+#ifdef _OPENMP
+	if (n <= 0) n = omp_get_max_threads();
+#else//_OPENMP
+	n = 1;
+#endif//_OPENMP
+	return n;
+}
+
+// evaluate the compiled program at the rows j0..j1-1 of the image, and store
+// the result into "out" starting at row j0
+//
+// The rows are evaluated in parallel.  The random generator is started
+// exactly where the sequential pixel-by-pixel evaluation would have it, so
+// that the result does not depend on the number of threads nor on the
+// evaluation order.
+//
+// seed: state of the random generator at the start of pixel (0,0)
+// the sample v rounded to the nearest integer of [0,qmax] (nan gives 0)
+static inline float plambda_quantize(float v, int qmax)
+{
+	return v > 0 ? v < qmax ? floorf(v + 0.5f) : qmax : 0;
+}
+
+// store the sample v at the position k of the output, which has samples of
+// type float (when qmax = 0), uint8_t (qmax = 255) or uint16_t (qmax = 65535)
+static inline void plambda_store(void *out, int qmax, long k, float v)
+{
+	if (qmax == 255)
+		((uint8_t *)out)[k] = plambda_quantize(v, qmax);
+	else if (qmax == 65535)
+		((uint16_t *)out)[k] = plambda_quantize(v, qmax);
+	else
+		((float *)out)[k] = v;
+}
+
+// bytes per sample of an output with samples in [0,qmax]
+static int plambda_sample_size(int qmax)
+{
+	return qmax == 255 ? 1 : qmax == 65535 ? 2 : sizeof(float);
+}
+
+// the pixels of the rows j0..j1-1 of the program, written into out with
+// the type given by qmax (see "plambda_store"); the result is quantized
+// while it is evaluated, so that no float image is stored
+static void plambda_machine_run_rows_q(void *out, int qmax,
+		struct plambda_machine *m,
+		float **val, int *w, int *h, int *pd, int j0, int j1,
+		uint64_t seed, int nthreads)
+{
+	int pdmax = m->outn;
+	uint64_t pixdraws = m->draws;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+#else
+	(void)nthreads;
+#endif
+	{
+	float *x = xmalloc((m->nx + 1) * PLAMBDA_SPAN * sizeof*x);
+	plambda_machine_init(x, m);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+	for (int j = j0; j < j1; j++)
+	for (int i = 0; i < *w; i += PLAMBDA_SPAN)
+	{
+		int n = *w - i < PLAMBDA_SPAN ? *w - i : PLAMBDA_SPAN;
+		uint64_t s = lcg_knuth_skip(seed,
+				(j * (uint64_t)*w + i) * pixdraws);
+		plambda_machine_run_span(x, m, val, w,h,pd, i,j, n, s);
+		long k = (i + (j - j0) * (long)*w) * pdmax;
+		float *y = x + m->out * PLAMBDA_SPAN;
+		if (!qmax) {
+			float *o = (float *)out + k;
+			for (int p = 0; p < n; p++)
+			for (int l = 0; l < pdmax; l++)
+				o[p*pdmax+l] = y[l*PLAMBDA_SPAN+p];
+		} else
+			for (int p = 0; p < n; p++)
+			for (int l = 0; l < pdmax; l++)
+				plambda_store(out, qmax, k + p*pdmax + l,
+						y[l*PLAMBDA_SPAN+p]);
+	}
+	free(x);
+	}
+}
+
+static void plambda_machine_run_rows(float *out, struct plambda_machine *m,
+		float **val, int *w, int *h, int *pd, int j0, int j1,
+		uint64_t seed, int nthreads)
+{
+	plambda_machine_run_rows_q(out, 0, m, val, w, h, pd, j0, j1, seed,
+			nthreads);
+}
+
+// leave the random generator as the sequential evaluation of the whole image
+static void plambda_machine_skip_image(struct plambda_machine *m,
+		int w, int h, uint64_t seed)
+{
+	if (m->draws)
+		lcg_knuth_srand(lcg_knuth_skip(seed,
+					w * (uint64_t)h * m->draws));
+}
+
+// returns the dimension of the output (of samples of the type given by
+// qmax, see "plambda_store")
+static int run_program_vectorially_q(void *out, int qmax, int pdmax,
 		struct plambda_program *p,
-		float **val, int *w, int *h, int *pd)
+		float **val, int *w, int *h, int *pd, int nthreads,
+		bool optimize, bool verbose)
 {
+	struct plambda_machine m[1];
+	bool compiled = plambda_machine_compile(m, p, val, w, h, pd, optimize);
+	if (verbose) {
+		print_compiled_program(p);
+		if (compiled) print_compiled_machine(m);
+	}
+	if (compiled && m->outn == pdmax)
+	{
+		uint64_t seed = lcg_knuth_seed;
+		plambda_machine_run_rows_q(out, qmax, m, val,w,h,pd, 0,*h,
+				seed, nthreads);
+		plambda_machine_skip_image(m, *w, *h, seed);
+		free(m->c);
+		return pdmax;
+	}
+	free(m->c);
+
 	for (int j = 0; j < *h; j++)
 	for (int i = 0; i < *w; i++)
 	{
@@ -2876,11 +4203,459 @@ static int run_program_vectorially(float *out, int pdmax,
 		assert(r == pdmax);
 		if (r != pdmax) fail("r != pdmax");
 		for (int l = 0; l < r; l++)
-			setsample_0(out, *w, *h, pdmax, i, j, l, result[l]);
+			plambda_store(out, qmax, (j * (long)*w + i) * pdmax + l,
+					result[l]);
 	}
 	return pdmax;
 }
 
+static int run_program_vectorially(float *out, int pdmax,
+		struct plambda_program *p,
+		float **val, int *w, int *h, int *pd, int nthreads,
+		bool optimize, bool verbose)
+{
+	return run_program_vectorially_q(out, 0, pdmax, p, val, w, h, pd,
+			nthreads, optimize, verbose);
+}
+
+// reductions {{{2
+
+#define PLAMBDA_REDUCE_SUM    1
+#define PLAMBDA_REDUCE_MEAN   2
+#define PLAMBDA_REDUCE_MINMAX 3
+#define PLAMBDA_REDUCE_HIST   4
+
+// statistics of the components of the result, accumulated while it is
+// evaluated instead of storing the image (option -r)
+//
+// The sums of each row are kept apart and added in order at the end, so that
+// the result does not depend on the number of threads.
+struct plambda_reduction {
+	int kind;             // one of the PLAMBDA_REDUCE_* above
+	int pd, h;            // dimension of the result, number of rows
+	int nbins;            // for histograms
+	bool range;           // whether the range of the histogram is known
+	double lo, hi;        // range of the histogram
+	long double *rowsum;  // sum of the (non-nan) samples of each row
+	long *rown;           // number of (non-nan) samples of each row
+	float min[PLAMBDA_MAX_PIXELDIM];
+	float max[PLAMBDA_MAX_PIXELDIM];
+	long *hist;           // hist[b*pd+l] = count of bin b for component l
+};
+
+// the part of a reduction accumulated by each thread
+struct plambda_accumulator {
+	float min[PLAMBDA_MAX_PIXELDIM];
+	float max[PLAMBDA_MAX_PIXELDIM];
+	long *hist;
+};
+
+// parse a reduction like "sum", "mean", "minmax", "hist:N" or "hist:N:a:b"
+static void plambda_reduction_parse(struct plambda_reduction *r, char *spec)
+{
+	double lo, hi;
+	r->range = false;
+	r->nbins = 0;
+	if (0 == strcmp(spec, "sum")) r->kind = PLAMBDA_REDUCE_SUM;
+	else if (0 == strcmp(spec, "mean")) r->kind = PLAMBDA_REDUCE_MEAN;
+	else if (0 == strcmp(spec, "avg")) r->kind = PLAMBDA_REDUCE_MEAN;
+	else if (0 == strcmp(spec, "minmax")) r->kind = PLAMBDA_REDUCE_MINMAX;
+	else if (3 == sscanf(spec, "hist:%d:%lf:%lf", &r->nbins, &lo, &hi)) {
+		r->kind = PLAMBDA_REDUCE_HIST;
+		r->range = true;
+		r->lo = lo;
+		r->hi = hi;
+	} else if (1 == sscanf(spec, "hist:%d", &r->nbins))
+		r->kind = PLAMBDA_REDUCE_HIST;
+	else fail("unrecognized reduction \"%s\"", spec);
+	if (r->kind == PLAMBDA_REDUCE_HIST && r->nbins < 1)
+		fail("bad number of histogram bins \"%s\"", spec);
+}
+
+// start a pass of the reduction over an image with h rows of pd samples
+static void plambda_reduction_start(struct plambda_reduction *r, int pd, int h)
+{
+	r->pd = pd;
+	r->h = h;
+	r->rowsum = xmalloc(h * (size_t)pd * sizeof*r->rowsum);
+	r->rown = xmalloc(h * (size_t)pd * sizeof*r->rown);
+	FORI(h * pd) r->rowsum[i] = r->rown[i] = 0;
+	FORL(pd) r->min[l] = INFINITY;
+	FORL(pd) r->max[l] = -INFINITY;
+	r->hist = NULL;
+	if (r->kind == PLAMBDA_REDUCE_HIST && r->range) {
+		r->hist = xmalloc(r->nbins * pd * sizeof*r->hist);
+		FORI(r->nbins * pd) r->hist[i] = 0;
+	}
+}
+
+static void plambda_reduction_end(struct plambda_reduction *r)
+{
+	free(r->rowsum);
+	free(r->rown);
+	free(r->hist);
+}
+
+static void plambda_accumulator_init(struct plambda_accumulator *a,
+		struct plambda_reduction *r)
+{
+	FORL(r->pd) a->min[l] = INFINITY;
+	FORL(r->pd) a->max[l] = -INFINITY;
+	a->hist = NULL;
+	if (r->hist) {
+		a->hist = xmalloc(r->nbins * r->pd * sizeof*a->hist);
+		FORI(r->nbins * r->pd) a->hist[i] = 0;
+	}
+}
+
+// add the samples of a thread to the reduction (one thread at a time)
+static void plambda_accumulator_merge(struct plambda_reduction *r,
+		struct plambda_accumulator *a)
+{
+	FORL(r->pd) if (a->min[l] < r->min[l]) r->min[l] = a->min[l];
+	FORL(r->pd) if (a->max[l] > r->max[l]) r->max[l] = a->max[l];
+	if (a->hist) {
+		FORI(r->nbins * r->pd) r->hist[i] += a->hist[i];
+		free(a->hist);
+	}
+}
+
+// accumulate the samples y[p*ps+l*cs] of n pixels of the row j
+static void plambda_accumulate(struct plambda_reduction *r,
+		struct plambda_accumulator *a, float *y, int n, int ps, int cs,
+		int j)
+{
+	double f = r->hi > r->lo ? r->nbins / (r->hi - r->lo) : 0;
+	FORL(r->pd) {
+		long double s = 0;
+		long k = 0;
+		float min = a->min[l], max = a->max[l];
+		for (int p = 0; p < n; p++) {
+			float v = y[p*ps + l*cs];
+			if (isnan(v)) continue;
+			s += v;
+			k += 1;
+			if (v < min) min = v;
+			if (v > max) max = v;
+			if (a->hist) {
+				int b = floor((v - r->lo) * f);
+				if (v == r->hi) b = r->nbins - 1;
+				if (b >= 0 && b < r->nbins)
+					a->hist[b*r->pd + l] += 1;
+			}
+		}
+		r->rowsum[j*r->pd + l] += s;
+		r->rown[j*r->pd + l] += k;
+		a->min[l] = min;
+		a->max[l] = max;
+	}
+}
+
+// accumulate the compiled program over the whole image, without storing it
+static void plambda_machine_reduce(struct plambda_reduction *r,
+		struct plambda_machine *m, float **val, int *w, int *h, int *pd,
+		uint64_t seed, int nthreads)
+{
+	uint64_t pixdraws = m->draws;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+#else
+	(void)nthreads;
+#endif
+	{
+	float *x = xmalloc((m->nx + 1) * PLAMBDA_SPAN * sizeof*x);
+	plambda_machine_init(x, m);
+	struct plambda_accumulator a[1];
+	plambda_accumulator_init(a, r);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+	for (int j = 0; j < *h; j++)
+	for (int i = 0; i < *w; i += PLAMBDA_SPAN)
+	{
+		int n = *w - i < PLAMBDA_SPAN ? *w - i : PLAMBDA_SPAN;
+		uint64_t s = lcg_knuth_skip(seed,
+				(j * (uint64_t)*w + i) * pixdraws);
+		plambda_machine_run_span(x, m, val, w,h,pd, i,j, n, s);
+		plambda_accumulate(r, a, x + m->out * PLAMBDA_SPAN, n,
+				1, PLAMBDA_SPAN, j);
+	}
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+	plambda_accumulator_merge(r, a);
+	free(x);
+	}
+}
+
+// accumulate an image already evaluated
+static void plambda_image_reduce(struct plambda_reduction *r,
+		float *x, int w, int h)
+{
+	struct plambda_accumulator a[1];
+	plambda_accumulator_init(a, r);
+	for (int j = 0; j < h; j++)
+		plambda_accumulate(r, a, x + j * (long)w * r->pd, w,
+				r->pd, 1, j);
+	plambda_accumulator_merge(r, a);
+}
+
+// set the range of the histogram from the result of a first pass
+static void plambda_reduction_set_range(struct plambda_reduction *r)
+{
+	r->lo = INFINITY;
+	r->hi = -INFINITY;
+	FORL(r->pd) if (r->min[l] < r->lo) r->lo = r->min[l];
+	FORL(r->pd) if (r->max[l] > r->hi) r->hi = r->max[l];
+	if (r->lo > r->hi) r->lo = r->hi = 0; // all the samples are nan
+	if (!isfinite(r->hi - r->lo))
+		fail("can not build histogram of infinite values "
+				"(give the range as hist:N:a:b)");
+	r->range = true;
+}
+
+static void plambda_reduction_print(struct plambda_reduction *r)
+{
+	char *fmt = getenv("PLAMBDA_FFMT");
+	if (!fmt) fmt = "%.15lf";
+	int pd = r->pd;
+	long double sum[pd];
+	long n[pd];
+	FORL(pd) {
+		sum[l] = 0;
+		n[l] = 0;
+		FORJ(r->h) sum[l] += r->rowsum[j*pd + l];
+		FORJ(r->h) n[l] += r->rown[j*pd + l];
+	}
+	switch (r->kind) {
+	case PLAMBDA_REDUCE_SUM:
+		FORL(pd) {
+			printf(fmt, (double)sum[l]);
+			putchar(l == pd - 1 ? '\n' : ' ');
+		}
+		break;
+	case PLAMBDA_REDUCE_MEAN:
+		FORL(pd) {
+			printf(fmt, (double)(sum[l] / n[l]));
+			putchar(l == pd - 1 ? '\n' : ' ');
+		}
+		break;
+	case PLAMBDA_REDUCE_MINMAX:
+		FORL(pd) {
+			printf(fmt, r->min[l]);
+			putchar(l == pd - 1 ? '\n' : ' ');
+		}
+		FORL(pd) {
+			printf(fmt, r->max[l]);
+			putchar(l == pd - 1 ? '\n' : ' ');
+		}
+		break;
+	case PLAMBDA_REDUCE_HIST:
+		FORI(r->nbins) {
+			double d = (r->hi - r->lo) / r->nbins;
+			printf(fmt, r->lo + (i + 0.5) * d);
+			FORL(pd) printf(" %ld", r->hist[i*pd + l]);
+			putchar('\n');
+		}
+		break;
+	}
+}
+
+// evaluate the program and print the reduction of its result
+//
+// The compiled programs are reduced while they are evaluated.  Histograms
+// without a given range need two evaluations, the first one to find the
+// range; they use the same random numbers.
+static void run_program_reduction(char *spec, int pdmax,
+		struct plambda_program *p,
+		float **val, int *w, int *h, int *pd, int nthreads,
+		bool optimize, bool verbose)
+{
+	struct plambda_reduction r[1];
+	plambda_reduction_parse(r, spec);
+	int npasses = r->kind == PLAMBDA_REDUCE_HIST && !r->range ? 2 : 1;
+
+	struct plambda_machine m[1];
+	bool compiled = plambda_machine_compile(m, p, val, w, h, pd, optimize);
+	if (verbose) {
+		print_compiled_program(p);
+		if (compiled) print_compiled_machine(m);
+	}
+	if (compiled && m->outn == pdmax) {
+		uint64_t seed = lcg_knuth_seed;
+		for (int k = 0; k < npasses; k++) {
+			if (k) {
+				plambda_reduction_set_range(r);
+				plambda_reduction_end(r);
+			}
+			plambda_reduction_start(r, pdmax, *h);
+			plambda_machine_reduce(r, m, val,w,h,pd, seed,nthreads);
+		}
+		plambda_machine_skip_image(m, *w, *h, seed);
+	} else {
+		float *out = xmalloc(*w * (long)*h * pdmax * sizeof*out);
+		run_program_vectorially(out, pdmax, p, val, w, h, pd, nthreads,
+				optimize, false);
+		for (int k = 0; k < npasses; k++) {
+			if (k) {
+				plambda_reduction_set_range(r);
+				plambda_reduction_end(r);
+			}
+			plambda_reduction_start(r, pdmax, *h);
+			plambda_image_reduce(r, out, *w, *h);
+		}
+		free(out);
+	}
+	free(m->c);
+	plambda_reduction_print(r);
+	plambda_reduction_end(r);
+}
+
+// evaluation by bands of rows {{{2
+
+#include "iio.h"
+#include "profile.c"
+
+// a band of rows of an input image, read from a stream
+struct plambda_band {
+	struct iio_stream *s;
+	int w, h, pd;
+	int y0, y1;     // rows y0..y1-1 are stored in x
+	float *x;
+};
+
+// load the rows a..z-1 of the image (the bands can only move forward)
+static void plambda_band_load(struct plambda_band *b, int a, int z)
+{
+	if (a < 0) a = 0;
+	if (z > b->h) z = b->h;
+	size_t n = b->w * (size_t)b->pd;
+	if (a >= b->y1)
+		b->y0 = b->y1 = a;
+	else if (a > b->y0) {
+		memmove(b->x, b->x + (a - b->y0) * n,
+				(b->y1 - a) * n * sizeof*b->x);
+		b->y0 = a;
+	}
+	if (z > b->y1) {
+		int r = z - b->y1;
+		if (r != iio_read_rows(b->s, b->x + (b->y1-b->y0)*n, b->y1, r))
+			fail("could not read rows %d..%d", b->y1, z - 1);
+		b->y1 = z;
+	}
+}
+
+// pointer to the (virtual) first row of the image, so that the band is
+// accessed with the coordinates of the whole image
+static float *plambda_band_origin(struct plambda_band *b)
+{
+	return b->x - b->y0 * (long)b->w * b->pd;
+}
+
+// largest vertical distance between a pixel and the samples it depends on
+static int plambda_program_halo(struct plambda_program *p)
+{
+	int r = 0;
+	FORI(p->n) {
+		struct plambda_token *t = p->t + i;
+		int d = abs(t->displacement[1]);
+		if (t->type == PLAMBDA_IMAGEOP)
+			d += 1; // all the stencils are 3x3
+		else if (t->type != PLAMBDA_SCALAR && t->type != PLAMBDA_VECTOR)
+			continue;
+		if (d > r) r = d;
+	}
+	return r;
+}
+
+// evaluate the program by bands of rows, reading the images by streams and
+// writing the result as it is computed
+//
+// Each band is read with a margin of as many rows as the largest vertical
+// displacement of the program.  If that is not enough (the program has
+// global operators, or the images have different sizes, or they are
+// extrapolated periodically), the whole images are read instead.
+static void run_program_by_bands(char *filename_out, struct plambda_program *p,
+		char **fname, int n, int band, int nthreads,
+		bool optimize, bool verbose)
+{
+	struct plambda_band b[n];
+	int w[n], h[n], pd[n];
+	float *val[n];
+	bool ok = true;
+	FORI(n) {
+		b[i].s = iio_open(fname[i], w + i, h + i, pd + i);
+		if (!b[i].s) fail("could not open image \"%s\"", fname[i]);
+		b[i].w = w[i];
+		b[i].h = h[i];
+		b[i].pd = pd[i];
+		b[i].y0 = b[i].y1 = 0;
+		ok = ok && w[i] == *w && h[i] == *h;
+	}
+	int halo = plambda_program_halo(p);
+	int rows = band + 2 * halo;
+	FORI(n) {
+		size_t r = rows < h[i] ? rows : h[i];
+		b[i].x = xmalloc(r * w[i] * pd[i] * sizeof*b[i].x);
+		plambda_band_load(b + i, -halo, band + halo);
+		val[i] = plambda_band_origin(b + i);
+	}
+
+	struct plambda_machine m[1];
+	m->c = NULL;
+	int pdreal = 0;
+	ok = ok && getsample_operator_cfg() != getsample_per
+		&& plambda_machine_compile(m, p, val, w, h, pd, optimize)
+		&& m->outn == (pdreal = eval_dim(p, val, pd));
+	if (!ok)
+	{
+		if (verbose)
+			fprintf(stderr, "can not evaluate by bands\n");
+		FORI(n) {
+			b[i].x = xrealloc(b[i].x, h[i]*(size_t)w[i]*pd[i]*sizeof*b[i].x);
+			plambda_band_load(b + i, 0, h[i]);
+			val[i] = b[i].x;
+		}
+		pdreal = eval_dim(p, val, pd);
+		float *out = xmalloc(*w * (long)*h * pdreal * sizeof*out);
+		PROFILE_SCOPE("plambda")
+			run_program_vectorially(out, pdreal, p, val, w, h, pd,
+					nthreads, optimize, verbose);
+		iio_write_image_float_vec(filename_out, out, *w, *h, pdreal);
+		free(out);
+	} else {
+		if (verbose) {
+			print_compiled_program(p);
+			print_compiled_machine(m);
+			fprintf(stderr, "evaluating by bands of %d rows with "
+					"a margin of %d rows\n", band, halo);
+		}
+		uint64_t seed = lcg_knuth_seed;
+		float *out = xmalloc(*w * (long)band * pdreal * sizeof*out);
+		struct iio_ostream *o = iio_create(filename_out,*w,*h,pdreal);
+		for (int j = 0; j < *h; j += band)
+		{
+			int j1 = j + band < *h ? j + band : *h;
+			FORI(n) {
+				plambda_band_load(b + i, j - halo, j1 + halo);
+				val[i] = plambda_band_origin(b + i);
+			}
+			PROFILE_SCOPE("plambda")
+				plambda_machine_run_rows(out, m, val, w, h, pd,
+						j, j1, seed, nthreads);
+			iio_write_rows(o, out, j1 - j);
+		}
+		plambda_machine_skip_image(m, *w, *h, seed);
+		iio_finish(o);
+		free(out);
+	}
+	free(m->c);
+	FORI(n) {
+		free(b[i].x);
+		iio_close(b[i].s);
+	}
+}
+
 // mains {{{1
 
 static void add_hidden_variables(char *out, int maxplen, int newvars, char *in)
@@ -2964,7 +4739,153 @@ static char *pick_option(int *c, char ***v, char *o, char *d)
 	return d;
 }
 
-#include "iio.h"
+// a line of a batch list: the names of the input images and of the output
+struct plambda_tuple {
+	int n;
+	char **f;
+};
+
+// read the lines of a batch list (the files are separated by spaces, and
+// anything after a '#' is ignored)
+static struct plambda_tuple *read_batch_list(char *filename, int *ntuples)
+{
+	FILE *f = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+	if (!f) fail("could not open batch list \"%s\"", filename);
+	struct plambda_tuple *t = NULL;
+	int n = 0, nalloc = 0;
+	char line[0x10000];
+	while (fgets(line, sizeof line, f))
+	{
+		char *hash = strchr(line, '#');
+		if (hash) *hash = '\0';
+		char *w[PLAMBDA_MAX_TOKENS], *tok = strtok(line, " \t\r\n");
+		int nw = 0;
+		for (; tok; tok = strtok(NULL, " \t\r\n")) {
+			if (nw >= PLAMBDA_MAX_TOKENS)
+				fail("too many files on a line of \"%s\"", filename);
+			w[nw++] = tok;
+		}
+		if (!nw) continue;
+		if (n >= nalloc) {
+			nalloc = 2 * nalloc + 16;
+			t = xrealloc(t, nalloc * sizeof*t);
+		}
+		t[n].n = nw;
+		t[n].f = xmalloc(nw * sizeof*t[n].f);
+		FORI(nw) {
+			t[n].f[i] = xmalloc(1 + strlen(w[i]));
+			strcpy(t[n].f[i], w[i]);
+		}
+		n += 1;
+	}
+	if (f != stdin) fclose(f);
+	*ntuples = n;
+	return t;
+}
+
+static bool program_has_magic(struct plambda_program *p)
+{
+	FORI(p->n)
+		if (p->t[i].type == PLAMBDA_MAGIC)
+			return true;
+	return false;
+}
+
+// evaluate the program on each line of a batch list
+//
+// The program is parsed once, and the lines are processed in parallel, each
+// one by a single thread, so that the decoding, evaluation and encoding of
+// different lines overlap.  The instructions are compiled again only when
+// the sizes of the images change.  Each line gets the same random numbers as
+// a separate run of plambda.  The magic variables are cached globally, thus
+// the programs that use them are evaluated one line after another.
+static int run_program_batch(char *listname, char *expression, int nthreads,
+		bool optimize, bool verbose)
+{
+	int ntuples;
+	struct plambda_tuple *t = read_batch_list(listname, &ntuples);
+	if (!ntuples) return EXIT_SUCCESS;
+	int n = t->n - 1;
+	FORI(ntuples) if (t[i].n != t->n)
+		fail("tuple %d of the batch has %d files instead of %d",
+				i, t[i].n, t->n);
+	if (n < 1)
+		fail("the batch must give the input images and the output");
+
+	struct plambda_program p[1];
+	plambda_compile_program(p, expression);
+	if (p->var->n == 0) {
+		int maxplen = n*10 + strlen(expression) + 100;
+		char newprogram[maxplen];
+		add_hidden_variables(newprogram, maxplen, n, expression);
+		plambda_compile_program(p, newprogram);
+	}
+	if (n != p->var->n)
+		fail("the program expects %d variables but %d images "
+					"are given by the batch", p->var->n, n);
+	bool magic = program_has_magic(p);
+	if (magic) nthreads = 1;
+	if (verbose) print_compiled_program(p);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nthreads) if(nthreads > 1)
+#else
+	(void)nthreads;
+#endif
+	{
+	struct plambda_machine m[1];
+	m->c = NULL;
+	bool compiled = false;
+	int mkey[n + 2];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+	for (int k = 0; k < ntuples; k++)
+	{
+		char **f = t[k].f;
+		int w[n], h[n], pd[n], key[n + 2];
+		float *x[n];
+		FORI(n) x[i] = iio_map_image_float_vec(f[i], w+i, h+i, pd+i);
+		if (magic) reset_magic_stats();
+
+		// the instructions depend only on the sizes of the images
+		key[0] = *w;
+		key[1] = *h;
+		FORI(n) key[i+2] = pd[i];
+		if (!m->c || memcmp(key, mkey, sizeof key)) {
+			free(m->c);
+			compiled = plambda_machine_compile(m, p, x, w, h, pd,
+					optimize);
+			memcpy(mkey, key, sizeof key);
+			if (verbose && compiled) print_compiled_machine(m);
+		}
+
+		xsrand(100+SRAND());
+		int pdreal = eval_dim(p, x, pd);
+		float *out = xmalloc(*w * (long)*h * pdreal * sizeof*out);
+		if (compiled && m->outn == pdreal)
+			plambda_machine_run_rows(out, m, x, w, h, pd, 0, *h,
+					lcg_knuth_seed, 1);
+		else
+			run_program_vectorially(out, pdreal, p, x, w, h, pd, 1,
+					optimize, false);
+		iio_write_image_float_vec(f[n], out, *w, *h, pdreal);
+
+		FORI(n) iio_free(x[i]);
+		free(out);
+	}
+	free(m->c);
+	}
+
+	FORI(ntuples) {
+		FORJ(t[i].n) free(t[i].f[j]);
+		free(t[i].f);
+	}
+	free(t);
+	collection_of_varnames_end(p->var);
+	return EXIT_SUCCESS;
+}
+
 static int main_images(int c, char **v)
 {
 	//fprintf(stderr, "main images c = %d\n", c);
@@ -2977,6 +4898,24 @@ static int main_images(int c, char **v)
 	}
 	bool verbose = pick_option(&c, &v, "v", NULL);
 	char *filename_out = pick_option(&c, &v, "o", "-");
+	int nthreads = plambda_threads(atoi(pick_option(&c, &v, "j", "0")));
+	bool optimize = !pick_option(&c, &v, "O0", NULL);
+	int band = atoi(pick_option(&c, &v, "t", "0"));
+	char *batch = pick_option(&c, &v, "-batch", "");
+	char *reduction = pick_option(&c, &v, "r", "");
+	char *quant = pick_option(&c, &v, "q", "");
+	int qmax = 0;
+	if (0 == strcmp(quant, "u8")) qmax = 255;
+	else if (0 == strcmp(quant, "u16")) qmax = 65535;
+	else if (*quant) fail("unrecognized output type \"%s\"", quant);
+	if (qmax && (*batch || band > 0))
+		fail("the option -q can not be used with -t or --batch");
+	if (*batch) {
+		if (c != 2)
+			fail("usage:\n\t%s --batch list.txt \"plambda\"", *v);
+		return run_program_batch(batch, v[1], nthreads, optimize,
+				verbose);
+	}
 
 	struct plambda_program p[1];
 
@@ -2994,12 +4933,6 @@ static int main_images(int c, char **v)
 	if (n != p->var->n && !(n == 1 && p->var->n == 0))
 		fail("the program expects %d variables but %d images "
 					"were given", p->var->n, n);
-	int w[n], h[n], pd[n];
-	float *x[n];
-	FORI(n) x[i] = iio_read_image_float_vec(v[i+1], w + i, h + i, pd + i);
-	//FORI(n-1)
-	//	if (w[0] != w[i+1] || h[0] != h[i+1])// || pd[0] != pd[i+1])
-	//		fail("input images size mismatch");
 
 	if (n>1) FORI(n) if (!strstr(p->var->t[i], "hidden") && verbose)
 		fprintf(stderr, "plambda correspondence \"%s\" = \"%s\"\n",
@@ -3007,16 +4940,46 @@ static int main_images(int c, char **v)
 
 	xsrand(100+SRAND());
 
+	if (band > 0 && n > 0) {
+		run_program_by_bands(filename_out, p, v + 1, n, band, nthreads,
+				optimize, verbose);
+		collection_of_varnames_end(p->var);
+		return EXIT_SUCCESS;
+	}
+
+	int w[n], h[n], pd[n];
+	float *x[n];
+	FORI(n) x[i] = iio_map_image_float_vec(v[i+1], w + i, h + i, pd + i);
+	//FORI(n-1)
+	//	if (w[0] != w[i+1] || h[0] != h[i+1])// || pd[0] != pd[i+1])
+	//		fail("input images size mismatch");
+
 	////print_compiled_program(p);
 	int pdreal = eval_dim(p, x, pd);
 
-	float *out = xmalloc(*w * (long)*h * pdreal * sizeof*out);
-	int opd = run_program_vectorially(out, pdreal, p, x, w, h, pd);
+	if (*reduction) {
+		run_program_reduction(reduction, pdreal, p, x, w, h, pd,
+				nthreads, optimize, verbose);
+		FORI(n) iio_free(x[i]);
+		collection_of_varnames_end(p->var);
+		return EXIT_SUCCESS;
+	}
+
+	void *out = xmalloc(*w * (long)*h * pdreal * plambda_sample_size(qmax));
+	int opd = 0;
+	PROFILE_SCOPE("plambda")
+		opd = run_program_vectorially_q(out, qmax, pdreal, p, x, w, h,
+				pd, nthreads, optimize, verbose);
 	assert(opd == pdreal);
 
-	iio_write_image_float_vec(filename_out, out, *w, *h, opd);
+	if (qmax == 255)
+		iio_write_image_uint8_vec(filename_out, out, *w, *h, opd);
+	else if (qmax == 65535)
+		iio_write_image_uint16_vec(filename_out, out, *w, *h, opd);
+	else
+		iio_write_image_float_vec(filename_out, out, *w, *h, opd);
 
-	FORI(n) free(x[i]);
+	FORI(n) iio_free(x[i]);
 	free(out);
 	collection_of_varnames_end(p->var);
 
@@ -3045,10 +5008,27 @@ expression are assigned to each input image in alphabetical order.\n\
 Usage: plambda a.png b.png c.png ... \"EXPRESSION\" > output\n\
    or: plambda a.png b.png c.png ... \"EXPRESSION\" -o output.png\n\
    or: plambda -c num1 num2 num3  ... \"EXPRESSION\"\n\
+   or: plambda --batch list.txt \"EXPRESSION\"\n\
 \n\
 Options:\n\
  -o file\tsave output to named file\n\
- -v\t\tverbose (print correspondence between files and variables)\n\
+ -q type\tstore the output with samples of type u8 or u16, rounded\n\
+ \t\tand clamped to [0,255] or [0,65535] while it is evaluated\n\
+ -j n\t\tuse n threads (default: PLAMBDA_THREADS, or all the cores)\n\
+ -O0\t\tdo not optimize the compiled expression\n\
+ -f32\t\tuse the single-precision variants of the math functions and\n\
+ \t\tsingle-precision arithmetic (faster, but the results may\n\
+ \t\tdiffer slightly from the default double precision)\n\
+ --batch list\tevaluate the expression for each line of the list, that\n\
+ \t\tgives the input files and then the output file (the lines\n\
+ \t\tare processed in parallel, see -j)\n\
+ -r red\t\tprint a reduction of the result instead of the image: sum,\n\
+ \t\tmean, minmax (two lines), or hist:N (N bins between the\n\
+ \t\tminimum and the maximum) or hist:N:a:b (N bins in [a,b])\n\
+ -t n\t\tevaluate by bands of n rows, streaming the images (the output\n\
+ \t\tis written while it is computed if it is a tiff file)\n\
+ -v\t\tverbose (print correspondence between files and variables,\n\
+ \t\tand the compiled expression)\n\
  -c\t\tact as a symbolic calculator\n\
  -h\t\tdisplay short help message\n\
  --help\t\tdisplay longer help message\n\
@@ -3178,6 +5158,7 @@ Magic variable modifiers (global data associated to each input image):\n\
  x%9n\tcomponent-wise nth order statistic (from the right)\n\
 \n\
 Random numbers (seeded by the SRAND environment variable):\n\
+(the result is the same for any number of threads)\n\
  randu\tpush a random number with distribution Uniform(0,1)\n\
  randn\tpush a random number with distribution Normal(0,1)\n\
  randc\tpush a random number with distribution Cauchy(0,1)\n\
@@ -3340,6 +5321,9 @@ int main_plambda(int c, char **v)
 	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
 	if (c == 2 && 0 == strcmp(v[1], "--examples"))return print_examples();
 
+	if (pick_option(&c, &v, "f32", NULL)) bind_float_functions();
+	threads_pin();
+
 	int (*f)(int, char**) = **v=='c' ?  main_calc : main_images;
 	if (f == main_images && c > 2 && 0 == strcmp(v[1], "-c")) {
 		for (int i = 1; i <= c; i++)
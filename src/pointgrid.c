@@ -0,0 +1,229 @@
+#ifndef _POINTGRID_C
+#define _POINTGRID_C
+
+// uniform grid index of a point cloud, for radius and nearest neighbor queries
+//
+// The first (up to three) coordinates of the points are binned into cubic
+// cells, and the indices of the points are sorted by cell with a counting
+// sort, so that the grid is built in two passes over the points and the
+// points of each cell are contiguous.  The queries visit the cells around
+// the query point: the radius queries visit a fixed block of cells, and the
+// nearest neighbor queries visit growing shells of cells until the k-th
+// neighbor found is closer than the unvisited shells.  The queries do not
+// modify the grid, so that they can run in parallel.  The points must have
+// finite coordinates.
+//
+// This file needs a function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define POINTGRID_DENSITY 2 // average number of points per cell
+
+struct pointgrid {
+	long n;       // number of points
+	int d;        // number of coordinates used for the cells (1 to 3)
+	float *x;     // the points, not owned by the grid: x[i*stride+k]
+	int stride;
+	double o[3];  // origin of the grid
+	double s;     // side of the cells
+	int g[3];     // number of cells along each axis
+	long *start;  // points of cell c: idx[start[c]] to idx[start[c+1]-1]
+	long *idx;
+};
+
+static long pointgrid_cell(struct pointgrid *p, const float *q, int c[3])
+{
+	long r = 0;
+	for (int k = 2; k >= 0; k--)
+	{
+		c[k] = k < p->d ? (q[k] - p->o[k]) / p->s : 0;
+		if (c[k] < 0) c[k] = 0;
+		if (c[k] >= p->g[k]) c[k] = p->g[k] - 1;
+		r = r * p->g[k] + c[k];
+	}
+	return r;
+}
+
+// build the grid of the n points x (with cells of side s, or a side chosen
+// from the density of the points when s <= 0)
+static void pointgrid_build(struct pointgrid *p, float *x, long n, int d,
+		int stride, double s)
+{
+	p->n = n;
+	p->d = d < 3 ? d : 3;
+	p->x = x;
+	p->stride = stride;
+
+	// bounding box
+	double a[3] = {0, 0, 0}, b[3] = {0, 0, 0};
+	for (int k = 0; k < p->d; k++)
+	{
+		a[k] = INFINITY;
+		b[k] = -INFINITY;
+	}
+	for (long i = 0; i < n; i++)
+	for (int k = 0; k < p->d; k++)
+	{
+		double v = x[i*stride+k];
+		if (v < a[k]) a[k] = v;
+		if (v > b[k]) b[k] = v;
+	}
+
+	// side of the cells, enlarged so that there are at most 2n+1 cells
+	double e = 0, v = 1;
+	int dv = 0;
+	for (int k = 0; k < p->d; k++)
+	{
+		if (b[k] - a[k] > e) e = b[k] - a[k];
+		if (b[k] > a[k]) { v *= b[k] - a[k]; dv += 1; }
+	}
+	if (!(s > 0))
+		s = dv ? pow(v * POINTGRID_DENSITY / (n + 1.0), 1.0 / dv) : 1;
+	if (!(s > 0) || !isfinite(s)) s = e > 0 ? e : 1;
+	for (;;) {
+		double nc = 1;
+		for (int k = 0; k < p->d; k++)
+			nc *= floor((b[k] - a[k]) / s) + 1;
+		if (nc <= 2.0 * n + 1)
+			break;
+		s *= 1.25;
+	}
+	p->s = s;
+	long nc = 1;
+	for (int k = 0; k < 3; k++)
+	{
+		p->o[k] = a[k];
+		p->g[k] = k < p->d ? floor((b[k] - a[k]) / s) + 1 : 1;
+		nc *= p->g[k];
+	}
+
+	// counting sort of the points by cell
+	p->start = xmalloc((nc + 1) * sizeof*p->start);
+	p->idx = xmalloc((n ? n : 1) * sizeof*p->idx);
+	long *cell = xmalloc((n ? n : 1) * sizeof*cell);
+	for (long c = 0; c <= nc; c++)
+		p->start[c] = 0;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < n; i++)
+	{
+		int c[3];
+		cell[i] = pointgrid_cell(p, x + i*stride, c);
+	}
+	for (long i = 0; i < n; i++)
+		p->start[cell[i] + 1] += 1;
+	for (long c = 0; c < nc; c++)
+		p->start[c + 1] += p->start[c];
+	for (long i = 0; i < n; i++)
+		p->idx[p->start[cell[i]]++] = i;
+	for (long c = nc; c > 0; c--)
+		p->start[c] = p->start[c - 1];
+	p->start[0] = 0;
+	free(cell);
+}
+
+static void pointgrid_free(struct pointgrid *p)
+{
+	free(p->start);
+	free(p->idx);
+}
+
+static double pointgrid_dist2(struct pointgrid *p, const float *q, long i)
+{
+	const float *y = p->x + i * p->stride;
+	double r = 0;
+	for (int k = 0; k < p->d; k++)
+		r += (q[k] - y[k]) * (double)(q[k] - y[k]);
+	return r;
+}
+
+// number of points at distance at most r of q (not counting the point
+// "self", if it is a point of the grid), stopping at nmax
+static long pointgrid_count(struct pointgrid *p, const float *q, double r,
+		long self, long nmax)
+{
+	int c[3], m = ceil(r / p->s), lo[3], hi[3];
+	pointgrid_cell(p, q, c);
+	for (int k = 0; k < 3; k++)
+	{
+		lo[k] = c[k] - m < 0 ? 0 : c[k] - m;
+		hi[k] = c[k] + m >= p->g[k] ? p->g[k] - 1 : c[k] + m;
+	}
+	long n = 0;
+	for (int z = lo[2]; z <= hi[2]; z++)
+	for (int y = lo[1]; y <= hi[1]; y++)
+	{
+		long row = (z * (long)p->g[1] + y) * p->g[0];
+		long t0 = p->start[row + lo[0]], t1 = p->start[row + hi[0] + 1];
+		for (long t = t0; t < t1; t++)
+			if (p->idx[t] != self
+					&& pointgrid_dist2(p, q, p->idx[t]) <= r * r)
+				if (++n >= nmax)
+					return n;
+	}
+	return n;
+}
+
+// insert (d2,i) into the sorted list of the best k candidates
+static void pointgrid_insert(double *od2, long *oi, int *nk, int k,
+		double d2, long i)
+{
+	if (*nk == k && d2 >= od2[k-1])
+		return;
+	int j = *nk < k ? (*nk)++ : k - 1;
+	for (; j > 0 && od2[j-1] > d2; j--)
+	{
+		od2[j] = od2[j-1];
+		oi[j] = oi[j-1];
+	}
+	od2[j] = d2;
+	oi[j] = i;
+}
+
+// the k nearest points of q (excluding the point "self"), as their indices
+// oi and squared distances od2, sorted; returns their number (less than k
+// only when the grid has fewer points)
+static int pointgrid_knn(long *oi, double *od2, int k, struct pointgrid *p,
+		const float *q, long self)
+{
+	int c[3], nk = 0;
+	pointgrid_cell(p, q, c);
+	int mmax = 0;
+	for (int l = 0; l < 3; l++)
+	{
+		if (c[l] > mmax) mmax = c[l];
+		if (p->g[l] - 1 - c[l] > mmax) mmax = p->g[l] - 1 - c[l];
+	}
+	for (int m = 0; m <= mmax; m++)
+	{
+		// the shell of cells at distance m (in cells) of the cell c
+		for (int z = c[2] - m; z <= c[2] + m; z++)
+		for (int y = c[1] - m; y <= c[1] + m; y++)
+		{
+			if (z < 0 || z >= p->g[2] || y < 0 || y >= p->g[1])
+				continue;
+			bool inner = abs(z - c[2]) < m && abs(y - c[1]) < m;
+			for (int x = c[0] - m; x <= c[0] + m; x += inner ? 2*m : 1)
+			{
+				if (x < 0 || x >= p->g[0])
+					continue;
+				long cell = (z * (long)p->g[1] + y) * p->g[0] + x;
+				for (long t = p->start[cell]; t < p->start[cell+1]; t++)
+					if (p->idx[t] != self)
+						pointgrid_insert(od2, oi, &nk, k,
+							pointgrid_dist2(p, q, p->idx[t]),
+							p->idx[t]);
+			}
+		}
+		// the unvisited points are farther than m cells
+		double b = m * p->s;
+		if (nk == k && od2[k-1] <= b * b)
+			break;
+	}
+	return nk;
+}
+
+#endif//_POINTGRID_C
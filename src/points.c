@@ -1,6 +1,7 @@
 // various operations with point clouds (generation, filtering)
 
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -15,6 +16,7 @@
 #include "parsenumbers.c"
 #include "drawsegment.c"
 #include "pickopt.c"
+#include "pointgrid.c"
 
 #define π 3.14159265358979323846264338328
 
@@ -175,6 +177,425 @@ int main_config(int c, char *v[])
 }
 
 
+// streams of points                                                        {{{1
+//
+// The filters below read and write their points by chunks, so that their
+// memory does not depend on the size of the input (except for the filters
+// that need all the points at once).  The points are text lines of numbers
+// (as printed by print_points), or npy files of float32 or float64 arrays
+// of shape (n,d).  The output is npy (float32) when its name ends in ".npy".
+
+#define POINTS_CHUNK 0x100000 // points per chunk
+
+struct point_reader {
+	FILE *f;
+	int d;          // number of coordinates
+	bool npy;       // binary rows (otherwise, text lines)
+	int ss;         // bytes per sample of the binary rows (4 or 8)
+	long left;      // rows left in the npy file
+	char *line;     // text line, already read but not yet returned
+	size_t nline;
+	bool pending;
+};
+
+// parse the header of a npy file, once its 6 magic bytes have been read
+static void point_reader_npy_header(struct point_reader *r)
+{
+	uint8_t v[2], l[4];
+	if (2 != fread(v, 1, 2, r->f)) fail("bad npy version");
+	int nl = v[0] == 1 ? 2 : 4;
+	if (nl != (int)fread(l, 1, nl, r->f)) fail("bad npy header");
+	long n = l[0] + 0x100 * l[1] + (nl > 2 ? 0x10000*l[2] + 0x1000000L*l[3] : 0);
+	char *h = xmalloc(n + 1);
+	if (n != (long)fread(h, 1, n, r->f)) fail("truncated npy header");
+	h[n] = '\0';
+	char *descr = strstr(h, "'descr'"), *shape = strstr(h, "'shape'");
+	if (!descr || !shape || strstr(h, "'fortran_order': True"))
+		fail("unsupported npy header \"%s\"", h);
+	if (strstr(descr, "'<f4'")) r->ss = 4;
+	else if (strstr(descr, "'<f8'")) r->ss = 8;
+	else fail("npy points must be little-endian floats (\"%s\")", h);
+	long a = 0, b = 1;
+	int k = sscanf(strchr(shape, '('), "(%ld, %ld", &a, &b);
+	if (k < 1 || strchr(strchr(shape, '('), ')') < strchr(shape, '('))
+		fail("bad npy shape \"%s\"", h);
+	if (k == 1) b = 1;
+	r->left = a;
+	r->d = b;
+	free(h);
+}
+
+// number of numbers in a text line
+static int count_numbers(char *s)
+{
+	int n = 0;
+	for (;;) {
+		char *e;
+		strtod(s, &e);
+		if (e == s) return n;
+		n += 1;
+		s = e;
+	}
+}
+
+static void point_reader_open(struct point_reader *r, char *filename)
+{
+	r->f = xfopen(filename, "r");
+	r->line = NULL;
+	r->nline = 0;
+	r->pending = false;
+	r->npy = false;
+	r->d = 0;
+	int c = getc(r->f);
+	if (c == 0x93) {
+		char m[5];
+		if (5 != fread(m, 1, 5, r->f) || memcmp(m, "NUMPY", 5))
+			fail("bad npy magic in \"%s\"", filename);
+		r->npy = true;
+		point_reader_npy_header(r);
+		return;
+	}
+	if (c != EOF)
+		ungetc(c, r->f);
+	while (getline(&r->line, &r->nline, r->f) >= 0)
+		if ((r->d = count_numbers(r->line))) {
+			r->pending = true;
+			break;
+		}
+}
+
+// read up to nmax points into x, returns their number
+static long point_reader_read(struct point_reader *r, float *x, long nmax)
+{
+	int d = r->d;
+	if (r->npy) {
+		long n = nmax < r->left ? nmax : r->left;
+		if (n <= 0)
+			return 0;
+		if (r->ss == 4)
+			n = fread(x, 4 * d, n, r->f);
+		else {
+			double *t = xmalloc(n * d * sizeof*t);
+			n = fread(t, 8 * d, n, r->f);
+			for (long i = 0; i < n * d; i++)
+				x[i] = t[i];
+			free(t);
+		}
+		r->left -= n;
+		return n;
+	}
+	long n = 0;
+	while (n < nmax && (r->pending
+			|| getline(&r->line, &r->nline, r->f) >= 0))
+	{
+		r->pending = false;
+		char *s = r->line, *e;
+		int k = 0;
+		for (; k < d; k++, s = e)
+		{
+			x[n*d+k] = strtod(s, &e);
+			if (e == s) break;
+		}
+		if (k == d)
+			n += 1;
+		else if (k)
+			fail("a point has %d coordinates instead of %d", k, d);
+	}
+	return n;
+}
+
+static void point_reader_close(struct point_reader *r)
+{
+	free(r->line);
+	xfclose(r->f);
+}
+
+// read all the points
+static float *point_reader_read_all(struct point_reader *r, long *n)
+{
+	long cap = POINTS_CHUNK, m;
+	float *x = xmalloc(cap * r->d * sizeof*x);
+	*n = 0;
+	while ((m = point_reader_read(r, x + *n * r->d, cap - *n)) > 0)
+		if ((*n += m) == cap)
+			x = xrealloc(x, (cap *= 2) * r->d * sizeof*x);
+	return x;
+}
+
+struct point_writer {
+	FILE *f;
+	int d;
+	bool npy;
+	long n;
+};
+
+#define POINTS_NPY_HEADER 128 // room for the header of the output npy files
+
+static void point_writer_npy_header(struct point_writer *w)
+{
+	char h[POINTS_NPY_HEADER + 1];
+	int m = snprintf(h, sizeof h, "%cNUMPY%c%c%c%c{'descr': '<f4', "
+			"'fortran_order': False, 'shape': (%ld, %d), }",
+			0x93, 1, 0, POINTS_NPY_HEADER - 10, 0, w->n, w->d);
+	for (int i = m; i < POINTS_NPY_HEADER - 1; i++)
+		h[i] = ' ';
+	h[POINTS_NPY_HEADER - 1] = '\n';
+	fwrite(h, 1, POINTS_NPY_HEADER, w->f);
+}
+
+static void point_writer_open(struct point_writer *w, char *filename, int d)
+{
+	int l = strlen(filename);
+	w->npy = l > 4 && !strcmp(filename + l - 4, ".npy");
+	w->f = xfopen(filename, "w");
+	w->d = d;
+	w->n = 0;
+	if (w->npy)
+		point_writer_npy_header(w); // rewritten with the actual size
+}
+
+static void point_writer_write(struct point_writer *w, float *x, long n)
+{
+	if (w->npy)
+		fwrite(x, w->d * sizeof*x, n, w->f);
+	else
+		for (long i = 0; i < n; i++)
+		for (int j = 0; j < w->d; j++)
+			fprintf(w->f, "%g%c", x[i*w->d+j], j==w->d-1?'\n':' ');
+	w->n += n;
+}
+
+static void point_writer_close(struct point_writer *w)
+{
+	if (w->npy) {
+		if (fseek(w->f, 0, SEEK_SET))
+			fail("npy points can only be written to regular files");
+		point_writer_npy_header(w);
+	}
+	xfclose(w->f);
+}
+
+// filters                                                                  {{{1
+
+// voxel-grid downsampling: each voxel is replaced by the centroid of its
+// points; the voxels are kept in a hash table, in order of appearance, and
+// only the keys of each chunk are computed in parallel
+struct voxel_table {
+	int d;
+	long n, cap;       // number of voxels, and size of the table
+	long *slot;        // voxel at each position of the table (or -1)
+	int64_t (*key)[3]; // integer coordinates of each voxel
+	double *sum;       // sum of the points of each voxel
+	long *count;
+};
+
+static uint64_t voxel_hash(int64_t k[3])
+{
+	uint64_t h = k[0] * 0x9e3779b97f4a7c15u;
+	h = (h ^ (h >> 29) ^ k[1]) * 0xbf58476d1ce4e5b9u;
+	h = (h ^ (h >> 32) ^ k[2]) * 0x94d049bb133111ebu;
+	return h ^ (h >> 31);
+}
+
+static long voxel_find(struct voxel_table *t, int64_t k[3])
+{
+	long i = voxel_hash(k) & (t->cap - 1);
+	for (;; i = (i + 1) & (t->cap - 1))
+	{
+		long v = t->slot[i];
+		if (v < 0 || !memcmp(t->key[v], k, sizeof*t->key))
+			return i;
+	}
+}
+
+static void voxel_grow(struct voxel_table *t)
+{
+	long cap = t->cap ? 2 * t->cap : 0x10000;
+	t->key = xrealloc(t->key, cap/2 * sizeof*t->key);
+	t->sum = xrealloc(t->sum, cap/2 * t->d * sizeof*t->sum);
+	t->count = xrealloc(t->count, cap/2 * sizeof*t->count);
+	free(t->slot);
+	t->slot = xmalloc(cap * sizeof*t->slot);
+	for (long i = 0; i < cap; i++)
+		t->slot[i] = -1;
+	t->cap = cap;
+	for (long v = 0; v < t->n; v++)
+		t->slot[voxel_find(t, t->key[v])] = v;
+}
+
+static void voxel_add(struct voxel_table *t, int64_t k[3], float *x)
+{
+	if (2 * (t->n + 1) > t->cap)
+		voxel_grow(t);
+	long i = voxel_find(t, k), v = t->slot[i];
+	if (v < 0) {
+		v = t->slot[i] = t->n++;
+		memcpy(t->key[v], k, sizeof*t->key);
+		t->count[v] = 0;
+		for (int l = 0; l < t->d; l++)
+			t->sum[v*t->d+l] = 0;
+	}
+	t->count[v] += 1;
+	for (int l = 0; l < t->d; l++)
+		t->sum[v*t->d+l] += x[l];
+}
+
+int main_voxel(int c, char *v[])
+{
+	if (c < 2 || c > 4)
+		return fprintf(stderr,"usage:\n\t%s size [in [out]]\n",*v);
+		//                                0 1     2   3
+	double s = atof(v[1]);
+	char *filename_in  = c > 2 ? v[2] : "-";
+	char *filename_out = c > 3 ? v[3] : "-";
+	if (!(s > 0)) fail("bad voxel size %g", s);
+
+	struct point_reader r[1];
+	point_reader_open(r, filename_in);
+	int d = r->d, dk = d < 3 ? d : 3;
+	struct voxel_table t[1] = {{.d = d}};
+	float *x = xmalloc(POINTS_CHUNK * (d ? d : 1) * sizeof*x);
+	int64_t (*k)[3] = xmalloc(POINTS_CHUNK * sizeof*k);
+	long n;
+	while (d && (n = point_reader_read(r, x, POINTS_CHUNK)) > 0)
+	{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (long i = 0; i < n; i++)
+		for (int l = 0; l < 3; l++)
+			k[i][l] = l < dk ? (int64_t)floor(x[i*d+l] / s) : 0;
+		for (long i = 0; i < n; i++)
+			voxel_add(t, k[i], x + i*d);
+	}
+	point_reader_close(r);
+
+	struct point_writer w[1];
+	point_writer_open(w, filename_out, d);
+	for (long i = 0; i < t->n; i += POINTS_CHUNK)
+	{
+		long m = t->n - i < POINTS_CHUNK ? t->n - i : POINTS_CHUNK;
+		for (long j = 0; j < m; j++)
+		for (int l = 0; l < d; l++)
+			x[j*d+l] = t->sum[(i+j)*d+l] / t->count[i+j];
+		point_writer_write(w, x, m);
+	}
+	point_writer_close(w);
+	free(k);
+	free(x);
+	free(t->slot);
+	free(t->key);
+	free(t->sum);
+	free(t->count);
+	return 0;
+}
+
+// write the points x[i] such that keep[i] is true
+static void write_kept_points(char *filename, float *x, bool *keep,
+		long n, int d)
+{
+	struct point_writer w[1];
+	point_writer_open(w, filename, d);
+	float *y = xmalloc(POINTS_CHUNK * d * sizeof*y);
+	long m = 0;
+	for (long i = 0; i < n; i++)
+		if (keep[i]) {
+			memcpy(y + m*d, x + i*d, d * sizeof*y);
+			if (++m == POINTS_CHUNK) {
+				point_writer_write(w, y, m);
+				m = 0;
+			}
+		}
+	point_writer_write(w, y, m);
+	point_writer_close(w);
+	free(y);
+}
+
+// statistical outlier removal: the points whose mean distance to their k
+// nearest neighbors is above the average by more than "nsigma" standard
+// deviations are removed
+int main_sor(int c, char *v[])
+{
+	if (c < 3 || c > 5)
+		return fprintf(stderr,"usage:\n\t%s k nsigma [in [out]]\n",*v);
+		//                                0 1 2       3   4
+	int k = atoi(v[1]);
+	double nsigma = atof(v[2]);
+	char *filename_in  = c > 3 ? v[3] : "-";
+	char *filename_out = c > 4 ? v[4] : "-";
+	if (k < 1) fail("bad number of neighbors %d", k);
+
+	struct point_reader r[1];
+	point_reader_open(r, filename_in);
+	long n;
+	int d = r->d;
+	float *x = point_reader_read_all(r, &n);
+	point_reader_close(r);
+
+	struct pointgrid g[1];
+	pointgrid_build(g, x, n, d, d, 0);
+	float *md = xmalloc((n ? n : 1) * sizeof*md);
+	double sm = 0, sm2 = 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,4096) reduction(+:sm,sm2)
+#endif
+	for (long i = 0; i < n; i++)
+	{
+		long oi[k];
+		double od2[k], a = 0;
+		int m = pointgrid_knn(oi, od2, k, g, x + i*d, i);
+		for (int j = 0; j < m; j++)
+			a += sqrt(od2[j]);
+		md[i] = m ? a / m : 0;
+		sm += md[i];
+		sm2 += md[i] * (double)md[i];
+	}
+	double μ = n ? sm / n : 0;
+	double σ = n ? sqrt(fmax(0, sm2 / n - μ * μ)) : 0;
+	bool *keep = xmalloc((n ? n : 1) * sizeof*keep);
+	for (long i = 0; i < n; i++)
+		keep[i] = md[i] <= μ + nsigma * σ;
+	write_kept_points(filename_out, x, keep, n, d);
+	pointgrid_free(g);
+	free(keep);
+	free(md);
+	free(x);
+	return 0;
+}
+
+// radius outlier removal: the points with less than "minpts" neighbors at
+// distance at most r are removed
+int main_radius(int c, char *v[])
+{
+	if (c < 3 || c > 5)
+		return fprintf(stderr,"usage:\n\t%s r minpts [in [out]]\n",*v);
+		//                                0 1 2       3   4
+	double radius = atof(v[1]);
+	long minpts = atol(v[2]);
+	char *filename_in  = c > 3 ? v[3] : "-";
+	char *filename_out = c > 4 ? v[4] : "-";
+
+	struct point_reader r[1];
+	point_reader_open(r, filename_in);
+	long n;
+	int d = r->d;
+	float *x = point_reader_read_all(r, &n);
+	point_reader_close(r);
+
+	struct pointgrid g[1];
+	pointgrid_build(g, x, n, d, d, radius);
+	bool *keep = xmalloc((n ? n : 1) * sizeof*keep);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,4096)
+#endif
+	for (long i = 0; i < n; i++)
+		keep[i] = pointgrid_count(g, x + i*d, radius, i, minpts) >= minpts;
+	write_kept_points(filename_out, x, keep, n, d);
+	pointgrid_free(g);
+	free(keep);
+	free(x);
+	return 0;
+}
 
 // CLI utility to access some point processing programs
 int main_points(int c, char *v[])
@@ -183,10 +604,13 @@ int main_points(int c, char *v[])
 	else if (0 == strcmp(v[1], "random")) return main_random(c-1, v+1);
 	else if (0 == strcmp(v[1], "map")) return main_map(c-1, v+1);
 	else if (0 == strcmp(v[1], "config")) return main_config(c-1, v+1);
+	else if (0 == strcmp(v[1], "voxel")) return main_voxel(c-1, v+1);
+	else if (0 == strcmp(v[1], "sor")) return main_sor(c-1, v+1);
+	else if (0 == strcmp(v[1], "radius")) return main_radius(c-1, v+1);
 //	else if (0 == strcmp(v[1], "stats")) return main_stats(c-1, v+1);
 	else {
-	usage: fprintf(stderr, "usage:\n\t%s [random|config|stats] "
-			       "params... \n", *v);
+	usage: fprintf(stderr, "usage:\n\t%s [random|map|config|voxel|sor"
+			       "|radius] params... \n", *v);
 	       return 1;
 	}
 }
@@ -1,6 +1,7 @@
 #include <math.h> // NAN
 #include <stdlib.h> // malloc, free
 #include <string.h> // memcpy
+#include "fftplans.c"
 
 
 // construct the symmetric boundary of an image
@@ -296,6 +297,9 @@ void simplest_inpainting_vec(float *x, int w, int h, int pd)
 	free(tmp);
 }
 
+// whether ppsmooth_split uses the spectral solver (see ppsmooth_direct)
+static bool global_ppsmooth_direct = false;
+
 // fill-in the periodic component of an image (with split channels)
 void ppsmooth(float *y, float *x, int w, int h)
 {
@@ -306,18 +310,87 @@ void ppsmooth(float *y, float *x, int w, int h)
 		y[i] = x[i] - y[i];
 }
 
+// fill the interior of a frame by the exact discrete harmonic function
+// (the interior is the Dirichlet problem of the 5-point laplacian, which is
+// diagonalized by the DST-I of size (w-2)x(h-2), thus it is solved by one
+// transform, a division by the eigenvalues, and the same transform again)
+static void harmonic_extension_of_frame(float *xx, int w, int h)
+{
+	float (*x)[w] = (void*)xx;
+	int W = w - 2, H = h - 2;
+	struct fftplan *p = fftplan_get(FFTPLAN_RODFT00, W, H);
+	float (*f)[W] = p->in, (*F)[W] = p->out;
+
+	// right hand side: the known neighbors of each interior pixel
+	for (int j = 0; j < H; j++)
+	for (int i = 0; i < W; i++)
+		f[j][i] = (i == 0   ? x[j+1][0]   : 0)
+			+ (i == W-1 ? x[j+1][w-1] : 0)
+			+ (j == 0   ? x[0][i+1]   : 0)
+			+ (j == H-1 ? x[h-1][i+1] : 0);
+	fftwf_execute(p->p);
+
+	// eigenvalues of (4 - adjacency), and normalization of the DST-I pair
+	float cx[W], cy[H], n = 4.0 * (W + 1) * (H + 1);
+	for (int i = 0; i < W; i++) cx[i] = 2 - 2 * cos(M_PI * (i+1) / (W+1));
+	for (int j = 0; j < H; j++) cy[j] = 2 - 2 * cos(M_PI * (j+1) / (H+1));
+	for (int j = 0; j < H; j++)
+	for (int i = 0; i < W; i++)
+		f[j][i] = F[j][i] / (n * (cx[i] + cy[j]));
+	fftwf_execute(p->p);
+
+	for (int j = 0; j < H; j++)
+	for (int i = 0; i < W; i++)
+		x[j+1][i+1] = F[j][i];
+}
+
+// like ppsmooth, but with the exact harmonic extension of the boundary
+void ppsmooth_direct(float *y, float *x, int w, int h)
+{
+	if (w < 3 || h < 3) {
+		ppsmooth(y, x, w, h);
+		return;
+	}
+	memcpy(y, x, w*h*sizeof*x);
+	global_boundary_function(y, w, h);
+	harmonic_extension_of_frame(y, w, h);
+	for (int i = 0; i < w*h; i++)
+		y[i] = x[i] - y[i];
+}
+
 // call ppsmooth for all the images in an array
 void ppsmooth_split(float *y, float *x, int w, int h, int pd)
 {
 	for (int l = 0; l < pd; l++)
-		ppsmooth(y + l*w*h, x + l*w*h, w, h);
+		if (global_ppsmooth_direct)
+			ppsmooth_direct(y + l*w*h, x + l*w*h, w, h);
+		else
+			ppsmooth(y + l*w*h, x + l*w*h, w, h);
 }
 
 #ifndef OMIT_PPSMOOTH_MAIN
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
 #include "pickopt.c"
+#include "xmalloc.c"
+#include "cleant_cgpois.c"
+
+// like ppsmooth, but refine the inpainting by "niter" steps of PCG
+static void ppsmooth_cg(float *y, float *x, int w, int h, int niter)
+{
+	float *b = xmalloc(w*h*sizeof*b);
+	memcpy(b, x, w*h*sizeof*x);
+	global_boundary_function(b, w, h);
+	memcpy(y, b, w*h*sizeof*b);
+	simplest_inpainting(y, w, h);
+	poisson_extension_by_pcg(y, b, NULL, w, h, y, niter, 1e-6);
+	for (int i = 0; i < w*h; i++)
+		y[i] = x[i] - y[i];
+	free(b);
+}
+
 int main(int c, char *v[])
 {
 	char *filename_m = pick_option(&c, &v, "m", "");
@@ -325,8 +398,10 @@ int main(int c, char *v[])
 	bool fan_boundary = pick_option(&c, &v, "f", NULL);
 	bool Fan_boundary = pick_option(&c, &v, "F", NULL);
 	global_parameter_p = atof(pick_option(&c, &v, "p", "NAN"));
+	int niter = atoi(pick_option(&c, &v, "c", "0"));
+	global_ppsmooth_direct = pick_option(&c, &v, "d", NULL);
 	if ((c != 1 && c != 2 && c != 3) || (c>1 && !strcmp(v[1], "-h"))) {
-		fprintf(stderr, "usage:\n\t%s [in [out]]\n", *v);
+		fprintf(stderr, "usage:\n\t%s [-d|-c niter] [in [out]]\n", *v);
 		//                          0  1   2
 		return 1;
 	}
@@ -358,7 +433,11 @@ int main(int c, char *v[])
 	float *x = iio_read_image_float_split(filename_i, &w, &h, &pd);
 	float *y = malloc(w*h*pd*sizeof*y);
 
-	ppsmooth_split(y, x, w, h, pd);
+	if (niter > 0)
+		for (int l = 0; l < pd; l++)
+			ppsmooth_cg(y + l*w*h, x + l*w*h, w, h, niter);
+	else
+		ppsmooth_split(y, x, w, h, pd);
 
 	iio_write_image_float_split(filename_o, y, w, h, pd);
 
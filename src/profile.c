@@ -0,0 +1,31 @@
+#ifndef _PROFILE_C
+#define _PROFILE_C
+
+// named timing scopes, reported by iio (see "iio_profile_add" in iio.h)
+//
+// 	PROFILE_SCOPE("blur") {
+// 		...
+// 	}
+//
+// times the block and adds it to the scope "blur" of the summary printed at
+// exit when IMSCRIPT_PROFILE is set.  Otherwise, the only cost is a test.
+// (The block must not be left by "break" or "return".)
+
+#include "iio.h"
+
+static double profile_start(void)
+{
+	return iio_profile_enabled() ? iio_profile_now() : 0;
+}
+
+static double profile_stop(const char *name, double t)
+{
+	if (iio_profile_enabled())
+		iio_profile_add(name, iio_profile_now() - t);
+	return -1;
+}
+
+#define PROFILE_SCOPE(name) for (double profile_t_ = profile_start(); \
+		profile_t_ >= 0; profile_t_ = profile_stop(name, profile_t_))
+
+#endif//_PROFILE_C
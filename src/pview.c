@@ -10,11 +10,20 @@
 // pview epipolar f1 ... f9 w h < pairs.txt
 // pview epipolar f1 ... f9 w h [mask.txt] < pairs.txt
 // pview polygons w h < polygons.txt
+// pview density w h < points.txt
 //
 // points.txt   = file with two columns of numbers (list of 2D points)
 // pairs.txt    = file with four columns of numbers (list of 2D point pairs)
 // triplets.txt = file with six columns of numbers (list of 2D point triplets)
 // polygons.txt = file with one polygonal curve per line (list of 2D points)
+//
+// With the option "-b", the numbers are read from binary native floats
+// instead of text (all the programs but "polygons").  The segments and the
+// points are drawn by tiles in parallel (see tileraster.c).  The "density"
+// program renders the number of points of each pixel, in logarithmic scale,
+// for the sets of points that are too large to be drawn one over another.
+// With the option "-l", the programs "points" and "pairs" write the index of
+// each point next to it (the labels are drawn by the batches of fontu.c).
 
 
 #include <assert.h>
@@ -32,6 +41,10 @@
 #include "parsenumbers.c"
 #include "drawsegment.c"
 #include "pickopt.c"
+#include "tileraster.c"
+#define OMIT_MAIN_FONTU
+#include "fontu.c"
+#include "fonts/xfont_5x7.c"
 
 struct rgb_value {
 	uint8_t r, g, b;
@@ -84,6 +97,79 @@ static bool inner_point(int w, int h, int x, int y)
 	return (x>=0) && (y>=0) && (x<w) && (y<h);
 }
 
+// whether the input numbers are binary native floats (option -b)
+static bool pview_binary = false;
+static bool pview_labels = false;
+
+// a batch of labels, in a small font
+struct pview_labels {
+	struct bitmap_font f[1];
+	struct font_atlas a[1];
+	struct font_batch b[1];
+};
+
+static void pview_labels_init(struct pview_labels *l)
+{
+	l->f[0] = reformat_font(*xfont_5x7, UNPACKED);
+	font_atlas_init(l->a, l->f);
+	font_batch_init(l->b, l->a, 4, 0);
+}
+
+// add the label "i" at the lower right of the point (x,y)
+static void pview_label(struct pview_labels *l, int x, int y, int i,
+		struct rgba_value c)
+{
+	float fg[4] = {c.r, c.g, c.b, c.a};
+	char s[16];
+	snprintf(s, sizeof s, "%d", i);
+	font_batch_string(l->b, x + 2, y + 2, s, fg, NULL, 1);
+}
+
+// draw the labels over a color image, and free the batch
+static void pview_labels_draw(struct pview_labels *l, struct rgba_value *x,
+		int w, int h)
+{
+	font_batch_draw_uint8(l->b, (uint8_t*)x, w, h);
+	font_batch_free(l->b);
+	font_atlas_free(l->a);
+	free(l->f->data);
+}
+
+static float *read_binary_floats(FILE *f, int *n)
+{
+	int nmax = 1024;
+	float *t = xmalloc(nmax * sizeof*t);
+	*n = 0;
+	while (1) {
+		if (*n == nmax)
+			t = xrealloc(t, (nmax *= 2) * sizeof*t);
+		int r = fread(t + *n, sizeof*t, nmax - *n, f);
+		*n += r;
+		if (r == 0) break;
+	}
+	return t;
+}
+
+// read the input numbers from stdin
+static float *read_pview_floats(int *n)
+{
+	if (!pview_binary)
+		return read_ascii_floats(stdin, n);
+	return read_binary_floats(stdin, n);
+}
+
+static double *read_pview_doubles(int *n)
+{
+	if (!pview_binary)
+		return read_ascii_doubles(stdin, n);
+	float *t = read_binary_floats(stdin, n);
+	double *r = xmalloc((*n ? *n : 1) * sizeof*r);
+	for (int i = 0; i < *n; i++)
+		r[i] = t[i];
+	free(t);
+	return r;
+}
+
 // CLI utility to view a set of planar points
 // (produces a transparent PNG image)
 static int main_viewp(int c, char *v[])
@@ -94,7 +180,7 @@ static int main_viewp(int c, char *v[])
 		return EXIT_FAILURE;
 	}
 	int n;
-	float *t = read_ascii_floats(stdin, &n);
+	float *t = read_pview_floats(&n);
 	n /= 2;
 	int sizex = atoi(v[1]);
 	int sizey = atoi(v[2]);
@@ -108,6 +194,13 @@ static int main_viewp(int c, char *v[])
 		if (inner_point(sizex, sizey, a, b))
 			x[b][a] = RGBA_GREEN;
 	}
+	if (pview_labels) {
+		struct pview_labels l[1];
+		pview_labels_init(l);
+		FORI(n)
+			pview_label(l, t[2*i+0], t[2*i+1], i, RGBA_YELLOW);
+		pview_labels_draw(l, x[0], sizex, sizey);
+	}
 	iio_write_image_uint8_vec("-", (uint8_t*)x, sizex, sizey, 4);
 	free(t); free(x);
 	return EXIT_SUCCESS;
@@ -122,7 +215,7 @@ static int main_viewhp(int c, char *v[])
 		return EXIT_FAILURE;
 	}
 	int n;
-	float *t = read_ascii_floats(stdin, &n);
+	float *t = read_pview_floats(&n);
 	n /= 2;
 	int sizex = atoi(v[1]);
 	int sizey = atoi(v[2]);
@@ -141,6 +234,56 @@ static int main_viewhp(int c, char *v[])
 	return EXIT_SUCCESS;
 }
 
+// density of points, in logarithmic scale
+// (produces a transparent PNG image)
+static int main_viewdensity(int c, char *v[])
+{
+	if (c != 3) {
+		fprintf(stderr, "usage:\n\t%s sx sy < points.txt\n", *v);
+		//                         0  1  2
+		return EXIT_FAILURE;
+	}
+	int n;
+	float *t = read_pview_floats(&n);
+	n /= 2;
+	int sizex = atoi(v[1]);
+	int sizey = atoi(v[2]);
+	int *k = xmalloc(sizex*sizey*sizeof*k);
+	FORI(sizex*sizey)
+		k[i] = 0;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	FORI(n)
+	{
+		int a = t[2*i+0];
+		int b = t[2*i+1];
+		if (inner_point(sizex, sizey, a, b))
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+			k[b*sizex+a] += 1;
+	}
+	int m = 0;
+	FORI(sizex*sizey)
+		if (k[i] > m)
+			m = k[i];
+	struct rgba_value *x = xmalloc(4*sizex*sizey);
+	float s = m ? 255 / log1p(m) : 0;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	FORI(sizex*sizey)
+	{
+		x[i] = RGBA_BLACK;
+		x[i].g = lrint(s * log1p(k[i]));
+	}
+	fprintf(stderr, "got %d points, at most %d on a pixel\n", n, m);
+	iio_write_image_uint8_vec("-", (uint8_t*)x, sizex, sizey, 4);
+	free(t); free(k); free(x);
+	return EXIT_SUCCESS;
+}
+
 
 bool identityP(double A[9])
 {
@@ -192,33 +335,21 @@ static double lincombin(double a, double b, double t)
 	return r;
 }
 
-// argument for the "traverse_segment_aa" function
-static void put_pixel_color_aa(int a, int b, float f, void *pp)
+// blending of the anti-aliased segments (for the "tileraster" batch)
+static void blend_color_aa(uint8_t *g, uint8_t *k, float f)
 {
-	struct {int w, h; struct rgba_value *x, c;} *p = pp;
-	if (inner_point(p->w, p->h, a, b))
-	{
-		struct rgba_value *g = p->x + b*p->w + a;
-		struct rgba_value *k = &p->c;
-		g->r = lincombin(g->r, k->r, f);
-		g->g = lincombin(g->g, k->g, f);
-		g->b = lincombin(g->b, k->b, f);
-		//g->r = g->r*(1-f) + k->r*f;
-		//g->g = g->g*(1-f) + k->g*f;
-		//g->b = g->b*(1-f) + k->b*f;
-	}
+	struct rgba_value *x = (void*)g, *c = (void*)k;
+	x->r = lincombin(x->r, c->r, f);
+	x->g = lincombin(x->g, c->g, f);
+	x->b = lincombin(x->b, c->b, f);
+	//x->r = x->r*(1-f) + c->r*f;
+	//x->g = x->g*(1-f) + c->g*f;
+	//x->b = x->b*(1-f) + c->b*f;
 }
 
-// argument for the "traverse_segment_aa" function
-static void put_pixel_gray_aa(int a, int b, float f, void *pp)
+static void blend_gray_aa(uint8_t *g, uint8_t *k, float f)
 {
-	struct {int w, h; uint8_t *x, c;} *p = pp;
-	if (inner_point(p->w, p->h, a, b))
-	{
-		uint8_t *g = p->x + b*p->w + a;
-		uint8_t *k = &p->c;
-		*g = lincombin(*g, *k, f);
-	}
+	*g = lincombin(*g, *k, f);
 }
 
 static void put_pixel_vec_aa(int a, int b, float f, void *ee)
@@ -244,30 +375,18 @@ static void put_pixel_rvec(int a, int b, void *ee)
 	}
 }
 
-// draw a color segment over a color image
-static void overlay_segment_color(struct rgba_value *x, int w, int h,
+// draw a color segment over a color image (into the batch r)
+static void overlay_segment_color(struct tileraster *r,
 		int px, int py, int qx, int qy, struct rgba_value c)
 {
-	//struct {int w, h; struct rgba_value *x, c; } e = {w, h, x, c};
-	struct {int w, h; struct rgba_value *x, c; } e;
-	e.w = w;
-	e.h = h;
-	e.x = x;
-	e.c = c;
-	traverse_segment_aa(px, py, qx, qy, put_pixel_color_aa, &e);
+	tileraster_segment(r, px, py, qx, qy, (uint8_t*)&c);
 }
 
-// draw a color segment over a color image
-static void overlay_segment_gray(uint8_t *x, int w, int h,
-		int px, int py, int qx, int qy)
+// draw a color pixel over a color image (into the batch r)
+static void overlay_point_color(struct tileraster *r,
+		int x, int y, struct rgba_value c)
 {
-	//struct {int w, h; struct rgba_value *x, c; } e = {w, h, x, c};
-	struct {int w, h; uint8_t *x, c; } e;
-	e.w = w;
-	e.h = h;
-	e.x = x;
-	e.c = 255;
-	traverse_segment_aa(px, py, qx, qy, put_pixel_gray_aa, &e);
+	tileraster_point(r, x, y, (uint8_t*)&c);
 }
 
 static void overlay_circle_gray(uint8_t *x, int w, int h,
@@ -309,18 +428,19 @@ static void overlay_segment_vec(float *x, int w, int h, int pd,
 
 // draw a color line over a color image
 static void overlay_line(double a, double b, double c,
-		struct rgba_value *x, int w, int h, struct rgba_value k)
+		struct tileraster *r, struct rgba_value k)
 {
+	int w = r->w, h = r->h;
 	if (b == 0) {
 		int f[2] = {-c/a, 0};
 		int t[2] = {-c/a, h-1};
-		overlay_segment_color(x, w, h, f[0], f[1], t[0], t[1], k);
+		overlay_segment_color(r, f[0], f[1], t[0], t[1], k);
 	} else {
 		double alpha = -a/b;
 		double beta = -c/b;
 		int f[2] = {0, beta};
 		int t[2] = {w-1, alpha*(w-1)+beta};
-		overlay_segment_color(x, w, h, f[0], f[1], t[0], t[1], k);
+		overlay_segment_color(r, f[0], f[1], t[0], t[1], k);
 	}
 }
 
@@ -340,7 +460,7 @@ int main_viewpairs(int c, char *v[])
 	int sizex = atoi(v[10]);
 	int sizey = atoi(v[11]);
 	int n;
-	double (*p)[4] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[4] = (void*)read_pview_doubles(&n);
 	n /= 4;
 	struct rgba_value (*o)[sizex] = xmalloc(sizex*sizey*4);
 	bool mask=c>12, bmask[n]; FORI(n) bmask[i] = !mask;
@@ -349,6 +469,8 @@ int main_viewpairs(int c, char *v[])
 		xfclose(f);
 	}
 	FORI(sizex*sizey) o[0][i] = RGBA_BLACK;
+	struct tileraster r[1];
+	tileraster_init(r, (uint8_t*)o, sizex, sizey, 4, blend_color_aa);
 	FORI(n) {
 		double *pxi = p[i];
 		double *pyi = p[i]+2;
@@ -358,11 +480,11 @@ int main_viewpairs(int c, char *v[])
 		if (inner_point(sizex, sizey, t[0], t[1]) &&
 				inner_point(sizex, sizey, z[0], z[1]))
 			if (!bmask[i]) {
-				overlay_segment_color(*o, sizex, sizey,
+				overlay_segment_color(r,
 						t[0], t[1], z[0], z[1],
 						RGBA_PHANTOM);
-				o[t[1]][t[0]] = RGBA_RED;
-				o[z[1]][z[0]] = RGBA_BLUE;
+				overlay_point_color(r, t[0], t[1], RGBA_RED);
+				overlay_point_color(r, z[0], z[1], RGBA_BLUE);
 			}
 	}
 	FORI(n) {
@@ -373,14 +495,30 @@ int main_viewpairs(int c, char *v[])
 				inner_point(sizex, sizey, z[0], z[1])
 		   ) {
 			if (bmask[i]) {
-				overlay_segment_color(*o, sizex, sizey,
+				overlay_segment_color(r,
 						t[0], t[1], z[0], z[1],
 						RGBA_BRIGHT);
-				o[t[1]][t[0]] = RGBA_RED;
-				o[z[1]][z[0]] = RGBA_GREEN;
+				overlay_point_color(r, t[0], t[1], RGBA_RED);
+				overlay_point_color(r, z[0], z[1], RGBA_GREEN);
 			}
 		}
 	}
+	tileraster_draw(r);
+	tileraster_free(r);
+	if (pview_labels) { // index of each pair, at its second point
+		struct pview_labels l[1];
+		pview_labels_init(l);
+		FORI(n) {
+			double tt[2]; projective_map(tt, A, p[i]);
+			int t[2] = {tt[0], tt[1]};
+			int z[2] = {p[i][2], p[i][3]};
+			if (inner_point(sizex, sizey, t[0], t[1]) &&
+					inner_point(sizex, sizey, z[0], z[1]))
+				pview_label(l, z[0], z[1], i, bmask[i] ?
+						RGBA_YELLOW : RGBA_GRAY50);
+		}
+		pview_labels_draw(l, o[0], sizex, sizey);
+	}
 	if (true) { // compute and show statistics
 		int n_inliers = 0, n_outliers = 0;
 		//stats: min,max,avg
@@ -448,7 +586,7 @@ int main_viewsegs(int c, char *v[])
 	int h = atoi(v[2]);
 
 	int n;
-	double (*p)[4] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[4] = (void*)read_pview_doubles(&n);
 	n /= 4;
 
 	if (w == -1) for (int i = 0; i < n; i++) {
@@ -464,13 +602,18 @@ int main_viewsegs(int c, char *v[])
 	for (int j = 0; j < h; j++)
 	for (int i = 0; i < w; i++)
 		o[j][i] = 0;
+	struct tileraster r[1];
+	tileraster_init(r, *o, w, h, 1, blend_gray_aa);
+	uint8_t white = 255;
 	for (int i = 0; i < n; i++)
 	{
 		int a[2] = { lrint(p[i][0]), lrint(p[i][1]) };
 		int b[2] = { lrint(p[i][2]), lrint(p[i][3]) };
 		if (inner_point(w,h, a[0],a[1]) && inner_point(w,h, b[0],b[1]))
-			overlay_segment_gray(*o, w, h, a[0], a[1], b[0], b[1]);
+			tileraster_segment(r, a[0], a[1], b[0], b[1], &white);
 	}
+	tileraster_draw(r);
+	tileraster_free(r);
 
 	iio_write_image_uint8_vec("-", (uint8_t*)o, w, h, 1);
 	return 0;
@@ -490,7 +633,7 @@ int main_gviewsegs(int c, char *v[])
 	int h = atoi(v[2]);
 
 	int n;
-	double (*p)[4] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[4] = (void*)read_pview_doubles(&n);
 	n /= 4;
 
 	if (w == -1) for (int i = 0; i < n; i++) {
@@ -535,7 +678,7 @@ int main_viewcircs(int c, char *v[])
 	int h = atoi(v[2]);
 
 	int n;
-	double (*p)[3] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[3] = (void*)read_pview_doubles(&n);
 	n /= 3;
 
 	if (w == -1) for (int i = 0; i < n; i++)
@@ -571,7 +714,7 @@ int main_gviewcircs(int c, char *v[])
 	int h = atoi(v[2]);
 
 	int n;
-	double (*p)[3] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[3] = (void*)read_pview_doubles(&n);
 	n /= 3;
 
 	if (w == -1) for (int i = 0; i < n; i++)
@@ -627,6 +770,8 @@ int main_viewpolygons(int c, char *v[])
 	struct rgba_value (*o)[w] = xmalloc(w * h * 4);
 	for (int i = 0; i < w*h; i++)
 		o[0][i] = RGBA_BLACK;
+	struct tileraster r[1];
+	tileraster_init(r, (uint8_t*)o, w, h, 4, blend_color_aa);
 	while (1) {
 		int n, maxlin = 1000*12*4;
 		char line[maxlin], *sl = fgets_until(line, maxlin, stdin, '\n');
@@ -634,10 +779,12 @@ int main_viewpolygons(int c, char *v[])
 		double *t = alloc_parse_doubles(maxlin, line, &n);
 		n /= 2;
 		for (int i = 0; i < n - 1 + option_c; i++)
-			overlay_segment_color(*o, w, h, t[2*i+0], t[2*i+1],
+			overlay_segment_color(r, t[2*i+0], t[2*i+1],
 				t[(2*i+2)%(2*n)], t[(2*i+3)%(2*n)], RGBA_GREEN);
 		free(t);
 	}
+	tileraster_draw(r);
+	tileraster_free(r);
 	iio_write_image_uint8_vec("-", (uint8_t*)o, w, h, 4);
 	return EXIT_SUCCESS;
 }
@@ -652,7 +799,7 @@ int main_viewtrips(int c, char *v[])
 		return EXIT_FAILURE;
 	}
 	int s[2], n; FORI(2) s[i] = atoi(v[1+i]);
-	double (*p)[6] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[6] = (void*)read_pview_doubles(&n);
 	n /= 6;
 	struct rgba_value (*o)[s[0]] = xmalloc(s[0]*s[1]*4);
 	bool bmask[n]; FORI(n) bmask[i] = c<4;
@@ -661,6 +808,8 @@ int main_viewtrips(int c, char *v[])
 		xfclose(f);
 	}
 	FORI(s[0]*s[1]) o[0][i] = RGBA_BLACK;
+	struct tileraster r[1];
+	tileraster_init(r, (uint8_t*)o, s[0], s[1], 4, blend_color_aa);
 	FORI(n) {
 		int t[2] = {p[i][0], p[i][1]};
 		int z[2] = {p[i][2], p[i][3]};
@@ -673,10 +822,8 @@ int main_viewtrips(int c, char *v[])
 			//	draw_brighter_pixel:draw_phantom_pixel;
 			struct rgba_value kk = (bmask[i]&&c>3)?
 				RGBA_BRIGHT:RGBA_PHANTOM;
-			overlay_segment_color(*o, s[0], s[1],
-					t[0], t[1], z[0], z[1], kk);
-			overlay_segment_color(*o, s[0], s[1],
-					z[0], z[1], Z[0], Z[1], kk);
+			overlay_segment_color(r, t[0], t[1], z[0], z[1], kk);
+			overlay_segment_color(r, z[0], z[1], Z[0], Z[1], kk);
 		}
 	}
 	FORI(n) {
@@ -687,11 +834,13 @@ int main_viewtrips(int c, char *v[])
 				inner_point(s[0], s[1], z[0], z[1]) &&
 				inner_point(s[0], s[1], Z[0], Z[1]))
 		{
-			o[t[1]][t[0]] = RGBA_YELLOW;
-			o[z[1]][z[0]] = RGBA_GREEN;
-			o[Z[1]][Z[0]] = RGBA_MAGENTA;
+			overlay_point_color(r, t[0], t[1], RGBA_YELLOW);
+			overlay_point_color(r, z[0], z[1], RGBA_GREEN);
+			overlay_point_color(r, Z[0], Z[1], RGBA_MAGENTA);
 		}
 	}
+	tileraster_draw(r);
+	tileraster_free(r);
 	iio_write_image_uint8_vec("-", (uint8_t*)o, s[0], s[1], 4);
 	return EXIT_SUCCESS;
 }
@@ -741,13 +890,15 @@ int main_viewepi(int c, char *v[])
 	int s[2], n; FORI(2) s[i] = atoi(v[10+i]);
 
 	// 0. read input pairs
-	double (*p)[4] = (void*)read_ascii_doubles(stdin, &n);
+	double (*p)[4] = (void*)read_pview_doubles(&n);
 	n /= 4;
 
 
 	// 1. create output image and plot black background
 	struct rgba_value (*o)[s[0]] = xmalloc(s[0]*s[1]*4);
 	FORI(s[0]*s[1]) o[0][i] = RGBA_BLACK;
+	struct tileraster r[1];
+	tileraster_init(r, (uint8_t*)o, s[0], s[1], 4, blend_color_aa);
 
 	// 2. if there is a mask file, read it
 	bool mask=c>12, bmask[n]; FORI(n) bmask[i] = !mask;
@@ -761,11 +912,11 @@ int main_viewepi(int c, char *v[])
 	// 3. draw the epipolar line L of p
 	FORI(n) if (!bmask[i] && innpair(s,p[i])) {
 			double L[3]; epipolar_line(L, A, p[i]);
-			overlay_line(L[0],L[1],L[2],o[0],s[0],s[1],RGBA_GRAY10);
+			overlay_line(L[0],L[1],L[2],r,RGBA_GRAY10);
 	}
 	FORI(n) if (bmask[i] && innpair(s,p[i])) {
 		double L[3]; epipolar_line(L, A, p[i]);
-			overlay_line(L[0],L[1],L[2],o[0],s[0],s[1],RGBA_GRAY50);
+			overlay_line(L[0],L[1],L[2],r,RGBA_GRAY50);
 	}
 	// 4. draw the projection line of q to L
 	FORI(n) {
@@ -779,26 +930,23 @@ int main_viewepi(int c, char *v[])
 		if (inner_point(s[0], s[1], iLy[0], iLy[1]))
 		{
 			if (inner_point(s[0], s[1], y[0], y[1]))
-				overlay_segment_color(*o, s[0], s[1],
+				overlay_segment_color(r,
 						y[0], y[1], iLy[0], iLy[1],
 					bmask[i]?RGBA_BRIGHT:RGBA_PHANTOM);
-			if (bmask[i])
-				o[iLy[1]][iLy[0]] = RGBA_MAGENTA;
-			else
-				o[iLy[1]][iLy[0]] = RGBA_RED;
+			overlay_point_color(r, iLy[0], iLy[1],
+					bmask[i]?RGBA_MAGENTA:RGBA_RED);
 		}
 	}
 	// 5. draw the corresponding point q (py)
 	FORI(n) {
 		if (!innpair(s,p[i])) continue;
 		int y[2] = {lrint(p[i][2]), lrint(p[i][3])};
-		if (inner_point(s[0], s[1], y[0], y[1])) {
-			if (bmask[i])
-				o[y[1]][y[0]] = RGBA_GREEN;
-			else
-				o[y[1]][y[0]] = RGBA_BLUE;
-		}
+		if (inner_point(s[0], s[1], y[0], y[1]))
+			overlay_point_color(r, y[0], y[1],
+					bmask[i]?RGBA_GREEN:RGBA_BLUE);
 	}
+	tileraster_draw(r);
+	tileraster_free(r);
 	iio_write_image_uint8_vec("-", (uint8_t*)o, s[0], s[1], 4);
 
 	if (true) { // show statistics
@@ -1029,9 +1177,12 @@ int main_viewfmpair(int c, char *v[])
 int main_pview(int c, char *v[])
 {
 	assert(4 == sizeof(struct rgba_value));
+	pview_binary = pick_option(&c, &v, "b", NULL);
+	pview_labels = pick_option(&c, &v, "l", NULL);
 	if (c < 2) goto usage;
 	else if (0 == strcmp(v[1], "points")) return main_viewp(c-1, v+1);
 	else if (0 == strcmp(v[1], "hpoints")) return main_viewhp(c-1, v+1);
+	else if (0 == strcmp(v[1], "density")) return main_viewdensity(c-1,v+1);
 	else if (0 == strcmp(v[1], "pairs")) return main_viewpairs(c-1, v+1);
 	else if (0 == strcmp(v[1], "segments")) return main_viewsegs(c-1, v+1);
 	else if (0 == strcmp(v[1], "gsegments")) return main_gviewsegs(c-1,v+1);
@@ -1043,8 +1194,8 @@ int main_pview(int c, char *v[])
 	else if (0 == strcmp(v[1], "fmpair")) return main_viewfmpair(c-1, v+1);
 	//else if (0 == strcmp(v[1],"fmpairi"))return main_viewfmpairi(c-1,v+1);
 	else {
-	usage: fprintf(stderr, "usage:\n\t%s [points|pairs|triplets|epipolar] "
-			       "params... < data.txt | display\n", *v);
+	usage: fprintf(stderr, "usage:\n\t%s [-b] [-l] [points|pairs|triplets|"
+			       "epipolar|density] params... < data.txt | display\n", *v);
 	       return EXIT_FAILURE;
 	}
 }
@@ -0,0 +1,285 @@
+# imscript: the core kernels of imscript, called directly on numpy arrays
+#
+#	import imscript
+#	y = imscript.blur(x, "gaussian", 2)
+#	z = imscript.morsi(y, "disk3", "median")
+#	w = imscript.plambda("x y - fabs", y, z)
+#
+# The images are numpy arrays of shape (h,w) or (h,w,pd), or any object
+# with the buffer protocol of that shape.  Arrays of float32 in C order are
+# passed to the C code as they are (other arrays are converted once), and
+# the results are written directly on new arrays, or on the arrays given by
+# the "out" arguments.  The computations release the GIL, so that several
+# python threads can run them at the same time.
+#
+# The kernels are those of the shared library "libimscript.so" (built by
+# "make lib", see src/lib/imscript.h).  It is searched in the directory of
+# the environment variable IMSCRIPT_LIB, next to this file, in the "bin"
+# directory of the source tree, and in the "bin" of the installation.
+#
+# Invalid arguments raise ValueError, but other errors of the kernels (e.g.,
+# out of memory) end the process, as in the command line tools.
+
+import ctypes, os, sys
+import numpy
+
+version = 1
+
+# internal: the library, loaded on the first call
+_lib = None
+
+def _library():
+	global _lib
+	if _lib:
+		return _lib
+	here = os.path.dirname(os.path.abspath(__file__))
+	dirs = [ os.environ.get("IMSCRIPT_LIB", ""), here,
+			os.path.join(here, "..", "..", "..", "bin"),
+			os.path.join(sys.prefix, "bin") ]
+	for d in dirs:
+		f = os.path.join(d, "libimscript.so")
+		if d and os.path.exists(f):
+			break
+	else:
+		raise OSError("imscript: libimscript.so not found")
+	# ctypes.CDLL releases the GIL during the calls
+	L = ctypes.CDLL(f)
+	P, I, F, S = ctypes.c_void_p, ctypes.c_int, ctypes.c_float, ctypes.c_char_p
+	L.imscript_blur.argtypes = [P, P, I, I, I, S, P, I]
+	L.imscript_morsi.argtypes = [P, P, I, I, I, S, S]
+	L.imscript_downsa.argtypes = [P, P, I, I, I, I, I]
+	L.imscript_upsa.argtypes = [P, P, I, I, I, I, I, F, F]
+	L.imscript_homwarp.argtypes = [P, I, I, P, P, I, I, I, I]
+	L.imscript_plambda_compile.argtypes = [S, I]
+	L.imscript_plambda_compile.restype = P
+	L.imscript_plambda_dim.argtypes = [P, P, P, P, P]
+	L.imscript_plambda_run.argtypes = [P, P, I, P, P, P, P, I]
+	L.imscript_plambda_free.argtypes = [P]
+	L.imscript_ransac.argtypes = [P, P, S, P, I, P, I, F, I]
+	L.imscript_ransac_dims.argtypes = [S, P, P]
+	L.imscript_sift_nearest_two.argtypes = [P, P, P,
+			P, ctypes.c_long, I, P, ctypes.c_long, I]
+	for f in L.imscript_blur, L.imscript_morsi, L.imscript_downsa, \
+			L.imscript_upsa, L.imscript_homwarp, \
+			L.imscript_plambda_dim, L.imscript_plambda_run, \
+			L.imscript_ransac, L.imscript_ransac_dims, \
+			L.imscript_sift_nearest_two:
+		f.restype = I
+	_lib = L
+	return L
+
+# internal: float32 array in C order (converted only if necessary)
+def _float32(x):
+	return numpy.ascontiguousarray(x, dtype=numpy.float32)
+
+# internal: the array of an image, and its sizes w, h, pd
+def _image(x):
+	x = _float32(x)
+	if x.ndim == 2:
+		return x, x.shape[1], x.shape[0], 1
+	if x.ndim == 3:
+		return x, x.shape[1], x.shape[0], x.shape[2]
+	raise ValueError(f"imscript: bad image shape {x.shape}")
+
+# internal: output array of size w, h, pd (2D if pd=1 and the input was 2D)
+def _output(out, w, h, pd, flat):
+	s = (h, w) if pd == 1 and flat else (h, w, pd)
+	if out is None:
+		return numpy.empty(s, dtype=numpy.float32)
+	if out.dtype != numpy.float32 or not out.flags.c_contiguous \
+			or out.size != w * h * pd:
+		raise ValueError("imscript: out must be a C-ordered float32 "
+				f"array of shape {s}")
+	return out
+
+def _check(r, name):
+	if r:
+		raise ValueError(f"imscript: bad arguments for {name} ({r})")
+
+# API
+
+def blur(x, kernel="gaussian", *params, out=None):
+	"""blur x by a kernel ("gaussian", "laplace", "cauchy", "disk",
+	"square", ...) of the given parameters, see "blur -h"
+
+	(an upper case kernel name subtracts the blur from the image)
+	"""
+	x, w, h, pd = _image(x)
+	p = _float32(params if params else [1])
+	y = _output(out, w, h, pd, x.ndim == 2)
+	r = _library().imscript_blur(y.ctypes.data, x.ctypes.data, w, h, pd,
+			kernel.encode(), p.ctypes.data, p.size)
+	_check(r, "blur")
+	return y
+
+def gblur(x, s, out=None):
+	"""gaussian blur of standard deviation s"""
+	return blur(x, "gaussian", s, out=out)
+
+def morsi(x, element, operation, out=None):
+	"""morphological operation ("erosion", "median", "opening", ...) by a
+	structuring element ("cross", "square", "disk4.2", "hrec5", ...)
+
+	(the operation "all" gives 13 results per channel, see "morsi -h")
+	"""
+	x, w, h, pd = _image(x)
+	pdo = 13 * pd if operation == "all" else pd
+	y = _output(out, w, h, pdo, x.ndim == 2)
+	r = _library().imscript_morsi(y.ctypes.data, x.ctypes.data, w, h, pd,
+			element.encode(), operation.encode())
+	_check(r, "morsi")
+	return y
+
+def downsa(x, n, type="v", out=None):
+	"""zoom-out by a factor n, combining each block of nxn pixels by its
+	average ("v"), median ("e"), min ("i"), max ("a"), first ("f"), ...
+	"""
+	x, w, h, pd = _image(x)
+	y = _output(out, w // n, h // n, pd, x.ndim == 2)
+	r = _library().imscript_downsa(y.ctypes.data, x.ctypes.data,
+			w, h, pd, n, ord(type[0]))
+	_check(r, "downsa")
+	return y
+
+def upsa(x, n, type=2, dx=0, dy=0, out=None):
+	"""zoom-in by a factor n, with interpolation 0=nearest 1=marching
+	2=bilinear -2=fade -3=fadeinv 3=bicubic 4=lanczos3 (the result has
+	size n*w-n by n*h-n, as that of "upsa")
+	"""
+	x, w, h, pd = _image(x)
+	if n < 1:
+		raise ValueError("imscript: bad zoom factor")
+	y = _output(out, n * w - n, n * h - n, pd, x.ndim == 2)
+	r = _library().imscript_upsa(y.ctypes.data, x.ctypes.data,
+			w, h, pd, n, type, dx, dy)
+	_check(r, "upsa")
+	return y
+
+zoom = upsa
+
+def homwarp(x, H, shape=None, order=-3, out=None):
+	"""warp x by the homography H (3x3), y(p) = x(H p), of the given shape
+	(h,w) (by default, that of x), and interpolation order
+	0, 2, -3 (bicubic), 3, 5, 7 (splines)
+	"""
+	x, w, h, pd = _image(x)
+	H = numpy.ascontiguousarray(H, dtype=numpy.float64).reshape(9)
+	oh, ow = shape if shape else (h, w)
+	y = _output(out, ow, oh, pd, x.ndim == 2)
+	r = _library().imscript_homwarp(y.ctypes.data, ow, oh, H.ctypes.data,
+			x.ctypes.data, w, h, pd, order)
+	_check(r, "homwarp")
+	return y
+
+class program:
+	"""a compiled plambda expression, e.g.
+
+		p = imscript.program("x y - fabs", 2)
+		for a, b in pairs:
+			d = p(a, b)
+
+	(the images are assigned to the variables in alphabetical order, and
+	they all have the size of the first one)
+	"""
+	def __init__(self, expression, n=1):
+		if n < 1:
+			raise ValueError("imscript: a program needs an image")
+		L = _library()
+		self.n = n
+		self.p = L.imscript_plambda_compile(expression.encode(), n)
+		if not self.p:
+			raise ValueError(f"imscript: the expression \"{expression}\""
+					f" does not have {n} variables")
+
+	def __del__(self):
+		if getattr(self, "p", None):
+			_library().imscript_plambda_free(self.p)
+			self.p = None
+
+	def __call__(self, *images, out=None, nthreads=0):
+		if len(images) != self.n:
+			raise ValueError(f"imscript: {self.n} images expected")
+		x = [ _image(i) for i in images ]
+		if any(i[1:3] != x[0][1:3] for i in x):
+			raise ValueError("imscript: images of different sizes")
+		I = ctypes.c_int * self.n
+		V = ctypes.c_void_p * self.n
+		v = V(*[i[0].ctypes.data for i in x])
+		w = I(*[i[1] for i in x])
+		h = I(*[i[2] for i in x])
+		pd = I(*[i[3] for i in x])
+		L = _library()
+		opd = L.imscript_plambda_dim(self.p, v, w, h, pd)
+		y = _output(out, w[0], h[0], opd, x[0][0].ndim == 2)
+		r = L.imscript_plambda_run(self.p, y.ctypes.data, opd,
+				v, w, h, pd, nthreads)
+		_check(r, "plambda")
+		return y
+
+def plambda(expression, *images, out=None):
+	"""evaluate a plambda expression on the given images"""
+	return program(expression, len(images))(*images, out=out)
+
+def ransac(model, data, ntrials=1000, maxerr=1, minliers=None,
+		quality=None):
+	"""fit a model ("line", "aff", "affn", "hom", "aff3d", "fm", "fma") to
+	the rows of data (2 columns for lines, 4 for pairs of points in the
+	plane, 6 for pairs in space); returns the model, the mask of inliers,
+	and their number (the model is None if none was found)
+
+	(the quality of each row, if given, is used by PROSAC)
+	"""
+	L = _library()
+	dd, md = ctypes.c_int(), ctypes.c_int()
+	if L.imscript_ransac_dims(model.encode(), ctypes.byref(dd),
+			ctypes.byref(md)):
+		raise ValueError(f"imscript: unknown ransac model \"{model}\"")
+	data = _float32(data)
+	if data.size % dd.value:
+		raise ValueError(f"imscript: \"{model}\" needs {dd.value} columns")
+	n = data.size // dd.value
+	if minliers is None:
+		minliers = dd.value
+	q = _float32(quality) if quality is not None else None
+	if q is not None and q.size != n:
+		raise ValueError("imscript: one quality per row is needed")
+	m = numpy.zeros(md.value, dtype=numpy.float32)
+	mask = numpy.zeros(n, dtype=numpy.bool_)
+	k = L.imscript_ransac(m.ctypes.data, mask.ctypes.data, model.encode(),
+			data.ctypes.data, n, q.ctypes.data if q is not None
+			else None, ntrials, maxerr, minliers)
+	return (m if k > 0 else None), mask, max(k, 0)
+
+# internal: descriptors (the last 128 columns of the keypoints), and stride
+def _descriptors(k):
+	k = _float32(k)
+	if k.ndim != 2 or k.shape[1] < 128:
+		raise ValueError("imscript: keypoints need 128 columns at least")
+	return k, k.ctypes.data + 4 * (k.shape[1] - 128), k.shape[1]
+
+def sift_nearest(a, b):
+	"""the two nearest (euclidean) descriptors in b of each row of a
+
+	returns the index of the nearest one, and the two distances (the rows
+	are keypoints like those of "siftu", where the descriptors are the
+	last 128 columns)
+	"""
+	a, pa, sa = _descriptors(a)
+	b, pb, sb = _descriptors(b)
+	n = a.shape[0]
+	i = numpy.empty(n, dtype=numpy.intc)
+	d = numpy.empty(n, dtype=numpy.float64)
+	d2 = numpy.empty(n, dtype=numpy.float64)
+	r = _library().imscript_sift_nearest_two(i.ctypes.data, d.ctypes.data,
+			d2.ctypes.data, pa, sa, n, pb, sb, b.shape[0])
+	_check(r, "sift_nearest")
+	return i, d, d2
+
+def sift_match(a, b, ratio=0.8):
+	"""pairs (i,j) of matching keypoints, with Lowe's ratio test, sorted by
+	distance (as "siftu pairR")
+	"""
+	i, d, d2 = sift_nearest(a, b)
+	k = numpy.flatnonzero((i >= 0) & (d < ratio * d2))
+	k = k[numpy.argsort(d[k], kind="stable")]
+	return numpy.stack([k, i[k]], axis=1)
@@ -9,7 +9,7 @@ class myinstall(install):
 	def run(self):
 		import os
 		os.system("mkdir -p bin")
-		os.system(f"make -j {programs()}")
+		os.system(f"make -j {programs()} bin/libimscript.so")
 		install.run(self)
 
 
@@ -28,5 +28,7 @@ setuptools.setup(
 		"Topic :: Scientific/Engineering :: Mathematics"
 		],
 	cmdclass = {'install' : myinstall},
-	data_files = [('bin', programs().split())]
+	py_modules = ["imscript"],
+	install_requires = ["numpy"],
+	data_files = [('bin', programs().split() + ["bin/libimscript.so"])]
 )
@@ -6,31 +6,26 @@
 #include "iio.h"
 
 #define xmalloc malloc
+#include "quantiles.c"
 static int global_verbose_flag = 0;
 
-static int compare_floats(const void *a, const void *b)
-{
-	const float *da = (const float *) a;
-	const float *db = (const float *) b;
-	return (*da > *db) - (*da < *db);
-}
-
+// (the NANs are placed after all the numbers, thus they are not selected)
 static void get_rminmax(float *rmin, float *rmax, float *x, int n, float rb)
 {
-	float *tx = xmalloc(n*sizeof*tx);
 	int N = 0;
 	for (int i = 0; i < n; i++)
 		if (!isnan(x[i]))
-			tx[N++] = x[i];
+			N += 1;
 	int irb = round(rb);
 	if (N < 1) {
 		fprintf(stderr, "too many NANs (rb N) = %g %d", rb, N);
 		abort();
 	}
-	qsort(tx, N, sizeof*tx, compare_floats);
-	*rmin = tx[irb];
-	*rmax = tx[N-1-irb];
-	free(tx);
+	long k[2] = {irb, N-1-irb};
+	float q[2];
+	quantiles_of_array(q, x, n, 1, k, 2);
+	*rmin = q[0];
+	*rmax = q[1];
 }
 
 static void get_avgstd(float *out_avg, float *out_std, float *x, int n)
@@ -48,60 +43,76 @@ static void get_avgstd(float *out_avg, float *out_std, float *x, int n)
 	*out_std = sqrt(var);
 }
 
+static float quantize_to_byte_value(float x)
+{
+	float g = round(x);
+	int ig = g;
+	if (ig < 0) ig = 0;
+	if (ig > 255) ig = 255;
+	return ig;
+}
+
 // adjust contrast by allowing a fixed percentile of top and bottom saturation
-static void simplest_color_balance(float *y, float *x, int w, int h, float p)
+// (and quantize the output, if requested)
+static void simplest_color_balance(float *y, float *x, int w, int h, float p,
+		bool quantize)
 {
 	float rmin, rmax;
 	get_rminmax(&rmin, &rmax, x, w*h, w*h*(p/100));
 	if (global_verbose_flag)
 		fprintf(stderr, "qauto: rminmax = %g %g\n", rmin, rmax);
 
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int i = 0; i < w*h; i++)
-		y[i] = 255 * (x[i] - rmin) / (rmax - rmin);
+	{
+		float g = 255 * (x[i] - rmin) / (rmax - rmin);
+		y[i] = quantize ? quantize_to_byte_value(g) : g;
+	}
 }
 
 // adjust contrast by normalizing avg=127 std=s
-static void adjust_avgstd(float *y, float *x, int w, int h, float s)
+static void adjust_avgstd(float *y, float *x, int w, int h, float s,
+		bool quantize)
 {
 	float avg, std;
 	get_avgstd(&avg, &std, x, w*h);
 	fprintf(stderr, "qauto: avgstd = %g %g\n", avg, std);
 
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int i = 0; i < w*h; i++)
-		y[i] = 127 + s * (x[i] - avg) / std;
+	{
+		float g = 127 + s * (x[i] - avg) / std;
+		y[i] = quantize ? quantize_to_byte_value(g) : g;
+	}
 }
 
-static void qauto_grey(float *y, float *x, int w, int h, float parameter)
+static void qauto_grey(float *y, float *x, int w, int h, float parameter,
+		bool quantize)
 {
 	if (parameter >= 0)
-		simplest_color_balance(y, x, w, h, parameter);
+		simplest_color_balance(y, x, w, h, parameter, quantize);
 	else
-		adjust_avgstd(y, x, w, h, -parameter);
-}
-
-static void quantize_to_byte_values_inplace(float *x, int n)
-{
-	for (int i = 0; i < n; i++)
-	{
-		float g = round(x[i]);
-		int ig = g;
-		if (ig < 0) ig = 0;
-		if (ig > 255) ig = 255;
-		x[i] = ig;
-	}
+		adjust_avgstd(y, x, w, h, -parameter, quantize);
 }
 
+// the quantization is done while writing the output
 static void qauto(float *y, float *x, int w, int h, int pd,
 	bool independent_channels, float parameter, bool do_not_quantize)
 {
-	if (independent_channels)
+	if (independent_channels) {
+		// the channels are independent (each one with its own histogram)
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 		for (int l = 0; l < pd; l++)
-			qauto_grey(y + w*h*l, x + w*h*l, w, h, parameter);
-	else
-		qauto_grey(y, x, w, h*pd, parameter);
-
-	if (!do_not_quantize)
-		quantize_to_byte_values_inplace(y, w*h*pd);
+			qauto_grey(y + w*h*l, x + w*h*l, w, h, parameter,
+					!do_not_quantize);
+	} else
+		qauto_grey(y, x, w, h*pd, parameter, !do_not_quantize);
 }
 
 
@@ -141,6 +152,7 @@ static char *help_string_long     =
 ;
 #include "help_stuff.c" // functions that print the strings named above
 #include "pickopt.c"    // function to extract hyphenated command line options
+#include "profile.c"
 int main_qauto(int c, char *v[])
 {
 	// process "help" arguments
@@ -172,7 +184,8 @@ int main_qauto(int c, char *v[])
 	float *y = xmalloc(w*h*pd*sizeof*y);
 
 	// run the algorithm
-	qauto(y, x, w, h, pd, independent, parameter, dontquantize);
+	PROFILE_SCOPE("qauto")
+		qauto(y, x, w, h, pd, independent, parameter, dontquantize);
 
 	// write result and exit
 	iio_write_image_float_split(out, y, w, h, pd);
@@ -0,0 +1,154 @@
+#ifndef _QUANTILES_C
+#define _QUANTILES_C
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Order statistics of arrays of floats, without sorting them.
+//
+// The order is the usual one, with all the NANs after the largest number.
+// The results are the same as those of sorting the array, thus
+//
+// 	quantile_select_spoilable(x, n, k) == qsort(x,...), x[k]
+//
+// This file needs a function "xmalloc" (e.g., from xmalloc.c).
+
+static int quantile_less(float a, float b)
+{
+	return a < b || (isnan(b) && !isnan(a));
+}
+
+static int quantile_compare(const void *aa, const void *bb)
+{
+	const float *a = (const float *)aa;
+	const float *b = (const float *)bb;
+	return quantile_less(*b, *a) - quantile_less(*a, *b);
+}
+
+// k-th smallest element of the array x[0..n-1] (the array is reordered)
+//
+// This is an introselect: a quickselect with median-of-three pivots, that
+// falls back to sorting the remaining part after too many bad partitions.
+static float quantile_select_spoilable(float *x, long n, long k)
+{
+	if (n < 1) return NAN;
+	if (k < 0) k = 0;
+	if (k >= n) k = n - 1;
+	int depth = 0;
+	for (long m = n; m > 1; m /= 2)
+		depth += 2;
+	long lo = 0, hi = n - 1;
+	while (hi > lo)
+	{
+		if (depth-- == 0) {
+			qsort(x + lo, hi - lo + 1, sizeof*x, quantile_compare);
+			return x[k];
+		}
+		long mid = lo + (hi - lo) / 2;
+		float t;
+#define QSWAP(a,b) (t = x[a], x[a] = x[b], x[b] = t)
+		if (quantile_less(x[mid], x[lo])) QSWAP(mid, lo);
+		if (quantile_less(x[hi], x[lo]))  QSWAP(hi, lo);
+		if (quantile_less(x[hi], x[mid])) QSWAP(hi, mid);
+		float p = x[mid];
+		long i = lo, j = hi;
+		while (i <= j)
+		{
+			while (quantile_less(x[i], p)) i++;
+			while (quantile_less(p, x[j])) j--;
+			if (i <= j) {
+				QSWAP(i, j);
+				i++;
+				j--;
+			}
+		}
+#undef QSWAP
+		// now x[lo..j] <= p <= x[i..hi], and x[j+1..i-1] == p
+		if (k <= j) hi = j;
+		else if (k >= i) lo = i;
+		else return x[k];
+	}
+	return x[k];
+}
+
+// monotonic integer key of a float (all the NANs get the largest key)
+static uint32_t quantile_key(float x)
+{
+	if (isnan(x)) return UINT32_MAX;
+	uint32_t u;
+	memcpy(&u, &x, sizeof u);
+	return u & 0x80000000 ? ~u : u | 0x80000000;
+}
+
+// several order statistics of the samples x[0], x[s], ..., x[(n-1)*s]
+//
+// q[i] = k[i]-th smallest sample, for i = 0, ..., nk-1
+//
+// The input is not modified.  A first pass computes the histogram of the
+// 16 high bits of the keys, which gives the bucket of each requested rank.
+// A second pass gathers the samples of those buckets, and the ranks are
+// selected within them.
+static void quantiles_of_array(float *q, float *x, long n, int s,
+		long *k, int nk)
+{
+	if (n < 1) {
+		for (int i = 0; i < nk; i++)
+			q[i] = NAN;
+		return;
+	}
+	int nb = 1 << 16;
+	long *start = xmalloc((nb + 1) * sizeof*start);
+	memset(start, 0, (nb + 1) * sizeof*start);
+	for (long i = 0; i < n; i++)
+		start[1 + (quantile_key(x[i*s]) >> 16)] += 1;
+	for (int b = 0; b < nb; b++)
+		start[b+1] += start[b];
+
+	// bucket of each rank (the last one that starts at or before it)
+	int bk[nk], *slot = xmalloc(nb * sizeof*slot), ns = 0;
+	for (int b = 0; b < nb; b++)
+		slot[b] = -1;
+	for (int i = 0; i < nk; i++)
+	{
+		long ki = k[i] < 0 ? 0 : (k[i] >= n ? n - 1 : k[i]);
+		int a = 0, b = nb - 1;
+		while (a < b) {
+			int m = (a + b + 1) / 2;
+			if (start[m] <= ki) a = m; else b = m - 1;
+		}
+		bk[i] = a;
+		if (slot[a] < 0)
+			slot[a] = ns++;
+	}
+
+	float *buf[ns];
+	long fill[ns];
+	for (int b = 0; b < nb; b++)
+		if (slot[b] >= 0) {
+			buf[slot[b]] = xmalloc((start[b+1] - start[b]) * sizeof(float));
+			fill[slot[b]] = 0;
+		}
+	for (long i = 0; i < n; i++)
+	{
+		int t = slot[quantile_key(x[i*s]) >> 16];
+		if (t >= 0)
+			buf[t][fill[t]++] = x[i*s];
+	}
+
+	for (int i = 0; i < nk; i++)
+	{
+		long ki = k[i] < 0 ? 0 : (k[i] >= n ? n - 1 : k[i]);
+		int b = bk[i];
+		q[i] = quantile_select_spoilable(buf[slot[b]],
+				start[b+1] - start[b], ki - start[b]);
+	}
+
+	for (int i = 0; i < ns; i++)
+		free(buf[i]);
+	free(slot);
+	free(start);
+}
+
+#endif//_QUANTILES_C
@@ -17,6 +17,9 @@
 // 	2. pass fancy statistical tests
 
 static uint64_t lcg_knuth_seed = 0;
+#ifdef _OPENMP
+#pragma omp threadprivate(lcg_knuth_seed)
+#endif
 
 static void lcg_knuth_srand(uint64_t x)
 {
@@ -32,6 +35,23 @@ static uint32_t lcg_knuth_rand(void)
 	return lcg_knuth_seed >> 32;
 }
 
+// state of the generator after n more steps (in logarithmic time)
+// this allows to generate the same sequence by pieces, from several threads
+static uint64_t lcg_knuth_skip(uint64_t seed, uint64_t n)
+{
+	uint64_t a = 6364136223846793005, c = 1442695040888963407;
+	uint64_t A = 1, C = 0;
+	while (n) {
+		if (n & 1) {
+			A *= a;
+			C = C * a + c;
+		}
+		c *= a + 1;
+		a *= a;
+		n >>= 1;
+	}
+	return A * seed + C;
+}
 
 static void xsrand(unsigned long int iseed)
 {
@@ -154,4 +174,242 @@ static double random_stable(double alpha, double beta)
 	return r;
 }
 
+// counter-based generator (Philox4x32-10)
+//
+// Salmon, Moraes, Dror, Shaw, "Parallel random numbers: as easy as 1, 2, 3",
+// SC 2011.  Each block of 4 random words is a function of a key (the seed)
+// and a counter (a position, a stream id and a sub-block), so that any
+// sample can be computed independently of the others.  Thus the samples
+// can be produced in any order, by any number of threads, and the results
+// are always the same.
+//
+// There are two ways to use it:
+// 	1. sample i of a stream: random_philox_uniform(seed, stream, i), etc.
+// 	   (the fill functions compute many of them in parallel)
+// 	2. sequences: struct random_stream, like the LCG above
+// They give different numbers (the sequences use the position as a block
+// counter, not as a sample index).
+
+static void philox4x32(uint32_t out[4], const uint32_t ctr[4],
+		const uint32_t key[2])
+{
+	uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int r = 0; r < 10; r++)
+	{
+		uint64_t p0 = 0xD2511F53 * (uint64_t)c0;
+		uint64_t p1 = 0xCD9E8D57 * (uint64_t)c2;
+		uint32_t n0 = (p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = (p0 >> 32) ^ c3 ^ k1;
+		c1 = p1;
+		c3 = p0;
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+// block "sub" of the random words at position i of a stream
+static void random_philox_block(uint32_t out[4], uint64_t seed,
+		uint32_t stream, uint64_t i, uint32_t sub)
+{
+	uint32_t key[2] = {seed, seed >> 32};
+	uint32_t ctr[4] = {i, i >> 32, stream, sub};
+	philox4x32(out, ctr, key);
+}
+
+// uniform in the open interval (0,1)
+static double random_philox_word_to_uniform(uint32_t x)
+{
+	return (x + 0.5) / 4294967296.0;
+}
+
+static double random_philox_uniform(uint64_t seed, uint32_t stream,
+		uint64_t i)
+{
+	uint32_t r[4];
+	random_philox_block(r, seed, stream, i, 0);
+	return random_philox_word_to_uniform(r[0]);
+}
+
+// tables of the ziggurat for the normal distribution, 128 layers
+// (Marsaglia and Tsang, "The ziggurat method for generating random
+// variables", Journal of Statistical Software 5(8), 2000)
+static uint32_t random_zig_k[128];
+static double random_zig_w[128], random_zig_f[128];
+static int random_zig_ready = 0;
+
+#define RANDOM_ZIG_R 3.442619855899
+
+static void random_zig_init(void)
+{
+	int ready;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+	ready = random_zig_ready;
+	if (ready) return;
+#ifdef _OPENMP
+#pragma omp critical(random_zig)
+#endif
+	if (!random_zig_ready)
+	{
+		double m = 2147483648.0, v = 9.91256303526217e-3;
+		double d = RANDOM_ZIG_R, t = d, q = v / exp(-0.5 * d * d);
+		random_zig_k[0] = (d / q) * m;
+		random_zig_k[1] = 0;
+		random_zig_w[0] = q / m;
+		random_zig_w[127] = d / m;
+		random_zig_f[0] = 1;
+		random_zig_f[127] = exp(-0.5 * d * d);
+		for (int i = 126; i >= 1; i--)
+		{
+			d = sqrt(-2 * log(v / d + exp(-0.5 * d * d)));
+			random_zig_k[i+1] = (d / t) * m;
+			t = d;
+			random_zig_f[i] = exp(-0.5 * d * d);
+			random_zig_w[i] = d / m;
+		}
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+		random_zig_ready = 1;
+	}
+}
+
+// source of random words for the ziggurat
+struct random_words {
+	uint64_t seed, i;
+	uint32_t stream, sub;
+	uint32_t r[4];
+	int n; // number of words of r already used
+};
+
+static uint32_t random_words_next(struct random_words *s)
+{
+	if (s->n == 4) {
+		random_philox_block(s->r, s->seed, s->stream, s->i, s->sub);
+		s->sub += 1;
+		s->n = 0;
+	}
+	return s->r[s->n++];
+}
+
+// standard normal sample, by the ziggurat (needs random_zig_init)
+static double random_zig_normal(struct random_words *s)
+{
+	for (;;)
+	{
+		int32_t hz = random_words_next(s);
+		int iz = random_words_next(s) & 127;
+		double x = hz * random_zig_w[iz];
+		if ((uint32_t)abs(hz) < random_zig_k[iz])
+			return x;
+		if (iz == 0) { // the tail
+			double a, b;
+			do {
+				double u1 = random_words_next(s);
+				double u2 = random_words_next(s);
+				a = -log((u1 + 0.5) / 4294967296.0) / RANDOM_ZIG_R;
+				b = -log((u2 + 0.5) / 4294967296.0);
+			} while (b + b < a * a);
+			return hz > 0 ? RANDOM_ZIG_R + a : -RANDOM_ZIG_R - a;
+		}
+		double u = random_philox_word_to_uniform(random_words_next(s));
+		double f0 = random_zig_f[iz], f1 = random_zig_f[iz-1];
+		if (f0 + u * (f1 - f0) < exp(-0.5 * x * x))
+			return x;
+	}
+}
+
+static double random_philox_normal(uint64_t seed, uint32_t stream,
+		uint64_t i)
+{
+	random_zig_init();
+	struct random_words s = {seed, i, stream, 0, {0}, 4};
+	return random_zig_normal(&s);
+}
+
+// x[k] = random_philox_uniform(seed, stream, offset + k), in parallel
+static void random_fill_uniform(float *x, long n, uint64_t seed,
+		uint32_t stream, uint64_t offset)
+{
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long k = 0; k < n; k++)
+		x[k] = random_philox_uniform(seed, stream, offset + k);
+}
+
+// x[k] = random_philox_normal(seed, stream, offset + k), in parallel
+static void random_fill_normal(float *x, long n, uint64_t seed,
+		uint32_t stream, uint64_t offset)
+{
+	random_zig_init();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long k = 0; k < n; k++)
+	{
+		struct random_words s = {seed, offset + k, stream, 0, {0}, 4};
+		x[k] = random_zig_normal(&s);
+	}
+}
+
+// sequence of random numbers, one for each stream id
+struct random_stream {
+	struct random_words w;
+};
+
+static void random_stream_init(struct random_stream *s, uint64_t seed,
+		uint32_t stream)
+{
+	s->w = (struct random_words){seed, 0, stream, 0, {0}, 4};
+}
+
+static uint32_t random_stream_u32(struct random_stream *s)
+{
+	if (s->w.n == 4) {
+		random_philox_block(s->w.r, s->w.seed, s->w.stream, s->w.i, 0);
+		s->w.i += 1;
+		s->w.n = 0;
+	}
+	return s->w.r[s->w.n++];
+}
+
+static double random_stream_uniform(struct random_stream *s)
+{
+	return random_philox_word_to_uniform(random_stream_u32(s));
+}
+
+static double random_stream_normal(struct random_stream *s)
+{
+	random_zig_init();
+	for (;;) // (the same ziggurat, drawing the words from the sequence)
+	{
+		int32_t hz = random_stream_u32(s);
+		int iz = random_stream_u32(s) & 127;
+		double x = hz * random_zig_w[iz];
+		if ((uint32_t)abs(hz) < random_zig_k[iz])
+			return x;
+		if (iz == 0) {
+			double a, b;
+			do {
+				a = -log(random_stream_uniform(s)) / RANDOM_ZIG_R;
+				b = -log(random_stream_uniform(s));
+			} while (b + b < a * a);
+			return hz > 0 ? RANDOM_ZIG_R + a : -RANDOM_ZIG_R - a;
+		}
+		double u = random_stream_uniform(s);
+		double f0 = random_zig_f[iz], f1 = random_zig_f[iz-1];
+		if (f0 + u * (f1 - f0) < exp(-0.5 * x * x))
+			return x;
+	}
+}
+
 #endif//_RANDOM_C
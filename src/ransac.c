@@ -6,6 +6,11 @@
 #include "xmalloc.c"
 #include "xfopen.c"
 #include "random.c"
+#include "smapa.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // generic function
 // evaluate the error of a datapoint according to a model
@@ -163,6 +168,179 @@ static void fill_random_indices(int *idx, int n, int a, int b)
 
 #define MAX_MODELS 10
 
+// probability of missing the best model, for the adaptive number of trials
+// (0 = always make all the trials)
+SMART_PARAMETER_SILENT(RANSAC_CONFIDENCE,0.005)
+
+// draws of the random generator reserved for each trial
+#define RANSAC_TRIAL_STRIDE 65536
+
+// number of trials needed to draw, with probability 1-eta, at least one
+// sample of nfit inliers, when the inlier ratio is ninliers/n
+// (q is the probability that the model of such a sample is not rejected)
+static int ransac_adaptive_trials(int ninliers, int n, int nfit, double eta,
+		double q, int ntrials)
+{
+	if (!(eta > 0 && eta < 1) || ninliers < 1)
+		return ntrials;
+	double p = q * pow(ninliers / (double)n, nfit);
+	if (p >= 1)
+		return 1;
+	double N = ceil(log(eta) / log1p(-p));
+	return N < ntrials ? N : ntrials;
+}
+
+// early rejection of the bad models, by Wald's sequential probability ratio
+// test (Chum and Matas, "Optimal randomized RANSAC", PAMI 2008)
+//
+// The data points are checked in a random order, and the model is rejected
+// as soon as the likelihood ratio of being a bad model (where each point is
+// an inlier with probability delta) against being a good one (probability
+// epsilon) goes above A.  This rejects a good model with probability 1/A.
+// The probabilities are estimated along the trials, from the best model and
+// from the rejected ones.
+SMART_PARAMETER_SILENT(RANSAC_SPRT,0)
+SMART_PARAMETER_SILENT(RANSAC_SPRT_EPSILON,0.1)
+SMART_PARAMETER_SILENT(RANSAC_SPRT_DELTA,0.01)
+
+// cost of generating a model, in evaluations of a data point
+#define RANSAC_SPRT_MODEL_COST 200
+
+struct ransac_sprt {
+	double epsilon, delta; // inlier ratios of the good and bad models
+	double A;              // decision threshold
+	double lg, lb;         // log-likelihood steps of good and bad points
+	double delta_sum;      // inlier ratios of the rejected models
+	int nrejected;
+};
+
+// decision threshold and steps for the current epsilon and delta
+static void ransac_sprt_update(struct ransac_sprt *s)
+{
+	double e = s->epsilon, d = s->delta;
+	if (d > 0.9 * e) d = 0.9 * e;
+	if (d < 1e-4) d = 1e-4;
+	double C = (1 - d) * log((1 - d) / (1 - e)) + d * log(d / e);
+	double K = RANSAC_SPRT_MODEL_COST / C;
+	double A = K + 1;
+	for (int i = 0; i < 10; i++)
+		A = K + 1 + log(A);
+	s->A = A;
+	s->lg = log(d / e);
+	s->lb = log((1 - d) / (1 - e));
+}
+
+static void ransac_sprt_init(struct ransac_sprt *s, double epsilon,
+		double delta)
+{
+	s->epsilon = epsilon;
+	s->delta = delta;
+	s->delta_sum = 0;
+	s->nrejected = 0;
+	ransac_sprt_update(s);
+}
+
+// like "ransac_trial", but give up (returning -1) as soon as the model can not
+// have more than "nbest" inliers, or it is rejected by the test "s" (if any);
+// the points are checked in the order perm[0..n-1]
+static int ransac_trial_early(bool *out_mask, float *data, float *model,
+		float max_error, int datadim, int n,
+		ransac_error_evaluation_function *mev, void *usr,
+		int *perm, int nbest, struct ransac_sprt *s)
+{
+	int cx = 0;
+	double L = 0, logA = s ? log(s->A) : 0;
+	for (int k = 0; k < n; k++)
+	{
+		int i = perm[k];
+		float e = mev(model, data + i*datadim, usr);
+		if (!(e >= 0)) fprintf(stderr, "WARNING e = %g\n", e);
+		assert(e >= 0);
+		out_mask[i] = e < max_error;
+		if (out_mask[i])
+			cx += 1;
+		if (cx + n - k - 1 <= nbest)
+			return -1;
+		if (s && (L += out_mask[i] ? s->lg : s->lb) > logA) {
+			s->delta_sum += cx / (k + 1.0);
+			s->nrejected += 1;
+			double d = s->delta_sum / s->nrejected;
+			if (fabs(d - s->delta) > 0.05 * s->delta) {
+				s->delta = d;
+				ransac_sprt_update(s);
+			}
+			return -1;
+		}
+	}
+	return cx;
+}
+
+// PROSAC: progressive sampling of the best data points first
+// (Chum and Matas, "Matching with PROSAC", CVPR 2005)
+//
+// The data points are sorted by decreasing quality.  The trial t draws its
+// sample among the first k(t) points, and it always includes the k(t)-th,
+// where k(t) grows so that, after ntrials trials, all the points are equally
+// likely (as in the uniform sampling).  Since k(t) only depends on t, the
+// trials can still be run in any order.
+
+struct prosac_item { float q; int i; };
+
+// sort by decreasing quality, the NANs last and ties by index
+static int compare_prosac_items(const void *aa, const void *bb)
+{
+	const struct prosac_item *a = (const struct prosac_item *)aa;
+	const struct prosac_item *b = (const struct prosac_item *)bb;
+	if (a->q > b->q || (isnan(b->q) && !isnan(a->q))) return -1;
+	if (a->q < b->q || (isnan(a->q) && !isnan(b->q))) return 1;
+	return (a->i > b->i) - (a->i < b->i);
+}
+
+// fill the order of the points, and the last trial T[k] of each size k
+static void prosac_init(int *order, int *T, float *quality, int n, int m,
+		int ntrials)
+{
+	struct prosac_item *t = xmalloc(n * sizeof*t);
+	for (int i = 0; i < n; i++)
+	{
+		t[i].q = quality[i];
+		t[i].i = i;
+	}
+	qsort(t, n, sizeof*t, compare_prosac_items);
+	for (int i = 0; i < n; i++)
+		order[i] = t[i].i;
+	free(t);
+
+	// expected number of samples of the first k points, among ntrials
+	double Tk = ntrials;
+	for (int i = 0; i < m; i++)
+		Tk *= (m - i) / (double)(n - i);
+	T[m] = 1;
+	for (int k = m; k < n; k++)
+	{
+		double Tk1 = Tk * (k + 1) / (k + 1 - m);
+		double d = ceil(Tk1 - Tk);
+		T[k+1] = T[k] + (d < INT_MAX - T[k] ? d : INT_MAX - T[k]);
+		Tk = Tk1;
+	}
+}
+
+// sample for the trial t (for t >= T[n], it is uniform)
+static void prosac_indices(int *idx, int m, int n, int *order, int *T, int t)
+{
+	int a = m, b = n;
+	while (a < b) { // first k such that T[k] > t
+		int k = (a + b) / 2;
+		if (T[k] > t) b = k; else a = k + 1;
+	}
+	if (a < n) {
+		fill_random_indices(idx, m - 1, 0, a - 1);
+		idx[m-1] = a - 1;
+	} else
+		fill_random_indices(idx, m, 0, n);
+	for (int i = 0; i < m; i++)
+		idx[i] = order[idx[i]];
+}
 
 // RANSAC
 //
@@ -174,7 +352,10 @@ static void fill_random_indices(int *idx, int n, int a, int b)
 // by hand, and then the inliers of a model are defined as the data points
 // which fit the model up to the allowed error.  The RANSAC algorithm randomly
 // tries several models and keeps the one with the largest number of inliers.
-static int ransac(
+//
+// If a quality is given for each data point (larger is better), the samples
+// are drawn by PROSAC.
+static int ransac_guided(
 		// output
 		bool *out_mask,    // array mask identifying the inliers
 		float *out_model,  // model parameters
@@ -197,7 +378,8 @@ static int ransac(
 
 		// decoration
 		ransac_model_accepting_function *macc,
-		void *usr
+		void *usr,
+		float *quality     // quality of each data point (optional)
 		)
 {
 	fprintf(stderr, "running RANSAC over %d datapoints of dimension %d\n",
@@ -206,50 +388,155 @@ static int ransac(
 		       	modeldim, nfit);
 	fprintf(stderr, "we will make %d trials and keep the best with e<%g\n",
 			ntrials, max_error);
+	if (RANSAC_CONFIDENCE() > 0)
+		fprintf(stderr, "(or fewer, to miss it with probability %g)\n",
+				RANSAC_CONFIDENCE());
 	fprintf(stderr, "a model must have more than %d inliers\n",
 			min_inliers);
+	if (quality)
+		fprintf(stderr, "the samples are drawn by PROSAC\n");
 
 	if (n < nfit)
 	  return 0;
-	int best_ninliers = 0;
+	int best_ninliers = 0, best_trial = -1;
 	float best_model[modeldim];
 	bool *best_mask = xmalloc(n * sizeof*best_mask);
-	bool *tmp_mask = xmalloc(n * sizeof*best_mask);
 
-	for (int i = 0; i < ntrials; i++)
+	// Each trial draws its sample from its own piece of the random
+	// sequence, so that the trials are the same for any number of threads.
+	// The trials are shared by the threads, each one keeps its own best
+	// model, and they are merged at the end.  Whenever a better model is
+	// found, the number of trials is reduced according to its inlier ratio.
+	//
+	// A trial is abandoned as soon as it can not beat the best model of
+	// its thread, and with RANSAC_SPRT also when it fails the test above.
+	double eta = RANSAC_CONFIDENCE();
+	bool sprt = RANSAC_SPRT() > 0;
+	double sprt_epsilon = RANSAC_SPRT_EPSILON();
+	double sprt_delta = RANSAC_SPRT_DELTA();
+	uint64_t seed = lcg_knuth_seed;
+	int *perm = xmalloc(n * sizeof*perm);
+	for (int i = 0; i < n; i++)
+		perm[i] = i;
+	if (sprt) {
+		lcg_knuth_srand(lcg_knuth_skip(seed,
+					(uint64_t)ntrials * RANSAC_TRIAL_STRIDE));
+		shuffle(perm, n, sizeof*perm);
+	}
+	int *order = NULL, *prosac_T = NULL;
+	if (quality) {
+		order = xmalloc(n * sizeof*order);
+		prosac_T = xmalloc((n + 1) * sizeof*prosac_T);
+		prosac_init(order, prosac_T, quality, n, nfit, ntrials);
+	}
+	int max_trials = ntrials; // shared by the threads
+	int n_tried = 0, n_rejected = 0;
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:n_tried,n_rejected)
+#endif
 	{
-		int indices[nfit];
-		fill_random_indices(indices, nfit, 0, n);
-
-		float x[nfit*datadim];
-		for (int j = 0; j < nfit; j++)
-		for (int k = 0; k < datadim; k++)
-			x[datadim*j + k] = data[datadim*indices[j] + k];
-
-		float model[modeldim*MAX_MODELS];
-		int nm = mgen(model, x, usr);
-		if (!nm)
-			continue;
-		if (macc && !macc(model, usr))
-			continue;
-
-		// generally, nm=1
-		for (int j = 0; j < nm; j++)
+		int my_ninliers = 0, my_trial = -1;
+		float my_model[modeldim];
+		bool *my_mask = xmalloc(n * sizeof*my_mask);
+		bool *tmp_mask = xmalloc(n * sizeof*tmp_mask);
+		struct ransac_sprt s[1];
+		ransac_sprt_init(s, sprt_epsilon, sprt_delta);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,16)
+#endif
+		for (int i = 0; i < ntrials; i++)
 		{
-			float *modelj = model + j*modeldim;
-			int n_inliers = ransac_trial(tmp_mask, data, modelj,
-					max_error, datadim, n, mev, usr);
-
-			if (n_inliers > best_ninliers)
+			int m;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+			m = max_trials;
+			if (i >= m)
+				continue;
+			n_tried += 1;
+			lcg_knuth_srand(lcg_knuth_skip(seed,
+						(uint64_t)i * RANSAC_TRIAL_STRIDE));
+
+			int indices[nfit];
+			if (quality)
+				prosac_indices(indices, nfit, n, order,
+						prosac_T, i);
+			else
+				fill_random_indices(indices, nfit, 0, n);
+
+			float x[nfit*datadim];
+			for (int j = 0; j < nfit; j++)
+			for (int k = 0; k < datadim; k++)
+				x[datadim*j + k] = data[datadim*indices[j] + k];
+
+			float model[modeldim*MAX_MODELS];
+			int nm = mgen(model, x, usr);
+			if (!nm)
+				continue;
+			if (macc && !macc(model, usr))
+				continue;
+
+			// generally, nm=1
+			for (int j = 0; j < nm; j++)
 			{
-				best_ninliers = n_inliers;
-				for(int k = 0; k < modeldim; k++)
-					best_model[k] = modelj[k];
-				for(int k = 0; k < n; k++)
-					best_mask[k] = tmp_mask[k];
+				float *modelj = model + j*modeldim;
+				int n_inliers = ransac_trial_early(tmp_mask,
+						data, modelj, max_error, datadim,
+						n, mev, usr, perm, my_ninliers,
+						sprt ? s : NULL);
+				if (n_inliers < 0)
+					n_rejected += 1;
+
+				if (n_inliers > my_ninliers)
+				{
+					my_ninliers = n_inliers;
+					my_trial = i;
+					for(int k = 0; k < modeldim; k++)
+						my_model[k] = modelj[k];
+					bool *t = my_mask;
+					my_mask = tmp_mask;
+					tmp_mask = t;
+					if (sprt && my_ninliers > s->epsilon * n) {
+						s->epsilon = my_ninliers / (double)n;
+						ransac_sprt_update(s);
+					}
+					double q = sprt ? 1 - 1 / s->A : 1;
+					int N = my_ninliers < min_inliers ? ntrials :
+						ransac_adaptive_trials(my_ninliers,
+							n, nfit, eta, q, ntrials);
+#ifdef _OPENMP
+#pragma omp critical(ransac_trials)
+#endif
+					if (N < max_trials)
+						max_trials = N;
+				}
 			}
 		}
+
+		// ties are broken by the first trial, as in the serial loop
+#ifdef _OPENMP
+#pragma omp critical(ransac_best)
+#endif
+		if (my_ninliers > best_ninliers || (my_ninliers > 0 &&
+				my_ninliers == best_ninliers && my_trial < best_trial))
+		{
+			best_ninliers = my_ninliers;
+			best_trial = my_trial;
+			for(int k = 0; k < modeldim; k++)
+				best_model[k] = my_model[k];
+			for(int k = 0; k < n; k++)
+				best_mask[k] = my_mask[k];
+		}
+		free(my_mask);
+		free(tmp_mask);
 	}
+	lcg_knuth_srand(lcg_knuth_skip(seed,
+				(uint64_t)ntrials * RANSAC_TRIAL_STRIDE));
+	fprintf(stderr, "RANSAC made %d trials (%d models rejected early)\n",
+			n_tried, n_rejected);
+	free(perm);
+	free(order);
+	free(prosac_T);
 
 	fprintf(stderr, "RANSAC found this best model:");
 	for (int i = 0; i < modeldim; i++)
@@ -300,11 +587,23 @@ static int ransac(
 			out_mask[j] = best_mask[j];
 
 	free(best_mask);
-	free(tmp_mask);
 
 	return return_value;
 }
 
+// RANSAC with uniform sampling
+static int ransac(bool *out_mask, float *out_model, float *data,
+		int datadim, int n, int modeldim,
+		ransac_error_evaluation_function *mev,
+		ransac_model_generating_function *mgen, int nfit,
+		int ntrials, int min_inliers, float max_error,
+		ransac_model_accepting_function *macc, void *usr)
+{
+	return ransac_guided(out_mask, out_model, data, datadim, n, modeldim,
+			mev, mgen, nfit, ntrials, min_inliers, max_error,
+			macc, usr, NULL);
+}
+
 #ifndef OMIT_MAIN
 
 #include <stdio.h>
@@ -312,14 +611,18 @@ static int ransac(
 
 #include "ransac_cases.c" // example functions for RANSAC input
 #include "parsenumbers.c" // function "read_ascii_floats"
+#include "pickopt.c"
 
 int main_cases(int c, char *v[])
 {
+	bool has_quality = pick_option(&c, &v, "q", NULL);
 	if (c != 6 && c != 7 && c != 8) {
-		fprintf(stderr, "usage:\n\t%s {line,aff,affn,fm} "
+		fprintf(stderr, "usage:\n\t%s {line,aff,affn,fm} [-q] "
 		//                         0   1
 		"ntrials maxerr minliers omodel [omask [oinliers]] <data\n",*v);
 		//2      3      4        5       6      7
+		fprintf(stderr, "\t(with -q, the last column of the data is "
+				"the quality of each point, for PROSAC)\n");
 		return EXIT_FAILURE;
 	}
 
@@ -406,15 +709,26 @@ int main_cases(int c, char *v[])
 	// read input data
 	int n;
 	float *data = read_ascii_floats(stdin, &n);
-	n /= datadim;
+	float *quality = NULL;
+	if (has_quality) {
+		n /= datadim + 1;
+		quality = xmalloc(n * sizeof*quality);
+		for (int i = 0; i < n; i++)
+		{
+			for (int d = 0; d < datadim; d++)
+				data[i*datadim+d] = data[i*(datadim+1)+d];
+			quality[i] = data[i*(datadim+1)+datadim];
+		}
+	} else
+		n /= datadim;
 
 	// call the ransac function to fit a model to data
 	float model[modeldim];
 	bool *mask = xmalloc(n * sizeof*mask);
-	int n_inliers = ransac(mask, model, data, datadim, n, modeldim,
+	int n_inliers = ransac_guided(mask, model, data, datadim, n, modeldim,
 			model_evaluation, model_generation,
 			nfit, ntrials, minliers, maxerr,
-			model_acceptation, user_data);
+			model_acceptation, user_data, quality);
 
 
 	// print a summary of the results
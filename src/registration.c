@@ -1,12 +1,19 @@
 // naive program to register two gray images
 // method: find the translation that minimizes their L2 distance
+// (or, with option -p, the peak of their phase correlation)
 
 #include <assert.h>
+#include <complex.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
 
+#include "fftplans.c"
+#define OMIT_PPSMOOTH_MAIN
+#include "ppsmooth.c"
+
 
 // auxiliary function to get the value of an image at any point (i,j)
 // (points outisde the original domain get the value 0)
@@ -58,7 +65,7 @@ void apply_translation(float *out, int dx, int dy, float *in, int w, int h)
 // ow: output image width (supplied by the user)
 // oh: output image height (supplied by the user)
 //
-static void zoom_out_by_factor_two(float *out, int ow, int oh,
+static void zoom_out_by_factor_two_0(float *out, int ow, int oh,
 		float *in, int iw, int ih)
 {
 	assert(abs(2*ow-iw) < 2);
@@ -120,8 +127,8 @@ void find_displacement(int d[2], float *A, float *B, int w, int h, int scale)
 		int hs = ceil(h/2.0);
 		float *As = malloc(ws * hs * sizeof*As);
 		float *Bs = malloc(ws * hs * sizeof*Bs);
-		zoom_out_by_factor_two(As, ws, hs, A, w, h);
-		zoom_out_by_factor_two(Bs, ws, hs, B, w, h);
+		zoom_out_by_factor_two_0(As, ws, hs, A, w, h);
+		zoom_out_by_factor_two_0(Bs, ws, hs, B, w, h);
 		find_displacement(d, As, Bs, ws, hs, scale-1);
 		free(As);
 		free(Bs);
@@ -180,13 +187,224 @@ void registration(float *out, float *left, float *right, int w, int h)
 }
 
 
+// apply a sub-pixel translation to the given image (bilinear interpolation)
+void apply_translation_bilinear(float *out, double dx, double dy,
+		float *in, int w, int h)
+{
+	int ix = floor(dx), iy = floor(dy);
+	float a = dx - ix, b = dy - iy;
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	{
+		int ii = i - ix;
+		int jj = j - iy;
+		out[j*w+i] = (1-a) * (1-b) * getpixel_0(in, w, h, ii  , jj  )
+			   +   a   * (1-b) * getpixel_0(in, w, h, ii-1, jj  )
+			   + (1-a) *   b   * getpixel_0(in, w, h, ii  , jj-1)
+			   +   a   *   b   * getpixel_0(in, w, h, ii-1, jj-1);
+	}
+}
+
+
+// prepare an image for the phase correlation: remove its mean (after taking
+// its periodic component, if "pp") and multiply it by a separable Hann window
+//
+// x: input image
+// w: width
+// h: height
+// pp: whether to take the periodic component of the image first
+// y: output image, to be filled-in
+//
+static void phase_correlation_window(float *y, float *x, int w, int h, bool pp)
+{
+	if (pp)
+		ppsmooth(y, x, w, h);
+	else
+		for (int i = 0; i < w*h; i++)
+			y[i] = x[i];
+	long double m = 0;
+	for (int i = 0; i < w*h; i++)
+		m += y[i];
+	m /= w*h;
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		y[j*w+i] = (y[j*w+i] - m) * sin(M_PI*(i+0.5)/w) * sin(M_PI*(i+0.5)/w)
+					  * sin(M_PI*(j+0.5)/h) * sin(M_PI*(j+0.5)/h);
+}
+
+
+SMART_PARAMETER_SILENT(REGISTRATION_PC_SIGMA,1.5)
+
+// phase correlation of two images (its peak is at the displacement of B)
+//
+// A, B: input images
+// w: width
+// h: heigth
+// pp: whether to use only the periodic component of each image
+// r: output correlation, to be filled-in (of size w x h, periodic)
+//
+static void phase_correlation(float *r, float *A, float *B, int w, int h,
+		bool pp)
+{
+	// the two spectra, using the in-place real FFT of the shared plans
+	// (the cross-power spectrum is hermitian, thus the half is enough)
+	struct fftplan *p = fftplan_get(FFTPLAN_REAL, w, h);
+	int W = w/2 + 1;
+	float *a = p->in;
+	fftwf_complex *fa = p->out;
+	fftwf_complex *fb = malloc(W * h * sizeof*fb);
+	float *t = malloc(w * h * sizeof*t);
+	for (int k = 0; k < 2; k++)
+	{
+		phase_correlation_window(t, k ? A : B, w, h, pp);
+		for (int j = 0; j < h; j++)
+		for (int i = 0; i < w; i++)
+			a[j*2*W+i] = t[j*w+i];
+		fftwf_execute(p->p);
+		if (!k)
+			for (int i = 0; i < W*h; i++)
+				fb[i] = fa[i];
+	}
+
+	// normalized cross-power spectrum, and back
+	// (with a gaussian low-pass, so that the peak is a gaussian of width
+	// REGISTRATION_PC_SIGMA pixels, which is robust to the sub-pixel shifts)
+	double s = 1 / (2 * M_PI * REGISTRATION_PC_SIGMA());
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < W; i++)
+	{
+		double u = i / (double)w, v = (j < (h+1)/2 ? j : j - h) / (double)h;
+		fftwf_complex c = fa[j*W+i] * conjf(fb[j*W+i]);
+		float n = cabsf(c);
+		float g = exp(-(u*u + v*v) / (2 * s * s));
+		fa[j*W+i] = n > 0 ? g * c / n : 0;
+	}
+	fftwf_execute(p->q);
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		r[j*w+i] = a[j*2*W+i] / (w * h);
+	free(fb);
+	free(t);
+}
+
+
+// sub-pixel position of a peak b, from its neighbors a and c
+// (vertex of the parabola through their logarithms, or through them)
+static double phase_correlation_subpixel(float a, float b, float c)
+{
+	double x = a, y = b, z = c;
+	if (a > 0 && b > 0 && c > 0) {
+		x = log(a);
+		y = log(b);
+		z = log(c);
+	}
+	double den = x - 2*y + z;
+	if (!(den < 0)) return 0;
+	return fmax(-0.5, fmin(0.5, (x - z) / (2 * den)));
+}
+
+// like "find_displacement", but using the phase correlation at each scale
+//
+// The coarsest scale (when the image is smaller than 64 pixels, or after
+// "scale" recursions) looks for the peak in the whole correlation, which
+// finds any displacement smaller than half the size of the image.  Each
+// finer scale translates B by the displacement of the previous one, and only
+// looks for a peak within a few pixels of it.  The result is refined to
+// sub-pixel precision by a parabola through the neighbors of the peak.
+//
+// A, B: input images
+// w: width
+// h: heigth
+// scale: maximum number of multi-scale recursions
+// pp: whether to use only the periodic component of each image
+// d: optimal displacement (output)
+//
+void find_displacement_pc(double d[2], float *A, float *B, int w, int h,
+		int scale, bool pp)
+{
+	// find an initial rough displacement d
+	int rad = -1; // radius of the search of the peak (or everywhere)
+	d[0] = d[1] = 0;
+	if (scale > 1 && w >= 64 && h >= 64)
+	{
+		int ws = ceil(w/2.0);
+		int hs = ceil(h/2.0);
+		float *As = malloc(ws * hs * sizeof*As);
+		float *Bs = malloc(ws * hs * sizeof*Bs);
+		zoom_out_by_factor_two_0(As, ws, hs, A, w, h);
+		zoom_out_by_factor_two_0(Bs, ws, hs, B, w, h);
+		find_displacement_pc(d, As, Bs, ws, hs, scale-1, pp);
+		free(As);
+		free(Bs);
+		d[0] *= 2;
+		d[1] *= 2;
+		rad = 3;
+	}
+	int id[2] = {lround(d[0]), lround(d[1])};
+
+	// correlate A with B translated by the rough displacement
+	float *Bt = malloc(w * h * sizeof*Bt);
+	float *r = malloc(w * h * sizeof*r);
+	apply_translation(Bt, id[0], id[1], B, w, h);
+	phase_correlation(r, A, Bt, w, h, pp);
+
+	// find its peak (the correlation is periodic)
+	int bi = 0, bj = 0;
+	float best = -INFINITY;
+	int ri = rad < 0 || 2*rad+1 > w ? w/2 : rad;
+	int rj = rad < 0 || 2*rad+1 > h ? h/2 : rad;
+	for (int j = -rj; j < h - rj && j <= rj; j++)
+	for (int i = -ri; i < w - ri && i <= ri; i++)
+	{
+		float v = r[((j+h)%h)*w + (i+w)%w];
+		if (v > best) {
+			best = v;
+			bi = i;
+			bj = j;
+		}
+	}
+#define PCR(i,j) r[(((j)+2*h)%h)*w + ((i)+2*w)%w]
+	d[0] = id[0] + bi
+		+ phase_correlation_subpixel(PCR(bi-1,bj), best, PCR(bi+1,bj));
+	d[1] = id[1] + bj
+		+ phase_correlation_subpixel(PCR(bi,bj-1), best, PCR(bi,bj+1));
+#undef PCR
+	free(Bt);
+	free(r);
+	fprintf(stderr, "%dx%d: %g %g\n", w, h, d[0], d[1]);
+}
+
+
+// register two images by phase correlation
+//
+// w: width
+// h: height
+// left: left image
+// right: right image
+// pp: whether to use only the periodic component of each image
+// out: right image after registration
+//
+void registration_pc(float *out, float *left, float *right, int w, int h,
+		bool pp)
+{
+	double d[2];
+	find_displacement_pc(d, left, right, w, h, 10, pp);
+	apply_translation_bilinear(out, d[0], d[1], right, w, h);
+	printf("%g %g\n", d[0], d[1]);
+}
+
+
 // main function
+#include "pickopt.c"
 int main_registration(int argc, char **argv)
 {
 	// process input arguments
+	bool phase = pick_option(&argc, &argv, "p", NULL);
+	bool pp = pick_option(&argc, &argv, "s", NULL);
 	if (argc != 4) {
-		fprintf(stderr, "usage:\n\t%s left right Tright\n", *argv);
-		//                          0 1    2     3
+		fprintf(stderr, "usage:\n\t%s [-p [-s]] left right Tright\n",
+				*argv);
+		//                          0          1    2     3
 		return 1;
 	}
 	char *filename_left = argv[1];
@@ -202,7 +420,10 @@ int main_registration(int argc, char **argv)
 	float *out = malloc(w*h*sizeof(float));
 
 	// run the algorithm
-	registration(out, left, right, w, h);
+	if (phase || pp)
+		registration_pc(out, left, right, w, h, pp);
+	else
+		registration(out, left, right, w, h);
 
 	// save the output image
 	iio_write_image_float(filename_Tright, out, w, h);
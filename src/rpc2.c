@@ -396,23 +396,27 @@ static void decompose_vector_basis(double a[2], double x[2], double u[2],
 static void eval_nrpc(double *, struct rpc *, double, double, double);
 static void eval_nrpci(double *, struct rpc *, double, double, double);
 
-// evaluate the normalized direct rpc model, iteratively from the inverse rpc
-// model
-static void eval_nrpc_iterative(double *result,
-		struct rpc *p, double x, double y, double z)
+#define RPC_MAXIT 100
+
+// solve f(r[0], r[1], z) = (x, y) for the normalized inverse rpc model f (or
+// the direct one, if "direct"), starting from the given r and with an initial
+// step eps for the finite differences
+static void nrpc_solve(double r[2], struct rpc *p, bool direct,
+		double x, double y, double z, double eps)
 {
+	void (*f)(double *, struct rpc *, double, double, double);
+	f = direct ? eval_nrpc : eval_nrpci;
 	double a[2];
 	double x0[2];
 	double x1[2];
 	double x2[2];
 	double xf[2] = {x, y};
-	double lon = -1, lat = -1, eps = 2;
-	eval_nrpci(x0, p, lon, lat, z);
-	eval_nrpci(x1, p, lon + eps, lat, z);
-	eval_nrpci(x2, p, lon, lat + eps, z);
-	fprintf(stderr, "\t\tnrpc_iter x0: (%g, %g), x1: (%g, %g), x2: (%g, %g)\n", x0[0], x0[1],
-	        x1[0], x1[1], x2[0], x2[1]);
-	while (l2_squared_dist(x0, xf) > 1e-18) {
+	double lon = r[0], lat = r[1];
+	f(x0, p, lon, lat, z);
+	f(x1, p, lon + eps, lat, z);
+	f(x2, p, lon, lat + eps, z);
+	for (int it = 0; it < RPC_MAXIT && l2_squared_dist(x0, xf) > 1e-18; it++)
+	{
 		double u [2] = {xf[0] - x0[0], xf[1] - x0[1]};
 		double e1[2] = {x1[0] - x0[0], x1[1] - x0[1]};
 		double e2[2] = {x2[0] - x0[0], x2[1] - x0[1]};
@@ -420,43 +424,29 @@ static void eval_nrpc_iterative(double *result,
 		lon += a[0] * eps;
 		lat += a[1] * eps;
 		eps = 0.1;
-		eval_nrpci(x0, p, lon, lat, z);
-		eval_nrpci(x1, p, lon + eps, lat, z);
-		eval_nrpci(x2, p, lon, lat + eps, z);
+		f(x0, p, lon, lat, z);
+		f(x1, p, lon + eps, lat, z);
+		f(x2, p, lon, lat + eps, z);
 	}
-	result[0] = lon;
-	result[1] = lat;
+	r[0] = lon;
+	r[1] = lat;
+}
+
+// evaluate the normalized direct rpc model, iteratively from the inverse rpc
+// model
+static void eval_nrpc_iterative(double *result,
+		struct rpc *p, double x, double y, double z)
+{
+	result[0] = result[1] = -1;
+	nrpc_solve(result, p, false, x, y, z, 2);
 }
 
 static void eval_nrpci_iterative(double *result,
 		struct rpc *p, double x, double y, double z)
 {
 	assert(isfinite(p->numx[0]));
-	double a[2];
-	double x0[2];
-	double x1[2];
-	double x2[2];
-	double xf[2] = {x, y};
-	double lon = -1, lat = -1, eps = 2;
-	eval_nrpc(x0, p, lon, lat, z);
-	eval_nrpc(x1, p, lon + eps, lat, z);
-	eval_nrpc(x2, p, lon, lat + eps, z);
-	fprintf(stderr, "\t\tnrpci_iter x0: (%g, %g), x1: (%g, %g), x2: (%g, %g)\n", x0[0], x0[1],
-	        x1[0], x1[1], x2[0], x2[1]);
-	while (l2_squared_dist(x0, xf) > 1e-18) {
-		double u [2] = {xf[0] - x0[0], xf[1] - x0[1]};
-		double e1[2] = {x1[0] - x0[0], x1[1] - x0[1]};
-		double e2[2] = {x2[0] - x0[0], x2[1] - x0[1]};
-		decompose_vector_basis(a, u, e1, e2);
-		lon += a[0] * eps;
-		lat += a[1] * eps;
-		eps = 0.1;
-		eval_nrpc(x0, p, lon, lat, z);
-		eval_nrpc(x1, p, lon + eps, lat, z);
-		eval_nrpc(x2, p, lon, lat + eps, z);
-	}
-	result[0] = lon;
-	result[1] = lat;
+	result[0] = result[1] = -1;
+	nrpc_solve(result, p, true, x, y, z, 2);
 }
 
 // evaluate the normalized direct rpc model
@@ -526,6 +516,136 @@ void eval_rpci(double *result,
 				x, y, z, result[0], result[1]);
 }
 
+// number of points evaluated together by the batched functions below
+#define RPC_BLOCK 64
+
+// monomials of a block of points, m[k][l] for the monomial k of the point l
+// (in the same order as in "eval_pol20")
+static void pol20_monomials_block(double m[20][RPC_BLOCK],
+		double *x, double *y, double *z, int n)
+{
+	for (int l = 0; l < n; l++)
+	{
+		double lig = x[l];
+		double col = y[l];
+		double alt = z[l];
+		m[0][l] = 1;
+		m[1][l] = lig;
+		m[2][l] = col;
+		m[3][l] = alt;
+		m[4][l] = lig*col;
+		m[5][l] = lig*alt;
+		m[6][l] = col*alt;
+		m[7][l] = lig*lig;
+		m[8][l] = col*col;
+		m[9][l] = alt*alt;
+		m[10][l] = col*lig*alt;
+		m[11][l] = lig*lig*lig;
+		m[12][l] = lig*col*col;
+		m[13][l] = lig*alt*alt;
+		m[14][l] = lig*lig*col;
+		m[15][l] = col*col*col;
+		m[16][l] = col*alt*alt;
+		m[17][l] = lig*lig*alt;
+		m[18][l] = col*col*alt;
+		m[19][l] = alt*alt*alt;
+	}
+}
+
+// r[l] = eval_pol20(c, x[l], y[l], z[l]), from the monomials of the block
+static void pol20_dot_block(double *r, double c[20], double m[20][RPC_BLOCK],
+		int n)
+{
+	for (int l = 0; l < n; l++)
+		r[l] = 0;
+	for (int k = 0; k < 20; k++)
+	for (int l = 0; l < n; l++)
+		r[l] += c[k] * m[k][l];
+}
+
+// evaluate the direct rpc model (or the inverse one) at n points, given by
+// separate arrays of coordinates
+//
+// The points are processed by blocks, in parallel.  The monomials of each
+// block are computed once, and shared by the four polynomials.  When the
+// model is only known through its inverse, the solution of each point is the
+// initial guess for the next one of the block.  The outputs may be the same
+// arrays as the inputs x and y.
+static void eval_rpc_many_gen(double *ox, double *oy, struct rpc *p,
+		bool inverse, double *x, double *y, double *z, int n)
+{
+	double *s = inverse ? p->iscale : p->scale;
+	double *o = inverse ? p->ioffset : p->offset;
+	double *S = inverse ? p->scale : p->iscale;
+	double *O = inverse ? p->offset : p->ioffset;
+	double *c[4] = {p->numx, p->denx, p->numy, p->deny};
+	if (inverse) {
+		c[0] = p->inumx;
+		c[1] = p->idenx;
+		c[2] = p->inumy;
+		c[3] = p->ideny;
+	}
+	bool polynomial = isfinite(c[0][0]);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = 0; b < n; b += RPC_BLOCK)
+	{
+		int m = n - b < RPC_BLOCK ? n - b : RPC_BLOCK;
+		double nx[RPC_BLOCK], ny[RPC_BLOCK], nz[RPC_BLOCK];
+		double t[4][RPC_BLOCK];
+		for (int l = 0; l < m; l++)
+		{
+			nx[l] = (x[b+l] - o[0])/s[0];
+			ny[l] = (y[b+l] - o[1])/s[1];
+			nz[l] = (z[b+l] - o[2])/s[2];
+		}
+		if (polynomial) {
+			double mon[20][RPC_BLOCK];
+			pol20_monomials_block(mon, nx, ny, nz, m);
+			for (int k = 0; k < 4; k++)
+				pol20_dot_block(t[k], c[k], mon, m);
+			for (int l = 0; l < m; l++)
+			{
+				t[0][l] = t[0][l] / t[1][l];
+				t[2][l] = t[2][l] / t[3][l];
+			}
+		} else {
+			double r[2] = {-1, -1}, eps = 2;
+			for (int l = 0; l < m; l++)
+			{
+				if (!isfinite(r[0]) || !isfinite(r[1])) {
+					r[0] = r[1] = -1;
+					eps = 2;
+				}
+				nrpc_solve(r, p, inverse, nx[l], ny[l], nz[l], eps);
+				t[0][l] = r[0];
+				t[2][l] = r[1];
+				eps = 0.1;
+			}
+		}
+		for (int l = 0; l < m; l++)
+		{
+			ox[b+l] = t[0][l] * S[0] + O[0];
+			oy[b+l] = t[2][l] * S[1] + O[1];
+		}
+	}
+}
+
+// localization of n points: (ox, oy) = L(x, y, z)
+void eval_rpc_many(double *ox, double *oy, struct rpc *p,
+		double *x, double *y, double *z, int n)
+{
+	eval_rpc_many_gen(ox, oy, p, false, x, y, z, n);
+}
+
+// projection of n points: (ox, oy) = P(x, y, z)
+void eval_rpci_many(double *ox, double *oy, struct rpc *p,
+		double *x, double *y, double *z, int n)
+{
+	eval_rpc_many_gen(ox, oy, p, true, x, y, z, n);
+}
+
 // evaluate a correspondence between two images given their rpc
 void eval_rpc_pair(double xprime[2],
 		struct rpc *pa, struct rpc *pb,
@@ -1,12 +1,24 @@
 
-#include <math.h> // sqrtl
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 
-// cholesky decomposition (slow, trivial, only for small and full matrices)
+#include "xmalloc.c"
+#include "smapa.h"
+
+// regularization of the linear fits (a multiple of the identity that is
+// added to the normalized normal equations)
+SMART_PARAMETER_SILENT(RPCFIT_LAMBDA,0)
+
+// number of points of each partial sum of the normal equations
+#define RPCFIT_CHUNK 4096
+
+// cholesky decomposition (trivial, only for small and full matrices)
 // Note: it produces a lower triangular matrix B such that B*B'=A
-static void cholesky(long double *B, long double *A, int n)
+static void cholesky(double *B, double *A, int n)
 {
-	long double (*a)[n] = (void *)A;  // a[n][n]
-	long double (*b)[n] = (void *)B;  // a[n][n]
+	double (*a)[n] = (void *)A;  // a[n][n]
+	double (*b)[n] = (void *)B;  // a[n][n]
 
 	for (int i = 0; i < n*n; i++)
 		B[i] = 0;
@@ -15,11 +27,11 @@ static void cholesky(long double *B, long double *A, int n)
 	for (int i = 0; i < n; i++)
 	for (int j = 0; j <= i; j++)
 	{
-		long double r = 0;
+		double r = 0;
 		for (int k = 0; k < j; k++)
 			r += b[i][k] * b[j][k];
 		if (i == j)
-			b[i][j] = sqrtl(a[i][j] - r);
+			b[i][j] = sqrt(a[i][j] - r);
 		else
 			b[i][j] = ( a[i][j] - r ) / b[j][j];
 	}
@@ -40,9 +52,9 @@ static void cholesky(long double *B, long double *A, int n)
 
 // solve an upper triangular system A' * x = b
 // where the matrix A is lower triangular
-static void solve_upper(long double *x, long double *A, long double *b, int n)
+static void solve_upper(double *x, double *A, double *b, int n)
 {
-	long double (*a)[n] = (void*)A;
+	double (*a)[n] = (void*)A;
 
 	for (int k = n-1; k >= 0; k--)
 	{
@@ -55,9 +67,9 @@ static void solve_upper(long double *x, long double *A, long double *b, int n)
 
 // solve a lower triangular system A * x = b
 // where the matrix A is lower triangular
-static void solve_lower(long double *x, long double *A, long double *b, int n)
+static void solve_lower(double *x, double *A, double *b, int n)
 {
-	long double (*a)[n] = (void*)A;
+	double (*a)[n] = (void*)A;
 
 	for (int k = 0; k < n; k++)
 	{
@@ -69,14 +81,14 @@ static void solve_lower(long double *x, long double *A, long double *b, int n)
 }
 
 // solve a symmetric, positive definite system
-static void solve_spd(long double *x, long double *A, long double *b, int n)
+static void solve_spd(double *x, double *A, double *b, int n)
 {
 	// factor the matrix A = L * L'
-	long double L[n*n];
+	double L[n*n];
 	cholesky(L, A, n);
 
 	// solve the two triangular systems L * L' * x = b
-	long double t[n];
+	double t[n];
 	solve_lower(t, L, b, n);
 	solve_upper(x, L, t, n);
 }
@@ -104,6 +116,86 @@ static void eval_mon20(long double m[20], long double X[3])
 		m[i] = t[i];
 }
 
+// evaluate all 20 monomials of degree 3 in 3 variables, in double precision
+static void eval_mon20d(double m[20], long double X[3])
+{
+	double x = X[0];
+	double y = X[1];
+	double z = X[2];
+	double t[20] = {1, x, y, z, x*y,
+		x*z, y*z, x*x, y*y, z*z,
+		x*y*z, x*x*x, x*y*y, x*z*z, x*x*y,
+		y*y*y, y*z*z, x*x*z, y*y*z, z*z*z};
+	for (int i = 0; i < 20; i++)
+		m[i] = t[i];
+}
+
+// accumulate the normal equations A * pq = b of the linear problem
+// minimize sum_i w_i |p(x_i) - q(x_i) f_i|^2, with w_i = 1/q(x_i)^2
+//
+// The design matrix is not stored: each chunk of points accumulates its own
+// partial sums, in parallel, and the partial sums are added in order (so
+// that the result does not depend on the number of threads).
+static void rpcfit33_normal_equations(double A[39][39], double b[39],
+		long double q[20], long double (*x)[3], long double *f, int n)
+{
+	double qd[20];
+	for (int i = 0; i < 20; i++)
+		qd[i] = q[i];
+	int nc = (n + RPCFIT_CHUNK - 1) / RPCFIT_CHUNK;
+	double (*a)[39][39] = xmalloc((nc + 1) * sizeof*a);
+	double (*c)[39] = xmalloc((nc + 1) * sizeof*c);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int t = 0; t < nc; t++)
+	{
+		double (*at)[39] = a[t], *ct = c[t];
+		for (int i = 0; i < 39; i++)
+		{
+			ct[i] = 0;
+			for (int j = 0; j <= i; j++)
+				at[i][j] = 0;
+		}
+		int k1 = (t + 1) * RPCFIT_CHUNK < n ? (t + 1) * RPCFIT_CHUNK : n;
+		for (int k = t * RPCFIT_CHUNK; k < k1; k++)
+		{
+			double m[39], fk = f[k], qk = 0;
+			eval_mon20d(m, x[k]);
+			for (int j = 0; j < 20; j++)
+				qk += qd[j] * m[j];
+			for (int j = 1; j < 20; j++)
+				m[19+j] = -fk * m[j];
+			double w = 1 / (qk * qk);
+			for (int i = 0; i < 39; i++)
+			{
+				double wm = w * m[i];
+				for (int j = 0; j <= i; j++)
+					at[i][j] += wm * m[j];
+				ct[i] += wm * fk;
+			}
+		}
+	}
+	for (int i = 0; i < 39; i++)
+	{
+		b[i] = 0;
+		for (int j = 0; j <= i; j++)
+			A[i][j] = 0;
+	}
+	for (int t = 0; t < nc; t++)
+	for (int i = 0; i < 39; i++)
+	{
+		b[i] += c[t][i];
+		for (int j = 0; j <= i; j++)
+			A[i][j] += a[t][i][j];
+	}
+	for (int i = 0; i < 39; i++)
+	for (int j = 0; j < i; j++)
+		A[j][i] = A[i][j];
+	free(a);
+	free(c);
+}
+
 // evaluate a polynomial of degree 3 in 3 variables
 static long double eval_pol20l(long double c[20], long double X[3])
 {
@@ -122,13 +214,12 @@ long double rpceval33(long double p[20], long double q[20], long double x[3])
 long double rpc33_error(long double p[20], long double q[20],
 		long double (*x)[3], long double *f, int n)
 {
-	long double v[n];
-	for (int i = 0; i < n; i++)
-		v[i] = rpceval33(p, q, x[i]);
-
-	long double r = 0;
+	double r = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:r)
+#endif
 	for (int i = 0; i < n; i++)
-		r = pow(f[i] - v[i], 2);
+		r += pow(f[i] - rpceval33(p, q, x[i]), 2);
 	return sqrt(r/n);
 }
 
@@ -167,6 +258,7 @@ long double rpcfit33(
 	// 2) when there are not enough data points
 	// In these cases the matrix of the linear problem is degenerate and
 	// the current solver fails, giving all-NAN, parameters.
+	// (A small regularization, RPCFIT_LAMBDA=1e-10, avoids this.)
 	//
 
 	// initialize q
@@ -174,41 +266,31 @@ long double rpcfit33(
 	for (int i = 1; i < 20; i++)
 		q[i] = 0;
 
-	// build matrix "M" of evaluated monomials
-	long double M[n][39];
-	for (int i = 0; i < n; i++)
-	{
-		eval_mon20(M[i], x[i]);
-		for (int j = 1; j < 20; j++)
-			M[i][19+j] = -f[i] * M[i][j];
-	}
-
 	long double best_error_so_far = INFINITY;
 	int best_iteration_so_far = -1;
 	int number_of_iterations = 13;
+	double lambda = RPCFIT_LAMBDA();
 	for (int iteration = 0; iteration < number_of_iterations; iteration++)
 	{
-		// vector "w" of weights
-		long double w[n];
-		for (int i = 0; i < n; i++)
-			w[i] = pow( eval_pol20l(q, x[i]), -2);
+		// normal equations of the problem, reweighted by the current q
+		double A[39][39], b[39];
+		rpcfit33_normal_equations(A, b, q, x, f, n);
 
-		// matrix "A" of the system
-		long double A[39][39] = {{0}};
-		for (int i = 0; i < 39; i++)
-		for (int j = 0; j < 39; j++)
-		for (int k = 0; k < n ; k++)
-			A[i][j] += w[k] * M[k][i] * M[k][j];
-
-		// vector "b"
-		long double b[39] = {0};
-		for (int i = 0; i < 39; i++)
-		for (int j = 0; j < n ; j++)
-			b[i] += w[j] * f[j] * M[j][i];
+		// regularization, relative to the mean of the diagonal
+		if (lambda > 0) {
+			double t = 0;
+			for (int i = 0; i < 39; i++)
+				t += A[i][i];
+			for (int i = 0; i < 39; i++)
+				A[i][i] += lambda * t / 39;
+		}
 
 		// solve the linear problem
+		double pqd[39];
+		solve_spd(pqd, (void*)A, b, 39);
 		long double pq[39];
-		solve_spd(pq, (void*)A, b, 39);
+		for (int i = 0; i < 39; i++)
+			pq[i] = pqd[i];
 
 		// update if it improves error
 		long double e = rpc33_errorpq(pq, x, f, n);
@@ -1,6 +1,7 @@
 // toolkit for dealing with RPC functions
 //
 // rpctk localize rpc.xml < ijh.txt > llh.txt
+// rpctk localize -u zone rpc.xml < ijh.txt > enh.txt
 // rpctk project  rpc.xml < llh.txt > ijh.txt
 // rpctk fit              < xyhXY.txt > rpc.txt
 // rpctk fitL             < ijhll.txt > rpc.xml
@@ -11,11 +12,13 @@
 // rpctk triangulate a.rpc b.rpc < ab.ijij > ab.xyh
 
 
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "xmalloc.c"
 #include "xfopen.c"
 #include "parsenumbers.c"
+#include "pickopt.c"
 
 #include "rpcfit33.c"
 
@@ -23,6 +26,9 @@
 #define DONT_USE_TEST_MAIN
 #include "rpc2.c"
 
+#define OMIT_MAIN_UTM
+#include "utm.c"
+
 int main_rpctk_info(int c, char *v[])
 {
 	if (c != 2)
@@ -51,25 +57,64 @@ int main_rpctk_info(int c, char *v[])
 	return 0;
 }
 
+#define RPCTK_CHUNK 0x10000
+
+// read up to n lines of three numbers "x y z" (returns the number of lines)
+static int read_triplets(double *x, double *y, double *z, int n, FILE *f)
+{
+	char line[0x400];
+	int i = 0;
+	while (i < n && fgets(line, sizeof line, f))
+	{
+		double t[3];
+		if (3 != parse_doubles(t, 3, line))
+			break;
+		x[i] = t[0];
+		y[i] = t[1];
+		z[i] = t[2];
+		i += 1;
+	}
+	return i;
+}
+
+// apply the localization or the projection to the points of stdin
+// (they are processed by chunks, and each chunk in parallel)
+// the localized points are converted to UTM when utm is true
+static int rpctk_map_stdin(struct rpc *r, bool project, bool utm, int zone)
+{
+	double *x = xmalloc(3 * RPCTK_CHUNK * sizeof*x);
+	double *y = x + RPCTK_CHUNK;
+	double *z = y + RPCTK_CHUNK;
+	int n;
+	do {
+		n = read_triplets(x, y, z, RPCTK_CHUNK, stdin);
+		if (project)
+			eval_rpci_many(x, y, r, x, y, z, n);
+		else
+			eval_rpc_many(x, y, r, x, y, z, n);
+		if (utm && !project)
+			utm_from_lonlat_many(x, y, x, y, n, zone);
+		for (int i = 0; i < n; i++)
+			printf("%lf %lf %lf\n", x[i], y[i], z[i]);
+	} while (n == RPCTK_CHUNK);
+	free(x);
+	return 0;
+}
+
+// with "-u zone", the output is in UTM coordinates of this zone (positive
+// for the north, negative for the south, and 0 for the zone of each point)
 int main_rpctk_localize(int c, char *v[])
 {
+	char *utm_zone = pick_option(&c, &v, "u", "");
 	if (c != 2)
-		return fprintf(stderr,"usage:\n\t%s "
+		return fprintf(stderr,"usage:\n\t%s [-u zone] "
 				"file.rpc < ijh.txt > llh.txt\n",*v);
 
 	char *filename_rpc = v[1];
 	struct rpc r[1];
 	read_rpc_file_xml(r, filename_rpc);
 
-	double ijh[3];
-	while (3 == scanf("%lg %lg %lg\n", ijh, ijh+1, ijh+2))
-	{
-		double ll[2];
-		rpc_localization(ll, r, ijh);
-		printf("%lf %lf %lf\n", ll[0], ll[1], ijh[2]);
-	}
-
-	return 0;
+	return rpctk_map_stdin(r, false, *utm_zone, atoi(utm_zone));
 }
 
 int main_rpctk_project(int c, char *v[])
@@ -82,15 +127,7 @@ int main_rpctk_project(int c, char *v[])
 	struct rpc r[1];
 	read_rpc_file_xml(r, filename_rpc);
 
-	double ijh[3];
-	while (3 == scanf("%lg %lg %lg\n", ijh, ijh+1, ijh+2))
-	{
-		double ll[2];
-		rpc_projection(ll, r, ijh);
-		printf("%lf %lf %lf\n", ll[0], ll[1], ijh[2]);
-	}
-
-	return 0;
+	return rpctk_map_stdin(r, true, false, 0);
 }
 
 // fit the localization function of an RPC given a (somewhat dense) list
@@ -108,7 +145,7 @@ static double rpc_fitL_full(struct rpc *r, double *ijhll, int n)
 		for (int j = 0; j < n; j++)
 			max[i] = fmax(max[i], ijhll[5*j+i]);
 	}
-	for (int j = 0; j < n; j++)
+	for (int j = 0; j < n && n < 2000; j++)
 		fprintf(stderr, "ijhll[%d] = %g %g %g %g %g\n",
 				j,
 				ijhll[5*j+0],
@@ -296,7 +333,8 @@ static void write_columns(char *fname, float *x, int w, int h)
 {
 	FILE *f = xfopen(fname, "w");
 	for (int i = 0; i < w*h; i++)
-		fprintf(stderr, "%lf%c", x[i], i%w ? ' ' : '\n');
+		fprintf(f, "%lf%c", x[i], (i+1)%w ? ' ' : '\n');
+	xfclose(f);
 }
 
 // Find a point in the epipolar line on right image that is closest to the
@@ -329,7 +367,7 @@ int main_rpctk_triangulate(int c, char *v[])
 	// (none yet)
 
 	// load positional arguments
-	if (c != 4)
+	if (c != 3)
 		return fprintf(stderr, "usage:\n"
 				"\t%s a.rpc b.rpc <ab.ijij >ab.xyh\n", *v);
 				//  0 1     2
@@ -349,7 +387,7 @@ int main_rpctk_triangulate(int c, char *v[])
 	if (n % 4)
 		fprintf(stderr, "WARNING: read %d numbers (not 0 mod 4)\n", n);
 	n /= 4;
-	float *y = xmalloc(3 * n * sizeof*y);
+	float *y = xmalloc(4 * n * sizeof*y);
 
 	// select triangulation function
 	// TODO: consider global triangulations that compute an affine
@@ -364,12 +402,20 @@ int main_rpctk_triangulate(int c, char *v[])
 			);
 	t = triangulate_pixright;
 
-	// perform computation (triangulate all matches in the list
+	// perform computation (triangulate all matches in the list)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,256)
+#endif
 	for (int i = 0; i < n; i++)
-		t(y, a, b, x);
+		t(y + 4*i, a, b, x + 4*i);
 
-	// write output and quit
+	// write output (x, y, h) and quit
+	for (int i = 0; i < n; i++)
+	for (int k = 0; k < 3; k++)
+		y[3*i+k] = y[4*i+k];
 	write_columns("-", y, 3, n);
+	free(x);
+	free(y);
 	return 0;
 }
 
@@ -0,0 +1,233 @@
+#ifndef _SAT_C
+#define _SAT_C
+
+// summed-area tables (integral images), for box sums in constant time
+//
+// The table of a channel of an image of size w x h has (w+1) x (h+1) entries:
+// s[j*(w+1)+i] is the sum of the values of the rectangle [0,i) x [0,j).  The
+// sum of any rectangle is then a combination of four entries.  The table is
+// computed by prefix sums along the rows (in parallel), and then along the
+// columns (by strips of columns, in parallel).
+//
+// For accuracy, the tables are in double and the values are offset by their
+// mean before the sums (so that the entries do not grow with the size of the
+// image).  With the flag SAT_COMPENSATED the tables are double-double (each
+// entry has a second table with its rounding errors, accumulated by the
+// error-free "two-sum"), for images where even that is not enough.
+//
+// Optional tables: the squares of the values (for the variances) and the
+// number of finite values (then the other values are ignored; otherwise they
+// count as zero).
+//
+// This file needs the function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define SAT_SQUARES     1  // table of squares, for sat_variance
+#define SAT_COUNTS      2  // table of counts, to ignore the non-finite values
+#define SAT_COMPENSATED 4  // double-double tables
+
+struct sat {
+	int w, h;       // size of the image
+	double c;       // offset subtracted from the values
+	double *s, *e;  // table of the sums, and of their errors (or NULL)
+	double *q, *f;  // table of the sums of squares, and their errors
+	double *n;      // table of the counts of finite values (or NULL)
+};
+
+// a + b = s + r exactly (Knuth's two-sum)
+static inline double sat_two_sum(double *r, double a, double b)
+{
+	double s = a + b, bb = s - a;
+	*r = (a - (s - bb)) + (b - bb);
+	return s;
+}
+
+// prefix sums of the table t (and of its errors e, if not NULL), whose first
+// row and column are zero
+static void sat_prefix(double *t, double *e, int w, int h)
+{
+	int W = w + 1;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 1; j <= h; j++)
+	{
+		double *tj = t + j*(long)W, *ej = e ? e + j*(long)W : NULL;
+		for (int i = 1; i <= w; i++)
+			if (e) {
+				double r;
+				tj[i] = sat_two_sum(&r, tj[i-1], tj[i]);
+				ej[i] = ej[i-1] + r;
+			} else
+				tj[i] += tj[i-1];
+	}
+	// the columns are processed by strips, for the sake of the cache
+	int sw = 64;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int i0 = 1; i0 <= w; i0 += sw)
+	{
+		int i1 = i0 + sw > W ? W : i0 + sw;
+		for (int j = 1; j <= h; j++)
+		{
+			double *a = t + (j-1)*(long)W, *b = t + j*(long)W;
+			if (e) {
+				double *ea = e + (j-1)*(long)W, *eb = e + j*(long)W;
+				for (int i = i0; i < i1; i++)
+				{
+					double r;
+					b[i] = sat_two_sum(&r, a[i], b[i]);
+					eb[i] += ea[i] + r;
+				}
+			} else
+				for (int i = i0; i < i1; i++)
+					b[i] += a[i];
+		}
+	}
+}
+
+static double *sat_table(int w, int h)
+{
+	double *t = xmalloc((w + 1) * (h + 1L) * sizeof*t);
+	for (int i = 0; i <= w; i++)
+		t[i] = 0;
+	for (int j = 1; j <= h; j++)
+		t[j*(w+1L)] = 0;
+	return t;
+}
+
+// tables of the channel l of the image x (flags are a combination of the
+// SAT_* above)
+static void sat_init(struct sat *t, float *x, int w, int h, int pd, int l,
+		int flags)
+{
+	t->w = w;
+	t->h = h;
+	int W = w + 1;
+	bool counts = flags & SAT_COUNTS;
+
+	// offset by the mean of the finite values
+	double m = 0;
+	long nm = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:m,nm)
+#endif
+	for (long k = 0; k < w * (long)h; k++)
+		if (isfinite(x[k*pd+l]))
+		{
+			m += x[k*pd+l];
+			nm += 1;
+		}
+	t->c = nm ? m / nm : 0;
+
+	t->s = sat_table(w, h);
+	t->e = flags & SAT_COMPENSATED ? sat_table(w, h) : NULL;
+	t->q = flags & SAT_SQUARES ? sat_table(w, h) : NULL;
+	t->f = t->q && t->e ? sat_table(w, h) : NULL;
+	t->n = counts ? sat_table(w, h) : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+	{
+		long p = (j + 1L) * W + i + 1;
+		float v = x[(j*(long)w + i)*pd + l];
+		bool finite = isfinite(v);
+		double d = finite ? v - t->c : counts ? 0 : -t->c;
+		t->s[p] = d;
+		if (t->e) t->e[p] = 0;
+		if (t->q) t->q[p] = d * d;
+		if (t->f) t->f[p] = 0;
+		if (t->n) t->n[p] = finite;
+	}
+	sat_prefix(t->s, t->e, w, h);
+	if (t->q)
+		sat_prefix(t->q, t->f, w, h);
+	if (t->n)
+		sat_prefix(t->n, NULL, w, h);
+}
+
+static void sat_free(struct sat *t)
+{
+	free(t->s);
+	free(t->e);
+	free(t->q);
+	free(t->f);
+	free(t->n);
+}
+
+// clip the rectangle [i0,i1) x [j0,j1) to the image (returns its area)
+static long sat_clip(struct sat *t, int *i0, int *j0, int *i1, int *j1)
+{
+	if (*i0 < 0) *i0 = 0;
+	if (*j0 < 0) *j0 = 0;
+	if (*i1 > t->w) *i1 = t->w;
+	if (*j1 > t->h) *j1 = t->h;
+	if (*i1 < *i0) *i1 = *i0;
+	if (*j1 < *j0) *j1 = *j0;
+	return (*i1 - *i0) * (long)(*j1 - *j0);
+}
+
+// sum of the table x on a clipped rectangle
+static inline double sat_rect(double *x, int W, int i0, int j0, int i1, int j1)
+{
+	return x[j1*(long)W+i1] - x[j0*(long)W+i1]
+		- x[j1*(long)W+i0] + x[j0*(long)W+i0];
+}
+
+// number of values of the rectangle [i0,i1) x [j0,j1) (only the finite ones,
+// if there is a table of counts)
+static long sat_count(struct sat *t, int i0, int j0, int i1, int j1)
+{
+	long a = sat_clip(t, &i0, &j0, &i1, &j1);
+	return t->n ? sat_rect(t->n, t->w + 1, i0, j0, i1, j1) : a;
+}
+
+// sum of the offset values x-c of a rectangle (and their number)
+static double sat_offset_sum(struct sat *t, long *n,
+		int i0, int j0, int i1, int j1)
+{
+	*n = sat_count(t, i0, j0, i1, j1);
+	sat_clip(t, &i0, &j0, &i1, &j1);
+	int W = t->w + 1;
+	double r = sat_rect(t->s, W, i0, j0, i1, j1);
+	if (t->e) r += sat_rect(t->e, W, i0, j0, i1, j1);
+	return r;
+}
+
+// sum of the values of the rectangle [i0,i1) x [j0,j1)
+static double sat_sum(struct sat *t, int i0, int j0, int i1, int j1)
+{
+	long n;
+	double r = sat_offset_sum(t, &n, i0, j0, i1, j1);
+	return r + n * t->c;
+}
+
+// average of the values of a rectangle (NAN if there are none)
+static double sat_mean(struct sat *t, int i0, int j0, int i1, int j1)
+{
+	long n;
+	double r = sat_offset_sum(t, &n, i0, j0, i1, j1);
+	return n ? t->c + r / n : NAN;
+}
+
+// variance of the values of a rectangle (needs the table of squares)
+static double sat_variance(struct sat *t, int i0, int j0, int i1, int j1)
+{
+	long n;
+	double r = sat_offset_sum(t, &n, i0, j0, i1, j1);
+	if (!n) return NAN;
+	sat_clip(t, &i0, &j0, &i1, &j1);
+	int W = t->w + 1;
+	double q = sat_rect(t->q, W, i0, j0, i1, j1);
+	if (t->f) q += sat_rect(t->f, W, i0, j0, i1, j1);
+	double v = q / n - (r / n) * (r / n);
+	return v > 0 ? v : 0;
+}
+
+#endif//_SAT_C
@@ -1,12 +1,20 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 
 #include "fail.c"
 #include "xmalloc.c"
 #include "xfopen.c"
 #include "parsenumbers.c"
+#include "kdforest.c"
 
 #define SIFT_LENGTH 128
 struct sift_keypoint {
@@ -222,6 +230,137 @@ static void write_raw_sift_gen(FILE *f, struct sift_keypoint *k)
 	SIFT_BINARY() ? write_raw_siftb(f, k) : write_raw_sift(f, k);
 }
 
+// binary keypoint files, that are mapped in memory and used in place
+//
+// The file has a header of 64 bytes, and then the arrays pos[n][2],
+// scale[n], orientation[n] and desc[n][dim] of floats, each one starting at
+// a multiple of 64 bytes.  All the numbers are in the native byte order.
+// The descriptors are stored as floats, so that the matchers can use the
+// mapped block directly, without any conversion.
+#define SIFT_MAP_MAGIC 0x31504b53 // "SKP1"
+#define SIFT_MAP_VERSION 1
+#define SIFT_MAP_ALIGN 64
+
+struct sift_map_header {
+	uint32_t magic, version, n, dim;
+	uint64_t pos, scale, orientation, desc; // offsets of the arrays
+	uint64_t size;                          // size of the file
+	uint64_t reserved[1];
+};
+
+struct sift_keypoints_map {
+	int n, dim;
+	float (*pos)[2], *scale, *orientation, *desc;
+	void *base;
+	size_t size;
+};
+
+static uint64_t sift_map_align(uint64_t x)
+{
+	return (x + SIFT_MAP_ALIGN - 1) / SIFT_MAP_ALIGN * SIFT_MAP_ALIGN;
+}
+
+static void sift_map_layout(struct sift_map_header *h, int n)
+{
+	memset(h, 0, sizeof*h);
+	h->magic = SIFT_MAP_MAGIC;
+	h->version = SIFT_MAP_VERSION;
+	h->n = n;
+	h->dim = SIFT_LENGTH;
+	h->pos = sift_map_align(sizeof*h);
+	h->scale = sift_map_align(h->pos + 2 * sizeof(float) * (uint64_t)n);
+	h->orientation = sift_map_align(h->scale + sizeof(float) * (uint64_t)n);
+	h->desc = sift_map_align(h->orientation + sizeof(float) * (uint64_t)n);
+	h->size = h->desc + SIFT_LENGTH * sizeof(float) * (uint64_t)n;
+}
+
+// write the file sequentially (so that it can go to a pipe)
+static void write_sifts_map(FILE *f, struct sift_keypoint *k, int n)
+{
+	struct sift_map_header h[1];
+	sift_map_layout(h, n);
+	uint64_t o = 0;
+	char zero[SIFT_MAP_ALIGN] = {0};
+	int ok = 1 == fwrite(h, sizeof*h, 1, f);
+	o += sizeof*h;
+#define SIFT_MAP_PAD(to) (ok = ok && (to)-o == fwrite(zero, 1, (to)-o, f), o=(to))
+	SIFT_MAP_PAD(h->pos);
+	for (int i = 0; ok && i < n; i++)
+		ok = 2 == fwrite(k[i].pos, sizeof(float), 2, f);
+	o += 2 * sizeof(float) * (uint64_t)n;
+	SIFT_MAP_PAD(h->scale);
+	for (int i = 0; ok && i < n; i++)
+		ok = 1 == fwrite(&k[i].scale, sizeof(float), 1, f);
+	o += sizeof(float) * (uint64_t)n;
+	SIFT_MAP_PAD(h->orientation);
+	for (int i = 0; ok && i < n; i++)
+		ok = 1 == fwrite(&k[i].orientation, sizeof(float), 1, f);
+	o += sizeof(float) * (uint64_t)n;
+	SIFT_MAP_PAD(h->desc);
+	for (int i = 0; ok && i < n; i++)
+		ok = SIFT_LENGTH == fwrite(k[i].sift, sizeof(float), SIFT_LENGTH, f);
+#undef SIFT_MAP_PAD
+	if (!ok)
+		fail("could not write the binary keypoint file");
+}
+
+// map a keypoint file in memory (read-only), "-" is the standard input
+static void sift_map_file(struct sift_keypoints_map *m, char *filename)
+{
+	int fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : 0;
+	if (fd < 0)
+		fail("could not open keypoint file \"%s\"", filename);
+	struct stat st[1];
+	if (fstat(fd, st) || !S_ISREG(st->st_mode))
+		fail("keypoint file \"%s\" is not a regular file", filename);
+	struct sift_map_header h[1] = {{0}};
+	void *p = NULL;
+	if (st->st_size >= (off_t)sizeof*h)
+		p = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (fd) close(fd);
+	if (!p || p == MAP_FAILED)
+		fail("could not map keypoint file \"%s\"", filename);
+	memcpy(h, p, sizeof*h);
+	if (h->magic != SIFT_MAP_MAGIC)
+		fail("\"%s\" is not a binary keypoint file", filename);
+	if (h->version != SIFT_MAP_VERSION || h->dim != SIFT_LENGTH)
+		fail("keypoint file \"%s\" has version %u, dimension %u",
+				filename, h->version, h->dim);
+	struct sift_map_header e[1];
+	sift_map_layout(e, h->n);
+	if (memcmp(e, h, sizeof*h) || h->size > (uint64_t)st->st_size)
+		fail("corrupt keypoint file \"%s\"", filename);
+	m->n = h->n;
+	m->dim = h->dim;
+	m->pos = (void *)((char *)p + h->pos);
+	m->scale = (void *)((char *)p + h->scale);
+	m->orientation = (void *)((char *)p + h->orientation);
+	m->desc = (void *)((char *)p + h->desc);
+	m->base = p;
+	m->size = st->st_size;
+}
+
+static void sift_unmap(struct sift_keypoints_map *m)
+{
+	munmap(m->base, m->size);
+}
+
+// copy of the mapped keypoints, for the functions that need the structures
+static struct sift_keypoint *sift_map_keypoints(struct sift_keypoints_map *m)
+{
+	struct sift_keypoint *r = xmalloc(m->n * sizeof*r);
+	FORI(m->n) {
+		memset(r + i, 0, sizeof*r);
+		r[i].pos[0] = m->pos[i][0];
+		r[i].pos[1] = m->pos[i][1];
+		r[i].scale = m->scale[i];
+		r[i].orientation = m->orientation[i];
+		memcpy(r[i].sift, m->desc + i * (size_t)SIFT_LENGTH,
+				sizeof r[i].sift);
+	}
+	return r;
+}
+
 static float emvdistppf(float *a, float *b, int n)
 {
 	//float ac = a[0];
@@ -349,7 +488,8 @@ static int fancynearest(struct sift_keypoint *q,
 			bestprev = bestd;
 			bestd = nb;
 			besti = i;
-		}
+		} else if (nb < bestprev)
+			bestprev = nb;
 	}
 	assert(besti >= 0);
 	*od = bestd;
@@ -464,7 +604,8 @@ static int fancynearest_idx(struct sift_keypoint *q,
 			bestprev = bestd;
 			bestd = nb;
 			besti = i;
-		}
+		} else if (nb < bestprev)
+			bestprev = nb;
 	}
 	//assert(besti >= 0);
 	*od = bestd;
@@ -472,6 +613,181 @@ static int fancynearest_idx(struct sift_keypoint *q,
 	return besti;
 }
 
+// exhaustive search of the two nearest neighbors of many keypoints at once
+//
+// The descriptors of "kb" are packed into blocks of SIFT_MATCH_TB columns
+// (the coordinates of each block are transposed), and the squared distances
+// of SIFT_MATCH_QB queries to a whole block are computed from the scalar
+// products |a|^2 + |b|^2 - 2 a.b, by a loop that the compiler vectorizes.
+// The chunks of SIFT_MATCH_QC blocks of queries run in parallel.  Only the
+// two nearest keypoints of each query are kept, and their distances are then
+// computed exactly.
+#define SIFT_MATCH_QB 8
+#define SIFT_MATCH_TB 16
+#define SIFT_MATCH_QC 16 // blocks of queries per thread (that stay in cache)
+
+// scalar products of SIFT_MATCH_QB queries "a" and a block "B" of targets
+// (a separate function with constant sizes, so that "s" stays in registers)
+static void sift_match_kernel(float acc[SIFT_MATCH_QB][SIFT_MATCH_TB],
+		float (*a)[SIFT_LENGTH], float *B)
+{
+	float s[SIFT_MATCH_QB][SIFT_MATCH_TB] = {{0}};
+	for (int k = 0; k < SIFT_LENGTH; k++)
+	for (int q = 0; q < SIFT_MATCH_QB; q++)
+	for (int t = 0; t < SIFT_MATCH_TB; t++)
+		s[q][t] += a[q][k] * B[k*SIFT_MATCH_TB+t];
+	for (int q = 0; q < SIFT_MATCH_QB; q++)
+	for (int t = 0; t < SIFT_MATCH_TB; t++)
+		acc[q][t] = s[q][t];
+}
+
+// euclidean nearest two neighbors, among the descriptors xb[j*sb+(0..127)],
+// of the descriptors xa[i*sa+(0..127)] (e.g., those of a mapped file)
+static void sift_nearest_two_l2(int *oi, double *od, double *opd,
+		float *xa, size_t sa, int na, float *xb, size_t sb, int nb)
+{
+	int L = SIFT_LENGTH, QB = SIFT_MATCH_QB, TB = SIFT_MATCH_TB;
+	int QC = QB * SIFT_MATCH_QC;
+	int nblocks = (nb + TB - 1) / TB;
+	float *bt = xmalloc(nblocks * (size_t)L * TB * sizeof*bt);
+	float *bn = xmalloc(nblocks * (size_t)TB * sizeof*bn);
+	for (int j = 0; j < nblocks * TB; j++)
+	{
+		float *B = bt + (j / TB) * (size_t)L * TB + j % TB;
+		double s = 0;
+		for (int k = 0; k < L; k++)
+		{
+			float x = j < nb ? xb[j*sb+k] : 0;
+			B[k*TB] = x;
+			s += x * x;
+		}
+		bn[j] = j < nb ? s : INFINITY;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int i0 = 0; i0 < na; i0 += QC)
+	{
+		int nq = na - i0 < QC ? na - i0 : QC;
+		float (*a)[SIFT_LENGTH] = xmalloc(QC * sizeof*a), an[QC];
+		float bd[QC][2];
+		int bi[QC][2];
+		for (int q = 0; q < QC; q++)
+		{
+			double s = 0;
+			for (int k = 0; k < L; k++)
+			{
+				a[q][k] = q < nq ? xa[(i0+q)*sa+k] : 0;
+				s += a[q][k] * a[q][k];
+			}
+			an[q] = s;
+			bd[q][0] = bd[q][1] = INFINITY;
+			bi[q][0] = bi[q][1] = -1;
+		}
+
+		// each block of targets is used by all the queries of the chunk
+		for (int b = 0; b < nblocks; b++)
+		for (int q0 = 0; q0 < nq; q0 += QB)
+		{
+			float acc[SIFT_MATCH_QB][SIFT_MATCH_TB];
+			sift_match_kernel(acc, a + q0, bt + b*(size_t)L*TB);
+			for (int q = q0; q < q0 + QB && q < nq; q++)
+			for (int t = 0; t < TB; t++)
+			{
+				float d = an[q] + bn[b*TB+t] - 2 * acc[q-q0][t];
+				if (d < bd[q][1]) {
+					int j = b*TB + t;
+					if (d < bd[q][0]) {
+						bd[q][1] = bd[q][0];
+						bi[q][1] = bi[q][0];
+						bd[q][0] = d;
+						bi[q][0] = j;
+					} else {
+						bd[q][1] = d;
+						bi[q][1] = j;
+					}
+				}
+			}
+		}
+
+		// exact distances (which may swap two almost equal neighbors)
+		for (int q = 0; q < nq; q++)
+		{
+			int i = i0 + q, j0 = bi[q][0], j1 = bi[q][1];
+			double d0 = j0 < 0 ? INFINITY :
+				distppf(xa + i*sa, xb + j0*sb, L);
+			double d1 = j1 < 0 ? INFINITY :
+				distppf(xa + i*sa, xb + j1*sb, L);
+			oi[i] = d1 < d0 ? j1 : j0;
+			od[i] = fmin(d0, d1);
+			opd[i] = fmax(d0, d1);
+		}
+		free(a);
+	}
+	free(bt);
+	free(bn);
+}
+
+// oi[i] = index of the closest keypoint to ka[i] (or -1 if nb = 0)
+// od[i] = its distance, opd[i] = distance of the second closest keypoint
+static void sift_nearest_two(int *oi, double *od, double *opd,
+		struct sift_keypoint *ka, int na,
+		struct sift_keypoint *kb, int nb)
+{
+	// other distances use the generic (slow) function
+	if (DIST_DESCS_EMV() > 0.5 || DIST_DESCS_LP() != 2) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+		FORI(na)
+			oi[i] = nb ? fancynearest(ka+i, kb, nb, od+i, opd+i) : -1;
+		return;
+	}
+	static struct sift_keypoint dummy[1];
+	size_t stride = sizeof*ka / sizeof(float);
+	sift_nearest_two_l2(oi, od, opd, na ? ka->sift : dummy->sift, stride, na,
+			nb ? kb->sift : dummy->sift, stride, nb);
+}
+
+// approximate search of the two nearest neighbors, on a kd-forest of "kb"
+// (SIFT_KDF_CHECKS is the number of keypoints compared to each query)
+SMART_PARAMETER(SIFT_KDF_TREES,4)
+SMART_PARAMETER(SIFT_KDF_CHECKS,256)
+
+// the kd-forest of a list of keypoints (or the list of a forest file)
+static void sift_kdforest(struct kdforest *f, char *filename,
+		struct sift_keypoint *k, int n)
+{
+	static struct sift_keypoint dummy[1];
+	float *x = n ? k->sift : dummy->sift;
+	int stride = sizeof*k / sizeof(float);
+	if (filename && *filename)
+		kdforest_load(f, filename, x, n, SIFT_LENGTH, stride);
+	else
+		kdforest_build(f, x, n, SIFT_LENGTH, stride, SIFT_KDF_TREES(), 0);
+}
+
+static void sift_nearest_two_kdf(int *oi, double *od, double *opd,
+		struct sift_keypoint *ka, int na,
+		struct sift_keypoint *kb, struct kdforest *f)
+{
+	int checks = SIFT_KDF_CHECKS();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	FORI(na) {
+		int j[2];
+		float e[2];
+		kdforest_knn(j, e, 2, f, ka[i].sift, checks);
+		oi[i] = j[0];
+		od[i] = j[0] < 0 ? INFINITY : distppf(ka[i].sift, kb[j[0]].sift,
+				SIFT_LENGTH);
+		opd[i] = j[1] < 0 ? INFINITY : distppf(ka[i].sift, kb[j[1]].sift,
+				SIFT_LENGTH);
+	}
+}
+
 static
 int (*siftlike_getpairs(
 		struct sift_keypoint *ka, int na, 
@@ -480,12 +796,17 @@ int (*siftlike_getpairs(
 		))[3]
 {
 	int (*p)[3] = xmalloc(na * sizeof * p);
+	int *idx = xmalloc(na * sizeof*idx);
+	double *d = xmalloc(2 * na * sizeof*d);
+	sift_nearest_two(idx, d, d + na, ka, na, kb, nb);
 	FORI(na) {
-		double d;
+		assert(idx[i] >= 0);
 		p[i][0] = i;
-		p[i][1] = nearestone(ka+i, kb, nb, &d);
-		p[i][2] = 10*log(d);
+		p[i][1] = idx[i];
+		p[i][2] = 10*log(d[i]);
 	}
+	free(idx);
+	free(d);
 	*np = na;
 	return p;
 }
@@ -513,13 +834,18 @@ struct ann_pair *siftlike_get_annpairs(
 		)
 {
 	struct ann_pair *p = xmalloc(na * sizeof * p);
+	int *idx = xmalloc(na * sizeof*idx);
+	double *d = xmalloc(2 * na * sizeof*d), *dp = d + na;
+	sift_nearest_two(idx, d, dp, ka, na, kb, nb);
 	FORI(na) {
-		double d, dp;
+		assert(idx[i] >= 0);
 		p[i].from = i;
-		p[i].to = fancynearest(ka+i, kb, nb, &d, &dp);
-		p[i].v[0] = d;
-		p[i].v[1] = dp;
+		p[i].to = idx[i];
+		p[i].v[0] = d[i];
+		p[i].v[1] = dp[i];
 	}
+	free(idx);
+	free(d);
 	//FORI(na) fprintf(stderr, "BEFORE p[%d].from=%d\n", i, p[i].from);
 	sort_annpairs(p, na);
 	//FORI(na) fprintf(stderr, "AFTER p[%d].from=%d\n", i, p[i].from);
@@ -540,19 +866,24 @@ struct ann_pair *siftlike_get_annpairs_lowe(
 	assert(loweratio < 1);
 	assert(loweratio > 0);
 	struct ann_pair *p = xmalloc(na * sizeof * p);
+	int *idx = xmalloc(na * sizeof*idx);
+	double *dd = xmalloc(2 * na * sizeof*dd);
+	sift_nearest_two(idx, dd, dd + na, ka, na, kb, nb);
 	int cx = 0;
 	FORI(na) {
-		double d, dp;
-		fancynearest(ka+i, kb, nb, &d, &dp);
+		double d = dd[i], dp = dd[na+i];
+		assert(idx[i] >= 0);
 		assert(dp >= d);
 		if (d / dp < loweratio) {
 			p[cx].from = i;
-			p[cx].to = fancynearest(ka+i, kb, nb, &d, &dp);
+			p[cx].to = idx[i];
 			p[cx].v[0] = d;
 			p[cx].v[1] = dp;
 			cx += 1;
 		}
 	}
+	free(idx);
+	free(dd);
 	//FORI(na) fprintf(stderr, "BEFORE p[%d].from=%d\n", i, p[i].from);
 	sort_annpairs(p, cx);
 	//FORI(na) fprintf(stderr, "AFTER p[%d].from=%d\n", i, p[i].from);
@@ -560,6 +891,94 @@ struct ann_pair *siftlike_get_annpairs_lowe(
 	return p;
 }
 
+// like "siftlike_get_annpairs_lowe", but approximate, using a kd-forest of kb
+// (the forest can be shared by several calls, even from parallel threads)
+static
+struct ann_pair *siftlike_get_annpairs_lowe_forest(
+		struct sift_keypoint *ka, int na,
+		struct sift_keypoint *kb, struct kdforest *f,
+		int *np,
+		float loweratio
+		)
+{
+	assert(loweratio < 1);
+	assert(loweratio > 0);
+	struct ann_pair *p = xmalloc((na + 1) * sizeof * p);
+	int *idx = xmalloc(na * sizeof*idx);
+	double *dd = xmalloc(2 * na * sizeof*dd);
+	sift_nearest_two_kdf(idx, dd, dd + na, ka, na, kb, f);
+	int cx = 0;
+	FORI(na) {
+		double d = dd[i], dp = dd[na+i];
+		if (idx[i] >= 0 && d / dp < loweratio) {
+			p[cx].from = i;
+			p[cx].to = idx[i];
+			p[cx].v[0] = d;
+			p[cx].v[1] = dp;
+			cx += 1;
+		}
+	}
+	free(idx);
+	free(dd);
+	sort_annpairs(p, cx);
+	*np = cx;
+	return p;
+}
+
+// like "siftlike_get_annpairs_lowe", but approximate, using a kd-forest of kb
+// (the forest is loaded from "filename", or built if it is empty)
+static
+struct ann_pair *siftlike_get_annpairs_lowe_kdf(
+		struct sift_keypoint *ka, int na,
+		struct sift_keypoint *kb, int nb,
+		int *np,
+		float loweratio, char *filename
+		)
+{
+	struct kdforest f[1];
+	sift_kdforest(f, filename, kb, nb);
+	struct ann_pair *p = siftlike_get_annpairs_lowe_forest(ka, na, kb, f,
+			np, loweratio);
+	kdforest_free(f);
+	return p;
+}
+
+// like "siftlike_get_annpairs_lowe", but on the descriptors of mapped files
+// (which are used in place, without copying them into keypoint structures)
+static
+struct ann_pair *siftlike_get_annpairs_lowe_map(
+		struct sift_keypoints_map *ka,
+		struct sift_keypoints_map *kb,
+		int *np,
+		float loweratio
+		)
+{
+	assert(loweratio < 1);
+	assert(loweratio > 0);
+	int na = ka->n;
+	struct ann_pair *p = xmalloc(na * sizeof * p);
+	int *idx = xmalloc(na * sizeof*idx);
+	double *dd = xmalloc(2 * na * sizeof*dd);
+	sift_nearest_two_l2(idx, dd, dd + na, ka->desc, ka->dim, na,
+			kb->desc, kb->dim, kb->n);
+	int cx = 0;
+	FORI(na) {
+		double d = dd[i], dp = dd[na+i];
+		if (idx[i] >= 0 && d / dp < loweratio) {
+			p[cx].from = i;
+			p[cx].to = idx[i];
+			p[cx].v[0] = d;
+			p[cx].v[1] = dp;
+			cx += 1;
+		}
+	}
+	free(idx);
+	free(dd);
+	sort_annpairs(p, cx);
+	*np = cx;
+	return p;
+}
+
 // get two lists of points, and produce a list of pairs
 // (nearest match from a to b)
 static
@@ -578,13 +997,16 @@ struct ann_pair *siftlike_get_annpairs_lowe2(
 	int count_ratio = 0;
 	int count_tup = 0;
 	int count_ratiotup = 0;
+	int *idx = xmalloc(na * sizeof*idx);
+	double *dd = xmalloc(2 * na * sizeof*dd);
+	sift_nearest_two(idx, dd, dd + na, ka, na, kb, nb);
 	FORI(na) {
-		double d, dp;
-		fancynearest(ka+i, kb, nb, &d, &dp);
+		double d = dd[i], dp = dd[na+i];
+		assert(idx[i] >= 0);
 		assert(dp >= d);
 		if ((d / dp < loweratio && d < tup) || d < tdown ) {
 			p[cx].from = i;
-			p[cx].to = fancynearest(ka+i, kb, nb, &d, &dp);
+			p[cx].to = idx[i];
 			p[cx].v[0] = d;
 			p[cx].v[1] = dp;
 			cx += 1;
@@ -594,6 +1016,8 @@ struct ann_pair *siftlike_get_annpairs_lowe2(
 		if (d < tup) count_tup += 1;
 		if (d/dp < loweratio && d < tup) count_ratiotup += 1;
 	}
+	free(idx);
+	free(dd);
 	fprintf(stderr, "count_tdown = %d\n", count_tdown);
 	fprintf(stderr, "count_ratio = %d\n", count_ratio);
 	fprintf(stderr, "count_tup = %d\n", count_tup);
@@ -668,81 +1092,177 @@ struct ann_pair *siftlike_get_accpairsrad(
 }
 
 //#define VERBOSE true
-#include "ok_list.c"
 #include "grid.c"
 
-struct ok_grid {
-	struct ok_list l[1];
+// keypoints sorted by the cells of a grid, as a read-only (shareable) index
+// (the points of the cell c are idx[start[c]] ... idx[start[c+1]-1])
+struct sift_grid {
 	struct grid g[1];
-	int *buf;
+	int *start;
+	int *idx;
 };
 
-static void ok_grid_init(struct ok_grid *o, int np,
-		float x0[2], float dx[2], int n[2])
+static void sift_grid_init(struct sift_grid *s, struct sift_keypoint *k,
+		int n, float x0[2], float dx[2], int nc[2])
 {
-	int nr = n[0] * n[1];
-	ok_init(o->l, nr, np);
-	grid_init(o->g, 2, x0, dx, n);
-	o->buf = xmalloc(np*sizeof*o->buf);
+	grid_init(s->g, 2, x0, dx, nc);
+	int m = s->g->nc, *c = xmalloc((n + 1) * sizeof*c);
+	s->start = xmalloc((m + 1) * sizeof*s->start);
+	s->idx = xmalloc((n + 1) * sizeof*s->idx);
+	for (int r = 0; r <= m; r++)
+		s->start[r] = 0;
+	for (int i = 0; i < n; i++)
+		s->start[1 + (c[i] = grid_locate(s->g, k[i].pos))] += 1;
+	for (int r = 0; r < m; r++)
+		s->start[r+1] += s->start[r];
+	for (int i = 0; i < n; i++) // counting sort (stable)
+		s->idx[s->start[c[i]]++] = i;
+	for (int r = m; r > 0; r--)
+		s->start[r] = s->start[r-1];
+	s->start[0] = 0;
+	free(c);
 }
 
-static void ok_grid_free(struct ok_grid *o)
+static void sift_grid_free(struct sift_grid *s)
 {
-	ok_free(o->l);
-	free(o->buf);
+	free(s->start);
+	free(s->idx);
 }
 
-static int ok_grid_add_point(struct ok_grid *o, int p, float x[2])
+// nearest descriptor in kb of each keypoint of ka, among the keypoints of kb
+// at most one cell size (dx,dy) away in each axis, if its distance is < t
+//
+// The queries of each cell are compared to all the keypoints of the 3x3
+// neighboring cells at once, by the blocked kernel of "sift_nearest_two", and
+// the cells are processed in parallel.  The grid of kb can be reused for
+// several calls.
+static
+struct ann_pair *compute_sift_matches_in_grid(int *onp,
+		struct sift_keypoint *ka, int na,
+		struct sift_keypoint *kb, struct sift_grid *gb, float t)
 {
-	int r = grid_locate(o->g, x);
-	ok_add_point(o->l, r, p);
-	return r;
-}
+	int L = SIFT_LENGTH, QB = SIFT_MATCH_QB, TB = SIFT_MATCH_TB;
+	struct grid *g = gb->g;
+	struct sift_grid ga[1];
+	sift_grid_init(ga, ka, na, g->x0, g->dx, g->n);
+	int *oj = xmalloc((na + 1) * sizeof*oj);
+	float *od = xmalloc((na + 1) * sizeof*od);
 
-static int ok_neighboring_points(struct ok_grid *o, float x[2])
-{
-	int r[4], nr = grid_locate_overlapping(r, o->g, x);
-	assert(nr <= 4);
-	//for (int i=0;i<nr;i++) fprintf(stderr, "\trglos{%g %g} [%d:%d] = %d\n", x[0], x[1], i, nr, r[i]);
-	int cx = 0;
-	for (int i = 0; i < nr; i++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int r = 0; r < g->nc; r++)
 	{
-		int nri = ok_which_points(o->l, r[i]);
-		for (int j = 0; j < nri; j++)
-			o->buf[cx++] = o->l->buf[j];
-	}
-	return cx;
-}
+		int nq = ga->start[r+1] - ga->start[r], *qi = ga->idx + ga->start[r];
+		if (!nq) continue;
+
+		// candidates: the keypoints of the neighboring cells
+		int ci = r % g->n[0], cj = r / g->n[0], m = 0;
+		for (int j = cj - 1; j <= cj + 1; j++)
+		for (int i = ci - 1; i <= ci + 1; i++)
+			if (i >= 0 && j >= 0 && i < g->n[0] && j < g->n[1])
+				m += gb->start[j*g->n[0]+i+1] - gb->start[j*g->n[0]+i];
+		int nblocks = (m + TB - 1) / TB, *tj = xmalloc((m + 1) * sizeof*tj);
+		m = 0;
+		for (int j = cj - 1; j <= cj + 1; j++)
+		for (int i = ci - 1; i <= ci + 1; i++)
+			if (i >= 0 && j >= 0 && i < g->n[0] && j < g->n[1])
+				for (int l = gb->start[j*g->n[0]+i];
+						l < gb->start[j*g->n[0]+i+1]; l++)
+					tj[m++] = gb->idx[l];
+		float *bt = xmalloc((nblocks * (size_t)L * TB + 1) * sizeof*bt);
+		float *bn = xmalloc((nblocks * TB + 1) * sizeof*bn);
+		for (int j = 0; j < nblocks * TB; j++)
+		{
+			float *B = bt + (j / TB) * (size_t)L * TB + j % TB;
+			double s = 0;
+			for (int k = 0; k < L; k++)
+			{
+				float x = j < m ? kb[tj[j]].sift[k] : 0;
+				B[k*TB] = x;
+				s += x * x;
+			}
+			bn[j] = j < m ? s : INFINITY;
+		}
 
-// returns i such that t[i] is as close as possible to q
-// if the distance is largest than dmax, return -1
-static int find_closest_in_grid(struct sift_keypoint *q,
-		struct sift_keypoint *t, int nt,
-		float *od, float dmax, struct ok_grid *g)
-{
-	// build the list of neighbors to traverse
-	int nn = ok_neighboring_points(g, q->pos);
-	int *nbuf = g->buf;
-	//fprintf(stderr, "site ( %g , %g ) has %d neighbors\n", q->pos[0], q->pos[1], nn);
-	//for(int i = 0; i < nn; i++) fprintf(stderr, "\t%d\n", nbuf[i]);
-	
-	// compute the closest point on this list
-	int besti = -1;
-	float bestd = dmax;
-	FORI(nn) {
-		int idx = nbuf[i];
-		if (fabs(q->pos[0] - t[idx].pos[0]) > g->g->dx[0]) continue;
-		if (fabs(q->pos[1] - t[idx].pos[1]) > g->g->dx[1]) continue;
-		float nb = sift_distance_topped(q, t+idx, bestd);
-		if (nb < bestd) {
-			bestd = nb;
-			besti = idx;
+		for (int q0 = 0; q0 < nq; q0 += QB)
+		{
+			float a[SIFT_MATCH_QB][SIFT_LENGTH], an[SIFT_MATCH_QB];
+			float bd[SIFT_MATCH_QB][2];
+			int bi[SIFT_MATCH_QB][2];
+			for (int q = 0; q < QB; q++)
+			{
+				double s = 0;
+				for (int k = 0; k < L; k++)
+				{
+					a[q][k] = q0+q < nq ? ka[qi[q0+q]].sift[k] : 0;
+					s += a[q][k] * a[q][k];
+				}
+				an[q] = s;
+				bd[q][0] = bd[q][1] = INFINITY;
+				bi[q][0] = bi[q][1] = -1;
+			}
+			for (int b = 0; b < nblocks; b++)
+			{
+				float acc[SIFT_MATCH_QB][SIFT_MATCH_TB];
+				sift_match_kernel(acc, a, bt + b*(size_t)L*TB);
+				for (int q = 0; q < QB && q0 + q < nq; q++)
+				for (int l = 0; l < TB && b*TB + l < m; l++)
+				{
+					float d = an[q] + bn[b*TB+l] - 2 * acc[q][l];
+					if (!(d < bd[q][1])) continue;
+					float *x = ka[qi[q0+q]].pos, *y = kb[tj[b*TB+l]].pos;
+					if (fabs(x[0] - y[0]) > g->dx[0]) continue;
+					if (fabs(x[1] - y[1]) > g->dx[1]) continue;
+					int z = d < bd[q][0];
+					bd[q][1] = z ? bd[q][0] : d;
+					bi[q][1] = z ? bi[q][0] : b*TB + l;
+					if (z) {
+						bd[q][0] = d;
+						bi[q][0] = b*TB + l;
+					}
+				}
+			}
+
+			// exact distances (which may swap two almost equal neighbors)
+			for (int q = 0; q < QB && q0 + q < nq; q++)
+			{
+				int i = qi[q0+q], j = -1;
+				float e = INFINITY;
+				for (int l = 0; l < 2; l++)
+					if (bi[q][l] >= 0) {
+						int jl = tj[bi[q][l]];
+						float el = distppf(ka[i].sift, kb[jl].sift, L);
+						if (el < e || (el == e && jl < j)) {
+							e = el;
+							j = jl;
+						}
+					}
+				oj[i] = e < t ? j : -1;
+				od[i] = e;
+			}
 		}
+		free(tj);
+		free(bt);
+		free(bn);
 	}
-	if (besti < 0) return -1;
-	assert(besti >= 0);
-	*od = bestd;
-	return bestd < dmax ? besti : -1;
+
+	struct ann_pair *p = xmalloc((na + 1) * sizeof * p);
+	int np = 0;
+	for (int i = 0; i < na; i++)
+		if (oj[i] >= 0) {
+			p[np].from = i;
+			p[np].to = oj[i];
+			p[np].v[0] = od[i];
+			p[np].v[1] = NAN;
+			np += 1;
+		}
+	sort_annpairs(p, np);
+	free(oj);
+	free(od);
+	sift_grid_free(ga);
+	*onp = np;
+	return p;
 }
 
 static
@@ -753,41 +1273,14 @@ struct ann_pair *compute_sift_matches_locally(int *onp,
 {
 	if (na == 0 || nb == 0) { *onp=0; return NULL; }
 
-	// build a grid structure for each list of keypoints
-	// NOTE: only the grid of "ka" is actually used
+	// build a grid structure for the keypoints of "kb"
 	float x0[2] = {0, 0};
 	float dxy[2] = {dx, dy};
 	int n[2] = {1+(w-1)/dx, 1+(h-1)/dy};
-	//int nr = n[0] * n[1];
-	//struct ok_grid ga[1]; ok_grid_init(ga, na, x0, dxy, n);
-	struct ok_grid gb[1]; ok_grid_init(gb, nb, x0, dxy, n);
-	//for (int i = 0; i < na; i++) ok_grid_add_point(ga, i, ka[i].pos);
-	for (int i = 0; i < nb; i++) ok_grid_add_point(gb, i, kb[i].pos);
-	//ok_display_tables(gb->l);
-	//ok_assert_consistency(gb->l);
-
-	// compute the pairs
-	struct ann_pair *p = xmalloc(na * sizeof * p);
-	int np = 0;
-	for (int i = 0; i < na; i++) {
-		float d;
-		int j = find_closest_in_grid(ka + i, kb, nb, &d, t, gb);
-		if (j >= 0) {
-			p[np].from = i;
-			p[np].to = j;
-			p[np].v[0] = d;
-			p[np].v[1] = NAN;
-			np += 1;
-		}
-	}
-	sort_annpairs(p, np);
-
-	// free the grid structures
-	//ok_grid_free(ga);
-	ok_grid_free(gb);
-
-	// return values
-	*onp = np;
+	struct sift_grid gb[1];
+	sift_grid_init(gb, kb, nb, x0, dxy, n);
+	struct ann_pair *p = compute_sift_matches_in_grid(onp, ka, na, kb, gb, t);
+	sift_grid_free(gb);
 	return p;
 }
 
@@ -1043,7 +1536,7 @@ void traverse_segment_thick(int px, int py, int qx, int qy,
 struct grille_traversal_state {
 	int *buf, nbuf, maxbuf;
 	int grille_width, grille_height;
-	struct ok_grid *o;
+	struct sift_grid *o;
 	float eps;
 	float img_line[3];
 	struct sift_keypoint *kb;
@@ -1071,13 +1564,14 @@ void grille_traversal_function(int i, int j, void *ee)
 	if (i >= e->grille_width ) return;
 	if (j >= e->grille_height) return;
 	int ridx = j * e->grille_width + i;
-	int np = ok_which_points(e->o->l, ridx);
+	int *pts = e->o->idx + e->o->start[ridx];
+	int np = e->o->start[ridx+1] - e->o->start[ridx];
 	//fprintf(stderr, "\t%d points here\n", np);
-	if (e->nbuf + np >= e->maxbuf)
+	if (e->nbuf + np > e->maxbuf)
 		fail("grille buffer overflow!");
 	for (int k = 0; k < np; k++)
 	{
-		int idx = e->o->l->buf[k];
+		int idx = pts[k];
 		float d = signed_distance_point_to_line(
 				e->img_line, e->kb[idx].pos);
 		if (fabs(d) < e->eps)
@@ -1125,6 +1619,40 @@ void overlay_red_thick_line(uint8_t *x, int w, int h, double a[2], double b[2])
 			pixel_plotter, e);
 }
 
+// fill "e->buf" with the keypoints of B near the epipolar line of x
+static void sift_fm_candidates(struct grille_traversal_state *e,
+		float x[2], double fm[9], double minxy[2], double maxxy[2],
+		float eps)
+{
+	e->nbuf = 0;
+	double xh[3] = { x[0], x[1], 1};
+	double epix[3]; // epipolar line in right IMAGE coordinates
+	vector_times_matrix(epix, xh, fm);
+	double factor = hypot(epix[0], epix[1]);
+	for (int l = 0; l < 3; l++) epix[l] /= factor;
+	for (int l = 0; l < 3; l++) e->img_line[l] = epix[l];
+	double epiX[3]; // epipolar line in right GRILLE coordinates
+	epiX[0] = epix[0];
+	epiX[1] = epix[1];
+	epiX[2] = (epix[2] + epix[0]*minxy[0] + epix[1]*minxy[1]) / eps;
+	//fprintf(stderr, "epix = %g %g %g\n", epix[0], epix[1], epix[2]);
+	//fprintf(stderr, "epiX = %g %g %g\n", epiX[0], epiX[1], epiX[2]);
+	double gfrom[2] = {0, 0};
+	double gto[2] = {e->grille_width, e->grille_height};
+	double pa[2], pb[2];
+	cut_line_with_rectangle(pa, pb, epix, minxy, maxxy);
+	if (cut_line_with_rectangle(pa, pb, epiX, gfrom, gto))
+		traverse_segment_thick_precise(
+				pa[0], pa[1], pb[0], pb[1],
+				grille_traversal_function, e);
+}
+
+// pairs of keypoints near the epipolar lines of the fundamental matrix "fm"
+//
+// The candidates of each keypoint of A are found on a grid of side "eps" of
+// the keypoints of B, which is shared by all the queries, and the queries
+// run in parallel.  (For rectified pairs, the lines are horizontal and
+// "compute_sift_matches_locally" with a window of height eps is faster.)
 static
 struct ann_pair *sift_fm_pairs(
 		struct sift_keypoint *ka, int na,
@@ -1133,7 +1661,7 @@ struct ann_pair *sift_fm_pairs(
 		int *out_np)
 {
 	if (na == 0 || nb == 0) { *out_np=0; return NULL; }
-	struct ann_pair *p = xmalloc((na*nb) * sizeof * p);
+	struct ann_pair *p = xmalloc((na + nb) * sizeof * p);
 	int num_pairs = 0;
 
 	// compute bounding box of points on image B
@@ -1141,139 +1669,118 @@ struct ann_pair *sift_fm_pairs(
 	get_bbx(minxy, maxxy, kb, nb);
 	//fprintf(stderr, "B's bbx = (%g %g)-(%g %g)\n", minxy[0], minxy[1], maxxy[0], maxxy[1]);
 
-	// prepare occupancy list of image B
+	// prepare occupancy grid of image B
 	float dxy[2] = {eps, eps};
 	int nxy[2] = {1+(maxxy[0]-minxy[0])/eps, 1+(maxxy[1]-minxy[1])/eps};
-	struct ok_grid gb[1];
-	ok_grid_init(gb, nb,(float[]){minxy[0],minxy[1]}, dxy, nxy);
-	for (int i = 0; i < nb; i++)
-		ok_grid_add_point(gb, i, kb[i].pos);
-
-	// transformation from "quadrille" to "pixel" coordinates
+	struct sift_grid gb[1];
+	sift_grid_init(gb, kb, nb, (float[]){minxy[0],minxy[1]}, dxy, nxy);
 	int qw = nxy[0];
 	int qh = nxy[1];
-	int q[qh][qw];
-	for (int j = 0; j < qh; j++)
-	for (int i = 0; i < qw; i++)
-		q[j][i] = j * qw + i;
-	//double aff_a[2] = { 1/eps, 1/eps};
-	//double aff_b[2] = { -minxy[0]/eps, -minxy[1]/eps};
-
-	// buffer for point indexes
-	int buf[nb];
-	struct grille_traversal_state e[1];
-	e->buf = buf;
-	e->nbuf = 0;
-	e->maxbuf = nb;
-	e->o = gb;
-	e->grille_width = qw;
-	e->grille_height = qh;
-	e->eps = eps/2;
-	e->kb = kb;
+
+	// traversal state (with its own buffer, for each thread)
+	struct grille_traversal_state e0[1];
+	e0->buf = NULL;
+	e0->nbuf = 0;
+	e0->maxbuf = nb;
+	e0->o = gb;
+	e0->grille_width = qw;
+	e0->grille_height = qh;
+	e0->eps = eps/2;
+	e0->kb = kb;
 
 	fprintf(stderr, "quadrille (%d %d) with eps=%g\n", qw, qh, eps);
 
-	// for each A point, etc
-	//assert(aff_a[0] == aff_a[1]);
-	for (int i = 0; i < na; i++)
-	{
-		e->nbuf = 0;
-		double x[3] = { ka[i].pos[0], ka[i].pos[1], 1};
-		//fprintf(stderr, "treating %dth A point (%g %g)\n",i,x[0],x[1]);
-		double epix[3]; // epipolar line in right IMAGE coordinates
-		vector_times_matrix(epix, x, fm);
-		double factor = hypot(epix[0], epix[1]);
-		for (int l = 0; l < 3; l++) epix[l] /= factor;
-		for (int l = 0; l < 3; l++) e->img_line[l] = epix[l];
-		double epiX[3]; // epipolar line in right GRILLE coordinates
-		epiX[0] = epix[0];
-		epiX[1] = epix[1];
-		epiX[2] = (epix[2] + epix[0]*minxy[0] + epix[1]*minxy[1]) / eps;
-		//epiX[2] = (epix[2] + aff_b[0]*epix[0] + aff_b[1]*epix[1]) * aff_a[0];
-		//epiX[2] = (epix[2] + aff_b[0]*epix[0] + aff_b[1]*epix[1]) * aff_a[0];
-		//fprintf(stderr, "epix = %g %g %g\n", epix[0], epix[1], epix[2]);
-		//fprintf(stderr, "epiX = %g %g %g\n", epiX[0], epiX[1], epiX[2]);
-		double gfrom[2] = {0, 0};
-		double gto[2] = {qw, qh};
-		double pa[2], pb[2];
+	if (isnan(tau)) { // debug mode
+		struct grille_traversal_state e[1] = {*e0};
+		e->buf = xmalloc(nb * sizeof*e->buf);
+		sift_fm_candidates(e, ka[0].pos, fm, minxy, maxxy, eps);
+		for (int k = 0; k < e->nbuf; k++)
+		{
+			int j = e->buf[k];
+			assert(j >= 0);
+			assert(j < nb);
+			p[num_pairs].from = 0;
+			p[num_pairs].to = j;
+			p[num_pairs].v[0] = 0;
+			p[num_pairs].v[1] = NAN;
+			num_pairs += 1;
+		}
+		int dbg_w = maxxy[0];
+		int dbg_h = maxxy[1];
+		uint8_t *dbg = xmalloc(3 * dbg_w * dbg_h);
+		for (int k = 0; k < dbg_w * dbg_h * 3; k++)
+			dbg[k] = 0;
+		double pa[2], pb[2], epix[3];
+		for (int l = 0; l < 3; l++) epix[l] = e->img_line[l];
 		cut_line_with_rectangle(pa, pb, epix, minxy, maxxy);
-		if (cut_line_with_rectangle(pa, pb, epiX, gfrom, gto))
+		fprintf(stderr, "pa = %g %g\n", pa[0], pa[1]);
+		fprintf(stderr, "pb = %g %g\n", pb[0], pb[1]);
+		overlay_red_thick_line(dbg, dbg_w, dbg_h, pa, pb);
+		for (int k = 0; k < num_pairs; k++)
 		{
-			//int ipa[2] = {round(pa[0]), round(pa[1])};
-			//int ipb[2] = {round(pb[0]), round(pb[1])};
-			traverse_segment_thick_precise(
-					pa[0], pa[1], pb[0], pb[1],
-					grille_traversal_function, e);
+			int idx = p[k].to;
+			int xp = round(kb[idx].pos[0]);
+			int yp = round(kb[idx].pos[1]);
+			if (insideP(dbg_w, dbg_h, xp, yp))
+				dbg[3*(dbg_w*yp+xp)+1] = 255;
 		}
-		//fprintf(stderr, "enbuf = %d\n", e->nbuf);
-		// now "e->buf" contains the list
-		// of the "e->nbuf" candidate keypoints (from image B)
-		// these keypoints must be compared to the keypoint "ka[i]"
-		// and the best one, if any, added to the list "p"
-		//
-		if (isnan(tau) && i == 0) { // debug mode
-			for (int k = 0; k < e->nbuf; k++)
-			{
-				int j = e->buf[k];
-				assert(j >= 0);
-				assert(j < nb);
-				p[num_pairs].from = i;
-				p[num_pairs].to = j;
-				p[num_pairs].v[0] = 0;
-				p[num_pairs].v[1] = NAN;
-				//fprintf(stderr, "added %dth pair {%d} [%d %d] (d=%g)\n", num_pairs, cidx, i, j, dist);
-				//if (dist_point_line(epix, kb[j].pos[0], kb[j].pos[1]) < eps)
-					num_pairs += 1;
-			}
-			int dbg_w = maxxy[0];
-			int dbg_h = maxxy[1];
-			uint8_t *dbg = xmalloc(3 * dbg_w * dbg_h);
-			for (int k = 0; k < dbg_w * dbg_h * 3; k++)
-				dbg[k] = 0;
-			cut_line_with_rectangle(pa, pb, epix, minxy, maxxy);
-			fprintf(stderr, "pa = %g %g\n", pa[0], pa[1]);
-			fprintf(stderr, "pb = %g %g\n", pb[0], pb[1]);
-			overlay_red_thick_line(dbg, dbg_w, dbg_h, pa, pb);
-			for (int k = 0; k < num_pairs; k++)
-			{
-				int idx = p[k].to;
-				int xp = round(kb[idx].pos[0]);
-				int yp = round(kb[idx].pos[1]);
-				if (insideP(dbg_w, dbg_h, xp, yp))
-					dbg[3*(dbg_w*yp+xp)+1] = 255;
+		iio_write_image_uint8_vec("/tmp/dbg_sfm.png", dbg, dbg_w, dbg_h, 3);
+		free(dbg);
+		free(e->buf);
+		goto acabemaqui;
+	}
+
+	// for each A point, the best candidate (if any)
+	int *oj = xmalloc(na * sizeof*oj);
+	float *od = xmalloc(na * sizeof*od);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		struct grille_traversal_state e[1] = {*e0};
+		e->buf = xmalloc(nb * sizeof*e->buf);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,64)
+#endif
+		for (int i = 0; i < na; i++)
+		{
+			// now "e->buf" contains the list
+			// of the "e->nbuf" candidate keypoints (from image B)
+			sift_fm_candidates(e, ka[i].pos, fm, minxy, maxxy, eps);
+			float dist, dsecond;
+			int cidx;
+			if (tau < 0 && tau > -1) {
+				cidx = fancynearest_idx(ka + i,
+						kb, e->buf, e->nbuf,
+						&dist, &dsecond, 500);
+				if (dist > 500 || (dist / dsecond > -tau))
+					cidx = -1;
 			}
-			iio_write_image_uint8_vec("/tmp/dbg_sfm.png", dbg, dbg_w, dbg_h, 3);
-			free(dbg);
-			goto acabemaqui;
-		}
-		float dist, dsecond;
-		int cidx;//
-		if (tau < 0 && tau > -1) {
-			cidx = fancynearest_idx(ka + i,
+			else
+				cidx = find_closest_keypoint_idxs(ka + i,
 					kb, e->buf, e->nbuf,
-					&dist, &dsecond, 500);
-			if (dist > 500 || (dist / dsecond > -tau))
-				cidx = -1;
+					&dist, tau, INFINITY, INFINITY);
+			oj[i] = cidx >= 0 ? e->buf[cidx] : -1;
+			od[i] = cidx >= 0 ? dist : INFINITY;
 		}
-		else
-			cidx = find_closest_keypoint_idxs(ka + i,
-				kb, e->buf, e->nbuf,
-				&dist, tau, INFINITY, INFINITY);
-		if (cidx >= 0)
+		free(e->buf);
+	}
+	for (int i = 0; i < na; i++)
+		if (oj[i] >= 0)
 		{
-			int j = e->buf[cidx];
-			assert(j >= 0);
+			int j = oj[i];
 			assert(j < nb);
 			p[num_pairs].from = i;
 			p[num_pairs].to = j;
-			p[num_pairs].v[0] = dist;
+			p[num_pairs].v[0] = od[i];
 			p[num_pairs].v[1] = NAN;
-			//fprintf(stderr, "added %dth pair {%d} [%d %d] (d=%g)\n", num_pairs, cidx, i, j, dist);
 			num_pairs += 1;
 		}
-	}
+	free(oj);
+	free(od);
 
 acabemaqui:
+	sift_grid_free(gb);
 	sort_annpairs(p, num_pairs);
 	*out_np = num_pairs;
 	return p;
@@ -1443,7 +1950,25 @@ struct ann_pair *siftlike_get_annpairs_kd(
 	*np = na;
 	return p;
 #else
-	return siftlike_get_annpairs(ka, na, kb, nb, np);
+	struct kdforest f[1];
+	sift_kdforest(f, NULL, kb, nb);
+	struct ann_pair *p = xmalloc(na * sizeof * p);
+	int *idx = xmalloc(na * sizeof*idx);
+	double *d = xmalloc(2 * na * sizeof*d);
+	sift_nearest_two_kdf(idx, d, d + na, ka, na, kb, f);
+	FORI(na) {
+		assert(idx[i] >= 0);
+		p[i].from = i;
+		p[i].to = idx[i];
+		p[i].v[0] = d[i];
+		p[i].v[1] = d[na+i];
+	}
+	free(idx);
+	free(d);
+	kdforest_free(f);
+	sort_annpairs(p, na);
+	*np = na;
+	return p;
 #endif
 }
 
@@ -4,6 +4,179 @@
 #include <string.h>
 
 #include "siftie.c"
+#define OMIT_MAIN
+#include "ransac.c"
+#include "ransac_cases.c"
+#include "pickopt.c"
+
+// compute pairs using sift-nn (non-sym, exhaustive, relative)
+// (euclidean, on two binary keypoint files that are mapped and used in place)
+static int main_siftcpairsRm(int c, char *v[])
+{
+	if (c != 5) {
+		fprintf(stderr,"usage:\n\t%s R k1.skp k2.skp pairs.txt\n",*v);
+		//                         0 1 2      3      4
+		return EXIT_FAILURE;
+	}
+	struct sift_keypoints_map m[2];
+	FORI(2) sift_map_file(m + i, v[2+i]);
+	int npairs;
+	float R = atof(v[1]);
+	struct ann_pair *pairs = siftlike_get_annpairs_lowe_map(m, m+1,
+			&npairs, R);
+	fprintf(stderr, "SIFTCPAIRS: produced %d pairs "
+			"(from %d and %d){%d}[%g%%]\n",
+			npairs, m[0].n, m[1].n, m[0].n*m[1].n,
+			npairs*100.0/(m[0].n*(double)m[1].n));
+	FILE *f = xfopen(v[4], "w");
+	FORI(npairs) {
+		float *a = m[0].pos[pairs[i].from];
+		float *b = m[1].pos[pairs[i].to];
+		fprintf(f, "%g %g %g %g\n", a[0], a[1], b[0], b[1]);
+	}
+	xfclose(f);
+	FORI(2) sift_unmap(m + i);
+	if (pairs) xfree(pairs);
+	return EXIT_SUCCESS;
+}
+
+// match all the pairs of a list of images, in a single run
+//
+// The keypoints of each image are read once, and the kd-forest of each one
+// is built once (in parallel) and shared by all its pairs, which are matched
+// in parallel.  If "-f maxerr" is given, the matches of each pair are filtered
+// by a RANSAC fundamental matrix, with PROSAC on the Lowe ratio.
+//
+// The output is a binary file, in the native byte order:
+//
+// 	int32 header[4] = {"SPR1", number of images, number of pairs, 0}
+// 	each pair:  int32 {a, b, n}, float model[9] (NAN without "-f")
+// 	            n matches {int32 i, j; float d, d2}
+//
+// where i is a keypoint of the image a < b, j its match on b, and d, d2 the
+// distances to the nearest and second nearest descriptors of b.
+#define SIFT_PAIRS_MAGIC 0x31525053 // "SPR1"
+
+SMART_PARAMETER(SIFT_PAIRS_NTRIALS,10000)
+
+struct sift_image_pair {
+	int a, b, n;
+	float model[9];
+	struct ann_pair *p;
+};
+
+// keep the matches of a pair of images that fit a fundamental matrix
+static void sift_pairs_ransac(struct sift_image_pair *e,
+		struct sift_keypoint *ka, struct sift_keypoint *kb, float maxerr)
+{
+	FORI(9) e->model[i] = NAN;
+	if (e->n < 7) { e->n = 0; return; }
+	int n = e->n;
+	float *data = xmalloc(4 * n * sizeof*data);
+	float *quality = xmalloc(n * sizeof*quality);
+	bool *mask = xmalloc(n * sizeof*mask);
+	FORI(n) {
+		struct ann_pair *q = e->p + i;
+		data[4*i+0] = ka[q->from].pos[0];
+		data[4*i+1] = ka[q->from].pos[1];
+		data[4*i+2] = kb[q->to].pos[0];
+		data[4*i+3] = kb[q->to].pos[1];
+		quality[i] = -q->v[0] / q->v[1];
+	}
+	int ni = ransac_guided(mask, e->model, data, 4, n, 9,
+			epipolar_error, seven_point_algorithm, 7,
+			SIFT_PAIRS_NTRIALS(), 7, maxerr, NULL, NULL, quality);
+	int cx = 0;
+	if (ni > 0) {
+		FORI(n) if (mask[i]) e->p[cx++] = e->p[i];
+	} else
+		FORI(9) e->model[i] = NAN;
+	e->n = cx;
+	free(data);
+	free(quality);
+	free(mask);
+}
+
+static int main_siftpairs(int c, char *v[])
+{
+	char *maxerr = pick_option(&c, &v, "f", "");
+	if (c < 5) {
+		fprintf(stderr,"usage:\n\t%s [-f maxerr] R out.bin k1 k2 ...\n",
+				*v);
+		//                         0             1 2       3  4
+		return EXIT_FAILURE;
+	}
+	float R = atof(v[1]);
+	char *filename_out = v[2];
+	int nimages = c - 3;
+	struct sift_keypoint **k = xmalloc(nimages * sizeof*k);
+	int *nk = xmalloc(nimages * sizeof*nk);
+	struct kdforest *f = xmalloc(nimages * sizeof*f);
+	FORI(nimages)
+		k[i] = read_raw_sifts_fname(v[3+i], nk + i);
+
+	// read the parameters before the parallel loops
+	SIFT_KDF_TREES();
+	SIFT_KDF_CHECKS();
+	SIFT_PAIRS_NTRIALS();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int i = 1; i < nimages; i++)
+		sift_kdforest(f + i, NULL, k[i], nk[i]);
+
+	int npairs = nimages * (nimages - 1) / 2;
+	struct sift_image_pair *e = xmalloc(npairs * sizeof*e);
+	for (int a = 0, cx = 0; a < nimages; a++)
+	for (int b = a + 1; b < nimages; b++)
+	{
+		e[cx].a = a;
+		e[cx].b = b;
+		cx += 1;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int i = 0; i < npairs; i++)
+	{
+		int a = e[i].a, b = e[i].b;
+		e[i].p = siftlike_get_annpairs_lowe_forest(k[a], nk[a],
+				k[b], f + b, &e[i].n, R);
+		if (*maxerr)
+			sift_pairs_ransac(e + i, k[a], k[b], atof(maxerr));
+		else
+			for (int l = 0; l < 9; l++)
+				e[i].model[l] = NAN;
+	}
+
+	FILE *o = xfopen(filename_out, "w");
+	int h[4] = {SIFT_PAIRS_MAGIC, nimages, npairs, 0};
+	int ok = 4 == fwrite(h, sizeof*h, 4, o), ntotal = 0;
+	FORI(npairs) {
+		int t[3] = {e[i].a, e[i].b, e[i].n};
+		ok = ok && 3 == fwrite(t, sizeof*t, 3, o)
+			&& 9 == fwrite(e[i].model, sizeof(float), 9, o)
+			&& e[i].n == (int)fwrite(e[i].p, sizeof*e[i].p, e[i].n, o);
+		ntotal += e[i].n;
+		free(e[i].p);
+	}
+	if (!ok)
+		fail("could not write the pairs file \"%s\"", filename_out);
+	xfclose(o);
+	fprintf(stderr, "SIFTPAIRS: produced %d matches (from %d images)\n",
+			ntotal, nimages);
+
+	FORI(nimages) {
+		if (i) kdforest_free(f + i);
+		if (k[i]) xfree(k[i]);
+	}
+	free(e);
+	free(f);
+	free(nk);
+	free(k);
+	return EXIT_SUCCESS;
+}
 
 // compute pairs using sift-nn (non-sym, exhaustive, explicit)
 static int main_siftcpairs(int c, char *v[])
@@ -114,6 +287,64 @@ static int main_siftcpairsR2(int c, char *v[])
 	return EXIT_SUCCESS;
 }
 
+// build the kd-forest of a list of keypoints, to match it later
+static int main_siftindex(int c, char *v[])
+{
+	if (c != 3) {
+		fprintf(stderr,"usage:\n\t%s k forest.kdf\n",*v);
+		//                         0 1 2
+		return EXIT_FAILURE;
+	}
+	int n;
+	FILE *f = xfopen(v[1], "r");
+	struct sift_keypoint *p = read_raw_sifts(f, &n);
+	xfclose(f);
+	struct kdforest t[1];
+	sift_kdforest(t, NULL, p, n);
+	kdforest_save(t, v[2]);
+	kdforest_free(t);
+	if (p) xfree(p);
+	return EXIT_SUCCESS;
+}
+
+// compute pairs using sift-nn (non-sym, approximate, relative)
+// (the kd-forest of k2 is read from a file, or built if its name is empty)
+static int main_siftcpairsRi(int c, char *v[])
+{
+	if (c != 6) {
+		fprintf(stderr,"usage:\n\t%s R k1 k2 k2.kdf pairs.txt\n",*v);
+		//                         0 1 2  3  4      5
+		return EXIT_FAILURE;
+	}
+	struct sift_keypoint *p[2];
+	int n[2];
+	FORI(2) {
+		FILE *f = xfopen(v[2+i], "r");
+		p[i] = read_raw_sifts(f, n+i);
+		xfclose(f);
+	}
+	int npairs;
+	struct ann_pair *pairs;
+	float R = atof(v[1]);
+	pairs = siftlike_get_annpairs_lowe_kdf(p[0], n[0], p[1], n[1], &npairs,
+			R, v[4]);
+	fprintf(stderr, "SIFTCPAIRS: produced %d pairs "
+			"(from %d and %d){%d}[%g%%]\n",
+			npairs, n[0], n[1], n[0]*n[1],npairs*100.0/(n[0]*n[1]));
+	FILE *f = xfopen(v[5], "w");
+	FORI(npairs) {
+		struct sift_keypoint *ka = p[0] + pairs[i].from;
+		struct sift_keypoint *kb = p[1] + pairs[i].to;
+		fprintf(f, "%g %g %g %g\n",
+				ka->pos[0], ka->pos[1],
+				kb->pos[0], kb->pos[1]);
+	}
+	xfclose(f);
+	FORI(2) if (p[i]) xfree(p[i]);
+	if (pairs) xfree(pairs);
+	return EXIT_SUCCESS;
+}
+
 // compute pairs using sift-nn (non-sym, exhaustive, explicit)
 static int main_siftcpairsr(int c, char *v[])
 {
@@ -499,10 +730,12 @@ int main_siftbad_hom(int c, char *v[])
 //}
 
 // sift file format conversion
+// (a=ascii, b=binary records, g=either one, m=mappable binary file)
 int main_siftcon(int c, char *v[])
 {
 	if (c != 3) {
-		fprintf(stderr, "usage:\n\t%s [a|b|g] [a|b|g] <in >out\n", *v);
+		fprintf(stderr, "usage:\n\t%s [a|b|g|m] [a|b|g|m] <in >out\n",
+				*v);
 		return EXIT_FAILURE;
 	}
 	int forma = v[1][0];
@@ -513,12 +746,21 @@ int main_siftcon(int c, char *v[])
 	case 'a': k = read_raw_sifts(stdin, &n); break;
 	case 'b': k = read_raw_siftsb(stdin, &n); break;
 	case 'g': k = read_raw_sifts_gen(stdin, &n); break;
+	case 'm': {
+		struct sift_keypoints_map m[1];
+		sift_map_file(m, "-");
+		k = sift_map_keypoints(m);
+		n = m->n;
+		sift_unmap(m);
+		break;
+	}
 	default: fail("unrecognized input format '%c'", forma);
 	}
 	switch(formb) {
 	case 'a': write_raw_sifts(stdout, k, n); break;
 	case 'b': write_raw_siftsb(stdout, k, n); break;
 	case 'g': write_raw_sifts_gen(stdout, k, n); break;
+	case 'm': write_sifts_map(stdout, k, n); break;
 	default: fail("unrecognized output format '%c'", formb);
 	}
 	xfree(k);
@@ -553,6 +795,10 @@ int main_siftu(int c, char *v[])
 	else if (0 == strcmp(v[1],"pairt"))  return main_siftcpairst(c-1, v+1);
 	else if (0 == strcmp(v[1],"pairR"))  return main_siftcpairsR(c-1, v+1);
 	else if (0 == strcmp(v[1],"pairR2")) return main_siftcpairsR2(c-1, v+1);
+	else if (0 == strcmp(v[1],"pairRi")) return main_siftcpairsRi(c-1, v+1);
+	else if (0 == strcmp(v[1],"pairRm")) return main_siftcpairsRm(c-1, v+1);
+	else if (0 == strcmp(v[1],"index"))  return main_siftindex(c-1, v+1);
+	else if (0 == strcmp(v[1],"pairs"))  return main_siftpairs(c-1, v+1);
 	else if (0 == strcmp(v[1],"pairfm")) return main_siftcpairsfm(c-1, v+1);
 	else if (0 == strcmp(v[1],"trip"))   return main_sifttriplets(c-1, v+1);
 	else if (0 == strcmp(v[1],"tripr"))  return main_sifttripletsr(c-1,v+1);
@@ -564,7 +810,7 @@ int main_siftu(int c, char *v[])
 	else if (0 == strcmp(v[1],"convert"))return main_siftcon(c-1, v+1);
 	else {
 	usage: fprintf(stderr, "usage:\n\t%s "
-				"[pair|trip|aff|split|clean|convert] params\n",
+				"[pair|pairs|trip|index|aff|split|clean|convert] params\n",
 				*v);
 		return EXIT_FAILURE;
 	}
@@ -18,6 +18,9 @@ static void *xmalloc(size_t n)
 	return new;
 }
 
+#include "multicolor.c"
+#include "nanreduce.c"
+
 // the type of a "getpixel" function
 typedef float (*getpixel_operator)(float*,int,int,int,int);
 
@@ -89,33 +92,70 @@ static float laplacian_neum(float *I, int w, int h, int i, int j)
 	return r;
 }
 
-// perform one gauss-seidel iteration in-place on the data I
-static void gauss_seidel_iteration(float *I, float *f, int w, int h,
-		int (*omega)[2], int n_omega, float tstep)
+// the operator selected by the time step, and the actual time step
+// (the order is that of the operator: 1=laplacian, 2=bilaplacian, 3=fourlap)
+static getpixel_operator operator_of_tstep(float *tstep, int *order)
 {
 	getpixel_operator op = laplacian_neum;
-	if (tstep < 0)
+	int k = 1;
+	if (*tstep < 0)
 	{
 		op = bilaplacian;
-		if (tstep < -1000)
+		k = 2;
+		if (*tstep < -1000)
 		{
 			op = fourlaplacian;
-			tstep += 1000;
-			tstep *= -1;
+			k = 3;
+			*tstep += 1000;
+			*tstep *= -1;
 		}
 	}
+	if (order) *order = k;
+	return op;
+}
 
-//#pragma omp parallel for
-	for (int p = 0; p < n_omega; p++)
-	{
-		int i = omega[p][0];
-		int j = omega[p][1];
-		int ij = j*w + i;
+// perform one gauss-seidel iteration in-place on the data I
+//
+// The pixels are visited by colors (red-black for the laplacian), so that
+// each color is updated in parallel, by runs of consecutive pixels.
+static void gauss_seidel_iteration(float *I, float *f, int w, int h,
+		int (*omega)[2], int n_omega, float tstep)
+{
+	int order;
+	getpixel_operator op = operator_of_tstep(&tstep, &order);
+	int k, m = multicolor_modulus_diamond(&k, order);
+	int n_runs, (*run)[3] = multicolor_runs(&n_runs, omega, n_omega);
 
-		float l = op(I, w, h, i, j);
-		float d = f ? f[ij] : 0;
-		I[ij] = I[ij] + tstep * (l - d);
+	for (int c = 0; c < m; c++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,64)
+#endif
+	for (int q = 0; q < n_runs; q++)
+	{
+		int j = run[q][0], i = multicolor_first(run[q], c, m, k);
+		int i1 = run[q][2];
+		if (op == laplacian_neum && j > 0 && j < h-1)
+		{
+			for (; i <= i1 && i < 1; i += m)
+				I[j*w+i] += tstep * (op(I, w, h, i, j)
+						- (f ? f[j*w+i] : 0));
+			// interior pixels, by direct indexing
+			int ie = i1 < w-1 ? i1 : w-2;
+			for (; i <= ie; i += m)
+			{
+				int ij = j*w + i;
+				float x = I[ij], r = 0;
+				float n[4] = {I[ij+1], I[ij+w], I[ij-1], I[ij-w]};
+				for (int l = 0; l < 4; l++)
+					if (isfinite(n[l]))
+						r += n[l] - x;
+				I[ij] = x + tstep * (r - (f ? f[ij] : 0));
+			}
+		}
+		for (; i <= i1; i += m)
+			I[j*w+i] += tstep * (op(I, w, h, i, j) - (f ? f[j*w+i] : 0));
 	}
+	free(run);
 }
 
 // build a mask of the NAN positions on image "x"
@@ -173,26 +213,10 @@ static void zoom_out_by_factor_two(float *out, int ow, int oh,
 		float *in, int iw, int ih)
 {
 	if (!out || !in) return;
-	getpixel_operator p = getpixel_1;
 	assert(abs(2*ow-iw) < 2);
 	assert(abs(2*oh-ih) < 2);
-
-	for (int j = 0; j < oh; j++)
-	for (int i = 0; i < ow; i++)
-	{
-		float a[4], m = 0;
-		a[0] = p(in, iw, ih, 2*i, 2*j);
-		a[1] = p(in, iw, ih, 2*i+1, 2*j);
-		a[2] = p(in, iw, ih, 2*i, 2*j+1);
-		a[3] = p(in, iw, ih, 2*i+1, 2*j+1);
-		int cx = 0;
-		for (int k = 0; k < 4; k++)
-			if (isfinite(a[k])) {
-				m += a[k];
-				cx += 1;
-			}
-		out[ow*j + i] = cx ? m/cx : NAN;
-	}
+	nanreduce2(out, ow, oh, in, iw, ih, 1, NANREDUCE_FMEAN,
+			NANREDUCE_EDGE_CLAMP);
 }
 
 // evaluate a bilinear cell at the given point
@@ -244,6 +268,9 @@ static void zoom_in_by_factor_two(float *out, int ow, int oh,
 SMART_PARAMETER_SILENT(PMSFAC,3)
 SMART_PARAMETER_SILENT(PONLIT,0)
 
+// preconditioner of the Conjugate Gradient (0=none, 1=incomplete Cholesky)
+static int global_cg_precond = 0;
+
 void poisson_rec(float *u, float *g, float *f, int w, int h,
 		float tstep, int niter, int scale, int cgit)
 {
@@ -277,17 +304,212 @@ void poisson_rec(float *u, float *g, float *f, int w, int h,
 
 	if (cgit && tstep > 0) { // if requested, refine by Conjugate Gradient
 		float cg_eps = 1e-6;
-		poisson_extension_by_cg(u, g, f, w, h, u, cgit, cg_eps);
+		if (global_cg_precond)
+			poisson_extension_by_pcg(u, g, f, w, h, u, cgit, cg_eps);
+		else
+			poisson_extension_by_cg(u, g, f, w, h, u, cgit, cg_eps);
 	} else {
 		float cg_eps = 1e-9;
-		biharmonic_extension_by_cg(u, g, f, w, h, u, cgit, cg_eps);
+		if (global_cg_precond && cgit)
+			biharmonic_extension_by_pcg(u, g, f, w, h, u, cgit, cg_eps);
+		else
+			biharmonic_extension_by_cg(u, g, f, w, h, u, cgit, cg_eps);
+	}
+}
+
+// Multigrid solver.
+//
+// This is the correction scheme: the error of the current solution solves
+// the same equation, with the residual as data term and zero boundary
+// values.  At each level, the error is smoothed by Gauss-Seidel iterations,
+// and the remaining residual is restricted by full weighting to the coarse
+// grid of the even pixels (the coarse region of interest are the even
+// pixels inside the fine one).  The coarse correction is interpolated back
+// inside the region, with the step that minimizes the energy of the error.
+// The coarse operators are the same, with the data scaled by 4^order.
+
+struct multigrid_params {
+	int ncycles;   // maximum number of cycles (0 = no multigrid)
+	float tol;     // relative tolerance of the RMS residual
+	int gamma;     // coarse corrections per level (1=V-cycle, 2=W-cycle)
+	int pre, post; // smoothing iterations before and after the correction
+	int coarse;    // iterations at the coarsest level
+};
+
+// r = f - L(u) on the region of interest, zero elsewhere
+// (returns the RMS of the residual)
+static double poisson_residual(float *r, float *u, float *f, int w, int h,
+		int (*omega)[2], int n_omega, float tstep)
+{
+	getpixel_operator op = operator_of_tstep(&tstep, NULL);
+	for (int i = 0; i < w*h; i++)
+		r[i] = 0;
+	double s = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:s)
+#endif
+	for (int p = 0; p < n_omega; p++)
+	{
+		int ij = omega[p][1]*w + omega[p][0];
+		r[ij] = (f ? f[ij] : 0) - op(u, w, h, omega[p][0], omega[p][1]);
+		s += r[ij] * (double)r[ij];
 	}
+	return n_omega ? sqrt(s / n_omega) : 0;
+}
+
+// restriction of the residual r by full weighting, where the coarse pixel
+// (i,j) is the fine pixel (2i,2j); the coarse region of interest "mc" are
+// the NANs of m at these positions
+static void restrict_by_factor_two(float *rc, float *mc, int ws, int hs,
+		float *r, float *m, int w, int h, float factor)
+{
+	for (int j = 0; j < hs; j++)
+	for (int i = 0; i < ws; i++)
+	{
+		float a = 0, b = 0;
+		for (int dj = -1; dj <= 1; dj++)
+		for (int di = -1; di <= 1; di++)
+		{
+			int ii = 2*i + di, jj = 2*j + dj;
+			if (ii < 0 || jj < 0 || ii >= w || jj >= h) continue;
+			float k = (2 - abs(di)) * (2 - abs(dj));
+			a += k * r[jj*w+ii];
+			b += k;
+		}
+		int c = isnan(m[2*j*w+2*i]);
+		rc[j*ws+i] = c ? factor * a / b : 0;
+		mc[j*ws+i] = c ? NAN : 0;
+	}
+}
+
+// cubic interpolation of the coarse correction, at the inverse positions
+// (interpolating the even pixels, and with weights -1,9,9,-1 at the odd
+// ones; the biharmonic operators need more than bilinear interpolation)
+static void prolong_by_factor_two(float *e, int w, int h,
+		float *ec, int ws, int hs)
+{
+	static const float k[4] = {-1/16.0, 9/16.0, 9/16.0, -1/16.0};
+	float *t = xmalloc(ws * h * sizeof*t);
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < ws; i++)
+		if (j % 2 == 0)
+			t[j*ws+i] = ec[(j/2)*ws+i];
+		else {
+			float a = 0;
+			for (int q = 0; q < 4; q++)
+				a += k[q] * getpixel_1(ec, ws, hs, i, j/2-1+q);
+			t[j*ws+i] = a;
+		}
+	for (int j = 0; j < h; j++)
+	for (int i = 0; i < w; i++)
+		if (i % 2 == 0)
+			e[j*w+i] = t[j*ws+i/2];
+		else {
+			float a = 0;
+			for (int q = 0; q < 4; q++)
+				a += k[q] * getpixel_1(t, ws, h, i/2-1+q, j);
+			e[j*w+i] = a;
+		}
+	free(t);
+}
+
+// one multigrid cycle for L(e) = r on the NANs of m, e = 0 elsewhere
+static void multigrid_cycle(float *e, float *r, float *m, int w, int h,
+		float tstep, struct multigrid_params *p)
+{
+	int n_omega, (*omega)[2] = build_mask(&n_omega, m, w, h);
+	int ws = ceil(w/2.0);
+	int hs = ceil(h/2.0);
+	if (n_omega && (n_omega < 16 || ws*hs == w*h)) { // coarsest level
+		for (int i = 0; i < p->coarse; i++)
+			gauss_seidel_iteration(e, r, w, h, omega, n_omega, tstep);
+	} else if (n_omega) {
+		for (int i = 0; i < p->pre; i++)
+			gauss_seidel_iteration(e, r, w, h, omega, n_omega, tstep);
+
+		int order;
+		float t = tstep;
+		getpixel_operator op = operator_of_tstep(&t, &order);
+		float *s = xmalloc(w * h * sizeof*s);
+		float *c = xmalloc(w * h * sizeof*c);
+		float *rc = xmalloc(ws * hs * sizeof*rc);
+		float *mc = xmalloc(ws * hs * sizeof*mc);
+		float *ec = xmalloc(ws * hs * sizeof*ec);
+		poisson_residual(s, e, r, w, h, omega, n_omega, tstep);
+		restrict_by_factor_two(rc, mc, ws, hs, s, m, w, h,
+				pow(4, order));
+		for (int i = 0; i < ws*hs; i++)
+			ec[i] = 0;
+		for (int i = 0; i < p->gamma; i++)
+			multigrid_cycle(ec, rc, mc, ws, hs, tstep, p);
+		prolong_by_factor_two(c, w, h, ec, ws, hs);
+		for (int i = 0; i < w*h; i++)
+			if (!isnan(m[i]))
+				c[i] = 0;
+
+		// step that minimizes the energy of the new error
+		// (the higher-order operators get overcorrected otherwise)
+		double sl = 0, ll = 0;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+:sl,ll)
+#endif
+		for (int q = 0; q < n_omega; q++)
+		{
+			int i = omega[q][0], j = omega[q][1];
+			double l = op(c, w, h, i, j);
+			sl += s[j*w+i] * (double)c[j*w+i];
+			ll += l * c[j*w+i];
+		}
+		float a = ll ? sl / ll : 0;
+		for (int q = 0; q < n_omega; q++)
+		{
+			int ij = omega[q][1]*w + omega[q][0];
+			e[ij] += a * c[ij];
+		}
+		free(s);
+		free(c);
+		free(rc);
+		free(mc);
+		free(ec);
+
+		for (int i = 0; i < p->post; i++)
+			gauss_seidel_iteration(e, r, w, h, omega, n_omega, tstep);
+	}
+	free(omega);
+}
+
+// refine the solution u of L(u) = f on the NANs of g by multigrid cycles,
+// until the RMS residual decreases by a factor "p->tol"
+static void poisson_multigrid(float *u, float *g, float *f, int w, int h,
+		float tstep, struct multigrid_params *p)
+{
+	int n_omega, (*omega)[2] = build_mask(&n_omega, g, w, h);
+	float *r = xmalloc(w * h * sizeof*r);
+	float *e = xmalloc(w * h * sizeof*e);
+	double r0 = poisson_residual(r, u, f, w, h, omega, n_omega, tstep);
+	double rn = r0;
+	for (int c = 0; c < p->ncycles && rn > p->tol * r0; c++)
+	{
+		for (int i = 0; i < w*h; i++)
+			e[i] = 0;
+		multigrid_cycle(e, r, g, w, h, tstep, p);
+		for (int q = 0; q < n_omega; q++)
+		{
+			int ij = omega[q][1]*w + omega[q][0];
+			u[ij] += e[ij];
+		}
+		rn = poisson_residual(r, u, f, w, h, omega, n_omega, tstep);
+	}
+	free(r);
+	free(e);
+	free(omega);
 }
 
 // extension by Poisson equation of each channel of a color image
 void poisson_solver_separable(float *out, float *in, float *dat,
 		int w, int h, int pd,
-		float tstep, int niter, int scale, float cgrad)
+		float tstep, int niter, int scale, float cgrad,
+		struct multigrid_params *mg)
 {
 #ifdef _OPENMP
 #pragma omp parallel for
@@ -298,6 +520,8 @@ void poisson_solver_separable(float *out, float *in, float *dat,
 		float *inl  = in  + w*h*l;
 		float *datl = dat ? dat + w*h*l : dat;
 		poisson_rec(outl, inl, datl, w, h, tstep, niter, scale, cgrad);
+		if (mg && mg->ncycles > 0)
+			poisson_multigrid(outl, inl, datl, w, h, tstep, mg);
 	}
 }
 
@@ -332,6 +556,11 @@ static char *help_string_long     =
 " -n 10\tNumber of Gauss-Seidel iterations\n"
 " -s 99\tMaximum number of multi-scale octaves\n"
 " -c 0\tNumber of Conjugate Gradient iterations\n"
+" -P none\tPreconditioner of the Conjugate Gradient (none, ic)\n"
+" -M 0\tMaximum number of multigrid cycles, after the above\n"
+" -e 1e-4\tRelative tolerance of the residual for the multigrid cycles\n"
+" -y 1\tMultigrid cycle (1=V-cycle, 2=W-cycle)\n"
+" -l 2,2,50\tMultigrid iterations (pre-smoothing,post-smoothing,coarsest)\n"
 " -h\tdisplay short help message\n"
 " --help\tdisplay longer help message\n"
 "\n"
@@ -339,6 +568,8 @@ static char *help_string_long     =
 " cat in.npy | simpois > out.npy           Fill NANs by Laplace equation\n"
 " cat in.npy | simpois -n 1 > out.npy      Fill NANs, fast (one iteration)\n"
 " cat in.npy | simpois -t -0.08 > out.npy  Fill NANs, smooth (Biharmonic)\n"
+" cat in.npy | simpois -M 20 > out.npy     Fill large holes, by multigrid\n"
+" cat in.npy | simpois -c 200 -P ic > out  Fill large holes, by PCG\n"
 " simpois -i in.npy -o out.npy             Laplace, with explicit data\n"
 " simpois -m mask.png ...                  Use mask instead of NANs\n"
 " simpois -f lap.npy ...                   Poisson editor\n"
@@ -358,6 +589,20 @@ int main_simpois(int argc, char *argv[])
 	float niter = atof(pick_option(&argc, &argv, "n", "10"));
 	float nscal = atof(pick_option(&argc, &argv, "s", "99"));
 	float cgrad = atof(pick_option(&argc, &argv, "c", "0"));
+	char *cg_precond = pick_option(&argc, &argv, "P", "none");
+	if (!strcmp(cg_precond, "ic"))
+		global_cg_precond = 1;
+	else if (strcmp(cg_precond, "none"))
+		return fprintf(stderr, "unknown preconditioner \"%s\"\n",
+				cg_precond);
+	struct multigrid_params mg[1];
+	mg->ncycles = atoi(pick_option(&argc, &argv, "M", "0"));
+	mg->tol = atof(pick_option(&argc, &argv, "e", "1e-4"));
+	mg->gamma = atoi(pick_option(&argc, &argv, "y", "1"));
+	char *mg_iter = pick_option(&argc, &argv, "l", "2,2,50");
+	if (3 != sscanf(mg_iter, "%d,%d,%d", &mg->pre, &mg->post, &mg->coarse))
+		return fprintf(stderr, "bad multigrid iterations \"%s\"\n",
+				mg_iter);
 	char *filename_i = pick_option(&argc, &argv, "i", "-"); // stdin
 	char *filename_o = pick_option(&argc, &argv, "o", "-"); // stdout
 	char *filename_m = pick_option(&argc, &argv, "m", "");
@@ -379,6 +624,11 @@ int main_simpois(int argc, char *argv[])
 			"\t-n 10      Number of Gauss-Seidel iterations\n"
 			"\t-s 99      Number of Multi-Scale octaves\n"
 			"\t-c 0       Number of Conjugate Gradient iterations\n"
+			"\t-P none    Conjugate Gradient preconditioner (none, ic)\n"
+			"\t-M 0       Number of multigrid cycles\n"
+			"\t-e 1e-4    Multigrid relative residual tolerance\n"
+			"\t-y 1       Multigrid cycle (1=V, 2=W)\n"
+			"\t-l 2,2,50  Multigrid iterations (pre,post,coarsest)\n"
 		);
 		fprintf(stderr, "\nNote: NAN values in the input image"
 				" are added to the region of interest\n");
@@ -425,7 +675,7 @@ int main_simpois(int argc, char *argv[])
 
 	// run the algorithm
 	poisson_solver_separable(out, img_i, img_f, w, h, pd,
-			tstep, niter, nscal, cgrad);
+			tstep, niter, nscal, cgrad, mg);
 
 	// save the output image
 	iio_write_image_float_split(filename_o, out, w, h, pd);
@@ -0,0 +1,175 @@
+#ifndef _SPLAT_C
+#define _SPLAT_C
+
+// forward splatting: accumulate the values of points into an image
+//
+// Each point has a position p (in pixel coordinates), a vector value v of
+// pd components, and optionally a depth z.  It is spread over the pixels
+// around p, with nearest, bilinear or gaussian weights.  The image "a"
+// accumulates the weighted values, and the image "s" the weights, so that
+// a/s is the weighted average of the points that fall into each pixel.
+//
+// With depths, each pixel only takes the points whose depth is within ztol
+// of the smallest depth that reaches it (a z-buffer with tolerance), so
+// that the occluded points are discarded.
+//
+// The points are bucketed by horizontal bands of the image, and the bands
+// are processed in parallel, first the even ones and then the odd ones.
+// The bands are taller than the footprint of the points, so that two bands
+// processed at the same time never touch the same pixel.  Thus there are no
+// atomic operations, and the result does not depend on the number of
+// threads.
+//
+// This file needs a function "xmalloc" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+
+#define SPLAT_NEAREST  0
+#define SPLAT_BILINEAR 1
+#define SPLAT_GAUSSIAN 2
+
+#define SPLAT_BAND 32 // minimum height of the bands
+
+// radius of the footprint of the gaussian kernel, in sigmas
+#define SPLAT_GAUSSIAN_RADIUS 3
+
+static int splat_radius(int kernel, float sigma)
+{
+	if (kernel == SPLAT_GAUSSIAN)
+		return ceil(SPLAT_GAUSSIAN_RADIUS * sigma);
+	return 0;
+}
+
+// pixels q[] reached by a point at (x,y) and their weights t[], return count
+// (q needs (2r+2)^2 places; the pixels may be outside the image)
+static int splat_footprint(int (*q)[2], float *t, float x, float y,
+		int kernel, float sigma, int r)
+{
+	if (kernel == SPLAT_NEAREST) {
+		q[0][0] = round(x);
+		q[0][1] = round(y);
+		t[0] = 1;
+		return 1;
+	}
+	int ix = floor(x), iy = floor(y), n = 0;
+	float u = x - ix, v = y - iy;
+	if (kernel == SPLAT_BILINEAR) {
+		float wx[2] = {1 - u, u}, wy[2] = {1 - v, v};
+		for (int j = 0; j < 2; j++)
+		for (int i = 0; i < 2; i++)
+		{
+			q[n][0] = ix + i;
+			q[n][1] = iy + j;
+			t[n++] = wx[i] * wy[j];
+		}
+		return n;
+	}
+	float gx[2*r+2], gy[2*r+2];
+	for (int i = -r; i <= r + 1; i++)
+	{
+		gx[i+r] = exp(-(i - u) * (i - u) / (2 * sigma * sigma));
+		gy[i+r] = exp(-(i - v) * (i - v) / (2 * sigma * sigma));
+	}
+	for (int j = -r; j <= r + 1; j++)
+	for (int i = -r; i <= r + 1; i++)
+	{
+		q[n][0] = ix + i;
+		q[n][1] = iy + j;
+		t[n++] = gx[i+r] * gy[j+r];
+	}
+	return n;
+}
+
+// accumulate the n points p[k], of values v[k*pd..k*pd+pd-1] and depths z[k]
+// (z may be NULL), into the images a (w*h*pd) and s (w*h)
+static void splat_points(float *a, float *s, int w, int h, int pd,
+		float (*p)[2], float *v, float *z, int n,
+		int kernel, float sigma, float ztol)
+{
+	// bucket the points by bands (in their original order)
+	int r = splat_radius(kernel, sigma);
+	int bh = 2*r + 2 > SPLAT_BAND ? 2*r + 2 : SPLAT_BAND;
+	int nb = (h + bh - 1) / bh;
+	int *start = xmalloc((nb + 1) * sizeof*start);
+	int *idx = xmalloc((n + 1) * sizeof*idx);
+	int *band = xmalloc((n + 1) * sizeof*band);
+	for (int b = 0; b <= nb; b++)
+		start[b] = 0;
+	for (int k = 0; k < n; k++)
+	{
+		float x = p[k][0], y = p[k][1];
+		band[k] = -1;
+		if (!(x > -r - 2 && x < w + r + 1 && y > -r - 2 && y < h + r + 1))
+			continue; // (also discards the NANs)
+		int j = floor(y);
+		j = j < 0 ? 0 : j >= h ? h - 1 : j;
+		band[k] = j / bh;
+		start[band[k] + 1] += 1;
+	}
+	for (int b = 0; b < nb; b++)
+		start[b+1] += start[b];
+	for (int k = 0; k < n; k++)
+		if (band[k] >= 0)
+			idx[start[band[k]]++] = k;
+	for (int b = nb; b > 0; b--)
+		start[b] = start[b-1];
+	start[0] = 0;
+	free(band);
+
+	// z-buffer
+	float *zb = NULL;
+	if (z) {
+		zb = xmalloc(w * h * sizeof*zb);
+		for (int i = 0; i < w * h; i++)
+			zb[i] = INFINITY;
+	}
+
+	// the first pass fills the z-buffer, and the second one accumulates
+	for (int pass = z ? 0 : 1; pass < 2; pass++)
+	for (int color = 0; color < 2; color++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int b = color; b < nb; b += 2)
+	{
+		int q[(2*r+2)*(2*r+2)][2];
+		float t[(2*r+2)*(2*r+2)];
+		for (int c = start[b]; c < start[b+1]; c++)
+		{
+			int k = idx[c];
+			int m = splat_footprint(q, t, p[k][0], p[k][1],
+					kernel, sigma, r);
+			for (int l = 0; l < m; l++)
+			{
+				int i = q[l][0], j = q[l][1];
+				if (i < 0 || j < 0 || i >= w || j >= h || !(t[l] > 0))
+					continue;
+				int o = j * w + i;
+				if (pass == 0) {
+					zb[o] = fmin(zb[o], z[k]);
+					continue;
+				}
+				if (zb && z[k] > zb[o] + ztol)
+					continue;
+				for (int e = 0; e < pd; e++)
+					a[o*pd+e] += t[l] * v[k*pd+e];
+				s[o] += t[l];
+			}
+		}
+	}
+
+	free(zb);
+	free(start);
+	free(idx);
+}
+
+// a = a / s, or NAN where there are no points
+static void splat_normalize(float *a, float *s, int w, int h, int pd)
+{
+	for (int i = 0; i < w * h; i++)
+	for (int l = 0; l < pd; l++)
+		a[i*pd+l] = s[i] > 0 ? a[i*pd+l] / s[i] : NAN;
+}
+
+#endif//_SPLAT_C
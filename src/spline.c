@@ -34,6 +34,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <math.h>
 
 static double initcausal(float *c, int step, int n, double z)
@@ -108,33 +109,101 @@ static bool fill_poles(double* z, int order)
 	return true;
 }
 
+// number of columns that are gathered together by the column pass
+#define SPLINE_BLOCK 16
+
 // Prepare image (in-place) for cardinal spline interpolation.
+// (the rows, and then the blocks of columns, are filtered in parallel)
 bool prepare_spline(float *img, int w, int h, int pd, int order)
 {
 	if(order < 3)
 		return true;
 
-	// Replace nans and infinities with 0
-	for (int i = 0; i < w * h * pd; i++)
-		if (!isfinite(img[i]))
-			img[i] = 0;
-
 	// Init poles of associated z-filter
 	double z[5];
 	if (! fill_poles(z, order))
 		return false;
 	int npoles = order / 2;
 
-	for (int k = 0; k < pd; k++) { // Loop on image components
-		for (int y = 0; y < h; y++) // Filter on lines
-			invspline1D(img + (y*w+0)*pd + k, pd * 1, w, z, npoles);
-		for (int x = 0; x < w; x++) // Filter on columns
-			invspline1D(img + (0*w+x)*pd + k, pd * w, h, z, npoles);
+	// Replace nans and infinities with 0
+	long W = w * pd; // (number of samples of a row)
+	for (long i = 0; i < W * h; i++)
+		if (!isfinite(img[i]))
+			img[i] = 0;
+
+	// Filter on lines
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int y = 0; y < h; y++)
+		for (int k = 0; k < pd; k++)
+			invspline1D(img + y*W + k, pd, w, z, npoles);
+
+	// Filter on columns (by blocks, so that the accesses are contiguous)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (long i0 = 0; i0 < W; i0 += SPLINE_BLOCK)
+	{
+		int nb = W - i0 < SPLINE_BLOCK ? W - i0 : SPLINE_BLOCK;
+		float *t = malloc(nb * h * sizeof*t);
+		for (int y = 0; y < h; y++)
+		for (int b = 0; b < nb; b++)
+			t[b*h + y] = img[y*W + i0 + b];
+		for (int b = 0; b < nb; b++)
+			invspline1D(t + b*h, 1, h, z, npoles);
+		for (int y = 0; y < h; y++)
+		for (int b = 0; b < nb; b++)
+			img[y*W + i0 + b] = t[b*h + y];
+		free(t);
 	}
 
 	return true;
 }
 
+// cache of the spline coefficients of an image, for warping it repeatedly
+//
+// The coefficients are computed on a copy, at the first call of
+// "spline_cache_get", so that the image itself is kept.  They are computed
+// again when the image, its size or the order change (the contents of the
+// image are not checked: call "spline_cache_free" after modifying it).
+struct spline_cache {
+	float *x, *c;   // image and its coefficients (c == x for order < 3)
+	int w, h, pd, order;
+};
+
+#define SPLINE_CACHE_INIT {0}
+
+void spline_cache_free(struct spline_cache *t)
+{
+	if (t->c != t->x)
+		free(t->c);
+	*t = (struct spline_cache)SPLINE_CACHE_INIT;
+}
+
+// get the coefficients of the image x for the given order, or NULL
+float *spline_cache_get(struct spline_cache *t,
+		float *x, int w, int h, int pd, int order)
+{
+	if (t->c && t->x == x && t->w == w && t->h == h && t->pd == pd
+			&& t->order == order)
+		return t->c;
+	spline_cache_free(t);
+	float *c = x;
+	if (order >= 3) {
+		c = malloc(w * h * pd * sizeof*c);
+		if (!c) return NULL;
+		for (long i = 0; i < (long)w * h * pd; i++)
+			c[i] = x[i];
+		if (!prepare_spline(c, w, h, pd, order)) {
+			free(c);
+			return NULL;
+		}
+	}
+	*t = (struct spline_cache){x, c, w, h, pd, order};
+	return c;
+}
+
 /* c[] = values of interpolation function at ...,t-2,t-1,t,t+1,... */
 
 /* coefficients for cubic interpolant (Keys' function) */
@@ -238,6 +307,33 @@ static float getsample_2(float *x, int w, int h, int pd, int i, int j, int l)
 	return getsample_ass(x, w, h, pd, i, j, l);
 }
 
+static bool valid_orderP(int order)
+{
+	return order == 0 || order == 1 || order == -3 || order == 3 ||
+		order == 5 || order == 7 || order == 9 || order == 11;
+}
+
+// interpolation weights c[] at offset t, for orders other than 0
+// (ak is the pre-computation of "init_splinen", for the orders >3)
+static void spline_weights(float *c, float t, int order, float *ak)
+{
+	float paramKeys = -0.5;
+	switch(order)  {
+	case 1: /* first order interpolation (bilinear) */
+		c[0] = t; c[1] = 1-t;
+		break;
+	case -3: /* third order interpolation (bicubic Keys) */
+		keys(c, t, paramKeys);
+		break;
+	case 3: /* spline of order 3 */
+		spline3(c, t);
+		break;
+	default: /* spline of order >3 */
+		splinen(c, t, ak, order);
+		break;
+	}
+}
+
 // Spline interpolation of given order of image im at point (x,y).
 // out must be an array of size the number of components.
 // Supported orders: 0(nn), 1(bilinear), -3(Keys's bicubic), 3, 5, 7, 9, 11.
@@ -249,8 +345,7 @@ bool evaluate_spline_at(float *out,
 	float  cx[12],cy[12];
 
 	/* CHECK ORDER */
-	if (order != 0 && order != 1 && order != -3 && order != 3 &&
-			order != 5 && order != 7 && order != 9 && order != 11)
+	if (!valid_orderP(order))
 		return false;
 
 	float ak[13];
@@ -274,29 +369,12 @@ bool evaluate_spline_at(float *out,
 		int yi = (y<0)? -1: y;
 		float ux = x - xi;
 		float uy = y - yi;
-		float paramKeys = -0.5;
-		switch(order)  {
-		case 1: /* first order interpolation (bilinear) */
-			cx[0] = ux; cx[1] = 1-ux;
-			cy[0] = uy; cy[1] = 1-uy;
-			break;
-		case -3: /* third order interpolation (bicubic Keys) */
-			keys(cx, ux, paramKeys);
-			keys(cy, uy, paramKeys);
-			break;
-		case 3: /* spline of order 3 */
-			spline3(cx, ux);
-			spline3(cy, uy);
-			break;
-		default: /* spline of order >3 */
-			splinen(cx, ux, ak, order);
-			splinen(cy, uy, ak, order);
-			break;
-		}
+		spline_weights(cx, ux, order, ak);
+		spline_weights(cy, uy, order, ak);
 		int n2 = (order == -3) ? 2 : (order+1)/2;
 		int n1 = 1 - n2;
 		/* this test saves computation time */
-		if (insideP(w, h, xi+n1, yi+n1) && insideP(w, h, xi+n1, yi+n2))
+		if (insideP(w, h, xi+n1, yi+n1) && insideP(w, h, xi+n2, yi+n2))
 		{
 			for (int k = 0; k < pd; k++) {
 				out[k] = 0;
@@ -328,6 +406,84 @@ bool evaluate_spline_at(float *out,
 	return true;
 }
 
+// evaluate at the n points p[] (nt taps per axis, weights from the order)
+// (the weights are computed once for each point, and the sums are separable)
+static inline void evaluate_spline_points_nt(float *out,
+		float *img, int w, int h, int pd,
+		int order, float (*p)[2], int n, int nt, float *ak)
+{
+	int n2 = nt / 2, n1 = 1 - n2;
+	for (int q = 0; q < n; q++)
+	{
+		float x = p[q][0], y = p[q][1], *o = out + q * pd;
+		if (!(x>=0 && x<=w && y>=0 && y<=h)) {
+			for (int k = 0; k < pd; k++)
+				o[k] = 0;
+			continue;
+		}
+		x -= 0.5; y -= 0.5;
+		int xi = (x<0)? -1: x;
+		int yi = (y<0)? -1: y;
+		float cx[12], cy[12];
+		spline_weights(cx, x - xi, order, ak);
+		spline_weights(cy, y - yi, order, ak);
+		bool in = insideP(w, h, xi+n1, yi+n1)
+			&& insideP(w, h, xi+n2, yi+n2);
+		for (int k = 0; k < pd; k++)
+		{
+			float r = 0;
+			for (int dy = n1; dy <= n2; dy++)
+			{
+				float s = 0;
+				if (in) {
+					float *v = img + ((yi+dy)*w + xi+n1)*pd + k;
+					for (int dx = n1; dx <= n2; dx++)
+						s += cx[n2-dx] * v[(dx-n1)*pd];
+				} else
+					for (int dx = n1; dx <= n2; dx++)
+						s += cx[n2-dx] * getsample_2(img, w, h, pd,
+								xi+dx, yi+dy, k);
+				r += cy[n2-dy] * s;
+			}
+			o[k] = r;
+		}
+	}
+}
+
+// Spline interpolation at the n points p[q], into out[q*pd+k].
+// The points outside the image get the value 0.
+// This gives the same values as "evaluate_spline_at", up to rounding errors.
+bool evaluate_spline_at_points(float *out,
+		float *img, int w, int h, int pd,
+		int order, float (*p)[2], int n)
+{
+	if (!valid_orderP(order))
+		return false;
+	if (order == 0) {
+		for (int q = 0; q < n; q++)
+			if (!evaluate_spline_at(out + q*pd, img, w, h, pd, 0,
+						p[q][0], p[q][1]))
+				for (int k = 0; k < pd; k++)
+					out[q*pd+k] = 0;
+		return true;
+	}
+
+	float ak[13];
+	if (order > 3)
+		init_splinen(ak, order);
+
+	// (the number of taps becomes a constant)
+	switch (order) {
+	case  1: evaluate_spline_points_nt(out,img,w,h,pd,1,p,n,2,ak); break;
+	case -3: evaluate_spline_points_nt(out,img,w,h,pd,-3,p,n,4,ak); break;
+	case  3: evaluate_spline_points_nt(out,img,w,h,pd,3,p,n,4,ak); break;
+	case  5: evaluate_spline_points_nt(out,img,w,h,pd,5,p,n,6,ak); break;
+	case  7: evaluate_spline_points_nt(out,img,w,h,pd,7,p,n,8,ak); break;
+	default: evaluate_spline_points_nt(out,img,w,h,pd,order,p,n,order+1,ak);
+	}
+	return true;
+}
+
 // this main serves as a unit test of the code above
 #ifdef MAIN_SPLINE
 #include <stdio.h>
@@ -41,8 +41,9 @@ SMART_PARAMETER(MR_NTRIALS,10000)
 SMART_PARAMETER(MR_MINLIERS,30)
 SMART_PARAMETER(MR_MAXERR,2)
 
+// (the quality of each pair is optional, and it guides the sampling)
 static int find_homographic_model_among_pairs(float *model, bool *omask,
-		float *data, int n)
+		float *data, float *quality, int n)
 {
 	int modeldim, datadim, nfit;
 	ransac_error_evaluation_function *model_evaluation;
@@ -63,10 +64,10 @@ static int find_homographic_model_among_pairs(float *model, bool *omask,
 	int minliers = MR_MINLIERS();
 	float maxerr = MR_MAXERR();
 
-	int n_inliers = ransac(omask, model, data, datadim, n, modeldim,
+	int n_inliers = ransac_guided(omask, model, data, datadim, n, modeldim,
 			model_evaluation, model_generation,
 			nfit, ntrials, minliers, maxerr,
-			model_acceptation, user_data);
+			model_acceptation, user_data, quality);
 	if (n_inliers > 0) {
 		printf("RANSAC found a model with %d inliers\n", n_inliers);
 		printf("parameters =");
@@ -101,9 +102,13 @@ static struct ann_pair *srmatch(
 			INFINITY, INFINITY);
 
 	// build a temporary list with these pairs of coordinates
+	// (and their quality: minus the distance, or minus the Lowe ratio)
 	float *tp0 = xmalloc(npairs*4*sizeof*tp0);
+	float *q0 = xmalloc(npairs*sizeof*q0);
 	for (int i = 0; i < npairs; i++)
 	{
+		float d = p0[i].v[0], dp = p0[i].v[1];
+		q0[i] = isfinite(dp) && dp > 0 ? -d / dp : -d;
 		struct sift_keypoint *kai = ka + p0[i].from;
 		struct sift_keypoint *kbi = kb + p0[i].to;
 		tp0[4*i+0] = kai->pos[0];
@@ -114,7 +119,9 @@ static struct ann_pair *srmatch(
 
 	// find a homographic model that matches this temporary list
 	float h0[9], ih0[9];
-	int nr0 = find_homographic_model_among_pairs(h0, omask, tp0, npairs);
+	int nr0 = find_homographic_model_among_pairs(h0, omask, tp0, q0,
+			npairs);
+	free(q0);
 	fprintf(stderr, "nr0 = %d\n", nr0);
 
 	// map back all the points of the second image by this homography
@@ -0,0 +1,74 @@
+#ifndef _STACKREDUCE_C
+#define _STACKREDUCE_C
+
+// pixelwise reduction of a stack of images, streamed by bands of rows
+//
+// The images are opened as streams (see "iio_open"), the same band of rows
+// of all of them is read and reduced into a band of the output, which is
+// written to an output stream (see "iio_create").  The height of the bands
+// is chosen so that the bands of all the images fit into a budget of
+// memory.  Thus the memory is proportional to the number of images times
+// the height of a band, not times the height of the images.
+//
+// This file needs the functions "xmalloc" and "fail" (e.g., from xmalloc.c).
+
+#include <stdlib.h>
+#include "iio.h"
+
+// reduce the bands x[0..n-1], of w x nrows pixels of pd channels, into y
+typedef void (*stackreduce_operator)(void *e, float *y, float **x, int n,
+		int pd, int w, int nrows);
+
+// height of the bands that fit into "megabytes" of memory
+static int stackreduce_band_height(double megabytes, int w, int h, int n,
+		int pd, int out_pd)
+{
+	double row = sizeof(float) * (double)w * (n * (double)pd + out_pd);
+	double r = megabytes * 1024 * 1024 / row;
+	return r < 1 ? 1 : r > h ? h : r;
+}
+
+// reduce the images fname[0..n-1] into the image "filename_out"
+// (the images must have the same size, and pd channels if pd > 0; the output
+// has out_pd channels, or as many as the inputs if out_pd == 0)
+static void stackreduce(char *filename_out, int out_pd, char **fname, int n,
+		int pd, double megabytes, stackreduce_operator f, void *e)
+{
+	struct iio_stream *s[n];
+	int w[n], h[n], d[n];
+	for (int i = 0; i < n; i++)
+	{
+		s[i] = iio_open(fname[i], w + i, h + i, d + i);
+		if (!s[i]) fail("could not open image \"%s\"", fname[i]);
+		if (w[i] != *w || h[i] != *h || d[i] != (pd > 0 ? pd : *d))
+			fail("%dth image size mismatch\n", i);
+	}
+	if (!out_pd) out_pd = *d;
+	int band = stackreduce_band_height(megabytes, *w, *h, n, *d, out_pd);
+
+	float *x[n];
+	for (int i = 0; i < n; i++)
+		x[i] = xmalloc(*w * (size_t)band * *d * sizeof*x[i]);
+	float *y = xmalloc(*w * (size_t)band * out_pd * sizeof*y);
+	struct iio_ostream *o = iio_create(filename_out, *w, *h, out_pd);
+	for (int j = 0; j < *h; j += band)
+	{
+		int r = j + band < *h ? band : *h - j;
+		for (int i = 0; i < n; i++)
+			if (r != iio_read_rows(s[i], x[i], j, r))
+				fail("could not read rows %d..%d of \"%s\"",
+						j, j + r - 1, fname[i]);
+		f(e, y, x, n, *d, *w, r);
+		iio_write_rows(o, y, r);
+	}
+	iio_finish(o);
+
+	free(y);
+	for (int i = 0; i < n; i++)
+	{
+		free(x[i]);
+		iio_close(s[i]);
+	}
+}
+
+#endif//_STACKREDUCE_C
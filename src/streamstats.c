@@ -0,0 +1,329 @@
+#ifndef _STREAMSTATS_C
+#define _STREAMSTATS_C
+
+// one-pass statistics of streams of samples, in a fixed memory
+//
+// The samples are given by parts (e.g., the bands of rows of an image read
+// by "iio_open"), and there are three kinds of accumulators:
+//
+// 	moments    count, sum, min, max, mean and variance (Welford)
+// 	sketch     quantiles, from a stack of compactors (as in KLL)
+// 	histogram  counts in fixed bins of an interval
+//
+// An accumulator can be filled by several threads separately, and the
+// parts merged at the end.  The sketch keeps all the samples while they
+// fit in its first level, so that its quantiles are exact for small inputs.
+// Afterwards, each level that gets full is sorted and half of its samples
+// (alternately the even and odd ones) are moved to the next level, where
+// they count twice.  The error of the ranks is about log2(n/k)/k, and the
+// memory k*log2(n/k) floats.
+//
+// The NaNs are counted apart, and ignored by all the statistics.
+//
+// This file needs the functions "xmalloc" and "fail" (e.g., from xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// moments {{{1
+
+struct streamstats_moments {
+	long n;              // number of samples (not NaN)
+	long nnan, ninf, nzero;
+	long double sum, sum2;
+	float min, max;
+	long nfinite;        // for the mean and the variance
+	double mean, m2;     // of the finite samples (Welford)
+};
+
+static void streamstats_moments_init(struct streamstats_moments *m)
+{
+	memset(m, 0, sizeof*m);
+	m->min = INFINITY;
+	m->max = -INFINITY;
+}
+
+static void streamstats_moments_add(struct streamstats_moments *m,
+		float *x, long n)
+{
+	for (long i = 0; i < n; i++)
+	{
+		float y = x[i];
+		if (isnan(y)) { m->nnan += 1; continue; }
+		m->n += 1;
+		if (y < m->min) m->min = y;
+		if (y > m->max) m->max = y;
+		m->sum += y;
+		m->sum2 += y * (long double)y;
+		if (!y) m->nzero += 1;
+		if (!isfinite(y)) { m->ninf += 1; continue; }
+		m->nfinite += 1;
+		double d = y - m->mean;
+		m->mean += d / m->nfinite;
+		m->m2 += d * (y - m->mean);
+	}
+}
+
+// a += b
+static void streamstats_moments_merge(struct streamstats_moments *a,
+		struct streamstats_moments *b)
+{
+	long n = a->nfinite + b->nfinite;
+	if (n) {
+		double d = b->mean - a->mean;
+		a->mean += d * b->nfinite / n;
+		a->m2 += b->m2 + d * d * a->nfinite * (double)b->nfinite / n;
+	}
+	a->nfinite = n;
+	a->n += b->n;
+	a->nnan += b->nnan;
+	a->ninf += b->ninf;
+	a->nzero += b->nzero;
+	a->sum += b->sum;
+	a->sum2 += b->sum2;
+	if (b->min < a->min) a->min = b->min;
+	if (b->max > a->max) a->max = b->max;
+}
+
+static double streamstats_moments_variance(struct streamstats_moments *m)
+{
+	return m->nfinite ? m->m2 / m->nfinite : NAN;
+}
+
+// sketch {{{1
+
+#define STREAMSTATS_LEVELS 48
+
+struct streamstats_sketch {
+	int k;                            // capacity of each level (even)
+	int n[STREAMSTATS_LEVELS];        // samples in each level
+	float *level[STREAMSTATS_LEVELS]; // (allocated when needed)
+	long count;                       // total number of samples given
+	unsigned parity;                  // of the compactions, alternately
+
+	// sorted summary, for the queries (rebuilt after additions)
+	int ns;
+	float *sv;
+	double *sw;                       // cumulative weights
+};
+
+static void streamstats_sketch_init(struct streamstats_sketch *s, int k)
+{
+	memset(s, 0, sizeof*s);
+	s->k = k < 2 ? 2 : k + k % 2;
+}
+
+static void streamstats_sketch_free(struct streamstats_sketch *s)
+{
+	for (int l = 0; l < STREAMSTATS_LEVELS; l++)
+		free(s->level[l]);
+	free(s->sv);
+	free(s->sw);
+	memset(s, 0, sizeof*s);
+}
+
+static int streamstats_compare_floats(const void *a, const void *b)
+{
+	const float *x = a, *y = b;
+	return (*x > *y) - (*x < *y);
+}
+
+static void streamstats_sketch_push(struct streamstats_sketch *s, int l,
+		float x);
+
+// sort the full level l, and move half of it to the level l+1
+static void streamstats_sketch_compact(struct streamstats_sketch *s, int l)
+{
+	if (l + 1 >= STREAMSTATS_LEVELS)
+		fail("streamstats: too many samples for the sketch");
+	float *t = s->level[l];
+	int n = s->n[l];
+	qsort(t, n, sizeof*t, streamstats_compare_floats);
+	s->n[l] = 0;
+	int o = s->parity++ % 2;
+	for (int i = o; i < n; i += 2)
+		streamstats_sketch_push(s, l + 1, t[i]);
+}
+
+static void streamstats_sketch_push(struct streamstats_sketch *s, int l,
+		float x)
+{
+	if (!s->level[l])
+		s->level[l] = xmalloc(s->k * sizeof*s->level[l]);
+	s->level[l][s->n[l]++] = x;
+	if (s->n[l] == s->k)
+		streamstats_sketch_compact(s, l);
+}
+
+static void streamstats_sketch_add(struct streamstats_sketch *s,
+		float *x, long n)
+{
+	if (!s->level[0])
+		s->level[0] = xmalloc(s->k * sizeof*s->level[0]);
+	for (long i = 0; i < n; i++)
+		if (!isnan(x[i]))
+		{
+			s->level[0][s->n[0]++] = x[i];
+			s->count += 1;
+			if (s->n[0] == s->k)
+				streamstats_sketch_compact(s, 0);
+		}
+	s->ns = 0;
+}
+
+// a += b
+static void streamstats_sketch_merge(struct streamstats_sketch *a,
+		struct streamstats_sketch *b)
+{
+	for (int l = 0; l < STREAMSTATS_LEVELS; l++)
+		for (int i = 0; i < b->n[l]; i++)
+			streamstats_sketch_push(a, l, b->level[l][i]);
+	a->count += b->count;
+	a->ns = 0;
+}
+
+// whether the sketch still has all the samples
+static bool streamstats_sketch_exact(struct streamstats_sketch *s)
+{
+	return s->count == s->n[0];
+}
+
+struct streamstats_item { float v; double w; };
+
+static int streamstats_compare_items(const void *a, const void *b)
+{
+	const struct streamstats_item *x = a, *y = b;
+	return (x->v > y->v) - (x->v < y->v);
+}
+
+static void streamstats_sketch_summary(struct streamstats_sketch *s)
+{
+	int n = 0;
+	for (int l = 0; l < STREAMSTATS_LEVELS; l++)
+		n += s->n[l];
+	struct streamstats_item *t = xmalloc((n + 1) * sizeof*t);
+	int c = 0;
+	for (int l = 0; l < STREAMSTATS_LEVELS; l++)
+	for (int i = 0; i < s->n[l]; i++)
+		t[c++] = (struct streamstats_item){s->level[l][i], ldexp(1,l)};
+	qsort(t, n, sizeof*t, streamstats_compare_items);
+	free(s->sv);
+	free(s->sw);
+	s->sv = xmalloc((n + 1) * sizeof*s->sv);
+	s->sw = xmalloc((n + 1) * sizeof*s->sw);
+	double a = 0;
+	for (int i = 0; i < n; i++)
+	{
+		a += t[i].w;
+		s->sv[i] = t[i].v;
+		s->sw[i] = a;
+	}
+	s->ns = n;
+	free(t);
+}
+
+// the sample of rank r (from 0 to count-1) in the sorted order
+// (exact when "streamstats_sketch_exact", approximate otherwise)
+static float streamstats_sketch_rank(struct streamstats_sketch *s, long r)
+{
+	if (!s->count) return NAN;
+	if (!s->ns) streamstats_sketch_summary(s);
+	if (r < 0) r = 0;
+	if (r >= s->count) r = s->count - 1;
+	// the levels above 0 hold the whole weight of the compacted samples,
+	// so the ranks are rescaled to the total weight of the summary
+	double q = (r + 0.5) * s->sw[s->ns-1] / s->count;
+	int a = 0, b = s->ns - 1;
+	while (a < b)
+	{
+		int m = (a + b) / 2;
+		if (s->sw[m] > q) b = m; else a = m + 1;
+	}
+	return s->sv[a];
+}
+
+// the quantile q (from 0 to 1)
+static float streamstats_sketch_quantile(struct streamstats_sketch *s,
+		double q)
+{
+	return streamstats_sketch_rank(s, q * (s->count - 1));
+}
+
+// histogram {{{1
+
+struct streamstats_histogram {
+	int nbins;
+	double lo, hi;
+	long *count;
+	long under, over, nan;
+};
+
+static void streamstats_histogram_init(struct streamstats_histogram *h,
+		int nbins, double lo, double hi)
+{
+	if (nbins < 1) fail("streamstats: bad number of bins %d", nbins);
+	h->nbins = nbins;
+	h->lo = lo;
+	h->hi = hi;
+	h->count = xmalloc(nbins * sizeof*h->count);
+	memset(h->count, 0, nbins * sizeof*h->count);
+	h->under = h->over = h->nan = 0;
+}
+
+static void streamstats_histogram_free(struct streamstats_histogram *h)
+{
+	free(h->count);
+	h->count = NULL;
+}
+
+// the bins are [lo,lo+d), [lo+d,lo+2d), ..., [hi-d,hi]
+static void streamstats_histogram_add(struct streamstats_histogram *h,
+		float *x, long n)
+{
+	double f = h->hi > h->lo ? h->nbins / (h->hi - h->lo) : 0;
+	for (long i = 0; i < n; i++)
+	{
+		float y = x[i];
+		if (isnan(y)) { h->nan += 1; continue; }
+		if (y < h->lo) { h->under += 1; continue; }
+		if (y > h->hi) { h->over += 1; continue; }
+		long b = (y - h->lo) * f;
+		if (b >= h->nbins) b = h->nbins - 1;
+		h->count[b] += 1;
+	}
+}
+
+// a += b (for histograms of the same bins)
+static void streamstats_histogram_merge(struct streamstats_histogram *a,
+		struct streamstats_histogram *b)
+{
+	for (int i = 0; i < a->nbins; i++)
+		a->count[i] += b->count[i];
+	a->under += b->under;
+	a->over += b->over;
+	a->nan += b->nan;
+}
+
+// center of the bin i
+static double streamstats_histogram_center(struct streamstats_histogram *h,
+		int i)
+{
+	return h->lo + (i + 0.5) * (h->hi - h->lo) / h->nbins;
+}
+
+// bands {{{1
+
+// height of the bands of rows of an image of width w and pd channels, that
+// fit into the given number of megabytes (at least one row)
+static int streamstats_band_height(double megabytes, int w, int h, int pd)
+{
+	double row = w * (double)pd * sizeof(float);
+	double b = megabytes * 1024 * 1024 / row;
+	if (b < 1) b = 1;
+	if (b > h) b = h;
+	return b;
+}
+
+#endif//_STREAMSTATS_C
@@ -128,6 +128,190 @@ static void compute_structure_tensor_field(float *out_st,
 	compute_structure_tensor_field_fancy(out_st, wv, wo, kside, gx,gy, w,h);
 }
 
+// fused structure tensor {{{1
+//
+// The gradients are the forward differences of the function below (zero on
+// the last row and column), their products are summed over the channels,
+// and the window is applied by two 1D passes: the gaussian weights
+// exp(-(r/sigma)^2) are the product of the weights of each coordinate, and
+// so are the box weights (sigma < 0).  The products are extended by constant
+// outside the image, as in "compute_structure_tensor_here", so that the
+// result is the same up to rounding.
+//
+// The image is processed by bands of rows, in parallel.  Each band computes
+// the products and the horizontal pass of its rows and of the halo of the
+// window, one plane at a time, into contiguous rows (so that the loops can
+// be vectorized), and the pixels far from the left and right borders are
+// filtered without extension.
+
+#ifndef STRT_BAND
+#define STRT_BAND 64
+#endif
+
+// weights of the 1D window, for the offsets k - (kside-1)/2
+static void fill_window_values_1d(float *wv, int kside, double sigma)
+{
+	int kradius = (kside - 1)/2;
+	double m = 0;
+	for (int k = 0; k < kside; k++)
+		m += wv[k] = sigma < 0 ? 1 : exp(-sqr((k - kradius)/sigma));
+	for (int k = 0; k < kside; k++)
+		wv[k] /= m;
+}
+
+// the products gx*gx, gx*gy, gy*gy of the row j, summed over the channels
+static void structure_tensor_products(float *pa, float *pb, float *pc,
+		float *x, int w, int h, int pd, int j)
+{
+	for (int i = 0; i < w; i++)
+		pa[i] = pb[i] = pc[i] = 0;
+	if (j >= h - 1)
+		return;
+	float *r = x + j * (size_t)w * pd; // this row
+	float *s = r + w * (size_t)pd;     // next row
+	if (pd == 1)
+		for (int i = 0; i < w - 1; i++)
+		{
+			float gx = r[i+1] - r[i];
+			float gy = s[i] - r[i];
+			pa[i] = gx * gx;
+			pb[i] = gx * gy;
+			pc[i] = gy * gy;
+		}
+	else
+		for (int i = 0; i < w - 1; i++)
+		for (int l = 0; l < pd; l++)
+		{
+			float gx = r[pd*(i+1)+l] - r[pd*i+l];
+			float gy = s[pd*i+l] - r[pd*i+l];
+			pa[i] += gx * gx;
+			pb[i] += gx * gy;
+			pc[i] += gy * gy;
+		}
+}
+
+// y[i] = sum_k wv[k] * x[i+k-kradius], with x extended by constant
+static void structure_tensor_hpass(float *y, float *x, int w,
+		float *wv, int kside)
+{
+	int kradius = (kside - 1)/2;
+	int a = kradius < w ? kradius : w;  // first interior pixel
+	int b = w - (kside - 1 - kradius);  // end of the interior pixels
+	if (b < a) b = a;
+	for (int i = a; i < b; i++)
+		y[i] = 0;
+	for (int k = 0; k < kside; k++)
+	{
+		float *xk = x + k - kradius;
+		for (int i = a; i < b; i++)
+			y[i] += wv[k] * xk[i];
+	}
+	for (int i = 0; i < w; i++)
+	{
+		if (i == a) i = b;
+		if (i >= w) break;
+		float r = 0;
+		for (int k = 0; k < kside; k++)
+		{
+			int ii = i + k - kradius;
+			if (ii < 0) ii = 0;
+			if (ii >= w) ii = w - 1;
+			r += wv[k] * x[ii];
+		}
+		y[i] = r;
+	}
+}
+
+// common kernel of the two functions below: if "t" is given, it is filled
+// with the 3 components of the tensor, and if "y" is given, with the Harris
+// response det(T) - kappa*trace(T)^2
+static void structure_tensor_fused(float *t, float *y, float kappa,
+		float *x, int w, int h, int pd, int kside, double sigma)
+{
+	assert(kside > 0);
+	float wv[kside]; fill_window_values_1d(wv, kside, sigma);
+	int kradius = (kside - 1)/2;
+	int nh = STRT_BAND + kside - 1; // rows of a band, with the halo
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+	{
+		float *P = xmalloc(3 * (size_t)w * (nh + 2) * sizeof*P);
+		float *V = P + 3 * (size_t)w;  // vertical pass of a row
+		float *H = V + 3 * (size_t)w;  // horizontal pass of the band
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+		for (int j0 = 0; j0 < h; j0 += STRT_BAND)
+		{
+			int n = h - j0 < STRT_BAND ? h - j0 : STRT_BAND;
+			for (int m = 0; m < n + kside - 1; m++)
+			{
+				int q = j0 + m - kradius;
+				if (q < 0) q = 0;
+				if (q >= h) q = h - 1;
+				structure_tensor_products(P, P + w, P + 2*w,
+						x, w, h, pd, q);
+				for (int c = 0; c < 3; c++)
+					structure_tensor_hpass(
+						H + (3*m + c) * (size_t)w,
+						P + c * (size_t)w, w, wv, kside);
+			}
+			for (int j = 0; j < n; j++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					float *v = V + c * (size_t)w;
+					for (int i = 0; i < w; i++)
+						v[i] = 0;
+					for (int k = 0; k < kside; k++)
+					{
+						float *r = H + (3*(j+k) + c) * (size_t)w;
+						for (int i = 0; i < w; i++)
+							v[i] += wv[k] * r[i];
+					}
+				}
+				size_t o = (j0 + j) * (size_t)w;
+				if (t)
+					for (int i = 0; i < w; i++)
+					{
+						t[3*(o+i)+0] = V[i];
+						t[3*(o+i)+1] = V[i + w];
+						t[3*(o+i)+2] = V[i + 2*w];
+					}
+				if (y)
+					for (int i = 0; i < w; i++)
+					{
+						float a = V[i];
+						float b = V[i + w];
+						float c = V[i + 2*w];
+						y[o+i] = a*c - b*b - kappa * (a+c) * (a+c);
+					}
+			}
+		}
+		free(P);
+	}
+}
+
+// "out_st" is filled to be an image of 3 channels (the components of the
+// tensor), from the image "x" of "pd" channels
+static void structure_tensor_field_fused(float *out_st,
+		float *x, int w, int h, int pd, int kside, double sigma)
+{
+	structure_tensor_fused(out_st, NULL, 0, x, w, h, pd, kside, sigma);
+}
+
+// "out_r" is filled with the Harris response det(T) - kappa*trace(T)^2 of
+// the structure tensor T of the image "x" of "pd" channels
+static void harris_response_fused(float *out_r, float kappa,
+		float *x, int w, int h, int pd, int kside, double sigma)
+{
+	structure_tensor_fused(NULL, out_r, kappa, x, w, h, pd, kside, sigma);
+}
+
+// }}}1
+
 // "out_stf" is filled to be an image of 7 channels, containing the structure
 // tensor T at each point, together with several related descriptors
 //
@@ -145,23 +329,11 @@ static void compute_structure_tensor_field(float *out_st,
 static void compute_structure_tensor_field_ultra_fancy(float *out_stf,
 		float *x, int w, int h, int kside, double sigma)
 {
-	int wo[kside*kside][2]; fill_window_offsets(wo, kside);
-	float wv[kside*kside]; fill_window_values(wv, wo, kside, sigma);
 	float *tt = malloc(3 * w * h * sizeof(float));
-	float *gx = malloc(2 * w * h * sizeof(float));
-	float *gy = gx + w*h;
-	for (int i = 0; i < w*h; i++)
-		gx[i] = gy[i] = 0;
-	for (int j = 0; j < h-1; j++)
-	for (int i = 0; i < w-1; i++)
-	{
-		int ij = j*w + i;
-		int Ij = j*w + i + 1;
-		int iJ = j*w + i + w;
-		gx[ij] = x[Ij] - x[ij];
-		gy[ij] = x[iJ] - x[ij];
-	}
-	compute_structure_tensor_field_fancy(tt, wv, wo, kside, gx,gy, w,h);
+	structure_tensor_field_fused(tt, x, w, h, 1, kside, sigma);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	for (int i = 0; i < w * h; i++)
 	{
 		double a = tt[3*i+0];
@@ -207,7 +379,6 @@ static void compute_structure_tensor_field_ultra_fancy(float *out_stf,
 		out_stf[7*i+6] = ey;
 
 	}
-	free(gx);
 	free(tt);
 }
 
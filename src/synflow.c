@@ -33,11 +33,36 @@ static int parse_doubles(double *t, int nmax, const char *s)
 
 
 
+// compute the output and the flow by bands of "band" rows, and write them
+// as they are computed (without the full-size flow and output images)
+static void synflow_by_bands(char *filename_out, char *filename_flow,
+		struct flow_model *fm, float *x, int w, int h, int pd, int band)
+{
+	float *y = xmalloc(w * (long)band * pd * sizeof*y);
+	float *f = xmalloc(w * (long)band * 2 * sizeof*y);
+	struct iio_ostream *oy = iio_create(filename_out, w, h, pd);
+	struct iio_ostream *of = iio_create(filename_flow, w, h, 2);
+	for (int j = 0; j < h; j += band)
+	{
+		int j1 = j + band < h ? j + band : h;
+		transform_rows(y, fm, x, w, h, pd, true, j, j1);
+		fill_flow_rows(f, fm, j, j1);
+		iio_write_rows(oy, y, j1 - j);
+		iio_write_rows(of, f, j1 - j);
+	}
+	iio_finish(oy);
+	iio_finish(of);
+	free(y);
+	free(f);
+}
+
+#include "pickopt.c"
 int main_synflow(int c, char *v[])
 {
+	int band = atoi(pick_option(&c, &v, "t", "0"));
 	if (c != 6) {
-		fprintf(stderr, "usage:\n\t%s model \"params\""
-				//         0  1       2
+		fprintf(stderr, "usage:\n\t%s [-t rows] model \"params\""
+				//                 0            1       2
 				" in out flow\n", *v);
 				//3  4   5
 		return EXIT_FAILURE;
@@ -46,15 +71,21 @@ int main_synflow(int c, char *v[])
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(v[3], &w, &h, &pd);
 
-	float *y = xmalloc(w * h * pd * sizeof*y);
-	float *f = xmalloc(w * h * 2 * sizeof*y);
-
 	int maxparam = 40;
 	double param[maxparam];
 	int nparams = parse_doubles(param, maxparam, v[2]);
 
 	struct flow_model fm[1];
 	produce_flow_model(fm, param, nparams, v[1], w, h);
+
+	if (band > 0) {
+		synflow_by_bands(v[4], v[5], fm, x, w, h, pd, band);
+		free(x);
+		return EXIT_SUCCESS;
+	}
+
+	float *y = xmalloc(w * h * pd * sizeof*y);
+	float *f = xmalloc(w * h * 2 * sizeof*y);
 	fill_flow_field(f, fm, w, h);
 	transform_forward(y, fm, x, w, h, pd);
 
@@ -4,6 +4,7 @@
 #include "fail.c"
 #include "getpixel.c"
 #include "marching_interpolation.c"
+#include "warpcore.c"
 
 static float interpolate_bilinear(float a, float b, float c, float d,
 					float x, float y)
@@ -817,53 +818,73 @@ static void apply_flow(float y[2], struct flow_model *f, float x[2], bool inv)
 //{
 //}
 
+// "API"
+// fill the rows j0..j1-1 of the vector field of the given flow
+// (xx has (j1-j0) rows of width f->w)
+static void fill_flow_rows(float *xx, struct flow_model *f, int j0, int j1)
+{
+	int w = f->w;
+	float (*x)[w][2] = (void*)xx;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = j0; j < j1; j++)
+	FORI(w) {
+		float p[2] = {i, j}, q[2];
+		apply_flow(q, f, p, 0);
+		FORL(2) x[j-j0][i][l] = q[l] - p[l];
+	}
+}
+
 // "API"
 // fill a image with the vector field of the given flow
 static void fill_flow_field(float *xx, struct flow_model *f, int w, int h)
 {
 	assert(f->w == w);
 	assert(f->h == h);
-	float (*x)[w][2] = (void*)xx;
-	FORJ(h) FORI(w) {
-		float p[2] = {i, j}, q[2];
-		apply_flow(q, f, p, 0);
-		FORL(2) x[j][i][l] = q[l] - p[l];
+	fill_flow_rows(xx, f, 0, h);
+}
+
+// positions of a flow model (for "warpcore"), for the rows starting at j0
+struct flow_model_positions { struct flow_model *f; bool inv; int j0; };
+
+static void flow_model_positions(float (*q)[2], int i0, int i1, int j, void *e)
+{
+	struct flow_model_positions *t = e;
+	for (int i = i0; i < i1; i++)
+	{
+		float p[2] = {i, j + t->j0};
+		apply_flow(q[i-i0], t->f, p, t->inv);
 	}
 }
 
+// "API"
+// morph the rows j0..j1-1 of an image according to a given flow model
+// (yy has (j1-j0) rows, the model is evaluated on the fly, tile by tile)
+static void transform_rows(float *yy, struct flow_model *f, float *xx,
+		int w, int h, int pd, bool inv, int j0, int j1)
+{
+	assert(f->w == w);
+	assert(f->h == h);
+	struct flow_model_positions t = {f, inv, j0};
+	getsample_operator P = get_sample_operator(getsample_0);
+	warpcore(yy, w, j1 - j0, xx, w, h, pd, WARPCORE_BILINEAR, P,
+			flow_model_positions, &t);
+}
+
 // "API"
 // morph an image according to a given flow model
 static void transform_back(float *yy, struct flow_model *f, float *xx,
 							int w, int h, int pd)
 {
-	float (*y)[w][pd] = (void *)yy;
-	assert(f->w == w);
-	assert(f->h == h);
-	FORJ(h) FORI(w) {
-		float p[2] = {i, j}, q[2];
-		apply_flow(q, f, p, 0);
-		float val[pd];
-		general_interpolate(val, xx, w, h, pd, q[0], q[1], 2);
-		FORL(pd)
-			y[j][i][l] = val[l];
-	}
+	transform_rows(yy, f, xx, w, h, pd, false, 0, h);
 }
 
 // "API"
 static void transform_forward(float *yy, struct flow_model *f, float *xx,
 							int w, int h, int pd)
 {
-	float (*y)[w][pd] = (void *)yy;
-	assert(f->w == w);
-	assert(f->h == h);
-	FORJ(h) FORI(w) {
-		float p[2] = {i, j}, q[2];
-		apply_flow(q, f, p, 1);
-		float val[pd];
-		general_interpolate(val, xx, w, h, pd, q[0], q[1], 2);
-		FORL(pd)
-			y[j][i][l] = val[l];
-	}
+	transform_rows(yy, f, xx, w, h, pd, true, 0, h);
 }
 
 
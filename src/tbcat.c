@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "iio.h"
@@ -5,11 +6,13 @@
 #include "xmalloc.c"
 #include "getpixel.c"
 #include "pickopt.c"
+#include "catstream.c"
 
 #define BAD_MAX(a,b) (a)<(b)?(b):(a);
 
 #include "smapa.h"
 SMART_PARAMETER_SILENT(BACKGROUND,0)
+SMART_PARAMETER_SILENT(CAT_BAND_MB,64)
 
 int main_tbcat_two(int c, char *v[])
 {
@@ -72,6 +75,7 @@ static char *help_string_long     =
 "\n"
 "Environment:\n"
 " BACKGROUND\tvalue to fill the background when images have different width\n"
+" CAT_BAND_MB\tmemory of the bands of rows that are copied (default 64)\n"
 "\n"
 "Examples:\n"
 " tbcat lena.png lena.png -o twolenas.png            duplicate an image\n"
@@ -91,33 +95,52 @@ int main_tbcat(int c, char *v[])
 		filename[i] = v[i+1];
 	filename[n] = filename_out;
 
-	int w[n+1], h[n+1], pd[n+1];
-	float *x[n+1];
-	w[n] = h[n] = pd[n] = 0;
+	if (n < 1) {
+		fprintf(stderr, "%s", help_string_usage);
+		return 1;
+	}
+
+	// sizes of the inputs and of the output
+	struct cat_input *x = xmalloc(n * sizeof*x);
+	int w = 0, h = 0, pd = 0;
 	for (int k = 0; k < n; k++)
 	{
-		x[k] = iio_read_image_float_vec(filename[k], w+k, h+k, pd+k);
-		w[n] = BAD_MAX(w[n], w[k]);
-		h[n] += h[k];
-		pd[n] = BAD_MAX(pd[n], pd[k]);
+		cat_input_info(x + k, filename[k]);
+		w = BAD_MAX(w, x[k].w);
+		h += x[k].h;
+		pd = BAD_MAX(pd, x[k].pd);
 	}
-	x[n] = xmalloc(w[n] * h[n] * pd[n] * sizeof(x[0][0]));
-	for (int i = 0; i < w[n] * h[n] * pd[n]; i++)
-		x[n][i] = BACKGROUND();
 
-	int ok = 0;
+	// the inputs are copied one after the other, by bands of rows
+	int band = cat_band_height(CAT_BAND_MB(), w, h, pd);
+	float *y = xmalloc(w * (size_t)band * pd * sizeof*y);
+	float bg = BACKGROUND();
+	struct iio_ostream *o = iio_create(filename[n], w, h, pd);
 	for (int k = 0; k < n; k++)
 	{
-		for (int j = 0; j < h[k]; j++)
-		for (int i = 0; i < w[k]; i++)
-		for (int l = 0; l < pd[2]; l++) {
-			float s = getsample_1(x[k], w[k], h[k], pd[k], i, j, l);
-			setsample_0(x[n], w[n], h[n], pd[n], i, j+ok, l, s);
+		cat_input_open(x + k, band);
+		for (int j0 = 0; j0 < x[k].h; j0 += band)
+		{
+			int r = iio_read_rows(x[k].s, x[k].band, j0, band);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+			for (int j = 0; j < r; j++)
+			{
+				float *yj = y + j * (size_t)w * pd;
+				cat_pixels(yj, pd, x[k].band +
+						j * (size_t)x[k].w * x[k].pd,
+						x[k].pd, x[k].w);
+				cat_fill(yj + x[k].w * (size_t)pd,
+						(w - x[k].w) * (size_t)pd, bg);
+			}
+			iio_write_rows(o, y, r);
 		}
-		ok += h[k];
+		cat_input_close(x + k);
 	}
-
-	iio_write_image_float_vec(filename[n], x[n], w[n], h[n], pd[n]);
+	iio_finish(o);
+	free(y);
+	free(x);
 	return 0;
 }
 
@@ -0,0 +1,146 @@
+#ifndef _THREADS_C
+#define _THREADS_C
+
+// placement of the threads, and of the memory of the parallel kernels
+//
+// On machines with several memory nodes (e.g., with two sockets), each page
+// of memory lives on the node of the thread that touches it first, and the
+// threads of the other nodes access it with a lower bandwidth.  Thus, the
+// big buffers are initialized in parallel, by rows, with the static schedule
+// of OpenMP, so that the kernels that run afterwards over the same rows with
+// "#pragma omp parallel for schedule(static)" find each row on the node of
+// the thread that processes it.  Successive stages keep their rows on the
+// same threads when they all use the static schedule over the same number
+// of rows.  (The static partition depends only on the number of iterations
+// and of threads; the standard guarantees it within a parallel region, and
+// the usual runtimes keep it between regions.)
+//
+// The threads can still migrate between the nodes, unless they are pinned.
+// The environment variable IMSCRIPT_PIN pins each thread of OpenMP to one
+// of the allowed processors, at the first call of "threads_pin":
+//
+// 	IMSCRIPT_PIN=compact   the thread t on the t-th processor
+// 	IMSCRIPT_PIN=spread    the threads evenly spread over the processors
+//
+// When OMP_PROC_BIND is set, the placement is left to the runtime.  The
+// pinning is only available on linux.
+//
+// This file needs a function "xmalloc" (e.g., from xmalloc.c).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define THREADS_MAXCPU 1024 // size of the affinity masks
+
+// number of memory nodes of the machine (1 when unknown)
+static int threads_nodes(void)
+{
+	static int n = 0;
+	if (!n) {
+		int k = 1;
+#ifdef __linux__
+		char s[64];
+		for (; k < 1024; k++)
+		{
+			snprintf(s, sizeof s, "/sys/devices/system/node/node%d", k);
+			if (access(s, F_OK))
+				break;
+		}
+#endif
+		n = k;
+	}
+	return n;
+}
+
+#ifdef __linux__
+// pin the calling thread to the processor p (the raw system calls avoid
+// the need of _GNU_SOURCE for the masks of sched.h)
+static void threads_pin_to(int p)
+{
+	unsigned long m[THREADS_MAXCPU / (8 * sizeof(long))] = {0};
+	int b = 8 * sizeof*m;
+	m[p / b] |= 1ul << (p % b);
+	if (syscall(SYS_sched_setaffinity, 0, sizeof m, m))
+		fprintf(stderr, "warning: could not pin a thread to cpu %d\n",p);
+}
+#endif
+
+// pin the threads of OpenMP, as requested by IMSCRIPT_PIN (only the first
+// call does something)
+static void threads_pin(void)
+{
+	static int done = 0;
+	if (done) return;
+	done = 1;
+	char *e = getenv("IMSCRIPT_PIN");
+	if (!e || !*e || getenv("OMP_PROC_BIND")) return;
+	int spread = !strcmp(e, "spread");
+	if (!spread && strcmp(e, "compact"))
+		fprintf(stderr, "warning: IMSCRIPT_PIN=%s is not \"compact\" "
+				"or \"spread\", using \"compact\"\n", e);
+#if defined(__linux__) && defined(_OPENMP)
+	// the allowed processors, in order
+	unsigned long m[THREADS_MAXCPU / (8 * sizeof(long))] = {0};
+	if (syscall(SYS_sched_getaffinity, 0, sizeof m, m) <= 0) return;
+	int cpu[THREADS_MAXCPU], ncpu = 0, b = 8 * sizeof*m;
+	for (int p = 0; p < THREADS_MAXCPU; p++)
+		if (m[p / b] & (1ul << (p % b)))
+			cpu[ncpu++] = p;
+	if (!ncpu) return;
+#pragma omp parallel
+	{
+		int t = omp_get_thread_num(), n = omp_get_num_threads();
+		int k = spread && n < ncpu ? t * (long)ncpu / n : t % ncpu;
+		threads_pin_to(cpu[k]);
+	}
+#endif
+}
+
+// allocate h rows of "row" bytes, zeroed in parallel by the threads that
+// process them with the static schedule
+static void *threads_alloc_rows(int h, size_t row)
+{
+	char *x = xmalloc(h * row);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int j = 0; j < h; j++)
+		memset(x + j * row, 0, row);
+	return x;
+}
+
+// copy h rows of "row" bytes, in parallel with the static schedule
+static void threads_copy_rows(void *y, const void *x, int h, size_t row)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for (int j = 0; j < h; j++)
+		memcpy((char *)y + j * row, (const char *)x + j * row, row);
+}
+
+// an image read by a single thread has all its pages on one node; on the
+// machines with several nodes, it is moved (by rows) to the nodes of the
+// threads that will process it, and the old buffer is freed
+static void *threads_spread_rows(void *x, int h, size_t row)
+{
+	if (threads_nodes() < 2 || h < 2)
+		return x;
+	void *y = xmalloc(h * row);
+	threads_copy_rows(y, x, h, row);
+	free(x);
+	return y;
+}
+
+#endif//_THREADS_C
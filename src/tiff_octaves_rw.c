@@ -2,6 +2,7 @@
 #define TIFF_OCTAVES_RW_C
 
 #include <assert.h>
+#include <errno.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -10,8 +11,20 @@
 #include <string.h>
 #include <stdarg.h>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <tiffio.h>
 
+#include "bitpack.c"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 // structs {{{1
 
@@ -29,7 +42,7 @@ struct tiff_info {
 	int16_t bps; // bits per sample
 	int16_t fmt; // sample format
 	bool broken; // whether pixels are contiguous or broken
-	bool packed; // whether bps=1,2 or 4
+	bool packed; // whether bps=1,2 or 4 (the cached tiles are unpacked)
 	bool tiled;  // whether data is organized into tiles
 	bool compressed;
 	int ntiles;
@@ -111,14 +124,327 @@ static int my_computetile(struct tiff_info *t, int i, int j)
 }
 
 
+// remote files {{{1
+
+// TIFF files given by an URL ("http://", "https://" or "s3://") are read by
+// range requests, via the "curl" program.  The reads are done in aligned
+// blocks, which are kept in a small global cache: the headers and the tile
+// offsets are fetched only once, and the consecutive missing blocks of a
+// read are fetched by a single request.  Tiles are read individually, and
+// several threads may fetch at the same time (see "tiff_octaves_prefetch").
+//
+// The "s3://bucket/key" names are accessed through the public https
+// endpoint of the bucket (for private objects, use a presigned https URL).
+
+#define REMOTE_BLOCK 65536 // size of the cached blocks
+#define REMOTE_BLOCKS 512  // number of cached blocks
+#define REMOTE_FILES 64    // number of different remote files
+
+struct remote_file {
+	char url[FILENAME_MAX];
+	long size;
+};
+
+struct remote_block {
+	int file;      // index on the table of files (-1 = empty)
+	long index;    // position of the block on the file, in blocks
+	long stamp;    // time of the last access, for eviction
+	char *data;
+};
+
+static struct remote_file global_remote_files[REMOTE_FILES];
+static int global_remote_nfiles;
+static struct remote_block global_remote_blocks[REMOTE_BLOCKS];
+static long global_remote_clock;
+
+// data of an open remote TIFF
+struct remote_handle {
+	int file;
+	long pos;
+};
+
+static bool filename_is_remote(const char *n)
+{
+	return n == strstr(n, "http://") || n == strstr(n, "https://")
+		|| n == strstr(n, "s3://");
+}
+
+// the https URL of a remote filename
+static void remote_url(char *url, const char *n)
+{
+	if (n == strstr(n, "s3://")) {
+		const char *slash = strchr(n + 5, '/');
+		if (!slash) slash = n + strlen(n);
+		snprintf(url, FILENAME_MAX, "https://%.*s.s3.amazonaws.com%s",
+				(int)(slash - (n + 5)), n + 5, slash);
+	} else
+		snprintf(url, FILENAME_MAX, "%s", n);
+}
+
+// fill-in "out" with the bytes a..b of an URL, return whether it worked
+static bool remote_fetch(char *out, const char *url, long a, long b)
+{
+	char cmd[FILENAME_MAX + 100];
+	snprintf(cmd, sizeof cmd, "curl -s -f -L -r %ld-%ld '%s'", a, b, url);
+	FILE *p = popen(cmd, "r");
+	if (!p) return false;
+	long n = fread(out, 1, b - a + 1, p);
+	int r = pclose(p);
+	return r == 0 && n == b - a + 1;
+}
+
+// size of the file at an URL (-1 if it can not be accessed)
+static long remote_fetch_size(const char *url)
+{
+	char cmd[FILENAME_MAX + 100], line[1000];
+	snprintf(cmd, sizeof cmd, "curl -s -f -L -I '%s'", url);
+	FILE *p = popen(cmd, "r");
+	if (!p) return -1;
+	long size = -1;
+	while (fgets(line, sizeof line, p)) // the last one, after redirections
+		sscanf(line, "%*[Cc]ontent-%*[Ll]ength: %ld", &size);
+	int r = pclose(p);
+	return r ? -1 : size;
+}
+
+// index of a remote file on the table, adding it if necessary
+static int remote_file_id(const char *filename)
+{
+	char url[FILENAME_MAX];
+	remote_url(url, filename);
+	if (strchr(url, '\''))
+		return -1;
+	int r = -1;
+#ifdef _OPENMP
+#pragma omp critical(remote_blocks)
+#endif
+	for (int i = 0; i < global_remote_nfiles; i++)
+		if (0 == strcmp(url, global_remote_files[i].url))
+		{
+			r = i;
+			break;
+		}
+	if (r >= 0) return r;
+
+	long size = remote_fetch_size(url);
+	if (size < 0) return -1;
+#ifdef _OPENMP
+#pragma omp critical(remote_blocks)
+#endif
+	{
+		if (!global_remote_nfiles)
+			for (int i = 0; i < REMOTE_BLOCKS; i++)
+				global_remote_blocks[i].file = -1;
+		if (global_remote_nfiles < REMOTE_FILES) {
+			r = global_remote_nfiles++;
+			struct remote_file *f = global_remote_files + r;
+			snprintf(f->url, FILENAME_MAX, "%s", url);
+			f->size = size;
+		}
+	}
+	return r;
+}
+
+// copy a cached block, return whether it was there
+static bool remote_block_get(char *out, int file, long index)
+{
+	bool r = false;
+#ifdef _OPENMP
+#pragma omp critical(remote_blocks)
+#endif
+	for (int i = 0; i < REMOTE_BLOCKS; i++)
+	{
+		struct remote_block *b = global_remote_blocks + i;
+		if (b->file == file && b->index == index) {
+			memcpy(out, b->data, REMOTE_BLOCK);
+			b->stamp = ++global_remote_clock;
+			r = true;
+			break;
+		}
+	}
+	return r;
+}
+
+// put a block in the cache, in place of the oldest one
+static void remote_block_put(char *data, int file, long index)
+{
+#ifdef _OPENMP
+#pragma omp critical(remote_blocks)
+#endif
+	{
+		struct remote_block *v = global_remote_blocks;
+		for (int i = 0; i < REMOTE_BLOCKS; i++)
+		{
+			struct remote_block *b = global_remote_blocks + i;
+			if (b->file == file && b->index == index) {
+				v = NULL; // another thread was faster
+				break;
+			}
+			if (b->file < 0 || b->stamp < v->stamp)
+				v = b;
+			if (b->file < 0) break;
+		}
+		if (v) {
+			if (v->file < 0)
+				v->data = xmalloc(REMOTE_BLOCK);
+			memcpy(v->data, data, REMOTE_BLOCK);
+			v->file = file;
+			v->index = index;
+			v->stamp = ++global_remote_clock;
+		}
+	}
+}
+
+// read n bytes at position a of a remote file, return the number read
+static long remote_read(char *out, int file, long a, long n)
+{
+	struct remote_file *f = global_remote_files + file;
+	if (a < 0 || a >= f->size) return 0;
+	if (a + n > f->size) n = f->size - a;
+	if (n <= 0) return 0;
+	long b0 = a / REMOTE_BLOCK, b1 = (a + n - 1) / REMOTE_BLOCK;
+	long nb = b1 - b0 + 1;
+	char *buf = xmalloc(nb * REMOTE_BLOCK);
+	bool *have = xmalloc(nb * sizeof*have);
+	for (long k = 0; k < nb; k++)
+		have[k] = remote_block_get(buf + k * REMOTE_BLOCK, file, b0 + k);
+
+	// fetch the runs of missing blocks
+	bool ok = true;
+	for (long k = 0; ok && k < nb; k++)
+	{
+		if (have[k]) continue;
+		long m = k;
+		while (m + 1 < nb && !have[m + 1])
+			m += 1;
+		long p = (b0 + k) * REMOTE_BLOCK, q = (b0 + m + 1) * REMOTE_BLOCK;
+		if (q > f->size) q = f->size;
+		memset(buf + k * REMOTE_BLOCK, 0, (m - k + 1) * REMOTE_BLOCK);
+		ok = remote_fetch(buf + k * REMOTE_BLOCK, f->url, p, q - 1);
+		for (long i = k; ok && i <= m; i++)
+			remote_block_put(buf + i * REMOTE_BLOCK, file, b0 + i);
+		k = m;
+	}
+	if (ok)
+		memcpy(out, buf + (a - b0 * REMOTE_BLOCK), n);
+	free(have);
+	free(buf);
+	return ok ? n : -1;
+}
+
+static tmsize_t remote_readproc(thandle_t h, void *buf, tmsize_t n)
+{
+	struct remote_handle *r = (void*)h;
+	long m = remote_read(buf, r->file, r->pos, n);
+	if (m > 0) r->pos += m;
+	return m;
+}
+
+static tmsize_t remote_writeproc(thandle_t h, void *buf, tmsize_t n)
+{
+	(void)h; (void)buf; (void)n;
+	return -1;
+}
+
+static toff_t remote_seekproc(thandle_t h, toff_t off, int whence)
+{
+	struct remote_handle *r = (void*)h;
+	long size = global_remote_files[r->file].size;
+	if (whence == SEEK_SET) r->pos = off;
+	if (whence == SEEK_CUR) r->pos += off;
+	if (whence == SEEK_END) r->pos = size + off;
+	return r->pos;
+}
+
+static int remote_closeproc(thandle_t h)
+{
+	free(h);
+	return 0;
+}
+
+static toff_t remote_sizeproc(thandle_t h)
+{
+	struct remote_handle *r = (void*)h;
+	return global_remote_files[r->file].size;
+}
+
+static int remote_mapproc(thandle_t h, void **base, toff_t *size)
+{
+	(void)h; (void)base; (void)size;
+	return 0;
+}
+
+static void remote_unmapproc(thandle_t h, void *base, toff_t size)
+{
+	(void)h; (void)base; (void)size;
+}
+
+// open a TIFF file, that may be remote (only for reading)
+static TIFF *tiffopen_any(char *filename, char *mode)
+{
+	if (!filename_is_remote(filename))
+		return TIFFOpen(filename, mode);
+	if (*mode != 'r' || mode[1] == '+')
+		return NULL;
+	int file = remote_file_id(filename);
+	if (file < 0) return NULL;
+	struct remote_handle *h = xmalloc(sizeof*h);
+	h->file = file;
+	h->pos = 0;
+	TIFF *tif = TIFFClientOpen(filename, "rm", (thandle_t)h,
+			remote_readproc, remote_writeproc, remote_seekproc,
+			remote_closeproc, remote_sizeproc,
+			remote_mapproc, remote_unmapproc);
+	if (!tif) free(h);
+	return tif;
+}
+
+// opening tiff files {{{1
+
+#define MAX_SUBIFDS 32
+
+// whether the current directory of a TIFF file is a transparency mask
+static bool tiff_is_mask(TIFF *tif)
+{
+	uint32_t t = 0;
+	TIFFGetField(tif, TIFFTAG_SUBFILETYPE, &t);
+	return t & FILETYPE_MASK;
+}
+
+// go to the n-th resolution level of a TIFF file open at its first image
+//
+// The levels are the images of the main chain of directories, skipping the
+// transparency masks (as in the internal overviews created by GDAL).  After
+// the end of the chain, the levels continue on the SubIFDs of the first
+// image.
+static bool tiff_set_level(TIFF *tif, int n)
+{
+	uint16_t nsub = 0;
+	uint64_t *p, sub[MAX_SUBIFDS];
+	if (TIFFGetField(tif, TIFFTAG_SUBIFD, &nsub, &p))
+		for (int i = 0; i < nsub && i < MAX_SUBIFDS; i++)
+			sub[i] = p[i];
+	if (nsub > MAX_SUBIFDS) nsub = MAX_SUBIFDS;
+
+	int k = 0;
+	while (k < n && TIFFReadDirectory(tif))
+		if (!tiff_is_mask(tif))
+			k += 1;
+	for (int i = 0; k < n && i < nsub; i++)
+		if (TIFFSetSubDirectory(tif, sub[i]) && !tiff_is_mask(tif))
+			k += 1;
+	return k == n;
+}
+
 // open a TIFF file, with some magic to access subimages
-// (i.e., filename "file.tif,3" refers to the third sub-image)
+// (i.e., filename "file.tif,3" refers to the third resolution level, see
+// "tiff_set_level" above)
 static TIFF *tiffopen_fancy(char *filename, char *mode)
 {
 	//fprintf(stderr, "tiffopen fancy \"%s\",\"%s\"\n", filename, mode);
 	char *comma = strrchr(filename, ',');
 	if (*mode != 'r' || !comma)
-	def:	return TIFFOpen(filename, mode);
+	def:	return tiffopen_any(filename, mode);
 
 	int aftercomma = strlen(comma + 1);
 	int ndigits = strspn(comma + 1, "0123456789");
@@ -131,10 +457,12 @@ static TIFF *tiffopen_fancy(char *filename, char *mode)
 	*comma = '\0';
 	int index = atoi(comma + 1);
 
-	TIFF *tif = TIFFOpen(buf, mode);
+	TIFF *tif = tiffopen_any(buf, mode);
 	if (!tif) return tif;
-	for (int i = 0; i < index; i++)
-		TIFFReadDirectory(tif);
+	if (!tiff_set_level(tif, index)) { // there is no such sub-image
+		TIFFClose(tif);
+		return NULL;
+	}
 
 	return tif;
 }
@@ -308,22 +636,28 @@ static void read_scanlines(struct tiff_tile *tout, TIFF *tif)
 	tout->spp = tinfo->spp;
 	tout->broken = false;
 
-	// define useful constants
-	int pixel_size = tinfo->spp * tinfo->bps/8;
+	// define useful constants (packed samples are unpacked to bytes)
+	int bps = tinfo->packed ? 8 : tinfo->bps;
+	int pixel_size = tinfo->spp * bps/8;
 	int output_size = tout->w * tout->h * pixel_size;
+	tout->bps = bps;
 
 	// allocate space for output data
 	tout->data = xmalloc(output_size);
 
 	// copy scanlines
 	int scanline_size = TIFFScanlineSize(tif);
-	assert(scanline_size == tinfo->w * pixel_size);
+	int n = tinfo->w * tinfo->spp;
+	uint8_t *pbuf = tinfo->packed ? xmalloc(scanline_size) : NULL;
+	if (!pbuf) assert(scanline_size == tinfo->w * pixel_size);
 	for (int j = 0; j < tinfo->h; j++)
 	{
-		uint8_t *buf = tout->data + scanline_size*j;
-		int r = TIFFReadScanline(tif, buf, j, 0);
+		uint8_t *buf = tout->data + tinfo->w * pixel_size * j;
+		int r = TIFFReadScanline(tif, pbuf ? pbuf : buf, j, 0);
 		if (r < 0) fail("could not read scanline %d", j);
+		if (pbuf) bitpack_unpack(buf, pbuf, n, tinfo->bps);
 	}
+	free(pbuf);
 }
 
 static tsize_t my_readtile(TIFF *tif, tdata_t buf,
@@ -373,6 +707,17 @@ static void read_tile_from_file(struct tiff_tile *t, char *filename, int tidx)
 		memset(t->data, 0, tbytes);
 		int r = my_readtile(tif, t->data, ii[0], ii[1], 0, 0);
 		if (r != tbytes) fail("could not read tile");
+
+		// packed samples are cached as bytes
+		if (bps < 8) {
+			int n = t->w * spp, row = (n * bps + 7) / 8;
+			uint8_t *u = xmalloc(n * t->h);
+			for (int j = 0; j < t->h; j++)
+				bitpack_unpack(u + j*n, t->data + j*row, n, bps);
+			free(t->data);
+			t->data = u;
+			t->bps = 8;
+		}
 	} else { // not tiled, read the whole image into 0th tile
 		read_scanlines(t, tif);
 	}
@@ -380,16 +725,11 @@ static void read_tile_from_file(struct tiff_tile *t, char *filename, int tidx)
 	TIFFClose(tif);
 }
 
-// overwrite a tile on an existing tiled TIFF image
-static void put_tile_into_file(char *filename, struct tiff_tile *t, int tidx)
+// overwrite a tile on a tiled TIFF image opened for writing
+static void put_tile_into_tiff(TIFF *tif, struct tiff_tile *t, int tidx)
 {
 	if (t->broken) fail("can not save broken tiles yet");
 
-	// Note, the mode "r+" is officially undocumented, but its behaviour is
-	// described on file tif_open.c from libtiff.
-	TIFF *tif = tiffopen_fancy(filename, "r+");
-	if (!tif) fail("could not open TIFF file \"%s\" for writing", filename);
-
 	int tw = tiff_tilewidth(tif);
 	int th = tiff_tilewidth(tif);
 	int spp = tiff_samplesperpixel(tif);
@@ -398,15 +738,33 @@ static void put_tile_into_file(char *filename, struct tiff_tile *t, int tidx)
 	if (tw != t->w) fail("tw=%d different to t->w=%d", tw, t->w);
 	if (th != t->h) fail("th=%d different to t->h=%d", th, t->h);
 	if (spp != t->spp) fail("spp=%d different to t->spp=%d", spp, t->spp);
-	if (bps != t->bps) fail("bps=%d different to t->bps=%d", bps, t->bps);
-	if (spp != t->spp) fail("spp=%d different to t->spp=%d", spp, t->spp);
+	bool pack = bps < 8 && t->bps == 8; // the cached tile is unpacked
+	if (bps != t->bps && !pack)
+		fail("bps=%d different to t->bps=%d", bps, t->bps);
 
 	int ii[2];
 	int r = tiff_tile_corner(ii, tif, tidx);
 	if (!r) fail("bad tile %d", tidx);
 
-	r = TIFFWriteTile(tif, t->data, ii[0], ii[1], 0, 0);
+	uint8_t *data = t->data;
+	if (pack) {
+		int n = t->w * spp, row = (n * bps + 7) / 8;
+		data = xmalloc(row * t->h);
+		for (int j = 0; j < t->h; j++)
+			bitpack_pack(data + j*row, t->data + j*n, n, bps);
+	}
+	r = TIFFWriteTile(tif, data, ii[0], ii[1], 0, 0);
+	if (pack) free(data);
+}
 
+// overwrite a tile on an existing tiled TIFF image
+static void put_tile_into_file(char *filename, struct tiff_tile *t, int tidx)
+{
+	// Note, the mode "r+" is officially undocumented, but its behaviour is
+	// described on file tif_open.c from libtiff.
+	TIFF *tif = tiffopen_fancy(filename, "r+");
+	if (!tif) fail("could not open TIFF file \"%s\" for writing", filename);
+	put_tile_into_tiff(tif, t, tidx);
 	TIFFClose(tif);
 }
 
@@ -470,9 +828,496 @@ static void create_zero_tiff_file(char *filename, int w, int h,
 
 
 
+// copying tiles {{{1
+
+// crop a tiled TIFF file at a rectangle that starts at the corner of a tile
+//
+// The output has the same tiles and codec as the input.  The tiles that are
+// whole in the output are copied without decoding them, and only the
+// partial tiles at the right and bottom edges are decoded and re-encoded.
+// Returns false, without doing anything, if the file can not be cropped
+// this way.
+static bool tiff_crop_tiles(char *fname_out, char *fname_in,
+		int x0, int y0, int w, int h)
+{
+	TIFF *tif = tiffopen_fancy(fname_in, "r");
+	if (!tif) return false;
+	struct tiff_info t[1];
+	get_tiff_info(t, tif);
+	uint16_t compression, predictor = PREDICTOR_NONE;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	if (!t->tiled || t->broken || t->packed
+			|| compression == COMPRESSION_JPEG
+			|| compression == COMPRESSION_OJPEG
+			|| w < 1 || h < 1 || x0 < 0 || y0 < 0
+			|| x0 % t->tw || y0 % t->th
+			|| x0 + w > t->w || y0 + h > t->h) {
+		TIFFClose(tif);
+		return false;
+	}
+	if (compression != COMPRESSION_NONE)
+		TIFFGetFieldDefaulted(tif, TIFFTAG_PREDICTOR, &predictor);
+
+	int ps = (t->spp * t->bps) / 8;
+	double gigabytes = ps * (double)w * h / 1e9;
+	TIFF *tout = TIFFOpen(fname_out, gigabytes > 1 ? "w8" : "w");
+	if (!tout) fail("could not open TIFF file \"%s\" for writing", fname_out);
+	TIFFSetField(tout, TIFFTAG_IMAGEWIDTH,      w);
+	TIFFSetField(tout, TIFFTAG_IMAGELENGTH,     h);
+	TIFFSetField(tout, TIFFTAG_SAMPLESPERPIXEL, t->spp);
+	TIFFSetField(tout, TIFFTAG_BITSPERSAMPLE,   t->bps);
+	TIFFSetField(tout, TIFFTAG_SAMPLEFORMAT,    t->fmt);
+	TIFFSetField(tout, TIFFTAG_PLANARCONFIG,    PLANARCONFIG_CONTIG);
+	TIFFSetField(tout, TIFFTAG_TILEWIDTH,       t->tw);
+	TIFFSetField(tout, TIFFTAG_TILELENGTH,      t->th);
+	TIFFSetField(tout, TIFFTAG_COMPRESSION,     compression);
+	if (predictor != PREDICTOR_NONE)
+		TIFFSetField(tout, TIFFTAG_PREDICTOR, predictor);
+
+	uint64_t *cnt;
+	TIFFGetField(tif, TIFFTAG_TILEBYTECOUNTS, &cnt);
+	int tilesize = t->tw * t->th * ps;
+	uint8_t *buf = xmalloc(tilesize);
+	for (int j = 0; j < h; j += t->th)
+	for (int i = 0; i < w; i += t->tw)
+	{
+		int tidx_in = TIFFComputeTile(tif, x0 + i, y0 + j, 0, 0);
+		int tidx_out = TIFFComputeTile(tout, i, j, 0, 0);
+
+		// a tile is whole if it has the same pixels in both images
+		bool whole_x = i + t->tw <= w || x0 + w == t->w;
+		bool whole_y = j + t->th <= h || y0 + h == t->h;
+		if (whole_x && whole_y) {
+			uint8_t *raw = xmalloc(cnt[tidx_in] ? cnt[tidx_in] : 1);
+			tmsize_t r = TIFFReadRawTile(tif, tidx_in, raw,
+					cnt[tidx_in]);
+			if (r < 0 || TIFFWriteRawTile(tout, tidx_out, raw, r) < 0)
+				fail("could not copy tile %d", tidx_in);
+			free(raw);
+			continue;
+		}
+
+		// partial tile: decode it, and clear the pixels outside
+		my_readtile(tif, buf, x0 + i, y0 + j, 0, 0);
+		for (int jj = 0; jj < t->th; jj++)
+		for (int ii = 0; ii < t->tw; ii++)
+			if (i + ii >= w || j + jj >= h)
+				memset(buf + (jj * t->tw + ii) * ps, 0, ps);
+		if (TIFFWriteEncodedTile(tout, tidx_out, buf, tilesize) < 0)
+			fail("could not write tile %d", tidx_out);
+	}
+	free(buf);
+	TIFFClose(tout);
+	TIFFClose(tif);
+	return true;
+}
+
+
+
+// raw tile reads {{{1
+
+// The tiles of a local tiled file can be read without libtiff doing the
+// I/O.  The offsets and the byte counts of the tiles are read once, when
+// the file is first accessed.  Then, the compressed bytes of a batch of
+// tiles are read by a single submission to io_uring (with a fallback to
+// preads in parallel, when io_uring is not available), and the tiles are
+// decoded in parallel by "TIFFReadFromUserBuffer".  The decoders are libtiff
+// handles on the file, opened once and reused by the following reads (a
+// handle is used by a single thread at a time).
+//
+// TIFF_OCTAVES_RAW=0     read the tiles by TIFFReadTile, as before
+// TIFF_OCTAVES_URING=0   do not use io_uring, only preads
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define TIFF_OCTAVES_URING
+#endif
+#endif
+#endif
+
+#define RAWTILES_HANDLES 64 // decoders kept open for each file
+#define RAWTILES_QUEUE 64   // reads in flight on io_uring
+
+struct tiff_rawtiles {
+	int fd;            // the file (-1 = no raw reads, -2 = not yet tried)
+	char *filename;    // (for opening the decoders)
+	int ntiles;
+	uint64_t *off;     // position of each compressed tile in the file
+	uint64_t *len;     // its size (0 = missing tile)
+	tmsize_t tbytes;   // size of a decoded tile
+	int32_t tw, th;
+	int16_t spp, bps, fmt;
+	int nh;            // decoders that are not in use
+	TIFF *h[RAWTILES_HANDLES];
+};
+
+static bool env_is_zero(const char *name)
+{
+	char *s = getenv(name);
+	return s && !atoi(s);
+}
+
+// the name of the file, without the ",n" suffix of tiffopen_fancy
+static void tiff_base_filename(char *out, const char *filename)
+{
+	snprintf(out, FILENAME_MAX, "%s", filename);
+	char *comma = strrchr(out, ',');
+	if (comma && comma[1] && strlen(comma+1) == strspn(comma+1, "0123456789"))
+		*comma = '\0';
+}
+
+// read the positions of the tiles (returns false if it is not possible)
+static bool rawtiles_open(struct tiff_rawtiles *r, char *filename)
+{
+	r->fd = -1;
+	if (filename_is_remote(filename) || env_is_zero("TIFF_OCTAVES_RAW"))
+		return false;
+	TIFF *tif = tiffopen_fancy(filename, "r");
+	if (!tif) return false;
+	uint16_t planarity, spp, bps, fmt;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG,    &planarity);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &spp);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE,   &bps);
+	TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT,    &fmt);
+	if (!TIFFIsTiled(tif) || planarity != PLANARCONFIG_CONTIG) {
+		TIFFClose(tif);
+		return false;
+	}
+	char base[FILENAME_MAX];
+	tiff_base_filename(base, filename);
+	int fd = open(base, O_RDONLY);
+	if (fd < 0) {
+		TIFFClose(tif);
+		return false;
+	}
+	r->filename = filename;
+	r->ntiles = TIFFNumberOfTiles(tif);
+	r->off = xmalloc((r->ntiles + 1) * sizeof*r->off);
+	r->len = xmalloc((r->ntiles + 1) * sizeof*r->len);
+	for (int i = 0; i < r->ntiles; i++)
+	{
+		r->off[i] = TIFFGetStrileOffset(tif, i);
+		r->len[i] = TIFFGetStrileByteCount(tif, i);
+	}
+	r->tbytes = TIFFTileSize(tif);
+	r->tw = tiff_tilewidth(tif);
+	r->th = tiff_tilelength(tif);
+	r->spp = spp;
+	r->bps = bps;
+	r->fmt = fmt;
+	r->h[0] = tif; // the first decoder
+	r->nh = 1;
+	r->fd = fd;
+	return true;
+}
+
+static void rawtiles_close(struct tiff_rawtiles *r)
+{
+	if (r->fd < 0) return;
+	for (int k = 0; k < r->nh; k++)
+		TIFFClose(r->h[k]);
+	xfree(r->off);
+	xfree(r->len);
+	close(r->fd);
+	r->fd = -1;
+}
+
+// take a decoder (NULL if it can not be opened)
+static TIFF *rawtiles_decoder(struct tiff_rawtiles *r)
+{
+	TIFF *h = NULL;
+#ifdef _OPENMP
+#pragma omp critical(tiff_rawtiles)
+#endif
+	if (r->nh)
+		h = r->h[--r->nh];
+	return h ? h : tiffopen_fancy(r->filename, "r");
+}
+
+// give back a decoder
+static void rawtiles_release(struct tiff_rawtiles *r, TIFF *h)
+{
+	if (!h) return;
+#ifdef _OPENMP
+#pragma omp critical(tiff_rawtiles)
+#endif
+	if (r->nh < RAWTILES_HANDLES) {
+		r->h[r->nh++] = h;
+		h = NULL;
+	}
+	if (h) TIFFClose(h);
+}
+
+// read n bytes at the offset "off", returns whether they were all read
+static bool pread_all(int fd, uint8_t *buf, uint64_t n, uint64_t off)
+{
+	while (n > 0) {
+		ssize_t r = pread(fd, buf, n, off);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		buf += r;
+		off += r;
+		n -= r;
+	}
+	return true;
+}
+
+#ifdef TIFF_OCTAVES_URING
+// a minimal io_uring, through the raw system calls
+struct raw_uring {
+	int fd;
+	unsigned entries;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	void *sq, *cq;
+	size_t sq_size, cq_size, sqe_size;
+};
+
+static void raw_uring_exit(struct raw_uring *u)
+{
+	if (u->sq && u->sq != MAP_FAILED) munmap(u->sq, u->sq_size);
+	if (u->cq && u->cq != MAP_FAILED) munmap(u->cq, u->cq_size);
+	if (u->sqe && (void*)u->sqe != MAP_FAILED) munmap(u->sqe, u->sqe_size);
+	close(u->fd);
+}
+
+static bool raw_uring_init(struct raw_uring *u, unsigned entries)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof p);
+	memset(u, 0, sizeof*u);
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0) return false;
+	u->entries = p.sq_entries;
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	int prot = PROT_READ | PROT_WRITE, flags = MAP_SHARED | MAP_POPULATE;
+	u->sq = mmap(0, u->sq_size, prot, flags, u->fd, IORING_OFF_SQ_RING);
+	u->cq = mmap(0, u->cq_size, prot, flags, u->fd, IORING_OFF_CQ_RING);
+	u->sqe = mmap(0, u->sqe_size, prot, flags, u->fd, IORING_OFF_SQES);
+	if (u->sq == MAP_FAILED || u->cq == MAP_FAILED
+			|| (void*)u->sqe == MAP_FAILED) {
+		raw_uring_exit(u);
+		return false;
+	}
+	char *s = u->sq, *c = u->cq;
+	u->sq_tail  = (void*)(s + p.sq_off.tail);
+	u->sq_mask  = (void*)(s + p.sq_off.ring_mask);
+	u->sq_array = (void*)(s + p.sq_off.array);
+	u->cq_head  = (void*)(c + p.cq_off.head);
+	u->cq_tail  = (void*)(c + p.cq_off.tail);
+	u->cq_mask  = (void*)(c + p.cq_off.ring_mask);
+	u->cqe      = (void*)(c + p.cq_off.cqes);
+	return true;
+}
+
+// read the n buffers through io_uring, and set got[k] to the number of bytes
+// read into buf[k] (or to a negative error); returns false if the ring fails
+static bool raw_uring_read(int fd, uint8_t **buf, uint64_t *off,
+		uint64_t *len, int n, int64_t *got)
+{
+	struct raw_uring u[1];
+	if (!raw_uring_init(u, n < RAWTILES_QUEUE ? n : RAWTILES_QUEUE))
+		return false;
+	int next = 0, done = 0;
+	unsigned queued = 0, inflight = 0; // in the ring, and taken by the kernel
+	bool ok = true;
+	while (done < n && (ok || inflight))
+	{
+		// queue as many reads as the ring takes
+		unsigned tail = *u->sq_tail;
+		while (ok && next < n && inflight + queued < u->entries)
+		{
+			unsigned k = tail & *u->sq_mask;
+			struct io_uring_sqe *e = u->sqe + k;
+			memset(e, 0, sizeof*e);
+			e->opcode = IORING_OP_READ;
+			e->fd = fd;
+			e->addr = (uintptr_t)buf[next];
+			e->len = len[next];
+			e->off = off[next];
+			e->user_data = next;
+			u->sq_array[k] = k;
+			tail += 1;
+			next += 1;
+			queued += 1;
+		}
+		__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+		// submit them, and wait for at least one completion (after an
+		// error, only the reads taken by the kernel are waited for)
+		int r = syscall(__NR_io_uring_enter, u->fd, ok ? queued : 0, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && !ok)
+			break; // (the ring can not even be drained)
+		if (r < 0 || (r == 0 && !inflight))
+			ok = false;
+		if (r > 0 && ok) {
+			inflight += r;
+			queued -= r;
+		}
+		if (!ok && !inflight)
+			break;
+
+		unsigned head = *u->cq_head;
+		while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			struct io_uring_cqe *c = u->cqe + (head & *u->cq_mask);
+			got[c->user_data] = c->res;
+			head += 1;
+			inflight -= 1;
+			done += 1;
+		}
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+	raw_uring_exit(u);
+	return ok;
+}
+#endif//TIFF_OCTAVES_URING
+
+// read the compressed bytes of the n tiles idx[k] into raw[k], using n
+// threads for the preads
+static void rawtiles_read(struct tiff_rawtiles *r, int *idx, int n,
+		uint8_t **raw, int nthreads)
+{
+	uint64_t *off = xmalloc(n * sizeof*off), *len = xmalloc(n * sizeof*len);
+	int64_t *got = xmalloc(n * sizeof*got);
+	for (int k = 0; k < n; k++)
+	{
+		off[k] = r->off[idx[k]];
+		len[k] = r->len[idx[k]];
+		raw[k] = len[k] ? xmalloc(len[k]) : NULL;
+		got[k] = len[k] ? -1 : 0;
+	}
+
+#ifdef TIFF_OCTAVES_URING
+	static int uring = -1; // whether io_uring works, once known
+	if (uring && n > 1 && !env_is_zero("TIFF_OCTAVES_URING"))
+		if (!raw_uring_read(r->fd, raw, off, len, n, got))
+			uring = 0;
+#endif
+
+	// the reads that were not done (or that were short) still need preads
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+#endif
+	for (int k = 0; k < n; k++)
+		if (got[k] != (int64_t)len[k]) {
+			int64_t a = got[k] > 0 ? got[k] : 0;
+			if (!pread_all(r->fd, raw[k] + a, len[k] - a, off[k] + a)) {
+				xfree(raw[k]);
+				raw[k] = NULL; // (read as a missing tile)
+			}
+		}
+	(void)nthreads;
+	xfree(got);
+	xfree(len);
+	xfree(off);
+}
+
+// decode the compressed tile tidx (missing or broken tiles are zeros)
+static void rawtiles_decode(struct tiff_rawtiles *r, struct tiff_tile *t,
+		int tidx, uint8_t *raw)
+{
+	t->w = r->tw;
+	t->h = r->th;
+	t->spp = r->spp;
+	t->bps = r->bps;
+	t->fmt = r->fmt;
+	t->broken = false;
+	t->data = xmalloc(r->tbytes);
+	TIFF *h = raw ? rawtiles_decoder(r) : NULL;
+	if (!h || TIFFReadFromUserBuffer(h, tidx, raw, r->len[tidx],
+				t->data, r->tbytes) != 1)
+		memset(t->data, 0, r->tbytes);
+	rawtiles_release(r, h);
+
+	// packed samples are cached as bytes
+	if (t->bps < 8) {
+		int n = t->w * t->spp, row = (n * t->bps + 7) / 8;
+		uint8_t *u = xmalloc(n * t->h);
+		for (int j = 0; j < t->h; j++)
+			bitpack_unpack(u + j*n, t->data + j*row, n, t->bps);
+		xfree(t->data);
+		t->data = u;
+		t->bps = 8;
+	}
+}
+
+// read and decode the n tiles idx[k] into t[k], using n threads
+static void rawtiles_get(struct tiff_rawtiles *r, struct tiff_tile *t,
+		int *idx, int n, int nthreads)
+{
+	uint8_t **raw = xmalloc(n * sizeof*raw);
+	if (n == 1)
+		raw[0] = r->len[*idx] ? xmalloc(r->len[*idx]) : NULL;
+	if (n == 1 && raw[0] && !pread_all(r->fd, raw[0], r->len[*idx],
+				r->off[*idx])) {
+		xfree(raw[0]);
+		raw[0] = NULL;
+	}
+	if (n > 1)
+		rawtiles_read(r, idx, n, raw, nthreads);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic) if(n > 1)
+#endif
+	for (int k = 0; k < n; k++)
+	{
+		rawtiles_decode(r, t + k, idx[k], raw[k]);
+		if (raw[k]) xfree(raw[k]);
+	}
+	xfree(raw);
+}
+
+
 // getpixel cache with octaves {{{1
 
 #define MAX_OCTAVES 25
+struct tiff_octaves_link {
+	int po, pi; // previous (more recently used) tile, or -1
+	int no, ni; // next (less recently used) tile, or -1
+};
+
+// a part of the cache, with its own list of tiles and its own lock
+//
+// Each tile belongs to a fixed shard, so that threads accessing tiles of
+// different shards do not block each other.
+#define TIFF_OCTAVES_SHARDS 16
+struct tiff_octaves_shard {
+	int first_o, first_i; // most recently used tile (-1 if none)
+	int last_o, last_i;   // least recently used tile (-1 if none)
+	int curtiles;    // current number of tiles of this shard in memory
+	int maxtiles;    // number of tiles of this shard allowed in memory
+
+	// statistics
+	long hits;       // accesses to a tile already in memory
+	long misses;     // accesses that had to read a tile from the file
+	long evictions;  // tiles freed to make room for others
+	long bytes_read; // total size of the tiles read from the files
+	long shared_hits;// misses that were found in the shared cache
+
+#ifdef _OPENMP
+	omp_lock_t lock; // protects this shard and the tiles that belong to it
+#endif
+};
+
+// Thread safety: after initialization, the functions
+// "tiff_octaves_getsample_float" and "tiff_octaves_getpixel_float" can be
+// called concurrently from many threads.  They hold the lock of the shard
+// of the tile while they read it, so the tile can not be evicted while in
+// use.  The functions that return pointers into the tiles
+// ("tiff_octaves_gettile" and "tiff_octaves_getpixel"), the implicit
+// initialization and the writing of tiles are not thread-safe.  (After an
+// implicit initialization, the octaves are loaded on their first access;
+// call "tiff_octaves_has_octave" before accessing them from many threads.)
 struct tiff_octaves {
 	// essential data
 	//
@@ -485,13 +1330,28 @@ struct tiff_octaves {
 	bool option_read;
 	bool option_write;
 	bool *changed;
+	TIFF *wtif;      // writer handle, opened on the first write-back
+	bool wdirty;     // whether wtif has tiles not yet flushed to the file
 
 	// data only necessary to delete tiles when the memory is full
+	// (the cached tiles of each shard form a list, from the most to the
+	// least recently used one, and l[o][i] are the links of the i-th tile
+	// of octave o)
 	//
-	unsigned int *a[MAX_OCTAVES]; // access counter for each tile
-	unsigned int ax; // global access counter
-	int curtiles;    // current number of tiles in memory
+	bool lru;        // whether the number of tiles in memory is limited
+	struct tiff_octaves_link *l[MAX_OCTAVES];
 	int maxtiles;    // number of tiles allowed to be in memory at once
+	int nshards;
+	struct tiff_octaves_shard s[TIFF_OCTAVES_SHARDS];
+
+	// optional cache shared between processes (see "shared tile cache")
+	int shm_fd;
+	char *shm_base;  // mapped region, or NULL if not used
+	size_t shm_size;
+	uint64_t shm_key[MAX_OCTAVES]; // identity of each octave file
+
+	// positions of the tiles in each file (see "raw tile reads")
+	struct tiff_rawtiles raw[MAX_OCTAVES];
 };
 
 //#include "smapa.h"
@@ -511,12 +1371,330 @@ static void disable_tiff_warnings_and_errors(void)
 	TIFFSetErrorHandler(NULL);
 }
 
+static void init_tile_shards(struct tiff_octaves *t, int nshards)
+{
+	t->nshards = nshards;
+	for (int k = 0; k < t->nshards; k++)
+	{
+		struct tiff_octaves_shard *s = t->s + k;
+		s->first_o = s->first_i = s->last_o = s->last_i = -1;
+		s->curtiles = 0;
+		s->maxtiles = t->lru ? t->maxtiles / t->nshards : 0;
+		s->hits = s->misses = s->evictions = s->bytes_read = 0;
+		s->shared_hits = 0;
+#ifdef _OPENMP
+		omp_init_lock(&s->lock);
+#endif
+	}
+}
+
+static void init_tile_lru(struct tiff_octaves *t)
+{
+	t->lru = t->megabytes;
+	int nshards = 1;
+#ifdef _OPENMP
+	nshards = TIFF_OCTAVES_SHARDS;
+#endif
+	if (t->lru) {
+		int tilesize = t->i->tw * t->i->th * (t->i->bps/8) * t->i->spp;
+		double mbts = tilesize / (1024.0 * 1024);
+		t->maxtiles = t->megabytes / mbts;
+		if (t->maxtiles < 1)
+			t->maxtiles = 1;
+		//fprintf(stderr, "maxtiles = %d\n", t->maxtiles);
+		if (nshards > t->maxtiles)
+			nshards = t->maxtiles;
+	}
+	init_tile_shards(t, nshards);
+	t->shm_base = NULL;
+	t->wtif = NULL;
+	t->wdirty = false;
+	for (int o = 0; o < MAX_OCTAVES; o++)
+		t->raw[o].fd = -2;
+}
+
+// shared tile cache {{{2
+
+// The decoded tiles can also be kept in a POSIX shared memory object, so
+// that several processes that read the same files do not decode the same
+// tiles again.  This cache sits below the private cache of each process.
+//
+// The region is a set-associative table of slots, keyed by the identity of
+// the file and the index of the tile, and each set is evicted in LRU order.
+// Its geometry is fixed by the first process that creates it.  Accesses are
+// serialized by a flock on the object.  The object persists after the
+// processes end; it can be removed from /dev/shm.
+
+#define TIFF_OCTAVES_SHM_MAGIC 0x74696c6563616368ULL
+#define TIFF_OCTAVES_SHM_WAYS 8
+#define TIFF_OCTAVES_SHM_HEADER 64
+
+struct tiff_octaves_shm_header {
+	uint64_t magic;
+	int64_t nsets;      // number of sets of TIFF_OCTAVES_SHM_WAYS slots
+	int64_t slot_bytes; // maximum size of a tile
+	uint64_t clock;     // global access counter
+};
+
+struct tiff_octaves_shm_slot {
+	uint64_t key;       // identity of the file (0 = empty slot)
+	int64_t tidx;       // index of the tile
+	uint64_t stamp;     // time of the last access
+	int64_t nbytes;     // size of the tile data, that follows the slot
+};
+
+static size_t shm_slot_stride(int64_t slot_bytes)
+{
+	size_t n = sizeof(struct tiff_octaves_shm_slot) + slot_bytes;
+	return (n + 63) / 64 * 64;
+}
+
+static uint64_t fnv_hash(uint64_t h, const void *p, size_t n)
+{
+	const uint8_t *c = p;
+	for (size_t i = 0; i < n; i++)
+		h = (h ^ c[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+// identity of a file (device, inode, size and modification time)
+// (filenames like "file.tif,3" refer to a sub-image of "file.tif")
+static uint64_t tiff_octaves_file_key(char *filename)
+{
+	char buf[FILENAME_MAX];
+	snprintf(buf, FILENAME_MAX, "%s", filename);
+	char *sub = NULL;
+	struct stat s[1];
+	int r = stat(buf, s);
+	if (r && (sub = strrchr(buf, ','))) {
+		*sub = '\0';
+		r = stat(buf, s);
+		sub = filename + (sub - buf);
+	}
+	if (r) return 0;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	h = fnv_hash(h, &s->st_dev, sizeof s->st_dev);
+	h = fnv_hash(h, &s->st_ino, sizeof s->st_ino);
+	h = fnv_hash(h, &s->st_size, sizeof s->st_size);
+	h = fnv_hash(h, &s->st_mtime, sizeof s->st_mtime);
+	if (sub) h = fnv_hash(h, sub, strlen(sub));
+	return h ? h : 1;
+}
+
+// map the shared cache called "name", creating it if necessary
+// (if it can not be used, the octaves keep only their private cache)
+static bool tiff_octaves_attach_shm(struct tiff_octaves *t, char *name,
+		double megabytes)
+{
+	int64_t tilesize = t->i->tw * t->i->th * (t->i->bps/8) * t->i->spp;
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "WARNING: could not open shm \"%s\"\n", name);
+		return false;
+	}
+	flock(fd, LOCK_EX);
+	struct stat s[1];
+	fstat(fd, s);
+	size_t size = s->st_size;
+	bool create = size == 0;
+	int64_t stride = shm_slot_stride(tilesize);
+	int64_t nsets = megabytes * 1024 * 1024 / (stride*TIFF_OCTAVES_SHM_WAYS);
+	if (nsets < 1) nsets = 1;
+	if (create) {
+		size = TIFF_OCTAVES_SHM_HEADER + nsets*TIFF_OCTAVES_SHM_WAYS*stride;
+		if (ftruncate(fd, size))
+			size = 0;
+	}
+	char *p = size ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0) : MAP_FAILED;
+	struct tiff_octaves_shm_header *h = (void*)p;
+	if (p != MAP_FAILED && create) {
+		h->magic = TIFF_OCTAVES_SHM_MAGIC;
+		h->nsets = nsets;
+		h->slot_bytes = tilesize;
+		h->clock = 0;
+	}
+	flock(fd, LOCK_UN);
+	if (p == MAP_FAILED || h->magic != TIFF_OCTAVES_SHM_MAGIC
+			|| h->slot_bytes < tilesize
+			|| size < TIFF_OCTAVES_SHM_HEADER + h->nsets
+				* TIFF_OCTAVES_SHM_WAYS * shm_slot_stride(h->slot_bytes))
+	{
+		fprintf(stderr, "WARNING: can not use shm \"%s\" for tiles "
+				"of %g bytes\n", name, (double)tilesize);
+		if (p != MAP_FAILED) munmap(p, size);
+		close(fd);
+		return false;
+	}
+	t->shm_fd = fd;
+	t->shm_base = p;
+	t->shm_size = size;
+	for (int o = 0; o < t->noctaves; o++)
+		t->shm_key[o] = tiff_octaves_file_key(t->filename[o]);
+	return true;
+}
+
+static void tiff_octaves_detach_shm(struct tiff_octaves *t)
+{
+	if (!t->shm_base) return;
+	munmap(t->shm_base, t->shm_size);
+	close(t->shm_fd);
+	t->shm_base = NULL;
+}
+
+// first slot of the set of the i-th tile of octave o
+static struct tiff_octaves_shm_slot *shm_set(struct tiff_octaves *t,
+		int o, int i)
+{
+	struct tiff_octaves_shm_header *h = (void*)t->shm_base;
+	uint64_t k = fnv_hash(t->shm_key[o], &i, sizeof i) % h->nsets;
+	size_t offset = TIFF_OCTAVES_SHM_HEADER
+		+ k * TIFF_OCTAVES_SHM_WAYS * shm_slot_stride(h->slot_bytes);
+	return (void*)(t->shm_base + offset);
+}
+
+// k-th slot of a set
+static struct tiff_octaves_shm_slot *shm_way(struct tiff_octaves *t,
+		struct tiff_octaves_shm_slot *set, int k)
+{
+	struct tiff_octaves_shm_header *h = (void*)t->shm_base;
+	return (void*)(k * shm_slot_stride(h->slot_bytes) + (char*)set);
+}
+
+// copy the i-th tile of octave o from the shared cache, if it is there
+static bool tiff_octaves_shm_get(struct tiff_octaves *t, void *out,
+		int o, int i, int64_t nbytes)
+{
+	bool r = false;
+	if (!t->shm_key[o]) return r;
+#ifdef _OPENMP
+#pragma omp critical(tiff_octaves_shm)
+#endif
+	{
+		flock(t->shm_fd, LOCK_EX);
+		struct tiff_octaves_shm_header *h = (void*)t->shm_base;
+		struct tiff_octaves_shm_slot *set = shm_set(t, o, i);
+		for (int k = 0; k < TIFF_OCTAVES_SHM_WAYS; k++)
+		{
+			struct tiff_octaves_shm_slot *s = shm_way(t, set, k);
+			if (s->key == t->shm_key[o] && s->tidx == i
+					&& s->nbytes == nbytes)
+			{
+				memcpy(out, s + 1, nbytes);
+				s->stamp = ++h->clock;
+				r = true;
+				break;
+			}
+		}
+		flock(t->shm_fd, LOCK_UN);
+	}
+	return r;
+}
+
+// store the i-th tile of octave o in the shared cache
+static void tiff_octaves_shm_put(struct tiff_octaves *t, void *data,
+		int o, int i, int64_t nbytes)
+{
+	if (!t->shm_key[o]) return;
+#ifdef _OPENMP
+#pragma omp critical(tiff_octaves_shm)
+#endif
+	{
+		flock(t->shm_fd, LOCK_EX);
+		struct tiff_octaves_shm_header *h = (void*)t->shm_base;
+		struct tiff_octaves_shm_slot *set = shm_set(t, o, i), *v = NULL;
+		for (int k = 0; k < TIFF_OCTAVES_SHM_WAYS; k++)
+		{
+			struct tiff_octaves_shm_slot *s = shm_way(t, set, k);
+			if (s->key == t->shm_key[o] && s->tidx == i) {
+				v = NULL; // another process was faster
+				break;
+			}
+			if (!v || s->stamp < v->stamp)
+				v = s;
+		}
+		if (v && nbytes <= h->slot_bytes) {
+			v->key = t->shm_key[o];
+			v->tidx = i;
+			v->stamp = ++h->clock;
+			v->nbytes = nbytes;
+			memcpy(v + 1, data, nbytes);
+		}
+		flock(t->shm_fd, LOCK_UN);
+	}
+}
+
+// the raw reads of octave o, or NULL if they are not available (the tiles
+// written back to the first octave move in the file, so that this file is
+// always read by libtiff)
+static struct tiff_rawtiles *tiff_octaves_raw(struct tiff_octaves *t, int o)
+{
+	struct tiff_rawtiles *r = t->raw + o;
+	if (o == 0 && t->option_write)
+		return NULL;
+#ifdef _OPENMP
+#pragma omp critical(tiff_rawtiles_open)
+#endif
+	if (r->fd == -2)
+		rawtiles_open(r, t->filename[o]);
+	return r->fd >= 0 ? r : NULL;
+}
+
+// read the i-th tile of octave o, from the shared cache or from the file
+// (return whether it was found in the shared cache)
+static bool tiff_octaves_read_tile(struct tiff_octaves *t,
+		struct tiff_tile *tmp, int o, int i)
+{
+	// the tiles written back are only visible after a flush
+	if (o == 0 && t->wdirty) {
+		TIFFFlush(t->wtif);
+		t->wdirty = false;
+	}
+
+	struct tiff_info *ti = t->i + o;
+	bool shared = t->shm_base && ti->tiled;
+	int64_t nbytes = ti->tw * ti->th * (ti->bps/8) * ti->spp;
+	if (shared) {
+		tmp->w = ti->tw;
+		tmp->h = ti->th;
+		tmp->spp = ti->spp;
+		tmp->bps = ti->bps;
+		tmp->fmt = ti->fmt;
+		tmp->broken = false;
+		tmp->data = xmalloc(nbytes);
+		if (tiff_octaves_shm_get(t, tmp->data, o, i, nbytes))
+			return true;
+		xfree(tmp->data);
+	}
+	struct tiff_rawtiles *r = ti->tiled ? tiff_octaves_raw(t, o) : NULL;
+	if (r)
+		rawtiles_get(r, tmp, &i, 1, 1);
+	else
+		read_tile_from_file(tmp, t->filename[o], i);
+	if (shared)
+		tiff_octaves_shm_put(t, tmp->data, o, i, nbytes);
+	return false;
+}
+
+// initialization and access {{{2
+
+// the packed samples of 1, 2 or 4 bits are cached as bytes
+static void tiff_info_unpacked(struct tiff_info *t)
+{
+	if (!t->packed)
+		return;
+	if (t->bps != 1 && t->bps != 2 && t->bps != 4)
+		fail("caching of %d-bit samples is not supported", t->bps);
+	if (t->broken)
+		fail("caching of broken packed samples is not supported");
+	t->bps = 8;
+}
+
 static int load_one_octave_file(struct tiff_octaves *t, int o)
 {
 	if (!get_tiff_info_filename_e(t->i + o, t->filename[o]))
 		return 1;
-	if (t->i[o].bps < 8 || t->i[o].packed)
-		fail("caching of packed samples is not supported");
+	tiff_info_unpacked(t->i + o);
 
 	// set up essential data
 	t->c[o] = xmalloc((1 + t->i[o].ntiles) * sizeof*t->c);
@@ -532,21 +1710,8 @@ static int load_one_octave_file(struct tiff_octaves *t, int o)
 	fprintf(stderr, "\n");
 
 	// set up data for old tile deletion
-	if (t->megabytes) {
-		for (int u = 0; u < t->noctaves; u++)
-		{
-			fprintf(stderr, "ti[%d].ntiles = %d\n", u, t->i[u].ntiles);
-			t->a[u] = xmalloc(t->i[u].ntiles * sizeof*t->a[u]);
-		}
-		t->ax = 0;
-		int tilesize = t->i->tw * t->i->th * (t->i->bps/8) * t->i->spp;
-		double mbts = tilesize / (1024.0 * 1024);
-		t->maxtiles = t->megabytes / mbts;
-		t->curtiles = 0;
-	} else  {
-		// unlimited tile usage
-		t->a[0] = NULL;
-	}
+	if (t->lru)
+		t->l[o] = xmalloc(t->i[o].ntiles * sizeof*t->l[o]);
 
 	t->loaded[o] = 1;
 	return 0;
@@ -567,8 +1732,7 @@ static void tiff_octaves_init0(struct tiff_octaves *t, char *filepattern,
 		if (!get_tiff_info_filename_e(t->i + o, t->filename[o]))
 			break;
 		t->loaded[o] = 1;
-		if (t->i[o].bps < 8 || t->i[o].packed)
-			fail("caching of packed samples is not supported");
+		tiff_info_unpacked(t->i + o);
 		if (o > 0) { // check consistency
 			if (0 == strcmp(t->filename[o], t->filename[0])) break;
 			if (t->i[o].bps != t->i->bps) fail("inconsistent bps");
@@ -599,19 +1763,10 @@ static void tiff_octaves_init0(struct tiff_octaves *t, char *filepattern,
 		t->changed[i] = false;
 
 	// set up data for old tile deletion
-	if (t->megabytes) {
+	init_tile_lru(t);
+	if (t->lru)
 		for (int o = 0; o < t->noctaves; o++)
-			t->a[o] = xmalloc(t->i[o].ntiles * sizeof*t->a[o]);
-		t->ax = 0;
-		int tilesize = t->i->tw * t->i->th * (t->i->bps/8) * t->i->spp;
-		double mbts = tilesize / (1024.0 * 1024);
-		t->maxtiles = t->megabytes / mbts;
-		//fprintf(stderr, "maxtiles = %d\n", t->maxtiles);
-		t->curtiles = 0;
-	} else  {
-		// unlimited tile usage
-		t->a[0] = NULL;
-	}
+			t->l[o] = xmalloc(t->i[o].ntiles * sizeof*t->l[o]);
 }
 
 inline
@@ -639,6 +1794,17 @@ void tiff_octaves_init_implicit(struct tiff_octaves *t, char *fpat, int mbytes)
 		// and that's it.  Do not ever check that the files exist
 	}
 	t->noctaves = MAX_OCTAVES;
+	t->lru = false; // the tile size is not known yet, so do not limit it
+	int nshards = 1;
+#ifdef _OPENMP
+	nshards = TIFF_OCTAVES_SHARDS;
+#endif
+	init_tile_shards(t, nshards);
+	t->shm_base = NULL;
+	t->wtif = NULL;
+	t->wdirty = false;
+	for (int o = 0; o < MAX_OCTAVES; o++)
+		t->raw[o].fd = -2;
 }
 
 static void re_write_tile(struct tiff_octaves *t, int tidx)
@@ -658,61 +1824,126 @@ static void re_write_tile(struct tiff_octaves *t, int tidx)
 	ti->fmt = t->i->fmt;
 	ti->broken = false;
 	ti->data = t->c[0][tidx];
-	put_tile_into_file(t->filename[0], ti, tidx);
+
+	// keep the file open between writes
+	if (!t->wtif) {
+		t->wtif = tiffopen_fancy(t->filename[0], "r+");
+		if (!t->wtif)
+			fail("could not open TIFF file \"%s\" for writing",
+					t->filename[0]);
+	}
+	put_tile_into_tiff(t->wtif, ti, tidx);
+	t->wdirty = true;
 	t->changed[tidx] = false;
 }
 
-
+// write all the changed tiles to the file, in order
 static
-void tiff_octaves_free(struct tiff_octaves *t)
+void tiff_octaves_flush(struct tiff_octaves *t)
 {
 	if (t->option_write)
 		for (int i = 0; i < t->i->ntiles; i++)
 			if (t->changed[i])
 				re_write_tile(t, i);
+	if (t->wdirty) {
+		TIFFFlush(t->wtif);
+		t->wdirty = false;
+	}
+}
+
+
+static
+void tiff_octaves_free(struct tiff_octaves *t)
+{
+	tiff_octaves_flush(t);
+	if (t->wtif)
+		TIFFClose(t->wtif);
 	for (int i = 0; i < t->noctaves; i++)
 	{
+		if (!t->loaded[i]) continue;
 		for (int j = 0; j < t->i[i].ntiles; j++)
 			if (t->c[i][j])
 				xfree(t->c[i][j]);
 		xfree(t->c[i]);
-		if (t->a[0])
-			xfree(t->a[i]);
+		if (t->lru)
+			xfree(t->l[i]);
 	}
 	xfree(t->changed);
+	tiff_octaves_detach_shm(t);
+	for (int o = 0; o < MAX_OCTAVES; o++)
+		rawtiles_close(t->raw + o);
+#ifdef _OPENMP
+	for (int k = 0; k < t->nshards; k++)
+		omp_destroy_lock(&t->s[k].lock);
+#endif
 }
 
 
-static void free_oldest_tile_octave(struct tiff_octaves *t)
+// shard of the i-th tile of octave o
+static struct tiff_octaves_shard *tile_shard(struct tiff_octaves *t,
+		int o, int i)
 {
-	// find oldest tile
-	int omin = -1, imin = -1;
-	for (int o = 0; o < t->noctaves; o++)
-		for (int i = 0; i < t->i[o].ntiles; i++)
-			if (t->c[o][i]) {
-				if (imin >= 0) {
-					if (t->a[o][i] < t->a[omin][imin]) {
-						imin = i;
-						omin = o;
-					}
-				} else {
-					imin = i;
-					omin = o;
-				}
-			}
-	assert(imin >= 0);
-	assert(t->a[omin][imin] > 0);
+	return t->s + (o + i) % t->nshards;
+}
+
+// remove a tile from the list of cached tiles of its shard
+static void unlink_tile_octave(struct tiff_octaves *t, int o, int i)
+{
+	struct tiff_octaves_shard *s = tile_shard(t, o, i);
+	struct tiff_octaves_link *k = t->l[o] + i;
+	if (k->po >= 0) {
+		t->l[k->po][k->pi].no = k->no;
+		t->l[k->po][k->pi].ni = k->ni;
+	} else {
+		s->first_o = k->no;
+		s->first_i = k->ni;
+	}
+	if (k->no >= 0) {
+		t->l[k->no][k->ni].po = k->po;
+		t->l[k->no][k->ni].pi = k->pi;
+	} else {
+		s->last_o = k->po;
+		s->last_i = k->pi;
+	}
+}
+
+// insert a tile at the beginning of the list of cached tiles of its shard
+static void push_tile_octave(struct tiff_octaves *t, int o, int i)
+{
+	struct tiff_octaves_shard *s = tile_shard(t, o, i);
+	struct tiff_octaves_link *k = t->l[o] + i;
+	k->po = k->pi = -1;
+	k->no = s->first_o;
+	k->ni = s->first_i;
+	if (s->first_o >= 0) {
+		t->l[s->first_o][s->first_i].po = o;
+		t->l[s->first_o][s->first_i].pi = i;
+	} else {
+		s->last_o = o;
+		s->last_i = i;
+	}
+	s->first_o = o;
+	s->first_i = i;
+}
+
+static void free_oldest_tile_octave(struct tiff_octaves *t,
+		struct tiff_octaves_shard *s)
+{
+	// the oldest tile is at the end of the list
+	int omin = s->last_o, imin = s->last_i;
+	assert(omin >= 0 && imin >= 0);
+	unlink_tile_octave(t, omin, imin);
 
 	// free it
 	//
-	//fprintf(stderr, "CACHE: FREEing tile %d of octave %d (%g)\n", imin, omin,global_accumulated_size);
+	//fprintf(stderr, "CACHE: FREEing tile %d of octave %d\n", imin, omin);
 	if (t->option_write && omin == 0 && t->changed[imin])
 		re_write_tile(t, imin);
 	assert(t->c[omin][imin]);
 	xfree(t->c[omin][imin]);
 	t->c[omin][imin] = 0;
-	t->a[omin][imin] = 0;
-	t->curtiles -= 1;
+	s->curtiles -= 1;
+	s->evictions += 1;
 }
 
 //static void free_oldest_half_of_tiles(struct tiff_octaves *t)
@@ -720,10 +1951,33 @@ static void free_oldest_tile_octave(struct tiff_octaves *t)
 //
 //}
 
+// move an already cached tile to the beginning of the list
 static void notify_tile_access_octave(struct tiff_octaves *t, int o, int i)
 {
 	//fprintf(stderr, "notify tile %d\n", i);
-	t->a[o][i] = ++t->ax;
+	struct tiff_octaves_shard *s = tile_shard(t, o, i);
+	if (o == s->first_o && i == s->first_i)
+		return;
+	unlink_tile_octave(t, o, i);
+	push_tile_octave(t, o, i);
+}
+
+static void lock_shard(struct tiff_octaves_shard *s)
+{
+#ifdef _OPENMP
+	omp_set_lock(&s->lock);
+#else
+	(void)s;
+#endif
+}
+
+static void unlock_shard(struct tiff_octaves_shard *s)
+{
+#ifdef _OPENMP
+	omp_unset_lock(&s->lock);
+#else
+	(void)s;
+#endif
 }
 
 static int bound(int a, int x, int b)
@@ -734,59 +1988,243 @@ static int bound(int a, int x, int b)
 }
 
 
-static
-void *tiff_octaves_gettile(struct tiff_octaves *t, int o, int i, int j)
+// sanitize the coordinates of a pixel, and return the index of its tile
+static int tiff_octaves_tile_index(struct tiff_octaves *t,
+		int *o, int *i, int *j)
 {
 	// if file is not loaded, load it
-	if (!t->loaded[o])
-		load_one_octave_file(t, o);
+	if (!t->loaded[*o])
+		load_one_octave_file(t, *o);
 
 	// sanitize input
-	o = bound(0, o, t->noctaves - 1);
-	i = bound(0, i, t->i[o].w - 1);
-	j = bound(0, j, t->i[o].h - 1);
+	*o = bound(0, *o, t->noctaves - 1);
+	*i = bound(0, *i, t->i[*o].w - 1);
+	*j = bound(0, *j, t->i[*o].h - 1);
 //	if (o < 0 || o >= t->noctaves) return NULL;
 //	if (i < 0 || i >= t->i[o].w) return NULL;
 //	if (j < 0 || j >= t->i[o].h) return NULL;
 
 	// get valid tile index
-	int tidx = my_computetile(t->i + o, i, j);
-	if (tidx < 0) return NULL;
+	return my_computetile(t->i + *o, *i, *j);
+}
 
+// put a tile that has just been read into the cache (the caller holds its
+// shard, and the tile is not yet in the cache)
+static void tiff_octaves_insert_tile(struct tiff_octaves *t,
+		struct tiff_octaves_shard *s, int o, int i,
+		struct tiff_tile *tmp, bool shared)
+{
+	if (t->lru && s->curtiles >= s->maxtiles)
+		free_oldest_tile_octave(t, s);
+	t->c[o][i] = tmp->data;
+	s->curtiles += 1;
+	s->misses += 1;
+	if (shared)
+		s->shared_hits += 1;
+	else
+		s->bytes_read += tmp->w * (long)tmp->h * tmp->spp * (tmp->bps/8);
+	if (t->lru)
+		push_tile_octave(t, o, i);
+}
+
+// get the tile with index tidx of octave o (the caller holds its shard)
+static void *tiff_octaves_gettile_locked(struct tiff_octaves *t,
+		struct tiff_octaves_shard *s, int o, int tidx)
+{
 	// if tile does not exist, read it from file
 	if (!t->c[o][tidx])
-//#pragma omp critical
 	{
-		if (t->a[0] && t->curtiles == t->maxtiles)
-			free_oldest_tile_octave(t);
-
 		//fprintf(stderr,"CACHE: LOADing tile %d of octave %d (%g)\n",tidx,o, global_accumulated_size);
 		struct tiff_tile tmp[1];
-		read_tile_from_file(tmp, t->filename[o], tidx);
-		t->c[o][tidx] = tmp->data;
-
-		t->curtiles += 1;
+		bool shared = tiff_octaves_read_tile(t, tmp, o, tidx);
+		tiff_octaves_insert_tile(t, s, o, tidx, tmp, shared);
+	} else {
+		s->hits += 1;
+		if (t->lru)
+			notify_tile_access_octave(t, o, tidx);
 	}
-	if (t->a[0])
-		notify_tile_access_octave(t, o, tidx);
 
 	return t->c[o][tidx];
 }
 
+static
+void *tiff_octaves_gettile(struct tiff_octaves *t, int o, int i, int j)
+{
+	int tidx = tiff_octaves_tile_index(t, &o, &i, &j);
+	if (tidx < 0) return NULL;
+	return tiff_octaves_gettile_locked(t, tile_shard(t, o, tidx), o, tidx);
+}
+
+// position of pixel (i,j) inside its tile, in bytes
+static int tiff_octaves_pixel_position(struct tiff_info *ti, int i, int j)
+{
+	int ii = i % ti->tw;
+	int jj = j % ti->th;
+	int pixel_index = jj * ti->tw + ii;
+	return pixel_index * ti->spp * (ti->bps / 8);
+}
+
 static
 void *tiff_octaves_getpixel(struct tiff_octaves *t, int o, int i, int j)
 {
 	//fprintf(stderr, "t_o_g(%d, %d, %d)\n", o, i, j);
-	void *tile = tiff_octaves_gettile(t, o, i, j);
-	if (!tile) return NULL;
+	int tidx = tiff_octaves_tile_index(t, &o, &i, &j);
+	if (tidx < 0) return NULL;
+	void *tile = tiff_octaves_gettile_locked(t, tile_shard(t, o, tidx),
+			o, tidx);
 
 	// get pointer to requested pixel
+	return tiff_octaves_pixel_position(t->i + o, i, j) + (char*)tile;
+}
+
+// thread-safe version of "tiff_octaves_getpixel", that copies the pixel
+// into the array "out" (of spp*bps/8 bytes)
+static
+bool tiff_octaves_getpixel_copy(void *out, struct tiff_octaves *t,
+		int o, int i, int j)
+{
+	int tidx = tiff_octaves_tile_index(t, &o, &i, &j);
+	if (tidx < 0) return false;
 	struct tiff_info *ti = t->i + o;
-	int ii = i % ti->tw;
-	int jj = j % ti->th;
-	int pixel_index = jj * ti->tw + ii;
-	int pixel_position = pixel_index * ti->spp * (ti->bps / 8);
-	return pixel_position + (char*)tile;
+	struct tiff_octaves_shard *s = tile_shard(t, o, tidx);
+	lock_shard(s);
+	char *tile = tiff_octaves_gettile_locked(t, s, o, tidx);
+	memcpy(out, tile + tiff_octaves_pixel_position(ti, i, j),
+			ti->spp * (ti->bps / 8));
+	unlock_shard(s);
+	return true;
+}
+
+// make sure that the i-th tile of octave o is in memory
+// (the file is read without holding the lock, so that several tiles of the
+// same shard can be read at once)
+static void tiff_octaves_prefetch_tile(struct tiff_octaves *t, int o, int i)
+{
+	struct tiff_octaves_shard *s = tile_shard(t, o, i);
+	lock_shard(s);
+	bool present = t->c[o][i];
+	unlock_shard(s);
+	if (present) return;
+
+	struct tiff_tile tmp[1];
+	bool shared = tiff_octaves_read_tile(t, tmp, o, i);
+
+	lock_shard(s);
+	if (t->c[o][i]) // another thread was faster
+		xfree(tmp->data);
+	else
+		tiff_octaves_insert_tile(t, s, o, i, tmp, shared);
+	unlock_shard(s);
+}
+
+// read the n tiles idx[k] of octave o by a batch of raw reads, and put them
+// into the cache (the tiles found meanwhile in the cache are dropped)
+static void tiff_octaves_prefetch_raw(struct tiff_octaves *t,
+		struct tiff_rawtiles *r, int o, int *idx, int n, int nthreads)
+{
+	struct tiff_info *ti = t->i + o;
+	int64_t nbytes = ti->tw * ti->th * (ti->bps/8) * ti->spp;
+	struct tiff_tile *tmp = xmalloc(n * sizeof*tmp);
+	bool *shared = xmalloc(n * sizeof*shared);
+
+	// the tiles of the shared cache are not read again
+	int m = 0;
+	for (int k = 0; k < n; k++)
+	{
+		shared[k] = false;
+		if (t->shm_base) {
+			tmp[k].w = ti->tw;
+			tmp[k].h = ti->th;
+			tmp[k].spp = ti->spp;
+			tmp[k].bps = ti->bps;
+			tmp[k].fmt = ti->fmt;
+			tmp[k].broken = false;
+			tmp[k].data = xmalloc(nbytes);
+			shared[k] = tiff_octaves_shm_get(t, tmp[k].data, o,
+					idx[k], nbytes);
+			if (!shared[k])
+				xfree(tmp[k].data);
+		}
+		if (!shared[k]) { // move it to the front
+			int i = idx[m]; idx[m] = idx[k]; idx[k] = i;
+			struct tiff_tile u = tmp[m]; tmp[m] = tmp[k]; tmp[k] = u;
+			bool b = shared[m]; shared[m] = shared[k]; shared[k] = b;
+			m += 1;
+		}
+	}
+
+	// the other ones are read by a single batch
+	if (m) rawtiles_get(r, tmp, idx, m, nthreads);
+	if (t->shm_base)
+		for (int k = 0; k < m; k++)
+			tiff_octaves_shm_put(t, tmp[k].data, o, idx[k], nbytes);
+
+	for (int k = 0; k < n; k++)
+	{
+		struct tiff_octaves_shard *s = tile_shard(t, o, idx[k]);
+		lock_shard(s);
+		if (t->c[o][idx[k]]) // another thread was faster
+			xfree(tmp[k].data);
+		else
+			tiff_octaves_insert_tile(t, s, o, idx[k], tmp+k, shared[k]);
+		unlock_shard(s);
+	}
+	xfree(shared);
+	xfree(tmp);
+}
+
+// read the missing tiles of a rectangle of octave o, using n threads
+// (if the rectangle does not fit in the cache, do nothing)
+static void tiff_octaves_prefetch(struct tiff_octaves *t, int o,
+		int x0, int y0, int w, int h, int n)
+{
+	if (o < 0 || o >= t->noctaves || w < 1 || h < 1 || n < 1)
+		return;
+	if (!t->loaded[o])
+		load_one_octave_file(t, o);
+	struct tiff_info *ti = t->i + o;
+	int i0 = bound(0, x0, ti->w - 1) / ti->tw;
+	int j0 = bound(0, y0, ti->h - 1) / ti->th;
+	int i1 = bound(0, x0 + w - 1, ti->w - 1) / ti->tw;
+	int j1 = bound(0, y0 + h - 1, ti->h - 1) / ti->th;
+	int na = i1 - i0 + 1;
+	int nt = na * (j1 - j0 + 1);
+	if (nt < 2 || (t->lru && nt > t->maxtiles / 2))
+		return;
+
+	// with raw reads, the missing tiles are read by a single batch
+	struct tiff_rawtiles *r = ti->tiled ? tiff_octaves_raw(t, o) : NULL;
+	if (r) {
+		int *idx = xmalloc(nt * sizeof*idx), m = 0;
+		for (int k = 0; k < nt; k++)
+		{
+			int i = (j0 + k / na) * ti->ta + i0 + k % na;
+			struct tiff_octaves_shard *s = tile_shard(t, o, i);
+			lock_shard(s);
+			if (!t->c[o][i])
+				idx[m++] = i;
+			unlock_shard(s);
+		}
+		if (m) tiff_octaves_prefetch_raw(t, r, o, idx, m, n);
+		xfree(idx);
+		return;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(n) schedule(dynamic)
+#endif
+	for (int k = 0; k < nt; k++)
+		tiff_octaves_prefetch_tile(t, o,
+				(j0 + k / na) * ti->ta + i0 + k % na);
+}
+
+// whether the octave o exists (it is loaded if it was not yet)
+static bool tiff_octaves_has_octave(struct tiff_octaves *t, int o)
+{
+	if (o < 0 || o >= t->noctaves)
+		return false;
+	if (!t->loaded[o])
+		load_one_octave_file(t, o);
+	return t->loaded[o];
 }
 
 static
@@ -851,6 +2289,26 @@ void tiff_octaves_setpixel_float(struct tiff_octaves *t, int i, int j, float *p)
 	tiff_octaves_setpixel(t, i, j, pix);
 }
 
+// set only the l-th sample of a pixel
+static
+void tiff_octaves_setsample_float(struct tiff_octaves *t,
+		int i, int j, int l, float v)
+{
+	if (i < 0 || i >= t->i->w) return;
+	if (j < 0 || j >= t->i->h) return;
+	if (l < 0 || l >= t->i->spp) return;
+
+	int tidx = my_computetile(t->i, i, j);
+	if (tidx < 0) return;
+	char *tile = tiff_octaves_gettile(t, 0, i, j);
+	if (!tile) return;
+
+	char *where = tile + tiff_octaves_pixel_position(t->i, i, j)
+		+ l * (t->i->bps / 8);
+	convert_floats_to_samples(t->i, where, &v, 1);
+	t->changed[tidx] = true;
+}
+
 inline
 static
 double from_sample_to_double(void *x, int fmt, int bps)
@@ -907,6 +2365,160 @@ void convert_pixel_to_float(float *out, struct tiff_info *t, void *in)
 
 
 
+// single-file pyramids {{{1
+
+// read a tile of an open tiled TIFF as floats (NAN outside of the image)
+static void read_tile_as_floats(float *out, TIFF *tif, struct tiff_info *ti,
+		int ti_i, int ti_j, void *buf)
+{
+	int n = ti->tw * ti->th;
+	if (ti_i < 0 || ti_i >= ti->ta || ti_j < 0 || ti_j >= ti->td) {
+		for (int k = 0; k < n * ti->spp; k++)
+			out[k] = NAN;
+		return;
+	}
+	int pixel_size = (ti->spp * ti->bps) / 8;
+	my_readtile(tif, buf, ti_i * ti->tw, ti_j * ti->th, 0, 0);
+	for (int k = 0; k < n; k++)
+		convert_pixel_to_float(out + k * ti->spp, ti,
+				k * pixel_size + (char*)buf);
+	for (int j = 0; j < ti->th; j++)
+	for (int i = 0; i < ti->tw; i++)
+		if (ti_i * ti->tw + i >= ti->w || ti_j * ti->th + j >= ti->h)
+			for (int l = 0; l < ti->spp; l++)
+				out[(j * ti->tw + i) * ti->spp + l] = NAN;
+}
+
+// compute one tile of a level from the 2x2 tiles of the previous level
+//
+// Each pixel is the average of the non-NAN samples of its 2x2 block.
+static void zoom_out_tile(float *out, float *in[4], int tw, int th, int pd)
+{
+	for (int j = 0; j < th; j++)
+	for (int i = 0; i < tw; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		int ii = 2 * i, jj = 2 * j;
+		float *q = in[(jj >= th) * 2 + (ii >= tw)];
+		ii %= tw;
+		jj %= th;
+		float a[4] = {
+			q[((jj  ) * tw + ii  ) * pd + l],
+			q[((jj  ) * tw + ii+1) * pd + l],
+			q[((jj+1) * tw + ii  ) * pd + l],
+			q[((jj+1) * tw + ii+1) * pd + l] };
+		float A = 0;
+		int n = 0;
+		for (int k = 0; k < 4; k++)
+			if (!isnan(a[k]))
+			{
+				A += a[k];
+				n += 1;
+			}
+		out[(j * tw + i) * pd + l] = n ? A/n : NAN;
+	}
+}
+
+// build the reduced-resolution levels of a tiled TIFF file
+//
+// The level k+1 is the level k zoomed-out by a factor two, with the same
+// tile size, until a level fits in a single tile.  The levels are stored as
+// additional directories of the same file, so that "filename,%d" is a
+// pyramid for "tiff_octaves_init".  Existing levels of the right size are
+// overwritten in place.  Returns the number of levels of the file.
+static int tiff_build_levels(char *filename)
+{
+	char fname[2][FILENAME_MAX];
+	struct tiff_info ti[2];
+	snprintf(fname[0], FILENAME_MAX, "%s,%d", filename, 0);
+	if (!get_tiff_info_filename_e(ti, fname[0]))
+		fail("could not open TIFF file \"%s\"", filename);
+	if (!ti->tiled || ti->broken || ti->packed)
+		fail("can only build levels of contiguous tiled files");
+	int tw = ti->tw, th = ti->th, pd = ti->spp, n = tw * th * pd;
+	int tbytes = ti->tw * ti->th * ((ti->spp * ti->bps) / 8);
+	uint16_t compression;
+	TIFF *tif = tiffopen_fancy(fname[0], "r");
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	TIFFClose(tif);
+
+	float *in[4], *out = xmalloc(n * sizeof*out);
+	for (int k = 0; k < 4; k++)
+		in[k] = xmalloc(n * sizeof*in[k]);
+	void *buf = xmalloc(tbytes);
+
+	int o = 0;
+	for (; o + 1 < MAX_OCTAVES && (ti[0].ta > 1 || ti[0].td > 1); o++)
+	{
+		// the new level, overwriting it if it already exists
+		int w = (ti[0].w + 1) / 2;
+		int h = (ti[0].h + 1) / 2;
+		snprintf(fname[1], FILENAME_MAX, "%s,%d", filename, o + 1);
+		TIFF *dst;
+		if (get_tiff_info_filename_e(ti + 1, fname[1])) {
+			if (ti[1].w != w || ti[1].h != h || ti[1].tw != tw
+					|| ti[1].th != th || ti[1].spp != pd
+					|| ti[1].bps != ti->bps
+					|| ti[1].fmt != ti->fmt)
+				fail("level %d of \"%s\" is inconsistent",
+						o + 1, filename);
+			dst = tiffopen_fancy(fname[1], "r+");
+		} else {
+			dst = TIFFOpen(filename, "a");
+			if (!dst) fail("could not append to \"%s\"", filename);
+			TIFFSetField(dst, TIFFTAG_SUBFILETYPE,
+					FILETYPE_REDUCEDIMAGE);
+			TIFFSetField(dst, TIFFTAG_IMAGEWIDTH, w);
+			TIFFSetField(dst, TIFFTAG_IMAGELENGTH, h);
+			TIFFSetField(dst, TIFFTAG_SAMPLESPERPIXEL, pd);
+			TIFFSetField(dst, TIFFTAG_BITSPERSAMPLE, ti->bps);
+			TIFFSetField(dst, TIFFTAG_SAMPLEFORMAT, ti->fmt);
+			TIFFSetField(dst, TIFFTAG_PLANARCONFIG,
+					PLANARCONFIG_CONTIG);
+			TIFFSetField(dst, TIFFTAG_TILEWIDTH, tw);
+			TIFFSetField(dst, TIFFTAG_TILELENGTH, th);
+			TIFFSetField(dst, TIFFTAG_COMPRESSION, compression);
+			ti[1] = ti[0];
+			ti[1].w = w;
+			ti[1].h = h;
+			ti[1].ta = how_many(w, tw);
+			ti[1].td = how_many(h, th);
+			ti[1].ntiles = ti[1].ta * ti[1].td;
+		}
+		if (!dst) fail("could not open level %d of \"%s\"", o+1, filename);
+
+		// fill its tiles from the previous level
+		snprintf(fname[0], FILENAME_MAX, "%s,%d", filename, o);
+		TIFF *src = tiffopen_fancy(fname[0], "r");
+		if (!src) fail("could not read level %d of \"%s\"", o, filename);
+		for (int j = 0; j < ti[1].td; j++)
+		for (int i = 0; i < ti[1].ta; i++)
+		{
+			for (int k = 0; k < 4; k++)
+				read_tile_as_floats(in[k], src, ti,
+						2*i + k%2, 2*j + k/2, buf);
+			zoom_out_tile(out, in, tw, th, pd);
+			if (ti->fmt != SAMPLEFORMAT_IEEEFP)
+				for (int k = 0; k < n; k++)
+					if (isnan(out[k]))
+						out[k] = 0;
+			convert_floats_to_samples(ti, buf, out, n);
+			TIFFWriteTile(dst, buf, i * tw, j * th, 0, 0);
+		}
+		TIFFClose(src);
+		TIFFClose(dst);
+		ti[0] = ti[1];
+	}
+
+	free(buf);
+	for (int k = 0; k < 4; k++)
+		free(in[k]);
+	free(out);
+	return o + 1;
+}
+
+
+
 //static int fmt_from_string(char *f)
 //{
 //	if (0 == strcmp(f, "uint")) return SAMPLEFORMAT_UINT;
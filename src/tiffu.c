@@ -5,17 +5,20 @@
 // tget     f.tiff n t.tiff   # get the nth tile (sizes must coincide)
 // tput     f.tiff n t.tiff   # an image into the nth tile (sizes must coincide)
 // zoomout  a.tiff b.tiff     # zoom out by a factor 2 (keeping tile size)
+// pyramid  a.tiff p.tiff     # build all the zoom-outs in a single pass
 // crop     cx cy r in out    # crop a tiff file
 // tzero    w h ...           # create a huge tiled tiff file
 // getpixel f.tiff < coords   # evaluate pixels specified by input lines
+// getpixel -i p.npy -o v.npy f.tiff # evaluate a binary array of points
 // manwhole ...               # like tzero, but create a mandelbrot image
 // meta   prog in.tiff ... out.tiff # run "prog" for all the tiles
 // octaves                    # example program for the pyramidal interface
 // dlist    f.tiff            # list images inside this file
 // dget     f.tiff n d.tiff   # get the nth image of a multi-image file
 // dpush    f.tiff d.tiff     # add a new image to a multi-image file
+// tileize  tw th a.tiff b.tiff # convert a striped image into a tiled one
 //
-// TODO: resample, tileize
+// TODO: resample
 // retile   in.t tw th out.t  # retile a file to the new given tile size
 //
 // NOTE: images from a multi-image file can be accessed like e.g. "fname.tiff:4"
@@ -32,9 +35,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
 
 #include <tiffio.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 // structs {{{1
 
@@ -879,6 +887,74 @@ static void crop_scanlines(struct tiff_tile *tout, struct tiff_info *tinfo,
 	free(buf);
 }
 
+// crop a tiled tiff file whose crop origin falls on the corner of a tile
+//
+// The output has the same tiles and codec as the input.  The tiles that are
+// whole in the output are copied without decoding them, and only the
+// partial tiles at the right and bottom edges are decoded and re-encoded.
+static void tcrop_aligned(char *fname_out, TIFF *tif, struct tiff_info *t,
+		int x0, int xf, int y0, int yf)
+{
+	int w = 1 + xf - x0;
+	int h = 1 + yf - y0;
+	uint16_t compression, predictor = PREDICTOR_NONE;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	if (compression != COMPRESSION_NONE)
+		TIFFGetFieldDefaulted(tif, TIFFTAG_PREDICTOR, &predictor);
+
+	double gigabytes = tinfo_pixelsize(t) * (double)w * h / 1e9;
+	TIFF *tout = TIFFOpen(fname_out, gigabytes > 1 ? "w8" : "w");
+	if (!tout) fail("could not open TIFF file \"%s\" for writing", fname_out);
+	TIFFSetField(tout, TIFFTAG_IMAGEWIDTH,      w);
+	TIFFSetField(tout, TIFFTAG_IMAGELENGTH,     h);
+	TIFFSetField(tout, TIFFTAG_SAMPLESPERPIXEL, t->spp);
+	TIFFSetField(tout, TIFFTAG_BITSPERSAMPLE,   t->bps);
+	TIFFSetField(tout, TIFFTAG_SAMPLEFORMAT,    t->fmt);
+	TIFFSetField(tout, TIFFTAG_PLANARCONFIG,    PLANARCONFIG_CONTIG);
+	TIFFSetField(tout, TIFFTAG_TILEWIDTH,       t->tw);
+	TIFFSetField(tout, TIFFTAG_TILELENGTH,      t->th);
+	TIFFSetField(tout, TIFFTAG_COMPRESSION,     compression);
+	if (predictor != PREDICTOR_NONE)
+		TIFFSetField(tout, TIFFTAG_PREDICTOR, predictor);
+
+	uint64_t *cnt;
+	TIFFGetField(tif, TIFFTAG_TILEBYTECOUNTS, &cnt);
+	int ps = tinfo_pixelsize(t);
+	int tilesize = tinfo_tilesize(t);
+	uint8_t *buf = xmalloc(tilesize);
+	for (int j = 0; j < h; j += t->th)
+	for (int i = 0; i < w; i += t->tw)
+	{
+		int tidx_in = TIFFComputeTile(tif, x0 + i, y0 + j, 0, 0);
+		int tidx_out = TIFFComputeTile(tout, i, j, 0, 0);
+
+		// a tile is whole if it has the same pixels in both images
+		bool whole_x = i + t->tw <= w || xf == t->w - 1;
+		bool whole_y = j + t->th <= h || yf == t->h - 1;
+		if (whole_x && whole_y) {
+			uint8_t *raw = xmalloc(cnt[tidx_in] ? cnt[tidx_in] : 1);
+			tmsize_t r = TIFFReadRawTile(tif, tidx_in, raw,
+					cnt[tidx_in]);
+			if (r < 0 || TIFFWriteRawTile(tout, tidx_out, raw, r) < 0)
+				fail("could not copy tile %d", tidx_in);
+			free(raw);
+			continue;
+		}
+
+		// partial tile: decode it, and clear the pixels outside
+		if (TIFFReadTile(tif, buf, x0 + i, y0 + j, 0, 0) < 0)
+			memset(buf, 0, tilesize);
+		for (int jj = 0; jj < t->th; jj++)
+		for (int ii = 0; ii < t->tw; ii++)
+			if (i + ii >= w || j + jj >= h)
+				memset(buf + (jj * t->tw + ii) * ps, 0, ps);
+		if (TIFFWriteEncodedTile(tout, tidx_out, buf, tilesize) < 0)
+			fail("could not write tile %d", tidx_out);
+	}
+	free(buf);
+	TIFFClose(tout);
+}
+
 // crop a tiff file, given by its name
 void tcrop(char *fname_out, char *fname_in, int x0, int xf, int y0, int yf)
 {
@@ -896,6 +972,18 @@ void tcrop(char *fname_out, char *fname_in, int x0, int xf, int y0, int yf)
 	if (xf >= tinfo->w) xf = tinfo->w - 1;
 	if (yf >= tinfo->h) yf = tinfo->h - 1;
 
+	// when the crop starts at a tile corner, copy the tiles directly
+	uint16_t compression;
+	TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+	if (tinfo->tiled && !tinfo->packed && !tinfo->broken
+			&& x0 % tinfo->tw == 0 && y0 % tinfo->th == 0
+			&& compression != COMPRESSION_JPEG
+			&& compression != COMPRESSION_OJPEG) {
+		tcrop_aligned(fname_out, tif, tinfo, x0, xf, y0, yf);
+		TIFFClose(tif);
+		return;
+	}
+
 	// create output structure
 	struct tiff_tile tout[1];
 	tout->w = 1 + xf - x0;
@@ -1201,10 +1289,21 @@ static void add_item_to_cmdline(char *cmdline, char *item, char *fileprefix)
 	strncat(cmdline, item, CMDLINE_MAX);
 }
 
-static char *create_temporary_directory(void)
+// create a new temporary directory inside "base" (or /tmp, when NULL),
+// returns its absolute name with a final slash
+static char *create_temporary_directory(char *base)
 {
 	//return "/tmp/metafilter_temporary_directory/";
-	return "/tmp/MTD/";
+	static char r[FILENAME_MAX];
+	char b[FILENAME_MAX];
+	if (base && *base != '/' && getcwd(b, FILENAME_MAX))
+		snprintf(r, FILENAME_MAX, "%s/%s/tiffu_meta_XXXXXX", b, base);
+	else
+		snprintf(r, FILENAME_MAX, "%s/tiffu_meta_XXXXXX",
+				base ? base : "/tmp");
+	if (!mkdtemp(r)) fail("could not create a temporary directory");
+	strncat(r, "/", FILENAME_MAX - strlen(r) - 1);
+	return r;
 }
 
 static char *bn(char *s)
@@ -1225,7 +1324,7 @@ static void fill_subs_cmdline(char *cmdline, char *cmd, char *fprefix,
 		char **fns_in, int n_in, char **fns_out, int n_out)
 {
 	*cmdline = 0;
-	char *tok = strtok(cmd, " ");
+	char *save, *tok = strtok_r(cmd, " ", &save);
 	do {
 		if (*tok=='>' || *tok=='|' || *tok=='<') {
 			fprintf(stderr, "ERROR: must be a single "
@@ -1245,50 +1344,136 @@ static void fill_subs_cmdline(char *cmdline, char *cmd, char *fprefix,
 			add_item_to_cmdline(cmdline, bn(fns_out[idx]), fprefix);
 		} else
 			add_item_to_cmdline(cmdline, tok, NULL);
-	} while ((tok = strtok(NULL, " ")));
+	} while ((tok = strtok_r(NULL, " ", &save)));
+}
+
+// crop the rectangle of a tile and a margin around it
+// (r = x0, y0, xf, yf of the cropped rectangle, clipped to the image)
+static void extract_tile(char *fname_tile, char *filename,
+		struct tiff_info *t, int idx, int m, int r[4])
+{
+	int x0 = (idx % t->ta) * t->tw;
+	int y0 = (idx / t->ta) * t->th;
+	r[0] = x0 - m < 0 ? 0 : x0 - m;
+	r[1] = y0 - m < 0 ? 0 : y0 - m;
+	r[2] = x0 + t->tw - 1 + m < t->w ? x0 + t->tw - 1 + m : t->w - 1;
+	r[3] = y0 + t->th - 1 + m < t->h ? y0 + t->th - 1 + m : t->h - 1;
+	tcrop(fname_tile, filename, r[0], r[2], r[1], r[3]);
+}
+
+// write the tile "idx" of an open file, from the result of a command run on
+// the rectangle "r" around it (the margin is trimmed)
+static void paste_tile(TIFF *tout, struct tiff_info *to, int idx,
+		char *fname_tile, int r[4])
+{
+	TIFF *tif = TIFFOpen(fname_tile, "r");
+	if (!tif) fail("could not open TIFF file \"%s\"", fname_tile);
+	struct tiff_info ti[1];
+	get_tiff_info(ti, tif);
+	if (ti->w != 1 + r[2] - r[0] || ti->h != 1 + r[3] - r[1])
+		fail("result \"%s\" has size %dx%d instead of %dx%d",
+			fname_tile, ti->w, ti->h, 1 + r[2] - r[0], 1 + r[3] - r[1]);
+	if (ti->spp != to->spp || ti->bps != to->bps || ti->fmt != to->fmt)
+		fail("result \"%s\" has a different pixel type", fname_tile);
+	if (ti->packed || ti->broken)
+		fail("result \"%s\" has packed or broken pixels", fname_tile);
+
+	// the part of the result that falls inside the tile
+	int x0 = (idx % to->ta) * to->tw;
+	int y0 = (idx / to->ta) * to->th;
+	int xf = x0 + to->tw - 1 < to->w ? x0 + to->tw - 1 : to->w - 1;
+	int yf = y0 + to->th - 1 < to->h ? y0 + to->th - 1 : to->h - 1;
+	struct tiff_tile c[1];
+	c->w = 1 + xf - x0;
+	c->h = 1 + yf - y0;
+	int ps = tinfo_pixelsize(to);
+	c->data = xmalloc(c->w * c->h * ps);
+	if (ti->tiled)
+		crop_tiles(c, ti, tif, x0-r[0], xf-r[0], y0-r[1], yf-r[1]);
+	else
+		crop_scanlines(c, ti, tif, x0-r[0], xf-r[0], y0-r[1], yf-r[1]);
+	TIFFClose(tif);
+
+	int tilesize = tinfo_tilesize(to);
+	uint8_t *buf = xmalloc(tilesize);
+	memset(buf, 0, tilesize);
+	for (int j = 0; j < c->h; j++)
+		memcpy(buf + j * to->tw * ps, c->data + j * c->w * ps, c->w * ps);
+	if (TIFFWriteTile(tout, buf, x0, y0, 0, 0) < 0)
+		fail("could not write tile %d", idx);
+	free(buf);
+	free(c->data);
 }
 
-static void extract_tile(char *tpd, char *filename, int idx)
+// the command line that runs "cmdline" on a remote host, through the
+// command of the environment variable TIFFU_SSH (by default, ssh without
+// password prompts); the quotes of cmdline are escaped for the remote shell
+static void remote_cmdline(char *r, char *host, char *cmdline)
 {
-	// 1. open large tiff image "filename"
-	// 2. locate idexed tile
-	// 3. read indexed tile data
-	// 4. close large tiff image
-	// 5. create new small tiff image "tpd/filename"
-	// 6. write data to new small tiff image
+	char *ssh = getenv("TIFFU_SSH");
+	int n = snprintf(r, CMDLINE_MAX, "%s %s '",
+			ssh ? ssh : "ssh -o BatchMode=yes", host);
+	for (char *c = cmdline; *c && n < CMDLINE_MAX - 5; c++)
+		if (*c == '\'') {
+			memcpy(r + n, "'\\''", 4);
+			n += 4;
+		} else
+			r[n++] = *c;
+	if (n > CMDLINE_MAX - 2)
+		fail("command line too long for host \"%s\"", host);
+	r[n++] = '\'';
+	r[n] = 0;
 }
 
-static void paste_tile(char *filename, int idx, char *tpd)
+// run a command line, trying again up to "retries" times if it fails
+//
+// When there are hosts, the command runs on the host "first", and each new
+// try goes to the next host, so that a tile that fails on a broken host is
+// re-queued on the other ones.
+static bool system_retry(char *cmdline, int retries,
+		char **hosts, int nhosts, int first)
 {
-	// 1. read data from small tiff file
-	// 2. open large tiff file
-	// 3. locate position of indexed tile
-	// 4. rewrite indexed tile with new data
-	// 5. save and close the large tiff file
+	for (int k = 0; k <= retries; k++)
+	{
+		char rcmdline[CMDLINE_MAX], *c = cmdline;
+		if (nhosts)
+			remote_cmdline(c = rcmdline, hosts[(first+k)%nhosts],
+					cmdline);
+		if (!system(c))
+			return true;
+		fprintf(stderr, "command \"%s\" failed (%d/%d)\n", c,
+				k + 1, retries + 1);
+	}
+	return false;
 }
 
+// run a command on each tile of the input images, and write the results on
+// the corresponding tiles of the output images
+//
+// The tiles are those of the first input image (the other ones only need
+// to have the same size).  They are processed by "nworkers" concurrent jobs.  Each job crops
+// its tile of the inputs with a margin "m" (clipped to the image), runs the
+// command, and writes back the tile of the results, trimming the margin.
+// The output images are created after the first tile, with the pixel type
+// of its results.  A failing command is run again up to "retries" times.
+//
+// Distributed mode: when a list of "nhosts" hosts is given, the commands run
+// on these hosts through ssh, and each job sends its tiles to the host of
+// its number (modulo nhosts), so that the tiles are handed out dynamically
+// to the hosts as they finish the previous ones.  The tiles of the inputs
+// and of the results are exchanged through the temporary directory, which
+// is created inside "tmpdir" (or /tmp): it must be on a storage shared with
+// the hosts, at the same path, and the commands must be in their PATH.
 void metatiler(char *command, char **fname_in, int n_in,
-		char **fname_out, int n_out)
+		char **fname_out, int n_out, int nworkers, int m, int retries,
+		char **hosts, int nhosts, char *tmpdir)
 {
-	// build command line (will be the same at each run)
-	char cmdline[CMDLINE_MAX];
-	char *tpd = create_temporary_directory();
-	fill_subs_cmdline(cmdline, command, tpd,
-			fname_in, n_in, fname_out, n_out);
-	fprintf(stderr, "CMDLINE = \"%s\"\n", cmdline);
-
-	// create temporary filenames
-	char tname_in[n_in][FILENAME_MAX];
-	char tname_out[n_out][FILENAME_MAX];
-	for (int i = 0; i < n_in; i++)
-		snprintf(tname_in[i],FILENAME_MAX,"%s%s",tpd,bn(fname_in[i]));
-	for (int i = 0; i < n_out; i++)
-		snprintf(tname_out[i],FILENAME_MAX,"%s%s",tpd,bn(fname_out[i]));
-
 	// determine input tile geometry
 	struct tiff_info tinfo_in[n_in], tinfo_out[n_out];
 	for (int i = 0; i < n_in; i++)
 		get_tiff_info_filename(tinfo_in + i, fname_in[i]);
+	if (!tinfo_in->tiled)
+		fail("image \"%s\" is not tiled", fname_in[0]);
 
 	// check tile geometry consistency
 	for (int i = 1; i < n_in; i++)
@@ -1298,20 +1483,45 @@ void metatiler(char *command, char **fname_in, int n_in,
 		if (ta->w != tb->w || ta->h != tb->h)
 			fail("image \"%s\" size mismatch (%dx%d != %dx%d)\n",
 				fname_in[i], ta->w, ta->h, tb->w, tb->h);
-		if (ta->ntiles != tb->ntiles)
-			fail("image \"%s\" ntiles mismatch (%d != %d)\n",
-				fname_in[i], ta->ntiles, tb->ntiles);
 	}
 
-	// do it!
-	for (int i = 0; i < tinfo_in->ntiles; i++)
+	char *tpd = create_temporary_directory(tmpdir);
+	TIFF *tout[n_out];
+	int ntiles = tinfo_in->ntiles, failed = 0;
+
+	// do it! (the first tile alone, to create the output files)
+	for (int ib = 0; ib < 2; ib++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(ib ? nworkers : 1)
+#endif
+	for (int i = ib; i < (ib ? ntiles : 1); i++)
 	{
-		fprintf(stderr, "process tile %d / %d\n", i+1,tinfo_in->ntiles);
+		// build the command line of this tile
+		char prefix[FILENAME_MAX], cmd[CMDLINE_MAX], cmdline[CMDLINE_MAX];
+		char tname_in[n_in][FILENAME_MAX];
+		char tname_out[n_out][FILENAME_MAX];
+		snprintf(prefix, FILENAME_MAX, "%st%d_", tpd, i);
+		snprintf(cmd, CMDLINE_MAX, "%s", command);
+		fill_subs_cmdline(cmdline, cmd, prefix,
+				fname_in, n_in, fname_out, n_out);
 		for (int k = 0; k < n_in; k++)
-			system_v("tiffu tget %s %d %s",
-				fname_in[k], i, tname_in[k]);
-		system_v("%s", cmdline);
-		if (!i) for (int k = 0; k < n_out; k++)
+			snprintf(tname_in[k], FILENAME_MAX, "%s%s",
+					prefix, bn(fname_in[k]));
+		for (int k = 0; k < n_out; k++)
+			snprintf(tname_out[k], FILENAME_MAX, "%s%s",
+					prefix, bn(fname_out[k]));
+
+		fprintf(stderr, "process tile %d / %d\n", i+1, ntiles);
+		int r[4];
+		for (int k = 0; k < n_in; k++)
+			extract_tile(tname_in[k], fname_in[k], tinfo_in,
+					i, m, r);
+		int job = 0;
+#ifdef _OPENMP
+		job = omp_get_thread_num();
+#endif
+		bool ok = system_retry(cmdline, retries, hosts, nhosts, job);
+		if (ok && !i) for (int k = 0; k < n_out; k++)
 		{
 			struct tiff_info *t = tinfo_out + k;
 			get_tiff_info_filename(t, tname_out[k]);
@@ -1319,27 +1529,52 @@ void metatiler(char *command, char **fname_in, int n_in,
 			t->h = tinfo_in->h;
 			t->tw = tinfo_in->tw;
 			t->th = tinfo_in->th;
+			t->ta = tinfo_in->ta;
+			t->td = tinfo_in->td;
+			t->ntiles = tinfo_in->ntiles;
+			t->tiled = true;
 			create_zero_tiff_file_tinfo(fname_out[k], t,true,false);
+			tout[k] = TIFFOpen(fname_out[k], "r+");
+			if (!tout[k]) fail("could not open \"%s\"", fname_out[k]);
 		}
-		for (int k = 0; k < n_out; k++)
-			system_v("tiffu tput %s %d %s",
-				fname_out[k], i, tname_out[k]);
+		if (!ok && !i) {
+			for (int k = 0; k < n_in; k++) remove(tname_in[k]);
+			rmdir(tpd);
+			fail("command \"%s\" failed on the first tile", cmdline);
+		}
+#ifdef _OPENMP
+#pragma omp critical(tiffu_meta)
+#endif
+		{
+			if (ok) for (int k = 0; k < n_out; k++)
+				paste_tile(tout[k], tinfo_out + k, i,
+						tname_out[k], r);
+			else
+				failed += 1;
+		}
+		for (int k = 0; k < n_in; k++) remove(tname_in[k]);
+		for (int k = 0; k < n_out; k++) remove(tname_out[k]);
 	}
 
-	//for (int i = 0; i < ntiles; i++)
-	//{
-	//	// 1. extract ith tile from input images
-	//	// 2. run cmdline
-	//	fprintf(stderr, "run \"%s\"\n", cmdline);
-	//	// 3. paste results to output files
-	//}
+	for (int k = 0; k < n_out; k++)
+		TIFFClose(tout[k]);
+	rmdir(tpd);
+	if (failed)
+		fail("the command failed on %d of %d tiles", failed, ntiles);
 }
 
 int main_meta(int argc, char *argv[])
 {
+	int nworkers = atoi(pick_option(&argc, &argv, "j", "1"));
+	int margin = atoi(pick_option(&argc, &argv, "m", "0"));
+	int retries = atoi(pick_option(&argc, &argv, "r", "2"));
+	char *hostlist = pick_option(&argc, &argv, "H", "");
+	char *tmpdir = pick_option(&argc, &argv, "d", "");
 	if (argc < 3) {
 		fprintf(stderr, "usage:\n\t"
-			"%s \"CMD <1 <2 >1\" in1 in2 -- out1\n", *argv);
+			"%s [-j workers] [-m margin] [-r retries] "
+			"[-H host1,host2,...] [-d shareddir] "
+			"\"CMD ^0 ^1 @0\" in0 in1 -- out0\n", *argv);
 		//       0   1               2   3   ...
 		return 1;
 	}
@@ -1353,6 +1588,8 @@ int main_meta(int argc, char *argv[])
 		filenames_in[n_in++] = argv[i];
 	for (int i = 3+n_in; i < argc; i++)
 		filenames_out[n_out++] = argv[i];
+	if (n_in < 1 || n_out < 1)
+		fail("at least one input and one output image are needed");
 
 	// print debug info
 	fprintf(stderr, "%d input files:\n", n_in);
@@ -1363,8 +1600,21 @@ int main_meta(int argc, char *argv[])
 		fprintf(stderr, "\t%s\n", filenames_out[i]);
 	fprintf(stderr, "COMMAND = \"%s\"\n", command);
 
+	// hosts of the distributed mode (by default, one job per host)
+	int nhosts = 0;
+	char *hosts[strlen(hostlist) + 1], *save;
+	for (char *t = strtok_r(hostlist, ", ", &save); t;
+			t = strtok_r(NULL, ", ", &save))
+		hosts[nhosts++] = t;
+	if (nhosts && nworkers < nhosts)
+		nworkers = nhosts;
+	for (int i = 0; i < nhosts; i++)
+		fprintf(stderr, "host %d: %s\n", i, hosts[i]);
+
 	// run program
-	metatiler(command, filenames_in, n_in, filenames_out, n_out);
+	metatiler(command, filenames_in, n_in, filenames_out, n_out,
+			nworkers < 1 ? 1 : nworkers, margin, retries,
+			hosts, nhosts, *tmpdir ? tmpdir : NULL);
 
 	// exit
 	return 0;
@@ -1375,7 +1625,7 @@ void metatiler_low_level(char *command, char **filenames_in, int n_in,
 {
 	// build command line (will be the same at each run)
 	char cmdline[CMDLINE_MAX];
-	char *tpd = create_temporary_directory();
+	char *tpd = create_temporary_directory(NULL);
 	fill_subs_cmdline(cmdline, command, tpd,
 			filenames_in, n_in, filenames_out, n_out);
 
@@ -1645,15 +1895,307 @@ static void convert_pixel_to_float(float *out, struct tiff_info *t, void *in)
 	}
 }
 
+// batched getpixel {{{1
+
+// The points are read from a binary array (npy file of shape (n,2), or raw
+// float32 pairs), by chunks.  The samples needed by the points of a chunk
+// are grouped by tile, and each tile is decoded once (per chunk, or once in
+// all if the cache is unlimited) by a pool of threads, each one with its own
+// TIFF handle.  The result is an array of n pixels of float32 samples, NAN
+// for the points outside the image.
+
+// types of the input coordinates
+enum { COORDS_F4, COORDS_F8, COORDS_I4, COORDS_I8 };
+
+// parse the header of an npy file of points, or assume raw float32 pairs
+// (the number of points is -1 when it is not known in advance)
+static FILE *coords_open(char *fname, int *type, long *n)
+{
+	FILE *f = strcmp(fname, "-") ? fopen(fname, "r") : stdin;
+	if (!f) fail("could not open points file \"%s\"", fname);
+	*type = COORDS_F4;
+	*n = -1;
+	char *dot = strrchr(fname, '.');
+	if (!dot || strcmp(dot, ".npy")) { // raw floats, size from the file
+		if (f != stdin && !fseek(f, 0, SEEK_END)) {
+			*n = ftell(f) / (2 * sizeof(float));
+			rewind(f);
+		}
+		return f;
+	}
+	uint8_t m[10];
+	if (8 != fread(m, 1, 8, f) || memcmp(m, "\x93NUMPY", 6))
+		fail("file \"%s\" is not npy", fname);
+	int hn = m[6] == 1 ? 2 : 4;
+	if ((size_t)hn != fread(m, 1, hn, f))
+		fail("bad npy header in \"%s\"", fname);
+	long hl = m[0] + 256 * m[1] + (hn == 4 ? 65536 * (m[2] + 256L*m[3]) : 0);
+	char h[hl + 1];
+	if ((size_t)hl != fread(h, 1, hl, f))
+		fail("bad npy header in \"%s\"", fname);
+	h[hl] = '\0';
+	char *d = strstr(h, "'descr':"), *sh = strstr(h, "'shape':");
+	if (!d || !sh || strstr(h, "'fortran_order': True"))
+		fail("unsupported npy header \"%s\"", h);
+	d = strchr(d + 8, '\'');
+	if (!d || d[1] == '>')
+		fail("unsupported npy type in \"%s\"", h);
+	if      (!strncmp(d + 2, "f4", 2)) *type = COORDS_F4;
+	else if (!strncmp(d + 2, "f8", 2)) *type = COORDS_F8;
+	else if (!strncmp(d + 2, "i4", 2)) *type = COORDS_I4;
+	else if (!strncmp(d + 2, "i8", 2)) *type = COORDS_I8;
+	else fail("unsupported npy type in \"%s\"", h);
+	long a = 0, b = 0;
+	int r = sscanf(strchr(sh, '('), "(%ld, %ld)", &a, &b);
+	if (r == 2 && b == 2) *n = a;
+	else if (r == 1 && a % 2 == 0) *n = a / 2;
+	else fail("the npy array of points must have shape (n,2), not %s",
+			strchr(sh, '('));
+	return f;
+}
+
+// read at most m points into xy, return the number of points read
+static long coords_read(double *xy, long m, FILE *f, int type)
+{
+	int ss = type == COORDS_F4 || type == COORDS_I4 ? 4 : 8;
+	uint8_t *buf = xmalloc(2 * m * ss);
+	long n = fread(buf, 2 * ss, m, f);
+	for (long i = 0; i < 2 * n; i++)
+		switch (type) {
+		case COORDS_F4: xy[i] = ((float  *)buf)[i]; break;
+		case COORDS_F8: xy[i] = ((double *)buf)[i]; break;
+		case COORDS_I4: xy[i] = ((int32_t*)buf)[i]; break;
+		case COORDS_I8: xy[i] = ((int64_t*)buf)[i]; break;
+		}
+	free(buf);
+	return n;
+}
+
+// header of an npy file of n pixels of pd float32 (always 128 bytes, so that
+// it can be rewritten when n is known)
+static void npy_write_header(FILE *f, long n, int pd)
+{
+	char h[128];
+	memset(h, ' ', sizeof h);
+	memcpy(h, "\x93NUMPY\x01\x00\x76\x00", 10);
+	int r = snprintf(h + 10, 118, "{'descr': '<f4', 'fortran_order': False, "
+			"'shape': (%ld, %d), }", n, pd);
+	h[10 + r] = ' ';
+	h[127] = '\n';
+	fwrite(h, 1, sizeof h, f);
+}
+
+// neighbors of a point, and their weights (1 if nearest, 4 if bilinear)
+static int point_neighbors(int i[4], int j[4], float w[4],
+		double x, double y, int wi, int hi, bool bilinear)
+{
+	if (!(x >= -0.5 && x < wi - 0.5 && y >= -0.5 && y < hi - 0.5))
+		return 0;
+	if (!bilinear) {
+		i[0] = floor(x + 0.5);
+		j[0] = floor(y + 0.5);
+		w[0] = 1;
+		return 1;
+	}
+	int x0 = floor(x), y0 = floor(y);
+	float a = x - x0, b = y - y0;
+	for (int k = 0; k < 4; k++)
+	{
+		i[k] = x0 + k % 2;
+		j[k] = y0 + k / 2;
+		if (i[k] < 0) i[k] = 0;
+		if (j[k] < 0) j[k] = 0;
+		if (i[k] >= wi) i[k] = wi - 1;
+		if (j[k] >= hi) j[k] = hi - 1;
+	}
+	w[0] = (1 - a) * (1 - b);
+	w[1] = a * (1 - b);
+	w[2] = (1 - a) * b;
+	w[3] = a * b;
+	return 4;
+}
+
+// decode the tile "tidx" (or the whole image if it is not tiled)
+static void *tile_decode(TIFF *tif, struct tiff_info *t, int tidx)
+{
+	if (!t->tiled) {
+		struct tiff_tile tmp[1];
+		read_scanlines(tmp, tif);
+		return tmp->data;
+	}
+	int ii[2];
+	tiff_tile_corner(ii, tif, tidx);
+	int tbytes = TIFFTileSize(tif);
+	void *p = xmalloc(tbytes);
+	memset(p, 0, tbytes);
+	my_readtile(tif, p, ii[0], ii[1], 0, 0);
+	return p;
+}
+
+static int main_getpixel_batch(char *filename_in, char *filename_pts,
+		char *filename_out, int megabytes, bool bilinear, long chunk)
+{
+	struct tiff_info t[1];
+	get_tiff_info_filename(t, filename_in);
+	if (t->bps < 8 || t->packed || t->broken)
+		fail("getpixel: packed or planar samples are not supported");
+	int pd = t->spp, ps = pd * (t->bps / 8), K = bilinear ? 4 : 1;
+	if (chunk < 1) chunk = 1;
+
+	int type;
+	long npoints;
+	FILE *fp = coords_open(filename_pts, &type, &npoints);
+	char *dot = strrchr(filename_out, '.');
+	bool npy = dot && !strcmp(dot, ".npy");
+	FILE *fo = strcmp(filename_out, "-") ? fopen(filename_out, "w") : stdout;
+	if (!fo) fail("could not open output file \"%s\"", filename_out);
+	if (npy && npoints < 0 && fseek(fo, 0, SEEK_CUR))
+		fail("getpixel: unknown number of points for a npy pipe");
+	if (npy) npy_write_header(fo, npoints < 0 ? 0 : npoints, pd);
+
+	// decoded tiles (kept between chunks while they fit in the megabytes)
+	void **c = xmalloc(t->ntiles * sizeof*c);
+	for (int k = 0; k < t->ntiles; k++)
+		c[k] = NULL;
+	double tile_mb = t->tw * (double)t->th * ps / (1024.0 * 1024);
+	int ncached = 0;
+
+	// each point has K slots, a neighbor and its weight, sorted by tile
+	double *xy  = xmalloc(2 * chunk * sizeof*xy);
+	int    *qt  = xmalloc(K * chunk * sizeof*qt);  // tile of the slot
+	int    *qo  = xmalloc(K * chunk * sizeof*qo);  // offset in the tile
+	float  *qw  = xmalloc(K * chunk * sizeof*qw);  // weight
+	float  *qv  = xmalloc(K * chunk * pd * sizeof*qv); // samples
+	long   *ord = xmalloc(K * chunk * sizeof*ord); // slots by tile
+	long   *first = xmalloc((t->ntiles + 1) * sizeof*first);
+	int    *tl  = xmalloc(t->ntiles * sizeof*tl);  // tiles of this chunk
+	float  *out = xmalloc(chunk * pd * sizeof*out);
+
+	long total = 0, n;
+	while ((n = coords_read(xy, chunk, fp, type)) > 0)
+	{
+		for (long p = 0; p < n; p++)
+		{
+			int i[4], j[4];
+			float w[4];
+			int m = point_neighbors(i, j, w, xy[2*p], xy[2*p+1],
+					t->w, t->h, bilinear);
+			for (int k = 0; k < K; k++)
+			{
+				long q = K * p + k;
+				qt[q] = k < m ? my_computetile(t, i[k], j[k]) : -1;
+				if (qt[q] < 0) continue;
+				qo[q] = ((j[k] % t->th) * t->tw + i[k] % t->tw) * ps;
+				qw[q] = w[k];
+			}
+		}
+
+		// counting sort of the slots by tile
+		for (int k = 0; k <= t->ntiles; k++)
+			first[k] = 0;
+		for (long q = 0; q < K * n; q++)
+			if (qt[q] >= 0)
+				first[qt[q] + 1] += 1;
+		int ntl = 0;
+		for (int k = 0; k < t->ntiles; k++)
+		{
+			if (first[k + 1]) {
+				tl[ntl++] = k;
+				ncached += !c[k];
+			}
+			first[k + 1] += first[k];
+		}
+		for (long q = 0; q < K * n; q++)
+			if (qt[q] >= 0)
+				ord[first[qt[q]]++] = q;
+		for (int k = t->ntiles; k > 0; k--)
+			first[k] = first[k - 1];
+		first[0] = 0;
+
+		// decode each tile once, and extract all its samples
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+		{
+			TIFF *tif = NULL;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+			for (int a = 0; a < ntl; a++)
+			{
+				int k = tl[a];
+				if (!c[k]) {
+					if (!tif) tif = tiffopen_fancy(filename_in, "r");
+					if (!tif) fail("could not open TIFF file \"%s\"",
+							filename_in);
+					c[k] = tile_decode(tif, t, k);
+				}
+				for (long b = first[k]; b < first[k + 1]; b++)
+				{
+					long q = ord[b];
+					convert_pixel_to_float(qv + q*pd, t,
+							qo[q] + (char*)c[k]);
+				}
+			}
+			if (tif) TIFFClose(tif);
+		}
+
+		// combine the neighbors of each point
+		for (long p = 0; p < n; p++)
+		for (int l = 0; l < pd; l++)
+		{
+			float r = qt[K*p] < 0 ? NAN : 0;
+			for (int k = 0; k < K && qt[K*p] >= 0; k++)
+				r += qw[K*p+k] * qv[(K*p+k)*pd+l];
+			out[p*pd+l] = r;
+		}
+		if ((size_t)(n * pd) != fwrite(out, sizeof*out, n * pd, fo))
+			fail("getpixel: could not write the output");
+		total += n;
+
+		// forget the tiles when the cache is full
+		if (megabytes && ncached * tile_mb > megabytes) {
+			for (int k = 0; k < t->ntiles; k++)
+			{
+				free(c[k]);
+				c[k] = NULL;
+			}
+			ncached = 0;
+		}
+	}
+
+	if (npy && total != npoints) {
+		if (fseek(fo, 0, SEEK_SET))
+			fail("getpixel: could not rewrite the npy header");
+		npy_write_header(fo, total, pd);
+	}
+	if (fp != stdin) fclose(fp);
+	if (fo != stdout) fclose(fo);
+	for (int k = 0; k < t->ntiles; k++)
+		free(c[k]);
+	free(c); free(xy); free(qt); free(qo); free(qw); free(qv);
+	free(ord); free(first); free(tl); free(out);
+	return 0;
+}
+
 static int main_getpixel(int c, char *v[])
 {
 	char *oM = pick_option(&c, &v, "m", "0");
+	char *oi = pick_option(&c, &v, "i", "");
+	char *oo = pick_option(&c, &v, "o", "");
+	char *on = pick_option(&c, &v, "n", "1048576");
+	bool ol = pick_option(&c, &v, "l", NULL);
 	if (c != 2) {
-		fprintf(stderr, "usage:\n\techo i j | %s file.tiff\n", *v);
+		fprintf(stderr, "usage:\n\techo i j | %s file.tiff\n"
+			"\t%s [-m MB] [-l] [-n chunk] [-i pts.npy] [-o out.npy]"
+			" file.tiff\n", *v, *v);
 		return 1;
 	}
 	char *filename_in = v[1];
 	int megabytes = atoi(oM);
+	if (*oi || *oo || ol)
+		return main_getpixel_batch(filename_in, *oi ? oi : "-",
+				*oo ? oo : "-", megabytes, ol, atol(on));
 
 	struct tiff_tile_cache t[1];
 	tiff_tile_cache_init(t, filename_in, megabytes);
@@ -2257,6 +2799,354 @@ static int main_vzoomout(int c, char *v[])
 	return 0;
 }
 
+// main_pyramid {{{1
+
+// in-memory TIFF files, used to compress tiles on several threads
+struct memtiff {
+	uint8_t *data;
+	toff_t size, cap, pos;
+};
+
+static tmsize_t memtiff_read(thandle_t h, void *buf, tmsize_t n)
+{
+	struct memtiff *m = (void*)h;
+	if (m->pos >= m->size) return 0;
+	if (n > (tmsize_t)(m->size - m->pos)) n = m->size - m->pos;
+	memcpy(buf, m->data + m->pos, n);
+	m->pos += n;
+	return n;
+}
+
+static tmsize_t memtiff_write(thandle_t h, void *buf, tmsize_t n)
+{
+	struct memtiff *m = (void*)h;
+	if (m->pos + n > m->cap) {
+		m->cap = 2 * (m->pos + n);
+		m->data = realloc(m->data, m->cap);
+		if (!m->data) fail("out of memory for an in-memory tiff");
+	}
+	memcpy(m->data + m->pos, buf, n);
+	m->pos += n;
+	if (m->pos > m->size) m->size = m->pos;
+	return n;
+}
+
+static toff_t memtiff_seek(thandle_t h, toff_t off, int whence)
+{
+	struct memtiff *m = (void*)h;
+	if (whence == SEEK_SET) m->pos = off;
+	if (whence == SEEK_CUR) m->pos += off;
+	if (whence == SEEK_END) m->pos = m->size + off;
+	return m->pos;
+}
+
+static int memtiff_close(thandle_t h) { (void)h; return 0; }
+static toff_t memtiff_size(thandle_t h) { return ((struct memtiff*)h)->size; }
+static int memtiff_map(thandle_t h, void **b, toff_t *s)
+{ (void)h; (void)b; (void)s; return 0; }
+static void memtiff_unmap(thandle_t h, void *b, toff_t s)
+{ (void)h; (void)b; (void)s; }
+
+#define PYRAMID_LEVELS 30
+
+// one level of a pyramid being built
+struct pyramid_level {
+	struct tiff_info t;  // sizes of this level
+	char filename[FILENAME_MAX];
+	TIFF *tif;
+	uint8_t *rows;       // the current row of tiles (t.th rows)
+	uint8_t *next;       // a row of the next level
+	int nrows;           // rows of this level received so far
+};
+
+struct pyramid {
+	int n;               // number of levels
+	struct pyramid_level l[PYRAMID_LEVELS];
+	uint16_t compression, predictor;
+	int op;              // how to combine 2x2 pixels (see "combine_4doubles")
+};
+
+static void pyramid_set_fields(TIFF *tif, struct pyramid *p, int k)
+{
+	struct tiff_info *t = &p->l[k].t;
+	if (k > 0)
+		TIFFSetField(tif, TIFFTAG_SUBFILETYPE, FILETYPE_REDUCEDIMAGE);
+	TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, t->w);
+	TIFFSetField(tif, TIFFTAG_IMAGELENGTH, t->h);
+	TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, t->spp);
+	TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, t->bps);
+	TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, t->fmt);
+	TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tif, TIFFTAG_TILEWIDTH, t->tw);
+	TIFFSetField(tif, TIFFTAG_TILELENGTH, t->th);
+	TIFFSetField(tif, TIFFTAG_COMPRESSION, p->compression);
+	if (p->predictor != PREDICTOR_NONE)
+		TIFFSetField(tif, TIFFTAG_PREDICTOR, p->predictor);
+}
+
+// compress a tile with the codec of the pyramid, returns the size
+static tmsize_t pyramid_compress_tile(uint8_t **out, struct pyramid *p,
+		void *tile)
+{
+	struct memtiff m[1] = {{NULL, 0, 0, 0}};
+	TIFF *tif = TIFFClientOpen("memtiff", "w", (thandle_t)m,
+			memtiff_read, memtiff_write, memtiff_seek,
+			memtiff_close, memtiff_size, memtiff_map,
+			memtiff_unmap);
+	if (!tif) fail("could not create an in-memory tiff");
+	struct pyramid tp[1] = {*p};
+	tp->l[0].t.w = p->l[0].t.tw;
+	tp->l[0].t.h = p->l[0].t.th;
+	pyramid_set_fields(tif, tp, 0);
+	tmsize_t n = TIFFWriteEncodedTile(tif, 0, tile, tinfo_tilesize(&p->l[0].t));
+	uint64_t *off, *cnt;
+	if (n < 0
+		|| !TIFFGetField(tif, TIFFTAG_TILEOFFSETS, &off)
+		|| !TIFFGetField(tif, TIFFTAG_TILEBYTECOUNTS, &cnt))
+		fail("could not compress a tile");
+	n = cnt[0];
+	*out = xmalloc(n);
+	memcpy(*out, m->data + off[0], n);
+	TIFFClose(tif);
+	free(m->data);
+	return n;
+}
+
+// write the current row of tiles of a level
+static void pyramid_flush_row(struct pyramid *p, int k)
+{
+	struct pyramid_level *l = p->l + k;
+	struct tiff_info *t = &l->t;
+	int ps = tinfo_pixelsize(t);
+	int tj = (l->nrows - 1) / t->th;
+	int nr = l->nrows - tj * t->th;
+	int tilesize = tinfo_tilesize(t);
+	bool compressed = p->compression != COMPRESSION_NONE;
+	uint8_t *raw[t->ta];
+	tmsize_t rawsize[t->ta];
+
+	// fill and compress the tiles of this row in parallel
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int ti = 0; ti < t->ta; ti++)
+	{
+		uint8_t *tile = xmalloc(tilesize);
+		memset(tile, 0, tilesize);
+		int x0 = ti * t->tw;
+		int nc = t->w - x0 < t->tw ? t->w - x0 : t->tw;
+		for (int j = 0; j < nr; j++)
+			memcpy(tile + j * t->tw * ps,
+				l->rows + (j * t->w + x0) * ps, nc * ps);
+		if (compressed) {
+			rawsize[ti] = pyramid_compress_tile(raw + ti, p, tile);
+			free(tile);
+		} else {
+			raw[ti] = tile;
+			rawsize[ti] = tilesize;
+		}
+	}
+
+	// write them in order
+	for (int ti = 0; ti < t->ta; ti++)
+	{
+		tmsize_t r = compressed
+			? TIFFWriteRawTile(l->tif, tj*t->ta + ti, raw[ti], rawsize[ti])
+			: TIFFWriteEncodedTile(l->tif, tj*t->ta+ti, raw[ti], rawsize[ti]);
+		if (r < 0)
+			fail("could not write tile %d of \"%s\"", tj*t->ta+ti,
+					l->filename);
+		free(raw[ti]);
+	}
+}
+
+// give the next row of a level, and build the levels below it
+static void pyramid_push_row(struct pyramid *p, int k, uint8_t *row)
+{
+	struct pyramid_level *l = p->l + k;
+	struct tiff_info *t = &l->t;
+	int ps = tinfo_pixelsize(t);
+	int r = l->nrows % t->th;
+	memcpy(l->rows + r * t->w * ps, row, t->w * ps);
+	l->nrows += 1;
+	bool last = l->nrows == t->h;
+
+	// each pair of rows gives a row of the next level
+	// (the missing row or column at the border is replicated)
+	if (k + 1 < p->n && (l->nrows % 2 == 0 || last))
+	{
+		uint8_t *a = l->rows + (r - (l->nrows % 2 == 0)) * t->w * ps;
+		uint8_t *b = l->rows + r * t->w * ps;
+		int w = p->l[k+1].t.w;
+		for (int i = 0; i < w; i++)
+		{
+			int i0 = 2 * i, i1 = 2 * i + 1 < t->w ? 2 * i + 1 : 2 * i;
+			void *q[4] = { a + i0 * ps, a + i1 * ps,
+			               b + i0 * ps, b + i1 * ps };
+			combine_4pixels(l->next + i * ps, q,
+					t->spp, t->fmt, t->bps, p->op);
+		}
+		pyramid_push_row(p, k + 1, l->next);
+	}
+
+	if (r == t->th - 1 || last)
+		pyramid_flush_row(p, k);
+}
+
+// copy the tiles of an image into a new directory of a file
+static void append_raw_tiles(char *fname_out, char *fname_in,
+		struct pyramid *p, int k)
+{
+	TIFF *in = TIFFOpen(fname_in, "r");
+	TIFF *out = TIFFOpen(fname_out, "a");
+	if (!in || !out) fail("could not append level %d", k);
+	pyramid_set_fields(out, p, k);
+	uint64_t *cnt;
+	TIFFGetField(in, TIFFTAG_TILEBYTECOUNTS, &cnt);
+	int n = TIFFNumberOfTiles(in);
+	for (int i = 0; i < n; i++)
+	{
+		uint8_t *buf = xmalloc(cnt[i] ? cnt[i] : 1);
+		tmsize_t r = TIFFReadRawTile(in, i, buf, cnt[i]);
+		if (r < 0 || TIFFWriteRawTile(out, i, buf, r) < 0)
+			fail("could not copy tile %d of level %d", i, k);
+		free(buf);
+	}
+	TIFFClose(in);
+	TIFFClose(out);
+}
+
+// build the levels of a pyramid in a single pass over the input
+//
+// The input is read by rows of tiles (or by scanlines).  Each level keeps
+// only its current row of tiles, which is written when full, so the memory
+// needed is about twice a row of tiles of the input.  If the output
+// filename has a "%d", the levels are written into separate files,
+// otherwise into a single file, as reduced-resolution sub-images.
+// There are at most "nlevels" levels, and they stop when a level fits in
+// a single tile of size "tw x th" (0 = same tiles as the input).
+static void build_pyramid(char *fname_out, char *fname_in, int op,
+		int tw, int th, int nlevels, bool lzw)
+{
+	TIFF *tin = tiffopen_fancy(fname_in, "r");
+	if (!tin) fail("could not open TIFF file \"%s\"", fname_in);
+	struct tiff_info ti[1];
+	get_tiff_info(ti, tin);
+	if (ti->broken || ti->packed)
+		fail("can not build pyramids of broken or packed images");
+
+	// sizes of the levels
+	struct pyramid p[1];
+	TIFFGetFieldDefaulted(tin, TIFFTAG_COMPRESSION, &p->compression);
+	p->predictor = PREDICTOR_NONE;
+	if (p->compression != COMPRESSION_NONE)
+		TIFFGetFieldDefaulted(tin, TIFFTAG_PREDICTOR, &p->predictor);
+	if (lzw || p->compression == COMPRESSION_JPEG
+			|| p->compression == COMPRESSION_OJPEG) {
+		p->compression = COMPRESSION_LZW;
+		p->predictor = PREDICTOR_NONE;
+	}
+	p->op = op;
+	if (!tw) tw = ti->tiled ? ti->tw : 256;
+	if (!th) th = ti->tiled ? ti->th : 256;
+	if (tw % 16 || th % 16)
+		fail("the tile size %dx%d is not a multiple of 16", tw, th);
+	if (nlevels > PYRAMID_LEVELS) nlevels = PYRAMID_LEVELS;
+	bool single = !strstr(fname_out, "%d");
+	double gigabytes = tinfo_pixelsize(ti) * (double) ti->w * ti->h / 1e9;
+	p->n = 0;
+	for (int k = 0; k < nlevels; k++)
+	{
+		struct pyramid_level *l = p->l + k;
+		l->t = *ti;
+		l->t.w = k ? (p->l[k-1].t.w + 1) / 2 : ti->w;
+		l->t.h = k ? (p->l[k-1].t.h + 1) / 2 : ti->h;
+		l->t.tiled = true;
+		l->t.tw = tw;
+		l->t.th = th;
+		l->t.ta = how_many(l->t.w, tw);
+		l->t.td = how_many(l->t.h, th);
+		l->t.ntiles = l->t.ta * l->t.td;
+		int ps = tinfo_pixelsize(&l->t);
+		l->rows = xmalloc((size_t)l->t.w * th * ps);
+		l->next = xmalloc((size_t)((l->t.w + 1) / 2) * ps);
+		l->nrows = 0;
+		if (single && k > 0)
+			snprintf(l->filename, FILENAME_MAX, "%s.%d.tmp",
+					fname_out, k);
+		else
+			snprintf(l->filename, FILENAME_MAX, fname_out, k);
+		l->tif = TIFFOpen(l->filename, gigabytes > 1 ? "w8" : "w");
+		if (!l->tif) fail("could not create \"%s\"", l->filename);
+		pyramid_set_fields(l->tif, p, k);
+		p->n += 1;
+		if (l->t.ntiles == 1)
+			break;
+	}
+
+	// read the input by rows of tiles
+	int ps = tinfo_pixelsize(ti);
+	int rh = ti->tiled ? ti->th : 1;
+	uint8_t *rows = xmalloc((size_t)ti->w * rh * ps);
+	uint8_t *tile = ti->tiled ? xmalloc(tinfo_tilesize(ti)) : NULL;
+	for (int j = 0; j < ti->h; j += rh)
+	{
+		int nr = ti->h - j < rh ? ti->h - j : rh;
+		if (ti->tiled)
+			for (int i = 0; i < ti->w; i += ti->tw)
+			{
+				if (TIFFReadTile(tin, tile, i, j, 0, 0) < 0)
+					memset(tile, 0, tinfo_tilesize(ti));
+				int nc = ti->w - i < ti->tw ? ti->w - i : ti->tw;
+				for (int jj = 0; jj < nr; jj++)
+					memcpy(rows + (jj * ti->w + i) * ps,
+						tile + jj * ti->tw * ps, nc * ps);
+			}
+		else if (TIFFReadScanline(tin, rows, j, 0) < 0)
+			fail("could not read scanline %d of \"%s\"", j, fname_in);
+		for (int jj = 0; jj < nr; jj++)
+			pyramid_push_row(p, 0, rows + jj * ti->w * ps);
+	}
+	free(tile);
+	free(rows);
+	TIFFClose(tin);
+
+	for (int k = 0; k < p->n; k++)
+	{
+		TIFFClose(p->l[k].tif);
+		free(p->l[k].rows);
+		free(p->l[k].next);
+	}
+
+	// gather the levels into the output file
+	if (single)
+		for (int k = 1; k < p->n; k++)
+		{
+			append_raw_tiles(fname_out, p->l[k].filename, p, k);
+			remove(p->l[k].filename);
+		}
+}
+
+static int main_pyramid(int c, char *v[])
+{
+	int tside = atoi(pick_option(&c, &v, "t", "0"));
+	bool lzw = pick_option(&c, &v, "c", NULL);
+	if (c != 4) {
+		fprintf(stderr, "usage:\n\t"
+				"%s [-t side] [-c] {f|v|i|a} in.tiff out.tiff\n", *v);
+		//                                0  1        2       3
+		return 1;
+	}
+	int op = v[1][0];
+	char *filename_in = v[2];
+	char *filename_out = v[3];
+
+	build_pyramid(filename_out, filename_in, op, tside, tside,
+			PYRAMID_LEVELS, lzw);
+
+	return 0;
+}
+
 // main_crop {{{1
 static int main_crop(int c, char *v[])
 {
@@ -2282,12 +3172,16 @@ static int main_crop(int c, char *v[])
 }
 
 // main_tileize {{{1
+
+// convert a striped image into a tiled one, by rows of tiles
+// (this is the first level of a pyramid, see "build_pyramid" above)
 static int main_tileize(int c, char *v[])
 {
 	// process input arguments
+	bool lzw = pick_option(&c, &v, "c", NULL);
 	if (c != 5) {
-		fprintf(stderr, "usage:\n\t%s tw th in.tiff out.tiff\n", *v);
-		//                         0  1  2  3       4
+		fprintf(stderr, "usage:\n\t%s [-c] tw th in.tiff out.tiff\n", *v);
+		//                              0  1  2  3       4
 		return 1;
 	}
 	int tw = atoi(v[1]);
@@ -2295,85 +3189,15 @@ static int main_tileize(int c, char *v[])
 	char *filename_in = v[3];
 	char *filename_out = v[4];
 
-	// read info of input image
-	TIFF *tif_a = TIFFOpen(filename_in, "r");
-	if (!tif_a)
-		fail("could not open TIFF file \"%s\" (r)", filename_in);
 	struct tiff_info ta[1];
-	get_tiff_info(ta, tif_a);
+	get_tiff_info_filename(ta, filename_in);
 	if (ta->tiled)
 		fail("file is already tiled! please, use retile");
+	if (tw <= 0 || th <= 0)
+		fail("bad tile size %dx%d", tw, th);
 
-	// create output tiff info
-	struct tiff_info tb[1];
-	*tb = *ta; // copy most of the data fields, except the following:
-	tb->tiled = true;
-	tb->tw = tw;
-	tb->th = th;
-	tb->ta = how_many(tb->w, tb->w);
-	tb->td = how_many(tb->h, tb->h);
-	tb->ntiles = tb->ta * tb->td;
-
-	// create output image (better use an auxiliary function that uses "tb")
-	double GiB = 1024.0 * 1024.0 * 1024.0;
-	double gigabytes = (ta->spp/8.0) * ta->w * ta->h * ta->bps / GiB;
-	TIFF *tif_b = TIFFOpen(filename_out, gigabytes > 1 ? "w8" : "w");
-	if (!tif_b)
-		fail("could not open TIFF file \"%s\" (r)", filename_out);
-	TIFFSetField(tif_b, TIFFTAG_IMAGEWIDTH, ta->w);
-	TIFFSetField(tif_b, TIFFTAG_IMAGEWIDTH, ta->w);
-	TIFFSetField(tif_b, TIFFTAG_SAMPLESPERPIXEL, ta->spp);
-	TIFFSetField(tif_b, TIFFTAG_BITSPERSAMPLE, ta->bps);
-	TIFFSetField(tif_b, TIFFTAG_SAMPLEFORMAT, ta->fmt);
-	TIFFSetField(tif_b, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-	TIFFSetField(tif_b, TIFFTAG_TILEWIDTH, tw);
-	TIFFSetField(tif_b, TIFFTAG_TILELENGTH, th);
-
-	// alloc buffer for one row of tiles
-	int bufsize = tinfo_tilesize(tb) * tb->ta;
-	uint8_t *buf = xmalloc(bufsize); // this is the malloc that may fail
-	uint8_t *tbuf = xmalloc(tinfo_tilesize(tb)); // small, just for a tile
-
-	// for each row of tiles
-	for (int tj = 0; tj < tb->td; tj++)
-	{
-		memset(buf, 127, bufsize);
-
-		// load the required scanlines from "tif_a" into the buffer
-		int scanline_size = TIFFScanlineSize(tif_a);
-		for (int j = 0; j < th; j++)
-		{
-			uint8_t *lin = buf + j * scanline_size;
-			int jj = tj * th + j;
-			int r = TIFFReadScanline(tif_a, lin, jj, 0);
-			if (r < 0) fail("could not read scanline %d", jj);
-		}
-
-		// dump the buffer into the required output tiles of "tif_b"
-		for (int ti = 0; ti < tb->ta; ti++)
-		{
-			memset(tbuf, 200, tinfo_tilesize(tb));
-			for (int j = 0; j < th; j++)
-			{
-				fail("write the body of this loop!");
-				int ps = tinfo_pixelsize(tb);
-				int tlin = ps * tw;
-				int off_out = 0;
-				int off_in = 0;
-				memcpy(tbuf + off_out, buf + off_in, tlin);
-			}
-			int tcorner_i = 0;
-			int tcorner_j = 0;
-			TIFFWriteTile(tif_b, tbuf, tcorner_i, tcorner_j, 0, 0);
-		}
-	}
-
+	build_pyramid(filename_out, filename_in, 'f', tw, th, 1, lzw);
 
-	// close the files (closing the outpuf file is necessary, because
-	// it writes part of the header).
-	TIFFClose(tif_b);
-	TIFFClose(tif_a);
-	free(buf);
 	return 0;
 }
 
@@ -2675,6 +3499,7 @@ int main_tiffu(int c, char *v[])
 	if (0 == strcmp(v[1], "getpixel")) return main_getpixel(c-1, v+1);
 	if (0 == strcmp(v[1], "zoomout"))  return main_zoomout (c-1, v+1);
 	if (0 == strcmp(v[1], "vzoomout")) return main_vzoomout(c-1, v+1);
+	if (0 == strcmp(v[1], "pyramid"))  return main_pyramid (c-1, v+1);
 	if (0 == strcmp(v[1], "manwhole")) return main_manwhole(c-1, v+1);
 	if (0 == strcmp(v[1], "octaves"))  return main_octaves (c-1, v+1);
 	if (0 == strcmp(v[1], "dlist"))    return main_dlist   (c-1, v+1);
@@ -0,0 +1,245 @@
+#ifndef _TILERASTER_C
+#define _TILERASTER_C
+
+// parallel drawing of many points and anti-aliased segments over an image
+//
+// The primitives are first recorded, in order, into a batch.  Then, they are
+// binned by the square tiles of the image that they cross (a segment is put
+// only into the tiles along its path, not into all the tiles of its bounding
+// box), and the tiles are drawn in parallel, each one by a single thread.
+// A segment is traversed only within each tile, so that the very long
+// segments (e.g., lines across the image) cost only their visible part.  The
+// segments are traversed exactly as by "traverse_segment_aa", and the
+// primitives of each tile are drawn in the order of the batch, so that the
+// result is the same as drawing the primitives one after another, and does
+// not depend on the number of threads.
+//
+// The points are copied over the pixels, and the segments are blended into
+// them by the function "blend" of the batch, whose third argument is the
+// coverage of the pixel.
+//
+// This file needs the functions "xmalloc" and "xrealloc" (e.g., from
+// xmalloc.c).
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILERASTER_SIDE 64 // side of the tiles
+
+struct tileraster_prim {
+	int p[4];      // the end points, or the point in p[0],p[1]
+	bool segment;
+	uint8_t c[4];  // color (the first pd bytes are used)
+};
+
+struct tileraster {
+	int w, h, pd;  // image of w*h pixels of pd bytes
+	uint8_t *x;
+	void (*blend)(uint8_t *pixel, uint8_t *color, float f);
+
+	int n, nmax;
+	struct tileraster_prim *t;
+};
+
+static void tileraster_init(struct tileraster *r, uint8_t *x, int w, int h,
+		int pd, void (*blend)(uint8_t*,uint8_t*,float))
+{
+	r->w = w;
+	r->h = h;
+	r->pd = pd;
+	r->x = x;
+	r->blend = blend;
+	r->n = 0;
+	r->nmax = 1024;
+	r->t = xmalloc(r->nmax * sizeof*r->t);
+}
+
+static void tileraster_free(struct tileraster *r)
+{
+	free(r->t);
+}
+
+static struct tileraster_prim *tileraster_push(struct tileraster *r,
+		const uint8_t *c)
+{
+	if (r->n == r->nmax) {
+		r->nmax *= 2;
+		r->t = xrealloc(r->t, r->nmax * sizeof*r->t);
+	}
+	struct tileraster_prim *t = r->t + r->n++;
+	memcpy(t->c, c, r->pd);
+	return t;
+}
+
+// add a pixel of color c at (x,y)
+static void tileraster_point(struct tileraster *r, int x, int y,
+		const uint8_t *c)
+{
+	struct tileraster_prim *t = tileraster_push(r, c);
+	t->segment = false;
+	t->p[0] = x;
+	t->p[1] = y;
+}
+
+// add an anti-aliased segment of color c from (px,py) to (qx,qy)
+static void tileraster_segment(struct tileraster *r,
+		int px, int py, int qx, int qy, const uint8_t *c)
+{
+	struct tileraster_prim *t = tileraster_push(r, c);
+	t->segment = true;
+	// (the order of traversal of "traverse_segment_aa")
+	bool swap = (px != qx || py != qy) && qx + qy < px + py;
+	t->p[0] = swap ? qx : px;
+	t->p[1] = swap ? qy : py;
+	t->p[2] = swap ? px : qx;
+	t->p[3] = swap ? py : qy;
+}
+
+static void tileraster_pixel(struct tileraster *r, int x0, int y0, int x1,
+		int y1, int i, int j, uint8_t *c, float f)
+{
+	if (i >= x0 && i < x1 && j >= y0 && j < y1)
+		r->blend(r->x + (j * (long)r->w + i) * r->pd, c, f);
+}
+
+// traverse the part of the segment t inside the rectangle [x0,x1)x[y0,y1)
+static void tileraster_draw_segment(struct tileraster *r,
+		struct tileraster_prim *t, int x0, int y0, int x1, int y1)
+{
+	int px = t->p[0], py = t->p[1], qx = t->p[2], qy = t->p[3];
+	if (px == qx && py == qy)
+		tileraster_pixel(r, x0, y0, x1, y1, px, py, t->c, 1.0);
+	else if (abs(qx - px) > qy - py) { // horizontal
+		float slope = (qy - py); slope /= (qx - px);
+		int ia = x0 - px > 0 ? x0 - px : 0;
+		int ib = x1 - 1 - px < qx - px ? x1 - 1 - px : qx - px;
+		for (int i = ia; i <= ib; i++) {
+			float exact = py + i*slope;
+			int whole = lrint(exact);
+			float part = fabs(whole - exact);
+			int owhole = (whole<exact)?whole+1:whole-1;
+			tileraster_pixel(r,x0,y0,x1,y1, i+px,whole, t->c,1-part);
+			tileraster_pixel(r,x0,y0,x1,y1, i+px,owhole, t->c,part);
+		}
+	} else { // vertical
+		float slope = (qx - px); slope /= (qy - py);
+		int ja = y0 - py > 0 ? y0 - py : 0;
+		int jb = y1 - 1 - py < qy - py ? y1 - 1 - py : qy - py;
+		for (int j = ja; j <= jb; j++) {
+			float exact = px + j*slope;
+			int whole = lrint(exact);
+			float part = fabs(whole - exact);
+			int owhole = (whole<exact)?whole+1:whole-1;
+			tileraster_pixel(r,x0,y0,x1,y1, whole,j+py, t->c,1-part);
+			tileraster_pixel(r,x0,y0,x1,y1, owhole,j+py, t->c,part);
+		}
+	}
+}
+
+struct tileraster_bin { int tile, prim; };
+
+struct tileraster_bins {
+	int n, nmax;
+	struct tileraster_bin *b;
+};
+
+static void tileraster_bin(struct tileraster_bins *b, int tile, int prim)
+{
+	if (b->n == b->nmax) {
+		b->nmax = b->nmax ? 2 * b->nmax : 1024;
+		b->b = xrealloc(b->b, b->nmax * sizeof*b->b);
+	}
+	b->b[b->n].tile = tile;
+	b->b[b->n].prim = prim;
+	b->n += 1;
+}
+
+// bin the tiles crossed by the primitive k (the minor coordinate of the
+// pixels of a segment is within 2 of the line, on each span of major
+// coordinates)
+static void tileraster_bin_prim(struct tileraster_bins *b,
+		struct tileraster *r, int k)
+{
+	int S = TILERASTER_SIDE, nx = (r->w + S - 1) / S, ny = (r->h + S - 1) / S;
+	int *p = r->t[k].p;
+	if (!r->t[k].segment || (p[0] == p[2] && p[1] == p[3])) {
+		if (p[0] >= 0 && p[0] < r->w && p[1] >= 0 && p[1] < r->h)
+			tileraster_bin(b, (p[1] / S) * nx + p[0] / S, k);
+		return;
+	}
+	bool horizontal = abs(p[2] - p[0]) > p[3] - p[1];
+	int a  = horizontal ? 0 : 1; // index of the major coordinate
+	int na = horizontal ? nx : ny, nb = horizontal ? ny : nx;
+	int la = horizontal ? r->w : r->h, lb = horizontal ? r->h : r->w;
+	double slope = (p[3-a] - p[1-a]) / (double)(p[2+a] - p[a]);
+	int u0 = p[a] > 0 ? p[a] : 0;
+	int u1 = p[2+a] < la - 1 ? p[2+a] : la - 1;
+	for (int ta = u0 / S; u0 <= u1 && ta < na && ta * S <= u1; ta++)
+	{
+		int ua = ta * S > u0 ? ta * S : u0;
+		int ub = ta * S + S - 1 < u1 ? ta * S + S - 1 : u1;
+		double va = p[1-a] + (ua - p[a]) * slope;
+		double vb = p[1-a] + (ub - p[a]) * slope;
+		double vmin = fmin(va, vb) - 2, vmax = fmax(va, vb) + 2;
+		if (vmax < 0 || vmin > lb - 1)
+			continue;
+		int tb0 = vmin < 0 ? 0 : vmin / S;
+		int tb1 = vmax > lb - 1 ? nb - 1 : vmax / S;
+		for (int tb = tb0; tb <= tb1; tb++)
+			tileraster_bin(b, horizontal ? tb*nx + ta : ta*nx + tb, k);
+	}
+}
+
+// draw the batch, and empty it
+static void tileraster_draw(struct tileraster *r)
+{
+	int S = TILERASTER_SIDE, nx = (r->w + S - 1) / S, ny = (r->h + S - 1) / S;
+	int nt = nx * ny;
+
+	// bins of the primitives, sorted by tile (in order within each tile)
+	struct tileraster_bins b[1] = {{0}};
+	for (int k = 0; k < r->n; k++)
+		tileraster_bin_prim(b, r, k);
+	int *start = xmalloc((nt + 1) * sizeof*start);
+	int *prim = xmalloc((b->n ? b->n : 1) * sizeof*prim);
+	for (int t = 0; t <= nt; t++)
+		start[t] = 0;
+	for (int k = 0; k < b->n; k++)
+		start[b->b[k].tile + 1] += 1;
+	for (int t = 0; t < nt; t++)
+		start[t + 1] += start[t];
+	for (int k = 0; k < b->n; k++)
+		prim[start[b->b[k].tile]++] = b->b[k].prim;
+	for (int t = nt; t > 0; t--)
+		start[t] = start[t - 1];
+	start[0] = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int t = 0; t < nt; t++)
+	{
+		int x0 = (t % nx) * S, y0 = (t / nx) * S;
+		int x1 = x0 + S < r->w ? x0 + S : r->w;
+		int y1 = y0 + S < r->h ? y0 + S : r->h;
+		for (int k = start[t]; k < start[t + 1]; k++)
+		{
+			struct tileraster_prim *q = r->t + prim[k];
+			if (q->segment)
+				tileraster_draw_segment(r, q, x0, y0, x1, y1);
+			else
+				memcpy(r->x + (q->p[1] * (long)r->w + q->p[0])
+						* r->pd, q->c, r->pd);
+		}
+	}
+
+	free(prim);
+	free(start);
+	free(b->b);
+	r->n = 0;
+}
+
+#endif//_TILERASTER_C
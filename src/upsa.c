@@ -12,6 +12,7 @@
 #include "marching_squares.c"
 #include "marching_interpolation.c"
 #include "bicubic.c"
+#include "pd_specialize.h"
 
 static float getsample(float *x, int w, int h, int pd, int i, int j, int l)
 {
@@ -91,7 +92,7 @@ static float interpolate_cell(float a, float b, float c, float d,
 	return -1;
 }
 
-static void interpolate_vec(float *out, float *x, int w, int h, int pd,
+static inline void interpolate_vec(float *out, float *x, int w, int h, int pd,
 		float p, float q, int m)
 {
 	if (m == 3) {
@@ -112,33 +113,148 @@ static void interpolate_vec(float *out, float *x, int w, int h, int pd,
 	}
 }
 
-float *zoom(float *x, int w, int h, int pd, int n, int zt,
-		int *ow, int *oh)
+// Separable resampling.
+//
+// All the methods except the marching interpolation (1) are products of
+// one-dimensional kernels.  For each output column (and row) the input
+// taps and their weights are computed once, and then the image is
+// resampled by a pass over the rows and a pass over the columns.
+//
+// 	 0  nearest neighbor       (1 tap)
+// 	 2  bilinear               (2 taps)
+// 	-2  bilinear "fade"        (2 taps)
+// 	-3  bilinear "fadeinv"     (2 taps)
+// 	 3  bicubic (Keys, a=-0.5) (4 taps)
+// 	 4  lanczos3               (6 taps)
+
+static int resampling_taps(int m)
 {
-	int W = n*w - n;  // l'amour est un oiseau rebelle
-	int H = n*h - n;  // que nul ne peut apprivoiser
-	float *y = xmalloc(W*H*pd*sizeof*y), nf = n;
-	for (int j = 0; j < H; j++)
-	for (int i = 0; i < W; i++)
+	switch (m) {
+	case 0:  return 1;
+	case 2:
+	case -2:
+	case -3: return 2;
+	case 3:  return 4;
+	case 4:  return 6;
+	default: return 0; // not separable
+	}
+}
+
+static float lanczos3(float x)
+{
+	if (x == 0) return 1;
+	if (fabs(x) >= 3) return 0;
+	double t = M_PI * x;
+	return 3 * sin(t) * sin(t/3) / (t * t);
+}
+
+// taps and weights of the sample at position p of a signal of length n
+static void resampling_weights(int *idx, float *wgt, float p, int n, int m)
+{
+	int ip = floor(p), k = resampling_taps(m), i0 = ip;
+	float x = p - ip;
+	switch (m) {
+	case 0:
+		i0 = x < 0.5 ? ip : ip + 1;
+		wgt[0] = 1;
+		break;
+	case 2:
+	case -2:
+	case -3:
+		if (m == -2) x = fade(x);
+		if (m == -3) x = fadeinv(x);
+		wgt[0] = 1 - x;
+		wgt[1] = x;
+		break;
+	case 3:
+		i0 = ip - 1;
+		wgt[0] = 0.5 * x * (-1 + x * (2 - x));
+		wgt[1] = 1 + 0.5 * x * x * (-5 + 3 * x);
+		wgt[2] = 0.5 * x * (1 + x * (4 - 3 * x));
+		wgt[3] = 0.5 * x * x * (-1 + x);
+		break;
+	case 4: {
+		i0 = ip - 2;
+		float t = 0;
+		for (int i = 0; i < 6; i++)
+			t += wgt[i] = lanczos3(x + 2 - i);
+		for (int i = 0; i < 6; i++)
+			wgt[i] /= t;
+		break;
+		}
+	default: fail("resampling method %d is not separable", m);
+	}
+	for (int i = 0; i < k; i++) // extrapolation by nearest value
 	{
-		float tmp[pd];
-		interpolate_vec(tmp, x, w, h, pd, i/nf, j/nf, zt);
-		for (int l = 0; l < pd; l++)
-			setsample(y, W, H, pd, i, j, l, tmp[l]);
+		int j = i0 + i;
+		idx[i] = j < 0 ? 0 : (j >= n ? n - 1 : j);
 	}
+}
 
-	*ow = W;
-	*oh = H;
-	return y;
+// resample a row x to the width W, given k taps and weights for each output
+PD_KERNEL void zoom_row(float *y, int W, float *x, int pd,
+		int *ix, float *wx, int k)
+{
+	for (int i = 0; i < W; i++)
+	for (int l = 0; l < pd; l++)
+	{
+		float r = 0;
+		for (int q = 0; q < k; q++)
+			r += wx[i*k+q] * x[ix[i*k+q]*pd + l];
+		y[i*pd + l] = r;
+	}
 }
 
-float *zoom_with_offset(float *x, int w, int h, int pd, int n, int zt,
-		int *ow, int *oh, float dx, float dy)
+// y(i,j) = x((i-dx)/n, (j-dy)/n), for an output image of size W x H
+static void zoom_separable(float *y, int W, int H, float *x, int w, int h,
+		int pd, int n, int m, float dx, float dy)
 {
-	int W = n*w - n;  // l'amour est enfant de Bohême
-	int H = n*h - n;  // il n'a jamais jamais connu de loi
-	float *y = xmalloc(W*H*pd*sizeof*y), nf = n;
+	int k = resampling_taps(m);
+	float nf = n;
+	int *ix = xmalloc(W*k*sizeof*ix), *iy = xmalloc(H*k*sizeof*iy);
+	float *wx = xmalloc(W*k*sizeof*wx), *wy = xmalloc(H*k*sizeof*wy);
+	for (int i = 0; i < W; i++)
+		resampling_weights(ix + i*k, wx + i*k, (i-dx)/nf, w, m);
 	for (int j = 0; j < H; j++)
+		resampling_weights(iy + j*k, wy + j*k, (j-dy)/nf, h, m);
+
+	// horizontal pass: each row of the input to the output width
+	float *t = xmalloc((long)W*h*pd*sizeof*t);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < h; j++)
+		PD_SPECIALIZE(pd, zoom_row(t + (long)j*W*pd, W,
+					x + (long)j*w*pd, pd, ix, wx, k));
+
+	// vertical pass: linear combinations of whole rows (vectorizable)
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < H; j++)
+	{
+		float *yj = y + (long)j*W*pd;
+		for (int i = 0; i < W*pd; i++)
+			yj[i] = 0;
+		for (int q = 0; q < k; q++)
+		{
+			float a = wy[j*k+q], *tq = t + (long)iy[j*k+q]*W*pd;
+			for (int i = 0; i < W*pd; i++)
+				yj[i] += a * tq[i];
+		}
+	}
+
+	free(t);
+	free(ix);
+	free(iy);
+	free(wx);
+	free(wy);
+}
+
+// the row j of the zoom, by a non-separable interpolation
+PD_KERNEL void zoom_into_row(float *y, int W, int H, float *x, int w, int h,
+		int pd, int j, float nf, float dx, float dy, int zt)
+{
 	for (int i = 0; i < W; i++)
 	{
 		float tmp[pd];
@@ -146,19 +262,55 @@ float *zoom_with_offset(float *x, int w, int h, int pd, int n, int zt,
 		for (int l = 0; l < pd; l++)
 			setsample(y, W, H, pd, i, j, l, tmp[l]);
 	}
+}
+
+// zoom into an already allocated image y of size (n*w-n)x(n*h-n)
+void zoom_into(float *y, float *x, int w, int h, int pd, int n, int zt,
+		float dx, float dy)
+{
+	int W = n*w - n;  // l'amour est enfant de Bohême
+	int H = n*h - n;  // il n'a jamais jamais connu de loi
+	float nf = n;
+	if (resampling_taps(zt)) {
+		zoom_separable(y, W, H, x, w, h, pd, n, zt, dx, dy);
+		return;
+	}
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j < H; j++)
+		PD_SPECIALIZE(pd, zoom_into_row(y, W, H, x, w, h, pd,
+					j, nf, dx, dy, zt));
+}
 
+float *zoom_with_offset(float *x, int w, int h, int pd, int n, int zt,
+		int *ow, int *oh, float dx, float dy)
+{
+	int W = n*w - n;
+	int H = n*h - n;
+	float *y = xmalloc(W*H*pd*sizeof*y);
 	*ow = W;
 	*oh = H;
+	zoom_into(y, x, w, h, pd, n, zt, dx, dy);
 	return y;
 }
 
+float *zoom(float *x, int w, int h, int pd, int n, int zt,
+		int *ow, int *oh)
+{
+	return zoom_with_offset(x, w, h, pd, n, zt, ow, oh, 0, 0);
+}
+
 #include "pickopt.c"
+#include "profile.c"
 int main_upsa(int c, char *v[])
 {
 	float off_x = atof(pick_option(&c, &v, "x", "0"));
 	float off_y = atof(pick_option(&c, &v, "y", "0"));
 	if (c < 3 || c > 5) {
-		fprintf(stderr, "usage:\n\t%s zoomf zoomtype [in [out]]\n", *v);
+		fprintf(stderr, "usage:\n\t%s zoomf zoomtype [in [out]]\n"
+			"zoomtype: 0=nearest 1=marching 2=bilinear -2=fade "
+			"-3=fadeinv 3=bicubic 4=lanczos3\n", *v);
 		//                            1     2         3   4
 		return 1;
 	}
@@ -171,8 +323,10 @@ int main_upsa(int c, char *v[])
 	int w, h, pd;
 	float *x = iio_read_image_float_vec(filename_in, &w, &h, &pd);
 
-	int ow, od;
-	float *y = zoom_with_offset(x,w,h,pd, zf, zt, &ow,&od, off_x,off_y);
+	int ow = 0, od = 0;
+	float *y = NULL;
+	PROFILE_SCOPE("upsa")
+		y = zoom_with_offset(x,w,h,pd, zf, zt, &ow,&od, off_x,off_y);
 
 	iio_write_image_float_vec(filename_out, y, ow, od, pd);
 
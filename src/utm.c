@@ -0,0 +1,165 @@
+#ifndef _UTM_C
+#define _UTM_C
+
+// conversion of longitude and latitude (WGS84, in degrees) into UTM (meters)
+//
+// The transverse Mercator projection is evaluated by the series of Krüger to
+// the third order (about a millimeter of error inside the zones).  A zone is
+// given by its number, positive for the northern hemisphere and negative for
+// the southern one (whose northings start at 10000 km).  The zone 0 means the
+// zone of each point, and its hemisphere.
+//
+// The array function processes blocks of points in parallel.  The constants
+// of the series are computed once for all the points, and the multiple
+// angles of the series by recurrences, so that each point costs a few
+// elementary functions.
+
+#include <math.h>
+#include <stdlib.h>
+
+#define UTM_BLOCK 256
+
+// constants for Krüger approximation
+struct utm_constants {
+	double rn;        // 2*sqrt(n)/(1+n)
+	double kA;        // k0 times the rectifying radius
+	double alpha[3];  // coefficients of the series
+};
+
+static void utm_constants(struct utm_constants *c)
+{
+	double a = 6378137;            // equatorial radius in meters
+	double f = 1 / 298.257223563;  // flattening
+	double k0 = 0.9996;            // base point scale factor
+	double n = f / (2 - f);
+	c->rn = 2 * sqrt(n) / (1 + n);
+	c->kA = k0 * a / (1 + n) * (1 + n*n/4 + n*n*n*n/64);
+	c->alpha[0] = n/2 - 2*n*n/3 + 5*n*n*n/16;
+	c->alpha[1] = 13*n*n/48 - 3*n*n*n/5;
+	c->alpha[2] = 61*n*n*n/240;
+}
+
+#define UTM_E0 500000.0      // easting of the central meridian
+#define UTM_N0S 10000000.0   // northing of the equator, in the south
+
+int utm_zone_from_longitude(double l)
+{
+	return 1 + lrint(floor((l + 180) / 6)) % 60;
+}
+
+// longitude of the central meridian of a zone, in radians
+static double utm_central_meridian(int zone)
+{
+	return (6 * abs(zone) - 183) * (M_PI / 180);
+}
+
+// easting and northing of a point, relative to the meridian lon0 (radians)
+static inline void utm_point(double *e, double *n, double lon, double lat,
+		double lon0, double n0, const struct utm_constants *c)
+{
+	double s = sin(lat * (M_PI / 180));
+	double dl = lon * (M_PI / 180) - lon0;
+	double t = sinh(atanh(s) - c->rn * atanh(c->rn * s));
+	double xi = atan(t / cos(dl));
+	double eta = atanh(sin(dl) / sqrt(1 + t*t));
+
+	// sin(2j xi), cos(2j xi), sinh(2j eta), cosh(2j eta) for j = 1, 2, 3
+	double s1 = sin(2*xi), c1 = cos(2*xi);
+	double x1 = exp(2*eta), sh1 = (x1 - 1/x1) / 2, ch1 = (x1 + 1/x1) / 2;
+	double sj = s1, cj = c1, shj = sh1, chj = ch1;
+	double E = eta, N = xi;
+	for (int j = 0; j < 3; j++)
+	{
+		E += c->alpha[j] * cj * shj;
+		N += c->alpha[j] * sj * chj;
+		double sn = sj * c1 + cj * s1, cn = cj * c1 - sj * s1;
+		double shn = shj * ch1 + chj * sh1, chn = chj * ch1 + shj * sh1;
+		sj = sn; cj = cn; shj = shn; chj = chn;
+	}
+	*e = UTM_E0 + c->kA * E;
+	*n = n0 + c->kA * N;
+}
+
+// UTM coordinates of a point in its own zone (returns the zone number)
+int utm_from_lonlat_kruger(double out_utm[2], double in_lonlat[2])
+{
+	struct utm_constants c[1];
+	utm_constants(c);
+	int z = utm_zone_from_longitude(in_lonlat[0]);
+	utm_point(out_utm + 0, out_utm + 1, in_lonlat[0], in_lonlat[1],
+			utm_central_meridian(z), in_lonlat[1] < 0 ? UTM_N0S : 0, c);
+	return z;
+}
+
+// (e[i], n[i]) = UTM coordinates of (lon[i], lat[i]) in the given zone, for
+// i in [0, np) (the outputs may be the inputs)
+static void utm_from_lonlat_many(double *e, double *n,
+		double *lon, double *lat, long np, int zone)
+{
+	struct utm_constants c[1];
+	utm_constants(c);
+	double lon0 = utm_central_meridian(zone);
+	double n0 = zone < 0 ? UTM_N0S : 0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (long b = 0; b < np; b += UTM_BLOCK)
+	{
+		int m = np - b < UTM_BLOCK ? np - b : UTM_BLOCK;
+		if (zone)
+			for (int l = 0; l < m; l++)
+				utm_point(e + b + l, n + b + l, lon[b+l], lat[b+l],
+						lon0, n0, c);
+		else
+			for (int l = 0; l < m; l++)
+			{
+				int z = utm_zone_from_longitude(lon[b+l]);
+				utm_point(e + b + l, n + b + l, lon[b+l], lat[b+l],
+						utm_central_meridian(z),
+						lat[b+l] < 0 ? UTM_N0S : 0, c);
+			}
+	}
+}
+
+//void lonlat_from_utm(double out_lonlat[2], double in_utm[2], int zone);
+
+#ifndef OMIT_MAIN_UTM
+#define MAIN_UTM
+#endif//OMIT_MAIN_UTM
+
+#ifdef MAIN_UTM
+#include <stdio.h>
+#include <stdlib.h>
+int main(int c, char *v[])
+{
+	// "utm zone < lonlat.txt > en.txt", for many points
+	if (c == 2) {
+		int zone = atoi(v[1]);
+		int N = 0x10000, m;
+		double *x = malloc(2 * N * sizeof*x), *y = x + N;
+		do {
+			for (m = 0; m < N; m++)
+				if (2 != scanf("%lf %lf", x + m, y + m))
+					break;
+			utm_from_lonlat_many(x, y, x, y, m, zone);
+			for (int i = 0; i < m; i++)
+				printf("%.3lf %.3lf\n", x[i], y[i]);
+		} while (m == N);
+		free(x);
+		return 0;
+	}
+	if (c != 3)
+		return fprintf(stderr, "usage:\n\t%s lon lat\n"
+				"\t%s zone < lonlat.txt > en.txt\n", *v, *v);
+	//                                         0 1   2
+	double lon = atof(v[1]);
+	double lat = atof(v[2]);
+	double lonlat[2] = {lon, lat}, utm[2];
+	int z = utm_from_lonlat_kruger(utm, lonlat);
+	printf("%d %.3lf %.3lf\n", z, utm[0], utm[1]);
+	return 0;
+
+}
+#endif//MAIN_UTM
+
+#endif//_UTM_C
@@ -425,6 +425,7 @@ static char *help_string_long     =
 " -k IMAGE     operate over the channels of a single image\n"
 " -c IMAGE     operate over the columns of a single image\n"
 " -i           operate independently along the dimensions of multispectral images\n"
+" -m MB        stream the images by bands of rows that fit in MB megabytes\n"
 "\n"
 "Operations:\n"
 " min          minimum value of the good samples\n"
@@ -468,6 +469,34 @@ static char *help_string_long     =
 ;
 #include "help_stuff.c"
 #include "pickopt.c"
+#include "stackreduce.c"
+
+// operation and goodness criterion
+struct veco_operation {
+	float (*f)(float *,int);
+	bool (*isgood)(float);
+};
+
+// apply the operation to each channel of the bands x[0..n-1]
+// (for "stackreduce")
+static void veco_band(void *ee, float *y, float **x, int n, int pd,
+		int w, int h)
+{
+	struct veco_operation *e = ee;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (long i = 0; i < w * (long)h * pd; i++)
+	{
+		float tmp[n];
+		int ngood = 0;
+		for (int j = 0; j < n; j++)
+			if (e->isgood(x[j][i]))
+				tmp[ngood++] = x[j][i];
+		y[i] = e->f(tmp, ngood);
+	}
+}
+
 int main_veco(int c, char *v[])
 {
 	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
@@ -479,6 +508,7 @@ int main_veco(int c, char *v[])
 	bool indep_chans =   pick_option(&c, &v, "i", 0);
 	char *goodness   =   pick_option(&c, &v, "g", "numeric");
 	char *filename_out = pick_option(&c, &v, "o", "-");
+	double megabytes   = atof(pick_option(&c, &v, "m", "0"));
 	if (c < 3 && !by_channels && !by_slices) {
 		fprintf(stderr,
 		"usage:\n\t%s {sum|min|max|avg|mul|med} [v1 ...] > out\n", *v);
@@ -620,6 +650,10 @@ int main_veco(int c, char *v[])
 		}
 		float out = f(y, ngood);
 		printf("%lf\n", out);
+	} else if (megabytes > 0) {
+		struct veco_operation e = {f, isgood};
+		stackreduce(filename_out, 0, v + 2, n, indep_chans ? 0 : 1,
+				megabytes, veco_band, &e);
 	} else if (indep_chans) {
 		float *x[n];
 		int w[n], h[n], d[n];
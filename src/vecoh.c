@@ -422,6 +422,7 @@ static char *help_string_long     =
 "Options:\n"
 " -o file      use a named output file instead of stdout\n"
 " -x NUMS      instead of images, compute clustering of the given numbers\n"
+" -m MB        stream the images by bands of rows that fit in MB megabytes\n"
 "\n"
 "Operations:\n"
 " kmeans          shortest vector in euclidean norm\n"
@@ -436,44 +437,24 @@ static char *help_string_long     =
 
 #include "help_stuff.c"
 #include "pickopt.c"
+#include "stackreduce.c"
 SMART_PARAMETER_SILENT(VECOH_VERBOSE,0)
-// main main: compute the modes of a series of images
-int main_vecoh(int c, char *v[])
-{
-	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
-	if (pick_option(&c, &v, "t", 0)) return main_ttry(c, v);
-	if (pick_option(&c, &v, "x", 0)) return main_xtry(c, v);
-	char *filename_out = pick_option(&c, &v, "o", "-");
-	if (c < 3) {
-		fprintf(stderr,
-		"usage:\n\t%s {kmeans|kmedians|contrario} [v1 ...] [-o out]\n", *v);
-		//          0  1                            2  3
-		return 1;
-	}
-	int n = c - 2;
-	char *operation_name = v[1];
-	float *x[n];
-	int w[n], h[n], pd[n];
-	for (int i = 0; i < n; i++)
-		x[i] = iio_read_image_float_vec(v[i+2], w + i, h + i, pd + i);
-	for (int i = 0; i < n; i++) {
-		if (w[i] != *w || h[i] != *h || pd[i] != 1)
-			fail("bad %dth image size\n", i);
-	}
 
-	void (*f)(float*,int,float*,int,float) = NULL;
-	if (0==strcmp(operation_name, "kmeans"))    f=float_xmeans;
-	if (0==strcmp(operation_name, "kmedians"))  f=float_xmedians;
-	if (0==strcmp(operation_name, "contrario")) f=acontrario_modes_detector;
-	if (!f) return fprintf(stderr, "unrecognized operation \"%s\"\n",
-				operation_name);
+typedef void (*vecoh_operation)(float*,int,float*,int,float);
 
-	int out_pd = 8;
-	float (*y) = xmalloc(*w * *h * out_pd * sizeof*y);
+#define VECOH_OUT_PD 8
+
+// apply the operation *e to the bands x[0..n-1]
+// (the computation at the pixel "verbose", if not negative, is printed)
+static void vecoh_band_verbose(void *e, float *y, float **x, int n,
+		int w, int h, long verbose)
+{
+	vecoh_operation f = *(vecoh_operation *)e;
+	int out_pd = VECOH_OUT_PD;
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
-	for (int i = 0; i < *w * *h; i++)
+	for (long i = 0; i < w * (long)h; i++)
 	{
 		float tmp[n];
 		int ngood = 0;
@@ -483,8 +464,8 @@ int main_vecoh(int c, char *v[])
 				ngood += 1;
 			}
 		f(y + i*out_pd, out_pd, tmp, ngood, PRECISION());
-		if (VECOH_VERBOSE() && 2*i == *w**h)
-		{ // if requested, print the computation at the central pixel
+		if (i == verbose)
+		{
 			float *Y = y + i*out_pd;
 			fprintf(stderr, "x = ");
 			for (int l = 0; l < n; l++)
@@ -496,6 +477,60 @@ int main_vecoh(int c, char *v[])
 
 		}
 	}
+}
+
+// (for "stackreduce", the images have one channel)
+static void vecoh_band(void *e, float *y, float **x, int n, int pd,
+		int w, int h)
+{
+	(void)pd;
+	vecoh_band_verbose(e, y, x, n, w, h, -1);
+}
+
+// main main: compute the modes of a series of images
+int main_vecoh(int c, char *v[])
+{
+	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
+	if (pick_option(&c, &v, "t", 0)) return main_ttry(c, v);
+	if (pick_option(&c, &v, "x", 0)) return main_xtry(c, v);
+	char *filename_out = pick_option(&c, &v, "o", "-");
+	double megabytes = atof(pick_option(&c, &v, "m", "0"));
+	if (c < 3) {
+		fprintf(stderr,
+		"usage:\n\t%s {kmeans|kmedians|contrario} [v1 ...] [-o out]\n", *v);
+		//          0  1                            2  3
+		return 1;
+	}
+	int n = c - 2;
+	char *operation_name = v[1];
+
+	vecoh_operation f = NULL;
+	if (0==strcmp(operation_name, "kmeans"))    f=float_xmeans;
+	if (0==strcmp(operation_name, "kmedians"))  f=float_xmedians;
+	if (0==strcmp(operation_name, "contrario")) f=acontrario_modes_detector;
+	if (!f) return fprintf(stderr, "unrecognized operation \"%s\"\n",
+				operation_name);
+
+	if (megabytes > 0) {
+		stackreduce(filename_out, VECOH_OUT_PD, v + 2, n, 1, megabytes,
+				vecoh_band, &f);
+		return 0;
+	}
+
+	float *x[n];
+	int w[n], h[n], pd[n];
+	for (int i = 0; i < n; i++)
+		x[i] = iio_read_image_float_vec(v[i+2], w + i, h + i, pd + i);
+	for (int i = 0; i < n; i++) {
+		if (w[i] != *w || h[i] != *h || pd[i] != 1)
+			fail("bad %dth image size\n", i);
+	}
+
+	int out_pd = VECOH_OUT_PD;
+	float (*y) = xmalloc(*w * *h * out_pd * sizeof*y);
+	// if requested, print the computation at the central pixel
+	long verbose = VECOH_VERBOSE() ? *w * (long)*h / 2 : -1;
+	vecoh_band_verbose(&f, y, x, n, *w, *h, verbose);
 	iio_write_image_float_vec(filename_out, y, *w, *h, out_pd);
 	free(y);
 	for (int i = 0; i < n; i++)
@@ -9,6 +9,8 @@
 #include "fail.c"
 #include "xmalloc.c"
 #include "random.c"
+#include "quantiles.c"
+#include "geomedian_core.c"
 
 // y[k] = sum_i x[i][k]
 static void float_sum(float *y, float *xx, int d, int n)
@@ -112,38 +114,96 @@ static void float_max(float *y, float *xx, int d, int n)
 		y[i] = x[midx][i];
 }
 
-static float medscore(float *xx, int idx, int d, int n)
+// squared euclidean distance between the vectors x and y
+static float fdist2(float *x, float *y, int d)
+{
+	float r = 0;
+	for (int k = 0; k < d; k++)
+		r += (x[k] - y[k]) * (x[k] - y[k]);
+	return r;
+}
+
+// sum of the distances from x[idx] to all the vectors
+// (the sum is abandoned as soon as it becomes larger than "bound")
+static float medscore(float *xx, int idx, int d, int n, float bound)
 {
 	float (*x)[d] = (void*)xx;
 	float r = 0;
-	for (int i = 0; i < n; i++)
+	for (int i = 0; i < n && r <= bound; i++)
 		if (i != idx)
-		{
-			float v[d];
-			for (int j = 0; j < d; j++)
-				v[j] = x[idx][j] - x[i][j];
-			r += fnorm(v, d);
-		}
+			r += d == 1 ? fabs(x[idx][0] - x[i][0])
+				: sqrt(fdist2(x[idx], x[i], d));
 	return r;
 }
 
+struct medcandidate { float e; int i; };
+
+static int compare_medcandidates(const void *aa, const void *bb)
+{
+	const struct medcandidate *a = aa, *b = bb;
+	return (a->e > b->e) - (a->e < b->e);
+}
+
 // y[] = x[i][] which is closest to the euclidean median
+//
+// For scalars, this is one of the two central order statistics.  For
+// vectors, the candidates are visited by increasing distance to the
+// componentwise median, so that the best score is found early, and the
+// scores of most of the other candidates are abandoned after a few terms.
+// The result is that of trying all candidates in order.
 static void float_med(float *y, float *xx, int d, int n)
 {
 	float (*x)[d] = (void*)xx;
-	int midx = 0;
-	float misc = medscore(xx, 0, d, n);
-	for (int i = 1; i < n; i++)
+	if (n < 1) {
+		for (int k = 0; k < d; k++)
+			y[k] = NAN;
+		return;
+	}
+	float t[n], c[d];
+	if (d == 1) {
+		for (int i = 0; i < n; i++)
+			t[i] = x[i][0];
+		float m[2] = {quantile_select_spoilable(t, n, (n - 1)/2),
+			quantile_select_spoilable(t, n, n/2)};
+		int midx = -1;
+		float best = INFINITY;
+		for (int i = 0; i < n; i++)
+			if (x[i][0] == m[0] || x[i][0] == m[1]) {
+				float si = medscore(xx, i, 1, n, best);
+				if (si < best) {
+					midx = i;
+					best = si;
+				}
+			}
+		y[0] = x[midx][0];
+		return;
+	}
+	for (int k = 0; k < d; k++)
 	{
-		float si = medscore(xx, i, d, n);
-		if (si < misc) {
+		for (int i = 0; i < n; i++)
+			t[i] = x[i][k];
+		c[k] = quantile_select_spoilable(t, n, n/2);
+	}
+	struct medcandidate o[n];
+	for (int i = 0; i < n; i++)
+	{
+		o[i].e = fdist2(x[i], c, d);
+		o[i].i = i;
+	}
+	qsort(o, n, sizeof*o, compare_medcandidates);
+	int midx = o[0].i;
+	float best = medscore(xx, midx, d, n, INFINITY);
+	for (int k = 1; k < n; k++)
+	{
+		int i = o[k].i;
+		float si = medscore(xx, i, d, n, best);
+		if (si < best || (si == best && i < midx)) {
 			midx = i;
-			misc = si;
+			best = si;
 		}
 	}
-	for (int i = 0; i < d; i++)
-		y[i] = x[midx][i];
-
+	for (int k = 0; k < d; k++)
+		y[k] = x[midx][k];
 }
 
 static float float_mod_1d(float *x, int n)
@@ -181,41 +241,50 @@ static void float_modc(float *y, float *xx, int d, int n)
 }
 
 
-// euclidean distance between the vectors x and y
-static float fdist(float *x, float *y, int n)
-{
-	return n ? hypot(*x - *y, fdist(x + 1, y + 1, n - 1)) : 0;
-}
-
-// euclidean distance between the vectors x and y, regularized around 0
-static float fdiste(float *x, float *y, int n, float e)
-{
-	return n ? hypot(*x - *y, fdiste(x + 1, y + 1, n - 1, e)) : e;
-}
-
 #include "smapa.h"
 SMART_PARAMETER_SILENT(WEISZ_NITER,10)
 
+// the weiszfeld iterations stop when the step is smaller than this
+static float weisz_tolerance = 0;
+
 // y[k] = euclidean median of the vectors x[i][k]
 static void float_weisz(float *y, float *x, int d, int n)
 {
 	float_avg(y, x, d, n);
 	int niter = WEISZ_NITER();
+	float e2 = 1e-5 * 1e-5; // (regularization of the distances around 0)
 	for (int k = 0; k < niter; k++) {
 		float a[d], b = 0;
 		for (int l = 0; l < d; l++)
 			a[l] = 0;
 		for (int i = 0; i < n; i++) {
-			float dxy = fdiste(x + i*d, y, d, 1e-5);
+			float dxy = sqrt(fdist2(x + i*d, y, d) + e2);
 			for (int l = 0; l < d; l++)
 				a[l] += x[i*d + l]/dxy;
 			b += 1/dxy;
 		}
 		for (int l = 0; l < d; l++)
-			y[l] = a[l]/b;
+			a[l] /= b;
+		float step = fdist2(a, y, d);
+		for (int l = 0; l < d; l++)
+			y[l] = a[l];
+		if (!(step > weisz_tolerance * weisz_tolerance))
+			break;
 	}
 }
 
+// y[k] = geometric median of the vectors x[i][k], to convergence
+static void float_gmed(float *y, float *x, int d, int n)
+{
+	double a[n*d + 1], m[d], mem[GEOMEDIAN_WORKSPACE_SIZE(d,n)];
+	struct geomedian_workspace w[1];
+	geomedian_workspace_init(w, d, n, mem);
+	for (int i = 0; i < n*d; i++)
+		a[i] = x[i];
+	geomedian(m, a, d, n, w);
+	for (int k = 0; k < d; k++)
+		y[k] = m[k];
+}
 
 static bool isgood(float *x, int n)
 {
@@ -229,7 +298,7 @@ static char *help_string_name     = "vecov";
 static char *help_string_version  = "vecov 1.0\n\nWritten by eml";
 static char *help_string_oneliner = "combine several vector images into one";
 static char *help_string_usage    = "usage:\n\t"
-"vecov {sum|avg|med|weisz|modc|...} in1 in2 ... {> out|-o out}";
+"vecov {sum|avg|med|weisz|gmed|modc|...} in1 in2 ... {> out|-o out}";
 static char *help_string_long     =
 "Vecov combines several vector-valued images by a pixelwise operation\n"
 "\n"
@@ -238,6 +307,8 @@ static char *help_string_long     =
 "\n"
 "Options:\n"
 " -o file      use a named output file instead of stdout\n"
+" -t tol       stop the weiszfeld iterations at steps smaller than tol\n"
+" -m MB        stream the images by bands of rows that fit in MB megabytes\n"
 "\n"
 "Operations:\n"
 " min          shortest vector in euclidean norm\n"
@@ -246,6 +317,7 @@ static char *help_string_long     =
 " sum          sum of vectors\n"
 " med          medoid of vectors\n"
 " weisz        geometric median (by weszfeld algorithm)\n"
+" gmed         geometric median (weiszfeld-vardi-zhang, to convergence)\n"
 " modc         componentwise mode (with 256 bins of size 1)\n"
 " mul          componentwise product of vectors\n"
 "\n"
@@ -257,11 +329,38 @@ static char *help_string_long     =
 
 #include "help_stuff.c"
 #include "pickopt.c"
+#include "stackreduce.c"
+
+typedef void (*vecov_operation)(float*,float*,int,int);
+
+// apply the operation *e to the bands x[0..n-1] (for "stackreduce")
+static void vecov_band(void *e, float *y, float **x, int n, int pd,
+		int w, int h)
+{
+	vecov_operation f = *(vecov_operation *)e;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int r = 0; r < h; r++)
+	for (int i = r * w; i < (r + 1) * w; i++) {
+		float tmp[n][pd];
+		int ngood = 0;
+		for (int j = 0; j < n; j++)
+			if (isgood(x[j]+i*pd, pd)) {
+				for (int k = 0; k < pd; k++)
+					tmp[ngood][k] = x[j][i*pd+k];
+				ngood += 1;
+			}
+		f(y + i*pd, tmp[0], pd, ngood);
+	}
+}
 
 int main_vecov(int c, char *v[])
 {
 	if (c == 2) if_help_is_requested_print_it_and_exit_the_program(v[1]);
 	char *filename_out = pick_option(&c, &v, "o", "-");
+	weisz_tolerance = atof(pick_option(&c, &v, "t", "0"));
+	double megabytes = atof(pick_option(&c, &v, "m", "0"));
 	if (c < 3) {
 		fprintf(stderr,
 		"usage:\n\t%s {sum|min|max|avg|weisz} [v1 ...] [-o out]\n", *v);
@@ -270,7 +369,7 @@ int main_vecov(int c, char *v[])
 	}
 	int n = c - 2;
 	char *operation_name = v[1];
-	void (*f)(float*,float*,int,int) = NULL;
+	vecov_operation f = NULL;
 	if (0 == strcmp(operation_name, "sum"))   f = float_sum;
 	if (0 == strcmp(operation_name, "mul"))   f = float_mul;
 	if (0 == strcmp(operation_name, "prod"))  f = float_mul;
@@ -283,38 +382,31 @@ int main_vecov(int c, char *v[])
 	if (0 == strcmp(operation_name, "medi"))   f = float_med;
 	if (0 == strcmp(operation_name, "modc"))   f = float_modc;
 	if (0 == strcmp(operation_name, "weisz"))   f = float_weisz;
+	if (0 == strcmp(operation_name, "gmed"))   f = float_gmed;
 	//if (0 == strcmp(operation_name, "medv"))   f = float_medv;
 	//if (0 == strcmp(operation_name, "rnd"))   f = float_pick;
 	//if (0 == strcmp(operation_name, "first")) f = float_first;
 	if (!f) fail("unrecognized operation \"%s\"", operation_name);
+	if (megabytes > 0) {
+		stackreduce(filename_out, 0, v + 2, n, 0, megabytes,
+				vecov_band, &f);
+		return EXIT_SUCCESS;
+	}
 	float *x[n];
 	int w[n], h[n], pd[n];
 	for (int i = 0; i < n; i++)
-		x[i] = iio_read_image_float_vec(v[i+2], w + i, h + i, pd + i);
+		x[i] = iio_map_image_float_vec(v[i+2], w + i, h + i, pd + i);
 	for (int i = 0; i < n; i++) {
 		if (w[i] != *w || h[i] != *h || pd[i] != *pd)
 			fail("%dth image sizes mismatch\n", i);
 	}
 	int out_pd = *pd;
 	float (*y) = xmalloc(*w * *h * out_pd * sizeof*y);
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-	for (int i = 0; i < *w * *h; i++) {
-		float tmp[n][*pd];
-		int ngood = 0;
-		for (int j = 0; j < n; j++)
-			if (isgood(x[j]+i**pd, *pd)) {
-				for (int k = 0; k < *pd; k++)
-					tmp[ngood][k] = x[j][i**pd+k];
-				ngood += 1;
-			}
-		f(y + i**pd, tmp[0], *pd, ngood);
-	}
+	vecov_band(&f, y, x, n, *pd, *w, *h);
 	iio_write_image_float_vec(filename_out, y, *w, *h, *pd);
 	free(y);
 	for (int i = 0; i < n; i++)
-		free(x[i]);
+		iio_free(x[i]);
 	return EXIT_SUCCESS;
 }
 
@@ -22,6 +22,7 @@
 #include "drawsegment.c"
 #include "colorcoordsf.c"
 #include "marching_squares.c"
+#include "fastlic.c"
 
 static void viewflow_pd(uint8_t (**y)[3], float (**x)[2], int w, int h, float m)
 {
@@ -43,32 +44,110 @@ static void viewflow_pd(uint8_t (**y)[3], float (**x)[2], int w, int h, float m)
 	}
 }
 
+// color lookup tables {{{1
+
+// The colors of the palettes depend only on the vector, normalized by the
+// saturation scale.  They are sampled on a grid of (n+1)x(n+1) vectors that
+// covers the square [-1,1]^2, and the color of each pixel is the bilinear
+// interpolation of the four nearest samples.  The vectors outside of the
+// unit disk have the color of their direction on the unit circle (the
+// palettes are saturated there), so that they are looked up at that point.
+// VIEWFLOW_LUT=0 computes the exact colors of each pixel, otherwise it is the
+// size n of the grid.
+
+SMART_PARAMETER_SILENT(VIEWFLOW_LUT,512)
+
+// build the table of the colors f(u,v), for u and v in [-1,1]
+static float (*flowlut_build(int n, void (*f)(float*,float,float)))[3]
+{
+	float (*t)[3] = xmalloc((n + 1) * (n + 1) * sizeof*t);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (int j = 0; j <= n; j++)
+	for (int i = 0; i <= n; i++)
+		f(t[j*(n+1)+i], -1 + 2.0*i/n, -1 + 2.0*j/n);
+	return t;
+}
+
+// interpolated color of the vector (u,v)
+static void flowlut_get(float rgb[3], float (*t)[3], int n, float u, float v)
+{
+	double r2 = u * (double)u + v * (double)v;
+	if (r2 > 1) {
+		double s = 1 / sqrt(r2);
+		u *= s;
+		v *= s;
+	}
+	float x = (u + 1) * n / 2, y = (v + 1) * n / 2;
+	int i = x, j = y;
+	if (i > n - 1) i = n - 1;
+	if (j > n - 1) j = n - 1;
+	if (i < 0) i = 0;
+	if (j < 0) j = 0;
+	float a = x - i, b = y - j;
+	float *p = t[j*(n+1)+i], *q = t[(j+1)*(n+1)+i];
+	FORL(3)
+		rgb[l] = (1-b) * ((1-a) * p[l] + a * p[l+3])
+			+ b * ((1-a) * q[l] + a * q[l+3]);
+}
+
+// flat palette {{{1
+
+// color of a vector of normalized length r and angle atan2(v1,-v0)
+static void flat_color(float rgb[3], double r, double a)
+{
+	a = (a+M_PI)*(180/M_PI);
+	a = fmod(a, 360);
+	float hsv[3];
+	hsv[0] = a;
+	hsv[1] = r;
+	hsv[2] = r;
+	hsv_to_rgb_floats(rgb, hsv);
+}
+
+static void flat_color_uv(float rgb[3], float u, float v)
+{
+	double r = hypot(u, v);
+	flat_color(rgb, r>1 ? 1 : r, atan2(v, -u));
+}
+
 static void viewflow_flat(uint8_t *py, float *px, int w, int h, float m)
 {
 	float (*x)[w][2] = (void*)px;
 	uint8_t (*y)[w][3] = (void*)py;
+	int n = VIEWFLOW_LUT();
+	float (*t)[3] = n > 0 ? flowlut_build(n, flat_color_uv) : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
 	FORJ(h) FORI(w) {
 		float *v = x[j][i];
-		double r = hypot(v[0], v[1]);
-		if (r > 1e8 || !isfinite(r)) {
-			FORL(3) y[j][i][l] = 255;
-			continue;
+		float rgb[3];
+		if (t) {
+			double r2 = v[0] * (double)v[0] + v[1] * (double)v[1];
+			if (!(r2 <= 1e16)) { // (also the NANs)
+				FORL(3) y[j][i][l] = 255;
+				continue;
+			}
+			flowlut_get(rgb, t, n, v[0]/m, v[1]/m);
+		} else {
+			double r = hypot(v[0], v[1]);
+			if (r > 1e8 || !isfinite(r)) {
+				FORL(3) y[j][i][l] = 255;
+				continue;
+			}
+			flat_color(rgb, r>m ? 1 : r/m, atan2(v[1], -v[0]));
 		}
-		r = r>m ? 1 : r/m;
-		double a = atan2(v[1], -v[0]);
-		a = (a+M_PI)*(180/M_PI);
-		a = fmod(a, 360);
-		float hsv[3], rgb[3];
-		hsv[0] = a;
-		hsv[1] = r;
-		hsv[2] = r;
-		hsv_to_rgb_floats(rgb, hsv);
 		FORL(3)
 			y[j][i][l] = 255*rgb[l];
 
 	}
+	free(t);
 }
 
+// middlebury palette {{{1
+
 
 int middlebury_ncols = 0;
 #define MIDDLEBURY_MAXCOLS 60
@@ -108,11 +187,10 @@ void middlebury_makecolorwheel(void)
     for (i = 0; i < MR; i++) middlebury_setcols(255, 0, 255-255*i/MR, k++);
 }
 
-void middlebury_computeColor(float fx, float fy, unsigned char *pix)
+// colors of the wheel, in the order of the output pixels (the vectors out of
+// range have the color of the unit circle, they are darkened by the caller)
+void middlebury_wheel(float *pix, float fx, float fy)
 {
-    if (middlebury_ncols == 0)
-	middlebury_makecolorwheel();
-
     float rad = sqrt(fx * fx + fy * fy);
     float a = atan2(-fy, -fx) / M_PI;
     float fk = (a + 1.0) / 2.0 * (middlebury_ncols-1);
@@ -126,12 +204,22 @@ void middlebury_computeColor(float fx, float fy, unsigned char *pix)
 	float col = (1 - f) * col0 + f * col1;
 	if (rad <= 1)
 	    col = 1 - rad * (1 - col); // increase saturation with radius
-	else
-	    col *= .75; // out of range
-	pix[2 - b] = (int)(255.0 * col);
+	pix[2 - b] = col;
     }
 }
 
+void middlebury_computeColor(float fx, float fy, unsigned char *pix)
+{
+    if (middlebury_ncols == 0)
+	middlebury_makecolorwheel();
+
+    float col[3];
+    middlebury_wheel(col, fx, fy);
+    bool out = sqrt(fx * fx + fy * fy) > 1;
+    for (int b = 0; b < 3; b++)
+	pix[b] = (int)(255.0 * (out ? col[b] * .75f : col[b])); // out of range
+}
+
 
 SMART_PARAMETER_SILENT(MRANGE,0)
 
@@ -148,6 +236,9 @@ static void viewflow_middlebury(uint8_t *py, float *px, int w, int h)
 	float range = MRANGE();
 	if (!isfinite(range)) {
 		range = -1;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(max:range)
+#endif
 		FORJ(h) FORI(w) {
 			float *v = x[j][i];
 			if (middlebury_toolarge(v))
@@ -158,20 +249,43 @@ static void viewflow_middlebury(uint8_t *py, float *px, int w, int h)
 		}
 	}
 	fprintf(stderr, "range = %g\n", range);
+	if (middlebury_ncols == 0)
+		middlebury_makecolorwheel();
+	int n = VIEWFLOW_LUT();
+	float (*t)[3] = n > 0 ? flowlut_build(n, middlebury_wheel) : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
 	FORJ(h) FORI(w) {
 		float *v = x[j][i];
 		unsigned char pix[3] = {0, 0, 0};
-		if (!middlebury_toolarge(v))
+		float fx = -v[1]/range, fy = -v[0]/range, col[3];
+		// (the wheel jumps along the ray of angle pi, where the
+		// direction is not interpolated; this ray is computed exactly)
+		bool seam = fx > 0 && fabs(fy) < 2.0 * fmax(1, fx) / n;
+		if (!middlebury_toolarge(v) && t && !seam) {
+			flowlut_get(col, t, n, fx, fy);
+			bool out = sqrt(fx * fx + fy * fy) > 1;
+			FORL(3)
+				pix[l] = (int)(255.0 * (out ? col[l] * .75f
+							: col[l]));
+		} else if (!middlebury_toolarge(v))
 			middlebury_computeColor(-v[1]/range, -v[0]/range, pix);
 		FORL(3)
 			y[j][i][l] = pix[l];
 
 	}
+	free(t);
 }
 
+// overlays {{{1
+
 static float pick_scale(float (*x)[2], int n)
 {
 	float range = -1;
+#ifdef _OPENMP
+#pragma omp parallel for reduction(max:range)
+#endif
 	FORI(n) {
 		if (middlebury_toolarge(x[i]))
 			continue;
@@ -214,6 +328,22 @@ static void overlay_level_line_in_black(uint8_t (**y)[3],
 }
 
 SMART_PARAMETER_SILENT(NOVERLINES,51)
+SMART_PARAMETER_SILENT(VIEWFLOW_LIC,0)
+
+// modulate the colors by a LIC texture of streamlines of length len
+static void overlic(uint8_t (**y)[3], float (**x)[2], int w, int h, float len)
+{
+	float *t = xmalloc(w * h * sizeof*t);
+	int L = lrint(len / (2 * FASTLIC_STEP));
+	fast_line_integral_convolution(t, x[0][0], w, h, L, 4 * L, 0);
+	fastlic_stretch(t, w * h, 0.25);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	FORJ(h) FORI(w) FORL(3)
+		y[j][i][l] = fmin(255, 2 * t[j*w+i] * y[j][i][l]);
+	free(t);
+}
 
 static void *matrix_build(int w, int h, size_t n)
 {
@@ -230,6 +360,9 @@ static void overlines(uint8_t (**y)[3], float (**x)[2], int w, int h, float s)
 {
 	assert(s > 0);
 	float **scalar = matrix_build(w, h, sizeof**scalar);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
 	FORJ(h) FORI(w)
 		scalar[j][i] = hypot(x[j][i][0], x[j][i][1]);
 
@@ -238,6 +371,8 @@ static void overlines(uint8_t (**y)[3], float (**x)[2], int w, int h, float s)
 		overlay_level_line_in_black(y, scalar, w, h, s*i);
 }
 
+// main {{{1
+
 static char *help_string_name     = "viewflow";
 static char *help_string_version  = "viewflow 1.0\n\nWritten by eml";
 static char *help_string_oneliner = "represent a vector field using a color code";
@@ -260,6 +395,8 @@ static char *help_string_long     =
 "Environment:\n"
 " MRANGE\tMaximum range for Middlebury palette (default 0)\n"
 " NOVERLINES\tTotal number of level lines to draw (default 50)\n"
+" VIEWFLOW_LIC\tStreamline length of a LIC texture over the colors (default 0)\n"
+" VIEWFLOW_LUT\tSize of the color tables, or 0 for exact colors (default 512)\n"
 "Options:\n"
 " -h\t\tdisplay short help message\n"
 " --help\t\tdisplay longer help message\n"
@@ -303,6 +440,8 @@ int main_viewflow(int c, char *v[])
 			overlines(view, flow, w, h, -satscale);
 	} else
 		viewflow_middlebury(view[0][0], flow[0][0], w, h);
+	if (VIEWFLOW_LIC() > 0)
+		overlic(view, flow, w, h, VIEWFLOW_LIC());
 
 	iio_write_image_uint8_vec(outfile, view[0][0], w, h, 3);
 
@@ -0,0 +1,185 @@
+#ifndef _WARPCORE_C
+#define _WARPCORE_C
+
+// warping core: y(i,j) = x(q(i,j)), for a map q of positions of the input
+//
+// The output is computed by tiles, in parallel.  The positions of each row
+// of a tile are produced at once (from a flow field, or by a callback), and
+// then interpolated.  The taps of the positions far from the boundary are
+// read directly, without bounds checks; those near (or outside) the
+// boundary are read through a "getsample_operator", that sets the
+// extrapolation.  The kernels are specialized for 1 to 4 channels.
+
+#include <math.h>
+#include <stdbool.h>
+
+#include "getpixel.c"
+#include "bicubic.c"
+#include "pd_specialize.h"
+
+#define WARPCORE_NEAREST  0
+#define WARPCORE_BILINEAR 2
+#define WARPCORE_BICUBIC  3
+
+#define WARPCORE_TILE 64
+
+// fill q[0..i1-i0-1] with the positions of the pixels (i0..i1-1, j)
+typedef void (*warpcore_positions_t)(float (*q)[2], int i0, int i1, int j,
+		void *e);
+
+static float warpcore_bilinear_cell(float a, float b, float c, float d,
+							float x, float y)
+{
+	float r = 0;
+	r += a * (1-x) * (1-y);
+	r += b * ( x ) * (1-y);
+	r += c * (1-x) * ( y );
+	r += d * ( x ) * ( y );
+	return r;
+}
+
+static inline void warpcore_nearest_row(float *y, float (*q)[2], int n,
+		float *x, int w, int h, int pd, getsample_operator ext)
+{
+	for (int k = 0; k < n; k++)
+	{
+		int ip = round(q[k][0]);
+		int iq = round(q[k][1]);
+		float *o = y + k * pd;
+		if (ip >= 0 && iq >= 0 && ip < w && iq < h) {
+			float *a = x + (iq * w + ip) * pd;
+			for (int l = 0; l < pd; l++)
+				o[l] = a[l];
+		} else
+			for (int l = 0; l < pd; l++)
+				o[l] = ext(x, w, h, pd, ip, iq, l);
+	}
+}
+
+static inline void warpcore_bilinear_row(float *y, float (*q)[2], int n,
+		float *x, int w, int h, int pd, getsample_operator ext)
+{
+	for (int k = 0; k < n; k++)
+	{
+		float p = q[k][0], r = q[k][1];
+		int ip = floor(p);
+		int iq = floor(r);
+		float u = p - ip, v = r - iq, *o = y + k * pd;
+		if (ip >= 0 && iq >= 0 && ip + 1 < w && iq + 1 < h) {
+			float *a = x + (iq * w + ip) * pd, *c = a + w * pd;
+			for (int l = 0; l < pd; l++)
+				o[l] = warpcore_bilinear_cell(a[l], a[l+pd],
+						c[l], c[l+pd], u, v);
+		} else
+			for (int l = 0; l < pd; l++)
+				o[l] = warpcore_bilinear_cell(
+					ext(x, w, h, pd, ip  , iq  , l),
+					ext(x, w, h, pd, ip+1, iq  , l),
+					ext(x, w, h, pd, ip  , iq+1, l),
+					ext(x, w, h, pd, ip+1, iq+1, l), u, v);
+	}
+}
+
+// (the same as "bicubic_interpolation_boundary2")
+static inline void warpcore_bicubic_row(float *y, float (*q)[2], int n,
+		float *x, int w, int h, int pd, getsample_operator ext)
+{
+	for (int k = 0; k < n; k++)
+	{
+		float p = q[k][0] - 1, r = q[k][1] - 1;
+		int ip = floor(p);
+		int iq = floor(r);
+		float *o = y + k * pd;
+		bool in = ip >= 0 && iq >= 0 && ip + 3 < w && iq + 3 < h;
+		for (int l = 0; l < pd; l++)
+		{
+			float c[4][4];
+			if (in) {
+				float *a = x + (iq * w + ip) * pd + l;
+				for (int j = 0; j < 4; j++)
+				for (int i = 0; i < 4; i++)
+					c[i][j] = a[(j * w + i) * pd];
+			} else
+				for (int j = 0; j < 4; j++)
+				for (int i = 0; i < 4; i++)
+					c[i][j] = ext(x, w, h, pd, ip+i, iq+j, l);
+			o[l] = bicubic_interpolation_cell(c, p - ip, r - iq);
+		}
+	}
+}
+
+PD_KERNEL void warpcore_row_pd(float *y, float (*q)[2], int n,
+		float *x, int w, int h, int pd, int method,
+		getsample_operator ext)
+{
+	if (method == WARPCORE_NEAREST)
+		warpcore_nearest_row(y, q, n, x, w, h, pd, ext);
+	else if (method == WARPCORE_BILINEAR)
+		warpcore_bilinear_row(y, q, n, x, w, h, pd, ext);
+	else
+		warpcore_bicubic_row(y, q, n, x, w, h, pd, ext);
+}
+
+// interpolate x at the n positions q, and store the results at y
+static void warpcore_row(float *y, float (*q)[2], int n,
+		float *x, int w, int h, int pd, int method,
+		getsample_operator ext)
+{
+	PD_SPECIALIZE(pd, warpcore_row_pd(y, q, n, x, w, h, pd, method, ext));
+}
+
+// y(i,j) = x(q(i,j)), where the positions q are given by the function f
+// (the output y has size ow x oh, the input x has size w x h, both have pd
+// channels, and ext is the extrapolation, e.g., getsample_nan)
+static void warpcore(float *y, int ow, int oh, float *x, int w, int h, int pd,
+		int method, getsample_operator ext,
+		warpcore_positions_t f, void *e)
+{
+	int nx = (ow + WARPCORE_TILE - 1) / WARPCORE_TILE;
+	int ny = (oh + WARPCORE_TILE - 1) / WARPCORE_TILE;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+	for (int t = 0; t < nx * ny; t++)
+	{
+		int i0 = WARPCORE_TILE * (t % nx);
+		int j0 = WARPCORE_TILE * (t / nx);
+		int i1 = i0 + WARPCORE_TILE < ow ? i0 + WARPCORE_TILE : ow;
+		int j1 = j0 + WARPCORE_TILE < oh ? j0 + WARPCORE_TILE : oh;
+		float q[WARPCORE_TILE][2];
+		for (int j = j0; j < j1; j++)
+		{
+			f(q, i0, i1, j, e);
+			warpcore_row(y + (j * (long)ow + i0) * pd, q, i1 - i0,
+					x, w, h, pd, method, ext);
+		}
+	}
+}
+
+// positions given by a flow field (for the function "warpcore_flow")
+struct warpcore_flow_field { float *f; int w, relative; };
+
+static void warpcore_flow_positions(float (*q)[2], int i0, int i1, int j,
+		void *e)
+{
+	struct warpcore_flow_field *t = e;
+	float *f = t->f + 2 * (j * (long)t->w + i0);
+	for (int i = i0; i < i1; i++, f += 2)
+	{
+		q[i-i0][0] = f[0] + (t->relative ? i : 0);
+		q[i-i0][1] = f[1] + (t->relative ? j : 0);
+	}
+}
+
+// y(i,j) = x((i,j) + f(i,j)), or x(f(i,j)) if not relative
+// (the flow f has size ow x oh, like the output)
+static void warpcore_flow(float *y, int ow, int oh, float *x, int w, int h,
+		int pd, float *f, bool relative, int method,
+		getsample_operator ext)
+{
+	struct warpcore_flow_field t = {f, ow, relative};
+	warpcore(y, ow, oh, x, w, h, pd, method, ext,
+			warpcore_flow_positions, &t);
+}
+
+#endif//_WARPCORE_C
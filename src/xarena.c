@@ -0,0 +1,171 @@
+#ifndef _XARENA_C
+#define _XARENA_C
+
+// arena of temporary memory
+//
+// An arena is a stack of memory blocks, from which the allocations are
+// taken consecutively, and released all at once (to a mark, or entirely).
+// The blocks are mapped with huge pages when available, and they are kept
+// when the arena is reset, so that the temporaries of a loop are allocated
+// and touched only in its first iteration.  When an arena has grown to
+// several blocks, resetting it coalesces them into a single block.
+//
+// Typical usage:
+//
+// 	struct xarena a[1];
+// 	xarena_init(a, 0);
+// 	for (...) {
+// 		float *t = xarena_alloc(a, n * sizeof*t);
+// 		...
+// 		xarena_reset(a);
+// 	}
+// 	xarena_free(a);
+//
+// The blocks are counted by the statistics of xmalloc (IMSCRIPT_MEMSTATS).
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "xmalloc.c"
+
+#ifdef __unix__
+#include <sys/mman.h>
+#endif
+
+#define XARENA_ALIGN 64            // alignment of the allocations
+#define XARENA_PAGE (2*1024*1024) // granularity of the blocks
+
+struct xarena_block {
+	struct xarena_block *prev;
+	size_t size; // including this header
+	size_t used;
+	int mapped;
+};
+
+struct xarena {
+	struct xarena_block *top;
+	size_t peak; // largest total size of the blocks
+};
+
+struct xarena_mark { struct xarena_block *b; size_t used; };
+
+static struct xarena_block *xarena_block_new(size_t size)
+{
+	size = (size + XARENA_PAGE - 1) / XARENA_PAGE * XARENA_PAGE;
+	struct xarena_block *b = NULL;
+	int mapped = 0;
+#if defined(MAP_ANONYMOUS)
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED) {
+		b = p;
+		mapped = 1;
+#ifdef MADV_HUGEPAGE
+		madvise(p, size, MADV_HUGEPAGE);
+#endif
+		if (xmalloc_stats_enabled())
+			xmalloc_stats_add((void*)xarena_block_new, size);
+	}
+#endif
+	if (!b)
+		b = xmalloc(size);
+	b->prev = NULL;
+	b->size = size;
+	b->used = (sizeof*b + XARENA_ALIGN - 1) / XARENA_ALIGN * XARENA_ALIGN;
+	b->mapped = mapped;
+	return b;
+}
+
+static void xarena_block_free(struct xarena_block *b)
+{
+#if defined(MAP_ANONYMOUS)
+	if (b->mapped) {
+		munmap(b, b->size);
+		return;
+	}
+#endif
+	free(b);
+}
+
+// total size of the blocks of the arena
+static size_t xarena_size(struct xarena *a)
+{
+	size_t r = 0;
+	for (struct xarena_block *b = a->top; b; b = b->prev)
+		r += b->size;
+	return r;
+}
+
+// start an empty arena (with a first block of "size" bytes, if not zero)
+static void xarena_init(struct xarena *a, size_t size)
+{
+	a->top = size ? xarena_block_new(size) : NULL;
+	a->peak = size ? a->top->size : 0;
+}
+
+// n bytes from the arena, aligned to XARENA_ALIGN bytes
+static void *xarena_alloc(struct xarena *a, size_t n)
+{
+	size_t m = (n + XARENA_ALIGN - 1) / XARENA_ALIGN * XARENA_ALIGN;
+	struct xarena_block *b = a->top;
+	if (!b || b->size - b->used < m)
+	{
+		size_t s = m + XARENA_ALIGN + sizeof*b;
+		if (b && s < 2 * b->size) s = 2 * b->size;
+		b = xarena_block_new(s);
+		b->prev = a->top;
+		a->top = b;
+		size_t t = xarena_size(a);
+		if (a->peak < t) a->peak = t;
+	}
+	void *r = b->used + (char *)b;
+	b->used += m;
+	return r;
+}
+
+// current position of the arena (to release the allocations done after it)
+static struct xarena_mark xarena_mark(struct xarena *a)
+{
+	struct xarena_mark r = { a->top, a->top ? a->top->used : 0 };
+	return r;
+}
+
+// release the allocations done after the mark m
+static void xarena_release(struct xarena *a, struct xarena_mark m)
+{
+	while (a->top && a->top != m.b)
+	{
+		struct xarena_block *b = a->top;
+		a->top = b->prev;
+		xarena_block_free(b);
+	}
+	if (a->top)
+		a->top->used = m.used;
+}
+
+// release all the allocations, but keep the memory
+static void xarena_reset(struct xarena *a)
+{
+	if (!a->top) return;
+	if (a->top->prev) { // several blocks, replace them by a single one
+		while (a->top)
+		{
+			struct xarena_block *b = a->top;
+			a->top = b->prev;
+			xarena_block_free(b);
+		}
+		a->top = xarena_block_new(a->peak);
+		return;
+	}
+	a->top->used = (sizeof*a->top + XARENA_ALIGN - 1)
+		/ XARENA_ALIGN * XARENA_ALIGN;
+}
+
+// give back the memory of the arena
+static void xarena_free(struct xarena *a)
+{
+	xarena_release(a, (struct xarena_mark){NULL, 0});
+	a->peak = 0;
+}
+
+#endif//_XARENA_C
@@ -5,6 +5,130 @@
 
 #include "fail.c"
 
+// allocation statistics
+//
+// If the environment variable IMSCRIPT_MEMSTATS is set, the allocations of
+// xmalloc and xrealloc are counted, by call site, and a summary is printed
+// at exit: number of allocations, bytes requested, largest allocation, peak
+// resident memory of the process, and the call sites that requested most
+// bytes.  (The sites are return addresses; add -rdynamic to get the names
+// of the functions, or give the offsets to addr2line.)
+//
+// Otherwise, the cost is one test per allocation.
+
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+
+#define XMALLOC_STATS_SITES 128
+#define XMALLOC_STATS_TOP 10
+
+struct xmalloc_stats_site { void *p; long n; double bytes; };
+
+static struct xmalloc_stats {
+	int on; // 0, 1, or -1 if not yet known
+	long n;
+	double bytes, largest;
+	struct xmalloc_stats_site site[XMALLOC_STATS_SITES];
+	struct xmalloc_stats_site other; // when the table is full
+} xmalloc_stats = { .on = -1 };
+
+static int xmalloc_stats_compare(const void *aa, const void *bb)
+{
+	const struct xmalloc_stats_site *a = aa, *b = bb;
+	return (a->bytes < b->bytes) - (a->bytes > b->bytes);
+}
+
+static void xmalloc_stats_report(void)
+{
+	struct xmalloc_stats *s = &xmalloc_stats;
+	struct rusage u;
+	double rss = getrusage(RUSAGE_SELF, &u) ? 0 : u.ru_maxrss / 1024.0;
+	double mb = 0x100000;
+	fprintf(stderr, "IMSCRIPT_MEMSTATS: %ld allocations, %gMB requested, "
+			"largest %gMB, peak resident %gMB\n",
+			s->n, s->bytes / mb, s->largest / mb, rss);
+
+	struct xmalloc_stats_site t[XMALLOC_STATS_SITES];
+	int n = 0;
+	for (int i = 0; i < XMALLOC_STATS_SITES; i++)
+		if (s->site[i].n)
+			t[n++] = s->site[i];
+	qsort(t, n, sizeof*t, xmalloc_stats_compare);
+	if (n > XMALLOC_STATS_TOP) n = XMALLOC_STATS_TOP;
+	void *p[XMALLOC_STATS_TOP];
+	for (int i = 0; i < n; i++)
+		p[i] = t[i].p;
+	char **name = NULL;
+#ifdef __GLIBC__
+	name = n ? backtrace_symbols(p, n) : NULL;
+#endif
+	for (int i = 0; i < n; i++)
+		if (!p[i])
+			fprintf(stderr, "\t%gMB\t%ld\t(xrealloc)\n",
+					t[i].bytes / mb, t[i].n);
+		else if (name)
+			fprintf(stderr, "\t%gMB\t%ld\t%s\n", t[i].bytes / mb,
+					t[i].n, name[i]);
+		else
+			fprintf(stderr, "\t%gMB\t%ld\t%p\n", t[i].bytes / mb,
+					t[i].n, p[i]);
+	if (s->other.n)
+		fprintf(stderr, "\t%gMB\t%ld\t(other sites)\n",
+				s->other.bytes / mb, s->other.n);
+	free(name);
+}
+
+static int xmalloc_stats_enabled(void)
+{
+	if (xmalloc_stats.on < 0)
+	{
+#ifdef _OPENMP
+#pragma omp critical(xmalloc_stats)
+#endif
+		if (xmalloc_stats.on < 0) {
+			xmalloc_stats.on = NULL != getenv("IMSCRIPT_MEMSTATS");
+			if (xmalloc_stats.on)
+				atexit(xmalloc_stats_report);
+		}
+	}
+	return xmalloc_stats.on;
+}
+
+// count an allocation of "size" bytes requested from the call site "p"
+static void xmalloc_stats_add(void *p, size_t size)
+{
+	struct xmalloc_stats *s = &xmalloc_stats;
+#ifdef _OPENMP
+#pragma omp critical(xmalloc_stats)
+#endif
+	{
+		s->n += 1;
+		s->bytes += size;
+		if (s->largest < size) s->largest = size;
+		struct xmalloc_stats_site *t = &s->other;
+		unsigned long k = (unsigned long)p;
+		k = (k ^ (k >> 7) ^ (k >> 17)) % XMALLOC_STATS_SITES;
+		for (int i = 0; i < XMALLOC_STATS_SITES; i++)
+		{
+			struct xmalloc_stats_site *q = s->site
+				+ (k + i) % XMALLOC_STATS_SITES;
+			if (q->p == p || !q->n) {
+				t = q;
+				break;
+			}
+		}
+		t->p = p;
+		t->n += 1;
+		t->bytes += size;
+	}
+}
+
+#ifdef __GNUC__
+// (not inlined, so that the return address is the call site)
+__attribute__((noinline))
+#endif
 static void *xmalloc(size_t size)
 {
 #ifndef NDEBUG
@@ -17,6 +141,13 @@ static void *xmalloc(size_t size)
 #endif
 	if (size == 0)
 		fail("xmalloc: zero size");
+#ifdef __GNUC__
+	if (xmalloc_stats_enabled())
+		xmalloc_stats_add(__builtin_return_address(0), size);
+#else
+	if (xmalloc_stats_enabled())
+		xmalloc_stats_add(NULL, size);
+#endif
 	void *new = malloc(size);
 	if (!new)
 	{
@@ -31,6 +162,8 @@ static void *xmalloc(size_t size)
 inline // to avoid unused warnings
 static void *xrealloc(void *p, size_t s)
 {
+	if (xmalloc_stats_enabled())
+		xmalloc_stats_add(NULL, s);
 	void *r = realloc(p, s);
 	if (!r) fail("realloc failed");
 	return r;